@@ -108,6 +108,7 @@ struct igb_adapter;
 #ifdef ENABLE_DNA
 #define DNA_IGB_DEFAULT_RXD             2048
 #define DNA_IGB_DEFAULT_TXD             2048
+#define DNA_IGB_MAX_QUEUES              IGB_MAX_RX_QUEUES
 #endif
 
 #define IGB_MIN_ITR_USECS                 10 /* 100k irq/sec */
@@ -594,6 +595,7 @@ struct igb_vmdq_adapter {
 #define IGB_FLAG_QUEUE_PAIRS       (1 << 5)
 #define IGB_FLAG_EEE               (1 << 6)
 #define IGB_FLAG_DMAC              (1 << 7)
+#define IGB_FLAG_RSS_SYMMETRIC     (1 << 8)
 
 #define IGB_MIN_TXPBSIZE           20408
 #define IGB_TX_BUF_4096            4096
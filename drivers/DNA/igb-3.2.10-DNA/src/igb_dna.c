@@ -42,6 +42,12 @@ static unsigned int num_tx_slots = DNA_IGB_DEFAULT_TXD;
 module_param(num_tx_slots, uint, 0644);
 MODULE_PARM_DESC(num_tx_slots, "Specify the number of TX slots. Default: 2048");
 
+static unsigned int rx_slots_per_queue[DNA_IGB_MAX_QUEUES] = { 0 };
+module_param_array(rx_slots_per_queue, uint, NULL, 0444);
+MODULE_PARM_DESC(rx_slots_per_queue,
+                 "Comma separated list of RX slots per queue, the same on all the adapters "
+		 "(0 = num_rx_slots). Max: 4096");
+
 /* Forward */
 static void igb_irq_enable(struct igb_adapter *adapter);
 static void igb_irq_disable(struct igb_adapter *adapter);
@@ -74,17 +80,43 @@ void dna_check_enable_adapter(struct igb_adapter *adapter) {
 
 /* ****************************** */
 
+static u16 dna_rx_ring_count(struct igb_adapter *adapter, int queue_index) {
+  u32 count;
+
+  if((queue_index >= DNA_IGB_MAX_QUEUES) || (rx_slots_per_queue[queue_index] == 0))
+    return(adapter->rx_ring_count);
+
+  count = max(rx_slots_per_queue[queue_index], (u32)IGB_MIN_RXD);
+  count = min(count, (u32)IGB_MAX_RXD);
+  return(ALIGN(count, REQ_RX_DESCRIPTOR_MULTIPLE));
+}
+
+/* ****************************** */
+
+/*
+  With MSI-X each RSS queue has its own vector: only that one is
+  (un)masked, so that a channel waiting for packets does not wake up
+  the others. MSI/legacy: one interrupt for all the queues.
+*/
 void igb_irq_enable_queues(struct igb_adapter *adapter, u32 queue_id) {
-  /* TODO - handle queue_id */
-  // void igb_ring_irq_enable(struct igb_q_vector *q_vector)
-  igb_irq_enable(adapter);
+  if(adapter->msix_entries && (queue_id < adapter->num_rx_queues)) {
+    struct igb_q_vector *q_vector = adapter->rx_ring[queue_id]->q_vector;
+
+    E1000_WRITE_REG(&adapter->hw, E1000_EIMS, q_vector->eims_value);
+  } else
+    igb_irq_enable(adapter);
 }
 
 /* ****************************** */
 
 void igb_irq_disable_queues(struct igb_adapter *adapter, u32 queue_id) {
-  /* TODO */
-  igb_irq_disable(adapter);
+  if(adapter->msix_entries && (queue_id < adapter->num_rx_queues)) {
+    struct igb_q_vector *q_vector = adapter->rx_ring[queue_id]->q_vector;
+
+    E1000_WRITE_REG(&adapter->hw, E1000_EIMC, q_vector->eims_value);
+    E1000_WRITE_FLUSH(&adapter->hw);
+  } else
+    igb_irq_disable(adapter);
 }
 
 /* ****************************** */
@@ -296,7 +328,7 @@ void notify_function_ptr(void *data, u_int8_t device_in_use) {
       printk("[DNA] %s(): %s@%d is IN use\n", __FUNCTION__,
 	     rx_ring->netdev->name, rx_ring->queue_index);
 
-    igb_irq_disable_queues(adapter, ((u64)1 << rx_ring->queue_index));
+    igb_irq_disable_queues(adapter, rx_ring->queue_index);
   } else {
     /* We're done using this device */
     
@@ -392,7 +424,7 @@ int wait_packet_function_ptr(void *data, int mode)
   } else {
     /* Disable interrupts */
 
-    igb_irq_disable_queues(adapter, ((u64)1 << rx_ring->queue_index));
+    igb_irq_disable_queues(adapter, rx_ring->queue_index);
 
     rx_ring->dna.rx_tx.rx.interrupt_enabled = 0;
 
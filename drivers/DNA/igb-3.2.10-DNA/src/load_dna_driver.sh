@@ -24,6 +24,12 @@ insmod ./igb.ko
 # Enable 8 queues (you need 8 or more CPU cores)
 #insmod ./igb.ko RSS=8,8,8,8
 
+# Enable 8 queues, both directions of a flow on the same queue
+#insmod ./igb.ko RSS=8,8,8,8 SymmetricRSS=1,1,1,1
+
+# Same, with larger rings on the first two queues
+#insmod ./igb.ko RSS=8,8,8,8 SymmetricRSS=1,1,1,1 rx_slots_per_queue=4096,4096
+
 sleep 1
 
 killall irqbalance 
@@ -93,6 +93,9 @@
 #define IXGBE_MAX_TXD                     32768
 #define DNA_IXGBE_DEFAULT_RXD              8192
 #define DNA_IXGBE_DEFAULT_TXD              8192
+#define DNA_IXGBE_MAX_QUEUES               IXGBE_MAX_FDIR_INDICES /* rx_slots_per_queue entries */
+#define DNA_MAX_HUGE_CHUNK_ORDER           9 /* 2 MB chunks with 4 KB pages */
+#define DNA_IXGBE_MAX_HDR_SPLIT_LEN     1024 /* SRRCTL.BSIZEHEADER limit */
 #endif
 
 /* flow control */
@@ -389,9 +392,17 @@ struct ixgbe_ring {
 	wait_queue_head_t   packet_waitqueue;
 	u_int8_t            interrupt_received;
 	u_int8_t            interrupt_enabled;
+
+	/* Last re-arm, see dna_ixgbe_adapt_itr() */
+	unsigned long       last_arm_jiffies;
+	u16                 last_arm_idx;
 	
 	/* Pointer to the slots where packets will be hosted */
 	unsigned long       packet_memory[DNA_MAX_NUM_CHUNKS];
+
+	/* Header split: payloads land here and are never read */
+	void                *payload_sink;
+	dma_addr_t          payload_sink_dma;
       } rx;
       
       struct {
@@ -639,6 +650,7 @@ struct ixgbe_adapter {
 #define IXGBE_FLAG2_FDIR_REQUIRES_REINIT         (u32)(1 << 9)
 #define IXGBE_FLAG2_RSS_FIELD_IPV4_UDP           (u32)(1 << 10)
 #define IXGBE_FLAG2_RSS_FIELD_IPV6_UDP           (u32)(1 << 11)
+#define IXGBE_FLAG2_RSS_SYMMETRIC                (u32)(1 << 12)
 
 	/* Tx fast path data */
 	int num_tx_queues;
@@ -45,6 +45,23 @@ static unsigned int num_tx_slots = DNA_IXGBE_DEFAULT_TXD;
 module_param(num_tx_slots, uint, 0644);
 MODULE_PARM_DESC(num_tx_slots, "Specify the number of TX slots. Default: 8192");
 
+static unsigned int rx_slots_per_queue[DNA_IXGBE_MAX_QUEUES] = { 0 };
+module_param_array(rx_slots_per_queue, uint, NULL, 0444);
+MODULE_PARM_DESC(rx_slots_per_queue,
+                 "Comma separated list of RX slots per queue, the same on all the adapters "
+		 "(0 = num_rx_slots). Max: 32768");
+
+static unsigned int chunk_order = DNA_MAX_CHUNK_ORDER;
+module_param(chunk_order, uint, 0444);
+MODULE_PARM_DESC(chunk_order, "Order of the packet memory chunks. Default: 5 (128 KB), "
+		 "up to 9 (2 MB, hugepage sized): large rings need fewer, larger chunks");
+
+static unsigned int hdr_split_len = 0;
+module_param(hdr_split_len, uint, 0444);
+MODULE_PARM_DESC(hdr_split_len, "82599/X540 header split: only the first bytes (64..1024, "
+		 "64 bytes units) of each packet land in the RX slots, the payload is discarded. "
+		 "Default: 0 (disabled)");
+
 /* Forward */
 static inline void ixgbe_irq_disable(struct ixgbe_adapter *adapter);
 void ixgbe_irq_enable_queues(struct ixgbe_adapter *adapter, u64 qmask);
@@ -79,6 +96,33 @@ void dna_check_enable_adapter(struct ixgbe_adapter *adapter) {
 
 /* ****************************** */
 
+/* RX descriptors of a queue: the per-queue setting, or the adapter one */
+static u16 dna_rx_ring_count(struct ixgbe_adapter *adapter, int queue_index) {
+  u32 count;
+
+  if((queue_index >= DNA_IXGBE_MAX_QUEUES) || (rx_slots_per_queue[queue_index] == 0))
+    return(adapter->rx_ring_count);
+
+  count = max(rx_slots_per_queue[queue_index], (u32)IXGBE_MIN_RXD);
+  count = min(count, (u32)IXGBE_MAX_RXD);
+  return(ALIGN(count, IXGBE_REQ_RX_DESCRIPTOR_MULTIPLE));
+}
+
+/* ****************************** */
+
+/*
+  Header split length (0 = whole packets in the slots). The 82598 has
+  no header split in the advanced one buffer descriptors we use.
+*/
+static u_int dna_hdr_split_len(struct ixgbe_adapter *adapter) {
+  if((hdr_split_len == 0) || (adapter->hw.mac.type == ixgbe_mac_82598EB))
+    return(0);
+
+  return(min_t(u_int, ALIGN(hdr_split_len, 64), DNA_IXGBE_MAX_HDR_SPLIT_LEN));
+}
+
+/* ****************************** */
+
 void reserve_memory(unsigned long base, unsigned long len) {
   struct page *page, *page_end;
 
@@ -143,6 +187,28 @@ static void free_contiguous_memory(unsigned long mem,
 
 /* ********************************** */
 
+/* All the chunks or none: returns 0 on success */
+static int alloc_packet_chunks(unsigned long *packet_memory, u_int num_chunks,
+			       u_int *chunk_len, u_int *mem_order) {
+  u_int i;
+
+  for(i=0; i<num_chunks; i++) {
+    if((packet_memory[i] = alloc_contiguous_memory(chunk_len, mem_order)) == 0) {
+      while(i > 0) {
+	i--;
+	free_contiguous_memory(packet_memory[i], *chunk_len, *mem_order);
+	packet_memory[i] = 0;
+      }
+
+      return(-1);
+    }
+  }
+
+  return(0);
+}
+
+/* ********************************** */
+
 static void print_adv_rx_descr(union ixgbe_adv_rx_desc	*descr) {
   if(likely(!enable_debug)) return;
 
@@ -223,6 +289,45 @@ void notify_function_ptr(void *data, u_int8_t device_in_use) {
 
 /* ********************************** */
 
+/*
+  Before re-arming the interrupt of a queue used by an application: the
+  EITR of its vector follows the packets read since the last re-arm, with
+  the ranges of ixgbe_set_itr() (dynamic InterruptThrottleRate only). At
+  most a lap of the ring is seen, enough to tell a sparse queue.
+*/
+static void dna_ixgbe_adapt_itr(struct ixgbe_ring *rx_ring, u16 next_to_read)
+{
+  struct ixgbe_q_vector	*q_vector = rx_ring->q_vector;
+  struct ixgbe_adapter	*adapter = q_vector->adapter;
+  unsigned long		elapsed = jiffies - rx_ring->dna.rx_tx.rx.last_arm_jiffies;
+  u32			num_pkts, pps, new_itr;
+
+  num_pkts = (next_to_read + rx_ring->count - rx_ring->dna.rx_tx.rx.last_arm_idx) % rx_ring->count;
+  rx_ring->dna.rx_tx.rx.last_arm_jiffies = jiffies, rx_ring->dna.rx_tx.rx.last_arm_idx = next_to_read;
+
+  if(adapter->rx_itr_setting != 1)
+    return;
+
+  pps = (elapsed > 0) ? (num_pkts * HZ) / elapsed : num_pkts * HZ;
+
+  if(pps > 100000)
+    new_itr = IXGBE_8K_ITR;   /* bulk: the application drains bursts */
+  else if(pps > 10000)
+    new_itr = IXGBE_20K_ITR;
+  else
+    new_itr = IXGBE_100K_ITR; /* sparse: lowest latency */
+
+  if(new_itr != q_vector->itr) {
+    q_vector->itr = new_itr;
+    ixgbe_write_eitr(q_vector);
+
+    if(unlikely(enable_debug))
+      printk("%s(): queue %d [%u pps] EITR %u\n", __FUNCTION__, rx_ring->queue_index, pps, new_itr);
+  }
+}
+
+/* ********************************** */
+
 int wait_packet_function_ptr(void *data, int mode)
 {
   struct ixgbe_ring		*rx_ring = (struct ixgbe_ring*)data;
@@ -269,8 +374,10 @@ int wait_packet_function_ptr(void *data, int mode)
       rx_ring->dna.rx_tx.rx.interrupt_received = 0;
 
       if(!rx_ring->dna.rx_tx.rx.interrupt_enabled) {
-	if(adapter->hw.mac.type != ixgbe_mac_82598EB)
+	if(adapter->hw.mac.type != ixgbe_mac_82598EB) {
+	  dna_ixgbe_adapt_itr(rx_ring, i);
 	  ixgbe_irq_enable_queues(adapter, ((u64)1 << q_vector->v_idx));
+	}
 
 	if(unlikely(enable_debug)) printk("%s(): Enabled interrupts, queue = %d\n", __FUNCTION__, q_vector->v_idx);
 	rx_ring->dna.rx_tx.rx.interrupt_enabled = 1;
@@ -381,6 +488,17 @@ void dna_ixgbe_alloc_tx_buffers(struct ixgbe_ring *tx_ring, struct pfring_hooks
 
 /* ********************************** */
 
+static void dna_ixgbe_free_payload_sink(struct ixgbe_ring *rx_ring) {
+  if(rx_ring->dna.rx_tx.rx.payload_sink == NULL) return;
+
+  pci_unmap_single(to_pci_dev(rx_ring->dev), rx_ring->dna.rx_tx.rx.payload_sink_dma,
+		   rx_ring->rx_buf_len, PCI_DMA_FROMDEVICE);
+  kfree(rx_ring->dna.rx_tx.rx.payload_sink);
+  rx_ring->dna.rx_tx.rx.payload_sink = NULL;
+}
+
+/* ********************************** */
+
 void dna_ixgbe_alloc_rx_buffers(struct ixgbe_ring *rx_ring) {
   union ixgbe_adv_rx_desc *rx_desc, *shadow_rx_desc;
   struct ixgbe_rx_buffer *bi;
@@ -393,6 +511,7 @@ void dna_ixgbe_alloc_rx_buffers(struct ixgbe_ring *rx_ring) {
   mem_ring_info         rx_info = {0};
   mem_ring_info         tx_info = {0};
   int                   num_slots_per_page;
+  u_int                 order, split_len = dna_hdr_split_len(adapter);
 
   /* Check if the memory has been already allocated */
   if(rx_ring->dna.memory_allocated) return;
@@ -417,14 +536,59 @@ void dna_ixgbe_alloc_rx_buffers(struct ixgbe_ring *rx_ring) {
   if(unlikely(enable_debug))
     printk("%s(): pci cache line size %d\n",__FUNCTION__, cache_line_size);
 
-  rx_ring->dna.packet_slot_len  = ALIGN(rx_ring->rx_buf_len, cache_line_size);
+  /*
+    Header split: the slots only host the headers so that the mapped
+    memory stays small and cache friendly, while all the payloads are
+    written by the NIC to a single sink buffer that nobody reads.
+  */
+  rx_ring->dna.packet_slot_len  = ALIGN(split_len ? split_len : rx_ring->rx_buf_len, cache_line_size);
   rx_ring->dna.packet_num_slots = rx_ring->count;
 
-  rx_ring->dna.tot_packet_memory = PAGE_SIZE << DNA_MAX_CHUNK_ORDER;
+  if(split_len) {
+    rx_ring->dna.rx_tx.rx.payload_sink = kmalloc(rx_ring->rx_buf_len, GFP_KERNEL);
+
+    if(rx_ring->dna.rx_tx.rx.payload_sink == NULL) {
+      printk("\n\n%s() ERROR: not enough memory for the RX payload sink!!\n\n\n",
+	     __FUNCTION__);
+      return;
+    }
+
+    rx_ring->dna.rx_tx.rx.payload_sink_dma = pci_map_single(to_pci_dev(rx_ring->dev),
+							    rx_ring->dna.rx_tx.rx.payload_sink,
+							    rx_ring->rx_buf_len, PCI_DMA_FROMDEVICE);
+  }
+
+  /*
+    Large chunks: a 32k slots ring takes a few dozen 2 MB chunks instead of
+    hundreds of 128 KB ones. When memory is too fragmented for them, the
+    default chunk order is used.
+  */
+  order = min_t(u_int, chunk_order, min_t(u_int, DNA_MAX_HUGE_CHUNK_ORDER, MAX_ORDER - 1));
+
+  while(1) {
+    rx_ring->dna.tot_packet_memory = PAGE_SIZE << order;
 
-  num_slots_per_page = rx_ring->dna.tot_packet_memory / rx_ring->dna.packet_slot_len;
+    num_slots_per_page = rx_ring->dna.tot_packet_memory / rx_ring->dna.packet_slot_len;
 
-  rx_ring->dna.num_memory_pages = (rx_ring->dna.packet_num_slots + num_slots_per_page-1) / num_slots_per_page;
+    rx_ring->dna.num_memory_pages = (rx_ring->dna.packet_num_slots + num_slots_per_page-1) / num_slots_per_page;
+
+    if((rx_ring->dna.num_memory_pages <= DNA_MAX_NUM_CHUNKS)
+       && (alloc_packet_chunks(rx_ring->dna.rx_tx.rx.packet_memory, rx_ring->dna.num_memory_pages,
+			       &rx_ring->dna.tot_packet_memory, &rx_ring->dna.mem_order) == 0))
+      break;
+
+    if(order <= DNA_MAX_CHUNK_ORDER) {
+      printk("\n\n%s() ERROR: not enough memory for RX DMA ring!!\n\n\n",
+	     __FUNCTION__);
+      dna_ixgbe_free_payload_sink(rx_ring);
+      return;
+    }
+
+    printk("[DNA] %s@%d: unable to allocate %u KB chunks, using %lu KB ones\n",
+	   rx_ring->netdev->name, rx_ring->queue_index,
+	   rx_ring->dna.tot_packet_memory >> 10, (PAGE_SIZE << DNA_MAX_CHUNK_ORDER) >> 10);
+    order = DNA_MAX_CHUNK_ORDER;
+  }
 
 
   /* Packet Split disabled in DNA mode */
@@ -443,15 +607,6 @@ void dna_ixgbe_alloc_rx_buffers(struct ixgbe_ring *rx_ring) {
 	   num_slots_per_page);
 
   for(i=0; i<rx_ring->dna.num_memory_pages; i++) {
-    rx_ring->dna.rx_tx.rx.packet_memory[i] =
-      alloc_contiguous_memory(&rx_ring->dna.tot_packet_memory, &rx_ring->dna.mem_order);
-
-    if (rx_ring->dna.rx_tx.rx.packet_memory[i] == 0) {
-      printk("\n\n%s() ERROR: not enough memory for RX DMA ring!!\n\n\n",
-	     __FUNCTION__);
-      return;
-    }
-
     if(unlikely(enable_debug))
       printk("[DNA] %s(): Successfully allocated RX %u@%u bytes at 0x%08lx [slot_len=%d]\n",
 	     __FUNCTION__, rx_ring->dna.tot_packet_memory, i,
@@ -487,14 +642,13 @@ void dna_ixgbe_alloc_rx_buffers(struct ixgbe_ring *rx_ring) {
 			     rx_ring->dna.packet_slot_len,
 			     PCI_DMA_BIDIRECTIONAL /* PCI_DMA_FROMDEVICE */ );
 
-    /* Packet Split disabled in DNA mode */
-    //if (!ring_is_ps_enabled(rx_ring)) {
+    if(!split_len) {
       rx_desc->read.hdr_addr = 0;
       rx_desc->read.pkt_addr = cpu_to_le64(bi->dma);
-    //} else {
-    //  rx_desc->read.hdr_addr = cpu_to_le64(bi->dma);
-    //  rx_desc->read.pkt_addr = cpu_to_le64(bi->dma + rx_ring->dna.packet_slot_len);
-    //}
+    } else {
+      rx_desc->read.hdr_addr = cpu_to_le64(bi->dma);
+      rx_desc->read.pkt_addr = cpu_to_le64(rx_ring->dna.rx_tx.rx.payload_sink_dma);
+    }
 
     rx_desc->wb.upper.status_error = 0;
 
@@ -524,9 +678,14 @@ void dna_ixgbe_alloc_rx_buffers(struct ixgbe_ring *rx_ring) {
     printk("[DNA] next_to_clean=%u/next_to_use=%u [register=%d]\n",
 	   rx_ring->next_to_clean, rx_ring->next_to_use, IXGBE_READ_REG(hw, IXGBE_RDT(rx_ring->reg_idx)));
 
-  /* Allocate TX memory */
+  /* Allocate TX memory (full size slots even with header split) */
+  if(split_len) {
+    tx_ring->dna.packet_slot_len = ALIGN(rx_ring->rx_buf_len, cache_line_size);
+    num_slots_per_page = rx_ring->dna.tot_packet_memory / tx_ring->dna.packet_slot_len;
+  } else
+    tx_ring->dna.packet_slot_len = rx_ring->dna.packet_slot_len;
+
   tx_ring->dna.tot_packet_memory = rx_ring->dna.tot_packet_memory;
-  tx_ring->dna.packet_slot_len   = rx_ring->dna.packet_slot_len;
   tx_ring->dna.packet_num_slots  = tx_ring->count;
   tx_ring->dna.mem_order         = rx_ring->dna.mem_order;
   tx_ring->dna.num_memory_pages  = (tx_ring->dna.packet_num_slots + num_slots_per_page-1) / num_slots_per_page;
@@ -2779,15 +2779,19 @@ static int ixgbe_flowspec_to_flow_type(struct ethtool_rx_flow_spec *fsp,
 	return 1;
 }
 
-static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
-					struct ethtool_rxnfc *cmd)
+/*
+ * Validates a perfect filter request and builds its filter and mask,
+ * without the lock: the program step takes input over, or frees it.
+ */
+static int ixgbe_prepare_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
+					    struct ethtool_rxnfc *cmd,
+					    struct ixgbe_fdir_filter **inputp,
+					    union ixgbe_atr_input *maskp)
 {
 	struct ethtool_rx_flow_spec *fsp =
 		(struct ethtool_rx_flow_spec *)&cmd->fs;
-	struct ixgbe_hw *hw = &adapter->hw;
 	struct ixgbe_fdir_filter *input;
 	union ixgbe_atr_input mask;
-	int err;
 
 	if (!(adapter->flags & IXGBE_FLAG_FDIR_PERFECT_CAPABLE))
 		return -EOPNOTSUPP;
@@ -2856,23 +2860,37 @@ static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 	else
 		input->action = fsp->ring_cookie;
 
-	spin_lock(&adapter->fdir_perfect_lock);
+	*inputp = input;
+	memcpy(maskp, &mask, sizeof(mask));
+	return 0;
+err_out:
+	kfree(input);
+	return -EINVAL;
+}
+
+/* Called with fdir_perfect_lock held */
+static int ixgbe_program_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
+					    struct ixgbe_fdir_filter *input,
+					    union ixgbe_atr_input *mask)
+{
+	struct ixgbe_hw *hw = &adapter->hw;
+	int err;
 
 	if (hlist_empty(&adapter->fdir_filter_list)) {
 		/* save mask and program input mask into HW */
-		memcpy(&adapter->fdir_mask, &mask, sizeof(mask));
-		err = ixgbe_fdir_set_input_mask_82599(hw, &mask);
+		memcpy(&adapter->fdir_mask, mask, sizeof(*mask));
+		err = ixgbe_fdir_set_input_mask_82599(hw, mask);
 		if (err) {
 			DPRINTK(DRV, ERR, "Error writing mask\n");
-			goto err_out_w_lock;
+			goto err_out;
 		}
-	} else if (memcmp(&adapter->fdir_mask, &mask, sizeof(mask))) {
+	} else if (memcmp(&adapter->fdir_mask, mask, sizeof(*mask))) {
 		DPRINTK(DRV, ERR, "Only one mask supported per port\n");
-		goto err_out_w_lock;
+		goto err_out;
 	}
 
 	/* apply mask and compute/store hash */
-	ixgbe_atr_compute_perfect_hash_82599(&input->filter, &mask);
+	ixgbe_atr_compute_perfect_hash_82599(&input->filter, mask);
 
 	/* program filters to filter memory */
 	err = ixgbe_fdir_write_perfect_filter_82599(hw,
@@ -2881,20 +2899,34 @@ static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 				IXGBE_FDIR_DROP_QUEUE :
 				adapter->rx_ring[input->action]->reg_idx);
 	if (err)
-		goto err_out_w_lock;
+		goto err_out;
 
 	ixgbe_update_ethtool_fdir_entry(adapter, input, input->sw_idx);
 
-	spin_unlock(&adapter->fdir_perfect_lock);
-
 	return err;
-err_out_w_lock:
-	spin_unlock(&adapter->fdir_perfect_lock);
 err_out:
 	kfree(input);
 	return -EINVAL;
 }
 
+static int ixgbe_add_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
+					struct ethtool_rxnfc *cmd)
+{
+	struct ixgbe_fdir_filter *input;
+	union ixgbe_atr_input mask;
+	int err;
+
+	err = ixgbe_prepare_ethtool_fdir_entry(adapter, cmd, &input, &mask);
+	if (err)
+		return err;
+
+	spin_lock(&adapter->fdir_perfect_lock);
+	err = ixgbe_program_ethtool_fdir_entry(adapter, input, &mask);
+	spin_unlock(&adapter->fdir_perfect_lock);
+
+	return err;
+}
+
 static int ixgbe_del_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 					struct ethtool_rxnfc *cmd)
 {
@@ -2909,6 +2941,112 @@ static int ixgbe_del_ethtool_fdir_entry(struct ixgbe_adapter *adapter,
 	return err;
 }
 
+#ifdef ENABLE_DNA
+struct ixgbe_fdir_bulk_entry {
+	struct ixgbe_fdir_filter *input;
+	union ixgbe_atr_input mask;
+};
+
+/*
+ * ETHTOOL_PFRING_SRXFTRLBULK: the perfect filters are validated and
+ * allocated first, then all the commands run under one acquisition of
+ * fdir_perfect_lock, in order, up to the first one that fails.
+ */
+static int ixgbe_bulk_ethtool_fdir_entries(struct ixgbe_adapter *adapter,
+					   struct pfring_ethtool_bulk *bulk)
+{
+	struct ixgbe_fdir_bulk_entry *entry;
+	u32 i, num = bulk->num;
+	int err = 0;
+
+	bulk->num_done = 0;
+
+	entry = vmalloc(num * sizeof(struct ixgbe_fdir_bulk_entry));
+	if (!entry)
+		return -ENOMEM;
+
+	for (i = 0; i < num; i++) {
+		struct ethtool_rx_flow_spec *fsp =
+			(struct ethtool_rx_flow_spec *)&bulk->cmd[i].fs;
+
+		if (fsp->ring_cookie > (adapter->num_rx_queues - 1))
+			fsp->ring_cookie = RX_CLS_FLOW_DISC; /* drop */
+
+		entry[i].input = NULL;
+
+		switch (bulk->cmd[i].cmd) {
+		case ETHTOOL_SRXCLSRLINS:
+			err = ixgbe_prepare_ethtool_fdir_entry(adapter,
+							       &bulk->cmd[i],
+							       &entry[i].input,
+							       &entry[i].mask);
+			break;
+		case ETHTOOL_SRXCLSRLDEL:
+		case ETHTOOL_PFRING_SRXFTRLINS:
+		case ETHTOOL_PFRING_SRXFTRLDEL:
+			break;
+		default:
+			err = -EOPNOTSUPP;
+			break;
+		}
+
+		if (err)
+			break;
+	}
+	num = i; /* the commands before the first invalid one */
+
+	spin_lock(&adapter->fdir_perfect_lock);
+
+	for (i = 0; i < num; i++) {
+		struct ethtool_rx_flow_spec *fsp =
+			(struct ethtool_rx_flow_spec *)&bulk->cmd[i].fs;
+		int ret;
+
+		switch (bulk->cmd[i].cmd) {
+		case ETHTOOL_SRXCLSRLINS:
+			ret = ixgbe_program_ethtool_fdir_entry(adapter,
+							       entry[i].input,
+							       &entry[i].mask);
+			entry[i].input = NULL; /* in the list, or freed */
+			break;
+		case ETHTOOL_SRXCLSRLDEL:
+			ret = ixgbe_update_ethtool_fdir_entry(adapter, NULL,
+							      fsp->location);
+			break;
+		case ETHTOOL_PFRING_SRXFTRLINS:
+			ret = ixgbe_ftqf_add_filter(&adapter->hw,
+						    fsp->flow_type,
+						    fsp->h_u.tcp_ip4_spec.ip4src,
+						    fsp->h_u.tcp_ip4_spec.psrc,
+						    fsp->h_u.tcp_ip4_spec.ip4dst,
+						    fsp->h_u.tcp_ip4_spec.pdst,
+						    fsp->ring_cookie,
+						    fsp->location);
+			break;
+		default: /* ETHTOOL_PFRING_SRXFTRLDEL */
+			ret = ixgbe_ftqf_add_filter(&adapter->hw, 0, 0, 0, 0,
+						    0, 0, fsp->location);
+			break;
+		}
+
+		if (ret) {
+			err = ret;
+			break;
+		}
+	}
+	bulk->num_done = i;
+
+	spin_unlock(&adapter->fdir_perfect_lock);
+
+	for (; i < num; i++)
+		kfree(entry[i].input); /* not programmed */
+
+	vfree(entry);
+
+	return err;
+}
+#endif
+
 #ifdef ETHTOOL_SRXNTUPLE
 /*
  * We need to keep this around for kernels 2.6.33 - 2.6.39 in order to avoid
@@ -3068,6 +3206,10 @@ static int ixgbe_set_rxnfc(struct net_device *dev, struct ethtool_rxnfc *cmd)
 					    fsp->location);
 		spin_unlock(&adapter->fdir_perfect_lock);
 		break;
+	case ETHTOOL_PFRING_SRXFTRLBULK:
+		ret = ixgbe_bulk_ethtool_fdir_entries(adapter,
+			(struct pfring_ethtool_bulk *)(unsigned long)cmd->data);
+		break;
 	case ETHTOOL_PFRING_SRXFTCHECK:
 		if (adapter->hw.mac.type != ixgbe_mac_82598EB) 	
 			ret = RING_MAGIC_VALUE;
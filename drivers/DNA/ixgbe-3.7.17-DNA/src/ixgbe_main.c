@@ -3581,6 +3581,14 @@ static void ixgbe_configure_srrctl(struct ixgbe_adapter *adapter,
 	/* This is used for 82599 to drop packets when a queue is full */
 	if(adapter->dna.dna_enabled && adapter->hw.mac.type != ixgbe_mac_82598EB)
 		srrctl |= IXGBE_SRRCTL_DROP_EN;
+
+	/* Headers into the (mapped) header buffer, payloads into the sink */
+	if(adapter->dna.dna_enabled && dna_hdr_split_len(adapter)) {
+		srrctl &= ~(IXGBE_SRRCTL_BSIZEHDR_MASK | IXGBE_SRRCTL_DESCTYPE_MASK);
+		srrctl |= (dna_hdr_split_len(adapter) << IXGBE_SRRCTL_BSIZEHDRSIZE_SHIFT) &
+			  IXGBE_SRRCTL_BSIZEHDR_MASK;
+		srrctl |= IXGBE_SRRCTL_DESCTYPE_HDR_SPLIT_ALWAYS;
+	}
 #endif
 
 	IXGBE_WRITE_REG(hw, IXGBE_SRRCTL(reg_idx), srrctl);
@@ -3592,6 +3600,12 @@ static void ixgbe_setup_mrqc(struct ixgbe_adapter *adapter)
 	static const u32 seed[10] = { 0xE291D73D, 0x1805EC6C, 0x2A94B30D,
 			  0xA54F2BEC, 0xEA49AF7C, 0xE214AD3D, 0xB855AABE,
 			  0x6A3E67EA, 0x14364D17, 0x3BED200D};
+	/* 0x6d5a repeated: the hash of (src, dst) equals the hash of (dst, src) */
+	static const u32 seed_symmetric[10] = { 0x5A6D5A6D, 0x5A6D5A6D,
+			  0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D,
+			  0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D};
+	const u32 *key = (adapter->flags2 & IXGBE_FLAG2_RSS_SYMMETRIC) ?
+			 seed_symmetric : seed;
 	u32 mrqc = 0, reta = 0;
 	u32 rxcsum;
 	int i, j;
@@ -3606,7 +3620,7 @@ static void ixgbe_setup_mrqc(struct ixgbe_adapter *adapter)
 
 	/* Fill out hash function seeds */
 	for (i = 0; i < 10; i++)
-		IXGBE_WRITE_REG(hw, IXGBE_RSSRK(i), seed[i]);
+		IXGBE_WRITE_REG(hw, IXGBE_RSSRK(i), key[i]);
 
 	/* Fill out redirection table */
 	for (i = 0, j = 0; i < 128; i++, j++) {
@@ -5566,6 +5580,8 @@ void ixgbe_clean_rx_ring(struct ixgbe_ring *rx_ring)
 		rx_ring->dna.rx_tx.rx.packet_memory[i] = 0;
 	      }
 
+	      dna_ixgbe_free_payload_sink(rx_ring);
+
 	      /* De-register with PF_RING: one per channel  */
 
               rx_info.packet_memory_num_chunks    = rx_ring->dna.num_memory_pages;
@@ -6553,7 +6569,11 @@ static int ixgbe_alloc_queues(struct ixgbe_adapter *adapter)
 			ring = kzalloc(sizeof(struct ixgbe_ring), GFP_KERNEL);
 		if (!ring)
 			goto err_rx_ring_allocation;
+#ifdef ENABLE_DNA
+		ring->count = dna_rx_ring_count(adapter, i);
+#else
 		ring->count = rx_count;
+#endif
 		ring->queue_index = i;
 		ring->dev = pci_dev_to_dev(adapter->pdev);
 		ring->netdev = adapter->netdev;
@@ -141,6 +141,17 @@ IXGBE_PARAM(DCA, "Disable or enable Direct Cache Access, 0=disabled, 1=descripto
 
 IXGBE_PARAM(RSS, "Number of Receive-Side Scaling Descriptor Queues, default 1=number of cpus");
 
+/* SymmetricRSS - Symmetric Receive-Side Scaling hash key
+ *
+ * Valid Range: 0-1
+ *  - 0 - the default key: the two directions of a connection may land
+ *        on different queues
+ *  - 1 - a symmetric key: both directions land on the same queue
+ *
+ * Default Value: 0
+ */
+IXGBE_PARAM(SymmetricRSS, "Symmetric Receive-Side Scaling key, both directions of a flow on the same queue (0,1), default 0");
+
 /* VMDQ - Virtual Machine Device Queues (VMDQ)
  *
  * Valid Range: 1-16
@@ -1201,6 +1212,29 @@ no_fdir_sample:
 		}
 	}
 #endif /* IXGBE_FCOE */
+	{ /* SymmetricRSS - Symmetric Receive-Side Scaling key */
+		struct ixgbe_option opt = {
+			.type = enable_option,
+			.name = "SymmetricRSS - Symmetric Receive-Side Scaling key",
+			.err  = "defaulting to Disabled",
+			.def  = OPTION_DISABLED
+		};
+
+#ifdef module_param_array
+		if (num_SymmetricRSS > bd) {
+#endif
+			unsigned int sym = SymmetricRSS[bd];
+			ixgbe_validate_option(&sym, &opt);
+			if (sym)
+				adapter->flags2 |= IXGBE_FLAG2_RSS_SYMMETRIC;
+			else
+				adapter->flags2 &= ~IXGBE_FLAG2_RSS_SYMMETRIC;
+#ifdef module_param_array
+		} else {
+			adapter->flags2 &= ~IXGBE_FLAG2_RSS_SYMMETRIC;
+		}
+#endif
+	}
 	{ /* LRO - Enable Large Receive Offload */
 		struct ixgbe_option opt = {
 			.type = enable_option,
@@ -27,6 +27,9 @@ insmod ./ixgbe.ko RSS=1,1,1,1
 # Enable 8 queues
 #insmod ./ixgbe.ko MQ=1,1 RSS=8,8 FdirMode=0,0
 
+# Symmetric RSS: both directions of a flow on the same queue
+#insmod ./ixgbe.ko RSS=8,8 SymmetricRSS=1,1
+
 # Enable hw filters
 #insmod ./ixgbe.ko RSS=0,0,0,0 FdirMode=2,2,2,2 FdirPballoc=3,3,3,3
 
@@ -1549,6 +1549,73 @@ static int bnx2x_fill_frag_skb(struct bnx2x *bp, struct bnx2x_fastpath *fp,
 	return 0;
 }
 
+#ifdef HAVE_PF_RING
+/* The RSS hash of the packet, 0 when the firmware did not compute one */
+static inline u32 bnx2x_pf_ring_rxhash(union eth_rx_cqe *cqe)
+{
+	if (cqe->fast_path_cqe.status_flags & ETH_FAST_PATH_RX_CQE_RSS_HASH_FLG)
+		return le32_to_cpu(cqe->fast_path_cqe.rss_hash_result);
+
+	return 0;
+}
+
+/*
+ * Gives the skb to PF_RING on the channel of its RSS queue. Returns 1 when
+ * PF_RING consumed it (transparent_mode=2), 0 when it goes to the stack.
+ */
+static int bnx2x_pf_ring_handle_skb(struct bnx2x *bp, struct bnx2x_fastpath *fp,
+				    struct sk_buff *skb, union eth_rx_cqe *cqe)
+{
+	struct pfring_hooks *hook = (struct pfring_hooks*)bp->dev->pfring_ptr;
+	u_int8_t skb_reference_in_use;
+	u32 rxhash;
+	int rc;
+
+	if (!hook || hook->magic != PF_RING || *hook->transparent_mode == standard_linux_path)
+		return 0;
+
+	if ((rxhash = bnx2x_pf_ring_rxhash(cqe)) != 0) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0)
+		skb->hash = rxhash;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,35)
+		skb->rxhash = rxhash;
+#endif
+	}
+
+	rc = hook->ring_handler(skb, 1, 1, &skb_reference_in_use,
+				fp->index, BNX2X_NUM_QUEUES(bp));
+
+	/* PF_RING has already freed the memory */
+	return (rc > 0 && *hook->transparent_mode == driver2pf_ring_non_transparent);
+}
+
+/*
+ * transparent_mode=2: the packets never reach the stack, so a packet goes
+ * to PF_RING straight from its RX buffer, which is then given back to the
+ * ring unchanged (bnx2x_reuse_rx_skb()): no skb is allocated, unmapped or
+ * freed. Returns 1 when the packet has been consumed.
+ */
+static int bnx2x_pf_ring_handle_rx_buffer(struct bnx2x *bp, struct bnx2x_fastpath *fp,
+					  union eth_rx_cqe *cqe, struct sw_rx_bd *rx_buf,
+					  struct sk_buff *skb, u16 pad, u16 len)
+{
+	struct pfring_hooks *hook = (struct pfring_hooks*)bp->dev->pfring_ptr;
+
+	if (!hook || hook->magic != PF_RING || !hook->buffer_rx_ring_handler
+	    || *hook->transparent_mode != driver2pf_ring_non_transparent)
+		return 0;
+
+	pci_dma_sync_single_for_cpu(bp->pdev, pci_unmap_addr(rx_buf, mapping),
+				    pad + len, PCI_DMA_FROMDEVICE);
+	hook->buffer_rx_ring_handler(bp->dev, (char *)skb->data + pad, len,
+				     fp->index, BNX2X_NUM_QUEUES(bp),
+				     bnx2x_pf_ring_rxhash(cqe));
+	pci_dma_sync_single_for_device(bp->pdev, pci_unmap_addr(rx_buf, mapping),
+				       pad + len, PCI_DMA_FROMDEVICE);
+	return 1;
+}
+#endif
+
 static void bnx2x_tpa_stop(struct bnx2x *bp, struct bnx2x_fastpath *fp,
 			   u16 queue, int pad, int len, union eth_rx_cqe *cqe,
 			   u16 cqe_idx)
@@ -1595,35 +1662,9 @@ static void bnx2x_tpa_stop(struct bnx2x *bp, struct bnx2x_fastpath *fp,
 		skb->ip_summed = CHECKSUM_UNNECESSARY;
 
 #ifdef HAVE_PF_RING
-		{
-		  int debug = 0;
-		  struct pfring_hooks *hook = (struct pfring_hooks*)bp->dev->pfring_ptr;
-		  
-		  if(hook && (hook->magic == PF_RING)) {
-		    /* Wow: PF_RING is alive & kickin' ! */
-		    int rc;
-			  
-		    if(debug)
-		      printk(KERN_INFO "[PF_RING] alive [%s][len=%d][queue=%d/%d]\n",
-			     bp->dev->name, skb->len,
-			     fp->index  /* queue */, BNX2X_NUM_QUEUES(bp));
-			  
-		    if(*hook->transparent_mode != standard_linux_path) {
-		      rc = hook->ring_handler(skb, 1, 1, queue, BNX2X_NUM_QUEUES(bp));
-		      if(rc >= 1 /* Packet handled by PF_RING */) {
-			if(*hook->transparent_mode == driver2pf_ring_non_transparent) {
-			  /* PF_RING has already freed the memory */
-			  goto next_pkt;
-			}
-		      }
-		    } else {
-		      if(debug) printk(KERN_INFO "[PF_RING] present but transparent_mode=0\n");
-		    }
-		  } else {
-		      if(debug) printk(KERN_INFO "[PF_RING] not present on %s [hook=%p]\n",
-				       bp->dev->name, hook);
-		  }
-		}
+		/* Aggregated on TPA bin 'queue' of the RSS queue fp->index */
+		if (bnx2x_pf_ring_handle_skb(bp, fp, skb, cqe))
+			goto next_pkt;
 #endif
 
 		{
@@ -1850,6 +1891,14 @@ static int bnx2x_rx_int(struct bnx2x_fastpath *fp, int budget)
 				goto reuse_rx;
 			}
 
+#ifdef HAVE_PF_RING
+			if (bnx2x_pf_ring_handle_rx_buffer(bp, fp, cqe, rx_buf,
+							   skb, pad, len)) {
+				bnx2x_reuse_rx_skb(fp, skb, bd_cons, bd_prod);
+				goto next_rx;
+			}
+#endif
+
 			/* Since we don't have a jumbo ring
 			 * copy small packets if mtu > 1500
 			 */
@@ -1909,6 +1958,12 @@ reuse_rx:
 
 		skb_record_rx_queue(skb, fp->index);
 
+#ifdef HAVE_PF_RING
+		/* Before the VLAN branch: accelerated VLAN packets included */
+		if (bnx2x_pf_ring_handle_skb(bp, fp, skb, cqe))
+			goto next_pkt2;
+#endif
+
 #if defined(__VMKLNX__) && defined(__VMKNETDDI_QUEUEOPS__) /* ! BNX2X_UPSTREAM */
 		vmknetddi_queueops_set_skb_queueid(skb,
 				VMKNETDDI_QUEUEOPS_MK_RX_QUEUEID(fp->index));
@@ -1921,40 +1976,6 @@ reuse_rx:
 				le16_to_cpu(cqe->fast_path_cqe.vlan_tag), skb); 
 		else
 #endif
-
-#ifdef HAVE_PF_RING
-		{
-
-		  int debug = 0;
-		  struct pfring_hooks *hook = (struct pfring_hooks*)bp->dev->pfring_ptr;
-		  
-		  if(hook && (hook->magic == PF_RING)) {
-		    /* Wow: PF_RING is alive & kickin' ! */
-		    int rc, queue = fp->index;
-			  
-		    if(debug)
-		      printk(KERN_INFO "[2] [PF_RING] alive [%s][len=%d][queue=%d/%d]\n",
-			     bp->dev->name, skb->len,
-			     queue, BNX2X_NUM_QUEUES(bp));
-			  
-		    if(*hook->transparent_mode != standard_linux_path) {
-		      rc = hook->ring_handler(skb, 1, 1, queue, BNX2X_NUM_QUEUES(bp));
-		      if(rc == 1 /* Packet handled by PF_RING */) {
-			if(*hook->transparent_mode == driver2pf_ring_non_transparent) {
-			  /* PF_RING has already freed the memory */
-			  goto next_pkt2;
-			}
-		      }
-		    } else {
-		      if(debug) printk(KERN_INFO "[2] [PF_RING] present but transparent_mode=0\n");
-		    }
-		  } else {
-		      if(debug) printk(KERN_INFO "[2] [PF_RING] not present on %s [hook=%p]\n",
-				       bp->dev->name, hook);
-		  }
-		}
-#endif
-
 			napi_gro_receive(&fp->napi, skb);
 		 
 
@@ -8145,6 +8166,10 @@ static int bnx2x_set_num_queues(struct bnx2x *bp)
 	}
 #ifdef BNX2X_MULTI_QUEUE /* BNX2X_UPSTREAM */
 	bp->dev->real_num_tx_queues = bp->num_queues;
+#endif
+#if defined(HAVE_PF_RING) && LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,37)
+	/* The channels PF_RING sees on the device (get_num_rx_queues()) */
+	netif_set_real_num_rx_queues(bp->dev, bp->num_queues);
 #endif
 	return rc;
 }
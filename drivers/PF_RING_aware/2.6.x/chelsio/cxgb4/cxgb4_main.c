@@ -54,6 +54,14 @@
 #include "cxgb4_ofld.h"
 #endif
 
+#define HAVE_PF_RING
+
+#ifdef HAVE_PF_RING
+/* struct ethtool_rx_flow_spec as laid out by pf_ring.c on older kernels */
+#define I82599_HW_FILTERING_SUPPORT
+#include "../../../../kernel/linux/pf_ring.h"
+#endif
+
 #if 0
 #include "../bonding/bonding.h"
 #undef DRV_VERSION
@@ -2271,6 +2279,10 @@ static int set_tso(struct net_device *dev, u32 value)
 	return 0;
 }
 
+#if defined(HAVE_PF_RING) && defined(CONFIG_CHELSIO_T4_OFFLOAD)
+static int cxgb4_set_rxnfc(struct net_device *dev, struct ethtool_rxnfc *cmd);
+#endif
+
 static struct ethtool_ops cxgb_ethtool_ops = {
 	.get_settings      = get_settings,
 	.set_settings      = set_settings,
@@ -2301,6 +2313,9 @@ static struct ethtool_ops cxgb_ethtool_ops = {
 	.get_wol           = get_wol,
 	.set_wol           = set_wol,
 	.set_tso           = set_tso,
+#if defined(HAVE_PF_RING) && defined(CONFIG_CHELSIO_T4_OFFLOAD)
+	.set_rxnfc         = cxgb4_set_rxnfc,
+#endif
 };
 
 /*
@@ -7289,6 +7304,279 @@ static int delete_filter(struct adapter *adapter, unsigned int fidx)
 
 	return 0;
 }
+
+/*
+ * Vet a filter specification against our hardware filter configuration and
+ * capabilities and write it at t->filter_id.  Shared by the CHELSIO_SET_FILTER
+ * ioctl() and the PF_RING hardware filtering rules (see cxgb4_set_rxnfc()).
+ */
+static int set_filter(struct adapter *adapter, struct net_device *dev,
+		      struct ch_filter *t)
+{
+	u32 fconf, iconf;
+	unsigned int fidx, iq;
+	struct filter_entry *f;
+	int ret;
+
+	if (t->filter_id >= adapter->tids.nftids)
+		return -E2BIG;
+
+	/*
+	 * Check for unconfigured fields being used.
+	 */
+	t4_read_indirect(adapter, A_TP_PIO_ADDR, A_TP_PIO_DATA,
+			 &fconf, 1, A_TP_VLAN_PRI_MAP);
+	t4_read_indirect(adapter, A_TP_PIO_ADDR, A_TP_PIO_DATA,
+			 &iconf, 1, A_TP_INGRESS_CONFIG);
+
+	#define S(_field) \
+		(t->fs.val._field || t->fs.mask._field)
+	#define U(_mask, _field) \
+		(!(fconf & (_mask)) && S(_field))
+
+	if (U(F_FCOE, fcoe) || U(F_PORT, iport) || U(F_TOS, tos) ||
+	    U(F_ETHERTYPE, ethtype) || U(F_MACMATCH, macidx) ||
+	    U(F_MPSHITTYPE, matchtype) || U(F_FRAGMENTATION, frag) ||
+	    U(F_PROTOCOL, proto) ||
+	    U(F_VNIC_ID, pfvf_vld) ||
+	    U(F_VNIC_ID, ovlan_vld) ||
+	    U(F_VLAN, ivlan_vld))
+		return -EOPNOTSUPP;
+
+	/*
+	 * T4 inconveniently uses the same 17 bits for both the Outer
+	 * VLAN Tag and PF/VF/VFvld fields based on F_VNIC being set
+	 * in TP_INGRESS_CONFIG.  Hense the somewhat crazy checks
+	 * below.  Additionally, since the T4 firmware interface also
+	 * carries that overlap, we need to translate any PF/VF
+	 * specification into that internal format below.
+	 */
+	if (S(pfvf_vld) && S(ovlan_vld))
+		return -EOPNOTSUPP;
+	if ((S(pfvf_vld) && !(iconf & F_VNIC)) ||
+	    (S(ovlan_vld) && (iconf & F_VNIC)))
+		return -EOPNOTSUPP;
+	if (t->fs.val.pf > 0x7 || t->fs.val.vf > 0x7f)
+		return -ERANGE;
+	t->fs.mask.pf &= 0x7;
+	t->fs.mask.vf &= 0x7f;
+
+	#undef S
+	#undef U
+
+	/*
+	 * If the user is requesting that the filter action loop
+	 * matching packets back out one of our ports, make sure that
+	 * the egress port is in range.
+	 */
+	if (t->fs.action == FILTER_SWITCH &&
+	    t->fs.eport >= adapter->params.nports)
+		return -ERANGE;
+
+	/*
+	 * Don't allow various trivially obvious bogus out-of-range
+	 * values ...
+	 */
+	if (t->fs.val.iport >= adapter->params.nports)
+		return -ERANGE;
+
+	/*
+	 * If the user has requested steering matching Ingress Packets
+	 * to a specific Queue Set, we need to make sure it's in range
+	 * for the port and map that into the Absolute Queue ID of the
+	 * Queue Set's Response Queue.
+	 */
+	if (!t->fs.dirsteer) {
+		if (t->fs.iq)
+			return -EINVAL;
+		iq = 0;
+	} else {
+		struct port_info *pi = netdev_priv(dev);
+
+		/*
+		 * If the iq id is greater than the number of qsets,
+		 * then assume it is an absolute qid.
+		 */
+		if (t->fs.iq < pi->nqsets)
+			iq = adapter->sge.ethrxq[pi->first_qset +
+						 t->fs.iq].rspq.abs_id;
+		else
+			iq = t->fs.iq;
+	}
+
+	/*
+	 * IPv6 filters occupy four slots and must be aligned on
+	 * four-slot boundaries.  IPv4 filters only occupy a single
+	 * slot and have no alignment requirements but writing a new
+	 * IPv4 filter into the middle of an existing IPv6 filter
+	 * requires clearing the old IPv6 filter.
+	 */
+	if (t->fs.type == 0) { /* IPv4 */
+		/*
+		 * If our IPv4 filter isn't being written to a
+		 * multiple of four filter index and there's an IPv6
+		 * filter at the multiple of 4 base slot, then we need
+		 * to delete that IPv6 filter ...
+		 */
+		fidx = t->filter_id & ~0x3;
+		if (fidx != t->filter_id &&
+		    adapter->tids.ftid_tab[fidx].fs.type) {
+			ret = delete_filter(adapter, fidx);
+			if (ret)
+				return ret;
+		}
+	} else { /* IPv6 */
+		/*
+		 * Ensure that the IPv6 filter is aligned on a
+		 * multiple of 4 boundary.
+		 */
+		if (t->filter_id & 0x3)
+			return -EINVAL;
+
+		/*
+		 * Check all except the base overlapping IPv4 filter
+		 * slots.
+		 */
+		for (fidx = t->filter_id+1; fidx < t->filter_id+4; fidx++) {
+			ret = delete_filter(adapter, fidx);
+			if (ret)
+				return ret;
+		}
+	}
+
+	/*
+	 * Check to make sure the filter requested is writable ...
+	 */
+	f = &adapter->tids.ftid_tab[t->filter_id];
+	ret = writable_filter(f);
+	if (ret)
+		return ret;
+
+	/*
+	 * Clear out any old resources being used by the filter before
+	 * we start constructing the new filter.
+	 */
+	if (f->valid)
+		clear_filter(adapter, f);
+
+	/*
+	 * Convert the filter specification into our internal format.
+	 * We copy the PF/VF specification into the Outer VLAN field
+	 * here so the rest of the code -- including the interface to
+	 * the firmware -- doesn't have to constantly do these checks.
+	 */
+	f->fs = t->fs;
+	f->fs.iq = iq;
+	if (iconf & F_VNIC) {
+		f->fs.val.ovlan = (t->fs.val.pf << 7) | t->fs.val.vf;
+		f->fs.mask.ovlan = (t->fs.mask.pf << 7) | t->fs.mask.vf;
+		f->fs.val.ovlan_vld = t->fs.val.pfvf_vld;
+		f->fs.mask.ovlan_vld = t->fs.mask.pfvf_vld;
+	}
+
+	/*
+	 * Attempt to set the filter.  If we don't succeed, we clear
+	 * it and return the failure.
+	 */
+	ret = set_filter_wr(adapter, t->filter_id);
+	if (ret) {
+		clear_filter(adapter, f);
+		return ret;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_PF_RING
+/*
+ * PF_RING hardware filtering rules (chelsio_t4_filter_rule, see pf_ring.c).
+ * A rule is an IPv4 5-tuple whose addresses may be prefixes (any field
+ * masked to 0 is a wildcard) and its action is either drop or steering to
+ * a queue of the port.  The filter index is the rule id.  Filters are
+ * global to the adapter: when the ingress port is part of the compressed
+ * filter tuple (TP_VLAN_PRI_MAP) the rule only matches the port of dev.
+ */
+static int cxgb4_set_rxnfc(struct net_device *dev, struct ethtool_rxnfc *cmd)
+{
+	struct ethtool_rx_flow_spec *fsp = (struct ethtool_rx_flow_spec *)&cmd->fs;
+	struct port_info *pi = netdev_priv(dev);
+	struct adapter *adapter = pi->adapter;
+	struct ch_filter t;
+	u32 fconf;
+
+	if (adapter->tids.nftids == 0 || adapter->tids.ftid_tab == NULL)
+		return -EOPNOTSUPP;
+
+	switch (cmd->cmd) {
+	case ETHTOOL_PFRING_SRXFTCHECK:
+		return CHELSIO_T4_MAGIC_VALUE;
+
+	case ETHTOOL_SRXCLSRLDEL:
+		if (!(adapter->flags & FULL_INIT_DONE))
+			return -EAGAIN;
+		if (fsp->location >= adapter->tids.nftids)
+			return -E2BIG;
+		return delete_filter(adapter, fsp->location);
+
+	case ETHTOOL_SRXCLSRLINS:
+		if (!(adapter->flags & FULL_INIT_DONE))
+			return -EAGAIN;
+		break;
+
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	memset(&t, 0, sizeof(t));
+	t.filter_id = fsp->location;
+
+	/* Addresses stay in network order: IPv4 in [3:0] of lip/fip */
+	memcpy(t.fs.val.lip, &fsp->h_u.usr_ip4_spec.ip4dst, 4);
+	memcpy(t.fs.mask.lip, &fsp->m_u.usr_ip4_spec.ip4dst, 4);
+	memcpy(t.fs.val.fip, &fsp->h_u.usr_ip4_spec.ip4src, 4);
+	memcpy(t.fs.mask.fip, &fsp->m_u.usr_ip4_spec.ip4src, 4);
+
+	switch (fsp->flow_type) {
+	case TCP_V4_FLOW:
+	case UDP_V4_FLOW:
+	case SCTP_V4_FLOW:
+		t.fs.val.proto = (fsp->flow_type == TCP_V4_FLOW) ? IPPROTO_TCP :
+			((fsp->flow_type == UDP_V4_FLOW) ? IPPROTO_UDP : IPPROTO_SCTP);
+		t.fs.mask.proto = 0xff;
+		t.fs.val.lport = ntohs(fsp->h_u.tcp_ip4_spec.pdst);
+		t.fs.mask.lport = ntohs(fsp->m_u.tcp_ip4_spec.pdst);
+		t.fs.val.fport = ntohs(fsp->h_u.tcp_ip4_spec.psrc);
+		t.fs.mask.fport = ntohs(fsp->m_u.tcp_ip4_spec.psrc);
+		break;
+	case IP_USER_FLOW:
+		t.fs.val.proto = fsp->h_u.usr_ip4_spec.proto;
+		t.fs.mask.proto = fsp->m_u.usr_ip4_spec.proto;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	t4_read_indirect(adapter, A_TP_PIO_ADDR, A_TP_PIO_DATA,
+			 &fconf, 1, A_TP_VLAN_PRI_MAP);
+	if (fconf & F_PORT) {
+		t.fs.val.iport = pi->port_id;
+		t.fs.mask.iport = 0x7;
+	}
+
+	if (fsp->ring_cookie == RX_CLS_FLOW_DISC)
+		t.fs.action = FILTER_DROP;
+	else {
+		if (fsp->ring_cookie >= pi->nqsets)
+			return -EINVAL;
+		t.fs.action = FILTER_PASS;
+		t.fs.dirsteer = 1;
+		t.fs.iq = fsp->ring_cookie;
+	}
+	t.fs.hitcnts = 1;
+
+	return set_filter(adapter, dev, &t);
+}
+#endif /* HAVE_PF_RING */
 #endif
 
 /*
@@ -7621,15 +7909,7 @@ static int cxgb_extension_ioctl(struct net_device *dev, void __user *useraddr)
 
 #ifdef CONFIG_CHELSIO_T4_OFFLOAD
 	case CHELSIO_SET_FILTER: {
-		u32 fconf, iconf;
 		struct ch_filter t;
-		unsigned int fidx, iq;
-		struct filter_entry *f;
-
-		/*
-		 * Vet the filter specification against our hardware filter
-		 * configuration and capabilities.
-		 */
 
 		if (!capable(CAP_NET_ADMIN))
 			return -EPERM;
@@ -7641,172 +7921,7 @@ static int cxgb_extension_ioctl(struct net_device *dev, void __user *useraddr)
 		if (copy_from_user(&t, useraddr, sizeof(t)))
 			return -EFAULT;
 
-		if (t.filter_id >= adapter->tids.nftids)
-			return -E2BIG;
-
-		/*
-		 * Check for unconfigured fields being used.
-		 */
-		t4_read_indirect(adapter, A_TP_PIO_ADDR, A_TP_PIO_DATA,
-				 &fconf, 1, A_TP_VLAN_PRI_MAP);
-		t4_read_indirect(adapter, A_TP_PIO_ADDR, A_TP_PIO_DATA,
-				 &iconf, 1, A_TP_INGRESS_CONFIG);
-
-		#define S(_field) \
-			(t.fs.val._field || t.fs.mask._field)
-		#define U(_mask, _field) \
-			(!(fconf & (_mask)) && S(_field))
-
-		if (U(F_FCOE, fcoe) || U(F_PORT, iport) || U(F_TOS, tos) ||
-		    U(F_ETHERTYPE, ethtype) || U(F_MACMATCH, macidx) ||
-		    U(F_MPSHITTYPE, matchtype) || U(F_FRAGMENTATION, frag) ||
-		    U(F_PROTOCOL, proto) ||
-		    U(F_VNIC_ID, pfvf_vld) ||
-		    U(F_VNIC_ID, ovlan_vld) ||
-		    U(F_VLAN, ivlan_vld))
-			return -EOPNOTSUPP;
-
-		/*
-		 * T4 inconveniently uses the same 17 bits for both the Outer
-		 * VLAN Tag and PF/VF/VFvld fields based on F_VNIC being set
-		 * in TP_INGRESS_CONFIG.  Hense the somewhat crazy checks
-		 * below.  Additionally, since the T4 firmware interface also
-		 * carries that overlap, we need to translate any PF/VF
-		 * specification into that internal format below.
-		 */
-		if (S(pfvf_vld) && S(ovlan_vld))
-			return -EOPNOTSUPP;
-		if ((S(pfvf_vld) && !(iconf & F_VNIC)) ||
-		    (S(ovlan_vld) && (iconf & F_VNIC)))
-			return -EOPNOTSUPP;
-		if (t.fs.val.pf > 0x7 || t.fs.val.vf > 0x7f)
-			return -ERANGE;
-		t.fs.mask.pf &= 0x7;
-		t.fs.mask.vf &= 0x7f;
-
-		#undef S
-		#undef U
-
-		/*
-		 * If the user is requesting that the filter action loop
-		 * matching packets back out one of our ports, make sure that
-		 * the egress port is in range.
-		 */
-		if (t.fs.action == FILTER_SWITCH &&
-		    t.fs.eport >= adapter->params.nports)
-			return -ERANGE;
-
-		/*
-		 * Don't allow various trivially obvious bogus out-of-range
-		 * values ...
-		 */
-		if (t.fs.val.iport >= adapter->params.nports)
-			return -ERANGE;
-
-		/*
-		 * If the user has requested steering matching Ingress Packets
-		 * to a specific Queue Set, we need to make sure it's in range
-		 * for the port and map that into the Absolute Queue ID of the
-		 * Queue Set's Response Queue.
-		 */
-		if (!t.fs.dirsteer) {
-			if (t.fs.iq)
-				return -EINVAL;
-			iq = 0;
-		} else {
-			struct port_info *pi = netdev_priv(dev);
-
-			/*
-			 * If the iq id is greater than the number of qsets,
-			 * then assume it is an absolute qid.
-			 */
-			if (t.fs.iq < pi->nqsets)
-				iq = adapter->sge.ethrxq[pi->first_qset +
-							 t.fs.iq].rspq.abs_id;
-			else
-				iq = t.fs.iq;
-		}
-
-		/*
-		 * IPv6 filters occupy four slots and must be aligned on
-		 * four-slot boundaries.  IPv4 filters only occupy a single
-		 * slot and have no alignment requirements but writing a new
-		 * IPv4 filter into the middle of an existing IPv6 filter
-		 * requires clearing the old IPv6 filter.
-		 */
-		if (t.fs.type == 0) { /* IPv4 */
-			/*
-			 * If our IPv4 filter isn't being written to a
-			 * multiple of four filter index and there's an IPv6
-			 * filter at the multiple of 4 base slot, then we need
-			 * to delete that IPv6 filter ...
-			 */
-			fidx = t.filter_id & ~0x3;
-			if (fidx != t.filter_id &&
-			    adapter->tids.ftid_tab[fidx].fs.type) {
-				ret = delete_filter(adapter, fidx);
-				if (ret)
-					return ret;
-			}
-		} else { /* IPv6 */
-			/*
-			 * Ensure that the IPv6 filter is aligned on a
-			 * multiple of 4 boundary.
-			 */
-			if (t.filter_id & 0x3)
-				return -EINVAL;
-
-			/*
-			 * Check all except the base overlapping IPv4 filter
-			 * slots.
-			 */
-			for (fidx = t.filter_id+1; fidx < t.filter_id+4; fidx++) {
-				ret = delete_filter(adapter, fidx);
-				if (ret)
-					return ret;
-			}
-		}
-
-		/*
-		 * Check to make sure the filter requested is writable ...
-		 */
-		f = &adapter->tids.ftid_tab[t.filter_id];
-		ret = writable_filter(f);
-		if (ret)
-			return ret;
-
-		/*
-		 * Clear out any old resources being used by the filter before
-		 * we start constructing the new filter.
-		 */
-		if (f->valid)
-			clear_filter(adapter, f);
-
-		/*
-		 * Convert the filter specification into our internal format.
-		 * We copy the PF/VF specification into the Outer VLAN field
-		 * here so the rest of the code -- including the interface to
-		 * the firmware -- doesn't have to constantly do these checks.
-		 */
-		f->fs = t.fs;
-		f->fs.iq = iq;
-		if (iconf & F_VNIC) {
-			f->fs.val.ovlan = (t.fs.val.pf << 7) | t.fs.val.vf;
-			f->fs.mask.ovlan = (t.fs.mask.pf << 7) | t.fs.mask.vf;
-			f->fs.val.ovlan_vld = t.fs.val.pfvf_vld;
-			f->fs.mask.ovlan_vld = t.fs.mask.pfvf_vld;
-		}
-
-		/*
-		 * Attempt to set the filter.  If we don't succeed, we clear
-		 * it and return the failure.
-		 */
-		ret = set_filter_wr(adapter, t.filter_id);
-		if (ret) {
-			clear_filter(adapter, f);
-			return ret;
-		}
-
+		ret = set_filter(adapter, dev, &t);
 		break;
 	}
 	case CHELSIO_DEL_FILTER: {
@@ -166,6 +166,29 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 #ifdef HAVE_PF_RING
 #include "../../../../kernel/linux/pf_ring.h"
+
+/*
+ * mcp_slot_8 of the firmware (MXGEFW_RSS_MCP_SLOT_TYPE_WITH_HASH): the RSS
+ * hash of the packet in front of the usual mcp_slot, its type in the top
+ * two bits of the length. Requested at reset, with myri10ge_rx_hash, so
+ * that PF_RING gets the hash of the NIC (skb rxhash) instead of computing
+ * one per packet.
+ */
+struct myri10ge_hash_slot {
+	__be32 hash;
+	struct mcp_slot slot;
+};
+
+#ifndef MXGEFW_RSS_HASH_MASK /* defined for NDIS only */
+#define MXGEFW_RSS_HASH_MASK (3 << 14)
+#endif
+
+#define MYRI10GE_SLOT_SIZE sizeof (struct myri10ge_hash_slot) /* allocated for the largest */
+#define MYRI10GE_SLOT(rx_done, i)					\
+	((rx_done)->hash ? &((struct myri10ge_hash_slot *)(rx_done)->entry)[i].slot : &(rx_done)->entry[i])
+#else
+#define MYRI10GE_SLOT_SIZE sizeof (struct mcp_slot)
+#define MYRI10GE_SLOT(rx_done, i) (&(rx_done)->entry[i])
 #endif
 
 struct myri10ge_rx_buffer_state {
@@ -238,10 +261,14 @@ struct myri10ge_tx_buf {
 };
 
 struct myri10ge_rx_done {
-	struct mcp_slot *entry;
+	struct mcp_slot *entry;		/* see MYRI10GE_SLOT() */
 	dma_addr_t bus;
 	int cnt;
 	int idx;
+#ifdef HAVE_PF_RING
+	int hash;			/* entries are myri10ge_hash_slot */
+	u32 pkt_hash;			/* of the packet being received, 0 = none */
+#endif
 #if MYRI10GE_LRO
 	struct net_lro_mgr lro_mgr;
 	struct net_lro_desc lro_desc[MYRI10GE_MAX_LRO_DESCRIPTORS];
@@ -577,6 +604,12 @@ static int myri10ge_rss_hash = MXGEFW_RSS_HASH_TYPE_SRC_PORT;
 module_param(myri10ge_rss_hash, int, S_IRUGO);
 MODULE_PARM_DESC(myri10ge_rss_hash, "Type of RSS hashing to do");
 
+#ifdef HAVE_PF_RING
+static int myri10ge_rx_hash = 1;
+module_param(myri10ge_rx_hash, int, S_IRUGO);
+MODULE_PARM_DESC(myri10ge_rx_hash, "Pass the RSS hash of each packet to PF_RING (firmware permitting)");
+#endif
+
 #ifndef LINUX_KERNEL_SPECIFIC
 #define MYRI10GE_TX_HASH_RX 0 /* same as RX hash */
 #define MYRI10GE_TX_HASH_SKB 1 /* use existing skb queue mapping */
@@ -1634,13 +1667,30 @@ myri10ge_reset(struct myri10ge_priv *mgp)
 	 * not understand this command, but will use the correct
 	 * sized mcp_slot, so we ignore error returns 
 	 */
+#ifdef HAVE_PF_RING
+	/* Unless the firmware takes the slots with the hash */
+	cmd.data0 = MXGEFW_RSS_MCP_SLOT_TYPE_WITH_HASH;
+	status = myri10ge_rx_hash ?
+		myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_RSS_MCP_SLOT_TYPE, &cmd, 0) : -1;
+	for (i = 0; i < mgp->num_slices; i++)
+		mgp->ss[i].rx_done.hash = (status == 0);
+	if (status != 0) {
+#endif
        cmd.data0 = MXGEFW_RSS_MCP_SLOT_TYPE_MIN;
        (void) myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_RSS_MCP_SLOT_TYPE,
 				&cmd, 0);	
+#ifdef HAVE_PF_RING
+	}
+#endif
 
 	/* Now exchange information about interrupts  */
 
+#ifdef HAVE_PF_RING
+	bytes = mgp->max_intr_slots *
+		(mgp->ss[0].rx_done.hash ? sizeof (struct myri10ge_hash_slot) : sizeof (struct mcp_slot));
+#else
 	bytes = mgp->max_intr_slots * sizeof (*mgp->ss[0].rx_done.entry);
+#endif
 	cmd.data0 = (u32) bytes;
 	status = myri10ge_send_cmd(mgp, MXGEFW_CMD_SET_INTRQ_SIZE, &cmd, 0);
 
@@ -2017,6 +2067,37 @@ myri10ge_rhel_gro_vlan_fixup(struct sk_buff *skb, uint8_t *va)
 	}
 }
 #endif
+#ifdef HAVE_PF_RING
+/*
+ * The packet to PF_RING, with its slice as channel id: one ring per slice
+ * can be bound (dev@<slice>, pfring_open_multichannel()). Returns 1 when
+ * PF_RING consumed and freed the skb.
+ */
+static inline int
+myri10ge_pf_ring_handle_skb(struct myri10ge_slice_state *ss, struct sk_buff *skb, u_char real_skb)
+{
+	struct pfring_hooks *hook = (struct pfring_hooks*)skb->dev->pfring_ptr;
+	u_int8_t skb_reference_in_use;
+	int rc;
+
+	if (!hook || hook->magic != PF_RING || *hook->transparent_mode == standard_linux_path)
+		return 0;
+
+	if (ss->rx_done.pkt_hash != 0) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0)
+		skb->hash = ss->rx_done.pkt_hash;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,35)
+		skb->rxhash = ss->rx_done.pkt_hash;
+#endif
+	}
+
+	rc = hook->ring_handler(skb, 1, real_skb, &skb_reference_in_use,
+				ss - &ss->mgp->ss[0], ss->mgp->num_slices);
+
+	return (rc > 0 && real_skb && *hook->transparent_mode == driver2pf_ring_non_transparent);
+}
+#endif
+
 static inline int
 myri10ge_rx_done(struct myri10ge_slice_state *ss, struct myri10ge_rx_buf *rx,
                  int bytes, int len, __wsum csum)
@@ -2087,32 +2168,7 @@ myri10ge_rx_done(struct myri10ge_slice_state *ss, struct myri10ge_rx_buf *rx,
 		myri10ge_rhel_gro_vlan_fixup(skb, va);
 #endif
 #ifdef HAVE_PF_RING
-	{
-	  int debug = 0;
-	  struct pfring_hooks *hook = (struct pfring_hooks*)skb->dev->pfring_ptr;
-	  
-	  if(hook && (hook->magic == PF_RING)) {
-	    /* Wow: PF_RING is alive & kickin' ! */
-	    int rc;
-
-	    if(debug) 
-	      printk(KERN_INFO "[PF_RING] alive [%s][len=%d]\n", 
-		     skb->dev->name, skb->len);
-
-	    // printk(KERN_INFO "[PF_RING] queue_index=%d\n", ring->queue_index);
-
-	    if(*hook->transparent_mode != standard_linux_path) {
-		    rc = hook->ring_handler(skb, 1, 0, ss - &mgp->ss[0], mgp->num_slices);
-	      
-	      if(rc >= 1 /* Packet handled by PF_RING */) {
-	      }
-	    } else {
-	      if(debug) printk(KERN_INFO "[PF_RING] not present on %s\n", 
-			       skb->dev->name);
-	    }
-	  }
-	}
-
+		myri10ge_pf_ring_handle_skb(ss, skb, 0);
 #endif
 		napi_gro_frags(&ss->napi);
 		myri10ge_set_last_rx(dev, jiffies);
@@ -2161,36 +2217,8 @@ myri10ge_rx_done(struct myri10ge_slice_state *ss, struct myri10ge_rx_buf *rx,
 	myri10ge_skb_record_rx_queue(skb, ss - &mgp->ss[0]);
 	//printk(KERN_INFO "TMC: Think I am in queue %d\n",ss - &mgp->ss[0]);
 #ifdef HAVE_PF_RING
-	{
-	  int debug = 0;
-	  struct pfring_hooks *hook = (struct pfring_hooks*)skb->dev->pfring_ptr;
-	  
-	  if(hook && (hook->magic == PF_RING)) {
-	    /* Wow: PF_RING is alive & kickin' ! */
-	    int rc;
-
-	    if(debug) 
-	      printk(KERN_INFO "[PF_RING] alive [%s][len=%d]\n", 
-		     skb->dev->name, skb->len);
-
-	    // printk(KERN_INFO "[PF_RING] queue_index=%d\n", ring->queue_index);
-
-	    if(*hook->transparent_mode != standard_linux_path) {
-  	      rc = hook->ring_handler(skb, 1, 1, ss - &mgp->ss[0], mgp->num_slices);
-	      
-	      if(rc >= 1 /* Packet handled by PF_RING */) {
-		if(*hook->transparent_mode == driver2pf_ring_non_transparent) {
-		  /* PF_RING has already freed the memory */
-		  return 0;
-		}
-	      }
-	    } else {
-	      if(debug) printk(KERN_INFO "[PF_RING] not present on %s\n", 
-			       skb->dev->name);
-	    }
-	  }
-	}
-
+	if (myri10ge_pf_ring_handle_skb(ss, skb, 1))
+		return 0; /* PF_RING has already freed the memory */
 #endif
 
 #ifndef LINUX_KERNEL_SPECIFIC
@@ -2317,16 +2345,26 @@ myri10ge_clean_rx_done(struct myri10ge_slice_state *ss, int *limit)
 	u16 length;
 	__wsum checksum;
 
-	while (rx_done->entry[idx].length != 0 &&
+	while (MYRI10GE_SLOT(rx_done, idx)->length != 0 &&
 #ifdef MYRI10GE_HAVE_NEW_NAPI
 		work_done < budget
 #else
 		*limit != 0
 #endif
 		) {
-		length = ntohs(rx_done->entry[idx].length);
-		rx_done->entry[idx].length = 0;
-		checksum = csum_unfold(rx_done->entry[idx].checksum);
+		struct mcp_slot *slot = MYRI10GE_SLOT(rx_done, idx);
+
+		length = ntohs(slot->length);
+		slot->length = 0;
+		checksum = csum_unfold(slot->checksum);
+#ifdef HAVE_PF_RING
+		if (rx_done->hash) {
+			/* The hash type is in the top bits of the length */
+			rx_done->pkt_hash = (length & MXGEFW_RSS_HASH_MASK) ?
+				ntohl(((struct myri10ge_hash_slot *)rx_done->entry)[idx].hash) : 0;
+			length &= ~MXGEFW_RSS_HASH_MASK;
+		}
+#endif
 		if (length <= mgp->small_bytes)
 			rx_ok = myri10ge_rx_done(ss, &ss->rx_small,
 						 mgp->small_bytes,
@@ -2498,7 +2536,7 @@ myri10ge_poll(struct net_device *netdev, int *budget)
 	*budget -= work_done;
 	netdev->quota -= work_done;
 
-	if (rx_done->entry[rx_done->idx].length == 0 ||
+	if (MYRI10GE_SLOT(rx_done, rx_done->idx)->length == 0 ||
 	    !netif_running(netdev)) {
 #ifdef RHEL_GRO
 		napi_gro_flush(&ss->napi);
@@ -2648,7 +2686,7 @@ myri10ge_intr(int irq __unused, void *arg)
 		/* check for transmit completes and receives */
 		send_done_count = ntohl(stats->send_done_count);
 		while ((send_done_count != tx->pkt_done) ||
-		       (rx_done->entry[rx_done->idx].length != 0)) {
+		       (MYRI10GE_SLOT(rx_done, rx_done->idx)->length != 0)) {
 			myri10ge_tx_done(ss, (int)send_done_count);
 			limit = 32;
 #ifdef MYRI10GE_HAVE_NEW_NAPI
@@ -5612,8 +5650,7 @@ myri10ge_free_slices(struct myri10ge_priv *mgp)
 	for (i = 0; i < mgp->num_slices; i++) {
 		ss = &mgp->ss[i];
 		if (ss->rx_done.entry != NULL) {
-			bytes = mgp->max_intr_slots *
-				sizeof (*ss->rx_done.entry);
+			bytes = mgp->max_intr_slots * MYRI10GE_SLOT_SIZE;
 			dma_free_coherent(&pdev->dev, bytes,
 					  ss->rx_done.entry,
 					  ss->rx_done.bus);
@@ -5652,7 +5689,7 @@ myri10ge_alloc_slices(struct myri10ge_priv *mgp)
 
 	for (i = 0; i < mgp->num_slices; i++) {
 		ss = &mgp->ss[i];
-		bytes = mgp->max_intr_slots * sizeof (*ss->rx_done.entry);
+		bytes = mgp->max_intr_slots * MYRI10GE_SLOT_SIZE;
 		ss->rx_done.entry = dma_alloc_coherent(&pdev->dev, bytes,
 					   &ss->rx_done.bus, GFP_KERNEL);
 		if (ss->rx_done.entry == NULL)
@@ -6099,6 +6136,10 @@ myri10ge_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 		goto abort_with_firmware;
 	}
 	MYRI10GE_SET_NUM_TXQ(netdev, mgp->num_slices);
+#if defined(HAVE_PF_RING) && LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,37)
+	/* The channels PF_RING sees on the device (get_num_rx_queues()) */
+	netif_set_real_num_rx_queues(netdev, mgp->num_slices);
+#endif
 	status = myri10ge_reset(mgp);
 	if (status != 0) {
 		dev_err(&pdev->dev, "failed reset\n");
@@ -4032,13 +4032,22 @@ static void e1000e_setup_rss_hash(struct e1000_adapter *adapter)
 		0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
 		0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
 	};
+	/* 0x6d5a repeated: the hash of (src, dst) equals the hash of (dst, src) */
+	static const u8 rsshash_symmetric[40] = {
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a
+	};
+	const u8 *key = (adapter->flags2 & FLAG2_RSS_SYMMETRIC) ?
+			rsshash_symmetric : rsshash;
 
 	/* Fill out hash function seeds */
 	for (j = 0; j < 10; j++) {
-		u32 rsskey = rsshash[(j * 4)];
-		rsskey |= rsshash[(j * 4) + 1] << 8;
-		rsskey |= rsshash[(j * 4) + 2] << 16;
-		rsskey |= rsshash[(j * 4) + 3] << 24;
+		u32 rsskey = key[(j * 4)];
+		rsskey |= key[(j * 4) + 1] << 8;
+		rsskey |= key[(j * 4) + 2] << 16;
+		rsskey |= key[(j * 4) + 3] << 24;
 		E1000_WRITE_REG_ARRAY(hw, E1000_RSSRK(0), j, rsskey);
 	}
 
@@ -178,6 +178,16 @@ E1000_PARAM(CrcStripping, "Enable CRC Stripping, disable if your BMC needs " \
  */
 E1000_PARAM(EEE, "Enable/disable on parts that support the feature");
 
+/*
+ * Symmetric RSS hash key: the hash reported with the packets is the same
+ * for both directions of a flow. All the traffic still goes to queue 0.
+ *
+ * Valid Range: 0, 1
+ *
+ * Default Value: 0
+ */
+E1000_PARAM(SymmetricRSS, "Symmetric RSS hash key (0,1), default 0");
+
 /* Enable node specific allocation of all data structures, typically
  *  specific to routing setups, not generally useful.
  *
@@ -466,6 +476,21 @@ void __devinit e1000e_check_options(struct e1000_adapter *adapter)
 			adapter->flags2 |= FLAG2_CRC_STRIPPING;
 		}
 	}
+	{ /* Symmetric RSS hash key */
+		static const struct e1000_option opt = {
+			.type = enable_option,
+			.name = "Symmetric RSS hash key",
+			.err  = "defaulting to Disabled",
+			.def  = OPTION_DISABLED
+		};
+
+		if (num_SymmetricRSS > bd) {
+			unsigned int sym = SymmetricRSS[bd];
+			e1000_validate_option(&sym, &opt, adapter);
+			if (sym == OPTION_ENABLED)
+				adapter->flags2 |= FLAG2_RSS_SYMMETRIC;
+		}
+	}
 	{ /* Kumeran Lock Loss Workaround */
 		static const struct e1000_option opt = {
 			.type = enable_option,
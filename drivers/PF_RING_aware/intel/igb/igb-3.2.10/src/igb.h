@@ -557,6 +557,7 @@ struct igb_vmdq_adapter {
 #define IGB_FLAG_QUEUE_PAIRS       (1 << 5)
 #define IGB_FLAG_EEE               (1 << 6)
 #define IGB_FLAG_DMAC              (1 << 7)
+#define IGB_FLAG_RSS_SYMMETRIC     (1 << 8)
 
 #define IGB_MIN_TXPBSIZE           20408
 #define IGB_TX_BUF_4096            4096
@@ -52,6 +52,19 @@
 
 #ifdef HAVE_PF_RING
 #include "../../../../../../kernel/linux/pf_ring.h"
+
+/* NAPI/ITR controls of /proc/net/pf_ring/dev/<dev>/tuning, NULL without PF_RING */
+static inline pfring_device_tuning *pf_ring_device_tuning(struct net_device *netdev) {
+  struct pfring_hooks *hook = (struct pfring_hooks*)netdev->pfring_ptr;
+
+  if(hook && (hook->magic == PF_RING) && hook->device_tuning)
+    return(hook->device_tuning(netdev->ifindex));
+
+  return(NULL);
+}
+
+/* The EITR interval in the q_vector->itr_val units (usec * 4) */
+#define PF_RING_USECS_TO_ITR(usecs) min_t(u32, (usecs) << 2, 0x7FFC)
 #endif
 
 #define DRV_DEBUG
@@ -2901,13 +2914,21 @@ static void igb_setup_mrqc(struct igb_adapter *adapter)
 		0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
 		0xae, 0x7b, 0x30, 0xb4,	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
 		0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa };
+	/* 0x6d5a repeated: the hash of (src, dst) equals the hash of (dst, src) */
+	static const u8 rsshash_symmetric[40] = {
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+		0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a };
+	const u8 *key = (adapter->flags & IGB_FLAG_RSS_SYMMETRIC) ?
+			rsshash_symmetric : rsshash;
 
 	/* Fill out hash function seeds */
 	for (j = 0; j < 10; j++) {
-		u32 rsskey = rsshash[(j * 4)];
-		rsskey |= rsshash[(j * 4) + 1] << 8;
-		rsskey |= rsshash[(j * 4) + 2] << 16;
-		rsskey |= rsshash[(j * 4) + 3] << 24;
+		u32 rsskey = key[(j * 4)];
+		rsskey |= key[(j * 4) + 1] << 8;
+		rsskey |= key[(j * 4) + 2] << 16;
+		rsskey |= key[(j * 4) + 3] << 24;
 		E1000_WRITE_REG_ARRAY(hw, E1000_RSSRK(0), j, rsskey);
 	}
 
@@ -5848,6 +5869,19 @@ void igb_ring_irq_enable(struct igb_q_vector *q_vector)
 			igb_set_itr(q_vector);
 		else
 			igb_update_ring_itr(q_vector);
+#ifdef HAVE_PF_RING
+		if (q_vector->rx.ring) {
+			pfring_device_tuning *tuning = pf_ring_device_tuning(adapter->netdev);
+			u16 queue = q_vector->rx.ring->queue_index;
+
+			/* user ceiling on the interval the adaptive algorithm picks */
+			if (tuning && (queue < MAX_NUM_RX_CHANNELS) && tuning->max_itr_usecs[queue]
+			    && (q_vector->itr_val > PF_RING_USECS_TO_ITR(tuning->max_itr_usecs[queue]))) {
+				q_vector->itr_val = PF_RING_USECS_TO_ITR(tuning->max_itr_usecs[queue]);
+				q_vector->set_itr = 1;
+			}
+		}
+#endif
 	}
 
 	if (!test_bit(__IGB_DOWN, &adapter->state)) {
@@ -5867,6 +5901,22 @@ static int igb_poll(struct napi_struct *napi, int budget)
 {
 	struct igb_q_vector *q_vector = container_of(napi, struct igb_q_vector, napi);
 	bool clean_complete = true;
+	int rx_budget = budget;
+#ifdef HAVE_PF_RING
+	pfring_device_tuning *tuning = pf_ring_device_tuning(q_vector->adapter->netdev);
+	u16 queue = q_vector->rx.ring ? q_vector->rx.ring->queue_index : 0;
+	bool pf_ring_busy = false;
+
+	if (tuning && q_vector->rx.ring && (queue < MAX_NUM_RX_CHANNELS)) {
+		if (tuning->napi_budget[queue])
+			rx_budget = min_t(int, budget, tuning->napi_budget[queue]);
+
+		/* a ring fed by this queue is full: let the consumer catch up */
+		if (tuning->busy_itr_usecs
+		    && test_and_clear_bit(queue, &tuning->busy_queues))
+			pf_ring_busy = true;
+	}
+#endif
 
 #ifdef IGB_DCA
 	if (q_vector->adapter->flags & IGB_FLAG_DCA_ENABLED)
@@ -5876,13 +5926,31 @@ static int igb_poll(struct napi_struct *napi, int budget)
 		clean_complete = igb_clean_tx_irq(q_vector);
 
 	if (q_vector->rx.ring)
-		clean_complete &= igb_clean_rx_irq(q_vector, budget);
+		clean_complete &= igb_clean_rx_irq(q_vector, rx_budget);
 
 #ifndef HAVE_NETDEV_NAPI_LIST
 	/* if netdev is disabled we need to stop polling */
 	if (!netif_running(q_vector->adapter->netdev))
 		clean_complete = true;
 
+#endif
+#ifdef HAVE_PF_RING
+	if (pf_ring_busy) {
+		/*
+		 * Stop polling and throttle the queue: the NIC buffers (or
+		 * drops in hardware) until the next interrupt instead of
+		 * burning the CPU the application needs to drain its ring.
+		 * Written now on purpose, to restart the EITR timer.
+		 */
+		napi_complete(napi);
+		q_vector->itr_val = PF_RING_USECS_TO_ITR(tuning->busy_itr_usecs);
+		q_vector->set_itr = 1;
+		igb_write_itr(q_vector);
+		igb_ring_irq_enable(q_vector);
+
+		return 0;
+	}
+
 #endif
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
@@ -6760,6 +6828,61 @@ static int pf_ring_handle_skb(struct igb_q_vector *q_vector, struct sk_buff *skb
 
   return(-1);
 }
+
+/*
+  transparent_mode=2: the packets never reach the stack, so a packet that
+  fits the skb data buffer (all of it with packet split disabled, header
+  only packets otherwise) goes to PF_RING straight from it and the skb
+  stays in the ring, mapped, for the next packet. Returns the length of
+  the consumed packet, 0 when it has to take the skb path.
+*/
+static unsigned int pf_ring_handle_rx_buffer(struct igb_q_vector *q_vector,
+				     struct igb_ring *rx_ring,
+				     union e1000_adv_rx_desc *rx_desc,
+				     struct igb_rx_buffer *buffer_info,
+				     struct sk_buff *skb) {
+  struct net_device *netdev = netdev_ring(rx_ring);
+  struct pfring_hooks *hook = (struct pfring_hooks*)netdev->pfring_ptr;
+  unsigned int len, dma_len;
+  u32 rxhash = 0;
+
+  if(!hook || (hook->magic != PF_RING) || !hook->buffer_rx_ring_handler
+     || (*hook->transparent_mode != driver2pf_ring_non_transparent))
+    return(0);
+
+  if(skb_is_nonlinear(skb) || !buffer_info->dma
+     || !igb_test_staterr(rx_desc, E1000_RXD_STAT_EOP)
+     || igb_test_staterr(rx_desc, E1000_RXDEXT_ERR_FRAME_ERR_MASK))
+    return(0);
+
+#ifdef HAVE_HW_TIME_STAMP
+  if(igb_test_staterr(rx_desc, E1000_RXDADV_STAT_TSIP | E1000_RXDADV_STAT_TS))
+    return(0); /* igb_rx_hwtstamp() sets the time PF_RING reads from the skb */
+#endif
+
+#ifdef CONFIG_IGB_DISABLE_PACKET_SPLIT
+  len = le16_to_cpu(rx_desc->wb.upper.length), dma_len = rx_ring->rx_buffer_len;
+#else
+  if(rx_desc->wb.upper.length)
+    return(0); /* Payload in the page */
+
+  len = igb_get_hlen(rx_desc), dma_len = IGB_RX_HDR_LEN;
+#endif
+
+#ifdef NETIF_F_RXHASH
+  if(netdev->features & NETIF_F_RXHASH) /* As igb_rx_hash() */
+    rxhash = le32_to_cpu(rx_desc->wb.lower.hi_dword.rss);
+#endif
+
+  dma_sync_single_for_cpu(rx_ring->dev, buffer_info->dma, dma_len, DMA_FROM_DEVICE);
+  hook->buffer_rx_ring_handler(netdev, skb->data, len,
+			       rx_ring->queue_index, q_vector->adapter->num_rx_queues,
+			       rxhash);
+  dma_sync_single_for_device(rx_ring->dev, buffer_info->dma, dma_len, DMA_FROM_DEVICE);
+
+  buffer_info->skb = skb;
+  return(len);
+}
 #endif
 
 
@@ -6798,6 +6921,20 @@ static bool igb_clean_rx_irq(struct igb_q_vector *q_vector, int budget)
 		 */
 		rmb();
 
+#ifdef HAVE_PF_RING
+		{
+			unsigned int len = pf_ring_handle_rx_buffer(q_vector, rx_ring, rx_desc,
+								    buffer_info, skb);
+
+			if (len) {
+				total_bytes += len;
+				total_packets++;
+				budget--;
+				goto next_desc;
+			}
+		}
+
+#endif
 #ifdef CONFIG_IGB_DISABLE_PACKET_SPLIT
 		__skb_put(skb, le16_to_cpu(rx_desc->wb.upper.length));
 		dma_unmap_single(rx_ring->dev, buffer_info->dma,
@@ -136,6 +136,17 @@ IGB_PARAM(LLISize, "Low Latency Interrupt on Packet Size (0-1500), default 0=off
  */
 IGB_PARAM(RSS, "Number of Receive-Side Scaling Descriptor Queues (0-8), default 1=number of cpus");
 
+/* SymmetricRSS (Symmetric RSS hash key)
+ *
+ * Valid Range: 0-1
+ *  - 0 - the default key: the two directions of a connection may land
+ *        on different queues
+ *  - 1 - a symmetric key: both directions land on the same queue
+ *
+ * Default Value:  0
+ */
+IGB_PARAM(SymmetricRSS, "Symmetric Receive-Side Scaling key, both directions of a flow on the same queue (0,1), default 0");
+
 #define DEFAULT_RSS       1
 #define MAX_RSS           ((adapter->hw.mac.type == e1000_82575) ? 4 : 8)
 #define MIN_RSS           0
@@ -577,6 +588,23 @@ void __devinit igb_check_options(struct igb_adapter *adapter)
 		} else {
 			adapter->rss_queues = opt.def;
 		}
+#endif
+	}
+	{ /* SymmetricRSS - Symmetric RSS hash key */
+		struct igb_option opt = {
+			.type = enable_option,
+			.name = "SymmetricRSS - Symmetric RSS hash key",
+			.err  = "defaulting to Disabled",
+			.def  = OPTION_DISABLED
+		};
+#ifdef module_param_array
+		if (num_SymmetricRSS > bd) {
+#endif
+			unsigned int sym = SymmetricRSS[bd];
+			igb_validate_option(&sym, &opt, adapter);
+			adapter->flags |= sym ? IGB_FLAG_RSS_SYMMETRIC : 0;
+#ifdef module_param_array
+		}
 #endif
 	}
 	{ /* QueuePairs - Enable TX/RX queue pairs for interrupt handling */
@@ -601,6 +601,7 @@ struct ixgbe_adapter {
 #define IXGBE_FLAG2_FDIR_REQUIRES_REINIT         (u32)(1 << 9)
 #define IXGBE_FLAG2_RSS_FIELD_IPV4_UDP           (u32)(1 << 10)
 #define IXGBE_FLAG2_RSS_FIELD_IPV6_UDP           (u32)(1 << 11)
+#define IXGBE_FLAG2_RSS_SYMMETRIC                (u32)(1 << 12)
 
 	/* Tx fast path data */
 	int num_tx_queues;
@@ -1727,6 +1727,56 @@ static int pf_ring_handle_skb(struct ixgbe_q_vector *q_vector, struct sk_buff *s
 
   return(-1);
 }
+
+/* NAPI/ITR controls of /proc/net/pf_ring/dev/<dev>/tuning, NULL without PF_RING */
+static inline pfring_device_tuning *pf_ring_device_tuning(struct net_device *netdev) {
+  struct pfring_hooks *hook = (struct pfring_hooks*)netdev->pfring_ptr;
+
+  if(hook && (hook->magic == PF_RING) && hook->device_tuning)
+    return(hook->device_tuning(netdev->ifindex));
+
+  return(NULL);
+}
+
+/* The EITR interval in the q_vector->itr units (usec * 4) */
+#define PF_RING_USECS_TO_ITR(usecs) min_t(u32, (usecs) << 2, IXGBE_MAX_EITR)
+
+/*
+  transparent_mode=2: the packets never reach the stack, so a single buffer
+  packet goes to PF_RING straight from its RX buffer, which is then given
+  back to the NIC unchanged: no sk_buff is built and freed. Returns true when
+  the packet has been consumed; jumbo/RSC and errored frames take the skb path.
+*/
+static bool pf_ring_handle_rx_buffer(struct ixgbe_q_vector *q_vector,
+				     struct ixgbe_ring *rx_ring,
+				     union ixgbe_adv_rx_desc *rx_desc,
+				     void *data, dma_addr_t dma, unsigned int dma_len) {
+  struct net_device *netdev = netdev_ring(rx_ring);
+  struct pfring_hooks *hook = (struct pfring_hooks*)netdev->pfring_ptr;
+  u32 rxhash = 0;
+
+  if(!hook || (hook->magic != PF_RING) || !hook->buffer_rx_ring_handler
+     || (*hook->transparent_mode != driver2pf_ring_non_transparent))
+    return(false);
+
+  if(!ixgbe_test_staterr(rx_desc, IXGBE_RXD_STAT_EOP)
+     || ixgbe_get_rsc_state(rx_ring, rx_desc)
+     || ixgbe_test_staterr(rx_desc, IXGBE_RXDADV_ERR_FRAME_ERR_MASK))
+    return(false);
+
+#ifdef NETIF_F_RXHASH
+  if(netdev->features & NETIF_F_RXHASH) /* As ixgbe_rx_hash() */
+    rxhash = le32_to_cpu(rx_desc->wb.lower.hi_dword.rss);
+#endif
+
+  dma_sync_single_for_cpu(rx_ring->dev, dma, dma_len, DMA_FROM_DEVICE);
+  hook->buffer_rx_ring_handler(netdev, data, le16_to_cpu(rx_desc->wb.upper.length),
+			       rx_ring->queue_index, q_vector->adapter->num_rx_queues,
+			       rxhash);
+  dma_sync_single_for_device(rx_ring->dev, dma, dma_len, DMA_FROM_DEVICE);
+
+  return(true);
+}
 #endif
 
 /**
@@ -1779,6 +1829,23 @@ static bool ixgbe_clean_rx_irq_bb(struct ixgbe_q_vector *q_vector,
 		prefetch(page_address(rx_buffer_info->page) +
 			 rx_buffer_info->page_offset);
 
+#ifdef HAVE_PF_RING
+		/* the page half stays mapped: no skb, no page flip */
+		if (!skb && pf_ring_handle_rx_buffer(q_vector, rx_ring, rx_desc,
+						     page_address(rx_buffer_info->page) +
+						     rx_buffer_info->page_offset,
+						     rx_buffer_info->page_dma,
+						     PAGE_SIZE / 2)) {
+			total_rx_bytes += le16_to_cpu(rx_desc->wb.upper.length);
+			total_rx_packets++;
+			ntc++;
+			if (ntc == rx_ring->count)
+				ntc = 0;
+			budget--;
+			goto next_desc;
+		}
+
+#endif
 		/* allocate a skb to store the frags */
 		if (!skb) {
 #ifndef IXGBE_NO_LRO
@@ -2075,6 +2142,24 @@ static bool ixgbe_clean_rx_irq_ps(struct ixgbe_q_vector *q_vector,
 		 */
 		rmb();
 
+#ifdef HAVE_PF_RING
+		/* the skb stays in the ring, mapped, for the next packet */
+		if (!ring_is_ps_enabled(rx_ring) && !skb_is_nonlinear(skb)
+		    && rx_buffer_info->dma
+		    && pf_ring_handle_rx_buffer(q_vector, rx_ring, rx_desc,
+						skb->data, rx_buffer_info->dma,
+						rx_ring->rx_buf_len)) {
+			rx_buffer_info->skb = skb;
+			total_rx_bytes += le16_to_cpu(rx_desc->wb.upper.length);
+			total_rx_packets++;
+			i++;
+			if (i == rx_ring->count)
+				i = 0;
+			budget--;
+			goto next_desc;
+		}
+
+#endif
 		pkt_is_rsc = ixgbe_get_rsc_state(rx_ring, rx_desc);
 
 		prefetch(skb->data);
@@ -2535,6 +2620,17 @@ static void ixgbe_set_itr(struct ixgbe_q_vector *q_vector)
 		break;
 	}
 
+#ifdef HAVE_PF_RING
+	if (q_vector->rx.ring) {
+		pfring_device_tuning *tuning = pf_ring_device_tuning(q_vector->adapter->netdev);
+		u16 queue = q_vector->rx.ring->queue_index;
+
+		/* user ceiling on the interval the adaptive algorithm picks */
+		if (tuning && (queue < MAX_NUM_RX_CHANNELS) && tuning->max_itr_usecs[queue])
+			new_itr = min_t(u32, new_itr, PF_RING_USECS_TO_ITR(tuning->max_itr_usecs[queue]));
+	}
+#endif
+
 	if (new_itr != q_vector->itr) {
 		/* do an exponential smoothing */
 		new_itr = (10 * new_itr * q_vector->itr) /
@@ -2907,8 +3003,23 @@ static int ixgbe_poll(struct napi_struct *napi, int budget)
 			       container_of(napi, struct ixgbe_q_vector, napi);
 	struct ixgbe_adapter *adapter = q_vector->adapter;
 	struct ixgbe_ring *ring;
-	int per_ring_budget;
+	int per_ring_budget, rx_budget = budget;
 	bool clean_complete = true;
+#ifdef HAVE_PF_RING
+	pfring_device_tuning *tuning = pf_ring_device_tuning(adapter->netdev);
+	u16 queue = q_vector->rx.ring ? q_vector->rx.ring->queue_index : 0;
+	bool pf_ring_busy = false;
+
+	if (tuning && (queue < MAX_NUM_RX_CHANNELS)) {
+		if (tuning->napi_budget[queue])
+			rx_budget = min_t(int, budget, tuning->napi_budget[queue]);
+
+		/* a ring fed by this queue is full: let the consumer catch up */
+		if (tuning->busy_itr_usecs
+		    && test_and_clear_bit(queue, &tuning->busy_queues))
+			pf_ring_busy = true;
+	}
+#endif
 
 	if (adapter->flags & IXGBE_FLAG_DCA_ENABLED)
 		ixgbe_update_dca(q_vector);
@@ -2919,9 +3030,9 @@ static int ixgbe_poll(struct napi_struct *napi, int budget)
 	/* attempt to distribute budget to each queue fairly, but don't allow
 	 * the budget to go below 1 because we'll exit polling */
 	if (q_vector->rx.count > 1)
-		per_ring_budget = max(budget/q_vector->rx.count, 1);
+		per_ring_budget = max(rx_budget/q_vector->rx.count, 1);
 	else
-		per_ring_budget = budget;
+		per_ring_budget = rx_budget;
 
 	for (ring = q_vector->rx.ring; ring != NULL; ring = ring->next)
 		clean_complete &= ixgbe_clean_rx_irq(q_vector, ring,
@@ -2931,6 +3042,24 @@ static int ixgbe_poll(struct napi_struct *napi, int budget)
 	if (!netif_running(adapter->netdev))
 		clean_complete = true;
 
+#endif
+#ifdef HAVE_PF_RING
+	if (pf_ring_busy) {
+		/*
+		 * Stop polling and throttle the queue: the NIC buffers (or
+		 * drops in hardware) until the next interrupt instead of
+		 * burning the CPU the application needs to drain its ring.
+		 * The adaptive ITR brings the rate back afterwards.
+		 */
+		napi_complete(napi);
+		q_vector->itr = PF_RING_USECS_TO_ITR(tuning->busy_itr_usecs);
+		ixgbe_write_eitr(q_vector);
+		if (!test_bit(__IXGBE_DOWN, &adapter->state))
+			ixgbe_irq_enable_queues(adapter, ((u64)1 << q_vector->v_idx));
+
+		return 0;
+	}
+
 #endif
 	/* If all work not completed, return budget and keep polling */
 	if (!clean_complete)
@@ -3591,6 +3720,12 @@ static void ixgbe_setup_mrqc(struct ixgbe_adapter *adapter)
 	static const u32 seed[10] = { 0xE291D73D, 0x1805EC6C, 0x2A94B30D,
 			  0xA54F2BEC, 0xEA49AF7C, 0xE214AD3D, 0xB855AABE,
 			  0x6A3E67EA, 0x14364D17, 0x3BED200D};
+	/* 0x6d5a repeated: the hash of (src, dst) equals the hash of (dst, src) */
+	static const u32 seed_symmetric[10] = { 0x5A6D5A6D, 0x5A6D5A6D,
+			  0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D,
+			  0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D, 0x5A6D5A6D};
+	const u32 *key = (adapter->flags2 & IXGBE_FLAG2_RSS_SYMMETRIC) ?
+			 seed_symmetric : seed;
 	u32 mrqc = 0, reta = 0;
 	u32 rxcsum;
 	int i, j;
@@ -3605,7 +3740,7 @@ static void ixgbe_setup_mrqc(struct ixgbe_adapter *adapter)
 
 	/* Fill out hash function seeds */
 	for (i = 0; i < 10; i++)
-		IXGBE_WRITE_REG(hw, IXGBE_RSSRK(i), seed[i]);
+		IXGBE_WRITE_REG(hw, IXGBE_RSSRK(i), key[i]);
 
 	/* Fill out redirection table */
 	for (i = 0, j = 0; i < 128; i++, j++) {
@@ -11,6 +11,8 @@
 
 #ifdef __KERNEL__
 #include <linux/in6.h>
+#include <linux/hrtimer.h>
+#include <linux/rcupdate.h>
 #else
 #include <netinet/in.h>
 #endif /* __KERNEL__ */
@@ -25,12 +27,12 @@
 
 #define RING_MAGIC
 #define RING_MAGIC_VALUE             0x88
-#define RING_FLOWSLOT_VERSION          13
+#define RING_FLOWSLOT_VERSION          17
 
 #define DEFAULT_BUCKET_LEN            128
 #define MAX_NUM_DEVICES               256
 
-// #define MAX_NUM_RING_SOCKETS          64 /* see MAX_NUM_LIST_ELEMENTS */
+// #define MAX_NUM_RING_SOCKETS          256 /* see MAX_NUM_LIST_ELEMENTS */
 
 /* Watermark */
 #define DEFAULT_MIN_PKT_QUEUED        128
@@ -76,6 +78,30 @@
 #define SO_ATTACH_DNA_CLUSTER            129
 #define SO_WAKE_UP_DNA_CLUSTER_SLAVE     130
 #define SO_ENABLE_RX_PACKET_BOUNCE       131
+#define SO_SET_CLUSTER_INDIRECTION       132
+#define SO_SET_PERCPU_RINGS              133 /* # sub-rings, 0 = one per CPU */
+#define SO_SET_METADATA_ONLY             134
+#define SO_SET_PKT_HEADER_FORMAT         135 /* PFRING_COMPACT_HDR_V1 */
+#define SO_SET_POLL_COALESCING           136 /* struct pfring_poll_coalescing */
+#define SO_SET_RING_MEM_POLICY           137 /* PFRING_MEM_* */
+#define SO_SET_OVERLOAD_POLICY           138 /* struct pfring_overload_policy */
+#define SO_SET_HASH_RULES_IDLE_TIMEOUT   139 /* sec, 0 = SO_PURGE_IDLE_HASH_RULES only */
+#define SO_SET_HASH_RULES_TABLE          140 /* struct pfring_hash_rules_table */
+#define SO_SET_PREFIX_BLOCKLIST          141 /* struct pfring_prefix_blocklist + prefixes */
+#define SO_ADD_HASH_FILTERING_RULES      142 /* struct pfring_hash_rules_bulk + rules */
+#define SO_REMOVE_HASH_FILTERING_RULES   143 /* struct pfring_hash_rules_bulk + rules */
+#define SO_SET_SHARED_RING               144 /* struct pfring_shared_ring */
+#define SO_ATTACH_SHARED_RING            145 /* u_int32_t shared ring id */
+#define SO_SET_INSERT_TIMESTAMP          146 /* u_int32_t 1 = on, see pfring_latency_histogram */
+#define SO_SET_TX_RING                   147 /* struct pfring_tx_ring_req, see FlowSlotTxInfo */
+#define SO_FLUSH_TX_RING                 148 /* sends the packets queued on the TX ring */
+#define SO_SET_SLOT_LAYOUT               149 /* PFRING_SLOT_* */
+#define SO_SET_VPFRING_COALESCING        150 /* struct vpfring_coalescing */
+#define SO_SET_TIMESTAMP_MODE            151 /* u_int32_t PFRING_TSTAMP_* */
+#define SO_SET_FLOW_SAMPLING_RATE        152 /* u_int32_t N: 1 in N flows, 1 = no sampling */
+#define SO_SET_FLOW_CACHE_LIFETIME       153 /* u_int32_t msec, 0 = no wildcard verdict cache */
+#define SO_ADD_HW_FILTERING_RULES        154 /* struct pfring_hw_rules_bulk + rules */
+#define SO_DEL_HW_FILTERING_RULES        155 /* struct pfring_hw_rules_bulk + rule ids */
 
 /* Get */
 #define SO_GET_RING_VERSION              170
@@ -93,6 +119,10 @@
 #define SO_GET_DEVICE_TYPE               182
 #define SO_GET_EXTRA_DMA_MEMORY          183
 #define SO_GET_BOUND_DEVICE_ID           184
+#define SO_GET_RING_STATS_EXT            185 /* struct pfring_ring_stats_ext */
+#define SO_GET_NUM_HW_FILTERS            186 /* u_int16_t: hardware filters on the bound device */
+#define SO_GET_HASH_FILTERING_RULES_STATS 187 /* struct pfring_hash_rules_stats_bulk + records */
+#define SO_GET_LOOPBACK_INJECT           188 /* struct pfring_loopback_inject: benchmark only */
 
 /* Map */
 #define SO_MAP_DNA_DEVICE                190
@@ -164,6 +194,22 @@ typedef union {
 #define host6_peer_a host_peer_a.v6
 #define host6_peer_b host_peer_b.v6
 
+/*
+  extended_hdr.pkt_hash. The kernel and libpfring compute the same values:
+  - toeplitz: RSS hash (IPv4/IPv6 addresses, then ports for TCP and UDP,
+              network byte order) with the symmetric 0x6D5A key by default
+  - crc32c:   CRC32C (Castagnoli) of proto, then the two <address, port>
+              endpoints, lowest first: symmetric whatever the key
+*/
+typedef enum {
+  pkt_hash_sum = 0, /* legacy: sum of vlan, proto, addresses and ports */
+  pkt_hash_toeplitz,
+  pkt_hash_crc32c
+} pkt_hash_type;
+
+#define RSS_KEY_LEN                40
+#define RSS_SYMMETRIC_KEY_WORD     0x6D5A
+
 #define GTP_SIGNALING_PORT         2123
 #define GTP_U_DATA_PORT            2152
 #define NO_GTP_TUNNEL_ID     0xFFFFFFFF
@@ -184,7 +230,8 @@ typedef struct {
 
 typedef enum {
   long_pkt_header = 0, /* it includes PF_RING-extensions over the original pcap header */
-  short_pkt_header     /* Short pcap-like header */
+  short_pkt_header,    /* Short pcap-like header */
+  compact_pkt_header   /* struct pfring_compact_pkthdr */
 } pkt_header_len;
 
 struct pkt_parsing_info {
@@ -246,13 +293,278 @@ struct pfring_pkthdr {
 
 /* *********************************** */
 
+/*
+  Compact slot header (SO_SET_PKT_HEADER_FORMAT): 32 bytes instead of a
+  pfring_pkthdr, then for IPv6 the addresses (src then dst, as parsed;
+  src_ip/dst_ip are then 0), then caplen packet bytes. The layout is
+  versioned: a kernel that does not know the requested version refuses
+  it. SO_SET_METADATA_ONLY is the same header with no packet bytes: for
+  counting, the ring holds 4-5 times the packets of a long header ring of
+  the same memory.
+*/
+#define PFRING_COMPACT_HDR_V1      1
+
+#define PFRING_COMPACT_RX          0x01 /* received, not transmitted */
+#define PFRING_COMPACT_IPV4        0x02
+#define PFRING_COMPACT_IPV6        0x04 /* the trailer is present */
+#define PFRING_COMPACT_TRAILER_LEN 32
+
+struct pfring_compact_pkthdr {
+  u_int64_t timestamp_ns;
+  u_int32_t src_ip, dst_ip;     /* IPv4, host byte order */
+  u_int16_t src_port, dst_port; /* non IP frames: src_port is the Ethernet type */
+  u_int16_t len, caplen;        /* len is off wire, saturated at 64K */
+  u_int32_t pkt_hash;
+  u_int8_t  proto, tcp_flags;
+  u_int8_t  l4_offset;          /* from the Ethernet header, 0 = unknown */
+  u_int8_t  flags;              /* PFRING_COMPACT_* | (l3_offset / 2) << 3 */
+};
+
+#define pfring_compact_l3_offset(h)   (((h)->flags >> 3) << 1)
+#define pfring_compact_data_offset(h) (sizeof(struct pfring_compact_pkthdr) + (((h)->flags & PFRING_COMPACT_IPV6) ? PFRING_COMPACT_TRAILER_LEN : 0))
+#define pfring_compact_slot_len(h)    (pfring_compact_data_offset(h) + (h)->caplen)
+
+/* *********************************** */
+
+/*
+  SO_SET_POLL_COALESCING: poll() returns once num_pkts packets are queued
+  (the poll watermark) or usec microseconds after the first packet that
+  did not reach it, whichever comes first.
+*/
+#define MAX_POLL_COALESCING_USEC 1000000
+
+struct pfring_poll_coalescing {
+  u_int32_t num_pkts;
+  u_int32_t usec; /* 0 = no time bound (watermark only) */
+};
+
+/* *********************************** */
+
+/*
+  SO_SET_RING_MEM_POLICY, before the first mmap(). PFRING_MEM_NUMA_LOCAL:
+  the ring pages come from the NUMA node of the bound NIC.
+  PFRING_MEM_CONTIGUOUS: the ring is one physically contiguous block (up
+  to MAX_ORDER), which the kernel writes through its large page linear
+  mapping instead of 4 KB vmalloc() pages. What cannot be honoured falls
+  back to the default allocation.
+*/
+#define PFRING_MEM_NUMA_LOCAL  0x01
+#define PFRING_MEM_CONTIGUOUS  0x02
+
+/* *********************************** */
+
+/*
+  SO_SET_SLOT_LAYOUT, before the first mmap(). PFRING_SLOT_ALIGNED: every
+  slot starts on a PFRING_SLOT_ALIGN boundary, so that the consumer never
+  reads a header split over two cache lines; the readers step over the
+  slots with pfring_slot_align(), a no-op for the packed layout
+  (slot_align_mask 0). PFRING_SLOT_NT_COPY: the kernel writes the slots
+  with non-temporal stores where the architecture has them, so that the
+  softirq CPU does not fill its cache with lines only the consumer reads.
+*/
+#define PFRING_SLOT_ALIGNED    0x01
+#define PFRING_SLOT_NT_COPY    0x02
+
+#define PFRING_SLOT_ALIGN      64
+
+/* *********************************** */
+
+/*
+  SO_SET_TIMESTAMP_MODE: the time a socket needs in its slots. The clock is
+  read once per packet, for the finest mode of the sockets of the device,
+  so a socket counting only (PFRING_TSTAMP_NONE, ts left 0) takes the
+  clock read out of the softirq path when the device has no other socket.
+  PFRING_TSTAMP_COARSE: the skb time when the stack has set one, else the
+  time of the last tick. PFRING_TSTAMP_HW, the default: the NIC time when
+  there is one, the skb time otherwise.
+*/
+#define PFRING_TSTAMP_NONE     0
+#define PFRING_TSTAMP_COARSE   1
+#define PFRING_TSTAMP_NS       2
+#define PFRING_TSTAMP_HW       3
+
+/* *********************************** */
+
+/*
+  SO_SET_FLOW_SAMPLING_RATE: all the packets, both directions, of 1 in N
+  flows, those whose symmetric pkt_hash_crc32c of the 5-tuple is below
+  (2^32 - 1) / N (pfring_flow_sampled()): 32 bit, no 64 bit division in
+  the kernel. The packets without an IP header are
+  one flow. Libpfring makes the same choice for the DNA rings, so the
+  sampled flows are the same whichever way they are read, and the
+  per-flow counts scale by exactly pfring_flow_sampling_scale().
+*/
+#define pfring_flow_sampling_threshold(rate) \
+  (((rate) <= 1) ? 0 : (0xFFFFFFFFU / (u_int32_t)(rate))) /* 0 = no sampling */
+#define pfring_flow_sampled(hash, threshold) ((hash) < (threshold))
+#define pfring_flow_sampling_scale(threshold) ((double)0x100000000ULL / (threshold))
+
+/* len: of one slot, 32 bit */
+#define pfring_slot_align(si, len)  (((len) + (si)->slot_align_mask) & ~(si)->slot_align_mask)
+
+/* *********************************** */
+
+/*
+  SO_SET_OVERLOAD_POLICY: decided before the BPF filter, the rules and
+  the plugins of the ring. PFRING_OVERLOAD_EARLY_DROP: a packet finding
+  no room is counted in tot_lost right away. Above sample_threshold % of
+  occupancy only 1 in N packets is kept, N growing linearly up to
+  max_sample_rate when the ring is full: the others are counted in
+  tot_sampled and the current N is in overload_sample_rate.
+*/
+#define PFRING_OVERLOAD_EARLY_DROP 0x01
+
+struct pfring_overload_policy {
+  u_int32_t flags;            /* PFRING_OVERLOAD_* */
+  u_int32_t sample_threshold; /* 1..99, 0 = no sampling */
+  u_int32_t max_sample_rate;  /* >= 2 with sampling */
+};
+
+/*
+  SO_SET_SHARED_RING: the packets the kernel copies into this ring are
+  also read by up to MAX_SHARED_RING_READERS other sockets
+  (SO_ATTACH_SHARED_RING), each with its own cursor: the second page of
+  its FlowSlotInfo, the only page it can write. With
+  PFRING_SHARED_RING_WAIT_SLOWEST a slot is reused once every reader has
+  read it (the packet is lost otherwise). With
+  PFRING_SHARED_RING_DROP_SLOWEST the reader holding the ring back is
+  cut loose instead: SHARED_RING_LAPPED is set in its
+  shared_ring_flags and the library moves it to shared_ring_resync.
+*/
+#define MAX_SHARED_RING_READERS          8
+#define PF_RING_SHARED_CURSOR_MEM_ID     7 /* mmap() page offset of a reader's cursor */
+
+/*
+  shared_ring_resync: the position of the owner in one 64 bit word, the
+  insert offset (rings up to 1 TB) and the low bits of tot_insert, enough
+  for the reader to rebuild the rest from its current tot_insert.
+*/
+#define SHARED_RING_RESYNC_OFF_BITS      40
+#define SHARED_RING_RESYNC(tot_insert, off) \
+  ((((u_int64_t)(tot_insert)) << SHARED_RING_RESYNC_OFF_BITS) | ((u_int64_t)(off) & SHARED_RING_RESYNC_OFF_MASK))
+#define SHARED_RING_RESYNC_OFF_MASK      ((((u_int64_t)1) << SHARED_RING_RESYNC_OFF_BITS) - 1)
+#define SHARED_RING_RESYNC_OFF(r)        ((r) & SHARED_RING_RESYNC_OFF_MASK)
+#define SHARED_RING_RESYNC_INSERT(r)     ((r) >> SHARED_RING_RESYNC_OFF_BITS) /* low bits of tot_insert */
+#define SHARED_RING_RESYNC_INSERT_MASK   ((((u_int64_t)1) << (64 - SHARED_RING_RESYNC_OFF_BITS)) - 1)
+
+#define PFRING_SHARED_RING_WAIT_SLOWEST  0
+#define PFRING_SHARED_RING_DROP_SLOWEST  1
+
+struct pfring_shared_ring {
+  u_int32_t shared_ring_id; /* != 0 */
+  u_int32_t policy;         /* PFRING_SHARED_RING_* */
+};
+
+/*
+  SO_SET_INSERT_TIMESTAMP: timestamp_ns of the slot header is the
+  CLOCK_REALTIME ns at which the kernel inserted the packet instead of the
+  packet timestamp (ts is left as it is). The library then keeps these
+  log2 histograms in the userland page of the (first) ring, also printed
+  in /proc/net/pf_ring. Bucket i > 0 counts values in [2^(i-1), 2^i), the
+  last one everything above, bucket 0 zero (or negative delays).
+*/
+#define PFRING_LATENCY_BUCKETS 32
+
+struct pfring_latency_histogram {
+  u_int64_t delay[PFRING_LATENCY_BUCKETS]; /* ns from insert to read */
+  u_int64_t fill[PFRING_LATENCY_BUCKETS];  /* pkts queued when read */
+};
+
+/*
+  SO_GET_LOOPBACK_INJECT: the calling thread inserts num_pkts synthetic
+  UDP packets of pkt_len bytes into the ring of the socket, from kernel
+  context and through the same parsing and copy as the received packets
+  (softirqs disabled), spread over num_flows source ports. It returns
+  once they have all been offered, or on a signal: a consumer must read
+  the ring meanwhile from another thread. The kernel fills in the rest.
+*/
+struct pfring_loopback_inject {
+  u_int32_t num_pkts, pkt_len;  /* pkt_len: 60..1514 */
+  u_int32_t num_flows;          /* 0 = 1 */
+  u_int32_t inserted, dropped;  /* dropped: ring full */
+  u_int64_t elapsed_ns;
+};
+
+/*
+  SO_GET_RING_STATS_EXT: why the packets seen by the ring were not
+  queued. ring_full + early_drop == tot_lost and overload_sampled ==
+  tot_sampled of slots_info. max_queued: highest occupancy of a (sub-)ring
+  of num_slots slots since the previous SO_GET_RING_STATS_EXT.
+*/
+struct pfring_ring_stats_ext {
+  u_int64_t tot_pkts, tot_insert;
+  u_int64_t ring_full;        /* no free slot */
+  u_int64_t early_drop;       /* PFRING_OVERLOAD_EARLY_DROP */
+  u_int64_t overload_sampled; /* SO_SET_OVERLOAD_POLICY sampling */
+  u_int64_t sampled;          /* SO_SET_SAMPLING_RATE, SO_SET_FLOW_SAMPLING_RATE */
+  u_int64_t filtered;         /* BPF filter and filtering rules */
+  u_int64_t blocked;          /* SO_SET_PREFIX_BLOCKLIST */
+  u_int64_t consumer_lost;    /* shared ring reader lapped by the kernel */
+  u_int32_t num_slots, max_queued;
+};
+
+/*
+  /proc/net/pf_ring/stats: one binary record per ring, for monitoring
+  agents. Built from the per CPU counters under rcu_read_lock() only:
+  no formatting and no lock shared with the capture path. Records are
+  fixed size, read them with a buffer multiple of their size.
+*/
+#define PFRING_PROC_STATS_VERSION  1
+
+struct pfring_proc_ring_stats {
+  u_int16_t version;          /* PFRING_PROC_STATS_VERSION */
+  u_int16_t record_len;       /* sizeof(struct pfring_proc_ring_stats) */
+  u_int32_t ring_id;
+  u_int32_t pid;
+  int32_t   channel_id;       /* -1 = any channel */
+  u_int16_t cluster_id;       /* 0 = no cluster */
+  u_int8_t  active, pad;
+  char      device_name[16];
+  u_int64_t tot_pkts, tot_insert, tot_read;
+  u_int64_t ring_full, early_drop, sampled, filtered, blocked;
+  u_int64_t tot_fwd_ok, tot_fwd_notok;
+  u_int32_t num_slots, num_free_slots;
+};
+
+/* SO_SET_HASH_RULES_TABLE */
+struct pfring_hash_rules_table {
+  u_int32_t size;      /* initial buckets (rounded up to a power of 2), 0 = DEFAULT_RING_HASH_SIZE */
+  u_int32_t max_rules; /* hash rules per socket, 0 = no limit */
+};
+
+/*
+  SO_SET_PREFIX_BLOCKLIST: packets whose source is in one of the prefixes
+  are dropped before any filtering. The list replaces the previous one
+  (num_prefixes = 0 removes it).
+*/
+#define MAX_BLOCKLIST_PREFIXES  (1 << 20)
+
+struct pfring_blocklist_prefix {
+  ip_addr   addr;       /* like the rules: IPv4 host byte order, IPv6 network byte order */
+  u_int8_t  ip_version; /* 4 or 6 */
+  u_int8_t  prefix_len; /* bits */
+  u_int16_t reserved;
+};
+
+struct pfring_prefix_blocklist {
+  u_int32_t num_prefixes;
+  struct pfring_blocklist_prefix prefixes[0];
+};
+
+/* *********************************** */
+
 #define NO_PLUGIN_ID        0
 #define MAX_PLUGIN_ID      72
 #define MAX_PLUGIN_FIELDS  32
 
 /* ************************************************* */
 
-#define MAX_NUM_LIST_ELEMENTS  64 /* sizeof(bits_set) [see below] */
+/*
+  Readers (the packet path) walk the list without locking inside an RCU
+  read-side section; writers update slots in place under list_lock and
+  wait for a grace period before freeing a removed element
+*/
+#define MAX_NUM_LIST_ELEMENTS  256
 
 #ifdef __KERNEL__
 
@@ -313,6 +625,16 @@ typedef struct {
   u_int16_t plugin_id; /* ('0'=no plugin) id of the plugin associated with this rule */
 } filtering_rule_plugin_action;
 
+/*
+  rate_limit_packet_and_stop_rule_evaluation: token bucket, split evenly
+  across the online CPUs (one bucket per CPU, no shared state), so with
+  traffic spread unevenly over the RX queues less than pps may pass.
+*/
+typedef struct {
+  u_int32_t pps;   /* packets per second let through */
+  u_int32_t burst; /* packets let through at once after a pause, 0: pps / 10 */
+} filtering_rule_rate_limit;
+
 typedef enum {
   forward_packet_and_stop_rule_evaluation = 0,
   dont_forward_packet_and_stop_rule_evaluation,
@@ -323,7 +645,8 @@ typedef enum {
   reflect_packet_and_stop_rule_evaluation,
   reflect_packet_and_continue_rule_evaluation,
   bounce_packet_and_stop_rule_evaluation,
-  bounce_packet_and_continue_rule_evaluation
+  bounce_packet_and_continue_rule_evaluation,
+  rate_limit_packet_and_stop_rule_evaluation /* forward up to rate_limit, drop the excess */
 } rule_action_behaviour;
 
 typedef enum {
@@ -352,8 +675,20 @@ typedef enum {
 typedef struct {
   unsigned long jiffies_last_match;  /* Jiffies of the last rule match (updated by pf_ring) */
   struct net_device *reflector_dev;  /* Reflector device */
+  u_int64_t tot_reflected, tot_reflect_failed; /* reflect/bounce actions */
+  u_int64_t tot_pkts, tot_bytes;     /* Hash rules: matching packets (updated by pf_ring, not atomic) */
+  struct rule_cpu_stats *cpu_stats;  /* Per CPU counters of the above (kernel, alloc_percpu()), NULL
+					for the rules added from the packet path */
+  struct rule_rate_limit_cpu *rate_limit; /* Per CPU token buckets (kernel, alloc_percpu()) */
 } filtering_internals;
 
+/* Returned by pfring_get_(hash_)filtering_rule_stats() for rules without plugin */
+struct pfring_rule_reflect_stats {
+  u_int64_t tot_reflected;      /* sent (or queued when batching) to the reflector device */
+  u_int64_t tot_reflect_failed; /* device down, no memory or queue full */
+  u_int64_t tot_rate_passed, tot_rate_dropped; /* rate_limit_packet_and_stop_rule_evaluation */
+};
+
 typedef struct {
   u_int16_t rule_id;                 /* Rules are processed in order from lowest to higest id */
   rule_action_behaviour rule_action; /* What to do in case of match */
@@ -364,6 +699,7 @@ typedef struct {
   filtering_rule_core_fields     core_fields;
   filtering_rule_extended_fields extended_fields;
   filtering_rule_plugin_action   plugin_action;
+  filtering_rule_rate_limit      rate_limit;
   char reflector_device_name[REFLECTOR_NAME_LEN];
 
   filtering_internals internals;   /* PF_RING internal fields */
@@ -413,6 +749,22 @@ typedef struct {
   actually duplicated)
 */
 
+/*
+  Chelsio T4 (cxgb4) filters
+
+  IPv4 rules matched by the adapter filter engine: addresses are prefixes
+  (a mask length of 0 matches any address), a protocol or port of 0 matches
+  any. Matching packets are dropped (queue_id -1) or steered to queue_id.
+*/
+
+typedef struct {
+  u_int8_t  proto;
+  u_int32_t s_addr, d_addr;          /* host byte order */
+  u_int8_t  s_mask_len, d_mask_len;  /* 0..32 */
+  u_int16_t s_port, d_port;
+  u_int16_t queue_id;
+} chelsio_t4_filter_hw_rule;
+
 typedef enum {
   drop_rule,
   redirect_rule,
@@ -434,7 +786,8 @@ typedef struct {
 typedef enum {
   intel_82599_five_tuple_rule,
   intel_82599_perfect_filter_rule,
-  silicom_redirector_rule
+  silicom_redirector_rule,
+  chelsio_t4_filter_rule
 } hw_filtering_rule_type;
 
 typedef struct {
@@ -445,16 +798,51 @@ typedef struct {
     intel_82599_five_tuple_filter_hw_rule five_tuple_rule;
     intel_82599_perfect_filter_hw_rule perfect_rule;
     silicom_redirector_hw_rule redirector_rule;
+    chelsio_t4_filter_hw_rule t4_rule;
   } rule_family;
 } hw_filtering_rule;
 
 #define MAGIC_HW_FILTERING_RULE_REQUEST  0x29010020 /* deprecated? */
 
+/*
+  SO_ADD_HW_FILTERING_RULES/SO_DEL_HW_FILTERING_RULES: num_rules
+  hw_filtering_rule (add) or u_int16_t rule ids (delete) after the header.
+  The rules are programmed in order, with one driver call when the device
+  takes ETHTOOL_PFRING_SRXFTRLBULK (82599 rules only). Ids already there
+  (add) or missing (delete) are skipped; the first rule the device refuses
+  stops the batch. num_done is set to the rules applied: without skipped
+  ids, the first num_done.
+*/
+#define MAX_HW_RULES_BULK          1024 /* per call */
+
+struct pfring_hw_rules_bulk {
+  u_int32_t num_rules;
+  u_int32_t num_done; /* set by the kernel */
+  hw_filtering_rule rules[0];
+};
+
 #ifdef __KERNEL__
 
 #define ETHTOOL_PFRING_SRXFTCHECK 0x10000000
 #define ETHTOOL_PFRING_SRXFTRLDEL 0x10000031
 #define ETHTOOL_PFRING_SRXFTRLINS 0x10000032
+#define ETHTOOL_PFRING_SRXFTRLBULK 0x10000033 /* cmd.data: struct pfring_ethtool_bulk* */
+
+/*
+  ETHTOOL_PFRING_SRXFTRLBULK: num ETHTOOL_SRXCLSRLINS/DEL and
+  ETHTOOL_PFRING_SRXFTRLINS/DEL commands run in order by the driver,
+  under one acquisition of its filter lock. It stops at the first one
+  that fails and returns its error, num_done being the commands run.
+  -EOPNOTSUPP: the driver has no bulk path, one call per command.
+*/
+struct pfring_ethtool_bulk {
+  u_int32_t num;
+  u_int32_t num_done;           /* set by the driver */
+  struct ethtool_rxnfc *cmd;
+};
+
+/* ETHTOOL_PFRING_SRXFTCHECK reply of cxgb4 (82599: RING_MAGIC_VALUE) */
+#define CHELSIO_T4_MAGIC_VALUE    0x89
 
 #if defined(I82599_HW_FILTERING_SUPPORT) && (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,40))
 #define	FLOW_EXT 0x80000000
@@ -499,16 +887,23 @@ typedef int (*five_tuple_rule_handler)(struct pf_ring_socket *pfr,
 typedef int (*perfect_filter_hw_rule_handler)(struct pf_ring_socket *pfr,
 					      hw_filtering_rule *rule,
 					      hw_filtering_rule_command request);
+typedef int (*t4_filter_hw_rule_handler)(struct pf_ring_socket *pfr,
+					 hw_filtering_rule *rule,
+					 hw_filtering_rule_command request);
 
 typedef struct {
   five_tuple_rule_handler five_tuple_handler;
   perfect_filter_hw_rule_handler perfect_filter_handler;
+  t4_filter_hw_rule_handler t4_filter_handler;
 } hw_filtering_device_handler;
 
 /* *********************************** */
 
 /* Hash size used for precise packet matching */
 #define DEFAULT_RING_HASH_SIZE     4096
+#define MAX_RING_HASH_SIZE         (1 << 20)
+#define HASH_RULES_MAX_LOAD        2  /* rules per bucket before the table is doubled */
+#define HASH_RULES_RESIZE_BATCH    64 /* buckets moved to the doubled table per change */
 
 /*
  * The hashtable contains only perfect matches: no
@@ -523,11 +918,50 @@ typedef struct {
 
   rule_action_behaviour rule_action; /* What to do in case of match */
   filtering_rule_plugin_action plugin_action;
+  filtering_rule_rate_limit rate_limit;
   char reflector_device_name[REFLECTOR_NAME_LEN];
 
   filtering_internals internals;   /* PF_RING internal fields */
 } hash_filtering_rule;
 
+/*
+  SO_ADD_HASH_FILTERING_RULES/SO_REMOVE_HASH_FILTERING_RULES: the rules
+  are applied in order under one ring_rules_lock acquisition. Rules
+  already there (add) or missing (remove) are skipped; any other error
+  stops the batch. num_done is set to the rules applied.
+*/
+#define MAX_HASH_RULES_BULK        4096 /* per call: bounds the time spent with BHs off */
+
+struct pfring_hash_rules_bulk {
+  u_int32_t num_rules;
+  u_int32_t num_done; /* set by the kernel */
+  hash_filtering_rule rules[0];
+};
+
+/*
+  SO_GET_HASH_FILTERING_RULES_STATS: the counters of up to max_rules hash
+  rules per call (at most MAX_HASH_RULES_BULK), walking the table from
+  cursor (0 the first time). The kernel sets num_rules and the cursor of
+  the next call, 0 once the whole table has been reported. Rules added or
+  removed between two calls, or a table resize, may make the walk miss
+  a rule or report it twice.
+*/
+struct pfring_hash_rule_stats {
+  u_int16_t vlan_id, plugin_id;
+  u_int8_t  proto, pad[3];
+  ip_addr   host_peer_a, host_peer_b;
+  u_int16_t port_peer_a, port_peer_b;
+  u_int32_t idle_msec;               /* since the last match (or since the rule was added) */
+  u_int64_t pkts, bytes;
+};
+
+struct pfring_hash_rules_stats_bulk {
+  u_int64_t cursor;                  /* opaque: chain << 32 | position in the chain */
+  u_int32_t max_rules;
+  u_int32_t num_rules;               /* set by the kernel */
+  struct pfring_hash_rule_stats rules[0];
+};
+
 /* ************************************************* */
 
 typedef struct _sw_filtering_hash_bucket {
@@ -535,7 +969,13 @@ typedef struct _sw_filtering_hash_bucket {
   void                          *plugin_data_ptr; /* ptr to a *continuous* memory area
 						     allocated by the plugin */
   u_int16_t                     plugin_data_ptr_len;
-  struct _sw_filtering_hash_bucket *next;
+  struct _sw_filtering_hash_bucket *next[2]; /* chain of the table using link 0/1 */
+
+#ifdef __KERNEL__
+  /* SO_SET_HASH_RULES_IDLE_TIMEOUT: slot of the expiry wheel */
+  struct _sw_filtering_hash_bucket *wheel_next, **wheel_pprev;
+  struct rcu_head rcu;
+#endif
 } sw_filtering_hash_bucket;
 
 /* *********************************** */
@@ -554,31 +994,98 @@ typedef struct _sw_filtering_hash_bucket {
 
 /* False sharing reference: http://en.wikipedia.org/wiki/False_sharing */
 
+/*
+  SO_SET_PERCPU_RINGS splits the ring of a socket in sub-rings, each with
+  its own FlowSlotInfo and slots, filled by the softirqs of one CPU only
+  (CPU % num_sub_rings) so that no lock is taken on insertion. Userland
+  merges them; tot_pkts/tot_lost are only maintained in the first one.
+*/
+#define MAX_NUM_SUB_RINGS         32
+
+/*
+  FlowSlotInfo.consumer_state. A consumer that only sleeps through
+  pfring_poll() tells the kernel when it does: while it reads or spins on
+  the ring there is nobody to wake, and the kernel skips the wakeup (the
+  waitqueue lock) and the poll timer for every packet it queues.
+  Single consumer only: a ring with several waiting threads stays LEGACY.
+*/
+#define PF_RING_CONSUMER_LEGACY    0 /* the fd may be in any poll()/select(): always woken */
+#define PF_RING_CONSUMER_SPINNING  1
+#define PF_RING_CONSUMER_WAITING   2 /* in pfring_poll() */
+
 typedef struct flowSlotInfo {
   /* first page, managed by kernel */
   u_int16_t version, sample_rate;
-  u_int32_t min_num_slots, slot_len, data_len, tot_mem;
-  u_int32_t insert_off, kernel_remove_off;
+  u_int32_t min_num_slots, slot_len, data_len;
+  u_int64_t tot_mem;                   /* 64 bit offsets since version 16: rings larger than 4 GB */
+  u_int64_t insert_off, kernel_remove_off;
   u_int64_t tot_pkts, tot_lost, tot_insert;
   u_int64_t tot_fwd_ok, tot_fwd_notok;
   u_int64_t good_pkt_sent, pkt_send_error;
   /* <-- 64 bytes here, should be enough to avoid some L1 VIVT coherence issues (32 ~ 64bytes lines) */
-  char padding[128-84];
+  u_int32_t num_sub_rings; /* > 1: as many rings of tot_mem bytes, mmapped one after the other */
+  u_int32_t overload_sample_rate; /* SO_SET_OVERLOAD_POLICY: 1 in N packets kept now, 1 = all */
+  u_int64_t tot_sampled;   /* not queued by the overload sampling (tot_lost: no room) */
+  u_int32_t slot_align_mask; /* PFRING_SLOT_ALIGN - 1 with PFRING_SLOT_ALIGNED, else 0 */
+  char padding[128-116];
   /* <-- 128 bytes here, should be enough to avoid false sharing in most L2 (64 ~ 128bytes lines) */
   char k_padding[4096-128];
   /* <-- 4096 bytes here, to get a page aligned block writable by kernel side only */
 
   /* second page, managed by userland */
   u_int64_t tot_read;
-  u_int32_t remove_off /* managed by userland */;
+  u_int64_t remove_off /* managed by userland */;
   u_int32_t vpfring_guest_flags; /* used by vPFRing */
   u_int32_t userspace_ring_flags;
-  char u_padding[4096-20];
+  u_int32_t shared_ring_flags;   /* shared ring readers: SHARED_RING_* */
+  u_int32_t consumer_state;      /* PF_RING_CONSUMER_* */
+  u_int64_t shared_ring_resync;  /* SHARED_RING_RESYNC() of the owner, when lapped */
+  u_int64_t shared_ring_lost;    /* packets skipped by the resyncs */
+  struct pfring_latency_histogram latency_hist; /* SO_SET_INSERT_TIMESTAMP */
+  char u_padding[4096-48-sizeof(struct pfring_latency_histogram)];
   /* <-- 8192 bytes here, to get a page aligned block writable by userland only */
 } FlowSlotInfo;
 
 /* **************************************** */
 
+/*
+  SO_SET_TX_RING: a ring of num_slots (power of 2) slots of slot_len
+  bytes (a pfring_tx_slot and the packet), mmap()ed at offset
+  PF_RING_TX_RING_MMAP_ID * PAGE_SIZE after this header. Userland copies
+  the packets to the slots from insert_idx on and moves it forward, then
+  calls SO_FLUSH_TX_RING once per batch: the kernel sends the slots up to
+  insert_idx on the bound device and moves remove_idx forward. Both
+  indexes are free running, the slot being (idx & (num_slots - 1)).
+*/
+
+#define PF_RING_TX_RING_MMAP_ID  7
+#define PFRING_TX_RING_VERSION   1
+#define MAX_TX_RING_SLOTS        65536
+
+struct pfring_tx_ring_req {
+  u_int32_t num_slots; /* rounded up to a power of 2 */
+  u_int32_t max_pkt_len;
+};
+
+struct pfring_tx_slot {
+  u_int32_t len, pad;
+  /* packet follows */
+};
+
+typedef struct flowSlotTxInfo {
+  /* first page, managed by kernel */
+  u_int32_t version, num_slots, slot_len, tot_mem; /* tot_mem: header included */
+  u_int32_t remove_idx, pad;
+  u_int64_t tot_sent, tot_errors;
+  char k_padding[4096-32];
+
+  /* second page, managed by userland */
+  u_int32_t insert_idx;
+  char u_padding[4096-4];
+} FlowSlotTxInfo;
+
+/* **************************************** */
+
 #define DNA_MAX_CHUNK_ORDER		5
 #define DNA_MAX_NUM_CHUNKS		4096
 
@@ -717,6 +1224,9 @@ typedef enum {
   cluster_per_flow_2_tuple, /* 2-tuple: <src ip,           dst ip                       >  */
   cluster_per_flow_4_tuple, /* 4-tuple: <src ip, src port, dst ip, dst port             >  */
   cluster_per_flow_5_tuple, /* 5-tuple: <src ip, src port, dst ip, dst port, proto      >  */
+  cluster_per_flow_toeplitz,/* pkt_hash_toeplitz of the 5-tuple, through the indirection  */
+  cluster_per_flow_crc32c,  /* pkt_hash_crc32c of the 5-tuple, through the indirection    */
+  cluster_per_queue,        /* RX queue i to member i % n, per flow on single queue NICs   */
 } cluster_type;
 
 struct add_to_cluster {
@@ -724,9 +1234,23 @@ struct add_to_cluster {
   cluster_type the_type;
 };
 
+/*
+  The symmetric cluster types map the hash to one of CLUSTER_INDIRECTION_LEN
+  buckets (multiply-shift, no division) and the bucket to a cluster element.
+  The table starts as an even spread and is reset whenever a member joins or
+  leaves; SO_SET_CLUSTER_INDIRECTION moves hot buckets to other members.
+*/
+#define CLUSTER_INDIRECTION_LEN   128
+#define CLUSTER_BUCKET(hash)      ((u_int32_t)(((u_int64_t)(hash) * CLUSTER_INDIRECTION_LEN) >> 32))
+
+struct cluster_indirection {
+  u_int8_t element[CLUSTER_INDIRECTION_LEN]; /* index of the member, in joining order */
+};
+
 typedef enum {
   standard_nic_family = 0, /* No Hw Filtering */
   intel_82599_family,
+  chelsio_t4_family
 } pfring_device_type;
 
 typedef struct {
@@ -775,6 +1299,7 @@ struct ring_cluster {
   cluster_type   hashing_mode;
   u_short        hashing_id;
   struct sock    *sk[CLUSTER_LEN];
+  u_int8_t       indirection[CLUSTER_INDIRECTION_LEN];
 };
 
 /*
@@ -785,6 +1310,22 @@ typedef struct {
   struct list_head list;
 } ring_cluster_element;
 
+/*
+ * Rings and clusters that can receive the packets of a device: the
+ * unclustered rings of channel c are rings[channel_rings[c]] up to
+ * rings[channel_rings[c + 1] - 1]
+ */
+typedef struct {
+  struct rcu_head rcu;
+  u_int8_t tstamp_mode; /* The finest PFRING_TSTAMP_* of the rings and cluster members */
+  u_int8_t parse_needed; /* A ring or a cluster reads the parsed headers */
+  u_int8_t channel_accept[MAX_NUM_RX_CHANNELS]; /* RING_ACCEPT_* of the rings of the channel and of the clusters */
+  u_int16_t num_clusters;
+  u_int16_t channel_rings[MAX_NUM_RX_CHANNELS + 1];
+  ring_cluster_element **clusters;
+  struct pf_ring_socket *rings[0];
+} ring_dispatch_table;
+
 #define MAX_NUM_DNA_BOUND_SOCKETS  8
 
 typedef struct {
@@ -862,7 +1403,7 @@ struct pf_userspace_ring {
   u_int16_t  slot_header_len;
   u_int32_t  bucket_len;
 
-  u_int32_t  tot_mem;
+  u_int64_t  tot_mem;
   char      *ring_memory;
 
   atomic_t   users[2]; /* producers/consumers */
@@ -874,6 +1415,37 @@ struct pf_userspace_ring {
 
 /* ************************************************* */
 
+struct pf_ring_mem {
+  int order;           /* >= 0: ring_memory is a single 2^order pages block */
+  struct page **pages; /* != NULL: ring_memory is a vmap() of these */
+  u_int32_t num_pages;
+
+  /* What it was allocated for: ring_mem_pool entries are reused for the same */
+  u_int64_t len;
+  u_int32_t policy;
+  int node;
+  u_int8_t pooled;     /* reused: only the FlowSlotInfo headers are zeroed */
+};
+
+/* SO_SET_SHARED_RING: outlives its owner while readers are attached */
+struct pf_shared_ring {
+  u_int32_t id, policy;
+  atomic_t users; /* owner + readers, the last one frees the ring memory */
+  struct pf_ring_socket *owner; /* NULL once released */
+
+  char *ring_memory;
+  struct pf_ring_mem ring_mem;
+  u_int16_t slot_header_len;
+  u_int32_t bucket_len;
+
+  FlowSlotInfo *cursor[MAX_SHARED_RING_READERS]; /* RCU, NULL = free */
+  wait_queue_head_t readers_waitqueue;
+
+  struct list_head list;
+};
+
+/* ************************************************* */
+
 struct dma_memory_info {
   u_int32_t num_chunks, chunk_len;
   u_int32_t num_slots,  slot_len;
@@ -932,6 +1504,93 @@ typedef int (*do_add_raw_packet_to_ring)(struct pf_ring_socket *pfr,
 /*
  * Ring options
  */
+/*
+  Hash rules idle expiry (SO_SET_HASH_RULES_IDLE_TIMEOUT): hierarchical
+  wheel ticking every second, level0 slots one second wide, level1 slots
+  HASH_RULES_WHEEL_SLOTS seconds wide (cascaded into level0 when their
+  turn comes). A rule is queued at its idle expiry and looked at once
+  when the slot comes up: matches only update jiffies_last_match, so a
+  rule that was hit meanwhile is queued again, at O(1).
+*/
+#define HASH_RULES_WHEEL_BITS   6
+#define HASH_RULES_WHEEL_SLOTS  (1 << HASH_RULES_WHEEL_BITS)
+#define HASH_RULES_WHEEL_MASK   (HASH_RULES_WHEEL_SLOTS - 1)
+
+struct hash_rules_wheel {
+  u_int32_t now; /* second (jiffies/HZ) of the next level0 slot to expire */
+  sw_filtering_hash_bucket *level0[HASH_RULES_WHEEL_SLOTS], *level1[HASH_RULES_WHEEL_SLOTS];
+  struct timer_list timer;
+};
+
+/* *********************************** */
+
+/*
+  Hash rules table, read under RCU by the packet handlers. When it is
+  doubled the buckets are linked to the new table with their other next[]
+  pointer, HASH_RULES_RESIZE_BATCH old buckets per rule change, while
+  readers keep walking the old one; the new table is published when the
+  last old bucket has been moved.
+*/
+struct sw_filtering_hash_table {
+  u_int32_t size;       /* power of 2 */
+  u_int8_t  link;       /* chains use sw_filtering_hash_bucket.next[link] */
+  u_int8_t  vmalloced;
+  sw_filtering_hash_bucket *chain[0];
+};
+
+/* *********************************** */
+
+/* Hot FlowSlotInfo counters, kept per CPU and summed by fold_ring_stats() */
+/*
+  SO_SET_PREFIX_BLOCKLIST, read under RCU. IPv4 is DIR-24 like: one bit
+  per /24 tells it is blocked, another one that the /24 has longer
+  prefixes, kept as sorted ranges. IPv6 prefixes are sorted ranges.
+*/
+struct prefix_blocklist_v4_range { u_int32_t lo, hi; };
+struct prefix_blocklist_v6_range { struct in6_addr lo, hi; };
+
+struct prefix_blocklist {
+  u_int32_t num_prefixes;
+  unsigned long *v4_blocked, *v4_partial; /* [2^24 bits], NULL without IPv4 prefixes */
+  u_int32_t num_v4_ranges, num_v6_ranges;
+  struct prefix_blocklist_v4_range *v4_ranges; /* /25../32, merged */
+  struct prefix_blocklist_v6_range *v6_ranges; /* merged */
+};
+
+/* *********************************** */
+
+/*
+  Counters of a sw filtering rule on a CPU: with a rule matched by all the
+  softirq CPUs a shared counter would bounce between their caches at every
+  packet. Summed when read.
+*/
+struct rule_cpu_stats {
+  u_int64_t tot_pkts, tot_bytes;
+  u_int64_t tot_reflected, tot_reflect_failed;
+};
+
+/* A rate_limit_packet_and_stop_rule_evaluation bucket, in time: a packet costs cost_ns of credit */
+struct rule_rate_limit_cpu {
+  u_int64_t credit_ns, last_ns;
+  u_int64_t cost_ns, depth_ns;
+  u_int64_t tot_passed, tot_dropped;
+};
+
+struct ring_cpu_stats {
+  u_int64_t tot_pkts, tot_lost, tot_sampled;
+  u_int64_t tot_blocked; /* SO_SET_PREFIX_BLOCKLIST drops */
+  u_int64_t tot_early_drop, tot_rate_sampled, tot_filtered; /* SO_GET_RING_STATS_EXT */
+  u_int32_t overload_count; /* 1 in overload_sample_rate */
+  u_int32_t max_queued;     /* reset by SO_GET_RING_STATS_EXT */
+};
+
+/* A dropping ring folds its drops into slots_info at least this often (jiffies) */
+#define RING_STATS_FOLD_INTERVAL  (HZ / 10)
+
+/* Packets a ring consumes, by direction: bit recv_packet of skb_ring_handler() */
+#define RING_ACCEPT_TX   0x01
+#define RING_ACCEPT_RX   0x02
+
 struct pf_ring_socket {
   u_int8_t ring_active, ring_shutdown, num_rx_channels, rehash_rss, num_bound_devices;
   ring_device_element *ring_netdev;
@@ -943,18 +1602,48 @@ struct pf_ring_socket {
   char *appl_name; /* String that identifies the application bound to the socket */
   packet_direction direction; /* Specify the capture direction for packets */
   socket_mode mode; /* Specify the link direction to enable (RX, TX, both) */
+  u_int8_t accept; /* RING_ACCEPT_*: what direction and mode let the ring consume, see ring_update_accept() */
   pkt_header_len header_len;
+  u_int8_t metadata_only; /* compact_pkt_header without the packet bytes */
+  u_int8_t insert_timestamp; /* SO_SET_INSERT_TIMESTAMP */
+  u_int8_t tstamp_mode;      /* SO_SET_TIMESTAMP_MODE: PFRING_TSTAMP_* */
+  u_int32_t slot_layout;     /* SO_SET_SLOT_LAYOUT: PFRING_SLOT_* */
 
   /* /proc */
   char sock_proc_name[64];
 
   /* Poll Watermark */
   u_int32_t num_poll_calls;
+
+  /* DNA ring_poll(), see dna_irq_hold_polls */
+  struct {
+    u_int64_t sleeps;     /* interrupt armed, nothing to read */
+    u_int64_t wakeups;    /* packets found after a sleep */
+    u_int64_t busy_polls; /* packets found at once */
+    u_int64_t disarms;
+    u_int32_t consecutive_busy;
+    u_int8_t slept;
+  } dna_wait;
   u_int16_t poll_num_pkts_watermark;
+  u_int32_t poll_coalescing_usec; /* 0 = watermark only */
+  struct hrtimer poll_timer;      /* started by the first packet under the watermark */
+  atomic_t poll_timer_armed;
+  u_int8_t poll_timer_expired;    /* cleared by ring_poll() */
+  u_int8_t consumer_woken;        /* PF_RING_CONSUMER_WAITING: wakeup sent, cleared by ring_poll() */
 
   /* Master Ring */
   struct pf_ring_socket *master_ring;
 
+  /* tot_pkts/tot_lost of slots_info, see ring_cpu_stats */
+  struct ring_cpu_stats *cpu_stats;
+  unsigned long stats_folded; /* jiffies of the last fold by inc_ring_stats() */
+
+  struct pfring_overload_policy overload;
+
+  /* Per-CPU sub-rings (SO_SET_PERCPU_RINGS): sub_slots_info[0] == slots_info */
+  u_int8_t num_sub_rings;
+  FlowSlotInfo *sub_slots_info[MAX_NUM_SUB_RINGS];
+
   /* Used to transmit packets after they have been received
      from user space */
   struct {
@@ -980,13 +1669,20 @@ struct pf_ring_socket {
 
   /* Ring Slots */
   char *ring_memory;
+  u_int32_t ring_mem_policy; /* PFRING_MEM_* */
+  struct pf_ring_mem ring_mem;
   u_int16_t slot_header_len;
   u_int32_t bucket_len, slot_tot_mem;
   FlowSlotInfo *slots_info; /* Points to ring_memory */
   char *ring_slots;         /* Points to ring_memory+sizeof(FlowSlotInfo) */
 
+  /* SO_SET_TX_RING */
+  FlowSlotTxInfo *tx_ring;  /* vmalloc_user(), NULL = none */
+  struct mutex tx_ring_lock; /* SO_FLUSH_TX_RING callers */
+
   /* Packet Sampling */
   u_int32_t pktToSample, sample_rate;
+  u_int32_t flow_sample_threshold; /* SO_SET_FLOW_SAMPLING_RATE, 0 = off */
 
   /* Virtual Filtering Device */
   virtual_filtering_device_element *v_filtering_dev;
@@ -995,8 +1691,20 @@ struct pf_ring_socket {
   struct sk_filter *bpfFilter;
 
   /* Sw Filtering Rules */
-  sw_filtering_hash_bucket **sw_filtering_hash;
-  u_int16_t num_sw_filtering_rules;
+  struct sw_filtering_hash_table *sw_filtering_hash; /* rcu */
+  struct sw_filtering_hash_table *sw_filtering_hash_resize;  /* doubled table being filled */
+  struct sw_filtering_hash_table *sw_filtering_hash_retired; /* freed after a grace period */
+  u_int32_t sw_filtering_hash_migrated; /* old buckets already in sw_filtering_hash_resize */
+  u_int32_t hash_rules_table_size, max_hash_rules, num_sw_filtering_hash_rules;
+  atomic_t hash_rules_table_busy; /* prepare_hash_rules_table() running */
+  u_int16_t hash_rules_idle_timeout; /* sec, 0 = no hash_rules_wheel */
+  struct hash_rules_wheel hash_rules_wheel;
+  u_int32_t num_sw_filtering_rules; /* wildcard + hash */
+  u_int32_t sw_filtering_rules_gen; /* bumped by every wildcard rule change */
+  struct wildcard_rules_classifier *sw_filtering_classifier; /* NULL = walk sw_filtering_rules */
+  struct flow_cache __percpu *flow_cache; /* NULL = no SO_SET_FLOW_CACHE_LIFETIME */
+  unsigned long flow_cache_lifetime;     /* jiffies */
+  struct prefix_blocklist *prefix_blocklist; /* rcu */
   u_int8_t sw_filtering_rules_default_accept_policy; /* 1=default policy is accept, drop otherwise */
   struct list_head sw_filtering_rules;
 
@@ -1005,7 +1713,6 @@ struct pf_ring_socket {
   struct list_head hw_filtering_rules;
 
   /* Locks */
-  atomic_t num_ring_users;
   wait_queue_head_t ring_slots_waitqueue;
   rwlock_t ring_index_lock, ring_rules_lock;
 
@@ -1022,12 +1729,22 @@ struct pf_ring_socket {
 
 #ifdef VPFRING_SUPPORT
   struct eventfd_ctx *vpfring_host_eventfd_ctx;   /* host  -> guest */
+  u_int32_t vpfring_coalescing_pkts, vpfring_coalescing_usec;
+  atomic_t vpfring_pending;                       /* queued, not signalled yet */
+  struct hrtimer vpfring_timer;                   /* started by the first pending packet */
+  atomic_t vpfring_timer_armed;
+  u_int64_t vpfring_signals;
 #endif /* VPFRING_SUPPORT */
 
   /* UserSpace RING */
   userspace_ring_client_type userspace_ring_type;
   struct pf_userspace_ring *userspace_ring;
 
+  /* Shared ring: owner, or reader with its cursor */
+  struct pf_shared_ring *shared_ring;
+  FlowSlotInfo *shared_cursor; /* reader only, vmalloc_user() */
+  int shared_reader_id;
+
   /* DNA cluster */
   struct dna_cluster *dna_cluster;
   dna_cluster_client_type dna_cluster_type;
@@ -1060,6 +1777,62 @@ typedef struct {
   void *plugin_data_ptr; /* ptr to a *continuous* memory area allocated by the plugin */
 } sw_filtering_rule_element;
 
+/*
+  Wildcard rules classifier (bit vector search): for each of proto, IPv4
+  sIP/dIP and sport/dport the values are split into intervals, each with
+  the bitmap of the rules that can match it. The AND of the packet
+  intervals bitmaps gives the candidates, evaluated in rule order with
+  match_filtering_rule() (MACs, VLAN, GTP, payload... are checked there).
+  Bidirectional rules are set for both directions: a superset is enough.
+*/
+#define WILDCARD_RULES_MIN_COMPILED  8    /* fewer rules are simply walked */
+#define WILDCARD_RULES_MAX_COMPILED  1024
+
+enum { wildcard_dim_sip = 0, wildcard_dim_dip, wildcard_dim_sport, wildcard_dim_dport, wildcard_num_dims };
+
+struct wildcard_rules_dim {
+  u_int32_t num_intervals;
+  u_int32_t *start;     /* ascending interval starts, start[0] = 0 */
+  unsigned long *rules; /* [num_intervals][num_longs] */
+};
+
+struct wildcard_rules_classifier {
+  u_int32_t gen;        /* pf_ring_socket.sw_filtering_rules_gen it has been built for */
+  u_int32_t num_rules, num_longs;
+  sw_filtering_rule_element **rules; /* [num_rules], rule_id order */
+  unsigned long *proto; /* [256][num_longs] */
+  struct wildcard_rules_dim dim[wildcard_num_dims];
+};
+
+/*
+  SO_SET_FLOW_CACHE_LIFETIME: the verdict of the wildcard rules memoized
+  per 5-tuple (and VLAN), per CPU, direct mapped on the rule hash of the
+  packet. Only verdicts that depend on nothing else are cached: every rule
+  evaluated matches on the 5-tuple, VLAN and balance hash only (no MAC,
+  GTP, pattern nor plugin) and the matching one, if any, forwards or drops.
+  An entry is valid for the lifetime and while sw_filtering_rules_gen is
+  unchanged. Packets served from the cache are not counted in the stats
+  of their rule.
+*/
+#define FLOW_CACHE_SIZE  1024 /* entries per CPU, power of 2 */
+
+enum { flow_cache_empty = 0, flow_cache_no_match, flow_cache_forward, flow_cache_drop };
+
+struct flow_cache_entry {
+  ip_addr src, dst;
+  u_int16_t sport, dport, vlan_id, rule_id;
+  u_int8_t proto, verdict;
+  u_int32_t gen;
+  unsigned long expires; /* jiffies */
+};
+
+struct flow_cache {
+  struct flow_cache_entry entry[FLOW_CACHE_SIZE];
+  u_int64_t hits, misses;
+};
+
+/* **************************************** */
+
 typedef struct {
   hw_filtering_rule rule;
   struct list_head list;
@@ -1070,6 +1843,8 @@ struct parse_buffer {
   u_int16_t  mem_len;
 };
 
+#define PLUGIN_PARSE_SCRATCH_LEN  128 /* bytes, per plugin and CPU (see pf_ring_parse_buffer()) */
+
 /* **************************************** */
 
 /* Plugins */
@@ -1186,6 +1961,20 @@ typedef void  (*handle_ring_dna_device)(dna_device_operation operation,
 					dna_device_notify dev_notify_function_ptr);
 typedef u_int8_t (*pfring_tx_pkt)(void* private_data, char *pkt, u_int pkt_len);
 
+/*
+  NAPI/interrupt moderation controls of the PF_RING-aware drivers, one per
+  device, set through /proc/net/pf_ring/dev/<device>/tuning and read by the
+  drivers at every NAPI poll.
+*/
+typedef struct {
+  u_int16_t napi_budget[MAX_NUM_RX_CHANNELS];   /* Packets per poll, 0 = driver default */
+  u_int16_t max_itr_usecs[MAX_NUM_RX_CHANNELS]; /* Adaptive ITR ceiling, 0 = driver default */
+  u_int16_t busy_itr_usecs;                     /* ITR while the rings are full, 0 = no backoff */
+  volatile unsigned long busy_queues;           /* Bit per queue: a ring fed by the queue was full */
+} pfring_device_tuning;
+
+typedef pfring_device_tuning* (*get_pfring_device_tuning)(int ifindex);
+
 extern register_pfring_plugin get_register_pfring_plugin(void);
 extern unregister_pfring_plugin get_unregister_pfring_plugin(void);
 extern read_device_pfring_free_slots get_read_device_pfring_free_slots(void);
@@ -1227,6 +2016,11 @@ typedef int (*handle_ring_skb)(struct sk_buff *skb, u_char recv_packet,
 			       u_int32_t num_rx_channels);
 typedef int (*handle_ring_buffer)(struct net_device *dev,
 				  char *data, int len);
+typedef int (*handle_ring_rx_buffer)(struct net_device *dev,
+				     char *data, int len,
+				     u_int32_t channel_id,
+				     u_int32_t num_rx_channels,
+				     u_int32_t rxhash /* RSS, 0 = none */);
 typedef int (*handle_add_hdr_to_ring)(struct pf_ring_socket *pfr,
 				      u_int8_t real_skb,
 				      struct pfring_pkthdr *hdr);
@@ -1247,12 +2041,24 @@ struct pfring_hooks {
   handle_ring_dna_device ring_dna_device_handler;
   read_device_pfring_free_slots pfring_free_device_slots;
   pfring_tx_pkt pfring_send_packet;
+  get_pfring_device_tuning device_tuning;
+  handle_ring_rx_buffer buffer_rx_ring_handler; /* transparent_mode=2, no skb */
 };
 
 /* *************************************************************** */
 
 extern void pf_ring_add_module_dependency(void);
 
+/*
+  Plugins: sets *storage (the filter_rule_memory_storage argument) to a
+  parse buffer of mem_len bytes (<= PLUGIN_PARSE_SCRATCH_LEN) from the
+  per-CPU scratch area, valid until the packet has been handled. No
+  allocation, nothing to free. NULL when not available: the plugin can
+  still kmalloc() the parse_buffer and its mem, freed by PF_RING.
+*/
+extern struct parse_buffer* pf_ring_parse_buffer(u_int16_t plugin_id, u_int16_t mem_len,
+						 struct parse_buffer **storage);
+
 #ifdef PF_RING_PLUGIN
 static struct pfring_plugin_registration plugin_reg;
 static struct list_head plugin_registered_devices_list;
@@ -1395,6 +2201,26 @@ struct vpfring_eventfd_info {
 /* Values for the FlowSlotInfo.vpfring_guest_flags bitmap */
 #define VPFRING_GUEST_NO_INTERRUPT 1
 
+/*
+  SO_SET_VPFRING_COALESCING: the host eventfd is signalled once num_pkts
+  packets have been queued since the last signal, or usec microseconds
+  after the first of them, whichever comes first (each signal is a VM
+  exit in the guest). num_pkts <= 1: a signal per packet.
+
+  A guest busy-polling the ring sets VPFRING_GUEST_NO_INTERRUPT: nothing
+  is counted nor signalled. Before blocking again (e.g. after a number of
+  empty polls) it clears the flag, issues a full barrier and looks at the
+  ring once more: the host orders its tot_insert update before its read
+  of the flag, hence a packet is either seen by that last look or
+  signalled.
+*/
+#define MAX_VPFRING_COALESCING_USEC 1000000
+
+struct vpfring_coalescing {
+  u_int32_t num_pkts;
+  u_int32_t usec; /* 0 = no time bound */
+};
+
 /* Host event IDs */
 #define VPFRING_HOST_EVENT_RX_INT 0
 
@@ -1403,4 +2229,7 @@ struct vpfring_eventfd_info {
 /* bit masks for the FlowSlotInfo.userspace_ring_flags bitmap */
 #define USERSPACE_RING_NO_INTERRUPT 1
 
+/* bit masks for the FlowSlotInfo.shared_ring_flags bitmap */
+#define SHARED_RING_LAPPED          1
+
 #endif /* __RING_H */
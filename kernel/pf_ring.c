@@ -78,6 +78,11 @@
 #endif
 #include <linux/module.h>
 #include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/sort.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
 #include <linux/kernel.h>
 #include <linux/socket.h>
 #include <linux/skbuff.h>
@@ -115,6 +120,11 @@
 #define I82599_HW_FILTERING_SUPPORT
 #endif
 
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,3,0))
+#include <linux/jump_label.h>
+#define TOGGLE_STATIC_KEYS
+#endif
+
 #include <linux/pf_ring.h>
 
 #ifndef SVN_REV
@@ -135,7 +145,9 @@
 #define PROC_INFO               "info"
 #define PROC_DEV                "dev"
 #define PROC_RULES              "rules"
+#define PROC_TUNING             "tuning"
 #define PROC_PLUGINS_INFO       "plugins_info"
+#define PROC_STATS              "stats"
 
 /* ************************************************* */
 
@@ -186,6 +198,15 @@ static struct list_head ring_aware_device_list; /* List of ring_device_element *
 /* Keep track of number of rings per device (plus any) */
 static u_int8_t num_rings_per_device[MAX_NUM_IFIDX] = { 0 };
 static struct pf_ring_socket* device_rings[MAX_NUM_IFIDX][MAX_NUM_RX_CHANNELS] = { { NULL } };
+
+/* Where skb_ring_handler() delivers the packets of a device (see rebuild_dispatch_tables()) */
+static ring_dispatch_table *dispatch_tables[MAX_NUM_IFIDX] = { NULL };
+static ring_dispatch_table *any_dispatch_table = NULL; /* Devices with only 'any' rings */
+static u_int8_t dispatch_tables_ok = 0; /* 0 = walk ring_table (e.g. out of memory) */
+static DEFINE_MUTEX(dispatch_tables_lock);
+
+/* NAPI/ITR controls read by the PF_RING-aware drivers (see ring_hooks) */
+static pfring_device_tuning device_tuning[MAX_NUM_IFIDX];
 static u_int8_t num_any_rings = 0;
 
 /* List of all DNA (direct nic access) devices */
@@ -207,6 +228,16 @@ static rwlock_t userspace_ring_lock =
 #endif
 ;
 
+/* List of shared rings (SO_SET_SHARED_RING) */
+static LIST_HEAD(shared_ring_list);
+static rwlock_t shared_ring_lock =
+#if(LINUX_VERSION_CODE < KERNEL_VERSION(2,6,39))
+  RW_LOCK_UNLOCKED
+#else
+  (rwlock_t) __RW_LOCK_UNLOCKED(shared_ring_lock)
+#endif
+;
+
 /* List of DNA clusters */
 static struct list_head dna_cluster_list;
 static rwlock_t dna_cluster_lock =
@@ -227,6 +258,7 @@ u_char *loobpack_test_buffer = NULL;
 struct proc_dir_entry *ring_proc_dir = NULL, *ring_proc_dev_dir = NULL;
 struct proc_dir_entry *ring_proc = NULL;
 struct proc_dir_entry *ring_proc_plugins_info = NULL;
+struct proc_dir_entry *ring_proc_stats = NULL;
 
 static int ring_proc_get_info(char *, char **, off_t, int, int *, void *);
 static int ring_proc_get_plugin_info(char *, char **, off_t, int, int *,
@@ -239,6 +271,7 @@ static void ring_proc_term(void);
 static int reflect_packet(struct sk_buff *skb,
 			  struct pf_ring_socket *pfr,
 			  struct net_device *reflector_dev,
+			  filtering_internals *rule_stats,
 			  int displ, rule_action_behaviour behaviour,
 			  u_int8_t do_clone_skb);
 
@@ -321,11 +354,65 @@ ip_defrag(struct sk_buff *skb, u32 user);
 static unsigned int min_num_slots = 4096;
 static unsigned int enable_tx_capture = 1;
 static unsigned int enable_ip_defrag = 0;
+static unsigned int enable_frag_coherence = 1;
 static unsigned int quick_mode = 0;
+static unsigned int enable_reflect_batch = 1;
 static unsigned int enable_debug = 0;
+static unsigned int ring_mem_pool = 0;
+static unsigned int dna_irq_hold_polls = 0;
 static unsigned int transparent_mode = standard_linux_path;
 static atomic_t ring_id_serial = ATOMIC_INIT(0);
 
+/*
+  enable_debug, enable_tx_capture and quick_mode are tested for every
+  packet. They are mirrored into static keys (jump labels), patched when
+  the parameter is written through /sys/module/pf_ring/parameters: a
+  disabled feature is a nop in the packet path instead of a load of a
+  global shared by all the CPUs and a branch. The variables stay the
+  reference (proc, module parameters).
+*/
+#ifdef TOGGLE_STATIC_KEYS
+static DEFINE_STATIC_KEY_FALSE(enable_debug_key);
+static DEFINE_STATIC_KEY_TRUE(enable_tx_capture_key);
+static DEFINE_STATIC_KEY_FALSE(quick_mode_key);
+
+#define debug_on()      static_branch_unlikely(&enable_debug_key)
+#define tx_capture_on() static_branch_likely(&enable_tx_capture_key)
+#define quick_mode_on() static_branch_unlikely(&quick_mode_key)
+
+#define set_toggle_key(key, on) \
+  do { if(on) static_branch_enable(key); else static_branch_disable(key); } while(0)
+
+static void sync_toggle_keys(void)
+{
+  set_toggle_key(&enable_debug_key, enable_debug);
+  set_toggle_key(&enable_tx_capture_key, enable_tx_capture);
+  set_toggle_key(&quick_mode_key, quick_mode);
+}
+
+static int toggle_param_set(const char *val, const struct kernel_param *kp)
+{
+  int rc = param_set_uint(val, kp);
+
+  /* Load time values are synced again by ring_init() */
+  if(rc == 0)
+    sync_toggle_keys();
+
+  return(rc);
+}
+
+static const struct kernel_param_ops toggle_param_ops = {
+  .set = toggle_param_set,
+  .get = param_get_uint,
+};
+#else
+#define debug_on()      unlikely(enable_debug)
+#define tx_capture_on() likely(enable_tx_capture)
+#define quick_mode_on() unlikely(quick_mode)
+
+static inline void sync_toggle_keys(void) { }
+#endif
+
 #if defined(RHEL_RELEASE_CODE)
 #if(RHEL_RELEASE_CODE >= RHEL_RELEASE_VERSION(4,8))
 #define REDHAT_PATCHED_KERNEL
@@ -335,17 +422,34 @@ static atomic_t ring_id_serial = ATOMIC_INIT(0);
 #if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,16)) || defined(REDHAT_PATCHED_KERNEL)
 module_param(min_num_slots, uint, 0644);
 module_param(transparent_mode, uint, 0644);
+#ifdef TOGGLE_STATIC_KEYS
+module_param_cb(enable_debug, &toggle_param_ops, &enable_debug, 0644);
+module_param_cb(enable_tx_capture, &toggle_param_ops, &enable_tx_capture, 0644);
+#else
 module_param(enable_debug, uint, 0644);
 module_param(enable_tx_capture, uint, 0644);
+#endif
 module_param(enable_ip_defrag, uint, 0644);
+module_param(enable_frag_coherence, uint, 0644);
+#ifdef TOGGLE_STATIC_KEYS
+module_param_cb(quick_mode, &toggle_param_ops, &quick_mode, 0644);
+#else
 module_param(quick_mode, uint, 0644);
+#endif
+module_param(enable_reflect_batch, uint, 0644);
+module_param(ring_mem_pool, uint, 0644);
+module_param(dna_irq_hold_polls, uint, 0644);
 #else
 MODULE_PARM(min_num_slots, "i");
 MODULE_PARM(transparent_mode, "i");
 MODULE_PARM(enable_debug, "i");
 MODULE_PARM(enable_tx_capture, "i");
 MODULE_PARM(enable_ip_defrag, "i");
+MODULE_PARM(enable_frag_coherence, "i");
 MODULE_PARM(quick_mode, "i");
+MODULE_PARM(enable_reflect_batch, "i");
+MODULE_PARM(ring_mem_pool, "i");
+MODULE_PARM(dna_irq_hold_polls, "i");
 #endif
 
 MODULE_PARM_DESC(min_num_slots, "Min number of ring slots");
@@ -357,9 +461,21 @@ MODULE_PARM_DESC(enable_tx_capture, "Set to 1 to capture outgoing packets");
 MODULE_PARM_DESC(enable_ip_defrag,
 		 "Set to 1 to enable IP defragmentation"
 		 "(only rx traffic is defragmentead)");
+MODULE_PARM_DESC(enable_frag_coherence,
+		 "Set to 1 to report the L4 ports of the first fragment "
+		 "in the following fragments (no reassembly)");
 MODULE_PARM_DESC(quick_mode,
 		 "Set to 1 to run at full speed but with up"
 		 "to one socket per interface");
+MODULE_PARM_DESC(enable_reflect_batch,
+		 "Set to 1 to send the reflected/bounced packets "
+		 "in bursts from a tasklet instead of one by one");
+MODULE_PARM_DESC(ring_mem_pool,
+		 "Number of released rings whose memory is kept "
+		 "for the next sockets (0 = none)");
+MODULE_PARM_DESC(dna_irq_hold_polls,
+		 "DNA: polls finding packets in a row before the "
+		 "queue interrupt is disabled (0 = at the first one)");
 
 /* ********************************** */
 
@@ -451,17 +567,18 @@ void init_lockless_list(lockless_list *l) {
 int lockless_list_add(lockless_list *l, void *elem) {
   int i;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] -> BEGIN %s() [total=%u]\n", __FUNCTION__, l->num_elements);
 
+  /* I could avoid mutexes but ... */
+  write_lock_bh(&l->list_lock);
+
   if(l->num_elements >= MAX_NUM_LIST_ELEMENTS) {
+    write_unlock_bh(&l->list_lock);
     printk("[PF_RING] Exceeded the maximum number of list items\n");
     return(-1); /* Too many */
   }
 
-  /* I could avoid mutexes but ... */
-  write_lock_bh(&l->list_lock);
-
   for(i=0; i<MAX_NUM_LIST_ELEMENTS; i++) {
     void *old_slot_value;
 
@@ -485,7 +602,7 @@ int lockless_list_add(lockless_list *l, void *elem) {
 
   l->num_elements++;
 
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     printk("[PF_RING] -> END %s() [total=%u][id=%u][top_element_id=%u]\n",
 	   __FUNCTION__, l->num_elements, i, l->top_element_id);
 
@@ -513,7 +630,7 @@ int lockless_list_add(lockless_list *l, void *elem) {
 int lockless_list_remove(lockless_list *l, void *elem) {
   int i, old_full_slot = -1;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] -> BEGIN %s() [total=%u]\n", __FUNCTION__, l->num_elements);
 
   if(l->num_elements == 0) return(-1); /* Not found */
@@ -532,7 +649,7 @@ int lockless_list_remove(lockless_list *l, void *elem) {
     }
   }
 
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     printk("[PF_RING] -> END %s() [total=%u][top_element_id=%u]\n", __FUNCTION__, l->num_elements, l->top_element_id);
 
     for(i=0; i<MAX_NUM_LIST_ELEMENTS; i++) {
@@ -599,25 +716,33 @@ void term_lockless_list(lockless_list *l, u_int8_t free_memory) {
 
 /* ************************************************** */
 
-static inline char* get_slot(struct pf_ring_socket *pfr, u_int32_t off) { return(&(pfr->ring_slots[off])); }
+static inline char* get_slot(struct pf_ring_socket *pfr, u_int64_t off) { return(&(pfr->ring_slots[off])); }
+
+/* Slots of a ring area: the ring itself or one of its per-CPU sub-rings */
+static inline char* get_area_slot(FlowSlotInfo *si, u_int64_t off) { return(&((char*)si)[sizeof(FlowSlotInfo) + off]); }
 
 /* ********************************** */
 
-static inline int get_next_slot_offset(struct pf_ring_socket *pfr, u_int32_t off)
+static inline u_int64_t get_area_next_slot_offset(struct pf_ring_socket *pfr, FlowSlotInfo *si, u_int64_t off)
 {
   struct pfring_pkthdr *hdr;
   u_int32_t real_slot_size;
 
   // smp_rmb();
 
-  hdr = (struct pfring_pkthdr*)get_slot(pfr, off);
+  hdr = (struct pfring_pkthdr*)get_area_slot(si, off);
 
-  real_slot_size = pfr->slot_header_len + hdr->caplen;
+  if(pfr->header_len == compact_pkt_header)
+    real_slot_size = pfring_compact_slot_len((struct pfring_compact_pkthdr*)hdr);
+  else
+    real_slot_size = pfr->slot_header_len + hdr->caplen;
 
   if(pfr->header_len == long_pkt_header)
     real_slot_size += hdr->extended_hdr.parsed_header_len;
 
-  if((off + real_slot_size + pfr->slots_info->slot_len) > (pfr->slots_info->tot_mem - sizeof(FlowSlotInfo))) {
+  real_slot_size = pfring_slot_align(si, real_slot_size);
+
+  if((off + real_slot_size + si->slot_len) > (si->tot_mem - sizeof(FlowSlotInfo))) {
     return 0;
   }
 
@@ -626,29 +751,227 @@ static inline int get_next_slot_offset(struct pf_ring_socket *pfr, u_int32_t off
 
 /* ********************************** */
 
+static inline u_int64_t get_next_slot_offset(struct pf_ring_socket *pfr, u_int64_t off)
+{
+  return(get_area_next_slot_offset(pfr, pfr->slots_info, off));
+}
+
+/* ********************************** */
+
+static void fold_ring_stats(struct pf_ring_socket *pfr);
+
+/*
+  tot_pkts/tot_lost are bumped on the CPU receiving the packet, so that the
+  softirqs filling the same ring only share insert_off/tot_insert. They
+  reach slots_info when userland polls or asks for the stats, and every
+  RING_STATS_FOLD_INTERVAL while the ring drops: a consumer that never
+  sleeps still sees its drops in the mapped memory
+  (pfring_stats_multichannel()).
+*/
+static inline void inc_ring_stats(struct pf_ring_socket *pfr, u_int lost)
+{
+  struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, get_cpu());
+
+  s->tot_pkts++, s->tot_lost += lost;
+  put_cpu();
+
+  if(unlikely(lost) && time_after(jiffies, pfr->stats_folded + RING_STATS_FOLD_INTERVAL)) {
+    pfr->stats_folded = jiffies;
+    fold_ring_stats(pfr);
+  }
+}
+
+/* ********************************** */
+
+/* A packet queued with queued packets in its (sub-)ring, this one included */
+static inline void inc_ring_stats_queued(struct pf_ring_socket *pfr, u_int32_t queued)
+{
+  struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, get_cpu());
+
+  s->tot_pkts++;
+  if(queued > s->max_queued) s->max_queued = queued;
+  put_cpu();
+}
+
+/* ********************************** */
+
+/* Rejected by the BPF filter or the filtering rules (not in tot_pkts) */
+static inline void inc_ring_filtered_stats(struct pf_ring_socket *pfr)
+{
+  struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, get_cpu());
+
+  s->tot_filtered++;
+  put_cpu();
+}
+
+/* ********************************** */
+
+static void fold_ring_stats(struct pf_ring_socket *pfr)
+{
+  u_int64_t tot_pkts = 0, tot_lost = 0, tot_sampled = 0;
+  int cpu;
+
+  /* The producer of a userspace ring keeps its own counters */
+  if((pfr->slots_info == NULL) || (pfr->userspace_ring != NULL))
+    return;
+
+  for_each_possible_cpu(cpu) {
+    struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, cpu);
+
+    tot_pkts += s->tot_pkts, tot_lost += s->tot_lost, tot_sampled += s->tot_sampled;
+  }
+
+  pfr->slots_info->tot_pkts = tot_pkts, pfr->slots_info->tot_lost = tot_lost;
+  pfr->slots_info->tot_sampled = tot_sampled;
+}
+
+/* ********************************** */
+
+static inline u_int32_t cursor_queued_pkts(u_int32_t tot_insert, u_int32_t tot_read)
+{
+  if(tot_insert >= tot_read) {
+    return(tot_insert - tot_read);
+  } else {
+    return(((u_int32_t) - 1) + tot_insert - tot_read);
+  }
+}
+
+/* ********************************** */
+
+static inline u_int32_t area_queued_pkts(FlowSlotInfo *si)
+{
+  return(cursor_queued_pkts(si->tot_insert, si->tot_read));
+}
+
+/* ********************************** */
+
 static inline u_int32_t num_queued_pkts(struct pf_ring_socket *pfr)
 {
   // smp_rmb();
 
   if(pfr->ring_slots != NULL) {
-    u_int32_t tot_insert = pfr->slots_info->tot_insert, tot_read = pfr->slots_info->tot_read;
+    u_int32_t num = 0;
+    int i;
 
-    if(tot_insert >= tot_read) {
-      return(tot_insert - tot_read);
-    } else {
-      return(((u_int32_t) - 1) + tot_insert - tot_read);
-    }
+    if(pfr->num_sub_rings <= 1)
+      return(area_queued_pkts(pfr->slots_info));
 
-    if(unlikely(enable_debug)) {
-      printk("[PF_RING] -> [tot_insert=%d][tot_read=%d]\n",
-	     tot_insert, tot_read);
-    }
+    for(i = 0; i < pfr->num_sub_rings; i++)
+      num += area_queued_pkts(pfr->sub_slots_info[i]);
+
+    return(num);
   } else
     return(0);
 }
 
 /* ************************************* */
 
+/* Hard irq context: only tell ring_poll() not to wait for the watermark */
+static enum hrtimer_restart ring_poll_timer(struct hrtimer *timer)
+{
+  struct pf_ring_socket *pfr = container_of(timer, struct pf_ring_socket, poll_timer);
+
+  pfr->poll_timer_expired = 1;
+  smp_wmb();
+  atomic_set(&pfr->poll_timer_armed, 0);
+  wake_up_interruptible(&pfr->ring_slots_waitqueue);
+
+  return(HRTIMER_NORESTART);
+}
+
+/* ************************************* */
+
+#ifdef VPFRING_SUPPORT
+
+static inline void vpfring_signal(struct pf_ring_socket *pfr)
+{
+  int pending = atomic_xchg(&pfr->vpfring_pending, 0);
+
+  if(pending > 0) {
+    eventfd_signal(pfr->vpfring_host_eventfd_ctx, pending);
+    pfr->vpfring_signals++;
+  }
+}
+
+/* Hard irq context: flushes what is below the packet threshold */
+static enum hrtimer_restart vpfring_coalescing_timer(struct hrtimer *timer)
+{
+  struct pf_ring_socket *pfr = container_of(timer, struct pf_ring_socket, vpfring_timer);
+
+  atomic_set(&pfr->vpfring_timer_armed, 0);
+  if(pfr->vpfring_host_eventfd_ctx)
+    vpfring_signal(pfr);
+
+  return(HRTIMER_NORESTART);
+}
+
+/*
+  After a packet has been queued: one host->guest signal every
+  vpfring_coalescing_pkts packets, or vpfring_coalescing_usec after the
+  first one not signalled (see struct vpfring_coalescing)
+*/
+static inline void vpfring_notify(struct pf_ring_socket *pfr)
+{
+  smp_mb(); /* tot_insert before the flag, see VPFRING_GUEST_NO_INTERRUPT */
+
+  if(pfr->slots_info->vpfring_guest_flags & VPFRING_GUEST_NO_INTERRUPT)
+    return; /* the guest is polling */
+
+  if(atomic_inc_return(&pfr->vpfring_pending) >= pfr->vpfring_coalescing_pkts)
+    vpfring_signal(pfr);
+  else if(pfr->vpfring_coalescing_usec
+	  && (atomic_cmpxchg(&pfr->vpfring_timer_armed, 0, 1) == 0))
+    hrtimer_start(&pfr->vpfring_timer, ns_to_ktime((u_int64_t)pfr->vpfring_coalescing_usec * 1000), HRTIMER_MODE_REL);
+}
+
+#endif //VPFRING_SUPPORT
+
+/* ************************************* */
+
+static inline void arm_poll_timer(struct pf_ring_socket *pfr)
+{
+  if(pfr->poll_coalescing_usec
+     && (!pfr->poll_timer_expired)
+     && (atomic_cmpxchg(&pfr->poll_timer_armed, 0, 1) == 0))
+    hrtimer_start(&pfr->poll_timer, ns_to_ktime((u_int64_t)pfr->poll_coalescing_usec * 1000), HRTIMER_MODE_REL);
+}
+
+/* ************************************* */
+
+/*
+  After a packet has been queued in si. A consumer spinning on the ring
+  (PF_RING_CONSUMER_SPINNING) costs one read of its page: no waitqueue
+  lock, no poll timer atomic. When it waits, the full barrier orders the
+  tot_insert store before the read of the flag, pairing with the one of
+  pfring_mod_poll() between its flag store and its last look at the ring;
+  a single wakeup is sent until the consumer is back in ring_poll(). The
+  ring_poll() check after poll_wait() bounds what an inconsistent read of
+  the two costs to the timeout of the poll().
+*/
+static inline void ring_wakeup(struct pf_ring_socket *pfr, FlowSlotInfo *si)
+{
+  u_int32_t state = *(volatile u_int32_t *)&pfr->slots_info->consumer_state;
+
+  if(likely(state == PF_RING_CONSUMER_SPINNING))
+    return;
+
+  if(state == PF_RING_CONSUMER_WAITING) {
+    smp_mb();
+    if(pfr->consumer_woken)
+      return;
+  }
+
+  /* With sub-rings this CPU's share of the watermark, not to read all of them */
+  if((area_queued_pkts(si) * ((pfr->num_sub_rings > 1) ? pfr->num_sub_rings : 1)) >= pfr->poll_num_pkts_watermark) {
+    if(state == PF_RING_CONSUMER_WAITING)
+      pfr->consumer_woken = 1;
+    wake_up_interruptible(&pfr->ring_slots_waitqueue);
+  } else
+    arm_poll_timer(pfr);
+}
+
+/* ************************************* */
+
 inline u_int get_num_ring_free_slots(struct pf_ring_socket * pfr)
 {
   u_int32_t nqpkts = num_queued_pkts(pfr);
@@ -672,10 +995,10 @@ static void consume_pending_pkts(struct pf_ring_socket *pfr, u_int8_t synchroniz
         (synchronized || pfr->slots_info->remove_off != get_next_slot_offset(pfr, pfr->slots_info->kernel_remove_off))) {
     struct pfring_pkthdr *hdr = (struct pfring_pkthdr*) &pfr->ring_slots[pfr->slots_info->kernel_remove_off];
 
-    if(unlikely(enable_debug))
-      printk("[PF_RING] Original offset [kernel_remove_off=%u][remove_off=%u][skb=%p]\n",
-	     pfr->slots_info->kernel_remove_off,
-	     pfr->slots_info->remove_off,
+    if(debug_on())
+      printk("[PF_RING] Original offset [kernel_remove_off=%llu][remove_off=%llu][skb=%p]\n",
+	     (unsigned long long)pfr->slots_info->kernel_remove_off,
+	     (unsigned long long)pfr->slots_info->remove_off,
 	     hdr->extended_hdr.tx.reserved);
 
     if(hdr->extended_hdr.tx.reserved != NULL) {
@@ -708,19 +1031,30 @@ static void consume_pending_pkts(struct pf_ring_socket *pfr, u_int8_t synchroniz
 	}
 
 	if(pfr->tx.last_tx_dev) {
-	  if(unlikely(enable_debug))
+	  struct sk_buff *skb = hdr->extended_hdr.tx.reserved;
+
+	  if(debug_on())
 	    printk("[PF_RING] Bouncing packet to interface %d/%s\n",
 		   hdr->extended_hdr.tx.bounce_interface,
 		   pfr->tx.last_tx_dev->name);
 
-	  reflect_packet(hdr->extended_hdr.tx.reserved, pfr,
-			 pfr->tx.last_tx_dev, 0 /* displ */,
-			 forward_packet_and_stop_rule_evaluation,
-			 0 /* don't clone skb */);
+	  if(skb_shared(skb)) {
+	    /* Still referenced by other rings (see copy_data_to_ring()): ours is a clone */
+	    struct sk_buff *cloned = skb_clone(skb, GFP_ATOMIC);
+
+	    kfree_skb(skb);
+	    skb = cloned;
+	  }
+
+	  if(skb != NULL)
+	    reflect_packet(skb, pfr,
+			   pfr->tx.last_tx_dev, NULL, 0 /* displ */,
+			   forward_packet_and_stop_rule_evaluation,
+			   0 /* don't clone skb */);
 	}
       } else {
-	if(unlikely(enable_debug))
-	  printk("[PF_RING] Freeing cloned (unforwarded) packet\n");
+	if(debug_on())
+	  printk("[PF_RING] Releasing (unforwarded) packet\n");
 
 	kfree_skb(hdr->extended_hdr.tx.reserved); /* Free memory */
       }
@@ -728,34 +1062,35 @@ static void consume_pending_pkts(struct pf_ring_socket *pfr, u_int8_t synchroniz
 
     pfr->slots_info->kernel_remove_off = get_next_slot_offset(pfr, pfr->slots_info->kernel_remove_off);
 
-    if(unlikely(enable_debug))
-      printk("[PF_RING] New offset [kernel_remove_off=%u][remove_off=%u]\n",
-	     pfr->slots_info->kernel_remove_off,
-	     pfr->slots_info->remove_off);
+    if(debug_on())
+      printk("[PF_RING] New offset [kernel_remove_off=%llu][remove_off=%llu]\n",
+	     (unsigned long long)pfr->slots_info->kernel_remove_off,
+	     (unsigned long long)pfr->slots_info->remove_off);
   }
 }
 
 /* ********************************** */
 
-static inline int check_and_init_free_slot(struct pf_ring_socket *pfr, int off)
+/* remove_off/tot_read: the cursor of a reader, the ring's own one or a shared ring reader's */
+static inline int check_cursor_free_slot(FlowSlotInfo *si, u_int64_t remove_off, u_int64_t tot_read)
 {
   // smp_rmb();
 
-  if(pfr->slots_info->insert_off == pfr->slots_info->remove_off) {
+  if(si->insert_off == remove_off) {
     /*
       Both insert and remove offset are set on the same slot.
       We need to find out whether the memory is full or empty
     */
 
-    if(num_queued_pkts(pfr) >= min_num_slots)
+    if(cursor_queued_pkts(si->tot_insert, tot_read) >= min_num_slots)
       return(0); /* Memory is full */
   } else {
     /* There are packets in the ring. We have to check whether we have
        enough space to accommodate a new packet */
 
-    if(pfr->slots_info->insert_off < pfr->slots_info->remove_off) {
+    if(si->insert_off < remove_off) {
       /* Zero-copy recv: this prevents from overwriting packets while apps are processing them */
-      if((pfr->slots_info->remove_off - pfr->slots_info->insert_off) < (2 * pfr->slots_info->slot_len))
+      if((remove_off - si->insert_off) < (2 * si->slot_len))
 	return(0);
     } else {
       /* We have enough room for the incoming packet as after we insert a packet, the insert_off
@@ -764,8 +1099,8 @@ static inline int check_and_init_free_slot(struct pf_ring_socket *pfr, int off)
       */
 
       /* Zero-copy recv: this prevents from overwriting packets while apps are processing them */
-      if((pfr->slots_info->tot_mem - sizeof(FlowSlotInfo) - pfr->slots_info->insert_off) < (2 * pfr->slots_info->slot_len) &&
-	 pfr->slots_info->remove_off == 0)
+      if((si->tot_mem - sizeof(FlowSlotInfo) - si->insert_off) < (2 * si->slot_len) &&
+	 remove_off == 0)
 	return(0);
     }
   }
@@ -775,107 +1110,392 @@ static inline int check_and_init_free_slot(struct pf_ring_socket *pfr, int off)
 
 /* ********************************** */
 
-#define IP_DEFRAG_RING 1234
-
-/* Returns new sk_buff, or NULL  */
-static struct sk_buff *ring_gather_frags(struct sk_buff *skb)
+static inline int check_area_free_slot(FlowSlotInfo *si)
 {
-#if(LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,23))
-  skb
-#else
-  int status
-#endif
-  = ip_defrag(skb, IP_DEFRAG_RING);
-
-  if(
-#if(LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,23))
-  skb == NULL
-#else
-  status
-#endif
-  )
-    skb = NULL;
-  else
-    ip_send_check(ip_hdr(skb));
-
-  return(skb);
+  return(check_cursor_free_slot(si, si->remove_off, si->tot_read));
 }
 
 /* ********************************** */
 
-static void ring_sock_destruct(struct sock *sk)
+#define shared_ring_position(si) SHARED_RING_RESYNC((si)->tot_insert, (si)->insert_off)
+
+/*
+  Owner of a shared ring, serialized as for its own insert_off: the slot
+  at insert_off must also have been read by every reader. A lapped reader
+  is skipped and told where to resume, i.e. right before the packet being
+  inserted
+*/
+static int check_shared_ring_free_slot(struct pf_ring_socket *pfr, FlowSlotInfo *si)
 {
-  struct pf_ring_socket *pfr;
+  struct pf_shared_ring *sr = pfr->shared_ring;
+  int i, rc = 1;
 
-  skb_queue_purge(&sk->sk_receive_queue);
+  rcu_read_lock();
 
-  if(!sock_flag(sk, SOCK_DEAD)) {
-    if(unlikely(enable_debug)) {
-      printk("[PF_RING] Attempt to release alive ring socket: %p\n", sk);
+  for(i = 0; i < MAX_SHARED_RING_READERS; i++) {
+    FlowSlotInfo *c = rcu_dereference(sr->cursor[i]);
+
+    if(c == NULL)
+      continue;
+
+    if(c->shared_ring_flags & SHARED_RING_LAPPED) {
+      c->shared_ring_resync = shared_ring_position(si);
+      continue;
     }
-    return;
+
+    if(check_cursor_free_slot(si, c->remove_off, c->tot_read))
+      continue;
+
+    if(sr->policy != PFRING_SHARED_RING_DROP_SLOWEST) {
+      rc = 0;
+      break;
+    }
+
+    c->shared_ring_resync = shared_ring_position(si);
+    smp_wmb();
+    c->shared_ring_flags |= SHARED_RING_LAPPED;
   }
 
-  pfr = ring_sk(sk);
+  rcu_read_unlock();
 
-  if(pfr)
-    kfree(pfr);
+  return(rc);
 }
 
 /* ********************************** */
 
-static void ring_proc_add(struct pf_ring_socket *pfr)
+static inline int check_and_init_free_slot(struct pf_ring_socket *pfr, u_int64_t off)
 {
-  if((ring_proc_dir != NULL)
-     && (pfr->sock_proc_name[0] == '\0')) {
-    snprintf(pfr->sock_proc_name, sizeof(pfr->sock_proc_name),
-	     "%d-%s.%d", pfr->ring_pid,
-	     pfr->ring_netdev->dev->name, pfr->ring_id);
+  return(check_area_free_slot(pfr->slots_info));
+}
 
-    create_proc_read_entry(pfr->sock_proc_name, 0 /* read-only */,
-			   ring_proc_dir,
-			   ring_proc_get_info, pfr);
+/* ********************************** */
 
-    if(unlikely(enable_debug))
-      printk("[PF_RING] Added /proc/net/pf_ring/%s\n", pfr->sock_proc_name);
+#define ring_overload_enabled(pfr) ((pfr)->overload.flags || (pfr)->overload.sample_threshold)
 
-    ring_table_size++;
+/*
+  SO_SET_OVERLOAD_POLICY: 1 = the packet has been accounted and must not
+  be processed any further
+*/
+static int ring_overloaded(struct pf_ring_socket *pfr)
+{
+  FlowSlotInfo *si = pfr->slots_info;
+  struct ring_cpu_stats *s;
+  u_int32_t occupancy, rate = 1;
+  int cpu, skip = 0;
+
+  if(si == NULL)
+    return(0);
+
+  cpu = get_cpu();
+  s = per_cpu_ptr(pfr->cpu_stats, cpu);
+
+  /* The sub-ring copy_data_to_ring() would use */
+  if(pfr->num_sub_rings > 1)
+    si = pfr->sub_slots_info[cpu % pfr->num_sub_rings];
+
+  if((pfr->overload.flags & PFRING_OVERLOAD_EARLY_DROP) && (!check_area_free_slot(si))) {
+    s->tot_pkts++, s->tot_lost++, s->tot_early_drop++;
+    skip = 1;
+  } else if(pfr->overload.sample_threshold > 0) {
+    occupancy = min_val((area_queued_pkts(si) * 100) / si->min_num_slots, 100);
+
+    if(occupancy >= pfr->overload.sample_threshold)
+      rate = 1 + ((pfr->overload.max_sample_rate - 1) * (occupancy - pfr->overload.sample_threshold))
+	/ (100 - pfr->overload.sample_threshold);
+
+    pfr->slots_info->overload_sample_rate = rate;
+
+    if((rate > 1) && ((++s->overload_count % rate) != 0)) {
+      s->tot_pkts++, s->tot_sampled++;
+      skip = 1;
+    }
   }
+
+  put_cpu();
+
+  return(skip);
 }
 
 /* ********************************** */
 
-static void ring_proc_remove(struct pf_ring_socket *pfr)
+/* SO_SET_PREFIX_BLOCKLIST: the caller is in an RCU read side */
+static int prefix_blocklisted(struct pf_ring_socket *pfr, struct pfring_pkthdr *hdr)
 {
-  if((ring_proc_dir != NULL)
-     && (pfr->sock_proc_name[0] != '\0')) {
-    if(unlikely(enable_debug))
-      printk("[PF_RING] Removing /proc/net/pf_ring/%s\n", pfr->sock_proc_name);
+  struct prefix_blocklist *b = rcu_dereference(pfr->prefix_blocklist);
+  u_int32_t low = 0, high, mid;
+  int found = 0;
 
-    remove_proc_entry(pfr->sock_proc_name, ring_proc_dir);
+  if(b == NULL)
+    return(0);
 
-    if(unlikely(enable_debug))
-      printk("[PF_RING] Removed /proc/net/pf_ring/%s\n", pfr->sock_proc_name);
+  if(hdr->extended_hdr.parsed_pkt.ip_version == 4) {
+    u_int32_t ip = hdr->extended_hdr.parsed_pkt.ipv4_src;
 
-    pfr->sock_proc_name[0] = '\0';
-    ring_table_size--;
+    if(b->v4_blocked == NULL)
+      return(0);
+
+    if(test_bit(ip >> 8, b->v4_blocked))
+      found = 1;
+    else if(test_bit(ip >> 8, b->v4_partial)) {
+      /* First range ending at or after ip */
+      for(high = b->num_v4_ranges; low < high; ) {
+	mid = (low + high) / 2;
+	if(b->v4_ranges[mid].hi < ip) low = mid + 1; else high = mid;
+      }
+
+      found = (low < b->num_v4_ranges) && (b->v4_ranges[low].lo <= ip);
+    }
+  } else if(hdr->extended_hdr.parsed_pkt.ip_version == 6) {
+    struct in6_addr *ip = &hdr->extended_hdr.parsed_pkt.ipv6_src;
+
+    for(high = b->num_v6_ranges; low < high; ) {
+      mid = (low + high) / 2;
+      if(memcmp(&b->v6_ranges[mid].hi, ip, sizeof(struct in6_addr)) < 0) low = mid + 1; else high = mid;
+    }
+
+    found = (low < b->num_v6_ranges) && (memcmp(&b->v6_ranges[low].lo, ip, sizeof(struct in6_addr)) <= 0);
+  }
+
+  if(found) {
+    struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, get_cpu());
+
+    s->tot_blocked++;
+    put_cpu();
   }
+
+  return(found);
 }
 
 /* ********************************** */
 
-static int ring_proc_dev_get_info(char *buf, char **start, off_t offset,
-				  int len, int *unused, void *data)
+static void free_prefix_blocklist(struct prefix_blocklist *b)
 {
-  int rlen = 0;
+  if(b->v4_blocked) vfree(b->v4_blocked);
+  if(b->v4_partial) vfree(b->v4_partial);
+  if(b->v4_ranges)  vfree(b->v4_ranges);
+  if(b->v6_ranges)  vfree(b->v6_ranges);
+  kfree(b);
+}
 
-  if(data != NULL) {
-    ring_device_element *dev_ptr = (ring_device_element*)data;
-    struct net_device *dev = dev_ptr->dev;
-    char dev_buf[16] = { 0 }, *dev_family = "???";
+/* ********************************** */
 
-    if(dev_ptr->is_dna_device) {
-      switch(dev_ptr->dna_device_model) {
+static int cmp_v4_range(const void *a, const void *b)
+{
+  u_int32_t x = ((const struct prefix_blocklist_v4_range*)a)->lo, y = ((const struct prefix_blocklist_v4_range*)b)->lo;
+
+  return((x > y) - (x < y));
+}
+
+static int cmp_v6_range(const void *a, const void *b)
+{
+  return(memcmp(&((const struct prefix_blocklist_v6_range*)a)->lo,
+		&((const struct prefix_blocklist_v6_range*)b)->lo, sizeof(struct in6_addr)));
+}
+
+/* ********************************** */
+
+/* Process context: SO_SET_PREFIX_BLOCKLIST */
+static int build_prefix_blocklist(struct pfring_blocklist_prefix *prefixes, u_int32_t num_prefixes,
+				  struct prefix_blocklist **blocklist)
+{
+  u_int32_t i, j, num_v4 = 0, num_v4_long = 0, num_v6 = 0;
+  struct prefix_blocklist *b;
+
+  for(i = 0; i < num_prefixes; i++) {
+    if((prefixes[i].ip_version == 4) && (prefixes[i].prefix_len <= 32)) {
+      num_v4++;
+      if(prefixes[i].prefix_len > 24) num_v4_long++;
+    } else if((prefixes[i].ip_version == 6) && (prefixes[i].prefix_len <= 128))
+      num_v6++;
+    else
+      return(-EINVAL);
+  }
+
+  if((b = kzalloc(sizeof(struct prefix_blocklist), GFP_KERNEL)) == NULL)
+    return(-ENOMEM);
+
+  b->num_prefixes = num_prefixes;
+
+  if(num_v4 > 0) {
+    b->v4_blocked = vmalloc(BITS_TO_LONGS(1 << 24) * sizeof(unsigned long));
+    b->v4_partial = vmalloc(BITS_TO_LONGS(1 << 24) * sizeof(unsigned long));
+    if((b->v4_blocked == NULL) || (b->v4_partial == NULL)) goto no_memory;
+    memset(b->v4_blocked, 0, BITS_TO_LONGS(1 << 24) * sizeof(unsigned long));
+    memset(b->v4_partial, 0, BITS_TO_LONGS(1 << 24) * sizeof(unsigned long));
+  }
+
+  if((num_v4_long > 0) && ((b->v4_ranges = vmalloc(num_v4_long * sizeof(struct prefix_blocklist_v4_range))) == NULL))
+    goto no_memory;
+
+  if((num_v6 > 0) && ((b->v6_ranges = vmalloc(num_v6 * sizeof(struct prefix_blocklist_v6_range))) == NULL))
+    goto no_memory;
+
+  for(i = 0; i < num_prefixes; i++) {
+    u_int8_t len = prefixes[i].prefix_len;
+
+    if(prefixes[i].ip_version == 4) {
+      u_int32_t mask = len ? (0xFFFFFFFF << (32 - len)) : 0;
+      u_int32_t lo = prefixes[i].addr.v4 & mask, hi = lo | ~mask;
+
+      if(len <= 24) {
+	for(j = lo >> 8; j <= (hi >> 8); j++)
+	  __set_bit(j, b->v4_blocked);
+      } else {
+	b->v4_ranges[b->num_v4_ranges].lo = lo, b->v4_ranges[b->num_v4_ranges].hi = hi;
+	b->num_v4_ranges++;
+	__set_bit(lo >> 8, b->v4_partial);
+      }
+    } else {
+      struct prefix_blocklist_v6_range *r = &b->v6_ranges[b->num_v6_ranges++];
+
+      for(j = 0; j < 16; j++) {
+	u_int8_t bits = (len >= 8 * (j + 1)) ? 0xFF : ((len <= 8 * j) ? 0 : (u_int8_t)(0xFF << (8 - (len - 8 * j))));
+
+	r->lo.s6_addr[j] = prefixes[i].addr.v6.s6_addr[j] & bits;
+	r->hi.s6_addr[j] = prefixes[i].addr.v6.s6_addr[j] | (u_int8_t)~bits;
+      }
+    }
+  }
+
+  /* Sorted and merged: the lookup is a binary search on hi */
+  if(b->num_v4_ranges > 0) {
+    sort(b->v4_ranges, b->num_v4_ranges, sizeof(struct prefix_blocklist_v4_range), cmp_v4_range, NULL);
+
+    for(i = 0, j = 1; j < b->num_v4_ranges; j++) {
+      if(b->v4_ranges[j].lo <= b->v4_ranges[i].hi) {
+	if(b->v4_ranges[j].hi > b->v4_ranges[i].hi) b->v4_ranges[i].hi = b->v4_ranges[j].hi;
+      } else
+	b->v4_ranges[++i] = b->v4_ranges[j];
+    }
+
+    b->num_v4_ranges = i + 1;
+  }
+
+  if(b->num_v6_ranges > 0) {
+    sort(b->v6_ranges, b->num_v6_ranges, sizeof(struct prefix_blocklist_v6_range), cmp_v6_range, NULL);
+
+    for(i = 0, j = 1; j < b->num_v6_ranges; j++) {
+      if(memcmp(&b->v6_ranges[j].lo, &b->v6_ranges[i].hi, sizeof(struct in6_addr)) <= 0) {
+	if(memcmp(&b->v6_ranges[j].hi, &b->v6_ranges[i].hi, sizeof(struct in6_addr)) > 0)
+	  b->v6_ranges[i].hi = b->v6_ranges[j].hi;
+      } else
+	b->v6_ranges[++i] = b->v6_ranges[j];
+    }
+
+    b->num_v6_ranges = i + 1;
+  }
+
+  *blocklist = b;
+  return(0);
+
+ no_memory:
+  free_prefix_blocklist(b);
+  return(-ENOMEM);
+}
+
+/* ********************************** */
+
+#define IP_DEFRAG_RING 1234
+
+/* Returns new sk_buff, or NULL  */
+static struct sk_buff *ring_gather_frags(struct sk_buff *skb)
+{
+#if(LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,23))
+  skb
+#else
+  int status
+#endif
+  = ip_defrag(skb, IP_DEFRAG_RING);
+
+  if(
+#if(LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,23))
+  skb == NULL
+#else
+  status
+#endif
+  )
+    skb = NULL;
+  else
+    ip_send_check(ip_hdr(skb));
+
+  return(skb);
+}
+
+/* ********************************** */
+
+static void ring_sock_destruct(struct sock *sk)
+{
+  struct pf_ring_socket *pfr;
+
+  skb_queue_purge(&sk->sk_receive_queue);
+
+  if(!sock_flag(sk, SOCK_DEAD)) {
+    if(debug_on()) {
+      printk("[PF_RING] Attempt to release alive ring socket: %p\n", sk);
+    }
+    return;
+  }
+
+  pfr = ring_sk(sk);
+
+  if(pfr)
+    kfree(pfr);
+}
+
+/* ********************************** */
+
+static void ring_proc_add(struct pf_ring_socket *pfr)
+{
+  if((ring_proc_dir != NULL)
+     && (pfr->sock_proc_name[0] == '\0')) {
+    snprintf(pfr->sock_proc_name, sizeof(pfr->sock_proc_name),
+	     "%d-%s.%d", pfr->ring_pid,
+	     pfr->ring_netdev->dev->name, pfr->ring_id);
+
+    create_proc_read_entry(pfr->sock_proc_name, 0 /* read-only */,
+			   ring_proc_dir,
+			   ring_proc_get_info, pfr);
+
+    if(debug_on())
+      printk("[PF_RING] Added /proc/net/pf_ring/%s\n", pfr->sock_proc_name);
+
+    ring_table_size++;
+  }
+}
+
+/* ********************************** */
+
+static void ring_proc_remove(struct pf_ring_socket *pfr)
+{
+  if((ring_proc_dir != NULL)
+     && (pfr->sock_proc_name[0] != '\0')) {
+    if(debug_on())
+      printk("[PF_RING] Removing /proc/net/pf_ring/%s\n", pfr->sock_proc_name);
+
+    remove_proc_entry(pfr->sock_proc_name, ring_proc_dir);
+
+    if(debug_on())
+      printk("[PF_RING] Removed /proc/net/pf_ring/%s\n", pfr->sock_proc_name);
+
+    pfr->sock_proc_name[0] = '\0';
+    ring_table_size--;
+  }
+}
+
+/* ********************************** */
+
+static int ring_proc_dev_get_info(char *buf, char **start, off_t offset,
+				  int len, int *unused, void *data)
+{
+  int rlen = 0;
+
+  if(data != NULL) {
+    ring_device_element *dev_ptr = (ring_device_element*)data;
+    struct net_device *dev = dev_ptr->dev;
+    char dev_buf[16] = { 0 }, *dev_family = "???";
+
+    if(dev_ptr->is_dna_device) {
+      switch(dev_ptr->dna_device_model) {
       case intel_e1000:
 	dev_family = "Intel e1000"; break;
       case intel_e1000e:
@@ -900,6 +1520,7 @@ static int ring_proc_dev_get_info(char *buf, char **start, off_t offset,
       switch(dev_ptr->device_type) {
       case standard_nic_family: dev_family = "Standard NIC"; break;
       case intel_82599_family:  dev_family = "Intel 82599"; break;
+      case chelsio_t4_family:   dev_family = "Chelsio T4"; break;
       }
     }
 
@@ -940,26 +1561,15 @@ static int ring_proc_dev_get_info(char *buf, char **start, off_t offset,
 
 /* **************** 82599 ****************** */
 
-static int i82599_generic_handler(struct pf_ring_socket *pfr,
-				  hw_filtering_rule *rule, hw_filtering_rule_command request) {
-  int rc = -1;
-
 #ifdef I82599_HW_FILTERING_SUPPORT
-  struct net_device *dev = pfr->ring_netdev->dev;
+/* The ethtool command of a rule: ETHTOOL_SRXCLSRLINS/DEL (perfect), ETHTOOL_PFRING_SRXFTRLINS/DEL (five tuple) */
+static int i82599_rule_to_rxnfc(hw_filtering_rule *rule, hw_filtering_rule_command request,
+				struct ethtool_rxnfc *cmd) {
   intel_82599_five_tuple_filter_hw_rule *ftfq_rule;
   intel_82599_perfect_filter_hw_rule *perfect_rule;
-  struct ethtool_rxnfc cmd;
-  struct ethtool_rx_flow_spec *fsp = (struct ethtool_rx_flow_spec *) &cmd.fs;
-
-  if(dev == NULL) return(-1);
-
-  if((dev->ethtool_ops == NULL) || (dev->ethtool_ops->set_rxnfc == NULL)) return(-1);
-
-  if(unlikely(enable_debug))
-    printk("[PF_RING] hw_filtering_rule[%s][request=%d][%p]\n",
-	   dev->name, request, dev->ethtool_ops->set_rxnfc);
+  struct ethtool_rx_flow_spec *fsp = (struct ethtool_rx_flow_spec *) &cmd->fs;
 
-  memset(&cmd, 0, sizeof(struct ethtool_rxnfc));
+  memset(cmd, 0, sizeof(struct ethtool_rxnfc));
 
   switch (rule->rule_family_type) {
     case intel_82599_five_tuple_rule:
@@ -973,7 +1583,7 @@ static int i82599_generic_handler(struct pf_ring_socket *pfr,
       fsp->ring_cookie = ftfq_rule->queue_id;
       fsp->location    = rule->rule_id;
 
-      cmd.cmd = (request == add_hw_rule ? ETHTOOL_PFRING_SRXFTRLINS : ETHTOOL_PFRING_SRXFTRLDEL);
+      cmd->cmd = (request == add_hw_rule ? ETHTOOL_PFRING_SRXFTRLINS : ETHTOOL_PFRING_SRXFTRLDEL);
 
       break;
 
@@ -1026,19 +1636,41 @@ static int i82599_generic_handler(struct pf_ring_socket *pfr,
 	  break;
       }
 
-      cmd.cmd = (request == add_hw_rule ? ETHTOOL_SRXCLSRLINS : ETHTOOL_SRXCLSRLDEL);
+      cmd->cmd = (request == add_hw_rule ? ETHTOOL_SRXCLSRLINS : ETHTOOL_SRXCLSRLDEL);
 
       break;
 
     default:
-      break;
+      return(-1);
   }
 
-  if (cmd.cmd) {
+  return(0);
+}
+#endif
+
+/* ************************************* */
+
+static int i82599_generic_handler(struct pf_ring_socket *pfr,
+				  hw_filtering_rule *rule, hw_filtering_rule_command request) {
+  int rc = -1;
+
+#ifdef I82599_HW_FILTERING_SUPPORT
+  struct net_device *dev = pfr->ring_netdev->dev;
+  struct ethtool_rxnfc cmd;
+
+  if(dev == NULL) return(-1);
+
+  if((dev->ethtool_ops == NULL) || (dev->ethtool_ops->set_rxnfc == NULL)) return(-1);
+
+  if(debug_on())
+    printk("[PF_RING] hw_filtering_rule[%s][request=%d][%p]\n",
+	   dev->name, request, dev->ethtool_ops->set_rxnfc);
+
+  if (i82599_rule_to_rxnfc(rule, request, &cmd) == 0) {
 
     rc = dev->ethtool_ops->set_rxnfc(dev, &cmd);
 
-    if (unlikely(enable_debug)
+    if (debug_on()
      && rule->rule_family_type == intel_82599_perfect_filter_rule
      && rc < 0) {
       intel_82599_perfect_filter_hw_rule *perfect_rule = &rule->rule_family.perfect_rule;
@@ -1058,13 +1690,85 @@ static int i82599_generic_handler(struct pf_ring_socket *pfr,
   return(rc);
 }
 
+/* **************** Chelsio T4 ****************** */
+
+/* cxgb4 takes the standard ethtool classifier requests: masks give the prefixes */
+static int chelsio_t4_handler(struct pf_ring_socket *pfr,
+			      hw_filtering_rule *rule, hw_filtering_rule_command request) {
+  int rc = -1;
+
+#ifdef I82599_HW_FILTERING_SUPPORT
+  struct net_device *dev = pfr->ring_netdev->dev;
+  chelsio_t4_filter_hw_rule *t4_rule = &rule->rule_family.t4_rule;
+  struct ethtool_rxnfc cmd;
+  struct ethtool_rx_flow_spec *fsp = (struct ethtool_rx_flow_spec *) &cmd.fs;
+
+  if(dev == NULL) return(-1);
+
+  if((dev->ethtool_ops == NULL) || (dev->ethtool_ops->set_rxnfc == NULL)) return(-1);
+
+  if((t4_rule->s_mask_len > 32) || (t4_rule->d_mask_len > 32)) return(-EINVAL);
+
+  memset(&cmd, 0, sizeof(struct ethtool_rxnfc));
+
+  fsp->location = rule->rule_id;
+
+  if(request == remove_hw_rule) {
+    cmd.cmd = ETHTOOL_SRXCLSRLDEL;
+    return(dev->ethtool_ops->set_rxnfc(dev, &cmd));
+  }
+
+  if(t4_rule->s_mask_len) {
+    fsp->m_u.tcp_ip4_spec.ip4src = htonl(0xFFFFFFFF << (32 - t4_rule->s_mask_len));
+    fsp->h_u.tcp_ip4_spec.ip4src = htonl(t4_rule->s_addr) & fsp->m_u.tcp_ip4_spec.ip4src;
+  }
+
+  if(t4_rule->d_mask_len) {
+    fsp->m_u.tcp_ip4_spec.ip4dst = htonl(0xFFFFFFFF << (32 - t4_rule->d_mask_len));
+    fsp->h_u.tcp_ip4_spec.ip4dst = htonl(t4_rule->d_addr) & fsp->m_u.tcp_ip4_spec.ip4dst;
+  }
+
+  switch(t4_rule->proto) {
+  case 6:   fsp->flow_type = TCP_V4_FLOW;  break;
+  case 17:  fsp->flow_type = UDP_V4_FLOW;  break;
+  case 132: fsp->flow_type = SCTP_V4_FLOW; break;
+  default:
+    fsp->flow_type = IP_USER_FLOW;
+    fsp->h_u.usr_ip4_spec.proto = t4_rule->proto;
+    fsp->m_u.usr_ip4_spec.proto = t4_rule->proto ? 0xFF : 0;
+    break;
+  }
+
+  if(fsp->flow_type != IP_USER_FLOW) {
+    if(t4_rule->s_port) {
+      fsp->h_u.tcp_ip4_spec.psrc = htons(t4_rule->s_port);
+      fsp->m_u.tcp_ip4_spec.psrc = 0xFFFF;
+    }
+
+    if(t4_rule->d_port) {
+      fsp->h_u.tcp_ip4_spec.pdst = htons(t4_rule->d_port);
+      fsp->m_u.tcp_ip4_spec.pdst = 0xFFFF;
+    }
+  }
+
+  fsp->ring_cookie = (t4_rule->queue_id == (u_int16_t)-1) ? RX_CLS_FLOW_DISC : t4_rule->queue_id;
+  cmd.cmd = ETHTOOL_SRXCLSRLINS;
+
+  rc = dev->ethtool_ops->set_rxnfc(dev, &cmd);
+
+  if(debug_on())
+    printk("[PF_RING] %s() %s rule %d returned %d\n", __FUNCTION__, dev->name, rule->rule_id, rc);
+#endif
+  return(rc);
+}
+
 /* ************************************* */
 
 static int handle_hw_filtering_rule(struct pf_ring_socket *pfr,
 				    hw_filtering_rule *rule,
 				    hw_filtering_rule_command command) {
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> handle_hw_filtering_rule(command=%d)\n", command);
 
   switch(rule->rule_family_type) {
@@ -1085,41 +1789,253 @@ static int handle_hw_filtering_rule(struct pf_ring_socket *pfr,
   case silicom_redirector_rule:
     return(-EINVAL); /* handled in userland */
     break;
+
+  case chelsio_t4_filter_rule:
+    if(pfr->ring_netdev->hw_filters.filter_handlers.t4_filter_handler == NULL)
+      return(-EINVAL);
+    else
+      return(chelsio_t4_handler(pfr, rule, command));
+    break;
   }
 
   return(-EINVAL);
 }
 
-/* ***************************************** */
+/* ************************************* */
 
-#ifdef ENABLE_PROC_WRITE_RULE
-#if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31))
-static int ring_proc_dev_rule_read(char *buf, char **start, off_t offset,
-				   int len, int *unused, void *data)
-{
-  int rlen = 0;
+/* The num rules of a batch, in order: one driver call if all of them go through ethtool on an 82599 */
+static int program_hw_filtering_rules(struct pf_ring_socket *pfr, hw_filtering_rule *rules,
+				      u_int32_t num, hw_filtering_rule_command command,
+				      u_int32_t *num_done) {
+  int rc;
+  u_int32_t i;
 
-  if(data != NULL) {
-    ring_device_element *dev_ptr = (ring_device_element*)data;
-    struct net_device *dev = dev_ptr->dev;
+  *num_done = 0;
 
-    rlen =  sprintf(buf,      "Name:              %s\n", dev->name);
-    rlen += sprintf(buf+rlen, "# Filters:         %d\n", dev_ptr->hw_filters.num_filters);
-    rlen += sprintf(buf+rlen, "\nFiltering Rules:\n"
-		    "[perfect rule]  +|-(rule_id,queue_id,vlan,tcp|udp,src_ip/mask,src_port,dst_ip/mask,dst_port)\n"
-		    "Example:\t+(1,-1,0,tcp,192.168.0.10/32,25,10.6.0.0/16,0) (queue_id = -1 => drop)\n\n"
-		    "[5 tuple rule]  +|-(rule_id,queue_id,tcp|udp,src_ip,src_port,dst_ip,dst_port)\n"
-		    "Example:\t+(1,-1,tcp,192.168.0.10,25,0.0.0.0,0)\n\n"
-		    "Note:\n\t- queue_id = -1 => drop\n\t- 0 = ignore value\n");
-  }
+#ifdef I82599_HW_FILTERING_SUPPORT
+  {
+    struct net_device *dev = pfr->ring_netdev->dev;
+    struct pfring_ethtool_bulk bulk;
+    struct ethtool_rxnfc *cmd;
+
+    for(i = 0; i < num; i++)
+      if(((rules[i].rule_family_type != intel_82599_five_tuple_rule)
+	  || (pfr->ring_netdev->hw_filters.filter_handlers.five_tuple_handler == NULL))
+	 && ((rules[i].rule_family_type != intel_82599_perfect_filter_rule)
+	     || (pfr->ring_netdev->hw_filters.filter_handlers.perfect_filter_handler == NULL)))
+	break;
 
-  return rlen;
-}
-#endif
+    if((i == num) && (num > 1) && (dev != NULL) && (dev->ethtool_ops != NULL)
+       && (dev->ethtool_ops->set_rxnfc != NULL)
+       && ((cmd = vmalloc(num * sizeof(struct ethtool_rxnfc))) != NULL)) {
+      struct ethtool_rxnfc req;
 
-/* ********************************** */
+      for(i = 0; i < num; i++)
+	i82599_rule_to_rxnfc(&rules[i], command, &cmd[i]);
 
-#ifdef ENABLE_PROC_WRITE_RULE
+      memset(&req, 0, sizeof(req));
+      bulk.num = num, bulk.num_done = 0, bulk.cmd = cmd;
+      req.cmd = ETHTOOL_PFRING_SRXFTRLBULK, req.data = (unsigned long)&bulk;
+
+      rc = dev->ethtool_ops->set_rxnfc(dev, &req);
+      vfree(cmd);
+
+      if(debug_on())
+	printk("[PF_RING] %s() %s: %u/%u rules in one call [rc=%d]\n",
+	       __FUNCTION__, dev->name, bulk.num_done, num, rc);
+
+      if((rc != -EOPNOTSUPP) || (bulk.num_done > 0)) {
+	*num_done = bulk.num_done;
+	return((rc < 0) ? rc : 0);
+      }
+      /* a driver without the bulk path: one call per rule */
+    }
+  }
+#endif
+
+  for(i = 0; i < num; i++) {
+    if((rc = handle_hw_filtering_rule(pfr, &rules[i], command)) < 0)
+      return(rc);
+
+    (*num_done)++;
+  }
+
+  return(0);
+}
+
+/* ************************************* */
+
+static hw_filtering_rule_element* find_hw_filtering_rule(struct pf_ring_socket *pfr, u_int16_t rule_id) {
+  struct list_head *ptr, *tmp_ptr;
+
+  list_for_each_safe(ptr, tmp_ptr, &pfr->hw_filtering_rules) {
+    hw_filtering_rule_element *rule = list_entry(ptr, hw_filtering_rule_element, list);
+
+    if(rule->rule.rule_id == rule_id)
+      return(rule);
+  }
+
+  return(NULL);
+}
+
+/* ************************************* */
+
+static int handle_hw_filtering_rules_bulk(struct pf_ring_socket *pfr,
+					  char __user *optval, unsigned int optlen,
+					  u_char add_rule)
+{
+  struct pfring_hw_rules_bulk bulk;
+  size_t rule_len = add_rule ? sizeof(hw_filtering_rule) : sizeof(u_int16_t);
+  hw_filtering_rule_element **elems;
+  hw_filtering_rule *rules;
+  u_int16_t *ids = NULL;
+  u_int32_t i, j, num = 0, num_done = 0;
+  struct list_head *ptr, *tmp_ptr;
+  int rc = 0;
+
+  if(optlen < sizeof(bulk))
+    return -EINVAL;
+
+  if(copy_from_user(&bulk, optval, sizeof(bulk)))
+    return -EFAULT;
+
+  if((bulk.num_rules > MAX_HW_RULES_BULK)
+     || (optlen != sizeof(bulk) + bulk.num_rules * rule_len))
+    return -EINVAL;
+
+  if(bulk.num_rules == 0)
+    return(0);
+
+  rules = vmalloc(bulk.num_rules * sizeof(hw_filtering_rule));
+  elems = vmalloc(bulk.num_rules * sizeof(hw_filtering_rule_element*));
+  if(!add_rule) ids = vmalloc(bulk.num_rules * sizeof(u_int16_t));
+
+  if((rules == NULL) || (elems == NULL) || (!add_rule && (ids == NULL))) {
+    rc = -ENOMEM;
+    goto out;
+  }
+
+  if(copy_from_user(add_rule ? (void*)rules : (void*)ids, optval + sizeof(bulk), bulk.num_rules * rule_len)) {
+    rc = -EFAULT;
+    goto out;
+  }
+
+  /* The rules to program, packed at the front of rules[], with their list element */
+  for(i = 0; i < bulk.num_rules; i++) {
+    if(add_rule) {
+      hw_filtering_rule_element *rule;
+
+      if(find_hw_filtering_rule(pfr, rules[i].rule_id) != NULL)
+	continue;
+
+      for(j = 0; (j < num) && (rules[j].rule_id != rules[i].rule_id); j++)
+	;
+      if(j < num)
+	continue; /* twice in the batch */
+
+      if((rule = kmalloc(sizeof(hw_filtering_rule_element), GFP_KERNEL)) == NULL) {
+	rc = -ENOMEM;
+	break;
+      }
+
+      INIT_LIST_HEAD(&rule->list);
+      memcpy(&rule->rule, &rules[i], sizeof(hw_filtering_rule));
+      if(num != i) memcpy(&rules[num], &rules[i], sizeof(hw_filtering_rule));
+      elems[num++] = rule;
+    } else {
+      hw_filtering_rule_element *rule = find_hw_filtering_rule(pfr, ids[i]);
+
+      if(rule == NULL)
+	continue;
+
+      /* Off the list until programmed: an id twice in the batch is found once */
+      list_del(&rule->list);
+      memcpy(&rules[num], &rule->rule, sizeof(hw_filtering_rule));
+      elems[num++] = rule;
+    }
+  }
+
+  if(rc == 0)
+    rc = program_hw_filtering_rules(pfr, rules, num, add_rule ? add_hw_rule : remove_hw_rule, &num_done);
+
+  for(i = 0; i < num; i++) {
+    if(add_rule) {
+      if(i < num_done)
+	list_add(&elems[i]->list, &pfr->hw_filtering_rules); /* Add as first entry */
+      else
+	kfree(elems[i]);
+    } else {
+      if(i < num_done)
+	kfree(elems[i]);
+      else
+	list_add(&elems[i]->list, &pfr->hw_filtering_rules); /* still in the NIC */
+    }
+  }
+
+  if(num_done > 0) {
+    if(add_rule)
+      pfr->num_hw_filtering_rules += num_done;
+    else
+      pfr->num_hw_filtering_rules -= num_done;
+
+    list_for_each_safe(ptr, tmp_ptr, &ring_aware_device_list) {
+      ring_device_element *dev_ptr = list_entry(ptr, ring_device_element, device_list);
+
+      if(dev_ptr->dev == pfr->ring_netdev->dev) {
+	if(add_rule)
+	  dev_ptr->hw_filters.num_filters += num_done;
+	else
+	  dev_ptr->hw_filters.num_filters -= min_t(u_int32_t, num_done, dev_ptr->hw_filters.num_filters);
+	break;
+      }
+    }
+  }
+
+  if(debug_on())
+    printk("[PF_RING] %s() %s %u/%u hw rules [rc=%d]\n", __FUNCTION__,
+	   add_rule ? "added" : "removed", num_done, bulk.num_rules, rc);
+
+ out:
+  if(rules != NULL) vfree(rules);
+  if(elems != NULL) vfree(elems);
+  if(ids != NULL) vfree(ids);
+
+  if(copy_to_user(optval + offsetof(struct pfring_hw_rules_bulk, num_done), &num_done, sizeof(num_done)))
+    return -EFAULT;
+
+  return(rc);
+}
+
+/* ***************************************** */
+
+#ifdef ENABLE_PROC_WRITE_RULE
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31))
+static int ring_proc_dev_rule_read(char *buf, char **start, off_t offset,
+				   int len, int *unused, void *data)
+{
+  int rlen = 0;
+
+  if(data != NULL) {
+    ring_device_element *dev_ptr = (ring_device_element*)data;
+    struct net_device *dev = dev_ptr->dev;
+
+    rlen =  sprintf(buf,      "Name:              %s\n", dev->name);
+    rlen += sprintf(buf+rlen, "# Filters:         %d\n", dev_ptr->hw_filters.num_filters);
+    rlen += sprintf(buf+rlen, "\nFiltering Rules:\n"
+		    "[perfect rule]  +|-(rule_id,queue_id,vlan,tcp|udp,src_ip/mask,src_port,dst_ip/mask,dst_port)\n"
+		    "Example:\t+(1,-1,0,tcp,192.168.0.10/32,25,10.6.0.0/16,0) (queue_id = -1 => drop)\n\n"
+		    "[5 tuple rule]  +|-(rule_id,queue_id,tcp|udp,src_ip,src_port,dst_ip,dst_port)\n"
+		    "Example:\t+(1,-1,tcp,192.168.0.10,25,0.0.0.0,0)\n\n"
+		    "Note:\n\t- queue_id = -1 => drop\n\t- 0 = ignore value\n");
+  }
+
+  return rlen;
+}
+#endif
+
+/* ********************************** */
+
+#ifdef ENABLE_PROC_WRITE_RULE
 static void init_intel_82599_five_tuple_filter_hw_rule(u_int8_t queue_id, u_int8_t proto,
 						       u_int32_t s_addr, u_int32_t d_addr,
 						       u_int16_t s_port, u_int16_t d_port,
@@ -1185,7 +2101,7 @@ static int ring_proc_dev_rule_write(struct file *file,
   if(copy_from_user(buf, buffer, count))  return(-EFAULT);
   buf[sizeof(buf)-1] = '\0', buf[count] = '\0';
 
-  if(unlikely(enable_debug)) printk("[PF_RING] ring_proc_dev_rule_write(%s)\n", buf);
+  if(debug_on()) printk("[PF_RING] ring_proc_dev_rule_write(%s)\n", buf);
 
   num = sscanf(buf, "%c(%d,%d,%d,%c%c%c,%d.%d.%d.%d/%d,%d,%d.%d.%d.%d/%d,%d)",
 	       &add, &rule_id, &queue_id, &vlan,
@@ -1193,7 +2109,7 @@ static int ring_proc_dev_rule_write(struct file *file,
 	       &s_a, &s_b, &s_c, &s_d, &s_mask, &s_port,
 	       &d_a, &d_b, &d_c, &d_d, &d_mask, &d_port);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_proc_dev_rule_write(%s): num=%d (1)\n", buf, num);
 
   if(num == 19) {
@@ -1218,7 +2134,7 @@ static int ring_proc_dev_rule_write(struct file *file,
 		 &s_a, &s_b, &s_c, &s_d, &s_port,
 		 &d_a, &d_b, &d_c, &d_d, &d_port);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] ring_proc_dev_rule_write(%s): num=%d (2)\n", buf, num);
 
     if(num == 16) {
@@ -1266,6 +2182,127 @@ static int ring_proc_dev_rule_write(struct file *file,
 
 /* ********************************** */
 
+static pfring_device_tuning* get_device_tuning(int ifindex) {
+  if((ifindex < 0) || (ifindex >= MAX_NUM_IFIDX))
+    return(NULL);
+
+  return(&device_tuning[ifindex]);
+}
+
+/* ********************************** */
+
+/* Tells the driver feeding a full ring to back off (see pfring_device_tuning) */
+static inline void set_device_busy(struct sk_buff *skb) {
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,30))
+  u_int16_t queue;
+
+  if((skb == NULL) || (skb->dev == NULL) || (skb->dev->ifindex >= MAX_NUM_IFIDX))
+    return;
+
+  queue = skb_get_rx_queue(skb);
+
+  if((queue < MAX_NUM_RX_CHANNELS)
+     && device_tuning[skb->dev->ifindex].busy_itr_usecs
+     && !test_bit(queue, &device_tuning[skb->dev->ifindex].busy_queues))
+    set_bit(queue, &device_tuning[skb->dev->ifindex].busy_queues);
+#endif
+}
+
+/* ********************************** */
+
+static int ring_proc_dev_tuning_read(char *buf, char **start, off_t offset,
+				     int len, int *unused, void *data)
+{
+  int rlen = 0, i;
+
+  if(data != NULL) {
+    ring_device_element *dev_ptr = (ring_device_element*)data;
+    pfring_device_tuning *t = get_device_tuning(dev_ptr->dev->ifindex);
+
+    if(t == NULL) return(0);
+
+    rlen =  sprintf(buf,      "Name:              %s\n", dev_ptr->dev->name);
+    rlen += sprintf(buf+rlen, "Busy ITR (usec):   %u\n", t->busy_itr_usecs);
+    rlen += sprintf(buf+rlen, "Busy Queues:       0x%08lx\n", t->busy_queues);
+    rlen += sprintf(buf+rlen, "\nQueue  NAPI Budget  Max ITR (usec)\n");
+
+    for(i = 0; i < MAX_NUM_RX_CHANNELS; i++)
+      if(t->napi_budget[i] || t->max_itr_usecs[i])
+	rlen += sprintf(buf+rlen, "%5d  %11u  %14u\n", i, t->napi_budget[i], t->max_itr_usecs[i]);
+
+    rlen += sprintf(buf+rlen, "\nSettings (0 = driver default, queue_id = -1 => all queues):\n"
+		    "budget <queue_id> <packets per poll>\n"
+		    "max_itr <queue_id> <usec>\n"
+		    "busy_itr <usec>   (interrupt rate while the rings are full, 0 = no backoff)\n");
+  }
+
+  return rlen;
+}
+
+/* ********************************** */
+
+static int ring_proc_dev_tuning_write(struct file *file,
+				      const char __user *buffer,
+				      unsigned long count, void *data)
+{
+  char buf[64], what[16];
+  ring_device_element *dev_ptr = (ring_device_element*)data;
+  pfring_device_tuning *t;
+  int num, queue_id, value, i;
+
+  if(data == NULL) return(0);
+
+  if((t = get_device_tuning(dev_ptr->dev->ifindex)) == NULL)
+    return(-EINVAL);
+
+  if(count > (sizeof(buf)-1))             count = sizeof(buf) - 1;
+  if(copy_from_user(buf, buffer, count))  return(-EFAULT);
+  buf[sizeof(buf)-1] = '\0', buf[count] = '\0';
+
+  num = sscanf(buf, "%15s %d %d", what, &queue_id, &value);
+
+  if((num == 2) && (!strcmp(what, "busy_itr"))) {
+    t->busy_itr_usecs = min_val(max_val(queue_id, 0), 0xFFFF);
+    if(t->busy_itr_usecs == 0) t->busy_queues = 0;
+    return((int)count);
+  }
+
+  if((num != 3) || (queue_id >= MAX_NUM_RX_CHANNELS))
+    return(-EINVAL);
+
+  value = min_val(max_val(value, 0), 0xFFFF);
+
+  for(i = 0; i < MAX_NUM_RX_CHANNELS; i++) {
+    if((queue_id >= 0) && (i != queue_id)) continue;
+
+    if(!strcmp(what, "budget"))
+      t->napi_budget[i] = value;
+    else if(!strcmp(what, "max_itr"))
+      t->max_itr_usecs[i] = value;
+    else
+      return(-EINVAL);
+  }
+
+  if(debug_on())
+    printk("[PF_RING] %s: %s[%d] = %d\n", dev_ptr->dev->name, what, queue_id, value);
+
+  return((int)count);
+}
+
+/* ********************************** */
+
+static void ring_proc_dev_tuning_add(ring_device_element *dev_ptr) {
+  struct proc_dir_entry *entry;
+
+  entry = create_proc_read_entry(PROC_TUNING, 0644 /* rw */,
+				 dev_ptr->proc_entry,
+				 ring_proc_dev_tuning_read, dev_ptr);
+  if(entry)
+    entry->write_proc = ring_proc_dev_tuning_write;
+}
+
+/* ********************************** */
+
 static char* direction2string(packet_direction d) {
   switch(d) {
   case rx_and_tx_direction: return("RX+TX");
@@ -1290,6 +2327,26 @@ static char* sockmode2string(socket_mode m) {
 
 /* ********************************** */
 
+/* Non-empty buckets only, as <upper bound>:<count> */
+static int sprint_latency_histogram(char *buf, char *label, u_int64_t *hist)
+{
+  int rlen = sprintf(buf, "%s", label), i;
+
+  for(i = 0; i < PFRING_LATENCY_BUCKETS; i++) {
+    if(hist[i] == 0)
+      continue;
+
+    if(i == (PFRING_LATENCY_BUCKETS - 1))
+      rlen += sprintf(buf + rlen, " more:%llu", (unsigned long long)hist[i]);
+    else
+      rlen += sprintf(buf + rlen, " %llu:%llu", i ? (1ULL << i) : 0ULL, (unsigned long long)hist[i]);
+  }
+
+  return(rlen + sprintf(buf + rlen, "\n"));
+}
+
+/* ********************************** */
+
 static int ring_proc_get_info(char *buf, char **start, off_t offset,
 			      int len, int *unused, void *data)
 {
@@ -1303,18 +2360,25 @@ static int ring_proc_get_info(char *buf, char **start, off_t offset,
     rlen += sprintf(buf + rlen, "Slot version        : %d\n", RING_FLOWSLOT_VERSION);
     rlen += sprintf(buf + rlen, "Capture TX          : %s\n", enable_tx_capture ? "Yes [RX+TX]" : "No [RX only]");
     rlen += sprintf(buf + rlen, "IP Defragment       : %s\n", enable_ip_defrag ? "Yes" : "No");
+    rlen += sprintf(buf + rlen, "Fragment ports      : %s\n", enable_frag_coherence ? "Yes" : "No");
     rlen += sprintf(buf + rlen, "Socket Mode         : %s\n", quick_mode ? "Quick" : "Standard");
+    rlen += sprintf(buf + rlen, "Reflect batching    : %s [TX errors: %d]\n",
+		    enable_reflect_batch ? "Yes" : "No", atomic_read(&reflect_xmit_failures));
     rlen += sprintf(buf + rlen, "Transparent mode    : %s\n",
 		    (transparent_mode == standard_linux_path ? "Yes (mode 0)" :
 		     (transparent_mode == driver2pf_ring_transparent ? "Yes (mode 1)" : "No (mode 2)")));
     rlen += sprintf(buf + rlen, "Total rings         : %d\n", ring_table_size);
     rlen += sprintf(buf + rlen, "Total plugins       : %d\n", plugin_registration_size);
+    rlen += sprintf(buf + rlen, "Ring memory pool    : %u/%u rings [%llu MB][%llu reused]\n",
+		    ring_mem_pool_len, ring_mem_pool,
+		    (unsigned long long)(ring_mem_pool_bytes >> 20), (unsigned long long)ring_mem_pool_hits);
   } else {
     /* Detailed statistics about a PF_RING */
     struct pf_ring_socket *pfr = (struct pf_ring_socket *)data;
 
     if(data) {
       fsi = pfr->slots_info;
+      fold_ring_stats(pfr);
 
       if(fsi) {
 	int num = 0;
@@ -1337,6 +2401,35 @@ static int ring_proc_get_info(char *buf, char **start, off_t offset,
 	rlen += sprintf(buf + rlen, "Active             : %d\n", pfr->ring_active);
 	rlen += sprintf(buf + rlen, "Breed              : %s\n", (pfr->dna_device_entry != NULL) ? "DNA" : "Non-DNA");
 	rlen += sprintf(buf + rlen, "Sampling Rate      : %d\n", pfr->sample_rate);
+	if(pfr->flow_sample_threshold != 0)
+	  rlen += sprintf(buf + rlen, "Flow Sampling Rate : %u\n",
+			  0xFFFFFFFFU / pfr->flow_sample_threshold);
+	if((pfr->flow_cache != NULL) && (pfr->flow_cache_lifetime > 0)) {
+	  u_int64_t hits = 0, misses = 0;
+	  int cpu;
+
+	  for_each_possible_cpu(cpu)
+	    hits += per_cpu_ptr(pfr->flow_cache, cpu)->hits, misses += per_cpu_ptr(pfr->flow_cache, cpu)->misses;
+	  rlen += sprintf(buf + rlen, "Flow Cache         : %u msec [%llu hits][%llu misses]\n",
+			  jiffies_to_msecs(pfr->flow_cache_lifetime),
+			  (unsigned long long)hits, (unsigned long long)misses);
+	}
+	rcu_read_lock();
+	if(rcu_dereference(pfr->prefix_blocklist) != NULL) {
+	  u_int64_t tot_blocked = 0;
+	  int cpu;
+
+	  for_each_possible_cpu(cpu)
+	    tot_blocked += per_cpu_ptr(pfr->cpu_stats, cpu)->tot_blocked;
+
+	  rlen += sprintf(buf + rlen, "Prefix Blocklist   : %u prefixes [%llu pkts dropped]\n",
+			  rcu_dereference(pfr->prefix_blocklist)->num_prefixes, tot_blocked);
+	}
+	rcu_read_unlock();
+	if(pfr->overload.sample_threshold > 0)
+	  rlen += sprintf(buf + rlen, "Overload Sampling  : 1:%u above %u%% [%llu pkts]\n",
+			  pfr->slots_info ? pfr->slots_info->overload_sample_rate : 1,
+			  pfr->overload.sample_threshold, pfr->slots_info ? pfr->slots_info->tot_sampled : 0);
 	rlen += sprintf(buf + rlen, "Capture Direction  : %s\n", direction2string(pfr->direction));
 	rlen += sprintf(buf + rlen, "Socket Mode        : %s\n", sockmode2string(pfr->mode));
 	rlen += sprintf(buf + rlen, "Appl. Name         : %s\n", pfr->appl_name ? pfr->appl_name : "<unknown>");
@@ -1344,7 +2437,22 @@ static int ring_proc_get_info(char *buf, char **start, off_t offset,
 	rlen += sprintf(buf + rlen, "BPF Filtering      : %s\n", pfr->bpfFilter ? "Enabled" : "Disabled");
 	rlen += sprintf(buf + rlen, "# Sw Filt. Rules   : %d\n", pfr->num_sw_filtering_rules);
 	rlen += sprintf(buf + rlen, "# Hw Filt. Rules   : %d\n", pfr->num_hw_filtering_rules);
+	if(pfr->sw_filtering_hash != NULL)
+	  rlen += sprintf(buf + rlen, "Hash Rules Table   : %u buckets%s [%u rules max]\n",
+			  pfr->sw_filtering_hash->size, pfr->sw_filtering_hash_resize ? " (doubling)" : "",
+			  pfr->max_hash_rules);
+	if(pfr->hash_rules_idle_timeout > 0)
+	  rlen += sprintf(buf + rlen, "Hash Rules Timeout : %u sec\n", pfr->hash_rules_idle_timeout);
 	rlen += sprintf(buf + rlen, "Poll Pkt Watermark : %d\n", pfr->poll_num_pkts_watermark);
+	rlen += sprintf(buf + rlen, "Poll Coalescing    : %u usec\n", pfr->poll_coalescing_usec);
+#ifdef VPFRING_SUPPORT
+	if(pfr->vpfring_host_eventfd_ctx)
+	  rlen += sprintf(buf + rlen, "vPFRing Signals    : %llu [coalescing %u pkts/%u usec]\n",
+			  (unsigned long long)pfr->vpfring_signals,
+			  pfr->vpfring_coalescing_pkts, pfr->vpfring_coalescing_usec);
+#endif
+	rlen += sprintf(buf + rlen, "Ring Memory        : %s\n",
+			(pfr->ring_mem.order >= 0) ? "Contiguous" : (pfr->ring_mem.pages ? "NUMA Local" : "vmalloc"));
 	rlen += sprintf(buf + rlen, "Num Poll Calls     : %u\n", pfr->num_poll_calls);
 
 	if(pfr->dna_device_entry != NULL) {
@@ -1359,24 +2467,45 @@ static int ring_proc_get_info(char *buf, char **start, off_t offset,
 			    pfr->dna_device_entry->dev.mem_info.tx.packet_memory_chunk_len   )
 			  + pfr->dna_device_entry->dev.mem_info.rx.descr_packet_memory_tot_len
 			  + pfr->dna_device_entry->dev.mem_info.tx.descr_packet_memory_tot_len);
+	  rlen += sprintf(buf + rlen, "Poll: Sleeps       : %llu\n", (unsigned long long)pfr->dna_wait.sleeps);
+	  rlen += sprintf(buf + rlen, "Poll: Wakeups      : %llu\n", (unsigned long long)pfr->dna_wait.wakeups);
+	  rlen += sprintf(buf + rlen, "Poll: Busy         : %llu\n", (unsigned long long)pfr->dna_wait.busy_polls);
+	  rlen += sprintf(buf + rlen, "Poll: IRQ Disarms  : %llu\n", (unsigned long long)pfr->dna_wait.disarms);
 	} else {
 	  rlen += sprintf(buf + rlen, "Channel Id         : %d\n", pfr->channel_id);
 	  rlen += sprintf(buf + rlen, "Cluster Id         : %d\n", pfr->cluster_id);
 	  rlen += sprintf(buf + rlen, "Min Num Slots      : %d\n", fsi->min_num_slots);
 	  rlen += sprintf(buf + rlen, "Bucket Len         : %d\n", fsi->data_len);
 	  rlen += sprintf(buf + rlen, "Slot Len           : %d [bucket+header]\n", fsi->slot_len);
-	  rlen += sprintf(buf + rlen, "Tot Memory         : %d\n", fsi->tot_mem);
+	  if(pfr->slot_layout)
+	    rlen += sprintf(buf + rlen, "Slot Layout        :%s%s\n",
+			    (pfr->slot_layout & PFRING_SLOT_ALIGNED) ? " aligned" : "",
+			    (pfr->slot_layout & PFRING_SLOT_NT_COPY) ? " non-temporal" : "");
+	  if(pfr->tstamp_mode != PFRING_TSTAMP_HW)
+	    rlen += sprintf(buf + rlen, "Timestamps         : %s\n",
+			    (pfr->tstamp_mode == PFRING_TSTAMP_NONE) ? "none" :
+			    ((pfr->tstamp_mode == PFRING_TSTAMP_COARSE) ? "coarse" : "ns"));
+	  rlen += sprintf(buf + rlen, "Tot Memory         : %llu\n", (unsigned long long)fsi->tot_mem);
 	  rlen += sprintf(buf + rlen, "Tot Packets        : %lu\n", (unsigned long)fsi->tot_pkts);
 	  rlen += sprintf(buf + rlen, "Tot Pkt Lost       : %lu\n", (unsigned long)fsi->tot_lost);
 	  rlen += sprintf(buf + rlen, "Tot Insert         : %lu\n", (unsigned long)fsi->tot_insert);
 	  rlen += sprintf(buf + rlen, "Tot Read           : %lu\n", (unsigned long)fsi->tot_read);
-	  rlen += sprintf(buf + rlen, "Insert Offset      : %lu\n", (unsigned long)fsi->insert_off);
-	  rlen += sprintf(buf + rlen, "Remove Offset      : %lu\n", (unsigned long)fsi->remove_off);
+	  rlen += sprintf(buf + rlen, "Insert Offset      : %llu\n", (unsigned long long)fsi->insert_off);
+	  rlen += sprintf(buf + rlen, "Remove Offset      : %llu\n", (unsigned long long)fsi->remove_off);
 	  rlen += sprintf(buf + rlen, "TX: Send Ok        : %lu\n", (unsigned long)fsi->good_pkt_sent);
 	  rlen += sprintf(buf + rlen, "TX: Send Errors    : %lu\n", (unsigned long)fsi->pkt_send_error);
+	  if(pfr->tx_ring != NULL)
+	    rlen += sprintf(buf + rlen, "TX Ring            : %u slots [%lu sent][%lu errors]\n",
+			    pfr->tx_ring->num_slots, (unsigned long)pfr->tx_ring->tot_sent,
+			    (unsigned long)pfr->tx_ring->tot_errors);
 	  rlen += sprintf(buf + rlen, "Reflect: Fwd Ok    : %lu\n", (unsigned long)fsi->tot_fwd_ok);
 	  rlen += sprintf(buf + rlen, "Reflect: Fwd Errors: %lu\n", (unsigned long)fsi->tot_fwd_notok);
 	  rlen += sprintf(buf + rlen, "Num Free Slots     : %u\n",  get_num_ring_free_slots(pfr));
+
+	  if(pfr->insert_timestamp) {
+	    rlen += sprint_latency_histogram(buf + rlen, "Queue Delay (ns)   :", fsi->latency_hist.delay);
+	    rlen += sprint_latency_histogram(buf + rlen, "Queue Fill (pkts)  :", fsi->latency_hist.fill);
+	  }
 	}
 
       } else {
@@ -1419,6 +2548,75 @@ static int ring_proc_get_plugin_info(char *buf, char **start, off_t offset,
 
 /* ********************************** */
 
+static void fill_proc_ring_stats(struct pf_ring_socket *pfr, struct pfring_proc_ring_stats *r)
+{
+  int cpu;
+
+  memset(r, 0, sizeof(*r));
+  r->version = PFRING_PROC_STATS_VERSION, r->record_len = sizeof(*r);
+  r->ring_id = pfr->ring_id, r->pid = pfr->ring_pid;
+  r->channel_id = pfr->channel_id, r->cluster_id = pfr->cluster_id;
+  r->active = pfr->ring_active;
+  strncpy(r->device_name, pfr->ring_netdev->dev->name, sizeof(r->device_name) - 1);
+
+  /* The producer of a userspace ring and shared ring readers have no counters here */
+  if((pfr->slots_info == NULL) || (pfr->userspace_ring != NULL) || (pfr->shared_cursor != NULL))
+    return;
+
+  /* Read only: unlike fold_ring_stats() nothing is written to the ring */
+  for_each_possible_cpu(cpu) {
+    struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, cpu);
+
+    r->tot_pkts += s->tot_pkts, r->ring_full += s->tot_lost - s->tot_early_drop;
+    r->early_drop += s->tot_early_drop, r->sampled += s->tot_sampled + s->tot_rate_sampled;
+    r->filtered += s->tot_filtered, r->blocked += s->tot_blocked;
+  }
+
+  for(cpu = 0; cpu < max_val(pfr->num_sub_rings, 1); cpu++)
+    r->tot_insert += pfr->sub_slots_info[cpu]->tot_insert;
+
+  r->tot_read = pfr->slots_info->tot_read;
+  r->tot_fwd_ok = pfr->slots_info->tot_fwd_ok, r->tot_fwd_notok = pfr->slots_info->tot_fwd_notok;
+  r->num_slots = pfr->slots_info->min_num_slots;
+  r->num_free_slots = get_num_ring_free_slots(pfr);
+}
+
+/* ********************************** */
+
+/* /proc/net/pf_ring/stats: the records from the one at offset on, whole records only */
+static int ring_proc_get_stats(char *buf, char **start, off_t offset,
+			       int len, int *eof, void *data)
+{
+  u_int32_t skip = offset / sizeof(struct pfring_proc_ring_stats), last_list_idx;
+  int rlen = 0;
+  struct sock *sk;
+
+  rcu_read_lock(); /* ring_release() waits for us before freeing the ring */
+
+  sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
+
+  while((sk != NULL) && (rlen + sizeof(struct pfring_proc_ring_stats) <= len)) {
+    if(skip > 0)
+      skip--;
+    else {
+      fill_proc_ring_stats(ring_sk(sk), (struct pfring_proc_ring_stats*)(buf + rlen));
+      rlen += sizeof(struct pfring_proc_ring_stats);
+    }
+
+    sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+  }
+
+  rcu_read_unlock();
+
+  if(sk == NULL)
+    *eof = 1;
+
+  *start = buf; /* offset moves by rlen */
+  return(rlen);
+}
+
+/* ********************************** */
+
 static void ring_proc_init(void)
 {
   ring_proc_dir = proc_mkdir("pf_ring",
@@ -1441,12 +2639,16 @@ static void ring_proc_init(void)
       create_proc_read_entry(PROC_PLUGINS_INFO, 0 /* read-only */,
 			     ring_proc_dir,
 			     ring_proc_get_plugin_info, NULL);
-    if(!ring_proc || !ring_proc_plugins_info)
+    ring_proc_stats = create_proc_read_entry(PROC_STATS, 0 /* read-only */,
+					     ring_proc_dir,
+					     ring_proc_get_stats, NULL);
+    if(!ring_proc || !ring_proc_plugins_info || !ring_proc_stats)
       printk("[PF_RING] unable to register proc file\n");
     else {
 #if(LINUX_VERSION_CODE < KERNEL_VERSION(2,6,30))
       ring_proc->owner = THIS_MODULE;
       ring_proc_plugins_info->owner = THIS_MODULE;
+      ring_proc_stats->owner = THIS_MODULE;
 #endif
       printk("[PF_RING] registered /proc/net/pf_ring/\n");
     }
@@ -1460,10 +2662,13 @@ static void ring_proc_term(void)
 {
   if(ring_proc != NULL) {
     remove_proc_entry(PROC_INFO, ring_proc_dir);
-    if(unlikely(enable_debug))  printk("[PF_RING] removed /proc/net/pf_ring/%s\n", PROC_INFO);
+    if(debug_on())  printk("[PF_RING] removed /proc/net/pf_ring/%s\n", PROC_INFO);
 
     remove_proc_entry(PROC_PLUGINS_INFO, ring_proc_dir);
-    if(unlikely(enable_debug)) printk("[PF_RING] removed /proc/net/pf_ring/%s\n", PROC_PLUGINS_INFO);
+    if(debug_on()) printk("[PF_RING] removed /proc/net/pf_ring/%s\n", PROC_PLUGINS_INFO);
+
+    if(ring_proc_stats != NULL)
+      remove_proc_entry(PROC_STATS, ring_proc_dir);
 
     remove_proc_entry(PROC_DEV, ring_proc_dir);
 
@@ -1473,22 +2678,19 @@ static void ring_proc_term(void)
 			init_net.
 #endif
 			proc_net);
-      if(unlikely(enable_debug)) printk("[PF_RING] deregistered /proc/net/pf_ring\n");
+      if(debug_on()) printk("[PF_RING] deregistered /proc/net/pf_ring\n");
     }
   }
 }
 
 /* ********************************** */
 
-static char *allocate_shared_memory(u_int32_t *mem_len)
+static u_int64_t shared_memory_len(u_int64_t tot_mem)
 {
-  u_int32_t tot_mem = *mem_len;
-  char *shared_mem;
-
   tot_mem = PAGE_ALIGN(tot_mem);
 
   /* Alignment necessary on ARM platforms */
-  tot_mem += SHMLBA - (tot_mem % SHMLBA);
+  tot_mem += SHMLBA - ((u_int32_t)tot_mem % SHMLBA); /* a power of 2 */
 
   /* rounding size to the next power of 2 (needed by vPFRing) */
   tot_mem--;
@@ -1497,8 +2699,19 @@ static char *allocate_shared_memory(u_int32_t *mem_len)
   tot_mem |= tot_mem >> 4;
   tot_mem |= tot_mem >> 8;
   tot_mem |= tot_mem >> 16;
+  tot_mem |= tot_mem >> 32;
   tot_mem++;
 
+  return(tot_mem);
+}
+
+/* ********************************** */
+
+static char *allocate_shared_memory(u_int32_t *mem_len)
+{
+  u_int32_t tot_mem = (u_int32_t)shared_memory_len(*mem_len);
+  char *shared_mem;
+
   /* Memory is already zeroed */
   shared_mem = vmalloc_user(tot_mem);
 
@@ -1506,18 +2719,214 @@ static char *allocate_shared_memory(u_int32_t *mem_len)
   return shared_mem;
 }
 
+/* ********************************** */
+
 /*
- * Allocate ring memory used later on for
- * mapping it to userland
+ * Memory of released rings, kept (up to ring_mem_pool entries, most
+ * recently released first) for the next sockets asking for the same
+ * length, policy and node: a capture restarting does not wait for
+ * vmalloc_user() to allocate and zero hundreds of MB again. Only the
+ * FlowSlotInfo headers of a reused ring are zeroed (see ring_alloc_mem()),
+ * the slots are overwritten before the insert offset moves past them.
  */
-static int ring_alloc_mem(struct sock *sk)
-{
-  u_int the_slot_len;
-  u_int32_t tot_mem;
-  struct pf_ring_socket *pfr = ring_sk(sk);
+struct ring_mem_pool_entry {
+  struct list_head list;
+  char *mem;
+  struct pf_ring_mem ring_mem;
+};
 
-  /* Userspace RING
-   * - producer attaching to a ring
+static LIST_HEAD(ring_mem_pool_list);
+static DEFINE_SPINLOCK(ring_mem_pool_lock);
+static u_int32_t ring_mem_pool_len = 0;
+static u_int64_t ring_mem_pool_bytes = 0, ring_mem_pool_hits = 0;
+
+static void free_ring_pages(struct pf_ring_mem *ring_mem, char *mem);
+
+/* ********************************** */
+
+static char *ring_mem_pool_get(struct pf_ring_mem *ring_mem)
+{
+  struct ring_mem_pool_entry *entry = NULL, *e;
+  char *mem = NULL;
+
+  spin_lock(&ring_mem_pool_lock);
+
+  list_for_each_entry(e, &ring_mem_pool_list, list) {
+    if((e->ring_mem.len == ring_mem->len)
+       && (e->ring_mem.policy == ring_mem->policy)
+       && (e->ring_mem.node == ring_mem->node)) {
+      list_del(&e->list);
+      ring_mem_pool_len--, ring_mem_pool_bytes -= e->ring_mem.len, ring_mem_pool_hits++;
+      entry = e;
+      break;
+    }
+  }
+
+  spin_unlock(&ring_mem_pool_lock);
+
+  if(entry != NULL) {
+    *ring_mem = entry->ring_mem, mem = entry->mem;
+    ring_mem->pooled = 1;
+    kfree(entry);
+  }
+
+  return(mem);
+}
+
+/* ********************************** */
+
+/* 0 if mem has been parked in the pool, the caller frees it otherwise */
+static int ring_mem_pool_put(struct pf_ring_mem *ring_mem, char *mem)
+{
+  struct ring_mem_pool_entry *entry, *evicted = NULL;
+
+  if((ring_mem_pool == 0) || (ring_mem->len == 0))
+    return(-1);
+
+  if((entry = kmalloc(sizeof(struct ring_mem_pool_entry), GFP_KERNEL)) == NULL)
+    return(-1);
+
+  entry->mem = mem, entry->ring_mem = *ring_mem;
+
+  spin_lock(&ring_mem_pool_lock);
+
+  list_add(&entry->list, &ring_mem_pool_list);
+  ring_mem_pool_len++, ring_mem_pool_bytes += ring_mem->len;
+
+  /* Lowered at runtime: evicted one at a time by the next releases */
+  if(ring_mem_pool_len > ring_mem_pool) {
+    evicted = list_entry(ring_mem_pool_list.prev, struct ring_mem_pool_entry, list);
+    list_del(&evicted->list);
+    ring_mem_pool_len--, ring_mem_pool_bytes -= evicted->ring_mem.len;
+  }
+
+  spin_unlock(&ring_mem_pool_lock);
+
+  if(evicted != NULL) {
+    evicted->ring_mem.len = 0; /* really freed */
+    free_ring_pages(&evicted->ring_mem, evicted->mem);
+    kfree(evicted);
+  }
+
+  return(0);
+}
+
+/* ********************************** */
+
+static void ring_mem_pool_drain(void)
+{
+  struct ring_mem_pool_entry *e, *tmp;
+
+  list_for_each_entry_safe(e, tmp, &ring_mem_pool_list, list) {
+    list_del(&e->list);
+    e->ring_mem.len = 0;
+    free_ring_pages(&e->ring_mem, e->mem);
+    kfree(e);
+  }
+
+  ring_mem_pool_len = 0, ring_mem_pool_bytes = 0;
+}
+
+/* ********************************** */
+
+/* Zeroed ring memory, see SO_SET_RING_MEM_POLICY, unless ring_mem.pooled */
+static char *alloc_ring_pages(struct pf_ring_socket *pfr, u_int64_t len)
+{
+  struct net_device *dev = pfr->ring_netdev ? pfr->ring_netdev->dev : NULL;
+  int node = -1, order = get_order(len);
+  char *mem;
+
+  pfr->ring_mem.order = -1, pfr->ring_mem.pages = NULL;
+  pfr->ring_mem.len = len, pfr->ring_mem.pooled = 0;
+
+  /* A userspace ring is mapped by other sockets as vmalloc() memory */
+  pfr->ring_mem.policy = (pfr->userspace_ring != NULL) ? 0 : pfr->ring_mem_policy;
+
+  if((pfr->ring_mem.policy & PFRING_MEM_NUMA_LOCAL)
+     && (dev != NULL) && (dev->dev.parent != NULL))
+    node = dev_to_node(dev->dev.parent);
+
+  pfr->ring_mem.node = node;
+
+  if((ring_mem_pool > 0) && ((mem = ring_mem_pool_get(&pfr->ring_mem)) != NULL))
+    return(mem);
+
+  if(pfr->ring_mem.policy == 0)
+    return(vmalloc_user(len));
+
+  if((pfr->ring_mem_policy & PFRING_MEM_CONTIGUOUS) && (order < MAX_ORDER)) {
+    struct page *page = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN, order);
+
+    if(page != NULL) {
+      pfr->ring_mem.order = order;
+      return((char*)page_address(page));
+    }
+
+    if(debug_on())
+      printk("[PF_RING] no contiguous order %d block on node %d\n", order, node);
+  }
+
+  if(node >= 0) {
+    u_int32_t i, num_pages = PAGE_ALIGN(len) >> PAGE_SHIFT;
+    struct page **pages = vmalloc(num_pages * sizeof(struct page*));
+
+    if(pages != NULL) {
+      for(i = 0; i < num_pages; i++)
+	if((pages[i] = alloc_pages_node(node, GFP_KERNEL | __GFP_ZERO, 0)) == NULL)
+	  break;
+
+      /* VM_USERMAP: ring_mmap() can remap_vmalloc_range() it */
+      if((i == num_pages) && ((mem = vmap(pages, num_pages, VM_MAP | VM_USERMAP, PAGE_KERNEL)) != NULL)) {
+	pfr->ring_mem.pages = pages, pfr->ring_mem.num_pages = num_pages;
+	return(mem);
+      }
+
+      while(i > 0)
+	__free_page(pages[--i]);
+
+      vfree(pages);
+    }
+  }
+
+  return(vmalloc_user(len));
+}
+
+/* ********************************** */
+
+static void free_ring_pages(struct pf_ring_mem *ring_mem, char *mem)
+{
+  if(ring_mem_pool_put(ring_mem, mem) == 0)
+    return;
+
+  if(ring_mem->order >= 0)
+    free_pages((unsigned long)mem, ring_mem->order);
+  else if(ring_mem->pages != NULL) {
+    u_int32_t i;
+
+    vunmap(mem);
+
+    for(i = 0; i < ring_mem->num_pages; i++)
+      __free_page(ring_mem->pages[i]);
+
+    vfree(ring_mem->pages);
+  } else
+    vfree(mem);
+}
+
+/* ********************************** */
+
+/*
+ * Allocate ring memory used later on for
+ * mapping it to userland
+ */
+static int ring_alloc_mem(struct sock *sk)
+{
+  u_int the_slot_len, mem_slot_len, num_areas, i;
+  u_int64_t tot_mem;
+  struct pf_ring_socket *pfr = ring_sk(sk);
+
+  /* Userspace RING
+   * - producer attaching to a ring
    * - or consumer re-opening an old ring already attachred */
   if(pfr->userspace_ring != NULL
       && (pfr->userspace_ring_type == userspace_ring_producer
@@ -1532,6 +2941,7 @@ static int ring_alloc_mem(struct sock *sk)
     pfr->ring_memory     = pfr->userspace_ring->ring_memory;
     pfr->slots_info      = (FlowSlotInfo *) pfr->ring_memory;
     pfr->ring_slots      = (char *) (pfr->ring_memory + sizeof(FlowSlotInfo));
+    pfr->num_sub_rings   = 0; /* never split */
 
     pfr->insert_page_id = 1, pfr->insert_slot_id = 0;
     pfr->sw_filtering_rules_default_accept_policy = 1;
@@ -1541,7 +2951,7 @@ static int ring_alloc_mem(struct sock *sk)
   /* Check if the memory has been already allocated */
   if(pfr->ring_memory != NULL) return(0);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_alloc_mem(bucket_len=%d)\n", pfr->bucket_len);
 
   /* **********************************************
@@ -1560,43 +2970,77 @@ static int ring_alloc_mem(struct sock *sk)
    * *        FlowSlot                   *   |
    * ************************************* <-+
    *
+   * repeated num_sub_rings times with SO_SET_PERCPU_RINGS
+   *
    * ********************************************** */
 
   if(pfr->header_len == short_pkt_header)
     pfr->slot_header_len = sizeof(struct timeval) + sizeof(u_int32_t) + sizeof(u_int32_t) + sizeof(u_int64_t) /* ts+caplen+len+timestamp_ns */;
+  else if(pfr->header_len == compact_pkt_header)
+    pfr->slot_header_len = sizeof(struct pfring_compact_pkthdr);
   else
     pfr->slot_header_len = sizeof(struct pfring_pkthdr);
 
-  the_slot_len = pfr->slot_header_len + pfr->bucket_len;
+  if(pfr->header_len == compact_pkt_header) {
+    if(pfr->metadata_only) {
+      /* The memory of a long header ring: more, smaller, slots */
+      mem_slot_len = sizeof(struct pfring_pkthdr) + pfr->bucket_len;
+      pfr->bucket_len = 0;
+    }
 
-  tot_mem = sizeof(FlowSlotInfo) + (min_num_slots * the_slot_len);
+    /* bucket_len stays the snaplen: the IPv6 trailer comes on top */
+    the_slot_len = pfr->slot_header_len + PFRING_COMPACT_TRAILER_LEN + pfr->bucket_len;
 
-  /* Memory is already zeroed */
-  pfr->ring_memory = allocate_shared_memory(&tot_mem);
+    if(!pfr->metadata_only)
+      mem_slot_len = the_slot_len;
+  } else
+    mem_slot_len = the_slot_len = pfr->slot_header_len + pfr->bucket_len;
+
+  if(pfr->slot_layout & PFRING_SLOT_ALIGNED)
+    the_slot_len = ALIGN(the_slot_len, PFRING_SLOT_ALIGN), mem_slot_len = ALIGN(mem_slot_len, PFRING_SLOT_ALIGN);
+
+  tot_mem = shared_memory_len(sizeof(FlowSlotInfo) + ((u_int64_t)min_num_slots * mem_slot_len));
+  num_areas = ((pfr->num_sub_rings > 1) && (pfr->userspace_ring == NULL)) ? pfr->num_sub_rings : 1;
+  pfr->num_sub_rings = num_areas;
+
+  /* Memory is already zeroed, but for the slots of a pooled ring */
+  pfr->ring_memory = alloc_ring_pages(pfr, tot_mem * num_areas);
 
   if(pfr->ring_memory != NULL) {
-    if(unlikely(enable_debug))
-      printk("[PF_RING] successfully allocated %lu bytes at 0x%08lx\n",
-	     (unsigned long)tot_mem, (unsigned long)pfr->ring_memory);
+    if(debug_on())
+      printk("[PF_RING] successfully allocated %lu bytes at 0x%08lx [order=%d][node local=%s][pooled=%s]\n",
+	     (unsigned long)tot_mem * num_areas, (unsigned long)pfr->ring_memory,
+	     pfr->ring_mem.order, pfr->ring_mem.pages ? "yes" : "no", pfr->ring_mem.pooled ? "yes" : "no");
   } else {
     printk("[PF_RING] ERROR: not enough memory for ring\n");
     return(-1);
   }
 
+  for(i = 0; i < num_areas; i++) {
+    FlowSlotInfo *si = (FlowSlotInfo *)&pfr->ring_memory[i * tot_mem];
+
+    if(pfr->ring_mem.pooled)
+      memset(si, 0, sizeof(FlowSlotInfo));
+
+    si->version = RING_FLOWSLOT_VERSION;
+    si->slot_len = the_slot_len;
+    si->data_len = pfr->bucket_len;
+    si->min_num_slots = min_val(div_u64(tot_mem - sizeof(FlowSlotInfo), the_slot_len), (u_int64_t)0xFFFFFFFF);
+    si->tot_mem = tot_mem;
+    si->sample_rate = 1;
+    si->overload_sample_rate = 1;
+    si->num_sub_rings = num_areas;
+    si->slot_align_mask = (pfr->slot_layout & PFRING_SLOT_ALIGNED) ? PFRING_SLOT_ALIGN - 1 : 0;
+    pfr->sub_slots_info[i] = si;
+  }
+
   pfr->slots_info = (FlowSlotInfo *) pfr->ring_memory;
   pfr->ring_slots = (char *)(pfr->ring_memory + sizeof(FlowSlotInfo));
 
-  pfr->slots_info->version = RING_FLOWSLOT_VERSION;
-  pfr->slots_info->slot_len = the_slot_len;
-  pfr->slots_info->data_len = pfr->bucket_len;
-  pfr->slots_info->min_num_slots = (tot_mem - sizeof(FlowSlotInfo)) / the_slot_len;
-  pfr->slots_info->tot_mem = tot_mem;
-  pfr->slots_info->sample_rate = 1;
-
-  if(unlikely(enable_debug))
-    printk("[PF_RING] allocated %d slots [slot_len=%d][tot_mem=%u]\n",
+  if(debug_on())
+    printk("[PF_RING] allocated %d slots [slot_len=%d][tot_mem=%llu]\n",
 	   pfr->slots_info->min_num_slots, pfr->slots_info->slot_len,
-	   pfr->slots_info->tot_mem);
+	   (unsigned long long)pfr->slots_info->tot_mem);
 
   pfr->insert_page_id = 1, pfr->insert_slot_id = 0;
   pfr->sw_filtering_rules_default_accept_policy = 1;
@@ -1627,7 +3071,7 @@ static inline int ring_insert(struct sock *sk)
 {
   struct pf_ring_socket *pfr;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_insert()\n");
 
   if (lockless_list_add(&ring_table, sk) == -1)
@@ -1659,7 +3103,7 @@ static inline void ring_remove(struct sock *sk_to_delete)
   u_int32_t last_list_idx;
   struct sock *sk;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_remove()\n");
 
   sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
@@ -1670,12 +3114,12 @@ static inline void ring_remove(struct sock *sk_to_delete)
     pfr = ring_sk(sk);
 
     if(pfr->master_ring == pfr_to_delete) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Removing master ring\n");
 
       pfr->master_ring = NULL, master_found = 1;
     } else if(sk == sk_to_delete) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Found socket to remove\n");
 
       socket_found = 1;
@@ -1692,7 +3136,7 @@ static inline void ring_remove(struct sock *sk_to_delete)
   } else
     printk("[PF_RING] WARNING: Unable to find socket to remove!!!\n");
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] leaving ring_remove()\n");
 }
 
@@ -1726,13 +3170,180 @@ inline u_int32_t hash_pkt_header(struct pfring_pkthdr * hdr, u_char mask_src, u_
   return(hdr->extended_hdr.pkt_hash);
 }
 
+/* ********************************** */
+
+/*
+  Symmetric hashes of the cluster_per_flow_toeplitz/crc32c clusters. They
+  follow pkt_hash_toeplitz/pkt_hash_crc32c of libpfring (symmetric key,
+  same input layout) so that userland knows the bucket of every flow.
+*/
+
+#define TOEPLITZ_MAX_INPUT 36
+
+static u_int32_t toeplitz_table[TOEPLITZ_MAX_INPUT][256];
+static u_int32_t crc32c_table[256];
+
+static void init_cluster_hash_tables(void)
+{
+  u_int8_t key[RSS_KEY_LEN];
+  u_int i, b, bit, k;
+
+  for(i = 0; i < RSS_KEY_LEN; i += 2)
+    key[i] = RSS_SYMMETRIC_KEY_WORD >> 8, key[i + 1] = RSS_SYMMETRIC_KEY_WORD & 0xFF;
+
+  for(i = 0; i < TOEPLITZ_MAX_INPUT; i++)
+    for(b = 0; b < 256; b++) {
+      u_int32_t v = 0;
+
+      for(bit = 0; bit < 8; bit++) {
+	u_int32_t w = 0;
+
+	if(!(b & (0x80 >> bit))) continue;
+
+	for(k = 8 * i + bit; k < 8 * i + bit + 32; k++)
+	  w = (w << 1) | ((key[k / 8] >> (7 - (k % 8))) & 1);
+
+	v ^= w;
+      }
+
+      toeplitz_table[i][b] = v;
+    }
+
+  for(i = 0; i < 256; i++) {
+    u_int32_t c = i;
+
+    for(bit = 0; bit < 8; bit++)
+      c = (c >> 1) ^ ((c & 1) ? 0x82F63B78 /* reflected Castagnoli */ : 0);
+
+    crc32c_table[i] = c;
+  }
+}
+
+/* ********************************** */
+
+/* Addresses and, for TCP/UDP, ports in network byte order */
+static u_int cluster_hash_input(struct pfring_pkthdr *hdr, u_int8_t *in)
+{
+  struct pkt_parsing_info *pp = &hdr->extended_hdr.parsed_pkt;
+  u_int len;
+
+  if(pp->ip_version == 6) {
+    memcpy(in, &pp->ip_src.v6, 16), memcpy(&in[16], &pp->ip_dst.v6, 16);
+    len = 32;
+  } else {
+    u_int32_t src = htonl(pp->ip_src.v4), dst = htonl(pp->ip_dst.v4);
+
+    memcpy(in, &src, 4), memcpy(&in[4], &dst, 4);
+    len = 8;
+  }
+
+  if((pp->l3_proto == IPPROTO_TCP) || (pp->l3_proto == IPPROTO_UDP)) {
+    u_int16_t sport = htons(pp->l4_src_port), dport = htons(pp->l4_dst_port);
+
+    memcpy(&in[len], &sport, 2), memcpy(&in[len + 2], &dport, 2);
+    len += 4;
+  }
+
+  return(len);
+}
+
+/* ********************************** */
+
+static u_int32_t cluster_hash(struct pfring_pkthdr *hdr, cluster_type type)
+{
+  u_int8_t in[TOEPLITZ_MAX_INPUT], buf[TOEPLITZ_MAX_INPUT + 1];
+  u_int len = cluster_hash_input(hdr, in), alen, plen, elen, i;
+  u_int32_t h;
+
+  if(type == cluster_per_flow_toeplitz) {
+    for(i = 0, h = 0; i < len; i++)
+      h ^= toeplitz_table[i][in[i]];
+
+    return(h);
+  }
+
+  /* CRC32C of the <address, port> endpoints, lowest first, and the proto */
+  alen = (hdr->extended_hdr.parsed_pkt.ip_version == 6) ? 16 : 4;
+  plen = (len > 2 * alen) ? 2 : 0, elen = alen + plen;
+
+  memcpy(buf, in, alen), memcpy(&buf[alen], &in[2 * alen], plen);
+  memcpy(&buf[elen], &in[alen], alen), memcpy(&buf[elen + alen], &in[2 * alen + plen], plen);
+
+  if(memcmp(buf, &buf[elen], elen) > 0) {
+    u_int8_t tmp[TOEPLITZ_MAX_INPUT / 2];
+
+    memcpy(tmp, buf, elen), memcpy(buf, &buf[elen], elen), memcpy(&buf[elen], tmp, elen);
+  }
+
+  buf[2 * elen] = hdr->extended_hdr.parsed_pkt.l3_proto;
+
+  for(i = 0, h = ~0U; i < 2 * elen + 1; i++)
+    h = crc32c_table[(h ^ buf[i]) & 0xFF] ^ (h >> 8);
+
+  return(~h);
+}
+
 /* ******************************************************* */
 
+/*
+  Non-first IP fragments carry no L4 header. The ports of the first fragment
+  are remembered by <src, dst, id, proto> in a fixed size table and reported
+  for the following ones: no reassembly and no allocation, so a fragment
+  flood just recycles the entries (see ring_gather_frags() for the other way)
+*/
+#define FRAG_TABLE_SIZE      4096 /* power of 2 */
+#define FRAG_ENTRY_LIFETIME  (30 * HZ) /* as ipfrag_time */
+
+typedef struct {
+  u_int64_t check_ports; /* <key check:32, src port:16, dst port:16>, a single store */
+  unsigned long expires;
+} frag_table_entry;
+
+static frag_table_entry frag_table[FRAG_TABLE_SIZE];
+
+static u_int32_t frag_key_hash(struct pfring_pkthdr *hdr, u_int32_t ip_id, u_int32_t seed)
+{
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+  u_int32_t key[9];
+
+  if(p->ip_version == 4)
+    return(jhash_3words(p->ipv4_src, p->ipv4_dst, ip_id | ((u_int32_t)p->l3_proto << 24), seed));
+
+  memcpy(&key[0], &p->ipv6_src, sizeof(struct in6_addr));
+  memcpy(&key[4], &p->ipv6_dst, sizeof(struct in6_addr));
+  key[8] = ip_id ^ p->l3_proto;
+
+  return(jhash2(key, 9, seed));
+}
+
+/* ********************************** */
+
+static void track_fragment(struct pfring_pkthdr *hdr, u_int32_t ip_id, u_int8_t first_fragment)
+{
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+  frag_table_entry *e = &frag_table[frag_key_hash(hdr, ip_id, 0) & (FRAG_TABLE_SIZE - 1)];
+  u_int32_t check = frag_key_hash(hdr, ip_id, 0x9E3779B9);
+
+  if(first_fragment) {
+    e->expires = jiffies + FRAG_ENTRY_LIFETIME;
+    e->check_ports = ((u_int64_t)check << 32) | ((u_int32_t)p->l4_src_port << 16) | p->l4_dst_port;
+  } else {
+    u_int64_t check_ports = e->check_ports;
+
+    if(((u_int32_t)(check_ports >> 32) == check) && time_before(jiffies, e->expires))
+      p->l4_src_port = (check_ports >> 16) & 0xFFFF, p->l4_dst_port = check_ports & 0xFFFF;
+  }
+}
+
+/* ********************************** */
+
 static int parse_raw_pkt(char *data, u_int data_len,
 			 struct pfring_pkthdr *hdr)
 {
   struct ethhdr *eh = (struct ethhdr *)data;
   u_int16_t displ, ip_len, fragment_offset = 0;
+  u_int32_t ip_id = 0;
+  u_int8_t more_fragments = 0;
 
   memset(&hdr->extended_hdr.parsed_pkt, 0, sizeof(hdr->extended_hdr.parsed_pkt));
 
@@ -1761,7 +3372,7 @@ static int parse_raw_pkt(char *data, u_int data_len,
     hdr->extended_hdr.parsed_pkt.vlan_id = 0; /* Any VLAN */
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] [eth_type=%04X]\n", hdr->extended_hdr.parsed_pkt.eth_type);
 
   /* Default */
@@ -1782,6 +3393,7 @@ static int parse_raw_pkt(char *data, u_int data_len,
     hdr->extended_hdr.parsed_pkt.ipv4_tos = ip->tos;
     hdr->extended_hdr.parsed_pkt.ip_version = 4;
     fragment_offset = ip->frag_off & htons(IP_OFFSET); /* fragment, but not the first */
+    more_fragments = (ip->frag_off & htons(IP_MF)) ? 1 : 0, ip_id = ntohs(ip->id);
     ip_len  = ip->ihl*4;
   } else if(hdr->extended_hdr.parsed_pkt.eth_type == ETH_P_IPV6 /* IPv6 */) {
     struct ipv6hdr *ipv6;
@@ -1824,6 +3436,16 @@ static int parse_raw_pkt(char *data, u_int data_len,
 	struct ipv6_opt_hdr *ipv6_opt;
 
 	ipv6_opt = (struct ipv6_opt_hdr *)(&data[hdr->extended_hdr.parsed_pkt.offset.l3_offset+ip_len]);
+
+	if(hdr->extended_hdr.parsed_pkt.l3_proto == NEXTHDR_FRAGMENT) {
+	  struct frag_hdr *frag = (struct frag_hdr *)ipv6_opt;
+
+	  if(data_len < hdr->extended_hdr.parsed_pkt.offset.l3_offset + ip_len + sizeof(struct frag_hdr)) return(0);
+
+	  fragment_offset = frag->frag_off & htons(IP6_OFFSET); /* fragment, but not the first */
+	  more_fragments = (frag->frag_off & htons(IP6_MF)) ? 1 : 0, ip_id = ntohl(frag->identification);
+	}
+
 	ip_len += 8;
 	if(hdr->extended_hdr.parsed_pkt.l3_proto == NEXTHDR_AUTH)
 	  /*
@@ -1841,7 +3463,7 @@ static int parse_raw_pkt(char *data, u_int data_len,
     return(0); /* No IP */
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] [l3_proto=%d]\n", hdr->extended_hdr.parsed_pkt.l3_proto);
 
   if((hdr->extended_hdr.parsed_pkt.l3_proto == IPPROTO_TCP || hdr->extended_hdr.parsed_pkt.l3_proto == IPPROTO_UDP) && !fragment_offset) {
@@ -1885,7 +3507,7 @@ static int parse_raw_pkt(char *data, u_int data_len,
     } else
       hdr->extended_hdr.parsed_pkt.offset.payload_offset = hdr->extended_hdr.parsed_pkt.offset.l4_offset;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] [l4_offset=%d][l4_src_port/l4_dst_port=%d/%d]\n",
 	     hdr->extended_hdr.parsed_pkt.offset.l4_offset,
 	     hdr->extended_hdr.parsed_pkt.l4_src_port,
@@ -1893,7 +3515,12 @@ static int parse_raw_pkt(char *data, u_int data_len,
   } else
     hdr->extended_hdr.parsed_pkt.l4_src_port = hdr->extended_hdr.parsed_pkt.l4_dst_port = 0;
 
-  hash_pkt_header(hdr, 0, 0, 0, 0, 0);
+  if(enable_frag_coherence
+     && (fragment_offset || more_fragments)
+     && (hdr->extended_hdr.parsed_pkt.l3_proto == IPPROTO_TCP || hdr->extended_hdr.parsed_pkt.l3_proto == IPPROTO_UDP))
+    track_fragment(hdr, ip_id, fragment_offset == 0);
+
+  /* pkt_hash: on demand, see hash_pkt_header() and copy_data_to_ring() */
 
   return(1); /* IP */
 }
@@ -1993,7 +3620,7 @@ static int hash_bucket_match(sw_filtering_hash_bucket * hash_bucket,
 inline int hash_bucket_match_rule(sw_filtering_hash_bucket * hash_bucket,
 				  hash_filtering_rule * rule)
 {
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] (%u,%d,%d.%d.%d.%d:%u,%d.%d.%d.%d:%u) "
 	   "(%u,%d,%d.%d.%d.%d:%u,%d.%d.%d.%d:%u)\n",
 	   hash_bucket->rule.vlan_id, hash_bucket->rule.proto,
@@ -2039,7 +3666,7 @@ inline int hash_bucket_match_rule(sw_filtering_hash_bucket * hash_bucket,
 inline int hash_filtering_rule_match(hash_filtering_rule * a,
 				     hash_filtering_rule * b)
 {
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] (%u,%d,%d.%d.%d.%d:%u,%d.%d.%d.%d:%u) "
 	   "(%u,%d,%d.%d.%d.%d:%u,%d.%d.%d.%d:%u)\n",
 	   a->vlan_id, a->proto,
@@ -2092,6 +3719,43 @@ inline int match_ipv6(ip_addr *addr, ip_addr *rule_addr, ip_addr *rule_mask) {
 
 /* ********************************** */
 
+/*
+  A match of the rule. jiffies_last_match, read by the idle rule purging,
+  is only written when it lags by more than a jiffy: the line stays
+  shared in the caches of the CPUs matching the rule.
+*/
+static inline void rule_hit(filtering_internals *internals, u_int32_t len)
+{
+  unsigned long now = jiffies;
+
+  if(internals->cpu_stats != NULL) {
+    struct rule_cpu_stats *s = per_cpu_ptr(internals->cpu_stats, get_cpu());
+
+    s->tot_pkts++, s->tot_bytes += len;
+    put_cpu();
+  } else
+    internals->tot_pkts++, internals->tot_bytes += len;
+
+  if(time_after(now, internals->jiffies_last_match + 1))
+    internals->jiffies_last_match = now;
+}
+
+/* ********************************** */
+
+static inline void rule_reflect_stats(filtering_internals *internals, int ok)
+{
+  if(internals->cpu_stats != NULL) {
+    struct rule_cpu_stats *s = per_cpu_ptr(internals->cpu_stats, get_cpu());
+
+    if(ok) s->tot_reflected++; else s->tot_reflect_failed++;
+    put_cpu();
+  } else {
+    if(ok) internals->tot_reflected++; else internals->tot_reflect_failed++;
+  }
+}
+
+/* ********************************** */
+
 /* 0 = no match, 1 = match */
 static int match_filtering_rule(struct pf_ring_socket *pfr,
 				sw_filtering_rule_element * rule,
@@ -2105,7 +3769,7 @@ static int match_filtering_rule(struct pf_ring_socket *pfr,
 {
   u_int8_t empty_mac[ETH_ALEN] = { 0 }; /* NULL MAC address */
 
-  if(unlikely(enable_debug)) printk("[PF_RING] %s()\n", __FUNCTION__);
+  if(debug_on()) printk("[PF_RING] %s()\n", __FUNCTION__);
 
   *behaviour = forward_packet_and_stop_rule_evaluation;	/* Default */
 
@@ -2118,7 +3782,7 @@ static int match_filtering_rule(struct pf_ring_socket *pfr,
     return(0);
 
   if(rule->rule.extended_fields.gtp.version != ignore_gtp_version) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] [version=%02X][TEID=0x%08X][MsgType=0x%02X]\n",
 	     hdr->extended_hdr.parsed_pkt.gtp.version,
 	     rule->rule.extended_fields.gtp.tunnel_id,
@@ -2212,7 +3876,7 @@ success:
 
 #ifdef CONFIG_TEXTSEARCH
   if(rule->pattern[0] != NULL) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] pattern\n");
 
     if((hdr->extended_hdr.parsed_pkt.offset.payload_offset > 0)
@@ -2225,7 +3889,7 @@ success:
 	int i;
 	struct ts_state state;
 
-	if(unlikely(enable_debug)) {
+	if(debug_on()) {
 	  printk("[PF_RING] Trying to match pattern [caplen=%d][len=%d][displ=%d][payload_offset=%d][",
 		 hdr->caplen, payload_len, displ,
 		 hdr->extended_hdr.parsed_pkt.offset.payload_offset);
@@ -2237,11 +3901,11 @@ success:
 
 	payload[payload_len] = '\0';
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] Attempt to match [%s]\n", payload);
 
 	for(i = 0; (i < MAX_NUM_PATTERN) && (rule->pattern[i] != NULL); i++) {
-	  if(unlikely(enable_debug))
+	  if(debug_on())
 	    printk("[PF_RING] Attempt to match pattern %d\n", i);
 	  rc = (textsearch_find_continuous
 		(rule->pattern[i], &state,
@@ -2250,7 +3914,7 @@ success:
 	    break;
 	}
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] Match returned: %d [payload_len=%d][%s]\n",
 		 rc, payload_len, payload);
 
@@ -2271,7 +3935,7 @@ success:
      ) {
     int rc;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] rule->plugin_id [rule_id=%d]"
 	     "[filter_plugin_id=%d][plugin_action=%d][ptr=%p]\n",
 	     rule->rule.rule_id,
@@ -2292,7 +3956,7 @@ success:
       hdr->extended_hdr.parsed_pkt.last_matched_plugin_id =
 	rule->rule.extended_fields.filter_plugin_id;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] [last_matched_plugin = %d][buffer=%p][len=%d]\n",
 	       *last_matched_plugin,
 	       parse_memory_buffer[rule->rule.extended_fields.filter_plugin_id],
@@ -2310,7 +3974,7 @@ success:
      ) {
     int rc;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] Calling pfring_plugin_handle_skb(pluginId=%d)\n",
 	     rule->rule.plugin_action.plugin_id);
 
@@ -2328,17 +3992,17 @@ success:
     if(parse_memory_buffer[rule->rule.plugin_action.plugin_id])
       *free_parse_mem = 1;
   } else {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] Skipping pfring_plugin_handle_skb(plugin_action=%d)\n",
 	     rule->rule.plugin_action.plugin_id);
     *behaviour = rule->rule.rule_action;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] Rule %d behaviour: %d\n",
 	     rule->rule.rule_id, rule->rule.rule_action);
   }
 
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     printk("[PF_RING] MATCH: %s(vlan=%u, proto=%u, sip=%u, sport=%u, dip=%u, dport=%u)\n"
            "          [rule(vlan=%u, proto=%u, ip=%u:%u, port=%u:%u-%u:%u)(behaviour=%d)]\n",
     	   __FUNCTION__,
@@ -2354,14 +4018,15 @@ success:
 	   *behaviour);
   }
 
-  rule->rule.internals.jiffies_last_match = jiffies;
+  rule_hit(&rule->rule.internals, hdr->len);
 
   return(1); /* match */
 }
 
 /* ********************************** */
 
-static inline void set_skb_time(struct sk_buff *skb, struct pfring_pkthdr *hdr) {
+/* tstamp_mode: PFRING_TSTAMP_*, never PFRING_TSTAMP_NONE */
+static inline void set_skb_time(struct sk_buff *skb, struct pfring_pkthdr *hdr, u_int8_t tstamp_mode) {
   /* BD - API changed for time keeping */
 #if(LINUX_VERSION_CODE < KERNEL_VERSION(2,6,14))
   if(skb->stamp.tv_sec == 0)
@@ -2374,17 +4039,33 @@ static inline void set_skb_time(struct sk_buff *skb, struct pfring_pkthdr *hdr)
   hdr->ts.tv_sec = skb->tstamp.off_sec, hdr->ts.tv_usec = skb->tstamp.off_usec;
   hdr->extended_hdr.timestamp_ns = 0; /* No nsec for old kernels */
 #else /* 2.6.22 and above */
+  if((tstamp_mode == PFRING_TSTAMP_COARSE) && (skb->tstamp.tv64 == 0)) {
+    /* The time of the last tick: no clocksource read */
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0))
+    struct timespec64 ts;
+
+    ktime_get_coarse_real_ts64(&ts);
+#else
+    struct timespec ts = current_kernel_time();
+#endif
+
+    hdr->ts.tv_sec = ts.tv_sec, hdr->ts.tv_usec = ts.tv_nsec / 1000;
+    hdr->extended_hdr.timestamp_ns = (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return;
+  }
+
   if(skb->tstamp.tv64 == 0)
     __net_timestamp(skb); /* If timestamp is missing add it */
 
   hdr->ts = ktime_to_timeval(skb->tstamp);
+  hdr->extended_hdr.timestamp_ns = 0;
 
 #if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,30))
-  {
+  if(tstamp_mode == PFRING_TSTAMP_HW) {
     /* Use hardware timestamps when present. If not, just use software timestamps */
     hdr->extended_hdr.timestamp_ns = ktime_to_ns(skb_hwtstamps(skb)->hwtstamp);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] hwts=%llu/dev=%s\n",
 	     hdr->extended_hdr.timestamp_ns,
 	     skb->dev ? skb->dev->name : "???");
@@ -2397,6 +4078,84 @@ static inline void set_skb_time(struct sk_buff *skb, struct pfring_pkthdr *hdr)
 
 /* ********************************** */
 
+/*
+  Compact slot header (see struct pfring_compact_pkthdr). hdr->caplen must
+  already be the number of packet bytes that follow. Returns where they go.
+*/
+static inline char* copy_compact_pkthdr(char *ring_bucket, struct pfring_pkthdr *hdr)
+{
+  struct pfring_compact_pkthdr *h = (struct pfring_compact_pkthdr*)ring_bucket;
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+
+  if(hdr->extended_hdr.timestamp_ns != 0)
+    h->timestamp_ns = hdr->extended_hdr.timestamp_ns;
+  else
+    h->timestamp_ns = (u_int64_t)hdr->ts.tv_sec * 1000000000 + (u_int64_t)hdr->ts.tv_usec * 1000;
+
+  h->len = min_val(hdr->len, 0xFFFF), h->caplen = hdr->caplen;
+  h->src_port = p->l4_src_port, h->dst_port = p->l4_dst_port;
+  h->pkt_hash = hash_pkt_header(hdr, 0, 0, 0, 0, 0);
+  h->proto = p->l3_proto, h->tcp_flags = p->tcp.flags;
+  h->l4_offset = ((p->l4_src_port || p->l4_dst_port) && (p->offset.l4_offset < 256)) ? p->offset.l4_offset : 0;
+  h->flags = hdr->extended_hdr.rx_direction ? PFRING_COMPACT_RX : 0;
+  h->src_ip = h->dst_ip = 0;
+
+  if(p->ip_version == 6) {
+    h->flags |= PFRING_COMPACT_IPV6;
+    memcpy(&ring_bucket[sizeof(struct pfring_compact_pkthdr)], &p->ip_src.v6, sizeof(struct in6_addr));
+    memcpy(&ring_bucket[sizeof(struct pfring_compact_pkthdr) + sizeof(struct in6_addr)], &p->ip_dst.v6, sizeof(struct in6_addr));
+  } else if(p->ip_version == 4) {
+    h->flags |= PFRING_COMPACT_IPV4;
+    h->src_ip = p->ipv4_src, h->dst_ip = p->ipv4_dst;
+  } else
+    h->src_port = p->eth_type, h->dst_port = 0;
+
+  if((p->ip_version != 0) && (p->offset.l3_offset < 64))
+    h->flags |= (p->offset.l3_offset >> 1) << 3;
+
+  return(&ring_bucket[pfring_compact_data_offset(h)]);
+}
+
+/* ********************************** */
+
+/* The skb of a packet referenced by the slots of the bounce-enabled rings */
+struct bounce_skb {
+  int num_slots;
+  struct sk_buff *skb;
+};
+
+/*
+  PFRING_SLOT_NT_COPY: non-temporal stores where the kernel has them
+  (memcpy_flushcache() falls back to memcpy() on the other architectures).
+  They are weakly ordered: copy_data_to_ring() fences them with wmb()
+  before publishing tot_insert.
+*/
+static inline void ring_memcpy(struct pf_ring_socket *pfr, void *to, const void *from, u_int len)
+{
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,14,0))
+  if(pfr->slot_layout & PFRING_SLOT_NT_COPY) {
+    memcpy_flushcache(to, from, len);
+    return;
+  }
+#endif
+
+  memcpy(to, from, len);
+}
+
+/* ********************************** */
+
+static inline void ring_copy_skb_bits(struct pf_ring_socket *pfr, const struct sk_buff *skb,
+				      int offset, void *to, u_int len)
+{
+  /* Only the linear part, the paged fragments take the usual path */
+  if((pfr->slot_layout & PFRING_SLOT_NT_COPY) && ((offset + (int)len) <= (int)skb_headlen(skb)))
+    ring_memcpy(pfr, to, skb->data + offset, len);
+  else
+    skb_copy_bits(skb, offset, to, len);
+}
+
+/* ********************************** */
+
 /*
   Generic function for copying either a skb or a raw
   memory block to the ring buffer
@@ -2410,16 +4169,25 @@ inline int copy_data_to_ring(struct sk_buff *skb,
 			     struct pfring_pkthdr *hdr,
 			     int displ, int offset, void *plugin_mem,
 			     void *raw_data, uint raw_data_len,
-			     int *clone_id) {
+			     struct bounce_skb *bounce) {
   char *ring_bucket;
-  u_int32_t off;
+  u_int64_t off;
+  FlowSlotInfo *si = pfr->slots_info;
+  int cpu = -1;
   u_short do_lock = ((pfr->num_bound_devices > 1) || (pfr->num_channels_per_ring > 1) || (pfr->cluster_id != 0)) ? 1 : 0;
 
   // do_lock = 0;
 
   if(pfr->ring_slots == NULL) return(0);
 
-  if(unlikely(enable_debug))
+  if(pfr->num_sub_rings > 1) {
+    /* The sub-ring of this CPU: single writer unless the CPUs outnumber the sub-rings */
+    cpu = get_cpu();
+    si = pfr->sub_slots_info[cpu % pfr->num_sub_rings];
+    do_lock = (nr_cpu_ids > pfr->num_sub_rings) ? 1 : 0;
+  }
+
+  if(debug_on())
     printk("[PF_RING] do_lock=%d [num_channels_per_ring=%d][num_bound_devices=%d]\n",
 	   do_lock, pfr->num_channels_per_ring, pfr->num_bound_devices);
 
@@ -2436,28 +4204,52 @@ inline int copy_data_to_ring(struct sk_buff *skb,
     write_unlock(&pfr->tx.consume_tx_packets_lock);
   }
 
-  off = pfr->slots_info->insert_off;
-  pfr->slots_info->tot_pkts++;
+  off = si->insert_off;
 
-  if(!check_and_init_free_slot(pfr, off)) /* Full */ {
+  if((!check_area_free_slot(si))
+     || (unlikely(pfr->shared_ring != NULL) && !check_shared_ring_free_slot(pfr, si))) /* Full */ {
     /* No room left */
-    pfr->slots_info->tot_lost++;
+    inc_ring_stats(pfr, 1);
+    set_device_busy(skb);
 
-    if(unlikely(enable_debug))
-      printk("[PF_RING] ==> slot(off=%d) is full [insert_off=%u][remove_off=%u][slot_len=%u][num_queued_pkts=%u]\n",
-	     off, pfr->slots_info->insert_off, pfr->slots_info->remove_off, pfr->slots_info->slot_len, num_queued_pkts(pfr));
+    if(debug_on())
+      printk("[PF_RING] ==> slot(off=%llu) is full [insert_off=%llu][remove_off=%llu][slot_len=%u][num_queued_pkts=%u]\n",
+	     (unsigned long long)off, (unsigned long long)si->insert_off, (unsigned long long)si->remove_off,
+	     si->slot_len, area_queued_pkts(si));
 
    if(do_lock) write_unlock(&pfr->ring_index_lock);
+   if(cpu >= 0) put_cpu();
     return(0);
   }
 
-  ring_bucket = get_slot(pfr, off);
+  inc_ring_stats_queued(pfr, area_queued_pkts(si) + 1);
+  ring_bucket = get_area_slot(si, off);
+
+  if(pfr->header_len == compact_pkt_header) {
+    char *data;
+
+    if(skb == NULL)
+      hdr->len = raw_data_len, hdr->caplen = min_val(raw_data_len, pfr->bucket_len);
+    else {
+      if((hdr->ts.tv_sec == 0) && (pfr->tstamp_mode != PFRING_TSTAMP_NONE))
+	set_skb_time(skb, hdr, pfr->tstamp_mode);
+
+      hdr->caplen = min_val(hdr->caplen, pfr->bucket_len); /* 0 for a metadata only ring */
+    }
+
+    data = copy_compact_pkthdr(ring_bucket, hdr);
 
-  if(skb != NULL) {
+    if(hdr->caplen > 0) {
+      if(skb != NULL)
+	ring_copy_skb_bits(pfr, skb, -displ, data, hdr->caplen);
+      else
+	ring_memcpy(pfr, data, raw_data, hdr->caplen);
+    }
+  } else if(skb != NULL) {
     /* skb copy mode */
 
-    if(hdr->ts.tv_sec == 0)
-      set_skb_time(skb, hdr);
+    if((hdr->ts.tv_sec == 0) && (pfr->tstamp_mode != PFRING_TSTAMP_NONE))
+      set_skb_time(skb, hdr, pfr->tstamp_mode);
 
     if(pfr->header_len == long_pkt_header) {
       if((plugin_mem != NULL) && (offset > 0))
@@ -2465,12 +4257,12 @@ inline int copy_data_to_ring(struct sk_buff *skb,
     }
 
     if(hdr->caplen > 0) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] --> [caplen=%d][len=%d][displ=%d][extended_hdr.parsed_header_len=%d][bucket_len=%d][sizeof=%d]\n",
 	       hdr->caplen, hdr->len, displ, hdr->extended_hdr.parsed_header_len, pfr->bucket_len,
 	       pfr->slot_header_len);
 
-      skb_copy_bits(skb, -displ, &ring_bucket[pfr->slot_header_len + offset], hdr->caplen);
+      ring_copy_skb_bits(pfr, skb, -displ, &ring_bucket[pfr->slot_header_len + offset], hdr->caplen);
     } else {
       if(hdr->extended_hdr.parsed_header_len >= pfr->bucket_len) {
 	static u_char print_once = 0;
@@ -2486,59 +4278,90 @@ inline int copy_data_to_ring(struct sk_buff *skb,
     if(pfr->tx.enable_tx_with_bounce
        && (pfr->header_len == long_pkt_header)
        && (skb != NULL)
-       && (clone_id != NULL) /* Just to be on the safe side */
+       && (bounce != NULL) /* Just to be on the safe side */
        ) {
-      struct sk_buff *cloned;
       /*
 	The TX transmission is supported only with long_pkt_header
-	where we can read the id of the output interface
+	where we can read the id of the output interface.
+
+	The slots of all the rings reference the same skb: the original
+	one, or with mode=1, where the stack goes on with the original, a
+	single clone of it. consume_pending_pkts() clones only the packets
+	actually bounced while still referenced by other rings.
+	skb_ring_handler() holds one more reference until it is done with
+	the rings, so that a bounce never finds the skb unshared while
+	references are still being added.
       */
+      if(bounce->num_slots++ == 0) {
+	if(transparent_mode != driver2pf_ring_transparent /* mode=1 */)
+	  bounce->skb = skb;
+	else
+	  bounce->skb = skb_clone(skb, GFP_ATOMIC);
 
-      if(((*clone_id)++ == 0)
-	 && (transparent_mode != driver2pf_ring_transparent /* mode=1 */))
-	hdr->extended_hdr.tx.reserved = skb;
-      else {
-	cloned = skb_clone(skb, GFP_ATOMIC);
-	hdr->extended_hdr.tx.reserved = cloned;
-      }
+	if(bounce->skb != NULL) {
+	  if(displ > 0) skb_push(bounce->skb, displ);
+	  skb_get(bounce->skb); /* skb_ring_handler() hold */
+	}
+      } else if(bounce->skb != NULL)
+	skb_get(bounce->skb);
 
-      if(displ > 0) skb_push(hdr->extended_hdr.tx.reserved, displ);
-      /* printk("[PF_RING] copy_data_to_ring(): clone_id=%d\n", *clone_id); */
+      hdr->extended_hdr.tx.reserved = bounce->skb;
     }
   } else {
     /* Raw data copy mode */
     raw_data_len = min_val(raw_data_len, pfr->bucket_len); /* Avoid overruns */
-    memcpy(&ring_bucket[pfr->slot_header_len], raw_data, raw_data_len); /* Copy raw data if present */
+    ring_memcpy(pfr, &ring_bucket[pfr->slot_header_len], raw_data, raw_data_len); /* Copy raw data if present */
     hdr->len = hdr->caplen = raw_data_len;
-    if(pfr->header_len == long_pkt_header)
+    if((pfr->header_len == long_pkt_header)
+       && (hdr->extended_hdr.if_index <= 0) /* Not a driver buffer (transparent_mode=2) */)
       hdr->extended_hdr.if_index = FAKE_PACKET;
     /* printk("[PF_RING] Copied raw data at slot with offset %d [len=%d]\n", off, raw_data_len); */
   }
 
-  memcpy(ring_bucket, hdr, pfr->slot_header_len); /* Copy extended packet header */
+  if(unlikely(pfr->insert_timestamp)) {
+    u_int64_t now = ktime_to_ns(ktime_get_real());
 
-  pfr->slots_info->insert_off = get_next_slot_offset(pfr, off);
+    if(pfr->header_len == compact_pkt_header)
+      ((struct pfring_compact_pkthdr*)ring_bucket)->timestamp_ns = now;
+    else
+      hdr->extended_hdr.timestamp_ns = now;
+  }
+
+  if(pfr->header_len != compact_pkt_header) {
+    if((pfr->header_len == long_pkt_header) && (hdr->extended_hdr.parsed_pkt.ip_version != 0))
+      hash_pkt_header(hdr, 0, 0, 0, 0, 0); /* No-op when already set */
+
+    ring_memcpy(pfr, ring_bucket, hdr, pfr->slot_header_len); /* Copy extended packet header */
+  }
 
-  if(unlikely(enable_debug))
-    printk("[PF_RING] ==> insert_off=%d\n", pfr->slots_info->insert_off);
+  si->insert_off = get_area_next_slot_offset(pfr, si, off);
+
+  if(debug_on())
+    printk("[PF_RING] ==> insert_off=%llu\n", (unsigned long long)si->insert_off);
 
   /*
-    NOTE: smp_* barriers are _compiler_ barriers on UP, mandatory barriers on SMP
-    a consumer _must_ see the new value of tot_insert only after the buffer update completes
+    NOTE: smp_* barriers are _compiler_ barriers on UP, mandatory barriers on SMP.
+    Release: a consumer _must_ see the new value of tot_insert only after the
+    buffer update completes (it reads tot_insert, then the slot after smp_rmb())
   */
-  smp_mb();
-  //wmb();
+  if(pfr->slot_layout & PFRING_SLOT_NT_COPY)
+    wmb(); /* sfence on x86, where smp_wmb() only orders the compiler */
+  else
+    smp_wmb();
 
-  pfr->slots_info->tot_insert++;
+  si->tot_insert++;
 
  if(do_lock) write_unlock(&pfr->ring_index_lock);
+ if(cpu >= 0) put_cpu();
 
- if(num_queued_pkts(pfr) >= pfr->poll_num_pkts_watermark)
-    wake_up_interruptible(&pfr->ring_slots_waitqueue);
+ ring_wakeup(pfr, si);
+
+ if(unlikely(pfr->shared_ring != NULL) && waitqueue_active(&pfr->shared_ring->readers_waitqueue))
+    wake_up_interruptible(&pfr->shared_ring->readers_waitqueue);
 
 #ifdef VPFRING_SUPPORT
-  if(pfr->vpfring_host_eventfd_ctx && !(pfr->slots_info->vpfring_guest_flags & VPFRING_GUEST_NO_INTERRUPT))
-     eventfd_signal(pfr->vpfring_host_eventfd_ctx, 1);
+  if(pfr->vpfring_host_eventfd_ctx)
+    vpfring_notify(pfr);
 #endif //VPFRING_SUPPORT
 
   return(1);
@@ -2554,18 +4377,78 @@ inline int copy_raw_data_to_ring(struct pf_ring_socket *pfr,
 
 /* ********************************** */
 
+static inline u_int32_t get_skb_rxhash(struct sk_buff *skb)
+{
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0))
+  return(skb->hash);
+#elif(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,35))
+  return(skb->rxhash);
+#else
+  return(0);
+#endif
+}
+
+/* ********************************** */
+
+/*
+  The pkt_hash userland reads is the RSS hash of the NIC when there is
+  one (ethtool -K <dev> rxhash on): hash_pkt_header() is then computed only
+  by the hash rules and the clusters, that keep using the software hash.
+  The fake skbs of the driver buffers have no hwtstamps: their time is taken
+  by buffer_rx_ring_handler().
+*/
+static int copy_skb_to_ring(struct sk_buff *skb, u_int8_t real_skb,
+			    struct pf_ring_socket *pfr,
+			    struct pfring_pkthdr *hdr,
+			    int displ, int offset, void *plugin_mem,
+			    struct bounce_skb *bounce)
+{
+  u_int32_t sw_hash = hdr->extended_hdr.pkt_hash, nic_hash = get_skb_rxhash(skb);
+  int rc;
+
+  if(nic_hash != 0)
+    hdr->extended_hdr.pkt_hash = nic_hash;
+
+  if(real_skb)
+    rc = copy_data_to_ring(skb, pfr, hdr, displ, offset, plugin_mem, NULL, 0, bounce);
+  else {
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,22))
+    if((hdr->ts.tv_sec == 0) && (pfr->tstamp_mode != PFRING_TSTAMP_NONE)) {
+      ktime_t ts = skb->tstamp.tv64 ? skb->tstamp : ktime_get_real();
+
+      hdr->ts = ktime_to_timeval(ts), hdr->extended_hdr.timestamp_ns = ktime_to_ns(ts);
+    }
+#else
+    if((hdr->ts.tv_sec == 0) && (pfr->tstamp_mode != PFRING_TSTAMP_NONE))
+      do_gettimeofday(&hdr->ts);
+#endif
+
+    rc = copy_raw_data_to_ring(pfr, hdr, skb->data, skb->len);
+
+    /* copy_data_to_ring() does not see the skb of the raw copies */
+    if(rc == 0) set_device_busy(skb);
+  }
+
+  if(nic_hash != 0)
+    hdr->extended_hdr.pkt_hash = sw_hash;
+
+  return(rc);
+}
+
+/* ********************************** */
+
 inline int add_pkt_to_ring(struct sk_buff *skb,
 			   u_int8_t real_skb,
 			   struct pf_ring_socket *_pfr,
 			   struct pfring_pkthdr *hdr,
 			   int displ, u_int32_t channel_id,
 			   int offset, void *plugin_mem,
-			   int *clone_id)
+			   struct bounce_skb *bounce)
 {
   struct pf_ring_socket *pfr = (_pfr->master_ring != NULL) ? _pfr->master_ring : _pfr;
   u_int32_t the_bit = 1 << channel_id;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> add_pkt_to_ring(len=%d) [pfr->channel_id=%d][channel_id=%d][real_skb=%u]\n",
 	   hdr->len, pfr->channel_id, channel_id, real_skb);
 
@@ -2583,15 +4466,12 @@ inline int add_pkt_to_ring(struct sk_buff *skb,
      && plugin_registration[pfr->kernel_consumer_plugin_id]->pfring_packet_reader) {
     write_lock(&pfr->ring_index_lock); /* Serialize */
     plugin_registration[pfr->kernel_consumer_plugin_id]->pfring_packet_reader(pfr, skb, channel_id, hdr, displ);
-    pfr->slots_info->tot_pkts++;
     write_unlock(&pfr->ring_index_lock);
+    inc_ring_stats(pfr, 0);
     return(0);
   }
 
-  if(real_skb)
-    return(copy_data_to_ring(skb, pfr, hdr, displ, offset, plugin_mem, NULL, 0, clone_id));
-  else
-    return(copy_raw_data_to_ring(pfr, hdr, skb->data, hdr->len));
+  return(copy_skb_to_ring(skb, real_skb, pfr, hdr, displ, offset, plugin_mem, bounce));
 }
 
 /* ********************************** */
@@ -2628,6 +4508,70 @@ static int add_raw_packet_to_ring(struct pf_ring_socket *pfr, struct pfring_pkth
 
 /* ********************************** */
 
+#define LOOPBACK_INJECT_RESCHED 1024 /* pkts between two reschedule/signal checks */
+
+/* SO_GET_LOOPBACK_INJECT: benchmark of the ring, see struct pfring_loopback_inject */
+static int loopback_inject(struct pf_ring_socket *pfr, struct pfring_loopback_inject *req)
+{
+  static const u_char header[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x00, /* Ethernet */
+    0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,             /* IPv4, UDP */
+    10, 0, 0, 1, 10, 0, 0, 2,
+    0x00, 0x00, 0x00, 0x35, 0x00, 0x00, 0x00, 0x00                                      /* UDP, dport 53 */
+  };
+  struct pfring_pkthdr hdr;
+  u_int64_t start = ktime_to_ns(ktime_get());
+  u_int32_t i, sport;
+  u_char *data;
+
+  if((pfr->ring_slots == NULL) || (pfr->userspace_ring != NULL)
+     || (req->pkt_len < 60) || (req->pkt_len > 1514))
+    return(-EINVAL);
+
+  if(req->num_flows == 0) req->num_flows = 1;
+
+  if((data = kzalloc(req->pkt_len, GFP_KERNEL)) == NULL)
+    return(-ENOMEM);
+
+  memcpy(data, header, sizeof(header));
+  *(u_int16_t*)&data[16] = htons(req->pkt_len - 14);
+  *(u_int16_t*)&data[38] = htons(req->pkt_len - 34);
+
+  req->inserted = req->dropped = 0;
+  memset(&hdr, 0, sizeof(hdr));
+
+  for(i = 0; i < req->num_pkts; i++) {
+    if((i % LOOPBACK_INJECT_RESCHED) == 0) {
+      ktime_t ts = ktime_get_real();
+
+      if(signal_pending(current)) break;
+      cond_resched();
+      /* The time of the received packets, read once per round */
+      hdr.ts = ktime_to_timeval(ts), hdr.extended_hdr.timestamp_ns = ktime_to_ns(ts);
+    }
+
+    sport = 1024 + (i % req->num_flows);
+    data[34] = sport >> 8, data[35] = sport & 0xFF;
+    hdr.len = hdr.caplen = req->pkt_len;
+
+    local_bh_disable(); /* as the softirq of the real packets */
+    parse_raw_pkt((char*)data, req->pkt_len, &hdr);
+    ring_read_lock_inbh();
+    if(copy_raw_data_to_ring(pfr, &hdr, data, req->pkt_len))
+      req->inserted++;
+    else
+      req->dropped++;
+    ring_read_unlock_inbh();
+    local_bh_enable();
+  }
+
+  req->elapsed_ns = ktime_to_ns(ktime_get()) - start;
+  kfree(data);
+  return(0);
+}
+
+/* ********************************** */
+
 static int add_hdr_to_ring(struct pf_ring_socket *pfr,
 			   u_int8_t real_skb,
 			   struct pfring_pkthdr *hdr)
@@ -2637,13 +4581,60 @@ static int add_hdr_to_ring(struct pf_ring_socket *pfr,
 
 /* ********************************** */
 
+/*
+ * Plugin parse memory: instead of kmalloc()ing a parse_buffer per packet,
+ * plugins borrow the one of their id from a per-CPU scratch area with
+ * pf_ring_parse_buffer(). It is given back by free_parse_memory() at the
+ * end of the packet, on the same CPU (add_skb_to_ring() does not sleep).
+ * A packet handled while another one holds the buffer on this CPU (e.g.
+ * transmitted by a plugin) gets NULL: the plugin then allocates as before.
+ */
+struct parse_scratch {
+  u_int8_t lent[MAX_PLUGIN_ID];
+  struct parse_buffer buf[MAX_PLUGIN_ID];
+  u_char mem[MAX_PLUGIN_ID][PLUGIN_PARSE_SCRATCH_LEN];
+};
+
+static struct parse_scratch *parse_scratch = NULL; /* per-CPU */
+
+struct parse_buffer* pf_ring_parse_buffer(u_int16_t plugin_id, u_int16_t mem_len,
+					  struct parse_buffer **storage)
+{
+  struct parse_scratch *s;
+
+  if(*storage != NULL)
+    return(*storage); /* already set for this packet (filter, then action) */
+
+  if((parse_scratch == NULL) || (plugin_id >= MAX_PLUGIN_ID) || (mem_len > PLUGIN_PARSE_SCRATCH_LEN))
+    return(NULL);
+
+  s = per_cpu_ptr(parse_scratch, smp_processor_id());
+
+  if(s->lent[plugin_id])
+    return(NULL);
+
+  s->lent[plugin_id] = 1;
+  s->buf[plugin_id].mem = s->mem[plugin_id], s->buf[plugin_id].mem_len = mem_len;
+  *storage = &s->buf[plugin_id];
+  return(*storage);
+}
+EXPORT_SYMBOL(pf_ring_parse_buffer);
+
+/* ********************************** */
+
 /* Free filtering placeholders */
 static void free_parse_memory(struct parse_buffer *parse_memory_buffer[])
 {
+  struct parse_scratch *s = (parse_scratch != NULL) ? per_cpu_ptr(parse_scratch, smp_processor_id()) : NULL;
   int i;
 
   for(i = 1; i <= max_registered_plugin_id; i++)
     if(parse_memory_buffer[i]) {
+      if((s != NULL) && (parse_memory_buffer[i] == &s->buf[i])) {
+	s->lent[i] = 0; /* borrowed, nothing to free */
+	continue;
+      }
+
       if(parse_memory_buffer[i]->mem != NULL) {
 	kfree(parse_memory_buffer[i]->mem);
       }
@@ -2654,6 +4645,114 @@ static void free_parse_memory(struct parse_buffer *parse_memory_buffer[])
 
 /* ************************************* */
 
+/*
+  Called on the rules copied from userland before they are added,
+  outside ring_rules_lock as alloc_percpu() may sleep
+*/
+static int init_rule_internals(filtering_internals *internals, rule_action_behaviour action,
+			       filtering_rule_rate_limit *rate_limit)
+{
+  u_int32_t num_cpus = num_online_cpus(), burst;
+  u_int64_t cost_ns, depth_ns;
+  int cpu;
+
+  /* Do not trust userland */
+  internals->cpu_stats = NULL, internals->rate_limit = NULL;
+  internals->tot_pkts = internals->tot_bytes = 0;
+
+  if((action == rate_limit_packet_and_stop_rule_evaluation) && (rate_limit->pps == 0))
+    return(-EINVAL);
+
+  if((internals->cpu_stats = alloc_percpu(struct rule_cpu_stats)) == NULL)
+    return(-ENOMEM);
+
+  if(action != rate_limit_packet_and_stop_rule_evaluation)
+    return(0);
+
+  burst = rate_limit->burst ? rate_limit->burst : max_val(rate_limit->pps / 10, 1);
+  cost_ns = div_u64((u_int64_t)NSEC_PER_SEC * num_cpus, rate_limit->pps);
+  depth_ns = max_val(div_u64((u_int64_t)burst * cost_ns, num_cpus), cost_ns);
+
+  if((internals->rate_limit = alloc_percpu(struct rule_rate_limit_cpu)) == NULL) {
+    free_percpu(internals->cpu_stats);
+    internals->cpu_stats = NULL;
+    return(-ENOMEM);
+  }
+
+  for_each_possible_cpu(cpu) {
+    struct rule_rate_limit_cpu *b = per_cpu_ptr(internals->rate_limit, cpu);
+
+    b->cost_ns = cost_ns, b->depth_ns = depth_ns;
+    b->credit_ns = depth_ns, b->last_ns = ktime_to_ns(ktime_get());
+  }
+
+  return(0);
+}
+
+/* ************************************* */
+
+static void free_rule_internals(filtering_internals *internals)
+{
+  if(internals->cpu_stats != NULL) {
+    free_percpu(internals->cpu_stats);
+    internals->cpu_stats = NULL;
+  }
+
+  if(internals->rate_limit != NULL) {
+    free_percpu(internals->rate_limit);
+    internals->rate_limit = NULL;
+  }
+}
+
+/* ************************************* */
+
+/* Summed over the CPUs */
+static void get_rule_counters(filtering_internals *internals, struct rule_cpu_stats *total)
+{
+  int cpu;
+
+  total->tot_pkts = internals->tot_pkts, total->tot_bytes = internals->tot_bytes;
+  total->tot_reflected = internals->tot_reflected, total->tot_reflect_failed = internals->tot_reflect_failed;
+
+  if(internals->cpu_stats != NULL) {
+    for_each_possible_cpu(cpu) {
+      struct rule_cpu_stats *s = per_cpu_ptr(internals->cpu_stats, cpu);
+
+      total->tot_pkts += s->tot_pkts, total->tot_bytes += s->tot_bytes;
+      total->tot_reflected += s->tot_reflected, total->tot_reflect_failed += s->tot_reflect_failed;
+    }
+  }
+}
+
+/* ************************************* */
+
+/* Returns 1 if the packet fits in the rate of the rule, 0 if it has to be dropped */
+static int rule_rate_limit_pass(filtering_internals *internals)
+{
+  struct rule_rate_limit_cpu *b;
+  u_int64_t now;
+  int pass;
+
+  if(internals->rate_limit == NULL)
+    return(1);
+
+  b = per_cpu_ptr(internals->rate_limit, get_cpu());
+  now = ktime_to_ns(ktime_get());
+
+  b->credit_ns = min_val(b->credit_ns + (now - b->last_ns), b->depth_ns);
+  b->last_ns = now;
+
+  if((pass = (b->credit_ns >= b->cost_ns)))
+    b->credit_ns -= b->cost_ns, b->tot_passed++;
+  else
+    b->tot_dropped++;
+
+  put_cpu();
+  return(pass);
+}
+
+/* ************************************* */
+
 static void free_filtering_rule(sw_filtering_rule_element * entry, u_int8_t freeing_ring)
 {
 #ifdef CONFIG_TEXTSEARCH
@@ -2691,6 +4790,8 @@ static void free_filtering_rule(sw_filtering_rule_element * entry, u_int8_t free
   if(entry->rule.internals.reflector_dev != NULL)
     dev_put(entry->rule.internals.reflector_dev); /* Release device */
 
+  free_rule_internals(&entry->rule.internals);
+
   if(entry->rule.extended_fields.filter_plugin_id > 0) {
     if(plugin_registration[entry->rule.extended_fields.filter_plugin_id]->pfring_plugin_register)
       plugin_registration[entry->rule.extended_fields.filter_plugin_id]->pfring_plugin_register(0);
@@ -2714,12 +4815,367 @@ static void free_sw_filtering_hash_bucket(sw_filtering_hash_bucket * bucket)
   if(bucket->rule.internals.reflector_dev != NULL)
     dev_put(bucket->rule.internals.reflector_dev);	/* Release device */
 
+  free_rule_internals(&bucket->rule.internals);
+
   if(bucket->rule.plugin_action.plugin_id > 0) {
     if(plugin_registration[bucket->rule.plugin_action.plugin_id]->pfring_plugin_register)
       plugin_registration[bucket->rule.plugin_action.plugin_id]->pfring_plugin_register(0);
   }
 }
 
+/* ************************************* */
+
+/* Packet handlers may still be walking the bucket: free it after a grace period */
+static void free_sw_filtering_hash_bucket_rcu(struct rcu_head *head)
+{
+  sw_filtering_hash_bucket *bucket = container_of(head, sw_filtering_hash_bucket, rcu);
+
+  free_sw_filtering_hash_bucket(bucket);
+  kfree(bucket);
+}
+
+/* ************************************* */
+
+static struct sw_filtering_hash_table* alloc_hash_rules_table(u_int32_t size, u_int8_t link,
+							      u_int8_t atomic)
+{
+  u_int32_t len = sizeof(struct sw_filtering_hash_table) + size * sizeof(sw_filtering_hash_bucket*);
+  struct sw_filtering_hash_table *t;
+
+  if(atomic)
+    t = kzalloc(len, GFP_ATOMIC);
+  else if((t = vmalloc(len)) != NULL)
+    memset(t, 0, len);
+
+  if(t == NULL)
+    return(NULL);
+
+  t->size = size, t->link = link, t->vmalloced = !atomic;
+  return(t);
+}
+
+/* ************************************* */
+
+static void free_hash_rules_table(struct sw_filtering_hash_table *t)
+{
+  if(t->vmalloced)
+    vfree(t);
+  else
+    kfree(t);
+}
+
+/* ************************************* */
+
+static inline u_int32_t hash_rules_table_idx(struct sw_filtering_hash_table *t,
+					     hash_filtering_rule *rule)
+{
+  return(hash_pkt(rule->vlan_id, rule->proto,
+		  rule->host_peer_a, rule->host_peer_b,
+		  rule->port_peer_a, rule->port_peer_b) & (t->size - 1));
+}
+
+/* ************************************* */
+
+/* Caller holds ring_rules_lock (write) */
+static void hash_rules_table_link(struct sw_filtering_hash_table *t,
+				  sw_filtering_hash_bucket *bucket)
+{
+  sw_filtering_hash_bucket **chain = &t->chain[hash_rules_table_idx(t, &bucket->rule)];
+
+  bucket->next[t->link] = *chain;
+  rcu_assign_pointer(*chain, bucket); /* readers see it initialized */
+}
+
+/* ************************************* */
+
+/* Caller holds ring_rules_lock (write): readers on bucket go on with its next[] */
+static int hash_rules_table_unlink(struct sw_filtering_hash_table *t,
+				   sw_filtering_hash_bucket *bucket)
+{
+  sw_filtering_hash_bucket **prev = &t->chain[hash_rules_table_idx(t, &bucket->rule)];
+
+  while((*prev != NULL) && (*prev != bucket))
+    prev = &(*prev)->next[t->link];
+
+  if(*prev == NULL)
+    return(-1);
+
+  *prev = bucket->next[t->link];
+  return(0);
+}
+
+/* ************************************* */
+
+/* Caller holds ring_rules_lock (write): both tables while resizing */
+static void hash_rules_link(struct pf_ring_socket *pfr, sw_filtering_hash_bucket *bucket)
+{
+  hash_rules_table_link(pfr->sw_filtering_hash, bucket);
+
+  if((pfr->sw_filtering_hash_resize != NULL)
+     && (hash_rules_table_idx(pfr->sw_filtering_hash, &bucket->rule) < pfr->sw_filtering_hash_migrated))
+    hash_rules_table_link(pfr->sw_filtering_hash_resize, bucket);
+}
+
+/* ************************************* */
+
+static void hash_rules_unlink(struct pf_ring_socket *pfr, sw_filtering_hash_bucket *bucket)
+{
+  if((pfr->sw_filtering_hash_resize != NULL)
+     && (hash_rules_table_idx(pfr->sw_filtering_hash, &bucket->rule) < pfr->sw_filtering_hash_migrated))
+    hash_rules_table_unlink(pfr->sw_filtering_hash_resize, bucket);
+
+  hash_rules_table_unlink(pfr->sw_filtering_hash, bucket);
+}
+
+/* ************************************* */
+
+/*
+  Move up to num_chains more old chains to the doubled table: it replaces
+  the old one when they have all been moved. Caller holds ring_rules_lock (write)
+*/
+static void hash_rules_table_migrate(struct pf_ring_socket *pfr, u_int32_t num_chains)
+{
+  struct sw_filtering_hash_table *old = pfr->sw_filtering_hash, *t = pfr->sw_filtering_hash_resize;
+
+  if(t == NULL)
+    return;
+
+  while((num_chains-- > 0) && (pfr->sw_filtering_hash_migrated < old->size)) {
+    sw_filtering_hash_bucket *bucket;
+
+    for(bucket = old->chain[pfr->sw_filtering_hash_migrated]; bucket != NULL; bucket = bucket->next[old->link])
+      hash_rules_table_link(t, bucket);
+
+    pfr->sw_filtering_hash_migrated++;
+  }
+
+  if(pfr->sw_filtering_hash_migrated == old->size) {
+    rcu_assign_pointer(pfr->sw_filtering_hash, t);
+    pfr->sw_filtering_hash_resize = NULL;
+    /* Its link is not reused before prepare_hash_rules_table() has waited for the readers */
+    pfr->sw_filtering_hash_retired = old;
+  }
+}
+
+/* ************************************* */
+
+/*
+  Allocate the table or start doubling it when it is too loaded: from
+  process context (vmalloc, synchronize_rcu) before a rule is added
+*/
+static void prepare_hash_rules_table(struct pf_ring_socket *pfr)
+{
+  struct sw_filtering_hash_table *retired, *t;
+  u_int32_t size = 0;
+
+  if(atomic_xchg(&pfr->hash_rules_table_busy, 1))
+    return; /* another thread is at it */
+
+  read_lock_bh(&pfr->ring_rules_lock);
+  retired = pfr->sw_filtering_hash_retired;
+  read_unlock_bh(&pfr->ring_rules_lock);
+
+  if(retired != NULL) {
+    synchronize_rcu(); /* nobody walks its chains anymore */
+    write_lock_bh(&pfr->ring_rules_lock);
+    pfr->sw_filtering_hash_retired = NULL;
+    write_unlock_bh(&pfr->ring_rules_lock);
+    free_hash_rules_table(retired);
+  }
+
+  read_lock_bh(&pfr->ring_rules_lock);
+  if(pfr->sw_filtering_hash == NULL)
+    size = pfr->hash_rules_table_size;
+  else if(pfr->sw_filtering_hash_resize == NULL) {
+    t = pfr->sw_filtering_hash;
+
+    if(t->size < pfr->hash_rules_table_size)
+      size = pfr->hash_rules_table_size; /* SO_SET_HASH_RULES_TABLE */
+    else if((t->size < MAX_RING_HASH_SIZE) && (pfr->num_sw_filtering_hash_rules >= t->size * HASH_RULES_MAX_LOAD))
+      size = t->size * 2;
+  }
+  read_unlock_bh(&pfr->ring_rules_lock);
+
+  if((size > 0) && ((t = alloc_hash_rules_table(size, 0, 0)) != NULL)) {
+    write_lock_bh(&pfr->ring_rules_lock);
+
+    if(pfr->sw_filtering_hash == NULL) {
+      rcu_assign_pointer(pfr->sw_filtering_hash, t);
+      t = NULL;
+    } else if((pfr->sw_filtering_hash_resize == NULL) && (pfr->sw_filtering_hash_retired == NULL)
+	    && (pfr->sw_filtering_hash->size < size)) {
+      t->link = !pfr->sw_filtering_hash->link;
+      pfr->sw_filtering_hash_resize = t, pfr->sw_filtering_hash_migrated = 0, t = NULL;
+      hash_rules_table_migrate(pfr, HASH_RULES_RESIZE_BATCH);
+    }
+
+    write_unlock_bh(&pfr->ring_rules_lock);
+
+    if(t != NULL)
+      free_hash_rules_table(t); /* lost a race with the packet path */
+
+    if(debug_on())
+      printk("[PF_RING] %s() hash rules table: %u buckets\n", __FUNCTION__, size);
+  }
+
+  atomic_set(&pfr->hash_rules_table_busy, 0);
+}
+
+/* ************************************* */
+
+static inline u_int32_t hash_rule_expire(struct pf_ring_socket *pfr,
+					 sw_filtering_hash_bucket *bucket)
+{
+  return((u_int32_t)(bucket->rule.internals.jiffies_last_match / HZ) + pfr->hash_rules_idle_timeout);
+}
+
+/* ************************************* */
+
+/* Caller holds ring_rules_lock (write) */
+static void hash_rules_wheel_add(struct pf_ring_socket *pfr,
+				 sw_filtering_hash_bucket *bucket)
+{
+  struct hash_rules_wheel *w = &pfr->hash_rules_wheel;
+  u_int32_t expire = hash_rule_expire(pfr, bucket);
+  sw_filtering_hash_bucket **slot;
+
+  if((int32_t)(expire - w->now) < HASH_RULES_WHEEL_SLOTS) {
+    if((int32_t)(expire - w->now) < 0)
+      expire = w->now; /* overdue: next tick */
+
+    slot = &w->level0[expire & HASH_RULES_WHEEL_MASK];
+  } else {
+    u_int32_t ahead = (expire >> HASH_RULES_WHEEL_BITS) - (w->now >> HASH_RULES_WHEEL_BITS);
+
+    /* Too far: looked at again (and queued further) when cascaded */
+    if(ahead >= HASH_RULES_WHEEL_SLOTS)
+      expire = ((w->now >> HASH_RULES_WHEEL_BITS) + HASH_RULES_WHEEL_SLOTS - 1) << HASH_RULES_WHEEL_BITS;
+
+    slot = &w->level1[(expire >> HASH_RULES_WHEEL_BITS) & HASH_RULES_WHEEL_MASK];
+  }
+
+  bucket->wheel_next = *slot, bucket->wheel_pprev = slot;
+  if(*slot != NULL) (*slot)->wheel_pprev = &bucket->wheel_next;
+  *slot = bucket;
+}
+
+/* ************************************* */
+
+static void hash_rules_wheel_del(sw_filtering_hash_bucket *bucket)
+{
+  if(bucket->wheel_pprev == NULL)
+    return; /* not queued */
+
+  *bucket->wheel_pprev = bucket->wheel_next;
+  if(bucket->wheel_next != NULL) bucket->wheel_next->wheel_pprev = bucket->wheel_pprev;
+  bucket->wheel_next = NULL, bucket->wheel_pprev = NULL;
+}
+
+/* ************************************* */
+
+/* SO_SET_HASH_RULES_IDLE_TIMEOUT: caller holds ring_rules_lock (write) */
+static void hash_rules_wheel_rebuild(struct pf_ring_socket *pfr)
+{
+  struct hash_rules_wheel *w = &pfr->hash_rules_wheel;
+  int i;
+
+  memset(w->level0, 0, sizeof(w->level0));
+  memset(w->level1, 0, sizeof(w->level1));
+  w->now = (u_int32_t)(jiffies / HZ);
+
+  if(pfr->sw_filtering_hash == NULL)
+    return;
+
+  /* All the rules are in sw_filtering_hash, even while resizing */
+  for(i = 0; i < pfr->sw_filtering_hash->size; i++) {
+    sw_filtering_hash_bucket *scan;
+
+    for(scan = pfr->sw_filtering_hash->chain[i]; scan != NULL; scan = scan->next[pfr->sw_filtering_hash->link]) {
+      scan->wheel_next = NULL, scan->wheel_pprev = NULL;
+
+      if(pfr->hash_rules_idle_timeout > 0)
+	hash_rules_wheel_add(pfr, scan);
+    }
+  }
+}
+
+/* ************************************* */
+
+static void hash_rules_wheel_expire(struct pf_ring_socket *pfr,
+				    sw_filtering_hash_bucket *bucket)
+{
+  int rc = 0;
+
+  if(bucket->rule.plugin_action.plugin_id > 0
+     && plugin_registration[bucket->rule.plugin_action.plugin_id]
+     && plugin_registration[bucket->rule.plugin_action.plugin_id]->pfring_plugin_purge_idle)
+    rc = plugin_registration[bucket->rule.plugin_action.plugin_id]->
+      pfring_plugin_purge_idle(pfr, NULL, bucket, pfr->hash_rules_idle_timeout);
+
+  if(((int32_t)(hash_rule_expire(pfr, bucket) - pfr->hash_rules_wheel.now) <= 0) || (rc > 0)) {
+    hash_rules_unlink(pfr, bucket);
+    call_rcu(&bucket->rcu, free_sw_filtering_hash_bucket_rcu);
+    pfr->num_sw_filtering_rules--, pfr->num_sw_filtering_hash_rules--;
+  } else
+    hash_rules_wheel_add(pfr, bucket); /* matched meanwhile */
+}
+
+/* ************************************* */
+
+static void hash_rules_wheel_tick(struct pf_ring_socket *pfr)
+{
+  struct hash_rules_wheel *w = &pfr->hash_rules_wheel;
+  u_int32_t now = (u_int32_t)(jiffies / HZ);
+
+  write_lock(&pfr->ring_rules_lock);
+
+  if(pfr->hash_rules_idle_timeout == 0) {
+    /* SO_SET_HASH_RULES_IDLE_TIMEOUT 0: do not rearm */
+    write_unlock(&pfr->ring_rules_lock);
+    return;
+  }
+
+  while((int32_t)(now - w->now) >= 0) {
+    sw_filtering_hash_bucket *bucket;
+
+    if((w->now & HASH_RULES_WHEEL_MASK) == 0) {
+      u_int32_t slot = (w->now >> HASH_RULES_WHEEL_BITS) & HASH_RULES_WHEEL_MASK;
+
+      /* Never queued back to the same level1 slot */
+      while((bucket = w->level1[slot]) != NULL) {
+	hash_rules_wheel_del(bucket);
+	hash_rules_wheel_add(pfr, bucket);
+      }
+    }
+
+    /* Queued back rules expire after now: never the same slot */
+    while((bucket = w->level0[w->now & HASH_RULES_WHEEL_MASK]) != NULL) {
+      hash_rules_wheel_del(bucket);
+      hash_rules_wheel_expire(pfr, bucket);
+    }
+
+    w->now++;
+  }
+
+  /* A resize also ends when no rule is added anymore */
+  hash_rules_table_migrate(pfr, HASH_RULES_RESIZE_BATCH);
+
+  mod_timer(&w->timer, jiffies + HZ);
+  write_unlock(&pfr->ring_rules_lock);
+}
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0))
+static void hash_rules_wheel_timer(struct timer_list *t)
+{
+  hash_rules_wheel_tick(container_of(t, struct pf_ring_socket, hash_rules_wheel.timer));
+}
+#else
+static void hash_rules_wheel_timer(unsigned long data)
+{
+  hash_rules_wheel_tick((struct pf_ring_socket*)data);
+}
+#endif
+
 /*
   NOTE
 
@@ -2734,13 +5190,12 @@ static int handle_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
 					   sw_filtering_hash_bucket * rule,
 					   u_char add_rule)
 {
-  int rc = -1;
+  sw_filtering_hash_bucket *bucket = NULL;
   u_int32_t hash_value = hash_pkt(rule->rule.vlan_id, rule->rule.proto,
 				  rule->rule.host_peer_a, rule->rule.host_peer_b,
-				  rule->rule.port_peer_a, rule->rule.port_peer_b)
-    % DEFAULT_RING_HASH_SIZE;
+				  rule->rule.port_peer_a, rule->rule.port_peer_b);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s(vlan=%u, proto=%u, "
 	   "sip=%d.%d.%d.%d, sport=%u, dip=%d.%d.%d.%d, dport=%u, "
 	   "hash_value=%u, add_rule=%d) called\n",
@@ -2768,20 +5223,28 @@ static int handle_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
         ret = -EFAULT;
 
       if(ret != 0) {
-        if(unlikely(enable_debug))
+        if(debug_on())
 	  printk("[PF_RING] Invalid action plugin [id=%d]\n",
 	         rule->rule.plugin_action.plugin_id);
         return(ret);
       }
     }
 
+    if((pfr->max_hash_rules > 0) && (pfr->num_sw_filtering_hash_rules >= pfr->max_hash_rules)) {
+      if(debug_on())
+	printk("[PF_RING] %s() too many hash rules [max=%u]\n", __FUNCTION__, pfr->max_hash_rules);
+      return(-ENOSPC);
+    }
+
+    rule->rule.internals.tot_reflected = rule->rule.internals.tot_reflect_failed = 0;
+
     /* Checking reflector device */
     if(rule->rule.reflector_device_name[0] != '\0') {
       if((pfr->ring_netdev->dev != NULL) &&
          rule->rule.rule_action != bounce_packet_and_stop_rule_evaluation &&
          rule->rule.rule_action != bounce_packet_and_continue_rule_evaluation &&
          (strcmp(rule->rule.reflector_device_name, pfr->ring_netdev->dev->name) == 0)) {
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] You cannot use as reflection device the same device on "
 	       "which this ring is bound\n");
         return(-EFAULT);
@@ -2801,18 +5264,19 @@ static int handle_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
     } else
       rule->rule.internals.reflector_dev = NULL;
 
-    /* initialiting hash table */
+    /* initialiting hash table (prepare_hash_rules_table() unless added from the packet path) */
     if(pfr->sw_filtering_hash == NULL) {
-      pfr->sw_filtering_hash = (sw_filtering_hash_bucket **)
-	kcalloc(DEFAULT_RING_HASH_SIZE, sizeof(sw_filtering_hash_bucket *), GFP_ATOMIC);
+      struct sw_filtering_hash_table *t = alloc_hash_rules_table(pfr->hash_rules_table_size, 0, 1);
 
-      if(pfr->sw_filtering_hash == NULL) {
-        if(unlikely(enable_debug))
+      if(t == NULL) {
+        if(debug_on())
 	  printk("[PF_RING] %s() returned %d [0]\n", __FUNCTION__, -EFAULT);
         return(-EFAULT);
       }
 
-      if(unlikely(enable_debug))
+      rcu_assign_pointer(pfr->sw_filtering_hash, t);
+
+      if(debug_on())
         printk("[PF_RING] %s() allocated memory\n", __FUNCTION__);
     }
   }
@@ -2822,78 +5286,259 @@ static int handle_sw_filtering_hash_bucket(struct pf_ring_socket *pfr,
     return(-EFAULT);
   }
 
-  if(pfr->sw_filtering_hash[hash_value] == NULL) {
-    if(add_rule) {
-      rule->next = NULL;
-      pfr->sw_filtering_hash[hash_value] = rule;
-      rc = 0;
-    } else {
-      if(unlikely(enable_debug))
-	printk("[PF_RING] %s() returned %d [1]\n", __FUNCTION__, -1);
-      return(-1);	/* Unable to find the specified rule */
+  /* All the rules are in sw_filtering_hash, even while resizing */
+  bucket = pfr->sw_filtering_hash->chain[hash_rules_table_idx(pfr->sw_filtering_hash, &rule->rule)];
+
+  while((bucket != NULL) && !hash_filtering_rule_match(&bucket->rule, &rule->rule))
+    bucket = bucket->next[pfr->sw_filtering_hash->link];
+
+  if(add_rule) {
+    if(bucket != NULL) {
+      if(debug_on())
+	printk("[PF_RING] Duplicate found while adding rule: discarded\n");
+      return(-EEXIST);
+    }
+
+    /* If the flow arrived until here, then this rule is unique */
+    if(debug_on())
+      printk("[PF_RING] %s() no duplicate rule found: adding the rule\n", __FUNCTION__);
+
+    /* Avoid immediate rule purging */
+    rule->rule.internals.jiffies_last_match = jiffies;
+
+    rule->wheel_next = NULL, rule->wheel_pprev = NULL;
+    if(pfr->hash_rules_idle_timeout > 0)
+      hash_rules_wheel_add(pfr, rule);
+
+    hash_rules_link(pfr, rule);
+    pfr->num_sw_filtering_rules++, pfr->num_sw_filtering_hash_rules++;
+
+    if(rule->rule.plugin_action.plugin_id > 0) {
+      if(plugin_registration[rule->rule.plugin_action.plugin_id]->pfring_plugin_register)
+        plugin_registration[rule->rule.plugin_action.plugin_id]->pfring_plugin_register(1);
     }
   } else {
-    sw_filtering_hash_bucket *prev = NULL, *bucket = pfr->sw_filtering_hash[hash_value];
-
-    while(bucket != NULL) {
-      if(hash_filtering_rule_match(&bucket->rule, &rule->rule)) {
-	if(add_rule) {
-	  if(unlikely(enable_debug))
-	    printk("[PF_RING] Duplicate found while adding rule: discarded\n");
-	  return(-EEXIST);
-	} else {
-	  /* We've found the bucket to delete */
-
-	  if(unlikely(enable_debug))
-	    printk("[PF_RING] %s() found a bucket to delete: removing it\n", __FUNCTION__);
-	  if(prev == NULL)
-	    pfr->sw_filtering_hash[hash_value] = bucket->next;
-	  else
-	    prev->next = bucket->next;
-
-	  free_sw_filtering_hash_bucket(bucket);
-	  kfree(bucket);
-	  pfr->num_sw_filtering_rules--;
-	  if(unlikely(enable_debug))
-	    printk("[PF_RING] %s() returned %d [2]\n", __FUNCTION__, 0);
-	  return(0);
+    if(bucket == NULL) {
+      /* The rule we searched for has not been found */
+      if(debug_on())
+	printk("[PF_RING] %s() returned %d [1]\n", __FUNCTION__, -1);
+      return(-1);
+    }
+
+    /* We've found the bucket to delete */
+    if(debug_on())
+      printk("[PF_RING] %s() found a bucket to delete: removing it\n", __FUNCTION__);
+
+    hash_rules_unlink(pfr, bucket);
+    hash_rules_wheel_del(bucket);
+    call_rcu(&bucket->rcu, free_sw_filtering_hash_bucket_rcu);
+    pfr->num_sw_filtering_rules--, pfr->num_sw_filtering_hash_rules--;
+  }
+
+  hash_rules_table_migrate(pfr, HASH_RULES_RESIZE_BATCH);
+
+  if(debug_on())
+    printk("[PF_RING] %s() returned %d [3]\n", __FUNCTION__, 0);
+
+  return(0);
+}
+
+/* ************************************* */
+
+static int handle_sw_filtering_hash_buckets(struct pf_ring_socket *pfr,
+					    char __user *optval, unsigned int optlen,
+					    u_char add_rule)
+{
+  struct pfring_hash_rules_bulk bulk;
+  sw_filtering_hash_bucket **buckets = NULL, del;
+  hash_filtering_rule *rules;
+  u_int32_t i, num_done = 0;
+  int rc = 0;
+
+  if(optlen < sizeof(bulk))
+    return -EINVAL;
+
+  if(copy_from_user(&bulk, optval, sizeof(bulk)))
+    return -EFAULT;
+
+  if((bulk.num_rules > MAX_HASH_RULES_BULK)
+     || (optlen != sizeof(bulk) + bulk.num_rules * sizeof(hash_filtering_rule)))
+    return -EINVAL;
+
+  if(bulk.num_rules == 0)
+    return(0);
+
+  if((rules = vmalloc(bulk.num_rules * sizeof(hash_filtering_rule))) == NULL)
+    return -ENOMEM;
+
+  if(copy_from_user(rules, optval + sizeof(bulk), bulk.num_rules * sizeof(hash_filtering_rule))) {
+    vfree(rules);
+    return -EFAULT;
+  }
+
+  if(add_rule) {
+    /* Allocated before taking the lock: GFP_KERNEL */
+    if((buckets = vmalloc(bulk.num_rules * sizeof(sw_filtering_hash_bucket*))) == NULL) {
+      vfree(rules);
+      return -ENOMEM;
+    }
+
+    for(i = 0; i < bulk.num_rules; i++) {
+      int ret = -ENOMEM;
+
+      if((buckets[i] = kcalloc(1, sizeof(sw_filtering_hash_bucket), GFP_KERNEL)) != NULL) {
+	memcpy(&buckets[i]->rule, &rules[i], sizeof(hash_filtering_rule));
+
+	if((ret = init_rule_internals(&buckets[i]->rule.internals, rules[i].rule_action,
+				       &rules[i].rate_limit)) != 0)
+	  kfree(buckets[i]);
+      }
+
+      if(ret != 0) {
+	while(i > 0) {
+	  free_rule_internals(&buckets[--i]->rule.internals);
+	  kfree(buckets[i]);
 	}
-      } else {
-	prev = bucket;
-	bucket = bucket->next;
+	vfree(buckets), vfree(rules);
+	return(ret);
       }
     }
 
-    if(add_rule) {
-      /* If the flow arrived until here, then this rule is unique */
-      if(unlikely(enable_debug))
-	printk("[PF_RING] %s() no duplicate rule found: adding the rule\n", __FUNCTION__);
+    prepare_hash_rules_table(pfr); /* may sleep */
+  }
+
+  write_lock_bh(&pfr->ring_rules_lock);
+
+  for(i = 0; i < bulk.num_rules; i++) {
+    int ret;
+
+    if(add_rule) {
+      if((ret = handle_sw_filtering_hash_bucket(pfr, buckets[i], 1 /* add */)) == 0)
+	buckets[i] = NULL; /* owned by the table */
+    } else {
+      memcpy(&del.rule, &rules[i], sizeof(hash_filtering_rule));
+      ret = handle_sw_filtering_hash_bucket(pfr, &del, 0 /* delete */);
+    }
+
+    if(ret == 0)
+      num_done++;
+    else if(ret != (add_rule ? -EEXIST : -1)) {
+      rc = ret;
+      break;
+    }
+  }
+
+  write_unlock_bh(&pfr->ring_rules_lock);
+
+  if(debug_on())
+    printk("[PF_RING] %s() %s %u/%u hash rules [rc=%d]\n", __FUNCTION__,
+	   add_rule ? "added" : "removed", num_done, bulk.num_rules, rc);
+
+  if(add_rule) {
+    for(i = 0; i < bulk.num_rules; i++)
+      if(buckets[i] != NULL) {
+	free_rule_internals(&buckets[i]->rule.internals);
+	kfree(buckets[i]);
+      }
+
+    vfree(buckets);
+  }
+
+  vfree(rules);
+
+  if(copy_to_user(optval + offsetof(struct pfring_hash_rules_bulk, num_done), &num_done, sizeof(num_done)))
+    return -EFAULT;
+
+  return(rc);
+}
+
+/* ************************************* */
+
+/* SO_GET_HASH_FILTERING_RULES_STATS: returns the length copied to optval */
+static int get_sw_filtering_hash_buckets_stats(struct pf_ring_socket *pfr,
+					       char __user *optval, int len)
+{
+  struct pfring_hash_rules_stats_bulk bulk;
+  struct pfring_hash_rule_stats *stats;
+  struct sw_filtering_hash_table *t;
+  u_int32_t chain, pos, num = 0;
+  unsigned long now = jiffies;
+
+  if(len < sizeof(bulk))
+    return -EINVAL;
+
+  if(copy_from_user(&bulk, optval, sizeof(bulk)))
+    return -EFAULT;
+
+  if((bulk.max_rules == 0) || (bulk.max_rules > MAX_HASH_RULES_BULK)
+     || (len < sizeof(bulk) + bulk.max_rules * sizeof(struct pfring_hash_rule_stats)))
+    return -EINVAL;
+
+  /* Allocated before taking the lock: GFP_KERNEL */
+  if((stats = vmalloc(bulk.max_rules * sizeof(struct pfring_hash_rule_stats))) == NULL)
+    return -ENOMEM;
+
+  chain = bulk.cursor >> 32, pos = (u_int32_t)bulk.cursor;
+
+  read_lock_bh(&pfr->ring_rules_lock);
+
+  /* During a resize the old table still links all the rules */
+  if((t = pfr->sw_filtering_hash) == NULL)
+    chain = 0;
+  else {
+    for(; chain < t->size; chain++, pos = 0) {
+      sw_filtering_hash_bucket *bucket = t->chain[chain];
+      u_int32_t i;
+
+      for(i = 0; (bucket != NULL) && (i < pos); i++)
+	bucket = bucket->next[t->link];
 
-      rule->next = pfr->sw_filtering_hash[hash_value];
-      pfr->sw_filtering_hash[hash_value] = rule;
-      rc = 0;
-    } else {
-      /* The rule we searched for has not been found */
-      rc = -1;
-    }
-  }
+      for(; bucket != NULL; bucket = bucket->next[t->link], pos++) {
+	struct pfring_hash_rule_stats *r = &stats[num];
+	struct rule_cpu_stats counters;
 
-  if(add_rule && rc == 0) {
-    pfr->num_sw_filtering_rules++;
+	if(num == bulk.max_rules)
+	  break;
 
-    /* Avoid immediate rule purging */
-    rule->rule.internals.jiffies_last_match = jiffies;
+	get_rule_counters(&bucket->rule.internals, &counters);
 
-    if(rule->rule.plugin_action.plugin_id > 0) {
-      if(plugin_registration[rule->rule.plugin_action.plugin_id]->pfring_plugin_register)
-        plugin_registration[rule->rule.plugin_action.plugin_id]->pfring_plugin_register(1);
+	r->vlan_id = bucket->rule.vlan_id, r->plugin_id = bucket->rule.plugin_action.plugin_id;
+	r->proto = bucket->rule.proto;
+	memset(r->pad, 0, sizeof(r->pad));
+	r->host_peer_a = bucket->rule.host_peer_a, r->host_peer_b = bucket->rule.host_peer_b;
+	r->port_peer_a = bucket->rule.port_peer_a, r->port_peer_b = bucket->rule.port_peer_b;
+	r->idle_msec = jiffies_to_msecs(now - bucket->rule.internals.jiffies_last_match);
+	r->pkts = counters.tot_pkts, r->bytes = counters.tot_bytes;
+	num++;
+      }
+
+      if(bucket != NULL)
+	break; /* stats[] full: resume from here */
     }
+
+    if(chain == t->size)
+      chain = 0, pos = 0; /* done */
   }
 
-  if(unlikely(enable_debug))
-    printk("[PF_RING] %s() returned %d [3]\n", __FUNCTION__, rc);
+  read_unlock_bh(&pfr->ring_rules_lock);
 
-  return(rc);
+  bulk.cursor = ((u_int64_t)chain << 32) | pos;
+  bulk.num_rules = num;
+
+  if(debug_on())
+    printk("[PF_RING] %s() returned %u hash rules [cursor=%llu]\n", __FUNCTION__,
+	   num, (unsigned long long)bulk.cursor);
+
+  len = sizeof(bulk) + num * sizeof(struct pfring_hash_rule_stats);
+
+  if(copy_to_user(optval, &bulk, sizeof(bulk))
+     || copy_to_user(optval + sizeof(bulk), stats, num * sizeof(struct pfring_hash_rule_stats))) {
+    vfree(stats);
+    return -EFAULT;
+  }
+
+  vfree(stats);
+  return(len);
 }
 
 /* ************************************* */
@@ -2923,7 +5568,7 @@ static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filterin
   if(rule->rule.extended_fields.filter_plugin_id != NO_PLUGIN_ID) {
     if(rule->rule.extended_fields.filter_plugin_id >= MAX_PLUGIN_ID
        || plugin_registration[rule->rule.extended_fields.filter_plugin_id] == NULL) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Invalid filtering plugin [id=%d]\n",
 	       rule->rule.extended_fields.filter_plugin_id);
       return(-EFAULT);
@@ -2933,19 +5578,21 @@ static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filterin
   if(rule->rule.plugin_action.plugin_id != NO_PLUGIN_ID) {
     if(rule->rule.plugin_action.plugin_id >= MAX_PLUGIN_ID
        || plugin_registration[rule->rule.plugin_action.plugin_id] == NULL) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Invalid action plugin [id=%d]\n",
 	       rule->rule.plugin_action.plugin_id);
       return(-EFAULT);
     }
   }
 
+  rule->rule.internals.tot_reflected = rule->rule.internals.tot_reflect_failed = 0;
+
   if(rule->rule.reflector_device_name[0] != '\0') {
     if((pfr->ring_netdev->dev != NULL) &&
        rule->rule.rule_action != bounce_packet_and_stop_rule_evaluation &&
        rule->rule.rule_action != bounce_packet_and_continue_rule_evaluation &&
        (strcmp(rule->rule.reflector_device_name, pfr->ring_netdev->dev->name) == 0)) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] You cannot use as reflection device the same device on which this ring is bound\n");
       return(-EFAULT);
     }
@@ -2963,7 +5610,7 @@ static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filterin
   } else
     rule->rule.internals.reflector_dev = NULL;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] SO_ADD_FILTERING_RULE: About to add rule %d\n",
 	   rule->rule.rule_id);
 
@@ -3004,7 +5651,7 @@ static int add_sw_filtering_rule_element(struct pf_ring_socket *pfr, sw_filterin
   }
 
   list_add_tail(&rule->list, prev);
-  pfr->num_sw_filtering_rules++;
+  pfr->num_sw_filtering_rules++, pfr->sw_filtering_rules_gen++;
   rule->rule.internals.jiffies_last_match = jiffies; /* Avoid immediate rule purging */
 
   if(rule->rule.extended_fields.filter_plugin_id > 0) {
@@ -3036,9 +5683,9 @@ static int remove_sw_filtering_rule_element(struct pf_ring_socket *pfr, u_int16_
       free_filtering_rule(entry, 0);
       kfree(entry);
 
-      pfr->num_sw_filtering_rules--;
+      pfr->num_sw_filtering_rules--, pfr->sw_filtering_rules_gen++;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] SO_REMOVE_FILTERING_RULE: rule %d has been removed\n", rule_id);
       rule_found = 1;
       break;
@@ -3048,16 +5695,428 @@ static int remove_sw_filtering_rule_element(struct pf_ring_socket *pfr, u_int16_
   return(rule_found);
 }
 
+/* ************************************* */
+
+/*
+  Values of a wildcard_dim_* packet field that can match the rule
+  (swapped: bidirectional rule, other direction). 0 = none
+*/
+static int wildcard_rule_range(sw_filtering_rule_element *entry, int dim, u_int8_t swapped,
+			       u_int32_t *lo, u_int32_t *hi)
+{
+  filtering_rule_core_fields *f = &entry->rule.core_fields;
+  u_int16_t port_low, port_high;
+  u_int32_t host, mask;
+
+  if((dim == wildcard_dim_sip) || (dim == wildcard_dim_dip)) {
+    if((dim == wildcard_dim_sip) != swapped)
+      host = f->shost.v4, mask = f->shost_mask.v4;
+    else
+      host = f->dhost.v4, mask = f->dhost_mask.v4;
+
+    if((~mask & (~mask + 1)) != 0) {
+      *lo = 0, *hi = 0xFFFFFFFF; /* not a prefix: left to match_filtering_rule() */
+      return(1);
+    }
+
+    if(host & ~mask)
+      return(0); /* (ip & mask) cannot be host */
+
+    *lo = host, *hi = host | ~mask;
+  } else {
+    if((dim == wildcard_dim_sport) != swapped)
+      port_low = f->sport_low, port_high = f->sport_high;
+    else
+      port_low = f->dport_low, port_high = f->dport_high;
+
+    if(port_high == 0)
+      port_low = 0, port_high = 0xFFFF; /* any port */
+    else if(port_low > port_high)
+      return(0);
+
+    *lo = port_low, *hi = port_high;
+  }
+
+  return(1);
+}
+
+/* ************************************* */
+
+/* Last interval starting at or before value */
+static inline u_int32_t wildcard_dim_interval(struct wildcard_rules_dim *d, u_int32_t value)
+{
+  u_int32_t low = 0, high = d->num_intervals - 1;
+
+  while(low < high) {
+    u_int32_t mid = (low + high + 1) / 2;
+
+    if(d->start[mid] <= value)
+      low = mid;
+    else
+      high = mid - 1;
+  }
+
+  return(low);
+}
+
+/* ************************************* */
+
+static int cmp_u32(const void *a, const void *b)
+{
+  u_int32_t x = *(const u_int32_t*)a, y = *(const u_int32_t*)b;
+
+  return((x > y) - (x < y));
+}
+
+/* ************************************* */
+
+/* bounds: scratch, 4 * num_rules + 1 entries like the dimension */
+static void build_wildcard_dim(struct wildcard_rules_classifier *c, int dim, u_int32_t *bounds)
+{
+  struct wildcard_rules_dim *d = &c->dim[dim];
+  u_int32_t max = ((dim == wildcard_dim_sip) || (dim == wildcard_dim_dip)) ? 0xFFFFFFFF : 0xFFFF;
+  u_int32_t i, k, n = 0, lo, hi;
+  u_int8_t swapped;
+
+  bounds[n++] = 0;
+
+  for(i = 0; i < c->num_rules; i++) {
+    for(swapped = 0; swapped < (c->rules[i]->rule.bidirectional ? 2 : 1); swapped++) {
+      if(wildcard_rule_range(c->rules[i], dim, swapped, &lo, &hi)) {
+	bounds[n++] = lo;
+	if(hi < max) bounds[n++] = hi + 1;
+      }
+    }
+  }
+
+  sort(bounds, n, sizeof(u_int32_t), cmp_u32, NULL);
+
+  for(d->num_intervals = 0, i = 0; i < n; i++)
+    if((i == 0) || (bounds[i] != bounds[i-1]))
+      d->start[d->num_intervals++] = bounds[i];
+
+  memset(d->rules, 0, d->num_intervals * c->num_longs * sizeof(unsigned long));
+
+  for(i = 0; i < c->num_rules; i++) {
+    for(swapped = 0; swapped < (c->rules[i]->rule.bidirectional ? 2 : 1); swapped++) {
+      if(wildcard_rule_range(c->rules[i], dim, swapped, &lo, &hi)) {
+	for(k = wildcard_dim_interval(d, lo); (k < d->num_intervals) && (d->start[k] <= hi); k++)
+	  __set_bit(i, &d->rules[k * c->num_longs]);
+      }
+    }
+  }
+}
+
+/* ************************************* */
+
+/*
+  From process context after a wildcard rule change: built under the read
+  lock (only rule changes wait) and swapped under the write lock, which
+  check_wildcard_rules() holds as read lock while using it. Rules changed
+  from the packet path make it stale (gen): the list is walked until the
+  next rebuild.
+*/
+static void rebuild_wildcard_rules_classifier(struct pf_ring_socket *pfr)
+{
+  struct wildcard_rules_classifier *c = NULL, *old;
+  u_int32_t num_rules, num_longs, max_bounds, gen, i, len;
+  int dim, attempts = 3;
+  struct list_head *ptr;
+  char *mem;
+
+ build:
+  read_lock_bh(&pfr->ring_rules_lock);
+  gen = pfr->sw_filtering_rules_gen;
+  num_rules = pfr->num_sw_filtering_rules - pfr->num_sw_filtering_hash_rules;
+  read_unlock_bh(&pfr->ring_rules_lock);
+
+  if((num_rules >= WILDCARD_RULES_MIN_COMPILED) && (num_rules <= WILDCARD_RULES_MAX_COMPILED)) {
+    num_longs = BITS_TO_LONGS(num_rules), max_bounds = 4 * num_rules + 1;
+    len = sizeof(struct wildcard_rules_classifier) + num_rules * sizeof(sw_filtering_rule_element*)
+      + (256 + wildcard_num_dims * max_bounds) * num_longs * sizeof(unsigned long)
+      + (wildcard_num_dims + 1 /* bounds */) * max_bounds * sizeof(u_int32_t);
+
+    if((mem = vmalloc(len)) == NULL)
+      return; /* the current one is stale: rules are walked */
+
+    c = (struct wildcard_rules_classifier*)mem, mem += sizeof(struct wildcard_rules_classifier);
+    c->rules = (sw_filtering_rule_element**)mem, mem += num_rules * sizeof(sw_filtering_rule_element*);
+    c->proto = (unsigned long*)mem, mem += 256 * num_longs * sizeof(unsigned long);
+    for(dim = 0; dim < wildcard_num_dims; dim++)
+      c->dim[dim].rules = (unsigned long*)mem, mem += max_bounds * num_longs * sizeof(unsigned long);
+    for(dim = 0; dim < wildcard_num_dims; dim++)
+      c->dim[dim].start = (u_int32_t*)mem, mem += max_bounds * sizeof(u_int32_t);
+
+    c->gen = gen, c->num_rules = num_rules, c->num_longs = num_longs;
+    memset(c->proto, 0, 256 * num_longs * sizeof(unsigned long));
+
+    read_lock_bh(&pfr->ring_rules_lock);
+
+    i = 0;
+    if(pfr->sw_filtering_rules_gen == gen) {
+      list_for_each(ptr, &pfr->sw_filtering_rules) {
+	sw_filtering_rule_element *entry = list_entry(ptr, sw_filtering_rule_element, list);
+	u_int32_t proto;
+
+	if(i == num_rules) break;
+	c->rules[i] = entry;
+
+	for(proto = 0; proto < 256; proto++)
+	  if((entry->rule.core_fields.proto == 0) || (entry->rule.core_fields.proto == proto))
+	    __set_bit(i, &c->proto[proto * num_longs]);
+	i++;
+      }
+    }
+
+    if((pfr->sw_filtering_rules_gen != gen) || (i != num_rules)) {
+      read_unlock_bh(&pfr->ring_rules_lock);
+      vfree(c);
+      c = NULL;
+
+      if(--attempts > 0)
+	goto build;
+
+      return;
+    }
+
+    for(dim = 0; dim < wildcard_num_dims; dim++)
+      build_wildcard_dim(c, dim, (u_int32_t*)mem);
+
+    read_unlock_bh(&pfr->ring_rules_lock);
+  }
+
+  write_lock_bh(&pfr->ring_rules_lock);
+  if(pfr->sw_filtering_rules_gen == gen) {
+    old = pfr->sw_filtering_classifier;
+    pfr->sw_filtering_classifier = c;
+    c = old;
+  }
+  write_unlock_bh(&pfr->ring_rules_lock);
+
+  if(c != NULL)
+    vfree(c); /* replaced, or already stale */
+
+  if(debug_on())
+    printk("[PF_RING] %s() %u wildcard rules %s\n", __FUNCTION__, num_rules,
+	   pfr->sw_filtering_classifier ? "compiled" : "walked");
+}
+
+/* ************************************* */
+
+static void wildcard_rules_candidates(struct wildcard_rules_classifier *c,
+				      struct pfring_pkthdr *hdr,
+				      unsigned long *candidates)
+{
+  u_int32_t value[wildcard_num_dims], i;
+  int dim;
+
+  value[wildcard_dim_sip]   = hdr->extended_hdr.parsed_pkt.ip_src.v4;
+  value[wildcard_dim_dip]   = hdr->extended_hdr.parsed_pkt.ip_dst.v4;
+  value[wildcard_dim_sport] = hdr->extended_hdr.parsed_pkt.l4_src_port;
+  value[wildcard_dim_dport] = hdr->extended_hdr.parsed_pkt.l4_dst_port;
+
+  memcpy(candidates, &c->proto[hdr->extended_hdr.parsed_pkt.l3_proto * c->num_longs],
+	 c->num_longs * sizeof(unsigned long));
+
+  for(dim = 0; dim < wildcard_num_dims; dim++) {
+    unsigned long *rules;
+
+    if((hdr->extended_hdr.parsed_pkt.ip_version == 6)
+       && ((dim == wildcard_dim_sip) || (dim == wildcard_dim_dip)))
+      continue; /* IPv6 addresses: match_filtering_rule() */
+
+    rules = &c->dim[dim].rules[wildcard_dim_interval(&c->dim[dim], value[dim]) * c->num_longs];
+
+    for(i = 0; i < c->num_longs; i++)
+      candidates[i] &= rules[i];
+  }
+}
+
+/* ************************************* */
+
+/* Next rule to evaluate: candidates in rule order, or the whole list without classifier */
+static inline sw_filtering_rule_element* next_wildcard_rule(struct pf_ring_socket *pfr,
+							    struct wildcard_rules_classifier *c,
+							    unsigned long *candidates,
+							    u_int32_t *idx, struct list_head **ptr)
+{
+  if(c == NULL) {
+    *ptr = (*ptr)->next;
+    return((*ptr == &pfr->sw_filtering_rules) ? NULL : list_entry(*ptr, sw_filtering_rule_element, list));
+  }
+
+  *idx = find_next_bit(candidates, c->num_rules, *idx);
+  return((*idx < c->num_rules) ? c->rules[(*idx)++] : NULL);
+}
+
+/* ********************************** */
+
+/*
+  Reflected packets are queued per CPU and sent by a tasklet, i.e. at the
+  end of the current softirq run, so that a burst of packets costs one
+  pass instead of one dev_queue_xmit() each. When available, packets
+  going to the same device are handed to the driver directly with the
+  xmit_more hint so the doorbell is rung once per burst.
+*/
+
+#define MAX_REFLECT_QUEUE_LEN  2048 /* > netdev_budget */
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,18,0))
+#define REFLECT_XMIT_MORE
+#endif
+
+struct reflect_queue {
+  struct sk_buff_head skbs;
+  struct tasklet_struct tasklet;
+};
+
+static DEFINE_PER_CPU(struct reflect_queue, reflect_queues);
+static atomic_t reflect_xmit_failures = ATOMIC_INIT(0);
+
+/* ********************************** */
+
+static void reflect_queue_xmit(struct sk_buff_head *list)
+{
+  struct sk_buff *skb;
+
+  while((skb = __skb_dequeue(list)) != NULL) {
+    struct net_device *dev = skb->dev;
+    int ret;
+#ifdef REFLECT_XMIT_MORE
+    struct sk_buff *next = skb_peek(list);
+    struct netdev_queue *txq;
+    u_int16_t queue_id = smp_processor_id() % dev->real_num_tx_queues;
+
+    skb_set_queue_mapping(skb, queue_id);
+    txq = netdev_get_tx_queue(dev, queue_id);
+
+    HARD_TX_LOCK(dev, txq, smp_processor_id());
+    if(netif_xmit_frozen_or_drv_stopped(txq))
+      ret = NETDEV_TX_BUSY;
+    else
+      ret = netdev_start_xmit(skb, dev, txq, (next != NULL) && (next->dev == dev));
+    HARD_TX_UNLOCK(dev, txq);
+
+    if(ret == NETDEV_TX_BUSY)
+      kfree_skb(skb);
+#else
+    ret = dev_queue_xmit(skb);
+#endif
+
+    if(ret != NETDEV_TX_OK)
+      atomic_inc(&reflect_xmit_failures);
+
+    dev_put(dev); /* Taken by reflect_packet() */
+  }
+}
+
+/* ********************************** */
+
+static void reflect_queue_tasklet(unsigned long data)
+{
+  struct reflect_queue *q = (struct reflect_queue *)data;
+  struct sk_buff_head list;
+  unsigned long flags;
+
+  __skb_queue_head_init(&list);
+
+  spin_lock_irqsave(&q->skbs.lock, flags);
+  skb_queue_splice_init(&q->skbs, &list);
+  spin_unlock_irqrestore(&q->skbs.lock, flags);
+
+  reflect_queue_xmit(&list);
+}
+
+/* ********************************** */
+
+static void init_reflect_queues(void)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    struct reflect_queue *q = &per_cpu(reflect_queues, cpu);
+
+    skb_queue_head_init(&q->skbs);
+    tasklet_init(&q->tasklet, reflect_queue_tasklet, (unsigned long)q);
+  }
+}
+
+/* ********************************** */
+
+static void term_reflect_queues(void)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    struct reflect_queue *q = &per_cpu(reflect_queues, cpu);
+    struct sk_buff *skb;
+
+    tasklet_kill(&q->tasklet);
+
+    while((skb = skb_dequeue(&q->skbs)) != NULL) {
+      dev_put(skb->dev);
+      kfree_skb(skb);
+    }
+  }
+}
+
+/* ********************************** */
+
+/* SO_GET_(HASH_)FILTERING_RULE_STATS of rules without plugin */
+static int get_rule_reflect_stats(filtering_internals *internals, char *buffer)
+{
+  struct pfring_rule_reflect_stats *stats = (struct pfring_rule_reflect_stats *)buffer;
+
+  struct rule_cpu_stats counters;
+  int cpu;
+
+  get_rule_counters(internals, &counters);
+  stats->tot_reflected = counters.tot_reflected;
+  stats->tot_reflect_failed = counters.tot_reflect_failed;
+  stats->tot_rate_passed = stats->tot_rate_dropped = 0;
+
+  if(internals->rate_limit != NULL) {
+    for_each_possible_cpu(cpu) {
+      struct rule_rate_limit_cpu *b = per_cpu_ptr(internals->rate_limit, cpu);
+
+      stats->tot_rate_passed += b->tot_passed, stats->tot_rate_dropped += b->tot_dropped;
+    }
+  }
+
+  return(sizeof(*stats));
+}
+
+/* ********************************** */
+
+/* Returns 0 if the packet has been queued */
+static int reflect_queue_packet(struct sk_buff *skb)
+{
+  struct reflect_queue *q = &get_cpu_var(reflect_queues);
+  int rc = 0;
+
+  if(skb_queue_len(&q->skbs) >= MAX_REFLECT_QUEUE_LEN)
+    rc = -ENOBUFS;
+  else {
+    dev_hold(skb->dev); /* The rule can be removed meanwhile */
+    skb_queue_tail(&q->skbs, skb);
+    tasklet_schedule(&q->tasklet);
+  }
+
+  put_cpu_var(reflect_queues);
+  return(rc);
+}
+
 /* ********************************** */
 
 static int reflect_packet(struct sk_buff *skb,
 			  struct pf_ring_socket *pfr,
 			  struct net_device *reflector_dev,
+			  filtering_internals *rule_stats,
 			  int displ,
 			  rule_action_behaviour behaviour,
 			  u_int8_t do_clone_skb)
 {
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] reflect_packet called\n");
 
   if((reflector_dev != NULL)
@@ -3087,25 +6146,39 @@ static int reflect_packet(struct sk_buff *skb,
       memcpy(&cloned->data[6], dst_mac, 6);
     }
 
-    /*
-      NOTE
-      dev_queue_xmit() must be called with interrupts enabled
-      which means it can't be called with spinlocks held.
-    */
-    ret = dev_queue_xmit(cloned);
+    if(enable_reflect_batch) {
+      if(reflect_queue_packet(cloned) == 0)
+	ret = NETDEV_TX_OK;
+      else {
+	kfree_skb(cloned);
+	ret = NETDEV_TX_BUSY;
+      }
+    } else {
+      /*
+	NOTE
+	dev_queue_xmit() must be called with interrupts enabled
+	which means it can't be called with spinlocks held.
+      */
+      ret = dev_queue_xmit(cloned);
+    }
 
-    if(ret == NETDEV_TX_OK)
+    if(ret == NETDEV_TX_OK) {
       pfr->slots_info->tot_fwd_ok++;
-    else
+      if(rule_stats) rule_reflect_stats(rule_stats, 1);
+    } else {
       pfr->slots_info->tot_fwd_notok++;
+      if(rule_stats) rule_reflect_stats(rule_stats, 0);
+    }
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] dev_queue_xmit(%s) returned %d\n", reflector_dev->name, ret);
 
     /* yield(); */
     return(ret == NETDEV_TX_OK ? 0 : -ENETDOWN);
-  } else
+  } else {
     pfr->slots_info->tot_fwd_notok++;
+    if(rule_stats) rule_reflect_stats(rule_stats, 0);
+  }
 
   return(-ENETDOWN);
 }
@@ -3120,24 +6193,27 @@ int check_perfect_rules(struct sk_buff *skb,
 			struct parse_buffer *parse_memory_buffer[MAX_PLUGIN_ID],
 			int displ, u_int *last_matched_plugin)
 {
-  u_int hash_idx;
+  struct sw_filtering_hash_table *t = rcu_dereference(pfr->sw_filtering_hash);
   sw_filtering_hash_bucket *hash_bucket;
   u_int8_t hash_found = 0;
 
-  hash_idx = hash_pkt_header(hdr, 0, 0, 0, 0, 0) % DEFAULT_RING_HASH_SIZE;
-  hash_bucket = pfr->sw_filtering_hash[hash_idx];
+  /* Lockless: the caller is in an RCU read side (see ring_release()) */
+  hash_bucket = rcu_dereference(t->chain[hash_pkt_header(hdr, 0, 0, 0, 0, 0) & (t->size - 1)]);
 
   while(hash_bucket != NULL) {
     if(hash_bucket_match(hash_bucket, hdr, 0, 0)) {
       hash_found = 1;
       break;
     } else
-      hash_bucket = hash_bucket->next;
+      hash_bucket = rcu_dereference(hash_bucket->next[t->link]);
   } /* while */
 
   if(hash_found) {
     rule_action_behaviour behaviour = forward_packet_and_stop_rule_evaluation;
 
+    /* Racy across CPUs as the reflect counters: good enough for stats and idle purging */
+    rule_hit(&hash_bucket->rule.internals, hdr->len);
+
     if((hash_bucket->rule.plugin_action.plugin_id != NO_PLUGIN_ID)
        && (hash_bucket->rule.plugin_action.plugin_id < MAX_PLUGIN_ID)
        && (plugin_registration[hash_bucket->rule.plugin_action.plugin_id] != NULL)
@@ -3179,14 +6255,19 @@ int check_perfect_rules(struct sk_buff *skb,
     case reflect_packet_and_stop_rule_evaluation:
     case bounce_packet_and_stop_rule_evaluation:
       *fwd_pkt = 0;
-      reflect_packet(skb, pfr, hash_bucket->rule.internals.reflector_dev, displ, behaviour, 1);
+      reflect_packet(skb, pfr, hash_bucket->rule.internals.reflector_dev,
+		     &hash_bucket->rule.internals, displ, behaviour, 1);
       break;
     case reflect_packet_and_continue_rule_evaluation:
     case bounce_packet_and_continue_rule_evaluation:
       *fwd_pkt = 0;
-      reflect_packet(skb, pfr, hash_bucket->rule.internals.reflector_dev, displ, behaviour, 1);
+      reflect_packet(skb, pfr, hash_bucket->rule.internals.reflector_dev,
+		     &hash_bucket->rule.internals, displ, behaviour, 1);
       hash_found = 0;	/* This way we also evaluate the list of rules */
       break;
+    case rate_limit_packet_and_stop_rule_evaluation:
+      *fwd_pkt = rule_rate_limit_pass(&hash_bucket->rule.internals);
+      break;
     }
   } else {
     /* printk("[PF_RING] Packet not found\n"); */
@@ -3197,6 +6278,79 @@ int check_perfect_rules(struct sk_buff *skb,
 
 /* ********************************** */
 
+/* The rule matches on the flow cache key only, and forwards or drops */
+static inline int wildcard_rule_cacheable(sw_filtering_rule_element *entry)
+{
+  static const u_int8_t empty_mac[ETH_ALEN] = { 0 };
+
+  return(((entry->rule.rule_action == forward_packet_and_stop_rule_evaluation)
+	  || (entry->rule.rule_action == dont_forward_packet_and_stop_rule_evaluation))
+	 && (entry->rule.extended_fields.gtp.version == ignore_gtp_version)
+	 && (entry->rule.extended_fields.filter_plugin_id == 0)
+	 && (entry->rule.plugin_action.plugin_id == NO_PLUGIN_ID)
+#ifdef CONFIG_TEXTSEARCH
+	 && (entry->pattern[0] == NULL)
+#endif
+	 && (memcmp(entry->rule.core_fields.smac, empty_mac, ETH_ALEN) == 0)
+	 && (memcmp(entry->rule.core_fields.dmac, empty_mac, ETH_ALEN) == 0));
+}
+
+/* ********************************** */
+
+static inline int flow_cache_match(struct flow_cache_entry *e, struct pfring_pkthdr *hdr)
+{
+  return((e->sport == hdr->extended_hdr.parsed_pkt.l4_src_port)
+	 && (e->dport == hdr->extended_hdr.parsed_pkt.l4_dst_port)
+	 && (e->vlan_id == hdr->extended_hdr.parsed_pkt.vlan_id)
+	 && (e->proto == hdr->extended_hdr.parsed_pkt.l3_proto)
+	 && (memcmp(&e->src, &hdr->extended_hdr.parsed_pkt.ip_src, sizeof(ip_addr)) == 0)
+	 && (memcmp(&e->dst, &hdr->extended_hdr.parsed_pkt.ip_dst, sizeof(ip_addr)) == 0));
+}
+
+/* ********************************** */
+
+/* The cached verdict of the flow of hdr: flow_cache_empty when none */
+static inline u_int8_t flow_cache_lookup(struct pf_ring_socket *pfr, struct pfring_pkthdr *hdr,
+					 u_int32_t hash)
+{
+  struct flow_cache *fc = get_cpu_ptr(pfr->flow_cache);
+  struct flow_cache_entry *e = &fc->entry[hash & (FLOW_CACHE_SIZE - 1)];
+  u_int8_t verdict = flow_cache_empty;
+
+  if((e->verdict != flow_cache_empty) && (e->gen == pfr->sw_filtering_rules_gen)
+     && time_before(jiffies, e->expires) && flow_cache_match(e, hdr)) {
+    verdict = e->verdict;
+    if(verdict != flow_cache_no_match)
+      hdr->extended_hdr.parsed_pkt.last_matched_rule_id = e->rule_id;
+    fc->hits++;
+  } else
+    fc->misses++;
+
+  put_cpu_ptr(pfr->flow_cache);
+  return(verdict);
+}
+
+/* ********************************** */
+
+static inline void flow_cache_insert(struct pf_ring_socket *pfr, struct pfring_pkthdr *hdr,
+				     u_int32_t hash, u_int32_t gen, u_int8_t verdict)
+{
+  struct flow_cache *fc = get_cpu_ptr(pfr->flow_cache);
+  struct flow_cache_entry *e = &fc->entry[hash & (FLOW_CACHE_SIZE - 1)];
+
+  memcpy(&e->src, &hdr->extended_hdr.parsed_pkt.ip_src, sizeof(ip_addr));
+  memcpy(&e->dst, &hdr->extended_hdr.parsed_pkt.ip_dst, sizeof(ip_addr));
+  e->sport = hdr->extended_hdr.parsed_pkt.l4_src_port, e->dport = hdr->extended_hdr.parsed_pkt.l4_dst_port;
+  e->vlan_id = hdr->extended_hdr.parsed_pkt.vlan_id, e->proto = hdr->extended_hdr.parsed_pkt.l3_proto;
+  e->rule_id = hdr->extended_hdr.parsed_pkt.last_matched_rule_id;
+  e->gen = gen, e->expires = jiffies + pfr->flow_cache_lifetime;
+  e->verdict = verdict;
+
+  put_cpu_ptr(pfr->flow_cache);
+}
+
+/* ********************************** */
+
 int check_wildcard_rules(struct sk_buff *skb,
 			 struct pf_ring_socket *pfr,
 			 struct pfring_pkthdr *hdr,
@@ -3205,32 +6359,64 @@ int check_wildcard_rules(struct sk_buff *skb,
 			 struct parse_buffer *parse_memory_buffer[MAX_PLUGIN_ID],
 			 int displ, u_int *last_matched_plugin)
 {
+  unsigned long candidates[BITS_TO_LONGS(WILDCARD_RULES_MAX_COMPILED)];
+  struct wildcard_rules_classifier *c;
   struct list_head *ptr, *tmp_ptr;
+  sw_filtering_rule_element *entry;
+  u_int32_t next_idx = 0, hash = 0, gen;
+  u_int8_t cacheable = 0, verdict = flow_cache_no_match;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] Entered check_wildcard_rules()\n");
 
+  /* [0] Flow cache: no rule evaluation for the next packets of a flow */
+  if((pfr->flow_cache_lifetime > 0) && (pfr->flow_cache != NULL)) {
+    hash = hash_pkt_header(hdr, 0, 0, 0, 0, 0);
+
+    switch(flow_cache_lookup(pfr, hdr, hash)) {
+    case flow_cache_no_match:
+      return(0);
+    case flow_cache_forward:
+      *fwd_pkt = 1;
+      return(0);
+    case flow_cache_drop:
+      *fwd_pkt = 0;
+      return(0);
+    }
+
+    cacheable = 1;
+  }
+
   read_lock(&pfr->ring_rules_lock);
 
-  list_for_each_safe(ptr, tmp_ptr, &pfr->sw_filtering_rules) {
-    sw_filtering_rule_element *entry;
+  gen = pfr->sw_filtering_rules_gen;
+  c = pfr->sw_filtering_classifier;
+  if((c != NULL) && (c->gen == pfr->sw_filtering_rules_gen))
+    wildcard_rules_candidates(c, hdr, candidates);
+  else
+    c = NULL;
+
+  ptr = &pfr->sw_filtering_rules;
+
+  while((entry = next_wildcard_rule(pfr, c, candidates, &next_idx, &ptr)) != NULL) {
     rule_action_behaviour behaviour = forward_packet_and_stop_rule_evaluation;
 
-    entry = list_entry(ptr, sw_filtering_rule_element, list);
+    if(cacheable && !wildcard_rule_cacheable(entry))
+      cacheable = 0;
 
     if(match_filtering_rule(pfr, entry, hdr, skb, displ,
 			    parse_memory_buffer, free_parse_mem,
 			    last_matched_plugin, &behaviour)) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Packet MATCH\n");
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] behaviour=%d\n", behaviour);
 
       hdr->extended_hdr.parsed_pkt.last_matched_rule_id = entry->rule.rule_id;
 
       if(behaviour == forward_packet_and_stop_rule_evaluation) {
-	*fwd_pkt = 1;
+	*fwd_pkt = 1, verdict = flow_cache_forward;
 	break;
       } else if(behaviour == forward_packet_add_rule_and_stop_rule_evaluation) {
         sw_filtering_rule_element *rule_element = NULL;
@@ -3267,7 +6453,7 @@ int check_wildcard_rules(struct sk_buff *skb,
 	           entry, hdr, free_rule_element_id, &rule_element, &hash_bucket,
 	           *last_matched_plugin, &parse_memory_buffer[*last_matched_plugin]);
 
-	    if(unlikely(enable_debug))
+	    if(debug_on())
 	      printk("pfring_plugin_add_rule() returned %d\n", rc);
 
 	    if(rc == 0) {
@@ -3317,7 +6503,7 @@ int check_wildcard_rules(struct sk_buff *skb,
 	      kfree(hash_bucket);
 	      hash_bucket = NULL;
 	    } else {
-	      if(unlikely(enable_debug))
+	      if(debug_on())
 	        printk("[PF_RING] Added rule: [%d.%d.%d.%d:%d <-> %d.%d.%d.%d:%d][tot_rules=%d]\n",
 		       ((hash_bucket->rule.host4_peer_a >> 24) & 0xff), ((hash_bucket->rule.host4_peer_a >> 16) & 0xff),
 		       ((hash_bucket->rule.host4_peer_a >> 8) & 0xff), ((hash_bucket->rule.host4_peer_a >> 0) & 0xff),
@@ -3347,7 +6533,7 @@ int check_wildcard_rules(struct sk_buff *skb,
 	         entry, hdr, &rule_element_id, &hash_bucket,
 	         *last_matched_plugin, &parse_memory_buffer[*last_matched_plugin]);
 
-	  if(unlikely(enable_debug))
+	  if(debug_on())
 	    printk("pfring_plugin_del_rule() returned %d\n", rc);
 
           if(rc > 0) {
@@ -3373,7 +6559,10 @@ int check_wildcard_rules(struct sk_buff *skb,
 	}
 	break;
       } else if(behaviour == dont_forward_packet_and_stop_rule_evaluation) {
-	*fwd_pkt = 0;
+	*fwd_pkt = 0, verdict = flow_cache_drop;
+	break;
+      } else if(behaviour == rate_limit_packet_and_stop_rule_evaluation) {
+	*fwd_pkt = rule_rate_limit_pass(&entry->rule.internals);
 	break;
       }
 
@@ -3393,26 +6582,60 @@ int check_wildcard_rules(struct sk_buff *skb,
       } else if((entry->rule.rule_action == reflect_packet_and_stop_rule_evaluation)
 		|| (entry->rule.rule_action == bounce_packet_and_stop_rule_evaluation)) {
 	*fwd_pkt = 0;
-	reflect_packet(skb, pfr, entry->rule.internals.reflector_dev, displ, entry->rule.rule_action, 1);
+	reflect_packet(skb, pfr, entry->rule.internals.reflector_dev,
+		       &entry->rule.internals, displ, entry->rule.rule_action, 1);
 	break;
       } else if((entry->rule.rule_action == reflect_packet_and_continue_rule_evaluation)
 		|| (entry->rule.rule_action == bounce_packet_and_continue_rule_evaluation)) {
 	*fwd_pkt = 1;
-	reflect_packet(skb, pfr, entry->rule.internals.reflector_dev, displ, entry->rule.rule_action, 1);
+	reflect_packet(skb, pfr, entry->rule.internals.reflector_dev,
+		       &entry->rule.internals, displ, entry->rule.rule_action, 1);
       }
     } else {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Packet not matched\n");
     }
   }  /* for */
 
   read_unlock(&pfr->ring_rules_lock);
 
+  if(cacheable)
+    flow_cache_insert(pfr, hdr, hash, gen, verdict);
+
   return(0);
 }
 
 /* ********************************** */
 
+/*
+  Since 3.0 the kernel runs a filter through filter->bpf_func, native
+  code when the BPF JIT is built and enabled (net.core.bpf_jit_enable),
+  sk_run_filter() otherwise
+*/
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,0,0))
+#define PF_RING_BPF_JIT
+#endif
+
+static void compile_bpf_filter(struct sk_filter *filter)
+{
+#ifdef PF_RING_BPF_JIT
+  filter->bpf_func = sk_run_filter;
+  bpf_jit_compile(filter); /* no-op without CONFIG_BPF_JIT */
+#endif
+}
+
+/* ********************************** */
+
+static void free_bpf_filter(struct sk_filter *filter)
+{
+#ifdef PF_RING_BPF_JIT
+  bpf_jit_free(filter);
+#endif
+  kfree(filter);
+}
+
+/* ********************************** */
+
 /*
   This code has been partially copied from af_packet.c
 
@@ -3441,11 +6664,15 @@ int bpf_filter_skb(struct sk_buff *skb,
     }
 
     rcu_read_lock_bh();
+#ifdef PF_RING_BPF_JIT
+    res = SK_RUN_FILTER(pfr->bpfFilter, skb);
+#else
     res = sk_run_filter(skb, pfr->bpfFilter->insns
 #if(LINUX_VERSION_CODE < KERNEL_VERSION(2,6,38))
 			, pfr->bpfFilter->len
 #endif
 			);
+#endif
     rcu_read_unlock_bh();
 
     /* Restore */
@@ -3454,11 +6681,11 @@ int bpf_filter_skb(struct sk_buff *skb,
 
     if(res == 0) {
       /* Filter failed */
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] add_skb_to_ring(skb): Filter failed [len=%d][tot=%llu]"
-	       "[insert_off=%d][pkt_type=%d][cloned=%d]\n",
+	       "[insert_off=%llu][pkt_type=%d][cloned=%d]\n",
 	       (int)skb->len, pfr->slots_info->tot_pkts,
-	       pfr->slots_info->insert_off, skb->pkt_type,
+	       (unsigned long long)pfr->slots_info->insert_off, skb->pkt_type,
 	       skb->cloned);
 
       return(0);
@@ -3490,7 +6717,7 @@ static int add_skb_to_ring(struct sk_buff *skb,
 			   int is_ip_pkt, int displ,
 			   u_int8_t channel_id,
 			   u_int8_t num_rx_channels,
-			   int *clone_id)
+			   struct bounce_skb *bounce)
 {
   int fwd_pkt = 0, rc = 0;
   struct parse_buffer *parse_memory_buffer[MAX_PLUGIN_ID] = { NULL };
@@ -3505,7 +6732,7 @@ static int add_skb_to_ring(struct sk_buff *skb,
      that will then be freed when the packet has been handled
   */
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> add_skb_to_ring(len=%d) [channel_id=%d/%d][active=%d][%s]\n",
 	   hdr->len, channel_id, num_rx_channels,
 	   pfr->ring_active, pfr->ring_netdev->dev->name);
@@ -3516,17 +6743,23 @@ static int add_skb_to_ring(struct sk_buff *skb,
   pfr->num_rx_channels = num_rx_channels; /* Constantly updated */
   hdr->extended_hdr.parsed_pkt.last_matched_rule_id = (u_int16_t)-1;
 
-  atomic_set(&pfr->num_ring_users, 1);
+  /* [0] Overload: before spending any filtering work on the packet */
+  if(ring_overload_enabled(pfr) && ring_overloaded(pfr))
+    return(0);
+
+  /* [0.1] Source prefix blocklist */
+  if((pfr->prefix_blocklist != NULL) && prefix_blocklisted(pfr, hdr))
+    return(-1);
 
   /* [1] BPF Filtering */
   if(pfr->bpfFilter != NULL) {
     if(bpf_filter_skb(skb, pfr, displ) == 0) {
-      atomic_set(&pfr->num_ring_users, 0);
+      inc_ring_filtered_stats(pfr);
       return(-1);
     }
   }
 
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     printk("[PF_RING] add_skb_to_ring: [%s][displ=%d][len=%d][caplen=%d]"
 	   "[is_ip_pkt=%d][%d -> %d][%p/%p]\n",
 	   (skb->dev->name != NULL) ? skb->dev->name : "<NULL>",
@@ -3550,51 +6783,69 @@ static int add_skb_to_ring(struct sk_buff *skb,
     hash_found = check_perfect_rules(skb, pfr, hdr, &fwd_pkt, &free_parse_mem,
 				     parse_memory_buffer, displ, &last_matched_plugin);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] check_perfect_rules() returned %d\n", hash_found);
 
   /* [2.2] Search rules list */
-  if((!hash_found) && (pfr->num_sw_filtering_rules > 0)) {
+  if((!hash_found) && (pfr->num_sw_filtering_rules > pfr->num_sw_filtering_hash_rules)) {
     if(check_wildcard_rules(skb, pfr, hdr, &fwd_pkt, &free_parse_mem,
 			    parse_memory_buffer, displ, &last_matched_plugin) != 0)
       fwd_pkt = 0;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] check_wildcard_rules() completed: fwd_pkt=%d\n", fwd_pkt);
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] add_skb_to_ring() verdict: fwd_pkt=%d [default=%u]\n",
 	   fwd_pkt, pfr->sw_filtering_rules_default_accept_policy);
 
   if(fwd_pkt) {
     /* We accept the packet: it needs to be queued */
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] Forwarding packet to userland\n");
 
-    /* [3] Packet sampling */
+    /* [3] Flow sampling: all or none of the packets of a flow */
+    if((pfr->flow_sample_threshold != 0)
+       && !pfring_flow_sampled(cluster_hash(hdr, cluster_per_flow_crc32c), pfr->flow_sample_threshold)) {
+      struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, get_cpu());
+
+      s->tot_pkts++, s->tot_rate_sampled++;
+      put_cpu();
+
+      if(free_parse_mem)
+	free_parse_memory(parse_memory_buffer);
+
+      return(-1);
+    }
+
+    /* [3.1] Packet sampling */
     if(pfr->sample_rate > 1) {
+      struct ring_cpu_stats *s;
+
       write_lock(&pfr->ring_index_lock);
-      pfr->slots_info->tot_pkts++;
 
       if(pfr->pktToSample <= 1) {
 	pfr->pktToSample = pfr->sample_rate;
       } else {
 	pfr->pktToSample--;
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] add_skb_to_ring(skb): sampled packet [len=%d]"
-		 "[tot=%llu][insert_off=%d][pkt_type=%d][cloned=%d]\n",
+		 "[tot=%llu][insert_off=%llu][pkt_type=%d][cloned=%d]\n",
 		 (int)skb->len, pfr->slots_info->tot_pkts,
-		 pfr->slots_info->insert_off, skb->pkt_type,
+		 (unsigned long long)pfr->slots_info->insert_off, skb->pkt_type,
 		 skb->cloned);
 
 	write_unlock(&pfr->ring_index_lock);
 
+	s = per_cpu_ptr(pfr->cpu_stats, get_cpu());
+	s->tot_pkts++, s->tot_rate_sampled++;
+	put_cpu();
+
 	if(free_parse_mem)
 	  free_parse_memory(parse_memory_buffer);
 
-	atomic_set(&pfr->num_ring_users, 0);
 	return(-1);
       }
 
@@ -3612,7 +6863,7 @@ static int add_skb_to_ring(struct sk_buff *skb,
 
 	hdr->extended_hdr.parsed_pkt.last_matched_plugin_id = last_matched_plugin;
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] --> [last_matched_plugin = %d][extended_hdr.parsed_header_len=%d]\n",
 		 last_matched_plugin, hdr->extended_hdr.parsed_header_len);
 
@@ -3623,32 +6874,42 @@ static int add_skb_to_ring(struct sk_buff *skb,
       } else
 	offset = 0, hdr->extended_hdr.parsed_header_len = 0, mem = NULL;
 
-      rc = add_pkt_to_ring(skb, real_skb, pfr, hdr, displ, channel_id, offset, mem, clone_id);
+      rc = add_pkt_to_ring(skb, real_skb, pfr, hdr, displ, channel_id, offset, mem, bounce);
     }
-  }
+  } else
+    inc_ring_filtered_stats(pfr);
 
-  if(unlikely(enable_debug))
-    printk("[PF_RING] [pfr->slots_info->insert_off=%d]\n",
-	   pfr->slots_info->insert_off);
+  if(debug_on())
+    printk("[PF_RING] [pfr->slots_info->insert_off=%llu]\n",
+	   (unsigned long long)pfr->slots_info->insert_off);
 
   if(free_parse_mem)
     free_parse_memory(parse_memory_buffer);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] add_skb_to_ring() returned %d\n", rc);
 
-  atomic_set(&pfr->num_ring_users, 0);
   return(rc);
 }
 
 /* ********************************** */
 
 static u_int hash_pkt_cluster(ring_cluster_element * cluster_ptr,
-			      struct pfring_pkthdr *hdr)
+			      struct pfring_pkthdr *hdr,
+			      struct net_device *dev, u_int32_t channel_id)
 {
   u_int idx;
 
   switch(cluster_ptr->cluster.hashing_mode) {
+    case cluster_per_queue:
+      /* RSS already spread the flows: keep the packets on the core of their queue */
+      if(get_num_rx_queues(dev) > 1) {
+	idx = channel_id;
+	break;
+      }
+
+      idx = hash_pkt_header(hdr, 0, 0, 0, 0, 0);
+      break;
     case cluster_round_robin:
       idx = cluster_ptr->cluster.hashing_id++;
       break;
@@ -3661,6 +6922,10 @@ static u_int hash_pkt_cluster(ring_cluster_element * cluster_ptr,
     case cluster_per_flow_5_tuple:
       idx = hash_pkt_header(hdr, 0, 0, 0, 0, 1);
       break;
+    case cluster_per_flow_toeplitz:
+    case cluster_per_flow_crc32c:
+      /* Always < CLUSTER_LEN: a stale entry just finds an empty sk[] */
+      return(cluster_ptr->cluster.indirection[CLUSTER_BUCKET(cluster_hash(hdr, cluster_ptr->cluster.hashing_mode))]);
     case cluster_per_flow:
     default:
       idx = hash_pkt_header(hdr, 0, 0, 0, 0, 0);
@@ -3677,7 +6942,7 @@ static int register_plugin(struct pfring_plugin_registration *reg)
   if(reg == NULL)
     return(-1);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> register_plugin(%d)\n", reg->plugin_id);
 
   if((reg->plugin_id >= MAX_PLUGIN_ID) || (reg->plugin_id == 0))
@@ -3789,6 +7054,24 @@ inline int is_valid_skb_direction(packet_direction direction, u_char recv_packet
 
 /* ********************************** */
 
+/* Precomputed from the direction and the socket mode: what skb_ring_handler() checks first */
+static void ring_update_accept(struct pf_ring_socket *pfr) {
+  u_int8_t accept = 0;
+
+  if(pfr->mode != send_only_mode) {
+    if(is_valid_skb_direction(pfr->direction, 1 /* RX */)) accept |= RING_ACCEPT_RX;
+    if(is_valid_skb_direction(pfr->direction, 0 /* TX */)) accept |= RING_ACCEPT_TX;
+  }
+
+  pfr->accept = accept;
+}
+
+static inline int ring_accepts(struct pf_ring_socket *pfr, u_int8_t recv_packet) {
+  return(pfr->accept & (1 << (recv_packet ? 1 : 0)));
+}
+
+/* ********************************** */
+
 static struct sk_buff* defrag_skb(struct sk_buff *skb,
 				  u_int16_t displ,
 				  struct pfring_pkthdr *hdr,
@@ -3803,7 +7086,7 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
   iphdr = ip_hdr(skb);
 
   if(iphdr && (iphdr->version == 4)) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] [version=%d] %X -> %X\n",
 	     iphdr->version, iphdr->saddr, iphdr->daddr);
 
@@ -3821,7 +7104,7 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
 	skb_reset_transport_header(cloned);
         iphdr = ip_hdr(cloned);
 
-	if(unlikely(enable_debug)) {
+	if(debug_on()) {
 	  int ihl, end;
 	  int offset = ntohs(iphdr->frag_off);
 	  offset &= IP_OFFSET;
@@ -3839,7 +7122,7 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
 	skk = ring_gather_frags(cloned);
 
 	if(skk != NULL) {
-	  if(unlikely(enable_debug)) {
+	  if(debug_on()) {
 	    unsigned char *c;
 	    printk("[PF_RING] IP reasm on new skb [skb_len=%d]"
 		   "[head_len=%d][nr_frags=%d][frag_list=%p]\n",
@@ -3874,7 +7157,7 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
 	}
       }
     } else {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Do not seems to be a fragmented ip_pkt[iphdr=%p]\n",
 	       iphdr);
     }
@@ -3882,7 +7165,7 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
     /* Re-assembling fragmented IPv6 packets has not been
        implemented. Probability of observing fragmented IPv6
        packets is extremely low. */
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] Re-assembling fragmented IPv6 packet hs not been implemented\n");
   }
 
@@ -3891,6 +7174,100 @@ static struct sk_buff* defrag_skb(struct sk_buff *skb,
 
 /* ********************************** */
 
+/*
+  Gives the packet to the cluster member selected by its hash or, in
+  round-robin mode, to the next member with a free slot.
+  Returns 1 when a member has been found.
+*/
+static int add_skb_to_cluster(ring_cluster_element *cluster_ptr,
+			      struct sk_buff *skb,
+			      u_int8_t real_skb, u_int8_t recv_packet,
+			      struct pfring_pkthdr *hdr,
+			      int is_ip_pkt, int displ,
+			      u_int32_t channel_id,
+			      u_int32_t num_rx_channels,
+			      struct bounce_skb *bounce, int *room_available)
+{
+  struct sock *skElement;
+  struct pf_ring_socket *pfr;
+  u_int skb_hash;
+  u_short num_iterations;
+
+  if(cluster_ptr->cluster.num_cluster_elements == 0)
+    return(0);
+
+  skb_hash = hash_pkt_cluster(cluster_ptr, hdr, skb->dev, channel_id);
+
+  /*
+    We try to add the packet to the right cluster
+    element, but if we're working in round-robin and this
+    element is full, we try to add this to the next available
+    element. If none with at least a free slot can be found
+    then we give up :-(
+  */
+
+  for(num_iterations = 0;
+      num_iterations < cluster_ptr->cluster.num_cluster_elements;
+      num_iterations++) {
+
+    skElement = cluster_ptr->cluster.sk[skb_hash];
+
+    if(skElement != NULL) {
+      pfr = ring_sk(skElement);
+
+      if((pfr != NULL)
+	 && ring_accepts(pfr, recv_packet)
+	 && (pfr->ring_slots != NULL)
+	 && (test_bit(skb->dev->ifindex, pfr->netdev_mask)
+	     || ((skb->dev->flags & IFF_SLAVE)
+		 && (pfr->ring_netdev->dev == skb->dev->master)))
+	 ) {
+	if((pfr->num_sub_rings > 1) /* copy_data_to_ring() checks the CPU sub-ring */
+	   || check_and_init_free_slot(pfr, pfr->slots_info->insert_off) /* Not full */) {
+	  /* We've found the ring where the packet can be stored */
+	  *room_available |= add_skb_to_ring(skb, real_skb, pfr, hdr, is_ip_pkt,
+					     displ, channel_id, num_rx_channels, bounce);
+	  return(1); /* Ring found: we've done our job */
+	} else if((cluster_ptr->cluster.hashing_mode != cluster_round_robin)
+		  /* We're the last element of the cluster so no further cluster element to check */
+		  || ((num_iterations + 1) > cluster_ptr->cluster.num_cluster_elements)) {
+	  inc_ring_stats(pfr, 1);
+	}
+      }
+    }
+
+    if(cluster_ptr->cluster.hashing_mode != cluster_round_robin)
+      break;
+    else
+      skb_hash = (skb_hash + 1) % cluster_ptr->cluster.num_cluster_elements;
+  }
+
+  return(0);
+}
+
+/* ********************************** */
+
+/*
+  The dispatch table of the device, NULL when the packet handler has to
+  walk ring_table and ring_cluster_list (see rebuild_dispatch_tables())
+*/
+static inline ring_dispatch_table* get_dispatch_table(struct net_device *dev)
+{
+  ring_dispatch_table *table = NULL;
+
+  if((!dispatch_tables_ok) || (dev->flags & IFF_SLAVE) /* Rings bound to the master */)
+    return(NULL);
+
+  smp_rmb(); /* dispatch_tables_ok before the tables */
+
+  if(dev->ifindex < MAX_NUM_IFIDX)
+    table = rcu_dereference(dispatch_tables[dev->ifindex]);
+
+  return((table != NULL) ? table : rcu_dereference(any_dispatch_table));
+}
+
+/* ********************************** */
+
 /*
   PF_RING main entry point
 
@@ -3910,8 +7287,8 @@ static int skb_ring_handler(struct sk_buff *skb,
 			    u_int32_t channel_id,
 			    u_int32_t num_rx_channels)
 {
-  struct sock *skElement;
-  int rc = 0, is_ip_pkt = 0, room_available = 0, clone_id = 0;
+  int rc = 0, is_ip_pkt = 0, room_available = 0;
+  struct bounce_skb bounce = { 0, NULL };
   struct pfring_pkthdr hdr;
   int displ;
   int defragmented_skb = 0;
@@ -3921,6 +7298,7 @@ static int skb_ring_handler(struct sk_buff *skb,
   struct sock *sk;
   struct pf_ring_socket *pfr;
   ring_cluster_element *cluster_ptr;
+  ring_dispatch_table *table;
 
   *skb_reference_in_use = 0;
 
@@ -3928,7 +7306,7 @@ static int skb_ring_handler(struct sk_buff *skb,
      could receive the packet: if none just stop here */
 
   if(ring_table_size == 0) {
-    /* if(unlikely(enable_debug)) printk("[PF_RING] (0) skb_ring_handler returned %d\n", rc); */
+    /* if(debug_on()) printk("[PF_RING] (0) skb_ring_handler returned %d\n", rc); */
     return(rc);
   }
 
@@ -3944,7 +7322,7 @@ static int skb_ring_handler(struct sk_buff *skb,
     displ = 0;
 
 #if 0
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     if(skb->dev && (skb->dev->ifindex < MAX_NUM_IFIDX))
       printk("[PF_RING] (1) skb_ring_handler(): [%d rings on %s (idx=%d), %d 'any' rings]\n",
 	     num_rings_per_device[skb->dev->ifindex], skb->dev->name, skb->dev->ifindex, num_any_rings);
@@ -3955,7 +7333,7 @@ static int skb_ring_handler(struct sk_buff *skb,
      && (skb->dev
 	 && (skb->dev->ifindex < MAX_NUM_IFIDX)
 	 && (num_rings_per_device[skb->dev->ifindex] == 0))) {
-    /* if(unlikely(enable_debug)) printk("[PF_RING] (1) skb_ring_handler returned %d\n", rc); */
+    /* if(debug_on()) printk("[PF_RING] (1) skb_ring_handler returned %d\n", rc); */
     return(rc);
   }
 
@@ -3968,9 +7346,9 @@ static int skb_ring_handler(struct sk_buff *skb,
     channel_id = skb_get_rx_queue(skb);
 #endif
 
-  if(channel_id > MAX_NUM_RX_CHANNELS) channel_id = 0 /* MAX_NUM_RX_CHANNELS */;
+  if(channel_id >= MAX_NUM_RX_CHANNELS) channel_id = 0 /* MAX_NUM_RX_CHANNELS */;
 
-  if((!skb) /* Invalid skb */ ||((!enable_tx_capture) && (!recv_packet))) {
+  if((!skb) /* Invalid skb */ ||((!tx_capture_on()) && (!recv_packet))) {
     /*
       An outgoing packet is about to be sent out
       but we decided not to handle transmitted
@@ -3978,11 +7356,11 @@ static int skb_ring_handler(struct sk_buff *skb,
     */
     rc = 0;
 
-    if(unlikely(enable_debug)) printk("[PF_RING] (2) skb_ring_handler returned %d\n", rc);
+    if(debug_on()) printk("[PF_RING] (2) skb_ring_handler returned %d\n", rc);
     return(0);
   }
 
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     struct timeval tv;
 
     skb_get_timestamp(skb, &tv);
@@ -4008,28 +7386,53 @@ static int skb_ring_handler(struct sk_buff *skb,
 			     + skb->dev->hard_header_len /* 14 */
 			     + 4 /* VLAN header */);
 
-  if(quick_mode) {
+  /* ring_release() waits for a grace period before freeing a socket */
+  rcu_read_lock();
+
+  if(quick_mode_on()) {
     pfr = device_rings[skb->dev->ifindex][channel_id];
 
     hdr.extended_hdr.parsed_header_len = 0;
 
-    if(pfr && pfr->rehash_rss && skb->dev) {
+    if(pfr && !ring_accepts(pfr, recv_packet))
+      pfr = NULL; /* Not even parsed */
+
+    if(pfr && ring_overload_enabled(pfr) && ring_overloaded(pfr))
+      rc = 1, pfr = NULL; /* Accounted: not even parsed */
+
+    if(pfr && skb->dev && (pfr->rehash_rss || (pfr->header_len == compact_pkt_header)
+			   || (pfr->prefix_blocklist != NULL))) {
       parse_pkt(skb, real_skb, displ, &hdr);
+      hdr.extended_hdr.rx_direction = recv_packet;
+
+      if(pfr->rehash_rss)
+	channel_id = hash_pkt_header(&hdr, 0, 0, 0, 0, 0) % get_num_rx_queues(skb->dev);
 
-      channel_id = hash_pkt_header(&hdr, 0, 0, 0, 0, 0) % get_num_rx_queues(skb->dev);
+      if((pfr->prefix_blocklist != NULL) && prefix_blocklisted(pfr, &hdr))
+	rc = 1, pfr = NULL; /* Accounted */
     }
 
-    if(unlikely(enable_debug)) printk("[PF_RING] Expecting channel %d [%p]\n", channel_id, pfr);
+    if(debug_on()) printk("[PF_RING] Expecting channel %d [%p]\n", channel_id, pfr);
 
-    if((pfr != NULL) && is_valid_skb_direction(pfr->direction, recv_packet)) {
+    if(pfr != NULL) {
       /* printk("==>>> [%d][%d]\n", skb->dev->ifindex, channel_id); */
 
       rc = 1, hdr.caplen = min_val(hdr.caplen, pfr->bucket_len);
-      room_available |= copy_data_to_ring(real_skb ? skb : NULL, pfr, &hdr, 
-					  displ, 0, NULL, NULL, 0, real_skb ? &clone_id : NULL);
+      room_available |= copy_skb_to_ring(skb, real_skb, pfr, &hdr,
+					 displ, 0, NULL, real_skb ? &bounce : NULL);
     }
   } else {
-    is_ip_pkt = parse_pkt(skb, real_skb, displ, &hdr);
+    /* Sockets with short headers only (e.g. pcap recording): the packet is not parsed */
+    table = get_dispatch_table(skb->dev);
+
+    /* Nobody on this channel consumes this direction: not parsed, not timestamped */
+    if((table != NULL) && !(table->channel_accept[channel_id] & (1 << (recv_packet ? 1 : 0)))) {
+      rcu_read_unlock();
+      return(0);
+    }
+
+    if((table == NULL) || table->parse_needed || enable_ip_defrag)
+      is_ip_pkt = parse_pkt(skb, real_skb, displ, &hdr);
 
     if(enable_ip_defrag) {
       if(real_skb
@@ -4038,8 +7441,9 @@ static int skb_ring_handler(struct sk_buff *skb,
 	skb = skk = defrag_skb(skb, displ, &hdr, &defragmented_skb);
 
 	if(skb == NULL) {
+	  rcu_read_unlock();
 	  rc = 0;
-	  if(unlikely(enable_debug)) printk("[PF_RING] (3) skb_ring_handler returned %d\n", rc);
+	  if(debug_on()) printk("[PF_RING] (3) skb_ring_handler returned %d\n", rc);
 	  return(0);
 	}
       }
@@ -4054,101 +7458,77 @@ static int skb_ring_handler(struct sk_buff *skb,
     hdr.extended_hdr.tx.reserved = NULL;
     hdr.extended_hdr.rx_direction = recv_packet;
 
-    /* [1] Check unclustered sockets */
-    sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
-
-    if(unlikely(enable_debug))
-      printk("[PF_RING] -> lockless_list_get_first=%p [num elements=%u][last_list_idx=%u]\n",
-	     sk, ring_table.num_elements, (unsigned int)last_list_idx);
-
-    while(sk != NULL) {
-      pfr = ring_sk(sk);
-
-      if((pfr != NULL)
-	 && (
-	     test_bit(skb->dev->ifindex, pfr->netdev_mask)
-	     || (pfr->ring_netdev == &any_device_element) /* Socket bound to 'any' */
-	     || ((skb->dev->flags & IFF_SLAVE) && (pfr->ring_netdev->dev == skb->dev->master)))
-	 && (pfr->ring_netdev != &none_device_element) /* Not a dummy socket bound to "none" */
-	 && (pfr->cluster_id == 0 /* No cluster */ )
-	 && (pfr->ring_slots != NULL)
-	 && is_valid_skb_direction(pfr->direction, recv_packet)
-	 ) {
-	/* We've found the ring where the packet can be stored */
-	int old_caplen = hdr.caplen;  /* Keep old lenght */
+    if(table != NULL) {
+      u_int16_t i;
 
-	hdr.caplen = min_val(hdr.caplen, pfr->bucket_len);
-	room_available |= add_skb_to_ring(skb, real_skb, pfr, &hdr, is_ip_pkt,
-					  displ, channel_id, num_rx_channels, &clone_id);
-	hdr.caplen = old_caplen;
-	rc = 1;	/* Ring found: we've done our job */
+      /*
+	The time once, for the finest mode of the device: the rings only
+	take it when there is no table (ring walk, quick_mode), the first
+	ring to store the packet setting it for the others.
+      */
+      if(real_skb && (table->tstamp_mode != PFRING_TSTAMP_NONE))
+	set_skb_time(skb, &hdr, table->tstamp_mode);
+
+      /* [1] Unclustered sockets of this channel */
+      for(i = table->channel_rings[channel_id]; i < table->channel_rings[channel_id + 1]; i++) {
+	pfr = table->rings[i];
+
+	if(ring_accepts(pfr, recv_packet)
+	   && (pfr->ring_slots != NULL)) {
+	  int old_caplen = hdr.caplen;  /* Keep old lenght */
+
+	  hdr.caplen = min_val(hdr.caplen, pfr->bucket_len);
+	  room_available |= add_skb_to_ring(skb, real_skb, pfr, &hdr, is_ip_pkt,
+					    displ, channel_id, num_rx_channels, &bounce);
+	  hdr.caplen = old_caplen;
+	  rc = 1;	/* Ring found: we've done our job */
+	}
       }
 
-      sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+      /* [2] Socket clusters with a member bound to the device */
+      for(i = 0; i < table->num_clusters; i++)
+	rc |= add_skb_to_cluster(table->clusters[i], skb, real_skb, recv_packet, &hdr, is_ip_pkt,
+				 displ, channel_id, num_rx_channels, &bounce, &room_available);
+    } else {
+      /* [1] Check unclustered sockets */
+      sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
 
-      if(unlikely(enable_debug))
-	printk("[PF_RING] -> lockless_list_get_next=%p [num elements=%u][last_list_idx=%u]\n",
-	       sk, ring_table.num_elements, (unsigned int)last_list_idx);
-    }
+      while(sk != NULL) {
+	pfr = ring_sk(sk);
 
-    cluster_ptr = (ring_cluster_element*)lockless_list_get_first(&ring_cluster_list, &last_list_idx);
+	if((pfr != NULL)
+	   && ring_accepts(pfr, recv_packet)
+	   && (
+	       test_bit(skb->dev->ifindex, pfr->netdev_mask)
+	       || (pfr->ring_netdev == &any_device_element) /* Socket bound to 'any' */
+	       || ((skb->dev->flags & IFF_SLAVE) && (pfr->ring_netdev->dev == skb->dev->master)))
+	   && (pfr->ring_netdev != &none_device_element) /* Not a dummy socket bound to "none" */
+	   && (pfr->cluster_id == 0 /* No cluster */ )
+	   && (pfr->ring_slots != NULL)
+	   ) {
+	  /* We've found the ring where the packet can be stored */
+	  int old_caplen = hdr.caplen;  /* Keep old lenght */
+
+	  hdr.caplen = min_val(hdr.caplen, pfr->bucket_len);
+	  room_available |= add_skb_to_ring(skb, real_skb, pfr, &hdr, is_ip_pkt,
+					    displ, channel_id, num_rx_channels, &bounce);
+	  hdr.caplen = old_caplen;
+	  rc = 1;	/* Ring found: we've done our job */
+	}
 
-    /* [2] Check socket clusters */
-    while(cluster_ptr != NULL) {
-      struct pf_ring_socket *pfr;
+	sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+      }
 
-      if(cluster_ptr->cluster.num_cluster_elements > 0) {
-	u_int skb_hash = hash_pkt_cluster(cluster_ptr, &hdr);
-	u_short num_iterations;
-
-	/*
-	  We try to add the packet to the right cluster
-	  element, but if we're working in round-robin and this
-	  element is full, we try to add this to the next available
-	  element. If none with at least a free slot can be found
-	  then we give up :-(
-	*/
-
-	for(num_iterations = 0;
-	    num_iterations < cluster_ptr->cluster.num_cluster_elements;
-	    num_iterations++) {
-
-	  skElement = cluster_ptr->cluster.sk[skb_hash];
-
-	  if(skElement != NULL) {
-	    pfr = ring_sk(skElement);
-
-	    if((pfr != NULL)
-	       && (pfr->ring_slots != NULL)
-	       && (test_bit(skb->dev->ifindex, pfr->netdev_mask)
-		   || ((skb->dev->flags & IFF_SLAVE)
-		       && (pfr->ring_netdev->dev == skb->dev->master)))
-	       && is_valid_skb_direction(pfr->direction, recv_packet)
-	       ) {
-	      if(check_and_init_free_slot(pfr, pfr->slots_info->insert_off) /* Not full */) {
-		/* We've found the ring where the packet can be stored */
-		room_available |= add_skb_to_ring(skb, real_skb, pfr, &hdr, is_ip_pkt,
-						  displ, channel_id, num_rx_channels, &clone_id);
-		rc = 1; /* Ring found: we've done our job */
-		break;
-
-	      } else if((cluster_ptr->cluster.hashing_mode != cluster_round_robin)
-			/* We're the last element of the cluster so no further cluster element to check */
-			|| ((num_iterations + 1) > cluster_ptr->cluster.num_cluster_elements)) {
-		pfr->slots_info->tot_pkts++, pfr->slots_info->tot_lost++;
-	      }
-	    }
-	  }
+      /* [2] Check socket clusters */
+      cluster_ptr = (ring_cluster_element*)lockless_list_get_first(&ring_cluster_list, &last_list_idx);
 
-	  if(cluster_ptr->cluster.hashing_mode != cluster_round_robin)
-	    break;
-	  else
-	    skb_hash = (skb_hash + 1) % cluster_ptr->cluster.num_cluster_elements;
-	}
-      }
+      while(cluster_ptr != NULL) {
+	rc |= add_skb_to_cluster(cluster_ptr, skb, real_skb, recv_packet, &hdr, is_ip_pkt,
+				 displ, channel_id, num_rx_channels, &bounce, &room_available);
 
-      cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
-    } /* Clustering */
+	cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
+      } /* Clustering */
+    }
 
 #ifdef PROFILING
     rdt1 = _rdtsc() - rdt1;
@@ -4160,8 +7540,13 @@ static int skb_ring_handler(struct sk_buff *skb,
       kfree_skb(skk);
   }
 
-  if(clone_id > 0)
+  rcu_read_unlock();
+
+  if(bounce.num_slots > 0) {
     *skb_reference_in_use = 1;
+    if(bounce.skb != NULL)
+      kfree_skb(bounce.skb); /* Our hold, see copy_data_to_ring() */
+  }
 
   if(rc == 1 /* Ring found */) {
     if(transparent_mode != driver2pf_ring_non_transparent /* 2 */) {
@@ -4169,16 +7554,16 @@ static int skb_ring_handler(struct sk_buff *skb,
       /* CHECK: I commented the line below as I have no idea why it has been put there */
       /* rc = 0; */
 #if 0
-      printk("[PF_RING] %s() [clone_id=%d][recv_packet=%d][real_skb=%d]\n", 
-	     __FUNCTION__, clone_id, recv_packet, real_skb);
+      printk("[PF_RING] %s() [num_slots=%d][recv_packet=%d][real_skb=%d]\n", 
+	     __FUNCTION__, bounce.num_slots, recv_packet, real_skb);
 #endif
     } else {
       /* transparent mode = 2 */
       if(recv_packet && real_skb) {
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] kfree_skb()\n");
 
-	if(clone_id == 0) /* We have not used the orig_skb */
+	if(bounce.num_slots == 0) /* We have not used the orig_skb */
 	  kfree_skb(orig_skb); /* Free memory */
       }
     }
@@ -4188,7 +7573,7 @@ static int skb_ring_handler(struct sk_buff *skb,
   rdt2 = _rdtsc() - rdt2;
   rdt = _rdtsc() - rdt;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] # cycles: %d [lock costed %d %d%%][free costed %d %d%%]\n",
 	   (int)rdt, rdt - rdt1,
 	   (int)((float)((rdt - rdt1) * 100) / (float)rdt), rdt2,
@@ -4198,7 +7583,7 @@ static int skb_ring_handler(struct sk_buff *skb,
   if((rc == 1) && (room_available == 0))
     rc = 2;
 
-  if(unlikely(enable_debug)) printk("[PF_RING] (4) skb_ring_handler returned %d\n", rc);
+  if(debug_on()) printk("[PF_RING] (4) skb_ring_handler returned %d\n", rc);
 
   return(rc); /*  0 = packet not handled */
 }
@@ -4211,7 +7596,7 @@ static int buffer_ring_handler(struct net_device *dev, char *data, int len)
 {
   u_int8_t skb_reference_in_use;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] buffer_ring_handler: [dev=%s][len=%d]\n",
 	   dev->name == NULL ? "<NULL>" : dev->name, len);
 
@@ -4234,6 +7619,51 @@ static int buffer_ring_handler(struct net_device *dev, char *data, int len)
 
 /* ********************************** */
 
+/*
+  transparent_mode=2 entry point of the aware drivers: the packet is read
+  straight from the driver RX buffer, which the driver gives back to the
+  NIC afterwards, so that no sk_buff is allocated and freed per packet.
+  The fake skb is per CPU as the NAPI polls of the queues run in parallel.
+*/
+static DEFINE_PER_CPU(struct sk_buff, ring_rx_fake_skb);
+
+static int buffer_rx_ring_handler(struct net_device *dev, char *data, int len,
+				  u_int32_t channel_id, u_int32_t num_rx_channels,
+				  u_int32_t rxhash)
+{
+  struct sk_buff *fake_skb = &get_cpu_var(ring_rx_fake_skb);
+  u_int8_t skb_reference_in_use;
+  int rc;
+
+  fake_skb->dev = dev, fake_skb->len = len, fake_skb->data = data, fake_skb->data_len = len;
+
+#if(LINUX_VERSION_CODE < KERNEL_VERSION(2,6,14))
+  fake_skb->stamp.tv_sec = 0;
+#elif(LINUX_VERSION_CODE < KERNEL_VERSION(2,6,22))
+  fake_skb->tstamp.off_sec = 0;
+#else
+  fake_skb->tstamp = ktime_get_real(); /* The same for all the rings */
+#endif
+
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,30))
+  skb_record_rx_queue(fake_skb, channel_id); /* see set_device_busy() */
+#endif
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0))
+  fake_skb->hash = rxhash;
+#elif(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,35))
+  fake_skb->rxhash = rxhash;
+#endif
+
+  rc = skb_ring_handler(fake_skb, 1, 0 /* fake skb */,
+			&skb_reference_in_use,
+			channel_id, num_rx_channels);
+
+  put_cpu_var(ring_rx_fake_skb);
+  return(rc);
+}
+
+/* ********************************** */
+
 static int packet_rcv(struct sk_buff *skb, struct net_device *dev,
 		      struct packet_type *pt
 #if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,16))
@@ -4297,7 +7727,7 @@ static int ring_create(
   struct pf_ring_socket *pfr;
   int err = -ENOMEM;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_create()\n");
 
   /* Are you root, superuser or so ? */
@@ -4337,19 +7767,40 @@ static int ring_create(
     goto free_sk;
 
   memset(pfr, 0, sizeof(*pfr));
+
+  if((pfr->cpu_stats = alloc_percpu(struct ring_cpu_stats)) == NULL)
+    goto free_pfr;
+
   pfr->ring_shutdown = 0;
   pfr->ring_active = 0;	/* We activate as soon as somebody waits for packets */
   pfr->num_rx_channels = UNKNOWN_NUM_RX_CHANNELS;
   pfr->channel_id = RING_ANY_CHANNEL;
+  ring_update_accept(pfr); /* rx_and_tx_direction, send_and_recv_mode */
   pfr->bucket_len = DEFAULT_BUCKET_LEN;
   pfr->poll_num_pkts_watermark = DEFAULT_MIN_PKT_QUEUED;
+  hrtimer_init(&pfr->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  pfr->ring_mem.order = -1; /* vmalloc() until ring_alloc_mem() */
+  mutex_init(&pfr->tx_ring_lock);
+  pfr->poll_timer.function = ring_poll_timer;
+#ifdef VPFRING_SUPPORT
+  hrtimer_init(&pfr->vpfring_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  pfr->vpfring_timer.function = vpfring_coalescing_timer;
+  pfr->vpfring_coalescing_pkts = 1;
+#endif
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0))
+  timer_setup(&pfr->hash_rules_wheel.timer, hash_rules_wheel_timer, 0);
+#else
+  setup_timer(&pfr->hash_rules_wheel.timer, hash_rules_wheel_timer, (unsigned long)pfr);
+#endif
   pfr->add_packet_to_ring = add_packet_to_ring;
   pfr->add_raw_packet_to_ring = add_raw_packet_to_ring;
   pfr->header_len = quick_mode ? short_pkt_header : long_pkt_header;
+  pfr->tstamp_mode = PFRING_TSTAMP_HW;
   init_waitqueue_head(&pfr->ring_slots_waitqueue);
   rwlock_init(&pfr->ring_index_lock);
   rwlock_init(&pfr->ring_rules_lock);
-  atomic_set(&pfr->num_ring_users, 0);
+  pfr->hash_rules_table_size = DEFAULT_RING_HASH_SIZE;
+  atomic_set(&pfr->hash_rules_table_busy, 0);
   INIT_LIST_HEAD(&pfr->sw_filtering_rules);
   INIT_LIST_HEAD(&pfr->hw_filtering_rules);
   pfr->master_ring = NULL;
@@ -4368,12 +7819,13 @@ static int ring_create(
 
   ring_proc_add(pfr);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_create(): created\n");
 
   return(0);
 
 free_pfr:
+  if(pfr->cpu_stats != NULL) free_percpu(pfr->cpu_stats);
   kfree(ring_sk(sk));
 free_sk:
   sk_free(sk);
@@ -4395,6 +7847,7 @@ static int ring_proc_virtual_filtering_dev_get_info(char *buf, char **start, off
     switch(info->device_type) {
     case standard_nic_family: dev_family = "Standard NIC"; break;
     case intel_82599_family:  dev_family = "Intel 82599"; break;
+    case chelsio_t4_family:   dev_family = "Chelsio T4"; break;
     }
 
     rlen =  sprintf(buf,      "Name:              %s\n", info->device_name);
@@ -4412,7 +7865,7 @@ static virtual_filtering_device_element* add_virtual_filtering_device(struct soc
   virtual_filtering_device_element *elem;
   struct list_head *ptr, *tmp_ptr;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> add_virtual_filtering_device(%s)\n", info->device_name);
 
   if(info == NULL)
@@ -4457,7 +7910,7 @@ static int remove_virtual_filtering_device(struct sock *sock, char *device_name)
 {
   struct list_head *ptr, *tmp_ptr;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> remove_virtual_filtering_device(%s)\n", device_name);
 
   write_lock(&virtual_filtering_lock);
@@ -4494,7 +7947,7 @@ static struct pf_userspace_ring* userspace_ring_create(char *u_dev_name, userspa
   struct pf_userspace_ring *usr = NULL;
 
   if(strncmp(u_dev_name, "usr", 3) != 0) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s(%s) failed (1)\n", __FUNCTION__, u_dev_name);
 
     return NULL;
@@ -4508,7 +7961,7 @@ static struct pf_userspace_ring* userspace_ring_create(char *u_dev_name, userspa
   list_for_each_safe(ptr, tmp_ptr, &userspace_ring_list) {
     entry = list_entry(ptr, struct pf_userspace_ring, list);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s(%d) vs %lu [users: %u][type: %s]\n",
              __FUNCTION__,
 	     entry->id, id, atomic_read(&entry->users[type]),
@@ -4527,11 +7980,11 @@ static struct pf_userspace_ring* userspace_ring_create(char *u_dev_name, userspa
   if(usr == NULL) {
     /* Note: a userspace ring can be created by a consumer only,
      * however a producer can keep it if the consumer dies */
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s(%s): attempting to create ring\n", __FUNCTION__, u_dev_name);
 
     if(type == userspace_ring_producer) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] %s(%s) failed (2)\n", __FUNCTION__, u_dev_name);
 
       goto unlock;
@@ -4540,7 +7993,7 @@ static struct pf_userspace_ring* userspace_ring_create(char *u_dev_name, userspa
     usr = kcalloc(1, sizeof(struct pf_userspace_ring), GFP_KERNEL);
 
     if(usr == NULL) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] %s(%s) failed (3)\n", __FUNCTION__, u_dev_name);
 
       goto unlock;
@@ -4555,7 +8008,7 @@ static struct pf_userspace_ring* userspace_ring_create(char *u_dev_name, userspa
 
   atomic_inc(&usr->users[type]);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s(%lu) just created [users: %u][type: %s]\n",
 	   __FUNCTION__, id, atomic_read(&usr->users[type]),
 	   (type == userspace_ring_producer) ? "producer" : "consumer");
@@ -4566,7 +8019,7 @@ static struct pf_userspace_ring* userspace_ring_create(char *u_dev_name, userspa
 unlock:
   write_unlock(&userspace_ring_lock);
 
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     if(usr != NULL)
       printk("[PF_RING] %s() Userspace ring found or created.\n", __FUNCTION__);
     else
@@ -4578,43 +8031,198 @@ unlock:
 
 /* ********************************** */
 
-static int userspace_ring_remove(struct pf_userspace_ring *usr,
-                                 userspace_ring_client_type type) {
-  struct list_head *ptr, *tmp_ptr;
-  struct pf_userspace_ring *entry;
-  int ret = 0;
+static int userspace_ring_remove(struct pf_userspace_ring *usr,
+                                 userspace_ring_client_type type) {
+  struct list_head *ptr, *tmp_ptr;
+  struct pf_userspace_ring *entry;
+  int ret = 0;
+
+  write_lock(&userspace_ring_lock);
+
+  list_for_each_safe(ptr, tmp_ptr, &userspace_ring_list) {
+    entry = list_entry(ptr, struct pf_userspace_ring, list);
+
+    if(entry == usr) {
+      if(atomic_read(&usr->users[type]) > 0)
+        atomic_dec(&usr->users[type]);
+
+      if(type == userspace_ring_consumer)
+        usr->consumer_ring_slots_waitqueue = NULL;
+
+      if(atomic_read(&usr->users[userspace_ring_consumer]) == 0
+       && atomic_read(&usr->users[userspace_ring_producer]) == 0) {
+        ret = 1; /* ring memory can be freed */
+        list_del(ptr);
+        kfree(entry);
+      }
+
+      break;
+    }
+  }
+
+  write_unlock(&userspace_ring_lock);
+
+  if(ret == 1) {
+    if(debug_on())
+      printk("[PF_RING] userspace_ring_remove() Ring can be freed.\n");
+  }
+
+  return ret;
+}
+
+/* ********************************** */
+
+/* SO_SET_SHARED_RING: the ring memory has been allocated (mmap) */
+static int shared_ring_create(struct pf_ring_socket *pfr, struct pfring_shared_ring *info)
+{
+  struct pf_shared_ring *sr, *entry;
+
+  if((sr = kzalloc(sizeof(struct pf_shared_ring), GFP_KERNEL)) == NULL)
+    return(-ENOMEM);
+
+  sr->id = info->shared_ring_id, sr->policy = info->policy;
+  atomic_set(&sr->users, 1);
+  sr->owner = pfr;
+  sr->ring_memory = pfr->ring_memory, sr->ring_mem = pfr->ring_mem;
+  sr->slot_header_len = pfr->slot_header_len, sr->bucket_len = pfr->bucket_len;
+  init_waitqueue_head(&sr->readers_waitqueue);
+
+  write_lock(&shared_ring_lock);
+
+  list_for_each_entry(entry, &shared_ring_list, list) {
+    if(entry->id == sr->id) {
+      write_unlock(&shared_ring_lock);
+      kfree(sr);
+      return(-EEXIST);
+    }
+  }
+
+  list_add(&sr->list, &shared_ring_list);
+  pfr->shared_ring = sr;
+
+  write_unlock(&shared_ring_lock);
+
+  if(debug_on())
+    printk("[PF_RING] %s(%u) [policy=%u]\n", __FUNCTION__, sr->id, sr->policy);
+
+  return(0);
+}
+
+/* ********************************** */
+
+/*
+  SO_ATTACH_SHARED_RING: the reader starts lapped with no resync position
+  (all ones), the owner tells it where to start on the next packet
+*/
+static int shared_ring_attach(struct pf_ring_socket *pfr, u_int32_t shared_ring_id)
+{
+  struct pf_shared_ring *sr;
+  FlowSlotInfo *cursor;
+  int i, rc = -ENOENT;
+
+  if((cursor = vmalloc_user(sizeof(FlowSlotInfo))) == NULL)
+    return(-ENOMEM);
+
+  cursor->shared_ring_resync = (u_int64_t)-1;
+  cursor->shared_ring_flags = SHARED_RING_LAPPED;
+
+  write_lock(&shared_ring_lock);
+
+  list_for_each_entry(sr, &shared_ring_list, list) {
+    if(sr->id != shared_ring_id)
+      continue;
+
+    if(sr->owner == NULL)
+      break; /* no more packets will come */
+
+    for(i = 0; i < MAX_SHARED_RING_READERS; i++)
+      if(sr->cursor[i] == NULL) break;
+
+    if(i == MAX_SHARED_RING_READERS) {
+      rc = -EBUSY;
+      break;
+    }
+
+    cursor->tot_read = ((FlowSlotInfo*)sr->ring_memory)->tot_insert; /* lost accounting only */
+    atomic_inc(&sr->users);
+    rcu_assign_pointer(sr->cursor[i], cursor);
+
+    pfr->shared_ring = sr, pfr->shared_cursor = cursor, pfr->shared_reader_id = i;
+    pfr->slot_header_len = sr->slot_header_len, pfr->bucket_len = sr->bucket_len;
+    rc = 0;
+    break;
+  }
+
+  write_unlock(&shared_ring_lock);
+
+  if(rc != 0)
+    vfree(cursor);
+
+  return(rc);
+}
+
+/* ********************************** */
+
+/*
+  ring_release(): returns 1 when the caller still has to free its ring
+  memory, i.e. an owner without readers left. The last reader to go
+  frees the memory of an owner released before it
+*/
+static int shared_ring_remove(struct pf_ring_socket *pfr)
+{
+  struct pf_shared_ring *sr = pfr->shared_ring;
+  int last;
+
+  write_lock(&shared_ring_lock);
+
+  if(pfr->shared_cursor != NULL)
+    rcu_assign_pointer(sr->cursor[pfr->shared_reader_id], NULL);
+  else
+    sr->owner = NULL;
+
+  if((last = atomic_dec_and_test(&sr->users)))
+    list_del(&sr->list);
+
+  write_unlock(&shared_ring_lock);
+
+  if(pfr->shared_cursor != NULL) {
+    synchronize_rcu(); /* the owner may be checking the cursor */
+    vfree(pfr->shared_cursor);
+    pfr->shared_cursor = NULL;
+
+    if(last)
+      free_ring_pages(&sr->ring_mem, sr->ring_memory);
+  } else if(!last)
+    wake_up_interruptible(&sr->readers_waitqueue); /* POLLHUP once drained */
 
-  write_lock(&userspace_ring_lock);
+  if(last)
+    kfree(sr);
 
-  list_for_each_safe(ptr, tmp_ptr, &userspace_ring_list) {
-    entry = list_entry(ptr, struct pf_userspace_ring, list);
+  pfr->shared_ring = NULL;
 
-    if(entry == usr) {
-      if(atomic_read(&usr->users[type]) > 0)
-        atomic_dec(&usr->users[type]);
+  return(last && (pfr->ring_memory != NULL));
+}
 
-      if(type == userspace_ring_consumer)
-        usr->consumer_ring_slots_waitqueue = NULL;
+/* ********************************** */
 
-      if(atomic_read(&usr->users[userspace_ring_consumer]) == 0
-       && atomic_read(&usr->users[userspace_ring_producer]) == 0) {
-        ret = 1; /* ring memory can be freed */
-        list_del(ptr);
-        kfree(entry);
-      }
+static unsigned int shared_ring_reader_poll(struct file *file, struct pf_ring_socket *pfr, poll_table *wait)
+{
+  struct pf_shared_ring *sr = pfr->shared_ring;
+  FlowSlotInfo *si = (FlowSlotInfo*)sr->ring_memory, *c = pfr->shared_cursor;
+  int readable;
 
-      break;
-    }
-  }
+  poll_wait(file, &sr->readers_waitqueue, wait);
+  smp_rmb();
 
-  write_unlock(&userspace_ring_lock);
+  if(c->shared_ring_flags & SHARED_RING_LAPPED)
+    readable = (c->shared_ring_resync != (u_int64_t)-1);
+  else
+    readable = (si->tot_insert != c->tot_read);
 
-  if(ret == 1) {
-    if(unlikely(enable_debug))
-      printk("[PF_RING] userspace_ring_remove() Ring can be freed.\n");
-  }
+  if(readable)
+    return(POLLIN | POLLRDNORM);
 
-  return ret;
+  return((sr->owner == NULL) ? POLLHUP : 0);
 }
 
 /* ************************************* */
@@ -4650,7 +8258,7 @@ static unsigned long alloc_contiguous_memory(u_int mem_len) {
   if(mem)
     reserve_memory(mem, mem_len);
   else
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s() Failure (len=%d, order=%d)\n", __FUNCTION__, mem_len, get_order(mem_len));
 
   return(mem);
@@ -4692,7 +8300,7 @@ static struct dma_memory_info *allocate_extra_dma_memory(struct device *hwdev,
     return NULL;
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s() Allocating %d chunks of %d bytes [slots per chunk=%d]\n",
            __FUNCTION__, dma_memory->num_chunks, dma_memory->chunk_len, num_slots_per_chunk);
 
@@ -4721,7 +8329,7 @@ static struct dma_memory_info *allocate_extra_dma_memory(struct device *hwdev,
 
     slot = (char *) (dma_memory->virtual_addr[chunk_id] + offset);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s() Mapping DMA slot %d of %d [slot addr=%p][offset=%u]\n",
              __FUNCTION__, i + 1, dma_memory->num_slots, slot, offset);
 
@@ -4764,7 +8372,7 @@ static void free_extra_dma_memory(struct dma_memory_info *dma_memory) {
   if (dma_memory->virtual_addr) {
     for(i=0; i < dma_memory->num_chunks; i++) {
       if(dma_memory->virtual_addr[i]) {
-        if(unlikely(enable_debug))
+        if(debug_on())
           printk("[PF_RING] %s() Freeing chunk %d of %d\n", __FUNCTION__, i, dma_memory->num_chunks);
 
         free_contiguous_memory(dma_memory->virtual_addr[i], dma_memory->chunk_len);
@@ -4797,7 +8405,7 @@ static struct dna_cluster* dna_cluster_create(u_int32_t dna_cluster_id, u_int32_
 
     if(entry->id == dna_cluster_id) {
 
-      if(unlikely(enable_debug))
+      if(debug_on())
         printk("[PF_RING] %s(%u) cluster already exists [master: %u][slaves: %u]\n",
                __FUNCTION__, dna_cluster_id, atomic_read(&entry->master), atomic_read(&entry->slaves));
 
@@ -4813,13 +8421,13 @@ static struct dna_cluster* dna_cluster_create(u_int32_t dna_cluster_id, u_int32_
 
   /* Creating a new dna cluster */
   if(dnac == NULL) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s(%u): attempting to create a dna cluster\n", __FUNCTION__, dna_cluster_id);
 
     dnac = kcalloc(1, sizeof(struct dna_cluster), GFP_KERNEL);
 
     if(dnac == NULL) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] %s(%u) failed\n", __FUNCTION__, dna_cluster_id);
       goto unlock;
     }
@@ -4868,7 +8476,7 @@ static struct dna_cluster* dna_cluster_create(u_int32_t dna_cluster_id, u_int32_
 
     list_add(&dnac->list, &dna_cluster_list);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s(%u) New DNA cluster created\n",  __FUNCTION__, dna_cluster_id);
 
     *recovered = 0;
@@ -4894,7 +8502,7 @@ unlock:
   write_unlock(&dna_cluster_lock);
 
   if(dnac != NULL) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s(%u) DNA cluster found or created [master: %u][slaves: %u]\n",
            __FUNCTION__, dna_cluster_id, atomic_read(&dnac->master), atomic_read(&dnac->slaves));
   } else
@@ -4928,7 +8536,7 @@ static void dna_cluster_remove(struct dna_cluster *dnac, dna_cluster_client_type
         vfree(entry->shared_memory);
         kfree(entry);
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] %s() success\n", __FUNCTION__);
       }
 
@@ -4953,7 +8561,7 @@ static struct dna_cluster* dna_cluster_attach(u_int32_t dna_cluster_id, wait_que
 
     if(entry->id == dna_cluster_id) {
 
-      if(unlikely(enable_debug))
+      if(debug_on())
         printk("[PF_RING] %s(%u) cluster found [master: %u][slaves: %u]\n",
                __FUNCTION__, dna_cluster_id, atomic_read(&entry->master), atomic_read(&entry->slaves));
 
@@ -4990,7 +8598,7 @@ static struct dna_cluster* dna_cluster_attach(u_int32_t dna_cluster_id, wait_que
 unlock:
   write_unlock(&dna_cluster_lock);
 
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     if(dnac != NULL)
       printk("[PF_RING] %s(%u) attached to DNA cluster [master: %u][slaves: %u]\n",
         __FUNCTION__, dna_cluster_id, atomic_read(&dnac->master), atomic_read(&dnac->slaves));
@@ -5003,6 +8611,241 @@ unlock:
 
 /* *********************************************** */
 
+static void free_dispatch_table_rcu(struct rcu_head *head)
+{
+  kfree(container_of(head, ring_dispatch_table, rcu));
+}
+
+/* *********************************************** */
+
+static void set_dispatch_table(ring_dispatch_table **slot, ring_dispatch_table *table)
+{
+  ring_dispatch_table *old = *slot;
+
+  rcu_assign_pointer(*slot, table);
+
+  if(old != NULL)
+    call_rcu(&old->rcu, free_dispatch_table_rcu);
+}
+
+/* *********************************************** */
+
+/* Back to the ring_table walk: the tables are freed after a grace period */
+static void reset_dispatch_tables(void)
+{
+  int ifindex;
+
+  dispatch_tables_ok = 0;
+  smp_wmb();
+
+  for(ifindex = 0; ifindex < MAX_NUM_IFIDX; ifindex++)
+    set_dispatch_table(&dispatch_tables[ifindex], NULL);
+
+  set_dispatch_table(&any_dispatch_table, NULL);
+}
+
+/* *********************************************** */
+
+/*
+  Whether a ring reads what parse_pkt() fills in: the headers of the long
+  and compact slots, the filtering rules, the blocklist, the RSS rehash, a
+  kernel plugin, its master. BPF runs on the skb. Cluster members always
+  do (hash_pkt_cluster()).
+*/
+static inline u_int8_t ring_needs_parse(struct pf_ring_socket *pfr)
+{
+  return((pfr->header_len != short_pkt_header)
+	 || (pfr->num_sw_filtering_rules > 0) || (pfr->sw_filtering_hash != NULL)
+	 || (pfr->prefix_blocklist != NULL)
+	 || pfr->rehash_rss
+	 || (pfr->flow_sample_threshold != 0)
+	 || (pfr->kernel_consumer_plugin_id != 0)
+	 || (pfr->master_ring != NULL)
+	 || (pfr->cluster_id != 0));
+}
+
+/* *********************************************** */
+
+static ring_dispatch_table* build_dispatch_table(int ifindex,
+						 struct pf_ring_socket **rings, u_int num_rings,
+						 ring_cluster_element **clusters, u_int num_clusters)
+{
+  ring_dispatch_table *table;
+  u_int num_entries = 0, i, c;
+  u_int8_t cluster_accept = 0;
+
+  for(i = 0; i < num_rings; i++) {
+    if((ifindex >= 0)
+       && (rings[i]->ring_netdev != &any_device_element)
+       && !test_bit(ifindex, rings[i]->netdev_mask))
+      continue;
+
+    for(c = 0; c < MAX_NUM_RX_CHANNELS; c++)
+      if(rings[i]->channel_id & (1 << c)) num_entries++;
+  }
+
+  if((num_entries == 0) && (num_clusters == 0))
+    return(NULL);
+
+  table = kmalloc(sizeof(ring_dispatch_table)
+		  + (num_entries + num_clusters) * sizeof(void*), GFP_KERNEL);
+
+  if(table == NULL)
+    return(ERR_PTR(-ENOMEM));
+
+  table->num_clusters = num_clusters;
+  table->clusters = (ring_cluster_element**)&table->rings[num_entries];
+  memcpy(table->clusters, clusters, num_clusters * sizeof(ring_cluster_element*));
+  table->tstamp_mode = PFRING_TSTAMP_NONE;
+  table->parse_needed = (num_clusters > 0) ? 1 : 0;
+
+  for(i = 0; i < num_clusters; i++) {
+    for(c = 0; c < clusters[i]->cluster.num_cluster_elements; c++) {
+      struct sock *member = clusters[i]->cluster.sk[c];
+
+      if((member != NULL) && (ring_sk(member) != NULL)) {
+	table->tstamp_mode = max_val(table->tstamp_mode, ring_sk(member)->tstamp_mode);
+	cluster_accept |= ring_sk(member)->accept; /* clusters take every channel */
+      }
+    }
+  }
+
+  for(c = 0, num_entries = 0; c < MAX_NUM_RX_CHANNELS; c++) {
+    table->channel_rings[c] = num_entries;
+    table->channel_accept[c] = cluster_accept;
+
+    for(i = 0; i < num_rings; i++) {
+      if((ifindex >= 0)
+	 && (rings[i]->ring_netdev != &any_device_element)
+	 && !test_bit(ifindex, rings[i]->netdev_mask))
+	continue;
+
+      if(rings[i]->channel_id & (1 << c)) {
+	table->channel_accept[c] |= rings[i]->accept;
+	table->rings[num_entries++] = rings[i];
+	table->tstamp_mode = max_val(table->tstamp_mode, rings[i]->tstamp_mode);
+	table->parse_needed |= ring_needs_parse(rings[i]);
+      }
+    }
+  }
+
+  table->channel_rings[MAX_NUM_RX_CHANNELS] = num_entries;
+  return(table);
+}
+
+/* *********************************************** */
+
+/*
+  skb_ring_handler() goes straight to the rings and clusters of the
+  device/channel of the packet instead of walking ring_table and
+  ring_cluster_list: their tables are rebuilt here, in process context,
+  whenever a socket is bound or released, changes its channels or its
+  cluster, and when a device goes away. A socket is freed only after a
+  grace period that follows the rebuild without it (see ring_release()).
+*/
+static void rebuild_dispatch_tables(void)
+{
+  struct pf_ring_socket **rings;
+  ring_cluster_element **clusters, **dev_clusters, *cluster_ptr;
+  u_int num_rings = 0, num_any = 0, num_clusters = 0, num_dev_clusters, i, j;
+  DECLARE_BITMAP(devices, MAX_NUM_IFIDX);
+  ring_dispatch_table *table;
+  u_int32_t last_list_idx;
+  struct sock *sk;
+  int ifindex;
+
+  rings = kmalloc(3 * MAX_NUM_LIST_ELEMENTS * sizeof(void*), GFP_KERNEL);
+
+  mutex_lock(&dispatch_tables_lock);
+
+  if(rings == NULL)
+    goto fallback;
+
+  clusters = (ring_cluster_element**)&rings[MAX_NUM_LIST_ELEMENTS];
+  dev_clusters = &clusters[MAX_NUM_LIST_ELEMENTS];
+  bitmap_zero(devices, MAX_NUM_IFIDX);
+
+  ring_read_lock();
+
+  /* The 'any' rings first: they are the whole table of the devices without rings */
+  for(j = 0; j < 2; j++) {
+    sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
+
+    while(sk != NULL) {
+      struct pf_ring_socket *pfr = ring_sk(sk);
+
+      if((pfr != NULL)
+	 && (pfr->ring_netdev != &none_device_element)
+	 && (pfr->cluster_id == 0)
+	 && ((pfr->ring_netdev == &any_device_element) == (j == 0))) {
+	rings[num_rings++] = pfr;
+	bitmap_or(devices, devices, pfr->netdev_mask, MAX_NUM_IFIDX);
+      }
+
+      sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
+    }
+
+    if(j == 0) num_any = num_rings;
+  }
+
+  cluster_ptr = (ring_cluster_element*)lockless_list_get_first(&ring_cluster_list, &last_list_idx);
+
+  while(cluster_ptr != NULL) {
+    if(cluster_ptr->cluster.num_cluster_elements > 0) {
+      clusters[num_clusters++] = cluster_ptr;
+
+      for(i = 0; i < cluster_ptr->cluster.num_cluster_elements; i++)
+	if((cluster_ptr->cluster.sk[i] != NULL) && (ring_sk(cluster_ptr->cluster.sk[i]) != NULL))
+	  bitmap_or(devices, devices, ring_sk(cluster_ptr->cluster.sk[i])->netdev_mask, MAX_NUM_IFIDX);
+    }
+
+    cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
+  }
+
+  ring_read_unlock();
+
+  table = build_dispatch_table(-1, rings, num_any, NULL, 0);
+  if(IS_ERR(table)) goto fallback;
+  set_dispatch_table(&any_dispatch_table, table);
+
+  for(ifindex = 0; ifindex < MAX_NUM_IFIDX; ifindex++) {
+    table = NULL;
+
+    if(test_bit(ifindex, devices)) {
+      for(i = 0, num_dev_clusters = 0; i < num_clusters; i++) {
+	for(j = 0; j < clusters[i]->cluster.num_cluster_elements; j++) {
+	  struct sock *member = clusters[i]->cluster.sk[j];
+
+	  if((member != NULL) && (ring_sk(member) != NULL)
+	     && test_bit(ifindex, ring_sk(member)->netdev_mask)) {
+	    dev_clusters[num_dev_clusters++] = clusters[i];
+	    break;
+	  }
+	}
+      }
+
+      table = build_dispatch_table(ifindex, rings, num_rings, dev_clusters, num_dev_clusters);
+      if(IS_ERR(table)) goto fallback;
+    }
+
+    set_dispatch_table(&dispatch_tables[ifindex], table);
+  }
+
+  smp_wmb(); /* The tables before dispatch_tables_ok */
+  dispatch_tables_ok = 1;
+  mutex_unlock(&dispatch_tables_lock);
+  kfree(rings);
+  return;
+
+ fallback:
+  printk("[PF_RING] Not enough memory for the dispatch tables: walking the rings\n");
+  reset_dispatch_tables();
+  mutex_unlock(&dispatch_tables_lock);
+  if(rings != NULL) kfree(rings);
+}
+
+/* *********************************************** */
+
 static int ring_release(struct socket *sock)
 {
   struct sock *sk = sock->sk;
@@ -5022,12 +8865,7 @@ static int ring_release(struct socket *sock)
     plugin_registration[pfr->kernel_consumer_plugin_id]->pfring_packet_term(pfr);
   }
 
-  /* Wait until the ring is being used... */
-  while(atomic_read(&pfr->num_ring_users) > 0) {
-    schedule();
-  }
-
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] called ring_release(%s)\n", pfr->ring_netdev->dev->name);
 
   if(pfr->kernel_consumer_options) kfree(pfr->kernel_consumer_options);
@@ -5079,6 +8917,35 @@ static int ring_release(struct socket *sock)
 
   sock->sk = NULL;
 
+  /*
+    The socket is no longer reachable from ring_table, device_rings[][]
+    or its cluster: wait for the packet handlers that may still be
+    walking them (see skb_ring_handler()) before freeing what they use
+  */
+  ring_write_unlock();
+  rebuild_dispatch_tables();
+  synchronize_rcu();
+  hrtimer_cancel(&pfr->poll_timer); /* nobody can start it anymore */
+  del_timer_sync(&pfr->hash_rules_wheel.timer);
+  if(pfr->prefix_blocklist != NULL)
+    free_prefix_blocklist(pfr->prefix_blocklist);
+  if(pfr->bpfFilter != NULL)
+    free_bpf_filter(pfr->bpfFilter);
+
+  /* Free Hw Filtering Rules: outside the lock as drivers may sleep (cxgb4) */
+  if((pfr->ring_netdev != &none_device_element) && (pfr->num_hw_filtering_rules > 0)) {
+    list_for_each_safe(ptr, tmp_ptr, &pfr->hw_filtering_rules) {
+      hw_filtering_rule_element *hw_rule = list_entry(ptr, hw_filtering_rule_element, list);
+
+      /* Remove hw rule */
+      handle_hw_filtering_rule(pfr, &hw_rule->rule, remove_hw_rule);
+
+      list_del(ptr);
+      kfree(hw_rule);
+    }
+  }
+  ring_write_lock();
+
   /* Free rules */
   if(pfr->ring_netdev != &none_device_element) {
     list_for_each_safe(ptr, tmp_ptr, &pfr->sw_filtering_rules) {
@@ -5090,16 +8957,20 @@ static int ring_release(struct socket *sock)
       kfree(rule);
     }
 
-    /* Filtering hash rules */
+    if(pfr->sw_filtering_classifier)
+      vfree(pfr->sw_filtering_classifier);
+
+    /* Filtering hash rules: all in sw_filtering_hash, even while resizing */
     if(pfr->sw_filtering_hash) {
+      struct sw_filtering_hash_table *t = pfr->sw_filtering_hash;
       int i;
 
-      for(i = 0; i < DEFAULT_RING_HASH_SIZE; i++) {
-	if(pfr->sw_filtering_hash[i] != NULL) {
-	  sw_filtering_hash_bucket *scan = pfr->sw_filtering_hash[i], *next;
+      for(i = 0; i < t->size; i++) {
+	if(t->chain[i] != NULL) {
+	  sw_filtering_hash_bucket *scan = t->chain[i], *next;
 
 	  while(scan != NULL) {
-	    next = scan->next;
+	    next = scan->next[t->link];
 
 	    free_sw_filtering_hash_bucket(scan);
 	    kfree(scan);
@@ -5108,23 +8979,15 @@ static int ring_release(struct socket *sock)
 	}
       }
 
-      kfree(pfr->sw_filtering_hash);
+      free_hash_rules_table(t);
     }
 
-    /* printk("[PF_RING] --> num_hw_filtering_rules=%d\n", pfr->num_hw_filtering_rules); */
-
-    /* Free Hw Filtering Rules */
-    if(pfr->num_hw_filtering_rules > 0) {
-      list_for_each_safe(ptr, tmp_ptr, &pfr->hw_filtering_rules) {
-	hw_filtering_rule_element *hw_rule = list_entry(ptr, hw_filtering_rule_element, list);
+    if(pfr->sw_filtering_hash_resize)
+      free_hash_rules_table(pfr->sw_filtering_hash_resize);
 
-	/* Remove hw rule */
-	handle_hw_filtering_rule(pfr, &hw_rule->rule, remove_hw_rule);
+    if(pfr->sw_filtering_hash_retired)
+      free_hash_rules_table(pfr->sw_filtering_hash_retired);
 
-	list_del(ptr);
-	kfree(hw_rule);
-      }
-    }
   }
 
   if(pfr->v_filtering_dev != NULL) {
@@ -5142,6 +9005,7 @@ static int ring_release(struct socket *sock)
   ring_write_unlock();
 
 #ifdef VPFRING_SUPPORT
+  hrtimer_cancel(&pfr->vpfring_timer);
   if(pfr->vpfring_host_eventfd_ctx)
     eventfd_ctx_put(pfr->vpfring_host_eventfd_ctx);
 #endif //VPFRING_SUPPORT
@@ -5153,8 +9017,15 @@ static int ring_release(struct socket *sock)
   if(pfr->userspace_ring != NULL)
     free_ring_memory = userspace_ring_remove(pfr->userspace_ring, pfr->userspace_ring_type);
 
+  /* Not reachable by the packet handlers anymore (see above) */
+  if(pfr->shared_ring != NULL)
+    free_ring_memory = shared_ring_remove(pfr);
+
   if(ring_memory_ptr != NULL && free_ring_memory)
-    vfree(ring_memory_ptr);
+    free_ring_pages(&pfr->ring_mem, ring_memory_ptr);
+
+  if(pfr->tx_ring != NULL)
+    vfree(pfr->tx_ring);
 
   if (pfr->dna_cluster != NULL)
     dna_cluster_remove(pfr->dna_cluster, pfr->dna_cluster_type, pfr->dna_cluster_slave_id);
@@ -5173,17 +9044,13 @@ static int ring_release(struct socket *sock)
     pfr->extra_dma_memory = NULL;
   }
 
-  /*
-     Wait long enough so that other threads using ring_table
-     have finished referencing the socket pointer that
-     we will be deleting
-  */
-  wmb();
-  msleep(100 /* 100 msec */);
+  if(pfr->flow_cache != NULL)
+    free_percpu(pfr->flow_cache);
 
+  free_percpu(pfr->cpu_stats);
   kfree(pfr); /* Time to free */
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_release: done\n");
 
   /* Some housekeeping tasks */
@@ -5210,15 +9077,18 @@ static int packet_ring_bind(struct sock *sk, char *dev_name)
    * Note: with userspace rings we expect that mmap() follow (only one) bind() */
 
   if(pfr->userspace_ring != NULL) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] packet_ring_bind(): userspace_ring != NULL, failure\n");
 
     return(-EINVAL); /* TODO bind() already called on a userspace ring */
   }
 
+  if(pfr->shared_cursor != NULL)
+    return(-EINVAL); /* shared ring reader: the owner is bound */
+
   if(strncmp(dev_name, "usr", 3) == 0) {
     if(pfr->ring_memory != NULL) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] packet_ring_bind(): ring_memory != NULL, failure\n");
 
       return(-EINVAL); /* TODO mmap() already called */
@@ -5252,13 +9122,13 @@ static int packet_ring_bind(struct sock *sk, char *dev_name)
   if(strcmp(dev->dev->name, "none") != 0
      && strcmp(dev->dev->name, "any") != 0
      && (!(dev->dev->flags & IFF_UP))) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] packet_ring_bind(%s): down\n", dev->dev->name);
 
     return(-ENETDOWN);
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] packet_ring_bind(%s, bucket_len=%d) called\n",
 	   dev->dev->name, pfr->bucket_len);
 
@@ -5305,6 +9175,7 @@ static int packet_ring_bind(struct sock *sk, char *dev_name)
 	     dev->dev->ifindex, dev->dev->name);
   }
 
+  rebuild_dispatch_tables();
   return(0);
 }
 
@@ -5315,7 +9186,7 @@ static int ring_bind(struct socket *sock, struct sockaddr *sa, int addr_len)
 {
   struct sock *sk = sock->sk;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_bind() called\n");
 
   /*
@@ -5331,7 +9202,7 @@ static int ring_bind(struct socket *sock, struct sockaddr *sa, int addr_len)
   /* Safety check: add trailing zero if missing */
   sa->sa_data[sizeof(sa->sa_data) - 1] = '\0';
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] searching device %s\n", sa->sa_data);
 
 #if 0
@@ -5344,7 +9215,7 @@ static int ring_bind(struct socket *sock, struct sockaddr *sa, int addr_len)
 #endif
 				sa->sa_data)) == NULL) {
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] search failed\n");
       return(-EINVAL);
     }
@@ -5383,7 +9254,7 @@ static int do_memory_mmap(struct vm_area_struct *vma, unsigned long size,
 
   start = vma->vm_start;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s(mode=%d, size=%lu, ptr=%p)\n", __FUNCTION__, mode, size, ptr);
 
   while(size > 0) {
@@ -5403,7 +9274,7 @@ static int do_memory_mmap(struct vm_area_struct *vma, unsigned long size,
     }
 
     if(rc) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] remap_pfn_range() failed\n");
 
       return(-EAGAIN);
@@ -5423,6 +9294,55 @@ static int do_memory_mmap(struct vm_area_struct *vma, unsigned long size,
 
 /* ************************************* */
 
+/*
+  Shared ring reader: the owner's ring, read-only, with the second page of
+  FlowSlotInfo replaced by the reader's cursor. The cursor is writable
+  through its own one page mapping (PF_RING_SHARED_CURSOR_MEM_ID) that the
+  library lays over it
+*/
+static int shared_ring_reader_mmap(struct pf_ring_socket *pfr, struct vm_area_struct *vma,
+				   unsigned long mem_id, unsigned long size)
+{
+  struct pf_shared_ring *sr = pfr->shared_ring;
+  char *cursor_page = (char*)pfr->shared_cursor + offsetof(FlowSlotInfo, tot_read);
+  unsigned long addr, off;
+
+  if(mem_id == PF_RING_SHARED_CURSOR_MEM_ID) {
+    if(size != PAGE_SIZE)
+      return(-EINVAL);
+
+    return(do_memory_mmap(vma, size, (char*)pfr->shared_cursor,
+			  offsetof(FlowSlotInfo, tot_read) / PAGE_SIZE, VM_LOCKED, 0));
+  }
+
+  if((mem_id != 0) || (size > ((FlowSlotInfo*)sr->ring_memory)->tot_mem))
+    return(-EINVAL);
+
+  if(vma->vm_flags & VM_WRITE)
+    return(-EPERM);
+
+  vma->vm_flags &= ~VM_MAYWRITE;
+  vma->vm_flags |= VM_LOCKED;
+
+  for(addr = vma->vm_start, off = 0; addr < vma->vm_end; addr += PAGE_SIZE, off += PAGE_SIZE) {
+    unsigned long pfn;
+
+    if(off == offsetof(FlowSlotInfo, tot_read))
+      pfn = vmalloc_to_pfn(cursor_page);
+    else if(sr->ring_mem.order >= 0)
+      pfn = __pa(&sr->ring_memory[off]) >> PAGE_SHIFT;
+    else /* vmalloc() or vmap() */
+      pfn = vmalloc_to_pfn(&sr->ring_memory[off]);
+
+    if(remap_pfn_range(vma, addr, pfn, PAGE_SIZE, vma->vm_page_prot))
+      return(-EAGAIN);
+  }
+
+  return(0);
+}
+
+/* ************************************* */
+
 static int ring_mmap(struct file *file,
 		     struct socket *sock, struct vm_area_struct *vma)
 {
@@ -5432,17 +9352,17 @@ static int ring_mmap(struct file *file,
   unsigned long mem_id = vma->vm_pgoff; /* using vm_pgoff as memory id */
   unsigned long size = (unsigned long)(vma->vm_end - vma->vm_start);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s() called\n", __FUNCTION__);
 
   if(size % PAGE_SIZE) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] %s() failed: len is not multiple of PAGE_SIZE\n", __FUNCTION__);
 
     return(-EINVAL);
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s() called, size: %ld bytes [bucket_len=%d]\n",
 	   __FUNCTION__, size, pfr->bucket_len);
 
@@ -5512,6 +9432,9 @@ static int ring_mmap(struct file *file,
     return(-EINVAL);
   }
 
+  if(pfr->shared_cursor != NULL)
+    return(shared_ring_reader_mmap(pfr, vma, mem_id, size));
+
   switch(mem_id) {
     /* RING */
     case 0:
@@ -5528,24 +9451,26 @@ static int ring_mmap(struct file *file,
       }
 
       /* If userspace tries to mmap beyond end of our buffer, then fail */
-      if(size > pfr->slots_info->tot_mem) {
-        if(unlikely(enable_debug))
-	  printk("[PF_RING] %s() failed: area too large [%ld > %d]\n", __FUNCTION__, size, pfr->slots_info->tot_mem);
+      if(size > (unsigned long)pfr->slots_info->tot_mem * pfr->slots_info->num_sub_rings) {
+        if(debug_on())
+	  printk("[PF_RING] %s() failed: area too large [%ld > %llu]\n", __FUNCTION__, size,
+		 (unsigned long long)pfr->slots_info->tot_mem * pfr->slots_info->num_sub_rings);
         return(-EINVAL);
       }
 
-      if(unlikely(enable_debug))
+      if(debug_on())
         printk("[PF_RING] mmap [slot_len=%d][tot_slots=%d] for ring on device %s\n",
 	       pfr->slots_info->slot_len, pfr->slots_info->min_num_slots, pfr->ring_netdev->dev->name);
 
-      if((rc = do_memory_mmap(vma, size, pfr->ring_memory, 0, VM_LOCKED, 0)) < 0)
+      /* A contiguous block is not vmalloc() memory: remap it by pfn */
+      if((rc = do_memory_mmap(vma, size, pfr->ring_memory, 0, VM_LOCKED, (pfr->ring_mem.order >= 0) ? 1 : 0)) < 0)
         return(rc);
 
       break;
     case 1:
       /* DNA: RX packet descriptors */
       if(pfr->dna_device == NULL) {
-        if(unlikely(enable_debug))
+        if(debug_on())
 	  printk("[PF_RING] %s() failed: operation for DNA only", __FUNCTION__);
         return(-EINVAL);
       }
@@ -5557,7 +9482,7 @@ static int ring_mmap(struct file *file,
     case 2:
       /* DNA: Physical card memory */
       if(pfr->dna_device == NULL) {
-        if(unlikely(enable_debug))
+        if(debug_on())
 	  printk("[PF_RING] %s() failed: operation for DNA only", __FUNCTION__);
         return(-EINVAL);
       }
@@ -5569,7 +9494,7 @@ static int ring_mmap(struct file *file,
     case 3:
       /* DNA: TX packet descriptors */
       if(pfr->dna_device == NULL) {
-        if(unlikely(enable_debug))
+        if(debug_on())
 	  printk("[PF_RING] %s() failed: operation for DNA only", __FUNCTION__);
         return(-EINVAL);
       }
@@ -5581,13 +9506,13 @@ static int ring_mmap(struct file *file,
     case 4:
       /* DNA cluster shared memory (master) */
       if(pfr->dna_cluster == NULL || pfr->dna_cluster_type != dna_cluster_master) {
-        if(unlikely(enable_debug))
+        if(debug_on())
 	  printk("[PF_RING] %s() failed: operation for DNA cluster master only", __FUNCTION__);
         return(-EINVAL);
       }
 
       if(size > (pfr->dna_cluster->slave_shared_memory_len * pfr->dna_cluster->num_slaves)) {
-        if(unlikely(enable_debug))
+        if(debug_on())
           printk("[PF_RING] %s() failed: area too large [%ld > %d]\n",
 	         __FUNCTION__, size, pfr->dna_cluster->slave_shared_memory_len * pfr->dna_cluster->num_slaves);
         return(-EINVAL);
@@ -5600,13 +9525,13 @@ static int ring_mmap(struct file *file,
     case 5:
       /* DNA cluster shared memory (slave) */
       if(pfr->dna_cluster == NULL || pfr->dna_cluster_type != dna_cluster_slave) {
-        if(unlikely(enable_debug))
+        if(debug_on())
 	  printk("[PF_RING] %s() failed: operation for DNA cluster slave only", __FUNCTION__);
         return(-EINVAL);
       }
 
       if(size > pfr->dna_cluster->slave_shared_memory_len) {
-        if(unlikely(enable_debug))
+        if(debug_on())
           printk("[PF_RING] %s() failed: area too large [%ld > %d]\n",
 	         __FUNCTION__, size, pfr->dna_cluster->slave_shared_memory_len * pfr->dna_cluster->num_slaves);
         return(-EINVAL);
@@ -5621,13 +9546,13 @@ static int ring_mmap(struct file *file,
     case 6:
       /* DNA cluster persistent memory (master) */
       if(pfr->dna_cluster == NULL || pfr->dna_cluster_type != dna_cluster_master) {
-        if(unlikely(enable_debug))
+        if(debug_on())
 	  printk("[PF_RING] %s() failed: operation for DNA cluster master only", __FUNCTION__);
         return(-EINVAL);
       }
 
       if(size > pfr->dna_cluster->master_persistent_memory_len) {
-        if(unlikely(enable_debug))
+        if(debug_on())
           printk("[PF_RING] %s() failed: area too large [%ld > %d]\n",
 	         __FUNCTION__, size, pfr->dna_cluster->master_persistent_memory_len);
         return(-EINVAL);
@@ -5636,50 +9561,184 @@ static int ring_mmap(struct file *file,
       if((rc = do_memory_mmap(vma, size, pfr->dna_cluster->master_persistent_memory, 0, VM_LOCKED, 0)) < 0)
         return(rc);
 
+      break;
+    case PF_RING_TX_RING_MMAP_ID:
+      /* SO_SET_TX_RING */
+      if(pfr->tx_ring == NULL) {
+        if(debug_on())
+	  printk("[PF_RING] %s() failed: no TX ring", __FUNCTION__);
+        return(-EINVAL);
+      }
+
+      if(size > pfr->tx_ring->tot_mem)
+        return(-EINVAL);
+
+      if((rc = do_memory_mmap(vma, size, (char*)pfr->tx_ring, 0, VM_LOCKED, 0)) < 0)
+        return(rc);
+
       break;
     default:
       return(-EAGAIN);
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s succeeded\n", __FUNCTION__);
 
-  return 0;
-}
+  return 0;
+}
+
+/* ************************************* */
+
+static int ring_recvmsg(struct kiocb *iocb, struct socket *sock,
+			struct msghdr *msg, size_t len, int flags)
+{
+  struct pf_ring_socket *pfr = ring_sk(sock->sk);
+  u_int32_t queued_pkts, num_loops = 0;
+
+  if(debug_on())
+    printk("[PF_RING] ring_recvmsg called\n");
+
+  pfr->ring_active = 1;
+
+  while((queued_pkts = num_queued_pkts(pfr)) < MIN_QUEUED_PKTS) {
+    wait_event_interruptible(pfr->ring_slots_waitqueue, 1);
+
+    if(debug_on())
+      printk("[PF_RING] -> ring_recvmsg "
+	     "[queued_pkts=%d][num_loops=%d]\n",
+	     queued_pkts, num_loops);
+
+    if(queued_pkts > 0) {
+      if(num_loops++ > MAX_QUEUE_LOOPS)
+	break;
+    }
+  }
+
+  return(queued_pkts);
+}
+
+/* ************************************* */
+
+/* This code is mostly coming from af_packet.c */
+/* SO_SET_TX_RING */
+static int set_tx_ring(struct pf_ring_socket *pfr, struct pfring_tx_ring_req *req)
+{
+  u_int32_t num_slots = 1, slot_len;
+  u_int64_t tot_mem;
+  FlowSlotTxInfo *tx_ring;
+
+  if((req->num_slots == 0) || (req->num_slots > MAX_TX_RING_SLOTS)
+     || (req->max_pkt_len == 0) || (req->max_pkt_len > 0xFFFF))
+    return(-EINVAL);
+
+  while(num_slots < req->num_slots)
+    num_slots <<= 1;
+
+  slot_len = ALIGN(sizeof(struct pfring_tx_slot) + req->max_pkt_len, 8);
+  tot_mem = PAGE_ALIGN(sizeof(FlowSlotTxInfo) + (u_int64_t)num_slots * slot_len);
+
+  if(tot_mem > (1 << 30))
+    return(-EINVAL);
+
+  /* Zeroed: both indexes start at 0 */
+  if((tx_ring = vmalloc_user(tot_mem)) == NULL)
+    return(-ENOMEM);
+
+  tx_ring->version = PFRING_TX_RING_VERSION;
+  tx_ring->num_slots = num_slots, tx_ring->slot_len = slot_len;
+  tx_ring->tot_mem = tot_mem;
+
+  mutex_lock(&pfr->tx_ring_lock);
+
+  /* Once per socket: it may be mmap()ed already */
+  if(pfr->tx_ring == NULL)
+    pfr->tx_ring = tx_ring, tx_ring = NULL;
+
+  mutex_unlock(&pfr->tx_ring_lock);
+
+  if(tx_ring != NULL) {
+    vfree(tx_ring);
+    return(-EBUSY);
+  }
+
+  if(debug_on())
+    printk("[PF_RING] TX ring: %u slots of %u bytes\n", num_slots, slot_len);
+
+  return(0);
+}
+
+/* ************************************* */
+
+/*
+ * SO_FLUSH_TX_RING: sends the slots userland queued up to insert_idx,
+ * a skb each. Returns the number of packets sent.
+ */
+static int flush_tx_ring(struct sock *sk, struct pf_ring_socket *pfr)
+{
+  FlowSlotTxInfo *tx_ring = pfr->tx_ring;
+  struct net_device *dev = pfr->ring_netdev->dev;
+  u_int32_t insert_idx, num_sent = 0, num_errors = 0;
+
+  if(tx_ring == NULL)
+    return(-EINVAL);
+
+  if(dev == NULL)
+    return(-ENODEV);
+
+  if(!(dev->flags & IFF_UP))
+    return(-ENETDOWN);
+
+  mutex_lock(&pfr->tx_ring_lock);
 
-/* ************************************* */
+  insert_idx = *(volatile u_int32_t*)&tx_ring->insert_idx;
+  smp_rmb(); /* the slots before insert_idx have been written */
 
-static int ring_recvmsg(struct kiocb *iocb, struct socket *sock,
-			struct msghdr *msg, size_t len, int flags)
-{
-  struct pf_ring_socket *pfr = ring_sk(sock->sk);
-  u_int32_t queued_pkts, num_loops = 0;
+  /* Never trust userland with more than a ring worth of slots */
+  if((insert_idx - tx_ring->remove_idx) > tx_ring->num_slots)
+    insert_idx = tx_ring->remove_idx + tx_ring->num_slots;
 
-  if(unlikely(enable_debug))
-    printk("[PF_RING] ring_recvmsg called\n");
+  while(tx_ring->remove_idx != insert_idx) {
+    struct pfring_tx_slot *slot = (struct pfring_tx_slot*)((char*)tx_ring + sizeof(FlowSlotTxInfo)
+							   + (tx_ring->remove_idx & (tx_ring->num_slots - 1)) * tx_ring->slot_len);
+    u_int32_t len = *(volatile u_int32_t*)&slot->len; /* read once: userland can rewrite it */
+    struct sk_buff *skb = NULL;
 
-  pfr->ring_active = 1;
+    if((len > 0)
+       && (len <= (tx_ring->slot_len - sizeof(struct pfring_tx_slot)))
+       && (len <= (dev->mtu + dev->hard_header_len)))
+      skb = alloc_skb(len + LL_RESERVED_SPACE(dev), GFP_KERNEL);
 
-  while((queued_pkts = num_queued_pkts(pfr)) < MIN_QUEUED_PKTS) {
-    wait_event_interruptible(pfr->ring_slots_waitqueue, 1);
+    if(skb != NULL) {
+      skb_reserve(skb, LL_RESERVED_SPACE(dev));
+      memcpy(skb_put(skb, len), &slot[1], len);
+      skb_reset_mac_header(skb);
+      skb_reset_network_header(skb);
+      skb->protocol = ((dev->type == ARPHRD_ETHER) && (len >= ETH_HLEN)) ? eth_hdr(skb)->h_proto : 0;
+      skb->dev = dev;
+      skb->priority = sk->sk_priority;
 
-    if(unlikely(enable_debug))
-      printk("[PF_RING] -> ring_recvmsg "
-	     "[queued_pkts=%d][num_loops=%d]\n",
-	     queued_pkts, num_loops);
+      if(dev_queue_xmit(skb) == NETDEV_TX_OK)
+	num_sent++;
+      else
+	num_errors++;
+    } else
+      num_errors++;
 
-    if(queued_pkts > 0) {
-      if(num_loops++ > MAX_QUEUE_LOOPS)
-	break;
-    }
+    tx_ring->remove_idx++;
   }
 
-  return(queued_pkts);
+  tx_ring->tot_sent += num_sent, tx_ring->tot_errors += num_errors;
+
+  mutex_unlock(&pfr->tx_ring_lock);
+
+  if(pfr->slots_info != NULL)
+    pfr->slots_info->good_pkt_sent += num_sent, pfr->slots_info->pkt_send_error += num_errors;
+
+  return(num_sent);
 }
 
 /* ************************************* */
 
-/* This code is mostly coming from af_packet.c */
 static int ring_sendmsg(struct kiocb *iocb, struct socket *sock,
 			struct msghdr *msg, size_t len)
 {
@@ -5820,8 +9879,9 @@ unsigned int ring_poll(struct file *file,
 {
   struct pf_ring_socket *pfr = ring_sk(sock->sk);
   int rc, mask = 0;
+  u_int32_t num_queued;
 
-  /* if(unlikely(enable_debug))
+  /* if(debug_on())
     printk("[PF_RING] -- poll called\n"); */
 
   pfr->num_poll_calls++;
@@ -5829,13 +9889,18 @@ unsigned int ring_poll(struct file *file,
   if(unlikely(pfr->ring_shutdown))
     return(mask);
 
+  if(pfr->shared_cursor != NULL)
+    return(shared_ring_reader_poll(file, pfr, wait));
+
   if(pfr->dna_device == NULL) {
     /* PF_RING mode (No DNA) */
 
-    /* if(unlikely(enable_debug))
+    /* if(debug_on())
       printk("[PF_RING] poll called (non DNA device)\n"); */
 
     pfr->ring_active = 1;
+    pfr->consumer_woken = 0;
+    fold_ring_stats(pfr);
     // smp_rmb();
 
     if(pfr->tx.enable_tx_with_bounce && pfr->header_len == long_pkt_header) {
@@ -5846,27 +9911,41 @@ unsigned int ring_poll(struct file *file,
 
     /* printk("Before [num_queued_pkts(pfr)=%u]\n", num_queued_pkts(pfr)); */
 
-    if(num_queued_pkts(pfr) < pfr->poll_num_pkts_watermark) {
+    if((num_queued = num_queued_pkts(pfr)) < pfr->poll_num_pkts_watermark) {
       poll_wait(file, &pfr->ring_slots_waitqueue, wait);
       // smp_mb();
+
+      /* Left under the watermark: bound the wait as for new packets */
+      if(num_queued > 0)
+	arm_poll_timer(pfr);
     }
 
     /* printk("After [num_queued_pkts(pfr)=%u]\n", num_queued_pkts(pfr)); */
 
-    if(num_queued_pkts(pfr) >= pfr->poll_num_pkts_watermark)
+    num_queued = num_queued_pkts(pfr);
+
+    if(num_queued >= pfr->poll_num_pkts_watermark)
       mask |= POLLIN | POLLRDNORM;
 
+    if(pfr->poll_timer_expired) {
+      /* Also when empty: the next packet restarts the timer */
+      pfr->poll_timer_expired = 0;
+
+      if(num_queued > 0)
+	mask |= POLLIN | POLLRDNORM;
+    }
+
     return(mask);
   } else {
     /* DNA mode */
     /* enable_debug = 1;  */
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] poll called on DNA device [%d]\n",
 	     *pfr->dna_device->interrupt_received);
 
     if(pfr->dna_device->wait_packet_function_ptr == NULL) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] wait_packet_function_ptr is NULL: returning to caller\n");
 
       return(0);
@@ -5874,25 +9953,44 @@ unsigned int ring_poll(struct file *file,
 
     rc = pfr->dna_device->wait_packet_function_ptr(pfr->dna_device->adapter_ptr, 1);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] wait_packet_function_ptr(1) returned %d\n", rc);
 
     if(rc == 0) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] calling poll_wait()\n");
 
+      pfr->dna_wait.sleeps++, pfr->dna_wait.slept = 1;
+      pfr->dna_wait.consecutive_busy = 0;
+
       /* No packet arrived yet */
       poll_wait(file, pfr->dna_device->packet_waitqueue, wait);
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] poll_wait() just returned\n");
-    } else
-      rc = pfr->dna_device->wait_packet_function_ptr(pfr->dna_device->adapter_ptr, 0);
+    } else {
+      if(pfr->dna_wait.slept)
+	pfr->dna_wait.wakeups++, pfr->dna_wait.slept = 0;
+      else
+	pfr->dna_wait.busy_polls++;
+
+      /*
+	Stop-and-go traffic finds packets once per wakeup: the interrupt
+	stays armed for the next gap instead of being disabled and enabled
+	again (two register writes). Only a queue busy for more than
+	dna_irq_hold_polls polls in a row runs without it.
+      */
+      if(++pfr->dna_wait.consecutive_busy > dna_irq_hold_polls) {
+	rc = pfr->dna_device->wait_packet_function_ptr(pfr->dna_device->adapter_ptr, 0);
+	pfr->dna_wait.disarms++;
+	pfr->dna_wait.consecutive_busy = dna_irq_hold_polls; /* no wrap */
+      }
+    }
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] wait_packet_function_ptr(0) returned %d\n", rc);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] poll %s return [%d]\n",
 	     pfr->ring_netdev->dev->name,
 	     *pfr->dna_device->interrupt_received);
@@ -5907,6 +10005,17 @@ unsigned int ring_poll(struct file *file,
 
 /* ************************************* */
 
+/* Even spread of the buckets over the current members */
+static void reset_cluster_indirection(struct ring_cluster *el)
+{
+  int i;
+
+  for(i = 0; i < CLUSTER_INDIRECTION_LEN; i++)
+    el->indirection[i] = el->num_cluster_elements ? (i % el->num_cluster_elements) : 0;
+}
+
+/* ************************************* */
+
 int add_sock_to_cluster_list(ring_cluster_element * el, struct sock *sock)
 {
   if(el->cluster.num_cluster_elements == CLUSTER_LEN)
@@ -5915,6 +10024,7 @@ int add_sock_to_cluster_list(ring_cluster_element * el, struct sock *sock)
   ring_sk_datatype(ring_sk(sock))->cluster_id = el->cluster.cluster_id;
   el->cluster.sk[el->cluster.num_cluster_elements] = sock;
   el->cluster.num_cluster_elements++;
+  reset_cluster_indirection(&el->cluster);
   return(0);
 }
 
@@ -5939,6 +10049,7 @@ int remove_from_cluster_list(struct ring_cluster *el, struct sock *sock)
 	memset(el->sk, 0, sizeof(el->sk));
       }
 
+      reset_cluster_indirection(el);
       return(0);
     }
 
@@ -5952,7 +10063,7 @@ static int remove_from_cluster(struct sock *sock, struct pf_ring_socket *pfr)
   ring_cluster_element *cluster_ptr;
   u_int32_t last_list_idx;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> remove_from_cluster(%d)\n", pfr->cluster_id);
 
   if(pfr->cluster_id == 0 /* 0 = No Cluster */ )
@@ -5988,11 +10099,12 @@ static int set_master_ring(struct sock *sock,
   u_int32_t last_list_idx;
   struct sock *sk;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] set_master_ring(%s=%d)\n",
 	   pfr->ring_netdev->dev ? pfr->ring_netdev->dev->name : "none",
 	   master_socket_id);
 
+  rcu_read_lock();
   sk = (struct sock*)lockless_list_get_first(&ring_table, &last_list_idx);
 
   while(sk != NULL) {
@@ -6003,7 +10115,7 @@ static int set_master_ring(struct sock *sock,
     if((pfr != NULL) && (pfr->ring_id == master_socket_id)) {
       pfr->master_ring = pfr;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Found set_master_ring(%s) -> %s\n",
 	       pfr->ring_netdev->dev ? pfr->ring_netdev->dev->name : "none",
 	       pfr->master_ring->ring_netdev->dev->name);
@@ -6011,7 +10123,7 @@ static int set_master_ring(struct sock *sock,
       rc = 0;
       break;
     } else {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Skipping socket(%s)=%d\n",
 	       pfr->ring_netdev->dev ? pfr->ring_netdev->dev->name : "none",
 	       pfr->ring_id);
@@ -6019,8 +10131,9 @@ static int set_master_ring(struct sock *sock,
 
     sk = (struct sock*)lockless_list_get_next(&ring_table, &last_list_idx);
   }
+  rcu_read_unlock();
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] set_master_ring(%s, socket_id=%d) = %d\n",
 	   pfr->ring_netdev->dev ? pfr->ring_netdev->dev->name : "none",
 	   master_socket_id, rc);
@@ -6037,7 +10150,7 @@ static int add_sock_to_cluster(struct sock *sock,
   ring_cluster_element *cluster_ptr;
   u_int32_t last_list_idx;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> add_sock_to_cluster(%d)\n", cluster->clusterId);
 
   if(cluster->clusterId == 0 /* 0 = No Cluster */ )
@@ -6069,6 +10182,7 @@ static int add_sock_to_cluster(struct sock *sock,
 
   memset(cluster_ptr->cluster.sk, 0, sizeof(cluster_ptr->cluster.sk));
   cluster_ptr->cluster.sk[0] = sock;
+  reset_cluster_indirection(&cluster_ptr->cluster);
   pfr->cluster_id = cluster->clusterId;
   lockless_list_add(&ring_cluster_list, cluster_ptr);
 
@@ -6077,12 +10191,43 @@ static int add_sock_to_cluster(struct sock *sock,
 
 /* ************************************* */
 
+static int set_cluster_indirection(struct pf_ring_socket *pfr,
+				   struct cluster_indirection *table)
+{
+  ring_cluster_element *cluster_ptr;
+  u_int32_t last_list_idx;
+  int i;
+
+  if(pfr->cluster_id == 0 /* 0 = No Cluster */ )
+    return(-EINVAL);
+
+  cluster_ptr = (ring_cluster_element*)lockless_list_get_first(&ring_cluster_list, &last_list_idx);
+
+  while(cluster_ptr != NULL) {
+    if(cluster_ptr->cluster.cluster_id == pfr->cluster_id) {
+      for(i = 0; i < CLUSTER_INDIRECTION_LEN; i++)
+	if(table->element[i] >= cluster_ptr->cluster.num_cluster_elements)
+	  return(-EINVAL);
+
+      /* Byte stores: readers see either the old or the new member of a bucket */
+      memcpy(cluster_ptr->cluster.indirection, table->element, CLUSTER_INDIRECTION_LEN);
+      return(0);
+    }
+
+    cluster_ptr = (ring_cluster_element*)lockless_list_get_next(&ring_cluster_list, &last_list_idx);
+  }
+
+  return(-EINVAL);	/* Not found */
+}
+
+/* ************************************* */
+
 static int ring_map_dna_device(struct pf_ring_socket *pfr,
 			       dna_device_mapping *mapping)
 {
   struct list_head *ptr, *tmp_ptr;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_map_dna_device(%s@%d): %s\n",
 	   mapping->device_name,
 	   mapping->channel_id,
@@ -6108,7 +10253,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
 	  }
 
 	if(!found) {
-	  if(unlikely(enable_debug))
+	  if(debug_on())
 	    printk("[PF_RING] ring_map_dna_device(remove_device_mapping, %s, %u): something got wrong\n",
 		   mapping->device_name, mapping->channel_id);
 	  return(-1); /* Something got wrong */
@@ -6117,7 +10262,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
 	entry->num_bound_sockets--;
 
 	if(pfr->dna_device != NULL) {
-	  if(unlikely(enable_debug))
+	  if(debug_on())
 	    printk("[PF_RING] ring_map_dna_device(%s): removed mapping [num_bound_sockets=%u]\n",
 		   mapping->device_name, entry->num_bound_sockets);
 	  pfr->dna_device->usage_notification(pfr->dna_device->adapter_ptr, 0 /* unlock */);
@@ -6127,7 +10272,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
       }
     }
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] ring_map_dna_device(%s): removed mapping\n", mapping->device_name);
 
     return(0);
@@ -6141,7 +10286,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
 	 && (entry->dev.channel_id == mapping->channel_id)) {
 	int i, found = 0;
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] ==>> %s@%d [num_bound_sockets=%d][%p]\n",
 		 entry->dev.netdev->name, mapping->channel_id,
 		 entry->num_bound_sockets, entry);
@@ -6154,7 +10299,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
 	  }
 
 	if(!found) {
-	  if(unlikely(enable_debug))
+	  if(debug_on())
 	    printk("[PF_RING] ring_map_dna_device(add_device_mapping, %s, %u, %s): "
 		   "something got wrong (too many DNA devices open)\n",
 		   mapping->device_name, mapping->channel_id, direction2string(pfr->mode));
@@ -6166,7 +10311,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
 
 	pfr->dna_device = &entry->dev, pfr->ring_netdev->dev = entry->dev.netdev /* Default */;
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] ring_map_dna_device(%s, %u): added mapping\n",
 		 mapping->device_name, mapping->channel_id);
 
@@ -6175,7 +10320,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
 	  ring_device_element *dev_ptr = list_entry(ptr, ring_device_element, device_list);
 
 	  if(!strcmp(dev_ptr->dev->name, mapping->device_name)) {
-	    if(unlikely(enable_debug))
+	    if(debug_on())
 	      printk("[PF_RING] ==>> %s [%p]\n", dev_ptr->dev->name, dev_ptr);
 	    pfr->ring_netdev = dev_ptr;
 	    break;
@@ -6183,7 +10328,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
 	}
 
 	/* Lock driver */
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] ===> ring_map_dna_device(%s): added mapping [num_bound_sockets=%u]\n",
 		 mapping->device_name, entry->num_bound_sockets);
 	pfr->dna_device->usage_notification(pfr->dna_device->adapter_ptr, 1 /* lock */);
@@ -6194,7 +10339,7 @@ static int ring_map_dna_device(struct pf_ring_socket *pfr,
     }
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] ring_map_dna_device(%s, %u): mapping failed or not a dna device\n",
 	   mapping->device_name, mapping->channel_id);
 
@@ -6210,19 +10355,21 @@ static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
   unsigned long expire_jiffies =
     jiffies - msecs_to_jiffies(1000 * rule_inactivity);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] purge_idle_hash_rules(rule_inactivity=%d)\n",
 	   rule_inactivity);
 
   /* Free filtering hash rules inactive for more than rule_inactivity seconds */
   if(pfr->sw_filtering_hash != NULL) {
-    for(i = 0; i < DEFAULT_RING_HASH_SIZE; i++) {
-      if(pfr->sw_filtering_hash[i] != NULL) {
-	sw_filtering_hash_bucket *scan = pfr->sw_filtering_hash[i], *next, *prev = NULL;
+    struct sw_filtering_hash_table *t = pfr->sw_filtering_hash;
+
+    for(i = 0; i < t->size; i++) {
+      if(t->chain[i] != NULL) {
+	sw_filtering_hash_bucket *scan = t->chain[i], *next;
 
 	while(scan != NULL) {
 	  int rc = 0;
-	  next = scan->next;
+	  next = scan->next[t->link];
 
           if(scan->rule.plugin_action.plugin_id > 0
              && plugin_registration[scan->rule.plugin_action.plugin_id]
@@ -6233,7 +10380,7 @@ static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
 	  if(scan->rule.internals.jiffies_last_match < expire_jiffies || rc > 0) {
 	    /* Expired rule: free it */
 
-	    if(unlikely(enable_debug))
+	    if(debug_on())
 	      printk ("[PF_RING] Purging hash rule "
 		      /* "[last_match=%u][expire_jiffies=%u]" */
 		      "[%d.%d.%d.%d:%d <-> %d.%d.%d.%d:%d][purged=%d][tot_rules=%d]\n",
@@ -6254,18 +10401,13 @@ static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
 		      num_purged_rules,
 		      pfr->num_sw_filtering_rules);
 
-	    free_sw_filtering_hash_bucket(scan);
-	    kfree(scan);
-
-	    if(prev == NULL)
-	      pfr->sw_filtering_hash[i] = next;
-	    else
-	      prev->next = next;
+	    hash_rules_unlink(pfr, scan);
+	    hash_rules_wheel_del(scan);
+	    call_rcu(&scan->rcu, free_sw_filtering_hash_bucket_rcu);
 
-	    pfr->num_sw_filtering_rules--;
+	    pfr->num_sw_filtering_rules--, pfr->num_sw_filtering_hash_rules--;
 	    num_purged_rules++;
-	  } else
-	    prev = scan;
+	  }
 
 	  scan = next;
 	}
@@ -6273,7 +10415,7 @@ static void purge_idle_hash_rules(struct pf_ring_socket *pfr,
     }
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] Purged %d hash rules [tot_rules=%d]\n",
 	   num_purged_rules, pfr->num_sw_filtering_rules);
 }
@@ -6288,7 +10430,7 @@ static void purge_idle_rules(struct pf_ring_socket *pfr,
   unsigned long expire_jiffies =
     jiffies - msecs_to_jiffies(1000 * rule_inactivity);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] %s(rule_inactivity=%d) [num_sw_filtering_rules=%d]\n",
 	   __FUNCTION__, rule_inactivity, pfr->num_sw_filtering_rules);
 
@@ -6309,7 +10451,7 @@ static void purge_idle_rules(struct pf_ring_socket *pfr,
       if((!entry->rule.locked && entry->rule.internals.jiffies_last_match < expire_jiffies) || rc > 0) {
         /* Expired rule: free it */
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk ("[PF_RING] Purging rule "
 		  // "[last_match=%u][expire_jiffies=%u]"
 		  "[%d.%d.%d.%d:%d -> %d.%d.%d.%d:%d][purged=%d][tot_rules=%d]\n",
@@ -6332,19 +10474,42 @@ static void purge_idle_rules(struct pf_ring_socket *pfr,
         free_filtering_rule(entry, 0);
         kfree(entry);
 
-        pfr->num_sw_filtering_rules--;
+        pfr->num_sw_filtering_rules--, pfr->sw_filtering_rules_gen++;
         num_purged_rules++;
       }
     }
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] Purged %d rules [tot_rules=%d]\n",
 	   num_purged_rules, pfr->num_sw_filtering_rules);
 }
 
 /* ************************************* */
 
+static void set_poll_watermark(struct pf_ring_socket *pfr, u_int32_t watermark)
+{
+  u_int16_t threshold;
+
+  if(pfr->slots_info != NULL)
+    threshold = pfr->slots_info->min_num_slots/2;
+  else
+    threshold = min_num_slots;
+
+  if(watermark > threshold)
+    watermark = threshold;
+
+  if(watermark == 0)
+    watermark = 1;
+
+  pfr->poll_num_pkts_watermark = watermark;
+
+  if(debug_on())
+    printk("[PF_RING] --> SO_SET_POLL_WATERMARK=%d\n", pfr->poll_num_pkts_watermark);
+}
+
+/* ************************************* */
+
 /* Code taken/inspired from core/sock.c */
 static int ring_setsockopt(struct socket *sock,
 			   int level, int optname,
@@ -6356,6 +10521,7 @@ static int ring_setsockopt(struct socket *sock,
 {
   struct pf_ring_socket *pfr = ring_sk(sock->sk);
   int val, found, ret = 0 /* OK */, i;
+  u_int8_t needed_parse;
   u_int32_t ring_id;
   struct add_to_cluster cluster;
   u_int32_t channel_id;
@@ -6376,16 +10542,16 @@ static int ring_setsockopt(struct socket *sock,
   if(get_user(val, (int *)optval))
     return -EFAULT;
 
-  found = 1;
+  found = 1, needed_parse = ring_needs_parse(pfr);
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> ring_setsockopt(optname=%u)\n", optname);
 
   switch(optname) {
   case SO_ATTACH_FILTER:
     ret = -EINVAL;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] BPF filter (%d)\n", 0);
 
     if(optlen == sizeof(struct sock_fprog)) {
@@ -6395,7 +10561,7 @@ static int ring_setsockopt(struct socket *sock,
 
       ret = -EFAULT;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] BPF filter (%d)\n", 1);
 
       /*
@@ -6431,6 +10597,8 @@ static int ring_setsockopt(struct socket *sock,
 	break;
       }
 
+      compile_bpf_filter(filter);
+
       old_filter = pfr->bpfFilter;
 
       /* get the lock, set the filter, release the lock */
@@ -6439,24 +10607,24 @@ static int ring_setsockopt(struct socket *sock,
       write_unlock_bh(&pfr->ring_rules_lock);
 
       if(old_filter != NULL)
-        kfree(old_filter);
+        free_bpf_filter(old_filter);
 
       ret = 0;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] BPF filter attached successfully [len=%d]\n",
 	       filter->len);
     }
     break;
 
   case SO_DETACH_FILTER:
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] Removing BPF filter [%p]\n", pfr->bpfFilter);
 
     write_lock_bh(&pfr->ring_rules_lock);
     found = 1;
     if(pfr->bpfFilter != NULL) {
-      kfree(pfr->bpfFilter);
+      free_bpf_filter(pfr->bpfFilter);
       pfr->bpfFilter = NULL;
     } else
       ret = -ENONET;
@@ -6474,12 +10642,30 @@ static int ring_setsockopt(struct socket *sock,
     write_lock_bh(&pfr->ring_rules_lock);
     ret = add_sock_to_cluster(sock->sk, pfr, &cluster);
     write_unlock_bh(&pfr->ring_rules_lock);
+    rebuild_dispatch_tables();
     break;
 
   case SO_REMOVE_FROM_CLUSTER:
     write_lock_bh(&pfr->ring_rules_lock);
     ret = remove_from_cluster(sock->sk, pfr);
     write_unlock_bh(&pfr->ring_rules_lock);
+    rebuild_dispatch_tables();
+    break;
+
+  case SO_SET_CLUSTER_INDIRECTION:
+    {
+      struct cluster_indirection table;
+
+      if(optlen != sizeof(table))
+	return -EINVAL;
+
+      if(copy_from_user(&table, optval, sizeof(table)))
+	return -EFAULT;
+
+      write_lock_bh(&pfr->ring_rules_lock);
+      ret = set_cluster_indirection(pfr, &table);
+      write_unlock_bh(&pfr->ring_rules_lock);
+    }
     break;
 
   case SO_SET_CHANNEL_ID:
@@ -6513,7 +10699,7 @@ static int ring_setsockopt(struct socket *sock,
       u_int32_t the_bit = 1 << i;
 
       if((channel_id & the_bit) == the_bit) {
-        if(unlikely(enable_debug)) printk("[PF_RING] Setting channel %d\n", i);
+        if(debug_on()) printk("[PF_RING] Setting channel %d\n", i);
 
 	if (quick_mode) {
 	  device_rings[pfr->ring_netdev->dev->ifindex][i] = pfr;
@@ -6524,10 +10710,12 @@ static int ring_setsockopt(struct socket *sock,
     }
 
     pfr->channel_id = channel_id;
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] [pfr->channel_id=%d][channel_id=%d]\n",
 	     pfr->channel_id, channel_id);
 
+    rebuild_dispatch_tables();
+
     ret = 0;
     break;
 
@@ -6558,7 +10746,9 @@ static int ring_setsockopt(struct socket *sock,
       return -EFAULT;
 
     pfr->direction = direction;
-    if(unlikely(enable_debug))
+    ring_update_accept(pfr);
+    rebuild_dispatch_tables(); /* channel_accept */
+    if(debug_on())
       printk("[PF_RING] SO_SET_PACKET_DIRECTION [pfr->direction=%s][direction=%s]\n",
 	     direction2string(pfr->direction), direction2string(direction));
 
@@ -6573,7 +10763,9 @@ static int ring_setsockopt(struct socket *sock,
       return -EFAULT;
 
     pfr->mode = sockmode;
-    if(unlikely(enable_debug))
+    ring_update_accept(pfr);
+    rebuild_dispatch_tables(); /* channel_accept */
+    if(debug_on())
       printk("[PF_RING] SO_SET_LINK_DIRECTION [pfr->mode=%s][mode=%s]\n",
 	     sockmode2string(pfr->mode), sockmode2string(sockmode));
 
@@ -6596,6 +10788,94 @@ static int ring_setsockopt(struct socket *sock,
     }
     break;
 
+  case SO_SET_HASH_RULES_IDLE_TIMEOUT:
+    if(optlen != sizeof(rule_inactivity))
+      return -EINVAL;
+
+    if(copy_from_user(&rule_inactivity, optval, sizeof(rule_inactivity)))
+      return -EFAULT;
+
+    write_lock_bh(&pfr->ring_rules_lock);
+    pfr->hash_rules_idle_timeout = rule_inactivity;
+    hash_rules_wheel_rebuild(pfr);
+    if(rule_inactivity > 0)
+      mod_timer(&pfr->hash_rules_wheel.timer, jiffies + HZ);
+    write_unlock_bh(&pfr->ring_rules_lock);
+
+    if(rule_inactivity == 0)
+      del_timer_sync(&pfr->hash_rules_wheel.timer); /* the handler takes ring_rules_lock */
+    ret = 0;
+    break;
+
+  case SO_SET_PREFIX_BLOCKLIST:
+    {
+      struct pfring_prefix_blocklist list;
+      struct pfring_blocklist_prefix *prefixes;
+      struct prefix_blocklist *blocklist = NULL, *old;
+
+      if(optlen < sizeof(list))
+	return -EINVAL;
+
+      if(copy_from_user(&list, optval, sizeof(list)))
+	return -EFAULT;
+
+      if((list.num_prefixes > MAX_BLOCKLIST_PREFIXES)
+	 || (optlen != sizeof(list) + list.num_prefixes * sizeof(struct pfring_blocklist_prefix)))
+	return -EINVAL;
+
+      if(list.num_prefixes > 0) {
+	if((prefixes = vmalloc(optlen - sizeof(list))) == NULL)
+	  return -ENOMEM;
+
+	if(copy_from_user(prefixes, optval + sizeof(list), optlen - sizeof(list)))
+	  ret = -EFAULT;
+	else
+	  ret = build_prefix_blocklist(prefixes, list.num_prefixes, &blocklist);
+
+	vfree(prefixes);
+
+	if(ret != 0)
+	  return(ret);
+      }
+
+      write_lock_bh(&pfr->ring_rules_lock); /* against another setsockopt() */
+      old = pfr->prefix_blocklist;
+      rcu_assign_pointer(pfr->prefix_blocklist, blocklist);
+      write_unlock_bh(&pfr->ring_rules_lock);
+
+      if(old != NULL) {
+	synchronize_rcu(); /* no packet handler looks at it anymore */
+	free_prefix_blocklist(old);
+      }
+
+      found = 1;
+    }
+    break;
+
+  case SO_SET_HASH_RULES_TABLE:
+    {
+      struct pfring_hash_rules_table conf;
+
+      if(optlen != sizeof(conf))
+	return -EINVAL;
+
+      if(copy_from_user(&conf, optval, sizeof(conf)))
+	return -EFAULT;
+
+      if(conf.size > MAX_RING_HASH_SIZE)
+	return -EINVAL;
+
+      write_lock_bh(&pfr->ring_rules_lock);
+      pfr->hash_rules_table_size = conf.size ? roundup_pow_of_two(conf.size) : DEFAULT_RING_HASH_SIZE;
+      pfr->max_hash_rules = conf.max_rules;
+      write_unlock_bh(&pfr->ring_rules_lock);
+
+      /* Allocated now, or doubled if it is smaller: never shrunk */
+      prepare_hash_rules_table(pfr);
+      found = 1;
+    }
+    break;
+
   case SO_PURGE_IDLE_RULES:
     if(optlen != sizeof(rule_inactivity))
       return -EINVAL;
@@ -6607,6 +10887,7 @@ static int ring_setsockopt(struct socket *sock,
 	write_lock_bh(&pfr->ring_rules_lock);
 	purge_idle_rules(pfr, rule_inactivity);
 	write_unlock_bh(&pfr->ring_rules_lock);
+	rebuild_wildcard_rules_classifier(pfr);
       }
       ret = 0;
     }
@@ -6625,7 +10906,7 @@ static int ring_setsockopt(struct socket *sock,
       pfr->sw_filtering_rules_default_accept_policy = new_policy;
       write_unlock_bh(&pfr->ring_rules_lock);
       /*
-	if(unlikely(enable_debug))
+	if(debug_on())
 	printk("[PF_RING] SO_TOGGLE_FILTER_POLICY: default policy is %s\n",
 	pfr->sw_filtering_rules_default_accept_policy ? "accept" : "drop");
       */
@@ -6633,7 +10914,7 @@ static int ring_setsockopt(struct socket *sock,
     break;
 
   case SO_ADD_FILTERING_RULE:
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] +++ SO_ADD_FILTERING_RULE(len=%d)(len=%u)\n",
 	     optlen, (unsigned int)sizeof(ip_addr));
 
@@ -6644,7 +10925,7 @@ static int ring_setsockopt(struct socket *sock,
       int ret;
       sw_filtering_rule_element *rule;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] Allocating memory [filtering_rule]\n");
 
       rule =(sw_filtering_rule_element *)
@@ -6656,6 +10937,11 @@ static int ring_setsockopt(struct socket *sock,
       if(copy_from_user(&rule->rule, optval, optlen))
 	return -EFAULT;
 
+      if((ret = init_rule_internals(&rule->rule.internals, rule->rule.rule_action, &rule->rule.rate_limit)) != 0) {
+        kfree(rule);
+        return(ret);
+      }
+
       INIT_LIST_HEAD(&rule->list);
 
       write_lock_bh(&pfr->ring_rules_lock);
@@ -6663,9 +10949,12 @@ static int ring_setsockopt(struct socket *sock,
       write_unlock_bh(&pfr->ring_rules_lock);
 
       if(ret != 0) { /* even if rc == -EEXIST */
+        free_rule_internals(&rule->rule.internals);
         kfree(rule);
         return(ret);
       }
+
+      rebuild_wildcard_rules_classifier(pfr);
     } else if(optlen == sizeof(hash_filtering_rule)) {
       /* This is a hash rule */
       int ret;
@@ -6677,70 +10966,203 @@ static int ring_setsockopt(struct socket *sock,
       if(rule == NULL)
 	return -EFAULT;
 
-      if(copy_from_user(&rule->rule, optval, optlen))
-	return -EFAULT;
+      if(copy_from_user(&rule->rule, optval, optlen))
+	return -EFAULT;
+
+      if((ret = init_rule_internals(&rule->rule.internals, rule->rule.rule_action, &rule->rule.rate_limit)) != 0) {
+        kfree(rule);
+        return(ret);
+      }
+
+      prepare_hash_rules_table(pfr); /* may sleep */
+
+      write_lock_bh(&pfr->ring_rules_lock);
+      ret = handle_sw_filtering_hash_bucket(pfr, rule, 1 /* add */);
+      write_unlock_bh(&pfr->ring_rules_lock);
+
+      if(ret != 0) { /* even if rc == -EEXIST */
+        free_rule_internals(&rule->rule.internals);
+        kfree(rule);
+        return(ret);
+      }
+    } else {
+      printk("[PF_RING] Bad rule length (%d): discarded\n", optlen);
+      return -EFAULT;
+    }
+    break;
+
+  case SO_REMOVE_FILTERING_RULE:
+    if(pfr->ring_netdev == &none_device_element) return -EFAULT;
+
+    if(optlen == sizeof(u_int16_t /* rule_id */ )) {
+      /* This is a list rule */
+      int rc;
+
+      if(copy_from_user(&rule_id, optval, optlen))
+	return -EFAULT;
+
+      write_lock_bh(&pfr->ring_rules_lock);
+      rc = remove_sw_filtering_rule_element(pfr, rule_id);
+      write_unlock_bh(&pfr->ring_rules_lock);
+      rebuild_wildcard_rules_classifier(pfr);
+
+      if (rc == 0) {
+	if(debug_on())
+	  printk("[PF_RING] SO_REMOVE_FILTERING_RULE: rule %d does not exist\n", rule_id);
+	return -EFAULT;	/* Rule not found */
+      }
+    } else if(optlen == sizeof(hash_filtering_rule)) {
+      /* This is a hash rule */
+      sw_filtering_hash_bucket rule;
+      int rc;
+
+      if(copy_from_user(&rule.rule, optval, optlen))
+	return -EFAULT;
+
+      write_lock_bh(&pfr->ring_rules_lock);
+      rc = handle_sw_filtering_hash_bucket(pfr, &rule, 0 /* delete */ );
+      write_unlock_bh(&pfr->ring_rules_lock);
+
+      if(rc != 0)
+	return(rc);
+    } else
+      return -EFAULT;
+    break;
+
+  case SO_ADD_HASH_FILTERING_RULES:
+  case SO_REMOVE_HASH_FILTERING_RULES:
+    if(pfr->ring_netdev == &none_device_element)
+      return -EFAULT;
+
+    if((ret = handle_sw_filtering_hash_buckets(pfr, optval, optlen,
+					       optname == SO_ADD_HASH_FILTERING_RULES)) != 0)
+      return(ret);
+    break;
+
+  case SO_SET_SAMPLING_RATE:
+    if(optlen != sizeof(pfr->sample_rate))
+      return -EINVAL;
+
+    if(copy_from_user(&pfr->sample_rate, optval, sizeof(pfr->sample_rate)))
+      return -EFAULT;
+    break;
+
+  case SO_SET_FLOW_SAMPLING_RATE:
+    {
+      u_int32_t rate;
+
+      if(optlen != sizeof(rate))
+	return -EINVAL;
+
+      if(copy_from_user(&rate, optval, sizeof(rate)))
+	return -EFAULT;
+
+      pfr->flow_sample_threshold = pfring_flow_sampling_threshold(rate);
+    }
+    break;
+
+  case SO_SET_FLOW_CACHE_LIFETIME:
+    {
+      struct flow_cache __percpu *cache;
+      u_int32_t msec;
+
+      if(optlen != sizeof(msec))
+	return -EINVAL;
+
+      if(copy_from_user(&msec, optval, sizeof(msec)))
+	return -EFAULT;
+
+      /* Allocated once, freed by ring_release(): the packet path uses it without lock */
+      if((msec > 0) && (pfr->flow_cache == NULL)) {
+	if((cache = alloc_percpu(struct flow_cache)) == NULL)
+	  return -ENOMEM;
+
+	if(cmpxchg(&pfr->flow_cache, NULL, cache) != NULL)
+	  free_percpu(cache);
+      }
+
+      pfr->flow_cache_lifetime = msecs_to_jiffies(msec);
+    }
+    break;
+
+  case SO_SET_OVERLOAD_POLICY:
+    {
+      struct pfring_overload_policy policy;
+
+      if(optlen != sizeof(policy))
+	return -EINVAL;
+
+      if(copy_from_user(&policy, optval, sizeof(policy)))
+	return -EFAULT;
+
+      if((policy.flags & ~PFRING_OVERLOAD_EARLY_DROP)
+	 || (policy.sample_threshold >= 100)
+	 || ((policy.sample_threshold > 0) && (policy.max_sample_rate < 2)))
+	return -EINVAL;
+
+      /* The fast path reads it unlocked: never a threshold without its rate */
+      pfr->overload.flags = pfr->overload.sample_threshold = 0;
+      smp_wmb();
+      pfr->overload.max_sample_rate = policy.max_sample_rate;
+      smp_wmb();
+      pfr->overload.flags = policy.flags, pfr->overload.sample_threshold = policy.sample_threshold;
 
-      write_lock_bh(&pfr->ring_rules_lock);
-      ret = handle_sw_filtering_hash_bucket(pfr, rule, 1 /* add */);
-      write_unlock_bh(&pfr->ring_rules_lock);
+      if(pfr->slots_info != NULL)
+	pfr->slots_info->overload_sample_rate = 1;
 
-      if(ret != 0) { /* even if rc == -EEXIST */
-        kfree(rule);
-        return(ret);
-      }
-    } else {
-      printk("[PF_RING] Bad rule length (%d): discarded\n", optlen);
-      return -EFAULT;
+      found = 1;
     }
     break;
 
-  case SO_REMOVE_FILTERING_RULE:
-    if(pfr->ring_netdev == &none_device_element) return -EFAULT;
+  case SO_SET_SHARED_RING:
+    {
+      struct pfring_shared_ring info;
 
-    if(optlen == sizeof(u_int16_t /* rule_id */ )) {
-      /* This is a list rule */
-      int rc;
+      if(optlen != sizeof(info))
+	return -EINVAL;
 
-      if(copy_from_user(&rule_id, optval, optlen))
+      if(copy_from_user(&info, optval, sizeof(info)))
 	return -EFAULT;
 
-      write_lock_bh(&pfr->ring_rules_lock);
-      rc = remove_sw_filtering_rule_element(pfr, rule_id);
-      write_unlock_bh(&pfr->ring_rules_lock);
-
-      if (rc == 0) {
-	if(unlikely(enable_debug))
-	  printk("[PF_RING] SO_REMOVE_FILTERING_RULE: rule %d does not exist\n", rule_id);
-	return -EFAULT;	/* Rule not found */
-      }
-    } else if(optlen == sizeof(hash_filtering_rule)) {
-      /* This is a hash rule */
-      sw_filtering_hash_bucket rule;
-      int rc;
+      if((info.shared_ring_id == 0) || (info.policy > PFRING_SHARED_RING_DROP_SLOWEST))
+	return -EINVAL;
 
-      if(copy_from_user(&rule.rule, optval, optlen))
-	return -EFAULT;
+      /* Readers map the ring as it is: a single area, already allocated */
+      if((pfr->ring_memory == NULL) || (pfr->num_sub_rings > 1) || (pfr->shared_ring != NULL)
+	 || (pfr->userspace_ring != NULL) || (pfr->dna_device != NULL))
+	return -EINVAL;
 
-      write_lock_bh(&pfr->ring_rules_lock);
-      rc = handle_sw_filtering_hash_bucket(pfr, &rule, 0 /* delete */ );
-      write_unlock_bh(&pfr->ring_rules_lock);
+      if((ret = shared_ring_create(pfr, &info)) < 0)
+	return ret;
 
-      if(rc != 0)
-	return(rc);
-    } else
-      return -EFAULT;
+      found = 1;
+    }
     break;
 
-  case SO_SET_SAMPLING_RATE:
-    if(optlen != sizeof(pfr->sample_rate))
-      return -EINVAL;
+  case SO_ATTACH_SHARED_RING:
+    {
+      u_int32_t shared_ring_id;
 
-    if(copy_from_user(&pfr->sample_rate, optval, sizeof(pfr->sample_rate)))
-      return -EFAULT;
+      if(optlen != sizeof(shared_ring_id))
+	return -EINVAL;
+
+      if(copy_from_user(&shared_ring_id, optval, sizeof(shared_ring_id)))
+	return -EFAULT;
+
+      /* Before mmap(): a reader has no ring of its own */
+      if((pfr->ring_memory != NULL) || (pfr->shared_ring != NULL) || (pfr->userspace_ring != NULL)
+	 || (pfr->ring_netdev != &none_device_element))
+	return -EINVAL;
+
+      if((ret = shared_ring_attach(pfr, shared_ring_id)) < 0)
+	return ret;
+
+      found = 1;
+    }
     break;
 
   case SO_ACTIVATE_RING:
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] * SO_ACTIVATE_RING *\n");
 
     if(pfr->dna_device_entry != NULL) {
@@ -6765,7 +11187,7 @@ static int ring_setsockopt(struct socket *sock,
     break;
 
   case SO_DEACTIVATE_RING:
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] * SO_DEACTIVATE_RING *\n");
     found = 1, pfr->ring_active = 0;
     break;
@@ -6774,24 +11196,103 @@ static int ring_setsockopt(struct socket *sock,
     if(optlen != sizeof(u_int16_t))
       return -EINVAL;
     else {
-      u_int16_t threshold;
+      u_int16_t watermark;
 
-      if(pfr->slots_info != NULL)
-	threshold = pfr->slots_info->min_num_slots/2;
-      else
-	threshold = min_num_slots;
+      if(copy_from_user(&watermark, optval, optlen))
+	return -EFAULT;
+
+      set_poll_watermark(pfr, watermark);
+      found = 1;
+    }
+    break;
+
+  case SO_SET_TX_RING:
+    {
+      struct pfring_tx_ring_req req;
+      int rc;
+
+      if(optlen != sizeof(req))
+	return -EINVAL;
+
+      if(copy_from_user(&req, optval, sizeof(req)))
+	return -EFAULT;
+
+      if((rc = set_tx_ring(pfr, &req)) < 0)
+	return rc;
+
+      found = 1;
+    }
+    break;
+
+  case SO_FLUSH_TX_RING:
+    {
+      int rc;
+
+      if((rc = flush_tx_ring(sock->sk, pfr)) < 0)
+	return rc;
+
+      found = 1;
+    }
+    break;
+
+  case SO_SET_INSERT_TIMESTAMP:
+    {
+      u_int32_t enable;
+
+      if(optlen != sizeof(enable))
+	return -EINVAL;
+
+      if(copy_from_user(&enable, optval, sizeof(enable)))
+	return -EFAULT;
+
+      pfr->insert_timestamp = enable ? 1 : 0;
+      found = 1;
+    }
+    break;
+
+  case SO_SET_TIMESTAMP_MODE:
+    {
+      u_int32_t mode;
+
+      if(optlen != sizeof(mode))
+	return -EINVAL;
+
+      if(copy_from_user(&mode, optval, sizeof(mode)))
+	return -EFAULT;
+
+      if(mode > PFRING_TSTAMP_HW)
+	return -EINVAL;
+
+      pfr->tstamp_mode = mode;
+      rebuild_dispatch_tables(); /* The finest mode of the devices */
+      found = 1;
+    }
+    break;
+
+  case SO_SET_POLL_COALESCING:
+    {
+      struct pfring_poll_coalescing pc;
+
+      if(optlen != sizeof(pc))
+	return -EINVAL;
 
-      if(copy_from_user(&pfr->poll_num_pkts_watermark, optval, optlen))
+      if(copy_from_user(&pc, optval, sizeof(pc)))
 	return -EFAULT;
 
-      if(pfr->poll_num_pkts_watermark > threshold)
-	pfr->poll_num_pkts_watermark = threshold;
+      if(pc.usec > MAX_POLL_COALESCING_USEC)
+	return -EINVAL;
+
+      set_poll_watermark(pfr, pc.num_pkts);
+
+      /* A pending timer would not be armed again */
+      if(hrtimer_cancel(&pfr->poll_timer))
+	atomic_set(&pfr->poll_timer_armed, 0);
 
-      if(pfr->poll_num_pkts_watermark == 0)
-	pfr->poll_num_pkts_watermark = 1;
+      pfr->poll_coalescing_usec = pc.usec;
 
-      if(unlikely(enable_debug))
-	printk("[PF_RING] --> SO_SET_POLL_WATERMARK=%d\n", pfr->poll_num_pkts_watermark);
+      if(debug_on())
+	printk("[PF_RING] --> SO_SET_POLL_COALESCING=%d pkts/%u usec\n",
+	       pfr->poll_num_pkts_watermark, pfr->poll_coalescing_usec);
 
       found = 1;
     }
@@ -6804,7 +11305,7 @@ static int ring_setsockopt(struct socket *sock,
       if(copy_from_user(&pfr->bucket_len, optval, optlen))
 	return -EFAULT;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] --> SO_RING_BUCKET_LEN=%d\n", pfr->bucket_len);
 
       found = 1;
@@ -6863,7 +11364,7 @@ static int ring_setsockopt(struct socket *sock,
     if(ret != -1) {
       hw_filtering_rule_element *rule;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
         printk("[PF_RING] New hw filtering rule [id=%d]\n", hw_rule.rule_id);
 
       /* Add the hw rule to the socket hw rule list */
@@ -6890,6 +11391,18 @@ static int ring_setsockopt(struct socket *sock,
     found = 1;
     break;
 
+  case SO_ADD_HW_FILTERING_RULES:
+  case SO_DEL_HW_FILTERING_RULES:
+    if(pfr->ring_netdev == &none_device_element)
+      return -EFAULT;
+
+    if((ret = handle_hw_filtering_rules_bulk(pfr, optval, optlen,
+					     optname == SO_ADD_HW_FILTERING_RULES)) != 0)
+      return(ret);
+
+    found = 1;
+    break;
+
   case SO_DEL_HW_FILTERING_RULE:
     if(optlen != sizeof(u_int16_t))
       return -EINVAL;
@@ -6961,7 +11474,7 @@ static int ring_setsockopt(struct socket *sock,
       /* Notify the consumer that we're ready to start */
       if(pfr->kernel_consumer_plugin_id
 	 && (plugin_registration[pfr->kernel_consumer_plugin_id] == NULL)) {
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] Plugin %d is unknown\n", pfr->kernel_consumer_plugin_id);
 
 	pfr->kernel_consumer_plugin_id = 0;
@@ -6997,7 +11510,7 @@ static int ring_setsockopt(struct socket *sock,
     break;
 
   case SO_REHASH_RSS_PACKET:
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] * SO_REHASH_RSS_PACKET *\n");
 
     found = 1, pfr->rehash_rss = 1;
@@ -7025,9 +11538,44 @@ static int ring_setsockopt(struct socket *sock,
     break;
 
   case SO_SET_VPFRING_CLEAN_EVENTFDS:
+    if(hrtimer_cancel(&pfr->vpfring_timer))
+      atomic_set(&pfr->vpfring_timer_armed, 0);
     if(pfr->vpfring_host_eventfd_ctx)
       eventfd_ctx_put(pfr->vpfring_host_eventfd_ctx);
     pfr->vpfring_host_eventfd_ctx = NULL;
+    atomic_set(&pfr->vpfring_pending, 0);
+    break;
+
+  case SO_SET_VPFRING_COALESCING:
+    {
+      struct vpfring_coalescing vc;
+
+      if(optlen != sizeof(vc))
+	return -EINVAL;
+
+      if(copy_from_user(&vc, optval, sizeof(vc)))
+	return -EFAULT;
+
+      if(vc.usec > MAX_VPFRING_COALESCING_USEC)
+	return -EINVAL;
+
+      /* A pending timer would not be armed again */
+      if(hrtimer_cancel(&pfr->vpfring_timer))
+	atomic_set(&pfr->vpfring_timer_armed, 0);
+
+      pfr->vpfring_coalescing_pkts = vc.num_pkts ? vc.num_pkts : 1;
+      pfr->vpfring_coalescing_usec = vc.usec;
+
+      /* Nothing left behind by the previous thresholds */
+      if(pfr->vpfring_host_eventfd_ctx)
+	vpfring_signal(pfr);
+
+      if(debug_on())
+	printk("[PF_RING] --> SO_SET_VPFRING_COALESCING=%u pkts/%u usec\n",
+	       pfr->vpfring_coalescing_pkts, pfr->vpfring_coalescing_usec);
+
+      found = 1;
+    }
     break;
 #endif //VPFRING_SUPPORT
 
@@ -7041,7 +11589,7 @@ static int ring_setsockopt(struct socket *sock,
       u_dev_name[sizeof(u_dev_name) - 1] = '\0';
 
       if(pfr->ring_memory != NULL) {
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] SO_ATTACH_USERSPACE_RING (1) [%s]\n", u_dev_name);
 
         return -EINVAL; /* TODO mmap() already called */
@@ -7051,7 +11599,7 @@ static int ring_setsockopt(struct socket *sock,
       pfr->userspace_ring = userspace_ring_create(u_dev_name, userspace_ring_producer, NULL);
 
       if(pfr->userspace_ring == NULL) {
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] SO_ATTACH_USERSPACE_RING (2) [%s]\n", u_dev_name);
 
         return -EINVAL;
@@ -7059,7 +11607,7 @@ static int ring_setsockopt(struct socket *sock,
 
       pfr->userspace_ring_type = userspace_ring_producer;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
         printk("[PF_RING] SO_ATTACH_USERSPACE_RING done [%s]\n", u_dev_name);
     }
 
@@ -7098,7 +11646,7 @@ static int ring_setsockopt(struct socket *sock,
 					    &cdnaci.recovered);
 
       if(pfr->dna_cluster == NULL) {
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] SO_CREATE_DNA_CLUSTER [%u]\n", cdnaci.cluster_id);
 
         return -EINVAL;
@@ -7121,7 +11669,7 @@ static int ring_setsockopt(struct socket *sock,
         return -EFAULT;
       }
 
-      if(unlikely(enable_debug))
+      if(debug_on())
         printk("[PF_RING] SO_CREATE_DNA_CLUSTER done [%u]\n", cdnaci.cluster_id);
     }
 
@@ -7138,7 +11686,7 @@ static int ring_setsockopt(struct socket *sock,
       pfr->dna_cluster = dna_cluster_attach(adnaci.cluster_id, &pfr->ring_slots_waitqueue, &adnaci.slave_id, &adnaci.mode);
 
       if(pfr->dna_cluster == NULL) {
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] SO_ATTACH_DNA_CLUSTER [%u]\n", adnaci.cluster_id);
 
         return -EINVAL;
@@ -7153,7 +11701,7 @@ static int ring_setsockopt(struct socket *sock,
         return -EFAULT;
       }
 
-      if(unlikely(enable_debug))
+      if(debug_on())
         printk("[PF_RING] SO_ATTACH_USERSPACE_RING done [%u]\n", adnaci.cluster_id);
     }
 
@@ -7181,15 +11729,115 @@ static int ring_setsockopt(struct socket *sock,
     found = 1, pfr->header_len = short_pkt_header;
     break;
 
+  case SO_SET_METADATA_ONLY:
+    /* The slot layout is fixed when the ring memory is allocated */
+    if((pfr->ring_memory != NULL) || (pfr->userspace_ring != NULL) || pfr->tx.enable_tx_with_bounce)
+      return -EINVAL;
+
+    found = 1, pfr->header_len = compact_pkt_header, pfr->metadata_only = 1;
+    break;
+
+  case SO_SET_PKT_HEADER_FORMAT:
+    {
+      u_int32_t version;
+
+      if(optlen != sizeof(version))
+	return -EINVAL;
+
+      if(copy_from_user(&version, optval, sizeof(version)))
+	return -EFAULT;
+
+      /* Only one compact layout so far: refuse the ones to come */
+      if(version != PFRING_COMPACT_HDR_V1)
+	return -EINVAL;
+
+      if((pfr->ring_memory != NULL) || (pfr->userspace_ring != NULL) || pfr->tx.enable_tx_with_bounce)
+	return -EINVAL;
+
+      found = 1, pfr->header_len = compact_pkt_header;
+    }
+    break;
+
   case SO_ENABLE_RX_PACKET_BOUNCE:
+    /* Bounced packets are only looked for in the first sub-ring */
+    if(pfr->num_sub_rings > 1)
+      return -EINVAL;
+
     found = 1, pfr->tx.enable_tx_with_bounce = 1;
     break;
 
+  case SO_SET_PERCPU_RINGS:
+    {
+      u_int32_t num_sub_rings;
+
+      if(optlen != sizeof(num_sub_rings))
+	return -EINVAL;
+
+      if(copy_from_user(&num_sub_rings, optval, sizeof(num_sub_rings)))
+	return -EFAULT;
+
+      /* The layout is decided when the ring memory is allocated (first mmap) */
+      if((pfr->ring_memory != NULL) || (pfr->userspace_ring != NULL)
+	 || (pfr->dna_device != NULL) || pfr->tx.enable_tx_with_bounce)
+	return -EINVAL;
+
+      if(num_sub_rings == 0)
+	num_sub_rings = nr_cpu_ids;
+
+      pfr->num_sub_rings = min_val(num_sub_rings, MAX_NUM_SUB_RINGS);
+
+      if(debug_on())
+	printk("[PF_RING] %d per-CPU sub-rings\n", pfr->num_sub_rings);
+    }
+    break;
+
+  case SO_SET_SLOT_LAYOUT:
+    {
+      u_int32_t layout;
+
+      if(optlen != sizeof(layout))
+	return -EINVAL;
+
+      if(copy_from_user(&layout, optval, sizeof(layout)))
+	return -EFAULT;
+
+      /* The aligned layout is decided when the ring memory is allocated */
+      if((layout & ~(PFRING_SLOT_ALIGNED | PFRING_SLOT_NT_COPY))
+	 || (((layout ^ pfr->slot_layout) & PFRING_SLOT_ALIGNED)
+	     && ((pfr->ring_memory != NULL) || (pfr->userspace_ring != NULL))))
+	return -EINVAL;
+
+      found = 1, pfr->slot_layout = layout;
+    }
+    break;
+
+  case SO_SET_RING_MEM_POLICY:
+    {
+      u_int32_t policy;
+
+      if(optlen != sizeof(policy))
+	return -EINVAL;
+
+      if(copy_from_user(&policy, optval, sizeof(policy)))
+	return -EFAULT;
+
+      if((policy & ~(PFRING_MEM_NUMA_LOCAL | PFRING_MEM_CONTIGUOUS))
+	 || (pfr->ring_memory != NULL) || (pfr->userspace_ring != NULL))
+	return -EINVAL;
+
+      found = 1, pfr->ring_mem_policy = policy;
+    }
+    break;
+
   default:
     found = 0;
     break;
   }
 
+  /* Rules, header format...: the devices may have to parse, or no longer */
+  if(found && (ring_needs_parse(pfr) != needed_parse))
+    rebuild_dispatch_tables();
+
   if(found)
     return(ret);
   else
@@ -7215,7 +11863,7 @@ static int ring_getsockopt(struct socket *sock,
   if(len < 0)
     return -EINVAL;
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] --> getsockopt(%d)\n", optname);
 
   switch (optname) {
@@ -7237,6 +11885,10 @@ static int ring_getsockopt(struct socket *sock,
       if(len < sizeof(struct tpacket_stats))
 	return -EINVAL;
 
+      if(pfr->slots_info == NULL)
+	return -EINVAL;
+
+      fold_ring_stats(pfr);
       st.tp_packets = pfr->slots_info->tot_insert;
       st.tp_drops = pfr->slots_info->tot_lost;
 
@@ -7263,7 +11915,7 @@ static int ring_getsockopt(struct socket *sock,
 	  return -EFAULT;
 	}
 
-	if(unlikely(enable_debug))
+	if(debug_on())
 	  printk("[PF_RING] so_get_hash_filtering_rule_stats"
 		 "(vlan=%u, proto=%u, sip=%u, sport=%u, dip=%u, dport=%u)\n",
 		 rule.vlan_id, rule.proto,
@@ -7271,17 +11923,13 @@ static int ring_getsockopt(struct socket *sock,
 		 rule.host4_peer_b,
 		 rule.port_peer_b);
 
-	hash_idx = hash_pkt(rule.vlan_id, rule.proto,
-			    rule.host_peer_a, rule.host_peer_b,
-			    rule.port_peer_a, rule.port_peer_b) % DEFAULT_RING_HASH_SIZE;
+	read_lock_bh(&pfr->ring_rules_lock);
+	hash_idx = hash_rules_table_idx(pfr->sw_filtering_hash, &rule);
 
-	if(pfr->sw_filtering_hash[hash_idx] != NULL) {
-	  sw_filtering_hash_bucket *bucket;
+	if(pfr->sw_filtering_hash->chain[hash_idx] != NULL) {
+	  sw_filtering_hash_bucket *bucket = pfr->sw_filtering_hash->chain[hash_idx];
 
-	  read_lock_bh(&pfr->ring_rules_lock);
-	  bucket = pfr->sw_filtering_hash[hash_idx];
-
-	  if(unlikely(enable_debug))
+	  if(debug_on())
 	    printk("[PF_RING] so_get_hash_filtering_rule_stats(): bucket=%p\n",
 		   bucket);
 
@@ -7293,7 +11941,10 @@ static int ring_getsockopt(struct socket *sock,
 		printk("[PF_RING] so_get_hash_filtering_rule_stats() no memory failure\n");
 		rc = -EFAULT;
 	      } else {
-		if((plugin_registration[rule.plugin_action.plugin_id] == NULL)
+		if((bucket->rule.plugin_action.plugin_id == NO_PLUGIN_ID)
+		   && (len >= sizeof(struct pfring_rule_reflect_stats)))
+		  rc = get_rule_reflect_stats(&bucket->rule.internals, buffer);
+		else if((plugin_registration[rule.plugin_action.plugin_id] == NULL)
 		   ||
 		   (plugin_registration[rule.plugin_action.plugin_id]->pfring_plugin_get_stats == NULL)) {
 		  printk("[PF_RING] Found rule but pluginId %d is not registered\n",
@@ -7312,15 +11963,15 @@ static int ring_getsockopt(struct socket *sock,
 	      }
 	      break;
 	    } else
-	      bucket = bucket->next;
+	      bucket = bucket->next[pfr->sw_filtering_hash->link];
 	  }	/* while */
-
-	  read_unlock_bh(&pfr->ring_rules_lock);
 	} else {
-	  if(unlikely(enable_debug))
+	  if(debug_on())
 	    printk("[PF_RING] so_get_hash_filtering_rule_stats(): entry not found [hash_idx=%d]\n",
 		   hash_idx);
 	}
+
+	read_unlock_bh(&pfr->ring_rules_lock);
       }
 
       return(rc);
@@ -7340,7 +11991,7 @@ static int ring_getsockopt(struct socket *sock,
       if(copy_from_user(&rule_id, optval, sizeof(rule_id)))
 	return -EFAULT;
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] SO_GET_FILTERING_RULE_STATS: rule_id=%d\n",
 	       rule_id);
 
@@ -7356,7 +12007,10 @@ static int ring_getsockopt(struct socket *sock,
 	  if(buffer == NULL)
 	    rc = -EFAULT;
 	  else {
-	    if((plugin_registration[rule->rule.plugin_action.plugin_id] == NULL)
+	    if((rule->rule.plugin_action.plugin_id == NO_PLUGIN_ID)
+	       && (len >= sizeof(struct pfring_rule_reflect_stats)))
+	      rc = get_rule_reflect_stats(&rule->rule.internals, buffer);
+	    else if((plugin_registration[rule->rule.plugin_action.plugin_id] == NULL)
 	       ||
 	       (plugin_registration[rule->rule.plugin_action.plugin_id]->pfring_plugin_get_stats == NULL)) {
 	      printk("[PF_RING] Found rule %d but pluginId %d is not registered\n",
@@ -7446,7 +12100,7 @@ static int ring_getsockopt(struct socket *sock,
 	  num_rx_channels = max_val(pfr->num_rx_channels, get_num_rx_queues(pfr->ring_netdev->dev));
       }
 
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] --> SO_GET_NUM_RX_CHANNELS[%s]=%d [dna=%d/dns_rx_channels=%d][%p]\n",
 	       pfr->ring_netdev->dev->name, num_rx_channels,
 	       pfr->ring_netdev->is_dna_device,
@@ -7462,7 +12116,7 @@ static int ring_getsockopt(struct socket *sock,
     if(len < sizeof(pfr->ring_id))
       return -EINVAL;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] --> SO_GET_RING_ID=%d\n", pfr->ring_id);
 
     if(copy_to_user(optval, &pfr->ring_id, sizeof(pfr->ring_id)))
@@ -7473,7 +12127,7 @@ static int ring_getsockopt(struct socket *sock,
     if(len < sizeof(pfr->kernel_consumer_plugin_id))
       return -EINVAL;
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] --> SO_GET_PACKET_CONSUMER_MODE=%d\n",
 	     pfr->kernel_consumer_plugin_id);
 
@@ -7545,6 +12199,51 @@ static int ring_getsockopt(struct socket *sock,
     }
     break;
 
+  case SO_GET_RING_STATS_EXT:
+    {
+      struct pfring_ring_stats_ext st;
+      int cpu, i;
+
+      if(len < sizeof(st))
+	return -EINVAL;
+
+      memset(&st, 0, sizeof(st));
+
+      if(pfr->shared_cursor != NULL) {
+	/* Shared ring reader: the kernel counters belong to the owner */
+	FlowSlotInfo *si = (FlowSlotInfo*)pfr->shared_ring->ring_memory;
+
+	st.consumer_lost = pfr->shared_cursor->shared_ring_lost;
+	st.num_slots = si->min_num_slots;
+	st.max_queued = min_val(cursor_queued_pkts(si->tot_insert, pfr->shared_cursor->tot_read), si->min_num_slots);
+      } else {
+	if((pfr->slots_info == NULL) || (pfr->userspace_ring != NULL))
+	  return -EINVAL;
+
+	for_each_possible_cpu(cpu) {
+	  struct ring_cpu_stats *s = per_cpu_ptr(pfr->cpu_stats, cpu);
+
+	  st.tot_pkts += s->tot_pkts, st.ring_full += s->tot_lost - s->tot_early_drop;
+	  st.early_drop += s->tot_early_drop, st.overload_sampled += s->tot_sampled;
+	  st.sampled += s->tot_rate_sampled, st.filtered += s->tot_filtered;
+	  st.blocked += s->tot_blocked;
+
+	  /* A racing insert may raise it again before the reset: at worst one interval late */
+	  if(s->max_queued > st.max_queued) st.max_queued = s->max_queued;
+	  s->max_queued = 0;
+	}
+
+	for(i = 0; i < max_val(pfr->num_sub_rings, 1); i++)
+	  st.tot_insert += pfr->sub_slots_info[i]->tot_insert;
+
+	st.num_slots = pfr->slots_info->min_num_slots;
+      }
+
+      if(copy_to_user(optval, &st, sizeof(st)))
+	return -EFAULT;
+    }
+    break;
+
   case SO_GET_PKT_HEADER_LEN:
     if(len < sizeof(pfr->slot_header_len))
       return -EINVAL;
@@ -7553,6 +12252,33 @@ static int ring_getsockopt(struct socket *sock,
       return -EFAULT;
     break;
 
+  case SO_GET_HASH_FILTERING_RULES_STATS:
+    {
+      int rc = get_sw_filtering_hash_buckets_stats(pfr, optval, len);
+
+      if(rc < 0)
+	return(rc);
+
+      len = rc;
+    }
+    break;
+
+  case SO_GET_NUM_HW_FILTERS:
+    {
+      /* Per device: rules installed by any socket, or through /proc */
+      u_int16_t num_filters = 0;
+
+      if(len < sizeof(num_filters))
+	return -EINVAL;
+
+      if(pfr->ring_netdev != &none_device_element)
+	num_filters = pfr->ring_netdev->hw_filters.num_filters;
+
+      if(copy_to_user(optval, &num_filters, sizeof(num_filters)))
+	return -EFAULT;
+    }
+    break;
+
   case SO_GET_BUCKET_LEN:
     if(len < sizeof(pfr->bucket_len))
       return -EINVAL;
@@ -7588,6 +12314,27 @@ static int ring_getsockopt(struct socket *sock,
     }
     break;
 
+  case SO_GET_LOOPBACK_INJECT:
+    {
+      struct pfring_loopback_inject req;
+      int rc;
+
+      if(len < sizeof(req))
+	return -EINVAL;
+
+      if(copy_from_user(&req, optval, sizeof(req)))
+	return -EFAULT;
+
+      if((rc = loopback_inject(pfr, &req)) != 0)
+	return(rc);
+
+      if(copy_to_user(optval, &req, sizeof(req)))
+	return -EFAULT;
+
+      len = sizeof(req);
+    }
+    break;
+
   case SO_GET_DEVICE_TYPE:
     if(len < sizeof(pfring_device_type))
       return -EINVAL;
@@ -7632,7 +12379,7 @@ void dna_device_handler(dna_device_operation operation,
 			dna_wait_packet wait_packet_function_ptr,
 			dna_device_notify dev_notify_function_ptr)
 {
-  if(unlikely(enable_debug)) {
+  if(debug_on()) {
     printk("[PF_RING] dna_device_handler(%s@%u [operation=%s])\n",
 	   netdev->name, channel_id,
 	   operation == add_device_mapping ? "add_device_mapping" : "remove_device_mapping");
@@ -7696,7 +12443,7 @@ void dna_device_handler(dna_device_operation operation,
 	    dev_ptr->num_dna_rx_queues = max_val(dev_ptr->num_dna_rx_queues, channel_id+1);
 	    dev_ptr->is_dna_device = 1, dev_ptr->dna_device_model = device_model;
 
-	    if(unlikely(enable_debug))
+	    if(debug_on())
 	      printk("[PF_RING] ==>> Updating DNA %s [num_dna_rx_queues=%d][%p]\n",
 		     dev_ptr->dev->name, dev_ptr->num_dna_rx_queues, dev_ptr);
 	    break;
@@ -7725,7 +12472,7 @@ void dna_device_handler(dna_device_operation operation,
     }
   }
 
-  if(unlikely(enable_debug))
+  if(debug_on())
     printk("[PF_RING] dna_device_handler(%s): [dna_devices_list_size=%d]\n",
 	   netdev->name, dna_devices_list_size);
 }
@@ -7822,6 +12569,8 @@ static struct pfring_hooks ring_hooks = {
   .pfring_registration = register_plugin,
   .pfring_unregistration = unregister_plugin,
   .ring_dna_device_handler = dna_device_handler,
+  .device_tuning = get_device_tuning,
+  .buffer_rx_ring_handler = buffer_rx_ring_handler,
 };
 
 /* ************************************ */
@@ -7841,6 +12590,7 @@ void remove_device_from_ring_list(struct net_device *dev) {
 	  remove_proc_entry(PROC_RULES, dev_ptr->proc_entry);
 #endif
 
+	remove_proc_entry(PROC_TUNING, dev_ptr->proc_entry);
 	remove_proc_entry(PROC_INFO, dev_ptr->proc_entry);
 	remove_proc_entry(dev_ptr->dev->name, ring_proc_dev_dir);
       }
@@ -7864,6 +12614,8 @@ void remove_device_from_ring_list(struct net_device *dev) {
       break;
     }
   }
+
+  rebuild_dispatch_tables();
 }
 
 /* ************************************ */
@@ -7885,6 +12637,12 @@ int add_device_to_ring_list(struct net_device *dev) {
 			 ring_proc_dev_get_info /* read */,
 			 dev_ptr);
 
+  /* A new device on a recycled ifindex starts from the driver defaults */
+  if(dev->ifindex < MAX_NUM_IFIDX)
+    memset(&device_tuning[dev->ifindex], 0, sizeof(pfring_device_tuning));
+
+  ring_proc_dev_tuning_add(dev_ptr);
+
 #if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31))
   /* Dirty trick to fix at some point used to discover Intel 82599 interfaces: FIXME */
   if((dev_ptr->dev->ethtool_ops != NULL) && (dev_ptr->dev->ethtool_ops->set_rxnfc != NULL)) {
@@ -7895,7 +12653,7 @@ int add_device_to_ring_list(struct net_device *dev) {
 
     rc = dev_ptr->dev->ethtool_ops->set_rxnfc(dev_ptr->dev, &cmd);
 
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] set_rxnfc returned %d\n", rc);
 
     if(rc == RING_MAGIC_VALUE) {
@@ -7912,16 +12670,20 @@ int add_device_to_ring_list(struct net_device *dev) {
 				     ring_proc_dev_rule_read, dev_ptr);
       if(entry) {
 	entry->write_proc = ring_proc_dev_rule_write;
-	if(unlikely(enable_debug)) printk("[PF_RING] Device %s (Intel 82599) DOES support hardware packet filtering\n", dev->name);
+	if(debug_on()) printk("[PF_RING] Device %s (Intel 82599) DOES support hardware packet filtering\n", dev->name);
       } else {
-	if(unlikely(enable_debug)) printk("[PF_RING] Error while creating /proc entry 'rules' for device %s\n", dev->name);
+	if(debug_on()) printk("[PF_RING] Error while creating /proc entry 'rules' for device %s\n", dev->name);
       }
 #endif
+    } else if(rc == CHELSIO_T4_MAGIC_VALUE) {
+      dev_ptr->device_type = chelsio_t4_family;
+      dev_ptr->hw_filters.filter_handlers.t4_filter_handler = chelsio_t4_handler;
+      if(debug_on()) printk("[PF_RING] Device %s (Chelsio T4) DOES support hardware packet filtering\n", dev->name);
     } else {
-      if(unlikely(enable_debug)) printk("[PF_RING] Device %s does NOT support hardware packet filtering [1]\n", dev->name);
+      if(debug_on()) printk("[PF_RING] Device %s does NOT support hardware packet filtering [1]\n", dev->name);
     }
   } else {
-    if(unlikely(enable_debug)) printk("[PF_RING] Device %s does NOT support hardware packet filtering [2]\n", dev->name);
+    if(debug_on()) printk("[PF_RING] Device %s does NOT support hardware packet filtering [2]\n", dev->name);
   }
 #endif
 
@@ -7945,7 +12707,7 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
   struct pfring_hooks *hook;
 
   if(dev != NULL) {
-    if(unlikely(enable_debug))
+    if(debug_on())
       printk("[PF_RING] packet_notifier(%lu) [%s][%d]\n", msg, dev->name, dev->type);
 
     /* Skip non ethernet interfaces */
@@ -7956,12 +12718,12 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
        && (dev->type != ARPHRD_IEEE80211_PRISM)
        && (dev->type != ARPHRD_IEEE80211_RADIOTAP)
        && strncmp(dev->name, "bond", 4)) {
-      if(unlikely(enable_debug)) printk("[PF_RING] packet_notifier(%s): skipping non ethernet device\n", dev->name);
+      if(debug_on()) printk("[PF_RING] packet_notifier(%s): skipping non ethernet device\n", dev->name);
       return NOTIFY_DONE;
     }
 
     if(dev->ifindex >= MAX_NUM_IFIDX) {
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] packet_notifier(%s): interface index %d > max index %d\n",
 	       dev->name, dev->ifindex, MAX_NUM_IFIDX);
       return NOTIFY_DONE;
@@ -7973,7 +12735,7 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
     case NETDEV_DOWN:
       break;
     case NETDEV_REGISTER:
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] packet_notifier(%s) [REGISTER][pfring_ptr=%p][hook=%p]\n",
 	       dev->name, dev->pfring_ptr, &ring_hooks);
 
@@ -7986,7 +12748,7 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
       break;
 
     case NETDEV_UNREGISTER:
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] packet_notifier(%s) [UNREGISTER][pfring_ptr=%p]\n",
 	       dev->name, dev->pfring_ptr);
 
@@ -8009,13 +12771,13 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
       {
 	struct list_head *ptr, *tmp_ptr;
 
-	if(unlikely(enable_debug)) printk("[PF_RING] Device change name %s\n", dev->name);
+	if(debug_on()) printk("[PF_RING] Device change name %s\n", dev->name);
 
 	list_for_each_safe(ptr, tmp_ptr, &ring_aware_device_list) {
 	  ring_device_element *dev_ptr = list_entry(ptr, ring_device_element, device_list);
 
 	  if(dev_ptr->dev == dev) {
-	    if(unlikely(enable_debug))
+	    if(debug_on())
 	      printk("[PF_RING] ==>> FOUND device change name %s -> %s\n",
 		     dev_ptr->proc_entry->name, dev->name);
 
@@ -8025,6 +12787,7 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
 	      remove_proc_entry(PROC_RULES, dev_ptr->proc_entry);
 #endif
 
+	    remove_proc_entry(PROC_TUNING, dev_ptr->proc_entry);
 	    remove_proc_entry(PROC_INFO, dev_ptr->proc_entry);
 	    remove_proc_entry(dev_ptr->proc_entry->name, ring_proc_dev_dir);
 	    /* Add new entry */
@@ -8033,6 +12796,7 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
 				   dev_ptr->proc_entry,
 				   ring_proc_dev_get_info /* read */,
 				   dev_ptr);
+	    ring_proc_dev_tuning_add(dev_ptr);
 
 #ifdef ENABLE_PROC_WRITE_RULE
 #if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,31))
@@ -8062,7 +12826,7 @@ static int ring_notifier(struct notifier_block *this, unsigned long msg, void *d
       break;
 
     default:
-      if(unlikely(enable_debug))
+      if(debug_on())
 	printk("[PF_RING] packet_notifier(%s): unhandled message [msg=%lu][pfring_ptr=%p]\n",
 	       dev->name, msg, dev->pfring_ptr);
       break;
@@ -8102,11 +12866,12 @@ static void __exit ring_exit(void)
       remove_proc_entry(PROC_RULES, dev_ptr->proc_entry);
 #endif
 
+    remove_proc_entry(PROC_TUNING, dev_ptr->proc_entry);
     remove_proc_entry(PROC_INFO, dev_ptr->proc_entry);
     remove_proc_entry(dev_ptr->dev->name, ring_proc_dev_dir);
 
     if(hook->magic == PF_RING) {
-      if(unlikely(enable_debug)) printk("[PF_RING] Unregister hook for %s\n", dev_ptr->dev->name);
+      if(debug_on()) printk("[PF_RING] Unregister hook for %s\n", dev_ptr->dev->name);
       dev_ptr->dev->pfring_ptr = NULL; /* Unhook PF_RING */
     }
 
@@ -8137,6 +12902,13 @@ static void __exit ring_exit(void)
   if(loobpack_test_buffer != NULL)
     kfree(loobpack_test_buffer);
 
+  term_reflect_queues();
+  if(parse_scratch != NULL)
+    free_percpu(parse_scratch);
+  reset_dispatch_tables();
+  ring_mem_pool_drain();
+  rcu_barrier(); /* free_sw_filtering_hash_bucket_rcu() is module code */
+
   printk("[PF_RING] Module unloaded\n");
 }
 
@@ -8173,6 +12945,12 @@ static int __init ring_init(void)
     INIT_LIST_HEAD(&device_ring_list[i]);
 
   init_ring_readers();
+  init_cluster_hash_tables();
+  init_reflect_queues();
+
+  /* Without it plugins kmalloc() their parse memory per packet */
+  if((parse_scratch = alloc_percpu(struct parse_scratch)) == NULL)
+    printk("[PF_RING] Unable to allocate the plugin parse scratch memory\n");
 
   memset(&any_dev, 0, sizeof(any_dev));
   strcpy(any_dev.name, "any");
@@ -8189,6 +12967,8 @@ static int __init ring_init(void)
   memset(&none_device_element, 0, sizeof(none_device_element));
   none_device_element.dev = &none_dev, none_device_element.device_type = standard_nic_family;
 
+  sync_toggle_keys();
+
   ring_proc_init();
   sock_register(&ring_family_ops);
   register_netdevice_notifier(&ring_netdev_notifier);
@@ -0,0 +1,361 @@
+/*
+ *
+ * In-kernel traffic aggregation for DDoS detection (see ddos_plugin.h)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <linux/version.h>
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,18))
+#if(LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,33))
+#include <generated/autoconf.h>
+#else
+#include <linux/autoconf.h>
+#endif
+#else
+#include <linux/config.h>
+#endif
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/socket.h>
+#include <linux/skbuff.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/init.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/list.h>
+#include <linux/proc_fs.h>
+#include <linux/textsearch.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/jiffies.h>
+#include <net/sock.h>
+
+/* Enable plugin PF_RING functions */
+#define PF_RING_PLUGIN
+#include "../linux/pf_ring.h"
+
+#include "ddos_plugin.h"
+
+static struct pfring_plugin_registration reg;
+
+/*
+  Only the CPU owning a table writes it. A table is reused every other
+  second: epoch is set to 0 while it is being cleared so that
+  ddos_plugin_get_stats() never takes a half cleared table for the last
+  complete second.
+*/
+struct ddos_cpu_table {
+  u_int32_t epoch;
+  u_int64_t not_tracked;
+  struct ddos_counters counters;
+  struct ddos_pair pairs[DDOS_PLUGIN_PAIRS];
+};
+
+struct ddos_cpu {
+  struct ddos_counters total;
+  struct ddos_cpu_table table[2]; /* [epoch & 1] */
+};
+
+static struct ddos_cpu **cpu_tables; /* [nr_cpu_ids], allocated on the CPU node */
+static u_int32_t hash_seed;
+
+#define DDOS_TCP_SYN  0x02
+#define DDOS_TCP_ACK  0x10
+
+/* #define DEBUG */
+
+/* ************************************ */
+
+static inline u_int32_t ddos_epoch(void)
+{
+  return((u_int32_t)(jiffies / HZ));
+}
+
+/* ************************************ */
+
+static void count_pkt(struct ddos_counters *c, struct pfring_pkthdr *hdr)
+{
+  switch(hdr->extended_hdr.parsed_pkt.l3_proto) {
+  case IPPROTO_TCP:
+    c->tcp_pkts++, c->tcp_bytes += hdr->len;
+
+    switch(hdr->extended_hdr.parsed_pkt.tcp.flags & (DDOS_TCP_SYN | DDOS_TCP_ACK)) {
+    case DDOS_TCP_SYN:                c->syn++;    break;
+    case DDOS_TCP_SYN | DDOS_TCP_ACK: c->synack++; break;
+    case DDOS_TCP_ACK:                c->ack++;    break;
+    }
+    break;
+  case IPPROTO_UDP:
+    c->udp_pkts++, c->udp_bytes += hdr->len;
+    break;
+  case IPPROTO_ICMP:
+    c->icmp_pkts++, c->icmp_bytes += hdr->len;
+    break;
+  default:
+    c->other_pkts++, c->other_bytes += hdr->len;
+  }
+}
+
+/* ************************************ */
+
+static struct ddos_pair* find_pair(struct ddos_cpu_table *t, u_int32_t src, u_int32_t dst)
+{
+  u_int32_t idx = jhash_2words(src, dst, hash_seed) & (DDOS_PLUGIN_PAIRS - 1);
+  int i;
+
+  for(i = 0; i < DDOS_PLUGIN_MAX_PROBES; i++, idx = (idx + 1) & (DDOS_PLUGIN_PAIRS - 1)) {
+    struct ddos_pair *p = &t->pairs[idx];
+
+    if((p->src == src) && (p->dst == dst))
+      return(p);
+
+    if((p->src == 0) && (p->dst == 0)) {
+      p->src = src, p->dst = dst;
+      return(p);
+    }
+  }
+
+  return(NULL);
+}
+
+/* ************************************ */
+
+static int ddos_plugin_handle_skb(struct pf_ring_socket *pfr,
+				  sw_filtering_rule_element *rule,
+				  sw_filtering_hash_bucket *hash_rule,
+				  struct pfring_pkthdr *hdr,
+				  struct sk_buff *skb, int displ,
+				  u_int16_t filter_plugin_id,
+				  struct parse_buffer **filter_rule_memory_storage,
+				  rule_action_behaviour *behaviour)
+{
+  u_int32_t now = ddos_epoch(), src, dst;
+  struct ddos_cpu_table *t;
+  struct ddos_cpu *c;
+
+  c = cpu_tables[get_cpu()];
+  t = &c->table[now & 1];
+
+  if(unlikely(t->epoch != now)) {
+    /* Two seconds old: start over */
+    t->epoch = 0;
+    smp_wmb();
+    memset(&t->not_tracked, 0, sizeof(struct ddos_cpu_table) - offsetof(struct ddos_cpu_table, not_tracked));
+    smp_wmb();
+    t->epoch = now;
+  }
+
+  count_pkt(&c->total, hdr);
+  count_pkt(&t->counters, hdr);
+
+  src = hdr->extended_hdr.parsed_pkt.ipv4_src, dst = hdr->extended_hdr.parsed_pkt.ipv4_dst;
+
+  if((hdr->extended_hdr.parsed_pkt.ip_version == 4) && (src || dst)) {
+    struct ddos_pair *p = find_pair(t, src, dst);
+
+    if(p != NULL)
+      count_pkt(&p->counters, hdr);
+    else
+      t->not_tracked++;
+  }
+
+  put_cpu();
+
+  /* Counting is the action: then do what the rule says */
+  if(rule != NULL)
+    *behaviour = rule->rule.rule_action;
+  else if(hash_rule != NULL)
+    *behaviour = hash_rule->rule.rule_action;
+
+  return(1);
+}
+
+/* ************************************ */
+
+static void add_counters(struct ddos_counters *to, const struct ddos_counters *from)
+{
+  to->tcp_pkts   += from->tcp_pkts,   to->udp_pkts   += from->udp_pkts;
+  to->icmp_pkts  += from->icmp_pkts,  to->other_pkts += from->other_pkts;
+  to->tcp_bytes  += from->tcp_bytes,  to->udp_bytes  += from->udp_bytes;
+  to->icmp_bytes += from->icmp_bytes, to->other_bytes += from->other_bytes;
+  to->syn += from->syn, to->synack += from->synack, to->ack += from->ack;
+}
+
+/* ************************************ */
+
+/*
+  Keep the heaviest pairs. A pair whose packets are spread over several
+  CPUs (no symmetric RSS) is merged as long as it stays in the top list.
+*/
+static void merge_pair(struct ddos_plugin_stats *stats, const struct ddos_pair *p)
+{
+  u_int32_t i, lightest = 0;
+
+  for(i = 0; i < stats->num_pairs; i++) {
+    if((stats->pairs[i].src == p->src) && (stats->pairs[i].dst == p->dst)) {
+      add_counters(&stats->pairs[i].counters, &p->counters);
+      return;
+    }
+
+    if(ddos_counters_pkts(&stats->pairs[i].counters) < ddos_counters_pkts(&stats->pairs[lightest].counters))
+      lightest = i;
+  }
+
+  if(stats->num_pairs < DDOS_PLUGIN_TOP_PAIRS)
+    stats->pairs[stats->num_pairs++] = *p;
+  else if(ddos_counters_pkts(&p->counters) > ddos_counters_pkts(&stats->pairs[lightest].counters))
+    stats->pairs[lightest] = *p;
+}
+
+/* ************************************ */
+
+static int ddos_plugin_get_stats(struct pf_ring_socket *pfr,
+				 sw_filtering_rule_element *rule,
+				 sw_filtering_hash_bucket  *hash_bucket,
+				 u_char* stats_buffer,
+				 u_int stats_buffer_len)
+{
+  struct ddos_plugin_stats *stats = (struct ddos_plugin_stats*)stats_buffer;
+  u_int32_t last = ddos_epoch() - 1, i, j;
+  int cpu;
+
+  if(stats_buffer_len < sizeof(struct ddos_plugin_stats))
+    return(0);
+
+  memset(stats, 0, sizeof(struct ddos_plugin_stats));
+  stats->epoch = last;
+
+  for_each_possible_cpu(cpu) {
+    struct ddos_cpu *c = cpu_tables[cpu];
+    struct ddos_cpu_table *t = &c->table[last & 1];
+
+    add_counters(&stats->total, &c->total);
+
+    /*
+      Not written anymore: the owner moved to the other table and clears
+      this one only when the next second starts
+    */
+    if(t->epoch != last)
+      continue; /* no traffic on this CPU in the last second */
+
+    smp_rmb();
+    add_counters(&stats->last_second, &t->counters);
+    stats->pairs_not_tracked += t->not_tracked;
+
+    for(i = 0; i < DDOS_PLUGIN_PAIRS; i++) {
+      if(t->pairs[i].src || t->pairs[i].dst)
+	merge_pair(stats, &t->pairs[i]);
+    }
+  }
+
+  /* Heaviest first */
+  for(i = 1; i < stats->num_pairs; i++) {
+    struct ddos_pair p = stats->pairs[i];
+
+    for(j = i; (j > 0) && (ddos_counters_pkts(&stats->pairs[j-1].counters) < ddos_counters_pkts(&p.counters)); j--)
+      stats->pairs[j] = stats->pairs[j-1];
+
+    stats->pairs[j] = p;
+  }
+
+#ifdef DEBUG
+  printk("-> ddos_plugin_get_stats() [epoch=%u][pairs=%u]\n", stats->epoch, stats->num_pairs);
+#endif
+
+  return(sizeof(struct ddos_plugin_stats));
+}
+
+/* ************************************ */
+
+static void ddos_plugin_register(u_int8_t register_plugin) {
+  if(register_plugin)
+    try_module_get(THIS_MODULE); /* Increment usage count */
+  else
+    module_put(THIS_MODULE);	 /* Decrement usage count */
+}
+
+/* ************************************ */
+
+static void free_cpu_tables(void)
+{
+  int cpu;
+
+  if(cpu_tables == NULL)
+    return;
+
+  for_each_possible_cpu(cpu) {
+    if(cpu_tables[cpu] != NULL)
+      vfree(cpu_tables[cpu]);
+  }
+
+  kfree(cpu_tables);
+  cpu_tables = NULL;
+}
+
+/* ************************************ */
+
+static int __init ddos_plugin_init(void)
+{
+  int cpu;
+
+  printk("Welcome to DDoS plugin for PF_RING\n");
+
+  if((cpu_tables = kzalloc(nr_cpu_ids * sizeof(struct ddos_cpu*), GFP_KERNEL)) == NULL)
+    return(-ENOMEM);
+
+  for_each_possible_cpu(cpu) {
+    if((cpu_tables[cpu] = vmalloc_node(sizeof(struct ddos_cpu), cpu_to_node(cpu))) == NULL) {
+      free_cpu_tables();
+      return(-ENOMEM);
+    }
+
+    memset(cpu_tables[cpu], 0, sizeof(struct ddos_cpu));
+  }
+
+  /* Colliding pairs cannot be chosen in advance */
+  get_random_bytes(&hash_seed, sizeof(hash_seed));
+
+  memset(&reg, 0, sizeof(reg));
+
+  reg.plugin_id                = DDOS_PLUGIN_ID;
+  reg.pfring_plugin_handle_skb = ddos_plugin_handle_skb;
+  reg.pfring_plugin_get_stats  = ddos_plugin_get_stats;
+  reg.pfring_plugin_register   = ddos_plugin_register;
+
+  snprintf(reg.name, sizeof(reg.name)-1, "ddos");
+  snprintf(reg.description, sizeof(reg.description)-1, "Per CPU protocol and sIP/dIP counters");
+
+  register_plugin(&reg);
+
+  /* Make sure that PF_RING is loaded when this plugin is loaded */
+  pf_ring_add_module_dependency();
+
+  printk("DDoS plugin started [id=%d][%u bytes per CPU]\n",
+	 DDOS_PLUGIN_ID, (unsigned int)sizeof(struct ddos_cpu));
+  return(0);
+}
+
+/* ************************************ */
+
+static void __exit ddos_plugin_exit(void)
+{
+  printk("Thanks for having used DDoS plugin for PF_RING\n");
+  unregister_plugin(DDOS_PLUGIN_ID);
+
+  /* No rule references the plugin anymore (module usage count) */
+  free_cpu_tables();
+}
+
+/* ************************************ */
+
+module_init(ddos_plugin_init);
+module_exit(ddos_plugin_exit);
+MODULE_LICENSE("GPL");
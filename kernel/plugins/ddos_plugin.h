@@ -0,0 +1,55 @@
+/*
+ *
+ * In-kernel traffic aggregation for DDoS detection
+ *
+ * A rule whose plugin_action is DDOS_PLUGIN_ID counts every packet it
+ * matches: per protocol packets/bytes, TCP SYN/SYN+ACK/ACK and the same
+ * counters per (sIP,dIP) IPv4 pair. Each CPU owns its tables (one per
+ * second, two kept) so that the skb handler never shares a cache line.
+ * pfring_get_filtering_rule_stats() returns a struct ddos_plugin_stats:
+ * the totals and the DDOS_PLUGIN_TOP_PAIRS heaviest pairs of the last
+ * complete second.
+ *
+ * The rule action is honoured after counting: with
+ * dont_forward_packet_and_stop_rule_evaluation the packets are counted
+ * but never copied to the ring.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _DDOS_PLUGIN_H_
+#define _DDOS_PLUGIN_H_
+
+#define DDOS_PLUGIN_ID            2
+
+#define DDOS_PLUGIN_PAIRS         512 /* per CPU and per second, power of 2 */
+#define DDOS_PLUGIN_MAX_PROBES    8   /* then the pair is counted in the totals only */
+#define DDOS_PLUGIN_TOP_PAIRS     32
+
+struct ddos_counters {
+  u_int64_t tcp_pkts, udp_pkts, icmp_pkts, other_pkts;
+  u_int64_t tcp_bytes, udp_bytes, icmp_bytes, other_bytes;
+  u_int64_t syn, synack, ack; /* TCP packets with only these of the SYN/ACK flags */
+};
+
+struct ddos_pair {
+  u_int32_t src, dst; /* IPv4, host byte order: 0/0 = free slot */
+  struct ddos_counters counters;
+};
+
+struct ddos_plugin_stats {
+  struct ddos_counters total;       /* since the plugin has been loaded */
+  struct ddos_counters last_second; /* all the CPUs */
+  u_int64_t pairs_not_tracked;      /* last second packets of the pairs not in a table */
+  u_int32_t epoch;                  /* second (jiffies/HZ) of last_second and pairs[] */
+  u_int32_t num_pairs;
+  struct ddos_pair pairs[DDOS_PLUGIN_TOP_PAIRS]; /* heaviest first */
+};
+
+#define ddos_counters_pkts(c) ((c)->tcp_pkts + (c)->udp_pkts + (c)->icmp_pkts + (c)->other_pkts)
+
+#endif /* _DDOS_PLUGIN_H_ */
@@ -16,6 +16,7 @@
 
 #define __USE_XOPEN2K
 #include <sys/types.h>
+#include <sys/epoll.h>
 #include <pthread.h>
 
 #include "pfring.h"
@@ -27,6 +28,7 @@
 #include "pfring_mod.h"
 
 #include "pfring_mod_usring.h"
+#include "pfring_mod_multi.h"
 
 #ifdef HAVE_DAG
 #include "pfring_mod_dag.h"
@@ -45,6 +47,14 @@ static pfring_module_info pfring_module_list[] = {
     .name = "default",
     .open = pfring_mod_open,
   },
+  { /* before "multi": matched with strstr() */
+    .name = "multits",
+    .open = pfring_mod_multi_ts_open,
+  },
+  {
+    .name = "multi",
+    .open = pfring_mod_multi_open,
+  },
 #ifdef HAVE_VIRTUAL
   { /* vPF_RING (guest-side) */
     .name = "host",
@@ -73,23 +83,18 @@ static pfring_module_info pfring_module_list[] = {
     .name = "userspace",
     .open = pfring_mod_usring_open,
   },
+  { /* reader of a ring shared with pfring_set_shared_ring() */
+    .name = "shared",
+    .open = pfring_mod_shared_open,
+  },
   {0}
 };
 
 /* **************************************************** */
 
-pfring* pfring_open(char *device_name, u_int32_t caplen, u_int32_t flags) {
-  int i = -1;
-  int mod_found = 0;
-  int ret;
-  char *str;
-  pfring *ring;
-
-#ifdef RING_DEBUG
-  printf("[PF_RING] Attempting to pfring_open(%s)\n", device_name);
-#endif
+static pfring* pfring_alloc_handle(u_int32_t caplen, u_int32_t flags) {
+  pfring *ring = (pfring*)malloc(sizeof(pfring));
 
-  ring = (pfring*)malloc(sizeof(pfring));
   if(ring == NULL)
     return NULL;
 
@@ -101,6 +106,64 @@ pfring* pfring_open(char *device_name, u_int32_t caplen, u_int32_t flags) {
   ring->direction   = rx_and_tx_direction;
   ring->mode        = send_and_recv_mode;
   ring->long_header = (flags & PF_RING_LONG_HEADER) ? 1 : 0;
+  ring->percpu_rings = (flags & PF_RING_PERCPU_RINGS) ? 1 : 0;
+  ring->metadata_only = (flags & PF_RING_METADATA_ONLY) ? 1 : 0;
+  ring->compact_header = (ring->metadata_only || (flags & PF_RING_COMPACT_HEADER)) ? 1 : 0;
+  ring->ring_mem_policy = ((flags & PF_RING_NUMA_LOCAL_MEM) ? PFRING_MEM_NUMA_LOCAL : 0)
+    | ((flags & PF_RING_CONTIGUOUS_MEM) ? PFRING_MEM_CONTIGUOUS : 0);
+  ring->slot_layout = ((flags & PF_RING_ALIGNED_SLOTS) ? PFRING_SLOT_ALIGNED : 0)
+    | ((flags & PF_RING_NT_COPY) ? PFRING_SLOT_NT_COPY : 0);
+
+  pfring_resolve_simd(ring);
+  return ring;
+}
+
+/* **************************************************** */
+
+static void pfring_handle_ready(pfring *ring) {
+  if(unlikely(ring->reentrant)) {
+    pthread_rwlock_init(&ring->rx_lock, PTHREAD_PROCESS_PRIVATE);
+    pthread_rwlock_init(&ring->tx_lock, PTHREAD_PROCESS_PRIVATE);
+  }
+
+  ring->socket_default_accept_policy = 1; /* Accept (default) */
+
+  ring->rdi.device_id = ring->rdi.port_id = -1; /* Default */
+
+  ring->initialized = 1;
+}
+
+/* **************************************************** */
+
+static void pfring_free_handle(pfring *ring) {
+  pfring_userspace_bpf_remove(ring);
+
+  if(unlikely(ring->reentrant)) {
+    pthread_rwlock_destroy(&ring->rx_lock);
+    pthread_rwlock_destroy(&ring->tx_lock);
+  }
+
+  free(ring->rdi.offloaded);
+  free(ring->t4.offloaded);
+  free(ring->device_name);
+  free(ring);
+}
+
+/* **************************************************** */
+
+pfring* pfring_open(char *device_name, u_int32_t caplen, u_int32_t flags) {
+  int i = -1;
+  int mod_found = 0;
+  int ret;
+  char *str;
+  pfring *ring;
+
+#ifdef RING_DEBUG
+  printf("[PF_RING] Attempting to pfring_open(%s)\n", device_name);
+#endif
+
+  if((ring = pfring_alloc_handle(caplen, flags)) == NULL)
+    return NULL;
 
 #ifdef RING_DEBUG
   printf("pfring_open: device_name=%s\n", device_name);
@@ -143,16 +206,7 @@ pfring* pfring_open(char *device_name, u_int32_t caplen, u_int32_t flags) {
     return NULL;
   }
 
-  if(unlikely(ring->reentrant)) {
-    pthread_rwlock_init(&ring->rx_lock, PTHREAD_PROCESS_PRIVATE);
-    pthread_rwlock_init(&ring->tx_lock, PTHREAD_PROCESS_PRIVATE);
-  }
-
-  ring->socket_default_accept_policy = 1; /* Accept (default) */
-
-  ring->rdi.device_id = ring->rdi.port_id = -1; /* Default */
-
-  ring->initialized = 1;
+  pfring_handle_ready(ring);
 
 #ifdef RING_DEBUG
   printf("[PF_RING] Successfully open pfring_open(%s)\n", device_name);
@@ -163,6 +217,29 @@ pfring* pfring_open(char *device_name, u_int32_t caplen, u_int32_t flags) {
 
 /* **************************************************** */
 
+pfring* pfring_open_fd(int fd, char *device_name, u_int32_t caplen, u_int32_t flags) {
+  pfring *ring;
+
+  if((ring = pfring_alloc_handle(caplen, flags)) == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  ring->fd = fd, ring->adopted = 1;
+  ring->device_name = strdup(device_name ? device_name : "any");
+
+  if(pfring_mod_open(ring) < 0) {
+    free(ring->device_name);
+    free(ring);
+    return NULL;
+  }
+
+  pfring_handle_ready(ring);
+  return ring;
+}
+
+/* **************************************************** */
+
 pfring* pfring_open_consumer(char *device_name, u_int32_t caplen, u_int32_t flags,
 			     u_int8_t consumer_plugin_id,
 			     char* consumer_data, u_int consumer_data_len) {
@@ -227,6 +304,116 @@ u_int8_t pfring_open_multichannel(char *device_name, u_int32_t caplen,
 
 /* **************************************************** */
 
+struct channel_open {
+  char dev[32];
+  u_int32_t channel_id;
+  const pfring_channel_config *config;
+  pfring *ring;
+};
+
+static int configure_channel(pfring *ring, u_int32_t channel_id, const pfring_channel_config *config) {
+  if(config->appl_name != NULL) {
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s %u", config->appl_name, channel_id);
+    pfring_set_application_name(ring, name);
+  }
+
+  /* DNA is RX only: the ring keeps its direction */
+  pfring_set_direction(ring, config->direction);
+
+  if(pfring_set_socket_mode(ring, config->mode) != 0)
+    return(-1);
+
+  if((config->poll_watermark > 0) && (pfring_set_poll_watermark(ring, config->poll_watermark) != 0))
+    return(-1);
+
+  if(config->poll_duration > 0)
+    pfring_set_poll_duration(ring, config->poll_duration);
+
+  if(config->rehash_rss && (pfring_enable_rss_rehash(ring) != 0))
+    return(-1);
+
+  if(config->enable && (pfring_enable_ring(ring) != 0))
+    return(-1);
+
+  return(0);
+}
+
+static void* open_channel_thread(void *_c) {
+  struct channel_open *c = (struct channel_open*)_c;
+
+  if((c->ring = pfring_open(c->dev, c->config->caplen, c->config->flags)) != NULL
+     && (configure_channel(c->ring, c->channel_id, c->config) != 0)) {
+    pfring_close(c->ring);
+    c->ring = NULL;
+  }
+
+  return(NULL);
+}
+
+/* **************************************************** */
+
+/*
+  Each pfring_open() allocates and maps its ring: zero-filling MBs per
+  channel, done in parallel and not one channel after the other.
+*/
+int pfring_open_multichannel_config(char *device_name, const pfring_channel_config *config,
+				    pfring* ring[MAX_NUM_RX_CHANNELS]) {
+  struct channel_open c[MAX_NUM_RX_CHANNELS];
+  pthread_t thread[MAX_NUM_RX_CHANNELS];
+  u_int8_t started[MAX_NUM_RX_CHANNELS];
+  u_int32_t num_channels, i, num = 0;
+  char base_device_name[32], *at;
+  pfring *probe;
+
+  snprintf(base_device_name, sizeof(base_device_name), "%s", device_name);
+  at = strchr(base_device_name, '@');
+  if(at != NULL)
+    at[0] = '\0';
+
+  /* Room for "@<channel>" in every channel name, channel < MAX_NUM_RX_CHANNELS (32) */
+  if(strlen(base_device_name) >= (sizeof(c[0].dev) - strlen("@31"))) {
+    errno = ENAMETOOLONG;
+    return(0);
+  }
+
+  /* Count how many RX channel the specified device supports */
+  if((probe = pfring_open(base_device_name, config->caplen, config->flags)) == NULL)
+    return(0);
+
+  num_channels = pfring_get_num_rx_channels(probe);
+  pfring_close(probe);
+
+  if(num_channels > MAX_NUM_RX_CHANNELS)
+    num_channels = MAX_NUM_RX_CHANNELS;
+
+  for(i = 0; i < num_channels; i++) {
+    snprintf(c[i].dev, sizeof(c[i].dev), "%s@%u", base_device_name, i);
+    c[i].channel_id = i, c[i].config = config, c[i].ring = NULL;
+
+    started[i] = (pthread_create(&thread[i], NULL, open_channel_thread, &c[i]) == 0);
+    if(!started[i])
+      open_channel_thread(&c[i]); /* in this thread then */
+  }
+
+  for(i = 0; i < num_channels; i++)
+    if(started[i])
+      pthread_join(thread[i], NULL);
+
+  /* Channels 0..num-1 as pfring_open_multichannel() */
+  for(i = 0; i < num_channels; i++) {
+    if((c[i].ring != NULL) && (num == i))
+      ring[num++] = c[i].ring;
+    else if(c[i].ring != NULL)
+      pfring_close(c[i].ring);
+  }
+
+  return(num);
+}
+
+/* **************************************************** */
+
 void pfring_close(pfring *ring) {
   if(!ring)
     return;
@@ -236,13 +423,21 @@ void pfring_close(pfring *ring) {
   if(ring->close)
     ring->close(ring);
 
-  if(unlikely(ring->reentrant)) {
-    pthread_rwlock_destroy(&ring->rx_lock);
-    pthread_rwlock_destroy(&ring->tx_lock);
-  }
+  pfring_free_handle(ring);
+}
 
-  free(ring->device_name);
-  free(ring);
+/* **************************************************** */
+
+int pfring_detach_fd(pfring *ring) {
+  int fd;
+
+  if(!ring->detach)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  if((fd = ring->detach(ring)) >= 0)
+    pfring_free_handle(ring);
+
+  return(fd);
 }
 
 /* **************************************************** */
@@ -325,6 +520,181 @@ int pfring_loop(pfring *ring, pfringProcesssPacket looper,
 
 /* **************************************************** */
 
+int pfring_loop_burst(pfring *ring, pfringProcesssPacketBurst looper,
+		      const u_char *user_bytes, u_int burst_len, u_int8_t wait_for_packet) {
+  u_char *buffers[MAX_BURST_LEN];
+  struct pfring_pkthdr hdrs[MAX_BURST_LEN];
+  int rc = 0;
+
+  if((! ring)
+     || ring->is_shutting_down
+     || (! ring->recv)
+     || ring->mode == send_only_mode)
+    return -1;
+
+  if((burst_len == 0) || (burst_len > MAX_BURST_LEN))
+    burst_len = MAX_BURST_LEN;
+
+  ring->break_recv_loop = 0;
+
+  while(!ring->break_recv_loop) {
+    /* The previous burst is released by the next receive */
+    rc = pfring_recv_burst(ring, buffers, hdrs, burst_len, wait_for_packet);
+    if(rc < 0)
+      break;
+    else if(rc > 0)
+      looper(hdrs, buffers, rc, user_bytes);
+  }
+
+  pfring_release_batch(ring);
+  return(rc);
+}
+
+/* **************************************************** */
+
+int pfring_loop_batch(pfring *ring, pfringProcesssPacketBatch looper,
+		      const u_char *user_bytes, u_int batch_len, u_int8_t wait_for_packet) {
+  struct pfring_pkthdr *hdrs[MAX_BURST_LEN];
+  u_char *buffers[MAX_BURST_LEN];
+  int rc = 0;
+
+  if((! ring)
+     || ring->is_shutting_down
+     || (! ring->recv)
+     || ring->mode == send_only_mode)
+    return -1;
+
+  if((batch_len == 0) || (batch_len > MAX_BURST_LEN))
+    batch_len = MAX_BURST_LEN;
+
+  ring->break_recv_loop = 0;
+
+  while(!ring->break_recv_loop) {
+    /* The previous batch is released by the next receive */
+    rc = pfring_recv_batch(ring, hdrs, buffers, batch_len, wait_for_packet);
+    if(rc < 0)
+      break;
+    else if(rc > 0)
+      looper(hdrs, buffers, rc, user_bytes);
+  }
+
+  pfring_release_batch(ring);
+  return(rc);
+}
+
+/* **************************************************** */
+
+static inline void prefetch_slot(const struct pfring_pkthdr *hdr, const u_char *buffer) {
+  const u_char *second_line = (const u_char*)hdr + 64;
+
+  /* The parsed fields span the first two lines of the header */
+  prefetch(hdr);
+  prefetch(second_line);
+  prefetch(buffer);
+}
+
+static void pipeline_packets(struct pfring_pkthdr **hdrs, u_char **buffers, u_int num_pkts, u_int lookahead,
+			     pfringProcesssPacket looper, pfringProcesssPacket prefetch_hook,
+			     const u_char *user_bytes) {
+  u_int i;
+
+  for(i = 0; (i < 2*lookahead) && (i < num_pkts); i++)
+    prefetch_slot(hdrs[i], buffers[i]);
+
+  if(prefetch_hook)
+    for(i = 0; (i < lookahead) && (i < num_pkts); i++)
+      prefetch_hook(hdrs[i], buffers[i], user_bytes);
+
+  for(i = 0; i < num_pkts; i++) {
+    if((i + 2*lookahead) < num_pkts)
+      prefetch_slot(hdrs[i + 2*lookahead], buffers[i + 2*lookahead]);
+
+    if(prefetch_hook && ((i + lookahead) < num_pkts))
+      prefetch_hook(hdrs[i + lookahead], buffers[i + lookahead], user_bytes);
+
+    looper(hdrs[i], buffers[i], user_bytes);
+  }
+}
+
+/* **************************************************** */
+
+int pfring_loop_pipelined(pfring *ring, pfringProcesssPacket looper, pfringProcesssPacket prefetch_hook,
+			  const u_char *user_bytes, u_int lookahead, u_int8_t wait_for_packet) {
+  struct pfring_pkthdr *hdrs[MAX_BURST_LEN], copies[MAX_BURST_LEN];
+  u_char *buffers[MAX_BURST_LEN];
+  u_int8_t in_place = 1;
+  int rc = 0, i;
+
+  if((! ring)
+     || ring->is_shutting_down
+     || (! ring->recv)
+     || ring->mode == send_only_mode)
+    return -1;
+
+  if(lookahead == 0)
+    lookahead = DEFAULT_PREFETCH_LOOKAHEAD;
+  else if(lookahead > (MAX_BURST_LEN / 2))
+    lookahead = MAX_BURST_LEN / 2;
+
+  ring->break_recv_loop = 0;
+
+  while(!ring->break_recv_loop) {
+    if(in_place) {
+      rc = pfring_recv_batch(ring, hdrs, buffers, MAX_BURST_LEN, wait_for_packet);
+
+      if(rc == PF_RING_ERROR_NOT_SUPPORTED) {
+	in_place = 0; /* short headers, or no batch support in the module */
+	continue;
+      }
+    } else {
+      rc = pfring_recv_burst(ring, buffers, copies, MAX_BURST_LEN, wait_for_packet);
+
+      for(i = 0; i < rc; i++)
+	hdrs[i] = &copies[i];
+    }
+
+    if(rc < 0)
+      break;
+    else if(rc > 0)
+      pipeline_packets(hdrs, buffers, rc, lookahead, looper, prefetch_hook, user_bytes);
+  }
+
+  pfring_release_batch(ring);
+  return(rc);
+}
+
+/* **************************************************** */
+
+int pfring_loop_mpmc(pfring *ring, u_int consumer_id, pfringProcesssPacketBatch looper,
+		     const u_char *user_bytes, u_int batch_len, u_int8_t wait_for_packet) {
+  struct pfring_pkthdr *hdrs[MAX_BURST_LEN];
+  u_char *buffers[MAX_BURST_LEN];
+  int rc = 0;
+
+  if((! ring)
+     || ring->is_shutting_down
+     || (! ring->recv)
+     || ring->mode == send_only_mode)
+    return -1;
+
+  if((batch_len == 0) || (batch_len > MAX_BURST_LEN))
+    batch_len = MAX_BURST_LEN;
+
+  /* break_recv_loop is shared: pfring_breakloop() stops every consumer */
+  while(!ring->break_recv_loop) {
+    rc = pfring_mpmc_recv(ring, consumer_id, hdrs, buffers, batch_len, wait_for_packet);
+    if(rc < 0)
+      break;
+    else if(rc > 0)
+      looper(hdrs, buffers, rc, user_bytes);
+  }
+
+  pfring_mpmc_release(ring, consumer_id);
+  return(rc);
+}
+
+/* **************************************************** */
+
 void pfring_breakloop(pfring *ring) {
   if(!ring)
     return;
@@ -348,6 +718,7 @@ int pfring_bundle_add(pfring_bundle *bundle, pfring *ring) {
   bundle->sockets[bundle->num_sockets] = ring;
   bundle->pfd[bundle->num_sockets].fd = pfring_get_selectable_fd(ring);
   bundle->num_sockets++;
+  bundle->heap_ready = 0; /* rebuilt at the next pick_fifo read */
 
   pfring_enable_ring(ring);
 
@@ -372,18 +743,111 @@ int pfring_bundle_poll(pfring_bundle *bundle, u_int wait_duration) {
 
 /* **************************************************** */
 
-int pfring_bundle_read(pfring_bundle *bundle,
-		       u_char** buffer, u_int buffer_len,
-		       struct pfring_pkthdr *hdr,
-		       u_int8_t wait_for_incoming_packet) {
-  int i, sock_id = -1, found, rc, empty_rings, scans;
-  struct timespec ts = { 0 };
-  struct timespec tmpts;
+/*
+  pick_fifo merge. A socket head time changes only when the socket is
+  read, then the heap is fixed for that socket alone: O(log N) per packet.
+  Empty sockets are asked again at every read, that is O(empty).
+*/
 
-redo_pfring_bundle_read:
+static inline int bundle_heap_before(pfring_bundle *bundle, u_int16_t a, u_int16_t b) {
+  return(timespec_is_before(&bundle->head_ts[bundle->heap[a]], &bundle->head_ts[bundle->heap[b]]));
+}
 
-  switch(bundle->policy) {
-  case pick_round_robin:
+static void bundle_heap_swap(pfring_bundle *bundle, u_int16_t a, u_int16_t b) {
+  u_int16_t tmp = bundle->heap[a];
+
+  bundle->heap[a] = bundle->heap[b], bundle->heap[b] = tmp;
+}
+
+static void bundle_heap_up(pfring_bundle *bundle, u_int16_t i) {
+  while((i > 0) && bundle_heap_before(bundle, i, (i - 1) / 2)) {
+    bundle_heap_swap(bundle, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void bundle_heap_down(pfring_bundle *bundle, u_int16_t i) {
+  while(1) {
+    u_int16_t l = 2 * i + 1, r = l + 1, min = i;
+
+    if((l < bundle->heap_len) && bundle_heap_before(bundle, l, min)) min = l;
+    if((r < bundle->heap_len) && bundle_heap_before(bundle, r, min)) min = r;
+    if(min == i) return;
+
+    bundle_heap_swap(bundle, i, min);
+    i = min;
+  }
+}
+
+/* **************************************************** */
+
+static void bundle_heap_build(pfring_bundle *bundle) {
+  u_int16_t i;
+
+  bundle->heap_len = 0, bundle->num_empty = 0;
+
+  for(i = 0; i < bundle->num_sockets; i++) {
+    if(pfring_next_pkt_time(bundle->sockets[i], &bundle->head_ts[i]) == 0) {
+      bundle->heap[bundle->heap_len] = i;
+      bundle_heap_up(bundle, bundle->heap_len++);
+    } else
+      bundle->empty[bundle->num_empty++] = i;
+  }
+
+  bundle->heap_ready = 1;
+}
+
+/* **************************************************** */
+
+static int bundle_read_fifo(pfring_bundle *bundle,
+			    u_char** buffer, u_int buffer_len,
+			    struct pfring_pkthdr *hdr) {
+  u_int16_t i, sock_id;
+  int rc;
+
+  if(!bundle->heap_ready)
+    bundle_heap_build(bundle);
+
+  for(i = 0; i < bundle->num_empty; ) {
+    sock_id = bundle->empty[i];
+
+    if(pfring_next_pkt_time(bundle->sockets[sock_id], &bundle->head_ts[sock_id]) == 0) {
+      bundle->empty[i] = bundle->empty[--bundle->num_empty];
+      bundle->heap[bundle->heap_len] = sock_id;
+      bundle_heap_up(bundle, bundle->heap_len++);
+    } else
+      i++;
+  }
+
+  if(bundle->heap_len == 0)
+    return(0);
+
+  sock_id = bundle->heap[0];
+  rc = pfring_recv(bundle->sockets[sock_id], buffer, buffer_len, hdr, 0);
+
+  /* New head of the socket just read */
+  if(pfring_next_pkt_time(bundle->sockets[sock_id], &bundle->head_ts[sock_id]) != 0) {
+    bundle->empty[bundle->num_empty++] = sock_id;
+    bundle->heap[0] = bundle->heap[--bundle->heap_len];
+  }
+
+  bundle_heap_down(bundle, 0);
+
+  return(rc);
+}
+
+/* **************************************************** */
+
+int pfring_bundle_read(pfring_bundle *bundle,
+		       u_char** buffer, u_int buffer_len,
+		       struct pfring_pkthdr *hdr,
+		       u_int8_t wait_for_incoming_packet) {
+  int i, rc;
+
+redo_pfring_bundle_read:
+
+  switch(bundle->policy) {
+  case pick_round_robin:
     for(i=0; i<bundle->num_sockets; i++) {
       bundle->last_read_socket = (bundle->last_read_socket + 1) % bundle->num_sockets;
 
@@ -395,36 +859,8 @@ redo_pfring_bundle_read:
     break;
 
   case pick_fifo:
-    found = 0;
-    empty_rings = 0;
-    scans = 0;
-
-  sockets_scan:
-    scans++;
-    for(i=0; i<bundle->num_sockets; i++) {
-      pfring *ring = bundle->sockets[i];
-
-      rc = pfring_next_pkt_time(ring, &tmpts);
-
-      if (rc == 0) {
-      	if(!found || timespec_is_before(&tmpts, &ts)) {
-	  memcpy(&ts, &tmpts, sizeof(struct timespec));
-	  found = 1;
-	  sock_id = i;
-	}
-      } else if (rc == PF_RING_ERROR_NO_PKT_AVAILABLE) {
-        empty_rings = 1;
-      } else {
-        /* error */
-      }
-    }
-
-    if(found) {
-      if (empty_rings > 0 && scans == 1)
-        goto sockets_scan; /* scanning ring twice (safety check) */
-
-      return(pfring_recv(bundle->sockets[sock_id], buffer, buffer_len, hdr, 0));
-    }
+    if((rc = bundle_read_fifo(bundle, buffer, buffer_len, hdr)) != 0)
+      return(rc);
     break;
   }
 
@@ -440,6 +876,28 @@ redo_pfring_bundle_read:
 
 /* **************************************************** */
 
+int pfring_bundle_read_batch(pfring_bundle *bundle,
+			     u_char* buffers[], u_int buffer_len,
+			     struct pfring_pkthdr hdrs[], u_int max_num_pkts,
+			     u_int8_t wait_for_incoming_packet) {
+  u_int num_pkts = 0;
+  int rc = 0;
+
+  while(num_pkts < max_num_pkts) {
+    rc = pfring_bundle_read(bundle, &buffers[num_pkts], buffer_len, &hdrs[num_pkts],
+			    (num_pkts == 0) ? wait_for_incoming_packet : 0);
+
+    if(rc <= 0)
+      break;
+
+    num_pkts++;
+  }
+
+  return((num_pkts > 0) ? (int)num_pkts : rc);
+}
+
+/* **************************************************** */
+
 void pfring_bundle_destroy(pfring_bundle *bundle) {
   int i;
 
@@ -464,6 +922,178 @@ void pfring_bundle_close(pfring_bundle *bundle) {
 
 /* **************************************************** */
 
+int pfring_epoll_bundle_init(pfring_epoll_bundle *bundle) {
+  memset(bundle, 0, sizeof(pfring_epoll_bundle));
+
+  if((bundle->epfd = epoll_create(1 /* ignored */)) < 0)
+    return(-1);
+
+  return(0);
+}
+
+/* **************************************************** */
+
+static void epoll_bundle_set_ready(pfring_epoll_bundle *bundle, u_int32_t sock_id) {
+  if(bundle->is_ready[sock_id])
+    return;
+
+  bundle->is_ready[sock_id] = 1;
+  bundle->ready[(bundle->ready_head + bundle->num_ready) % bundle->max_sockets] = sock_id;
+  bundle->num_ready++;
+}
+
+/* **************************************************** */
+
+int pfring_epoll_bundle_add(pfring_epoll_bundle *bundle, pfring *ring) {
+  struct epoll_event ev;
+
+  if(bundle->num_sockets == bundle->max_sockets) {
+    u_int32_t max = bundle->max_sockets ? 2 * bundle->max_sockets : MAX_NUM_BUNDLE_ELEMENTS, i;
+    pfring **sockets = realloc(bundle->sockets, max * sizeof(pfring*));
+    struct epoll_event *events = sockets ? realloc(bundle->events, max * sizeof(struct epoll_event)) : NULL;
+    u_int32_t *ready = malloc(max * sizeof(u_int32_t));
+    u_int8_t *is_ready = realloc(bundle->is_ready, max);
+
+    if(sockets) bundle->sockets = sockets;
+    if(events) bundle->events = events;
+    if(is_ready) bundle->is_ready = is_ready;
+
+    if((sockets == NULL) || (events == NULL) || (ready == NULL) || (is_ready == NULL)) {
+      if(ready) free(ready);
+      return(-1);
+    }
+
+    /* Unwrapped in the larger list */
+    for(i = 0; i < bundle->num_ready; i++)
+      ready[i] = bundle->ready[(bundle->ready_head + i) % bundle->max_sockets];
+
+    if(bundle->ready) free(bundle->ready);
+    bundle->ready = ready, bundle->ready_head = 0, bundle->max_sockets = max;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN, ev.data.u32 = bundle->num_sockets;
+
+  if(epoll_ctl(bundle->epfd, EPOLL_CTL_ADD, pfring_get_selectable_fd(ring), &ev) < 0)
+    return(-1);
+
+  bundle->sockets[bundle->num_sockets] = ring;
+  bundle->is_ready[bundle->num_sockets] = 0;
+  epoll_bundle_set_ready(bundle, bundle->num_sockets); /* packets may be queued already */
+  bundle->num_sockets++;
+
+  pfring_enable_ring(ring);
+
+  return(0);
+}
+
+/* **************************************************** */
+
+/* Returns the number of sockets added to the ready list */
+int pfring_epoll_bundle_poll(pfring_epoll_bundle *bundle, u_int wait_duration) {
+  int rc, i;
+
+  if(bundle->num_sockets == 0)
+    return(0);
+
+  errno = 0;
+  rc = epoll_wait(bundle->epfd, bundle->events, bundle->num_sockets, wait_duration);
+
+  if(rc == 0) {
+    /* Timeout: below the poll watermark packets are not reported */
+    for(i = 0; i < bundle->num_sockets; i++)
+      if(pfring_is_pkt_available(bundle->sockets[i]))
+	epoll_bundle_set_ready(bundle, i);
+
+    return(bundle->num_ready);
+  }
+
+  for(i = 0; i < rc; i++)
+    epoll_bundle_set_ready(bundle, bundle->events[i].data.u32);
+
+  return(rc);
+}
+
+/* **************************************************** */
+
+int pfring_epoll_bundle_read_burst(pfring_epoll_bundle *bundle, pfring **ring,
+				   u_char* buffers[], struct pfring_pkthdr hdrs[],
+				   u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  int rc;
+
+  while(1) {
+    while(bundle->num_ready > 0) {
+      u_int32_t sock_id = bundle->ready[bundle->ready_head];
+
+      bundle->ready_head = (bundle->ready_head + 1) % bundle->max_sockets;
+      bundle->num_ready--;
+
+      rc = pfring_recv_burst(bundle->sockets[sock_id], buffers, hdrs, max_num_pkts, 0);
+
+      if(rc > 0) {
+	/* Back at the tail: the other ready sockets come first */
+	bundle->ready[(bundle->ready_head + bundle->num_ready) % bundle->max_sockets] = sock_id;
+	bundle->num_ready++;
+
+	*ring = bundle->sockets[sock_id];
+	return(rc);
+      }
+
+      bundle->is_ready[sock_id] = 0; /* until epoll reports it again */
+
+      if(rc < 0) {
+	*ring = bundle->sockets[sock_id];
+	return(rc);
+      }
+    }
+
+    if(!wait_for_incoming_packet || (bundle->num_sockets == 0))
+      return(0);
+
+    if((rc = pfring_epoll_bundle_poll(bundle, bundle->sockets[0]->poll_duration)) < 0)
+      return(rc);
+
+    if(rc == 0)
+      return(0);
+  }
+}
+
+/* **************************************************** */
+
+static void free_epoll_bundle(pfring_epoll_bundle *bundle) {
+  if(bundle->epfd > 0) close(bundle->epfd);
+  if(bundle->sockets)  free(bundle->sockets);
+  if(bundle->events)   free(bundle->events);
+  if(bundle->ready)    free(bundle->ready);
+  if(bundle->is_ready) free(bundle->is_ready);
+
+  memset(bundle, 0, sizeof(pfring_epoll_bundle));
+}
+
+/* **************************************************** */
+
+void pfring_epoll_bundle_destroy(pfring_epoll_bundle *bundle) {
+  u_int32_t i;
+
+  for(i = 0; i < bundle->num_sockets; i++)
+    pfring_disable_ring(bundle->sockets[i]);
+
+  free_epoll_bundle(bundle);
+}
+
+/* **************************************************** */
+
+void pfring_epoll_bundle_close(pfring_epoll_bundle *bundle) {
+  u_int32_t i;
+
+  for(i = 0; i < bundle->num_sockets; i++)
+    pfring_close(bundle->sockets[i]);
+
+  free_epoll_bundle(bundle);
+}
+
+/* **************************************************** */
+
 int pfring_bounce_init(pfring_bounce *bounce, pfring *ingress_ring, pfring *egress_ring) {
 
   if (bounce == NULL || ingress_ring == NULL || egress_ring == NULL ||
@@ -486,6 +1116,7 @@ int pfring_bounce_init(pfring_bounce *bounce, pfring *ingress_ring, pfring *egre
   /* disabling harmful functions / backing up func ptrs */
   bounce->recv          = ingress_ring->recv,         ingress_ring->recv         = NULL;
   bounce->send          = egress_ring->send,          egress_ring->send          = NULL;
+  bounce->send_burst    = egress_ring->send_burst,    egress_ring->send_burst    = NULL;
   bounce->send_parsed   = egress_ring->send_parsed,   egress_ring->send_parsed   = NULL;
   bounce->send_get_time = egress_ring->send_get_time, egress_ring->send_get_time = NULL;
 
@@ -549,6 +1180,7 @@ void pfring_bounce_destroy(pfring_bounce *bounce) {
   /* restoring func ptrs */
   bounce->rx_socket->recv          = bounce->recv;
   bounce->tx_socket->send          = bounce->send;
+  bounce->tx_socket->send_burst    = bounce->send_burst;
   bounce->tx_socket->send_parsed   = bounce->send_parsed;
   bounce->tx_socket->send_get_time = bounce->send_get_time;
 
@@ -563,8 +1195,58 @@ void pfring_bounce_destroy(pfring_bounce *bounce) {
 /* **************************************************** */
 
 int pfring_stats(pfring *ring, pfring_stat *stats) {
-  if(ring && ring->stats)
+  if(ring && ring->stats) {
+    /* Modules that do not know a counter leave it to 0 */
+    if(stats != NULL) memset(stats, 0, sizeof(pfring_stat));
     return ring->stats(ring, stats);
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_stats_multichannel(pfring **rings, u_int32_t num_rings, pfring_multichannel_stat *stats) {
+  u_int32_t i;
+
+  if((rings == NULL) || (stats == NULL) || (num_rings > MAX_NUM_RX_CHANNELS))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  memset(stats, 0, sizeof(pfring_multichannel_stat));
+
+  /* The reads back to back, nothing else in between */
+  for(i = 0; i < num_rings; i++) {
+    if(rings[i] == NULL)
+      continue;
+
+    if(rings[i]->stats_mapped)
+      rings[i]->stats_mapped(rings[i], &stats->channel[i]);
+    else if(rings[i]->stats)
+      rings[i]->stats(rings[i], &stats->channel[i]); /* modules without mapped counters */
+  }
+
+  clock_gettime(CLOCK_REALTIME, &stats->ts);
+
+  for(i = 0; i < num_rings; i++) {
+    stats->total.recv += stats->channel[i].recv;
+    stats->total.drop += stats->channel[i].drop;
+    stats->total.sampled += stats->channel[i].sampled;
+  }
+
+  stats->num_channels = num_rings;
+  return(0);
+}
+
+/* **************************************************** */
+
+int pfring_stats_ext(pfring *ring, pfring_stat_ext *stats) {
+  if(ring && ring->stats_ext) {
+    if(stats == NULL)
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+    memset(stats, 0, sizeof(pfring_stat_ext));
+    return ring->stats_ext(ring, stats);
+  }
 
   return(PF_RING_ERROR_NOT_SUPPORTED);
 }
@@ -585,8 +1267,16 @@ int pfring_recv(pfring *ring, u_char** buffer, u_int buffer_len,
       return(PF_RING_ERROR_INVALID_ARGUMENT);
 
     ring->break_recv_loop = 0;
+
+  again:
     rc = ring->recv(ring, buffer, buffer_len, hdr, wait_for_incoming_packet);
 
+    if(unlikely(ring->userspace_bpf != NULL) && (rc > 0)
+       && !pfring_userspace_bpf_match(ring, *buffer,
+				      ((buffer_len > 0) && (hdr->caplen > buffer_len)) ? buffer_len : hdr->caplen,
+				      hdr->len))
+      goto again; /* filtered out: next packet */
+
     if(unlikely(ring->reflector_socket != NULL))
       pfring_send(ring->reflector_socket, (char*)buffer, hdr->caplen, 0 /* flush */);
 
@@ -598,6 +1288,123 @@ int pfring_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 
 /* **************************************************** */
 
+int pfring_recv_burst(pfring *ring, u_char* buffers[], struct pfring_pkthdr hdrs[],
+		      u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  if(likely((ring
+	     && ring->enabled
+	     && ring->recv
+	     && (ring->mode != send_only_mode)))) {
+    int rc, i;
+
+    /* Reentrancy is not compatible with zero copy */
+    if(unlikely(ring->reentrant || (max_num_pkts == 0)))
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+    ring->break_recv_loop = 0;
+
+  again:
+    if(ring->recv_burst)
+      rc = ring->recv_burst(ring, buffers, hdrs, max_num_pkts, wait_for_incoming_packet);
+    else /* Modules without native burst support: one packet per call */
+      rc = ring->recv(ring, &buffers[0], 0, &hdrs[0], wait_for_incoming_packet);
+
+    if(unlikely(ring->userspace_bpf != NULL) && (rc > 0)
+       && ((rc = pfring_userspace_bpf_filter_burst(ring, buffers, hdrs, rc)) == 0))
+      goto again; /* the whole burst was filtered out: until the ring is empty */
+
+    if(unlikely(ring->reflector_socket != NULL))
+      for(i = 0; i < rc; i++)
+	pfring_send(ring->reflector_socket, (char*)buffers[i], hdrs[i].caplen, 0 /* flush */);
+
+    return rc;
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_recv_batch(pfring *ring, struct pfring_pkthdr* hdrs[], u_char* buffers[],
+		      u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  if(likely((ring
+	     && ring->enabled
+	     && ring->recv
+	     && (ring->mode != send_only_mode)))) {
+    int rc, i;
+
+    /* Slots are owned by a single consumer until released */
+    if(unlikely(ring->reentrant || (max_num_pkts == 0)))
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+    if(ring->recv_batch == NULL)
+      return(PF_RING_ERROR_NOT_SUPPORTED);
+
+    ring->break_recv_loop = 0;
+
+    rc = ring->recv_batch(ring, hdrs, buffers, max_num_pkts, wait_for_incoming_packet);
+
+    if(unlikely(ring->reflector_socket != NULL))
+      for(i = 0; i < rc; i++)
+	pfring_send(ring->reflector_socket, (char*)buffers[i], hdrs[i]->caplen, 0 /* flush */);
+
+    return rc;
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+void pfring_release_batch(pfring *ring) {
+  if(ring && ring->release_batch)
+    ring->release_batch(ring);
+}
+
+/* **************************************************** */
+
+int pfring_enable_mpmc(pfring *ring, u_int num_consumers) {
+  if(ring && ring->enable_mpmc)
+    return ring->enable_mpmc(ring, num_consumers);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_enable_mpsc(pfring *ring) {
+  if(ring && ring->enable_mpsc)
+    return ring->enable_mpsc(ring);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_mpmc_recv(pfring *ring, u_int consumer_id, struct pfring_pkthdr* hdrs[], u_char* buffers[],
+		     u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  if(likely((ring
+	     && ring->enabled
+	     && ring->mpmc_recv
+	     && ring->mpmc
+	     && (ring->mode != send_only_mode)))) {
+    if(unlikely(max_num_pkts == 0))
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+    return ring->mpmc_recv(ring, consumer_id, hdrs, buffers, max_num_pkts, wait_for_incoming_packet);
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+void pfring_mpmc_release(pfring *ring, u_int consumer_id) {
+  if(ring && ring->mpmc && ring->mpmc_release)
+    ring->mpmc_release(ring, consumer_id);
+}
+
+/* **************************************************** */
+
 int pfring_recv_parsed(pfring *ring, u_char** buffer, u_int buffer_len,
 		       struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet,
 		       u_int8_t level /* 1..4 */, u_int8_t add_timestamp, u_int8_t add_hash) {
@@ -620,6 +1427,23 @@ int pfring_set_poll_watermark(pfring *ring, u_int16_t watermark) {
 
 /* **************************************************** */
 
+/*
+  Wake up pfring_poll() at num_pkts queued packets or usec microseconds
+  after the first one, whichever comes first (usec = 0: watermark only).
+*/
+int pfring_set_poll_coalescing(pfring *ring, u_int16_t num_pkts, u_int32_t usec) {
+  if(ring && ring->set_poll_coalescing) {
+    if(usec > MAX_POLL_COALESCING_USEC)
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+    return ring->set_poll_coalescing(ring, num_pkts, usec);
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_set_poll_duration(pfring *ring, u_int duration) {
   if(ring && ring->set_poll_duration)
     return ring->set_poll_duration(ring, duration);
@@ -638,6 +1462,15 @@ int pfring_set_tx_watermark(pfring *ring, u_int16_t watermark) {
 
 /* **************************************************** */
 
+int pfring_set_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t max_pkt_len) {
+  if(ring && ring->set_tx_ring)
+    return ring->set_tx_ring(ring, num_slots, max_pkt_len);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_add_hw_rule(pfring *ring, hw_filtering_rule *rule) {
   if(ring && ring->add_hw_rule)
     return ring->add_hw_rule(ring, rule);
@@ -647,9 +1480,42 @@ int pfring_add_hw_rule(pfring *ring, hw_filtering_rule *rule) {
 
 /* **************************************************** */
 
-int pfring_remove_hw_rule(pfring *ring, u_int16_t rule_id) {
-  if(ring && ring->remove_hw_rule)
-    return ring->remove_hw_rule(ring, rule_id);
+int pfring_remove_hw_rule(pfring *ring, u_int16_t rule_id) {
+  if(ring && ring->remove_hw_rule)
+    return ring->remove_hw_rule(ring, rule_id);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_add_hw_rules(pfring *ring, hw_filtering_rule *rules, u_int32_t num_rules) {
+  if((num_rules > 0) && (rules == NULL))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->add_hw_rules)
+    return ring->add_hw_rules(ring, rules, num_rules);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_remove_hw_rules(pfring *ring, u_int16_t *rule_ids, u_int32_t num_rules) {
+  if((num_rules > 0) && (rule_ids == NULL))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->remove_hw_rules)
+    return ring->remove_hw_rules(ring, rule_ids, num_rules);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_get_num_hw_rules(pfring *ring) {
+  if(ring && ring->get_num_hw_rules)
+    return ring->get_num_hw_rules(ring);
 
   return(PF_RING_ERROR_NOT_SUPPORTED);
 }
@@ -709,6 +1575,44 @@ int pfring_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
 
 /* **************************************************** */
 
+int pfring_send_burst(pfring *ring, char **pkts, u_int *pkts_len, u_int num_pkts, u_int8_t flush_packet) {
+  int rc = -1;
+  u_int i;
+
+  if(unlikely(num_pkts == 0))
+    return 0;
+
+  if(likely(ring
+	    && ring->enabled
+	    && (!ring->is_shutting_down)
+	    && (ring->send_burst || ring->send)
+	    && (ring->mode != recv_only_mode))) {
+
+    if(unlikely(ring->reentrant))
+      pthread_rwlock_wrlock(&ring->tx_lock);
+
+    if(ring->send_burst)
+      rc = ring->send_burst(ring, pkts, pkts_len, num_pkts, flush_packet);
+    else {
+      /* Only the last packet is flushed: one doorbell (e.g. DNA tail register) for the burst */
+      for(i = 0; i < num_pkts; i++) {
+	if(unlikely(pkts_len[i] > 9000 /* Jumbo MTU */)
+	   || (ring->send(ring, pkts[i], pkts_len[i], flush_packet && (i == (num_pkts - 1))) < 0))
+	  break;
+      }
+
+      rc = (i > 0) ? i : -1;
+    }
+
+    if(unlikely(ring->reentrant))
+      pthread_rwlock_unlock(&ring->tx_lock);
+  }
+
+  return rc;
+}
+
+/* **************************************************** */
+
 int pfring_send_parsed(pfring *ring, char *pkt, struct pfring_pkthdr *hdr, u_int8_t flush_packet) {
   int rc = -1;
 
@@ -783,6 +1687,78 @@ int pfring_set_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */)
 
 /* **************************************************** */
 
+int pfring_set_flow_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
+  if(ring && ring->set_flow_sampling_rate)
+    return ring->set_flow_sampling_rate(ring, rate);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+/*
+  What the kernel does with a packet for a full or almost full ring,
+  before filtering it: see SO_SET_OVERLOAD_POLICY. pfring_stats() reports
+  the packets left out by sampling apart from the dropped ones.
+*/
+int pfring_set_overload_policy(pfring *ring, u_int8_t early_drop,
+			       u_int8_t sample_threshold, u_int32_t max_sample_rate) {
+  if(ring && ring->set_overload_policy) {
+    if((sample_threshold >= 100) || ((sample_threshold > 0) && (max_sample_rate < 2)))
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+    return ring->set_overload_policy(ring, early_drop, sample_threshold, max_sample_rate);
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_latency_histogram(pfring *ring, u_int8_t enable) {
+  if(ring && ring->set_latency_histogram)
+    return ring->set_latency_histogram(ring, enable);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_timestamp_mode(pfring *ring, u_int8_t mode) {
+  if(ring && ring->set_timestamp_mode)
+    return ring->set_timestamp_mode(ring, mode);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_get_latency_histogram(pfring *ring, struct pfring_latency_histogram *hist) {
+  if((ring == NULL) || (hist == NULL))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring->latency_hist == NULL)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  memcpy(hist, ring->latency_hist, sizeof(struct pfring_latency_histogram));
+  return(0);
+}
+
+/* **************************************************** */
+
+int pfring_set_shared_ring(pfring *ring, u_int32_t shared_ring_id, u_int8_t drop_slowest) {
+  if(ring && ring->set_shared_ring) {
+    if(shared_ring_id == 0)
+      return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+    return ring->set_shared_ring(ring, shared_ring_id, drop_slowest);
+  }
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_get_selectable_fd(pfring *ring) {
   if(ring && ring->get_selectable_fd)
     return ring->get_selectable_fd(ring);
@@ -858,6 +1834,18 @@ int pfring_remove_from_cluster(pfring *ring) {
 
 /* **************************************************** */
 
+int pfring_set_cluster_indirection(pfring *ring, const u_int8_t *element) {
+  if(element == NULL)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->set_cluster_indirection)
+    return ring->set_cluster_indirection(ring, element);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_set_master_id(pfring *ring, u_int32_t master_id) {
   if(ring && ring->set_master_id)
     return ring->set_master_id(ring, master_id);
@@ -923,6 +1911,19 @@ int pfring_get_hash_filtering_rule_stats(pfring *ring, hash_filtering_rule* rule
 
 /* **************************************************** */
 
+int pfring_get_hash_filtering_rules_stats(pfring *ring, struct pfring_hash_rule_stats *stats,
+					  u_int32_t max_rules, u_int64_t *cursor) {
+  if((stats == NULL) || (cursor == NULL) || (max_rules == 0))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->get_hash_filtering_rules_stats)
+    return ring->get_hash_filtering_rules_stats(ring, stats, max_rules, cursor);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_add,
 				      u_char add_rule) {
   if(ring && ring->handle_hash_filtering_rule)
@@ -933,6 +1934,30 @@ int pfring_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to
 
 /* **************************************************** */
 
+int pfring_add_hash_filtering_rules_bulk(pfring *ring, hash_filtering_rule *rules, u_int32_t num_rules) {
+  if((num_rules > 0) && (rules == NULL))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->handle_hash_filtering_rules_bulk)
+    return ring->handle_hash_filtering_rules_bulk(ring, rules, num_rules, 1 /* add */);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_remove_hash_filtering_rules_bulk(pfring *ring, hash_filtering_rule *rules, u_int32_t num_rules) {
+  if((num_rules > 0) && (rules == NULL))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->handle_hash_filtering_rules_bulk)
+    return ring->handle_hash_filtering_rules_bulk(ring, rules, num_rules, 0 /* remove */);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec) {
   if(ring && ring->purge_idle_hash_rules)
     return ring->purge_idle_hash_rules(ring, inactivity_sec);
@@ -942,6 +1967,73 @@ int pfring_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec) {
 
 /* **************************************************** */
 
+int pfring_set_hash_rules_idle_timeout(pfring *ring, u_int16_t inactivity_sec) {
+  if(ring && ring->set_hash_rules_idle_timeout)
+    return ring->set_hash_rules_idle_timeout(ring, inactivity_sec);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_hash_rules_table(pfring *ring, u_int32_t table_size, u_int32_t max_rules) {
+  if(table_size > MAX_RING_HASH_SIZE)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->set_hash_rules_table)
+    return ring->set_hash_rules_table(ring, table_size, max_rules);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_dna_parsing(pfring *ring, u_int8_t level, u_int8_t flags) {
+  if((level == 1) || (level > 4))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->set_dna_parsing)
+    return ring->set_dna_parsing(ring, level, flags);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_prefix_blocklist(pfring *ring, struct pfring_blocklist_prefix *prefixes, u_int32_t num_prefixes) {
+  if((num_prefixes > MAX_BLOCKLIST_PREFIXES) || ((num_prefixes > 0) && (prefixes == NULL)))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->set_prefix_blocklist)
+    return ring->set_prefix_blocklist(ring, prefixes, num_prefixes);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_offload_drop_prefixes(pfring *ring, struct pfring_blocklist_prefix *prefixes,
+				 u_int64_t *volumes, u_int32_t num_prefixes) {
+  if((num_prefixes > 0) && (prefixes == NULL))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  if(ring && ring->offload_drop_prefixes)
+    return ring->offload_drop_prefixes(ring, prefixes, volumes, num_prefixes);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
+int pfring_set_dna_wait_spin(pfring *ring, u_int32_t usec) {
+  if(ring && ring->set_dna_wait_spin)
+    return ring->set_dna_wait_spin(ring, usec);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_purge_idle_rules(pfring *ring, u_int16_t inactivity_sec) {
   if(ring && ring->purge_idle_rules)
     return ring->purge_idle_rules(ring, inactivity_sec);
@@ -988,6 +2080,15 @@ int pfring_toggle_filtering_policy(pfring *ring, u_int8_t rules_default_accept_p
 
 /* **************************************************** */
 
+int pfring_set_flow_cache_lifetime(pfring *ring, u_int32_t msec) {
+  if(ring && ring->set_flow_cache_lifetime)
+    return ring->set_flow_cache_lifetime(ring, msec);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_enable_rss_rehash(pfring *ring) {
   if(ring && ring->enable_rss_rehash)
     return ring->enable_rss_rehash(ring);
@@ -1006,6 +2107,104 @@ int pfring_poll(pfring *ring, u_int wait_duration) {
 
 /* **************************************************** */
 
+int pfring_set_adaptive_wait(pfring *ring, u_int32_t spin_usec) {
+  if(!ring || !ring->is_pkt_available || !ring->poll)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  ring->adaptive_spin_usec = spin_usec;
+  memset(&ring->wait_stats, 0, sizeof(ring->wait_stats));
+  return(0);
+}
+
+/* **************************************************** */
+
+int pfring_get_wait_stats(pfring *ring, pfring_wait_stats *stats) {
+  if(!ring)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  *stats = ring->wait_stats;
+  return(0);
+}
+
+/* **************************************************** */
+
+static inline u_int64_t wait_clock_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/* **************************************************** */
+
+/*
+  Called by the modules when the ring is empty. Without adaptive wait it
+  is a plain poll(). Otherwise: spin for adaptive_spin_usec, then sleep
+  POLL_SLEEP_MIN..POLL_SLEEP_MAX usec doubling at every round, then block.
+  The burst front is caught while spinning, idle rings end up in poll().
+*/
+int pfring_wait_for_packet(pfring *ring) {
+  u_int64_t start, now, deadline;
+  u_int32_t i, sleep_usec;
+  int rc;
+
+  if(ring->adaptive_spin_usec == 0)
+    return(pfring_poll(ring, ring->poll_duration));
+
+  start = now = wait_clock_ns();
+  deadline = start + (u_int64_t)ring->adaptive_spin_usec * 1000;
+
+  for(i = 0; ; i++) {
+    if(ring->is_pkt_available(ring)) {
+      ring->wait_stats.spin_ns += wait_clock_ns() - start;
+      ring->wait_stats.spin_wakeups++;
+      return(1);
+    }
+
+    if(ring->break_recv_loop)
+      return(0);
+
+    /* The clock is read every few rounds: spinning on it would be slower than on the ring */
+    if(((i & 63) == 63) && ((now = wait_clock_ns()) >= deadline))
+      break;
+
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__("rep; nop" ::: "memory"); /* pause */
+#endif
+  }
+
+  ring->wait_stats.spin_ns += now - start, start = now;
+
+  for(sleep_usec = POLL_SLEEP_MIN; sleep_usec <= POLL_SLEEP_MAX; sleep_usec *= 2) {
+    usleep(sleep_usec);
+
+    if(ring->is_pkt_available(ring)) {
+      ring->wait_stats.sleep_ns += wait_clock_ns() - start;
+      ring->wait_stats.sleep_wakeups++;
+
+      if(pfring_get_num_queued_pkts(ring) >= POLL_QUEUE_MIN_LEN)
+	ring->wait_stats.late_wakeups++;
+
+      return(1);
+    }
+
+    if(ring->break_recv_loop)
+      return(0);
+  }
+
+  now = wait_clock_ns();
+  ring->wait_stats.sleep_ns += now - start, start = now;
+
+  rc = ring->poll(ring, ring->poll_duration);
+
+  ring->wait_stats.block_ns += wait_clock_ns() - start;
+  if(rc > 0) ring->wait_stats.block_wakeups++;
+
+  return(rc);
+}
+
+/* **************************************************** */
+
 int pfring_version(pfring *ring, u_int32_t *version) {
   if(ring && ring->version)
     return ring->version(ring, version);
@@ -1060,6 +2259,15 @@ int pfring_loopback_test(pfring *ring, char *buffer, u_int buffer_len, u_int tes
 
 /* **************************************************** */
 
+int pfring_loopback_inject(pfring *ring, struct pfring_loopback_inject *req) {
+  if(ring && ring->loopback_inject)
+    return ring->loopback_inject(ring, req);
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
+
+/* **************************************************** */
+
 int pfring_enable_ring(pfring *ring) {
   if(ring && ring->enable_ring) {
     int rc;
@@ -1129,16 +2337,153 @@ int pfring_set_bpf_filter(pfring *ring, char *filter_buffer){
     return ring->set_bpf_filter(ring, filter_buffer);
   }
 
+  /* No kernel path (DNA, DAG): evaluated in pfring_recv*() */
+  if(ring && filter_buffer)
+    return pfring_userspace_bpf_set(ring, filter_buffer);
+
   return(PF_RING_ERROR_NOT_SUPPORTED);
 }
 
 /* **************************************************** */
 
+/*
+  [src|dst] host/port: either direction when neither is given, i.e. one
+  rule per direction (rules have a single source and destination)
+*/
+#define NATIVE_DIR_SRC  0x01
+#define NATIVE_DIR_DST  0x02
+
+static int parse_native_filter(char *filter_buffer, filtering_rule *rules, u_int *num_rules) {
+  char buf[256], *tok, *pos, *end;
+  u_int8_t proto = 0, host_dir = 0, port_dir = 0, dir = 0;
+  u_int32_t host = 0;
+  long port = 0;
+  u_int h, p, n = 0;
+  struct in_addr addr;
+
+  if(strlen(filter_buffer) >= sizeof(buf))
+    return -1;
+
+  strcpy(buf, filter_buffer);
+
+  for(tok = strtok_r(buf, " \t", &pos); tok != NULL; tok = strtok_r(NULL, " \t", &pos)) {
+    if(!strcmp(tok, "and") || !strcmp(tok, "&&") || !strcmp(tok, "ip")) {
+      if(dir) return -1;
+    } else if(!strcmp(tok, "src") || !strcmp(tok, "dst")) {
+      if(dir) return -1;
+      dir = (tok[0] == 's') ? NATIVE_DIR_SRC : NATIVE_DIR_DST;
+    } else if(!strcmp(tok, "tcp") || !strcmp(tok, "udp") || !strcmp(tok, "icmp")) {
+      if(dir || proto) return -1;
+      proto = (tok[0] == 't') ? 6 : ((tok[0] == 'u') ? 17 : 1);
+    } else if(!strcmp(tok, "host")) {
+      if(host_dir || (tok = strtok_r(NULL, " \t", &pos)) == NULL || inet_pton(AF_INET, tok, &addr) != 1)
+	return -1;
+      host = ntohl(addr.s_addr), host_dir = dir ? dir : (NATIVE_DIR_SRC | NATIVE_DIR_DST), dir = 0;
+    } else if(!strcmp(tok, "port")) {
+      if(port_dir || (tok = strtok_r(NULL, " \t", &pos)) == NULL)
+	return -1;
+      port = strtol(tok, &end, 10);
+      if(*end != '\0' || port <= 0 || port > 65535)
+	return -1;
+      port_dir = dir ? dir : (NATIVE_DIR_SRC | NATIVE_DIR_DST), dir = 0;
+    } else
+      return -1; /* anything else (or, not, net, ...) is left to BPF */
+  }
+
+  if(dir || (!proto && !host_dir && !port_dir))
+    return -1;
+
+  if(port_dir && proto == 1 /* icmp has no ports */)
+    return -1;
+
+  /* host_dir x port_dir rules, at most 2 x 2 */
+  for(h = NATIVE_DIR_SRC; h <= NATIVE_DIR_DST; h <<= 1) {
+    if(host_dir && !(host_dir & h)) continue;
+
+    for(p = NATIVE_DIR_SRC; p <= NATIVE_DIR_DST; p <<= 1) {
+      filtering_rule *r = &rules[n];
+
+      if(port_dir && !(port_dir & p)) continue;
+
+      memset(r, 0, sizeof(filtering_rule));
+      r->rule_id = PF_RING_NATIVE_FILTER_RULE_ID + n;
+      r->rule_action = forward_packet_and_stop_rule_evaluation;
+      r->core_fields.proto = proto;
+
+      if(host_dir && h == NATIVE_DIR_SRC)
+	r->core_fields.shost.v4 = host, r->core_fields.shost_mask.v4 = 0xFFFFFFFF;
+      else if(host_dir)
+	r->core_fields.dhost.v4 = host, r->core_fields.dhost_mask.v4 = 0xFFFFFFFF;
+
+      if(port_dir && p == NATIVE_DIR_SRC)
+	r->core_fields.sport_low = r->core_fields.sport_high = port;
+      else if(port_dir)
+	r->core_fields.dport_low = r->core_fields.dport_high = port;
+
+      n++;
+      if(!port_dir) break;
+    }
+
+    if(!host_dir) break;
+  }
+
+  *num_rules = n;
+  return 0;
+}
+
+/* **************************************************** */
+
+int pfring_set_native_filter(pfring *ring, char *filter_buffer) {
+  filtering_rule rules[PF_RING_NATIVE_FILTER_MAX_RULES];
+  u_int num_rules = 0, i;
+
+  if(!ring || !filter_buffer)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  pfring_remove_bpf_filter(ring); /* the previous filter, whatever its kind */
+
+  if(ring->add_filtering_rule && ring->remove_filtering_rule && ring->toggle_filtering_policy
+     && (parse_native_filter(filter_buffer, rules, &num_rules) == 0)) {
+    for(i = 0; i < num_rules; i++) {
+      if(ring->add_filtering_rule(ring, &rules[i]) < 0)
+	break;
+    }
+
+    if((i == num_rules) && (ring->toggle_filtering_policy(ring, 0 /* drop what no rule forwards */) >= 0)) {
+      ring->num_native_filter_rules = num_rules;
+      return 1;
+    }
+
+    while(i-- > 0)
+      ring->remove_filtering_rule(ring, rules[i].rule_id);
+  }
+
+  return pfring_set_bpf_filter(ring, filter_buffer);
+}
+
+/* **************************************************** */
+
 int pfring_remove_bpf_filter(pfring *ring){
+  if(ring && ring->num_native_filter_rules > 0) {
+    u_int i;
+
+    for(i = 0; i < ring->num_native_filter_rules; i++)
+      ring->remove_filtering_rule(ring, PF_RING_NATIVE_FILTER_RULE_ID + i);
+
+    ring->num_native_filter_rules = 0;
+    ring->toggle_filtering_policy(ring, 1 /* accept */);
+    return 0;
+  }
+
   if(ring && ring->remove_bpf_filter) {
     return ring->remove_bpf_filter(ring);
   }
 
+  if(ring && ring->userspace_bpf) {
+    pfring_userspace_bpf_remove(ring);
+    return 0;
+  }
+
   return(PF_RING_ERROR_NOT_SUPPORTED);
 }
 
@@ -1305,3 +2650,20 @@ int pfring_send_pkt_buff(pfring *ring, pfring_pkt_buff *pkt_handle, u_int8_t flu
 
 /* **************************************************** */
 
+int pfring_send_pkt_buff_burst(pfring *ring, pfring_pkt_buff **pkt_handles, u_int num_pkts, u_int8_t flush_packet) {
+  u_int i;
+
+  if(!ring || !ring->send_pkt_buff)
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  /* Only the last packet is flushed */
+  for(i = 0; i < num_pkts; i++) {
+    if(ring->send_pkt_buff(ring, pkt_handles[i], flush_packet && (i == (num_pkts - 1))) < 0)
+      break;
+  }
+
+  return(((i > 0) || (num_pkts == 0)) ? (int)i : -1);
+}
+
+/* **************************************************** */
+
@@ -89,11 +89,41 @@ extern "C" {
 #endif
 
   typedef void (*pfringProcesssPacket)(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes);
+  typedef void (*pfringProcesssPacketBurst)(const struct pfring_pkthdr *h, u_char * const *p, u_int num_pkts,
+					    const u_char *user_bytes);
+  typedef void (*pfringProcesssPacketBatch)(struct pfring_pkthdr * const *h, u_char * const *p, u_int num_pkts,
+					    const u_char *user_bytes);
+
+  /* Max number of packets returned by a single pfring_recv_burst() call inside pfring_loop_burst() */
+#define MAX_BURST_LEN 64
+
+  /* pfring_set_dna_parsing() flags */
+#define PF_RING_DNA_PARSE_TIMESTAMP 0x01 /* pfring_gettimeofday() when the NIC gives none */
+#define PF_RING_DNA_PARSE_HASH      0x02 /* extended_hdr.pkt_hash */
+
+  /* Slots pfring_loop_pipelined() looks ahead by default */
+#define DEFAULT_PREFETCH_LOOKAHEAD 4
+
+  /* Max number of threads sharing a ring with pfring_enable_mpmc() */
+#define MAX_MPMC_CONSUMERS 64
 
   /* ********************************* */
 
   typedef struct __pfring pfring; /* Forward declaration */
 
+  /* pfring_open_multichannel_config(): applied to every channel */
+  typedef struct {
+    u_int32_t caplen, flags;     /* as pfring_open() */
+    packet_direction direction;  /* when supported: DNA captures RX only */
+    socket_mode mode;
+    u_int16_t poll_watermark;    /* 0 = default */
+    u_int16_t poll_duration;     /* msec, 0 = default */
+    u_int8_t rehash_rss;
+    u_int8_t enable;             /* pfring_enable_ring() once configured */
+    const char *appl_name;       /* "<appl_name> <channel>", NULL = default */
+  } pfring_channel_config;
+  struct pfring_mpmc;              /* Shared consumption state, see pfring_mod.c */
+
   /* ********************************* */
 
 #define MAX_NUM_BUNDLE_ELEMENTS 32
@@ -108,8 +138,29 @@ extern "C" {
     u_int16_t num_sockets, last_read_socket;
     pfring *sockets[MAX_NUM_BUNDLE_ELEMENTS];
     struct pollfd pfd[MAX_NUM_BUNDLE_ELEMENTS];
+
+    /* pick_fifo: min-heap of the sockets by head packet time, the others are empty */
+    u_int8_t heap_ready;
+    u_int16_t heap_len, num_empty;
+    u_int16_t heap[MAX_NUM_BUNDLE_ELEMENTS], empty[MAX_NUM_BUNDLE_ELEMENTS];
+    struct timespec head_ts[MAX_NUM_BUNDLE_ELEMENTS];
   } pfring_bundle;
 
+  /*
+    Bundle without a size limit: the sockets reported by epoll go to a
+    ready list, read in bursts round robin and left out of it once empty,
+    so that a read costs O(ready sockets) and not O(sockets).
+  */
+  typedef struct {
+    int epfd;
+    u_int32_t num_sockets, max_sockets;
+    pfring **sockets;
+    struct epoll_event *events;   /* epoll_wait() output, max_sockets */
+    u_int32_t *ready;             /* circular list of socket ids, max_sockets */
+    u_int8_t *is_ready;           /* [socket id] */
+    u_int32_t ready_head, num_ready;
+  } pfring_epoll_bundle;
+
   /* ********************************* */
 
   typedef int (*pfringBounceProcesssPacket)(u_int16_t pkt_len, u_char *pkt, const u_char *user_bytes);
@@ -123,6 +174,7 @@ extern "C" {
     /* disabled functions */
     int       (*recv)                         (pfring *, u_char**, u_int, struct pfring_pkthdr *, u_int8_t);
     int       (*send)                         (pfring *, char *, u_int, u_int8_t);
+    int       (*send_burst)                   (pfring *, char **, u_int *, u_int, u_int8_t);
     int       (*send_parsed)                  (pfring *, char *, struct pfring_pkthdr *, u_int8_t);
     int       (*send_get_time)                (pfring *, char *, u_int, struct timespec *);    
   } pfring_bounce;
@@ -131,8 +183,53 @@ extern "C" {
 
   typedef struct {
     u_int64_t recv, drop;
+    u_int64_t sampled; /* pfring_set_overload_policy(): seen but not queued */
   } pfring_stat;
 
+  /*
+    pfring_stats_multichannel(): the counters of every channel read in one
+    pass from the mapped memory (slots_info, DNA registers), at ts
+    (CLOCK_REALTIME, taken right after the pass). Kernel drops are folded
+    into slots_info when the consumer polls or asks pfring_stats(), and
+    every 100 ms while the ring drops.
+  */
+  typedef struct {
+    struct timespec ts;
+    u_int32_t num_channels;
+    pfring_stat total;
+    pfring_stat channel[MAX_NUM_RX_CHANNELS];
+  } pfring_multichannel_stat;
+
+  /*
+    pfring_stats_ext(): why packets were not received, to size rings and
+    cores. The counters a module cannot know are left to 0.
+  */
+  typedef struct {
+    u_int64_t recv;
+    u_int64_t ring_full;        /* no free slot */
+    u_int64_t early_drop;       /* pfring_set_overload_policy() early drop */
+    u_int64_t overload_sampled; /* pfring_set_overload_policy() sampling */
+    u_int64_t sampled;          /* pfring_set_sampling_rate(), pfring_set_flow_sampling_rate() */
+    u_int64_t filtered;         /* BPF filter and filtering rules */
+    u_int64_t blocked;          /* pfring_set_prefix_blocklist() */
+    u_int64_t consumer_lost;    /* shared ring reader lapped by the kernel */
+    u_int64_t nic_missed, nic_no_buffer; /* DNA: NIC MPC and RNBC registers */
+    u_int32_t num_slots;
+    u_int32_t max_queued;       /* occupancy high-water mark since the previous call */
+  } pfring_stat_ext;
+
+  /*
+    Adaptive wait (pfring_set_adaptive_wait()): time spent in each phase
+    when no packet was available, and how many waits ended in each phase.
+    late_wakeups: sleeps that ended with POLL_QUEUE_MIN_LEN or more packets
+    queued, i.e. the spin budget is too short for the traffic.
+  */
+  typedef struct {
+    u_int64_t spin_ns, sleep_ns, block_ns;
+    u_int64_t spin_wakeups, sleep_wakeups, block_wakeups;
+    u_int64_t late_wakeups;
+  } pfring_wait_stats;
+
   /* ********************************* */
 
   typedef enum {
@@ -158,6 +255,10 @@ extern "C" {
 						 Header of the past packet
 						 that has been received on this socket
 					       */
+      u_int16_t watermark; /* pfring_set_tx_watermark(), 0 = no queueing */
+      void *queue;         /* module private: packets sent without flush_packet */
+      FlowSlotTxInfo *ring; /* pfring_set_tx_ring(), NULL = none */
+      u_int32_t ring_pending; /* queued on it since the last flush */
     } tx;
 
     /* TODO these fields should be moved in ->priv_data */
@@ -167,8 +268,13 @@ extern "C" {
       u_int16_t num_rx_pkts_before_dna_sync, num_tx_pkts_before_dna_sync, 
 	dna_rx_sync_watermark, dna_tx_sync_watermark;
       u_int64_t tot_dna_read_pkts, tot_dna_lost_pkts;
+      u_int64_t tot_nic_missed, tot_nic_no_buffer; /* summed: the registers clear on read */
       u_int32_t rx_reg, tx_reg, last_rx_slot_read;
       u_int32_t num_rx_slots_per_chunk, num_tx_slots_per_chunk;
+      u_int8_t parse_level, parse_flags; /* pfring_set_dna_parsing() */
+      u_int32_t wait_spin_usec;          /* pfring_set_dna_wait_spin() */
+      u_int32_t flow_sample_threshold;   /* pfring_set_flow_sampling_rate(), 0 = off */
+      u_int64_t tot_flow_sampled;        /* packets of the flows left out */
       
       dna_device dna_dev;    
       dna_indexes *indexes_ptr;
@@ -180,24 +286,43 @@ extern "C" {
     void       *priv_data; /* module private data */
 
     void      (*close)                        (pfring *);
+    int       (*detach)                       (pfring *);
     int	      (*stats)                        (pfring *, pfring_stat *);
+    int	      (*stats_ext)                    (pfring *, pfring_stat_ext *);
+    int	      (*stats_mapped)                 (pfring *, pfring_stat *); /* no syscall */
     int       (*recv)                         (pfring *, u_char**, u_int, struct pfring_pkthdr *, u_int8_t);
+    int       (*recv_burst)                   (pfring *, u_char**, struct pfring_pkthdr *, u_int, u_int8_t);
+    int       (*recv_batch)                   (pfring *, struct pfring_pkthdr **, u_char**, u_int, u_int8_t);
+    void      (*release_batch)                (pfring *);
+    int       (*enable_mpmc)                  (pfring *, u_int);
+    int       (*mpmc_recv)                    (pfring *, u_int, struct pfring_pkthdr **, u_char**, u_int, u_int8_t);
+    void      (*mpmc_release)                 (pfring *, u_int);
+    int       (*enable_mpsc)                  (pfring *);
     int       (*set_poll_watermark)           (pfring *, u_int16_t);
+    int       (*set_poll_coalescing)          (pfring *, u_int16_t, u_int32_t);
     int       (*set_poll_duration)            (pfring *, u_int);
     int       (*set_tx_watermark)             (pfring *, u_int16_t);
+    int       (*set_tx_ring)                  (pfring *, u_int32_t, u_int32_t);
     int       (*set_channel_id)               (pfring *, u_int32_t);
     int       (*set_application_name)         (pfring *, char *);
     int       (*bind)                         (pfring *, char *);
     int       (*send)                         (pfring *, char *, u_int, u_int8_t);
+    int       (*send_burst)                   (pfring *, char **, u_int *, u_int, u_int8_t);
     int       (*send_parsed)                  (pfring *, char *, struct pfring_pkthdr *, u_int8_t);
     int       (*send_get_time)                (pfring *, char *, u_int, struct timespec *);
     u_int8_t  (*get_num_rx_channels)          (pfring *);
     int       (*set_sampling_rate)            (pfring *, u_int32_t);
+    int       (*set_flow_sampling_rate)       (pfring *, u_int32_t);
+    int       (*set_overload_policy)          (pfring *, u_int8_t, u_int8_t, u_int32_t);
+    int       (*set_shared_ring)              (pfring *, u_int32_t, u_int8_t);
+    int       (*set_latency_histogram)        (pfring *, u_int8_t);
+    int       (*set_timestamp_mode)           (pfring *, u_int8_t);
     int       (*get_selectable_fd)            (pfring *);
     int       (*set_direction)                (pfring *, packet_direction);
     int       (*set_socket_mode)              (pfring *, socket_mode);
     int       (*set_cluster)                  (pfring *, u_int, cluster_type);
     int       (*remove_from_cluster)          (pfring *);
+    int       (*set_cluster_indirection)      (pfring *, const u_int8_t *);
     int       (*set_master_id)                (pfring *, u_int32_t);
     int       (*set_master)                   (pfring *, pfring *);
     u_int16_t (*get_ring_id)                  (pfring *);
@@ -206,12 +331,21 @@ extern "C" {
     int       (*set_packet_consumer_mode)     (pfring *, u_int8_t, char *, u_int);
     int       (*get_hash_filtering_rule_stats)(pfring *, hash_filtering_rule *, char *, u_int *);
     int       (*handle_hash_filtering_rule)   (pfring *, hash_filtering_rule *, u_char);
+    int       (*handle_hash_filtering_rules_bulk) (pfring *, hash_filtering_rule *, u_int32_t, u_char);
+    int       (*get_hash_filtering_rules_stats) (pfring *, struct pfring_hash_rule_stats *, u_int32_t, u_int64_t *);
     int       (*purge_idle_hash_rules)        (pfring *, u_int16_t);
+    int       (*set_hash_rules_idle_timeout)  (pfring *, u_int16_t);
+    int       (*set_hash_rules_table)         (pfring *, u_int32_t, u_int32_t);
+    int       (*set_prefix_blocklist)         (pfring *, struct pfring_blocklist_prefix *, u_int32_t);
+    int       (*offload_drop_prefixes)        (pfring *, struct pfring_blocklist_prefix *, u_int64_t *, u_int32_t);
+    int       (*set_dna_parsing)              (pfring *, u_int8_t, u_int8_t);
+    int       (*set_dna_wait_spin)            (pfring *, u_int32_t);
     int       (*add_filtering_rule)           (pfring *, filtering_rule *);
     int       (*remove_filtering_rule)        (pfring *, u_int16_t);
     int       (*purge_idle_rules)             (pfring *, u_int16_t);
     int       (*get_filtering_rule_stats)     (pfring *, u_int16_t, char *, u_int *);
     int       (*toggle_filtering_policy)      (pfring *, u_int8_t);
+    int       (*set_flow_cache_lifetime)      (pfring *, u_int32_t);
     int       (*enable_rss_rehash)            (pfring *);
     int       (*poll)                         (pfring *, u_int);
     int       (*is_pkt_available)             (pfring *);
@@ -223,7 +357,11 @@ extern "C" {
     int       (*set_virtual_device)           (pfring *, virtual_filtering_device_info *);
     int       (*add_hw_rule)                  (pfring *, hw_filtering_rule *);
     int       (*remove_hw_rule)               (pfring *, u_int16_t);
+    int       (*add_hw_rules)                 (pfring *, hw_filtering_rule *, u_int32_t);
+    int       (*remove_hw_rules)              (pfring *, u_int16_t *, u_int32_t);
+    int       (*get_num_hw_rules)             (pfring *);
     int       (*loopback_test)                (pfring *, char *, u_int, u_int);
+    int       (*loopback_inject)              (pfring *, struct pfring_loopback_inject *);
     int       (*enable_ring)                  (pfring *);
     int       (*disable_ring)                 (pfring *);
     void      (*shutdown)                     (pfring *);
@@ -260,8 +398,18 @@ extern "C" {
     /* Silicom Redirector Only */
     struct {
       int8_t device_id, port_id;
+      u_int16_t max_rules;     /* learnt rule table size (0 = unknown) */
+      u_int16_t num_offloaded; /* pfring_offload_drop_prefixes() */
+      void *offloaded;
     } rdi;
 
+    /* Chelsio T4 Only */
+    struct {
+      u_int16_t max_rules;     /* learnt filter table size (0 = unknown) */
+      u_int16_t num_offloaded; /* pfring_offload_drop_prefixes() */
+      void *offloaded;
+    } t4;
+
     filtering_mode ft_mode;
     pfring_device_type ft_device_type;
 
@@ -270,25 +418,76 @@ extern "C" {
     u_int32_t caplen;
     u_int16_t slot_header_len;
     u_int8_t kernel_packet_consumer, is_shutting_down, socket_default_accept_policy;
+    u_int8_t adopted; /* pfring_open_fd(): socket configured by another process */
     int fd;
     FlowSlotInfo *slots_info;
     u_int poll_sleep;
     u_int16_t poll_duration;
     u_int8_t promisc, clear_promisc, reentrant, break_recv_loop;
+    u_int8_t consumer_state_set; /* PF_RING_CONSUMER_* chosen: see pfring_mod_consumer_opt_in() */
     u_long num_poll_calls;
+    u_int32_t adaptive_spin_usec; /* 0 = always block in poll() */
+    pfring_wait_stats wait_stats;
+    struct {
+      /* Read frontier of the slots handed out by recv_batch, published on release */
+      u_int64_t tot_read;
+      u_int64_t remove_off;
+      u_int32_t num_pkts; /* num_pkts = 0: nothing outstanding */
+    } batch;
+    struct pfring_mpmc *mpmc; /* NULL unless pfring_enable_mpmc() */
+    struct {
+      u_int8_t mpsc;                /* pfring_enable_mpsc() */
+      volatile u_int64_t claim;     /* (slots claimed << 32) | next insert_off */
+    } usring;
+    u_int8_t percpu_rings, metadata_only, compact_header;
+    u_int32_t ring_mem_policy; /* PFRING_MEM_* */
+    u_int32_t slot_layout;     /* PFRING_SLOT_* */
+    struct {
+      /* num > 1: slots_info/slots point to the sub-ring being read */
+      u_int8_t num, next;
+      FlowSlotInfo *slots_info[MAX_NUM_SUB_RINGS];
+    } sub_rings;
     pthread_rwlock_t rx_lock, tx_lock;
 
     struct sockaddr_ll sock_tx;
 
     /* Reflector socket (copy RX packets onto it) */
     pfring *reflector_socket;
+
+    /* Filtering rules installed by pfring_set_native_filter() */
+    u_int8_t num_native_filter_rules;
+
+    /* struct bpf_program run in userland, modules without kernel BPF (DNA, DAG) */
+    void *userspace_bpf;
+
+    /* NULL unless pfring_set_latency_histogram(): in the userland page of the ring */
+    struct pfring_latency_histogram *latency_hist;
+
+    /* Kernels for the CPU of the host, resolved by pfring_open() (see pfring_cpu_features()) */
+    struct {
+      u_int32_t cpu_features;
+      void (*parse_pkt_burst)(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+			      u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash);
+    } simd;
   };
 
   /* ********************************* */
 
+  #define PF_RING_NATIVE_FILTER_RULE_ID  65520 /* up to PF_RING_NATIVE_FILTER_MAX_RULES ids */
+  #define PF_RING_NATIVE_FILTER_MAX_RULES 4
+
+  /* ********************************* */
+
   #define PF_RING_REENTRANT        1 << 1
   #define PF_RING_LONG_HEADER     1 << 2
   #define PF_RING_PROMISC          1 << 3
+  #define PF_RING_PERCPU_RINGS     1 << 4 /* kernel fills one sub-ring per CPU without locking, merged on receive */
+  #define PF_RING_METADATA_ONLY    1 << 5 /* slots hold a struct pfring_compact_pkthdr only: caplen 0 */
+  #define PF_RING_COMPACT_HEADER   1 << 6 /* struct pfring_compact_pkthdr slots, converted on receive */
+  #define PF_RING_NUMA_LOCAL_MEM   1 << 7 /* ring memory on the NUMA node of the NIC */
+  #define PF_RING_CONTIGUOUS_MEM   1 << 8 /* ring memory physically contiguous when it fits */
+  #define PF_RING_ALIGNED_SLOTS    1 << 9 /* slots on cache line boundaries */
+  #define PF_RING_NT_COPY          1 << 10 /* kernel copies into the ring with non-temporal stores */
 
   /* ********************************* */
 
@@ -298,38 +497,172 @@ extern "C" {
 			       char* consumer_data, u_int consumer_data_len);
   u_int8_t pfring_open_multichannel(char *device_name, u_int32_t caplen, 
 				    u_int32_t flags, pfring* ring[MAX_NUM_RX_CHANNELS]);
-
+  /*
+    Channels opened (ring memory allocated in the kernel) and configured
+    one thread each. Returns the channels 0..n-1 opened, the others are closed.
+  */
+  int pfring_open_multichannel_config(char *device_name, const pfring_channel_config *config,
+				      pfring* ring[MAX_NUM_RX_CHANNELS]);
+
+  /*
+    Handle of a socket configured, bound and mapped by pfring_open() in
+    another process, passed on a UNIX socket (SCM_RIGHTS, see
+    pfring_detach_fd()): the ring is mapped again as it is, the packets
+    queued included, and read from the current remove_off. flags as the
+    ones the socket was opened with (header format). The fd is closed on
+    failure. Plain PF_RING sockets only.
+  */
+  pfring* pfring_open_fd(int fd, char *device_name, u_int32_t caplen, u_int32_t flags);
+  /*
+    Unmaps the ring and frees the handle, but leaves the socket as it is
+    (bound, enabled, rules and cluster, still capturing) and returns its
+    fd, for another process to pfring_open_fd() it. Its consumers must
+    have returned first: pfring_breakloop(), not pfring_shutdown() that
+    stops the socket. PF_RING_ERROR_NOT_SUPPORTED but for the plain
+    PF_RING sockets.
+  */
+  int pfring_detach_fd(pfring *ring);
   void pfring_shutdown(pfring *ring);
   void pfring_config(u_short cpu_percentage);
   int  pfring_loop(pfring *ring, pfringProcesssPacket looper, 
 		   const u_char *user_bytes, u_int8_t wait_for_packet);
+  int  pfring_loop_burst(pfring *ring, pfringProcesssPacketBurst looper,
+			 const u_char *user_bytes, u_int burst_len, u_int8_t wait_for_packet);
+  int  pfring_loop_batch(pfring *ring, pfringProcesssPacketBatch looper,
+			 const u_char *user_bytes, u_int batch_len, u_int8_t wait_for_packet);
+  /*
+    As pfring_loop(), but the slots 2*lookahead packets ahead are prefetched
+    and prefetch_hook (optional) is called on the packet 'lookahead' slots
+    ahead, so that the application can prefetch its own state (e.g. the
+    hash bucket of the flow) before the packet gets to the looper.
+  */
+  int  pfring_loop_pipelined(pfring *ring, pfringProcesssPacket looper, pfringProcesssPacket prefetch_hook,
+			     const u_char *user_bytes, u_int lookahead, u_int8_t wait_for_packet);
+  int  pfring_loop_mpmc(pfring *ring, u_int consumer_id, pfringProcesssPacketBatch looper,
+			const u_char *user_bytes, u_int batch_len, u_int8_t wait_for_packet);
   void pfring_breakloop(pfring *);
   
   void pfring_close(pfring *ring);
   int pfring_stats(pfring *ring, pfring_stat *stats);
+  /* The channels of pfring_open_multichannel() (up to MAX_NUM_RX_CHANNELS), no syscall: see pfring_multichannel_stat */
+  int pfring_stats_multichannel(pfring **rings, u_int32_t num_rings, pfring_multichannel_stat *stats);
+  /* Drops by reason and ring occupancy: see pfring_stat_ext */
+  int pfring_stats_ext(pfring *ring, pfring_stat_ext *stats);
   int pfring_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 		  struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+  /*
+    Zero-copy: buffers[i] points into the ring and it is valid until the next
+    receive call or pfring_release_batch(), whichever comes first
+  */
+  int pfring_recv_burst(pfring *ring, u_char* buffers[], struct pfring_pkthdr hdrs[],
+			u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+  /*
+    Zero-copy, headers included: hdrs[i] and buffers[i] point into the ring
+    slots, which the kernel does not reuse until pfring_release_batch() (or
+    the next pfring_recv_batch(), which releases the previous batch first).
+    Requires PF_RING_LONG_HEADER as the parsed fields are read in place.
+  */
+  int pfring_recv_batch(pfring *ring, struct pfring_pkthdr* hdrs[], u_char* buffers[],
+			u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+  void pfring_release_batch(pfring *ring);
+  /*
+    Several threads draining the same ring without rx_lock: each consumer
+    (0..num_consumers-1, one thread each) claims a range of slots and reads
+    it in place as with pfring_recv_batch(); the kernel gets the slots back
+    once every range before them has been released. Once enabled the ring
+    must only be read with pfring_mpmc_recv().
+  */
+  int pfring_enable_mpmc(pfring *ring, u_int num_consumers);
+  int pfring_mpmc_recv(pfring *ring, u_int consumer_id, struct pfring_pkthdr* hdrs[], u_char* buffers[],
+		       u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+  void pfring_mpmc_release(pfring *ring, u_int consumer_id);
+  /*
+    Several threads sending on the same usrX producer without tx_lock (do
+    not open it PF_RING_REENTRANT): slots are claimed atomically and the
+    packets published in claim order. To be called before they start.
+  */
+  int pfring_enable_mpsc(pfring *ring);
   int pfring_recv_parsed(pfring *ring, u_char** buffer, u_int buffer_len,
 		  struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet,
 		  u_int8_t level /* 1..4 */, u_int8_t add_timestamp, u_int8_t add_hash);
   int pfring_set_poll_watermark(pfring *ring, u_int16_t watermark);
+  int pfring_set_poll_coalescing(pfring *ring, u_int16_t num_pkts, u_int32_t usec);
   int pfring_set_poll_duration(pfring *ring, u_int duration);
   int pfring_set_tx_watermark(pfring *ring, u_int16_t watermark);
+  /*
+    Sends through num_slots slots of up to max_pkt_len bytes mmap()ed from
+    the kernel instead of one sendto() per packet: the slots queued are
+    sent with a single syscall when a packet is flushed, the ring is full
+    or pfring_set_tx_watermark() packets are queued. Non-DNA sockets only.
+  */
+  int pfring_set_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t max_pkt_len);
   int pfring_add_hw_rule(pfring *ring, hw_filtering_rule *rule);
   int pfring_remove_hw_rule(pfring *ring, u_int16_t rule_id);
+  /*
+    Many hardware rules with one syscall per MAX_HW_RULES_BULK rules (and one
+    driver call on an 82599): returns the rules added/removed, the first ones
+    of the array when no id is skipped (already there/missing), or < 0 when
+    none could be
+  */
+  int pfring_add_hw_rules(pfring *ring, hw_filtering_rule *rules, u_int32_t num_rules);
+  int pfring_remove_hw_rules(pfring *ring, u_int16_t *rule_ids, u_int32_t num_rules);
+  /* Hardware filters in use on the bound device, by any application: 0 if it has none */
+  int pfring_get_num_hw_rules(pfring *ring);
   int pfring_set_channel_id(pfring *ring, u_int32_t channel_id);
   int pfring_set_application_name(pfring *ring, char *name);
   int pfring_bind(pfring *ring, char *device_name);
   int pfring_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet);
+  /* num_pkts packets, transmitted (flushed) once: returns the number of packets sent */
+  int pfring_send_burst(pfring *ring, char **pkts, u_int *pkts_len, u_int num_pkts, u_int8_t flush_packet);
   int pfring_send_parsed(pfring *ring, char *pkt, struct pfring_pkthdr *hdr, u_int8_t flush_packet);
   int pfring_send_get_time(pfring *ring, char *pkt, u_int pkt_len, struct timespec *ts);
   u_int8_t pfring_get_num_rx_channels(pfring *ring);
   int pfring_set_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */);
+  /*
+    All the packets, both directions, of 1 in <rate> flows instead of 1 in
+    <rate> packets (see SO_SET_FLOW_SAMPLING_RATE): connection handshakes
+    stay paired and the counts of a flow are exact, the totals scaling by
+    pfring_flow_sampling_scale(pfring_flow_sampling_threshold(rate)). In the
+    kernel for the PF_RING sockets, in the library for DNA (parsed up to L4
+    whatever pfring_set_dna_parsing() says). Flows are picked by the same
+    hash either way.
+  */
+  int pfring_set_flow_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */);
+  int pfring_set_overload_policy(pfring *ring, u_int8_t early_drop,
+				 u_int8_t sample_threshold /* ring occupancy %, 0 = no sampling */,
+				 u_int32_t max_sample_rate);
+  /*
+    Lets other processes read the packets of this ring without a copy of
+    their own: pfring_open("shared:<shared_ring_id>") maps it read-only
+    with a cursor of its own (same header flags as this ring). A slot is
+    reused once every reader is past it; with drop_slowest a reader
+    holding the ring back skips ahead instead (counted in its drops).
+    After pfring_open(), before the readers.
+  */
+  int pfring_set_shared_ring(pfring *ring, u_int32_t shared_ring_id, u_int8_t drop_slowest);
+  /*
+    Queueing delay (kernel insert to read) and ring fill level histograms,
+    see struct pfring_latency_histogram: the kernel then stamps the insert
+    time in place of the packet ns timestamp. Counted by the recv, burst
+    and batch receive calls, not by pfring_loop_mpmc().
+  */
+  int pfring_set_latency_histogram(pfring *ring, u_int8_t enable);
+  int pfring_get_latency_histogram(pfring *ring, struct pfring_latency_histogram *hist);
+  /*
+    The packet time the application needs (PFRING_TSTAMP_*, default
+    PFRING_TSTAMP_HW). The kernel reads the clock once per packet for the
+    finest mode of the sockets of the device: with PFRING_TSTAMP_NONE
+    (counting only) the headers have no time unless another socket asks
+    for one, with PFRING_TSTAMP_COARSE the time is the one of the last tick.
+  */
+  int pfring_set_timestamp_mode(pfring *ring, u_int8_t mode);
   int pfring_get_selectable_fd(pfring *ring);
   int pfring_set_direction(pfring *ring, packet_direction direction);
   int pfring_set_socket_mode(pfring *ring, socket_mode mode);
   int pfring_set_cluster(pfring *ring, u_int clusterId, cluster_type the_type);
   int pfring_remove_from_cluster(pfring *ring);
+  /* Bucket -> member table of the symmetric cluster types (CLUSTER_INDIRECTION_LEN entries) */
+  int pfring_set_cluster_indirection(pfring *ring, const u_int8_t *element);
   int pfring_set_master_id(pfring *ring, u_int32_t master_id);
   int pfring_set_master(pfring *ring, pfring *master);
   u_int16_t pfring_get_ring_id(pfring *ring);
@@ -340,18 +673,72 @@ extern "C" {
   int pfring_handle_hash_filtering_rule(pfring *ring,
 					hash_filtering_rule* rule_to_add,
 					u_char add_rule);
+  /*
+    Many hash rules with one syscall per MAX_HASH_RULES_BULK rules: returns the
+    rules added/removed (duplicates and missing rules are skipped) or < 0 on error
+  */
+  int pfring_add_hash_filtering_rules_bulk(pfring *ring, hash_filtering_rule *rules, u_int32_t num_rules);
+  int pfring_remove_hash_filtering_rules_bulk(pfring *ring, hash_filtering_rule *rules, u_int32_t num_rules);
   int pfring_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add);
   int pfring_remove_filtering_rule(pfring *ring, u_int16_t rule_id);
   int pfring_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec);
+  /* Hash rules idle for inactivity_sec are removed by the kernel (0 = disabled) */
+  int pfring_set_hash_rules_idle_timeout(pfring *ring, u_int16_t inactivity_sec);
+  /*
+    Hash rules table buckets (doubled by the kernel as rules are added,
+    0 = DEFAULT_RING_HASH_SIZE) and max number of hash rules (0 = no limit)
+  */
+  int pfring_set_hash_rules_table(pfring *ring, u_int32_t table_size, u_int32_t max_rules);
+  /* Drop the packets coming from these prefixes before any filtering (replaces the previous list) */
+  int pfring_set_prefix_blocklist(pfring *ring, struct pfring_blocklist_prefix *prefixes, u_int32_t num_prefixes);
+  /*
+    Drop these prefixes in the NIC (Silicom redirector switch, Chelsio T4
+    filters): only the highest volumes fit the rule table, the previous set is
+    updated in place. Returns the number of prefixes offloaded.
+  */
+  int pfring_offload_drop_prefixes(pfring *ring, struct pfring_blocklist_prefix *prefixes,
+				   u_int64_t *volumes, u_int32_t num_prefixes);
+  /*
+    DNA: what pfring_recv() fills in the header (default level 4, timestamp
+    and hash). Level 0 parses nothing: pfring_lazy_parsed_pkt() does it
+    when a field is needed. Zero-copy reads parse nothing in any case.
+    DAG: same levels (default 0), the timestamp always comes from the card.
+  */
+  int pfring_set_dna_parsing(pfring *ring, u_int8_t level /* 0, 2..4 */, u_int8_t flags /* PF_RING_DNA_PARSE_* */);
+  /*
+    DNA: a blocking pfring_recv() keeps checking the RX ring for up to
+    usec before it calls poll(), which re-arms the queue interrupt. 0
+    (default) sleeps at once. See also the dna_irq_hold_polls parameter
+    of pf_ring.ko.
+  */
+  int pfring_set_dna_wait_spin(pfring *ring, u_int32_t usec);
   int pfring_purge_idle_rules(pfring *ring, u_int16_t inactivity_sec);
+  /* Rules without plugin: stats is a struct pfring_rule_reflect_stats */
   int pfring_get_hash_filtering_rule_stats(pfring *ring,
 					   hash_filtering_rule* rule,
 					   char* stats, u_int *stats_len);
   int pfring_get_filtering_rule_stats(pfring *ring, u_int16_t rule_id,
 				      char* stats, u_int *stats_len);
+  /*
+    Counters of all the hash rules, max_rules at a time: start with
+    *cursor = 0 and call again until it is 0 again. Returns the number
+    of entries of stats filled or < 0 on error.
+  */
+  int pfring_get_hash_filtering_rules_stats(pfring *ring, struct pfring_hash_rule_stats *stats,
+					    u_int32_t max_rules, u_int64_t *cursor);
   int pfring_toggle_filtering_policy(pfring *ring, u_int8_t rules_default_accept_policy);
+  /*
+    The next packets of a flow get the verdict of the wildcard rules
+    without evaluating them, for msec after the first one (per CPU, see
+    SO_SET_FLOW_CACHE_LIFETIME). Only for the rule sets that match on the
+    5-tuple and VLAN, and forward or drop. 0 = no cache.
+  */
+  int pfring_set_flow_cache_lifetime(pfring *ring, u_int32_t msec);
   int pfring_enable_rss_rehash(pfring *ring);
   int pfring_poll(pfring *ring, u_int wait_duration);
+  int pfring_set_adaptive_wait(pfring *ring, u_int32_t spin_usec);
+  int pfring_get_wait_stats(pfring *ring, pfring_wait_stats *stats);
+  int pfring_wait_for_packet(pfring *ring);
   int pfring_is_pkt_available(pfring *ring);
   int pfring_next_pkt_time(pfring *ring, struct timespec *ts);
   int pfring_next_pkt_raw_timestamp(pfring *ring, u_int64_t *timestamp_ns);
@@ -362,10 +749,23 @@ extern "C" {
   int pfring_get_bound_device_id(pfring *ring, int *device_id);
   int pfring_set_virtual_device(pfring *ring, virtual_filtering_device_info *info);
   int pfring_loopback_test(pfring *ring, char *buffer, u_int buffer_len, u_int test_len);
+  /*
+    Benchmark: the kernel inserts req->num_pkts synthetic packets into the
+    ring (see struct pfring_loopback_inject). Blocks the calling thread
+    until done: read the ring from another one.
+  */
+  int pfring_loopback_inject(pfring *ring, struct pfring_loopback_inject *req);
   int pfring_enable_ring(pfring *ring);
   int pfring_disable_ring(pfring *ring);
   int pfring_set_bpf_filter(pfring *ring, char *filter_buffer);
-  int pfring_remove_bpf_filter(pfring *ring);
+  /*
+    Simple expressions ([ip] [tcp|udp|icmp] [and] [src|dst] host <IPv4> [and] [src|dst] port <port>)
+    become wildcard filtering rules, from rule id PF_RING_NATIVE_FILTER_RULE_ID on, with a
+    default drop policy: no BPF program runs per packet. Other expressions are set with
+    pfring_set_bpf_filter(). Returns 1 (rules), 0 (BPF) or < 0.
+  */
+  int pfring_set_native_filter(pfring *ring, char *filter_buffer);
+  int pfring_remove_bpf_filter(pfring *ring); /* or the pfring_set_native_filter() rules */
   int pfring_set_filtering_mode(pfring *ring, filtering_mode mode);
   int pfring_get_device_clock(pfring *ring, struct timespec *ts);
   int pfring_set_device_clock(pfring *ring, struct timespec *ts);
@@ -385,6 +785,7 @@ extern "C" {
   void pfring_release_pkt_buff(pfring *ring, pfring_pkt_buff *pkt_handle);
   int pfring_recv_pkt_buff(pfring *ring, pfring_pkt_buff *pkt_handle, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet); /* Note: this function fills the buffer pointed by pkt_handle */
   int pfring_send_pkt_buff(pfring *ring, pfring_pkt_buff *pkt_handle, u_int8_t flush_packet); /* Note: this function reset the buffer pointed by pkt_handle */
+  int pfring_send_pkt_buff_burst(pfring *ring, pfring_pkt_buff **pkt_handles, u_int num_pkts, u_int8_t flush_packet); /* Same, flushed once: returns the number of packets sent */
 
   /* PF_RING Socket bundle */
   void pfring_bundle_init(pfring_bundle *bundle, bundle_read_policy p);
@@ -394,8 +795,22 @@ extern "C" {
 			 u_char** buffer, u_int buffer_len,
 			 struct pfring_pkthdr *hdr,
 			 u_int8_t wait_for_incoming_packet);
+  /* Up to max_num_pkts packets (time ordered with pick_fifo), waiting for the first one only */
+  int pfring_bundle_read_batch(pfring_bundle *bundle,
+			       u_char* buffers[], u_int buffer_len,
+			       struct pfring_pkthdr hdrs[], u_int max_num_pkts,
+			       u_int8_t wait_for_incoming_packet);
   void pfring_bundle_destroy(pfring_bundle *bundle);
   void pfring_bundle_close(pfring_bundle *bundle);  
+  int pfring_epoll_bundle_init(pfring_epoll_bundle *bundle);
+  int pfring_epoll_bundle_add(pfring_epoll_bundle *bundle, pfring *ring);
+  int pfring_epoll_bundle_poll(pfring_epoll_bundle *bundle, u_int wait_duration);
+  /* Zero-copy burst from the next ready socket, returned in *ring (see pfring_recv_burst()) */
+  int pfring_epoll_bundle_read_burst(pfring_epoll_bundle *bundle, pfring **ring,
+				     u_char* buffers[], struct pfring_pkthdr hdrs[],
+				     u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+  void pfring_epoll_bundle_destroy(pfring_epoll_bundle *bundle);
+  void pfring_epoll_bundle_close(pfring_epoll_bundle *bundle);
 
   /* PF_RING Bounce */
   int pfring_bounce_init(pfring_bounce *bounce, pfring *ingress_ring, pfring *egress_ring);
@@ -407,7 +822,45 @@ extern "C" {
   /* Utils (defined in pfring_utils.c) */
   int pfring_parse_pkt(u_char *pkt, struct pfring_pkthdr *hdr, u_int8_t level /* 2..4 */, 
 		       u_int8_t add_timestamp /* 0,1 */, u_int8_t add_hash /* 0,1 */);
+  /* Same result as pfring_parse_pkt() on each packet, with a fast path for IPv4 TCP/UDP */
+  void pfring_parse_pkt_burst(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+			      u_int8_t level /* 2..4 */, u_int8_t add_timestamp, u_int8_t add_hash);
+  /* Parsed on first use (level 4 and hash) when the header left it empty */
+  struct pkt_parsing_info* pfring_lazy_parsed_pkt(u_char *pkt, struct pfring_pkthdr *hdr);
+  /*
+    Hash stored in extended_hdr.pkt_hash by pfring_parse_pkt() when it is
+    not already set (default pkt_hash_sum). Toeplitz uses the symmetric
+    key unless pfring_set_rss_key() sets the one programmed in the NIC.
+    Both are meant to be called before the capture threads start.
+  */
+  void pfring_set_pkt_hash_type(pkt_hash_type type);
+  /*
+    Clock of the timestamps filled in by the library: calibrated TSC
+    (re-synced with CLOCK_REALTIME every second) when the CPU has an
+    invariant one, CLOCK_REALTIME otherwise or after pfring_set_tsc_clock(0)
+  */
+  u_int64_t pfring_gettime_ns(void);
+  void pfring_gettimeofday(struct timeval *tv);
+  void pfring_set_tsc_clock(u_int8_t enable);
+  int pfring_set_rss_key(const u_int8_t *key, u_int key_len);
+  u_int32_t pfring_compute_pkt_hash(const struct pfring_pkthdr *hdr, pkt_hash_type type);
+  /*
+    PF_RING_CPU_* the SIMD kernels of the library may use on this host,
+    detected once (CPUID, and XGETBV for the AVX state saved by the OS),
+    restricted by the PF_RING_CPU_FEATURES=<mask> environment variable
+  */
+#define PF_RING_CPU_SSSE3   0x01
+#define PF_RING_CPU_SSE42   0x02
+#define PF_RING_CPU_AVX2    0x04
+#define PF_RING_CPU_AVX512  0x08 /* F and BW */
+  u_int32_t pfring_cpu_features(void);
+  void pfring_resolve_simd(pfring *ring);
   int pfring_set_if_promisc(const char *device, int set_promisc);
+  /* Userland BPF used by pfring_set_bpf_filter() when the module has no kernel filter */
+  int pfring_userspace_bpf_set(pfring *ring, char *filter_buffer);
+  void pfring_userspace_bpf_remove(pfring *ring);
+  int pfring_userspace_bpf_match(pfring *ring, const u_char *pkt, u_int caplen, u_int len);
+  u_int pfring_userspace_bpf_filter_burst(pfring *ring, u_char *buffers[], struct pfring_pkthdr hdrs[], u_int num_pkts);
   char* pfring_format_numbers(double val, char *buf, u_int buf_len, u_int8_t add_decimals);
   int pfring_enable_hw_timestamp(pfring* ring, char *device_name, u_int8_t enable_rx, u_int8_t enable_tx);
 
@@ -0,0 +1,166 @@
+/*
+ *
+ * (C) 2012 - Luca Deri <deri@ntop.org>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/*
+  Header-only C++ (C++11) layer over the PF_RING API.
+
+  pfring_loop*() call the application through a function pointer for
+  every packet (or burst): the compiler can neither inline the handler
+  nor optimize across packets. Here the receive loop is a template on the
+  handler type: it is compiled in the application, on top of the same
+  zero-copy slot access as pfring_loop_batch() (pfring_recv_batch(), the
+  headers and packets read in place in the ring), and the handler is
+  inlined into the drain loop.
+
+    pf_ring::ring r = pf_ring::ring::open("eth1", 128, PF_RING_PROMISC | PF_RING_LONG_HEADER);
+
+    if(r && (r.enable() == 0))
+      r.loop([&](const struct pfring_pkthdr &h, const u_char *p) { count(h, p); });
+
+  A handler is any callable: a lambda, or a class with an inline
+  operator(). loop() calls it once per packet,
+    void (const struct pfring_pkthdr &hdr, const u_char *pkt)
+  and loop_burst() once per burst of up to burst_len packets:
+    void (struct pfring_pkthdr * const *hdrs, u_char * const *pkts, u_int num_pkts)
+  The slots stay valid until the handler returns. Sockets without long
+  headers (pfring_recv_batch() not supported) are read with
+  pfring_recv_burst(), the headers being copied out.
+
+  A ring owns its pfring: pfring_close() is called by its destructor.
+  It can be moved, not copied. Errors are the return codes of the C API.
+*/
+
+#ifndef _PFRING_HPP_
+#define _PFRING_HPP_
+
+#include "pfring.h"
+
+namespace pf_ring {
+
+  class ring {
+  public:
+    ring() : r_(NULL) {}
+    /* Takes ownership of r */
+    explicit ring(pfring *r) : r_(r) {}
+    ~ring() { reset(); }
+
+    ring(ring &&other) : r_(other.r_) { other.r_ = NULL; }
+    ring& operator=(ring &&other) {
+      if(this != &other) {
+	reset(other.r_);
+	other.r_ = NULL;
+      }
+      return(*this);
+    }
+
+    ring(const ring &) = delete;
+    ring& operator=(const ring &) = delete;
+
+    /* As pfring_open(): test the result with operator bool */
+    static ring open(const char *device_name, u_int32_t caplen, u_int32_t flags) {
+      return(ring(pfring_open(const_cast<char *>(device_name), caplen, flags)));
+    }
+
+    explicit operator bool() const { return(r_ != NULL); }
+    pfring* get() const { return(r_); }
+
+    /* Gives up ownership */
+    pfring* release() {
+      pfring *r = r_;
+
+      r_ = NULL;
+      return(r);
+    }
+
+    void reset(pfring *r = NULL) {
+      if(r_ != NULL) pfring_close(r_);
+      r_ = r;
+    }
+
+    int  enable() { return(pfring_enable_ring(r_)); }
+    void breakloop() { pfring_breakloop(r_); }
+    int  stats(pfring_stat &stats) { return(pfring_stats(r_, &stats)); }
+    int  set_direction(packet_direction direction) { return(pfring_set_direction(r_, direction)); }
+    int  set_bpf_filter(const char *filter) { return(pfring_set_bpf_filter(r_, const_cast<char *>(filter))); }
+
+    /* As pfring_loop_batch(), the handler inlined */
+    template <typename Handler>
+    int loop_burst(Handler &&handler, u_int8_t wait_for_packet = 1, u_int burst_len = MAX_BURST_LEN) {
+      struct pfring_pkthdr *hdrs[MAX_BURST_LEN];
+      u_char *pkts[MAX_BURST_LEN];
+      int rc;
+
+      if((r_ == NULL) || r_->is_shutting_down || (r_->recv == NULL) || (r_->mode == send_only_mode))
+	return(-1);
+
+      if((burst_len == 0) || (burst_len > MAX_BURST_LEN))
+	burst_len = MAX_BURST_LEN;
+
+      r_->break_recv_loop = 0;
+
+      while(!r_->break_recv_loop) {
+	/* The previous burst is released by the next receive */
+	rc = pfring_recv_batch(r_, hdrs, pkts, burst_len, wait_for_packet);
+	if(rc == PF_RING_ERROR_NOT_SUPPORTED)
+	  return(loop_burst_copy(handler, wait_for_packet, burst_len));
+	else if(rc < 0)
+	  break;
+	else if(rc > 0)
+	  handler(hdrs, pkts, (u_int)rc);
+      }
+
+      pfring_release_batch(r_);
+      return(rc);
+    }
+
+    /* As pfring_loop(), the handler inlined */
+    template <typename Handler>
+    int loop(Handler &&handler, u_int8_t wait_for_packet = 1, u_int burst_len = MAX_BURST_LEN) {
+      return(loop_burst([&handler](struct pfring_pkthdr * const *hdrs, u_char * const *pkts, u_int num_pkts) {
+	    for(u_int i = 0; i < num_pkts; i++) {
+	      if((i + 1) < num_pkts) {
+		__builtin_prefetch(hdrs[i + 1]);
+		__builtin_prefetch(pkts[i + 1]);
+	      }
+	      handler(*hdrs[i], pkts[i]);
+	    }
+	  }, wait_for_packet, burst_len));
+    }
+
+  private:
+    /* Short slot headers: pfring_recv_burst(), the headers copied out */
+    template <typename Handler>
+    int loop_burst_copy(Handler &handler, u_int8_t wait_for_packet, u_int burst_len) {
+      struct pfring_pkthdr hdr[MAX_BURST_LEN], *hdrs[MAX_BURST_LEN];
+      u_char *pkts[MAX_BURST_LEN];
+      int rc = 0;
+
+      for(u_int i = 0; i < MAX_BURST_LEN; i++)
+	hdrs[i] = &hdr[i];
+
+      while(!r_->break_recv_loop) {
+	rc = pfring_recv_burst(r_, pkts, hdr, burst_len, wait_for_packet);
+	if(rc < 0)
+	  break;
+	else if(rc > 0)
+	  handler(hdrs, pkts, (u_int)rc);
+      }
+
+      return(rc);
+    }
+
+    pfring *r_;
+  };
+
+} /* namespace pf_ring */
+
+#endif /* _PFRING_HPP_ */
@@ -0,0 +1,234 @@
+/*
+ *
+ * (C) 2012 - Luca Deri <deri@ntop.org>
+ *            Alfredo Cardigliano <cardigliano@ntop.org>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lessed General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+/*
+  Chelsio T4 (cxgb4) filter engine: IPv4 drop rules with address prefixes,
+  programmed by the kernel module through the driver (chelsio_t4_filter_rule).
+  The rule id is the index in the adapter filter table.
+*/
+
+/* ********************************* */
+
+static u_int8_t t4_mask_len(u_int32_t mask /* host byte order */) {
+  u_int8_t len = 0;
+
+  while(mask & 0x80000000)
+    len++, mask <<= 1;
+
+  return(len);
+}
+
+/* ********************************* */
+
+static int t4_drop_rule_action(rule_action_behaviour action) {
+  switch(action) {
+  case forward_packet_and_stop_rule_evaluation:
+  case forward_packet_add_rule_and_stop_rule_evaluation:
+    return 0; /* Nothing to do */
+
+  case dont_forward_packet_and_stop_rule_evaluation:
+    return 1; /* Ok - DROP */
+
+  default:
+    return -3; /* Not supported */
+  }
+}
+
+/* ********************************* */
+
+int t4_add_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_add) {
+  hw_filtering_rule rule;
+  int rc;
+
+  if((rc = t4_drop_rule_action(rule_to_add->rule_action)) <= 0)
+    return rc;
+
+  memset(&rule, 0, sizeof(rule));
+  rule.rule_id = rule_to_add->rule_id;
+  rule.rule_family_type = chelsio_t4_filter_rule;
+  rule.rule_family.t4_rule.proto      = rule_to_add->proto;
+  rule.rule_family.t4_rule.s_addr     = rule_to_add->host_peer_a.v4;
+  rule.rule_family.t4_rule.s_mask_len = rule_to_add->host_peer_a.v4 ? 32 : 0;
+  rule.rule_family.t4_rule.d_addr     = rule_to_add->host_peer_b.v4;
+  rule.rule_family.t4_rule.d_mask_len = rule_to_add->host_peer_b.v4 ? 32 : 0;
+  rule.rule_family.t4_rule.s_port     = rule_to_add->port_peer_a;
+  rule.rule_family.t4_rule.d_port     = rule_to_add->port_peer_b;
+  rule.rule_family.t4_rule.queue_id   = -1;
+
+  return virtual_filtering_device_add_hw_rule(ring, &rule);
+}
+
+/* ********************************* */
+
+int t4_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
+  hw_filtering_rule rule;
+  int rc;
+
+  if((rc = t4_drop_rule_action(rule_to_add->rule_action)) <= 0)
+    return rc;
+
+  if(rule_to_add->core_fields.vlan_id
+     || rule_to_add->core_fields.sport_high != rule_to_add->core_fields.sport_low
+     || rule_to_add->core_fields.dport_high != rule_to_add->core_fields.dport_low)
+    return -3; /* No VLAN, no port range */
+
+  memset(&rule, 0, sizeof(rule));
+  rule.rule_id = rule_to_add->rule_id;
+  rule.rule_family_type = chelsio_t4_filter_rule;
+  rule.rule_family.t4_rule.proto      = rule_to_add->core_fields.proto;
+  rule.rule_family.t4_rule.s_addr     = rule_to_add->core_fields.shost.v4;
+  rule.rule_family.t4_rule.s_mask_len = rule_to_add->core_fields.shost.v4 ? t4_mask_len(rule_to_add->core_fields.shost_mask.v4) : 0;
+  rule.rule_family.t4_rule.d_addr     = rule_to_add->core_fields.dhost.v4;
+  rule.rule_family.t4_rule.d_mask_len = rule_to_add->core_fields.dhost.v4 ? t4_mask_len(rule_to_add->core_fields.dhost_mask.v4) : 0;
+  rule.rule_family.t4_rule.s_port     = rule_to_add->core_fields.sport_low;
+  rule.rule_family.t4_rule.d_port     = rule_to_add->core_fields.dport_low;
+  rule.rule_family.t4_rule.queue_id   = -1;
+
+  return virtual_filtering_device_add_hw_rule(ring, &rule);
+}
+
+/* ********************************* */
+
+int t4_remove_filtering_rule(pfring *ring, u_int16_t rule_id) {
+  return virtual_filtering_device_remove_hw_rule(ring, rule_id);
+}
+
+/* ********************************* */
+
+/*
+  Mitigation offload: the prefixes sending the most traffic get the filters
+  T4_OFFLOAD_FIRST_RULE_ID and above (lower ids are left to the application
+  rules). Unlike the redirector each filter is written on its own, hence only
+  the prefixes entering or leaving the selection are touched. The capacity is
+  learnt from the first add failure (beyond the adapter filter table).
+*/
+
+#define T4_OFFLOAD_FIRST_RULE_ID  256
+#define T4_MAX_OFFLOAD_RULES      256
+
+struct t4_offloaded_prefix {
+  u_int32_t addr;
+  u_int8_t  prefix_len;
+  u_int16_t slot;
+};
+
+struct t4_offload_candidate {
+  struct pfring_blocklist_prefix *prefix;
+  u_int64_t volume;
+};
+
+static int t4_cmp_volume(const void *_a, const void *_b) {
+  const struct t4_offload_candidate *a = _a, *b = _b;
+
+  if(a->volume == b->volume) return(0);
+  return((a->volume > b->volume) ? -1 : 1);
+}
+
+/* ********************************* */
+
+int t4_offload_drop_prefixes(pfring *ring, struct pfring_blocklist_prefix *prefixes,
+			     u_int64_t *volumes, u_int32_t num_prefixes) {
+  struct t4_offloaded_prefix *offloaded = ring->t4.offloaded, *next;
+  struct t4_offload_candidate *candidates;
+  u_int8_t used[T4_MAX_OFFLOAD_RULES];
+  u_int i, j, slot = 0, num_candidates = 0, num_next = 0, capacity;
+
+  if(!ring->socket_default_accept_policy)
+    num_prefixes = 0; /* Nothing to drop: everything not forwarded is already dropped */
+
+  if(offloaded == NULL) {
+    if((offloaded = calloc(T4_MAX_OFFLOAD_RULES, sizeof(*offloaded))) == NULL)
+      return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+    ring->t4.offloaded = offloaded;
+  }
+
+  capacity = ring->t4.max_rules ? ring->t4.max_rules : T4_MAX_OFFLOAD_RULES;
+
+  if((candidates = malloc((num_prefixes + 1) * sizeof(*candidates))) == NULL)
+    return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+
+  if((next = calloc(T4_MAX_OFFLOAD_RULES, sizeof(*next))) == NULL) {
+    free(candidates);
+    return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+  }
+
+  for(i = 0; i < num_prefixes; i++) {
+    if(prefixes[i].ip_version != 4 /* IPv4 only */
+       || prefixes[i].prefix_len == 0 || prefixes[i].prefix_len > 32)
+      continue;
+    candidates[num_candidates].prefix = &prefixes[i];
+    candidates[num_candidates].volume = volumes ? volumes[i] : 0;
+    num_candidates++;
+  }
+
+  qsort(candidates, num_candidates, sizeof(*candidates), t4_cmp_volume);
+
+  if(num_candidates > capacity)
+    num_candidates = capacity;
+
+  memset(used, 0, sizeof(used));
+
+  /* Keep the filters still selected, remove the others */
+  for(i = 0; i < ring->t4.num_offloaded; i++) {
+    for(j = 0; j < num_candidates; j++)
+      if(candidates[j].prefix != NULL
+	 && candidates[j].prefix->addr.v4 == offloaded[i].addr
+	 && candidates[j].prefix->prefix_len == offloaded[i].prefix_len)
+	break;
+
+    if(j < num_candidates) {
+      next[num_next++] = offloaded[i];
+      used[offloaded[i].slot] = 1;
+      candidates[j].prefix = NULL; /* Already there */
+    } else {
+      virtual_filtering_device_remove_hw_rule(ring, T4_OFFLOAD_FIRST_RULE_ID + offloaded[i].slot);
+      used[offloaded[i].slot] = 1; /* Deletion pending in the adapter: not reusable yet */
+    }
+  }
+
+  for(j = 0; j < num_candidates; j++) {
+    hw_filtering_rule rule;
+
+    if(candidates[j].prefix == NULL) continue;
+
+    while(slot < T4_MAX_OFFLOAD_RULES && used[slot]) slot++;
+    if(slot == T4_MAX_OFFLOAD_RULES) break;
+
+    memset(&rule, 0, sizeof(rule));
+    rule.rule_id = T4_OFFLOAD_FIRST_RULE_ID + slot;
+    rule.rule_family_type = chelsio_t4_filter_rule;
+    rule.rule_family.t4_rule.s_addr = candidates[j].prefix->addr.v4;
+    rule.rule_family.t4_rule.s_mask_len = candidates[j].prefix->prefix_len;
+    rule.rule_family.t4_rule.queue_id = -1;
+
+    if(virtual_filtering_device_add_hw_rule(ring, &rule) < 0) {
+      /* Table full: remember its size */
+      ring->t4.max_rules = num_next;
+      break;
+    }
+
+    next[num_next].addr = candidates[j].prefix->addr.v4;
+    next[num_next].prefix_len = candidates[j].prefix->prefix_len;
+    next[num_next].slot = slot;
+    used[slot] = 1;
+    num_next++;
+  }
+
+  free(candidates);
+
+  memcpy(offloaded, next, num_next * sizeof(*next));
+  ring->t4.num_offloaded = num_next;
+  free(next);
+
+  return(num_next);
+}
@@ -27,9 +27,64 @@ static int virtual_filtering_device_remove_hw_rule(pfring *ring, u_int16_t rule_
   return setsockopt(ring->fd, 0, SO_DEL_HW_FILTERING_RULE, &rule_id, sizeof(rule_id));
 }
 
+/* One syscall per MAX_HW_RULES_BULK rules: the rules (add) or rule ids (remove) done, < 0 if none */
+static int virtual_filtering_device_hw_rules_bulk(pfring *ring, void *rules, u_int32_t num_rules, u_char add_rule) {
+  size_t rule_len = add_rule ? sizeof(hw_filtering_rule) : sizeof(u_int16_t);
+  struct pfring_hw_rules_bulk *bulk;
+  u_int32_t done = 0, i, n;
+  int rc = 0;
+
+  n = (num_rules < MAX_HW_RULES_BULK) ? num_rules : MAX_HW_RULES_BULK;
+  if((bulk = (struct pfring_hw_rules_bulk*)malloc(sizeof(*bulk) + n * rule_len)) == NULL)
+    return(-1);
+
+  for(i = 0; i < num_rules; i += n) {
+    n = ((num_rules - i) < MAX_HW_RULES_BULK) ? (num_rules - i) : MAX_HW_RULES_BULK;
+
+    bulk->num_rules = n, bulk->num_done = 0;
+    memcpy(bulk->rules, (char*)rules + i * rule_len, n * rule_len);
+
+    rc = setsockopt(ring->fd, 0, add_rule ? SO_ADD_HW_FILTERING_RULES : SO_DEL_HW_FILTERING_RULES,
+		    bulk, sizeof(*bulk) + n * rule_len);
+
+    done += bulk->num_done;
+
+    if(rc < 0)
+      break;
+  }
+
+  free(bulk);
+
+  if((rc < 0) && (done == 0) && (errno == ENOPROTOOPT)) {
+    /* A kernel without the bulk options: one rule at a time */
+    for(i = 0; i < num_rules; i++) {
+      if(add_rule)
+	rc = virtual_filtering_device_add_hw_rule(ring, &((hw_filtering_rule*)rules)[i]);
+      else
+	rc = virtual_filtering_device_remove_hw_rule(ring, ((u_int16_t*)rules)[i]);
+
+      if(rc < 0) break;
+      done++;
+    }
+  }
+
+  return((done > 0) ? (int)done : rc);
+}
+
+static int virtual_filtering_device_get_num_hw_rules(pfring *ring) {
+  u_int16_t num_filters;
+  socklen_t len = sizeof(num_filters);
+
+  if(getsockopt(ring->fd, 0, SO_GET_NUM_HW_FILTERS, &num_filters, &len) < 0)
+    return -1;
+
+  return num_filters;
+}
+
 /* ********************************* */
 
 #include "pfring_i82599.c"
+#include "pfring_chelsio_t4.c"
 
 /* ********************************* */
 
@@ -70,6 +125,7 @@ int pfring_hw_ft_add_hw_rule(pfring *ring, hw_filtering_rule *rule) {
 
   switch (ring->ft_device_type) {
     case intel_82599_family:
+    case chelsio_t4_family:
       rc = virtual_filtering_device_add_hw_rule(ring, rule);
       break;
 
@@ -97,6 +153,7 @@ int pfring_hw_ft_remove_hw_rule(pfring *ring, u_int16_t rule_id) {
 
   switch (ring->ft_device_type) {
     case intel_82599_family:
+    case chelsio_t4_family:
       rc = virtual_filtering_device_remove_hw_rule(ring, rule_id);
       break;
 
@@ -119,6 +176,84 @@ int pfring_hw_ft_remove_hw_rule(pfring *ring, u_int16_t rule_id) {
 
 /* ********************************* */
 
+int pfring_hw_ft_add_hw_rules(pfring *ring, hw_filtering_rule *rules, u_int32_t num_rules) {
+  int rc;
+
+  if(num_rules == 0)
+    return 0;
+
+  switch (ring->ft_device_type) {
+    case intel_82599_family:
+    case chelsio_t4_family:
+      rc = virtual_filtering_device_hw_rules_bulk(ring, rules, num_rules, 1 /* add */);
+      break;
+
+    case standard_nic_family:
+    default:
+      rc = num_rules;
+    break;
+  }
+
+#ifdef HAVE_REDIRECTOR
+  if(ring && (ring->rdi.port_id != -1)) {
+    u_int32_t i;
+
+    for(i = 0; (rc > 0) && (i < (u_int32_t)rc); i++)
+      redirector_add_hw_rule(ring, &rules[i], NULL, NULL);
+  }
+#endif
+
+  return rc;
+}
+
+/* ********************************* */
+
+int pfring_hw_ft_remove_hw_rules(pfring *ring, u_int16_t *rule_ids, u_int32_t num_rules) {
+  int rc;
+
+  if(num_rules == 0)
+    return 0;
+
+  switch (ring->ft_device_type) {
+    case intel_82599_family:
+    case chelsio_t4_family:
+      rc = virtual_filtering_device_hw_rules_bulk(ring, rule_ids, num_rules, 0 /* remove */);
+      break;
+
+    case standard_nic_family:
+    default:
+      rc = num_rules;
+    break;
+  }
+
+#ifdef HAVE_REDIRECTOR
+  if(ring && (ring->rdi.port_id != -1)) {
+    u_int32_t i;
+
+    for(i = 0; (rc > 0) && (i < (u_int32_t)rc); i++)
+      redirector_remove_hw_rule(ring, rule_ids[i]);
+  }
+#endif
+
+  return rc;
+}
+
+/* ********************************* */
+
+int pfring_hw_ft_get_num_hw_rules(pfring *ring) {
+  switch (ring->ft_device_type) {
+    case intel_82599_family:
+    case chelsio_t4_family:
+      return virtual_filtering_device_get_num_hw_rules(ring);
+
+    case standard_nic_family:
+    default:
+      return 0;
+  }
+}
+
+/* ********************************* */
+
 int pfring_hw_ft_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_add, u_char add_rule) {
   int rc;
 
@@ -136,6 +271,13 @@ int pfring_hw_ft_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* r
         rc = i82599_remove_filtering_rule(ring, rule_to_add->rule_id);
       break;
 
+    case chelsio_t4_family:
+      if(add_rule)
+        rc = t4_add_hash_filtering_rule(ring, rule_to_add);
+      else
+        rc = t4_remove_filtering_rule(ring, rule_to_add->rule_id);
+      break;
+
     case standard_nic_family:
     default:
       rc = 0;
@@ -173,6 +315,10 @@ int pfring_hw_ft_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
       rc = i82599_add_filtering_rule(ring, rule_to_add); 
       break;
 
+    case chelsio_t4_family:
+      rc = t4_add_filtering_rule(ring, rule_to_add);
+      break;
+
     case standard_nic_family:
     default:
       rc = 0;
@@ -200,6 +346,10 @@ int pfring_hw_ft_remove_filtering_rule(pfring *ring, u_int16_t rule_id) {
       rc = i82599_remove_filtering_rule(ring, rule_id);
       break;
 
+    case chelsio_t4_family:
+      rc = t4_remove_filtering_rule(ring, rule_id);
+      break;
+
     case standard_nic_family:
     default:
       rc = 0;
@@ -217,3 +367,18 @@ int pfring_hw_ft_remove_filtering_rule(pfring *ring, u_int16_t rule_id) {
   return rc;
 }
 
+
+/* ********************************* */
+
+int pfring_hw_ft_offload_drop_prefixes(pfring *ring, struct pfring_blocklist_prefix *prefixes,
+				       u_int64_t *volumes, u_int32_t num_prefixes) {
+#ifdef HAVE_REDIRECTOR
+  if(ring->rdi.port_id != -1)
+    return(redirector_offload_drop_prefixes(ring, prefixes, volumes, num_prefixes));
+#endif
+
+  if(ring->ft_device_type == chelsio_t4_family)
+    return(t4_offload_drop_prefixes(ring, prefixes, volumes, num_prefixes));
+
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+}
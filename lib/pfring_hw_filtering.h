@@ -18,9 +18,14 @@ void pfring_hw_ft_init(pfring *ring);
 int pfring_hw_ft_set_traffic_policy(pfring *ring, u_int8_t rules_default_accept_policy);
 int pfring_hw_ft_add_hw_rule(pfring *ring, hw_filtering_rule *rule);
 int pfring_hw_ft_remove_hw_rule(pfring *ring, u_int16_t rule_id);
+int pfring_hw_ft_add_hw_rules(pfring *ring, hw_filtering_rule *rules, u_int32_t num_rules);
+int pfring_hw_ft_remove_hw_rules(pfring *ring, u_int16_t *rule_ids, u_int32_t num_rules);
+int pfring_hw_ft_get_num_hw_rules(pfring *ring);
 int pfring_hw_ft_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_add, u_char add_rule);
 int pfring_hw_ft_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add);
 int pfring_hw_ft_remove_filtering_rule(pfring *ring, u_int16_t rule_id);
+int pfring_hw_ft_offload_drop_prefixes(pfring *ring, struct pfring_blocklist_prefix *prefixes,
+				       u_int64_t *volumes, u_int32_t num_prefixes);
 
 
 #endif /* _PFRING_HW_FT_H_ */
@@ -35,6 +35,7 @@ int i82599_add_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_ad
   case bounce_packet_and_continue_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
+  case rate_limit_packet_and_stop_rule_evaluation:
   default:
     return -3; /* Not supported */
   }
@@ -76,6 +77,7 @@ int i82599_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
   case bounce_packet_and_continue_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
+  case rate_limit_packet_and_stop_rule_evaluation:
   default:
     return -3; /* Not supported */
   }
@@ -15,8 +15,10 @@
  *
  */
 
+#define _GNU_SOURCE /* sendmmsg() */
 #define __USE_XOPEN2K
 #include <sys/types.h>
+#include <stddef.h>
 #include <pthread.h>
 
 //#define ENABLE_BPF
@@ -59,7 +61,90 @@ unsigned long long rdtsc() {
 
 /* **************************************************** */
 
+/* Moves slots_info/slots to the next sub-ring holding packets, round robin */
+int pfring_select_sub_ring(pfring *ring) {
+  u_int i;
+
+  for(i = 0; i < ring->sub_rings.num; i++) {
+    FlowSlotInfo *si = ring->sub_rings.slots_info[ring->sub_rings.next];
+
+    if(++ring->sub_rings.next == ring->sub_rings.num)
+      ring->sub_rings.next = 0;
+
+    if(si->tot_insert != si->tot_read) {
+      /* The outstanding batch frontier belongs to the current sub-ring */
+      if(unlikely(ring->batch.num_pkts > 0) && (si != ring->slots_info))
+	pfring_mod_release_batch(ring);
+
+      ring->slots_info = si, ring->slots = (char*)si + sizeof(FlowSlotInfo);
+      return(1);
+    }
+  }
+
+  return(0);
+}
+
+/* **************************************************** */
+
+/*
+  Shared ring reader cut loose by the owner (SHARED_RING_LAPPED): moves
+  the cursor where the owner resumed inserting, the packets in between
+  are accounted as lost. Returns 0 when the owner has not inserted
+  anything since the reader attached.
+*/
+int pfring_shared_ring_resync(pfring *ring) {
+  FlowSlotInfo *si = ring->slots_info;
+  u_int64_t resync = *(volatile u_int64_t*)&si->shared_ring_resync, tot_insert;
+
+  if(resync == (u_int64_t)-1)
+    return(0);
+
+  rmb();
+
+  /* The owner only publishes the low bits of its tot_insert */
+  tot_insert = si->tot_insert;
+  tot_insert -= (tot_insert - SHARED_RING_RESYNC_INSERT(resync)) & SHARED_RING_RESYNC_INSERT_MASK;
+
+  si->shared_ring_lost += tot_insert - si->tot_read;
+  si->tot_read = tot_insert, si->remove_off = SHARED_RING_RESYNC_OFF(resync);
+
+  gcc_mb();
+  si->shared_ring_flags &= ~SHARED_RING_LAPPED; /* the owner checks this cursor again */
+  return(1);
+}
+
+/* **************************************************** */
+
+/*
+  The kernel reads the consumer_state of the first sub-ring only.
+  Rings start in PF_RING_CONSUMER_LEGACY, as an application may poll()
+  ring->fd directly; the first receive or pfring_poll() opts into
+  spinning unless the fd was handed out by pfring_get_selectable_fd().
+  The flag is one word per ring, so it only tracks a single waiter:
+  rings read by several threads (reentrant, MPMC) stay in LEGACY.
+*/
+static inline volatile u_int32_t *consumer_state(pfring *ring) {
+  return(&((FlowSlotInfo *)ring->buffer)->consumer_state);
+}
+
+static void pfring_mod_consumer_opt_in(pfring *ring) {
+  ring->consumer_state_set = 1;
+
+  if(!ring->reentrant && (ring->mpmc == NULL))
+    *consumer_state(ring) = PF_RING_CONSUMER_SPINNING;
+}
+
+/* **************************************************** */
+
 inline int pfring_there_is_pkt_available(pfring *ring) {
+  if(unlikely(ring->sub_rings.num > 1))
+    return(pfring_select_sub_ring(ring));
+
+  /* 0 but for shared ring readers */
+  if(unlikely(ring->slots_info->shared_ring_flags & SHARED_RING_LAPPED)
+     && !pfring_shared_ring_resync(ring))
+    return(0);
+
   return(ring->slots_info->tot_insert != ring->slots_info->tot_read);
 }
 
@@ -67,25 +152,45 @@ inline int pfring_there_is_pkt_available(pfring *ring) {
 
 int pfring_mod_open(pfring *ring) {
   int rc;
-  u_int memSlotsLen;
+  u_int64_t memSlotsLen;
+  u_int i;
 
   /* Setting pointers, we need these functions soon */
   ring->close = pfring_mod_close;
+  ring->detach = pfring_mod_detach;
   ring->stats = pfring_mod_stats;
+  ring->stats_mapped = pfring_mod_stats_mapped;
+  ring->stats_ext = pfring_mod_stats_ext;
   ring->recv  = pfring_mod_recv;
+  ring->recv_burst = pfring_mod_recv_burst;
+  ring->recv_batch = pfring_mod_recv_batch;
+  ring->release_batch = pfring_mod_release_batch;
+  ring->enable_mpmc = pfring_mod_enable_mpmc;
+  ring->mpmc_recv = pfring_mod_mpmc_recv;
+  ring->mpmc_release = pfring_mod_mpmc_release;
   ring->set_poll_watermark = pfring_mod_set_poll_watermark;
+  ring->set_poll_coalescing = pfring_mod_set_poll_coalescing;
   ring->set_poll_duration = pfring_mod_set_poll_duration;
   ring->set_channel_id = pfring_mod_set_channel_id;
   ring->set_application_name = pfring_mod_set_application_name;
   ring->bind = pfring_mod_bind;
   ring->send = pfring_mod_send;
+  ring->send_burst = pfring_mod_send_burst;
+  ring->set_tx_watermark = pfring_mod_set_tx_watermark;
+  ring->set_tx_ring = pfring_mod_set_tx_ring;
   ring->get_num_rx_channels = pfring_mod_get_num_rx_channels;
   ring->set_sampling_rate = pfring_mod_set_sampling_rate;
+  ring->set_flow_sampling_rate = pfring_mod_set_flow_sampling_rate;
+  ring->set_overload_policy = pfring_mod_set_overload_policy;
+  ring->set_shared_ring = pfring_mod_set_shared_ring;
+  ring->set_latency_histogram = pfring_mod_set_latency_histogram;
+  ring->set_timestamp_mode = pfring_mod_set_timestamp_mode;
   ring->get_selectable_fd = pfring_mod_get_selectable_fd;
   ring->set_direction = pfring_mod_set_direction;
   ring->set_socket_mode = pfring_mod_set_socket_mode;
   ring->set_cluster = pfring_mod_set_cluster;
   ring->remove_from_cluster = pfring_mod_remove_from_cluster;
+  ring->set_cluster_indirection = pfring_mod_set_cluster_indirection;
   ring->set_master_id = pfring_mod_set_master_id;
   ring->set_master = pfring_mod_set_master;
   ring->get_ring_id = pfring_mod_get_ring_id;
@@ -94,21 +199,36 @@ int pfring_mod_open(pfring *ring) {
   ring->set_packet_consumer_mode = pfring_mod_set_packet_consumer_mode;
   ring->get_hash_filtering_rule_stats = pfring_mod_get_hash_filtering_rule_stats;
   ring->handle_hash_filtering_rule = pfring_mod_handle_hash_filtering_rule;
+  ring->handle_hash_filtering_rules_bulk = pfring_mod_handle_hash_filtering_rules_bulk;
+  ring->get_hash_filtering_rules_stats = pfring_mod_get_hash_filtering_rules_stats;
   ring->purge_idle_hash_rules = pfring_mod_purge_idle_hash_rules;
+  ring->set_hash_rules_idle_timeout = pfring_mod_set_hash_rules_idle_timeout;
+  ring->set_hash_rules_table = pfring_mod_set_hash_rules_table;
+  ring->set_prefix_blocklist = pfring_mod_set_prefix_blocklist;
+  ring->bounce_init = pfring_mod_bounce_init;
+  ring->bounce_loop = pfring_mod_bounce_loop;
+  ring->bounce_destroy = pfring_mod_bounce_destroy;
   ring->add_filtering_rule = pfring_mod_add_filtering_rule;
   ring->remove_filtering_rule = pfring_mod_remove_filtering_rule;
   ring->purge_idle_rules = pfring_mod_purge_idle_rules;
   ring->get_filtering_rule_stats = pfring_mod_get_filtering_rule_stats;
   ring->toggle_filtering_policy = pfring_mod_toggle_filtering_policy;
+  ring->set_flow_cache_lifetime = pfring_mod_set_flow_cache_lifetime;
   ring->enable_rss_rehash = pfring_mod_enable_rss_rehash;
   ring->poll = pfring_mod_poll;
   ring->version = pfring_mod_version;
+  ring->next_pkt_time = pfring_mod_next_pkt_time;
   ring->get_bound_device_address = pfring_mod_get_bound_device_address;
   ring->get_slot_header_len = pfring_mod_get_slot_header_len;
   ring->set_virtual_device = pfring_mod_set_virtual_device;
   ring->add_hw_rule = pfring_hw_ft_add_hw_rule;
   ring->remove_hw_rule = pfring_hw_ft_remove_hw_rule;
+  ring->add_hw_rules = pfring_hw_ft_add_hw_rules;
+  ring->remove_hw_rules = pfring_hw_ft_remove_hw_rules;
+  ring->get_num_hw_rules = pfring_hw_ft_get_num_hw_rules;
+  ring->offload_drop_prefixes = pfring_hw_ft_offload_drop_prefixes;
   ring->loopback_test = pfring_mod_loopback_test;
+  ring->loopback_inject = pfring_mod_loopback_inject;
   ring->enable_ring = pfring_mod_enable_ring;
   ring->disable_ring = pfring_mod_disable_ring;
   ring->is_pkt_available = pfring_mod_is_pkt_available;
@@ -118,6 +238,13 @@ int pfring_mod_open(pfring *ring) {
   ring->send_last_rx_packet = pfring_mod_send_last_rx_packet;
 
   ring->poll_duration = DEFAULT_POLL_DURATION;
+
+  if(ring->adopted) {
+    /* pfring_open_fd(): bound, configured and with its ring allocated */
+    ring->kernel_packet_consumer = 0;
+    goto map_ring;
+  }
+
   ring->fd = socket(PF_RING, SOCK_RAW, htons(ETH_P_ALL));
 
   if(ring->fd < 0)
@@ -144,6 +271,25 @@ int pfring_mod_open(pfring *ring) {
     }
   }
 
+  if(ring->metadata_only) {
+    rc = setsockopt(ring->fd, 0, SO_SET_METADATA_ONLY, &ring->metadata_only, sizeof(ring->metadata_only));
+
+    if(rc < 0) {
+      close(ring->fd);
+      return -1;
+    }
+  } else if(ring->compact_header) {
+    u_int32_t version = PFRING_COMPACT_HDR_V1;
+
+    /* An older kernel refuses the version: no silent fallback to pfring_pkthdr */
+    rc = setsockopt(ring->fd, 0, SO_SET_PKT_HEADER_FORMAT, &version, sizeof(version));
+
+    if(rc < 0) {
+      close(ring->fd);
+      return -1;
+    }
+  }
+
   /* printf("channel_id=%d\n", channel_id); */
 
   if(!strcmp(ring->device_name, "none")) {
@@ -159,6 +305,33 @@ int pfring_mod_open(pfring *ring) {
 
   ring->kernel_packet_consumer = 0;
 
+  if(ring->percpu_rings) {
+    u_int32_t num_sub_rings = 0; /* one per CPU */
+
+    /* Before the first mmap(), which allocates the ring */
+    if(setsockopt(ring->fd, 0, SO_SET_PERCPU_RINGS, &num_sub_rings, sizeof(num_sub_rings)) < 0) {
+      close(ring->fd);
+      return -1;
+    }
+  }
+
+  /* After pfring_bind(): the NUMA node is the one of the bound device */
+  if(ring->ring_mem_policy) {
+    if(setsockopt(ring->fd, 0, SO_SET_RING_MEM_POLICY, &ring->ring_mem_policy, sizeof(ring->ring_mem_policy)) < 0) {
+      close(ring->fd);
+      return -1;
+    }
+  }
+
+  if(ring->slot_layout) {
+    if(setsockopt(ring->fd, 0, SO_SET_SLOT_LAYOUT, &ring->slot_layout, sizeof(ring->slot_layout)) < 0) {
+      close(ring->fd);
+      return -1;
+    }
+  }
+
+  /* Maps the ring of an adopted socket as it is, its remove_off included */
+ map_ring:
   ring->buffer = (char *)mmap(NULL, PAGE_SIZE, PROT_READ|PROT_WRITE,
 			      MAP_SHARED, ring->fd, 0);
 
@@ -176,7 +349,10 @@ int pfring_mod_open(pfring *ring) {
     close(ring->fd);
     return -1;
   }
-  memSlotsLen = ring->slots_info->tot_mem;
+  if(ring->slots_info->num_sub_rings > 1)
+    ring->sub_rings.num = ring->slots_info->num_sub_rings;
+
+  memSlotsLen = ring->slots_info->tot_mem * (ring->sub_rings.num ? ring->sub_rings.num : 1);
   munmap(ring->buffer, PAGE_SIZE);
 
   ring->buffer = (char *)mmap(NULL, memSlotsLen,
@@ -194,12 +370,18 @@ int pfring_mod_open(pfring *ring) {
    ring->slots_info = (FlowSlotInfo *)ring->buffer;
    ring->slots = (char *)(ring->buffer+sizeof(FlowSlotInfo));
 
+   for(i = 0; i < ring->sub_rings.num; i++)
+     ring->sub_rings.slots_info[i] = (FlowSlotInfo *)&ring->buffer[i * ring->slots_info->tot_mem];
+
+   /* Anybody may poll() ring->fd until the first receive says otherwise */
+   ring->slots_info->consumer_state = PF_RING_CONSUMER_LEGACY;
+
 #ifdef RING_DEBUG
-  printf("RING (%s): tot_mem=%u/max_slot_len=%u/"
-	 "insert_off=%u/remove_off=%u/dropped=%lu\n",
-	 ring->device_name, ring->slots_info->tot_mem,
-	 ring->slots_info->slot_len,   ring->slots_info->insert_off,
-	 ring->slots_info->remove_off, ring->slots_info->tot_lost);
+  printf("RING (%s): tot_mem=%llu/max_slot_len=%u/"
+	 "insert_off=%llu/remove_off=%llu/dropped=%lu\n",
+	 ring->device_name, (unsigned long long)ring->slots_info->tot_mem,
+	 ring->slots_info->slot_len, (unsigned long long)ring->slots_info->insert_off,
+	 (unsigned long long)ring->slots_info->remove_off, ring->slots_info->tot_lost);
 #endif
 
   if(ring->promisc) {
@@ -222,6 +404,108 @@ int pfring_mod_open(pfring *ring) {
 
 /* ******************************* */
 
+/*
+  "shared:<id>": reader of the ring of another socket (see
+  pfring_set_shared_ring()). The kernel maps that ring read-only but for
+  the second page of FlowSlotInfo, tot_read/remove_off, that is this
+  reader's own cursor: the receive path is the one of pfring_mod_open()
+*/
+int pfring_mod_shared_open(pfring *ring) {
+  u_int32_t shared_ring_id;
+  u_int64_t tot_mem;
+  socklen_t s_len;
+  char *end;
+
+  ring->close = pfring_mod_close;
+  ring->stats = pfring_mod_stats;
+  ring->stats_mapped = pfring_mod_stats_mapped;
+  ring->stats_ext = pfring_mod_stats_ext;
+  ring->recv  = pfring_mod_recv;
+  ring->recv_burst = pfring_mod_recv_burst;
+  ring->recv_batch = pfring_mod_recv_batch;
+  ring->release_batch = pfring_mod_release_batch;
+  ring->get_selectable_fd = pfring_mod_get_selectable_fd;
+  ring->poll = pfring_mod_poll;
+  ring->version = pfring_mod_version;
+  ring->get_slot_header_len = pfring_mod_get_slot_header_len;
+  ring->enable_ring = pfring_mod_enable_ring;
+  ring->disable_ring = pfring_mod_disable_ring;
+  ring->is_pkt_available = pfring_mod_is_pkt_available;
+  ring->shutdown = pfring_mod_shutdown;
+
+  ring->poll_duration = DEFAULT_POLL_DURATION;
+
+  shared_ring_id = strtoul(ring->device_name, &end, 10);
+  if((*end != '\0') || (shared_ring_id == 0))
+    return -1;
+
+  ring->fd = socket(PF_RING, SOCK_RAW, htons(ETH_P_ALL));
+
+  if(ring->fd < 0)
+    return -1;
+
+  if(setsockopt(ring->fd, 0, SO_ATTACH_SHARED_RING, &shared_ring_id, sizeof(shared_ring_id)) < 0) {
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->buffer = (char *)mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, ring->fd, 0);
+
+  if(ring->buffer == MAP_FAILED) {
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->slots_info = (FlowSlotInfo *)ring->buffer;
+  if(ring->slots_info->version != RING_FLOWSLOT_VERSION) {
+    printf("Wrong RING version: "
+	   "kernel is %i, libpfring was compiled with %i\n",
+	   ring->slots_info->version, RING_FLOWSLOT_VERSION);
+    munmap(ring->buffer, PAGE_SIZE);
+    close(ring->fd);
+    return -1;
+  }
+
+  tot_mem = ring->slots_info->tot_mem;
+  munmap(ring->buffer, PAGE_SIZE);
+
+  ring->buffer = (char *)mmap(NULL, tot_mem, PROT_READ, MAP_SHARED, ring->fd, 0);
+
+  if(ring->buffer == MAP_FAILED) {
+    close(ring->fd);
+    return -1;
+  }
+
+  /* Our cursor, writable, over the second page */
+  if(mmap(&ring->buffer[offsetof(FlowSlotInfo, tot_read)], PAGE_SIZE, PROT_READ|PROT_WRITE,
+	  MAP_SHARED|MAP_FIXED, ring->fd, PF_RING_SHARED_CURSOR_MEM_ID * PAGE_SIZE) == MAP_FAILED) {
+    munmap(ring->buffer, tot_mem);
+    close(ring->fd);
+    return -1;
+  }
+
+  ring->slots_info = (FlowSlotInfo *)ring->buffer;
+  ring->slots = (char *)(ring->buffer+sizeof(FlowSlotInfo));
+
+  /* The slot layout of the owner */
+  ring->slot_header_len = pfring_get_slot_header_len(ring);
+  s_len = sizeof(ring->caplen);
+
+  if((ring->slot_header_len == (u_int16_t)-1)
+     || (getsockopt(ring->fd, 0, SO_GET_BUCKET_LEN, &ring->caplen, &s_len) < 0)) {
+    pfring_mod_close(ring);
+    return -1;
+  }
+
+  ring->long_header = (ring->slot_header_len == sizeof(struct pfring_pkthdr));
+  ring->compact_header = (ring->slot_header_len == sizeof(struct pfring_compact_pkthdr));
+  ring->metadata_only = (ring->compact_header && (ring->caplen == 0));
+
+  return 0;
+}
+
+/* ******************************* */
+
 int pfring_mod_set_channel_id(pfring *ring, u_int32_t channel_id) {
   return(setsockopt(ring->fd, 0, SO_SET_CHANNEL_ID, &channel_id, sizeof(channel_id)));
 }
@@ -278,209 +562,1098 @@ int pfring_mod_bind(pfring *ring, char *device_name) {
       for(i = min_val; i <= max_val; i++)
 	channel_id |= 1 << i;
 
-      tok = strtok_r(NULL, ",", &pos);
-    }
-  }
+      tok = strtok_r(NULL, ",", &pos);
+    }
+  }
+
+  /* Setup TX */
+  ring->sock_tx.sll_family = PF_PACKET;
+  ring->sock_tx.sll_protocol = htons(ETH_P_ALL);
+
+  snprintf(name_copy, sizeof(name_copy), "%s", device_name);
+  elem = strtok(name_copy, ";,");
+
+  while(elem != NULL) {
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_family = PF_RING;
+    snprintf(sa.sa_data, sizeof(sa.sa_data), "%s", elem);
+
+    rc = bind(ring->fd, (struct sockaddr *)&sa, sizeof(sa));
+    
+    if(rc == 0) {
+      /* if(channel_id != RING_ANY_CHANNEL) */ {
+	rc = pfring_set_channel_id(ring, channel_id);
+	
+	if(rc != 0)
+	  printf("pfring_set_channel_id() failed: %d\n", rc);
+      }
+    }
+    
+    elem = strtok(NULL, ";,");
+  }
+
+  return(rc);
+}
+
+/* **************************************************** */
+
+void pfring_mod_close(pfring *ring) {
+  if(ring->clear_promisc)
+    pfring_set_if_promisc(ring->device_name, 0);
+
+  close(pfring_mod_detach(ring));
+}
+
+/* **************************************************** */
+
+/* All but the socket, which keeps capturing for the next owner */
+int pfring_mod_detach(pfring *ring) {
+  if(ring->buffer != NULL)
+    munmap(ring->buffer, ring->slots_info->tot_mem * (ring->sub_rings.num ? ring->sub_rings.num : 1));
+
+  pfring_mod_set_tx_watermark(ring, 0); /* flushes the queued packets */
+
+  if(ring->tx.ring != NULL)
+    munmap(ring->tx.ring, ring->tx.ring->tot_mem);
+
+  free(ring->mpmc);
+  return(ring->fd);
+}
+
+/* **************************************************** */
+
+/*
+  TX queue (pfring_set_tx_watermark() > 1): packets sent without
+  flush_packet are copied here and handed to the kernel with a single
+  sendmmsg() once the watermark is reached, the buffer is full or a
+  packet is flushed.
+*/
+
+#define MOD_TX_QUEUE_MAX_PKTS  256
+#define MOD_TX_QUEUE_BYTES     (256 * 1024)
+
+struct mod_tx_queue {
+  u_int32_t num_pkts, used;
+  struct mmsghdr msg[MOD_TX_QUEUE_MAX_PKTS];
+  struct iovec iov[MOD_TX_QUEUE_MAX_PKTS];
+  char data[MOD_TX_QUEUE_BYTES];
+};
+
+/* ******************************* */
+
+static inline void mod_tx_msg(pfring *ring, struct mmsghdr *m, struct iovec *iov, char *pkt, u_int pkt_len) {
+  iov->iov_base = pkt, iov->iov_len = pkt_len;
+
+  memset(m, 0, sizeof(struct mmsghdr));
+  m->msg_hdr.msg_name = &ring->sock_tx, m->msg_hdr.msg_namelen = sizeof(ring->sock_tx);
+  m->msg_hdr.msg_iov = iov, m->msg_hdr.msg_iovlen = 1;
+}
+
+/* ******************************* */
+
+/* One syscall per call when possible: returns the number of messages sent, -1 if none */
+static int mod_tx_sendmmsg(pfring *ring, struct mmsghdr *msg, u_int num) {
+  u_int done = 0;
+  int rc;
+
+  while(done < num) {
+    rc = sendmmsg(ring->fd, &msg[done], num - done, 0);
+
+    if(rc < 0 && errno == ENOSYS) {
+      /* Kernel without sendmmsg() */
+      rc = sendto(ring->fd, msg[done].msg_hdr.msg_iov->iov_base, msg[done].msg_hdr.msg_iov->iov_len,
+		  0, (struct sockaddr *)&ring->sock_tx, sizeof(ring->sock_tx));
+      if(rc >= 0) rc = 1;
+    }
+
+    if(rc <= 0) {
+      if(rc < 0 && errno == EINTR) continue;
+      break;
+    }
+
+    done += rc;
+  }
+
+  return((done > 0) ? (int)done : -1);
+}
+
+/* ******************************* */
+
+static int mod_tx_flush(pfring *ring) {
+  struct mod_tx_queue *q = (struct mod_tx_queue*)ring->tx.queue;
+  int rc;
+
+  if(q->num_pkts == 0)
+    return(0);
+
+  /* Not sent (e.g. ENOBUFS): dropped, as sendto() would have done */
+  rc = mod_tx_sendmmsg(ring, q->msg, q->num_pkts);
+  q->num_pkts = 0, q->used = 0;
+
+  return(rc);
+}
+
+/* ******************************* */
+
+/*
+  TX ring (pfring_set_tx_ring()): the packets are copied to the slots
+  shared with the kernel, which sends those up to insert_idx on
+  SO_FLUSH_TX_RING. It takes the place of the TX queue.
+*/
+
+static int mod_tx_ring_flush(pfring *ring) {
+  int dummy = 0;
+
+  if(ring->tx.ring_pending == 0)
+    return(0);
+
+  ring->tx.ring_pending = 0;
+  return(setsockopt(ring->fd, 0, SO_FLUSH_TX_RING, &dummy, sizeof(dummy)));
+}
+
+/* ******************************* */
+
+static int mod_tx_ring_queue(pfring *ring, char *pkt, u_int pkt_len) {
+  FlowSlotTxInfo *tx = ring->tx.ring;
+  struct pfring_tx_slot *slot;
+
+  if(pkt_len > (tx->slot_len - sizeof(struct pfring_tx_slot))) {
+    errno = EMSGSIZE;
+    return(-1);
+  }
+
+  if((tx->insert_idx - *(volatile u_int32_t*)&tx->remove_idx) == tx->num_slots) {
+    /* Full: the kernel drains it all before returning */
+    if((mod_tx_ring_flush(ring) < 0)
+       || ((tx->insert_idx - *(volatile u_int32_t*)&tx->remove_idx) == tx->num_slots)) {
+      errno = ENOBUFS;
+      return(-1);
+    }
+  }
+
+  slot = (struct pfring_tx_slot*)((char*)tx + sizeof(FlowSlotTxInfo) + (tx->insert_idx & (tx->num_slots - 1)) * tx->slot_len);
+  slot->len = pkt_len;
+  memcpy(&slot[1], pkt, pkt_len);
+
+  gcc_mb(); /* the slot before insert_idx, SO_FLUSH_TX_RING orders the rest */
+  tx->insert_idx++;
+  ring->tx.ring_pending++;
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_set_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t max_pkt_len) {
+  struct pfring_tx_ring_req req;
+  FlowSlotTxInfo *tx;
+  u_int32_t tot_mem;
+  off_t offset = (off_t)PF_RING_TX_RING_MMAP_ID * getpagesize();
+
+  if(ring->tx.ring != NULL)
+    return(-1);
+
+  req.num_slots = num_slots, req.max_pkt_len = max_pkt_len;
+
+  if(setsockopt(ring->fd, 0, SO_SET_TX_RING, &req, sizeof(req)) < 0)
+    return(-1);
+
+  /* The header first, for its size */
+  if((tx = (FlowSlotTxInfo*)mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, ring->fd, offset)) == MAP_FAILED)
+    return(-1);
+
+  tot_mem = (tx->version == PFRING_TX_RING_VERSION) ? tx->tot_mem : 0;
+  munmap(tx, getpagesize());
+
+  if(tot_mem == 0)
+    return(-1);
+
+  if((tx = (FlowSlotTxInfo*)mmap(NULL, tot_mem, PROT_READ|PROT_WRITE, MAP_SHARED, ring->fd, offset)) == MAP_FAILED)
+    return(-1);
+
+  /* The packets queued so far go first */
+  if(ring->tx.queue != NULL) {
+    mod_tx_flush(ring);
+    free(ring->tx.queue);
+    ring->tx.queue = NULL;
+  }
+
+  ring->tx.ring = tx, ring->tx.ring_pending = 0;
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_set_tx_watermark(pfring *ring, u_int16_t watermark) {
+  if(ring->tx.ring != NULL) {
+    mod_tx_ring_flush(ring);
+    ring->tx.watermark = (watermark <= 1) ? 0 : ((watermark > ring->tx.ring->num_slots) ? ring->tx.ring->num_slots : watermark);
+    return(0);
+  }
+
+  if(ring->tx.queue != NULL) {
+    mod_tx_flush(ring);
+
+    if(watermark <= 1) {
+      free(ring->tx.queue);
+      ring->tx.queue = NULL;
+    }
+  }
+
+  if(watermark <= 1) {
+    ring->tx.watermark = 0;
+    return(0);
+  }
+
+  if(ring->tx.queue == NULL) {
+    if((ring->tx.queue = calloc(1, sizeof(struct mod_tx_queue))) == NULL)
+      return(-1);
+  }
+
+  ring->tx.watermark = (watermark > MOD_TX_QUEUE_MAX_PKTS) ? MOD_TX_QUEUE_MAX_PKTS : watermark;
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
+  struct mod_tx_queue *q = (struct mod_tx_queue*)ring->tx.queue;
+  int rc = 0;
+
+  if(ring->tx.ring != NULL) {
+    if(mod_tx_ring_queue(ring, pkt, pkt_len) < 0)
+      return(-1);
+
+    if(flush_packet || (ring->tx.ring_pending >= ring->tx.watermark))
+      rc = mod_tx_ring_flush(ring);
+
+    return((rc < 0) ? rc : (int)pkt_len);
+  }
+
+  if(q == NULL)
+    return(sendto(ring->fd, pkt, pkt_len, 0, (struct sockaddr *)&ring->sock_tx, sizeof(ring->sock_tx)));
+
+  if((q->used + pkt_len) > MOD_TX_QUEUE_BYTES)
+    rc = mod_tx_flush(ring);
+
+  memcpy(&q->data[q->used], pkt, pkt_len);
+  mod_tx_msg(ring, &q->msg[q->num_pkts], &q->iov[q->num_pkts], &q->data[q->used], pkt_len);
+  q->num_pkts++, q->used += pkt_len;
+
+  if(flush_packet || (q->num_pkts >= ring->tx.watermark))
+    rc = mod_tx_flush(ring);
+
+  return((rc < 0) ? rc : (int)pkt_len);
+}
+
+/* ******************************* */
+
+/* Zero copy: the queued packets go first, then the burst with one sendmmsg() per MOD_TX_QUEUE_MAX_PKTS */
+int pfring_mod_send_burst(pfring *ring, char **pkts, u_int *pkts_len, u_int num_pkts, u_int8_t flush_packet) {
+  struct mmsghdr msg[MOD_TX_QUEUE_MAX_PKTS];
+  struct iovec iov[MOD_TX_QUEUE_MAX_PKTS];
+  u_int sent = 0, n, i;
+  int rc;
+
+  if(ring->tx.ring != NULL) {
+    /* Copied to the slots, one syscall when the ring fills up and one at the end */
+    for(i = 0; i < num_pkts; i++)
+      if(mod_tx_ring_queue(ring, pkts[i], pkts_len[i]) < 0)
+	break;
+
+    mod_tx_ring_flush(ring);
+    return((i > 0) ? (int)i : -1);
+  }
+
+  if(ring->tx.queue != NULL)
+    mod_tx_flush(ring);
+
+  while(sent < num_pkts) {
+    n = num_pkts - sent;
+    if(n > MOD_TX_QUEUE_MAX_PKTS) n = MOD_TX_QUEUE_MAX_PKTS;
+
+    for(i = 0; i < n; i++)
+      mod_tx_msg(ring, &msg[i], &iov[i], pkts[sent + i], pkts_len[sent + i]);
+
+    if((rc = mod_tx_sendmmsg(ring, msg, n)) < 0)
+      break;
+
+    sent += rc;
+    if((u_int)rc < n) break; /* e.g. socket buffer full */
+  }
+
+  return((sent > 0) ? (int)sent : -1);
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_poll_watermark(pfring *ring, u_int16_t watermark) {
+  return(setsockopt(ring->fd, 0, SO_SET_POLL_WATERMARK, &watermark, sizeof(watermark)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_poll_coalescing(pfring *ring, u_int16_t num_pkts, u_int32_t usec) {
+  struct pfring_poll_coalescing pc;
+
+  pc.num_pkts = num_pkts, pc.usec = usec;
+
+  return(setsockopt(ring->fd, 0, SO_SET_POLL_COALESCING, &pc, sizeof(pc)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_poll_duration(pfring *ring, u_int duration) {
+  ring->poll_duration = duration;
+
+  return duration;
+}
+
+/* **************************************************** */
+
+u_int8_t pfring_mod_get_num_rx_channels(pfring *ring) {
+  socklen_t len = sizeof(u_int32_t);
+  u_int8_t num_rx_channels;
+  int rc = getsockopt(ring->fd, 0, SO_GET_NUM_RX_CHANNELS, &num_rx_channels, &len);
+
+  return((rc == 0) ? num_rx_channels : 1);
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
+  return(setsockopt(ring->fd, 0, SO_SET_SAMPLING_RATE, &rate, sizeof(rate)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_flow_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
+  return(setsockopt(ring->fd, 0, SO_SET_FLOW_SAMPLING_RATE, &rate, sizeof(rate)));
+}
+
+/* **************************************************** */
+
+int pfring_mod_set_overload_policy(pfring *ring, u_int8_t early_drop, u_int8_t sample_threshold, u_int32_t max_sample_rate) {
+  struct pfring_overload_policy policy;
+
+  policy.flags = early_drop ? PFRING_OVERLOAD_EARLY_DROP : 0;
+  policy.sample_threshold = sample_threshold, policy.max_sample_rate = max_sample_rate;
+
+  return(setsockopt(ring->fd, 0, SO_SET_OVERLOAD_POLICY, &policy, sizeof(policy)));
+}
+
+/* ******************************* */
+
+int pfring_mod_set_shared_ring(pfring *ring, u_int32_t shared_ring_id, u_int8_t drop_slowest) {
+  struct pfring_shared_ring info;
+
+  info.shared_ring_id = shared_ring_id;
+  info.policy = drop_slowest ? PFRING_SHARED_RING_DROP_SLOWEST : PFRING_SHARED_RING_WAIT_SLOWEST;
+
+  return(setsockopt(ring->fd, 0, SO_SET_SHARED_RING, &info, sizeof(info)));
+}
+
+/* ******************************* */
+
+int pfring_mod_set_latency_histogram(pfring *ring, u_int8_t enable) {
+  FlowSlotInfo *si = (ring->sub_rings.num > 1) ? ring->sub_rings.slots_info[0] : ring->slots_info;
+  u_int32_t on = enable ? 1 : 0;
+  int rc;
+
+  if(si == NULL)
+    return(-1);
+
+  if((rc = setsockopt(ring->fd, 0, SO_SET_INSERT_TIMESTAMP, &on, sizeof(on))) == 0)
+    ring->latency_hist = on ? &si->latency_hist : NULL;
+
+  return(rc);
+}
+
+/* ******************************* */
+
+int pfring_mod_set_timestamp_mode(pfring *ring, u_int8_t mode) {
+  u_int32_t m = mode;
+
+  return(setsockopt(ring->fd, 0, SO_SET_TIMESTAMP_MODE, &m, sizeof(m)));
+}
+
+/* ******************************* */
+
+/* The counters of the mapped slots_info as they are: drops folded by the last poll, stats call or drop */
+int pfring_mod_stats_mapped(pfring *ring, pfring_stat *stats) {
+
+  if((ring->slots_info != NULL) && (stats != NULL)) {
+    rmb();
+
+    if(ring->sub_rings.num > 1) {
+      u_int i;
+
+      /* Drops are only accounted in the first sub-ring */
+      for(i = 0, stats->recv = 0; i < ring->sub_rings.num; i++)
+	stats->recv += ring->sub_rings.slots_info[i]->tot_read;
+      stats->drop = ring->sub_rings.slots_info[0]->tot_lost;
+      stats->sampled = ring->sub_rings.slots_info[0]->tot_sampled;
+    } else {
+      /* shared_ring_lost: skipped by a shared ring reader, 0 otherwise */
+      stats->recv = ring->slots_info->tot_read - ring->slots_info->shared_ring_lost;
+      stats->drop = ring->slots_info->tot_lost + ring->slots_info->shared_ring_lost;
+      stats->sampled = ring->slots_info->tot_sampled;
+    }
+    return(0);
+  }
+
+  return(-1);
+}
+
+/* ******************************* */
+
+int pfring_mod_stats(pfring *ring, pfring_stat *stats) {
+  struct tpacket_stats st;
+  socklen_t len = sizeof(st);
+
+  if((ring->slots_info == NULL) || (stats == NULL))
+    return(-1);
+
+  /* Lets the kernel fold its per-CPU drop counters into slots_info */
+  getsockopt(ring->fd, 0, PACKET_STATISTICS, &st, &len);
+
+  return(pfring_mod_stats_mapped(ring, stats));
+}
+
+/* ******************************* */
+
+int pfring_mod_stats_ext(pfring *ring, pfring_stat_ext *stats) {
+  struct pfring_ring_stats_ext st;
+  socklen_t len = sizeof(st);
+  pfring_stat s;
+
+  if(getsockopt(ring->fd, 0, SO_GET_RING_STATS_EXT, &st, &len) != 0)
+    return(-1);
+
+  if(pfring_mod_stats(ring, &s) == 0)
+    stats->recv = s.recv;
+
+  stats->ring_full = st.ring_full, stats->early_drop = st.early_drop;
+  stats->overload_sampled = st.overload_sampled, stats->sampled = st.sampled;
+  stats->filtered = st.filtered, stats->blocked = st.blocked;
+  stats->consumer_lost = st.consumer_lost;
+  stats->num_slots = st.num_slots, stats->max_queued = st.max_queued;
+
+  return(0);
+}
+
+/* **************************************************** */
+
+int pfring_mod_is_pkt_available(pfring *ring) {
+  return(pfring_there_is_pkt_available(ring));
+}
+
+/* **************************************************** */
+
+int pfring_mod_next_pkt_time(pfring *ring, struct timespec *ts) {
+  struct pfring_pkthdr *header;
+
+  /* First, as it may move to another sub-ring */
+  if(!pfring_there_is_pkt_available(ring))
+    return PF_RING_ERROR_NO_PKT_AVAILABLE;
+
+  header = (struct pfring_pkthdr*) &ring->slots[ring->slots_info->remove_off];
+
+  if(ring->compact_header) {
+    u_int64_t ns = ((struct pfring_compact_pkthdr*)header)->timestamp_ns;
+
+    ts->tv_sec = ns / 1000000000, ts->tv_nsec = ns % 1000000000;
+    return 0;
+  }
+
+  if(!header->ts.tv_sec)
+    return PF_RING_ERROR_WRONG_CONFIGURATION;
+
+  ts->tv_sec = header->ts.tv_sec;
+  ts->tv_nsec = header->ts.tv_usec * 1000;
+
+  /* TODO In order to use ns from hw ts we should make sure that
+   * hw ts is in sync with sys time. */
+  //if(header->extended_hdr.timestamp_ns)
+  //  ts->tv_nsec = header->extended_hdr.timestamp_ns % 1000000000;
+
+  return 0;
+}
+
+/* **************************************************** */
+
+/*
+  PF_RING_COMPACT_HEADER/PF_RING_METADATA_ONLY: the header pfring_recv()
+  users expect out of a struct pfring_compact_pkthdr slot. Returns the
+  offset of the packet bytes (hdr->caplen of them) in the slot.
+*/
+static u_int32_t pfring_compact_to_hdr(const char *bucket, struct pfring_pkthdr *hdr) {
+  const struct pfring_compact_pkthdr *h = (const struct pfring_compact_pkthdr*)bucket;
+  struct pkt_parsing_info *p = &hdr->extended_hdr.parsed_pkt;
+
+  memset(hdr, 0, sizeof(struct pfring_pkthdr));
+
+  hdr->ts.tv_sec = h->timestamp_ns / 1000000000, hdr->ts.tv_usec = (h->timestamp_ns % 1000000000) / 1000;
+  hdr->len = h->len, hdr->caplen = h->caplen;
+  hdr->extended_hdr.timestamp_ns = h->timestamp_ns;
+  hdr->extended_hdr.rx_direction = (h->flags & PFRING_COMPACT_RX) ? 1 : 0;
+  hdr->extended_hdr.if_index = UNKNOWN_INTERFACE;
+  hdr->extended_hdr.pkt_hash = h->pkt_hash;
+
+  p->l3_proto = h->proto, p->tcp.flags = h->tcp_flags;
+  p->offset.l3_offset = pfring_compact_l3_offset(h), p->offset.l4_offset = h->l4_offset;
+
+  if(h->flags & PFRING_COMPACT_IPV6) {
+    p->eth_type = 0x86DD, p->ip_version = 6;
+    memcpy(&p->ip_src.v6, &bucket[sizeof(struct pfring_compact_pkthdr)], sizeof(struct in6_addr));
+    memcpy(&p->ip_dst.v6, &bucket[sizeof(struct pfring_compact_pkthdr) + sizeof(struct in6_addr)], sizeof(struct in6_addr));
+  } else if(h->flags & PFRING_COMPACT_IPV4) {
+    p->eth_type = 0x0800, p->ip_version = 4;
+    p->ipv4_src = h->src_ip, p->ipv4_dst = h->dst_ip;
+  } else {
+    p->eth_type = h->src_port;
+    return(pfring_compact_data_offset(h));
+  }
+
+  p->l4_src_port = h->src_port, p->l4_dst_port = h->dst_port;
+
+  return(pfring_compact_data_offset(h));
+}
+
+/* ******************************* */
+
+static inline u_int32_t latency_bucket(u_int64_t v) {
+  u_int32_t i = (v == 0) ? 0 : (64 - __builtin_clzll(v));
+
+  return((i < PFRING_LATENCY_BUCKETS) ? i : (PFRING_LATENCY_BUCKETS - 1));
+}
+
+/* pfring_set_latency_histogram(): a packet read with queued packets in its ring, itself included */
+static inline void account_latency(pfring *ring, u_int64_t now, struct pfring_pkthdr *hdr, u_int32_t queued) {
+  u_int64_t ts = hdr->extended_hdr.timestamp_ns;
+
+  ring->latency_hist->delay[latency_bucket((now > ts) ? (now - ts) : 0)]++;
+  ring->latency_hist->fill[latency_bucket(queued)]++;
+}
+
+/* **************************************************** */
+
+int pfring_mod_recv(pfring *ring, u_char** buffer, u_int buffer_len,
+		    struct pfring_pkthdr *hdr,
+		    u_int8_t wait_for_incoming_packet) {
+  int rc = 0;
+
+  if(ring->is_shutting_down || (ring->buffer == NULL))
+    return(-1);
+
+  if(unlikely(ring->batch.num_pkts > 0))
+    pfring_mod_release_batch(ring);
+
+  if(unlikely(!ring->consumer_state_set))
+    pfring_mod_consumer_opt_in(ring);
+
+  ring->break_recv_loop = 0;
+
+  do_pfring_recv:
+    if(ring->break_recv_loop)
+      return(0);
+
+    if(unlikely(ring->reentrant))
+      pthread_rwlock_wrlock(&ring->rx_lock);
+
+    //rmb();
+
+    if(pfring_there_is_pkt_available(ring)) {
+      char *bucket = &ring->slots[ring->slots_info->remove_off];
+      u_int64_t next_off;
+      u_int32_t real_slot_len, bktLen, data_off = ring->slot_header_len;
+
+      /* Keep it for packet sending */
+      ring->tx.last_received_hdr = (struct pfring_pkthdr*)bucket;
+
+      if(ring->compact_header) {
+	data_off = pfring_compact_to_hdr(bucket, hdr), bktLen = hdr->caplen;
+	real_slot_len = data_off + bktLen;
+      } else {
+	memcpy(hdr, bucket, ring->slot_header_len);
+
+	if(ring->slot_header_len != sizeof(struct pfring_pkthdr))
+	  bktLen = hdr->caplen;
+	else
+	  bktLen = hdr->caplen+hdr->extended_hdr.parsed_header_len;
+
+	real_slot_len = ring->slot_header_len + bktLen;
+      }
+
+      real_slot_len = pfring_slot_align(ring->slots_info, real_slot_len);
+
+      if(unlikely(ring->latency_hist != NULL))
+	account_latency(ring, pfring_gettime_ns(), hdr,
+			ring->slots_info->tot_insert - ring->slots_info->tot_read);
+
+      if(bktLen > buffer_len) bktLen = buffer_len;
+
+      if(buffer_len == 0)
+	*buffer = (u_char*)&bucket[data_off];
+      else
+	memcpy(*buffer, &bucket[data_off], bktLen);
+
+      next_off = ring->slots_info->remove_off + real_slot_len;
+      if((next_off + ring->slots_info->slot_len) > (ring->slots_info->tot_mem - sizeof(FlowSlotInfo))) {
+        next_off = 0;
+      }
+      
+#ifdef USE_MB
+      /* This prevents the compiler from reordering instructions.
+       * http://en.wikipedia.org/wiki/Memory_ordering#Compiler_memory_barrier */
+      gcc_mb();
+#endif
+
+      /*
+	We need to stay one packet back otherwise the kernel will assume that
+	the slot has been processed
+      */
+      ring->slots_info->tot_read++, ring->slots_info->remove_off = next_off;
+
+      /* Ugly safety check */
+      if((ring->slots_info->tot_insert == ring->slots_info->tot_read)
+	 && (ring->slots_info->remove_off > ring->slots_info->insert_off)) {
+	ring->slots_info->remove_off = ring->slots_info->insert_off;
+      }
+
+      if(unlikely(ring->reentrant)) pthread_rwlock_unlock(&ring->rx_lock);
+      return(1);
+    }
+
+    /* Nothing to do: we need to wait */
+    if(unlikely(ring->reentrant)) pthread_rwlock_unlock(&ring->rx_lock);
+
+    if(wait_for_incoming_packet) {
+      rc = pfring_wait_for_packet(ring);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv;
+    }
+
+  return(0); /* non-blocking, no packet */
+}
+
+/* ******************************* */
+
+/*
+  Same slot walk as pfring_mod_recv() but the shared tot_read/remove_off
+  are read once per batch. Packets are returned in zero-copy (the caller
+  rejects reentrant rings), so as in pfring_mod_recv_batch() the frontier
+  is only published by pfring_mod_release_batch() on the next receive.
+*/
+int pfring_mod_recv_burst(pfring *ring, u_char** buffers, struct pfring_pkthdr *hdrs,
+			  u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  int rc = 0;
+
+  if(ring->is_shutting_down || (ring->buffer == NULL))
+    return(-1);
+
+  if(unlikely(ring->batch.num_pkts > 0))
+    pfring_mod_release_batch(ring);
+
+  if(unlikely(!ring->consumer_state_set))
+    pfring_mod_consumer_opt_in(ring);
+
+  ring->break_recv_loop = 0;
+
+  do_pfring_recv_burst:
+    if(ring->break_recv_loop)
+      return(0);
+
+    if(pfring_there_is_pkt_available(ring)) {
+      u_int64_t tot_insert = ring->slots_info->tot_insert, tot_read = ring->slots_info->tot_read;
+      u_int64_t remove_off = ring->slots_info->remove_off;
+      u_int64_t max_off = ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - ring->slots_info->slot_len;
+      u_int num_pkts = 0;
+      char *bucket = NULL;
+      u_int64_t now = (ring->latency_hist != NULL) ? pfring_gettime_ns() : 0;
+
+      /* Do not read the slots before tot_insert */
+      gcc_mb();
+
+      while((num_pkts < max_num_pkts) && (tot_read != tot_insert)) {
+	struct pfring_pkthdr *hdr = &hdrs[num_pkts];
+	u_int32_t bktLen;
+
+	bucket = &ring->slots[remove_off];
+
+	if(ring->compact_header) {
+	  u_int32_t data_off = pfring_compact_to_hdr(bucket, hdr);
+
+	  buffers[num_pkts++] = (u_char*)&bucket[data_off];
+	  remove_off += pfring_slot_align(ring->slots_info, data_off + hdr->caplen);
+	} else {
+	  buffers[num_pkts++] = (u_char*)&bucket[ring->slot_header_len];
+	  memcpy(hdr, bucket, ring->slot_header_len);
+
+	  if(ring->slot_header_len != sizeof(struct pfring_pkthdr))
+	    bktLen = hdr->caplen;
+	  else
+	    bktLen = hdr->caplen+hdr->extended_hdr.parsed_header_len;
+
+	  remove_off += pfring_slot_align(ring->slots_info, ring->slot_header_len + bktLen);
+	}
+	if(remove_off > max_off)
+	  remove_off = 0;
+
+	if(unlikely(now != 0))
+	  account_latency(ring, now, hdr, tot_insert - tot_read);
+
+	tot_read++;
+      }
+
+      /* Keep it for packet sending */
+      ring->tx.last_received_hdr = (struct pfring_pkthdr*)bucket;
+
+      /* The slots are still being read by the caller: published on release */
+      ring->batch.tot_read = tot_read, ring->batch.remove_off = remove_off;
+      ring->batch.num_pkts = num_pkts;
+
+      return(num_pkts);
+    }
+
+    /* Nothing to do: we need to wait */
+    if(wait_for_incoming_packet) {
+      rc = pfring_wait_for_packet(ring);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv_burst;
+    }
+
+  return(0); /* non-blocking, no packet */
+}
+
+/* ******************************* */
+
+/*
+  Zero-copy headers too: hdrs[i] is the slot itself, nothing is copied.
+  The walk moves a private frontier only, remove_off is published by
+  pfring_mod_release_batch() so that the kernel does not overwrite the
+  slots while they are being read.
+*/
+int pfring_mod_recv_batch(pfring *ring, struct pfring_pkthdr **hdrs, u_char **buffers,
+			  u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  int rc = 0;
+
+  if(ring->is_shutting_down || (ring->buffer == NULL))
+    return(-1);
+
+  /* Short slot headers have no extended_hdr to be read in place; the
+     frontier of a batch is kept for one ring, not for each sub-ring */
+  if((ring->slot_header_len != sizeof(struct pfring_pkthdr)) || (ring->sub_rings.num > 1))
+    return(PF_RING_ERROR_NOT_SUPPORTED);
+
+  if(ring->batch.num_pkts > 0)
+    pfring_mod_release_batch(ring);
+
+  if(unlikely(!ring->consumer_state_set))
+    pfring_mod_consumer_opt_in(ring);
+
+  ring->break_recv_loop = 0;
+
+  do_pfring_recv_batch:
+    if(ring->break_recv_loop)
+      return(0);
+
+    if(pfring_there_is_pkt_available(ring)) {
+      u_int64_t tot_insert = ring->slots_info->tot_insert, tot_read = ring->slots_info->tot_read;
+      u_int64_t remove_off = ring->slots_info->remove_off;
+      u_int64_t max_off = ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - ring->slots_info->slot_len;
+      u_int num_pkts = 0;
+      u_int64_t now = (ring->latency_hist != NULL) ? pfring_gettime_ns() : 0;
+
+      /* Do not read the slots before tot_insert */
+      gcc_mb();
+
+      while((num_pkts < max_num_pkts) && (tot_read != tot_insert)) {
+	struct pfring_pkthdr *hdr = (struct pfring_pkthdr*)&ring->slots[remove_off];
+
+	if(unlikely(now != 0))
+	  account_latency(ring, now, hdr, tot_insert - tot_read);
+
+	hdrs[num_pkts] = hdr;
+	buffers[num_pkts++] = (u_char*)hdr + sizeof(struct pfring_pkthdr);
+
+	remove_off += pfring_slot_align(ring->slots_info,
+					sizeof(struct pfring_pkthdr) + hdr->caplen + hdr->extended_hdr.parsed_header_len);
+	if(remove_off > max_off)
+	  remove_off = 0;
+
+	tot_read++;
+      }
+
+      /* Keep it for packet sending */
+      ring->tx.last_received_hdr = hdrs[num_pkts-1];
+
+      ring->batch.tot_read = tot_read, ring->batch.remove_off = remove_off;
+      ring->batch.num_pkts = num_pkts;
+      return(num_pkts);
+    }
+
+    /* Nothing to do: we need to wait */
+    if(wait_for_incoming_packet) {
+      rc = pfring_wait_for_packet(ring);
+
+      if((rc == -1) && (errno != EINTR))
+	return(-1);
+      else
+	goto do_pfring_recv_batch;
+    }
+
+  return(0); /* non-blocking, no packet */
+}
+
+/* ******************************* */
 
-  /* Setup TX */
-  ring->sock_tx.sll_family = PF_PACKET;
-  ring->sock_tx.sll_protocol = htons(ETH_P_ALL);
+void pfring_mod_release_batch(pfring *ring) {
+  if(ring->batch.num_pkts == 0)
+    return;
 
-  snprintf(name_copy, sizeof(name_copy), "%s", device_name);
-  elem = strtok(name_copy, ";,");
+  /* All the reads of the batch slots happen before the kernel can reuse them */
+  gcc_mb();
 
-  while(elem != NULL) {
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_family = PF_RING;
-    snprintf(sa.sa_data, sizeof(sa.sa_data), "%s", elem);
+  ring->slots_info->tot_read = ring->batch.tot_read, ring->slots_info->remove_off = ring->batch.remove_off;
+  ring->batch.num_pkts = 0;
 
-    rc = bind(ring->fd, (struct sockaddr *)&sa, sizeof(sa));
-    
-    if(rc == 0) {
-      /* if(channel_id != RING_ANY_CHANNEL) */ {
-	rc = pfring_set_channel_id(ring, channel_id);
-	
-	if(rc != 0)
-	  printf("pfring_set_channel_id() failed: %d\n", rc);
-      }
-    }
-    
-    elem = strtok(NULL, ";,");
+  /* Ugly safety check */
+  if((ring->slots_info->tot_insert == ring->slots_info->tot_read)
+     && (ring->slots_info->remove_off > ring->slots_info->insert_off)) {
+    ring->slots_info->remove_off = ring->slots_info->insert_off;
   }
-
-  return(rc);
 }
 
-/* **************************************************** */
+/* ******************************* */
 
-void pfring_mod_close(pfring *ring) {
-  if(ring->buffer != NULL)
-    munmap(ring->buffer, ring->slots_info->tot_mem);
+/*
+  Shared consumption (pfring_enable_mpmc).
+
+  Slots have a variable length, so a range cannot be claimed with a
+  fetch-add on an index: the claim cursor packs the offset of the next
+  unclaimed slot with the low 32 bits of its sequence number, and a
+  consumer moves it past the slots it has walked with a single CAS.
+  Losing the CAS costs a header walk of at most max_num_pkts slots.
+
+  Before walking, a consumer announces the cursor it starts from in its
+  own claim word. The release frontier published to the kernel
+  (tot_read/remove_off) is the oldest announced claim, or the cursor
+  when nobody holds one, so that no slot is returned before every range
+  before it has been released. Publishing is done by one thread at a
+  time; the others just leave a request that the publisher picks up.
+*/
+
+#define MPMC_CURSOR(off, seq)  (((u_int64_t)(off) << 32) | (u_int32_t)(seq))
+#define MPMC_OFF(c)            ((u_int32_t)((c) >> 32))
+#define MPMC_SEQ(c)            ((u_int32_t)(c))
+#define MPMC_IDLE              ((u_int64_t)-1) /* no slot offset is 0xFFFFFFFF */
+#define MPMC_IDLE_OFF          0xFFFFFFFFULL   /* rings from 4 GB can't be shared this way */
+
+/* Sequence numbers wrap at 2^32: compare them by distance */
+#define MPMC_BEFORE(a, b)      ((int32_t)(MPMC_SEQ(a) - MPMC_SEQ(b)) < 0)
+
+struct pfring_mpmc_consumer {
+  volatile u_int64_t claim; /* cursor the outstanding range starts from, MPMC_IDLE if none */
+} __attribute__((aligned(64)));
+
+struct pfring_mpmc {
+  volatile u_int64_t cursor __attribute__((aligned(64)));
+  volatile u_int32_t publish_requests __attribute__((aligned(64)));
+  volatile u_int32_t publishing;
+  u_int32_t num_consumers;
+  struct pfring_mpmc_consumer consumers[MAX_MPMC_CONSUMERS];
+};
 
-  if(ring->clear_promisc)
-    pfring_set_if_promisc(ring->device_name, 0);
+/* ******************************* */
 
-  close(ring->fd);
-}
+int pfring_mod_enable_mpmc(pfring *ring, u_int num_consumers) {
+  struct pfring_mpmc *m;
+  u_int i;
 
-/* **************************************************** */
+  if((ring->buffer == NULL) || (ring->mpmc != NULL) || (ring->batch.num_pkts > 0)
+     || (num_consumers == 0) || (num_consumers > MAX_MPMC_CONSUMERS))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
 
-int  pfring_mod_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
-  return(sendto(ring->fd, pkt, pkt_len, 0, (struct sockaddr *)&ring->sock_tx, sizeof(ring->sock_tx)));
-}
+  /* Headers are read in place as with pfring_mod_recv_batch(); the cursor packs a 32 bit offset */
+  if((ring->slot_header_len != sizeof(struct pfring_pkthdr)) || (ring->sub_rings.num > 1)
+     || (ring->slots_info->tot_mem - sizeof(FlowSlotInfo) >= MPMC_IDLE_OFF))
+    return(PF_RING_ERROR_NOT_SUPPORTED);
 
-/* **************************************************** */
+  if(posix_memalign((void**)&m, 64, sizeof(struct pfring_mpmc)) != 0)
+    return(PF_RING_ERROR_GENERIC);
 
-int pfring_mod_set_poll_watermark(pfring *ring, u_int16_t watermark) {
-  return(setsockopt(ring->fd, 0, SO_SET_POLL_WATERMARK, &watermark, sizeof(watermark)));
-}
+  memset(m, 0, sizeof(struct pfring_mpmc));
+  m->num_consumers = num_consumers;
+  m->cursor = MPMC_CURSOR(ring->slots_info->remove_off, ring->slots_info->tot_read);
 
-/* **************************************************** */
+  for(i = 0; i < MAX_MPMC_CONSUMERS; i++)
+    m->consumers[i].claim = MPMC_IDLE;
 
-int pfring_mod_set_poll_duration(pfring *ring, u_int duration) {
-  ring->poll_duration = duration;
+  /* Concurrent pfring_poll() callers would reset each other's WAITING flag */
+  ring->consumer_state_set = 1;
+  *consumer_state(ring) = PF_RING_CONSUMER_LEGACY;
 
-  return duration;
+  ring->mpmc = m;
+  return(0);
 }
 
-/* **************************************************** */
+/* ******************************* */
 
-u_int8_t pfring_mod_get_num_rx_channels(pfring *ring) {
-  socklen_t len = sizeof(u_int32_t);
-  u_int8_t num_rx_channels;
-  int rc = getsockopt(ring->fd, 0, SO_GET_NUM_RX_CHANNELS, &num_rx_channels, &len);
+static u_int64_t mpmc_frontier(struct pfring_mpmc *m) {
+  u_int64_t frontier = m->cursor;
+  u_int i;
 
-  return((rc == 0) ? num_rx_channels : 1);
-}
+  /* The cursor first: a claim announced after this read starts beyond it */
+  __sync_synchronize();
 
-/* **************************************************** */
+  for(i = 0; i < m->num_consumers; i++) {
+    u_int64_t claim = m->consumers[i].claim;
 
-int pfring_mod_set_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
-  return(setsockopt(ring->fd, 0, SO_SET_SAMPLING_RATE, &rate, sizeof(rate)));
+    if((claim != MPMC_IDLE) && MPMC_BEFORE(claim, frontier))
+      frontier = claim;
+  }
+
+  return(frontier);
 }
 
 /* ******************************* */
 
-int pfring_mod_stats(pfring *ring, pfring_stat *stats) {
+static void mpmc_publish(pfring *ring) {
+  struct pfring_mpmc *m = ring->mpmc;
+  u_int32_t seen;
 
-  if((ring->slots_info != NULL) && (stats != NULL)) {
-    rmb();
-    stats->recv = ring->slots_info->tot_read;
-    stats->drop = ring->slots_info->tot_lost;
-    return(0);
-  }
+  __sync_add_and_fetch(&m->publish_requests, 1);
 
-  return(-1);
-}
+  while(__sync_bool_compare_and_swap(&m->publishing, 0, 1)) {
+    do {
+      u_int64_t frontier;
+      u_int64_t tot_read = ring->slots_info->tot_read;
+      u_int32_t delta;
 
-/* **************************************************** */
+      seen = m->publish_requests;
+      frontier = mpmc_frontier(m);
+      delta = MPMC_SEQ(frontier) - (u_int32_t)tot_read;
 
-int pfring_mod_is_pkt_available(pfring *ring) {
-  return(pfring_there_is_pkt_available(ring));
-}
+      if((int32_t)delta > 0)
+	ring->slots_info->tot_read = tot_read + delta, ring->slots_info->remove_off = MPMC_OFF(frontier);
+    } while(seen != m->publish_requests);
 
-/* **************************************************** */
+    __sync_lock_release(&m->publishing);
 
-int pfring_mod_next_pkt_time(pfring *ring, struct timespec *ts) {
-  struct pfring_pkthdr *header = (struct pfring_pkthdr*) &ring->slots[ring->slots_info->remove_off];
+    /* A request left between the last pass and the release has no publisher yet */
+    if(m->publish_requests == seen)
+      break;
+  }
+}
 
-  if(!pfring_there_is_pkt_available(ring))
-    return PF_RING_ERROR_NO_PKT_AVAILABLE;
+/* ******************************* */
 
-  if(!header->ts.tv_sec)
-    return PF_RING_ERROR_WRONG_CONFIGURATION;
+void pfring_mod_mpmc_release(pfring *ring, u_int consumer_id) {
+  struct pfring_mpmc_consumer *c = &ring->mpmc->consumers[consumer_id];
 
-  ts->tv_sec = header->ts.tv_sec;
-  ts->tv_nsec = header->ts.tv_usec * 1000;
+  if((consumer_id >= ring->mpmc->num_consumers) || (c->claim == MPMC_IDLE))
+    return;
 
-  /* TODO In order to use ns from hw ts we should make sure that
-   * hw ts is in sync with sys time. */
-  //if(header->extended_hdr.timestamp_ns)
-  //  ts->tv_nsec = header->extended_hdr.timestamp_ns % 1000000000;
+  /* All the reads of the range happen before the kernel can reuse it */
+  __sync_synchronize();
+  c->claim = MPMC_IDLE;
 
-  return 0;
+  mpmc_publish(ring);
 }
 
-/* **************************************************** */
+/* ******************************* */
 
-int pfring_mod_recv(pfring *ring, u_char** buffer, u_int buffer_len,
-		    struct pfring_pkthdr *hdr,
-		    u_int8_t wait_for_incoming_packet) {
+int pfring_mod_mpmc_recv(pfring *ring, u_int consumer_id, struct pfring_pkthdr **hdrs, u_char **buffers,
+			 u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  struct pfring_mpmc *m = ring->mpmc;
+  struct pfring_mpmc_consumer *c;
+  u_int32_t max_off;
   int rc = 0;
 
   if(ring->is_shutting_down || (ring->buffer == NULL))
     return(-1);
 
-  ring->break_recv_loop = 0;
+  if(consumer_id >= m->num_consumers)
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
 
-  do_pfring_recv:
-    if(ring->break_recv_loop)
-      return(0);
+  c = &m->consumers[consumer_id];
+  max_off = ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - ring->slots_info->slot_len;
 
-    if(unlikely(ring->reentrant))
-      pthread_rwlock_wrlock(&ring->rx_lock);
+  pfring_mod_mpmc_release(ring, consumer_id);
 
-    //rmb();
+  /* break_recv_loop is not reset here: it is shared by all the consumers */
 
-    if(pfring_there_is_pkt_available(ring)) {
-      char *bucket = &ring->slots[ring->slots_info->remove_off];
-      u_int32_t next_off, real_slot_len, bktLen;
+  do_pfring_mpmc_recv:
+    if(ring->break_recv_loop)
+      return(0);
 
-      /* Keep it for packet sending */
-      ring->tx.last_received_hdr = (struct pfring_pkthdr*)bucket;
+    while(1) {
+      u_int64_t cursor = m->cursor;
+      u_int32_t tot_insert = (u_int32_t)ring->slots_info->tot_insert;
+      u_int32_t off = MPMC_OFF(cursor), seq = MPMC_SEQ(cursor);
+      u_int num_pkts = 0;
 
-      memcpy(hdr, bucket, ring->slot_header_len);
+      if(seq == tot_insert)
+	break; /* everything has been claimed */
 
-      if(ring->slot_header_len != sizeof(struct pfring_pkthdr))
-	bktLen = hdr->caplen;
-      else
-	bktLen = hdr->caplen+hdr->extended_hdr.parsed_header_len;
+      /*
+	Announce the claim, then check that the cursor has not moved: past
+	this point the frontier cannot go beyond it, so the slots can be
+	walked safely even if the CAS below is lost.
+      */
+      c->claim = cursor;
+      __sync_synchronize();
 
-      real_slot_len = ring->slot_header_len + bktLen;
-      if(bktLen > buffer_len) bktLen = buffer_len;
+      if(m->cursor != cursor)
+	continue;
 
-      if(buffer_len == 0)
-	*buffer = (u_char*)&bucket[ring->slot_header_len];
-      else
-	memcpy(*buffer, &bucket[ring->slot_header_len], bktLen);
+      while((num_pkts < max_num_pkts) && (seq != tot_insert)) {
+	struct pfring_pkthdr *hdr = (struct pfring_pkthdr*)&ring->slots[off];
 
-      next_off = ring->slots_info->remove_off + real_slot_len;
-      if((next_off + ring->slots_info->slot_len) > (ring->slots_info->tot_mem - sizeof(FlowSlotInfo))) {
-        next_off = 0;
-      }
-      
-#ifdef USE_MB
-      /* This prevents the compiler from reordering instructions.
-       * http://en.wikipedia.org/wiki/Memory_ordering#Compiler_memory_barrier */
-      gcc_mb();
-#endif
+	hdrs[num_pkts] = hdr;
+	buffers[num_pkts++] = (u_char*)hdr + sizeof(struct pfring_pkthdr);
 
-      /*
-	We need to stay one packet back otherwise the kernel will assume that
-	the slot has been processed
-      */
-      ring->slots_info->tot_read++, ring->slots_info->remove_off = next_off;
+	off += pfring_slot_align(ring->slots_info,
+				 sizeof(struct pfring_pkthdr) + hdr->caplen + hdr->extended_hdr.parsed_header_len);
+	if(off > max_off)
+	  off = 0;
 
-      /* Ugly safety check */
-      if((ring->slots_info->tot_insert == ring->slots_info->tot_read)
-	 && (ring->slots_info->remove_off > ring->slots_info->insert_off)) {
-	ring->slots_info->remove_off = ring->slots_info->insert_off;
+	seq++;
       }
 
-      if(unlikely(ring->reentrant)) pthread_rwlock_unlock(&ring->rx_lock);
-      return(1);
+      if(__sync_bool_compare_and_swap(&m->cursor, cursor, MPMC_CURSOR(off, seq)))
+	return(num_pkts);
+
+      /* Another consumer took these slots: start again from where it stopped */
     }
 
-    /* Nothing to do: we need to wait */
-    if(unlikely(ring->reentrant)) pthread_rwlock_unlock(&ring->rx_lock);
+    /* Nothing left to claim: drop the announcement so the frontier can move */
+    if(c->claim != MPMC_IDLE) {
+      c->claim = MPMC_IDLE;
+      mpmc_publish(ring);
+    }
 
     if(wait_for_incoming_packet) {
-      rc = pfring_poll(ring, ring->poll_duration);
+      if(pfring_there_is_pkt_available(ring)) {
+	/* Only slots still held by other consumers: poll() would return at once */
+	usleep(POLL_SLEEP_MIN);
+	if(ring->is_shutting_down) return(-1);
+	goto do_pfring_mpmc_recv;
+      }
+
+      rc = pfring_wait_for_packet(ring);
 
       if((rc == -1) && (errno != EINTR))
 	return(-1);
       else
-	goto do_pfring_recv;
+	goto do_pfring_mpmc_recv;
     }
 
   return(0); /* non-blocking, no packet */
@@ -489,6 +1662,12 @@ int pfring_mod_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 /* ******************************* */
 
 int pfring_mod_get_selectable_fd(pfring *ring) {
+  /* The caller may poll() it: the kernel has to wake it up for every packet */
+  if(ring->buffer != NULL) {
+    ring->consumer_state_set = 1;
+    *consumer_state(ring) = PF_RING_CONSUMER_LEGACY;
+  }
+
   return(ring->fd);
 }
 
@@ -539,18 +1718,68 @@ int pfring_mod_remove_from_cluster(pfring *ring) {
 
 /* ******************************* */
 
+int pfring_mod_set_cluster_indirection(pfring *ring, const u_int8_t *element) {
+  struct cluster_indirection table;
+
+  memcpy(table.element, element, sizeof(table.element));
+  return(setsockopt(ring->fd, 0, SO_SET_CLUSTER_INDIRECTION, &table, sizeof(table)));
+}
+
+/* ******************************* */
+
 int pfring_mod_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec) {
   return(setsockopt(ring->fd, 0, SO_PURGE_IDLE_HASH_RULES, &inactivity_sec, sizeof(inactivity_sec)));
 }
 
 /* ******************************* */
 
+int pfring_mod_set_hash_rules_idle_timeout(pfring *ring, u_int16_t inactivity_sec) {
+  return(setsockopt(ring->fd, 0, SO_SET_HASH_RULES_IDLE_TIMEOUT, &inactivity_sec, sizeof(inactivity_sec)));
+}
+
+/* ******************************* */
+
+int pfring_mod_set_hash_rules_table(pfring *ring, u_int32_t table_size, u_int32_t max_rules) {
+  struct pfring_hash_rules_table conf;
+
+  conf.size = table_size, conf.max_rules = max_rules;
+  return(setsockopt(ring->fd, 0, SO_SET_HASH_RULES_TABLE, &conf, sizeof(conf)));
+}
+
+/* ******************************* */
+
+int pfring_mod_set_prefix_blocklist(pfring *ring, struct pfring_blocklist_prefix *prefixes, u_int32_t num_prefixes) {
+  u_int32_t len = sizeof(struct pfring_prefix_blocklist) + num_prefixes * sizeof(struct pfring_blocklist_prefix);
+  struct pfring_prefix_blocklist *list;
+  int rc;
+
+  if((list = (struct pfring_prefix_blocklist*)malloc(len)) == NULL)
+    return(-1);
+
+  list->num_prefixes = num_prefixes;
+  if(num_prefixes > 0)
+    memcpy(list->prefixes, prefixes, num_prefixes * sizeof(struct pfring_blocklist_prefix));
+
+  rc = setsockopt(ring->fd, 0, SO_SET_PREFIX_BLOCKLIST, list, len);
+  free(list);
+
+  return(rc);
+}
+
+/* ******************************* */
+
 int pfring_mod_purge_idle_rules(pfring *ring, u_int16_t inactivity_sec) {
   return(setsockopt(ring->fd, 0, SO_PURGE_IDLE_RULES, &inactivity_sec, sizeof(inactivity_sec)));
 }
 
 /* **************************************************** */
 
+int pfring_mod_set_flow_cache_lifetime(pfring *ring, u_int32_t msec) {
+  return(setsockopt(ring->fd, 0, SO_SET_FLOW_CACHE_LIFETIME, &msec, sizeof(msec)));
+}
+
+/* **************************************************** */
+
 int pfring_mod_toggle_filtering_policy(pfring *ring, u_int8_t rules_default_accept_policy) {
 
   int rc = setsockopt(ring->fd, 0, SO_TOGGLE_FILTER_POLICY,
@@ -584,13 +1813,29 @@ int pfring_mod_poll(pfring *ring, u_int wait_duration) {
     return(ring->is_pkt_available(ring));
   else {
     struct pollfd pfd;
-    int rc;
+    int rc, waiting = 0;
 
     /* Userspace RING: enabling interrupts */
     if(ring->slots_info != NULL)
       ring->slots_info->userspace_ring_flags &= ~USERSPACE_RING_NO_INTERRUPT; 
     //gcc_mb();
 
+    if((ring->buffer != NULL) && !ring->consumer_state_set)
+      pfring_mod_consumer_opt_in(ring);
+
+    if((ring->buffer != NULL) && (*consumer_state(ring) != PF_RING_CONSUMER_LEGACY)) {
+      /* Ask for wakeups, then look again: a packet queued before the kernel saw the flag was not signalled */
+      *consumer_state(ring) = PF_RING_CONSUMER_WAITING;
+      __sync_synchronize();
+
+      if(ring->is_pkt_available(ring)) {
+	*consumer_state(ring) = PF_RING_CONSUMER_SPINNING;
+	return(1);
+      }
+
+      waiting = 1;
+    }
+
     /* Sleep when nothing is happening */
     pfd.fd      = ring->fd;
     pfd.events  = POLLIN /* | POLLERR */;
@@ -600,6 +1845,9 @@ int pfring_mod_poll(pfring *ring, u_int wait_duration) {
     rc = poll(&pfd, 1, wait_duration);
     ring->num_poll_calls++;
 
+    if(waiting)
+      *consumer_state(ring) = PF_RING_CONSUMER_SPINNING;
+
     return(rc);
   }
 }
@@ -671,6 +1919,32 @@ int pfring_mod_get_hash_filtering_rule_stats(pfring *ring,
 
 /* **************************************************** */
 
+int pfring_mod_get_hash_filtering_rules_stats(pfring *ring, struct pfring_hash_rule_stats *stats,
+					      u_int32_t max_rules, u_int64_t *cursor) {
+  struct pfring_hash_rules_stats_bulk *bulk;
+  socklen_t len;
+  int rc;
+
+  if(max_rules > MAX_HASH_RULES_BULK)
+    max_rules = MAX_HASH_RULES_BULK;
+
+  len = sizeof(*bulk) + max_rules * sizeof(struct pfring_hash_rule_stats);
+  if((bulk = (struct pfring_hash_rules_stats_bulk*)malloc(len)) == NULL)
+    return(-1);
+
+  bulk->cursor = *cursor, bulk->max_rules = max_rules, bulk->num_rules = 0;
+
+  /* One syscall and one kernel lock round-trip for the whole batch */
+  if((rc = getsockopt(ring->fd, 0, SO_GET_HASH_FILTERING_RULES_STATS, bulk, &len)) == 0) {
+    memcpy(stats, bulk->rules, bulk->num_rules * sizeof(struct pfring_hash_rule_stats));
+    *cursor = bulk->cursor;
+    rc = bulk->num_rules;
+  }
+
+  free(bulk);
+  return(rc);
+}
+
 int pfring_mod_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
   int rc = -1;
 
@@ -759,6 +2033,56 @@ int pfring_mod_handle_hash_filtering_rule(pfring *ring,
 
 /* ******************************* */
 
+int pfring_mod_handle_hash_filtering_rules_bulk(pfring *ring,
+						hash_filtering_rule *rules,
+						u_int32_t num_rules,
+						u_char add_rule) {
+  struct pfring_hash_rules_bulk *bulk;
+  u_int32_t done = 0, i, n;
+  int rc;
+
+  if(ring->ft_mode == hardware_only) {
+    for(i = 0; i < num_rules; i++)
+      if(pfring_hw_ft_handle_hash_filtering_rule(ring, &rules[i], add_rule) == 0)
+	done++;
+
+    return(done);
+  }
+
+  n = (num_rules < MAX_HASH_RULES_BULK) ? num_rules : MAX_HASH_RULES_BULK;
+  if((bulk = (struct pfring_hash_rules_bulk*)malloc(sizeof(*bulk) + n * sizeof(hash_filtering_rule))) == NULL)
+    return(-1);
+
+  /* One syscall (and one kernel lock round-trip) per MAX_HASH_RULES_BULK rules */
+  for(i = 0; i < num_rules; i += n) {
+    n = ((num_rules - i) < MAX_HASH_RULES_BULK) ? (num_rules - i) : MAX_HASH_RULES_BULK;
+
+    bulk->num_rules = n, bulk->num_done = 0;
+    memcpy(bulk->rules, &rules[i], n * sizeof(hash_filtering_rule));
+
+    rc = setsockopt(ring->fd, 0, add_rule ? SO_ADD_HASH_FILTERING_RULES : SO_REMOVE_HASH_FILTERING_RULES,
+		    bulk, sizeof(*bulk) + n * sizeof(hash_filtering_rule));
+
+    done += bulk->num_done;
+
+    if(rc < 0) {
+      free(bulk);
+      return(rc);
+    }
+  }
+
+  free(bulk);
+
+  if(ring->ft_mode != software_only) {
+    for(i = 0; i < num_rules; i++)
+      pfring_hw_ft_handle_hash_filtering_rule(ring, &rules[i], add_rule);
+  }
+
+  return(done);
+}
+
+/* ******************************* */
+
 u_int8_t pfring_mod_get_packet_consumer_mode(pfring *ring) {
   u_int8_t id;
   socklen_t len = sizeof(id);
@@ -804,6 +2128,14 @@ int pfring_mod_loopback_test(pfring *ring, char *buffer, u_int buffer_len, u_int
 
 /* *********************************** */
 
+int pfring_mod_loopback_inject(pfring *ring, struct pfring_loopback_inject *req) {
+  socklen_t len = sizeof(struct pfring_loopback_inject);
+
+  return(getsockopt(ring->fd, 0, SO_GET_LOOPBACK_INJECT, (char*)req, &len));
+}
+
+/* *********************************** */
+
 int pfring_mod_get_bound_device_address(pfring *ring, u_char mac_address[6]) {
   socklen_t len = 6;
 
@@ -831,13 +2163,19 @@ int pfring_mod_set_bpf_filter(pfring *ring, char *filter_buffer){
   if(!filter_buffer)
     return -1;
 
+  /*
+    The optimizer drops the redundant loads and jumps that the kernel would
+    run for every packet. Some expressions are known to trip it up with
+    older libpcap versions: compile them as they are then.
+  */
   if(pcap_compile_nopcap(ring->caplen,  /* snaplen_arg */
                          DLT_EN10MB,    /* linktype_arg */
                          &filter,       /* program */
                          filter_buffer, /* const char *buf */
-                         0,             /* optimize */
+                         1,             /* optimize */
                          0              /* mask */
-                         ) == -1)
+                         ) == -1
+     && pcap_compile_nopcap(ring->caplen, DLT_EN10MB, &filter, filter_buffer, 0 /* optimize */, 0) == -1)
     return -1;
 
   if(filter.bf_insns == NULL)
@@ -894,6 +2232,106 @@ int pfring_mod_send_last_rx_packet(pfring *ring, int tx_interface_id) {
 
 /* **************************************************** */
 
+/*
+  Kernel rings bounce in zero-copy: the kernel keeps the skb of every
+  slot (SO_ENABLE_RX_PACKET_BOUNCE) and, when the slot is consumed,
+  queues it to the egress device or frees it according to the
+  bounce_interface written here. Nothing is copied to a TX slot. The
+  consumption (the "doorbell") is asked with a poll() once every
+  BOUNCE_DOORBELL_BATCH packets or when the ingress ring is empty.
+*/
+
+#define BOUNCE_DOORBELL_BATCH 64
+
+struct mod_bounce {
+  int tx_ifindex;
+  u_int32_t pending;
+};
+
+static void mod_bounce_doorbell(pfring_bounce *bounce) {
+  struct mod_bounce *b = (struct mod_bounce*)bounce->priv_data;
+  struct pollfd pfd;
+
+  if(b->pending == 0)
+    return;
+
+  pfd.fd = bounce->rx_socket->fd, pfd.events = POLLIN, pfd.revents = 0;
+  poll(&pfd, 1, 0); /* consume_pending_pkts() */
+  b->pending = 0;
+}
+
+int pfring_mod_bounce_init(pfring_bounce *bounce) {
+  struct mod_bounce *b;
+  int dummy = 0;
+
+  /* The egress interface id is read in the long slot header */
+  if(!bounce->rx_socket->long_header || bounce->rx_socket->compact_header)
+    return(-1);
+
+  if((b = (struct mod_bounce*)calloc(1, sizeof(struct mod_bounce))) == NULL)
+    return(-1);
+
+  if((pfring_get_bound_device_id(bounce->tx_socket, &b->tx_ifindex) < 0)
+     || (setsockopt(bounce->rx_socket->fd, 0, SO_ENABLE_RX_PACKET_BOUNCE, &dummy, sizeof(dummy)) < 0)) {
+    free(b);
+    return(-1);
+  }
+
+  bounce->rx_socket->tx.enabled_rx_packet_send = 1;
+  bounce->priv_data = b;
+  return(0);
+}
+
+/* **************************************************** */
+
+int pfring_mod_bounce_loop(pfring_bounce *bounce, pfringBounceProcesssPacket looper,
+			   const u_char *user_bytes, u_int8_t wait_for_packet) {
+  struct mod_bounce *b = (struct mod_bounce*)bounce->priv_data;
+  pfring *rx = bounce->rx_socket;
+  struct pfring_pkthdr hdr;
+  u_char *pkt;
+  int rc = 0;
+
+  while(!bounce->break_loop) {
+    /* Zero-copy: the slot stays readable until the next recv */
+    if((rc = bounce->recv(rx, &pkt, 0, &hdr, 0)) < 0)
+      break;
+
+    if(rc == 0) {
+      mod_bounce_doorbell(bounce);
+
+      if(!wait_for_packet)
+	break;
+
+      if(pfring_poll(rx, rx->poll_duration) < 0 && (errno != EINTR))
+	break;
+
+      continue;
+    }
+
+    /* Not consumed by the kernel before the next recv (it stays one slot back) */
+    rx->tx.last_received_hdr->extended_hdr.tx.bounce_interface =
+      looper(hdr.caplen, pkt, user_bytes) ? b->tx_ifindex : UNKNOWN_INTERFACE;
+
+    if(++b->pending >= BOUNCE_DOORBELL_BATCH)
+      mod_bounce_doorbell(bounce);
+  }
+
+  mod_bounce_doorbell(bounce);
+  return((rc < 0) ? rc : 0);
+}
+
+/* **************************************************** */
+
+void pfring_mod_bounce_destroy(pfring_bounce *bounce) {
+  if(bounce->priv_data != NULL) {
+    free(bounce->priv_data);
+    bounce->priv_data = NULL;
+  }
+}
+
+/* **************************************************** */
+
 void pfring_mod_shutdown(pfring *ring) {
   int dummy = 0;
 
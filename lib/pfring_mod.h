@@ -15,14 +15,28 @@
 #define _PFRING_MOD_H_
 
 int pfring_mod_open (pfring *ring);
+int pfring_mod_shared_open(pfring *ring);
 
 void pfring_mod_close(pfring *ring);
+int pfring_mod_detach(pfring *ring);
 int pfring_mod_stats(pfring *ring, pfring_stat *stats);
+int pfring_mod_stats_mapped(pfring *ring, pfring_stat *stats);
+int pfring_mod_stats_ext(pfring *ring, pfring_stat_ext *stats);
 int pfring_mod_is_pkt_available(pfring *ring);
 int pfring_mod_next_pkt_time(pfring *ring, struct timespec *ts);
 int pfring_mod_recv (pfring *ring, u_char** buffer, u_int buffer_len, 
 			  struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int pfring_mod_recv_burst(pfring *ring, u_char** buffers, struct pfring_pkthdr *hdrs,
+			  u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+int pfring_mod_recv_batch(pfring *ring, struct pfring_pkthdr **hdrs, u_char **buffers,
+			  u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+void pfring_mod_release_batch(pfring *ring);
+int pfring_mod_enable_mpmc(pfring *ring, u_int num_consumers);
+int pfring_mod_mpmc_recv(pfring *ring, u_int consumer_id, struct pfring_pkthdr **hdrs, u_char **buffers,
+			 u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+void pfring_mod_mpmc_release(pfring *ring, u_int consumer_id);
 int pfring_mod_set_poll_watermark(pfring *ring, u_int16_t watermark);
+int pfring_mod_set_poll_coalescing(pfring *ring, u_int16_t num_pkts, u_int32_t usec);
 int pfring_mod_set_poll_duration(pfring *ring, u_int duration);
 int pfring_mod_add_hw_rule(pfring *ring, hw_filtering_rule *rule);
 int pfring_mod_remove_hw_rule(pfring *ring, u_int16_t rule_id);
@@ -30,13 +44,22 @@ int pfring_mod_set_channel_id(pfring *ring, u_int32_t channel_id);
 int pfring_mod_set_application_name(pfring *ring, char *name);
 int pfring_mod_bind(pfring *ring, char *device_name);
 int pfring_mod_send(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet);
+int pfring_mod_send_burst(pfring *ring, char **pkts, u_int *pkts_len, u_int num_pkts, u_int8_t flush_packet);
+int pfring_mod_set_tx_watermark(pfring *ring, u_int16_t watermark);
+int pfring_mod_set_tx_ring(pfring *ring, u_int32_t num_slots, u_int32_t max_pkt_len);
 u_int8_t pfring_mod_get_num_rx_channels(pfring *ring);
 int pfring_mod_set_sampling_rate(pfring *ring, u_int32_t rate);
+int pfring_mod_set_flow_sampling_rate(pfring *ring, u_int32_t rate);
+int pfring_mod_set_overload_policy(pfring *ring, u_int8_t early_drop, u_int8_t sample_threshold, u_int32_t max_sample_rate);
+int pfring_mod_set_shared_ring(pfring *ring, u_int32_t shared_ring_id, u_int8_t drop_slowest);
+int pfring_mod_set_latency_histogram(pfring *ring, u_int8_t enable);
+int pfring_mod_set_timestamp_mode(pfring *ring, u_int8_t mode);
 int pfring_mod_get_selectable_fd(pfring *ring);
 int pfring_mod_set_direction(pfring *ring, packet_direction direction);
 int pfring_mod_set_socket_mode(pfring *ring, socket_mode mode);
 int pfring_mod_set_cluster(pfring *ring, u_int clusterId, cluster_type the_type);
 int pfring_mod_remove_from_cluster(pfring *ring);
+int pfring_mod_set_cluster_indirection(pfring *ring, const u_int8_t *element);
 int pfring_mod_set_master_id(pfring *ring, u_int32_t master_id);
 int pfring_mod_set_master(pfring *ring, pfring *master);
 u_int16_t pfring_mod_get_ring_id(pfring *ring);
@@ -51,12 +74,24 @@ int pfring_mod_handle_hash_filtering_rule(pfring *ring,
 					  hash_filtering_rule* rule_to_add,
 					  u_char add_rule);
 int pfring_mod_purge_idle_hash_rules(pfring *ring, u_int16_t inactivity_sec); 
+int pfring_mod_set_hash_rules_idle_timeout(pfring *ring, u_int16_t inactivity_sec);
+int pfring_mod_set_hash_rules_table(pfring *ring, u_int32_t table_size, u_int32_t max_rules);
+int pfring_mod_handle_hash_filtering_rules_bulk(pfring *ring, hash_filtering_rule *rules,
+						u_int32_t num_rules, u_char add_rule);
+int pfring_mod_get_hash_filtering_rules_stats(pfring *ring, struct pfring_hash_rule_stats *stats,
+					      u_int32_t max_rules, u_int64_t *cursor);
+int pfring_mod_bounce_init(pfring_bounce *bounce);
+int pfring_mod_bounce_loop(pfring_bounce *bounce, pfringBounceProcesssPacket looper,
+			   const u_char *user_bytes, u_int8_t wait_for_packet);
+void pfring_mod_bounce_destroy(pfring_bounce *bounce);
+int pfring_mod_set_prefix_blocklist(pfring *ring, struct pfring_blocklist_prefix *prefixes, u_int32_t num_prefixes);
 int pfring_mod_purge_idle_rules(pfring *ring, u_int16_t inactivity_sec);
 int pfring_mod_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add);
 int pfring_mod_remove_filtering_rule(pfring *ring, u_int16_t rule_id);
 int pfring_mod_get_filtering_rule_stats(pfring *ring, u_int16_t rule_id,
 					char* stats, u_int *stats_len);
 int pfring_mod_toggle_filtering_policy(pfring *ring, u_int8_t rules_default_accept_policy);
+int pfring_mod_set_flow_cache_lifetime(pfring *ring, u_int32_t msec);
 int pfring_mod_enable_rss_rehash(pfring *ring);
 int pfring_mod_poll(pfring *ring, u_int wait_duration);
 int pfring_mod_version(pfring *ring, u_int32_t *version);
@@ -64,6 +99,7 @@ int pfring_mod_get_bound_device_address(pfring *ring, u_char mac_address[6]);
 u_int16_t pfring_mod_get_slot_header_len(pfring *ring);
 int pfring_mod_set_virtual_device(pfring *ring, virtual_filtering_device_info *info);
 int pfring_mod_loopback_test(pfring *ring, char *buffer, u_int buffer_len, u_int test_len);
+int pfring_mod_loopback_inject(pfring *ring, struct pfring_loopback_inject *req);
 int pfring_mod_enable_ring(pfring *ring);
 int pfring_mod_disable_ring(pfring *ring);
 int pfring_mod_set_bpf_filter(pfring *ring, char *filter_buffer);
@@ -33,6 +33,8 @@ int pfring_dag_open(pfring *ring) {
   ring->close              = pfring_dag_close;
   ring->stats              = pfring_dag_stats;
   ring->recv               = pfring_dag_recv;
+  ring->recv_burst         = pfring_dag_recv_burst;
+  ring->set_dna_parsing    = pfring_dag_set_parsing;
   ring->set_poll_watermark = pfring_dag_set_poll_watermark;
   ring->set_poll_duration  = pfring_dag_set_poll_duration;
   ring->poll               = pfring_dag_poll;
@@ -47,6 +49,12 @@ int pfring_dag_open(pfring *ring) {
   memset(ring->priv_data, 0, sizeof(pfring_dag));
   d = ring->priv_data;
 
+#ifdef PFRING_DAG_PARSE_PKT
+  ring->dna.parse_level = 4, ring->dna.parse_flags = PF_RING_DNA_PARSE_HASH;
+#else
+  ring->dna.parse_level = 0, ring->dna.parse_flags = 0; /* pfring_set_dna_parsing() */
+#endif
+
   if(ring->caplen > MAX_CAPLEN) 
     ring->caplen = MAX_CAPLEN;
 
@@ -172,7 +180,12 @@ void pfring_dag_close(pfring *ring) {
 
 /* **************************************************** */
 
-int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
+/*
+  Decodes the next complete ERF record between bottom and top, skipping
+  the padding and the unhandled types. Returns 1 (packet in *payload/hdr),
+  0 when no complete record is left, -1 on a corrupted record.
+*/
+static int pfring_dag_next_record(pfring *ring, pfring_dag *d, u_char **payload_ptr, struct pfring_pkthdr *hdr) {
   int caplen = 0;
   int skip;
   dag_record_t *erf_hdr;
@@ -180,40 +193,13 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
   u_char *payload;
   uint8_t *ext_hdr_type;
   uint32_t ext_hdr_num;
-  uint32_t len;
+  uint32_t len = 0;
   unsigned long long ts;
-  int retval = 0;
-  pfring_dag *d;
 
-#ifdef DAG_DEBUG
-  printf("[PF_RING] DAG recv\n");
-#endif
-
-  if(ring->priv_data == NULL) 
-    return -1;
-
-  d = (pfring_dag *) ring->priv_data;
+ next_record:
 
-  if(ring->reentrant)
-    pthread_rwlock_wrlock(&ring->lock);
-
- check_and_poll:
-
-  if (ring->break_recv_loop)
-    goto exit; /* retval = 0 */
-
-  if ((d->top - d->bottom) < dag_record_size) {
-
-    if ( (d->top = dag_advance_stream(d->fd, d->stream_num, (void * /* but it is void** */) &d->bottom)) == NULL) {
-      retval = -1;
-      goto exit;
-    }
-
-    if ( (d->top - d->bottom) < dag_record_size && !wait_for_incoming_packet )
-      goto exit; /* retval = 0 */
-		
-    goto check_and_poll;
-  }
+  if ((d->top - d->bottom) < dag_record_size)
+    return 0;
 
   erf_hdr = (dag_record_t *) d->bottom;
 
@@ -221,10 +207,12 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
 
   if (rlen < dag_record_size) {
     fprintf(stderr, "Error: wrong record size\n");
-    retval = -1;
-    goto exit;
+    return -1;
   }
 
+  if ((d->top - d->bottom) < rlen)
+    return 0; /* Not complete yet */
+
   d->bottom += rlen;
 
   skip = 0;    
@@ -248,7 +236,7 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
   }
 		
   if (skip)
-    goto check_and_poll;
+    goto next_record;
 
   payload = (u_char *) erf_hdr;
   payload += dag_record_size;
@@ -289,9 +277,6 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
 
     if (caplen > len) 
       caplen = len;
-     
-    if((buffer_len > 0) && (caplen > buffer_len))
-      caplen = buffer_len;
 
     payload += 2;
 
@@ -300,15 +285,10 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
 #ifdef DAG_DEBUG
     printf("Warning: unhandled ERF type\n");
 #endif
-    goto check_and_poll;
+    goto next_record;
   }
 
-  if (buffer_len > 0){
-    if(*buffer != NULL && caplen > 0)
-      memcpy(*buffer, payload, caplen);
-  }
-  else
-    *buffer = payload;
+  *payload_ptr = payload;
 
   hdr->caplen = caplen;
   hdr->len = len;
@@ -332,12 +312,65 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
   ts += ((erf_hdr->ts >> 32) * 1000000000);
   hdr->extended_hdr.timestamp_ns = ts;
 
-#ifdef PFRING_DAG_PARSE_PKT
-  pfring_parse_pkt(*buffer, hdr, 4, 0, 1);
-#else
   hdr->extended_hdr.parsed_header_len = 0;
+
+  return 1;
+}
+
+/* **************************************************** */
+
+int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
+  u_char *payload;
+  int retval = 0;
+  pfring_dag *d;
+
+#ifdef DAG_DEBUG
+  printf("[PF_RING] DAG recv\n");
 #endif
 
+  if(ring->priv_data == NULL) 
+    return -1;
+
+  d = (pfring_dag *) ring->priv_data;
+
+  if(ring->reentrant)
+    pthread_rwlock_wrlock(&ring->rx_lock);
+
+ check_and_poll:
+
+  if (ring->break_recv_loop)
+    goto exit; /* retval = 0 */
+
+  if ((retval = pfring_dag_next_record(ring, d, &payload, hdr)) == 0) {
+
+    if ( (d->top = dag_advance_stream(d->fd, d->stream_num, (void * /* but it is void** */) &d->bottom)) == NULL) {
+      retval = -1;
+      goto exit;
+    }
+
+    if ( (d->top - d->bottom) < dag_record_size && !wait_for_incoming_packet )
+      goto exit; /* retval = 0 */
+		
+    goto check_and_poll;
+  }
+
+  if (retval < 0)
+    goto exit;
+
+  if (buffer_len > 0){
+    if(hdr->caplen > buffer_len)
+      hdr->caplen = buffer_len;
+
+    if(*buffer != NULL && hdr->caplen > 0)
+      memcpy(*buffer, payload, hdr->caplen);
+  }
+  else
+    *buffer = payload;
+
+  if(ring->dna.parse_level > 0)
+    pfring_parse_pkt(*buffer, hdr, ring->dna.parse_level, 0,
+		     !!(ring->dna.parse_flags & PF_RING_DNA_PARSE_HASH));
+
   d->stats_recv++;
 	
   retval = 1;
@@ -345,13 +378,70 @@ int pfring_dag_recv(pfring *ring, u_char** buffer, u_int buffer_len, struct pfri
  exit:
 
   if(ring->reentrant) 
-    pthread_rwlock_unlock(&ring->spinlock);
+    pthread_rwlock_unlock(&ring->rx_lock);
 
   return retval;
 }
 
 /* **************************************************** */
 
+/*
+  Every complete ERF record between bottom and top in one call, as
+  zero-copy buffers: the stream is advanced (and the previous burst given
+  back to the card) only once they have all been read.
+*/
+int pfring_dag_recv_burst(pfring *ring, u_char** buffers, struct pfring_pkthdr *hdrs,
+			  u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  u_int num_pkts = 0;
+  int rc = 0;
+  pfring_dag *d;
+
+  if(ring->priv_data == NULL) 
+    return -1;
+
+  d = (pfring_dag *) ring->priv_data;
+
+ check_and_poll:
+
+  if (ring->break_recv_loop)
+    return 0;
+
+  while ((num_pkts < max_num_pkts)
+	 && ((rc = pfring_dag_next_record(ring, d, &buffers[num_pkts], &hdrs[num_pkts])) > 0))
+    num_pkts++;
+
+  if (num_pkts == 0) {
+    if (rc < 0)
+      return -1;
+
+    if ( (d->top = dag_advance_stream(d->fd, d->stream_num, (void * /* but it is void** */) &d->bottom)) == NULL)
+      return -1;
+
+    if ( (d->top - d->bottom) < dag_record_size && !wait_for_incoming_packet )
+      return 0;
+
+    goto check_and_poll;
+  }
+
+  if(ring->dna.parse_level > 0)
+    ring->simd.parse_pkt_burst(buffers, hdrs, num_pkts, ring->dna.parse_level, 0,
+			   !!(ring->dna.parse_flags & PF_RING_DNA_PARSE_HASH));
+
+  d->stats_recv += num_pkts;
+
+  return num_pkts;
+}
+
+/* **************************************************** */
+
+/* Like DNA: level 0 hands out the ERF timestamp and color/hash only */
+int pfring_dag_set_parsing(pfring *ring, u_int8_t level, u_int8_t flags) {
+  ring->dna.parse_level = level, ring->dna.parse_flags = flags;
+  return 0;
+}
+
+/* **************************************************** */
+
 int pfring_dag_set_poll_watermark(pfring *ring, u_int16_t watermark) {
   uint32_t mindata;
   struct timeval maxwait;
@@ -44,6 +44,8 @@ int  pfring_dag_open (pfring *ring);
 void pfring_dag_close(pfring *ring);
 int  pfring_dag_stats(pfring *ring, pfring_stat *stats);
 int  pfring_dag_recv (pfring *ring, u_char** buffer, u_int buffer_len, struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int  pfring_dag_recv_burst(pfring *ring, u_char** buffers, struct pfring_pkthdr *hdrs, u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+int  pfring_dag_set_parsing(pfring *ring, u_int8_t level, u_int8_t flags);
 int  pfring_dag_set_poll_watermark(pfring *ring, u_int16_t watermark);
 int  pfring_dag_set_poll_duration(pfring *ring, u_int duration);
 int  pfring_dag_poll(pfring *ring, u_int wait_duration);
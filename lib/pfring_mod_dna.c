@@ -93,7 +93,67 @@ void pfring_dna_close(pfring *ring) {
 /* **************************************************** */
 
 int pfring_dna_stats(pfring *ring, pfring_stat *stats) {
-  stats->recv = ring->dna.tot_dna_read_pkts, stats->drop = 0;
+  /* The per-queue drop register (82599 QPRDC) clears on read: summed */
+  if(ring->dna.qprdc_reg_ptr != NULL)
+    ring->dna.tot_dna_lost_pkts += *ring->dna.qprdc_reg_ptr;
+
+  stats->recv = ring->dna.tot_dna_read_pkts, stats->drop = ring->dna.tot_dna_lost_pkts;
+  return(0);
+}
+
+/* **************************************************** */
+
+/* Only the ring reading the NIC stats should call it: the registers clear on read */
+int pfring_dna_stats_ext(pfring *ring, pfring_stat_ext *stats) {
+  if(ring->dna.mpc_reg_ptr != NULL)
+    ring->dna.tot_nic_missed += *ring->dna.mpc_reg_ptr;
+
+  if(ring->dna.rnbc_reg_ptr != NULL)
+    ring->dna.tot_nic_no_buffer += *ring->dna.rnbc_reg_ptr;
+
+  stats->recv = ring->dna.tot_dna_read_pkts;
+  stats->sampled = ring->dna.tot_flow_sampled;
+  stats->nic_missed = ring->dna.tot_nic_missed, stats->nic_no_buffer = ring->dna.tot_nic_no_buffer;
+  stats->num_slots = ring->dna.dna_dev.mem_info.rx.packet_memory_num_slots;
+
+  return(0);
+}
+
+/* **************************************************** */
+
+/*
+  pfring_set_dna_wait_spin(): 1 while the RX ring is to be checked again
+  rather than sleeping in poll(), which re-arms the queue interrupt.
+*/
+static inline int dna_wait_spin(pfring *ring, u_int64_t *spin_until) {
+  u_int64_t now;
+
+  if(ring->dna.wait_spin_usec == 0)
+    return(0);
+
+  now = pfring_gettime_ns();
+
+  if(*spin_until == 0)
+    *spin_until = now + (u_int64_t)ring->dna.wait_spin_usec * 1000;
+
+  return(now < *spin_until);
+}
+
+/* **************************************************** */
+
+/*
+  pfring_set_flow_sampling_rate(): 1 when the packet is of a sampled flow.
+  The hash needs the 5-tuple: the packet is parsed here when the ring is
+  not parsed up to L4.
+*/
+static inline int dna_flow_sampled(pfring *ring, u_char *pkt, struct pfring_pkthdr *hdr, u_int8_t parsed) {
+  if(!parsed)
+    pfring_parse_pkt(pkt, hdr, 4, 0, 0);
+
+  if(pfring_flow_sampled(pfring_compute_pkt_hash(hdr, pkt_hash_crc32c), ring->dna.flow_sample_threshold))
+    return(1);
+
+  ring->dna.tot_flow_sampled++;
   return(0);
 }
 
@@ -104,6 +164,7 @@ int pfring_dna_recv(pfring *ring, u_char** buffer, u_int buffer_len,
 		    u_int8_t wait_for_incoming_packet) {
   u_char *pkt = NULL;
   int8_t status = 0;
+  u_int64_t spin_until = 0;
 
   if(unlikely(ring->reentrant)) pthread_rwlock_wrlock(&ring->rx_lock);
 
@@ -116,8 +177,18 @@ int pfring_dna_recv(pfring *ring, u_char** buffer, u_int buffer_len,
   pkt = ring->dna_next_packet(ring, buffer, buffer_len, hdr);
 
   if(pkt && (hdr->len > 0)) {
-    if(buffer_len > 0)
-      pfring_parse_pkt(*buffer, hdr, 4, 1, 1);
+    if(buffer_len > 0) {
+      if(ring->dna.parse_level > 0)
+	pfring_parse_pkt(*buffer, hdr, ring->dna.parse_level,
+			 !!(ring->dna.parse_flags & PF_RING_DNA_PARSE_TIMESTAMP),
+			 !!(ring->dna.parse_flags & PF_RING_DNA_PARSE_HASH));
+      else if((ring->dna.parse_flags & PF_RING_DNA_PARSE_TIMESTAMP) && (hdr->ts.tv_sec == 0))
+	pfring_gettimeofday(&hdr->ts);
+    }
+
+    if(unlikely(ring->dna.flow_sample_threshold != 0)
+       && !dna_flow_sampled(ring, pkt, hdr, (buffer_len > 0) && (ring->dna.parse_level >= 4)))
+      goto redo_pfring_recv;
 
     hdr->extended_hdr.rx_direction = 1;
 
@@ -126,6 +197,9 @@ int pfring_dna_recv(pfring *ring, u_char** buffer, u_int buffer_len,
   }
 
   if(wait_for_incoming_packet) {
+    if(dna_wait_spin(ring, &spin_until))
+      goto redo_pfring_recv;
+
     status = ring->dna_check_packet_to_read(ring, wait_for_incoming_packet);
 
     if(status > 0)
@@ -136,6 +210,115 @@ int pfring_dna_recv(pfring *ring, u_char** buffer, u_int buffer_len,
   return(0);
 }
 
+/* **************************************************** */
+
+/*
+  Zero-copy: the slots are drained first, then parsed with a single
+  pfring_parse_pkt_burst() call (one clock read per burst) as set by
+  pfring_set_dna_parsing(). The RX tail
+  register is still written by dna_next_packet() once every
+  dna_rx_sync_watermark packets, so a slot read here goes back to the
+  NIC at the end of its ring: the burst is bounded to half the ring for
+  the buffers to stay valid until the next call.
+*/
+int pfring_dna_recv_burst(pfring *ring, u_char** buffers, struct pfring_pkthdr *hdrs,
+			  u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  u_int num_pkts = 0;
+  int8_t status = 0;
+  u_int64_t spin_until = 0;
+
+  if(ring->dna_get_num_rx_slots) {
+    u_int max_burst = ring->dna_get_num_rx_slots(ring) / 2;
+
+    if((max_burst > 0) && (max_num_pkts > max_burst))
+      max_num_pkts = max_burst;
+  }
+
+ redo_pfring_recv_burst:
+  if(ring->is_shutting_down || ring->break_recv_loop)
+    return(-1);
+
+  while(num_pkts < max_num_pkts) {
+    u_char *pkt = ring->dna_next_packet(ring, &buffers[num_pkts], 0, &hdrs[num_pkts]);
+
+    if((pkt == NULL) || (hdrs[num_pkts].len == 0))
+      break;
+
+    buffers[num_pkts] = pkt;
+    hdrs[num_pkts].extended_hdr.rx_direction = 1;
+    num_pkts++;
+  }
+
+  if(num_pkts > 0) {
+    if(ring->dna.parse_level > 0)
+      ring->simd.parse_pkt_burst(buffers, hdrs, num_pkts, ring->dna.parse_level,
+			     !!(ring->dna.parse_flags & PF_RING_DNA_PARSE_TIMESTAMP),
+			     !!(ring->dna.parse_flags & PF_RING_DNA_PARSE_HASH));
+    else if(ring->dna.parse_flags & PF_RING_DNA_PARSE_TIMESTAMP) {
+      struct timeval now;
+      u_int i;
+
+      now.tv_sec = 0;
+      for(i = 0; i < num_pkts; i++) {
+	if(hdrs[i].ts.tv_sec == 0) {
+	  if(now.tv_sec == 0) pfring_gettimeofday(&now);
+	  hdrs[i].ts = now;
+	}
+      }
+    }
+
+    if(unlikely(ring->dna.flow_sample_threshold != 0)) {
+      u_int i, num_sampled = 0;
+
+      for(i = 0; i < num_pkts; i++) {
+	if(dna_flow_sampled(ring, buffers[i], &hdrs[i], ring->dna.parse_level >= 4)) {
+	  if(num_sampled != i)
+	    buffers[num_sampled] = buffers[i], hdrs[num_sampled] = hdrs[i];
+	  num_sampled++;
+	}
+      }
+
+      if((num_pkts = num_sampled) == 0)
+	goto redo_pfring_recv_burst;
+    }
+
+    return(num_pkts);
+  }
+
+  if(wait_for_incoming_packet) {
+    if(dna_wait_spin(ring, &spin_until))
+      goto redo_pfring_recv_burst;
+
+    status = ring->dna_check_packet_to_read(ring, wait_for_incoming_packet);
+
+    if(status > 0)
+      goto redo_pfring_recv_burst;
+  }
+
+  return(0);
+}
+
+/* ******************************* */
+
+static int pfring_dna_set_parsing(pfring *ring, u_int8_t level, u_int8_t flags) {
+  ring->dna.parse_level = level, ring->dna.parse_flags = flags;
+  return(0);
+}
+
+/* ******************************* */
+
+static int pfring_dna_set_wait_spin(pfring *ring, u_int32_t usec) {
+  ring->dna.wait_spin_usec = usec;
+  return(0);
+}
+
+/* ******************************* */
+
+static int pfring_dna_set_flow_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
+  ring->dna.flow_sample_threshold = pfring_flow_sampling_threshold(rate);
+  return(0);
+}
+
 /* ******************************* */
 
 static int pfring_get_mapped_dna_device(pfring *ring, dna_device *dev) {
@@ -167,10 +350,18 @@ int pfring_dna_open(pfring *ring) {
   char *at;
 
   ring->direction = rx_only_direction;
+  ring->dna.parse_level = 4; /* full parsing unless pfring_set_dna_parsing() */
+  ring->dna.parse_flags = PF_RING_DNA_PARSE_TIMESTAMP | PF_RING_DNA_PARSE_HASH;
 
   ring->close = pfring_dna_close;
   ring->stats = pfring_dna_stats;
+  ring->stats_mapped = pfring_dna_stats; /* no syscall */
+  ring->stats_ext = pfring_dna_stats_ext;
   ring->recv  = pfring_dna_recv;
+  ring->recv_burst = pfring_dna_recv_burst;
+  ring->set_dna_parsing = pfring_dna_set_parsing;
+  ring->set_dna_wait_spin = pfring_dna_set_wait_spin;
+  ring->set_flow_sampling_rate = pfring_dna_set_flow_sampling_rate;
   ring->enable_ring = pfring_dna_enable_ring;
   ring->set_direction = pfring_dna_set_direction;
   ring->poll = pfring_dna_poll;
@@ -190,9 +381,14 @@ int pfring_dna_open(pfring *ring) {
   ring->set_virtual_device = pfring_mod_set_virtual_device;
   ring->add_hw_rule = pfring_hw_ft_add_hw_rule;
   ring->remove_hw_rule = pfring_hw_ft_remove_hw_rule;
+  ring->add_hw_rules = pfring_hw_ft_add_hw_rules;
+  ring->remove_hw_rules = pfring_hw_ft_remove_hw_rules;
+  ring->offload_drop_prefixes = pfring_hw_ft_offload_drop_prefixes;
   ring->loopback_test = pfring_mod_loopback_test;
   ring->disable_ring = pfring_mod_disable_ring;
   ring->handle_hash_filtering_rule = pfring_mod_handle_hash_filtering_rule;
+  ring->handle_hash_filtering_rules_bulk = pfring_mod_handle_hash_filtering_rules_bulk;
+  ring->get_hash_filtering_rules_stats = pfring_mod_get_hash_filtering_rules_stats;
   ring->add_filtering_rule = pfring_mod_add_filtering_rule;
   ring->remove_filtering_rule = pfring_mod_remove_filtering_rule;
   ring->toggle_filtering_policy = pfring_mod_toggle_filtering_policy;
@@ -18,8 +18,11 @@ int  pfring_dna_open (pfring *ring);
 
 void pfring_dna_close(pfring *ring);
 int  pfring_dna_stats(pfring *ring, pfring_stat *stats);
+int  pfring_dna_stats_ext(pfring *ring, pfring_stat_ext *stats);
 int  pfring_dna_recv (pfring *ring, u_char** buffer, u_int buffer_len, 
 		      struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int  pfring_dna_recv_burst(pfring *ring, u_char** buffers, struct pfring_pkthdr *hdrs,
+			   u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
 int  pfring_dna_send(pfring *ring, char *pkt, u_int pkt_len);
 int  pfring_dna_enable_ring(pfring *ring);
 int  pfring_dna_set_direction(pfring *ring, packet_direction direction);
@@ -0,0 +1,498 @@
+/*
+ *
+ * (C) 2005-12 - Luca Deri <deri@ntop.org>
+ *               Alfredo Cardigliano <cardigliano@ntop.org>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lessed General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include "pfring.h"
+#include "pfring_utils.h"
+#include "pfring_mod.h"
+#include "pfring_mod_multi.h"
+
+// #define MULTI_RING_DEBUG
+
+#define multi_priv(ring) ((struct pfring_multi *)(ring)->priv_data)
+
+/* Applies a call to all the members, stops at the first error */
+#define MULTI_FOR_ALL(ring, call)					\
+  do {									\
+    struct pfring_multi *__m = multi_priv(ring);			\
+    u_int16_t __i;							\
+    int __rc;								\
+									\
+    for(__i = 0; __i < __m->num_rings; __i++) {				\
+      pfring *member = __m->rings[__i];					\
+									\
+      if((__rc = (call)) < 0)						\
+	return(__rc);							\
+    }									\
+  } while(0)
+
+/* ******************************* */
+
+static int pfring_mod_multi_open_members(pfring *ring, u_int8_t ts_order) {
+  struct pfring_multi *m;
+  char *list, *tok, *pos = NULL, *sep;
+  u_int32_t flags = (ring->promisc ? PF_RING_PROMISC : 0)
+    | (ring->long_header ? PF_RING_LONG_HEADER : 0)
+    | (ring->metadata_only ? PF_RING_METADATA_ONLY : 0)
+    | (ring->compact_header ? PF_RING_COMPACT_HEADER : 0)
+    | ((ring->ring_mem_policy & PFRING_MEM_NUMA_LOCAL) ? PF_RING_NUMA_LOCAL_MEM : 0)
+    | ((ring->ring_mem_policy & PFRING_MEM_CONTIGUOUS) ? PF_RING_CONTIGUOUS_MEM : 0)
+    | ((ring->slot_layout & PFRING_SLOT_ALIGNED) ? PF_RING_ALIGNED_SLOTS : 0)
+    | ((ring->slot_layout & PFRING_SLOT_NT_COPY) ? PF_RING_NT_COPY : 0);
+
+  if((m = calloc(1, sizeof(struct pfring_multi))) == NULL)
+    return(-1);
+
+  if((list = strdup(ring->device_name)) == NULL) {
+    free(m);
+    return(-1);
+  }
+
+  m->ts_order = ts_order;
+  pfring_bundle_init(&m->bundle, ts_order ? pick_fifo : pick_round_robin);
+  ring->priv_data = m;
+
+  sep = strchr(list, ';') ? ";" : ",";
+
+  for(tok = strtok_r(list, sep, &pos); tok != NULL; tok = strtok_r(NULL, sep, &pos)) {
+    pfring *member;
+
+    if((m->num_rings == MULTI_MAX_RINGS)
+       || ((member = pfring_open(tok, ring->caplen, flags)) == NULL)) {
+#ifdef MULTI_RING_DEBUG
+      printf("[PF_RING] multi: unable to open %s\n", tok);
+#endif
+      free(list);
+      pfring_mod_multi_close(ring);
+      return(-1);
+    }
+
+    m->rings[m->num_rings++] = member;
+  }
+
+  free(list);
+
+  if(m->num_rings == 0) {
+    pfring_mod_multi_close(ring);
+    return(-1);
+  }
+
+  ring->close = pfring_mod_multi_close;
+  ring->stats = pfring_mod_multi_stats;
+  ring->stats_ext = pfring_mod_multi_stats_ext;
+  ring->recv = pfring_mod_multi_recv;
+  ring->recv_burst = pfring_mod_multi_recv_burst;
+  ring->poll = pfring_mod_multi_poll;
+  ring->is_pkt_available = pfring_mod_multi_is_pkt_available;
+  ring->next_pkt_time = pfring_mod_multi_next_pkt_time;
+  ring->enable_ring = pfring_mod_multi_enable_ring;
+  ring->disable_ring = pfring_mod_multi_disable_ring;
+  ring->shutdown = pfring_mod_multi_shutdown;
+  ring->add_hw_rule = pfring_mod_multi_add_hw_rule;
+  ring->remove_hw_rule = pfring_mod_multi_remove_hw_rule;
+  ring->set_sampling_rate = pfring_mod_multi_set_sampling_rate;
+  ring->set_flow_sampling_rate = pfring_mod_multi_set_flow_sampling_rate;
+  ring->set_direction = pfring_mod_multi_set_direction;
+  ring->set_socket_mode = pfring_mod_multi_set_socket_mode;
+  ring->set_poll_watermark = pfring_mod_multi_set_poll_watermark;
+  ring->set_poll_duration = pfring_mod_multi_set_poll_duration;
+  ring->set_application_name = pfring_mod_multi_set_application_name;
+  ring->set_bpf_filter = pfring_mod_multi_set_bpf_filter;
+  ring->remove_bpf_filter = pfring_mod_multi_remove_bpf_filter;
+  ring->enable_rss_rehash = pfring_mod_multi_enable_rss_rehash;
+  ring->add_filtering_rule = pfring_mod_multi_add_filtering_rule;
+  ring->remove_filtering_rule = pfring_mod_multi_remove_filtering_rule;
+  ring->handle_hash_filtering_rule = pfring_mod_multi_handle_hash_filtering_rule;
+  ring->toggle_filtering_policy = pfring_mod_multi_toggle_filtering_policy;
+  ring->set_flow_cache_lifetime = pfring_mod_multi_set_flow_cache_lifetime;
+  ring->version = pfring_mod_multi_version;
+
+  /* Not a single socket */
+  ring->fd = -1;
+  ring->poll_duration = DEFAULT_POLL_DURATION;
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_open(pfring *ring) {
+  return(pfring_mod_multi_open_members(ring, 0));
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_ts_open(pfring *ring) {
+  return(pfring_mod_multi_open_members(ring, 1));
+}
+
+/* ******************************* */
+
+void pfring_mod_multi_close(pfring *ring) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  if(m == NULL)
+    return;
+
+  for(i = 0; i < m->num_rings; i++)
+    pfring_close(m->rings[i]);
+
+  free(m);
+  ring->priv_data = NULL;
+}
+
+/* ******************************* */
+
+/* The members' counters summed: one set of stats for the logical stream */
+int pfring_mod_multi_stats(pfring *ring, pfring_stat *stats) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  for(i = 0; i < m->num_rings; i++) {
+    pfring_stat s;
+
+    if(pfring_stats(m->rings[i], &s) < 0)
+      continue;
+
+    stats->recv += s.recv, stats->drop += s.drop, stats->sampled += s.sampled;
+  }
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_stats_ext(pfring *ring, pfring_stat_ext *stats) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  for(i = 0; i < m->num_rings; i++) {
+    pfring_stat_ext s;
+
+    if(pfring_stats_ext(m->rings[i], &s) < 0)
+      continue;
+
+    stats->recv += s.recv, stats->ring_full += s.ring_full;
+    stats->early_drop += s.early_drop, stats->overload_sampled += s.overload_sampled;
+    stats->sampled += s.sampled, stats->filtered += s.filtered;
+    stats->blocked += s.blocked, stats->consumer_lost += s.consumer_lost;
+    stats->nic_missed += s.nic_missed, stats->nic_no_buffer += s.nic_no_buffer;
+    stats->num_slots += s.num_slots;
+    if(s.max_queued > stats->max_queued) stats->max_queued = s.max_queued;
+  }
+
+  return(0);
+}
+
+/* ******************************* */
+
+/*
+  Turns of up to MULTI_BURST_LEN packets per member: a busy port cannot
+  starve the other one, and consecutive packets come from the same ring.
+*/
+static pfring* multi_next_member(pfring *ring) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  for(i = 0; i <= m->num_rings; i++) {
+    pfring *member = m->rings[m->current];
+
+    if((m->burst_left > 0) && (pfring_is_pkt_available(member) > 0))
+      return(member);
+
+    m->current = (m->current + 1) % m->num_rings;
+    m->burst_left = MULTI_BURST_LEN;
+  }
+
+  return(NULL);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_recv(pfring *ring, u_char** buffer, u_int buffer_len,
+			  struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet) {
+  struct pfring_multi *m = multi_priv(ring);
+  int rc;
+
+  if(m->ts_order)
+    return(pfring_bundle_read(&m->bundle, buffer, buffer_len, hdr, wait_for_incoming_packet));
+
+  while(!ring->break_recv_loop) {
+    pfring *member = multi_next_member(ring);
+
+    if(member != NULL) {
+      m->burst_left--;
+      return(pfring_recv(member, buffer, buffer_len, hdr, 0));
+    }
+
+    if(!wait_for_incoming_packet)
+      return(0);
+
+    if((rc = pfring_bundle_poll(&m->bundle, ring->poll_duration)) < 0)
+      return(rc);
+  }
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_recv_burst(pfring *ring, u_char* buffers[], struct pfring_pkthdr hdrs[],
+				u_int max_num_pkts, u_int8_t wait_for_incoming_packet) {
+  struct pfring_multi *m = multi_priv(ring);
+  int rc;
+
+  /* A packet at a time: the member heads are compared at each read */
+  if(m->ts_order)
+    return(pfring_bundle_read(&m->bundle, &buffers[0], 0, &hdrs[0], wait_for_incoming_packet));
+
+  while(!ring->break_recv_loop) {
+    pfring *member = multi_next_member(ring);
+
+    if(member != NULL) {
+      if(max_num_pkts > m->burst_left) max_num_pkts = m->burst_left;
+
+      if((rc = pfring_recv_burst(member, buffers, hdrs, max_num_pkts, 0)) > 0)
+	m->burst_left -= rc;
+
+      return(rc);
+    }
+
+    if(!wait_for_incoming_packet)
+      return(0);
+
+    if((rc = pfring_bundle_poll(&m->bundle, ring->poll_duration)) < 0)
+      return(rc);
+  }
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_poll(pfring *ring, u_int wait_duration) {
+  return(pfring_bundle_poll(&multi_priv(ring)->bundle, wait_duration));
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_is_pkt_available(pfring *ring) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  for(i = 0; i < m->num_rings; i++)
+    if(pfring_is_pkt_available(m->rings[i]) > 0)
+      return(1);
+
+  return(0);
+}
+
+/* ******************************* */
+
+/* The oldest head among the members */
+int pfring_mod_multi_next_pkt_time(pfring *ring, struct timespec *ts) {
+  struct pfring_multi *m = multi_priv(ring);
+  int found = 0;
+  u_int16_t i;
+
+  for(i = 0; i < m->num_rings; i++) {
+    struct timespec t;
+
+    if(pfring_next_pkt_time(m->rings[i], &t) != 0)
+      continue;
+
+    if(!found || timespec_is_before(&t, ts))
+      *ts = t, found = 1;
+  }
+
+  return(found ? 0 : PF_RING_ERROR_NO_PKT_AVAILABLE);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_enable_ring(pfring *ring) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+  int rc;
+
+  if(m->bundle.num_sockets > 0) {
+    /* Enabled again after pfring_disable_ring() */
+    MULTI_FOR_ALL(ring, pfring_enable_ring(member));
+    return(0);
+  }
+
+  /* The bundle enables its sockets */
+  for(i = 0; i < m->num_rings; i++)
+    if((rc = pfring_bundle_add(&m->bundle, m->rings[i])) < 0)
+      return(rc);
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_disable_ring(pfring *ring) {
+  MULTI_FOR_ALL(ring, pfring_disable_ring(member));
+  return(0);
+}
+
+/* ******************************* */
+
+void pfring_mod_multi_shutdown(pfring *ring) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  for(i = 0; i < m->num_rings; i++)
+    pfring_shutdown(m->rings[i]);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_add_hw_rule(pfring *ring, hw_filtering_rule *rule) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  for(i = 0; i < m->num_rings; i++) {
+    if(pfring_add_hw_rule(m->rings[i], rule) < 0) {
+      pfring_mod_multi_remove_hw_rule(ring, rule->rule_id);
+      return(-1);
+    }
+  }
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_remove_hw_rule(pfring *ring, u_int16_t rule_id) {
+  struct pfring_multi *m = multi_priv(ring);
+  u_int16_t i;
+
+  for(i = 0; i < m->num_rings; i++)
+    pfring_remove_hw_rule(m->rings[i], rule_id);
+
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
+  MULTI_FOR_ALL(ring, pfring_set_sampling_rate(member, rate));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_flow_sampling_rate(pfring *ring, u_int32_t rate /* 1 = no sampling */) {
+  MULTI_FOR_ALL(ring, pfring_set_flow_sampling_rate(member, rate));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_direction(pfring *ring, packet_direction direction) {
+  MULTI_FOR_ALL(ring, pfring_set_direction(member, direction));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_socket_mode(pfring *ring, socket_mode mode) {
+  MULTI_FOR_ALL(ring, pfring_set_socket_mode(member, mode));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_poll_watermark(pfring *ring, u_int16_t watermark) {
+  MULTI_FOR_ALL(ring, pfring_set_poll_watermark(member, watermark));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_poll_duration(pfring *ring, u_int duration) {
+  MULTI_FOR_ALL(ring, pfring_set_poll_duration(member, duration));
+  ring->poll_duration = duration;
+  return(duration);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_application_name(pfring *ring, char *name) {
+  MULTI_FOR_ALL(ring, pfring_set_application_name(member, name));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_bpf_filter(pfring *ring, char *filter_buffer) {
+  MULTI_FOR_ALL(ring, pfring_set_bpf_filter(member, filter_buffer));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_remove_bpf_filter(pfring *ring) {
+  MULTI_FOR_ALL(ring, pfring_remove_bpf_filter(member));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_enable_rss_rehash(pfring *ring) {
+  MULTI_FOR_ALL(ring, pfring_enable_rss_rehash(member));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
+  MULTI_FOR_ALL(ring, pfring_add_filtering_rule(member, rule_to_add));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_remove_filtering_rule(pfring *ring, u_int16_t rule_id) {
+  MULTI_FOR_ALL(ring, pfring_remove_filtering_rule(member, rule_id));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_add,
+						u_char add_rule) {
+  MULTI_FOR_ALL(ring, pfring_handle_hash_filtering_rule(member, rule_to_add, add_rule));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_toggle_filtering_policy(pfring *ring, u_int8_t rules_default_accept_policy) {
+  MULTI_FOR_ALL(ring, pfring_toggle_filtering_policy(member, rules_default_accept_policy));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_set_flow_cache_lifetime(pfring *ring, u_int32_t msec) {
+  MULTI_FOR_ALL(ring, pfring_set_flow_cache_lifetime(member, msec));
+  return(0);
+}
+
+/* ******************************* */
+
+int pfring_mod_multi_version(pfring *ring, u_int32_t *version) {
+  return(pfring_version(multi_priv(ring)->rings[0], version));
+}
@@ -0,0 +1,72 @@
+/*
+ *
+ * (C) 2005-12 - Luca Deri <deri@ntop.org>
+ *               Alfredo Cardigliano <cardigliano@ntop.org>
+ *
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesses General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _PFRING_MOD_MULTI_H_
+#define _PFRING_MOD_MULTI_H_
+
+/*
+  multi:dev1,dev2     one logical stream from several rings, read in
+                      bursts of MULTI_BURST_LEN packets per ring in turn
+  multits:dev1,dev2   same, merged in timestamp order
+
+  The members are any pfring_open() device (e.g. dna0, eth1@0-3). Use ';'
+  instead of ',' between members when they carry a channel list.
+*/
+
+#define MULTI_MAX_RINGS  (MAX_NUM_BUNDLE_ELEMENTS - 1)
+#define MULTI_BURST_LEN  32
+
+struct pfring_multi {
+  u_int8_t ts_order;
+  u_int16_t num_rings, current, burst_left;
+  pfring *rings[MULTI_MAX_RINGS];
+  pfring_bundle bundle; /* poll() of all the members, multits merge */
+};
+
+int  pfring_mod_multi_open(pfring *ring);
+int  pfring_mod_multi_ts_open(pfring *ring);
+
+void pfring_mod_multi_close(pfring *ring);
+int  pfring_mod_multi_stats(pfring *ring, pfring_stat *stats);
+int  pfring_mod_multi_stats_ext(pfring *ring, pfring_stat_ext *stats);
+int  pfring_mod_multi_recv(pfring *ring, u_char** buffer, u_int buffer_len,
+			   struct pfring_pkthdr *hdr, u_int8_t wait_for_incoming_packet);
+int  pfring_mod_multi_recv_burst(pfring *ring, u_char* buffers[], struct pfring_pkthdr hdrs[],
+				 u_int max_num_pkts, u_int8_t wait_for_incoming_packet);
+int  pfring_mod_multi_poll(pfring *ring, u_int wait_duration);
+int  pfring_mod_multi_is_pkt_available(pfring *ring);
+int  pfring_mod_multi_next_pkt_time(pfring *ring, struct timespec *ts);
+int  pfring_mod_multi_enable_ring(pfring *ring);
+int  pfring_mod_multi_disable_ring(pfring *ring);
+void pfring_mod_multi_shutdown(pfring *ring);
+int  pfring_mod_multi_add_hw_rule(pfring *ring, hw_filtering_rule *rule);
+int  pfring_mod_multi_remove_hw_rule(pfring *ring, u_int16_t rule_id);
+int  pfring_mod_multi_set_sampling_rate(pfring *ring, u_int32_t rate);
+int  pfring_mod_multi_set_flow_sampling_rate(pfring *ring, u_int32_t rate);
+int  pfring_mod_multi_set_direction(pfring *ring, packet_direction direction);
+int  pfring_mod_multi_set_socket_mode(pfring *ring, socket_mode mode);
+int  pfring_mod_multi_set_poll_watermark(pfring *ring, u_int16_t watermark);
+int  pfring_mod_multi_set_poll_duration(pfring *ring, u_int duration);
+int  pfring_mod_multi_set_application_name(pfring *ring, char *name);
+int  pfring_mod_multi_set_bpf_filter(pfring *ring, char *filter_buffer);
+int  pfring_mod_multi_remove_bpf_filter(pfring *ring);
+int  pfring_mod_multi_enable_rss_rehash(pfring *ring);
+int  pfring_mod_multi_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add);
+int  pfring_mod_multi_remove_filtering_rule(pfring *ring, u_int16_t rule_id);
+int  pfring_mod_multi_handle_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_to_add,
+						 u_char add_rule);
+int  pfring_mod_multi_toggle_filtering_policy(pfring *ring, u_int8_t rules_default_accept_policy);
+int  pfring_mod_multi_set_flow_cache_lifetime(pfring *ring, u_int32_t msec);
+int  pfring_mod_multi_version(pfring *ring, u_int32_t *version);
+
+#endif /* _PFRING_MOD_MULTI_H_ */
@@ -39,12 +39,14 @@ static __inline__ ticks getticks(void)
 
 int pfring_mod_usring_open(pfring *ring) {
   int rc;
-  int tot_ring_mem;
+  u_int64_t tot_ring_mem;
   socklen_t s_len;
 
   ring->close        = pfring_mod_usring_close;
   ring->send         = pfring_mod_usring_enqueue;
   ring->send_parsed  = pfring_mod_usring_enqueue_parsed;
+  ring->send_burst   = pfring_mod_usring_enqueue_burst;
+  ring->enable_mpsc  = pfring_mod_usring_enable_mpsc;
 
   ring->enable_ring = pfring_mod_enable_ring;
 
@@ -132,20 +134,39 @@ void pfring_mod_usring_close(pfring *ring) {
 
 /* ******************************* */
 
-static inline char* get_slot(pfring *ring, u_int32_t off) {
+/*
+  Several threads enqueueing on the same producer handle without a lock
+  (the kernel allows one producer socket per usrX): each enqueue claims
+  its slots with a single CAS on usring.claim, which packs the number of
+  slots claimed so far (high 32 bits) and the offset of the next free slot,
+  copies the packets, then publishes them in claim order by waiting for
+  tot_insert to reach its first slot. To be called before the producers
+  start.
+*/
+int pfring_mod_usring_enable_mpsc(pfring *ring) {
+  /* The claim packs a 32 bit offset */
+  if(ring->slots_info->tot_mem - sizeof(FlowSlotInfo) > 0xFFFFFFFFULL)
+    return PF_RING_ERROR_NOT_SUPPORTED;
+
+  ring->usring.claim = (((u_int64_t)(u_int32_t)ring->slots_info->tot_insert) << 32)
+    | ring->slots_info->insert_off;
+  ring->usring.mpsc = 1;
+  return 0;
+}
+
+/* ******************************* */
+
+static inline char* get_slot(pfring *ring, u_int64_t off) {
   return &(ring->slots[off]); 
 }
 
 /* ******************************* */
 
-static inline int get_next_slot_offset(pfring *ring, u_int32_t off)
+static inline u_int64_t next_slot_offset(pfring *ring, u_int64_t off, u_int32_t caplen)
 {
-  struct pfring_pkthdr *hdr;
   u_int32_t real_slot_size;
 
-  hdr = (struct pfring_pkthdr *) get_slot(ring, off);
-
-  real_slot_size = ring->slot_header_len + hdr->caplen;
+  real_slot_size = pfring_slot_align(ring->slots_info, ring->slot_header_len + caplen);
 
   //TODO extended_hdr.parsed_header
   //if(ring->slot_header_len == sizeof(struct pfring_pkthdr)) /* !quick_mode */
@@ -172,18 +193,21 @@ static inline u_int32_t num_queued_pkts(pfring *ring)
 
 /* ******************************* */
 
-static inline int check_and_init_free_slot(pfring *ring, int off)
+/* off: where the packet would go, queued: packets inserted (or claimed) and not read */
+static inline int check_and_init_free_slot(pfring *ring, u_int64_t off, u_int32_t queued)
 {
-  if(ring->slots_info->insert_off == ring->slots_info->remove_off) {
-    if(num_queued_pkts(ring) >= ring->slots_info->min_num_slots)
+  u_int64_t remove_off = ring->slots_info->remove_off;
+
+  if(off == remove_off) {
+    if(queued >= ring->slots_info->min_num_slots)
       return 0;
   } else {
-    if(ring->slots_info->insert_off < ring->slots_info->remove_off) {
-      if((ring->slots_info->remove_off - ring->slots_info->insert_off) < (2 * ring->slots_info->slot_len))
+    if(off < remove_off) {
+      if((remove_off - off) < (2 * ring->slots_info->slot_len))
 	return 0;
     } else {
-      if ((ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - ring->slots_info->insert_off) < (2 * ring->slots_info->slot_len) &&
-          ring->slots_info->remove_off == 0)
+      if ((ring->slots_info->tot_mem - sizeof(FlowSlotInfo) - off) < (2 * ring->slots_info->slot_len) &&
+          remove_off == 0)
 	return 0;
     }
   }
@@ -193,23 +217,14 @@ static inline int check_and_init_free_slot(pfring *ring, int off)
 
 /* ******************************* */
 
-static inline int copy_data_to_ring(pfring *ring, struct pfring_pkthdr *pkt_hdr, void *pkt, uint pkt_len) {
+/* Returns the offset of the next slot */
+static inline u_int64_t copy_data_to_slot(pfring *ring, u_int64_t off, struct pfring_pkthdr *pkt_hdr, void *pkt, uint pkt_len) {
   struct pfring_pkthdr *hdr;
   char *ring_bucket;
-  u_int32_t off;
-
-  off = ring->slots_info->insert_off;
-  ring->slots_info->tot_pkts++;
-
-  if(!check_and_init_free_slot(ring, off)) {
-    ring->slots_info->tot_lost++;
-    return -1;
-  }
 
   ring_bucket = get_slot(ring, off);
   hdr = (struct pfring_pkthdr *) ring_bucket;
 
-
   if (pkt_hdr != NULL) {
     memcpy(hdr, pkt_hdr, ring->slot_header_len);
     //TODO extended_hdr.parsed_header
@@ -225,7 +240,33 @@ static inline int copy_data_to_ring(pfring *ring, struct pfring_pkthdr *pkt_hdr,
   hdr->caplen = min_val(pkt_len, ring->caplen);
   memcpy(&ring_bucket[ring->slot_header_len], pkt, hdr->caplen);
 
-  ring->slots_info->insert_off = get_next_slot_offset(ring, off);
+  return next_slot_offset(ring, off, hdr->caplen);
+}
+
+/* ******************************* */
+
+/* pkt_hdr (or NULL) is used for every packet: enqueue_parsed passes one */
+static inline int copy_data_to_ring(pfring *ring, struct pfring_pkthdr *pkt_hdr, char **pkts, u_int *pkts_len, u_int num_pkts) {
+  u_int64_t off;
+  u_int i;
+
+  off = ring->slots_info->insert_off;
+  ring->slots_info->tot_pkts += num_pkts;
+
+  for(i = 0; i < num_pkts; i++) {
+    if(!check_and_init_free_slot(ring, off, num_queued_pkts(ring) + i))
+      break;
+
+    off = copy_data_to_slot(ring, off, pkt_hdr, pkts[i], pkts_len[i]);
+  }
+
+  if(i < num_pkts)
+    ring->slots_info->tot_lost += num_pkts - i;
+
+  if(i == 0)
+    return -1;
+
+  ring->slots_info->insert_off = off;
 
   /*
     NOTE: smp_* barriers are _compiler_ barriers on UP, mandatory barriers on SMP
@@ -234,19 +275,68 @@ static inline int copy_data_to_ring(pfring *ring, struct pfring_pkthdr *pkt_hdr,
   //smp_mb();
   gcc_mb();
 
-  ring->slots_info->tot_insert++;
+  ring->slots_info->tot_insert += i; /* one update for the whole burst */
 
-  return 1;
+  return i;
+}
+
+/* ******************************* */
+
+static inline int copy_data_to_ring_mpsc(pfring *ring, struct pfring_pkthdr *pkt_hdr, char **pkts, u_int *pkts_len, u_int num_pkts) {
+  volatile u_int64_t *tot_insert = (volatile u_int64_t *) &ring->slots_info->tot_insert;
+  u_int64_t claim, next = 0;
+  u_int32_t seq, off, end, tot_read;
+  u_int i, n;
+
+  do {
+    claim = ring->usring.claim;
+    seq = claim >> 32, end = (u_int32_t)claim;
+    tot_read = ring->slots_info->tot_read;
+
+    for(n = 0; n < num_pkts; n++) {
+      if(!check_and_init_free_slot(ring, end, seq + n - tot_read))
+	break;
+
+      end = next_slot_offset(ring, end, min_val(pkts_len[n], ring->caplen));
+    }
+
+    if(n == 0)
+      break;
+
+    next = (((u_int64_t)(seq + n)) << 32) | end;
+  } while(!__sync_bool_compare_and_swap(&ring->usring.claim, claim, next));
+
+  __sync_fetch_and_add(&ring->slots_info->tot_pkts, num_pkts);
+
+  if(n < num_pkts)
+    __sync_fetch_and_add(&ring->slots_info->tot_lost, num_pkts - n);
+
+  if(n == 0)
+    return -1;
+
+  for(i = 0, off = (u_int32_t)claim; i < n; i++)
+    off = copy_data_to_slot(ring, off, pkt_hdr, pkts[i], pkts_len[i]);
+
+  /* The slots claimed before ours are published first */
+  while((u_int32_t)*tot_insert != seq)
+    gcc_mb();
+
+  ring->slots_info->insert_off = end;
+  gcc_mb();
+  *tot_insert += n;
+
+  return n;
 }
 
 /* ******************************* */
 
-static inline void pfring_mod_usring_signal(pfring *ring, u_int8_t flush_packet) {
+static inline void pfring_mod_usring_signal(pfring *ring, u_int num_pkts, u_int8_t flush_packet) {
   if (!(ring->slots_info->userspace_ring_flags & USERSPACE_RING_NO_INTERRUPT)) {
 
 #ifdef USE_WATERMARK
-    if(!flush_packet && ring->dna.num_tx_pkts_before_dna_sync < ring->dna.dna_tx_sync_watermark)
-      ring->dna.num_tx_pkts_before_dna_sync++;
+    /* Not atomic with MPSC: a lost update only moves the next wakeup */
+    if(!flush_packet && (ring->dna.num_tx_pkts_before_dna_sync + num_pkts) <= ring->dna.dna_tx_sync_watermark)
+      ring->dna.num_tx_pkts_before_dna_sync += num_pkts;
     else {
       ring->dna.num_tx_pkts_before_dna_sync = 0;
 #endif
@@ -271,27 +361,36 @@ static inline void pfring_mod_usring_signal(pfring *ring, u_int8_t flush_packet)
 
 /* ******************************* */
 
-int pfring_mod_usring_enqueue(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
+static inline int usring_enqueue(pfring *ring, struct pfring_pkthdr *hdr, char **pkts, u_int *pkts_len,
+				 u_int num_pkts, u_int8_t flush_packet) {
   int rc;
 
-  rc = copy_data_to_ring(ring, NULL, pkt, pkt_len);
+  if(ring->usring.mpsc)
+    rc = copy_data_to_ring_mpsc(ring, hdr, pkts, pkts_len, num_pkts);
+  else
+    rc = copy_data_to_ring(ring, hdr, pkts, pkts_len, num_pkts);
 
-  if (rc == 1)
-    pfring_mod_usring_signal(ring, flush_packet);
+  if (rc > 0)
+    pfring_mod_usring_signal(ring, rc, flush_packet);
 
   return rc;
 }
 
 /* ******************************* */
 
-int pfring_mod_usring_enqueue_parsed(pfring *ring, char *pkt, struct pfring_pkthdr *hdr, u_int8_t flush_packet) {
-  int rc;
-
-  rc = copy_data_to_ring(ring, hdr, pkt, hdr->len);
+int pfring_mod_usring_enqueue(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet) {
+  return usring_enqueue(ring, NULL, &pkt, &pkt_len, 1, flush_packet);
+}
 
-  if (rc == 1)
-    pfring_mod_usring_signal(ring, flush_packet);
+/* ******************************* */
 
-  return rc;
+int pfring_mod_usring_enqueue_parsed(pfring *ring, char *pkt, struct pfring_pkthdr *hdr, u_int8_t flush_packet) {
+  return usring_enqueue(ring, hdr, &pkt, &hdr->len, 1, flush_packet);
 }
 
+/* ******************************* */
+
+/* One tot_insert update and at most one wakeup of the consumer per burst */
+int pfring_mod_usring_enqueue_burst(pfring *ring, char **pkts, u_int *pkts_len, u_int num_pkts, u_int8_t flush_packet) {
+  return usring_enqueue(ring, NULL, pkts, pkts_len, num_pkts, flush_packet);
+}
@@ -19,5 +19,7 @@ int  pfring_mod_usring_open (pfring *ring);
 void pfring_mod_usring_close(pfring *ring);
 int  pfring_mod_usring_enqueue(pfring *ring, char *pkt, u_int pkt_len, u_int8_t flush_packet);
 int  pfring_mod_usring_enqueue_parsed(pfring *ring, char *pkt, struct pfring_pkthdr *hdr, u_int8_t flush_packet);
+int  pfring_mod_usring_enqueue_burst(pfring *ring, char **pkts, u_int *pkts_len, u_int num_pkts, u_int8_t flush_packet);
+int  pfring_mod_usring_enable_mpsc(pfring *ring);
 
 #endif /* _PFRING_MOD_USRING_H_ */
@@ -96,9 +96,8 @@ static u_int32_t cird2mask(u_int cidr) {
 
 /* ********************************* */
 
-int redirector_add_hw_rule(pfring *ring, hw_filtering_rule *rule,
-			   filtering_rule* rule_to_add,
-			   hash_filtering_rule* hash_rule_to_add) {
+/* Adds the rule to the switch table without installing it: returns the rule id */
+static int redirector_push_hw_rule(pfring *ring, hw_filtering_rule *rule) {
   int ret;
   rdi_mem_t rdi_rule;
 
@@ -156,6 +155,16 @@ int redirector_add_hw_rule(pfring *ring, hw_filtering_rule *rule,
     break;
   }
 
+  return(ret);
+}
+
+/* ********************************* */
+
+int redirector_add_hw_rule(pfring *ring, hw_filtering_rule *rule,
+			   filtering_rule* rule_to_add,
+			   hash_filtering_rule* hash_rule_to_add) {
+  int ret = redirector_push_hw_rule(ring, rule);
+
   if(ret < 0)
     return ret;
   else {
@@ -213,6 +222,7 @@ int redirector_add_filtering_rule(pfring *ring, filtering_rule* rule_to_add) {
   case bounce_packet_and_continue_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
+  case rate_limit_packet_and_stop_rule_evaluation:
     return(-3); /* Not supported */
   }
 
@@ -269,6 +279,7 @@ int redirector_add_hash_filtering_rule(pfring *ring, hash_filtering_rule* rule_t
   case bounce_packet_and_continue_rule_evaluation:
   case execute_action_and_continue_rule_evaluation:
   case execute_action_and_stop_rule_evaluation:
+  case rate_limit_packet_and_stop_rule_evaluation:
     return(-3); /* Not supported */
   }
 
@@ -301,3 +312,128 @@ int redirector_remove_filtering_rule(pfring *ring, u_int16_t rule_id) {
 }
 
 /* ********************************* */
+
+/*
+  Mitigation offload: the switch rule table is small and every
+  rdi_install_rules() reprograms it, hence only the prefixes sending
+  the most traffic are offloaded and the table is updated with one
+  install per call. The capacity is learnt from the first add failure.
+*/
+
+#define REDIRECTOR_MAX_OFFLOAD_RULES 512
+
+struct redirector_offloaded_prefix {
+  u_int32_t addr;
+  u_int8_t  prefix_len;
+  int       rule_id;
+};
+
+struct redirector_offload_candidate {
+  struct pfring_blocklist_prefix *prefix;
+  u_int64_t volume;
+};
+
+static int redirector_cmp_volume(const void *_a, const void *_b) {
+  const struct redirector_offload_candidate *a = _a, *b = _b;
+
+  if(a->volume == b->volume) return(0);
+  return((a->volume > b->volume) ? -1 : 1);
+}
+
+/* ********************************* */
+
+int redirector_offload_drop_prefixes(pfring *ring, struct pfring_blocklist_prefix *prefixes,
+				     u_int64_t *volumes, u_int32_t num_prefixes) {
+  struct redirector_offloaded_prefix *offloaded = ring->rdi.offloaded, *next;
+  struct redirector_offload_candidate *candidates;
+  u_int i, j, num_candidates = 0, num_next = 0, capacity, changed = 0;
+  int rc;
+
+  if(!ring->socket_default_accept_policy)
+    num_prefixes = 0; /* Nothing to drop: everything not forwarded is already dropped */
+
+  if(offloaded == NULL) {
+    if((offloaded = calloc(REDIRECTOR_MAX_OFFLOAD_RULES, sizeof(*offloaded))) == NULL)
+      return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+    ring->rdi.offloaded = offloaded;
+  }
+
+  capacity = ring->rdi.max_rules ? ring->rdi.max_rules : REDIRECTOR_MAX_OFFLOAD_RULES;
+
+  if((candidates = malloc((num_prefixes + 1) * sizeof(*candidates))) == NULL)
+    return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+
+  if((next = calloc(REDIRECTOR_MAX_OFFLOAD_RULES, sizeof(*next))) == NULL) {
+    free(candidates);
+    return(PF_RING_ERROR_NOT_ENOUGH_MEMORY);
+  }
+
+  for(i = 0; i < num_prefixes; i++) {
+    if(prefixes[i].ip_version != 4 /* IPv4 only */
+       || prefixes[i].prefix_len == 0 || prefixes[i].prefix_len > 32)
+      continue;
+    candidates[num_candidates].prefix = &prefixes[i];
+    candidates[num_candidates].volume = volumes ? volumes[i] : 0;
+    num_candidates++;
+  }
+
+  qsort(candidates, num_candidates, sizeof(*candidates), redirector_cmp_volume);
+
+  if(num_candidates > capacity)
+    num_candidates = capacity;
+
+  /* Keep the rules still selected, remove the others */
+  for(i = 0; i < ring->rdi.num_offloaded; i++) {
+    for(j = 0; j < num_candidates; j++)
+      if(candidates[j].prefix != NULL
+	 && candidates[j].prefix->addr.v4 == offloaded[i].addr
+	 && candidates[j].prefix->prefix_len == offloaded[i].prefix_len)
+	break;
+
+    if(j < num_candidates) {
+      next[num_next++] = offloaded[i];
+      candidates[j].prefix = NULL; /* Already there */
+    } else {
+      rdi_entry_remove(ring->rdi.device_id, offloaded[i].rule_id);
+      changed = 1;
+    }
+  }
+
+  for(j = 0; j < num_candidates; j++) {
+    hw_filtering_rule rule;
+    silicom_redirector_hw_rule *silicom = &rule.rule_family.redirector_rule;
+
+    if(candidates[j].prefix == NULL) continue;
+
+    memset(&rule, 0, sizeof(rule));
+    rule.rule_family_type = silicom_redirector_rule;
+    silicom->rule_type = drop_rule;
+    silicom->rule_port = ring->rdi.port_id;
+    silicom->src_addr.v4 = candidates[j].prefix->addr.v4;
+    silicom->src_mask = candidates[j].prefix->prefix_len;
+
+    if((rc = redirector_push_hw_rule(ring, &rule)) < 0) {
+      /* Table full: remember its size */
+      ring->rdi.max_rules = num_next;
+      break;
+    }
+
+    next[num_next].addr = candidates[j].prefix->addr.v4;
+    next[num_next].prefix_len = candidates[j].prefix->prefix_len;
+    next[num_next].rule_id = rc;
+    num_next++, changed = 1;
+  }
+
+  free(candidates);
+
+  memcpy(offloaded, next, num_next * sizeof(*next));
+  ring->rdi.num_offloaded = num_next;
+  free(next);
+
+  if(changed && (rc = rdi_install_rules(ring->rdi.device_id)) < 0)
+    return(rc);
+
+  return(num_next);
+}
+
+/* ********************************* */
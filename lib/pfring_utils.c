@@ -21,10 +21,24 @@
 
 #include <linux/if.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define PFRING_X86
+#include <cpuid.h>
+#include <tmmintrin.h>
+#include <nmmintrin.h>
+/* Compiled for the instruction set whatever -march is, called only where the CPU has it */
+#define PFRING_TARGET(isa) __attribute__((target(isa)))
+#endif
+
 #ifdef ENABLE_HW_TIMESTAMP
 #include <linux/net_tstamp.h>
 #endif
 
+#ifdef ENABLE_BPF
+#include <pcap/pcap.h>
+#include <pcap/bpf.h>
+#endif
+
 /* ******************************* */
 
 int pfring_enable_hw_timestamp(pfring* ring, char *device_name, u_int8_t enable_rx, u_int8_t enable_tx) {
@@ -65,7 +79,7 @@ int pfring_enable_hw_timestamp(pfring* ring, char *device_name, u_int8_t enable_
 
 /* ******************************* */
 
-static u_int32_t pfring_hash_pkt(struct pfring_pkthdr *hdr) {
+static u_int32_t pfring_hash_pkt_sum(const struct pfring_pkthdr *hdr) {
   return  
     hdr->extended_hdr.parsed_pkt.vlan_id +
     hdr->extended_hdr.parsed_pkt.l3_proto +
@@ -83,6 +97,392 @@ static u_int32_t pfring_hash_pkt(struct pfring_pkthdr *hdr) {
 
 /* ******************************* */
 
+/*
+  Runtime CPU dispatch. The SIMD kernels of the library are built for each
+  instruction set they have a version for (PFRING_TARGET), next to the
+  scalar one, and the best one for the host is picked once: a binary built
+  for the oldest machines of a fleet still uses SSSE3/SSE4.2 where the CPU
+  has them. The per-ring kernels are copied into ring->simd by
+  pfring_open(). PF_RING_CPU_FEATURES=<mask> in the environment restricts
+  the features used, e.g. 0 to measure the scalar paths.
+*/
+
+static u_int32_t cpu_features;
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+static u_int32_t crc32c_sw(u_int32_t crc, const u_int8_t *buf, u_int len);
+static void parse_pkt_burst_scalar(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+				   u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash);
+#ifdef PFRING_X86
+static u_int32_t crc32c_sse42(u_int32_t crc, const u_int8_t *buf, u_int len);
+static void parse_pkt_burst_ssse3(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+				  u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash);
+#endif
+
+static u_int32_t (*crc32c)(u_int32_t crc, const u_int8_t *buf, u_int len) = crc32c_sw;
+static void (*parse_pkt_burst)(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+			       u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash) = parse_pkt_burst_scalar;
+
+static void detect_cpu_features(void) {
+#ifdef PFRING_X86
+  unsigned int eax, ebx, ecx, edx;
+  char *mask;
+
+  if(__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    if(ecx & (1 << 9))  cpu_features |= PF_RING_CPU_SSSE3;
+    if(ecx & (1 << 20)) cpu_features |= PF_RING_CPU_SSE42;
+
+    /* AVX: supported (bit 28) and its registers saved by the OS (OSXSAVE, bit 27, then XCR0) */
+    if((ecx & (1 << 27)) && (ecx & (1 << 28)) && (__get_cpuid_max(0, NULL) >= 7)) {
+      u_int32_t xcr0, xcr0_hi;
+
+      __asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+      if(((xcr0 & 0x06) == 0x06 /* XMM, YMM */) && (ebx & (1 << 5)))
+	cpu_features |= PF_RING_CPU_AVX2;
+      if(((xcr0 & 0xE6) == 0xE6 /* + opmask, ZMM */) && (ebx & (1 << 16) /* F */) && (ebx & (1 << 30) /* BW */))
+	cpu_features |= PF_RING_CPU_AVX512;
+    }
+  }
+
+  if((mask = getenv("PF_RING_CPU_FEATURES")) != NULL)
+    cpu_features &= strtoul(mask, NULL, 0);
+
+  if(cpu_features & PF_RING_CPU_SSE42) crc32c = crc32c_sse42;
+  if(cpu_features & PF_RING_CPU_SSSE3) parse_pkt_burst = parse_pkt_burst_ssse3;
+#endif
+}
+
+u_int32_t pfring_cpu_features(void) {
+  pthread_once(&simd_once, detect_cpu_features);
+  return(cpu_features);
+}
+
+void pfring_resolve_simd(pfring *ring) {
+  ring->simd.cpu_features = pfring_cpu_features();
+  ring->simd.parse_pkt_burst = parse_pkt_burst;
+}
+
+/* ******************************* */
+
+/*
+  Toeplitz and CRC32C packet hashes (see pkt_hash_type in pf_ring.h).
+  Toeplitz is table driven: the contribution of every byte value at every
+  input position is precomputed from the key (36 bytes of input at most,
+  two IPv6 addresses and the ports).
+*/
+
+#define TOEPLITZ_MAX_INPUT 36
+
+static pkt_hash_type pkt_hash = pkt_hash_sum;
+static u_int8_t  rss_key[RSS_KEY_LEN];
+static u_int32_t toeplitz_table[TOEPLITZ_MAX_INPUT][256];
+static u_int32_t crc32c_table[256];
+static pthread_once_t hash_tables_once = PTHREAD_ONCE_INIT;
+
+/* 32 bits of the key starting from bit 'first' (msb first) */
+static u_int32_t rss_key_window(u_int first) {
+  u_int32_t v = 0;
+  u_int k;
+
+  for(k = first; k < first + 32; k++)
+    v = (v << 1) | ((rss_key[k / 8] >> (7 - (k % 8))) & 1);
+
+  return(v);
+}
+
+static void build_toeplitz_table(void) {
+  u_int i, b, bit;
+
+  for(i = 0; i < TOEPLITZ_MAX_INPUT; i++)
+    for(b = 0; b < 256; b++) {
+      u_int32_t v = 0;
+
+      for(bit = 0; bit < 8; bit++)
+	if(b & (0x80 >> bit))
+	  v ^= rss_key_window(8 * i + bit);
+
+      toeplitz_table[i][b] = v;
+    }
+}
+
+static void init_hash_tables(void) {
+  u_int i;
+
+  for(i = 0; i < RSS_KEY_LEN; i += 2)
+    rss_key[i] = RSS_SYMMETRIC_KEY_WORD >> 8, rss_key[i + 1] = RSS_SYMMETRIC_KEY_WORD & 0xFF;
+
+  build_toeplitz_table();
+
+  for(i = 0; i < 256; i++) {
+    u_int32_t c = i, j;
+
+    for(j = 0; j < 8; j++)
+      c = (c >> 1) ^ ((c & 1) ? 0x82F63B78 /* reflected Castagnoli */ : 0);
+
+    crc32c_table[i] = c;
+  }
+
+  pfring_cpu_features(); /* crc32c */
+}
+
+/* ******************************* */
+
+/* Addresses and, for TCP/UDP, ports in network byte order: the RSS input */
+static u_int rss_input(const struct pfring_pkthdr *hdr, u_int8_t *in) {
+  const struct pkt_parsing_info *pp = &hdr->extended_hdr.parsed_pkt;
+  u_int len;
+
+  if(pp->ip_version == 6) {
+    memcpy(in, &pp->ip_src.v6, 16), memcpy(&in[16], &pp->ip_dst.v6, 16);
+    len = 32;
+  } else {
+    u_int32_t src = htonl(pp->ip_src.v4), dst = htonl(pp->ip_dst.v4);
+
+    memcpy(in, &src, 4), memcpy(&in[4], &dst, 4);
+    len = 8;
+  }
+
+  if((pp->l3_proto == IPPROTO_TCP) || (pp->l3_proto == IPPROTO_UDP)) {
+    u_int16_t sport = htons(pp->l4_src_port), dport = htons(pp->l4_dst_port);
+
+    memcpy(&in[len], &sport, 2), memcpy(&in[len + 2], &dport, 2);
+    len += 4;
+  }
+
+  return(len);
+}
+
+/* ******************************* */
+
+static u_int32_t toeplitz_hash(const struct pfring_pkthdr *hdr) {
+  u_int8_t in[TOEPLITZ_MAX_INPUT];
+  u_int32_t h = 0;
+  u_int i, len = rss_input(hdr, in);
+
+  for(i = 0; i < len; i++)
+    h ^= toeplitz_table[i][in[i]];
+
+  return(h);
+}
+
+/* ******************************* */
+
+static u_int32_t crc32c_sw(u_int32_t crc, const u_int8_t *buf, u_int len) {
+  for(; len > 0; buf++, len--)
+    crc = crc32c_table[(crc ^ *buf) & 0xFF] ^ (crc >> 8);
+
+  return(crc);
+}
+
+#ifdef PFRING_X86
+static PFRING_TARGET("sse4.2") u_int32_t crc32c_sse42(u_int32_t crc, const u_int8_t *buf, u_int len) {
+  for(; len >= 4; buf += 4, len -= 4) {
+    u_int32_t w;
+
+    memcpy(&w, buf, 4);
+    crc = _mm_crc32_u32(crc, w);
+  }
+
+  for(; len > 0; buf++, len--)
+    crc = _mm_crc32_u8(crc, *buf);
+
+  return(crc);
+}
+#endif
+
+/* <address, port> endpoints lowest first, then proto */
+static u_int32_t crc32c_hash(const struct pfring_pkthdr *hdr) {
+  u_int8_t in[TOEPLITZ_MAX_INPUT], buf[TOEPLITZ_MAX_INPUT + 1];
+  u_int len = rss_input(hdr, in), alen = (hdr->extended_hdr.parsed_pkt.ip_version == 6) ? 16 : 4;
+  u_int plen = (len > 2 * alen) ? 2 : 0, elen = alen + plen;
+
+  /* in = src, dst, sport, dport: rebuild as src|sport, dst|dport */
+  memcpy(buf, in, alen), memcpy(&buf[alen], &in[2 * alen], plen);
+  memcpy(&buf[elen], &in[alen], alen), memcpy(&buf[elen + alen], &in[2 * alen + plen], plen);
+
+  if(memcmp(buf, &buf[elen], elen) > 0) {
+    u_int8_t tmp[TOEPLITZ_MAX_INPUT / 2];
+
+    memcpy(tmp, buf, elen), memcpy(buf, &buf[elen], elen), memcpy(&buf[elen], tmp, elen);
+  }
+
+  buf[2 * elen] = hdr->extended_hdr.parsed_pkt.l3_proto;
+
+  return(~crc32c(~0U, buf, 2 * elen + 1));
+}
+
+/* ******************************* */
+
+u_int32_t pfring_compute_pkt_hash(const struct pfring_pkthdr *hdr, pkt_hash_type type) {
+  switch(type) {
+  case pkt_hash_toeplitz:
+    pthread_once(&hash_tables_once, init_hash_tables);
+    return(toeplitz_hash(hdr));
+  case pkt_hash_crc32c:
+    pthread_once(&hash_tables_once, init_hash_tables);
+    return(crc32c_hash(hdr));
+  case pkt_hash_sum:
+  default:
+    return(pfring_hash_pkt_sum(hdr));
+  }
+}
+
+/* ******************************* */
+
+void pfring_set_pkt_hash_type(pkt_hash_type type) {
+  pthread_once(&hash_tables_once, init_hash_tables);
+  pkt_hash = type;
+}
+
+/* ******************************* */
+
+int pfring_set_rss_key(const u_int8_t *key, u_int key_len) {
+  if((key == NULL) || (key_len != RSS_KEY_LEN))
+    return(PF_RING_ERROR_INVALID_ARGUMENT);
+
+  pthread_once(&hash_tables_once, init_hash_tables);
+  memcpy(rss_key, key, RSS_KEY_LEN);
+  build_toeplitz_table();
+  return(0);
+}
+
+/* ******************************* */
+
+/*
+  TSC clock. The frequency is measured once against CLOCK_REALTIME, then
+  each thread converts cycles from its own base, re-synced every
+  TSC_RESYNC_NS: the frequency is refined on the way (NTP steps are
+  ignored) and the thread never sees the time going back. Without an
+  invariant TSC (or on other architectures) it is CLOCK_REALTIME.
+*/
+
+#define TSC_CALIBRATION_NS  20000000   /* 20 msec */
+#define TSC_RESYNC_NS       1000000000 /* 1 sec */
+
+static u_int8_t  tsc_clock_usable = 0, tsc_clock_enabled = 1;
+static u_int64_t tsc_mult;          /* ns per cycle, 32.32 fixed point */
+static u_int64_t tsc_resync_cycles;
+static pthread_once_t tsc_clock_once = PTHREAD_ONCE_INIT;
+
+static __thread u_int64_t tsc_base, tsc_base_ns, tsc_thread_mult, tsc_last_ns;
+
+static inline u_int64_t realtime_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+static inline u_int64_t read_tsc(void) {
+  u_int32_t a, d;
+
+  asm volatile("rdtsc" : "=a" (a), "=d" (d));
+  return(((u_int64_t)d << 32) | a);
+}
+
+static int tsc_invariant(void) {
+  char line[4096];
+  int constant = 0, nonstop = 0;
+  FILE *fd = fopen("/proc/cpuinfo", "r");
+
+  if(fd == NULL)
+    return(0);
+
+  while(fgets(line, sizeof(line), fd) != NULL) {
+    if(strncmp(line, "flags", 5) == 0) {
+      constant = (strstr(line, " constant_tsc") != NULL), nonstop = (strstr(line, " nonstop_tsc") != NULL);
+      break;
+    }
+  }
+
+  fclose(fd);
+  return(constant && nonstop);
+}
+#else
+static inline u_int64_t read_tsc(void) { return(0); }
+static int tsc_invariant(void) { return(0); }
+#endif
+
+static void init_tsc_clock(void) {
+  u_int64_t ns, tsc, end_ns, end_tsc;
+
+  if(!tsc_invariant())
+    return;
+
+  ns = realtime_ns(), tsc = read_tsc();
+  do { end_ns = realtime_ns(), end_tsc = read_tsc(); } while((end_ns - ns) < TSC_CALIBRATION_NS);
+
+  if(end_tsc <= tsc)
+    return;
+
+  tsc_mult = ((end_ns - ns) << 32) / (end_tsc - tsc);
+  tsc_resync_cycles = ((u_int64_t)TSC_RESYNC_NS << 32) / tsc_mult;
+  tsc_clock_usable = (tsc_mult > 0) && (tsc_resync_cycles > 0);
+}
+
+/* ******************************* */
+
+void pfring_set_tsc_clock(u_int8_t enable) {
+  pthread_once(&tsc_clock_once, init_tsc_clock);
+  tsc_clock_enabled = enable;
+}
+
+/* ******************************* */
+
+u_int64_t pfring_gettime_ns(void) {
+  u_int64_t tsc, delta, ns;
+
+  pthread_once(&tsc_clock_once, init_tsc_clock);
+
+  if(!(tsc_clock_usable && tsc_clock_enabled))
+    return(realtime_ns());
+
+  tsc = read_tsc(), delta = tsc - tsc_base;
+
+  if((tsc_base == 0) || (delta >= tsc_resync_cycles)) {
+    ns = realtime_ns();
+
+    if(tsc_base == 0)
+      tsc_thread_mult = tsc_mult;
+    else if((delta < 2 * tsc_resync_cycles) && (ns > tsc_base_ns)) {
+      u_int64_t mult = ((ns - tsc_base_ns) << 32) / delta;
+
+      /* Within 0.1% of the calibration: not a clock step */
+      if((mult > tsc_mult - tsc_mult / 1000) && (mult < tsc_mult + tsc_mult / 1000))
+	tsc_thread_mult = mult;
+    }
+
+    tsc_base = tsc, tsc_base_ns = ns, delta = 0;
+  }
+
+  ns = tsc_base_ns + ((delta * tsc_thread_mult) >> 32);
+
+  if(ns < tsc_last_ns)
+    ns = tsc_last_ns; /* after a re-sync */
+
+  tsc_last_ns = ns;
+  return(ns);
+}
+
+/* ******************************* */
+
+void pfring_gettimeofday(struct timeval *tv) {
+  u_int64_t ns = pfring_gettime_ns();
+
+  tv->tv_sec = ns / 1000000000ULL, tv->tv_usec = (ns % 1000000000ULL) / 1000;
+}
+
+/* ******************************* */
+
+static inline u_int32_t pfring_hash_pkt(struct pfring_pkthdr *hdr) {
+  return(pfring_compute_pkt_hash(hdr, pkt_hash));
+}
+
+/* ******************************* */
+
 int pfring_parse_pkt(u_char *pkt, struct pfring_pkthdr *hdr, u_int8_t level /* 2..4 */, 
 		     u_int8_t add_timestamp /* 0,1 */, u_int8_t add_hash /* 0,1 */) {
   struct eth_hdr *eh = (struct eth_hdr*) pkt;
@@ -245,7 +645,7 @@ L4:
 TIMESTAMP:
 
   if(add_timestamp && hdr->ts.tv_sec == 0)
-    gettimeofday(&hdr->ts, NULL);
+    pfring_gettimeofday(&hdr->ts);
 
   if (add_hash && hdr->extended_hdr.pkt_hash == 0)
     hdr->extended_hdr.pkt_hash = pfring_hash_pkt(hdr);
@@ -255,6 +655,194 @@ TIMESTAMP:
 
 /* ******************************* */
 
+/*
+  Burst parser. The packets of a chunk are classified first with a few
+  loads each: Ethernet with at most one VLAN tag, IPv4 without options
+  and not a fragment, TCP or UDP (not on a GTP port) with the whole L4
+  header captured. Those are then decoded with a fixed layout where,
+  with SSSE3, one shuffle byte-swaps addresses, ports and TCP sequence
+  number. Anything else (IPv6 and its extension chains, IP options, GTP,
+  QinQ, short captures, already parsed headers) is left to
+  pfring_parse_pkt(), so the result is the same as calling it on each
+  packet.
+*/
+
+#define PARSE_BURST_CHUNK 16
+
+static inline u_int16_t fast_l3_offset(const u_char *pkt, const struct pfring_pkthdr *hdr) {
+  const u_char *ip, *l4;
+  u_int16_t eth_type, l3 = sizeof(struct eth_hdr), sport, dport;
+
+  if((hdr->extended_hdr.parsed_pkt.offset.l3_offset != 0)
+     || (hdr->caplen < sizeof(struct eth_hdr) + 20 + 8))
+    return(0);
+
+  eth_type = (pkt[12] << 8) | pkt[13];
+
+  if(eth_type == 0x8100 /* 802.1q (VLAN) */) {
+    eth_type = (pkt[16] << 8) | pkt[17];
+    l3 += sizeof(struct eth_vlan_hdr);
+  }
+
+  ip = &pkt[l3], l4 = &ip[20];
+
+  if((eth_type != 0x0800) || (ip[0] != 0x45 /* v4, no options */)
+     || (((ip[6] << 8) | ip[7]) & IP_OFFSET))
+    return(0);
+
+  if(ip[9] == IPPROTO_TCP)
+    return((hdr->caplen >= (u_int32_t)l3 + 20 + 20) ? l3 : 0);
+
+  if((ip[9] != IPPROTO_UDP) || (hdr->caplen < (u_int32_t)l3 + 20 + 8))
+    return(0);
+
+  sport = (l4[0] << 8) | l4[1], dport = (l4[2] << 8) | l4[3];
+  if((sport == GTP_SIGNALING_PORT) || (dport == GTP_SIGNALING_PORT)
+     || (sport == GTP_U_DATA_PORT) || (dport == GTP_U_DATA_PORT))
+    return(0);
+
+  return(l3);
+}
+
+/* ******************************* */
+
+/* w: saddr, daddr, sport|dport, tcp seq, in host order */
+static inline __attribute__((always_inline)) void fast_parse_fields(const u_char *pkt, struct pfring_pkthdr *hdr,
+								    u_int16_t l3, const u_int32_t w[4]) {
+  struct pkt_parsing_info *pp = &hdr->extended_hdr.parsed_pkt;
+  const u_char *ip = &pkt[l3], *l4 = &ip[20];
+
+  pp->eth_type = 0x0800;
+  pp->offset.eth_offset = 0;
+  if(l3 > sizeof(struct eth_hdr)) {
+    pp->offset.vlan_offset = sizeof(struct eth_hdr);
+    pp->vlan_id = ((pkt[14] << 8) | pkt[15]) & 0x0fff;
+  } else
+    pp->offset.vlan_offset = 0, pp->vlan_id = 0;
+  pp->offset.l3_offset = l3;
+
+  pp->ip_version = 4;
+  pp->ipv4_src = w[0], pp->ipv4_dst = w[1];
+  pp->l3_proto = ip[9], pp->ipv4_tos = ip[1];
+  pp->offset.l4_offset = l3 + 20;
+
+  pp->gtp.tunnel_id = NO_GTP_TUNNEL_ID;
+  pp->l4_src_port = w[2] & 0xFFFF, pp->l4_dst_port = w[2] >> 16;
+
+  if(pp->l3_proto == IPPROTO_TCP) {
+    pp->offset.payload_offset = pp->offset.l4_offset + ((l4[12] >> 4) * 4);
+    pp->tcp.seq_num = w[3];
+    pp->tcp.ack_num = ((u_int32_t)l4[8] << 24) | (l4[9] << 16) | (l4[10] << 8) | l4[11];
+    pp->tcp.flags = l4[13] & 0x3F; /* FIN..URG, same bits as the TH_*_MULTIPLIER */
+  } else
+    pp->offset.payload_offset = pp->offset.l4_offset + sizeof(struct udphdr);
+}
+
+static inline void fast_parse_pkt(const u_char *pkt, struct pfring_pkthdr *hdr, u_int16_t l3) {
+  const u_char *ip = &pkt[l3], *l4 = &ip[20];
+  u_int32_t w[4];
+
+  memcpy(w, &ip[12], sizeof(w));
+  w[0] = ntohl(w[0]), w[1] = ntohl(w[1]), w[3] = ntohl(w[3]);
+  w[2] = (((u_int32_t)((l4[2] << 8) | l4[3])) << 16) | ((l4[0] << 8) | l4[1]);
+  fast_parse_fields(pkt, hdr, l3, w);
+}
+
+#ifdef PFRING_X86
+/* One shuffle byte-swaps addresses, ports and TCP sequence number */
+static inline PFRING_TARGET("ssse3") void fast_parse_pkt_ssse3(const u_char *pkt, struct pfring_pkthdr *hdr, u_int16_t l3) {
+  const __m128i swap = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 9, 8, 11, 10, 15, 14, 13, 12);
+  const u_char *ip = &pkt[l3];
+  u_int32_t w[4];
+
+  /* ip[12..27] are within the capture: the UDP header ends at ip[28] */
+  _mm_storeu_si128((__m128i*)w, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&ip[12]), swap));
+  fast_parse_fields(pkt, hdr, l3, w);
+}
+#endif
+
+/* ******************************* */
+
+/* Instantiated per instruction set: ssse3 is a constant */
+static inline __attribute__((always_inline)) void parse_pkt_burst_body(u_char *pkts[], struct pfring_pkthdr hdrs[],
+								       u_int num_pkts, u_int8_t level,
+								       u_int8_t add_timestamp, u_int8_t add_hash,
+								       u_int8_t ssse3) {
+  u_int16_t l3[PARSE_BURST_CHUNK];
+  struct timeval now;
+  u_int base, i, n;
+
+  if(level < 4) {
+    for(i = 0; i < num_pkts; i++)
+      pfring_parse_pkt(pkts[i], &hdrs[i], level, add_timestamp, add_hash);
+    return;
+  }
+
+  now.tv_sec = 0;
+
+  for(base = 0; base < num_pkts; base += n) {
+    n = ((num_pkts - base) < PARSE_BURST_CHUNK) ? (num_pkts - base) : PARSE_BURST_CHUNK;
+
+    for(i = 0; i < n; i++)
+      l3[i] = fast_l3_offset(pkts[base + i], &hdrs[base + i]);
+
+    for(i = 0; i < n; i++) {
+      struct pfring_pkthdr *hdr = &hdrs[base + i];
+
+      if(l3[i] == 0) {
+	pfring_parse_pkt(pkts[base + i], hdr, level, add_timestamp, add_hash);
+	continue;
+      }
+
+#ifdef PFRING_X86
+      if(ssse3)
+	fast_parse_pkt_ssse3(pkts[base + i], hdr, l3[i]);
+      else
+#endif
+	fast_parse_pkt(pkts[base + i], hdr, l3[i]);
+
+      /* One clock read per burst */
+      if(add_timestamp && hdr->ts.tv_sec == 0) {
+	if(now.tv_sec == 0) pfring_gettimeofday(&now);
+	hdr->ts = now;
+      }
+
+      if(add_hash && hdr->extended_hdr.pkt_hash == 0)
+	hdr->extended_hdr.pkt_hash = pfring_hash_pkt(hdr);
+    }
+  }
+}
+
+static void parse_pkt_burst_scalar(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+				   u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash) {
+  parse_pkt_burst_body(pkts, hdrs, num_pkts, level, add_timestamp, add_hash, 0);
+}
+
+#ifdef PFRING_X86
+static PFRING_TARGET("ssse3") void parse_pkt_burst_ssse3(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+							  u_int8_t level, u_int8_t add_timestamp, u_int8_t add_hash) {
+  parse_pkt_burst_body(pkts, hdrs, num_pkts, level, add_timestamp, add_hash, 1);
+}
+#endif
+
+void pfring_parse_pkt_burst(u_char *pkts[], struct pfring_pkthdr hdrs[], u_int num_pkts,
+			    u_int8_t level /* 2..4 */, u_int8_t add_timestamp, u_int8_t add_hash) {
+  pfring_cpu_features();
+  parse_pkt_burst(pkts, hdrs, num_pkts, level, add_timestamp, add_hash);
+}
+
+/* ******************************* */
+
+struct pkt_parsing_info* pfring_lazy_parsed_pkt(u_char *pkt, struct pfring_pkthdr *hdr) {
+  /* pfring_parse_pkt() always sets eth_type */
+  if(hdr->extended_hdr.parsed_pkt.eth_type == 0)
+    pfring_parse_pkt(pkt, hdr, 4, 0, 1);
+
+  return(&hdr->extended_hdr.parsed_pkt);
+}
+
+/* ******************************* */
+
 static int pfring_promisc(const char *device, int set_promisc) {
   int sock_fd, ret = 0;
   struct ifreq ifr;
@@ -346,3 +934,77 @@ char* pfring_format_numbers(double val, char *buf, u_int buf_len, u_int8_t add_d
   return(buf);
 }
 
+
+/* ******************************* */
+
+/*
+  Userland BPF, for the modules whose packets never go through the kernel
+  filter (DNA, DAG): the program is compiled once (optimized) and run by
+  pfring_recv()/pfring_recv_burst() on what the module returns.
+*/
+int pfring_userspace_bpf_set(pfring *ring, char *filter_buffer) {
+#ifdef ENABLE_BPF
+  struct bpf_program *filter;
+
+  if((filter = calloc(1, sizeof(struct bpf_program))) == NULL)
+    return(-1);
+
+  if((pcap_compile_nopcap(ring->caplen, DLT_EN10MB, filter, filter_buffer, 1 /* optimize */, 0) == -1)
+     && (pcap_compile_nopcap(ring->caplen, DLT_EN10MB, filter, filter_buffer, 0, 0) == -1)) {
+    free(filter);
+    return(-1);
+  }
+
+  pfring_userspace_bpf_remove(ring);
+  ring->userspace_bpf = filter;
+  return(0);
+#else
+  return(PF_RING_ERROR_NOT_SUPPORTED);
+#endif
+}
+
+/* ******************************* */
+
+void pfring_userspace_bpf_remove(pfring *ring) {
+#ifdef ENABLE_BPF
+  if(ring->userspace_bpf != NULL) {
+    pcap_freecode((struct bpf_program*)ring->userspace_bpf);
+    free(ring->userspace_bpf);
+    ring->userspace_bpf = NULL;
+  }
+#endif
+}
+
+/* ******************************* */
+
+int pfring_userspace_bpf_match(pfring *ring, const u_char *pkt, u_int caplen, u_int len) {
+#ifdef ENABLE_BPF
+  return(bpf_filter(((struct bpf_program*)ring->userspace_bpf)->bf_insns, pkt, len, caplen) != 0);
+#else
+  return(1);
+#endif
+}
+
+/* ******************************* */
+
+/* The packets that pass are moved to the front (order kept): returns how many */
+u_int pfring_userspace_bpf_filter_burst(pfring *ring, u_char *buffers[], struct pfring_pkthdr hdrs[], u_int num_pkts) {
+#ifdef ENABLE_BPF
+  const struct bpf_insn *insns = ((struct bpf_program*)ring->userspace_bpf)->bf_insns;
+  u_int i, num = 0;
+
+  for(i = 0; i < num_pkts; i++) {
+    if(bpf_filter(insns, buffers[i], hdrs[i].len, hdrs[i].caplen) == 0)
+      continue;
+
+    if(num != i)
+      buffers[num] = buffers[i], hdrs[num] = hdrs[i];
+
+    num++;
+  }
+
+  return(num);
+#else
+  return(num_pkts);
+#endif
+}
@@ -465,6 +465,11 @@ pcap_compile(pcap_t *p, struct bpf_program *program,
 	program->bf_insns = icode_to_fcode(root, &len);
 	program->bf_len = len;
 
+#ifdef HAVE_PF_RING
+	if (p->ring != NULL)
+		pcap_save_pfring_filter(p, xbuf ? xbuf : "", program);
+#endif
+
 	lex_cleanup();
 	freechunks();
 	return (0);
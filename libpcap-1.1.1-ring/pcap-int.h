@@ -341,6 +341,15 @@ struct pcap {
 
 #ifdef HAVE_PF_RING
   pfring *ring;
+  struct ns_pcaphdr pfring_header; /* pcap_next_ex() on PF_RING handles */
+  /* Last pcap_compile() on the handle: its expression, to install it as PF_RING rules */
+  char *pfring_filter_expr;
+  struct bpf_program pfring_filter_prog;
+  /* PCAP_PF_RING_MULTICHANNEL: one ring per RX channel, ring is the first one */
+  u_int8_t pfring_num_channels;
+  pfring *pfring_channel_rings[MAX_NUM_RX_CHANNELS];
+  struct pcap *pfring_channels[MAX_NUM_RX_CHANNELS]; /* pcap_pfring_channel(), [0] unused */
+  struct pcap *pfring_parent;                         /* of a channel handle */
 #endif
 };
 
@@ -432,6 +441,10 @@ int	yylex(void);
 /* XXX should these be in pcap.h? */
 int	pcap_offline_read(pcap_t *, int, pcap_handler, u_char *);
 int	pcap_read(pcap_t *, int cnt, pcap_handler, u_char *);
+#ifdef HAVE_PF_RING
+int	pcap_next_ex_pfring(pcap_t *, struct pcap_pkthdr **, const u_char **);
+void	pcap_save_pfring_filter(pcap_t *, const char *, const struct bpf_program *);
+#endif
 
 #ifndef HAVE_STRLCPY
 #define strlcpy(x, y, z) \
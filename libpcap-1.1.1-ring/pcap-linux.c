@@ -999,8 +999,28 @@ static void	pcap_cleanup_linux( pcap_t *handle )
 
 #ifdef HAVE_PF_RING
 	if(handle->ring != NULL) {
+	  u_int8_t i;
+
+	  /* Channel handles: the rings and what is not shared with this handle */
+	  for(i = 1; i < handle->pfring_num_channels; i++) {
+	    pcap_t *channel = handle->pfring_channels[i];
+
+	    if(channel != NULL) {
+	      pcap_freecode(&channel->fcode);
+	      free(channel->buffer);
+	      free(channel);
+	    }
+
+	    pfring_close(handle->pfring_channel_rings[i]);
+	  }
+	  handle->pfring_num_channels = 0;
+
 	  pfring_close(handle->ring);
 	  handle->ring = NULL;
+	  free(handle->pfring_filter_expr);
+	  handle->pfring_filter_expr = NULL;
+	  free(handle->pfring_filter_prog.bf_insns);
+	  handle->pfring_filter_prog.bf_insns = NULL;
 	  return;
 	}
 #endif
@@ -1110,6 +1130,27 @@ static void	pcap_cleanup_linux( pcap_t *handle )
 	pcap_cleanup_live_common(handle);
 }
 
+#ifdef HAVE_PF_RING
+/* Settings of the environment applied to every ring of the handle */
+static void
+pfring_shim_setup_ring(pfring *ring)
+{
+	/* Code courtesy of Chris Wakelin <c.d.wakelin@reading.ac.uk> */
+	char *clusterId;
+
+	if((clusterId = getenv("PCAP_PF_RING_CLUSTER_ID")) != NULL
+	   && atoi(clusterId) > 0 && atoi(clusterId) < 255) {
+	  if(getenv("PCAP_PF_RING_USE_CLUSTER_PER_FLOW"))
+	    pfring_set_cluster(ring, atoi(clusterId), cluster_per_flow);
+	  else
+	    pfring_set_cluster(ring, atoi(clusterId), cluster_round_robin);
+	}
+
+	pfring_set_poll_watermark(ring, 1 /* watermark */);
+	ring->dna.dna_rx_sync_watermark = 0; /* trick (otherwise tshark wouldn't work with DNA) */
+}
+#endif
+
 /*
  *  Get a handle for a live capture from the given device. You can
  *  pass NULL as device to get all packages (without link level
@@ -1162,31 +1203,30 @@ pcap_activate_linux(pcap_t *handle)
 
 #ifdef HAVE_PF_RING
 	if(!getenv("PCAP_NO_PF_RING")) {
-	  /* Code courtesy of Chris Wakelin <c.d.wakelin@reading.ac.uk> */
-	  char *clusterId;
 	  int flags = 0;
-	  	  
+	  u_int8_t i;
+
 	  if(handle->opt.promisc) flags |= PF_RING_PROMISC;
-	  
-	  handle->ring = pfring_open((char*)device, handle->snapshot, flags);
 
-	  if(handle->ring) {
-	    if(clusterId = getenv("PCAP_PF_RING_CLUSTER_ID"))
-	      if(atoi(clusterId) > 0 && atoi(clusterId) < 255)
-		if(getenv("PCAP_PF_RING_USE_CLUSTER_PER_FLOW"))
-		  pfring_set_cluster(handle->ring, atoi(clusterId), cluster_per_flow);
-		else
-		  pfring_set_cluster(handle->ring, atoi(clusterId), cluster_round_robin);
-	    
-	    pfring_set_poll_watermark(handle->ring, 1 /* watermark */);
-	    handle->ring->dna.dna_rx_sync_watermark = 0; /* trick (otherwise tshark wouldn't work with DNA) */
+	  if(getenv("PCAP_PF_RING_MULTICHANNEL") && !strchr(device, '@')) {
+	    /* One ring per RX channel, see pcap_pfring_channel() */
+	    handle->pfring_num_channels = pfring_open_multichannel((char*)device, handle->snapshot,
+								   flags, handle->pfring_channel_rings);
+	    handle->ring = (handle->pfring_num_channels > 0) ? handle->pfring_channel_rings[0] : NULL;
 	  } else
-	    handle->ring = NULL;
+	    handle->ring = pfring_open((char*)device, handle->snapshot, flags);
+
+	  if(handle->ring) {
+	    pfring_shim_setup_ring(handle->ring);
+
+	    for(i = 1; i < handle->pfring_num_channels; i++)
+	      pfring_shim_setup_ring(handle->pfring_channel_rings[i]);
+	  }
 	} else
           handle->ring = NULL;
 
 	if(handle->ring != NULL) {
-	  handle->fd = handle->ring->fd;
+	  handle->fd = pfring_get_selectable_fd(handle->ring);
 	  handle->bufsize = handle->snapshot;
 	  handle->linktype = DLT_EN10MB;
 	  handle->offset = 2;
@@ -1314,6 +1354,157 @@ void pcap_set_appl_name_linux(pcap_t *handle, char *appl_name)
   if(handle->ring)
     pfring_set_application_name(handle->ring, appl_name);
 }
+
+/*
+ * Timestamps of the struct ns_pcaphdr handed to the callbacks: the nsec
+ * one of the NIC or of the kernel, else derived from ts. Packets without
+ * any get *now_ns, read from the TSC clock of the library once per call
+ * of the caller (0 = not read yet): no clock call per packet.
+ */
+static inline void
+pfring_pcap_set_ts(struct ns_pcaphdr *myhdr, const struct pfring_pkthdr *h, u_int64_t *now_ns)
+{
+	u_int64_t ns = h->extended_hdr.timestamp_ns;
+
+	if (h->ts.tv_sec != 0) {
+	  myhdr->ts.tv_sec = h->ts.tv_sec, myhdr->ts.tv_usec = h->ts.tv_usec;
+	  if (ns == 0)
+	    ns = (u_int64_t)h->ts.tv_sec * 1000000000 + (u_int64_t)h->ts.tv_usec * 1000;
+	} else {
+	  if (ns == 0) {
+	    if (*now_ns == 0) *now_ns = pfring_gettime_ns();
+	    ns = *now_ns;
+	  }
+	  myhdr->ts.tv_sec = ns / 1000000000, myhdr->ts.tv_usec = (ns % 1000000000) / 1000;
+	}
+
+	myhdr->ns = ns;
+}
+
+#define PFRING_PCAP_BURST MAX_BURST_LEN /* packets per ring visit when max_packets <= 0 */
+
+/*
+ * PF_RING handles: up to max_packets are drained per call with
+ * pfring_recv_burst() and handed to the callback in a tight loop. Only
+ * the first burst may wait; the packets are read in place and stay valid
+ * until the next receive, i.e. while the callback runs. The time of day
+ * is taken once per burst for the packets without a timestamp.
+ */
+static int
+pcap_read_pfring(pcap_t *handle, int max_packets, pcap_handler callback, u_char *userdata)
+{
+	u_char *packets[PFRING_PCAP_BURST];
+	struct pfring_pkthdr hdrs[PFRING_PCAP_BURST];
+	struct ns_pcaphdr myhdr;
+	u_int64_t now_ns;
+	int wait_for_incoming_packet = handle->md.timeout < 0 ? 0 : 1;
+	int todo = (max_packets > 0) ? max_packets : PFRING_PCAP_BURST;
+	int done = 0, delivered = 0, ret, i;
+
+	if(!handle->ring->enabled) pfring_enable_ring(handle->ring);
+
+	while (done < todo) {
+	  if (handle->break_loop) {
+	    handle->break_loop = 0;
+	    return -2;
+	  }
+
+	  ret = pfring_recv_burst(handle->ring, packets, hdrs,
+				  min(todo - done, PFRING_PCAP_BURST),
+				  (done == 0) ? wait_for_incoming_packet : 0);
+
+	  if (ret == PF_RING_ERROR_INVALID_ARGUMENT) /* no zero copy (reentrant ring) */
+	    return (done > 0) ? delivered : pcap_read_packet(handle, callback, userdata);
+
+	  if (ret == 0) {
+	    if (done > 0 || !wait_for_incoming_packet)
+	      break; /* ring drained */
+	    continue;
+	  } else if (ret < 0) {
+	    if (errno == EINTR || errno == ENETDOWN)
+	      continue;
+	    return (done > 0) ? delivered : -1;
+	  }
+
+	  now_ns = 0;
+
+	  for (i = 0; i < ret; i++) {
+	    struct pfring_pkthdr *h = &hdrs[i];
+	    u_int32_t caplen = min(h->caplen, handle->bufsize);
+
+	    /* Run the packet filter if not using kernel filter */
+	    if (!handle->md.use_bpf && handle->fcode.bf_insns
+		&& bpf_filter(handle->fcode.bf_insns, packets[i], h->len, caplen) == 0)
+	      continue;
+
+	    pfring_pcap_set_ts(&myhdr, h, &now_ns);
+	    myhdr.caplen = caplen, myhdr.len = h->len;
+
+	    handle->md.packets_read++;
+	    callback(userdata, (struct pcap_pkthdr*)&myhdr, packets[i]);
+	    delivered++;
+	  }
+
+	  done += ret;
+	}
+
+	return delivered;
+}
+
+/*
+ * pcap_next_ex() on PF_RING handles: one zero copy pfring_recv() and the
+ * header converted in place in the handle, without going through the
+ * one-shot callback. The header carries the nsec timestamp (struct
+ * ns_pcaphdr); header and packet stay valid until the next call.
+ */
+int
+pcap_next_ex_pfring(pcap_t *handle, struct pcap_pkthdr **pkt_header, const u_char **pkt_data)
+{
+	struct ns_pcaphdr *myhdr = &handle->pfring_header;
+	struct pfring_pkthdr h;
+	u_int64_t now_ns = 0;
+	u_char *packet;
+	int wait_for_incoming_packet = handle->md.timeout < 0 ? 0 : 1;
+	u_int32_t caplen;
+	int ret;
+
+	if(!handle->ring->enabled) pfring_enable_ring(handle->ring);
+
+	while (1) {
+	  if (handle->break_loop) {
+	    handle->break_loop = 0;
+	    return -2;
+	  }
+
+	  h.ts.tv_sec = 0;
+	  ret = pfring_recv(handle->ring, &packet, 0, &h, wait_for_incoming_packet);
+
+	  if (ret == 0) {
+	    if (!wait_for_incoming_packet)
+	      return 0; /* non-blocking */
+	    continue;
+	  } else if (ret < 0) {
+	    if (errno == EINTR || errno == ENETDOWN)
+	      continue;
+	    return -1;
+	  }
+
+	  caplen = min(h.caplen, handle->bufsize);
+
+	  /* Run the packet filter if not using kernel filter */
+	  if (!handle->md.use_bpf && handle->fcode.bf_insns
+	      && bpf_filter(handle->fcode.bf_insns, packet, h.len, caplen) == 0)
+	    continue;
+
+	  pfring_pcap_set_ts(myhdr, &h, &now_ns);
+	  myhdr->caplen = caplen, myhdr->len = h.len;
+
+	  handle->md.packets_read++;
+	  *pkt_header = (struct pcap_pkthdr*)myhdr;
+	  *pkt_data = packet;
+	  return 1;
+	}
+}
 #endif
 
 /*
@@ -1324,6 +1515,11 @@ void pcap_set_appl_name_linux(pcap_t *handle, char *appl_name)
 static int
 pcap_read_linux(pcap_t *handle, int max_packets, pcap_handler callback, u_char *user)
 {
+#ifdef HAVE_PF_RING
+	if(handle->ring)
+	  return pcap_read_pfring(handle, max_packets, callback, user);
+#endif
+
 	/*
 	 * Currently, on Linux only one packet is delivered per read,
 	 * so we don't loop.
@@ -1405,7 +1601,6 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	      bp = packet;
 	      pcap_header.caplen = min(pcap_header.caplen, handle->bufsize);
 	      caplen = pcap_header.caplen, packet_len = pcap_header.len;
-	      if(pcap_header.ts.tv_sec == 0) gettimeofday((struct timeval*)&pcap_header.ts, NULL);
 	      break;
 
 	    } else {
@@ -1736,16 +1931,16 @@ pcap_read_packet(pcap_t *handle, pcap_handler callback, u_char *userdata)
 	/* Call the user supplied callback function */
 #if defined(HAVE_PF_RING)
 	{
-	  struct myts {
-	    struct timeval ts;
-	    u_int32_t caplen, len;
-	    u_int64_t ns;
-	  };
-	  struct myts myhdr;
-
-	  myhdr.ts.tv_sec = pcap_header.ts.tv_sec, myhdr.ts.tv_usec = pcap_header.ts.tv_usec;
+	  struct ns_pcaphdr myhdr;
+	  u_int64_t now_ns = 0;
+
+	  if (handle->ring != NULL)
+	    pfring_pcap_set_ts(&myhdr, &pcap_header, &now_ns);
+	  else {
+	    myhdr.ts.tv_sec = pcap_header.ts.tv_sec, myhdr.ts.tv_usec = pcap_header.ts.tv_usec;
+	    myhdr.ns = (u_int64_t)pcap_header.ts.tv_sec * 1000000000 + (u_int64_t)pcap_header.ts.tv_usec * 1000;
+	  }
 	  myhdr.caplen = pcap_header.caplen, myhdr.len = pcap_header.len;
-	  myhdr.ns = pcap_header.extended_hdr.timestamp_ns;
 
 	  callback(userdata, (struct pcap_pkthdr*)&myhdr, bp);
 	}
@@ -2300,6 +2495,43 @@ pcap_platform_finddevs(pcap_if_t **alldevsp, char *errbuf)
 	return (0);
 }
 
+#ifdef HAVE_PF_RING
+/*
+ * Called by pcap_compile() on PF_RING handles: the expression and a copy
+ * of the program, so that pcap_setfilter() can tell whether it is given
+ * that program.
+ */
+void
+pcap_save_pfring_filter(pcap_t *handle, const char *expr, const struct bpf_program *program)
+{
+	size_t len = program->bf_len * sizeof(struct bpf_insn);
+
+	free(handle->pfring_filter_expr);
+	free(handle->pfring_filter_prog.bf_insns);
+	handle->pfring_filter_prog.bf_len = 0;
+
+	handle->pfring_filter_expr = strdup(expr);
+	if ((handle->pfring_filter_prog.bf_insns = malloc(len)) != NULL) {
+		memcpy(handle->pfring_filter_prog.bf_insns, program->bf_insns, len);
+		handle->pfring_filter_prog.bf_len = program->bf_len;
+	}
+}
+
+/* The expression filter was compiled from, NULL if unknown */
+static const char *
+pfring_filter_expression(pcap_t *handle, const struct bpf_program *filter)
+{
+	if (handle->pfring_filter_expr == NULL
+	    || handle->pfring_filter_prog.bf_insns == NULL
+	    || filter->bf_len != handle->pfring_filter_prog.bf_len
+	    || memcmp(filter->bf_insns, handle->pfring_filter_prog.bf_insns,
+		      filter->bf_len * sizeof(struct bpf_insn)) != 0)
+		return NULL;
+
+	return handle->pfring_filter_expr;
+}
+#endif
+
 /*
  *  Attach the given BPF code to the packet capture device.
  */
@@ -2333,6 +2565,26 @@ pcap_setfilter_linux_common(pcap_t *handle, struct bpf_program *filter,
 	 */
 	handle->md.use_bpf = 0;
 
+#ifdef HAVE_PF_RING
+	/*
+	 * The expression of a program compiled on this handle goes to
+	 * pfring_set_native_filter(): simple host/port/proto expressions
+	 * become filtering rules (no BPF run per packet), the others a
+	 * kernel BPF filter. Either way rejected packets never reach the
+	 * ring. DNA bypasses the kernel: filter in userland.
+	 */
+	if (handle->ring != NULL && strncmp(handle->md.device, "dna", 3)) {
+		const char *expr = pfring_filter_expression(handle->pfring_parent ?
+							    handle->pfring_parent : handle, filter);
+
+		if (expr != NULL
+		    && pfring_set_native_filter(handle->ring, (char *)expr) >= 0) {
+			handle->md.use_bpf = 1;
+			return 0;
+		}
+	}
+#endif
+
 	/* Install kernel level filter if possible */
 
 #ifdef SO_ATTACH_FILTER
@@ -2449,6 +2701,16 @@ pcap_setfilter_linux_common(pcap_t *handle, struct bpf_program *filter,
 static int
 pcap_setfilter_linux(pcap_t *handle, struct bpf_program *filter)
 {
+#ifdef HAVE_PF_RING
+	u_int8_t i;
+
+	/* Channel handles share the filter of the handle they come from */
+	for(i = 1; i < handle->pfring_num_channels; i++)
+		if (handle->pfring_channels[i] != NULL
+		    && pcap_setfilter_linux_common(handle->pfring_channels[i], filter, 0) != 0)
+			return -1;
+#endif
+
 	return pcap_setfilter_linux_common(handle, filter, 0);
 }
 
@@ -2463,6 +2725,7 @@ pcap_setdirection_linux(pcap_t *handle, pcap_direction_t d)
 #ifdef HAVE_PF_RING
 	if(handle->ring != NULL) {
 	  packet_direction direction; 
+	  u_int8_t i;
 
 	  switch(d) {
 	  case PCAP_D_INOUT: direction = rx_and_tx_direction; break;
@@ -2471,6 +2734,8 @@ pcap_setdirection_linux(pcap_t *handle, pcap_direction_t d)
 	  }
 
 	  pfring_set_direction(handle->ring, direction);
+	  for(i = 1; i < handle->pfring_num_channels; i++)
+	    pfring_set_direction(handle->pfring_channel_rings[i], direction);
 	  return(0);
 	}
 #endif
@@ -3740,15 +4005,12 @@ pcap_read_linux_mmap(pcap_t *handle, int max_packets, pcap_handler callback,
 		  
 		  myhdr.caplen = pcaphdr.caplen, myhdr.len = pcaphdr.len;
 
-		  if(handle->ring != NULL) {
-		    myhdr.ns = 0;
-		  } else {
 #if defined(HAVE_TPACKET2)
+		  if (handle->md.tp_version == TPACKET_V2)
 		    myhdr.ns = ((u_int64_t)h.h2->tp_sec * 1000000000) + h.h2->tp_nsec;
-#else
-		    myhdr.ns = 0;
+		  else
 #endif
-		  }
+		    myhdr.ns = ((u_int64_t)pcaphdr.ts.tv_sec * 1000000000) + (u_int64_t)pcaphdr.ts.tv_usec * 1000;
 
 		  callback(user, (struct pcap_pkthdr*)&myhdr, bp);
 		}
@@ -5105,7 +5367,7 @@ reset_kernel_filter(pcap_t *handle)
 
 #ifdef HAVE_PF_RING
 	if(handle->ring != NULL)
-	  return(-1);
+	  return(pfring_remove_bpf_filter(handle->ring)); /* or the native filter rules */
 #endif
 
 	return setsockopt(handle->fd, SOL_SOCKET, SO_DETACH_FILTER,
@@ -5132,4 +5394,67 @@ int pcap_set_master(pcap_t *handle, pcap_t *master) {
 int pcap_set_application_name(pcap_t *handle, char *name) {
     return(pfring_set_application_name(handle->ring, name));
 }
+
+int pcap_pfring_num_channels(pcap_t *handle) {
+  if(handle->ring == NULL)
+    return(0);
+
+  return((handle->pfring_num_channels > 0) ? handle->pfring_num_channels : 1);
+}
+
+/*
+ * Handle of an RX channel of a PCAP_PF_RING_MULTICHANNEL handle (channel
+ * 0 is the handle itself). Created on the first call, with the filter of
+ * the handle; later pcap_setfilter()/pcap_setdirection() calls on the
+ * handle apply to all the channels. Owned by the handle: freed by its
+ * pcap_close(), never pcap_close() it directly.
+ */
+pcap_t *pcap_pfring_channel(pcap_t *handle, u_int8_t channel_id) {
+  pcap_t *channel;
+
+  if(handle->ring == NULL || handle->pfring_parent != NULL)
+    return(NULL);
+
+  if(channel_id == 0)
+    return(handle);
+
+  if(channel_id >= handle->pfring_num_channels)
+    return(NULL);
+
+  if(handle->pfring_channels[channel_id] != NULL)
+    return(handle->pfring_channels[channel_id]);
+
+  if((channel = malloc(sizeof(*channel))) == NULL)
+    return(NULL);
+
+  /* Same settings and methods, its own ring, buffer and filter */
+  memcpy(channel, handle, sizeof(*channel));
+  channel->ring = handle->pfring_channel_rings[channel_id];
+  channel->fd = channel->selectable_fd = pfring_get_selectable_fd(channel->ring);
+  channel->break_loop = 0;
+  memset(&channel->md.stat, 0, sizeof(channel->md.stat));
+  channel->md.packets_read = 0;
+  channel->fcode.bf_len = 0, channel->fcode.bf_insns = NULL;
+  channel->pfring_filter_expr = NULL;
+  channel->pfring_filter_prog.bf_len = 0, channel->pfring_filter_prog.bf_insns = NULL;
+  channel->pfring_num_channels = 0;
+  memset(channel->pfring_channels, 0, sizeof(channel->pfring_channels));
+  memset(channel->pfring_channel_rings, 0, sizeof(channel->pfring_channel_rings));
+  channel->pfring_parent = handle;
+
+  if((channel->buffer = malloc(handle->bufsize + handle->offset)) == NULL) {
+    free(channel);
+    return(NULL);
+  }
+
+  if(handle->fcode.bf_insns != NULL
+     && pcap_setfilter_linux_common(channel, &handle->fcode, 0) != 0) {
+    free(channel->buffer);
+    free(channel);
+    return(NULL);
+  }
+
+  handle->pfring_channels[channel_id] = channel;
+  return(channel);
+}
 #endif
@@ -169,6 +169,12 @@ pcap_next_ex(pcap_t *p, struct pcap_pkthdr **pkt_header,
 			return (status);
 	}
 
+#ifdef HAVE_PF_RING
+	/* Zero copy, without the one-shot callback */
+	if (p->ring && !p->ring->reentrant)
+		return (pcap_next_ex_pfring(p, pkt_header, pkt_data));
+#endif
+
 	/*
 	 * Return codes for pcap_read() are:
 	 *   -  0: timeout
@@ -367,6 +367,16 @@ void	bpf_dump(const struct bpf_program *, int);
 
 #ifdef HAVE_PF_RING
 u_int32_t pcap_get_pfring_id(pcap_t *handle);
+/*
+ * With PCAP_PF_RING_MULTICHANNEL=1 in the environment a handle opens all
+ * the RX channels of the device: one worker thread per channel can then
+ * run pcap_loop() on pcap_pfring_channel(handle, id). Get the channel
+ * handles before starting the workers.
+ */
+int pcap_pfring_num_channels(pcap_t *handle);
+pcap_t *pcap_pfring_channel(pcap_t *handle, u_int8_t channel_id);
+pcap_dumper_t *pcap_dump_open_ns(pcap_t *, const char *);
+void	pcap_dump_ns(u_char *, const struct pcap_pkthdr *, const u_char *);
 int pcap_set_master_id(pcap_t *handle, u_int32_t master_id);
 int pcap_set_master(pcap_t *handle, pcap_t *master);
 #endif
@@ -137,13 +137,21 @@ pcap_check_header(pcap_t *p, bpf_u_int32 magic, FILE *fp, char *errbuf)
 	 * number for a pcap savefile, or for a byte-swapped pcap
 	 * savefile.
 	 */
-	if (magic != TCPDUMP_MAGIC && magic != KUZNETZOV_TCPDUMP_MAGIC) {
+	if (magic != TCPDUMP_MAGIC && magic != KUZNETZOV_TCPDUMP_MAGIC
+	    && magic != NSEC_TCPDUMP_MAGIC) {
 		magic = SWAPLONG(magic);
-		if (magic != TCPDUMP_MAGIC && magic != KUZNETZOV_TCPDUMP_MAGIC)
+		if (magic != TCPDUMP_MAGIC && magic != KUZNETZOV_TCPDUMP_MAGIC
+		    && magic != NSEC_TCPDUMP_MAGIC)
 			return (0);	/* nope */
 		p->sf.swapped = 1;
 	}
 
+	/*
+	 * Nanosecond files: the timestamps are scaled down to
+	 * microseconds as the packets are read.
+	 */
+	p->sf.tsresol = (magic == NSEC_TCPDUMP_MAGIC) ? 1000000000 : 1000000;
+
 	/*
 	 * They are.  Put the magic number in the header, and read
 	 * the rest of the header.
@@ -334,6 +342,8 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 		hdr->ts.tv_sec = sf_hdr.ts.tv_sec;
 		hdr->ts.tv_usec = sf_hdr.ts.tv_usec;
 	}
+	if (p->sf.tsresol == 1000000000)
+		hdr->ts.tv_usec /= 1000;
 	/* Swap the caplen and len fields, if necessary. */
 	switch (p->sf.lengths_swapped) {
 
@@ -448,11 +458,11 @@ pcap_next_packet(pcap_t *p, struct pcap_pkthdr *hdr, u_char **data)
 }
 
 static int
-sf_write_header(FILE *fp, int linktype, int thiszone, int snaplen)
+sf_write_header(FILE *fp, bpf_u_int32 magic, int linktype, int thiszone, int snaplen)
 {
 	struct pcap_file_header hdr;
 
-	hdr.magic = TCPDUMP_MAGIC;
+	hdr.magic = magic;
 	hdr.version_major = PCAP_VERSION_MAJOR;
 	hdr.version_minor = PCAP_VERSION_MINOR;
 
@@ -486,8 +496,36 @@ pcap_dump(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
 	(void)fwrite(sp, h->caplen, 1, f);
 }
 
+#ifdef HAVE_PF_RING
+/*
+ * Output a packet to a dump file opened with pcap_dump_open_ns(): h is
+ * the struct ns_pcaphdr handed to the callbacks of PF_RING handles.
+ */
+void
+pcap_dump_ns(u_char *user, const struct pcap_pkthdr *h, const u_char *sp)
+{
+	const struct ns_pcaphdr *nh = (const struct ns_pcaphdr *)h;
+	register FILE *f;
+	struct pcap_sf_pkthdr sf_hdr;
+
+	f = (FILE *)user;
+	if (nh->ns != 0) {
+		sf_hdr.ts.tv_sec  = nh->ns / 1000000000;
+		sf_hdr.ts.tv_usec = nh->ns % 1000000000;
+	} else {
+		sf_hdr.ts.tv_sec  = h->ts.tv_sec;
+		sf_hdr.ts.tv_usec = h->ts.tv_usec * 1000;
+	}
+	sf_hdr.caplen     = h->caplen;
+	sf_hdr.len        = h->len;
+	/* XXX we should check the return status */
+	(void)fwrite(&sf_hdr, sizeof(sf_hdr), 1, f);
+	(void)fwrite(sp, h->caplen, 1, f);
+}
+#endif
+
 static pcap_dumper_t *
-pcap_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname)
+pcap_setup_dump(pcap_t *p, bpf_u_int32 magic, int linktype, FILE *f, const char *fname)
 {
 
 #if defined(WIN32) || defined(MSDOS)
@@ -503,7 +541,7 @@ pcap_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname)
 	else
 		setbuf(f, NULL);
 #endif
-	if (sf_write_header(f, linktype, p->tzoff, p->snapshot) == -1) {
+	if (sf_write_header(f, magic, linktype, p->tzoff, p->snapshot) == -1) {
 		snprintf(p->errbuf, PCAP_ERRBUF_SIZE, "Can't write to %s: %s",
 		    fname, pcap_strerror(errno));
 		if (f != stdout)
@@ -516,8 +554,8 @@ pcap_setup_dump(pcap_t *p, int linktype, FILE *f, const char *fname)
 /*
  * Initialize so that sf_write() will output to the file named 'fname'.
  */
-pcap_dumper_t *
-pcap_dump_open(pcap_t *p, const char *fname)
+static pcap_dumper_t *
+pcap_dump_open_magic(pcap_t *p, const char *fname, bpf_u_int32 magic)
 {
 	FILE *f;
 	int linktype;
@@ -556,9 +594,24 @@ pcap_dump_open(pcap_t *p, const char *fname)
 			return (NULL);
 		}
 	}
-	return (pcap_setup_dump(p, linktype, f, fname));
+	return (pcap_setup_dump(p, magic, linktype, f, fname));
 }
 
+pcap_dumper_t *
+pcap_dump_open(pcap_t *p, const char *fname)
+{
+	return (pcap_dump_open_magic(p, fname, TCPDUMP_MAGIC));
+}
+
+#ifdef HAVE_PF_RING
+/* Nanosecond timestamps (NSEC_TCPDUMP_MAGIC): write with pcap_dump_ns() */
+pcap_dumper_t *
+pcap_dump_open_ns(pcap_t *p, const char *fname)
+{
+	return (pcap_dump_open_magic(p, fname, NSEC_TCPDUMP_MAGIC));
+}
+#endif
+
 /*
  * Initialize so that sf_write() will output to the given stream.
  */
@@ -576,7 +629,7 @@ pcap_dump_fopen(pcap_t *p, FILE *f)
 	}
 	linktype |= p->linktype_ext;
 
-	return (pcap_setup_dump(p, linktype, f, "stream"));
+	return (pcap_setup_dump(p, TCPDUMP_MAGIC, linktype, f, "stream"));
 }
 
 FILE *
@@ -0,0 +1,243 @@
+/*
+ *
+ * CPU placement of the pfcount_multichannel threads
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sched.h>
+
+#include "affinity.h"
+
+/* *************************************** */
+
+/* "0,2,4-7" */
+int affinity_parse_list(const char *list, int *cores, u_int max) {
+  u_int num = 0;
+  const char *p = list;
+
+  while(*p != '\0') {
+    char *end;
+    long first = strtol(p, &end, 10), last;
+
+    if((end == p) || (first < 0)) return(-1);
+    last = first;
+
+    if(*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if((end == p) || (last < first)) return(-1);
+    }
+
+    for(; (first <= last) && (num < max); first++)
+      cores[num++] = first;
+
+    p = end;
+    if(*p == ',') p++;
+    else if((*p != '\0') && !isspace(*p)) return(-1);
+    else break;
+  }
+
+  return(num);
+}
+
+/* *************************************** */
+
+static int read_line(const char *path, char *buf, u_int len) {
+  FILE *f = fopen(path, "r");
+  int rc = -1;
+
+  if(f == NULL) return(-1);
+
+  if(fgets(buf, len, f) != NULL) {
+    buf[strcspn(buf, "\n")] = '\0';
+    rc = 0;
+  }
+
+  fclose(f);
+  return(rc);
+}
+
+/* *************************************** */
+
+/* Without the "@<queue>" suffix of the PF_RING device name */
+static void base_device(const char *device, char *buf, u_int len) {
+  snprintf(buf, len, "%s", device);
+  buf[strcspn(buf, "@")] = '\0';
+}
+
+/* *************************************** */
+
+int affinity_numa_node(const char *device) {
+  char dev[64], path[256], buf[32];
+
+  base_device(device, dev, sizeof(dev));
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", dev);
+
+  if(read_line(path, buf, sizeof(buf)) != 0)
+    return(-1);
+
+  return(atoi(buf)); /* -1 as well on non NUMA systems */
+}
+
+/* *************************************** */
+
+/* Lowest CPU of a /proc/irq/<n>/smp_affinity mask, -1 unless exactly one is set */
+static int parse_irq_mask(const char *mask) {
+  int cpu = -1, num_set = 0, base = 0;
+  const char *p = mask + strlen(mask);
+
+  /* Comma separated groups of 32 bit, most significant first */
+  while(p > mask) {
+    const char *start = p;
+    u_int32_t v;
+    int bit;
+
+    while((start > mask) && (start[-1] != ',')) start--;
+    v = strtoul(start, NULL, 16);
+
+    for(bit = 0; bit < 32; bit++)
+      if(v & (1U << bit)) {
+	if(cpu == -1) cpu = base + bit;
+	num_set++;
+      }
+
+    base += 32;
+    p = (start > mask) ? start - 1 : mask;
+  }
+
+  /* Spread over several CPUs (e.g. no irqbalance): not a placement hint */
+  return((num_set == 1) ? cpu : -1);
+}
+
+/* *************************************** */
+
+int affinity_queue_core(const char *device, u_int queue) {
+  char dev[64], names[2][96], line[4096], path[64], mask[512];
+  int core = -1;
+  FILE *f;
+
+  base_device(device, dev, sizeof(dev));
+  snprintf(names[0], sizeof(names[0]), "%s-TxRx-%u", dev, queue); /* ixgbe, igb */
+  snprintf(names[1], sizeof(names[1]), "%s-rx-%u", dev, queue);   /* e1000e, split vectors */
+
+  if((f = fopen("/proc/interrupts", "r")) == NULL)
+    return(-1);
+
+  while(fgets(line, sizeof(line), f) != NULL) {
+    char *name, *end;
+    long irq = strtol(line, &end, 10);
+
+    if((end == line) || (*end != ':')) continue;
+
+    line[strcspn(line, "\n")] = '\0';
+    name = strrchr(line, ' ');
+    name = name ? name + 1 : line;
+
+    if(strcmp(name, names[0]) && strcmp(name, names[1])) continue;
+
+    snprintf(path, sizeof(path), "/proc/irq/%ld/smp_affinity", irq);
+    if(read_line(path, mask, sizeof(mask)) == 0)
+      core = parse_irq_mask(mask);
+    break;
+  }
+
+  fclose(f);
+  return(core);
+}
+
+/* *************************************** */
+
+/* Online CPUs of 'node' (-1 = all), skipping the hyperthread siblings */
+int affinity_node_cores(int node, int *cores, u_int max) {
+  static int cpus[AFFINITY_MAX_CPUS];
+  char path[128], buf[1024];
+  int num_cpus, num = 0, i;
+
+  if(node >= 0)
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  else
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/online");
+
+  if((read_line(path, buf, sizeof(buf)) != 0)
+     || ((num_cpus = affinity_parse_list(buf, cpus, AFFINITY_MAX_CPUS)) <= 0))
+    return(-1);
+
+  for(i = 0; (i < num_cpus) && ((u_int)num < max); i++) {
+    int siblings[8];
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpus[i]);
+    if((read_line(path, buf, sizeof(buf)) == 0)
+       && (affinity_parse_list(buf, siblings, 8) > 0)
+       && (siblings[0] != cpus[i]))
+      continue; /* not the first thread of its core */
+
+    cores[num++] = cpus[i];
+  }
+
+  return(num);
+}
+
+/* *************************************** */
+
+/*
+  One core per queue: the one servicing its RX IRQ when it is pinned,
+  otherwise the next unused core of the NIC node.
+  Returns the number of queues placed on their IRQ core.
+*/
+int affinity_plan(const char *device, u_int num_queues, int *cores) {
+  static int pool[AFFINITY_MAX_CPUS];
+  int num_pool, found = 0, next = 0;
+  u_int q, j;
+
+  if((num_pool = affinity_node_cores(affinity_numa_node(device), pool, AFFINITY_MAX_CPUS)) <= 0)
+    num_pool = affinity_node_cores(-1, pool, AFFINITY_MAX_CPUS);
+
+  for(q = 0; q < num_queues; q++)
+    if((cores[q] = affinity_queue_core(device, q)) >= 0)
+      found++;
+
+  for(q = 0; q < num_queues; q++) {
+    int tries;
+
+    if(cores[q] >= 0) continue;
+
+    if(num_pool <= 0) {
+      cores[q] = q; /* no topology information at all */
+      continue;
+    }
+
+    /* Prefer a core that no other queue uses, wrap around otherwise */
+    for(tries = 0; tries < num_pool; tries++, next++) {
+      int candidate = pool[next % num_pool], used = 0;
+
+      for(j = 0; j < num_queues; j++)
+	if(cores[j] == candidate) used = 1;
+
+      if(!used) break;
+    }
+
+    cores[q] = pool[next++ % num_pool];
+  }
+
+  return(found);
+}
+
+/* *************************************** */
+
+int affinity_bind(pthread_t thread, int core) {
+  cpu_set_t cpuset;
+
+  CPU_ZERO(&cpuset);
+  CPU_SET(core, &cpuset);
+  return(pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset));
+}
@@ -0,0 +1,34 @@
+/*
+ *
+ * CPU placement of the pfcount_multichannel threads.
+ *
+ * Capture threads are pinned either to an explicit core list ("0,2,4-7")
+ * or, with "auto", to the core servicing the RX IRQ of their queue
+ * (found in /proc/interrupts and /proc/irq/<n>/smp_affinity). Queues
+ * whose IRQ cannot be found get the cores of the NIC NUMA node
+ * (/sys/class/net/<dev>/device/numa_node), one per physical core so that
+ * two capture threads never share a hyperthread pair.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _AFFINITY_H_
+#define _AFFINITY_H_
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#define AFFINITY_MAX_CPUS  1024
+
+int affinity_parse_list(const char *list, int *cores, u_int max);
+int affinity_numa_node(const char *device);
+int affinity_queue_core(const char *device, u_int queue);
+int affinity_node_cores(int node, int *cores, u_int max);
+int affinity_plan(const char *device, u_int num_queues, int *cores);
+int affinity_bind(pthread_t thread, int core);
+
+#endif /* _AFFINITY_H_ */
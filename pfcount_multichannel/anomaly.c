@@ -0,0 +1,169 @@
+/*
+ *
+ * Per-destination anomaly detection for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "anomaly.h"
+
+const char *anomaly_metric_name[NUM_ANOMALY_METRICS] = { "pkt/sec", "bit/sec", "SYN/sec", "packet mix" };
+
+/* *************************************** */
+
+int anomaly_init(struct anomaly_detector *d, u_int32_t capacity) {
+  memset(d, 0, sizeof(struct anomaly_detector));
+
+  if((d->pool = calloc(capacity, sizeof(struct baseline))) == NULL)
+    return(-1);
+
+  d->capacity = capacity;
+  tommy_hashdyn_init(&d->map);
+  tommy_list_init(&d->lru);
+  return(0);
+}
+
+/* *************************************** */
+
+void anomaly_done(struct anomaly_detector *d) {
+  tommy_hashdyn_done(&d->map);
+  free(d->pool);
+  d->pool = NULL;
+}
+
+/* *************************************** */
+
+static int compare_baseline(const void *arg, const void *obj) {
+  return(!victim_key_equal(arg, &((const struct baseline *)obj)->key));
+}
+
+/* *************************************** */
+
+static struct baseline* get_baseline(struct anomaly_detector *d, const struct victim_key *key) {
+  u_int64_t hash = victim_hash(key);
+  struct baseline *b = tommy_hashdyn_search(&d->map, compare_baseline, key, hash);
+
+  if(b != NULL) {
+    tommy_list_remove_existing(&d->lru, &b->lru_node);
+    tommy_list_insert_tail(&d->lru, &b->lru_node, b);
+    return(b);
+  }
+
+  if(d->used < d->capacity)
+    b = &d->pool[d->used++];
+  else {
+    /* The least recently updated */
+    b = tommy_list_head(&d->lru)->data;
+    tommy_hashdyn_remove_existing(&d->map, &b->node);
+    tommy_list_remove_existing(&d->lru, &b->lru_node);
+    d->recycled++;
+  }
+
+  memset(b, 0, sizeof(struct baseline));
+  b->key = *key;
+  tommy_hashdyn_insert(&d->map, &b->node, b, hash);
+  tommy_list_insert_tail(&d->lru, &b->lru_node, b);
+  return(b);
+}
+
+/* *************************************** */
+
+static u_int32_t check_sample(struct baseline *b, const struct victim_totals *t, u_int32_t sigmas,
+			      u_int32_t min_pps, struct anomaly *found, u_int32_t max) {
+  double x[NUM_ANOMALY_RATES], share[NUM_PKT_CLASSES], distance = 0;
+  u_int32_t n = 0, i;
+
+  x[anomaly_pps] = t->pkts, x[anomaly_bps] = 8.0 * t->bytes, x[anomaly_syn] = t->syns;
+  for(i = 0; i < NUM_PKT_CLASSES; i++) {
+    share[i] = t->pkts ? (double)t->mix.classes[i] / t->pkts : 0;
+    distance += fabs(share[i] - b->mix[i]);
+  }
+
+  if((b->samples >= ANOMALY_WARMUP) && (t->pkts >= min_pps)) {
+    for(i = 0; i < NUM_ANOMALY_RATES; i++) {
+      double sd = sqrt(b->var[i]), min_sd = ANOMALY_MIN_SD_RATIO * b->mean[i] + 1;
+
+      if(sd < min_sd) sd = min_sd;
+      if(x[i] > b->mean[i] + sigmas * sd) {
+	if(n < max)
+	  found[n].metric = i, found[n].value = x[i], found[n].mean = b->mean[i], found[n].deviation = (x[i] - b->mean[i]) / sd;
+	n++;
+      }
+    }
+
+    if((b->mix_samples >= ANOMALY_WARMUP) && (distance > ANOMALY_MIX_SHIFT)) {
+      if(n < max)
+	found[n].metric = anomaly_mix, found[n].value = 0, found[n].mean = 0, found[n].deviation = distance;
+      n++;
+    }
+  }
+
+  if(n > 0)
+    return(n); /* not learned */
+
+  for(i = 0; i < NUM_ANOMALY_RATES; i++) {
+    double diff = x[i] - b->mean[i];
+
+    if(b->samples == 0) {
+      b->mean[i] = x[i]; /* no bias towards 0 during the warmup */
+      continue;
+    }
+
+    b->mean[i] += ANOMALY_ALPHA * diff;
+    b->var[i] = (1 - ANOMALY_ALPHA) * (b->var[i] + ANOMALY_ALPHA * diff * diff);
+  }
+
+  /* The mix of a silent second says nothing */
+  if(t->pkts > 0) {
+    for(i = 0; i < NUM_PKT_CLASSES; i++)
+      b->mix[i] += (b->mix_samples ? ANOMALY_ALPHA : 1.0) * (share[i] - b->mix[i]);
+    b->mix_samples++;
+  }
+
+  b->samples++;
+  return(0);
+}
+
+/* *************************************** */
+
+u_int32_t anomaly_run(struct anomaly_detector *d, struct victim_summary *s, u_int32_t epoch,
+		      u_int32_t sigmas, u_int32_t min_pps, u_int32_t budget,
+		      struct anomaly *found, u_int32_t max) {
+  static const struct victim_totals silent;
+  u_int32_t visits = victim_summary_count(s), num = 0, n, j;
+
+  if(visits > budget) visits = budget;
+
+  while(visits-- > 0) {
+    tommy_node *i = tommy_list_head(&s->all);
+    struct victim_summary_node *v = i->data;
+    const struct victim_totals *t = &v->second[epoch & 1];
+    struct baseline *b;
+
+    /* Round robin: the head is the least recently visited */
+    tommy_list_remove_existing(&s->all, i);
+    tommy_list_insert_tail(&s->all, i, v);
+
+    b = get_baseline(d, &v->key);
+    if(b->epoch == epoch)
+      continue; /* already sampled */
+
+    b->epoch = epoch, d->samples++;
+    n = check_sample(b, (t->epoch == epoch) ? t : &silent, sigmas, min_pps,
+		     &found[(num < max) ? num : max], (num < max) ? max - num : 0);
+
+    for(j = num; (j < num + n) && (j < max); j++)
+      found[j].key = v->key;
+    num += n;
+  }
+
+  return(num);
+}
@@ -0,0 +1,94 @@
+/*
+ *
+ * Per-destination anomaly detection for pfcount_multichannel (-z).
+ *
+ * Runs on the reporter, after the per destination deltas of the threads
+ * have been drained into the summary (victims.h), and only reads the
+ * totals of the last complete second there: never the flow tables nor
+ * anything written by the capture threads.
+ *
+ * Each destination has a baseline: exponentially weighted moving average
+ * and variance of its packets, bits and SYNs per second, and of its
+ * packet mix (pkt_class shares). A second deviates when a rate exceeds
+ * its mean by more than 'sigmas' standard deviations, or when the mix
+ * moves by more than ANOMALY_MIX_SHIFT (L1 distance of the shares), for
+ * destinations above a minimum rate. The baseline is not learned from the
+ * seconds that deviate, so that an attack does not become the norm.
+ *
+ * The cost of a run is bounded: at most 'budget' destinations of the
+ * summary are visited, the least recently visited first (visited nodes
+ * move to the tail of the summary list), so with more destinations than
+ * the budget each is sampled every few seconds instead of every second.
+ * Baselines live in a preallocated pool of fixed size, outliving the
+ * summary's short memory; when it is full the least recently updated one
+ * is recycled.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _ANOMALY_H_
+#define _ANOMALY_H_
+
+#include <sys/types.h>
+
+#include "victims.h"
+
+#define DEFAULT_ANOMALY_BASELINES  262144 /* ~40 MB */
+#define DEFAULT_ANOMALY_BUDGET     65536  /* destinations per run */
+#define DEFAULT_ANOMALY_MIN_PPS    1000
+#define ANOMALY_ALPHA              (1.0 / 32) /* weight of a new sample */
+#define ANOMALY_WARMUP             30   /* samples before a baseline is trusted */
+#define ANOMALY_MIN_SD_RATIO       0.1  /* of the mean: a flat history is not infinitely sensitive */
+#define ANOMALY_MIX_SHIFT          1.0  /* L1 distance, out of 2: half of the packets changed class */
+
+typedef enum {
+  anomaly_pps = 0,
+  anomaly_bps,
+  anomaly_syn,
+  NUM_ANOMALY_RATES,
+  anomaly_mix = NUM_ANOMALY_RATES,
+  NUM_ANOMALY_METRICS
+} anomaly_metric;
+
+extern const char *anomaly_metric_name[NUM_ANOMALY_METRICS];
+
+struct baseline {
+  tommy_node node;      /* map */
+  tommy_node lru_node;  /* lru */
+  struct victim_key key;
+  u_int32_t samples, mix_samples, epoch; /* of the last sample */
+  float mean[NUM_ANOMALY_RATES], var[NUM_ANOMALY_RATES];
+  float mix[NUM_PKT_CLASSES];
+};
+
+struct anomaly {
+  struct victim_key key;
+  anomaly_metric metric;
+  double value, mean;   /* per sec; pkt_mix: 0 */
+  double deviation;     /* standard deviations; pkt_mix: L1 distance */
+};
+
+struct anomaly_detector {
+  tommy_hashdyn map;
+  tommy_list lru;       /* least recently updated first */
+  struct baseline *pool;
+  u_int32_t capacity, used;
+  u_int64_t samples, recycled;
+};
+
+int  anomaly_init(struct anomaly_detector *d, u_int32_t capacity);
+void anomaly_done(struct anomaly_detector *d);
+
+/*
+  Compares the destinations of the summary with their baselines for second 'epoch', then
+  learns it: returns the number of deviations, the first 'max' of them in 'found'.
+*/
+u_int32_t anomaly_run(struct anomaly_detector *d, struct victim_summary *s, u_int32_t epoch,
+		      u_int32_t sigmas, u_int32_t min_pps, u_int32_t budget,
+		      struct anomaly *found, u_int32_t max);
+
+#endif /* _ANOMALY_H_ */
@@ -0,0 +1,265 @@
+/*
+ *
+ * Columnar archive of the pfcount_multichannel reports
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+
+const char *archive_column_name[NUM_ARCHIVE_COLUMNS] = {
+  "epoch", "interval_ms", "pkts", "bytes", "ip_pkts", "ip_bytes",
+  "tcp_pkts", "tcp_bytes", "udp_pkts", "udp_bytes", "icmp_pkts", "icmp_bytes",
+  "other_pkts", "other_bytes", "drops", "flows", "half_open", "victims", "customers"
+};
+
+#define PAGE_ALIGN(x)  (((x) + ARCHIVE_PAGE - 1) & ~((u_int64_t)ARCHIVE_PAGE - 1))
+
+/* *************************************** */
+
+static u_int32_t column_width(archive_column col) {
+  switch(col) {
+  case archive_epoch:
+  case archive_interval_ms:
+    return(sizeof(u_int32_t));
+  case archive_victims:
+    return(ARCHIVE_TOP_VICTIMS * sizeof(struct export_victim));
+  case archive_customers:
+    return(ARCHIVE_MAX_CUSTOMERS * sizeof(struct archive_customer));
+  default:
+    return(sizeof(u_int64_t));
+  }
+}
+
+/* The layout of a new file: returns its size */
+static size_t layout(struct archive_header *h) {
+  u_int64_t offset = PAGE_ALIGN(sizeof(struct archive_header));
+  u_int32_t c;
+
+  for(c = 0; c < NUM_ARCHIVE_COLUMNS; c++) {
+    h->column[c].width = column_width(c);
+    h->column[c].offset = offset;
+    offset = PAGE_ALIGN(offset + (u_int64_t)ARCHIVE_ROWS * h->column[c].width);
+  }
+
+  return(offset);
+}
+
+/* *************************************** */
+
+int archive_open(struct archive *a, const char *dir) {
+  struct stat st;
+
+  memset(a, 0, sizeof(struct archive));
+
+  if((stat(dir, &st) != 0) && (mkdir(dir, 0755) != 0))
+    return(-1);
+
+  return(((a->dir = strdup(dir)) != NULL) ? 0 : -1);
+}
+
+/* *************************************** */
+
+static void unmap(struct archive *a) {
+  if(a->header == NULL)
+    return;
+
+  msync(a->header, a->size, MS_ASYNC);
+  munmap(a->header, a->size);
+  a->header = NULL;
+}
+
+void archive_close(struct archive *a) {
+  unmap(a);
+  free(a->dir);
+  a->dir = NULL;
+}
+
+/* *************************************** */
+
+/* Maps the file of the day of epoch, created sparse if new */
+static struct archive_header* map_day(struct archive *a, u_int32_t epoch) {
+  u_int32_t day = epoch - (epoch % ARCHIVE_ROWS);
+  struct archive_header layout_hdr, *h;
+  char path[512], name[16];
+  time_t t = day;
+  struct tm tm;
+  size_t size;
+  int fd;
+
+  if((a->header != NULL) && (a->header->day == day))
+    return(a->header);
+
+  unmap(a);
+
+  memset(&layout_hdr, 0, sizeof(layout_hdr));
+  size = layout(&layout_hdr);
+
+  strftime(name, sizeof(name), "%Y%m%d", gmtime_r(&t, &tm));
+  snprintf(path, sizeof(path), "%s/%s.pfa", a->dir, name);
+
+  if((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+    return(NULL);
+
+  if(ftruncate(fd, size) != 0) {
+    close(fd);
+    return(NULL);
+  }
+
+  h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(h == MAP_FAILED)
+    return(NULL);
+
+  if(h->magic == 0) {
+    memcpy(h->column, layout_hdr.column, sizeof(h->column));
+    h->version = ARCHIVE_VERSION, h->day = day, h->rows = ARCHIVE_ROWS, h->num_columns = NUM_ARCHIVE_COLUMNS;
+    __sync_synchronize();
+    h->magic = ARCHIVE_MAGIC;
+  } else if((h->magic != ARCHIVE_MAGIC) || (h->version != ARCHIVE_VERSION) || (h->day != day)) {
+    munmap(h, size); /* not ours: left untouched */
+    return(NULL);
+  }
+
+  a->header = h, a->size = size;
+  return(h);
+}
+
+/* *************************************** */
+
+static void* cell(struct archive_header *h, archive_column col, u_int32_t epoch) {
+  return((u_char *)h + h->column[col].offset + (u_int64_t)(epoch - h->day) * h->column[col].width);
+}
+
+static void set_u64(struct archive_header *h, archive_column col, u_int32_t epoch, u_int64_t v) {
+  memcpy(cell(h, col, epoch), &v, sizeof(v));
+}
+
+/* *************************************** */
+
+int archive_summary(struct archive *a, u_int32_t epoch, const struct export_summary *s) {
+  struct archive_header *h = map_day(a, epoch);
+
+  if(h == NULL) {
+    a->epoch = 0, a->errors++;
+    return(-1);
+  }
+
+  a->epoch = epoch;
+  *(u_int32_t *)cell(h, archive_interval_ms, epoch) = s->interval_ms;
+  set_u64(h, archive_pkts, epoch, s->pkts), set_u64(h, archive_bytes, epoch, s->bytes);
+  set_u64(h, archive_ip_pkts, epoch, s->ip_pkts), set_u64(h, archive_ip_bytes, epoch, s->ip_bytes);
+  set_u64(h, archive_tcp_pkts, epoch, s->tcp_pkts), set_u64(h, archive_tcp_bytes, epoch, s->tcp_bytes);
+  set_u64(h, archive_udp_pkts, epoch, s->udp_pkts), set_u64(h, archive_udp_bytes, epoch, s->udp_bytes);
+  set_u64(h, archive_icmp_pkts, epoch, s->icmp_pkts), set_u64(h, archive_icmp_bytes, epoch, s->icmp_bytes);
+  set_u64(h, archive_other_pkts, epoch, s->other_pkts), set_u64(h, archive_other_bytes, epoch, s->other_bytes);
+  set_u64(h, archive_drops, epoch, s->drops), set_u64(h, archive_flows, epoch, s->flows);
+  set_u64(h, archive_half_open, epoch, (u_int64_t)s->half_open);
+  /* Left by a previous run over the same second: not this report's */
+  memset(cell(h, archive_victims, epoch), 0, h->column[archive_victims].width);
+  memset(cell(h, archive_customers, epoch), 0, h->column[archive_customers].width);
+
+  /* Last: a reader seeing the epoch sees the row */
+  __sync_synchronize();
+  *(u_int32_t *)cell(h, archive_epoch, epoch) = epoch;
+
+  if(h->first == 0) h->first = epoch;
+  h->last = epoch;
+  a->rows++;
+  return(0);
+}
+
+/* *************************************** */
+
+/* In the row of the last archive_summary(): the victims and customers of that report */
+
+void archive_victim(struct archive *a, const struct export_victim *v) {
+  struct archive_header *h = a->header;
+
+  if((h == NULL) || (a->epoch == 0) || (v->rank >= ARCHIVE_TOP_VICTIMS))
+    return;
+
+  memcpy((struct export_victim *)cell(h, archive_victims, a->epoch) + v->rank, v, sizeof(struct export_victim));
+}
+
+/* *************************************** */
+
+void archive_customer_deltas(struct archive *a, const struct customers *c) {
+  struct archive_header *h = a->header;
+  struct archive_customer *row;
+  u_int32_t i, num = (c->num < ARCHIVE_MAX_CUSTOMERS) ? c->num : ARCHIVE_MAX_CUSTOMERS, d, k;
+
+  if((h == NULL) || (a->epoch == 0))
+    return;
+
+  /* Customer ids are the order of the -X file: the names of the day are those of its first report */
+  if(h->num_customers == 0) {
+    for(i = 0; i < num; i++)
+      snprintf(h->customer_name[i], CUSTOMER_NAME_LEN, "%s", c->customer[i].name);
+    h->num_customers = num;
+  }
+
+  row = (struct archive_customer *)cell(h, archive_customers, a->epoch);
+  for(i = 0; i < num; i++) {
+    const struct customer *cust = &c->customer[i];
+    struct archive_customer *x = &row[i];
+
+    memset(x, 0, sizeof(struct archive_customer));
+    for(d = 0; d < NUM_CUSTOMER_DIRS; d++)
+      for(k = 0; k < 4; k++) {
+	x->pkts[d] += cust->total.pkts[d][k] - cust->last.pkts[d][k];
+	x->bytes[d] += cust->total.bytes[d][k] - cust->last.bytes[d][k];
+      }
+    x->syns = cust->total.syns - cust->last.syns;
+  }
+}
+
+/* *************************************** */
+
+const struct archive_header* archive_map_day(const char *path, size_t *size) {
+  struct archive_header *h;
+  struct stat st;
+  int fd;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return(NULL);
+
+  if((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(struct archive_header))) {
+    close(fd);
+    return(NULL);
+  }
+
+  h = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(h == MAP_FAILED)
+    return(NULL);
+
+  if((h->magic != ARCHIVE_MAGIC) || (h->version != ARCHIVE_VERSION) || (h->num_columns != NUM_ARCHIVE_COLUMNS)
+     || (h->column[NUM_ARCHIVE_COLUMNS - 1].offset
+	 + (u_int64_t)h->rows * h->column[NUM_ARCHIVE_COLUMNS - 1].width > (u_int64_t)st.st_size)) {
+    munmap(h, st.st_size);
+    return(NULL);
+  }
+
+  /* Column scans: read ahead */
+  madvise(h, st.st_size, MADV_SEQUENTIAL);
+  *size = st.st_size;
+  return(h);
+}
+
+void archive_unmap_day(const struct archive_header *h, size_t size) {
+  munmap((void *)h, size);
+}
@@ -0,0 +1,113 @@
+/*
+ *
+ * Columnar archive of the pfcount_multichannel reports (-x archive:<dir>).
+ *
+ * Every report the reporter writes the traffic of the epoch (the deltas of
+ * export.h: global and per protocol counters), its top victims and, with
+ * -X, the traffic of each customer to <dir>/<YYYYMMDD>.pfa, one file per
+ * UTC day mapped in memory. A file is its own index: the row of an epoch
+ * is its second of the day, so a time range is an offset, and each column
+ * is a fixed width array of ARCHIVE_ROWS values starting on its own page.
+ * A scan over weeks of one counter reads that column only, sequentially,
+ * at memory bandwidth once in the page cache: no database, no parsing.
+ *
+ * Rows are written in place with memcpy(): the kernel writes the pages
+ * back. Nothing is done on the capture threads, and a sparse file only
+ * takes the pages of the seconds written. Rows without a report have
+ * epoch 0; the counters of a row are over its interval_ms.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include <sys/types.h>
+
+#include "export.h"
+#include "customers.h"
+
+#define ARCHIVE_MAGIC          0x50465241 /* "PFRA" */
+#define ARCHIVE_VERSION        1
+#define ARCHIVE_ROWS           86400      /* seconds of a day */
+#define ARCHIVE_TOP_VICTIMS    10
+#define ARCHIVE_MAX_CUSTOMERS  64         /* the first ones of -X, 221 MB a day when all are written */
+#define ARCHIVE_PAGE           4096
+
+typedef enum {
+  archive_epoch = 0,     /* u_int32_t, sec: 0 = no report in that second */
+  archive_interval_ms,   /* u_int32_t */
+  archive_pkts,          /* u_int64_t from here to archive_drops */
+  archive_bytes,
+  archive_ip_pkts,
+  archive_ip_bytes,
+  archive_tcp_pkts,
+  archive_tcp_bytes,
+  archive_udp_pkts,
+  archive_udp_bytes,
+  archive_icmp_pkts,
+  archive_icmp_bytes,
+  archive_other_pkts,
+  archive_other_bytes,
+  archive_drops,
+  archive_flows,         /* u_int64_t, current */
+  archive_half_open,     /* int64_t, current */
+  archive_victims,       /* struct export_victim [ARCHIVE_TOP_VICTIMS], rank order, pkts 0 = none */
+  archive_customers,     /* struct archive_customer [ARCHIVE_MAX_CUSTOMERS], by customer id */
+  NUM_ARCHIVE_COLUMNS
+} archive_column;
+
+extern const char *archive_column_name[NUM_ARCHIVE_COLUMNS];
+
+struct archive_customer {
+  u_int64_t pkts[NUM_CUSTOMER_DIRS], bytes[NUM_CUSTOMER_DIRS];
+  u_int64_t syns;
+};
+
+struct archive_column_desc {
+  u_int32_t width;             /* bytes per row */
+  u_int32_t pad;
+  u_int64_t offset;            /* from the start of the file, page aligned */
+};
+
+struct archive_header {
+  u_int32_t magic, version;
+  u_int32_t day;               /* epoch of 00:00 UTC: row = epoch - day */
+  u_int32_t rows;              /* ARCHIVE_ROWS */
+  u_int32_t num_columns;       /* NUM_ARCHIVE_COLUMNS */
+  u_int32_t num_customers;
+  u_int32_t first, last;       /* epochs written, 0 = none */
+  struct archive_column_desc column[NUM_ARCHIVE_COLUMNS];
+  char customer_name[ARCHIVE_MAX_CUSTOMERS][CUSTOMER_NAME_LEN];
+};
+
+struct archive {
+  char *dir;
+  struct archive_header *header; /* the day mapped, NULL if none */
+  size_t size;
+  u_int32_t epoch;             /* of the last archive_summary(), 0 if it failed */
+  u_int64_t rows, errors;
+};
+
+/* Writer: the reporter */
+int  archive_open(struct archive *a, const char *dir);
+void archive_close(struct archive *a);
+int  archive_summary(struct archive *a, u_int32_t epoch, const struct export_summary *s);
+/* In the row of the last archive_summary() */
+void archive_victim(struct archive *a, const struct export_victim *v);
+/* The deltas since the previous customers_collect(), in the row of the last archive_summary() */
+void archive_customer_deltas(struct archive *a, const struct customers *c);
+
+/* Reader: maps a day file read only, NULL on error (see archive_unmap_day()) */
+const struct archive_header* archive_map_day(const char *path, size_t *size);
+void archive_unmap_day(const struct archive_header *h, size_t size);
+
+static inline const void* archive_cell(const struct archive_header *h, archive_column col, u_int32_t row) {
+  return((const u_char *)h + h->column[col].offset + (u_int64_t)row * h->column[col].width);
+}
+
+#endif /* _ARCHIVE_H_ */
@@ -0,0 +1,135 @@
+/*
+ *
+ * Per-thread memory arena for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "arena.h"
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB     0x40000
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB    (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB    (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define MPOL_PREFERRED  1 /* from <numaif.h>, not to depend on libnuma */
+
+#define HUGE_2M         (2UL << 20)
+#define HUGE_1G         (1UL << 30)
+#define ARENA_ALIGN     64 /* cache line */
+
+/* *************************************** */
+
+/* Prefer the node of the CPU we are running on (the capture thread is already bound) */
+static void bind_to_local_node(void *addr, size_t len) {
+#if defined(SYS_mbind) && defined(SYS_getcpu)
+  unsigned int cpu, node;
+  unsigned long nodemask;
+
+  if((syscall(SYS_getcpu, &cpu, &node, NULL) != 0) || (node >= 8*sizeof(nodemask)))
+    return;
+
+  nodemask = 1UL << node;
+  syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &nodemask, 8*sizeof(nodemask)+1, 0);
+#endif
+}
+
+/* *************************************** */
+
+static void* map_region(size_t len, int flags) {
+  void *addr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|flags, -1, 0);
+
+  return((addr == MAP_FAILED) ? NULL : addr);
+}
+
+/* *************************************** */
+
+int arena_init(struct arena *a, size_t size) {
+  memset(a, 0, sizeof(struct arena));
+
+  if(size == 0)
+    return(0); /* disabled */
+
+  if(size >= HUGE_1G) {
+    a->size = (size + HUGE_1G - 1) & ~(HUGE_1G - 1);
+    if((a->base = map_region(a->size, MAP_HUGETLB|MAP_HUGE_1GB)) != NULL)
+      a->page_type = arena_pages_1g;
+  }
+
+  if(a->base == NULL) {
+    a->size = (size + HUGE_2M - 1) & ~(HUGE_2M - 1);
+    if((a->base = map_region(a->size, MAP_HUGETLB|MAP_HUGE_2MB)) != NULL)
+      a->page_type = arena_pages_2m;
+  }
+
+  if(a->base == NULL) {
+    /* No hugetlb pages reserved: regular pages, populated on demand */
+    if((a->base = map_region(a->size, MAP_NORESERVE)) == NULL) {
+      a->size = 0;
+      return(-1);
+    }
+
+    a->page_type = arena_pages_4k;
+#ifdef MADV_HUGEPAGE
+    madvise(a->base, a->size, MADV_HUGEPAGE);
+#endif
+  }
+
+  bind_to_local_node(a->base, a->size);
+  return(0);
+}
+
+/* *************************************** */
+
+void arena_done(struct arena *a) {
+  if(a->base != NULL)
+    munmap(a->base, a->size);
+
+  memset(a, 0, sizeof(struct arena));
+}
+
+/* *************************************** */
+
+void* arena_alloc(struct arena *a, size_t len) {
+  char *ptr;
+
+  len = (len + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  if((a->base == NULL) || (len > (a->size - a->used)))
+    return(NULL);
+
+  ptr = &a->base[a->used];
+  a->used += len;
+  return(ptr);
+}
+
+/* *************************************** */
+
+const char* arena_page_type_name(arena_page_type type) {
+  switch(type) {
+  case arena_pages_none: return("none");
+  case arena_pages_1g:   return("1 GB hugepages");
+  case arena_pages_2m:   return("2 MB hugepages");
+  case arena_pages_4k:   return("4 KB pages");
+  }
+
+  return("???");
+}
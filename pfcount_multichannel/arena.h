@@ -0,0 +1,43 @@
+/*
+ *
+ * Per-thread memory arena for the pfcount_multichannel record pools.
+ *
+ * A single region is reserved at startup, backed (in order of preference)
+ * by 1 GB or 2 MB hugetlb pages, or by regular pages with transparent
+ * hugepages requested. The region is bound to the NUMA node of the
+ * calling thread and records are carved from it with a bump pointer:
+ * pools never give memory back, free records are recycled by the caller.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <sys/types.h>
+
+#define DEFAULT_ARENA_SIZE_MB  256
+
+typedef enum {
+  arena_pages_none = 0, /* no reservation: arena_alloc() always fails */
+  arena_pages_1g,
+  arena_pages_2m,
+  arena_pages_4k
+} arena_page_type;
+
+struct arena {
+  char *base;
+  size_t size, used;
+  arena_page_type page_type;
+};
+
+int   arena_init(struct arena *a, size_t size);
+void  arena_done(struct arena *a);
+void* arena_alloc(struct arena *a, size_t len);
+const char* arena_page_type_name(arena_page_type type);
+
+#endif /* _ARENA_H_ */
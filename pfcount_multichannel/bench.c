@@ -0,0 +1,394 @@
+/*
+ *
+ * Offline packet sources for the pfcount_multichannel benchmark
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/perf_event.h>
+
+#include "bench.h"
+
+#define PCAP_MAGIC        0xa1b2c3d4
+#define PCAP_MAGIC_NSEC   0xa1b23c4d
+#define PCAP_LINKTYPE_ETH 1
+
+#define BENCH_VICTIM      0xC0A80001 /* 192.168.0.1 */
+
+struct pcap_file_hdr {
+  u_int32_t magic;
+  u_int16_t version_major, version_minor;
+  int32_t   thiszone;
+  u_int32_t sigfigs, snaplen, linktype;
+};
+
+struct pcap_rec_hdr {
+  u_int32_t ts_sec, ts_frac, caplen, len;
+};
+
+/* *************************************** */
+
+int bench_parse_source(const char *spec, bench_source_type *type, const char **pcap_path) {
+  if(!strncmp(spec, "pcap:", 5)) {
+    *type = bench_pcap, *pcap_path = &spec[5];
+    return(0);
+  }
+
+  if(!strcmp(spec, "uniform"))            *type = bench_uniform;
+  else if(!strcmp(spec, "zipf"))          *type = bench_zipf;
+  else if(!strcmp(spec, "synflood"))      *type = bench_synflood;
+  else if(!strcmp(spec, "amplification")) *type = bench_amplification;
+  else return(-1);
+
+  *pcap_path = NULL;
+  return(0);
+}
+
+/* *************************************** */
+
+const char* bench_source_name(bench_source_type type) {
+  switch(type) {
+  case bench_pcap:          return("pcap");
+  case bench_uniform:       return("uniform");
+  case bench_zipf:          return("zipf");
+  case bench_synflood:      return("synflood");
+  case bench_amplification: return("amplification");
+  }
+
+  return("???");
+}
+
+/* *************************************** */
+
+static inline u_int32_t swap32(u_int32_t v, int swapped) {
+  return(swapped ? __builtin_bswap32(v) : v);
+}
+
+/* *************************************** */
+
+/*
+  Same split as RSS on a NIC programmed with the symmetric Toeplitz key,
+  so that both directions of a flow land on the same thread
+*/
+static u_int32_t rss_hash(const struct pfring_pkthdr *h) {
+  return(pfring_compute_pkt_hash(h, pkt_hash_toeplitz));
+}
+
+/* *************************************** */
+
+static void parse(struct pfring_pkthdr *h, u_char *data) {
+  memset(&h->extended_hdr, 0, sizeof(h->extended_hdr));
+  h->extended_hdr.rx_direction = 1, h->extended_hdr.if_index = UNKNOWN_INTERFACE;
+  pfring_parse_pkt(data, h, 4, 0, 0);
+}
+
+/* *************************************** */
+
+/* The whole file is loaded, split in num_threads traces */
+int bench_load_pcap(const char *path, u_int32_t num_threads, struct bench_trace *traces) {
+  struct pcap_file_hdr fh;
+  struct pcap_rec_hdr rh;
+  u_char buf[65536];
+  int swapped, nsec;
+  u_int32_t i;
+  FILE *f;
+
+  if((f = fopen(path, "r")) == NULL)
+    return(-1);
+
+  if(fread(&fh, sizeof(fh), 1, f) != 1) {
+    fclose(f);
+    return(-1);
+  }
+
+  swapped = (fh.magic == __builtin_bswap32(PCAP_MAGIC)) || (fh.magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+  nsec = (swap32(fh.magic, swapped) == PCAP_MAGIC_NSEC);
+
+  if(((swap32(fh.magic, swapped) != PCAP_MAGIC) && !nsec)
+     || (swap32(fh.linktype, swapped) != PCAP_LINKTYPE_ETH)) {
+    fclose(f);
+    return(-1);
+  }
+
+  memset(traces, 0, num_threads * sizeof(struct bench_trace));
+
+  while(fread(&rh, sizeof(rh), 1, f) == 1) {
+    struct bench_trace *t;
+    struct bench_packet p;
+    u_int32_t caplen = swap32(rh.caplen, swapped);
+
+    if((caplen > sizeof(buf)) || (fread(buf, caplen, 1, f) != 1))
+      break; /* truncated */
+
+    if(caplen > BENCH_SNAPLEN) caplen = BENCH_SNAPLEN;
+
+    /* Parsed first: the hash decides the trace */
+    memcpy(p.data, buf, caplen);
+    p.hdr.ts.tv_sec  = swap32(rh.ts_sec, swapped);
+    p.hdr.ts.tv_usec = swap32(rh.ts_frac, swapped) / (nsec ? 1000 : 1);
+    p.hdr.caplen = caplen, p.hdr.len = swap32(rh.len, swapped);
+    parse(&p.hdr, p.data);
+
+    t = &traces[rss_hash(&p.hdr) % num_threads];
+    if(t->num == t->size) {
+      u_int32_t size = t->size ? 2 * t->size : 1024;
+      struct bench_packet *n = realloc(t->pkts, size * sizeof(struct bench_packet));
+
+      if(n == NULL) break;
+      t->pkts = n, t->size = size;
+    }
+
+    t->pkts[t->num++] = p;
+  }
+
+  fclose(f);
+
+  for(i = 0; i < num_threads; i++)
+    if(traces[i].num > 0)
+      return(0);
+
+  return(-1); /* no packets */
+}
+
+/* *************************************** */
+
+void bench_free_trace(struct bench_trace *trace) {
+  free(trace->pkts);
+  memset(trace, 0, sizeof(struct bench_trace));
+}
+
+/* *************************************** */
+
+double* bench_zipf_init(u_int32_t n) {
+  double *cdf = malloc(n * sizeof(double)), sum = 0;
+  u_int32_t i;
+
+  if(cdf == NULL) return(NULL);
+
+  for(i = 0; i < n; i++)
+    sum += 1.0 / (i + 1), cdf[i] = sum;
+
+  for(i = 0; i < n; i++)
+    cdf[i] /= sum;
+
+  return(cdf);
+}
+
+/* *************************************** */
+
+static inline u_int64_t next_rand(struct bench_source *s) {
+  s->rng ^= s->rng >> 12;
+  s->rng ^= s->rng << 25;
+  s->rng ^= s->rng >> 27;
+  return(s->rng * 0x2545F4914F6CDD1DULL);
+}
+
+/* *************************************** */
+
+static u_int32_t zipf_rank(struct bench_source *s) {
+  double u = (next_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+  u_int32_t lo = 0, hi = s->num_sources - 1;
+
+  while(lo < hi) {
+    u_int32_t mid = (lo + hi) / 2;
+
+    if(s->zipf_cdf[mid] < u) lo = mid + 1; else hi = mid;
+  }
+
+  return(lo);
+}
+
+/* *************************************** */
+
+/* Source of a given rank: an odd multiplier is a bijection of the 24 bit space */
+static inline u_int32_t source_addr(u_int32_t rank) {
+  return(0x0A000000 | ((rank * 2654435761U) & 0x00FFFFFF));
+}
+
+/* *************************************** */
+
+void bench_source_init(struct bench_source *s, bench_source_type type, u_int64_t seed,
+                       u_int32_t num_sources, const double *zipf_cdf, const struct bench_trace *trace) {
+  memset(s, 0, sizeof(struct bench_source));
+
+  s->type = type, s->rng = seed | 1;
+  s->num_sources = num_sources ? num_sources : DEFAULT_BENCH_SOURCES;
+  if(s->num_sources > BENCH_MAX_SOURCES) s->num_sources = BENCH_MAX_SOURCES;
+  s->zipf_cdf = zipf_cdf, s->trace = trace;
+  gettimeofday(&s->start, NULL);
+
+  if((trace != NULL) && (trace->num > 0)) {
+    const struct timeval *first = &trace->pkts[0].hdr.ts, *last = &trace->pkts[trace->num - 1].hdr.ts;
+
+    s->trace_span.tv_sec = last->tv_sec - first->tv_sec + 1; /* a second apart between loops */
+  }
+}
+
+/* *************************************** */
+
+static void build_packet(struct pfring_pkthdr *h, u_char *data, u_int8_t proto, u_int32_t saddr,
+                         u_int32_t daddr, u_int16_t sport, u_int16_t dport, u_int8_t flags, u_int32_t len) {
+  static const u_char macs[12] = { 0x00, 0x1b, 0x21, 0x00, 0x00, 0x01, 0x00, 0x1b, 0x21, 0x00, 0x00, 0x02 };
+  u_char *ip = &data[14], *l4 = &data[34];
+  u_int16_t v16;
+  u_int32_t v32;
+
+  memcpy(data, macs, sizeof(macs));
+  data[12] = 0x08, data[13] = 0x00;
+
+  memset(ip, 0, 20);
+  ip[0] = 0x45, ip[8] = 64, ip[9] = proto;
+  v16 = htons(len - 14), memcpy(&ip[2], &v16, 2);
+  v32 = htonl(saddr), memcpy(&ip[12], &v32, 4);
+  v32 = htonl(daddr), memcpy(&ip[16], &v32, 4);
+
+  memset(l4, 0, 20);
+  v16 = htons(sport), memcpy(&l4[0], &v16, 2);
+  v16 = htons(dport), memcpy(&l4[2], &v16, 2);
+  if(proto == IPPROTO_TCP)
+    l4[12] = 5 << 4, l4[13] = flags;
+  else
+    v16 = htons(len - 34), memcpy(&l4[4], &v16, 2);
+
+  h->len = len, h->caplen = (len < BENCH_SNAPLEN) ? len : BENCH_SNAPLEN;
+  parse(h, data);
+}
+
+/* *************************************** */
+
+static void background_packet(struct bench_source *s, struct pfring_pkthdr *h, u_char *data, int zipf) {
+  u_int64_t r = next_rand(s);
+  u_int32_t rank = zipf ? zipf_rank(s) : (u_int32_t)(r % s->num_sources);
+  u_int32_t daddr = 0xC0A80000 | ((r >> 24) % BENCH_NUM_VICTIMS);
+  u_int16_t sport = 1024 + ((r >> 40) & 0x7FFF);
+
+  if(((r >> 56) % 10) < 6)
+    build_packet(h, data, IPPROTO_TCP, source_addr(rank), daddr, sport, ((r >> 60) & 1) ? 443 : 80,
+		 0x10 /* ACK */, 64 + ((r >> 8) & 0x3FF));
+  else
+    build_packet(h, data, IPPROTO_UDP, source_addr(rank), daddr, sport, 53, 0, 80 + ((r >> 8) & 0xFF));
+}
+
+/* *************************************** */
+
+void bench_source_next(struct bench_source *s, struct pfring_pkthdr *hdrs,
+                       u_char data[][BENCH_SNAPLEN], u_int num) {
+  static const u_int16_t reflector_ports[4] = { 53, 123, 1900, 11211 };
+  u_int i;
+
+  for(i = 0; i < num; i++, s->count++) {
+    struct pfring_pkthdr *h = &hdrs[i];
+    u_int64_t r;
+
+    switch(s->type) {
+    case bench_pcap:
+      {
+	const struct bench_packet *p = &s->trace->pkts[s->count % s->trace->num];
+	u_int32_t loop = s->count / s->trace->num;
+
+	*h = p->hdr;
+	memcpy(data[i], p->data, p->hdr.caplen);
+	h->ts.tv_sec += loop * s->trace_span.tv_sec;
+      }
+      continue; /* keep the trace timestamps */
+
+    case bench_uniform:
+      background_packet(s, h, data[i], 0);
+      break;
+
+    case bench_zipf:
+      background_packet(s, h, data[i], 1);
+      break;
+
+    case bench_synflood:
+      r = next_rand(s);
+      build_packet(h, data[i], IPPROTO_TCP, (u_int32_t)r | 1, BENCH_VICTIM,
+		   1024 + ((r >> 32) & 0x7FFF), 80, 0x02 /* SYN */, 60);
+      break;
+
+    case bench_amplification:
+      r = next_rand(s);
+      if((r % 10) == 0)
+	background_packet(s, h, data[i], 0);
+      else
+	build_packet(h, data[i], IPPROTO_UDP, source_addr((u_int32_t)((r >> 8) % s->num_sources)),
+		     BENCH_VICTIM, reflector_ports[(r >> 40) & 3], 1024 + ((r >> 42) & 0x7FFF), 0,
+		     512 + ((r >> 20) % 961));
+      break;
+    }
+
+    /* Virtual clock: BENCH_PKT_RATE pkt/sec from the start of the run */
+    h->ts.tv_sec  = s->start.tv_sec + s->count / BENCH_PKT_RATE;
+    h->ts.tv_usec = (s->count % BENCH_PKT_RATE) * (1000000 / BENCH_PKT_RATE);
+  }
+}
+
+/* *************************************** */
+
+#define CACHE_READ_MISS(cache) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+int bench_counters_open(struct bench_counters *c) {
+  static const struct { u_int32_t type; u_int64_t config; } events[bench_num_counters] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+  };
+  int i, num = 0;
+
+  for(i = 0; i < bench_num_counters; i++) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = events[i].type, attr.size = sizeof(attr);
+    attr.config = events[i].config;
+    attr.exclude_kernel = 1, attr.exclude_hv = 1;
+    /* More counters than the PMU has: the kernel multiplexes them */
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    if((c->fd[i] = syscall(__NR_perf_event_open, &attr, 0 /* this thread */, -1, -1, 0)) >= 0)
+      num++;
+  }
+
+  return(num);
+}
+
+/* *************************************** */
+
+void bench_counters_read(const struct bench_counters *c, u_int64_t values[bench_num_counters]) {
+  u_int64_t v[3]; /* value, time enabled, time running */
+  int i;
+
+  for(i = 0; i < bench_num_counters; i++) {
+    if((c->fd[i] < 0) || (read(c->fd[i], v, sizeof(v)) != sizeof(v)))
+      values[i] = 0;
+    else if((v[2] != 0) && (v[2] < v[1]))
+      values[i] = (u_int64_t)((double)v[0] * v[1] / v[2]);
+    else
+      values[i] = v[0];
+  }
+}
+
+/* *************************************** */
+
+void bench_counters_close(struct bench_counters *c) {
+  int i;
+
+  for(i = 0; i < bench_num_counters; i++) {
+    if(c->fd[i] >= 0) close(c->fd[i]);
+    c->fd[i] = -1;
+  }
+}
@@ -0,0 +1,104 @@
+/*
+ *
+ * Offline packet sources for the pfcount_multichannel benchmark (-B).
+ *
+ * Packets are read from a pcap file (loaded in memory and split across
+ * the threads on a symmetric address hash, as RSS would do) or built by
+ * one of the synthetic generators:
+ *
+ * - uniform:       sources uniform over the source space, 1024 destinations
+ * - zipf:          as uniform, sources Zipf distributed (s = 1)
+ * - synflood:      spoofed sources, SYNs towards one victim
+ * - amplification: 90% UDP replies of a reflector pool (DNS, NTP, SSDP,
+ *                  memcached) towards one victim, 10% uniform background
+ *
+ * Either way packets are parsed with pfring_parse_pkt() into the extended
+ * header, as the kernel would, and stamped with a virtual clock.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <sys/types.h>
+
+#include "pfring.h"
+
+#define BENCH_SNAPLEN          128
+#define DEFAULT_BENCH_PKTS     (10*1000*1000) /* per thread */
+#define DEFAULT_BENCH_SOURCES  (1 << 20)
+#define BENCH_MAX_SOURCES      (1 << 24)      /* 10.0.0.0/8 */
+#define BENCH_NUM_VICTIMS      1024
+#define BENCH_PKT_RATE         1000000        /* virtual pkt/sec per thread */
+
+typedef enum {
+  bench_pcap = 0,
+  bench_uniform,
+  bench_zipf,
+  bench_synflood,
+  bench_amplification
+} bench_source_type;
+
+struct bench_packet {
+  struct pfring_pkthdr hdr;
+  u_char data[BENCH_SNAPLEN];
+};
+
+/* One thread's share of a pcap file */
+struct bench_trace {
+  struct bench_packet *pkts;
+  u_int32_t num, size;
+};
+
+struct bench_source {
+  bench_source_type type;
+  u_int64_t rng;    /* xorshift64* state */
+  u_int64_t count;  /* packets produced */
+  u_int32_t num_sources;
+  const double *zipf_cdf;
+  struct timeval start;
+  const struct bench_trace *trace;
+  struct timeval trace_span; /* replay offset: the trace is looped */
+};
+
+int  bench_parse_source(const char *spec, bench_source_type *type, const char **pcap_path);
+const char* bench_source_name(bench_source_type type);
+
+int  bench_load_pcap(const char *path, u_int32_t num_threads, struct bench_trace *traces);
+void bench_free_trace(struct bench_trace *trace);
+double* bench_zipf_init(u_int32_t n);
+
+void bench_source_init(struct bench_source *s, bench_source_type type, u_int64_t seed,
+                       u_int32_t num_sources, const double *zipf_cdf, const struct bench_trace *trace);
+void bench_source_next(struct bench_source *s, struct pfring_pkthdr *hdrs,
+                       u_char data[][BENCH_SNAPLEN], u_int num);
+
+/*
+  Hardware counters of the calling thread (perf events, user space only),
+  read at the boundaries of a measurement window. A counter the machine
+  or the kernel does not provide has fd -1 and reads as 0.
+*/
+typedef enum {
+  bench_cycles = 0,
+  bench_instructions,
+  bench_llc_misses,
+  bench_dtlb_misses,
+  bench_branch_misses,
+  bench_num_counters
+} bench_counter_type;
+
+struct bench_counters {
+  int fd[bench_num_counters];
+};
+
+/* Number of counters available */
+int  bench_counters_open(struct bench_counters *c);
+void bench_counters_read(const struct bench_counters *c, u_int64_t values[bench_num_counters]);
+void bench_counters_close(struct bench_counters *c);
+
+#endif /* _BENCH_H_ */
@@ -0,0 +1,97 @@
+/*
+ *
+ * Memory budget of pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "budget.h"
+
+static const char *policy_name[] = { "evict", "drop", "sketch" };
+
+/* *************************************** */
+
+int budget_parse(struct memory_budget *b, const char *arg) {
+  char *end;
+  u_int32_t i;
+
+  b->thread_cap = (u_int64_t)strtoul(arg, &end, 10) << 20;
+
+  if(*end == ':')
+    b->total_cap = (u_int64_t)strtoul(end + 1, &end, 10) << 20;
+
+  if(*end == ',') {
+    for(i = 0; i < sizeof(policy_name) / sizeof(policy_name[0]); i++)
+      if(!strcmp(end + 1, policy_name[i]))
+	break;
+
+    if(i == sizeof(policy_name) / sizeof(policy_name[0]))
+      return(-1);
+
+    b->policy = (budget_policy)i, end += strlen(end);
+  }
+
+  return((*end == '\0') ? 0 : -1);
+}
+
+/* *************************************** */
+
+const char* budget_policy_name(budget_policy policy) {
+  return(policy_name[policy]);
+}
+
+/* *************************************** */
+
+int budget_charge(struct memory_budget *b, struct budget_account *a, size_t len) {
+  if((b->thread_cap > 0) && (a->used + len > b->thread_cap)) {
+    a->refused++;
+    return(-1);
+  }
+
+  /* Add first: two owners racing for the last bytes cannot both get them */
+  if((__sync_add_and_fetch(&b->used, len) > b->total_cap) && (b->total_cap > 0)) {
+    __sync_sub_and_fetch(&b->used, len);
+    a->refused++;
+    return(-1);
+  }
+
+  a->used += len;
+  return(0);
+}
+
+/* *************************************** */
+
+void budget_force(struct memory_budget *b, struct budget_account *a, size_t len) {
+  __sync_add_and_fetch(&b->used, len);
+  a->used += len;
+}
+
+/* *************************************** */
+
+void budget_release(struct memory_budget *b, struct budget_account *a, size_t len) {
+  __sync_sub_and_fetch(&b->used, len);
+  a->used -= len;
+}
+
+/* *************************************** */
+
+u_int64_t budget_room(struct memory_budget *b, struct budget_account *a) {
+  u_int64_t room = (u_int64_t)-1, used = b->used, total_room;
+
+  if(b->thread_cap > 0)
+    room = (a->used < b->thread_cap) ? (b->thread_cap - a->used) : 0;
+
+  if(b->total_cap > 0) {
+    total_room = (used < b->total_cap) ? (b->total_cap - used) : 0;
+    if(total_room < room) room = total_room;
+  }
+
+  return(room);
+}
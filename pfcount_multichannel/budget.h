@@ -0,0 +1,75 @@
+/*
+ *
+ * Memory budget of pfcount_multichannel (-M <flows>,<MB>[:<total MB>][,<policy>]).
+ *
+ * The containers charge the memory they allocate to their owner (a capture
+ * thread, or the reporter for the victim summary) and to the process: the
+ * record pools and the counter carries as they grow, the flow table buckets
+ * once they have grown, the summary nodes. The fixed size structures (half-
+ * open connections, sketches, queues) are charged once, when they are set
+ * up, so that the totals are the whole footprint of the tables.
+ *
+ * A charge that would take its owner above the per thread cap, or the
+ * process above the total one, is refused and the container applies the
+ * policy to the flow that needed the memory:
+ *
+ * - evict:  the record of the least recently seen flow is reused (CLOCK)
+ * - drop:   no record, the packets are counted in the overflow bucket
+ * - sketch: drop, the packets being counted by the sketches of the thread
+ *           (-m sketch) too: the heavy victims are still reported
+ *
+ * The pools never give memory back (arena.h): the usage grows up to the
+ * caps, the records freed by aging being reused before a new block is
+ * charged. A hashdyn table doubles at once and may go past the cap by its
+ * growth; -T hashlin and -T open do not.
+ *
+ * Charges are done once per block, never per packet: a plain add on the
+ * account, written by its owner only, and an atomic one on the total.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+#include <sys/types.h>
+
+typedef enum {
+  budget_evict = 0,
+  budget_drop,
+  budget_sketch
+} budget_policy;
+
+struct memory_budget {
+  u_int64_t thread_cap, total_cap; /* bytes, 0 = no cap */
+  budget_policy policy;
+  volatile u_int64_t used;         /* all the accounts */
+};
+
+/* Of one owner: written by it only, read by the reporter */
+struct budget_account {
+  volatile u_int64_t used;
+  u_int64_t refused;               /* charges */
+};
+
+/* "<MB>[:<total MB>][,evict|drop|sketch]": returns 0, -1 on a syntax error */
+int budget_parse(struct memory_budget *b, const char *arg);
+const char* budget_policy_name(budget_policy policy);
+
+/* Charges len if it fits in both caps: returns 0, or -1 (nothing charged) */
+int  budget_charge(struct memory_budget *b, struct budget_account *a, size_t len);
+/* Charges len whatever the caps: fixed costs, memory already allocated */
+void budget_force(struct memory_budget *b, struct budget_account *a, size_t len);
+void budget_release(struct memory_budget *b, struct budget_account *a, size_t len);
+/* The largest charge that would fit now */
+u_int64_t budget_room(struct memory_budget *b, struct budget_account *a);
+
+static inline int budget_capped(const struct memory_budget *b) {
+  return((b->thread_cap > 0) || (b->total_cap > 0));
+}
+
+#endif /* _BUDGET_H_ */
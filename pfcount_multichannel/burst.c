@@ -0,0 +1,242 @@
+/*
+ *
+ * Microburst detection for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "burst.h"
+
+/* *************************************** */
+
+/* Capture thread side: once per ms and key */
+
+void burst_rotate(struct burst *b, struct burst_key *k, u_int64_t ms) {
+  u_int32_t interval = b->interval, pkts, window = 0, i;
+  struct burst_stats *s = &k->stats[interval & 1];
+  u_int64_t m;
+
+  if(s->interval != interval) {
+    memset(s, 0, sizeof(struct burst_stats));
+    s->interval = interval;
+  }
+
+  if((k->ms == 0) || (ms < k->ms)) {
+    /* First packet, or a clock that went back: a new ring */
+    memset(k->pkts, 0, sizeof(k->pkts));
+    memset(k->bytes, 0, sizeof(k->bytes));
+    k->run = 0, k->ms = ms;
+    return;
+  }
+
+  /* The bin of k->ms is complete */
+  pkts = k->pkts[k->ms & (BURST_BINS - 1)];
+  s->pkts += pkts;
+
+  if(pkts > s->peak_pkts)
+    s->peak_pkts = pkts, s->peak_at = k->ms;
+  if(k->bytes[k->ms & (BURST_BINS - 1)] > s->peak_bytes)
+    s->peak_bytes = k->bytes[k->ms & (BURST_BINS - 1)];
+
+  for(i = 0; i < BURST_WINDOW; i++)
+    window += k->pkts[(k->ms - i) & (BURST_BINS - 1)];
+  if(window > s->peak_window)
+    s->peak_window = window;
+
+  if(pkts >= b->threshold) {
+    if(k->run++ == 0) s->bursts++;
+    s->burst_ms++;
+    if(k->run > s->longest) s->longest = k->run;
+  } else
+    k->run = 0;
+
+  if(ms > k->ms + 1)
+    k->run = 0; /* ms without packets in between */
+
+  /* The bins of the ms since, the one of ms included: all of them after a longer silence */
+  for(m = k->ms + 1; (m <= ms) && (m <= k->ms + BURST_BINS); m++)
+    k->pkts[m & (BURST_BINS - 1)] = 0, k->bytes[m & (BURST_BINS - 1)] = 0;
+
+  k->ms = ms;
+}
+
+/* *************************************** */
+
+/* IPv6, or an IPv4 destination that is not the one of its slot */
+void burst_victim_slow(struct burst_thread *t, const struct pfring_pkthdr *h, u_int64_t ms) {
+  struct victim_key key;
+  struct burst_key *k;
+  u_int32_t hash;
+
+  memset(&key, 0, sizeof(key));
+  if(h->extended_hdr.parsed_pkt.eth_type == 0x0800) {
+    key.addr[0] = h->extended_hdr.parsed_pkt.ipv4_dst, key.version = 4;
+    hash = tommy_inthash_u32(key.addr[0]);
+  } else {
+    memcpy(key.addr, &h->extended_hdr.parsed_pkt.ipv6_dst, sizeof(key.addr));
+    key.version = 6;
+    hash = (u_int32_t)victim_hash(&key);
+  }
+
+  k = &t->victims[hash & (BURST_VICTIMS - 1)];
+
+  if(!victim_key_equal(&k->key, &key)) {
+    if((k->ms != 0) && (ms < k->ms + BURST_IDLE_MS)) {
+      t->untracked++;
+      return;
+    }
+
+    /* Free, or its destination is gone */
+    memset(k, 0, sizeof(struct burst_key));
+    k->key = key;
+  }
+
+  burst_add(t->burst, k, ms, h->len);
+}
+
+/* *************************************** */
+
+int burst_init(struct burst *b, u_int32_t threshold, u_int32_t num_threads) {
+  u_int32_t i;
+
+  memset(b, 0, sizeof(struct burst));
+  b->threshold = threshold, b->num_threads = num_threads;
+  b->interval = 1; /* the zeroed statistics belong to none */
+
+  if((b->thread = calloc(num_threads, sizeof(struct burst_thread))) == NULL)
+    return(-1);
+
+  for(i = 0; i < num_threads; i++) {
+    struct burst_thread *t = &b->thread[i];
+    void *mem;
+
+    if(posix_memalign(&mem, 64, BURST_VICTIMS * sizeof(struct burst_key)) != 0)
+      return(-1);
+
+    memset(mem, 0, BURST_VICTIMS * sizeof(struct burst_key)); /* no page faults while capturing */
+    t->burst = b, t->victims = mem;
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+void burst_term(struct burst *b) {
+  u_int32_t i;
+
+  if(b->thread == NULL)
+    return;
+
+  for(i = 0; i < b->num_threads; i++)
+    free(b->thread[i].victims);
+
+  free(b->thread);
+  b->thread = NULL;
+}
+
+/* *************************************** */
+
+struct burst_top {
+  const struct burst_key *key;
+  const struct burst_stats *stats;
+  u_int32_t thread;
+};
+
+static const struct burst_stats* burst_stats_of(const struct burst_key *k, u_int32_t interval) {
+  const struct burst_stats *s = &k->stats[interval & 1];
+
+  return(((s->interval == interval) && (s->pkts > 0)) ? s : NULL);
+}
+
+static char* burst_time(u_int64_t ms, char *buf, size_t len) {
+  time_t sec = ms / 1000;
+  struct tm tm;
+
+  strftime(buf, len, "%H:%M:%S", localtime_r(&sec, &tm));
+  snprintf(&buf[strlen(buf)], len - strlen(buf), ".%03u", (unsigned int)(ms % 1000));
+  return(buf);
+}
+
+static char* burst_addr(const struct victim_key *key, char *buf, size_t len) {
+  if(key->version == 4) {
+    u_int32_t a = htonl(key->addr[0]);
+
+    inet_ntop(AF_INET, &a, buf, len);
+  } else
+    inet_ntop(AF_INET6, key->addr, buf, len);
+
+  return(buf);
+}
+
+static void burst_print(FILE *out, const struct burst_stats *s) {
+  char when[32];
+
+  fprintf(out, "peak %u pkts/ms (%.1f Mbit/s) at %s, %u pkts/%u ms, %u bursts (%u ms, longest %u ms)\n",
+	  s->peak_pkts, s->peak_bytes * 8 / 1000.0, burst_time(s->peak_at, when, sizeof(when)),
+	  s->peak_window, BURST_WINDOW, s->bursts, s->burst_ms, s->longest);
+}
+
+/* *************************************** */
+
+void burst_report(struct burst *b, FILE *out) {
+  struct burst_top top[BURST_TOP];
+  u_int32_t interval = b->interval, i, j, n = 0, peaks = 0;
+  u_int64_t untracked = 0;
+  char addr[INET6_ADDRSTRLEN];
+
+  b->interval = interval + 1;
+  __sync_synchronize();
+
+  for(i = 0; i < b->num_threads; i++)
+    untracked += b->thread[i].untracked;
+  untracked -= b->reported_untracked, b->reported_untracked += untracked;
+
+  fprintf(out, "Microbursts: [>= %u pkts/ms per channel][%llu pkts of untracked destinations]\n",
+	  b->threshold, (unsigned long long)untracked);
+
+  for(i = 0; i < b->num_threads; i++) {
+    const struct burst_thread *t = &b->thread[i];
+    const struct burst_stats *s;
+
+    if((s = burst_stats_of(&t->link, interval)) != NULL) {
+      fprintf(out, "  channel %-2u ", i);
+      burst_print(out, s);
+      peaks += s->peak_pkts;
+    }
+
+    /* The destinations that went above the threshold, by 1 ms peak */
+    for(j = 0; j < BURST_VICTIMS; j++) {
+      u_int32_t k;
+
+      if(((s = burst_stats_of(&t->victims[j], interval)) == NULL) || (s->bursts == 0))
+	continue;
+
+      for(k = n; (k > 0) && (top[k - 1].stats->peak_pkts < s->peak_pkts); k--)
+	if(k < BURST_TOP) top[k] = top[k - 1];
+
+      if(k < BURST_TOP) {
+	top[k].key = &t->victims[j], top[k].stats = s, top[k].thread = i;
+	if(n < BURST_TOP) n++;
+      }
+    }
+  }
+
+  if(b->num_threads > 1)
+    fprintf(out, "  link: up to %u pkts/ms (sum of the channel peaks)\n", peaks);
+
+  for(i = 0; i < n; i++) {
+    fprintf(out, "  %-15s channel %-2u ", burst_addr(&top[i].key->key, addr, sizeof(addr)), top[i].thread);
+    burst_print(out, top[i].stats);
+  }
+}
@@ -0,0 +1,120 @@
+/*
+ *
+ * Microburst detection for pfcount_multichannel (-j burst:<pkts/ms>), at
+ * 1 ms resolution on the packet timestamps (extended_hdr.timestamp_ns, the
+ * NIC or the kernel time: the rings are not put in coarse timestamp mode).
+ *
+ * The per second rates of print_stats() hide the pulse wave attacks, that
+ * fill a link for 10-50 ms at a time. Each capture thread tracks its
+ * channel of the link and up to BURST_VICTIMS destinations (direct mapped
+ * by address hash: an idle destination gives its slot up to the next one)
+ * with a ring of BURST_BINS 1 ms bins each. A packet increments the bin of
+ * its ms; when the ms changes the ring is rotated, on the next packet of
+ * the key only: the closed bin goes into the statistics of the report
+ * interval (peak pkts and bytes in 1 ms, peak over BURST_WINDOW ms, bursts:
+ * runs of ms with at least <pkts/ms> packets) and the bins of the ms
+ * without packets are cleared.
+ *
+ * The statistics are kept for the current and the previous report
+ * interval, tagged with it: the reporter starts a new interval, then reads
+ * the previous one of every key, without a lock (the ms closed while the
+ * interval changes may land in either).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _BURST_H_
+#define _BURST_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "pfring.h"
+#include "victims.h"
+
+#define BURST_BINS          16    /* 1 ms bins per key, power of 2 */
+#define BURST_WINDOW        10    /* ms, <= BURST_BINS: the sustained peak */
+#define BURST_VICTIMS       1024  /* destinations per thread, power of 2 */
+#define BURST_IDLE_MS       1000  /* a destination silent for longer gives its slot up */
+#define BURST_TOP           10
+
+struct burst_stats {
+  u_int32_t interval;                /* of the reporter */
+  u_int32_t peak_pkts, peak_bytes;   /* in 1 ms */
+  u_int32_t peak_window;             /* pkts in BURST_WINDOW ms */
+  u_int32_t bursts, burst_ms, longest; /* ms at or above the threshold: runs, total, longest run */
+  u_int64_t peak_at;                 /* ms */
+  u_int64_t pkts;
+};
+
+struct burst_key {
+  struct victim_key key;             /* destinations only */
+  u_int64_t ms;                      /* of the current bin, 0 = free slot */
+  u_int32_t run;                     /* ms at or above the threshold, up to the last closed one */
+  u_int32_t pkts[BURST_BINS], bytes[BURST_BINS];
+  struct burst_stats stats[2];       /* by interval parity */
+};
+
+struct burst_thread {
+  struct burst *burst;
+  struct burst_key link;
+  struct burst_key *victims;         /* BURST_VICTIMS */
+  u_int64_t untracked;               /* pkts: the slot of their destination was busy */
+};
+
+struct burst {
+  u_int32_t threshold;               /* pkts/ms */
+  volatile u_int32_t interval;       /* bumped by the reporter */
+  u_int32_t num_threads;
+  struct burst_thread *thread;
+  u_int64_t reported_untracked;      /* reporter */
+};
+
+int  burst_init(struct burst *b, u_int32_t threshold, u_int32_t num_threads);
+void burst_term(struct burst *b);
+/* Reporter: starts a new interval, then prints the link and the top destinations of the previous one */
+void burst_report(struct burst *b, FILE *out);
+
+void burst_rotate(struct burst *b, struct burst_key *k, u_int64_t ms);
+void burst_victim_slow(struct burst_thread *t, const struct pfring_pkthdr *h, u_int64_t ms);
+
+static inline u_int64_t burst_ms(const struct pfring_pkthdr *h) {
+  if(h->extended_hdr.timestamp_ns != 0)
+    return(h->extended_hdr.timestamp_ns / 1000000);
+
+  return((u_int64_t)h->ts.tv_sec * 1000 + h->ts.tv_usec / 1000);
+}
+
+static inline void burst_add(struct burst *b, struct burst_key *k, u_int64_t ms, u_int32_t len) {
+  if(unlikely(ms != k->ms))
+    burst_rotate(b, k, ms);
+
+  k->pkts[ms & (BURST_BINS - 1)]++, k->bytes[ms & (BURST_BINS - 1)] += len;
+}
+
+/* Capture thread: the bin of the channel, and of the destination of the IPv4 packets on their own */
+static inline void burst_packet(struct burst_thread *t, const struct pfring_pkthdr *h) {
+  u_int64_t ms = burst_ms(h);
+  struct burst_key *k;
+
+  burst_add(t->burst, &t->link, ms, h->len);
+
+  if(h->extended_hdr.parsed_pkt.eth_type == 0x0800) {
+    u_int32_t dst = h->extended_hdr.parsed_pkt.ipv4_dst;
+
+    k = &t->victims[tommy_inthash_u32(dst) & (BURST_VICTIMS - 1)];
+    if(likely((k->key.addr[0] == dst) && (k->key.version == 4))) {
+      burst_add(t->burst, k, ms, h->len);
+      return;
+    }
+  } else if(h->extended_hdr.parsed_pkt.eth_type != 0x86DD)
+    return;
+
+  burst_victim_slow(t, h, ms);
+}
+
+#endif /* _BURST_H_ */
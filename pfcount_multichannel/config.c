@@ -0,0 +1,128 @@
+/*
+ *
+ * Runtime settings of pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "config.h"
+
+struct detector_config * volatile config_current = NULL;
+static struct detector_config *retired = NULL;
+
+/* *************************************** */
+
+static int parse_u32(const char *value, u_int32_t *out) {
+  char *end;
+  unsigned long v = strtoul(value, &end, 10);
+
+  if((end == value) || (*end != '\0') || (v > 0xFFFFFFFFUL))
+    return(-1);
+
+  *out = (u_int32_t)v;
+  return(0);
+}
+
+/* *************************************** */
+
+static int parse_string(const char *value, char *out, size_t len) {
+  if(strlen(value) >= len)
+    return(-1);
+
+  if(!strcmp(value, "none"))
+    out[0] = '\0';
+  else
+    strcpy(out, value);
+
+  return(0);
+}
+
+/* *************************************** */
+
+int config_load(struct detector_config *c, const char *path, char *error, size_t error_len) {
+  char line[512], *name, *value, *end;
+  u_int32_t line_num = 0;
+  FILE *fd;
+  int rc = 0;
+
+  if((fd = fopen(path, "r")) == NULL) {
+    snprintf(error, error_len, "unable to open the file");
+    return(-1);
+  }
+
+  while((rc == 0) && (fgets(line, sizeof(line), fd) != NULL)) {
+    line_num++;
+
+    if((end = strchr(line, '#')) != NULL) *end = '\0';
+    for(end = line + strlen(line); (end > line) && isspace((unsigned char)end[-1]); end--) ;
+    *end = '\0';
+
+    for(name = line; isspace((unsigned char)*name); name++) ;
+    if(*name == '\0') continue;
+
+    for(value = name; (*value != '\0') && !isspace((unsigned char)*value); value++) ;
+    if(*value != '\0') *value++ = '\0';
+    while(isspace((unsigned char)*value)) value++;
+
+    if(!strcmp(name, "flow_idle_timeout"))       rc = parse_u32(value, &c->flow_idle_timeout);
+    else if(!strcmp(name, "max_flows"))          rc = parse_u32(value, &c->max_flows_per_thread);
+    else if(!strcmp(name, "scrub_rate"))         rc = parse_u32(value, &c->scrub_rate_pps);
+    else if(!strcmp(name, "scrub_drop"))         rc = parse_u32(value, &c->scrub_drop_pps);
+    else if(!strcmp(name, "drop_threshold"))     rc = parse_u32(value, &c->drop_threshold);
+    else if(!strcmp(name, "drop_rules_per_sec")) rc = parse_u32(value, &c->drop_rules_per_sec);
+    else if(!strcmp(name, "anomaly_sigmas"))     rc = parse_u32(value, &c->anomaly_sigmas);
+    else if(!strcmp(name, "anomaly_min_pps"))    rc = parse_u32(value, &c->anomaly_min_pps);
+    else if(!strcmp(name, "bpf"))                rc = parse_string(value, c->bpf_filter, sizeof(c->bpf_filter));
+    else if(!strcmp(name, "export"))             rc = parse_string(value, c->export_name, sizeof(c->export_name));
+    else {
+      snprintf(error, error_len, "line %u: unknown setting '%s'", line_num, name);
+      fclose(fd);
+      return(-1);
+    }
+
+    if(rc != 0)
+      snprintf(error, error_len, "line %u: invalid value for '%s'", line_num, name);
+  }
+
+  fclose(fd);
+  return(rc);
+}
+
+/* *************************************** */
+
+void config_publish(struct detector_config *c) {
+  struct detector_config *old = config_current;
+
+  c->generation = (old != NULL) ? old->generation + 1 : 0;
+  c->retired_next = NULL;
+  __sync_synchronize(); /* c is complete before it can be seen */
+  config_current = c;
+  __sync_synchronize(); /* pairs with config_acquire(): hazards are read after the store */
+
+  if(old != NULL)
+    old->retired_next = retired, retired = old;
+}
+
+/* *************************************** */
+
+void config_reclaim(int (*in_use)(const struct detector_config *c)) {
+  struct detector_config **prev = &retired, *c;
+
+  while((c = *prev) != NULL) {
+    if(in_use(c))
+      prev = &c->retired_next;
+    else {
+      *prev = c->retired_next;
+      free(c);
+    }
+  }
+}
@@ -0,0 +1,78 @@
+/*
+ *
+ * Runtime settings of pfcount_multichannel (-o), reloaded on SIGHUP.
+ *
+ * A reload builds a new detector_config from the command line values and
+ * the settings file, then publishes it with a single pointer store: a
+ * published config is never modified. Capture threads compare their
+ * config pointer with config_current at batch boundaries (one load of a
+ * read-mostly line, no lock) and switch with config_acquire(). The
+ * pointer a thread stores there is its hazard pointer: config_reclaim()
+ * only frees a replaced config once no thread points to it any more.
+ *
+ * Settings file: "name value" per line, '#' comments.
+ *   flow_idle_timeout <sec>      0 = never
+ *   max_flows <flows>            per thread, 0 = table capacity
+ *   scrub_rate <pps>             -F, all the channels
+ *   scrub_drop <pps>             -F, all the channels, 0 = never drop
+ *   drop_threshold <pps>         victims above it get a drop rule, 0 = off
+ *   drop_rules_per_sec <rules>
+ *   anomaly_sigmas <k>           -z: deviation of a baseline reported, 0 = off
+ *   anomaly_min_pps <pps>        -z: destinations below it are not reported
+ *   bpf <filter>                 the rest of the line, "none" = no filter
+ *   export <name>                shared memory segment, "none" = no export
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _CONFIG_H_
+#define _CONFIG_H_
+
+#include <sys/types.h>
+
+#define CONFIG_BPF_LEN   256
+#define CONFIG_NAME_LEN  64
+
+struct detector_config {
+  /* Capture threads */
+  u_int32_t flow_idle_timeout;
+  u_int32_t max_flows_per_thread;
+  u_int32_t scrub_rate_pps, scrub_drop_pps;
+  /* Reporter */
+  u_int32_t drop_threshold, drop_rules_per_sec;
+  u_int32_t anomaly_sigmas, anomaly_min_pps;
+  char bpf_filter[CONFIG_BPF_LEN];   /* "" = none */
+  char export_name[CONFIG_NAME_LEN]; /* "" = none */
+
+  u_int32_t generation;
+  struct detector_config *retired_next;
+};
+
+extern struct detector_config * volatile config_current;
+
+/* Settings of 'path' applied over *c: returns 0, or -1 with the reason in 'error' */
+int config_load(struct detector_config *c, const char *path, char *error, size_t error_len);
+
+/* Reporter: c (malloc()ed) replaces config_current, which is retired */
+void config_publish(struct detector_config *c);
+/* Reporter: frees the retired configs for which in_use() is false */
+void config_reclaim(int (*in_use)(const struct detector_config *c));
+
+/* Capture thread: the current config, *hazard then points to it */
+static inline const struct detector_config* config_acquire(const struct detector_config * volatile *hazard) {
+  struct detector_config *c;
+
+  do {
+    c = config_current;
+    *hazard = c;
+    __sync_synchronize(); /* the store is visible before config_current is read again */
+  } while(c != config_current);
+
+  return(c);
+}
+
+#endif /* _CONFIG_H_ */
@@ -0,0 +1,163 @@
+/*
+ *
+ * Half-open TCP connection tracking for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "conn_table.h"
+
+#include "../tommyds-1.0/tommyhash.h"
+
+#define CONN_STATE(e)       ((e)->meta & 3)
+#define CONN_LAST_SEEN(e)   ((e)->meta >> 2)
+#define CONN_META(s, now)   (((u_int32_t)(now) << 2) | (s))
+#define CONN_AGE(e, now)    ((((u_int32_t)(now)) - CONN_LAST_SEEN(e)) & 0x3FFFFFFF) /* 30 bit clock */
+
+/* *************************************** */
+
+static u_int32_t num_buckets(u_int32_t capacity) {
+  if(capacity < (16 * CONN_BUCKET_SIZE)) capacity = 16 * CONN_BUCKET_SIZE;
+  if(capacity > (1U << 30)) capacity = 1U << 30;
+
+  return(tommy_roundup_pow2_u32(capacity) / CONN_BUCKET_SIZE);
+}
+
+/* *************************************** */
+
+size_t conn_table_memory_size(u_int32_t capacity) {
+  return((size_t)num_buckets(capacity) * CONN_BUCKET_SIZE * sizeof(struct conn_entry));
+}
+
+/* *************************************** */
+
+/* 'mem' (64 bytes aligned, conn_table_memory_size() bytes) may be NULL: the table allocates it */
+int conn_table_init(struct conn_table *t, u_int32_t capacity, u_int32_t idle_timeout, void *mem) {
+  size_t size = conn_table_memory_size(capacity);
+
+  memset(t, 0, sizeof(struct conn_table));
+
+  if(mem == NULL) {
+    if(posix_memalign(&mem, 64, size) != 0)
+      return(-1);
+    t->own_memory = 1;
+  }
+
+  memset(mem, 0, size);
+  t->entries = mem;
+  t->bucket_mask = num_buckets(capacity) - 1;
+  t->idle_timeout = idle_timeout;
+  return(0);
+}
+
+/* *************************************** */
+
+void conn_table_done(struct conn_table *t) {
+  if(t->own_memory) free(t->entries);
+  memset(t, 0, sizeof(struct conn_table));
+}
+
+/* *************************************** */
+
+static inline int expired(struct conn_table *t, struct conn_entry *e, u_int32_t now) {
+  return((t->idle_timeout > 0) && (CONN_AGE(e, now) > t->idle_timeout));
+}
+
+/* *************************************** */
+
+int conn_table_event(struct conn_table *t, u_int32_t saddr, u_int32_t daddr,
+		     u_int16_t sport, u_int16_t dport, conn_event event, u_int32_t now) {
+  const u_int32_t key[3] = { saddr, daddr, ((u_int32_t)sport << 16) | dport };
+  u_int64_t hash = tommy_hash_u64_fixed(0, key, sizeof(key));
+  struct conn_entry *bucket = &t->entries[(hash & t->bucket_mask) * CONN_BUCKET_SIZE];
+  struct conn_entry *e, *match = NULL, *free_entry = NULL, *oldest = NULL;
+  int delta = 0, i;
+
+  for(i = 0; i < CONN_BUCKET_SIZE; i++) {
+    e = &bucket[i];
+
+    if((CONN_STATE(e) != 0) && expired(t, e, now))
+      e->meta = 0, t->count--, delta--;
+
+    if(CONN_STATE(e) == 0) {
+      if(free_entry == NULL) free_entry = e;
+    } else if((e->saddr == saddr) && (e->daddr == daddr) && (e->sport == sport) && (e->dport == dport)) {
+      match = e;
+      break;
+    } else if((oldest == NULL) || (CONN_AGE(e, now) > CONN_AGE(oldest, now)))
+      oldest = e;
+  }
+
+  if(match != NULL) {
+    switch(event) {
+    case conn_syn: /* retransmission, or a new attempt after a SYN+ACK */
+      match->meta = CONN_META(conn_syn, now);
+      break;
+    case conn_synack:
+      match->meta = CONN_META(conn_synack, now);
+      break;
+    case conn_ack:
+      if(CONN_STATE(match) == conn_synack) {
+	match->meta = 0, t->count--, delta--; /* established */
+      } else
+	match->meta = CONN_META(CONN_STATE(match), now);
+      break;
+    }
+  } else if(event == conn_syn) {
+    if((e = free_entry) == NULL) {
+      e = oldest; /* bucket full */
+      t->count--, delta--, t->evicted++;
+    }
+
+    e->saddr = saddr, e->daddr = daddr, e->sport = sport, e->dport = dport;
+    e->meta = CONN_META(conn_syn, now);
+    t->count++, delta++;
+  }
+
+  return(delta);
+}
+
+/* *************************************** */
+
+/* Expire the idle entries of the next bucket */
+int conn_table_age(struct conn_table *t, u_int32_t now) {
+  struct conn_entry *bucket;
+  int delta = 0, i;
+
+  if(t->idle_timeout == 0)
+    return(0);
+
+  bucket = &t->entries[t->sweep * CONN_BUCKET_SIZE];
+  t->sweep = (t->sweep + 1) & t->bucket_mask;
+
+  for(i = 0; i < CONN_BUCKET_SIZE; i++)
+    if((CONN_STATE(&bucket[i]) != 0) && expired(t, &bucket[i], now))
+      bucket[i].meta = 0, t->count--, delta--;
+
+  return(delta);
+}
+
+/* *************************************** */
+
+/* The bucket of an entry only depends on its 4-tuple: the array is copied as is */
+int conn_table_restore(struct conn_table *t, const struct conn_entry *entries, u_int64_t num_entries) {
+  u_int32_t i;
+
+  if(num_entries != conn_table_num_entries(t))
+    return(-1);
+
+  memcpy(t->entries, entries, num_entries * sizeof(struct conn_entry));
+
+  for(i = 0, t->count = 0; i < num_entries; i++)
+    if(CONN_STATE(&t->entries[i]) != 0)
+      t->count++;
+
+  return(t->count);
+}
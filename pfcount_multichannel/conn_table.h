@@ -0,0 +1,64 @@
+/*
+ *
+ * Half-open TCP connection tracking for pfcount_multichannel.
+ *
+ * A per-thread, fixed-size table keyed by the 4-tuple of the client side
+ * (the SYN sender). Entries are 16 bytes and grouped in buckets of one
+ * cache line: a lookup probes a single bucket, so a TCP control packet
+ * costs at most one cache miss. A full bucket recycles its least recently
+ * seen entry; idle entries are expired while probing and by a sweep that
+ * visits one bucket per packet. Completed handshakes leave the table.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _CONN_TABLE_H_
+#define _CONN_TABLE_H_
+
+#include <sys/types.h>
+
+#define CONN_BUCKET_SIZE  4 /* entries per 64 bytes bucket */
+
+typedef enum {
+  conn_syn = 1,    /* SYN seen */
+  conn_synack = 2, /* SYN+ACK seen, waiting for the ACK */
+  conn_ack = 3     /* event only: completes the handshake */
+} conn_event;
+
+struct conn_entry {
+  u_int32_t saddr, daddr;
+  u_int16_t sport, dport;
+  u_int32_t meta; /* state (2 bits, 0 = free) | last seen sec << 2 */
+};
+
+struct conn_table {
+  struct conn_entry *entries;
+  u_int32_t bucket_mask;
+  u_int32_t count;        /* half-open connections tracked */
+  u_int32_t idle_timeout; /* sec, 0 = never expire */
+  u_int32_t sweep;        /* next bucket visited by conn_table_age() */
+  u_int64_t evicted;      /* half-open entries recycled because their bucket was full */
+  u_int8_t  own_memory;
+};
+
+size_t conn_table_memory_size(u_int32_t capacity);
+int  conn_table_init(struct conn_table *t, u_int32_t capacity, u_int32_t idle_timeout, void *mem);
+void conn_table_done(struct conn_table *t);
+
+/* Both return the change in the number of half-open connections */
+int  conn_table_event(struct conn_table *t, u_int32_t saddr, u_int32_t daddr,
+		      u_int16_t sport, u_int16_t dport, conn_event event, u_int32_t now);
+int  conn_table_age(struct conn_table *t, u_int32_t now);
+
+static inline u_int32_t conn_table_num_entries(const struct conn_table *t) {
+  return((t->bucket_mask + 1) * CONN_BUCKET_SIZE);
+}
+
+/* Entries of a table of the same size (snapshot.h): returns the half-open connections, -1 on a mismatch */
+int  conn_table_restore(struct conn_table *t, const struct conn_entry *entries, u_int64_t num_entries);
+
+#endif /* _CONN_TABLE_H_ */
@@ -0,0 +1,235 @@
+/*
+ *
+ * Per-customer traffic for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "../tommyds-1.0/tommytopk.h"
+#include "mitigation.h"
+#include "customers.h"
+
+/* *************************************** */
+
+/* Not counted in c->num until a prefix is added */
+static struct customer* new_customer(struct customers *c, const char *name) {
+  struct customer *cust = &c->customer[c->num];
+
+  /* Only shown: names are checked by add_prefix(), the prefix text may be cut */
+  snprintf(cust->name, sizeof(cust->name), "%.*s", CUSTOMER_NAME_LEN - 1, name);
+  cust->id = c->num;
+  return(cust);
+}
+
+/* *************************************** */
+
+static struct customer* customer_by_name(struct customers *c, const char *name) {
+  u_int32_t i;
+
+  for(i = 0; i < c->num; i++)
+    if(!strcmp(c->customer[i].name, name))
+      return(&c->customer[i]);
+
+  return(new_customer(c, name));
+}
+
+/* *************************************** */
+
+static int add_prefix(struct customers *c, char *line) {
+  struct pfring_blocklist_prefix p;
+  struct customer_prefix *prefix = &c->prefix[c->num_prefixes];
+  struct customer *cust;
+  char *name = line + strcspn(line, " \t");
+  int rc;
+
+  if(*name != '\0') {
+    *name++ = '\0';
+    name += strspn(name, " \t");
+  }
+
+  /* Stored as is and looked up by: a cut name would not match its own entry */
+  if(strlen(name) >= CUSTOMER_NAME_LEN) {
+    errno = ENAMETOOLONG;
+    return(-1);
+  }
+
+  if(mitigation_parse_prefix(line, &p) != 0) {
+    errno = EINVAL;
+    return(-1);
+  }
+
+  /* A line without a name is a customer of its own (a duplicate prefix is rejected below) */
+  cust = (*name != '\0') ? customer_by_name(c, name) : new_customer(c, line);
+
+  memset(&prefix->node, 0, sizeof(prefix->node));
+  if(p.ip_version == 4) {
+    u_int32_t addr = htonl(p.addr.v4);
+
+    rc = tommy_lpm_insert(&c->v4, &prefix->node, cust, &addr, p.prefix_len);
+  } else
+    rc = tommy_lpm_insert(&c->v6, &prefix->node, cust, &p.addr.v6, p.prefix_len);
+
+  if(rc != 0) {
+    errno = EEXIST;
+    return(-1);
+  }
+
+  if(cust->num_prefixes++ == 0) c->num++;
+  c->num_prefixes++;
+  return(0);
+}
+
+/* *************************************** */
+
+int customers_load(struct customers *c, const char *path) {
+  u_int32_t size = 0, line_id = 0;
+  char line[256];
+  FILE *fd;
+
+  memset(c, 0, sizeof(struct customers));
+
+  if((fd = fopen(path, "r")) == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+    return(-1);
+  }
+
+  /* Counted first: the tries keep pointers to the customers */
+  while(fgets(line, sizeof(line), fd) != NULL)
+    size++;
+
+  if((size > 0)
+     && ((posix_memalign((void**)&c->customer, 64, size * sizeof(struct customer)) != 0)
+	 || ((c->prefix = calloc(size, sizeof(struct customer_prefix))) == NULL))) {
+    free(c->customer);
+    fclose(fd);
+    return(-1);
+  }
+
+  if(size > 0)
+    memset(c->customer, 0, size * sizeof(struct customer));
+
+  tommy_lpm_init(&c->v4, 32);
+  tommy_lpm_init(&c->v6, 128);
+
+  rewind(fd);
+  while((c->num_prefixes < size) && (fgets(line, sizeof(line), fd) != NULL)) {
+    char *s = line, *e;
+
+    line_id++;
+
+    if((e = strchr(s, '#')) != NULL) *e = '\0';
+    while((*s == ' ') || (*s == '\t')) s++;
+    for(e = s + strlen(s); (e > s) && ((e[-1] == ' ') || (e[-1] == '\t') || (e[-1] == '\r') || (e[-1] == '\n')); e--) ;
+    *e = '\0';
+
+    if(*s == '\0')
+      continue;
+
+    if(add_prefix(c, s) != 0) {
+      if(errno == ENAMETOOLONG)
+	fprintf(stderr, "%s:%u: customer name longer than %u characters, skipped\n",
+		path, line_id, CUSTOMER_NAME_LEN - 1);
+      else
+	fprintf(stderr, "%s:%u: invalid or duplicate prefix, skipped\n", path, line_id);
+    }
+  }
+
+  fclose(fd);
+  return(c->num);
+}
+
+/* *************************************** */
+
+void customers_done(struct customers *c) {
+  tommy_lpm_done(&c->v4);
+  tommy_lpm_done(&c->v6);
+  free(c->customer);
+  free(c->prefix);
+}
+
+/* *************************************** */
+
+void customers_collect(struct customers *c, struct customer_counters * const *counters, u_int32_t num_threads,
+		       u_int32_t now) {
+  u_int32_t i, t, d, k;
+
+  for(i = 0; i < c->num; i++) {
+    struct customer *cust = &c->customer[i];
+
+    cust->last = cust->total;
+    memset(&cust->total, 0, sizeof(cust->total));
+
+    /* Racy reads of counters that only grow: at worst a few packets late */
+    for(t = 0; t < num_threads; t++) {
+      const struct customer_counters *b;
+
+      if(counters[t] == NULL) continue;
+
+      b = &counters[t][i];
+      for(d = 0; d < NUM_CUSTOMER_DIRS; d++)
+	for(k = 0; k < 4; k++)
+	  cust->total.pkts[d][k] += b->pkts[d][k], cust->total.bytes[d][k] += b->bytes[d][k];
+      cust->total.syns += b->syns;
+    }
+  }
+
+  c->elapsed = c->collected ? now - c->collected : 0;
+  c->collected = now;
+}
+
+/* *************************************** */
+
+u_int64_t customers_delta_pkts(const struct customer *cust, customer_dir dir) {
+  u_int64_t n = 0;
+  u_int32_t k;
+
+  for(k = 0; k < 4; k++)
+    n += cust->total.pkts[dir][k] - cust->last.pkts[dir][k];
+
+  return(n);
+}
+
+u_int64_t customers_delta_bytes(const struct customer *cust, customer_dir dir) {
+  u_int64_t n = 0;
+  u_int32_t k;
+
+  for(k = 0; k < 4; k++)
+    n += cust->total.bytes[dir][k] - cust->last.bytes[dir][k];
+
+  return(n);
+}
+
+/* *************************************** */
+
+u_int32_t customers_top(struct customers *c, struct customer **top, u_int32_t max) {
+  tommy_topk heaviest;
+  u_int32_t num, i;
+
+  tommy_topk_init(&heaviest, max);
+
+  for(i = 0; i < c->num; i++) {
+    struct customer *cust = &c->customer[i];
+    u_int64_t pkts = customers_delta_pkts(cust, customer_in);
+
+    if(pkts > 0)
+      tommy_topk_insert(&heaviest, cust, pkts);
+  }
+
+  num = tommy_topk_sort(&heaviest);
+
+  for(i = 0; i < num; i++)
+    top[i] = tommy_topk_get(&heaviest, i);
+
+  tommy_topk_done(&heaviest);
+  return(num);
+}
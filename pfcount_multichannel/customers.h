@@ -0,0 +1,120 @@
+/*
+ *
+ * Per-customer traffic for pfcount_multichannel (-X).
+ *
+ * The protected customers are lists of IPv4/IPv6 prefixes, the lines of
+ * the same name making one customer, stored in two longest prefix match
+ * tries (tommy_lpm): an address belongs to the customer of its longest
+ * prefix, whatever the number of prefixes, with at most three reads of
+ * the trie for IPv4.
+ *
+ * Each capture thread looks up the destination (in) and the source (out)
+ * of its packets and counts them in its own block of customer_counters
+ * per customer, cache line aligned, written by that thread only. The
+ * reporter sums the blocks of the threads: a report costs
+ * O(customers x threads) whatever the number of flows or destinations.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _CUSTOMERS_H_
+#define _CUSTOMERS_H_
+
+#include <sys/types.h>
+
+#include "../tommyds-1.0/tommylpm.h"
+
+#define CUSTOMER_NAME_LEN  32
+
+typedef enum {
+  customer_in = 0, /* to the customer's prefixes */
+  customer_out,    /* from them */
+  NUM_CUSTOMER_DIRS
+} customer_dir;
+
+/* Per thread and customer, since start: TCP, UDP, ICMP, others */
+struct customer_counters {
+  u_int64_t pkts[NUM_CUSTOMER_DIRS][4], bytes[NUM_CUSTOMER_DIRS][4];
+  u_int64_t syns; /* in */
+} __attribute__((aligned(64)));
+
+struct customer {
+  char name[CUSTOMER_NAME_LEN];      /* the prefix when the line has no name, cut to fit */
+  u_int32_t id, num_prefixes;
+  /* Reporter only: sums over the threads at the last two customers_collect() */
+  struct customer_counters total, last;
+};
+
+struct customer_prefix {
+  tommy_lpm_node node;               /* data: the struct customer */
+};
+
+struct customers {
+  tommy_lpm v4, v6;
+  struct customer *customer;
+  struct customer_prefix *prefix;
+  u_int32_t num, num_prefixes;
+  u_int32_t collected, elapsed;      /* sec, of the last customers_collect() and since the previous one */
+};
+
+/* "addr/len [name]" per line (IPv4 or IPv6, '#' comments): returns the number of customers or -1 */
+int customers_load(struct customers *c, const char *path);
+void customers_done(struct customers *c);
+
+/* Of the blocks of a capture thread, for customers_count(), zeroed and 64 byte aligned */
+static inline size_t customers_counters_size(const struct customers *c) {
+  return((size_t)c->num * sizeof(struct customer_counters));
+}
+
+/* The customer of the longest prefix containing the address, NULL if none */
+static inline struct customer* customers_find_v4(struct customers *c, u_int32_t addr /* host byte order */) {
+  return(tommy_lpm_search_u32(&c->v4, addr));
+}
+
+static inline struct customer* customers_find_v6(struct customers *c, const void *addr /* network byte order */) {
+  return(tommy_lpm_search(&c->v6, addr));
+}
+
+static inline u_int32_t customers_proto_class(u_int8_t proto) {
+  switch(proto) {
+  case 0x06: return(0);
+  case 0x11: return(1);
+  case 0x01:
+  case 0x3A: return(2);
+  default:   return(3);
+  }
+}
+
+/* Capture thread: a packet from src to dst (either NULL when outside the customers) */
+static inline void customers_count(struct customer_counters *counters, const struct customer *src,
+				   const struct customer *dst, u_int8_t proto, u_int8_t tcp_flags, u_int32_t len) {
+  u_int32_t cls = customers_proto_class(proto);
+
+  if(dst != NULL) {
+    struct customer_counters *b = &counters[dst->id];
+
+    b->pkts[customer_in][cls]++, b->bytes[customer_in][cls] += len;
+    b->syns += (proto == 0x06) && ((tcp_flags & 0x12) == 0x02); /* SYN without ACK */
+  }
+
+  if(src != NULL) {
+    struct customer_counters *b = &counters[src->id];
+
+    b->pkts[customer_out][cls]++, b->bytes[customer_out][cls] += len;
+  }
+}
+
+/* Reporter: sums the blocks of the num_threads threads (NULL: thread not running) at 'now' */
+void customers_collect(struct customers *c, struct customer_counters * const *counters, u_int32_t num_threads,
+		       u_int32_t now);
+/* Traffic of a customer between the last two customers_collect() */
+u_int64_t customers_delta_pkts(const struct customer *cust, customer_dir dir);
+u_int64_t customers_delta_bytes(const struct customer *cust, customer_dir dir);
+/* The 'max' customers receiving the most packets since the previous collection: returns how many were found */
+u_int32_t customers_top(struct customers *c, struct customer **top, u_int32_t max);
+
+#endif /* _CUSTOMERS_H_ */
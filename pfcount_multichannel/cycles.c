@@ -0,0 +1,61 @@
+/*
+ *
+ * Per-stage cycle accounting for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include "cycles.h"
+
+static const char *stage_name[num_cycle_stages] = { "ring", "lookup", "alloc", "syn", "stats" };
+
+/* *************************************** */
+
+const char* cycle_stage_name(cycle_stage stage) {
+  return(stage_name[stage]);
+}
+
+/* *************************************** */
+
+/* Upper bound of the bucket holding the q-th quantile of the samples */
+static u_int64_t hist_quantile(const u_int64_t *hist, double q) {
+  u_int64_t tot = 0, sum = 0;
+  int i;
+
+  for(i = 0; i < CYCLE_HIST_BUCKETS; i++) tot += hist[i];
+  if(tot == 0) return(0);
+
+  for(i = 0; i < CYCLE_HIST_BUCKETS; i++) {
+    sum += hist[i];
+    if(sum >= q * tot) break;
+  }
+
+  return(1ULL << ((i < CYCLE_HIST_BUCKETS) ? i : (CYCLE_HIST_BUCKETS - 1)));
+}
+
+/* *************************************** */
+
+void cycle_stats_print(FILE *out, int channel, const struct cycle_stats *cs) {
+  u_int64_t tot = 0;
+  int s;
+
+  for(s = 0; s < num_cycle_stages; s++) tot += cs->cycles[s];
+  if(tot == 0) return;
+
+  fprintf(out, "Cycles: [channel=%d]", channel);
+
+  for(s = 0; s < num_cycle_stages; s++) {
+    if(cs->calls[s] == 0) continue;
+
+    fprintf(out, "[%s %.1f%% %.0f/call p50<%llu p99<%llu]", stage_name[s],
+	    (cs->cycles[s] * 100.0) / tot, (double)cs->cycles[s] / cs->calls[s],
+	    (unsigned long long)hist_quantile(cs->hist[s], 0.5),
+	    (unsigned long long)hist_quantile(cs->hist[s], 0.99));
+  }
+
+  fprintf(out, "\n");
+}
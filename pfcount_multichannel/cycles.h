@@ -0,0 +1,93 @@
+/*
+ *
+ * Per-stage cycle accounting for pfcount_multichannel.
+ *
+ * Built with -DCYCLE_ACCOUNTING only (see the Makefile): otherwise the
+ * CYCLES_* macros are empty and the packet path is unchanged. Each
+ * capture thread sums the TSC cycles spent in every stage of a packet,
+ * and one measure in CYCLE_SAMPLE_RATE goes into a log2 histogram of the
+ * stage. The ring stage is the time between two packets given to the
+ * callback, i.e. what pfring_loop*() spends on the ring: gaps of
+ * CYCLE_IDLE_GAP cycles or more are a wait for packets, not counted.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _CYCLES_H_
+#define _CYCLES_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+typedef enum {
+  cycle_ring = 0, /* pfring_loop*() between two packets */
+  cycle_lookup,   /* flow table search */
+  cycle_alloc,    /* flow record allocation and insert */
+  cycle_syn,      /* half-open connection state machine */
+  cycle_stats,    /* counters, destinations, aging */
+  num_cycle_stages
+} cycle_stage;
+
+#define CYCLE_HIST_BUCKETS  24  /* [i]: [2^(i-1), 2^i) cycles, the last one above */
+#define CYCLE_SAMPLE_RATE   64  /* power of 2 */
+#define CYCLE_IDLE_GAP      (1ULL << 22)
+
+/* Written by its capture thread only, read by print_stats() without a lock */
+struct cycle_stats {
+  u_int64_t cycles[num_cycle_stages], calls[num_cycle_stages];
+  u_int64_t hist[num_cycle_stages][CYCLE_HIST_BUCKETS];
+  u_int64_t last_pkt_end; /* TSC, 0 before the first packet */
+};
+
+/* Share and cycles per call of each stage, with the median and 99th percentile of the samples */
+void cycle_stats_print(FILE *out, int channel, const struct cycle_stats *cs);
+const char* cycle_stage_name(cycle_stage stage);
+
+#ifdef CYCLE_ACCOUNTING
+
+static inline u_int64_t cycles_now(void) {
+#if defined(__i386__) || defined(__x86_64__)
+  u_int32_t a, d;
+
+  __asm__ __volatile__("rdtsc" : "=a" (a), "=d" (d));
+  return(((u_int64_t)d << 32) | a);
+#else
+  return(0);
+#endif
+}
+
+static inline void cycles_add(struct cycle_stats *cs, cycle_stage stage, u_int64_t cycles) {
+  if((cs->calls[stage]++ & (CYCLE_SAMPLE_RATE - 1)) == 0) {
+    u_int32_t b = (cycles == 0) ? 0 : (64 - __builtin_clzll(cycles));
+
+    cs->hist[stage][(b < CYCLE_HIST_BUCKETS) ? b : (CYCLE_HIST_BUCKETS - 1)]++;
+  }
+
+  cs->cycles[stage] += cycles;
+}
+
+#define CYCLES_BEGIN(t)            u_int64_t t = cycles_now()
+#define CYCLES_END(cs, stage, t)   cycles_add((cs), (stage), cycles_now() - (t))
+
+/* At the start of a packet, t being the CYCLES_BEGIN() of its callback */
+#define CYCLES_RING(cs, t) do {						\
+    if(((cs)->last_pkt_end != 0) && (((t) - (cs)->last_pkt_end) < CYCLE_IDLE_GAP)) \
+      cycles_add((cs), cycle_ring, (t) - (cs)->last_pkt_end);		\
+  } while(0)
+
+#define CYCLES_PKT_END(cs)         ((cs)->last_pkt_end = cycles_now())
+
+#else
+
+#define CYCLES_BEGIN(t)
+#define CYCLES_END(cs, stage, t)
+#define CYCLES_RING(cs, t)
+#define CYCLES_PKT_END(cs)
+
+#endif /* CYCLE_ACCOUNTING */
+
+#endif /* _CYCLES_H_ */
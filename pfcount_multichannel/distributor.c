@@ -0,0 +1,271 @@
+/*
+ *
+ * Software cluster for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "distributor.h"
+
+#include "../tommyds-1.0/tommyhash.h"
+
+/* *************************************** */
+
+int distributor_init(struct distributor *d, pfring *ring, u_int32_t num_slaves, u_int32_t snaplen,
+		     u_int8_t zero_copy) {
+  u_int32_t i, record_size = zero_copy ? sizeof(struct dist_desc) : (sizeof(struct dist_record) + snaplen + 63) & ~63;
+
+  if((num_slaves == 0) || (num_slaves > DIST_MAX_SLAVES))
+    return(-1);
+
+  memset(d, 0, sizeof(struct distributor));
+  d->ring = ring, d->num_slaves = num_slaves, d->snaplen = snaplen, d->zero_copy = zero_copy;
+
+  for(i = 0; i < num_slaves; i++) {
+    void *mem;
+
+    if(posix_memalign(&mem, 64, spsc_ring_size(DIST_QUEUE_RECORDS, record_size)) != 0) {
+      distributor_term(d);
+      return(-1);
+    }
+
+    d->slave[i].queue = spsc_ring_init(mem, DIST_QUEUE_RECORDS, record_size);
+  }
+
+  /* Last: once enabled the ring can only be read this way */
+  if(zero_copy && (pfring_enable_mpmc(ring, DIST_MAX_BATCHES) != 0)) {
+    distributor_term(d);
+    return(-1);
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+void distributor_term(struct distributor *d) {
+  u_int32_t i;
+
+  for(i = 0; i < d->num_slaves; i++) {
+    free(d->slave[i].queue);
+    d->slave[i].queue = NULL;
+  }
+}
+
+/* *************************************** */
+
+void distributor_stop(struct distributor *d) {
+  d->shutdown = 1;
+}
+
+/* *************************************** */
+
+/* Symmetric: the addresses are summed, both directions get the same value */
+u_int32_t distributor_hash(const u_char *p, u_int32_t caplen) {
+  u_int32_t off = 14, sum = 0, w, i;
+  u_int16_t eth_type;
+
+  if(caplen < 14) return(0);
+  eth_type = (p[12] << 8) | p[13];
+
+  while(((eth_type == 0x8100) || (eth_type == 0x88A8)) && (caplen >= (off + 4))) {
+    eth_type = (p[off + 2] << 8) | p[off + 3];
+    off += 4;
+  }
+
+  if((eth_type == 0x0800) && (caplen >= (off + 20))) {
+    for(i = 12; i < 20; i += 4) {
+      memcpy(&w, &p[off + i], 4);
+      sum += w;
+    }
+  } else if((eth_type == 0x86DD) && (caplen >= (off + 40))) {
+    for(i = 8; i < 40; i += 4) {
+      memcpy(&w, &p[off + i], 4);
+      sum += w;
+    }
+  } else
+    return(0); /* not IP: all on the first slave */
+
+  return(tommy_inthash_u32(sum));
+}
+
+/* *************************************** */
+
+static void commit_all(struct distributor *d) {
+  u_int32_t i;
+
+  for(i = 0; i < d->num_slaves; i++) {
+    struct dist_slave *s = &d->slave[i];
+
+    if(s->pending > 0) {
+      spsc_ring_commit(s->queue, s->pending);
+      s->queued += s->pending, s->pending = 0;
+    }
+  }
+}
+
+/* *************************************** */
+
+/* Zero copy: drops num references to the batch, the last one gives its slots back to the kernel */
+static void put_batch(struct distributor *d, u_int32_t batch_id, u_int32_t num) {
+  struct dist_batch *b = &d->batch[batch_id];
+
+  if(__sync_sub_and_fetch(&b->pending, num) == 0) {
+    pfring_mpmc_release(d->ring, batch_id);
+    __sync_lock_release(&b->busy); /* the master may claim it again */
+  }
+}
+
+/* *************************************** */
+
+static void zero_copy_master_loop(struct distributor *d, u_int8_t wait_for_packet) {
+  struct pfring_pkthdr *hdrs[DIST_COMMIT_BATCH];
+  u_char *pkts[DIST_COMMIT_BATCH];
+  u_int32_t batch_id = 0;
+
+  while(!d->shutdown) {
+    struct dist_batch *b = &d->batch[batch_id];
+    u_int32_t dropped = 0, i;
+    int num;
+
+    if(b->busy) {
+      /* The oldest batch in flight: the slaves are behind */
+      d->stalls++;
+      if(wait_for_packet) usleep(DIST_IDLE_USEC); else sched_yield();
+      continue;
+    }
+
+    if((num = pfring_mpmc_recv(d->ring, batch_id, hdrs, pkts, DIST_COMMIT_BATCH, wait_for_packet)) <= 0) {
+      if(!wait_for_packet) sched_yield();
+      continue;
+    }
+
+    /* The master holds a reference until every packet is queued */
+    b->pending = num + 1, b->busy = 1;
+
+    for(i = 0; i < (u_int32_t)num; i++) {
+      struct dist_slave *s = &d->slave[distributor_hash(pkts[i], hdrs[i]->caplen) % d->num_slaves];
+      struct dist_desc *desc;
+
+      if((desc = spsc_ring_reserve(s->queue, s->pending)) == NULL) {
+	s->dropped++, dropped++;
+	continue;
+      }
+
+      desc->hdr = hdrs[i], desc->data = pkts[i], desc->batch = batch_id;
+      s->pending++;
+    }
+
+    commit_all(d);
+    put_batch(d, batch_id, dropped + 1);
+    batch_id = (batch_id + 1) % DIST_MAX_BATCHES;
+  }
+}
+
+/* *************************************** */
+
+void distributor_master_loop(struct distributor *d, u_int8_t wait_for_packet) {
+  u_int32_t batched = 0;
+
+  if(d->zero_copy) {
+    zero_copy_master_loop(d, wait_for_packet);
+    return;
+  }
+
+  while(!d->shutdown) {
+    struct pfring_pkthdr hdr;
+    struct dist_record *rec;
+    struct dist_slave *s;
+    u_char *pkt = NULL;
+    u_int32_t len;
+
+    if(pfring_recv(d->ring, &pkt, 0 /* zero copy */, &hdr, 0) <= 0) {
+      /* Nothing to read: let the slaves see what is there before waiting */
+      commit_all(d), batched = 0;
+
+      if(wait_for_packet) {
+	if(pfring_recv(d->ring, &pkt, 0, &hdr, 1) <= 0) continue;
+      } else {
+	sched_yield();
+	continue;
+      }
+    }
+
+    len = (hdr.caplen < d->snaplen) ? hdr.caplen : d->snaplen;
+    s = &d->slave[distributor_hash(pkt, len) % d->num_slaves];
+
+    if((rec = spsc_ring_reserve(s->queue, s->pending)) == NULL) {
+      s->dropped++;
+      continue;
+    }
+
+    memcpy(&rec->hdr, &hdr, sizeof(struct pfring_pkthdr));
+    rec->hdr.caplen = len;
+    memcpy(rec->data, pkt, len);
+    s->pending++;
+
+    if(++batched == DIST_COMMIT_BATCH)
+      commit_all(d), batched = 0;
+  }
+
+  commit_all(d);
+}
+
+/* *************************************** */
+
+void distributor_slave_loop(struct distributor *d, u_int32_t slave_id, pfringProcesssPacketBatch looper,
+			    const u_char *user_bytes, u_int32_t max_burst, u_int8_t wait_for_packet) {
+  struct spsc_ring *q = d->slave[slave_id].queue;
+  struct pfring_pkthdr *hdrs[max_burst];
+  u_char *pkts[max_burst];
+  void *recs[max_burst];
+
+  while(1) {
+    u_int32_t num = spsc_ring_peek(q, recs, max_burst), i;
+
+    if(num == 0) {
+      if(d->shutdown) break;
+      if(wait_for_packet) usleep(DIST_IDLE_USEC); else sched_yield();
+      continue;
+    }
+
+    if(d->zero_copy) {
+      u_int32_t batch[max_burst], refs;
+
+      for(i = 0; i < num; i++) {
+	struct dist_desc *desc = (struct dist_desc *)recs[i];
+
+	hdrs[i] = desc->hdr, pkts[i] = desc->data, batch[i] = desc->batch;
+      }
+
+      spsc_ring_release(q, num);
+      looper(hdrs, pkts, num, user_bytes);
+
+      /* One atomic per run of packets of the same batch */
+      for(i = 0; i < num; i += refs) {
+	for(refs = 1; (i + refs < num) && (batch[i + refs] == batch[i]); refs++)
+	  ;
+	put_batch(d, batch[i], refs);
+      }
+      continue;
+    }
+
+    for(i = 0; i < num; i++) {
+      struct dist_record *rec = (struct dist_record *)recs[i];
+
+      hdrs[i] = &rec->hdr, pkts[i] = rec->data;
+    }
+
+    looper(hdrs, pkts, num, user_bytes);
+    spsc_ring_release(q, num);
+  }
+}
@@ -0,0 +1,97 @@
+/*
+ *
+ * Software cluster for pfcount_multichannel (-Z).
+ *
+ * One master thread reads a single ring (typically a DNA device, where a
+ * single queue or an asymmetric RSS key would split the two directions
+ * of a flow) and hands each packet to one of N slave threads according
+ * to a symmetric hash of the IP address pair: both directions of a
+ * conversation are counted by the same slave.
+ *
+ * The libzero DNA cluster shipped with the library has no distribution
+ * hook, hence the distribution is done here. Every slave has its own
+ * spsc ring of packet records: the master copies the packet once, from
+ * the DMA slot (recycled by the next receive) straight into the slave's
+ * record, and the slave processes the records in place. Packets are
+ * dropped, and counted, when the queue of their slave is full.
+ *
+ * Zero copy (-Z <threads>:zc, PF-RING rings only): the master claims the
+ * slots in batches of DIST_COMMIT_BATCH packets with the shared
+ * consumption of the library (pfring_mpmc_recv(), one consumer id per
+ * batch in flight), and only queues descriptors pointing into them. The
+ * slots of a batch go back to the kernel once every slave has processed
+ * its packets: the last one releases it. With all DIST_MAX_BATCHES in
+ * flight the master waits for the slaves (stalls), the packets piling
+ * up in the kernel ring meanwhile.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _DISTRIBUTOR_H_
+#define _DISTRIBUTOR_H_
+
+#include <sys/types.h>
+
+#include "pfring.h"
+#include "spsc.h"
+
+#define DIST_MAX_SLAVES      64
+#define DIST_QUEUE_RECORDS   8192 /* per slave */
+#define DIST_COMMIT_BATCH    32   /* packets queued before the slaves see them */
+#define DIST_IDLE_USEC       10   /* slave sleep on an empty queue (blocking wait) */
+#define DIST_MAX_BATCHES     64   /* zero copy: batches in flight (<= MAX_MPMC_CONSUMERS) */
+
+struct dist_record {
+  struct pfring_pkthdr hdr;
+  u_char data[];
+};
+
+/* Zero copy: a packet still in the ring slots of its batch */
+struct dist_desc {
+  struct pfring_pkthdr *hdr;
+  u_char *data;
+  u_int32_t batch;
+};
+
+struct dist_batch {
+  volatile u_int32_t pending;  /* packets not processed yet, + 1 while the master queues them */
+  volatile u_int32_t busy;     /* claimed, until the last reference is dropped */
+} __attribute__((aligned(64)));
+
+struct dist_slave {
+  struct spsc_ring *queue;
+  u_int32_t pending;   /* reserved by the master, not committed */
+  /* Written by the master only, read by print_stats() */
+  u_int64_t queued, dropped;
+} __attribute__((aligned(64)));
+
+struct distributor {
+  pfring *ring;
+  u_int32_t num_slaves, snaplen;
+  u_int8_t zero_copy;
+  volatile u_int8_t shutdown;
+  u_int64_t stalls;    /* zero copy: master waits for a free batch */
+  struct dist_slave slave[DIST_MAX_SLAVES];
+  struct dist_batch batch[DIST_MAX_BATCHES];
+};
+
+/* zero_copy: enables the shared consumption of the ring, fails if the ring does not support it */
+int distributor_init(struct distributor *d, pfring *ring, u_int32_t num_slaves, u_int32_t snaplen,
+		     u_int8_t zero_copy);
+void distributor_term(struct distributor *d);
+void distributor_stop(struct distributor *d);
+
+/* Master: returns when stopped */
+void distributor_master_loop(struct distributor *d, u_int8_t wait_for_packet);
+
+/* Slave: up to max_burst packets per call of looper, returns when stopped */
+void distributor_slave_loop(struct distributor *d, u_int32_t slave_id, pfringProcesssPacketBatch looper,
+			    const u_char *user_bytes, u_int32_t max_burst, u_int8_t wait_for_packet);
+
+u_int32_t distributor_hash(const u_char *p, u_int32_t caplen);
+
+#endif /* _DISTRIBUTOR_H_ */
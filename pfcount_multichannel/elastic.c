@@ -0,0 +1,230 @@
+/*
+ *
+ * Elastic worker pool for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "elastic.h"
+#include "distributor.h" /* dist_record, distributor_hash() */
+
+/* *************************************** */
+
+int elastic_init(struct elastic_pool *e, pfring **rings, u_int32_t num_receivers, u_int32_t num_workers,
+		 u_int32_t num_partitions, u_int32_t snaplen) {
+  u_int32_t i, record_size = (sizeof(struct dist_record) + snaplen + 63) & ~63;
+
+  if((num_receivers == 0) || (num_receivers > ELASTIC_MAX_RECEIVERS)
+     || (num_workers == 0) || (num_workers > ELASTIC_MAX_WORKERS)
+     || (num_partitions < num_workers) || (num_partitions > ELASTIC_MAX_PARTITIONS))
+    return(-1);
+
+  memset(e, 0, sizeof(struct elastic_pool));
+  e->num_receivers = num_receivers, e->num_workers = num_workers;
+  e->num_partitions = num_partitions, e->snaplen = snaplen;
+  memcpy(e->ring, rings, num_receivers * sizeof(pfring *));
+
+  if(posix_memalign((void **)&e->queue, 64, num_receivers * num_partitions * sizeof(struct elastic_queue)) != 0) {
+    e->queue = NULL;
+    return(-1);
+  }
+
+  memset(e->queue, 0, num_receivers * num_partitions * sizeof(struct elastic_queue));
+
+  for(i = 0; i < num_receivers * num_partitions; i++) {
+    void *mem;
+
+    if(posix_memalign(&mem, 64, spsc_ring_size(ELASTIC_QUEUE_RECORDS, record_size)) != 0) {
+      elastic_term(e);
+      return(-1);
+    }
+
+    e->queue[i].ring = spsc_ring_init(mem, ELASTIC_QUEUE_RECORDS, record_size);
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+void elastic_term(struct elastic_pool *e) {
+  u_int32_t i;
+
+  if(e->queue == NULL)
+    return;
+
+  for(i = 0; i < e->num_receivers * e->num_partitions; i++)
+    free(e->queue[i].ring);
+
+  free(e->queue);
+  e->queue = NULL;
+}
+
+/* *************************************** */
+
+void elastic_stop(struct elastic_pool *e) {
+  e->shutdown = 1;
+}
+
+/* *************************************** */
+
+void elastic_set_partition(struct elastic_pool *e, u_int32_t partition, const u_char *user_bytes) {
+  __sync_synchronize(); /* the flow state before the pointer */
+  e->partition[partition].user_bytes = user_bytes;
+}
+
+/* *************************************** */
+
+static void commit_all(struct elastic_queue *queues, u_int32_t num) {
+  u_int32_t i;
+
+  for(i = 0; i < num; i++) {
+    struct elastic_queue *q = &queues[i];
+
+    if(q->pending > 0) {
+      spsc_ring_commit(q->ring, q->pending);
+      q->queued += q->pending, q->pending = 0;
+    }
+  }
+}
+
+/* *************************************** */
+
+void elastic_receiver_loop(struct elastic_pool *e, u_int32_t receiver_id, u_int8_t wait_for_packet) {
+  struct elastic_queue *queues = &e->queue[receiver_id * e->num_partitions];
+  pfring *ring = e->ring[receiver_id];
+  u_int32_t batched = 0;
+
+  while(!e->shutdown) {
+    struct pfring_pkthdr hdr;
+    struct dist_record *rec;
+    struct elastic_queue *q;
+    u_char *pkt = NULL;
+    u_int32_t len;
+
+    if(pfring_recv(ring, &pkt, 0 /* zero copy */, &hdr, 0) <= 0) {
+      /* Nothing to read: let the workers see what is there before waiting */
+      commit_all(queues, e->num_partitions), batched = 0;
+
+      if(wait_for_packet) {
+	if(pfring_recv(ring, &pkt, 0, &hdr, 1) <= 0) continue;
+      } else {
+	sched_yield();
+	continue;
+      }
+    }
+
+    len = (hdr.caplen < e->snaplen) ? hdr.caplen : e->snaplen;
+    q = &queues[distributor_hash(pkt, len) % e->num_partitions];
+
+    if((rec = spsc_ring_reserve(q->ring, q->pending)) == NULL) {
+      q->dropped++;
+      continue;
+    }
+
+    memcpy(&rec->hdr, &hdr, sizeof(struct pfring_pkthdr));
+    rec->hdr.caplen = len;
+    memcpy(rec->data, pkt, len);
+    q->pending++;
+
+    if(++batched == ELASTIC_COMMIT_BATCH)
+      commit_all(queues, e->num_partitions), batched = 0;
+  }
+
+  commit_all(queues, e->num_partitions);
+}
+
+/* *************************************** */
+
+/* Returns the packets processed, 0 when the partition is empty or owned by another worker */
+static u_int32_t drain_partition(struct elastic_pool *e, u_int32_t partition, u_int32_t worker_id,
+				 pfringProcesssPacketBatch looper, u_int32_t max_burst) {
+  struct elastic_partition *p = &e->partition[partition];
+  struct pfring_pkthdr *hdrs[max_burst];
+  u_char *pkts[max_burst];
+  void *recs[max_burst];
+  u_int32_t r, num, i, tot = 0;
+
+  if((p->user_bytes == NULL) || (p->owner != 0)
+     || !__sync_bool_compare_and_swap(&p->owner, 0, worker_id + 1))
+    return(0);
+
+  /* Until released, the only consumer of the queues of the partition and writer of its flow state */
+  for(r = 0; r < e->num_receivers; r++) {
+    struct spsc_ring *q = e->queue[r * e->num_partitions + partition].ring;
+
+    if((num = spsc_ring_peek(q, recs, max_burst)) == 0)
+      continue;
+
+    for(i = 0; i < num; i++) {
+      struct dist_record *rec = (struct dist_record *)recs[i];
+
+      hdrs[i] = &rec->hdr, pkts[i] = rec->data;
+    }
+
+    looper(hdrs, pkts, num, p->user_bytes);
+    spsc_ring_release(q, num);
+    tot += num;
+  }
+
+  __sync_lock_release(&p->owner); /* release: the flow state and the queue tails before the owner */
+  return(tot);
+}
+
+/* *************************************** */
+
+/* The free partition of another worker with the largest backlog, num_partitions if none is worth it */
+static u_int32_t partition_to_steal(struct elastic_pool *e, u_int32_t worker_id) {
+  u_int32_t partition, r, best = e->num_partitions, best_backlog = ELASTIC_STEAL_BACKLOG - 1;
+
+  for(partition = 0; partition < e->num_partitions; partition++) {
+    u_int32_t backlog = 0;
+
+    if((elastic_home_worker(e, partition) == worker_id) || (e->partition[partition].owner != 0))
+      continue;
+
+    for(r = 0; r < e->num_receivers; r++)
+      backlog += spsc_ring_count(e->queue[r * e->num_partitions + partition].ring);
+
+    if(backlog > best_backlog)
+      best = partition, best_backlog = backlog;
+  }
+
+  return(best);
+}
+
+/* *************************************** */
+
+void elastic_worker_loop(struct elastic_pool *e, u_int32_t worker_id, pfringProcesssPacketBatch looper,
+			 u_int32_t max_burst, u_int8_t wait_for_packet) {
+  struct elastic_worker *w = &e->worker[worker_id];
+
+  while(1) {
+    u_int32_t num = 0, partition;
+
+    for(partition = worker_id; partition < e->num_partitions; partition += e->num_workers)
+      num += drain_partition(e, partition, worker_id, looper, max_burst);
+
+    w->pkts += num;
+
+    if((num == 0) && ((partition = partition_to_steal(e, worker_id)) < e->num_partitions)) {
+      num = drain_partition(e, partition, worker_id, looper, max_burst);
+      w->pkts += num, w->stolen_pkts += num;
+    }
+
+    if(num == 0) {
+      /* The receivers are stopped first: what is still queued gets processed */
+      if(e->shutdown) break;
+      if(wait_for_packet) usleep(ELASTIC_IDLE_USEC); else sched_yield();
+    }
+  }
+}
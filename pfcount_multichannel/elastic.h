@@ -0,0 +1,99 @@
+/*
+ *
+ * Elastic worker pool for pfcount_multichannel (-f).
+ *
+ * With RSS a flood towards a single victim often lands almost entirely on
+ * one queue: the thread of that channel saturates while the others idle.
+ * Here the thread of each channel (receiver) only copies the packets out
+ * of its ring and hands them, by the symmetric hash of the IP pair
+ * (distributor_hash()), to one of num_partitions flow partitions. Each
+ * partition has its own flow state (a struct thread_ctx of the main
+ * program), so that both directions of a flow are always counted in the
+ * same place whoever processes them.
+ *
+ * A partition is processed by one worker at a time: the worker owning it
+ * (owner, taken with a compare and swap) is the only consumer of its
+ * queues, one spsc ring per receiver. Every worker has its home
+ * partitions (partition % num_workers), drained first; a worker finding
+ * them empty steals the partition of another worker with the largest
+ * backlog, above ELASTIC_STEAL_BACKLOG records so that the flow state
+ * does not bounce between the caches of two cores for a few packets.
+ * With more partitions than workers (ELASTIC_PARTITIONS_PER_WORKER) the
+ * load of a hot queue spreads over all the workers; the traffic of a
+ * single IP pair still has one partition and one worker at a time.
+ *
+ * Packets are dropped, and counted, when the queue of their partition
+ * is full. The queues take num_receivers x num_partitions x
+ * ELASTIC_QUEUE_RECORDS records of the snaplen: about 20 MB per channel
+ * with 64 partitions and the default snaplen.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _ELASTIC_H_
+#define _ELASTIC_H_
+
+#include <sys/types.h>
+
+#include "pfring.h"
+#include "spsc.h"
+
+#define ELASTIC_MAX_RECEIVERS          64
+#define ELASTIC_MAX_WORKERS            64
+#define ELASTIC_MAX_PARTITIONS         64
+#define ELASTIC_PARTITIONS_PER_WORKER  4
+#define ELASTIC_QUEUE_RECORDS          1024 /* per receiver and partition */
+#define ELASTIC_COMMIT_BATCH           32   /* packets queued before the workers see them */
+#define ELASTIC_STEAL_BACKLOG          256  /* records queued before a partition is stolen */
+#define ELASTIC_IDLE_USEC              10   /* worker sleep with nothing to do (blocking wait) */
+
+/* Written by the receiver only */
+struct elastic_queue {
+  struct spsc_ring *ring;
+  u_int32_t pending;           /* reserved, not committed */
+  u_int64_t queued, dropped;
+} __attribute__((aligned(64)));
+
+struct elastic_partition {
+  volatile u_int32_t owner;    /* worker id + 1, 0 = free */
+  const u_char *user_bytes;    /* the flow state, NULL until elastic_set_partition() */
+} __attribute__((aligned(64)));
+
+/* Written by the worker only */
+struct elastic_worker {
+  u_int64_t pkts, stolen_pkts; /* stolen: from the home partitions of the others */
+} __attribute__((aligned(64)));
+
+struct elastic_pool {
+  u_int32_t num_receivers, num_workers, num_partitions, snaplen;
+  volatile u_int8_t shutdown;
+  pfring *ring[ELASTIC_MAX_RECEIVERS];
+  struct elastic_queue *queue; /* [receiver * num_partitions + partition] */
+  struct elastic_partition partition[ELASTIC_MAX_PARTITIONS];
+  struct elastic_worker worker[ELASTIC_MAX_WORKERS];
+};
+
+int  elastic_init(struct elastic_pool *e, pfring **rings, u_int32_t num_receivers, u_int32_t num_workers,
+		  u_int32_t num_partitions, u_int32_t snaplen);
+void elastic_term(struct elastic_pool *e);
+void elastic_stop(struct elastic_pool *e);
+
+/* The partition is not processed before its flow state is set */
+void elastic_set_partition(struct elastic_pool *e, u_int32_t partition, const u_char *user_bytes);
+
+static inline u_int32_t elastic_home_worker(const struct elastic_pool *e, u_int32_t partition) {
+  return(partition % e->num_workers);
+}
+
+/* Receiver: reads ring[receiver_id], returns when stopped */
+void elastic_receiver_loop(struct elastic_pool *e, u_int32_t receiver_id, u_int8_t wait_for_packet);
+
+/* Worker: up to max_burst packets per call of looper, with the user_bytes of the partition */
+void elastic_worker_loop(struct elastic_pool *e, u_int32_t worker_id, pfringProcesssPacketBatch looper,
+			 u_int32_t max_burst, u_int8_t wait_for_packet);
+
+#endif /* _ELASTIC_H_ */
@@ -0,0 +1,56 @@
+/*
+ *
+ * Streaming entropy estimation for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <math.h>
+
+#include "entropy.h"
+
+const char *entropy_feature_name[NUM_ENTROPY_FEATURES] = { "Src IP", "Src port", "Dst port" };
+
+float entropy_u_term[ENTROPY_U_SLOTS], entropy_w_term[ENTROPY_W_SLOTS];
+
+/* *************************************** */
+
+void entropy_init(void) {
+  u_int32_t lz, m, i;
+
+  /*
+    X = tan(w1) (pi/2 - w1) + ln(W cos(w1) / (pi/2 - w1)), w1 = pi (U - 1/2),
+    W exponential: the U terms, then ln(W) = ln(-ln(V)), V uniform
+  */
+  for(lz = 0; lz < 32; lz++) {
+    for(m = 0; m < 256; m++) {
+      double u = ldexp(1.0 + (m + 0.5) / 256.0, -(int)lz - 1); /* in [2^-(lz+1), 2^-lz) */
+      double w1 = M_PI * (u - 0.5);
+
+      entropy_u_term[(lz << 8) | m] = tan(w1) * (M_PI_2 - w1) + log(cos(w1) / (M_PI_2 - w1));
+    }
+  }
+
+  for(i = 0; i < ENTROPY_W_SLOTS; i++)
+    entropy_w_term[i] = log(-log((i + 0.5) / ENTROPY_W_SLOTS));
+}
+
+/* *************************************** */
+
+double entropy_estimate(const struct entropy_sketch *s, entropy_feature f, u_int64_t pkts) {
+  double mean = 0, h;
+  u_int32_t j;
+
+  if(pkts == 0)
+    return(0);
+
+  for(j = 0; j < ENTROPY_ROWS; j++)
+    mean += exp(s->y[f][j] / (double)pkts);
+
+  h = -log(mean / ENTROPY_ROWS) / M_LN2;
+  return((h > 0) ? h : 0);
+}
@@ -0,0 +1,91 @@
+/*
+ *
+ * Streaming entropy of the sources of each destination for
+ * pfcount_multichannel (-Y): a spoofed flood shows up as a jump of the
+ * source address entropy, without keeping a counter per source.
+ *
+ * Stable sketch (Clifford & Cosma): each of the ENTROPY_ROWS counters of a
+ * feature (source address, source port, destination port) adds, for every
+ * packet, a value drawn for the packet's item from a maximally skewed
+ * 1-stable distribution. The value only depends on the item and the row,
+ * so the sketches of the threads and of a second are merged by adding
+ * them, and
+ *
+ *   H = -ln(mean over the rows of exp(y / pkts))
+ *
+ * estimates the Shannon entropy of the items: about half a bit of error
+ * with 16 rows, from one to millions of distinct items.
+ *
+ * The values are the two terms of the Chambers-Mallows-Stuck formula read
+ * from tables indexed by a hash of (item, row): the uniform term on a log
+ * scale down to 2^-32, as the estimate lives in its heavy tail. An update
+ * costs ENTROPY_ROWS hashes, two lookups and an add per feature, whatever
+ * the traffic.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _ENTROPY_H_
+#define _ENTROPY_H_
+
+#include <sys/types.h>
+
+#include "../tommyds-1.0/tommyhash.h"
+
+#define ENTROPY_ROWS           16
+#define ENTROPY_U_SLOTS        (32 * 256)  /* leading zeros x 8 mantissa bits */
+#define ENTROPY_W_SLOTS        4096
+
+typedef enum {
+  entropy_src_addr = 0,
+  entropy_src_port,
+  entropy_dst_port,
+  NUM_ENTROPY_FEATURES
+} entropy_feature;
+
+extern const char *entropy_feature_name[NUM_ENTROPY_FEATURES];
+
+struct entropy_sketch {
+  float y[NUM_ENTROPY_FEATURES][ENTROPY_ROWS];
+};
+
+extern float entropy_u_term[ENTROPY_U_SLOTS], entropy_w_term[ENTROPY_W_SLOTS];
+
+/* Fills the tables, before the capture threads start */
+void entropy_init(void);
+
+static inline void entropy_add_item(float *y, u_int64_t item) {
+  u_int32_t j;
+
+  for(j = 0; j < ENTROPY_ROWS; j++) {
+    u_int64_t h = tommy_inthash_u64(item + j * 0x9E3779B97F4A7C15ULL);
+    u_int32_t u = (u_int32_t)h, lz = __builtin_clz(u | 1);
+
+    y[j] += entropy_u_term[(lz << 8) | (((u << lz) >> 23) & 0xFF)] + entropy_w_term[(h >> 32) & (ENTROPY_W_SLOTS - 1)];
+  }
+}
+
+/* items: one per feature */
+static inline void entropy_add(struct entropy_sketch *s, const u_int64_t *items) {
+  u_int32_t f;
+
+  for(f = 0; f < NUM_ENTROPY_FEATURES; f++)
+    entropy_add_item(s->y[f], items[f]);
+}
+
+static inline void entropy_merge(struct entropy_sketch *a, const struct entropy_sketch *b) {
+  u_int32_t f, j;
+
+  for(f = 0; f < NUM_ENTROPY_FEATURES; f++)
+    for(j = 0; j < ENTROPY_ROWS; j++)
+      a->y[f][j] += b->y[f][j];
+}
+
+/* Bits, of the pkts items added to s */
+double entropy_estimate(const struct entropy_sketch *s, entropy_feature f, u_int64_t pkts);
+
+#endif /* _ENTROPY_H_ */
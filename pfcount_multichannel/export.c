@@ -0,0 +1,93 @@
+/*
+ *
+ * Binary export of the pfcount_multichannel summaries
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "export.h"
+
+#define RING_OFFSET  ((sizeof(struct export_header) + 63) & ~63)
+
+/* *************************************** */
+
+int export_open(struct exporter *e, const char *name, u_int32_t num_records) {
+  struct stat st;
+  int fd;
+  void *mem;
+
+  memset(e, 0, sizeof(struct exporter));
+  e->size = RING_OFFSET + spsc_ring_size(num_records, sizeof(struct export_record));
+
+  /* Readers of a previous segment see its magic cleared when its writer leaves, then attach again */
+  shm_unlink(name);
+
+  if((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644)) < 0)
+    return(-1);
+
+  if((fstat(fd, &st) != 0) || (ftruncate(fd, e->size) != 0)) {
+    close(fd);
+    shm_unlink(name);
+    return(-1);
+  }
+
+  mem = mmap(NULL, e->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(mem == MAP_FAILED) {
+    shm_unlink(name);
+    return(-1);
+  }
+
+  e->name = strdup(name), e->ino = st.st_ino;
+  e->header = mem;
+  e->ring = spsc_ring_init((char*)mem + RING_OFFSET, num_records, sizeof(struct export_record));
+
+  e->header->record_size = sizeof(struct export_record);
+  e->header->ring_offset = RING_OFFSET;
+  e->header->version = EXPORT_VERSION;
+  __sync_synchronize();
+  e->header->magic = EXPORT_MAGIC; /* last: the segment is ready */
+  return(0);
+}
+
+/* *************************************** */
+
+void export_close(struct exporter *e) {
+  struct stat st;
+  int fd;
+
+  if(e->header == NULL)
+    return;
+
+  e->header->magic = 0;
+  munmap(e->header, e->size);
+
+  /* The name may be the segment of the process we handed off to by now */
+  if((fd = shm_open(e->name, O_RDONLY, 0)) >= 0) {
+    if((fstat(fd, &st) == 0) && (st.st_ino == e->ino))
+      shm_unlink(e->name);
+    close(fd);
+  }
+
+  free(e->name);
+  memset(e, 0, sizeof(struct exporter));
+}
+
+/* *************************************** */
+
+void export_push(struct exporter *e, const struct export_record *record) {
+  if((e->ring != NULL) && (spsc_ring_push(e->ring, record) != 0))
+    e->header->dropped++;
+}
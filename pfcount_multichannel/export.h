@@ -0,0 +1,89 @@
+/*
+ *
+ * Binary export of the pfcount_multichannel summaries.
+ *
+ * Once per reporting epoch the reporter appends fixed layout records to a
+ * POSIX shared memory segment (shm_open() name given with -x). The
+ * segment is an export_header followed by an spsc_ring (spsc.h) of
+ * export_record: a consumer maps it, checks magic/version and pops records
+ * with spsc_ring_pop(); nothing has to be parsed. If the consumer falls
+ * behind, new records are dropped (export_header.dropped) rather than
+ * overwriting unread ones.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <sys/types.h>
+
+#include "spsc.h"
+
+#define EXPORT_MAGIC            0x50465258 /* "PFRX" */
+#define EXPORT_VERSION          1
+#define DEFAULT_EXPORT_RECORDS  4096
+
+typedef enum {
+  export_epoch_summary = 1, /* one per epoch, first */
+  export_top_victim = 2     /* then up to NUM_TOP_VICTIMS, by rank */
+} export_record_type;
+
+/* Traffic of the epoch: counters are deltas over interval_ms */
+struct export_summary {
+  u_int32_t interval_ms;
+  u_int32_t num_channels;
+  u_int64_t pkts, bytes, ip_pkts, ip_bytes;
+  u_int64_t tcp_pkts, udp_pkts, icmp_pkts, other_pkts;
+  u_int64_t tcp_bytes, udp_bytes, icmp_bytes, other_bytes;
+  u_int64_t drops;          /* dropped by PF_RING */
+  int64_t   half_open;      /* current */
+  u_int64_t flows;          /* current */
+  double    owcr;           /* half-open connections / IP packets, as printed */
+};
+
+struct export_victim {
+  u_int32_t rank;           /* 0 = heaviest */
+  u_int32_t version;        /* 4 or 6 */
+  u_int32_t addr[4];        /* IPv4 (host byte order) in addr[0], IPv6 in network byte order */
+  u_int8_t  proto;          /* 0 = any (per destination view) */
+  u_int8_t  pad;
+  u_int16_t port;           /* 0 = any */
+  u_int32_t pkts, syns;     /* last second */
+  u_int64_t bytes;          /* last second */
+  u_int32_t sources;        /* distinct sources over the last second, 0 = not available */
+};
+
+struct export_record {
+  u_int32_t type;           /* export_record_type */
+  u_int32_t epoch;          /* sec */
+  union {
+    struct export_summary summary;
+    struct export_victim victim;
+  } u;
+} __attribute__((aligned(8)));
+
+struct export_header {
+  u_int32_t magic, version;
+  u_int32_t record_size;    /* sizeof(struct export_record) */
+  u_int32_t ring_offset;    /* from the start of the segment */
+  volatile u_int64_t dropped;
+} __attribute__((aligned(64)));
+
+struct exporter {
+  char *name;
+  ino_t ino;                /* of the segment, unlinked only if the name is still it */
+  struct export_header *header;
+  struct spsc_ring *ring;
+  size_t size;
+};
+
+int  export_open(struct exporter *e, const char *name, u_int32_t num_records);
+void export_close(struct exporter *e);
+void export_push(struct exporter *e, const struct export_record *record);
+
+#endif /* _EXPORT_H_ */
@@ -0,0 +1,322 @@
+/*
+ *
+ * Flow table backends for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flow_table.h"
+
+/* Keep the open addressing table at most 3/4 full: probe chains stay short */
+#define OPEN_MAX_LOAD(slots)  (((slots) / 4) * 3)
+
+/* *************************************** */
+
+int flow_table_parse_type(const char *name, flow_table_type *type) {
+  if(!strcmp(name, "dyn"))       *type = flow_table_hashdyn;
+  else if(!strcmp(name, "lin"))  *type = flow_table_hashlin;
+  else if(!strcmp(name, "open")) *type = flow_table_open;
+  else return(-1);
+
+  return(0);
+}
+
+/* *************************************** */
+
+const char* flow_table_type_name(flow_table_type type) {
+  switch(type) {
+  case flow_table_hashdyn: return("dyn");
+  case flow_table_hashlin: return("lin");
+  case flow_table_open:    return("open");
+  }
+
+  return("???");
+}
+
+/* *************************************** */
+
+static int open_init(struct flow_table_open *o, u_int32_t capacity) {
+  u_int32_t num_slots;
+
+  if(capacity < 16) capacity = 16;
+  if(capacity > (1U << 30)) capacity = 1U << 30;
+
+  /* Room for 'capacity' flows within the max load factor */
+  num_slots = tommy_roundup_pow2_u32(capacity + capacity / 3 + 1);
+
+  o->slots = (struct flow_table_slot*)calloc(num_slots, sizeof(struct flow_table_slot));
+  if(o->slots == NULL) return(-1);
+
+  o->mask = num_slots - 1, o->count = 0;
+  o->max_count = OPEN_MAX_LOAD(num_slots);
+  if(o->max_count > capacity) o->max_count = capacity;
+
+  return(0);
+}
+
+/* *************************************** */
+
+static int open_insert(struct flow_table_open *o, tommy_node *node, tommy_hash_t hash) {
+  u_int32_t pos;
+
+  if(o->count >= o->max_count)
+    return(-1); /* Full: the caller decides what to do with the flow */
+
+  for(pos = hash & o->mask; o->slots[pos].data != NULL; pos = (pos + 1) & o->mask)
+    ;
+
+  o->slots[pos].hash = hash, o->slots[pos].data = node->data;
+  o->count++;
+  return(0);
+}
+
+/* *************************************** */
+
+static void* open_search(struct flow_table_open *o, flow_table_compare_func *cmp,
+			 const void *arg, tommy_hash_t hash) {
+  u_int32_t pos;
+
+  for(pos = hash & o->mask; o->slots[pos].data != NULL; pos = (pos + 1) & o->mask) {
+    if(o->slots[pos].hash == hash
+       && ((cmp == NULL) || (cmp(arg, o->slots[pos].data) == 0)))
+      return(o->slots[pos].data);
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+/*
+  Removal with backward shift (no tombstones), so that probe chains
+  do not degrade as flows come and go.
+*/
+static void* open_remove(struct flow_table_open *o, tommy_node *node) {
+  u_int32_t pos, next, home;
+
+  for(pos = node->key & o->mask; o->slots[pos].data != node->data; pos = (pos + 1) & o->mask)
+    if(o->slots[pos].data == NULL) return(NULL); /* Not here */
+
+  for(next = (pos + 1) & o->mask; o->slots[next].data != NULL; next = (next + 1) & o->mask) {
+    home = o->slots[next].hash & o->mask;
+
+    /* Move 'next' into the hole unless its home lies cyclically in (pos, next] */
+    if(((next > pos) && ((home <= pos) || (home > next)))
+       || ((next < pos) && ((home <= pos) && (home > next)))) {
+      o->slots[pos] = o->slots[next];
+      pos = next;
+    }
+  }
+
+  o->slots[pos].data = NULL;
+  o->count--;
+  return(node->data);
+}
+
+/* *************************************** */
+
+int flow_table_init(struct flow_table *t, flow_table_type type, u_int32_t capacity) {
+  t->type = type;
+
+  switch(type) {
+  case flow_table_hashdyn:
+    tommy_hashdyn_init(&t->u.dyn);
+    return(0);
+  case flow_table_hashlin:
+    tommy_hashlin_init(&t->u.lin);
+    return(0);
+  case flow_table_open:
+    return(open_init(&t->u.open, capacity));
+  }
+
+  return(-1);
+}
+
+/* *************************************** */
+
+void flow_table_reserve(struct flow_table *t, u_int32_t flows) {
+  switch(t->type) {
+  case flow_table_hashdyn:
+    tommy_hashdyn_done(&t->u.dyn);
+    tommy_hashdyn_init_size(&t->u.dyn, flows);
+    break;
+  case flow_table_hashlin:
+    tommy_hashlin_done(&t->u.lin);
+    tommy_hashlin_init_size(&t->u.lin, flows);
+    break;
+  case flow_table_open:
+    /* Sized by its capacity: calloc() left the pages to the first inserts */
+    memset(t->u.open.slots, 0, (size_t)(t->u.open.mask + 1) * sizeof(struct flow_table_slot));
+    break;
+  }
+}
+
+/* *************************************** */
+
+void flow_table_set_shrink(struct flow_table *t, u_int32_t min_flows, u_int32_t delay) {
+  switch(t->type) {
+  case flow_table_hashdyn: tommy_hashdyn_set_shrink(&t->u.dyn, min_flows, delay); break;
+  case flow_table_hashlin: tommy_hashlin_set_shrink(&t->u.lin, min_flows, delay); break;
+  case flow_table_open:    break; /* never resized */
+  }
+}
+
+/* *************************************** */
+
+/* As with tommy containers, the table is expected to be empty */
+void flow_table_done(struct flow_table *t) {
+  switch(t->type) {
+  case flow_table_hashdyn: tommy_hashdyn_done(&t->u.dyn); break;
+  case flow_table_hashlin: tommy_hashlin_done(&t->u.lin); break;
+  case flow_table_open:    free(t->u.open.slots); t->u.open.slots = NULL; break;
+  }
+}
+
+/* *************************************** */
+
+int flow_table_insert(struct flow_table *t, tommy_node *node, void *data, tommy_hash_t hash) {
+  switch(t->type) {
+  case flow_table_hashdyn:
+    tommy_hashdyn_insert(&t->u.dyn, node, data, hash);
+    return(0);
+  case flow_table_hashlin:
+    tommy_hashlin_insert(&t->u.lin, node, data, hash);
+    return(0);
+  case flow_table_open:
+    node->data = data, node->key = hash;
+    return(open_insert(&t->u.open, node, hash));
+  }
+
+  return(-1);
+}
+
+/* *************************************** */
+
+void* flow_table_search(struct flow_table *t, flow_table_compare_func *cmp,
+			const void *arg, tommy_hash_t hash) {
+  tommy_node *i;
+
+  switch(t->type) {
+  case flow_table_hashdyn:
+    i = tommy_hashdyn_bucket(&t->u.dyn, hash);
+    break;
+  case flow_table_hashlin:
+    i = tommy_hashlin_bucket(&t->u.lin, hash);
+    break;
+  case flow_table_open:
+    return(open_search(&t->u.open, cmp, arg, hash));
+  default:
+    return(NULL);
+  }
+
+  /* we first check if the hash matches, as in the same bucket we may have multiples hash values */
+  for(; i != NULL; i = i->next)
+    if((i->key == hash) && ((cmp == NULL) || (cmp(arg, i->data) == 0)))
+      return(i->data);
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+/*
+  Issued a few packets before flow_table_search() with the same hash: the
+  bucket head is read here (it may miss) and its first node prefetched, so
+  that the search finds both in cache.
+*/
+void flow_table_prefetch(struct flow_table *t, tommy_hash_t hash) {
+  switch(t->type) {
+  case flow_table_hashdyn:
+    __builtin_prefetch(tommy_hashdyn_bucket(&t->u.dyn, hash));
+    break;
+  case flow_table_hashlin:
+    __builtin_prefetch(tommy_hashlin_bucket(&t->u.lin, hash));
+    break;
+  case flow_table_open:
+    __builtin_prefetch(&t->u.open.slots[hash & t->u.open.mask]);
+    break;
+  }
+}
+
+/* *************************************** */
+
+/*
+  Same, for a whole burst before its first search: the bucket heads are
+  loaded together by tommy_*_bucket_batch(), so their misses overlap
+  instead of being paid one packet at a time.
+*/
+void flow_table_prefetch_batch(struct flow_table *t, const tommy_hash_t *hash, u_int32_t num) {
+  tommy_node *bucket[FLOW_TABLE_BATCH];
+  u_int32_t i, n;
+
+  for(i = 0; i < num; i += n) {
+    n = ((num - i) < FLOW_TABLE_BATCH) ? (num - i) : FLOW_TABLE_BATCH;
+
+    switch(t->type) {
+    case flow_table_hashdyn:
+      tommy_hashdyn_bucket_batch(&t->u.dyn, &hash[i], bucket, n);
+      break;
+    case flow_table_hashlin:
+      tommy_hashlin_bucket_batch(&t->u.lin, &hash[i], bucket, n);
+      break;
+    case flow_table_open: {
+      u_int32_t j;
+
+      for(j = 0; j < n; j++)
+	__builtin_prefetch(&t->u.open.slots[hash[i + j] & t->u.open.mask]);
+      } break;
+    }
+  }
+}
+
+/* *************************************** */
+
+void* flow_table_remove_existing(struct flow_table *t, tommy_node *node) {
+  switch(t->type) {
+  case flow_table_hashdyn: return(tommy_hashdyn_remove_existing(&t->u.dyn, node));
+  case flow_table_hashlin: return(tommy_hashlin_remove_existing(&t->u.lin, node));
+  case flow_table_open:    return(open_remove(&t->u.open, node));
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+u_int32_t flow_table_count(struct flow_table *t) {
+  switch(t->type) {
+  case flow_table_hashdyn: return(tommy_hashdyn_count(&t->u.dyn));
+  case flow_table_hashlin: return(tommy_hashlin_count(&t->u.lin));
+  case flow_table_open:    return(t->u.open.count);
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+size_t flow_table_memory_usage(struct flow_table *t) {
+  switch(t->type) {
+  case flow_table_hashdyn: return(tommy_hashdyn_memory_usage(&t->u.dyn));
+  case flow_table_hashlin: return(tommy_hashlin_memory_usage(&t->u.lin));
+  case flow_table_open:    return((t->u.open.mask + 1) * sizeof(struct flow_table_slot));
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+size_t flow_table_index_memory(struct flow_table *t) {
+  if(t->type == flow_table_open)
+    return(flow_table_memory_usage(t));
+
+  return(flow_table_memory_usage(t) - (size_t)flow_table_count(t) * sizeof(tommy_node));
+}
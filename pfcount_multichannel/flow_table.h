@@ -0,0 +1,88 @@
+/*
+ *
+ * Flow table used by pfcount_multichannel to map sIP/dIP pairs to counters.
+ *
+ * The legacy tommy_hashdyn backend reallocates the whole bucket array in a
+ * single step when it doubles, which stalls the capture thread for
+ * 100 ms - 1 sec with 1-10 M entries. The other two backends keep the
+ * insert cost bounded:
+ *
+ * - hashlin: tommy_hashlin, grows/shrinks one bucket at a time
+ * - open:    linear probing over a preallocated slot array, never resized.
+ *            Inserts fail once the configured capacity is reached.
+ *
+ * With the flows evicted at the end of each attack wave, the tommy tables
+ * would halve and double again at every wave: flow_table_set_shrink()
+ * keeps them at a floor and waits FLOW_TABLE_SHRINK_DELAY removes before
+ * halving.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _FLOW_TABLE_H_
+#define _FLOW_TABLE_H_
+
+#include <sys/types.h>
+
+#include "../tommyds-1.0/tommyhashdyn.h"
+#include "../tommyds-1.0/tommyhashlin.h"
+
+typedef enum {
+  flow_table_hashdyn = 0,
+  flow_table_hashlin,
+  flow_table_open
+} flow_table_type;
+
+#define DEFAULT_FLOW_TABLE_CAPACITY  (1 << 20)
+#define FLOW_TABLE_BATCH             64 /* hashes resolved per bucket_batch() call */
+#define FLOW_TABLE_SHRINK_DELAY      (1 << 16) /* removes at a low load before a tommy table halves */
+
+struct flow_table_slot {
+  tommy_hash_t hash;
+  void *data;      /* NULL = empty slot */
+};
+
+struct flow_table_open {
+  struct flow_table_slot *slots;
+  u_int32_t mask, count, max_count;
+};
+
+struct flow_table {
+  flow_table_type type;
+  union {
+    tommy_hashdyn dyn;
+    tommy_hashlin lin;
+    struct flow_table_open open;
+  } u;
+};
+
+/*
+  Compare callback: return 0 when 'data' matches 'arg'.
+  A NULL callback matches the first element with the same hash.
+*/
+typedef tommy_compare_func flow_table_compare_func;
+
+int   flow_table_parse_type(const char *name, flow_table_type *type);
+const char* flow_table_type_name(flow_table_type type);
+
+int   flow_table_init(struct flow_table *t, flow_table_type type, u_int32_t capacity);
+/* The empty table sized for 'flows' and its memory written: no resize nor page fault up to them */
+void  flow_table_reserve(struct flow_table *t, u_int32_t flows);
+/* Once grown to 'min_flows' a tommy table stays there, and halves after 'delay' removes at a low load */
+void  flow_table_set_shrink(struct flow_table *t, u_int32_t min_flows, u_int32_t delay);
+void  flow_table_done(struct flow_table *t);
+int   flow_table_insert(struct flow_table *t, tommy_node *node, void *data, tommy_hash_t hash);
+void* flow_table_search(struct flow_table *t, flow_table_compare_func *cmp, const void *arg, tommy_hash_t hash);
+void  flow_table_prefetch(struct flow_table *t, tommy_hash_t hash);
+void  flow_table_prefetch_batch(struct flow_table *t, const tommy_hash_t *hash, u_int32_t num);
+void* flow_table_remove_existing(struct flow_table *t, tommy_node *node);
+u_int32_t flow_table_count(struct flow_table *t);
+size_t flow_table_memory_usage(struct flow_table *t);
+/* Without the nodes, embedded in the records of the caller */
+size_t flow_table_index_memory(struct flow_table *t);
+
+#endif /* _FLOW_TABLE_H_ */
@@ -0,0 +1,433 @@
+/*
+ *
+ * Forensic capture for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE /* O_DIRECT */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "forensic.h"
+
+#define FORENSIC_ALIGN       4096
+#define FORENSIC_IDLE_USEC   10000
+
+#define PCAP_MAGIC           0xa1b2c3d4
+#define PCAP_LINKTYPE_ETH    1
+
+struct pcap_file_hdr {
+  u_int32_t magic;
+  u_int16_t version_major, version_minor;
+  int32_t   thiszone;
+  u_int32_t sigfigs, snaplen, linktype;
+};
+
+struct pcap_rec_hdr {
+  u_int32_t ts_sec, ts_usec, caplen, len;
+};
+
+/* *************************************** */
+
+/* Capture thread side */
+
+static inline int forensic_match(const struct forensic *f, const struct victim_key *dst) {
+  u_int32_t i, seq;
+  int hit;
+
+  for(i = 0; i < FORENSIC_MAX_VICTIMS; i++) {
+    const struct forensic_slot *s = &f->slot[i];
+
+    do {
+      seq = s->seq;
+      forensic_barrier();
+      hit = s->active && victim_key_equal(&s->key, dst);
+      forensic_barrier();
+    } while((seq & 1) || (seq != s->seq));
+
+    if(hit) return(i);
+  }
+
+  return(-1);
+}
+
+/* *************************************** */
+
+static void forensic_handover(struct forensic_thread *t) {
+  /* The full ring has room for all the buffers of the thread */
+  spsc_ring_push(t->full, &t->current);
+
+  if(spsc_ring_pop(t->free, &t->current) == 0)
+    t->current->used = 0;
+  else
+    t->current = NULL;
+}
+
+/* *************************************** */
+
+void forensic_packet_slow(struct forensic_thread *t, const struct pfring_pkthdr *h, const u_char *frame) {
+  struct forensic_record *r;
+  struct victim_key dst;
+  struct timeval ts;
+  u_int32_t caplen, need;
+  int slot;
+
+  ts.tv_sec = h->ts.tv_sec, ts.tv_usec = h->ts.tv_usec;
+  if(ts.tv_sec == 0)
+    gettimeofday(&ts, NULL);
+
+  if(t->current == NULL) {
+    if(spsc_ring_pop(t->free, &t->current) != 0)
+      t->current = NULL;
+    else
+      t->current->used = 0;
+  } else if((t->current->used > 0) && ((u_int32_t)ts.tv_sec - t->current->first_sec >= FORENSIC_BUFFER_AGE))
+    forensic_handover(t);
+
+  switch(h->extended_hdr.parsed_pkt.eth_type) {
+  case 0x0800:
+    memset(&dst, 0, sizeof(dst));
+    dst.addr[0] = h->extended_hdr.parsed_pkt.ipv4_dst, dst.version = 4;
+    break;
+  case 0x86DD:
+    memcpy(dst.addr, &h->extended_hdr.parsed_pkt.ipv6_dst, sizeof(dst.addr));
+    dst.version = 6;
+    break;
+  default:
+    return;
+  }
+
+  if((t->forensic->num_active == 0) || ((slot = forensic_match(t->forensic, &dst)) < 0))
+    return;
+
+  caplen = (h->caplen > 0xFFFF) ? 0xFFFF : h->caplen;
+  need = sizeof(struct forensic_record) + ((caplen + 3) & ~3);
+
+  if((t->current != NULL) && (t->current->used + need > FORENSIC_BUFFER_SIZE))
+    forensic_handover(t);
+
+  if(t->current == NULL) {
+    t->lost++; /* the writer is behind */
+    return;
+  }
+
+  if(t->current->used == 0)
+    t->current->first_sec = ts.tv_sec;
+
+  r = (struct forensic_record*)&t->current->data[t->current->used];
+  r->slot = slot, r->caplen = caplen, r->len = h->len;
+  r->ts_sec = ts.tv_sec, r->ts_usec = ts.tv_usec;
+  memcpy(&r[1], frame, caplen);
+  t->current->used += need;
+  t->recorded++;
+}
+
+/* *************************************** */
+
+/* Writer side */
+
+static int forensic_flush(struct forensic *f, struct forensic_file *ff) {
+  int rc = 0;
+
+  if(ff->used == 0)
+    return(0);
+
+  if(ff->used < FORENSIC_FILE_BUFFER_SIZE && ff->direct) {
+    /* The tail of the file is not a multiple of the alignment */
+    int flags = fcntl(ff->fd, F_GETFL);
+
+    if(flags != -1) fcntl(ff->fd, F_SETFL, flags & ~O_DIRECT);
+    ff->direct = 0;
+  }
+
+  if(write(ff->fd, ff->buf, ff->used) != (ssize_t)ff->used)
+    f->write_errors++, rc = -1;
+  else
+    f->bytes += ff->used;
+
+  ff->size += ff->used, ff->used = 0;
+  return(rc);
+}
+
+/* *************************************** */
+
+static void forensic_append(struct forensic *f, struct forensic_file *ff, const void *data, u_int32_t len) {
+  const u_char *p = data;
+
+  while(len > 0) {
+    u_int32_t n = FORENSIC_FILE_BUFFER_SIZE - ff->used;
+
+    if(n > len) n = len;
+    memcpy(&ff->buf[ff->used], p, n);
+    ff->used += n, p += n, len -= n;
+
+    if(ff->used == FORENSIC_FILE_BUFFER_SIZE)
+      forensic_flush(f, ff);
+  }
+}
+
+/* *************************************** */
+
+static void forensic_close(struct forensic *f, struct forensic_file *ff) {
+  if(ff->fd < 0)
+    return;
+
+  forensic_flush(f, ff);
+  close(ff->fd);
+  ff->fd = -1;
+}
+
+/* *************************************** */
+
+static int forensic_open(struct forensic *f, u_int32_t slot) {
+  const struct forensic_slot *s = &f->slot[slot];
+  struct forensic_file *ff = &f->file[slot];
+  struct pcap_file_hdr hdr;
+  char addr[INET6_ADDRSTRLEN], path[512];
+
+  if(s->key.version == 4) {
+    u_int32_t a = htonl(s->key.addr[0]);
+
+    inet_ntop(AF_INET, &a, addr, sizeof(addr));
+  } else
+    inet_ntop(AF_INET6, s->key.addr, addr, sizeof(addr));
+
+  if(ff->part == 0)
+    snprintf(path, sizeof(path), "%s/%s-%u.pcap", f->dir, addr, s->started);
+  else
+    snprintf(path, sizeof(path), "%s/%s-%u.%u.pcap", f->dir, addr, s->started, ff->part);
+
+  ff->direct = 1;
+  if(((ff->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644)) < 0) && (errno == EINVAL)) {
+    ff->direct = 0; /* e.g. tmpfs */
+    ff->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+
+  if(ff->fd < 0) {
+    f->write_errors++;
+    return(-1);
+  }
+
+  ff->size = 0, ff->used = 0;
+  f->files++;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = PCAP_MAGIC, hdr.version_major = 2, hdr.version_minor = 4;
+  hdr.snaplen = 0xFFFF, hdr.linktype = PCAP_LINKTYPE_ETH;
+  forensic_append(f, ff, &hdr, sizeof(hdr));
+  return(0);
+}
+
+/* *************************************** */
+
+static void forensic_write_buffer(struct forensic *f, const struct forensic_buffer *b) {
+  u_int32_t offset = 0;
+
+  while(offset < b->used) {
+    const struct forensic_record *r = (const struct forensic_record*)&b->data[offset];
+    struct forensic_file *ff = &f->file[r->slot];
+    struct pcap_rec_hdr rec;
+
+    offset += sizeof(struct forensic_record) + ((r->caplen + 3) & ~3);
+
+    if(f->slot[r->slot].closed)
+      continue; /* late, the capture is over */
+
+    rec.ts_sec = r->ts_sec, rec.ts_usec = r->ts_usec, rec.caplen = r->caplen, rec.len = r->len;
+
+    if((ff->fd >= 0) && (ff->size + ff->used + sizeof(rec) + r->caplen > FORENSIC_MAX_FILE_SIZE)) {
+      forensic_close(f, ff);
+      ff->part++;
+    }
+
+    if((ff->fd < 0) && (forensic_open(f, r->slot) != 0))
+      continue;
+
+    forensic_append(f, ff, &rec, sizeof(rec));
+    forensic_append(f, ff, &r[1], r->caplen);
+  }
+}
+
+/* *************************************** */
+
+/* Files are closed FORENSIC_GRACE sec after the end of the capture: the threads may still hold its last packets */
+static void forensic_close_ended(struct forensic *f, u_int8_t all) {
+  u_int32_t i, now = time(NULL);
+
+  for(i = 0; i < FORENSIC_MAX_VICTIMS; i++) {
+    struct forensic_slot *s = &f->slot[i];
+
+    if(s->closed) continue;
+    if(!all) {
+      if(s->active) continue;
+      forensic_barrier(); /* ended is set before active is cleared */
+      if(now < s->ended + FORENSIC_GRACE) continue;
+    }
+
+    forensic_close(f, &f->file[i]);
+    f->file[i].part = 0;
+    forensic_barrier();
+    s->closed = 1; /* the reporter may reuse the slot */
+  }
+}
+
+/* *************************************** */
+
+static void* forensic_writer(void *arg) {
+  struct forensic *f = arg;
+  struct forensic_buffer *b;
+  u_int32_t i;
+
+  for(;;) {
+    u_int8_t stop = f->shutdown, idle = 1;
+
+    for(i = 0; i < f->num_threads; i++) {
+      struct forensic_thread *t = &f->thread[i];
+
+      while(spsc_ring_pop(t->full, &b) == 0) {
+	forensic_write_buffer(f, b);
+	spsc_ring_push(t->free, &b);
+	idle = 0;
+      }
+    }
+
+    forensic_close_ended(f, stop);
+
+    if(stop)
+      break;
+
+    if(idle)
+      usleep(FORENSIC_IDLE_USEC);
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+int forensic_init(struct forensic *f, const char *dir, u_int32_t duration, u_int32_t num_threads) {
+  size_t ring_size = spsc_ring_size(FORENSIC_BUFFERS, sizeof(struct forensic_buffer*));
+  u_int32_t i, j;
+
+  memset(f, 0, sizeof(struct forensic));
+  snprintf(f->dir, sizeof(f->dir), "%s", dir);
+  f->duration = duration, f->num_threads = num_threads;
+
+  for(i = 0; i < FORENSIC_MAX_VICTIMS; i++) {
+    f->slot[i].closed = 1;
+    f->file[i].fd = -1;
+    if(posix_memalign((void**)&f->file[i].buf, FORENSIC_ALIGN, FORENSIC_FILE_BUFFER_SIZE) != 0)
+      return(-1);
+  }
+
+  if((f->thread = calloc(num_threads, sizeof(struct forensic_thread))) == NULL)
+    return(-1);
+
+  for(i = 0; i < num_threads; i++) {
+    struct forensic_thread *t = &f->thread[i];
+    void *full, *empty;
+
+    if((posix_memalign(&full, 64, ring_size) != 0) || (posix_memalign(&empty, 64, ring_size) != 0))
+      return(-1);
+
+    t->forensic = f;
+    t->full = spsc_ring_init(full, FORENSIC_BUFFERS, sizeof(struct forensic_buffer*));
+    t->free = spsc_ring_init(empty, FORENSIC_BUFFERS, sizeof(struct forensic_buffer*));
+
+    for(j = 0; j < FORENSIC_BUFFERS; j++) {
+      struct forensic_buffer *b = malloc(sizeof(struct forensic_buffer));
+
+      if(b == NULL) return(-1);
+      memset(b, 0, sizeof(struct forensic_buffer)); /* no page faults while capturing */
+      spsc_ring_push(t->free, &b);
+    }
+  }
+
+  if(pthread_create(&f->writer, NULL, forensic_writer, f) != 0)
+    return(-1);
+
+  return(0);
+}
+
+/* *************************************** */
+
+void forensic_term(struct forensic *f) {
+  u_int32_t i;
+
+  if(f->thread == NULL)
+    return;
+
+  /* The capture threads are gone: their last buffer is queued from here */
+  for(i = 0; i < f->num_threads; i++) {
+    struct forensic_thread *t = &f->thread[i];
+
+    if((t->current != NULL) && (t->current->used > 0))
+      forensic_handover(t);
+  }
+
+  f->shutdown = 1;
+  pthread_join(f->writer, NULL);
+}
+
+/* *************************************** */
+
+int forensic_watch(struct forensic *f, const struct victim_key *key, u_int32_t now) {
+  struct forensic_slot *s = NULL;
+  u_int32_t i;
+
+  for(i = 0; i < FORENSIC_MAX_VICTIMS; i++) {
+    if(!f->slot[i].closed && victim_key_equal(&f->slot[i].key, key))
+      return(0); /* captured, or its file is being closed */
+
+    if(f->slot[i].closed && (s == NULL))
+      s = &f->slot[i];
+  }
+
+  if(s == NULL)
+    return(-1);
+
+  s->seq++;
+  forensic_barrier();
+  s->key = *key;
+  s->started = now, s->until = now + f->duration;
+  s->closed = 0, s->active = 1;
+  forensic_barrier();
+  s->seq++;
+
+  f->num_active++, f->captures++;
+  return(1);
+}
+
+/* *************************************** */
+
+void forensic_tick(struct forensic *f, u_int32_t now) {
+  u_int32_t i;
+
+  for(i = 0; i < FORENSIC_MAX_VICTIMS; i++) {
+    struct forensic_slot *s = &f->slot[i];
+
+    if(!s->active || (now < s->until)) continue;
+
+    s->seq++;
+    forensic_barrier();
+    s->ended = now;
+    forensic_barrier();
+    s->active = 0;
+    forensic_barrier();
+    s->seq++;
+
+    f->num_active--;
+  }
+}
@@ -0,0 +1,126 @@
+/*
+ *
+ * Forensic capture for pfcount_multichannel (-j): a pcap file with the
+ * traffic of each victim above a packet rate, for a few seconds.
+ *
+ * The reporter arms a slot per victim (forensic_watch()). Capture threads
+ * check the destination of their packets against the armed slots (one
+ * load of num_active when none is armed) and copy the matching ones into
+ * a preallocated per thread buffer. Full buffers, or buffers older than
+ * FORENSIC_BUFFER_AGE, are handed to the writer thread over an SPSC ring
+ * and come back on another one once written: with FORENSIC_BUFFERS per
+ * thread the capture keeps filling a buffer while the previous ones are
+ * on their way to disk. When no buffer is free the packet is counted as
+ * lost: a capture thread never waits for the disk.
+ *
+ * The writer sorts the records into one pcap file per victim, named
+ * <dir>/<victim>-<start time>[.<part>].pcap and rotated every
+ * FORENSIC_MAX_FILE_SIZE bytes. Files are written FORENSIC_FILE_BUFFER_SIZE
+ * bytes at a time with O_DIRECT (when the file system supports it), so
+ * that the capture does not fill the page cache.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _FORENSIC_H_
+#define _FORENSIC_H_
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "pfring.h"
+#include "spsc.h"
+#include "victims.h"
+
+#define FORENSIC_MAX_VICTIMS       8          /* captured at the same time */
+#define FORENSIC_BUFFERS           4          /* per thread */
+#define FORENSIC_BUFFER_SIZE       (1 << 20)
+#define FORENSIC_BUFFER_AGE        1          /* sec */
+#define FORENSIC_FILE_BUFFER_SIZE  (1 << 20)  /* per victim, multiple of the O_DIRECT alignment */
+#define FORENSIC_MAX_FILE_SIZE     (1ULL << 30)
+#define FORENSIC_GRACE             3          /* sec after the end of a capture before its file is closed */
+#define DEFAULT_FORENSIC_DURATION  30         /* sec */
+
+#if defined(__i386__) || defined(__x86_64__)
+#define forensic_barrier() __asm__ __volatile__("": : :"memory")
+#else
+#define forensic_barrier() __sync_synchronize()
+#endif
+
+struct forensic_slot {
+  volatile u_int32_t seq;        /* odd while the reporter updates key/active */
+  volatile u_int8_t active;
+  volatile u_int8_t closed;      /* writer: the file of the previous capture is closed */
+  struct victim_key key;
+  u_int32_t started, until, ended; /* reporter */
+};
+
+/* In the thread buffers: a record followed by caplen bytes, padded to 4 */
+struct forensic_record {
+  u_int16_t slot, caplen;
+  u_int32_t len;
+  u_int32_t ts_sec, ts_usec;
+};
+
+struct forensic_buffer {
+  u_int32_t used, first_sec;
+  u_char data[FORENSIC_BUFFER_SIZE];
+};
+
+struct forensic_thread {
+  struct forensic *forensic;
+  struct forensic_buffer *current;  /* being filled, NULL when none was free */
+  struct spsc_ring *full, *free;    /* of struct forensic_buffer* */
+  u_int64_t recorded, lost;         /* pkts */
+};
+
+struct forensic_file {
+  int fd;                           /* -1: not open */
+  u_int8_t direct;
+  u_int32_t part;
+  u_int64_t size;                   /* written */
+  u_int32_t used;
+  u_char *buf;                      /* FORENSIC_FILE_BUFFER_SIZE, page aligned */
+};
+
+struct forensic {
+  volatile u_int32_t num_active;
+  struct forensic_slot slot[FORENSIC_MAX_VICTIMS];
+  char dir[256];
+  u_int32_t duration;               /* sec */
+
+  u_int32_t num_threads;
+  struct forensic_thread *thread;
+
+  /* Writer */
+  pthread_t writer;
+  volatile u_int8_t shutdown;
+  struct forensic_file file[FORENSIC_MAX_VICTIMS];
+  u_int64_t captures, files, bytes, write_errors;
+};
+
+/* Allocates the buffers of num_threads threads and starts the writer */
+int  forensic_init(struct forensic *f, const char *dir, u_int32_t duration, u_int32_t num_threads);
+/* Once the capture threads are stopped: writes what is left and closes the files */
+void forensic_term(struct forensic *f);
+
+/* Reporter: 1 when a capture of key starts, 0 if already captured, -1 when no slot is free */
+int  forensic_watch(struct forensic *f, const struct victim_key *key, u_int32_t now);
+/* Reporter: ends the captures that are over */
+void forensic_tick(struct forensic *f, u_int32_t now);
+
+void forensic_packet_slow(struct forensic_thread *t, const struct pfring_pkthdr *h, const u_char *frame);
+
+/* Capture thread: records the frame (parsed h) if its destination is captured */
+static inline void forensic_packet(struct forensic_thread *t, const struct pfring_pkthdr *h, const u_char *frame) {
+  if((t->forensic->num_active == 0) && ((t->current == NULL) || (t->current->used == 0)))
+    return; /* nothing to record nor to hand over */
+
+  forensic_packet_slow(t, h, frame);
+}
+
+#endif /* _FORENSIC_H_ */
@@ -0,0 +1,206 @@
+/*
+ *
+ * Handoff of the rings of pfcount_multichannel to the next process
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+
+/* *************************************** */
+
+static int handoff_address(struct sockaddr_un *sun, const char *path) {
+  if(strlen(path) >= sizeof(sun->sun_path)) {
+    errno = ENAMETOOLONG;
+    return(-1);
+  }
+
+  memset(sun, 0, sizeof(struct sockaddr_un));
+  sun->sun_family = AF_UNIX;
+  snprintf(sun->sun_path, sizeof(sun->sun_path), "%s", path);
+  return(0);
+}
+
+/* *************************************** */
+
+/* New process */
+
+int handoff_receive(const char *path, struct handoff_msg *msg, int fds[HANDOFF_MAX_RINGS]) {
+  char control[CMSG_SPACE(HANDOFF_MAX_RINGS * sizeof(int))];
+  struct timeval timeout = { HANDOFF_TIMEOUT, 0 };
+  struct sockaddr_un sun;
+  struct cmsghdr *cmsg;
+  struct msghdr m;
+  struct iovec iov;
+  u_int32_t num_fds = 0, i;
+  ssize_t len;
+  int fd;
+
+  if(handoff_address(&sun, path) != 0)
+    return(-1);
+
+  /* Message boundaries: the fds come with the one message */
+  if((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+    return(-1);
+
+  if(connect(fd, (struct sockaddr*)&sun, sizeof(sun)) != 0) {
+    close(fd);
+    /* Nobody there, or a socket file left by a process gone */
+    return(((errno == ENOENT) || (errno == ECONNREFUSED)) ? 0 : -1);
+  }
+
+  /* The old process first waits for its threads to leave their rings */
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  memset(&m, 0, sizeof(m));
+  iov.iov_base = msg, iov.iov_len = sizeof(struct handoff_msg);
+  m.msg_iov = &iov, m.msg_iovlen = 1;
+  m.msg_control = control, m.msg_controllen = sizeof(control);
+
+  len = recvmsg(fd, &m, 0);
+  close(fd);
+
+  if(len <= 0)
+    return((len == 0) ? 0 /* refused */ : -1);
+
+  for(cmsg = CMSG_FIRSTHDR(&m); cmsg != NULL; cmsg = CMSG_NXTHDR(&m, cmsg)) {
+    if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+      num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+      break;
+    }
+  }
+
+  if((len != sizeof(struct handoff_msg)) || (m.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+     || (msg->magic != HANDOFF_MAGIC) || (msg->version != HANDOFF_VERSION)
+     || (msg->num_rings == 0) || (msg->num_rings != num_fds)) {
+    for(i = 0; i < num_fds; i++)
+      close(fds[i]);
+    errno = EPROTO;
+    return(-1);
+  }
+
+  msg->device[sizeof(msg->device) - 1] = '\0';
+  msg->shm_flows[sizeof(msg->shm_flows) - 1] = '\0';
+  return(num_fds);
+}
+
+/* *************************************** */
+
+/* Running process */
+
+int handoff_listen(struct handoff *h, const char *path) {
+  struct sockaddr_un sun;
+  struct stat st;
+
+  memset(h, 0, sizeof(struct handoff));
+  h->listen_fd = h->conn_fd = -1;
+
+  if(handoff_address(&sun, path) != 0)
+    return(-1);
+
+  if((h->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+    return(-1);
+
+  unlink(path); /* the previous process is done with it */
+
+  if((bind(h->listen_fd, (struct sockaddr*)&sun, sizeof(sun)) != 0)
+     || (listen(h->listen_fd, 1) != 0)
+     || (stat(path, &st) != 0)) {
+    close(h->listen_fd);
+    h->listen_fd = -1;
+    return(-1);
+  }
+
+  snprintf(h->path, sizeof(h->path), "%s", path);
+  h->ino = st.st_ino;
+  return(0);
+}
+
+/* *************************************** */
+
+int handoff_accept(struct handoff *h, int timeout_ms) {
+  struct pollfd pfd;
+  int rc;
+
+  pfd.fd = h->listen_fd, pfd.events = POLLIN, pfd.revents = 0;
+
+  if((rc = poll(&pfd, 1, timeout_ms)) <= 0)
+    return(((rc == 0) || (errno == EINTR)) ? 0 : -1);
+
+  if((h->conn_fd = accept(h->listen_fd, NULL, NULL)) < 0)
+    return(((errno == EAGAIN) || (errno == EINTR) || (errno == ECONNABORTED)) ? 0 : -1);
+
+  return(1);
+}
+
+/* *************************************** */
+
+void handoff_refuse(struct handoff *h) {
+  if(h->conn_fd >= 0)
+    close(h->conn_fd);
+
+  h->conn_fd = -1;
+}
+
+/* *************************************** */
+
+int handoff_send(struct handoff *h, const struct handoff_msg *msg, const int *fds) {
+  char control[CMSG_SPACE(HANDOFF_MAX_RINGS * sizeof(int))];
+  struct cmsghdr *cmsg;
+  struct msghdr m;
+  struct iovec iov;
+  int rc;
+
+  if((msg->num_rings == 0) || (msg->num_rings > HANDOFF_MAX_RINGS)) {
+    errno = EINVAL;
+    return(-1);
+  }
+
+  memset(&m, 0, sizeof(m));
+  memset(control, 0, sizeof(control));
+  iov.iov_base = (void*)msg, iov.iov_len = sizeof(struct handoff_msg);
+  m.msg_iov = &iov, m.msg_iovlen = 1;
+  m.msg_control = control, m.msg_controllen = CMSG_SPACE(msg->num_rings * sizeof(int));
+
+  cmsg = CMSG_FIRSTHDR(&m);
+  cmsg->cmsg_level = SOL_SOCKET, cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(msg->num_rings * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, msg->num_rings * sizeof(int));
+
+  rc = (sendmsg(h->conn_fd, &m, MSG_NOSIGNAL) == (ssize_t)sizeof(struct handoff_msg)) ? 0 : -1;
+  handoff_refuse(h); /* done with the connection either way */
+  return(rc);
+}
+
+/* *************************************** */
+
+void handoff_close(struct handoff *h) {
+  struct stat st;
+
+  handoff_refuse(h);
+
+  if(h->listen_fd >= 0) {
+    close(h->listen_fd);
+    /* The new process listens on the same path by now */
+    if((stat(h->path, &st) == 0) && (st.st_ino == h->ino))
+      unlink(h->path);
+  }
+
+  h->listen_fd = -1;
+}
@@ -0,0 +1,75 @@
+/*
+ *
+ * Handoff of the rings and of the flow tables of pfcount_multichannel to the
+ * process that replaces it (-x handoff:<path>), for an upgrade without a
+ * gap in the capture.
+ *
+ * The running process listens on the UNIX socket <path>. A new process
+ * started with the same option connects to it before opening any ring:
+ * the old one stops its capture threads (pfring_breakloop(), the sockets
+ * are not shut down), unmaps its rings (pfring_detach_fd()) and sends the
+ * socket fds (SCM_RIGHTS) with a handoff_msg. The new process maps the
+ * same rings again (pfring_open_fd()) and goes on from their remove_off:
+ * the packets that arrived in between are queued in the rings, as the
+ * sockets were never closed, and their rules, cluster and channel binding
+ * stay as they were.
+ *
+ * The flow records travel in the shared memory flow tables (-x flows:,
+ * see shmtable.h): the new process maps the segments named in the message
+ * before creating its own under the same names, and its threads load the
+ * flows from them. The rest of the state (mitigation rules, snapshots of
+ * the sketches) is rebuilt as on a restart.
+ *
+ * With no process listening (or one that refuses, its capture already
+ * stopping) the new process opens its rings as usual.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _HANDOFF_H_
+#define _HANDOFF_H_
+
+#include <sys/types.h>
+
+#define HANDOFF_MAGIC      0x50464844 /* "PFHD" */
+#define HANDOFF_VERSION    1
+#define HANDOFF_MAX_RINGS  64
+#define HANDOFF_TIMEOUT    30         /* sec the new process waits for the rings */
+
+struct handoff_msg {
+  u_int32_t magic, version;
+  u_int32_t num_rings;               /* fds attached, ring order */
+  u_int32_t num_threads;             /* flow table segments, one per thread */
+  u_int32_t caplen, flags;           /* the rings were opened with (pfring_open()) */
+  char device[64];
+  char shm_flows[64];                /* -x flows: name, "" = none */
+};
+
+struct handoff {
+  int listen_fd, conn_fd;
+  char path[108];
+  ino_t ino;                         /* of the socket file */
+};
+
+/*
+  New process: the rings of the process listening on path, fds[] in ring
+  order. Returns their number, 0 if there is no such process or it
+  refused, -1 (errno set) on error.
+*/
+int  handoff_receive(const char *path, struct handoff_msg *msg, int fds[HANDOFF_MAX_RINGS]);
+
+/* Running process: returns 0, -1 (errno set) */
+int  handoff_listen(struct handoff *h, const char *path);
+/* 1 once a new process connected (conn_fd), 0 after timeout_ms, -1 on error */
+int  handoff_accept(struct handoff *h, int timeout_ms);
+/* The connected process gets nothing: it opens its own rings */
+void handoff_refuse(struct handoff *h);
+/* msg->num_rings fds to the connected process: returns 0, -1 (errno set) */
+int  handoff_send(struct handoff *h, const struct handoff_msg *msg, const int *fds);
+void handoff_close(struct handoff *h);
+
+#endif /* _HANDOFF_H_ */
@@ -0,0 +1,429 @@
+/*
+ *
+ * Sampled deep inspection of the amplification payloads for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "inspect.h"
+
+#define INSPECT_IDLE_USEC    10000
+#define INSPECT_BATCH        64
+
+#define MEMCACHED_UDP_HDR    8
+
+/* *************************************** */
+
+/* Capture thread side */
+
+static inline void inspect_key(struct victim_key *k, const struct pfring_pkthdr *h, u_int8_t src) {
+  if(h->extended_hdr.parsed_pkt.eth_type == 0x0800) {
+    memset(k, 0, sizeof(struct victim_key));
+    k->addr[0] = src ? h->extended_hdr.parsed_pkt.ipv4_src : h->extended_hdr.parsed_pkt.ipv4_dst;
+    k->version = 4;
+  } else {
+    memcpy(k->addr, src ? &h->extended_hdr.parsed_pkt.ipv6_src : &h->extended_hdr.parsed_pkt.ipv6_dst,
+	   sizeof(k->addr));
+    k->version = 6;
+  }
+}
+
+/* *************************************** */
+
+void inspect_packet_slow(struct inspect_thread *t, const struct pfring_pkthdr *h, const u_char *frame, amp_class amp) {
+  struct inspect_bucket *b;
+  struct inspect_sample *s;
+  struct victim_key dst;
+  u_int32_t now, offset, caplen;
+
+  if((h->extended_hdr.parsed_pkt.eth_type != 0x0800) && (h->extended_hdr.parsed_pkt.eth_type != 0x86DD))
+    return;
+
+  inspect_key(&dst, h, 0);
+  now = (h->ts.tv_sec != 0) ? (u_int32_t)h->ts.tv_sec : (u_int32_t)time(NULL);
+
+  b = &t->bucket[victim_hash(&dst) & (INSPECT_BUCKETS - 1)];
+  if(b->sec != now)
+    b->sec = now, b->tokens = t->inspect->rate;
+
+  if(b->tokens == 0)
+    return;
+
+  b->tokens--;
+
+  offset = h->extended_hdr.parsed_pkt.offset.payload_offset;
+  if(offset == 0) offset = h->extended_hdr.parsed_pkt.offset.l4_offset + 8 /* UDP header */;
+  if(offset >= h->caplen)
+    return; /* non-first fragment, or no payload */
+
+  if((s = spsc_ring_reserve(t->queue, 0)) == NULL) {
+    t->lost++; /* the worker is behind */
+    return;
+  }
+
+  caplen = h->caplen - offset;
+  if(caplen > INSPECT_SNAPLEN) caplen = INSPECT_SNAPLEN;
+
+  s->victim = dst;
+  inspect_key(&s->reflector, h, 1);
+  s->amp = amp, s->caplen = caplen, s->len = h->len;
+  memcpy(s->payload, &frame[offset], caplen);
+  spsc_ring_commit(t->queue, 1);
+  t->sampled++;
+}
+
+/* *************************************** */
+
+/* Worker side: the payload parsers, 0 on success */
+
+static const char* dns_type_name(u_int16_t qtype) {
+  switch(qtype) {
+  case 1:   return("A");
+  case 2:   return("NS");
+  case 5:   return("CNAME");
+  case 6:   return("SOA");
+  case 12:  return("PTR");
+  case 15:  return("MX");
+  case 16:  return("TXT");
+  case 28:  return("AAAA");
+  case 43:  return("DS");
+  case 46:  return("RRSIG");
+  case 48:  return("DNSKEY");
+  case 255: return("ANY");
+  default:  return(NULL);
+  }
+}
+
+static int parse_dns(const u_char *p, u_int32_t len, char *what, size_t what_len) {
+  u_int32_t off = 12;
+  const char *name;
+  u_int16_t qtype;
+
+  if((len < 12) || (((p[4] << 8) | p[5]) == 0))
+    return(-1); /* no question */
+
+  /* The name of the first question: labels, or a pointer */
+  while(off < len) {
+    if(p[off] == 0) {
+      off++;
+      break;
+    } else if((p[off] & 0xC0) == 0xC0) {
+      off += 2;
+      break;
+    } else
+      off += p[off] + 1;
+  }
+
+  if(off + 2 > len)
+    return(-1);
+
+  qtype = (p[off] << 8) | p[off + 1];
+  if((name = dns_type_name(qtype)) != NULL)
+    snprintf(what, what_len, "%s", name);
+  else
+    snprintf(what, what_len, "type %u", qtype);
+  return(0);
+}
+
+static int parse_ntp(const u_char *p, u_int32_t len, char *what, size_t what_len) {
+  u_int8_t mode;
+
+  if(len < 4)
+    return(-1);
+
+  switch(mode = p[0] & 0x07) {
+  case 4:
+    snprintf(what, what_len, "server");
+    break;
+  case 6: /* control: readvar... */
+    snprintf(what, what_len, ((p[1] & 0x1F) == 2) ? "readvar" : "control %u", p[1] & 0x1F);
+    break;
+  case 7: /* private: REQ_MON_GETLIST(_1) */
+    snprintf(what, what_len, ((p[3] == 20) || (p[3] == 42)) ? "monlist" : "private %u", p[3]);
+    break;
+  default:
+    snprintf(what, what_len, "mode %u", mode);
+  }
+
+  return(0);
+}
+
+/* The ST: header of the reply, else its first line */
+static int parse_ssdp(const u_char *p, u_int32_t len, char *what, size_t what_len) {
+  u_int32_t i, start = 0, eol;
+
+  for(i = 0; i < len; i = eol + 1) {
+    for(eol = i; (eol < len) && (p[eol] != '\r') && (p[eol] != '\n'); eol++)
+      ;
+
+    if((eol - i > 3) && !strncasecmp((const char*)&p[i], "ST:", 3)) {
+      for(start = i + 3; (start < eol) && (p[start] == ' '); start++)
+	;
+      snprintf(what, what_len, "%.*s", (int)(eol - start), (const char*)&p[start]);
+      return(0);
+    }
+  }
+
+  for(eol = 0; (eol < len) && (p[eol] != '\r') && (p[eol] != '\n'); eol++)
+    ;
+
+  if(eol == 0)
+    return(-1);
+
+  snprintf(what, what_len, "%.*s", (int)eol, (const char*)p);
+  return(0);
+}
+
+/* The first word after the UDP frame header: VALUE, STAT, END... */
+static int parse_memcached(const u_char *p, u_int32_t len, char *what, size_t what_len) {
+  u_int32_t i;
+
+  if(len <= MEMCACHED_UDP_HDR)
+    return(-1);
+
+  p += MEMCACHED_UDP_HDR, len -= MEMCACHED_UDP_HDR;
+  for(i = 0; (i < len) && (p[i] >= 'A') && (p[i] <= 'Z'); i++)
+    ;
+
+  if(i == 0)
+    return(-1);
+
+  snprintf(what, what_len, "%.*s", (int)i, (const char*)p);
+  return(0);
+}
+
+/* *************************************** */
+
+/* Under lock */
+
+static void inspect_count_signature(struct inspect *f, u_int8_t amp, const char *what, u_int32_t len) {
+  struct inspect_signature *sig;
+  u_int32_t i;
+
+  for(i = 0; i < f->num_signatures; i++)
+    if((f->signature[i].amp == amp) && !strcmp(f->signature[i].what, what))
+      break;
+
+  if(i == f->num_signatures) {
+    if(i == INSPECT_MAX_SIGNATURES) {
+      f->overflow++;
+      return;
+    }
+
+    sig = &f->signature[f->num_signatures++];
+    memset(sig, 0, sizeof(struct inspect_signature));
+    sig->amp = amp;
+    snprintf(sig->what, sizeof(sig->what), "%s", what);
+  } else
+    sig = &f->signature[i];
+
+  sig->pkts++, sig->bytes += len;
+}
+
+/* Open addressing, up to 3/4 full */
+static void inspect_count_reflector(struct inspect *f, const struct inspect_sample *s) {
+  const struct victim_key *key = &s->reflector;
+  u_int32_t i = victim_hash(key) & (INSPECT_MAX_REFLECTORS - 1);
+  struct inspect_reflector *r;
+
+  while((r = &f->reflector[i])->pkts > 0) {
+    if(victim_key_equal(&r->key, key))
+      break;
+    i = (i + 1) & (INSPECT_MAX_REFLECTORS - 1);
+  }
+
+  if(r->pkts == 0) {
+    if(f->num_reflectors >= INSPECT_MAX_REFLECTORS / 4 * 3) {
+      f->overflow++;
+      return;
+    }
+
+    f->num_reflectors++;
+    r->key = *key, r->amp = s->amp;
+  }
+
+  r->victim = s->victim;
+  r->pkts++, r->bytes += s->len;
+  if(s->len > r->max_len) r->max_len = s->len;
+}
+
+/* *************************************** */
+
+static void inspect_sample(struct inspect *f, const struct inspect_sample *s) {
+  char what[sizeof(f->signature[0].what)];
+  int rc;
+
+  switch(s->amp) {
+  case amp_dns:       rc = parse_dns(s->payload, s->caplen, what, sizeof(what)); break;
+  case amp_ntp:       rc = parse_ntp(s->payload, s->caplen, what, sizeof(what)); break;
+  case amp_ssdp:      rc = parse_ssdp(s->payload, s->caplen, what, sizeof(what)); break;
+  case amp_memcached: rc = parse_memcached(s->payload, s->caplen, what, sizeof(what)); break;
+  default:            rc = -1;
+  }
+
+  pthread_mutex_lock(&f->lock);
+  f->inspected++;
+  if(rc == 0)
+    inspect_count_signature(f, s->amp, what, s->len);
+  else
+    f->unparsed++;
+  inspect_count_reflector(f, s);
+  pthread_mutex_unlock(&f->lock);
+}
+
+/* *************************************** */
+
+static void* inspect_worker(void *arg) {
+  struct inspect *f = arg;
+  void *samples[INSPECT_BATCH];
+  u_int32_t i, j, n;
+
+  for(;;) {
+    u_int8_t stop = f->shutdown, idle = 1;
+
+    for(i = 0; i < f->num_threads; i++) {
+      struct inspect_thread *t = &f->thread[i];
+
+      while((n = spsc_ring_peek(t->queue, samples, INSPECT_BATCH)) > 0) {
+	for(j = 0; j < n; j++)
+	  inspect_sample(f, samples[j]);
+	spsc_ring_release(t->queue, n);
+	idle = 0;
+      }
+    }
+
+    if(stop)
+      break;
+
+    if(idle)
+      usleep(INSPECT_IDLE_USEC);
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+int inspect_init(struct inspect *f, u_int32_t rate, u_int32_t num_threads) {
+  size_t ring_size = spsc_ring_size(INSPECT_QUEUE_LEN, sizeof(struct inspect_sample));
+  u_int32_t i;
+
+  memset(f, 0, sizeof(struct inspect));
+  f->rate = rate, f->num_threads = num_threads;
+  pthread_mutex_init(&f->lock, NULL);
+
+  if((f->thread = calloc(num_threads, sizeof(struct inspect_thread))) == NULL)
+    return(-1);
+
+  for(i = 0; i < num_threads; i++) {
+    struct inspect_thread *t = &f->thread[i];
+    void *mem;
+
+    if(posix_memalign(&mem, 64, ring_size) != 0)
+      return(-1);
+
+    memset(mem, 0, ring_size); /* no page faults while capturing */
+    t->inspect = f;
+    t->queue = spsc_ring_init(mem, INSPECT_QUEUE_LEN, sizeof(struct inspect_sample));
+  }
+
+  if(pthread_create(&f->worker, NULL, inspect_worker, f) != 0)
+    return(-1);
+
+  return(0);
+}
+
+/* *************************************** */
+
+void inspect_term(struct inspect *f) {
+  if(f->thread == NULL)
+    return;
+
+  f->shutdown = 1;
+  pthread_join(f->worker, NULL);
+}
+
+/* *************************************** */
+
+static char* inspect_addr(const struct victim_key *key, char *buf, size_t len) {
+  if(key->version == 4) {
+    u_int32_t a = htonl(key->addr[0]);
+
+    inet_ntop(AF_INET, &a, buf, len);
+  } else
+    inet_ntop(AF_INET6, key->addr, buf, len);
+
+  return(buf);
+}
+
+static int cmp_signatures(const void *a, const void *b) {
+  const struct inspect_signature *x = a, *y = b;
+
+  return((x->pkts < y->pkts) ? 1 : (x->pkts > y->pkts) ? -1 : 0);
+}
+
+static int cmp_reflectors(const void *a, const void *b) {
+  const struct inspect_reflector *x = a, *y = b;
+
+  return((x->bytes < y->bytes) ? 1 : (x->bytes > y->bytes) ? -1 : 0);
+}
+
+/* *************************************** */
+
+void inspect_report(struct inspect *f, FILE *out) {
+  struct inspect_reflector *top;
+  u_int64_t sampled = 0, lost = 0;
+  u_int32_t i, n = 0;
+  char addr[INET6_ADDRSTRLEN], victim[INET6_ADDRSTRLEN];
+
+  for(i = 0; i < f->num_threads; i++)
+    sampled += f->thread[i].sampled, lost += f->thread[i].lost;
+
+  sampled -= f->reported_sampled, f->reported_sampled += sampled;
+  lost -= f->reported_lost, f->reported_lost += lost;
+
+  if((top = malloc(sizeof(struct inspect_reflector) * INSPECT_MAX_REFLECTORS)) == NULL)
+    return;
+
+  pthread_mutex_lock(&f->lock);
+
+  fprintf(out, "Inspection: [%llu pkts sampled][%llu lost: queue full][%llu inspected][%llu unparsed]"
+	  "[%llu not counted: tables full]\n", (unsigned long long)sampled, (unsigned long long)lost,
+	  (unsigned long long)f->inspected, (unsigned long long)f->unparsed, (unsigned long long)f->overflow);
+
+  qsort(f->signature, f->num_signatures, sizeof(struct inspect_signature), cmp_signatures);
+  for(i = 0; (i < f->num_signatures) && (i < INSPECT_TOP); i++)
+    fprintf(out, "  %-10s %-32s [%llu pkts][avg %llu bytes]\n", amp_class_name[f->signature[i].amp],
+	    f->signature[i].what, (unsigned long long)f->signature[i].pkts,
+	    (unsigned long long)(f->signature[i].bytes / f->signature[i].pkts));
+
+  for(i = 0; i < INSPECT_MAX_REFLECTORS; i++)
+    if(f->reflector[i].pkts > 0)
+      top[n++] = f->reflector[i];
+
+  qsort(top, n, sizeof(struct inspect_reflector), cmp_reflectors);
+  for(i = 0; (i < n) && (i < INSPECT_TOP); i++)
+    fprintf(out, "  reflector %-15s %-10s -> %-15s [%llu pkts][%llu bytes][max %u bytes]\n",
+	    inspect_addr(&top[i].key, addr, sizeof(addr)), amp_class_name[top[i].amp],
+	    inspect_addr(&top[i].victim, victim, sizeof(victim)),
+	    (unsigned long long)top[i].pkts, (unsigned long long)top[i].bytes, top[i].max_len);
+
+  f->num_signatures = 0, f->num_reflectors = 0;
+  memset(f->reflector, 0, sizeof(f->reflector));
+  f->inspected = 0, f->unparsed = 0, f->overflow = 0;
+
+  pthread_mutex_unlock(&f->lock);
+  free(top);
+}
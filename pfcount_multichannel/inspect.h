@@ -0,0 +1,120 @@
+/*
+ *
+ * Sampled deep inspection of the amplification payloads for
+ * pfcount_multichannel (-j inspect:<pps>).
+ *
+ * The replies of the DNS, NTP, SSDP and memcached reflectors (UDP, by
+ * source port, see amp_classify()) are sampled per destination: a token
+ * bucket per hash bucket of destinations lets up to <pps> packets a
+ * second through on each thread. The sampled packets (the first
+ * INSPECT_SNAPLEN bytes of their payload) are copied into a per thread
+ * SPSC queue; a full queue counts the packet as lost, a capture thread
+ * never waits. Any other packet costs a compare on the protocol and a
+ * switch on the source port.
+ *
+ * The worker thread parses the payloads into a signature: the DNS query
+ * type (ANY, TXT...), the NTP mode or mode 7 request (monlist), the SSDP
+ * search target, the memcached reply (VALUE, STATS). It counts the
+ * signatures, and the reflectors with their largest reply, per interval:
+ * the reporter prints the top ones and resets the tables.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _INSPECT_H_
+#define _INSPECT_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "pfring.h"
+#include "spsc.h"
+#include "victims.h"
+
+#define INSPECT_BUCKETS         4096  /* token buckets per thread, by destination hash */
+#define INSPECT_QUEUE_LEN       4096  /* samples per thread */
+#define INSPECT_SNAPLEN         256   /* payload bytes */
+#define INSPECT_MAX_SIGNATURES  256
+#define INSPECT_MAX_REFLECTORS  4096
+#define INSPECT_TOP             10
+
+struct inspect_sample {
+  struct victim_key victim, reflector;
+  u_int8_t amp;                      /* amp_class */
+  u_int16_t caplen;                  /* payload bytes copied */
+  u_int32_t len;                     /* of the frame */
+  u_char payload[INSPECT_SNAPLEN];
+};
+
+struct inspect_bucket {
+  u_int32_t sec, tokens;
+};
+
+struct inspect_thread {
+  struct inspect *inspect;
+  struct inspect_bucket bucket[INSPECT_BUCKETS];
+  struct spsc_ring *queue;           /* of struct inspect_sample */
+  u_int64_t sampled, lost;           /* pkts */
+};
+
+struct inspect_signature {
+  u_int8_t amp;
+  char what[32];
+  u_int64_t pkts, bytes;
+};
+
+struct inspect_reflector {
+  struct victim_key key, victim;     /* victim: the last one */
+  u_int8_t amp;
+  u_int64_t pkts, bytes;
+  u_int32_t max_len;
+};
+
+struct inspect {
+  u_int32_t rate;                    /* pkt/sec per destination bucket and thread */
+
+  u_int32_t num_threads;
+  struct inspect_thread *thread;
+
+  /* Worker, the tables under lock: read and reset by the reporter */
+  pthread_t worker;
+  volatile u_int8_t shutdown;
+  pthread_mutex_t lock;
+  u_int32_t num_signatures, num_reflectors;
+  struct inspect_signature signature[INSPECT_MAX_SIGNATURES];
+  struct inspect_reflector reflector[INSPECT_MAX_REFLECTORS];
+  u_int64_t inspected, unparsed, overflow; /* samples; overflow: tables full */
+  u_int64_t reported_sampled, reported_lost; /* reporter */
+};
+
+/* Allocates the queues of num_threads threads and starts the worker */
+int  inspect_init(struct inspect *f, u_int32_t rate, u_int32_t num_threads);
+/* Once the capture threads are stopped */
+void inspect_term(struct inspect *f);
+/* Reporter: prints the top signatures and reflectors of the interval, then resets them */
+void inspect_report(struct inspect *f, FILE *out);
+
+void inspect_packet_slow(struct inspect_thread *t, const struct pfring_pkthdr *h, const u_char *frame, amp_class amp);
+
+/* Capture thread: samples the frame (parsed h) if it is an amplification reply */
+static inline void inspect_packet(struct inspect_thread *t, const struct pfring_pkthdr *h, const u_char *frame) {
+  amp_class amp = amp_classify(h->extended_hdr.parsed_pkt.l3_proto, h->extended_hdr.parsed_pkt.l4_src_port);
+
+  switch(amp) {
+  case amp_dns:
+  case amp_ntp:
+  case amp_ssdp:
+  case amp_memcached:
+    inspect_packet_slow(t, h, frame, amp);
+    break;
+  default:
+    break;
+  }
+}
+
+#endif /* _INSPECT_H_ */
@@ -0,0 +1,272 @@
+/*
+ *
+ * IPFIX export of the flow counters of pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE /* sendmmsg() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include "ipfix.h"
+
+#define IPFIX_VERSION         10
+#define IPFIX_HDR_LEN         16
+#define IPFIX_SET_HDR_LEN     4
+#define IPFIX_TEMPLATE_SET    2
+#define IPFIX_TEMPLATE_IPV4   256
+#define IPFIX_TEMPLATE_IPV6   257
+
+/* Information element id, length */
+static const u_int16_t template_ipv4[][2] = {
+  { 8, 4 },   /* sourceIPv4Address */
+  { 12, 4 },  /* destinationIPv4Address */
+  { 4, 1 },   /* protocolIdentifier */
+  { 86, 8 },  /* packetTotalCount */
+  { 85, 8 },  /* octetTotalCount */
+  { 150, 4 }, /* flowStartSeconds */
+  { 151, 4 }, /* flowEndSeconds */
+  { 136, 1 }, /* flowEndReason */
+  { 61, 1 }   /* flowDirection */
+};
+
+static const u_int16_t template_ipv6[][2] = {
+  { 27, 16 }, /* sourceIPv6Address */
+  { 28, 16 }, /* destinationIPv6Address */
+  { 4, 1 }, { 86, 8 }, { 85, 8 }, { 150, 4 }, { 151, 4 }, { 136, 1 }, { 61, 1 }
+};
+
+#define NUM_FIELDS(t)    (sizeof(t) / sizeof(t[0]))
+#define RECORD_LEN_IPV4  (4 + 4 + 1 + 8 + 8 + 4 + 4 + 1 + 1)
+#define RECORD_LEN_IPV6  (16 + 16 + 1 + 8 + 8 + 4 + 4 + 1 + 1)
+
+static const u_int8_t protocol_id[4] = { 6, 17, 1, 255 };
+
+/* *************************************** */
+
+static inline u_char* put16(u_char *p, u_int16_t v) {
+  p[0] = v >> 8, p[1] = v;
+  return(p + 2);
+}
+
+static inline u_char* put32(u_char *p, u_int32_t v) {
+  p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+  return(p + 4);
+}
+
+static inline u_char* put64(u_char *p, u_int64_t v) {
+  return(put32(put32(p, v >> 32), v));
+}
+
+/* *************************************** */
+
+int ipfix_open(struct ipfix_exporter *e, const char *collector, u_int32_t domain_id) {
+  struct addrinfo hints, *res;
+  char host[256], port[16], *sep;
+  int rc;
+
+  memset(e, 0, sizeof(struct ipfix_exporter));
+  e->fd = -1, e->domain_id = domain_id;
+
+  snprintf(host, sizeof(host), "%s", collector);
+  snprintf(port, sizeof(port), "%u", IPFIX_DEFAULT_PORT);
+
+  if(host[0] == '[') {
+    /* [<IPv6>]:<port> */
+    if((sep = strchr(host, ']')) == NULL) return(-1);
+    *sep++ = '\0';
+    memmove(host, host + 1, strlen(host));
+    if(*sep == ':') snprintf(port, sizeof(port), "%s", sep + 1);
+  } else if(((sep = strchr(host, ':')) != NULL) && (strchr(sep + 1, ':') == NULL)) {
+    *sep = '\0';
+    snprintf(port, sizeof(port), "%s", sep + 1);
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC, hints.ai_socktype = SOCK_DGRAM;
+
+  if(getaddrinfo(host, port, &hints, &res) != 0)
+    return(-1);
+
+  if((e->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) >= 0
+     && (rc = connect(e->fd, res->ai_addr, res->ai_addrlen)) != 0) {
+    close(e->fd);
+    e->fd = -1;
+  }
+
+  freeaddrinfo(res);
+  return((e->fd >= 0) ? 0 : -1);
+}
+
+/* *************************************** */
+
+void ipfix_close(struct ipfix_exporter *e) {
+  if(e->fd < 0)
+    return;
+
+  ipfix_flush(e);
+  close(e->fd);
+  e->fd = -1;
+}
+
+/* *************************************** */
+
+static void close_set(struct ipfix_exporter *e) {
+  u_char *msg = e->msg[e->num_msgs - 1];
+
+  if(e->set_id == 0)
+    return;
+
+  put16(&msg[e->set_start + 2], e->msg_len[e->num_msgs - 1] - e->set_start);
+  e->set_id = 0;
+}
+
+/* *************************************** */
+
+static void close_msg(struct ipfix_exporter *e) {
+  if(!e->msg_open)
+    return;
+
+  close_set(e);
+  put16(&e->msg[e->num_msgs - 1][2], e->msg_len[e->num_msgs - 1]);
+  e->msg_open = 0;
+}
+
+/* *************************************** */
+
+static u_char* add_template(u_char *p, u_int16_t id, const u_int16_t (*fields)[2], u_int16_t num_fields) {
+  u_int16_t i;
+
+  p = put16(put16(p, id), num_fields);
+  for(i = 0; i < num_fields; i++)
+    p = put16(put16(p, fields[i][0]), fields[i][1]);
+
+  return(p);
+}
+
+/* *************************************** */
+
+static void open_msg(struct ipfix_exporter *e, u_int32_t now) {
+  u_char *msg, *p;
+
+  if(e->num_msgs == IPFIX_BATCH)
+    ipfix_flush(e);
+
+  msg = e->msg[e->num_msgs++];
+  p = put16(msg, IPFIX_VERSION);
+  p = put16(p, 0); /* length, set by close_msg() */
+  p = put32(p, now);
+  p = put32(p, e->sequence);
+  p = put32(p, e->domain_id);
+
+  if((e->templates_sent == 0) || (now - e->templates_sent >= IPFIX_TEMPLATE_REFRESH)) {
+    u_char *set = p;
+
+    p = put16(put16(p, IPFIX_TEMPLATE_SET), 0);
+    p = add_template(p, IPFIX_TEMPLATE_IPV4, template_ipv4, NUM_FIELDS(template_ipv4));
+    p = add_template(p, IPFIX_TEMPLATE_IPV6, template_ipv6, NUM_FIELDS(template_ipv6));
+    put16(set + 2, p - set);
+    e->templates_sent = now;
+  }
+
+  e->msg_len[e->num_msgs - 1] = p - msg;
+  e->msg_open = 1, e->set_id = 0;
+}
+
+/* *************************************** */
+
+/* Room for a record of set_id, at the end of the current set or of a new one */
+static u_char* reserve_record(struct ipfix_exporter *e, u_int16_t set_id, u_int32_t record_len, u_int32_t now) {
+  u_int32_t *len;
+
+  if(e->msg_open && (e->set_id != set_id)
+     && (e->msg_len[e->num_msgs - 1] + IPFIX_SET_HDR_LEN + record_len > IPFIX_MAX_MSG_LEN))
+    close_msg(e);
+
+  if(e->msg_open && (e->set_id == set_id) && (e->msg_len[e->num_msgs - 1] + record_len > IPFIX_MAX_MSG_LEN))
+    close_msg(e);
+
+  if(!e->msg_open)
+    open_msg(e, now);
+
+  len = &e->msg_len[e->num_msgs - 1];
+
+  if(e->set_id != set_id) {
+    close_set(e);
+    e->set_id = set_id, e->set_start = *len;
+    put16(put16(&e->msg[e->num_msgs - 1][*len], set_id), 0);
+    *len += IPFIX_SET_HDR_LEN;
+  }
+
+  *len += record_len;
+  return(&e->msg[e->num_msgs - 1][*len - record_len]);
+}
+
+/* *************************************** */
+
+void ipfix_add_flow(struct ipfix_exporter *e, const struct ipfix_flow *f, u_int32_t now) {
+  u_int32_t i;
+  u_char *p;
+
+  for(i = 0; i < 4; i++) {
+    if(f->pkts[i] == 0) continue;
+
+    if(f->version == 4) {
+      p = reserve_record(e, IPFIX_TEMPLATE_IPV4, RECORD_LEN_IPV4, now);
+      p = put32(put32(p, f->src[0]), f->dst[0]);
+    } else {
+      p = reserve_record(e, IPFIX_TEMPLATE_IPV6, RECORD_LEN_IPV6, now);
+      memcpy(p, f->src, 16), memcpy(p + 16, f->dst, 16); /* already in network byte order */
+      p += 32;
+    }
+
+    *p++ = protocol_id[i];
+    p = put64(put64(p, f->pkts[i]), f->bytes[i]);
+    p = put32(put32(p, f->first_seen), f->last_seen);
+    *p++ = f->end_reason;
+    *p++ = f->rx_direction ? 0 : 1; /* ingress, egress */
+
+    e->sequence++, e->records++;
+  }
+}
+
+/* *************************************** */
+
+void ipfix_flush(struct ipfix_exporter *e) {
+  struct mmsghdr msgs[IPFIX_BATCH];
+  struct iovec iov[IPFIX_BATCH];
+  u_int32_t i, sent = 0;
+  int rc;
+
+  close_msg(e);
+
+  if(e->num_msgs == 0)
+    return;
+
+  memset(msgs, 0, sizeof(msgs));
+  for(i = 0; i < e->num_msgs; i++) {
+    iov[i].iov_base = e->msg[i], iov[i].iov_len = e->msg_len[i];
+    msgs[i].msg_hdr.msg_iov = &iov[i], msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while(sent < e->num_msgs) {
+    if((rc = sendmmsg(e->fd, &msgs[sent], e->num_msgs - sent, 0)) <= 0) {
+      e->send_errors += e->num_msgs - sent; /* e.g. ECONNREFUSED: no collector listening */
+      break;
+    }
+
+    sent += rc;
+  }
+
+  e->messages += sent;
+  e->num_msgs = 0;
+}
@@ -0,0 +1,81 @@
+/*
+ *
+ * IPFIX export of the flow counters of pfcount_multichannel (-E).
+ *
+ * The capture threads only queue an ipfix_flow (a copy of the counters
+ * of a flow) on an SPSC ring when the flow is evicted, or every active
+ * timeout while it lives, as the aging hand visits it. The reporter
+ * drains the rings on its timer and encodes the flows into IPFIX
+ * messages (RFC 7011) built in preallocated buffers, sent
+ * IPFIX_BATCH at a time with one sendmmsg() on a connected UDP socket:
+ * encoding and sending never run on the capture cores.
+ *
+ * A flow of pfcount is an address pair, both directions in one record: it
+ * is exported as one data record per direction and protocol class seen
+ * (TCP, UDP, ICMP, others, the latter with protocolIdentifier 255) with
+ * total counts since the flow was created.
+ * Two templates (256: IPv4, 257: IPv6) are sent in the first message and
+ * again every IPFIX_TEMPLATE_REFRESH sec, as UDP transport requires.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _IPFIX_H_
+#define _IPFIX_H_
+
+#include <sys/types.h>
+
+#define IPFIX_DEFAULT_PORT            4739
+#define IPFIX_MAX_MSG_LEN             1400   /* no IP fragmentation on Ethernet */
+#define IPFIX_BATCH                   32     /* messages per sendmmsg() */
+#define IPFIX_TEMPLATE_REFRESH        60     /* sec */
+#define IPFIX_FLOW_QUEUE_RECORDS      8192   /* per thread */
+#define DEFAULT_IPFIX_ACTIVE_TIMEOUT  60     /* sec */
+
+/* flowEndReason */
+typedef enum {
+  ipfix_idle_timeout = 1,
+  ipfix_active_timeout = 2,
+  ipfix_forced_end = 4,
+  ipfix_lack_of_resources = 5
+} ipfix_end_reason;
+
+/* Queued by the capture threads */
+struct ipfix_flow {
+  u_int32_t src[4], dst[4];    /* as struct flow_key */
+  u_int8_t  version, end_reason, rx_direction, pad;
+  u_int32_t first_seen, last_seen;
+  u_int64_t pkts[4], bytes[4]; /* TCP, UDP, ICMP, others */
+};
+
+struct ipfix_exporter {
+  int fd;                      /* -1: closed */
+  u_int32_t domain_id;
+  u_int32_t sequence;          /* data records encoded so far */
+  u_int32_t templates_sent;    /* sec, 0 = never */
+
+  /* Messages being built */
+  u_int32_t num_msgs;
+  u_int8_t  msg_open;          /* the last one is still being filled */
+  u_int16_t set_id;            /* of the set being filled, 0 = none */
+  u_int32_t set_start;
+  u_int32_t msg_len[IPFIX_BATCH];
+  u_char    msg[IPFIX_BATCH][IPFIX_MAX_MSG_LEN];
+
+  u_int64_t records, messages, send_errors;
+};
+
+/* collector: "<host>[:<port>]", "[<IPv6>]:<port>" */
+int  ipfix_open(struct ipfix_exporter *e, const char *collector, u_int32_t domain_id);
+void ipfix_close(struct ipfix_exporter *e);
+
+/* Encodes the records of f, sending the full batches */
+void ipfix_add_flow(struct ipfix_exporter *e, const struct ipfix_flow *f, u_int32_t now);
+/* Sends the messages built so far */
+void ipfix_flush(struct ipfix_exporter *e);
+
+#endif /* _IPFIX_H_ */
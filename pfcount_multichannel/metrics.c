@@ -0,0 +1,284 @@
+/*
+ *
+ * Prometheus metrics endpoint of pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "metrics.h"
+
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+/* *************************************** */
+
+/* Listener side */
+
+static int send_all(int fd, const char *data, size_t len) {
+  ssize_t n;
+
+  while(len > 0) {
+    if((n = send(fd, data, len, MSG_NOSIGNAL)) <= 0) {
+      if((n < 0) && (errno == EINTR)) continue;
+      return(-1);
+    }
+    data += n, len -= n;
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+static void serve(struct metrics *m, int fd) {
+  struct timeval timeout = { METRICS_TIMEOUT, 0 };
+  char request[METRICS_MAX_REQUEST], header[256];
+  const struct metrics_buffer *b;
+  size_t len = 0;
+  ssize_t n;
+  int idx, hlen;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  /* The request line is enough: the headers and a body are not read */
+  while((len < sizeof(request) - 1) && (memchr(request, '\n', len) == NULL)) {
+    if((n = recv(fd, &request[len], sizeof(request) - 1 - len, 0)) <= 0) {
+      if((n < 0) && (errno == EINTR)) continue;
+      m->errors++;
+      return;
+    }
+    len += n;
+  }
+  request[len] = '\0';
+
+  /* The whole path: "/metricsfoo" is not ours */
+  if(strncmp(request, "GET /metrics ", 13) && strncmp(request, "GET /metrics?", 13)
+     && strncmp(request, "GET / ", 6)) {
+    static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    send_all(fd, not_found, sizeof(not_found) - 1);
+    m->errors++;
+    return;
+  }
+
+  if(m->current < 0) {
+    static const char unavailable[] = "HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    send_all(fd, unavailable, sizeof(unavailable) - 1); /* before the first report */
+    return;
+  }
+
+  /* Marked before being read: either the reporter sees the mark, or we see it has moved on */
+  for(;;) {
+    idx = m->current;
+    __sync_fetch_and_add(&m->buf[idx].readers, 1);
+    if(idx == m->current) break;
+    __sync_fetch_and_sub(&m->buf[idx].readers, 1);
+  }
+
+  b = &m->buf[idx];
+  hlen = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+		  "Connection: close\r\n\r\n", METRICS_CONTENT_TYPE, b->len);
+
+  if((send_all(fd, header, hlen) == 0) && (send_all(fd, b->data, b->len) == 0))
+    m->scrapes++;
+  else
+    m->errors++;
+
+  __sync_fetch_and_sub(&m->buf[idx].readers, 1);
+}
+
+/* *************************************** */
+
+static void* listener(void *arg) {
+  struct metrics *m = (struct metrics*)arg;
+  struct pollfd pfd;
+  int fd;
+
+  while(m->running) {
+    pfd.fd = m->listen_fd, pfd.events = POLLIN, pfd.revents = 0;
+
+    /* Woken up now and then to see if we are done */
+    if(poll(&pfd, 1, 500) <= 0)
+      continue;
+
+    if((fd = accept(m->listen_fd, NULL, NULL)) < 0)
+      continue;
+
+    /* One client at a time: a scrape is a copy of a buffer */
+    serve(m, fd);
+    close(fd);
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+int metrics_open(struct metrics *m, const char *addr) {
+  char host[128], port[16], *sep, *port_str;
+  struct addrinfo hints, *res;
+  int i, one = 1;
+
+  memset(m, 0, sizeof(struct metrics));
+  m->listen_fd = -1, m->current = -1;
+
+  /* [<addr>:]<port>, [<IPv6>]:<port> */
+  if((size_t)snprintf(host, sizeof(host), "%s", addr) >= sizeof(host)) {
+    errno = EINVAL;
+    return(-1);
+  }
+
+  if((sep = strrchr(host, ':')) != NULL) {
+    *sep = '\0', port_str = sep + 1;
+    if((host[0] == '[') && (sep[-1] == ']'))
+      sep[-1] = '\0', memmove(host, host + 1, strlen(host));
+  } else
+    port_str = host;
+
+  if(strlen(port_str) >= sizeof(port)) {
+    errno = EINVAL;
+    return(-1);
+  }
+
+  strcpy(port, port_str);
+  if(port_str == host)
+    host[0] = '\0';
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC, hints.ai_socktype = SOCK_STREAM, hints.ai_flags = AI_PASSIVE;
+
+  if(getaddrinfo((host[0] != '\0') ? host : NULL, port, &hints, &res) != 0) {
+    errno = EINVAL;
+    return(-1);
+  }
+
+  if((m->listen_fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) >= 0) {
+    setsockopt(m->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if((bind(m->listen_fd, res->ai_addr, res->ai_addrlen) != 0) || (listen(m->listen_fd, 16) != 0)) {
+      close(m->listen_fd);
+      m->listen_fd = -1;
+    }
+  }
+
+  freeaddrinfo(res);
+  if(m->listen_fd < 0)
+    return(-1);
+
+  for(i = 0; i < 2; i++) {
+    if((m->buf[i].data = malloc(METRICS_INITIAL_SIZE)) == NULL)
+      goto error;
+    m->buf[i].size = METRICS_INITIAL_SIZE;
+  }
+
+  m->running = 1;
+  if((errno = pthread_create(&m->listener, NULL, listener, m)) != 0) {
+    m->running = 0;
+    goto error;
+  }
+
+  return(0);
+
+ error:
+  close(m->listen_fd);
+  m->listen_fd = -1;
+  free(m->buf[0].data), free(m->buf[1].data);
+  m->buf[0].data = m->buf[1].data = NULL;
+  return(-1);
+}
+
+/* *************************************** */
+
+void metrics_close(struct metrics *m) {
+  if(m->listen_fd < 0)
+    return;
+
+  m->running = 0;
+  pthread_join(m->listener, NULL);
+  close(m->listen_fd);
+  free(m->buf[0].data), free(m->buf[1].data);
+  memset(m, 0, sizeof(struct metrics));
+  m->listen_fd = -1, m->current = -1;
+}
+
+/* *************************************** */
+
+/* Reporter side */
+
+int metrics_begin(struct metrics *m) {
+  m->back = (m->current < 0) ? 0 : (m->current ^ 1);
+
+  __sync_synchronize();
+  if(m->buf[m->back].readers != 0) {
+    m->skipped++;
+    return(-1);
+  }
+
+  m->buf[m->back].len = 0, m->overflow = 0;
+  return(0);
+}
+
+/* *************************************** */
+
+void metrics_printf(struct metrics *m, const char *fmt, ...) {
+  struct metrics_buffer *b = &m->buf[m->back];
+  va_list ap;
+  int n;
+
+  for(;;) {
+    va_start(ap, fmt);
+    n = vsnprintf(&b->data[b->len], b->size - b->len, fmt, ap);
+    va_end(ap);
+
+    if((n < 0) || m->overflow)
+      return;
+
+    if(b->len + n < b->size) {
+      b->len += n;
+      return;
+    }
+
+    /* Nobody reads the back buffer: it can move */
+    {
+      char *data = realloc(b->data, b->size * 2);
+
+      if(data == NULL) {
+	m->overflow = 1;
+	return;
+      }
+      b->data = data, b->size *= 2;
+    }
+  }
+}
+
+/* *************************************** */
+
+void metrics_family(struct metrics *m, const char *name, const char *type, const char *help) {
+  metrics_printf(m, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* *************************************** */
+
+void metrics_publish(struct metrics *m) {
+  if(m->overflow)
+    return; /* the scrapers keep the previous report */
+
+  __sync_synchronize();
+  m->current = m->back;
+  __sync_synchronize();
+}
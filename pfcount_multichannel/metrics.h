@@ -0,0 +1,68 @@
+/*
+ *
+ * Prometheus metrics of pfcount_multichannel over HTTP
+ * (-x metrics:[<addr>:]<port>).
+ *
+ * A scrape must not cost the capture anything, nor the reporter a walk of
+ * the tables: print_stats() renders the exposition text once per report,
+ * from the totals it has already read, into the back one of two buffers
+ * and publishes it. A listener thread answers every GET with the buffer
+ * last published, as it is: no formatting, no lock, whatever the number
+ * of scrapers.
+ *
+ * The listener marks the buffer it sends (readers). The reporter renders
+ * into the other one, unless it is still being sent from the report
+ * before (a scraper slower than the report interval): that report is
+ * then skipped and the scrapers keep the previous one.
+ *
+ * The values are the counters since the start (Prometheus computes the
+ * rates) and the gauges of the last report; a metric family starts with
+ * metrics_family(), its samples follow.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#define METRICS_INITIAL_SIZE  65536  /* bytes per buffer, doubled as needed */
+#define METRICS_MAX_REQUEST   1024   /* bytes of the request read, the rest is ignored */
+#define METRICS_TIMEOUT       2      /* sec to read a request or send a reply */
+
+struct metrics_buffer {
+  char *data;
+  size_t len, size;
+  volatile u_int32_t readers;        /* listener sending it */
+};
+
+struct metrics {
+  int listen_fd;
+  pthread_t listener;
+  volatile u_int8_t running;
+  struct metrics_buffer buf[2];
+  volatile int current;              /* published, -1 before the first report */
+  int back;                          /* being rendered: reporter only */
+  u_int8_t overflow;                 /* out of memory while rendering: not published */
+  u_int64_t skipped;                 /* reports, back buffer still being sent */
+  volatile u_int64_t scrapes, errors; /* listener */
+};
+
+/* Listens on [<addr>:]<port> and starts the listener: returns 0, -1 (errno set) */
+int  metrics_open(struct metrics *m, const char *addr);
+void metrics_close(struct metrics *m);
+
+/* Reporter: 0 if the back buffer is free to render, -1 (report skipped) */
+int  metrics_begin(struct metrics *m);
+void metrics_family(struct metrics *m, const char *name, const char *type, const char *help);
+void metrics_printf(struct metrics *m, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+/* The rendered buffer is the one served from now on */
+void metrics_publish(struct metrics *m);
+
+#endif /* _METRICS_H_ */
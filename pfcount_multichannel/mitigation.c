@@ -0,0 +1,350 @@
+/*
+ *
+ * Drop rules for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "mitigation.h"
+
+/* *************************************** */
+
+void mitigation_init(struct mitigation *m, pfring **rings, u_int32_t num_rings,
+                     u_int32_t rules_per_sec, u_int32_t idle_timeout) {
+  memset(m, 0, sizeof(struct mitigation));
+
+  m->rings = rings, m->num_rings = num_rings;
+  m->rules_per_sec = rules_per_sec ? rules_per_sec : DEFAULT_MITIGATION_RULES_PER_SEC;
+  m->idle_timeout  = idle_timeout ? idle_timeout : DEFAULT_MITIGATION_IDLE;
+
+  /* Perfect filters are per device: any channel can install them */
+  m->use_hw = (num_rings > 0) && (rings[0]->ft_device_type == intel_82599_family);
+  m->steer_queue = -1;
+}
+
+/* *************************************** */
+
+int mitigation_steer(struct mitigation *m, int queue_id) {
+  if(!m->use_hw || (queue_id < -1) || (queue_id >= (int)m->num_rings))
+    return(-1);
+
+  m->steer_queue = queue_id;
+  return(0);
+}
+
+/* *************************************** */
+
+static void hw_rule(struct mitigation *m, struct mitigation_rule *r, u_int16_t rule_id, hw_filtering_rule *rule) {
+  intel_82599_perfect_filter_hw_rule *p = &rule->rule_family.perfect_rule;
+
+  memset(rule, 0, sizeof(hw_filtering_rule));
+  rule->rule_family_type = intel_82599_perfect_filter_rule, rule->rule_id = rule_id;
+  p->queue_id = m->steer_queue; /* -1 = drop */
+  p->proto = r->proto, p->d_addr = r->key.addr[0], p->d_port = r->port;
+}
+
+/* *************************************** */
+
+/* The same rule on every channel: each socket has its own rule list */
+static int install_sw_rule(struct mitigation *m, struct mitigation_rule *r, u_int16_t rule_id) {
+  filtering_rule rule;
+  u_int32_t i, added = 0;
+
+  memset(&rule, 0, sizeof(rule));
+  rule.rule_id = rule_id;
+  rule.rule_action = dont_forward_packet_and_stop_rule_evaluation;
+  rule.core_fields.proto = r->proto;
+  rule.core_fields.dport_low = rule.core_fields.dport_high = r->port;
+
+  if(r->key.version == 4) {
+    rule.core_fields.dhost.v4 = r->key.addr[0];
+    rule.core_fields.dhost_mask.v4 = 0xFFFFFFFF;
+  } else {
+    memcpy(&rule.core_fields.dhost.v6, r->key.addr, sizeof(struct in6_addr));
+    memset(&rule.core_fields.dhost_mask.v6, 0xFF, sizeof(struct in6_addr));
+  }
+
+  for(i = 0; i < m->num_rings; i++) {
+    /* EEXIST: the kernel still has it from a previous install */
+    if((pfring_add_filtering_rule(m->rings[i], &rule) == 0) || (errno == EEXIST))
+      added++;
+  }
+
+  return((added > 0) ? 0 : -1);
+}
+
+/* *************************************** */
+
+/* The NIC rules queued by mitigation_block(), in one call: those it refuses become kernel rules */
+static void flush_hw_rules(struct mitigation *m) {
+  hw_filtering_rule rules[MAX_MITIGATION_RULES];
+  u_int32_t slots[MAX_MITIGATION_RULES], i, n = 0, done = 0;
+  int in_use, rc;
+
+  if(m->num_pending == 0)
+    return;
+
+  /* The slots left to the other applications: the rest falls back to kernel rules */
+  in_use = pfring_get_num_hw_rules(m->rings[0]);
+  if(in_use < 0) in_use = 0;
+
+  for(i = 0; i < MAX_MITIGATION_RULES; i++) {
+    if(!m->rules[i].pending)
+      continue;
+
+    if(in_use + n >= MITIGATION_HW_FILTER_SLOTS) {
+      m->hw_full++;
+      continue;
+    }
+
+    hw_rule(m, &m->rules[i], MITIGATION_RULE_ID_BASE + i, &rules[n]);
+    slots[n++] = i;
+  }
+
+  if((n > 0) && ((rc = pfring_add_hw_rules(m->rings[0], rules, n)) > 0))
+    done = rc; /* the first ones: our ids are never duplicated */
+
+  for(i = 0; i < n; i++)
+    if(i < done)
+      m->rules[slots[i]].hw = 1, m->rules[slots[i]].pending = 0, m->num_hw++;
+
+  for(i = 0; i < MAX_MITIGATION_RULES; i++) {
+    struct mitigation_rule *r = &m->rules[i];
+
+    if(!r->pending)
+      continue;
+
+    r->pending = 0;
+    if(install_sw_rule(m, r, MITIGATION_RULE_ID_BASE + i) != 0) {
+      r->in_use = 0;
+      m->num_active--, m->installed--, m->failed++;
+    }
+  }
+
+  m->num_pending = 0;
+}
+
+/* *************************************** */
+
+/* The NIC rules of the slots go away in one call */
+static void remove_rules(struct mitigation *m, const u_int32_t *slots, u_int32_t num) {
+  u_int16_t rule_ids[MAX_MITIGATION_RULES];
+  u_int32_t i, j, n = 0;
+
+  for(i = 0; i < num; i++) {
+    struct mitigation_rule *r = &m->rules[slots[i]];
+    u_int16_t rule_id = MITIGATION_RULE_ID_BASE + slots[i];
+
+    /* Software rules may already be gone (kernel purge): errors are expected */
+    if(r->hw)
+      rule_ids[n++] = rule_id, m->num_hw--;
+    else if(!r->pending) {
+      for(j = 0; j < m->num_rings; j++)
+	pfring_remove_filtering_rule(m->rings[j], rule_id);
+    } else
+      r->pending = 0, m->num_pending--;
+
+    r->in_use = 0;
+    m->num_active--, m->removed++;
+  }
+
+  if(n > 0)
+    pfring_remove_hw_rules(m->rings[0], rule_ids, n);
+}
+
+/* *************************************** */
+
+mitigation_result mitigation_block(struct mitigation *m, const struct victim_key *key,
+                                   u_int8_t proto, u_int16_t port, u_int32_t now) {
+  struct mitigation_rule *r;
+  u_int32_t i, slot = MAX_MITIGATION_RULES;
+
+  for(i = 0; i < MAX_MITIGATION_RULES; i++) {
+    r = &m->rules[i];
+
+    if(!r->in_use) {
+      if(slot == MAX_MITIGATION_RULES) slot = i;
+      continue;
+    }
+
+    if((r->proto == proto) && (r->port == port) && !memcmp(&r->key, key, sizeof(struct victim_key))) {
+      /*
+	Over the threshold again while blocked: the software rule has been
+	purged by the kernel (its traffic is visible again), put it back.
+      */
+      r->last_trip = now;
+      if(!r->hw && !r->pending) install_sw_rule(m, r, MITIGATION_RULE_ID_BASE + i);
+      return(mitigation_active);
+    }
+  }
+
+  if(m->tokens_epoch != now)
+    m->tokens = m->rules_per_sec, m->tokens_epoch = now;
+
+  if((slot == MAX_MITIGATION_RULES) || (m->tokens == 0)) {
+    m->limited++;
+    return(mitigation_limited);
+  }
+
+  m->tokens--;
+  r = &m->rules[slot];
+  memset(r, 0, sizeof(struct mitigation_rule));
+  r->key = *key, r->proto = proto, r->port = port;
+  r->installed = r->last_trip = now;
+
+  /* NIC rules are programmed together by the next mitigation_tick() */
+  if(m->use_hw && (r->key.version == 4))
+    r->pending = 1, m->num_pending++;
+  else if(install_sw_rule(m, r, MITIGATION_RULE_ID_BASE + slot) != 0) {
+    m->failed++;
+    return(mitigation_failed);
+  }
+
+  r->in_use = 1;
+  m->num_active++, m->installed++;
+  return(mitigation_installed);
+}
+
+/* *************************************** */
+
+/* Once per reporting interval */
+void mitigation_tick(struct mitigation *m, u_int32_t now) {
+  u_int32_t slots[MAX_MITIGATION_RULES], i, n = 0;
+
+  if(m->use_hw) {
+    flush_hw_rules(m);
+    m->hw_filters = pfring_get_num_hw_rules(m->rings[0]);
+  }
+
+  if(m->num_active == 0)
+    return;
+
+  for(i = 0; i < m->num_rings; i++)
+    pfring_purge_idle_rules(m->rings[i], m->idle_timeout);
+
+  /*
+    Hardware drop rules discard everything before we can see it: they are
+    released after the idle timeout and reinstalled if the victim trips
+    again. Steered victims are still counted, so last_trip stays fresh
+    while the attack lasts.
+  */
+  for(i = 0; i < MAX_MITIGATION_RULES; i++)
+    if(m->rules[i].in_use && ((now - m->rules[i].last_trip) >= m->idle_timeout))
+      slots[n++] = i;
+
+  remove_rules(m, slots, n);
+}
+
+/* *************************************** */
+
+void mitigation_done(struct mitigation *m) {
+  u_int32_t slots[MAX_MITIGATION_RULES], i, n = 0;
+
+  for(i = 0; i < MAX_MITIGATION_RULES; i++)
+    if(m->rules[i].in_use)
+      slots[n++] = i;
+
+  remove_rules(m, slots, n);
+}
+
+/* *************************************** */
+
+int mitigation_parse_prefix(char *line, struct pfring_blocklist_prefix *p) {
+  char *slash = strchr(line, '/');
+  int len;
+
+  memset(p, 0, sizeof(struct pfring_blocklist_prefix));
+
+  if(slash != NULL)
+    *slash = '\0';
+
+  if(inet_pton(AF_INET, line, &p->addr.v4) == 1) {
+    p->ip_version = 4, p->addr.v4 = ntohl(p->addr.v4), len = 32;
+  } else if(inet_pton(AF_INET6, line, &p->addr.v6) == 1) {
+    p->ip_version = 6, len = 128;
+  } else
+    return(-1);
+
+  if(slash != NULL) {
+    int l = atoi(slash + 1);
+
+    if((l < 0) || (l > len))
+      return(-1);
+
+    len = l;
+  }
+
+  p->prefix_len = len;
+  return(0);
+}
+
+/* *************************************** */
+
+int mitigation_load_blocklist(pfring **rings, u_int32_t num_rings, const char *path) {
+  struct pfring_blocklist_prefix *prefixes = NULL;
+  u_int32_t num = 0, size = 0, line_id = 0, i;
+  char line[256];
+  FILE *fd;
+
+  if((fd = fopen(path, "r")) == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+    return(-1);
+  }
+
+  while(fgets(line, sizeof(line), fd) != NULL) {
+    char *s = line, *e;
+
+    line_id++;
+
+    if((e = strchr(s, '#')) != NULL) *e = '\0';
+    while((*s == ' ') || (*s == '\t')) s++;
+    for(e = s + strlen(s); (e > s) && ((e[-1] == ' ') || (e[-1] == '\t') || (e[-1] == '\r') || (e[-1] == '\n')); e--) ;
+    *e = '\0';
+
+    if(*s == '\0')
+      continue;
+
+    if(num == size) {
+      struct pfring_blocklist_prefix *p;
+
+      size = size ? 2 * size : 1024;
+      if((p = realloc(prefixes, size * sizeof(struct pfring_blocklist_prefix))) == NULL) {
+        free(prefixes), fclose(fd);
+        return(-1);
+      }
+      prefixes = p;
+    }
+
+    if(mitigation_parse_prefix(s, &prefixes[num]) != 0) {
+      fprintf(stderr, "%s:%u: invalid prefix, skipped\n", path, line_id);
+      continue;
+    }
+
+    num++;
+  }
+
+  fclose(fd);
+
+  for(i = 0; i < num_rings; i++) {
+    int rc = pfring_set_prefix_blocklist(rings[i], prefixes, num);
+
+    if(rc != 0) {
+      fprintf(stderr, "pfring_set_prefix_blocklist returned [rc=%d][prefixes=%u]\n", rc, num);
+      free(prefixes);
+      return(-1);
+    }
+  }
+
+  free(prefixes);
+  return(num);
+}
@@ -0,0 +1,87 @@
+/*
+ *
+ * Drop rules for the victims reported by pfcount_multichannel.
+ *
+ * When a victim goes over the configured rate the reporter asks for a
+ * drop rule, so that its traffic is discarded before it is copied to the
+ * rings. On Intel 82599 a perfect filter is installed on the NIC (IPv4
+ * only), otherwise, or if the NIC refuses it, a wildcard rule is added to
+ * the kernel rule list of every channel. The NIC rules of a report are
+ * queued and programmed by mitigation_tick() with one pfring_add_hw_rules()
+ * (one syscall, one driver lock round-trip), the idle ones removed the
+ * same way. Rules are aged by the kernel
+ * (pfring_purge_idle_rules()) and by mitigation_tick() once the victim has
+ * been quiet for the idle timeout. A token bucket bounds the rule churn.
+ *
+ * With mitigation_steer() the NIC rules send the victims to a sacrificial
+ * RX queue instead of dropping them: the other queues' cores are spared
+ * and the victims are still measured, so their rules expire only once
+ * the attack is over. The perfect filter table is shared with the other
+ * applications: no rule is installed once the device has
+ * MITIGATION_HW_FILTER_SLOTS filters (pfring_get_num_hw_rules()).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _MITIGATION_H_
+#define _MITIGATION_H_
+
+#include "pfring.h"
+#include "victims.h"
+
+#define MAX_MITIGATION_RULES              64
+#define MITIGATION_RULE_ID_BASE           1024 /* rule_id = base + slot */
+#define DEFAULT_MITIGATION_RULES_PER_SEC  4    /* installs per second, also the burst */
+#define DEFAULT_MITIGATION_IDLE           30   /* sec */
+#define MITIGATION_HW_FILTER_SLOTS        2046 /* 82599 perfect filters with the default FdirPballoc */
+
+typedef enum {
+  mitigation_installed = 0, /* new rule */
+  mitigation_active,        /* already in place */
+  mitigation_limited,       /* churn limit or table full: retry later */
+  mitigation_failed
+} mitigation_result;
+
+struct mitigation_rule {
+  u_int8_t in_use, hw;
+  u_int8_t pending;    /* NIC rule queued for the next mitigation_tick() */
+  u_int8_t proto;      /* 0 = any */
+  u_int16_t port;      /* destination port, 0 = any */
+  struct victim_key key;
+  u_int32_t installed; /* sec */
+  u_int32_t last_trip; /* sec: last time the victim was over the threshold */
+};
+
+struct mitigation {
+  pfring **rings;
+  u_int32_t num_rings;
+  u_int8_t use_hw;
+  int8_t steer_queue;  /* NIC rules: -1 = drop, otherwise the RX queue */
+  int hw_filters;      /* on the device, all applications: updated by mitigation_tick() */
+  u_int32_t rules_per_sec, idle_timeout;
+  u_int32_t tokens, tokens_epoch;
+  u_int32_t num_active, num_hw, num_pending;
+  u_int64_t installed, removed, limited, failed, hw_full;
+  struct mitigation_rule rules[MAX_MITIGATION_RULES];
+};
+
+void mitigation_init(struct mitigation *m, pfring **rings, u_int32_t num_rings,
+                     u_int32_t rules_per_sec, u_int32_t idle_timeout);
+void mitigation_done(struct mitigation *m);
+/* NIC rules steer to RX queue_id instead of dropping (-1): returns -1 if the NIC has no rules */
+int  mitigation_steer(struct mitigation *m, int queue_id);
+mitigation_result mitigation_block(struct mitigation *m, const struct victim_key *key,
+                                   u_int8_t proto, u_int16_t port, u_int32_t now);
+/* Once per report: programs the queued NIC rules, then removes the idle rules */
+void mitigation_tick(struct mitigation *m, u_int32_t now);
+
+/* "addr[/len]", IPv4 in host byte order in p->addr.v4: returns 0, or -1 if invalid */
+int mitigation_parse_prefix(char *line, struct pfring_blocklist_prefix *p);
+/* "addr/len" per line (IPv4 or IPv6, '#' comments): returns the number of prefixes or -1 */
+int mitigation_load_blocklist(pfring **rings, u_int32_t num_rings, const char *path);
+
+#endif /* _MITIGATION_H_ */
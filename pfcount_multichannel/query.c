@@ -0,0 +1,442 @@
+/*
+ *
+ * Live queries of the per-destination statistics for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "../tommyds-1.0/tommytopk.h"
+#include "query.h"
+
+/* *************************************** */
+
+int query_open(struct query_server *q, const char *path) {
+  struct sockaddr_un sun;
+  struct stat st;
+  int i;
+
+  memset(q, 0, sizeof(struct query_server));
+  q->listen_fd = -1;
+  for(i = 0; i < QUERY_MAX_CLIENTS; i++) q->conns[i].fd = -1;
+
+  if(strlen(path) >= sizeof(sun.sun_path)) {
+    errno = ENAMETOOLONG;
+    return(-1);
+  }
+
+  if((q->reply = malloc(QUERY_MAX_REPLY)) == NULL)
+    return(-1);
+
+  if((q->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    goto error;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+  unlink(path); /* left by a previous run */
+
+  if((bind(q->listen_fd, (struct sockaddr*)&sun, sizeof(sun)) != 0)
+     || (listen(q->listen_fd, QUERY_MAX_CLIENTS) != 0)
+     || (stat(path, &st) != 0))
+    goto error;
+
+  snprintf(q->path, sizeof(q->path), "%s", path);
+  q->ino = st.st_ino;
+  return(0);
+
+ error:
+  if(q->listen_fd >= 0) close(q->listen_fd);
+  q->listen_fd = -1;
+  free(q->reply);
+  q->reply = NULL;
+  return(-1);
+}
+
+/* *************************************** */
+
+void query_close(struct query_server *q) {
+  struct stat st;
+  int i;
+
+  for(i = 0; i < QUERY_MAX_CLIENTS; i++)
+    if(q->conns[i].fd >= 0) close(q->conns[i].fd);
+
+  if(q->listen_fd >= 0) {
+    close(q->listen_fd);
+    /* Not once bound again by the next process (-x handoff:) */
+    if((stat(q->path, &st) == 0) && (st.st_ino == q->ino))
+      unlink(q->path);
+  }
+
+  for(i = 0; i < 2; i++) {
+    free(q->index[i].by_addr);
+    free(q->index[i].by_pkts);
+  }
+
+  free(q->reply);
+  memset(q, 0, sizeof(struct query_server));
+  q->listen_fd = -1;
+}
+
+/* *************************************** */
+
+/* IPv4 in the first word, IPv6 word by word in host order: prefixes are ranges */
+static void key_to_order(const struct victim_key *key, u_int32_t *order) {
+  u_int32_t i;
+
+  if(key->version == 4) {
+    order[0] = key->addr[0], order[1] = order[2] = order[3] = 0;
+    return;
+  }
+
+  for(i = 0; i < 4; i++)
+    order[i] = ntohl(key->addr[i]);
+}
+
+static int order_cmp(u_int32_t version_a, const u_int32_t *a, u_int32_t version_b, const u_int32_t *b) {
+  u_int32_t i;
+
+  if(version_a != version_b)
+    return((version_a < version_b) ? -1 : 1);
+
+  for(i = 0; i < 4; i++)
+    if(a[i] != b[i])
+      return((a[i] < b[i]) ? -1 : 1);
+
+  return(0);
+}
+
+static int cmp_by_addr(const void *a, const void *b) {
+  const struct query_entry *x = a, *y = b;
+
+  return(order_cmp(x->key.version, x->order, y->key.version, y->order));
+}
+
+static int cmp_by_pkts(const void *a, const void *b) {
+  const struct query_entry *x = *(const struct query_entry**)a, *y = *(const struct query_entry**)b;
+
+  return((x->pkts > y->pkts) ? -1 : (x->pkts < y->pkts) ? 1 : cmp_by_addr(x, y));
+}
+
+/* *************************************** */
+
+int query_publish(struct query_server *q, struct victim_summary *s, u_int32_t epoch) {
+  struct query_index *idx = (q->current == &q->index[0]) ? &q->index[1] : &q->index[0];
+  u_int32_t num = 0, i;
+  tommy_node *n;
+
+  for(n = tommy_list_head(&s->all); n != NULL; n = n->next) {
+    const struct victim_totals *t = &((struct victim_summary_node *)n->data)->second[epoch & 1];
+
+    num += (t->epoch == epoch) && (t->pkts > 0);
+  }
+
+  /* The buffers of the index not published are reused, grown only */
+  if(num > idx->capacity) {
+    struct query_entry *by_addr = realloc(idx->by_addr, num * sizeof(struct query_entry));
+    struct query_entry **by_pkts;
+
+    if(by_addr == NULL)
+      return(-1);
+    idx->by_addr = by_addr;
+
+    if((by_pkts = realloc(idx->by_pkts, num * sizeof(struct query_entry *))) == NULL)
+      return(-1);
+    idx->by_pkts = by_pkts, idx->capacity = num;
+  }
+
+  for(n = tommy_list_head(&s->all), i = 0; (n != NULL) && (i < num); n = n->next) {
+    const struct victim_summary_node *v = n->data;
+    const struct victim_totals *t = &v->second[epoch & 1];
+    struct query_entry *e = &idx->by_addr[i];
+
+    if((t->epoch != epoch) || (t->pkts == 0))
+      continue;
+
+    e->key = v->key;
+    key_to_order(&v->key, e->order);
+    e->pkts = t->pkts, e->syns = t->syns, e->bytes = t->bytes;
+    e->amp = t->amp, e->mix = t->mix;
+    i++;
+  }
+
+  idx->num = i, idx->epoch = epoch;
+  qsort(idx->by_addr, idx->num, sizeof(struct query_entry), cmp_by_addr);
+
+  for(i = 0; i < idx->num; i++)
+    idx->by_pkts[i] = &idx->by_addr[i];
+  qsort(idx->by_pkts, idx->num, sizeof(struct query_entry *), cmp_by_pkts);
+
+  q->current = idx;
+  return(0);
+}
+
+/* *************************************** */
+
+/* The first entry not below (version, order) */
+static u_int32_t lower_bound(const struct query_index *idx, u_int32_t version, const u_int32_t *order) {
+  u_int32_t lo = 0, hi = idx->num;
+
+  while(lo < hi) {
+    u_int32_t mid = lo + (hi - lo) / 2;
+
+    if(order_cmp(idx->by_addr[mid].key.version, idx->by_addr[mid].order, version, order) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return(lo);
+}
+
+/* Returns the version, 0 if addr is not an address */
+static u_int32_t parse_addr(const char *addr, u_int32_t *order) {
+  u_int32_t a[4], i;
+
+  if(inet_pton(AF_INET, addr, a) == 1) {
+    order[0] = ntohl(a[0]), order[1] = order[2] = order[3] = 0;
+    return(4);
+  }
+
+  if(inet_pton(AF_INET6, addr, a) == 1) {
+    for(i = 0; i < 4; i++)
+      order[i] = ntohl(a[i]);
+    return(6);
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+struct reply {
+  char *buf;
+  u_int32_t len;
+};
+
+static void out(struct reply *r, const char *fmt, ...) {
+  va_list ap;
+  int rc;
+
+  if(r->len >= QUERY_MAX_REPLY - 1)
+    return; /* truncated */
+
+  va_start(ap, fmt);
+  rc = vsnprintf(&r->buf[r->len], QUERY_MAX_REPLY - r->len, fmt, ap);
+  va_end(ap);
+
+  if(rc > 0)
+    r->len += ((u_int32_t)rc < QUERY_MAX_REPLY - r->len) ? (u_int32_t)rc : QUERY_MAX_REPLY - r->len - 1;
+}
+
+static void out_entry(struct reply *r, const struct query_entry *e) {
+  char addr[INET6_ADDRSTRLEN];
+  u_int32_t a = htonl(e->key.addr[0]);
+
+  inet_ntop((e->key.version == 4) ? AF_INET : AF_INET6, (e->key.version == 4) ? (void *)&a : (void *)e->key.addr,
+	    addr, sizeof(addr));
+  out(r, "%s %u pkt/sec %.2f Mbit/sec %u SYN/sec\n", addr, e->pkts, (8.0 * e->bytes) / 1000000, e->syns);
+}
+
+static void out_details(struct reply *r, const struct query_entry *e) {
+  u_int32_t i, n;
+
+  for(i = 0, n = 0; i < NUM_AMP_CLASSES; i++)
+    if(e->amp.pkts[i] > 0)
+      out(r, "%s %s %u pkt/sec %.2f Mbit/sec", n++ ? "," : "amplification:", amp_class_name[i],
+	  e->amp.pkts[i], (8.0 * e->amp.bytes[i]) / 1000000);
+  if(n > 0) out(r, "\n");
+
+  for(i = 0, n = 0; i < pkt_class_other; i++)
+    if(e->mix.classes[i] > 0)
+      out(r, "%s %s %u", n++ ? "," : "packet mix:", pkt_class_name[i], e->mix.classes[i]);
+  if(n > 0) out(r, "\n");
+}
+
+/* *************************************** */
+
+static void query_victim(const struct query_index *idx, const char *arg, struct reply *r) {
+  u_int32_t order[4], version = parse_addr(arg, order), pos;
+
+  if(version == 0) {
+    out(r, "error: bad address '%s'\n", arg);
+    return;
+  }
+
+  pos = lower_bound(idx, version, order);
+  if((pos == idx->num) || (order_cmp(idx->by_addr[pos].key.version, idx->by_addr[pos].order, version, order) != 0)) {
+    out(r, "%s: no traffic\n", arg);
+    return;
+  }
+
+  out_entry(r, &idx->by_addr[pos]);
+  out_details(r, &idx->by_addr[pos]);
+}
+
+static void query_prefix(const struct query_index *idx, char *arg, struct reply *r) {
+  u_int32_t order[4], low[4], high[4], version, bits, pos, num = 0, syns = 0, i;
+  u_int64_t pkts = 0, bytes = 0;
+  char *slash = strchr(arg, '/');
+  tommy_topk heaviest;
+
+  if(slash != NULL) *slash = '\0';
+  if(((version = parse_addr(arg, order)) == 0)
+     || ((bits = (slash != NULL) ? atoi(slash + 1) : ((version == 4) ? 32 : 128)) > ((version == 4) ? 32 : 128))) {
+    out(r, "error: bad prefix\n");
+    return;
+  }
+
+  for(i = 0; i < 4; i++) {
+    u_int32_t word_bits = (bits > 32 * i) ? bits - 32 * i : 0;
+    u_int32_t mask = (word_bits >= 32) ? 0xFFFFFFFF : (word_bits ? ~(0xFFFFFFFF >> word_bits) : 0);
+
+    if((version == 4) && (i > 0)) mask = 0xFFFFFFFF; /* unused words: 0 */
+    low[i] = order[i] & mask, high[i] = order[i] | ~mask;
+  }
+
+  tommy_topk_init(&heaviest, QUERY_DEFAULT_TOP);
+  for(pos = lower_bound(idx, version, low); pos < idx->num; pos++) {
+    struct query_entry *e = &idx->by_addr[pos];
+
+    if(order_cmp(e->key.version, e->order, version, high) > 0)
+      break;
+
+    num++, pkts += e->pkts, bytes += e->bytes, syns += e->syns;
+    tommy_topk_insert(&heaviest, e, e->pkts);
+  }
+
+  out(r, "%s/%u: %u destinations %llu pkt/sec %.2f Mbit/sec %u SYN/sec\n", arg, bits, num,
+      (unsigned long long)pkts, (8.0 * bytes) / 1000000, syns);
+  for(i = 0, num = tommy_topk_sort(&heaviest); i < num; i++)
+    out_entry(r, tommy_topk_get(&heaviest, i));
+  tommy_topk_done(&heaviest);
+}
+
+static void query_top(const struct query_index *idx, const char *arg, struct reply *r) {
+  u_int32_t k = (arg[0] != '\0') ? atoi(arg) : QUERY_DEFAULT_TOP, i;
+
+  if(k > QUERY_MAX_ROWS) k = QUERY_MAX_ROWS;
+
+  for(i = 0; (i < k) && (i < idx->num); i++)
+    out_entry(r, idx->by_pkts[i]);
+}
+
+/* *************************************** */
+
+/* One request line, the reply in q->reply: returns its length */
+static u_int32_t answer(struct query_server *q, char *line) {
+  struct reply r = { q->reply, 0 };
+  char *arg = line + strcspn(line, " \t");
+
+  if(*arg != '\0') *arg++ = '\0';
+  arg += strspn(arg, " \t");
+  arg[strcspn(arg, " \t\r")] = '\0';
+
+  q->queries++;
+
+  if(q->current == NULL)
+    out(&r, "error: no data yet\n");
+  else if(!strcmp(line, "victim"))
+    query_victim(q->current, arg, &r);
+  else if(!strcmp(line, "prefix"))
+    query_prefix(q->current, arg, &r);
+  else if(!strcmp(line, "top"))
+    query_top(q->current, arg, &r);
+  else if(!strcmp(line, "info"))
+    out(&r, "epoch %u: %u destinations\n", q->current->epoch, q->current->num);
+  else {
+    out(&r, "error: unknown request '%s' (victim, prefix, top, info)\n", line);
+    q->errors++;
+  }
+
+  out(&r, "\n");
+  return(r.len);
+}
+
+/* Reads what is available, answering the complete lines: -1 when the connection has to be closed */
+static int serve_conn(struct query_server *q, struct query_conn *conn) {
+  char *line, *eol;
+  ssize_t rc;
+
+  if((rc = recv(conn->fd, &conn->buf[conn->len], sizeof(conn->buf) - 1 - conn->len, 0)) <= 0)
+    return(((rc < 0) && (errno == EINTR)) ? 0 : -1);
+
+  conn->len += rc, conn->buf[conn->len] = '\0';
+
+  for(line = conn->buf; (eol = strchr(line, '\n')) != NULL; line = eol + 1) {
+    u_int32_t len;
+
+    *eol = '\0';
+    if((eol > line) && (eol[-1] == '\r')) eol[-1] = '\0';
+    if(*line == '\0') continue;
+
+    len = answer(q, line);
+    /* A client not reading its replies is dropped: the reporter never blocks on it */
+    if(send(conn->fd, q->reply, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len) {
+      q->errors++;
+      return(-1);
+    }
+  }
+
+  conn->len -= line - conn->buf;
+  memmove(conn->buf, line, conn->len);
+
+  if(conn->len == sizeof(conn->buf) - 1) {
+    q->errors++; /* line too long */
+    return(-1);
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+void query_poll(struct query_server *q, int timeout_ms) {
+  struct pollfd pfd[QUERY_MAX_CLIENTS + 1];
+  struct query_conn *conn[QUERY_MAX_CLIENTS + 1];
+  u_int32_t num = 1, i;
+  int fd;
+
+  pfd[0].fd = q->listen_fd, pfd[0].events = POLLIN;
+  for(i = 0; i < QUERY_MAX_CLIENTS; i++) {
+    if(q->conns[i].fd < 0) continue;
+    pfd[num].fd = q->conns[i].fd, pfd[num].events = POLLIN;
+    conn[num++] = &q->conns[i];
+  }
+
+  if(poll(pfd, num, timeout_ms) <= 0)
+    return;
+
+  for(i = 1; i < num; i++)
+    if((pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) && (serve_conn(q, conn[i]) != 0)) {
+      close(conn[i]->fd);
+      conn[i]->fd = -1, conn[i]->len = 0;
+    }
+
+  if((pfd[0].revents & POLLIN) && ((fd = accept(q->listen_fd, NULL, NULL)) >= 0)) {
+    for(i = 0; i < QUERY_MAX_CLIENTS; i++) {
+      if(q->conns[i].fd >= 0) continue;
+      q->conns[i].fd = fd, q->conns[i].len = 0;
+      return;
+    }
+
+    close(fd); /* QUERY_MAX_CLIENTS connections already */
+    q->errors++;
+  }
+}
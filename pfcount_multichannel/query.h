@@ -0,0 +1,85 @@
+/*
+ *
+ * Live queries of the per-destination statistics (-x unix:<path>).
+ *
+ * Every report (-m exact) the reporter builds, from the victim summary
+ * (victims.h) of the last second, a read-only index: the destinations
+ * sorted by address, so that a victim is a binary search and a prefix a
+ * contiguous range, and their ranks by packets for the top-K. The index
+ * is never modified once published, and the queries are answered from it
+ * by the reporter while it waits for the next report: the capture threads
+ * and the live summary are never touched by a query, whatever the number
+ * of clients.
+ *
+ * The protocol is text over a UNIX stream socket, one request per line,
+ * each reply ending with an empty line:
+ *
+ *   victim <addr>            totals, amplification and packet mix
+ *   prefix <addr>/<len>      totals of the range and its heaviest destinations
+ *   top [<k>]                the k heaviest destinations (default 10)
+ *   info                     epoch and size of the index
+ *
+ * e.g. echo "victim 203.0.113.7" | socat - UNIX-CONNECT:<path>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _QUERY_H_
+#define _QUERY_H_
+
+#include <sys/types.h>
+
+#include "victims.h"
+
+#define QUERY_MAX_CLIENTS     16
+#define QUERY_MAX_REQUEST     256   /* bytes per line */
+#define QUERY_MAX_REPLY       65536 /* bytes: longer replies are truncated */
+#define QUERY_MAX_ROWS        256   /* destinations per reply */
+#define QUERY_DEFAULT_TOP     10
+
+struct query_entry {
+  u_int32_t order[4];          /* the address as a host order 128 bit number: sort key */
+  struct victim_key key;
+  u_int32_t pkts, syns;
+  u_int64_t bytes;
+  struct amp_counters amp;
+  struct pkt_mix mix;
+};
+
+/* Immutable once published */
+struct query_index {
+  u_int32_t epoch;             /* sec */
+  u_int32_t num, capacity;
+  struct query_entry *by_addr; /* by version, then address */
+  struct query_entry **by_pkts; /* into by_addr, heaviest first */
+};
+
+struct query_conn {
+  int fd;                      /* -1: free */
+  u_int32_t len;
+  char buf[QUERY_MAX_REQUEST];
+};
+
+struct query_server {
+  int listen_fd;
+  char path[108];
+  ino_t ino;                   /* of the socket file */
+  struct query_conn conns[QUERY_MAX_CLIENTS];
+  struct query_index index[2];
+  struct query_index *current; /* NULL until the first query_publish() */
+  char *reply;                 /* QUERY_MAX_REPLY */
+  u_int64_t queries, errors;
+};
+
+int  query_open(struct query_server *q, const char *path);
+void query_close(struct query_server *q);
+/* Replaces the published index with the destinations of second 'epoch' */
+int  query_publish(struct query_server *q, struct victim_summary *s, u_int32_t epoch);
+/* Accepts and answers the clients for up to timeout_ms */
+void query_poll(struct query_server *q, int timeout_ms);
+
+#endif /* _QUERY_H_ */
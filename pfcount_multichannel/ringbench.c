@@ -0,0 +1,327 @@
+/*
+ *
+ * Kernel to userland ring throughput benchmark.
+ *
+ * For every combination of consumer API, packet length and poll
+ * watermark a fresh ring is opened on the device and a consumer thread
+ * reads it while the main thread has the kernel insert synthetic packets
+ * (pfring_loopback_inject(), SO_GET_LOOPBACK_INJECT) through the same
+ * parsing and slot copy as the received ones. The kernel reports how
+ * many packets made it into the ring and how long the insertion took,
+ * the consumer how fast it read them:
+ *
+ * - recv:  pfring_recv() copying into a buffer
+ * - loop:  pfring_loop() callback
+ * - burst: pfring_recv_burst()
+ * - zc:    pfring_recv_batch(), headers and packets read in the slots
+ *
+ * Every consumer reads the first byte of each packet. Use a quiet device:
+ * the packets it receives meanwhile are counted as well.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "pfring.h"
+
+#define DEFAULT_DEVICE      "lo"
+#define DEFAULT_PKTS        (10*1000*1000) /* per run */
+#define DEFAULT_LENGTHS     "64,512,1514"
+#define DEFAULT_WATERMARKS  "1,64"
+#define DEFAULT_APIS        "recv,loop,burst,zc"
+#define DEFAULT_FLOWS       1024
+#define MAX_LIST            16
+#define DRAIN_IDLE_MSEC     500 /* consumer done once it has read nothing for that long */
+
+typedef enum {
+  api_recv = 0,
+  api_loop,
+  api_burst,
+  api_zc,
+  NUM_APIS
+} consumer_api;
+
+static const char *api_name[NUM_APIS] = { "recv", "loop", "burst", "zc" };
+
+struct run {
+  pfring *ring;
+  consumer_api api;
+  u_int32_t snaplen;
+  int core;
+  volatile u_int8_t stop;
+  /* Written by the consumer only */
+  volatile u_int64_t pkts, last_ns;
+  u_int64_t sink;
+};
+
+/* *************************************** */
+
+static u_int64_t clock_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/* *************************************** */
+
+static void bind_to_core(int core) {
+  cpu_set_t set;
+
+  if(core < 0) return;
+
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    fprintf(stderr, "Unable to bind to core %d\n", core);
+}
+
+/* *************************************** */
+
+static inline void consumed(struct run *r, u_int32_t num) {
+  r->pkts += num, r->last_ns = clock_ns();
+}
+
+/* *************************************** */
+
+static void loop_callback(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes) {
+  struct run *r = (struct run *)user_bytes;
+
+  r->sink += p[0];
+  consumed(r, 1);
+}
+
+/* *************************************** */
+
+static void* consumer_thread(void *arg) {
+  struct run *r = (struct run *)arg;
+  struct pfring_pkthdr hdr, hdrs[MAX_BURST_LEN], *batch_hdrs[MAX_BURST_LEN];
+  u_char buffer[r->snaplen], *p, *pkts[MAX_BURST_LEN];
+  int num, i;
+
+  bind_to_core(r->core);
+
+  if(r->api == api_loop) {
+    pfring_loop(r->ring, loop_callback, (u_char *)r, 1);
+    return(NULL);
+  }
+
+  while(!r->stop) {
+    switch(r->api) {
+    case api_recv:
+      p = buffer;
+      if(pfring_recv(r->ring, &p, r->snaplen, &hdr, 1) > 0) {
+	r->sink += buffer[0];
+	consumed(r, 1);
+      }
+      break;
+    case api_burst:
+      if((num = pfring_recv_burst(r->ring, pkts, hdrs, MAX_BURST_LEN, 1)) > 0) {
+	for(i = 0; i < num; i++) r->sink += pkts[i][0];
+	consumed(r, num);
+      }
+      break;
+    case api_zc:
+      /* The previous batch is given back by this call */
+      if((num = pfring_recv_batch(r->ring, batch_hdrs, pkts, MAX_BURST_LEN, 1)) > 0) {
+	for(i = 0; i < num; i++) r->sink += pkts[i][0] + batch_hdrs[i]->caplen;
+	consumed(r, num);
+      }
+      break;
+    default:
+      return(NULL);
+    }
+  }
+
+  if(r->api == api_zc)
+    pfring_release_batch(r->ring);
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+static int bench_run(char *device, consumer_api api, u_int32_t pkt_len, u_int16_t watermark,
+		     u_int32_t num_pkts, u_int32_t num_flows, int inject_core, int consumer_core) {
+  struct pfring_loopback_inject req;
+  struct run r;
+  pthread_t consumer;
+  u_int64_t start, idle_since, last;
+  double kernel_mpps, user_mpps, ns_pkt;
+  int rc;
+
+  memset(&r, 0, sizeof(r));
+  r.api = api, r.snaplen = pkt_len, r.core = consumer_core;
+
+  if((r.ring = pfring_open(device, pkt_len, PF_RING_LONG_HEADER)) == NULL) {
+    fprintf(stderr, "pfring_open(%s) error [%s]\n", device, strerror(errno));
+    return(-1);
+  }
+
+  pfring_set_application_name(r.ring, "ringbench");
+  pfring_set_poll_watermark(r.ring, watermark);
+
+  if(pfring_enable_ring(r.ring) != 0) {
+    fprintf(stderr, "Unable to enable the ring\n");
+    pfring_close(r.ring);
+    return(-1);
+  }
+
+  pthread_create(&consumer, NULL, consumer_thread, &r);
+  usleep(100000); /* the consumer waits in poll() */
+
+  memset(&req, 0, sizeof(req));
+  req.num_pkts = num_pkts, req.pkt_len = pkt_len, req.num_flows = num_flows;
+
+  bind_to_core(inject_core);
+  start = clock_ns();
+  rc = pfring_loopback_inject(r.ring, &req);
+
+  /* What is still queued */
+  for(last = r.pkts, idle_since = clock_ns(); (rc == 0) && (r.pkts < req.inserted); ) {
+    usleep(1000);
+    if(r.pkts != last)
+      last = r.pkts, idle_since = clock_ns();
+    else if((clock_ns() - idle_since) > DRAIN_IDLE_MSEC * 1000000ULL)
+      break;
+  }
+
+  r.stop = 1;
+  pfring_breakloop(r.ring);
+  pthread_join(consumer, NULL);
+  pfring_close(r.ring);
+
+  if(rc != 0) {
+    fprintf(stderr, "pfring_loopback_inject() returned %d: kernel module without SO_GET_LOOPBACK_INJECT?\n", rc);
+    return(-1);
+  }
+
+  kernel_mpps = req.elapsed_ns ? (double)req.inserted * 1000 / req.elapsed_ns : 0;
+  ns_pkt = r.pkts ? (double)(r.last_ns - start) / r.pkts : 0;
+  user_mpps = ns_pkt ? 1000 / ns_pkt : 0;
+
+  printf("%-6s %6u %6u %12u %12u %6.2f%% %10.2f %10.2f %9.1f\n",
+	 api_name[api], pkt_len, watermark, req.inserted, req.dropped,
+	 req.num_pkts ? (double)req.dropped * 100 / req.num_pkts : 0,
+	 kernel_mpps, user_mpps, ns_pkt);
+  return(0);
+}
+
+/* *************************************** */
+
+/* Comma separated numbers: returns how many, at most MAX_LIST */
+static int parse_list(char *s, u_int32_t *values) {
+  char *tok, *save = NULL;
+  int n = 0;
+
+  for(tok = strtok_r(s, ",", &save); (tok != NULL) && (n < MAX_LIST); tok = strtok_r(NULL, ",", &save))
+    values[n++] = atoi(tok);
+
+  return(n);
+}
+
+/* *************************************** */
+
+static void help(void) {
+  printf("ringbench - kernel to userland ring throughput\n\n");
+  printf("-h              Print this help\n");
+  printf("-i <device>     Device (default %s): a quiet one, its packets are counted too\n", DEFAULT_DEVICE);
+  printf("-n <pkts>       Packets inserted per run (default %u)\n", DEFAULT_PKTS);
+  printf("-l <len,...>    Packet lengths, 60..1514 (default %s)\n", DEFAULT_LENGTHS);
+  printf("-w <pkts,...>   Poll watermarks (default %s)\n", DEFAULT_WATERMARKS);
+  printf("-a <api,...>    Consumer APIs: recv, loop, burst, zc (default %s)\n", DEFAULT_APIS);
+  printf("-f <flows>      Distinct UDP source ports (default %u)\n", DEFAULT_FLOWS);
+  printf("-g <core>:<core> Bind the inserting and the consumer thread\n");
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char *device = DEFAULT_DEVICE, apis[256] = DEFAULT_APIS, lengths_arg[256] = DEFAULT_LENGTHS;
+  char watermarks_arg[256] = DEFAULT_WATERMARKS, *tok, *save = NULL;
+  u_int32_t lengths[MAX_LIST], watermarks[MAX_LIST], num_pkts = DEFAULT_PKTS, num_flows = DEFAULT_FLOWS;
+  int num_lengths, num_watermarks, inject_core = -1, consumer_core = -1, a, l, w, c;
+  u_int8_t api_enabled[NUM_APIS] = { 0 };
+
+  while((c = getopt(argc, argv, "hi:n:l:w:a:f:g:")) != -1) {
+    switch(c) {
+    case 'h':
+      help();
+      return(0);
+    case 'i':
+      device = optarg;
+      break;
+    case 'n':
+      num_pkts = atoi(optarg);
+      break;
+    case 'l':
+      snprintf(lengths_arg, sizeof(lengths_arg), "%s", optarg);
+      break;
+    case 'w':
+      snprintf(watermarks_arg, sizeof(watermarks_arg), "%s", optarg);
+      break;
+    case 'a':
+      snprintf(apis, sizeof(apis), "%s", optarg);
+      break;
+    case 'f':
+      num_flows = atoi(optarg);
+      break;
+    case 'g':
+      if(sscanf(optarg, "%d:%d", &inject_core, &consumer_core) != 2) {
+	fprintf(stderr, "-g needs <core>:<core>\n");
+	return(-1);
+      }
+      break;
+    default:
+      help();
+      return(-1);
+    }
+  }
+
+  for(tok = strtok_r(apis, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    for(a = 0; a < NUM_APIS; a++)
+      if(!strcmp(tok, api_name[a])) break;
+
+    if(a == NUM_APIS) {
+      fprintf(stderr, "Unknown consumer API '%s'\n", tok);
+      return(-1);
+    }
+    api_enabled[a] = 1;
+  }
+
+  num_lengths = parse_list(lengths_arg, lengths);
+  num_watermarks = parse_list(watermarks_arg, watermarks);
+
+  for(l = 0; l < num_lengths; l++)
+    if((lengths[l] < 60) || (lengths[l] > 1514)) {
+      fprintf(stderr, "Packet length %u out of 60..1514\n", lengths[l]);
+      return(-1);
+    }
+
+  printf("%-6s %6s %6s %12s %12s %7s %10s %10s %9s\n",
+	 "API", "Len", "Wmark", "Inserted", "Dropped", "Drop", "Kern Mpps", "User Mpps", "ns/pkt");
+
+  for(a = 0; a < NUM_APIS; a++) {
+    if(!api_enabled[a]) continue;
+
+    for(l = 0; l < num_lengths; l++)
+      for(w = 0; w < num_watermarks; w++)
+	if(bench_run(device, a, lengths[l], watermarks[w], num_pkts, num_flows, inject_core, consumer_core) != 0)
+	  return(-1);
+  }
+
+  return(0);
+}
@@ -0,0 +1,83 @@
+/*
+ *
+ * Inline scrubbing for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <string.h>
+
+#include "pfring.h"
+#include "scrub.h"
+
+#define BUCKET_MASK  (SCRUB_BUCKETS - 1)
+#define PKT_CREDIT   1000000000ULL /* one packet, rates are per sec and time in nsec */
+
+/* *************************************** */
+
+void scrubber_init(struct scrubber *s, u_int32_t rate_pps, u_int32_t drop_pps) {
+  memset(s, 0, sizeof(struct scrubber));
+  scrubber_set_rates(s, rate_pps, drop_pps);
+}
+
+/* *************************************** */
+
+void scrubber_set_rates(struct scrubber *s, u_int32_t rate_pps, u_int32_t drop_pps) {
+  u_int64_t burst = ((u_int64_t)rate_pps * SCRUB_BURST_MSEC) / 1000;
+
+  s->rate_pps = rate_pps, s->drop_pps = drop_pps;
+  s->burst = ((burst > 0) ? burst : 1) * PKT_CREDIT;
+}
+
+/* *************************************** */
+
+static struct scrub_bucket* find_bucket(struct scrubber *s, const struct victim_key *key, u_int64_t now) {
+  struct scrub_bucket *b, *reuse = NULL;
+  u_int32_t pos = victim_hash(key) & BUCKET_MASK, i;
+
+  for(i = 0; i < SCRUB_MAX_PROBES; i++, pos = (pos + 1) & BUCKET_MASK) {
+    b = &s->bucket[pos];
+
+    if(b->last_ns == 0 || (now - b->last_ns) > SCRUB_BUCKET_IDLE_NS) {
+      if(reuse == NULL) reuse = b; /* keep probing: the key can be further */
+    } else if(victim_key_equal(&b->key, key))
+      return(b);
+  }
+
+  if(reuse != NULL) {
+    reuse->key = *key;
+    reuse->credit = s->burst, reuse->last_ns = now; /* the destination just went over the rate */
+  }
+
+  return(reuse);
+}
+
+/* *************************************** */
+
+scrub_verdict scrub_rate_limit(struct scrubber *s, const struct victim_key *key) {
+  u_int64_t now = pfring_gettime_ns(), elapsed;
+  struct scrub_bucket *b;
+
+  if((b = find_bucket(s, key, now)) == NULL) {
+    s->no_bucket++;
+    return(scrub_dropped);
+  }
+
+  /* Capped before the multiplication: no overflow with a 32 bit rate */
+  elapsed = (now > b->last_ns) ? (now - b->last_ns) : 0;
+  if(elapsed > SCRUB_BUCKET_IDLE_NS) elapsed = SCRUB_BUCKET_IDLE_NS;
+
+  b->last_ns = now;
+  b->credit += elapsed * s->rate_pps;
+  if(b->credit > s->burst) b->credit = s->burst;
+
+  if(b->credit < PKT_CREDIT)
+    return(scrub_limited);
+
+  b->credit -= PKT_CREDIT;
+  return(scrub_pass);
+}
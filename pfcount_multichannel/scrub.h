@@ -0,0 +1,77 @@
+/*
+ *
+ * Inline scrubbing for pfcount_multichannel (-F).
+ *
+ * Each channel bounces its packets to the egress device with
+ * pfring_bounce_loop(). The verdict is taken right after the packet has
+ * been counted, from the delta of its destination for the current second
+ * that the counting has just updated (still in cache, no other lookup):
+ * up to the rate threshold the packet passes, above the drop threshold it
+ * is dropped, in between it goes through a token bucket of the
+ * destination refilled at the rate threshold. Only the destinations over
+ * the rate threshold have a bucket, in a small per thread table.
+ *
+ * The thresholds are per thread: main() splits the configured rates over
+ * the channels (RSS spreads a victim's traffic over all of them).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _SCRUB_H_
+#define _SCRUB_H_
+
+#include <sys/types.h>
+
+#include "victims.h"
+
+#define SCRUB_BUCKETS          1024 /* power of 2: destinations over the rate threshold per thread */
+#define SCRUB_MAX_PROBES       8    /* then the packet is dropped (no bucket) */
+#define SCRUB_BURST_MSEC       10   /* bucket depth, at the rate threshold */
+#define SCRUB_BUCKET_IDLE_NS   1000000000ULL /* a bucket unused for longer can be taken */
+
+typedef enum {
+  scrub_pass = 0,
+  scrub_limited, /* no token left */
+  scrub_dropped, /* over the drop threshold, or no bucket */
+  scrub_num_verdicts
+} scrub_verdict;
+
+struct scrub_bucket {
+  struct victim_key key;
+  u_int64_t credit;  /* pkts * 1e9 */
+  u_int64_t last_ns; /* refill time: 0 = free */
+};
+
+struct scrubber {
+  u_int32_t rate_pps, drop_pps; /* per thread, drop_pps 0 = never drop */
+  u_int64_t burst;              /* credit cap */
+  /* Read by print_stats() without a lock: monotonic 64 bit counters */
+  u_int64_t verdicts[scrub_num_verdicts], no_bucket;
+  struct scrub_bucket bucket[SCRUB_BUCKETS];
+};
+
+void scrubber_init(struct scrubber *s, u_int32_t rate_pps, u_int32_t drop_pps);
+/* New thresholds, by the thread owning the scrubber: the buckets are kept (credit capped at the next refill) */
+void scrubber_set_rates(struct scrubber *s, u_int32_t rate_pps, u_int32_t drop_pps);
+scrub_verdict scrub_rate_limit(struct scrubber *s, const struct victim_key *key);
+
+/* v: the destination's delta of this second, NULL when it is not tracked (passed) */
+static inline scrub_verdict scrub_packet(struct scrubber *s, const struct victim_delta *v) {
+  scrub_verdict verdict;
+
+  if((v == NULL) || (v->pkts <= s->rate_pps))
+    verdict = scrub_pass;
+  else if((s->drop_pps > 0) && (v->pkts > s->drop_pps))
+    verdict = scrub_dropped;
+  else
+    verdict = scrub_rate_limit(s, &v->key);
+
+  s->verdicts[verdict]++;
+  return(verdict);
+}
+
+#endif /* _SCRUB_H_ */
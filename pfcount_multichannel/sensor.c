@@ -0,0 +1,464 @@
+/*
+ *
+ * Multi-sensor aggregation for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../tommyds-1.0/tommyhash.h"
+#include "sensor.h"
+
+/* *************************************** */
+
+static inline u_char* put16(u_char *p, u_int16_t v) {
+  p[0] = v >> 8, p[1] = v;
+  return(p + 2);
+}
+
+static inline u_char* put32(u_char *p, u_int32_t v) {
+  p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v;
+  return(p + 4);
+}
+
+static inline u_char* put64(u_char *p, u_int64_t v) {
+  return(put32(put32(p, v >> 32), v));
+}
+
+static inline u_int16_t get16(const u_char *p) {
+  return((p[0] << 8) | p[1]);
+}
+
+static inline u_int32_t get32(const u_char *p) {
+  return(((u_int32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+static inline u_int64_t get64(const u_char *p) {
+  return(((u_int64_t)get32(p) << 32) | get32(p + 4));
+}
+
+/* *************************************** */
+
+static u_int32_t encode_summary(const struct sensor_summary *s, u_char *msg) {
+  u_char *p = msg;
+  u_int32_t i;
+
+  p = put32(p, SENSOR_MAGIC);
+  p = put16(p, SENSOR_VERSION);
+  p = put16(p, s->num_victims);
+  p = put32(p, 0); /* length, set below */
+  p = put32(p, s->sensor_id);
+  p = put32(p, s->epoch);
+  memcpy(p, s->name, SENSOR_NAME_LEN), p += SENSOR_NAME_LEN;
+
+  for(i = 0; i < 4; i++)
+    p = put64(put64(p, s->pkts[i]), s->bytes[i]);
+
+  p = put32(p, DEFAULT_COUNT_MIN_WIDTH);
+  for(i = 0; i < SENSOR_CMS_COUNTERS; i++)
+    p = put64(p, s->cms[i]);
+
+  for(i = 0; i < s->num_victims; i++) {
+    const struct sensor_victim *v = &s->victims[i];
+
+    p = put64(put64(put64(put64(p, v->key), v->pkts), v->bytes), v->error);
+    memcpy(p, v->fanin, HLL_REGISTERS), p += HLL_REGISTERS;
+  }
+
+  put32(msg + 8, p - msg);
+  return(p - msg);
+}
+
+/* *************************************** */
+
+/* Length of the message announced by a header, 0 if invalid */
+static u_int32_t message_len(const u_char *hdr) {
+  u_int32_t num_victims = get16(hdr + 6), len = get32(hdr + 8);
+
+  if((get32(hdr) != SENSOR_MAGIC) || (get16(hdr + 4) != SENSOR_VERSION)
+     || (num_victims > SENSOR_MAX_VICTIMS)
+     || (len != SENSOR_MAX_MSG_LEN - (SENSOR_MAX_VICTIMS - num_victims) * SENSOR_VICTIM_LEN))
+    return(0);
+
+  return(len);
+}
+
+/* msg: a whole message, validated by message_len() */
+static int decode_summary(const u_char *msg, struct sensor_summary *s) {
+  const u_char *p = msg + 12;
+  u_int32_t i;
+
+  if(get32(msg + SENSOR_HDR_LEN + 8 * 8) != DEFAULT_COUNT_MIN_WIDTH)
+    return(-1); /* the sketches would not add up */
+
+  s->num_victims = get16(msg + 6);
+  s->sensor_id = get32(p), p += 4;
+  s->epoch = get32(p), p += 4;
+  memcpy(s->name, p, SENSOR_NAME_LEN), p += SENSOR_NAME_LEN;
+  s->name[SENSOR_NAME_LEN - 1] = '\0';
+
+  for(i = 0; i < 4; i++, p += 16)
+    s->pkts[i] = get64(p), s->bytes[i] = get64(p + 8);
+
+  p += 4;
+  for(i = 0; i < SENSOR_CMS_COUNTERS; i++, p += 8)
+    s->cms[i] = get64(p);
+
+  for(i = 0; i < s->num_victims; i++) {
+    struct sensor_victim *v = &s->victims[i];
+
+    v->key = get64(p), v->pkts = get64(p + 8), v->bytes = get64(p + 16), v->error = get64(p + 24);
+    memcpy(v->fanin, p + 32, HLL_REGISTERS), p += SENSOR_VICTIM_LEN;
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+int sensor_open(struct sensor_link *l, const char *collector, const char *name) {
+  char *sep;
+
+  memset(l, 0, sizeof(struct sensor_link));
+  l->fd = -1;
+
+  snprintf(l->host, sizeof(l->host), "%s", collector);
+  snprintf(l->port, sizeof(l->port), "%u", SENSOR_DEFAULT_PORT);
+
+  if(l->host[0] == '[') {
+    /* [<IPv6>]:<port> */
+    if((sep = strchr(l->host, ']')) == NULL) return(-1);
+    *sep++ = '\0';
+    memmove(l->host, l->host + 1, strlen(l->host));
+    if(*sep == ':') snprintf(l->port, sizeof(l->port), "%s", sep + 1);
+  } else if(((sep = strchr(l->host, ':')) != NULL) && (strchr(sep + 1, ':') == NULL)) {
+    *sep = '\0';
+    snprintf(l->port, sizeof(l->port), "%s", sep + 1);
+  }
+
+  if(name != NULL)
+    snprintf(l->name, sizeof(l->name), "%s", name);
+  else if(gethostname(l->name, sizeof(l->name) - 1) != 0)
+    snprintf(l->name, sizeof(l->name), "sensor");
+
+  l->sensor_id = tommy_hash_u32(0, l->name, strlen(l->name));
+  return(0);
+}
+
+/* *************************************** */
+
+static int sensor_connect(struct sensor_link *l) {
+  struct timeval tv = { SENSOR_SEND_TIMEOUT / 1000, (SENSOR_SEND_TIMEOUT % 1000) * 1000 };
+  struct addrinfo hints, *res;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC, hints.ai_socktype = SOCK_STREAM;
+
+  if(getaddrinfo(l->host, l->port, &hints, &res) != 0)
+    return(-1);
+
+  /* The timeout also bounds connect() */
+  if((l->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) >= 0
+     && ((setsockopt(l->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+	 || (connect(l->fd, res->ai_addr, res->ai_addrlen) != 0))) {
+    close(l->fd);
+    l->fd = -1;
+  }
+
+  freeaddrinfo(res);
+  return((l->fd >= 0) ? 0 : -1);
+}
+
+/* *************************************** */
+
+int sensor_send(struct sensor_link *l, struct sensor_summary *s) {
+  u_int32_t len, sent = 0;
+  ssize_t rc;
+
+  s->sensor_id = l->sensor_id;
+  memcpy(s->name, l->name, SENSOR_NAME_LEN);
+  len = encode_summary(s, l->msg);
+
+  if((l->fd < 0) && (sensor_connect(l) != 0)) {
+    l->send_errors++;
+    return(-1);
+  }
+
+  while(sent < len) {
+    if((rc = send(l->fd, &l->msg[sent], len - sent, MSG_NOSIGNAL)) <= 0) {
+      /*
+	Timeout or error: a partial message would desynchronize the stream,
+	start again on a new connection at the next interval
+      */
+      close(l->fd);
+      l->fd = -1, l->send_errors++;
+      return(-1);
+    }
+
+    sent += rc;
+  }
+
+  l->sent++, l->bytes_sent += len;
+  return(0);
+}
+
+/* *************************************** */
+
+void sensor_close(struct sensor_link *l) {
+  if(l->fd >= 0) {
+    close(l->fd);
+    l->fd = -1;
+  }
+}
+
+/* *************************************** */
+
+int collector_open(struct collector *c, u_int16_t port) {
+  struct sockaddr_in6 sin6;
+  struct sockaddr_in sin;
+  int i, on = 1, off = 0;
+
+  memset(c, 0, sizeof(struct collector));
+  for(i = 0; i < MAX_SENSORS; i++) c->conns[i].fd = -1;
+
+  if((c->sensors = calloc(MAX_SENSORS, sizeof(struct sensor_view))) == NULL)
+    return(-1);
+
+  /* Dual stack when available */
+  if((c->listen_fd = socket(AF_INET6, SOCK_STREAM, 0)) >= 0) {
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6, sin6.sin6_addr = in6addr_any, sin6.sin6_port = htons(port);
+    setsockopt(c->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(c->listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    if(bind(c->listen_fd, (struct sockaddr*)&sin6, sizeof(sin6)) != 0) {
+      close(c->listen_fd);
+      c->listen_fd = -1;
+    }
+  }
+
+  if(c->listen_fd < 0) {
+    if((c->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+      goto error;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET, sin.sin_addr.s_addr = htonl(INADDR_ANY), sin.sin_port = htons(port);
+    setsockopt(c->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if(bind(c->listen_fd, (struct sockaddr*)&sin, sizeof(sin)) != 0)
+      goto error;
+  }
+
+  if(listen(c->listen_fd, MAX_SENSORS) != 0)
+    goto error;
+
+  return(0);
+
+ error:
+  if(c->listen_fd >= 0) close(c->listen_fd);
+  c->listen_fd = -1;
+  free(c->sensors);
+  c->sensors = NULL;
+  return(-1);
+}
+
+/* *************************************** */
+
+static void close_conn(struct sensor_conn *conn) {
+  close(conn->fd);
+  conn->fd = -1, conn->len = 0;
+}
+
+/* *************************************** */
+
+static struct sensor_view* sensor_slot(struct collector *c, u_int32_t sensor_id, u_int32_t now) {
+  struct sensor_view *oldest = NULL;
+  u_int32_t i;
+
+  for(i = 0; i < MAX_SENSORS; i++) {
+    struct sensor_view *v = &c->sensors[i];
+
+    if((v->last_seen != 0) && (v->summary.sensor_id == sensor_id))
+      return(v);
+    if((oldest == NULL) || (v->last_seen < oldest->last_seen))
+      oldest = v;
+  }
+
+  /* A free slot, else the one silent for longer (if it dropped out of the view) */
+  if((oldest->last_seen != 0) && (now - oldest->last_seen <= SENSOR_TIMEOUT))
+    return(NULL);
+
+  return(oldest);
+}
+
+/* *************************************** */
+
+/* Reads what is available, merging a complete summary: -1 when the connection has to be closed */
+static int read_conn(struct collector *c, struct sensor_conn *conn, u_int32_t now) {
+  u_int32_t want = (conn->len < SENSOR_HDR_LEN) ? SENSOR_HDR_LEN : message_len(conn->buf);
+  struct sensor_view *view;
+  ssize_t rc;
+
+  if((rc = recv(conn->fd, &conn->buf[conn->len], want - conn->len, 0)) <= 0)
+    return(((rc < 0) && (errno == EINTR)) ? 0 : -1);
+
+  if((conn->len += rc) < want)
+    return(0);
+
+  if(want == SENSOR_HDR_LEN) {
+    if(message_len(conn->buf) == 0) {
+      c->errors++; /* not a sensor, or another version */
+      return(-1);
+    }
+    return(0);
+  }
+
+  conn->len = 0;
+  if((view = sensor_slot(c, get32(conn->buf + 12), now)) == NULL) {
+    c->errors++; /* MAX_SENSORS sensors already */
+    return(0);
+  }
+
+  if(decode_summary(conn->buf, &view->summary) != 0) {
+    view->last_seen = 0; /* possibly partially overwritten */
+    c->errors++;
+    return(0);
+  }
+
+  view->last_seen = now;
+  c->summaries++;
+  return(0);
+}
+
+/* *************************************** */
+
+void collector_poll(struct collector *c, int timeout_ms) {
+  struct pollfd pfd[MAX_SENSORS + 1];
+  struct sensor_conn *conn[MAX_SENSORS + 1];
+  u_int32_t num = 1, i, now;
+  int fd;
+
+  pfd[0].fd = c->listen_fd, pfd[0].events = POLLIN;
+  for(i = 0; i < MAX_SENSORS; i++) {
+    if(c->conns[i].fd < 0) continue;
+    pfd[num].fd = c->conns[i].fd, pfd[num].events = POLLIN;
+    conn[num++] = &c->conns[i];
+  }
+
+  if(poll(pfd, num, timeout_ms) <= 0)
+    return;
+
+  now = time(NULL);
+  for(i = 1; i < num; i++)
+    if((pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) && (read_conn(c, conn[i], now) != 0))
+      close_conn(conn[i]);
+
+  if((pfd[0].revents & POLLIN) && ((fd = accept(c->listen_fd, NULL, NULL)) >= 0)) {
+    for(i = 0; i < MAX_SENSORS; i++) {
+      struct sensor_conn *free_conn = &c->conns[i];
+
+      if(free_conn->fd >= 0) continue;
+      if((free_conn->buf == NULL) && ((free_conn->buf = malloc(SENSOR_MAX_MSG_LEN)) == NULL)) break;
+      free_conn->fd = fd, free_conn->len = 0;
+      return;
+    }
+
+    close(fd); /* MAX_SENSORS connections already */
+    c->errors++;
+  }
+}
+
+/* *************************************** */
+
+static int cmp_victim_keys(const void *a, const void *b) {
+  const struct sensor_victim *x = *(const struct sensor_victim**)a, *y = *(const struct sensor_victim**)b;
+
+  return((x->key < y->key) ? -1 : (x->key > y->key));
+}
+
+static int cmp_victim_pkts(const void *a, const void *b) {
+  const struct sensor_victim *x = *(const struct sensor_victim**)a, *y = *(const struct sensor_victim**)b;
+
+  return((x->pkts > y->pkts) ? -1 : (x->pkts < y->pkts));
+}
+
+/* *************************************** */
+
+u_int32_t collector_merge(struct collector *c, u_int32_t now, struct sensor_summary *global) {
+  static const struct sensor_victim *all[MAX_SENSORS * SENSOR_MAX_VICTIMS];
+  static struct sensor_victim merged[MAX_SENSORS * SENSOR_MAX_VICTIMS];
+  static struct sensor_victim *heaviest[MAX_SENSORS * SENSOR_MAX_VICTIMS];
+  u_int32_t num_sensors = 0, num_all = 0, num_merged = 0, i, j, s;
+
+  memset(global, 0, sizeof(struct sensor_summary));
+
+  for(s = 0; s < MAX_SENSORS; s++) {
+    const struct sensor_summary *v = &c->sensors[s].summary;
+
+    if((c->sensors[s].last_seen == 0) || (now - c->sensors[s].last_seen > SENSOR_TIMEOUT))
+      continue;
+
+    for(i = 0; i < 4; i++)
+      global->pkts[i] += v->pkts[i], global->bytes[i] += v->bytes[i];
+    for(i = 0; i < SENSOR_CMS_COUNTERS; i++)
+      global->cms[i] += v->cms[i];
+    for(i = 0; i < v->num_victims; i++)
+      all[num_all++] = &v->victims[i];
+
+    if(v->epoch > global->epoch) global->epoch = v->epoch;
+    num_sensors++;
+  }
+
+  /* The same victim seen by several sensors */
+  qsort(all, num_all, sizeof(all[0]), cmp_victim_keys);
+  for(i = 0; i < num_all; i = j) {
+    struct sensor_victim *m = &merged[num_merged];
+
+    memcpy(m, all[i], sizeof(struct sensor_victim));
+    for(j = i + 1; (j < num_all) && (all[j]->key == m->key); j++) {
+      m->pkts += all[j]->pkts, m->bytes += all[j]->bytes, m->error += all[j]->error;
+      hll_merge(m->fanin, all[j]->fanin);
+    }
+
+    heaviest[num_merged++] = m;
+  }
+
+  qsort(heaviest, num_merged, sizeof(heaviest[0]), cmp_victim_pkts);
+  for(i = 0; (i < num_merged) && (i < SENSOR_MAX_VICTIMS); i++)
+    memcpy(&global->victims[i], heaviest[i], sizeof(struct sensor_victim));
+  global->num_victims = i;
+
+  return(num_sensors);
+}
+
+/* *************************************** */
+
+void collector_close(struct collector *c) {
+  u_int32_t i;
+
+  for(i = 0; i < MAX_SENSORS; i++) {
+    if(c->conns[i].fd >= 0) close_conn(&c->conns[i]);
+    free(c->conns[i].buf);
+    c->conns[i].buf = NULL;
+  }
+
+  if(c->listen_fd >= 0) close(c->listen_fd);
+  c->listen_fd = -1;
+  free(c->sensors);
+  c->sensors = NULL;
+}
@@ -0,0 +1,114 @@
+/*
+ *
+ * Multi-sensor aggregation for pfcount_multichannel (-u sensor, -d collector).
+ *
+ * Every interval a sensor (-m sketch) ships to the collector a summary of
+ * fixed size, whatever the traffic: the per-protocol totals, the Count-Min
+ * sketch and the top-K victims of its threads, merged, each victim with
+ * the HyperLogLog registers of its sources in the last second. About
+ * 66 KB per interval.
+ *
+ * All of it is mergeable, so the collector (the same binary, run with -d,
+ * no capture) builds the global view by adding the latest summary of each
+ * sensor: totals and Count-Min counters are summed (the sensors hash the
+ * keys the same way, so the sum is the sketch of the union of their
+ * traffic), victims are summed by key and their registers merged with a
+ * register-wise max. A sensor silent for SENSOR_TIMEOUT sec drops out of
+ * the view.
+ *
+ * Transport: a message per summary on a TCP connection, so that a
+ * summary is either received whole or not at all. The sensor sends from
+ * the reporter thread with a short timeout and reconnects at the next
+ * interval on error: the capture threads never wait for the network.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _SENSOR_H_
+#define _SENSOR_H_
+
+#include <sys/types.h>
+
+#include "sketch.h"
+
+#define SENSOR_DEFAULT_PORT   5140
+#define SENSOR_MAGIC          0x50465353 /* "PFSS" */
+#define SENSOR_VERSION        1
+#define SENSOR_NAME_LEN       32
+#define SENSOR_MAX_VICTIMS    DEFAULT_TOPK_SIZE
+#define SENSOR_CMS_COUNTERS   (COUNT_MIN_DEPTH * DEFAULT_COUNT_MIN_WIDTH)
+#define SENSOR_SEND_TIMEOUT   200   /* msec */
+#define SENSOR_TIMEOUT        10    /* sec */
+#define MAX_SENSORS           64
+
+#define SENSOR_HDR_LEN        (4 + 2 + 2 + 4 + 4 + 4 + SENSOR_NAME_LEN)
+#define SENSOR_VICTIM_LEN     (4 * 8 + HLL_REGISTERS)
+#define SENSOR_MAX_MSG_LEN    (SENSOR_HDR_LEN + 8 * 8 + 4 + 8 * SENSOR_CMS_COUNTERS \
+                               + SENSOR_MAX_VICTIMS * SENSOR_VICTIM_LEN)
+
+struct sensor_victim {
+  u_int64_t key;                  /* as topk_entry */
+  u_int64_t pkts, bytes, error;
+  u_int8_t  fanin[HLL_REGISTERS]; /* sources, last second */
+};
+
+struct sensor_summary {
+  u_int32_t sensor_id, epoch;
+  char      name[SENSOR_NAME_LEN];
+  u_int64_t pkts[4], bytes[4];          /* TCP, UDP, ICMP, others, since start */
+  u_int64_t cms[SENSOR_CMS_COUNTERS];   /* since start */
+  u_int32_t num_victims;
+  struct sensor_victim victims[SENSOR_MAX_VICTIMS];
+};
+
+/* Sensor side */
+struct sensor_link {
+  int fd;                      /* -1: not connected */
+  char host[256], port[16];
+  u_int32_t sensor_id;
+  char name[SENSOR_NAME_LEN];
+  u_int64_t sent, bytes_sent, send_errors;
+  u_char msg[SENSOR_MAX_MSG_LEN];
+};
+
+/* Collector side */
+struct sensor_conn {
+  int fd;                      /* -1: free */
+  u_int32_t len;               /* received so far */
+  u_char *buf;                 /* SENSOR_MAX_MSG_LEN */
+};
+
+struct sensor_view {
+  u_int32_t last_seen;         /* 0: free */
+  struct sensor_summary summary;
+};
+
+struct collector {
+  int listen_fd;
+  struct sensor_conn conns[MAX_SENSORS];
+  struct sensor_view *sensors; /* MAX_SENSORS, by sensor_id */
+  u_int64_t summaries, errors;
+};
+
+/*
+  collector: "<host>[:<port>]", "[<IPv6>]:<port>"; name: NULL for the host name, which
+  also gives the sensor id. The connection is made by sensor_send().
+*/
+int  sensor_open(struct sensor_link *l, const char *collector, const char *name);
+/* Fills the id and name of s, -1 if it could not be sent */
+int  sensor_send(struct sensor_link *l, struct sensor_summary *s);
+void sensor_close(struct sensor_link *l);
+
+int  collector_open(struct collector *c, u_int16_t port);
+/* Accepts and reads the sensors for up to timeout_ms */
+void collector_poll(struct collector *c, int timeout_ms);
+/* The global view of the sensors heard in the last SENSOR_TIMEOUT sec, victims by decreasing
+   packets: returns the number of sensors */
+u_int32_t collector_merge(struct collector *c, u_int32_t now, struct sensor_summary *global);
+void collector_close(struct collector *c);
+
+#endif /* _SENSOR_H_ */
@@ -0,0 +1,289 @@
+/*
+ *
+ * Flow tables of pfcount_multichannel in named shared memory
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmtable.h"
+
+#define SHMTABLE_ALIGN(x)  (((x) + 63) & ~63)
+
+/* *************************************** */
+
+static void shmtable_name(char *buf, size_t len, const char *name, u_int32_t thread_id) {
+  snprintf(buf, len, "%s%s.%u", (name[0] == '/') ? "" : "/", name, thread_id);
+}
+
+/* *************************************** */
+
+/* Unless the name is now the segment of another process (-x handoff:) */
+static void shmtable_unlink_own(const char *path, ino_t ino) {
+  struct stat st;
+  int fd;
+
+  if((fd = shm_open(path, O_RDONLY, 0)) < 0)
+    return;
+
+  if((fstat(fd, &st) == 0) && (st.st_ino == ino))
+    shm_unlink(path);
+
+  close(fd);
+}
+
+/* *************************************** */
+
+/* Writer side */
+
+int shmtable_open(struct shmtable *t, const char *name, u_int32_t thread_id, u_int32_t num_slots) {
+  u_int32_t num_buckets = 1, bucket_offset, slot_offset, i;
+  struct stat st;
+  char path[256];
+  void *mem;
+  int fd;
+
+  memset(t, 0, sizeof(struct shmtable));
+
+  while(num_buckets < num_slots)
+    num_buckets <<= 1;
+
+  bucket_offset = SHMTABLE_ALIGN(sizeof(struct shmtable_header));
+  slot_offset = SHMTABLE_ALIGN(bucket_offset + num_buckets * sizeof(struct shmtable_bucket));
+  t->size = slot_offset + (size_t)(num_slots + 1) * sizeof(struct shmtable_slot);
+
+  if((t->free = malloc(num_slots * sizeof(u_int32_t))) == NULL)
+    return(-1);
+
+  shmtable_name(path, sizeof(path), name, thread_id);
+
+  /*
+    A new segment, not the old one truncated: the process that had the name
+    (or a reader) keeps its mapping until it is done with it
+  */
+  shm_unlink(path);
+
+  if((fd = shm_open(path, O_CREAT | O_EXCL | O_RDWR, 0644)) < 0)
+    goto fail;
+
+  if((fstat(fd, &st) != 0) || (ftruncate(fd, t->size) != 0)) {
+    close(fd);
+    shm_unlink(path);
+    goto fail;
+  }
+
+  /* Zero filled: all the buckets are empty. Touched by the capture thread, on its node */
+  mem = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(mem == MAP_FAILED) {
+    shm_unlink(path);
+    goto fail;
+  }
+
+  t->name = strdup(path), t->ino = st.st_ino;
+  t->header = mem;
+  t->buckets = (struct shmtable_bucket*)((char*)mem + bucket_offset);
+  t->slots = (struct shmtable_slot*)((char*)mem + slot_offset);
+
+  /* Lowest indexes first */
+  for(i = 0; i < num_slots; i++)
+    t->free[i] = num_slots - i;
+  t->num_free = num_slots;
+
+  t->header->thread_id = thread_id;
+  t->header->num_buckets = num_buckets, t->header->num_slots = num_slots;
+  t->header->bucket_offset = bucket_offset, t->header->slot_offset = slot_offset;
+  t->header->slot_size = sizeof(struct shmtable_slot);
+  t->header->version = SHMTABLE_VERSION;
+  __sync_synchronize();
+  t->header->magic = SHMTABLE_MAGIC; /* last: the segment is ready */
+  return(0);
+
+ fail:
+  free(t->free);
+  t->free = NULL;
+  return(-1);
+}
+
+/* *************************************** */
+
+void shmtable_close(struct shmtable *t) {
+  if(t->header == NULL)
+    return;
+
+  t->header->magic = 0;
+  munmap(t->header, t->size);
+  shmtable_unlink_own(t->name, t->ino);
+  free(t->name);
+  free(t->free);
+  memset(t, 0, sizeof(struct shmtable));
+}
+
+/* *************************************** */
+
+u_int32_t shmtable_insert(struct shmtable *t, const struct shmtable_key *key, u_int32_t hash, u_int32_t now) {
+  struct shmtable_bucket *b;
+  struct shmtable_slot *s;
+  u_int32_t slot;
+
+  if(t->num_free == 0) {
+    t->header->full++;
+    return(0);
+  }
+
+  slot = t->free[--t->num_free];
+  s = &t->slots[slot];
+  s->bucket = hash & (t->header->num_buckets - 1);
+  b = &t->buckets[s->bucket];
+
+  b->seq++;
+  shmtable_barrier();
+  s->key = *key;
+  s->first_seen = s->last_seen = now;
+  memset(s->pkts, 0, sizeof(s->pkts));
+  memset(s->bytes, 0, sizeof(s->bytes));
+  s->next = b->head;
+  b->head = slot;
+  shmtable_barrier();
+  b->seq++;
+
+  t->header->count++;
+  return(slot);
+}
+
+/* *************************************** */
+
+void shmtable_remove(struct shmtable *t, u_int32_t slot) {
+  struct shmtable_slot *s = &t->slots[slot];
+  struct shmtable_bucket *b = &t->buckets[s->bucket];
+  volatile u_int32_t *prev = &b->head;
+
+  while((*prev != slot) && (*prev != 0))
+    prev = &t->slots[*prev].next;
+
+  b->seq++;
+  shmtable_barrier();
+  if(*prev == slot)
+    *prev = s->next;
+  shmtable_barrier();
+  b->seq++;
+
+  t->free[t->num_free++] = slot;
+  t->header->count--;
+}
+
+/* *************************************** */
+
+void shmtable_set(struct shmtable *t, u_int32_t slot, u_int8_t dir, const u_int64_t pkts[4], const u_int64_t bytes[4]) {
+  struct shmtable_slot *s = &t->slots[slot];
+  struct shmtable_bucket *b = &t->buckets[s->bucket];
+
+  b->seq++;
+  shmtable_barrier();
+  memcpy(s->pkts[dir], pkts, sizeof(s->pkts[dir]));
+  memcpy(s->bytes[dir], bytes, sizeof(s->bytes[dir]));
+  shmtable_barrier();
+  b->seq++;
+}
+
+/* *************************************** */
+
+/* Reader side */
+
+int shmtable_attach(struct shmtable_view *v, const char *name, u_int32_t thread_id) {
+  const struct shmtable_header *h;
+  struct stat st;
+  char path[256];
+  void *mem;
+  int fd;
+
+  memset(v, 0, sizeof(struct shmtable_view));
+  shmtable_name(path, sizeof(path), name, thread_id);
+
+  if((fd = shm_open(path, O_RDONLY, 0)) < 0)
+    return(-1);
+
+  if((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(struct shmtable_header))) {
+    close(fd);
+    errno = EINVAL;
+    return(-1);
+  }
+
+  mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(mem == MAP_FAILED)
+    return(-1);
+
+  h = mem;
+  if((h->magic != SHMTABLE_MAGIC) || (h->version != SHMTABLE_VERSION)
+     || (h->slot_size != sizeof(struct shmtable_slot))
+     || ((size_t)h->slot_offset + (size_t)(h->num_slots + 1) * h->slot_size > (size_t)st.st_size)) {
+    munmap(mem, st.st_size);
+    errno = EINVAL;
+    return(-1);
+  }
+
+  v->header = h, v->size = st.st_size;
+  v->buckets = (const struct shmtable_bucket*)((const char*)mem + h->bucket_offset);
+  v->slots = (const struct shmtable_slot*)((const char*)mem + h->slot_offset);
+  return(0);
+}
+
+/* *************************************** */
+
+void shmtable_detach(struct shmtable_view *v) {
+  if(v->header != NULL)
+    munmap((void*)v->header, v->size);
+
+  memset(v, 0, sizeof(struct shmtable_view));
+}
+
+/* *************************************** */
+
+void shmtable_unlink(const char *name, u_int32_t thread_id) {
+  char path[256];
+
+  shmtable_name(path, sizeof(path), name, thread_id);
+  shm_unlink(path);
+}
+
+/* *************************************** */
+
+int shmtable_read_bucket(const struct shmtable_view *v, u_int32_t bucket, struct shmtable_slot *out, u_int32_t max_slots) {
+  const struct shmtable_bucket *b = &v->buckets[bucket & (v->header->num_buckets - 1)];
+  u_int32_t attempt, seq, slot, n;
+
+  for(attempt = 0; attempt < SHMTABLE_RETRIES; attempt++) {
+    if((seq = b->seq) & 1)
+      continue;
+
+    shmtable_barrier();
+
+    /* The indexes may be torn while the writer is at work: checked, the copy then discarded */
+    for(n = 0, slot = b->head; (slot != 0) && (slot <= v->header->num_slots) && (n < max_slots); n++) {
+      out[n] = v->slots[slot];
+      slot = out[n].next;
+    }
+
+    shmtable_barrier();
+
+    if(b->seq == seq)
+      return(n);
+  }
+
+  return(-1);
+}
@@ -0,0 +1,143 @@
+/*
+ *
+ * Flow tables of pfcount_multichannel in named shared memory (-x flows:<name>),
+ * readable by other processes while the capture threads write them.
+ *
+ * Each capture thread mirrors its flow records in its own POSIX shared
+ * memory segment, /<name>.<thread id>: a shmtable_header, the bucket array
+ * and the slot array, at the offsets given by the header. Nothing in the
+ * segment is a pointer: buckets and slots chain by slot index (1..num_slots,
+ * 0 = end), so that a reader maps it anywhere.
+ *
+ * A slot holds the key and the 64 bit counters of one flow, both
+ * directions, as the record of the thread: the thread updates it with the
+ * record, for every packet. The bucket of the flow (hash & (num_buckets -
+ * 1)) carries a version counter, odd while the thread changes anything in
+ * its chain: a reader copies the chain between two even reads of the same
+ * version (shmtable_read_bucket()) and gets a consistent snapshot of those
+ * flows without ever blocking the writer. A bucket changes only when one
+ * of its flows gets a packet, so a walk of the table mostly retries on the
+ * few flows busy at that time.
+ *
+ * The segments are sized for the flow capacity of the threads (-T/-M): the
+ * flows beyond are counted in the record but not mirrored (header.full).
+ *
+ * A segment is created anew, never truncated, and unlinked on close only if
+ * the name is still its own: the next process (-x handoff:) reads the
+ * segments of the previous one while it creates its own under the same
+ * names.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _SHMTABLE_H_
+#define _SHMTABLE_H_
+
+#include <sys/types.h>
+
+#define SHMTABLE_MAGIC     0x50465446 /* "PFTF" */
+#define SHMTABLE_VERSION   1
+#define SHMTABLE_RETRIES   64         /* shmtable_read_bucket() attempts */
+
+#if defined(__i386__) || defined(__x86_64__)
+#define shmtable_barrier() __asm__ __volatile__("": : :"memory")
+#else
+#define shmtable_barrier() __sync_synchronize()
+#endif
+
+/* As the flow keys of pfcount_multichannel */
+struct shmtable_key {
+  u_int32_t src[4], dst[4];  /* IPv4 (host byte order) in [0], IPv6 in network byte order; src < dst */
+  u_int16_t version;         /* 4 or 6 */
+  u_int16_t vlan_id;
+  u_int32_t teid;
+};
+
+struct shmtable_header {
+  u_int32_t magic, version;
+  u_int32_t thread_id;
+  u_int32_t num_buckets;            /* power of 2 */
+  u_int32_t num_slots;
+  u_int32_t bucket_offset, slot_offset; /* from the start of the segment */
+  u_int32_t slot_size;              /* sizeof(struct shmtable_slot) */
+  volatile u_int32_t count;         /* flows mirrored */
+  volatile u_int32_t updated;       /* sec of the last packet */
+  volatile u_int64_t full;          /* flows not mirrored: no free slot */
+} __attribute__((aligned(64)));
+
+struct shmtable_bucket {
+  volatile u_int32_t seq;           /* odd while the chain changes */
+  volatile u_int32_t head;          /* slot index, 0 = empty */
+};
+
+struct shmtable_slot {
+  struct shmtable_key key;
+  u_int32_t next;                   /* slot index in the chain, 0 = last */
+  u_int32_t bucket;
+  u_int32_t first_seen, last_seen;  /* sec */
+  u_int64_t pkts[2][4], bytes[2][4]; /* by direction (src -> dst first), then TCP, UDP, ICMP, other */
+} __attribute__((aligned(64)));
+
+/* Writer: one per capture thread */
+struct shmtable {
+  char *name;
+  ino_t ino;                        /* of the segment: the name may be taken over */
+  struct shmtable_header *header;
+  struct shmtable_bucket *buckets;
+  struct shmtable_slot *slots;      /* slots[0] unused */
+  size_t size;
+  u_int32_t *free, num_free;        /* slot indexes, private */
+};
+
+/* Reader */
+struct shmtable_view {
+  const struct shmtable_header *header;
+  const struct shmtable_bucket *buckets;
+  const struct shmtable_slot *slots;
+  size_t size;
+};
+
+/* Creates /<name>.<thread_id> for num_slots flows: returns 0, -1 (errno set) */
+int  shmtable_open(struct shmtable *t, const char *name, u_int32_t thread_id, u_int32_t num_slots);
+void shmtable_close(struct shmtable *t);
+
+/* A slot for the new flow key of hash, 0 when none is free */
+u_int32_t shmtable_insert(struct shmtable *t, const struct shmtable_key *key, u_int32_t hash, u_int32_t now);
+void shmtable_remove(struct shmtable *t, u_int32_t slot);
+/* Restored counters of one direction */
+void shmtable_set(struct shmtable *t, u_int32_t slot, u_int8_t dir, const u_int64_t pkts[4], const u_int64_t bytes[4]);
+
+/* Capture thread: one packet of the flow of slot */
+static inline void shmtable_account(struct shmtable *t, u_int32_t slot, u_int8_t dir, u_int8_t proto_class,
+				    u_int32_t len, u_int32_t now) {
+  struct shmtable_slot *s = &t->slots[slot];
+  struct shmtable_bucket *b = &t->buckets[s->bucket];
+
+  b->seq++;
+  shmtable_barrier();
+  s->pkts[dir][proto_class]++, s->bytes[dir][proto_class] += len;
+  s->last_seen = now;
+  shmtable_barrier();
+  b->seq++;
+
+  if(t->header->updated != now)
+    t->header->updated = now;
+}
+
+/* Maps /<name>.<thread_id> read only: returns 0, -1 (errno set) */
+int  shmtable_attach(struct shmtable_view *v, const char *name, u_int32_t thread_id);
+void shmtable_detach(struct shmtable_view *v);
+/* Removes the name of /<name>.<thread_id>, the segment goes with its last mapping */
+void shmtable_unlink(const char *name, u_int32_t thread_id);
+/*
+  Copies the flows of a bucket, up to max_slots, as they were at one point
+  in time: returns their number, -1 if the writer kept changing them for
+  SHMTABLE_RETRIES attempts.
+*/
+int  shmtable_read_bucket(const struct shmtable_view *v, u_int32_t bucket, struct shmtable_slot *out, u_int32_t max_slots);
+
+#endif /* _SHMTABLE_H_ */
@@ -0,0 +1,352 @@
+/*
+ *
+ * Count-Min sketch and top-K for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sketch.h"
+
+#include "../tommyds-1.0/tommytypes.h"
+
+/* *************************************** */
+
+int count_min_init(struct count_min *cm, u_int32_t width) {
+  if(width < 64) width = 64;
+  width = tommy_roundup_pow2_u32(width);
+
+  cm->counters = calloc((size_t)COUNT_MIN_DEPTH * width, sizeof(u_int64_t));
+  if(cm->counters == NULL) return(-1);
+
+  cm->width_mask = width - 1;
+  return(0);
+}
+
+/* *************************************** */
+
+void count_min_done(struct count_min *cm) {
+  free(cm->counters);
+  cm->counters = NULL;
+}
+
+/* *************************************** */
+
+/* Row i uses h1 + i*h2 (Kirsch-Mitzenmacher): one 64 bit hash for all the rows */
+#define CM_CELL(cm, row, h1, h2) \
+  (&(cm)->counters[((row) * ((cm)->width_mask + 1)) + (((h1) + (row) * (h2)) & (cm)->width_mask)])
+
+/* *************************************** */
+
+u_int64_t count_min_estimate(struct count_min *cm, u_int64_t hash) {
+  u_int32_t h1 = (u_int32_t)hash, h2 = (u_int32_t)(hash >> 32) | 1, row;
+  u_int64_t min = *CM_CELL(cm, 0, h1, h2);
+
+  for(row = 1; row < COUNT_MIN_DEPTH; row++) {
+    u_int64_t v = *CM_CELL(cm, row, h1, h2);
+    if(v < min) min = v;
+  }
+
+  return(min);
+}
+
+/* *************************************** */
+
+size_t count_min_memory_usage(struct count_min *cm) {
+  return((cm->counters != NULL) ? (size_t)COUNT_MIN_DEPTH * (cm->width_mask + 1) * sizeof(u_int64_t) : 0);
+}
+
+/* *************************************** */
+
+/*
+  Conservative update: only the cells holding the minimum are increased,
+  which keeps the estimate tighter than the plain Count-Min update.
+  Returns the updated estimate.
+*/
+u_int64_t count_min_update(struct count_min *cm, u_int64_t hash, u_int32_t inc) {
+  u_int32_t h1 = (u_int32_t)hash, h2 = (u_int32_t)(hash >> 32) | 1, row;
+  u_int64_t *cell[COUNT_MIN_DEPTH], min, target;
+
+  cell[0] = CM_CELL(cm, 0, h1, h2), min = *cell[0];
+  for(row = 1; row < COUNT_MIN_DEPTH; row++) {
+    cell[row] = CM_CELL(cm, row, h1, h2);
+    if(*cell[row] < min) min = *cell[row];
+  }
+
+  target = min + inc;
+  for(row = 0; row < COUNT_MIN_DEPTH; row++)
+    if(*cell[row] < target) *cell[row] = target;
+
+  return(target);
+}
+
+/* *************************************** */
+
+int topk_init(struct topk *t, u_int32_t k) {
+  u_int32_t slots;
+
+  if(k == 0) k = DEFAULT_TOPK_SIZE;
+  slots = tommy_roundup_pow2_u32(2 * k);
+
+  memset(t, 0, sizeof(struct topk));
+  t->heap  = calloc(k, sizeof(struct topk_entry));
+  t->index = calloc(slots, sizeof(u_int32_t));
+  t->hll   = calloc(k, sizeof(struct hll));
+  t->windows = calloc(k, sizeof(struct rate_window));
+
+  if((t->heap == NULL) || (t->index == NULL) || (t->hll == NULL) || (t->windows == NULL)) {
+    topk_done(t);
+    return(-1);
+  }
+
+  t->k = k, t->index_mask = slots - 1;
+
+  for(slots = 0; slots < k; slots++)
+    t->heap[slots].fanin = &t->hll[slots], t->heap[slots].rate = &t->windows[slots];
+
+  return(0);
+}
+
+/* *************************************** */
+
+void topk_done(struct topk *t) {
+  free(t->heap);
+  free(t->index);
+  free(t->hll);
+  free(t->windows);
+  t->heap = NULL, t->index = NULL, t->hll = NULL, t->windows = NULL;
+}
+
+/* *************************************** */
+
+static inline void heap_set(struct topk *t, u_int32_t pos, struct topk_entry *e) {
+  t->heap[pos] = *e;
+  t->index[e->slot] = pos + 1;
+}
+
+/* *************************************** */
+
+/* pkts of 'pos' increased: move it towards the leaves */
+static void heap_sift_down(struct topk *t, u_int32_t pos) {
+  struct topk_entry e = t->heap[pos];
+
+  for(;;) {
+    u_int32_t child = 2 * pos + 1;
+
+    if(child >= t->num) break;
+    if(((child + 1) < t->num) && (t->heap[child + 1].pkts < t->heap[child].pkts)) child++;
+    if(t->heap[child].pkts >= e.pkts) break;
+
+    heap_set(t, pos, &t->heap[child]);
+    pos = child;
+  }
+
+  heap_set(t, pos, &e);
+}
+
+/* *************************************** */
+
+/* New entry at 'pos' (always the last one): move it towards the root */
+static void heap_sift_up(struct topk *t, u_int32_t pos) {
+  struct topk_entry e = t->heap[pos];
+
+  while(pos > 0) {
+    u_int32_t parent = (pos - 1) / 2;
+
+    if(t->heap[parent].pkts <= e.pkts) break;
+
+    heap_set(t, pos, &t->heap[parent]);
+    pos = parent;
+  }
+
+  heap_set(t, pos, &e);
+}
+
+/* *************************************** */
+
+static u_int32_t index_find(struct topk *t, u_int64_t key, u_int32_t hash) {
+  u_int32_t slot;
+
+  for(slot = hash & t->index_mask; t->index[slot] != 0; slot = (slot + 1) & t->index_mask)
+    if(t->heap[t->index[slot] - 1].key == key)
+      return(slot);
+
+  return(slot); /* empty slot where the key would go */
+}
+
+/* *************************************** */
+
+/* Backward shift deletion, as in flow_table.c */
+static void index_remove(struct topk *t, u_int32_t slot) {
+  u_int32_t next, home;
+
+  for(next = (slot + 1) & t->index_mask; t->index[next] != 0; next = (next + 1) & t->index_mask) {
+    struct topk_entry *e = &t->heap[t->index[next] - 1];
+
+    home = e->hash & t->index_mask;
+
+    if(((next > slot) && ((home <= slot) || (home > next)))
+       || ((next < slot) && ((home <= slot) && (home > next)))) {
+      t->index[slot] = t->index[next];
+      e->slot = slot;
+      slot = next;
+    }
+  }
+
+  t->index[slot] = 0;
+}
+
+/* *************************************** */
+
+struct topk_entry* topk_find(struct topk *t, u_int64_t key, u_int64_t hash) {
+  u_int32_t slot = index_find(t, key, (u_int32_t)hash);
+
+  return((t->index[slot] != 0) ? &t->heap[t->index[slot] - 1] : NULL);
+}
+
+/* *************************************** */
+
+size_t topk_memory_usage(struct topk *t) {
+  return((size_t)t->k * (sizeof(struct topk_entry) + sizeof(struct hll) + sizeof(struct rate_window))
+	 + (t->k ? (size_t)(t->index_mask + 1) * sizeof(u_int32_t) : 0));
+}
+
+/* *************************************** */
+
+/*
+  Account one packet of 'key'. 'estimate' is the packet count of the key
+  according to the sketch (this packet included): it decides whether an
+  untracked key replaces the current minimum.
+  Returns the entry of the key, NULL if it is not tracked.
+*/
+struct topk_entry* topk_offer(struct topk *t, u_int64_t key, u_int64_t hash, u_int64_t estimate, u_int32_t len) {
+  u_int32_t slot = index_find(t, key, (u_int32_t)hash), pos;
+  struct topk_entry e;
+
+  if(t->index[slot] != 0) {
+    pos = t->index[slot] - 1;
+
+    t->heap[pos].pkts++, t->heap[pos].bytes += len;
+    heap_sift_down(t, pos);
+    return(&t->heap[t->index[slot] - 1]);
+  }
+
+  e.key = key, e.hash = (u_int32_t)hash, e.slot = slot;
+  e.pkts = estimate, e.bytes = len;
+
+  if(t->num < t->k) {
+    e.error = 0, e.fanin = t->heap[t->num].fanin, e.rate = t->heap[t->num].rate;
+    t->index[slot] = ++t->num; /* heap_set() updates it */
+    t->heap[t->num - 1] = e;
+    heap_sift_up(t, t->num - 1);
+  } else if(estimate > t->heap[0].pkts) {
+    /* Replace the minimum (Space-Saving) */
+    e.error = t->heap[0].pkts, e.fanin = t->heap[0].fanin, e.rate = t->heap[0].rate;
+    index_remove(t, t->heap[0].slot);
+    e.slot = index_find(t, key, (u_int32_t)hash);
+    t->index[e.slot] = 1;
+    t->heap[0] = e;
+    heap_sift_down(t, 0);
+  } else
+    return(NULL);
+
+  hll_reset(e.fanin);
+  window_reset(e.rate);
+  return(&t->heap[t->index[e.slot] - 1]);
+}
+
+/* *************************************** */
+
+struct topk_entry* topk_restore(struct topk *t, u_int64_t key, u_int32_t hash, u_int64_t pkts,
+				u_int64_t bytes, u_int64_t error) {
+  u_int32_t slot = index_find(t, key, hash);
+  struct topk_entry e;
+
+  if((t->num == t->k) || (t->index[slot] != 0))
+    return(NULL);
+
+  e.key = key, e.hash = hash, e.slot = slot;
+  e.pkts = pkts, e.bytes = bytes, e.error = error;
+  e.fanin = t->heap[t->num].fanin, e.rate = t->heap[t->num].rate;
+  t->index[slot] = ++t->num;
+  t->heap[t->num - 1] = e;
+  heap_sift_up(t, t->num - 1);
+
+  return(&t->heap[t->index[slot] - 1]);
+}
+
+/* *************************************** */
+
+void hll_reset(struct hll *h) {
+  memset(h, 0, sizeof(struct hll));
+}
+
+/* *************************************** */
+
+static inline void hll_rotate(struct hll *h, u_int32_t now) {
+  if(now == h->epoch + 1)
+    memcpy(h->last, h->cur, HLL_REGISTERS);
+  else
+    memset(h->last, 0, HLL_REGISTERS); /* idle for more than a second */
+
+  memset(h->cur, 0, HLL_REGISTERS);
+  h->epoch = now;
+}
+
+/* *************************************** */
+
+/* The top HLL_BITS of the hash select the register, the rest gives the rank */
+void hll_add(struct hll *h, u_int32_t now, u_int64_t hash) {
+  u_int32_t reg = (u_int32_t)(hash >> (64 - HLL_BITS));
+  u_int64_t w = (hash << HLL_BITS) | (1ULL << (HLL_BITS - 1)); /* bound the rank */
+  u_int8_t rank = __builtin_clzll(w) + 1;
+
+  if(h->epoch != now) hll_rotate(h, now);
+  if(h->cur[reg] < rank) h->cur[reg] = rank;
+}
+
+/* *************************************** */
+
+/* Registers of the second before 'now', NULL if nothing was seen then */
+const u_int8_t* hll_window(const struct hll *h, u_int32_t now) {
+  if(h->epoch == now)     return(h->last);
+  if(h->epoch + 1 == now) return(h->cur);
+  return(NULL);
+}
+
+/* *************************************** */
+
+void hll_merge(u_int8_t *dst, const u_int8_t *src) {
+  u_int32_t i;
+
+  for(i = 0; i < HLL_REGISTERS; i++)
+    if(dst[i] < src[i]) dst[i] = src[i];
+}
+
+/* *************************************** */
+
+double hll_estimate(const u_int8_t *registers) {
+  const double m = HLL_REGISTERS, alpha = 0.7213 / (1 + 1.079 / m);
+  double sum = 0, estimate;
+  u_int32_t i, zeros = 0;
+
+  for(i = 0; i < HLL_REGISTERS; i++) {
+    sum += ldexp(1.0, -registers[i]);
+    if(registers[i] == 0) zeros++;
+  }
+
+  estimate = alpha * m * m / sum;
+
+  /* Small range correction: linear counting */
+  if((estimate <= 2.5 * m) && (zeros > 0))
+    estimate = m * log(m / zeros);
+
+  return(estimate);
+}
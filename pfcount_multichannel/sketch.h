@@ -0,0 +1,91 @@
+/*
+ *
+ * Fixed-memory aggregation for pfcount_multichannel:
+ *
+ * - count_min: Count-Min sketch (conservative update) of packets per key
+ * - topk:      Space-Saving style top-K of the heaviest keys, kept in a
+ *              min-heap with a small open addressing index so that a
+ *              packet costs one probe plus a short sift
+ * - hll:       HyperLogLog distinct count (e.g. sources of a victim) over
+ *              one second windows, attached to each top-K entry
+ *
+ * Each top-K entry also carries a rate_window (window.h) of its traffic.
+ *
+ * Everything is allocated at init time, nothing is allocated per packet.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _SKETCH_H_
+#define _SKETCH_H_
+
+#include <sys/types.h>
+
+#include "window.h"
+
+#define COUNT_MIN_DEPTH          4
+#define DEFAULT_COUNT_MIN_WIDTH  1024 /* 4 x 1024 x 8 bytes = 32 KB, L1 sized */
+#define DEFAULT_TOPK_SIZE        32
+#define HLL_BITS                 10   /* 1024 registers: ~3% standard error */
+#define HLL_REGISTERS            (1 << HLL_BITS)
+
+struct count_min {
+  u_int32_t width_mask;
+  u_int64_t *counters; /* COUNT_MIN_DEPTH rows of (width_mask+1) counters */
+};
+
+/*
+  Registers of the current second and of the previous one, rotated lazily
+  by hll_add(): readers use the last complete window (hll_window()).
+*/
+struct hll {
+  u_int32_t epoch; /* second 'cur' refers to */
+  u_int8_t cur[HLL_REGISTERS];
+  u_int8_t last[HLL_REGISTERS];
+};
+
+struct topk_entry {
+  u_int64_t key;
+  u_int64_t pkts, bytes;
+  u_int64_t error;  /* overestimation inherited when the key replaced the minimum */
+  u_int32_t hash;   /* low bits of the key hash: home slot in topk.index */
+  u_int32_t slot;   /* position in topk.index */
+  struct hll *fanin; /* owned by the heap position, reset when the key is replaced */
+  struct rate_window *rate; /* ditto */
+};
+
+struct topk {
+  u_int32_t k, num;
+  struct topk_entry *heap; /* min-heap on pkts */
+  u_int32_t *index;        /* heap position + 1, 0 = empty */
+  u_int32_t index_mask;
+  struct hll *hll;         /* k blocks */
+  struct rate_window *windows; /* k blocks */
+};
+
+int  count_min_init(struct count_min *cm, u_int32_t width);
+void count_min_done(struct count_min *cm);
+u_int64_t count_min_update(struct count_min *cm, u_int64_t hash, u_int32_t inc);
+u_int64_t count_min_estimate(struct count_min *cm, u_int64_t hash);
+size_t count_min_memory_usage(struct count_min *cm);
+
+int  topk_init(struct topk *t, u_int32_t k);
+void topk_done(struct topk *t);
+struct topk_entry* topk_offer(struct topk *t, u_int64_t key, u_int64_t hash, u_int64_t estimate, u_int32_t len);
+struct topk_entry* topk_find(struct topk *t, u_int64_t key, u_int64_t hash);
+size_t topk_memory_usage(struct topk *t);
+/* Warm restart: adds an entry as it was, NULL if the heap is full or the key is there */
+struct topk_entry* topk_restore(struct topk *t, u_int64_t key, u_int32_t hash, u_int64_t pkts,
+				u_int64_t bytes, u_int64_t error);
+
+void hll_reset(struct hll *h);
+void hll_add(struct hll *h, u_int32_t now, u_int64_t hash);
+const u_int8_t* hll_window(const struct hll *h, u_int32_t now);
+void hll_merge(u_int8_t *dst, const u_int8_t *src);
+double hll_estimate(const u_int8_t *registers);
+
+#endif /* _SKETCH_H_ */
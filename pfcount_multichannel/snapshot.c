@@ -0,0 +1,259 @@
+/*
+ *
+ * Detector state snapshots for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE /* mremap() */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "snapshot.h"
+
+#define ALIGN64(x)            (((x) + 63) & ~63ULL)
+#define SNAPSHOT_INITIAL_SIZE (4 << 20)
+
+/* *************************************** */
+
+static int snapshot_resize(struct snapshot_writer *w, u_int64_t size) {
+  void *mem;
+
+  if(ftruncate(w->fd, size) != 0)
+    return(-1);
+
+  if(w->base == NULL)
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+  else
+    mem = mremap(w->base, w->size, size, MREMAP_MAYMOVE);
+
+  if(mem == MAP_FAILED)
+    return(-1);
+
+  w->base = mem, w->size = size;
+  return(0);
+}
+
+/* *************************************** */
+
+int snapshot_create(struct snapshot_writer *w, const char *tmp_path) {
+  memset(w, 0, sizeof(struct snapshot_writer));
+
+  if((w->fd = open(tmp_path, O_CREAT | O_RDWR | O_TRUNC, 0644)) < 0)
+    return(-1);
+
+  if(snapshot_resize(w, SNAPSHOT_INITIAL_SIZE) != 0) {
+    close(w->fd);
+    unlink(tmp_path);
+    return(-1);
+  }
+
+  /* The file is sparse: pages are zero until written */
+  w->used = ALIGN64(sizeof(struct snapshot_header));
+  return(0);
+}
+
+/* *************************************** */
+
+void* snapshot_section_add(struct snapshot_writer *w, u_int32_t type, u_int32_t owner,
+			   u_int32_t record_size, u_int64_t max_records) {
+  struct snapshot_header *h = snapshot_writer_header(w);
+  struct snapshot_section *s;
+  u_int64_t offset = ALIGN64(w->used), need = offset + record_size * max_records;
+
+  if(h->num_sections == SNAPSHOT_MAX_SECTIONS)
+    return(NULL);
+
+  if(need > w->size) {
+    u_int64_t size = w->size * 2;
+
+    while(size < need) size *= 2;
+
+    if(snapshot_resize(w, size) != 0)
+      return(NULL);
+    h = snapshot_writer_header(w);
+  }
+
+  s = &h->section[h->num_sections++];
+  s->type = type, s->owner = owner;
+  s->offset = offset, s->record_size = record_size, s->num_records = max_records;
+  w->used = need;
+
+  return(w->base + offset);
+}
+
+/* *************************************** */
+
+void snapshot_section_done(struct snapshot_writer *w, u_int64_t num_records) {
+  struct snapshot_header *h = snapshot_writer_header(w);
+  struct snapshot_section *s = &h->section[h->num_sections - 1];
+
+  if(num_records < s->num_records)
+    s->num_records = num_records;
+
+  w->used = s->offset + s->record_size * s->num_records;
+}
+
+/* *************************************** */
+
+int snapshot_commit(struct snapshot_writer *w, const char *tmp_path, const char *path, u_int8_t abort) {
+  struct snapshot_header *h = snapshot_writer_header(w);
+  int rc = -1;
+
+  if(!abort) {
+    h->size = w->used;
+    h->version = SNAPSHOT_VERSION;
+    h->magic = SNAPSHOT_MAGIC;
+
+    if((msync(w->base, w->used, MS_SYNC) == 0) && (ftruncate(w->fd, w->used) == 0))
+      rc = 0;
+  }
+
+  munmap(w->base, w->size);
+  close(w->fd);
+
+  if((rc == 0) && (rename(tmp_path, path) == 0))
+    return(0);
+
+  unlink(tmp_path);
+  return(-1);
+}
+
+/* *************************************** */
+
+int snapshot_open(struct snapshot *s, const char *path) {
+  const struct snapshot_header *h;
+  struct stat st;
+  void *mem;
+  u_int32_t i;
+  int fd;
+
+  memset(s, 0, sizeof(struct snapshot));
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return(-1);
+
+  if((fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(struct snapshot_header))) {
+    close(fd);
+    return(-1);
+  }
+
+  mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(mem == MAP_FAILED)
+    return(-1);
+
+  s->base = mem, s->size = st.st_size, h = mem;
+
+  if((h->magic != SNAPSHOT_MAGIC) || (h->version != SNAPSHOT_VERSION) || (h->size != s->size)
+     || (h->num_sections > SNAPSHOT_MAX_SECTIONS))
+    goto corrupted;
+
+  for(i = 0; i < h->num_sections; i++) {
+    const struct snapshot_section *sec = &h->section[i];
+
+    if((sec->offset > s->size)
+       || ((sec->record_size > 0) && (sec->num_records > (s->size - sec->offset) / sec->record_size)))
+      goto corrupted;
+  }
+
+  s->header = h;
+  return(0);
+
+ corrupted:
+  snapshot_close(s);
+  return(-1);
+}
+
+/* *************************************** */
+
+const void* snapshot_find(const struct snapshot *s, u_int32_t type, u_int32_t owner,
+			  u_int32_t record_size, u_int64_t *num_records) {
+  u_int32_t i;
+
+  if(s->header == NULL)
+    return(NULL);
+
+  for(i = 0; i < s->header->num_sections; i++) {
+    const struct snapshot_section *sec = &s->header->section[i];
+
+    if((sec->type == type) && (sec->owner == owner) && (sec->record_size == record_size)) {
+      *num_records = sec->num_records;
+      return(s->base + sec->offset);
+    }
+  }
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+void snapshot_close(struct snapshot *s) {
+  if(s->base != NULL)
+    munmap((void*)s->base, s->size);
+
+  memset(s, 0, sizeof(struct snapshot));
+}
+
+/* *************************************** */
+
+static void snapshot_reaped(struct snapshot_job *j, int status) {
+  if(WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+    j->taken++;
+  else
+    j->failed++;
+
+  j->pid = 0;
+}
+
+/* *************************************** */
+
+int snapshot_fork(struct snapshot_job *j, int (*dump)(void *arg), void *arg) {
+  int status;
+  pid_t pid;
+
+  if(j->pid > 0) {
+    if(waitpid(j->pid, &status, WNOHANG) == 0) {
+      j->skipped++; /* slower than the interval */
+      return(-1);
+    }
+
+    snapshot_reaped(j, status);
+  }
+
+  if((pid = fork()) < 0) {
+    j->failed++;
+    return(-1);
+  }
+
+  if(pid == 0) {
+    /* Finish the file on ^C: the parent waits for it at shutdown */
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    _exit((dump(arg) == 0) ? 0 : 1);
+  }
+
+  j->pid = pid;
+  return(0);
+}
+
+/* *************************************** */
+
+void snapshot_wait(struct snapshot_job *j) {
+  int status;
+
+  if((j->pid > 0) && (waitpid(j->pid, &status, 0) == j->pid))
+    snapshot_reaped(j, status);
+}
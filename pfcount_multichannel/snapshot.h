@@ -0,0 +1,143 @@
+/*
+ *
+ * Detector state snapshots for pfcount_multichannel (-y), for warm restarts.
+ *
+ * A snapshot file is a snapshot_header followed by sections of fixed size
+ * records (flows of a thread, its half-open connections, the reporter's
+ * victim summary...). Records hold no pointers, only values and offsets
+ * from the start of the file: a restarted instance maps the file
+ * read-only, checks magic/version and re-inserts the records in its own
+ * tables.
+ *
+ * The file is written by a child process (snapshot_fork()): fork() gives
+ * it a copy-on-write image of the tables as they were at that instant, so
+ * the capture threads are neither stopped nor locked while it is written.
+ * The file is written under a temporary name and renamed when complete: a
+ * crash while dumping leaves the previous snapshot in place.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <sys/types.h>
+
+#include "conn_table.h"
+#include "sketch.h"
+#include "victims.h"
+
+#define SNAPSHOT_MAGIC             0x50465353 /* "PFSS" */
+#define SNAPSHOT_VERSION           5 /* 2: amplification counters, 3: packet mix, 4: entropy sketches in the victims, 5: flow tags */
+#define SNAPSHOT_MAX_SECTIONS      256
+#define SNAPSHOT_NO_OWNER          0xFFFFFFFF /* section of the reporter, not of a thread */
+#define DEFAULT_SNAPSHOT_INTERVAL  60 /* sec */
+
+typedef enum {
+  snapshot_flows = 1,     /* struct snapshot_flow, per thread */
+  snapshot_conns = 2,     /* struct conn_entry (the whole table), per thread */
+  snapshot_victims = 3,   /* struct snapshot_victim, reporter */
+  snapshot_topk = 4,      /* struct snapshot_topk, per thread, heap order */
+  snapshot_count_min = 5  /* u_int64_t counters, per thread */
+} snapshot_section_type;
+
+struct snapshot_section {
+  u_int32_t type, owner;  /* owner: thread id or SNAPSHOT_NO_OWNER */
+  u_int64_t offset;       /* from the start of the file, 64 bytes aligned */
+  u_int64_t num_records;
+  u_int32_t record_size, reserved;
+};
+
+struct snapshot_header {
+  u_int32_t magic, version;
+  u_int32_t taken;        /* sec */
+  u_int32_t num_sections;
+  u_int32_t num_threads;  /* the per thread sections only fit the same number of threads */
+  u_int32_t aggregation;
+  u_int64_t size;
+  struct snapshot_section section[SNAPSHOT_MAX_SECTIONS];
+};
+
+/* Records */
+
+struct snapshot_flow {
+  u_int32_t src[4], dst[4]; /* as struct flow_key */
+  u_int32_t version;        /* 4 or 6 */
+  u_int32_t last_seen;      /* sec */
+  u_int8_t  rx_direction, pad;
+  u_int16_t vlan_id;        /* -V tags, as struct flow_key */
+  u_int32_t teid;
+  u_int64_t pkts[4], bytes[4]; /* TCP, UDP, ICMP, others */
+};
+
+struct snapshot_victim {
+  struct victim_key key;
+  struct victim_totals second[2];
+};
+
+struct snapshot_topk {
+  u_int64_t key, pkts, bytes, error;
+  u_int32_t hash, pad;
+  struct hll fanin;
+  struct rate_window rate;
+};
+
+/* Writer */
+
+struct snapshot_writer {
+  int fd;
+  u_char *base;
+  u_int64_t size, used;
+};
+
+/* The caller fills the header fields other than magic, version, size and sections */
+int snapshot_create(struct snapshot_writer *w, const char *tmp_path);
+/*
+  Room for up to max_records records of a new section, NULL on error. The
+  section is closed by snapshot_section_done() with the records actually
+  written. Adding a section may move the mapping: fill them one at a time.
+*/
+void* snapshot_section_add(struct snapshot_writer *w, u_int32_t type, u_int32_t owner,
+			   u_int32_t record_size, u_int64_t max_records);
+void snapshot_section_done(struct snapshot_writer *w, u_int64_t num_records);
+static inline struct snapshot_header* snapshot_writer_header(struct snapshot_writer *w) {
+  return((struct snapshot_header*)w->base);
+}
+/* Syncs and renames tmp_path to path. abort: discards the file instead */
+int snapshot_commit(struct snapshot_writer *w, const char *tmp_path, const char *path, u_int8_t abort);
+
+/* Reader */
+
+struct snapshot {
+  const u_char *base;
+  u_int64_t size;
+  const struct snapshot_header *header;
+};
+
+int snapshot_open(struct snapshot *s, const char *path);
+/* The records of a section, NULL if missing or not of this record size */
+const void* snapshot_find(const struct snapshot *s, u_int32_t type, u_int32_t owner,
+			  u_int32_t record_size, u_int64_t *num_records);
+void snapshot_close(struct snapshot *s);
+
+/* Background dump */
+
+struct snapshot_job {
+  pid_t pid;                 /* 0: none running */
+  u_int64_t taken, skipped, failed;
+};
+
+/*
+  Runs dump(arg) in a child process, which exits with 0 on success. Returns
+  -1 (skipped) while the previous dump is still running. The child must not
+  call malloc(): another thread may have held its lock at fork() time.
+*/
+int  snapshot_fork(struct snapshot_job *j, int (*dump)(void *arg), void *arg);
+/* Waits for the running dump, if any */
+void snapshot_wait(struct snapshot_job *j);
+
+#endif /* _SNAPSHOT_H_ */
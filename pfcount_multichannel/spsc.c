@@ -0,0 +1,119 @@
+/*
+ *
+ * Single producer / single consumer ring for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <string.h>
+
+#include "spsc.h"
+
+#include "../tommyds-1.0/tommytypes.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+/* x86 does not reorder stores with stores nor loads with loads */
+#define ring_barrier() __asm__ __volatile__("": : :"memory")
+#else
+#define ring_barrier() __sync_synchronize()
+#endif
+
+/* *************************************** */
+
+size_t spsc_ring_size(u_int32_t num_records, u_int32_t record_size) {
+  return(sizeof(struct spsc_ring) + (size_t)tommy_roundup_pow2_u32(num_records) * record_size);
+}
+
+/* *************************************** */
+
+/* 'mem' holds spsc_ring_size() bytes, 64 bytes aligned */
+struct spsc_ring* spsc_ring_init(void *mem, u_int32_t num_records, u_int32_t record_size) {
+  struct spsc_ring *r = mem;
+
+  memset(r, 0, sizeof(struct spsc_ring));
+  r->num_records = tommy_roundup_pow2_u32(num_records);
+  r->record_size = record_size;
+  return(r);
+}
+
+/* *************************************** */
+
+/* Producer side: -1 when the ring is full (the record is not queued) */
+int spsc_ring_push(struct spsc_ring *r, const void *record) {
+  u_int32_t head = r->head;
+
+  if((head - r->tail) >= r->num_records)
+    return(-1);
+
+  memcpy(&r->records[(size_t)(head & (r->num_records - 1)) * r->record_size], record, r->record_size);
+  ring_barrier(); /* the record before the index */
+  r->head = head + 1;
+  return(0);
+}
+
+/* *************************************** */
+
+/* Consumer side: -1 when the ring is empty */
+int spsc_ring_pop(struct spsc_ring *r, void *record) {
+  u_int32_t tail = r->tail;
+
+  if(tail == r->head)
+    return(-1);
+
+  ring_barrier(); /* the index before the record */
+  memcpy(record, &r->records[(size_t)(tail & (r->num_records - 1)) * r->record_size], r->record_size);
+  ring_barrier(); /* done with the record before giving it back */
+  r->tail = tail + 1;
+  return(0);
+}
+
+/* *************************************** */
+
+/* Producer side: the pending-th free record, NULL when the ring is full */
+void* spsc_ring_reserve(struct spsc_ring *r, u_int32_t pending) {
+  u_int32_t head = r->head + pending;
+
+  if((head - r->tail) >= r->num_records)
+    return(NULL);
+
+  return(&r->records[(size_t)(head & (r->num_records - 1)) * r->record_size]);
+}
+
+/* *************************************** */
+
+void spsc_ring_commit(struct spsc_ring *r, u_int32_t num_records) {
+  ring_barrier(); /* the records before the index */
+  r->head += num_records;
+}
+
+/* *************************************** */
+
+/* Consumer side: the records stay in the ring until spsc_ring_release() */
+u_int32_t spsc_ring_peek(struct spsc_ring *r, void **records, u_int32_t max_records) {
+  u_int32_t tail = r->tail, num = r->head - tail, i;
+
+  if(num > max_records) num = max_records;
+  ring_barrier(); /* the index before the records */
+
+  for(i = 0; i < num; i++)
+    records[i] = &r->records[(size_t)((tail + i) & (r->num_records - 1)) * r->record_size];
+
+  return(num);
+}
+
+/* *************************************** */
+
+void spsc_ring_release(struct spsc_ring *r, u_int32_t num_records) {
+  ring_barrier(); /* done with the records before giving them back */
+  r->tail += num_records;
+}
+
+/* *************************************** */
+
+u_int32_t spsc_ring_count(const struct spsc_ring *r) {
+  return(r->head - r->tail);
+}
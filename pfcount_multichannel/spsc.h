@@ -0,0 +1,52 @@
+/*
+ *
+ * Bounded single producer / single consumer ring of fixed size records.
+ *
+ * The ring is position independent (no pointers inside) so that it can
+ * live in any caller provided memory, including a shared mapping: the
+ * producer only writes 'head', the consumer only writes 'tail', and each
+ * sits on its own cache line. No locks, no atomic read-modify-write.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _SPSC_H_
+#define _SPSC_H_
+
+#include <sys/types.h>
+
+struct spsc_ring {
+  volatile u_int32_t head; /* next record written by the producer */
+  char pad0[60];
+  volatile u_int32_t tail; /* next record read by the consumer */
+  char pad1[60];
+  u_int32_t num_records;   /* power of 2 */
+  u_int32_t record_size;
+  char pad2[56];
+  char records[];
+} __attribute__((aligned(64)));
+
+size_t spsc_ring_size(u_int32_t num_records, u_int32_t record_size);
+struct spsc_ring* spsc_ring_init(void *mem, u_int32_t num_records, u_int32_t record_size);
+int spsc_ring_push(struct spsc_ring *r, const void *record);
+int spsc_ring_pop(struct spsc_ring *r, void *record);
+
+/*
+  In place access, no copy of the records: the producer fills the records
+  returned by spsc_ring_reserve(r, 0), (r, 1)... and queues them all with
+  one spsc_ring_commit(); the consumer reads up to max_records in place
+  and gives them back with spsc_ring_release().
+*/
+void* spsc_ring_reserve(struct spsc_ring *r, u_int32_t pending);
+void spsc_ring_commit(struct spsc_ring *r, u_int32_t num_records);
+u_int32_t spsc_ring_peek(struct spsc_ring *r, void **records, u_int32_t max_records);
+void spsc_ring_release(struct spsc_ring *r, u_int32_t num_records);
+
+/* Either side, or a third thread: records queued, a hint that may be stale */
+u_int32_t spsc_ring_count(const struct spsc_ring *r);
+
+#endif /* _SPSC_H_ */
@@ -0,0 +1,82 @@
+/*
+ *
+ * Packet header time machine for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "timemachine.h"
+
+#define TM_QUERY_CHUNK  4096 /* records copied at a time */
+
+/* *************************************** */
+
+int tm_init(struct time_machine *tm, u_int64_t num_records) {
+  u_int64_t n = 1;
+
+  memset(tm, 0, sizeof(struct time_machine));
+
+  while(n < num_records) n <<= 1;
+  if(n < TM_COMMIT_BATCH) n = TM_COMMIT_BATCH;
+
+  if((arena_init(&tm->arena, n * sizeof(struct tm_record)) != 0)
+     || ((tm->records = arena_alloc(&tm->arena, n * sizeof(struct tm_record))) == NULL)) {
+    arena_done(&tm->arena);
+    return(-1);
+  }
+
+  /* First touch, here rather than on the capture path */
+  memset(tm->records, 0, n * sizeof(struct tm_record));
+  tm->mask = n - 1;
+  return(0);
+}
+
+/* *************************************** */
+
+void tm_done(struct time_machine *tm) {
+  arena_done(&tm->arena);
+  memset(tm, 0, sizeof(struct time_machine));
+}
+
+/* *************************************** */
+
+u_int64_t tm_query(const struct time_machine *tm, const struct victim_key *key, u_int32_t since,
+		   void (*match)(const struct tm_record *r, void *arg), void *arg) {
+  struct tm_record chunk[TM_QUERY_CHUNK];
+  u_int64_t size = tm->mask + 1, end = tm->committed, i, j, n, valid, num = 0;
+  u_int32_t addr = (key != NULL) ? tm_fold(key->addr, key->version) : 0;
+
+  for(i = (end > size) ? end - size : 0; i < end; i += n) {
+    n = ((end - i) < TM_QUERY_CHUNK) ? (end - i) : TM_QUERY_CHUNK;
+
+    for(j = 0; j < n; j++)
+      chunk[j] = tm->records[(i + j) & tm->mask];
+
+    /* Records the writer may have overwritten while they were copied */
+    __sync_synchronize();
+    valid = tm->committed + TM_COMMIT_BATCH;
+    valid = (valid > size) ? valid - size : 0;
+
+    for(j = 0; j < n; j++) {
+      const struct tm_record *r = &chunk[j];
+
+      if((i + j < valid) || (r->ts_sec < since))
+	continue;
+
+      if((key != NULL) && ((r->version != key->version) || ((r->src != addr) && (r->dst != addr))))
+	continue;
+
+      match(r, arg);
+      num++;
+    }
+  }
+
+  return(num);
+}
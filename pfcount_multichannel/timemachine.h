@@ -0,0 +1,112 @@
+/*
+ *
+ * Packet header "time machine" for pfcount_multichannel (-J): the last
+ * seconds of packet headers of each capture thread, always in memory.
+ *
+ * Every packet seen by a capture thread leaves a 32 byte tm_record
+ * (addresses, ports, length, TCP flags, timestamp) in a per thread
+ * circular buffer, reserved in a hugepage backed arena and sized as
+ * seconds x peak packet rate. The records are written with non-temporal
+ * stores: the buffer is far larger than the caches and is only read back
+ * after an attack, so it must not evict the flow tables.
+ *
+ * Non-temporal stores are weakly ordered: the writer publishes its
+ * position ('committed') after a store fence every TM_COMMIT_BATCH
+ * records. Readers (the reporter) copy committed records in chunks and
+ * drop those the writer may have overwritten meanwhile.
+ *
+ * IPv6 addresses are folded to 32 bits (xor of the four words): a query
+ * by IPv6 victim may return the packets of a few other addresses.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _TIMEMACHINE_H_
+#define _TIMEMACHINE_H_
+
+#include <sys/types.h>
+#include <string.h>
+
+#include "pfring.h"
+#include "arena.h"
+#include "victims.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TM_COMMIT_BATCH        64          /* records */
+#define DEFAULT_TM_PEAK_KPPS   1000        /* per thread */
+
+struct tm_record {
+  u_int32_t ts_sec, ts_usec;
+  u_int32_t src, dst;          /* host byte order, IPv6 folded */
+  u_int16_t sport, dport;
+  u_int16_t len;
+  u_int8_t  proto, tcp_flags;
+  u_int8_t  version, rx_direction;
+  u_int8_t  pad[6];
+} __attribute__((aligned(32)));
+
+struct time_machine {
+  struct tm_record *records;
+  u_int64_t mask;              /* number of records - 1 */
+  u_int64_t head;              /* writer */
+  volatile u_int64_t committed;
+  struct arena arena;
+};
+
+/* Reserves room for num_records (rounded up to a power of 2), on the NUMA node of the calling thread */
+int  tm_init(struct time_machine *tm, u_int64_t num_records);
+void tm_done(struct time_machine *tm);
+
+static inline u_int32_t tm_fold(const u_int32_t *addr, u_int8_t version) {
+  return((version == 4) ? addr[0] : (addr[0] ^ addr[1] ^ addr[2] ^ addr[3]));
+}
+
+/* Capture thread: records the header of a parsed IP packet */
+static inline void tm_record_packet(struct time_machine *tm, const struct pfring_pkthdr *h) {
+  const struct pkt_parsing_info *pp = &h->extended_hdr.parsed_pkt;
+  struct tm_record r, *slot = &tm->records[tm->head & tm->mask];
+
+  r.ts_sec = h->ts.tv_sec, r.ts_usec = h->ts.tv_usec;
+  if(pp->eth_type == 0x86DD) {
+    r.src = tm_fold((const u_int32_t*)&pp->ipv6_src, 6), r.dst = tm_fold((const u_int32_t*)&pp->ipv6_dst, 6);
+    r.version = 6;
+  } else
+    r.src = pp->ipv4_src, r.dst = pp->ipv4_dst, r.version = 4;
+  r.sport = pp->l4_src_port, r.dport = pp->l4_dst_port;
+  r.len = (h->len > 0xFFFF) ? 0xFFFF : h->len;
+  r.proto = pp->l3_proto, r.tcp_flags = (pp->l3_proto == 6) ? pp->tcp.flags : 0;
+  r.rx_direction = h->extended_hdr.rx_direction;
+
+#ifdef __SSE2__
+  _mm_stream_si128((__m128i*)slot, _mm_load_si128((const __m128i*)&r));
+  _mm_stream_si128((__m128i*)slot + 1, _mm_load_si128((const __m128i*)&r + 1));
+#else
+  memcpy(slot, &r, sizeof(r));
+#endif
+
+  if((++tm->head & (TM_COMMIT_BATCH - 1)) == 0) {
+#ifdef __SSE2__
+    _mm_sfence();
+#else
+    __sync_synchronize();
+#endif
+    tm->committed = tm->head;
+  }
+}
+
+/*
+  Reporter: calls match() on the committed records of tm with
+  ts_sec >= since, oldest first, for key (NULL: all of them). Returns the
+  number of records passed to match().
+*/
+u_int64_t tm_query(const struct time_machine *tm, const struct victim_key *key, u_int32_t since,
+		   void (*match)(const struct tm_record *r, void *arg), void *arg);
+
+#endif /* _TIMEMACHINE_H_ */
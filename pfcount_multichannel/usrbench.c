@@ -0,0 +1,417 @@
+/*
+ *
+ * Consumer path microbenchmark over a userspace ring (usrX), no NIC needed.
+ *
+ * A producer thread enqueues packets on usrX (the usring module of the
+ * library, pfring_send_burst()) while a consumer thread, on another core,
+ * reads them with one of the pfring_mod_recv() based loops:
+ *
+ * - loop:      pfring_loop()
+ * - burst:     pfring_loop_burst()
+ * - batch:     pfring_loop_batch(), headers and packets read in the slots
+ * - pipelined: pfring_loop_pipelined(), -P slots of lookahead
+ *
+ * The packet lengths follow a weighted mix (-s, default a simple IMIX).
+ * The producer writes its clock in the payload of every packet, so that
+ * the consumer measures the enqueue to read latency, reported as a
+ * distribution. The consumer also reads its hardware counters (bench.h):
+ * the LLC misses per packet are the slot and index cache lines moving
+ * from the producer core. The ring is never allowed to drop: a producer
+ * finding it full retries, and the retries are reported.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "pfring.h"
+#include "bench.h" /* bench_counters */
+
+#define DEFAULT_USR_DEVICE  "usr0"
+#define DEFAULT_PKTS        (10*1000*1000) /* per run */
+#define DEFAULT_MIX         "60:7,590:4,1514:1"
+#define DEFAULT_APIS        "loop,burst,batch,pipelined"
+#define DEFAULT_SEND_BURST  32
+#define MAX_MIX             8
+#define MIX_PATTERN         1024 /* lengths the producer cycles through */
+#define TIMESTAMP_OFFSET    42   /* Ethernet + IPv4 + UDP */
+#define LATENCY_BUCKETS     40   /* log2(ns) */
+
+typedef enum {
+  api_loop = 0,
+  api_burst,
+  api_batch,
+  api_pipelined,
+  NUM_APIS
+} consumer_api;
+
+static const char *api_name[NUM_APIS] = { "loop", "burst", "batch", "pipelined" };
+
+struct consumer {
+  pfring *ring;
+  consumer_api api;
+  u_int32_t lookahead;
+  int core;
+  u_int64_t num_pkts;
+  /* Written by the consumer thread only */
+  u_int64_t pkts, bytes, sink, last_ns;
+  u_int64_t latency[LATENCY_BUCKETS];
+  u_int64_t counters[bench_num_counters];
+  int num_counters;
+};
+
+/* *************************************** */
+
+static u_int64_t clock_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/* *************************************** */
+
+static void bind_to_core(int core) {
+  cpu_set_t set;
+
+  if(core < 0) return;
+
+  CPU_ZERO(&set);
+  CPU_SET(core, &set);
+  if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+    fprintf(stderr, "Unable to bind to core %d\n", core);
+}
+
+/* *************************************** */
+
+static inline void consume(struct consumer *c, const struct pfring_pkthdr *h, const u_char *p) {
+  if(h->caplen >= TIMESTAMP_OFFSET + sizeof(u_int64_t)) {
+    u_int64_t sent, delay;
+    u_int32_t bucket = 0;
+
+    memcpy(&sent, &p[TIMESTAMP_OFFSET], sizeof(sent));
+    delay = clock_ns() - sent;
+    while((delay >>= 1) && (bucket < LATENCY_BUCKETS - 1)) bucket++;
+    c->latency[bucket]++;
+  } else
+    c->sink += p[0];
+
+  c->pkts++, c->bytes += h->len;
+
+  if(c->pkts == c->num_pkts) {
+    c->last_ns = clock_ns();
+    pfring_breakloop(c->ring);
+  }
+}
+
+/* *************************************** */
+
+static void loop_callback(const struct pfring_pkthdr *h, const u_char *p, const u_char *user_bytes) {
+  consume((struct consumer *)user_bytes, h, p);
+}
+
+static void burst_callback(const struct pfring_pkthdr *h, u_char * const *p, u_int num_pkts, const u_char *user_bytes) {
+  u_int i;
+
+  for(i = 0; i < num_pkts; i++)
+    consume((struct consumer *)user_bytes, &h[i], p[i]);
+}
+
+static void batch_callback(struct pfring_pkthdr * const *h, u_char * const *p, u_int num_pkts, const u_char *user_bytes) {
+  u_int i;
+
+  for(i = 0; i < num_pkts; i++)
+    consume((struct consumer *)user_bytes, h[i], p[i]);
+}
+
+/* *************************************** */
+
+static void* consumer_thread(void *arg) {
+  struct consumer *c = (struct consumer *)arg;
+  struct bench_counters counters;
+  u_int64_t start[bench_num_counters], end[bench_num_counters];
+  int i;
+
+  bind_to_core(c->core);
+  c->num_counters = bench_counters_open(&counters);
+  bench_counters_read(&counters, start);
+
+  /* Not waiting: the loops spin, as a busy capture thread would */
+  while(c->pkts < c->num_pkts) {
+    switch(c->api) {
+    case api_loop:
+      pfring_loop(c->ring, loop_callback, (u_char *)c, 0);
+      break;
+    case api_burst:
+      pfring_loop_burst(c->ring, burst_callback, (u_char *)c, MAX_BURST_LEN, 0);
+      break;
+    case api_batch:
+      pfring_loop_batch(c->ring, batch_callback, (u_char *)c, MAX_BURST_LEN, 0);
+      break;
+    case api_pipelined:
+      pfring_loop_pipelined(c->ring, loop_callback, NULL, (u_char *)c, c->lookahead, 0);
+      break;
+    default:
+      return(NULL);
+    }
+  }
+
+  bench_counters_read(&counters, end);
+  bench_counters_close(&counters);
+
+  for(i = 0; i < bench_num_counters; i++)
+    c->counters[i] = end[i] - start[i];
+
+  return(NULL);
+}
+
+/* *************************************** */
+
+/* The latency (ns, upper bound of its bucket) below which 'fraction' of the packets were read */
+static u_int64_t latency_percentile(const struct consumer *c, double fraction) {
+  u_int64_t total = 0, seen = 0;
+  int i;
+
+  for(i = 0; i < LATENCY_BUCKETS; i++) total += c->latency[i];
+  if(total == 0) return(0);
+
+  for(i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += c->latency[i];
+    if(seen >= fraction * total) break;
+  }
+
+  return(2ULL << i);
+}
+
+/* *************************************** */
+
+static int bench_run(const char *usr_device, consumer_api api, u_int32_t flags, u_int32_t lookahead,
+		     const u_int32_t *pattern, u_int64_t num_pkts, u_int32_t send_burst,
+		     int producer_core, int consumer_core) {
+  static u_char pkt[MAX_BURST_LEN][1514];
+  char device[64], *pkts[MAX_BURST_LEN];
+  u_int lens[MAX_BURST_LEN];
+  struct consumer c;
+  pfring *producer;
+  pthread_t consumer;
+  u_int64_t sent = 0, retries = 0, start, ns;
+  u_int32_t i, next = 0;
+
+  memset(&c, 0, sizeof(c));
+  c.api = api, c.lookahead = lookahead, c.core = consumer_core, c.num_pkts = num_pkts;
+
+  /* The consumer creates usrX, the producer attaches to it */
+  snprintf(device, sizeof(device), "%s", usr_device);
+  if((c.ring = pfring_open(device, 1514, flags)) == NULL) {
+    fprintf(stderr, "pfring_open(%s) error [%s]\n", device, strerror(errno));
+    return(-1);
+  }
+
+  snprintf(device, sizeof(device), "userspace:%s", usr_device);
+  if((producer = pfring_open(device, 1514, 0)) == NULL) {
+    fprintf(stderr, "pfring_open(%s) error [%s]\n", device, strerror(errno));
+    pfring_close(c.ring);
+    return(-1);
+  }
+
+  pfring_set_application_name(c.ring, "usrbench");
+  pfring_enable_ring(c.ring);
+  pfring_enable_ring(producer);
+
+  /* UDP packets from 10.0.0.1 to 10.0.0.2 */
+  memset(pkt, 0, sizeof(pkt));
+  for(i = 0; i < MAX_BURST_LEN; i++) {
+    static const u_char header[] = {
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x08, 0x00,
+      0x45, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,
+      10, 0, 0, 1, 10, 0, 0, 2,
+      0x04, 0x00, 0x00, 0x35, 0x00, 0x00, 0x00, 0x00
+    };
+
+    memcpy(pkt[i], header, sizeof(header));
+    pkts[i] = (char *)pkt[i];
+  }
+
+  pthread_create(&consumer, NULL, consumer_thread, &c);
+  usleep(100000);
+
+  bind_to_core(producer_core);
+  start = clock_ns();
+
+  while(sent < num_pkts) {
+    u_int32_t num = ((num_pkts - sent) < send_burst) ? (num_pkts - sent) : send_burst;
+    u_int64_t now = clock_ns();
+    int rc;
+
+    for(i = 0; i < num; i++) {
+      lens[i] = pattern[next++ % MIX_PATTERN];
+      memcpy(&pkt[i][TIMESTAMP_OFFSET], &now, sizeof(now));
+    }
+
+    while((rc = pfring_send_burst(producer, pkts, lens, num, 1)) <= 0)
+      retries++; /* full: the consumer is behind */
+
+    sent += rc;
+    next -= num - rc; /* the lengths not sent go again */
+  }
+
+  pthread_join(consumer, NULL);
+  ns = c.last_ns - start;
+
+  pfring_close(producer);
+  pfring_close(c.ring);
+
+  printf("%-9s %10.2f %8.2f %8.1f %10.2f %8.2f %8.2f %8llu %8llu %8llu %10llu\n",
+	 api_name[api], (double)c.pkts * 1000 / ns, (double)c.bytes * 8 / ns, (double)ns / c.pkts,
+	 (double)retries / sent,
+	 c.num_counters ? (double)c.counters[bench_cycles] / c.pkts : 0,
+	 c.num_counters ? (double)c.counters[bench_llc_misses] / c.pkts : 0,
+	 (unsigned long long)latency_percentile(&c, 0.5), (unsigned long long)latency_percentile(&c, 0.99),
+	 (unsigned long long)latency_percentile(&c, 0.999), (unsigned long long)latency_percentile(&c, 1));
+  return(0);
+}
+
+/* *************************************** */
+
+/* "len:weight,..." into MIX_PATTERN lengths, interleaved: returns -1 if invalid */
+static int parse_mix(char *spec, u_int32_t *pattern) {
+  u_int32_t len[MAX_MIX], weight[MAX_MIX], credit[MAX_MIX] = { 0 }, total = 0, num = 0, i, j;
+  char *tok, *save = NULL;
+
+  for(tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if((num == MAX_MIX) || (sscanf(tok, "%u:%u", &len[num], &weight[num]) != 2)
+       || (len[num] < 60) || (len[num] > 1514) || (weight[num] == 0))
+      return(-1);
+    total += weight[num++];
+  }
+
+  if(num == 0) return(-1);
+
+  /* Smooth weighted round robin: the lengths are spread, not in runs */
+  for(i = 0; i < MIX_PATTERN; i++) {
+    u_int32_t best = 0;
+
+    for(j = 0; j < num; j++) {
+      credit[j] += weight[j];
+      if(credit[j] > credit[best]) best = j;
+    }
+
+    credit[best] -= total;
+    pattern[i] = len[best];
+  }
+
+  return(0);
+}
+
+/* *************************************** */
+
+static void help(void) {
+  printf("usrbench - libpfring consumer paths over a userspace ring\n\n");
+  printf("-h              Print this help\n");
+  printf("-i <usrX>       Userspace ring (default %s)\n", DEFAULT_USR_DEVICE);
+  printf("-n <pkts>       Packets per run (default %u)\n", DEFAULT_PKTS);
+  printf("-s <len:w,...>  Packet length mix, 60..1514 bytes with weights (default %s)\n", DEFAULT_MIX);
+  printf("-a <api,...>    Consumer loops: loop, burst, batch, pipelined (default %s)\n", DEFAULT_APIS);
+  printf("-b <pkts>       Producer burst (default %u, max %u)\n", DEFAULT_SEND_BURST, MAX_BURST_LEN);
+  printf("-P <slots>      pipelined lookahead (default %u)\n", DEFAULT_PREFETCH_LOOKAHEAD);
+  printf("-C              Compact 32 byte slot header\n");
+  printf("-g <core>:<core> Bind the producer and the consumer thread\n");
+}
+
+/* *************************************** */
+
+int main(int argc, char* argv[]) {
+  char *usr_device = DEFAULT_USR_DEVICE, apis[256] = DEFAULT_APIS, mix[256] = DEFAULT_MIX, *tok, *save = NULL;
+  u_int32_t pattern[MIX_PATTERN], flags = PF_RING_LONG_HEADER, lookahead = DEFAULT_PREFETCH_LOOKAHEAD;
+  u_int32_t send_burst = DEFAULT_SEND_BURST;
+  u_int64_t num_pkts = DEFAULT_PKTS;
+  int producer_core = -1, consumer_core = -1, a, c;
+  u_int8_t api_enabled[NUM_APIS] = { 0 };
+
+  while((c = getopt(argc, argv, "hi:n:s:a:b:P:Cg:")) != -1) {
+    switch(c) {
+    case 'h':
+      help();
+      return(0);
+    case 'i':
+      usr_device = optarg;
+      break;
+    case 'n':
+      num_pkts = atoll(optarg);
+      break;
+    case 's':
+      snprintf(mix, sizeof(mix), "%s", optarg);
+      break;
+    case 'a':
+      snprintf(apis, sizeof(apis), "%s", optarg);
+      break;
+    case 'b':
+      send_burst = atoi(optarg);
+      break;
+    case 'P':
+      lookahead = atoi(optarg);
+      break;
+    case 'C':
+      flags = PF_RING_COMPACT_HEADER;
+      break;
+    case 'g':
+      if(sscanf(optarg, "%d:%d", &producer_core, &consumer_core) != 2) {
+	fprintf(stderr, "-g needs <core>:<core>\n");
+	return(-1);
+      }
+      break;
+    default:
+      help();
+      return(-1);
+    }
+  }
+
+  if(strncmp(usr_device, "usr", 3)) {
+    fprintf(stderr, "-i needs a usrX device\n");
+    return(-1);
+  }
+
+  if((send_burst == 0) || (send_burst > MAX_BURST_LEN) || (num_pkts == 0)) {
+    fprintf(stderr, "-b needs 1..%u packets, -n at least one\n", MAX_BURST_LEN);
+    return(-1);
+  }
+
+  if(parse_mix(mix, pattern) != 0) {
+    fprintf(stderr, "Invalid packet mix '%s' (len:weight,... with at most %u lengths of 60..1514 bytes)\n",
+	    mix, MAX_MIX);
+    return(-1);
+  }
+
+  for(tok = strtok_r(apis, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    for(a = 0; a < NUM_APIS; a++)
+      if(!strcmp(tok, api_name[a])) break;
+
+    if(a == NUM_APIS) {
+      fprintf(stderr, "Unknown consumer loop '%s'\n", tok);
+      return(-1);
+    }
+    api_enabled[a] = 1;
+  }
+
+  printf("%-9s %10s %8s %8s %10s %8s %8s %8s %8s %8s %10s\n", "Loop", "Mpps", "Gbit/s", "ns/pkt",
+	 "Retry/pkt", "Cyc/pkt", "LLC/pkt", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+
+  for(a = 0; a < NUM_APIS; a++)
+    if(api_enabled[a]
+       && (bench_run(usr_device, a, flags, lookahead, pattern, num_pkts, send_burst, producer_core, consumer_core) != 0))
+      return(-1);
+
+  return(0);
+}
@@ -0,0 +1,285 @@
+/*
+ *
+ * Process-wide per-destination traffic for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "victims.h"
+
+#define DELTA_MASK  (VICTIM_DELTA_SLOTS * 2 - 1)
+
+const char *amp_class_name[NUM_AMP_CLASSES] = {
+  "DNS", "Chargen", "Portmap", "NTP", "SNMP", "CLDAP", "SSDP", "Memcached"
+};
+
+const char *pkt_class_name[NUM_PKT_CLASSES] = {
+  "SYN", "SYN+ACK", "ACK", "PSH+ACK", "RST", "FIN", "Odd", "Frag", "Other"
+};
+
+/* FIN 0x01, SYN 0x02, RST 0x04, PSH 0x08, ACK 0x10, URG 0x20 (ignored) */
+#define TCP_CLASS(f)							\
+  ((((f) & 0x07) == 0x02) ? (((f) & 0x10) ? pkt_class_synack : pkt_class_syn) \
+   : (((f) & 0x07) == 0x04) ? pkt_class_rst				\
+   : (((f) & 0x07) == 0x01) ? pkt_class_fin				\
+   : ((((f) & 0x07) != 0) || !((f) & 0x10)) ? pkt_class_odd		\
+   : ((f) & 0x08) ? pkt_class_pshack : pkt_class_ack)
+#define TCP_CLASS4(f)   TCP_CLASS(f), TCP_CLASS(f + 1), TCP_CLASS(f + 2), TCP_CLASS(f + 3)
+#define TCP_CLASS16(f)  TCP_CLASS4(f), TCP_CLASS4(f + 4), TCP_CLASS4(f + 8), TCP_CLASS4(f + 12)
+
+const u_int8_t pkt_class_map[66] = {
+  TCP_CLASS16(0), TCP_CLASS16(16), TCP_CLASS16(32), TCP_CLASS16(48),
+  pkt_class_other, pkt_class_fragment
+};
+
+/* *************************************** */
+
+void victim_deltas_init(struct victim_deltas *d) {
+  memset(d, 0, sizeof(struct victim_deltas));
+}
+
+/* *************************************** */
+
+static u_int32_t flush(struct victim_deltas *d, struct spsc_ring *ring) {
+  u_int32_t i, lost = 0;
+
+  for(i = 0; i < d->count; i++) {
+    struct victim_delta *v = &d->slot[d->used[i]];
+
+    if(spsc_ring_push(ring, v) != 0) lost++;
+    v->pkts = 0; /* free */
+  }
+
+  d->count = 0;
+  return(lost);
+}
+
+/* *************************************** */
+
+u_int32_t victim_deltas_flush(struct victim_deltas *d, struct spsc_ring *ring) {
+  return(flush(d, ring));
+}
+
+/* *************************************** */
+
+u_int32_t victim_deltas_add(struct victim_deltas *d, struct spsc_ring *ring, const struct victim_key *key,
+			    u_int32_t now, u_int32_t len, u_int8_t syn, amp_class amp, pkt_class mix,
+			    const u_int64_t *entropy_items, const struct victim_delta **touched) {
+  u_int32_t pos, lost = 0;
+  struct victim_delta *v;
+
+  if(d->epoch != now) {
+    lost = flush(d, ring);
+    d->epoch = now;
+  }
+
+  for(pos = victim_hash(key) & DELTA_MASK; d->slot[pos].pkts != 0; pos = (pos + 1) & DELTA_MASK) {
+    if(victim_key_equal(&d->slot[pos].key, key)) {
+      v = &d->slot[pos];
+      v->pkts++, v->bytes += len, v->syns += syn;
+      amp_add(&v->amp, amp, len);
+      pkt_mix_add(&v->mix, mix, len);
+      if(entropy_items != NULL) entropy_add(&v->entropy, entropy_items);
+      *touched = v;
+      return(lost);
+    }
+  }
+
+  if(d->count == VICTIM_DELTA_SLOTS) {
+    *touched = NULL;
+    return(lost + 1); /* too many destinations this second */
+  }
+
+  v = &d->slot[pos];
+  v->key = *key, v->epoch = now;
+  v->pkts = 1, v->bytes = len, v->syns = syn;
+  memset(&v->amp, 0, sizeof(v->amp));
+  memset(&v->mix, 0, sizeof(v->mix));
+  memset(&v->entropy, 0, sizeof(v->entropy));
+  amp_add(&v->amp, amp, len);
+  pkt_mix_add(&v->mix, mix, len);
+  if(entropy_items != NULL) entropy_add(&v->entropy, entropy_items);
+  d->used[d->count++] = pos;
+  *touched = v;
+  return(lost);
+}
+
+/* *************************************** */
+
+void victim_summary_init(struct victim_summary *s) {
+  s->map_type = victim_map_hash;
+  tommy_hashdyn_init(&s->map);
+  tommy_trie_inplace_init(&s->map4);
+  tommy_list_init(&s->all);
+  s->records = 0;
+  s->budget = NULL;
+  memset(&s->account, 0, sizeof(s->account));
+  s->overflow = 0;
+}
+
+/* *************************************** */
+
+static int compare_victim(const void *arg, const void *obj) {
+  return(!victim_key_equal(arg, &((const struct victim_summary_node *)obj)->key));
+}
+
+/* *************************************** */
+
+static inline int in_trie(const struct victim_summary *s, const struct victim_key *key) {
+  return((s->map_type == victim_map_trie) && (key->version == 4));
+}
+
+static inline tommy_key_t trie_key(const struct victim_key *key) {
+  return((tommy_key_t)key->addr[0] << (TOMMY_KEY_BIT - 32));
+}
+
+static struct victim_summary_node* summary_node(struct victim_summary *s, const struct victim_key *key) {
+  u_int64_t hash = 0;
+  struct victim_summary_node *n;
+
+  if(in_trie(s, key))
+    n = tommy_trie_inplace_search(&s->map4, trie_key(key)); /* one object per key */
+  else
+    n = tommy_hashdyn_search(&s->map, compare_victim, key, hash = victim_hash(key));
+
+  if(n == NULL) {
+    if((s->budget != NULL) && (budget_charge(s->budget, &s->account, sizeof(struct victim_summary_node)) != 0))
+      return(NULL);
+
+    if((n = calloc(1, sizeof(struct victim_summary_node))) == NULL) {
+      if(s->budget != NULL) budget_release(s->budget, &s->account, sizeof(struct victim_summary_node));
+      return(NULL);
+    }
+
+    n->key = *key;
+    if(in_trie(s, key))
+      tommy_trie_inplace_insert(&s->map4, &n->node.trie, n, trie_key(key));
+    else
+      tommy_hashdyn_insert(&s->map, &n->node.hash, n, hash);
+    tommy_list_insert_tail(&s->all, &n->list_node, n);
+  }
+
+  return(n);
+}
+
+/* *************************************** */
+
+static void amp_merge(struct amp_counters *a, const struct amp_counters *b) {
+  u_int32_t i;
+
+  for(i = 0; i < NUM_AMP_CLASSES; i++)
+    a->pkts[i] += b->pkts[i], a->bytes[i] += b->bytes[i];
+
+  for(i = 0; i < AMP_SIZE_BUCKETS; i++)
+    a->sizes[i] += b->sizes[i];
+}
+
+/* *************************************** */
+
+static void pkt_mix_merge(struct pkt_mix *a, const struct pkt_mix *b) {
+  u_int32_t i;
+
+  for(i = 0; i < NUM_PKT_CLASSES; i++)
+    a->classes[i] += b->classes[i];
+
+  for(i = 0; i < PKT_SIZE_BUCKETS; i++)
+    a->sizes[i] += b->sizes[i];
+}
+
+/* *************************************** */
+
+void victim_summary_drain(struct victim_summary *s, struct spsc_ring *ring) {
+  struct victim_delta v;
+
+  while(spsc_ring_pop(ring, &v) == 0) {
+    struct victim_summary_node *n = summary_node(s, &v.key);
+    struct victim_totals *t;
+
+    if(n == NULL) {
+      s->overflow++;
+      continue;
+    }
+
+    t = &n->second[v.epoch & 1];
+    if(t->epoch != v.epoch)
+      memset(t, 0, sizeof(struct victim_totals)), t->epoch = v.epoch;
+
+    t->pkts += v.pkts, t->bytes += v.bytes, t->syns += v.syns;
+    amp_merge(&t->amp, &v.amp);
+    pkt_mix_merge(&t->mix, &v.mix);
+    entropy_merge(&t->entropy, &v.entropy);
+    s->records++;
+  }
+}
+
+/* *************************************** */
+
+u_int32_t victim_summary_top(struct victim_summary *s, u_int32_t epoch, struct victim_delta *top, u_int32_t max) {
+  tommy_topk heaviest;
+  tommy_node *i;
+  u_int32_t num, j;
+
+  /* O(n log max) and one compare for most of the destinations: millions under a spoofed flood */
+  tommy_topk_init(&heaviest, max);
+
+  for(i = tommy_list_head(&s->all); i != NULL; i = i->next) {
+    struct victim_summary_node *n = i->data;
+    struct victim_totals *t = &n->second[epoch & 1];
+
+    if((t->epoch == epoch) && (t->pkts > 0))
+      tommy_topk_insert(&heaviest, n, t->pkts);
+  }
+
+  num = tommy_topk_sort(&heaviest);
+
+  for(j = 0; j < num; j++) {
+    struct victim_summary_node *n = tommy_topk_get(&heaviest, j);
+    struct victim_totals *t = &n->second[epoch & 1];
+
+    top[j].key = n->key, top[j].epoch = t->epoch;
+    top[j].pkts = t->pkts, top[j].bytes = t->bytes, top[j].syns = t->syns;
+    top[j].amp = t->amp, top[j].mix = t->mix, top[j].entropy = t->entropy;
+  }
+
+  tommy_topk_done(&heaviest);
+  return(num);
+}
+
+/* *************************************** */
+
+void victim_summary_expire(struct victim_summary *s, u_int32_t now) {
+  tommy_node *i = tommy_list_head(&s->all);
+
+  while(i != NULL) {
+    struct victim_summary_node *n = i->data;
+    u_int32_t newest = (n->second[0].epoch > n->second[1].epoch) ? n->second[0].epoch : n->second[1].epoch;
+
+    i = i->next;
+    if((int32_t)(now - newest) > VICTIM_SUMMARY_TTL) {
+      if(in_trie(s, &n->key))
+	tommy_trie_inplace_remove_existing(&s->map4, &n->node.trie);
+      else
+	tommy_hashdyn_remove_existing(&s->map, &n->node.hash);
+      tommy_list_remove_existing(&s->all, &n->list_node);
+      free(n);
+      if(s->budget != NULL) budget_release(s->budget, &s->account, sizeof(struct victim_summary_node));
+    }
+  }
+}
+
+/* *************************************** */
+
+void victim_summary_restore(struct victim_summary *s, const struct victim_key *key,
+			    const struct victim_totals *second) {
+  struct victim_summary_node *n = summary_node(s, key);
+
+  if(n != NULL)
+    memcpy(n->second, second, sizeof(n->second));
+}
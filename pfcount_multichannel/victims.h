@@ -0,0 +1,236 @@
+/*
+ *
+ * Process-wide per-destination traffic for pfcount_multichannel.
+ *
+ * Each capture thread accumulates, for the current second, a delta per
+ * destination in a small private table. On the first packet of the next
+ * second, or when the capture loop finds the ring empty in a later second,
+ * the deltas are pushed to the thread's SPSC ring and the table is
+ * cleared. The reporter drains all the rings into one summary keyed by
+ * destination, holding the last two seconds, so that per victim totals
+ * across channels need no lock and no scan of the flow tables.
+ *
+ * UDP packets from the source port of a well-known amplifier (DNS, NTP,
+ * SSDP, memcached...) are also counted per reflection class, with a size
+ * histogram, in the same entry: a switch on the port and a few adds.
+ * Every packet also counts in the packet mix of its destination: TCP flag
+ * combination class (or non-first fragment) and log2 size, looked up and
+ * counted without a branch. With -Y, the source address, source port and
+ * destination port entropy sketches (entropy.h) of the destination are
+ * updated as well: the reporter adds up those of the threads.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _VICTIMS_H_
+#define _VICTIMS_H_
+
+#include <sys/types.h>
+
+#include "spsc.h"
+#include "entropy.h"
+#include "budget.h"
+#include "../tommyds-1.0/tommyhashdyn.h"
+#include "../tommyds-1.0/tommytrieinp.h"
+#include "../tommyds-1.0/tommylist.h"
+#include "../tommyds-1.0/tommytopk.h"
+
+#define VICTIM_DELTA_SLOTS     4096 /* destinations per thread and second */
+#define VICTIM_QUEUE_RECORDS   8192
+#define VICTIM_SUMMARY_TTL     10   /* sec: destinations silent for longer are forgotten */
+
+typedef enum {
+  amp_dns = 0,    /* 53 */
+  amp_chargen,    /* 19 */
+  amp_portmap,    /* 111 */
+  amp_ntp,        /* 123 */
+  amp_snmp,       /* 161 */
+  amp_cldap,      /* 389 */
+  amp_ssdp,       /* 1900 */
+  amp_memcached,  /* 11211 */
+  NUM_AMP_CLASSES,
+  amp_none = NUM_AMP_CLASSES
+} amp_class;
+
+#define AMP_SIZE_BUCKETS       5    /* < 128, < 512, < 1024, < 1500, >= 1500 bytes */
+
+extern const char *amp_class_name[NUM_AMP_CLASSES];
+
+struct amp_counters {
+  u_int32_t pkts[NUM_AMP_CLASSES];
+  u_int64_t bytes[NUM_AMP_CLASSES];
+  u_int32_t sizes[AMP_SIZE_BUCKETS]; /* of the packets of any class */
+};
+
+static inline amp_class amp_classify(u_int8_t proto, u_int16_t sport) {
+  if(proto != 17)
+    return(amp_none);
+
+  switch(sport) {
+  case 53:    return(amp_dns);
+  case 19:    return(amp_chargen);
+  case 111:   return(amp_portmap);
+  case 123:   return(amp_ntp);
+  case 161:   return(amp_snmp);
+  case 389:   return(amp_cldap);
+  case 1900:  return(amp_ssdp);
+  case 11211: return(amp_memcached);
+  default:    return(amp_none);
+  }
+}
+
+static inline void amp_add(struct amp_counters *a, amp_class c, u_int32_t len) {
+  if(c == amp_none)
+    return;
+
+  a->pkts[c]++, a->bytes[c] += len;
+  a->sizes[(len < 128) ? 0 : (len < 512) ? 1 : (len < 1024) ? 2 : (len < 1500) ? 3 : 4]++;
+}
+
+typedef enum {
+  pkt_class_syn = 0,
+  pkt_class_synack,
+  pkt_class_ack,       /* ACK alone */
+  pkt_class_pshack,    /* PSH+ACK: data */
+  pkt_class_rst,       /* RST, RST+ACK */
+  pkt_class_fin,       /* FIN, FIN+ACK */
+  pkt_class_odd,       /* null, PSH alone, SYN+FIN, xmas... */
+  pkt_class_fragment,  /* TCP/UDP non-first fragment: no L4 header */
+  pkt_class_other,     /* UDP, ICMP... not reported */
+  NUM_PKT_CLASSES
+} pkt_class;
+
+#define PKT_SIZE_BUCKETS       8    /* log2: < 64, < 128 ... < 4096, >= 4096 bytes */
+
+extern const char *pkt_class_name[NUM_PKT_CLASSES];
+/* TCP flags (6 bits) to pkt_class, then [64] non TCP and [65] fragments */
+extern const u_int8_t pkt_class_map[66];
+
+struct pkt_mix {
+  u_int32_t classes[NUM_PKT_CLASSES];
+  u_int32_t sizes[PKT_SIZE_BUCKETS];
+};
+
+static inline pkt_class pkt_classify(u_int8_t proto, u_int8_t tcp_flags, int16_t l4_offset) {
+  u_int32_t is_tcp = (proto == 6), is_fragment = (is_tcp | (proto == 17)) & (l4_offset == 0);
+  u_int32_t idx = (tcp_flags & 0x3F) * is_tcp + 64 * !is_tcp;
+
+  return((pkt_class)pkt_class_map[idx + (65 - idx) * is_fragment]);
+}
+
+static inline void pkt_mix_add(struct pkt_mix *m, pkt_class c, u_int32_t len) {
+  u_int32_t b = 31 - __builtin_clz(len | 32) - 5; /* 0 below 64 bytes */
+
+  m->classes[c]++;
+  m->sizes[b - (b > 7) * (b - 7)]++;
+}
+
+/* IPv4 address (host byte order) in addr[0], IPv6 (network byte order) in addr[] */
+struct victim_key {
+  u_int32_t addr[4];
+  u_int32_t version;
+};
+
+struct victim_delta {
+  struct victim_key key;
+  u_int32_t epoch; /* sec */
+  u_int32_t pkts, syns;
+  u_int64_t bytes;
+  struct amp_counters amp;
+  struct pkt_mix mix;
+  struct entropy_sketch entropy;
+};
+
+static inline u_int64_t victim_hash(const struct victim_key *key) {
+  return(tommy_hash_u64_16(key->version, key->addr));
+}
+
+static inline int victim_key_equal(const struct victim_key *a, const struct victim_key *b) {
+  return(((a->addr[0] ^ b->addr[0]) | (a->addr[1] ^ b->addr[1]) | (a->addr[2] ^ b->addr[2])
+	  | (a->addr[3] ^ b->addr[3]) | (a->version ^ b->version)) == 0);
+}
+
+/* Capture thread side */
+struct victim_deltas {
+  u_int32_t epoch, count;
+  u_int32_t used[VICTIM_DELTA_SLOTS]; /* slots in use, to clear them without a full pass */
+  struct victim_delta slot[VICTIM_DELTA_SLOTS * 2]; /* at most half full */
+};
+
+/* Reporter side */
+struct victim_totals {
+  u_int32_t epoch;
+  u_int32_t pkts, syns;
+  u_int64_t bytes;
+  struct amp_counters amp;
+  struct pkt_mix mix;
+  struct entropy_sketch entropy;
+};
+
+struct victim_summary_node {
+  union {
+    tommy_node hash;               /* map */
+    tommy_trie_inplace_node trie;  /* map4 */
+  } node;
+  tommy_node list_node; /* all */
+  struct victim_key key;
+  struct victim_totals second[2]; /* indexed by epoch & 1 */
+};
+
+/*
+ * victim_map_trie (-m <mode>,trie): the IPv4 destinations are in an inplace
+ * trie keyed by their address, in the high bits of the key so that the
+ * first levels branch on the prefix: no hash to compute, no resize (a
+ * hash table doubling under a spoofed flood moves millions of nodes in
+ * one report). The IPv6 ones stay in the hash table.
+ */
+typedef enum {
+  victim_map_hash = 0,
+  victim_map_trie
+} victim_map_type;
+
+struct victim_summary {
+  victim_map_type map_type;  /* before the first victim_summary_drain() */
+  tommy_hashdyn map;
+  tommy_trie_inplace map4;   /* victim_map_trie */
+  tommy_list all;
+  u_int64_t records;
+  struct memory_budget *budget; /* NULL: nodes not accounted */
+  struct budget_account account; /* the nodes */
+  u_int64_t overflow;           /* deltas of the destinations refused a node */
+};
+
+static inline u_int32_t victim_summary_count(struct victim_summary *s) {
+  return(tommy_hashdyn_count(&s->map) + tommy_trie_inplace_count(&s->map4));
+}
+
+void victim_deltas_init(struct victim_deltas *d);
+/*
+ * Returns the number of deltas lost (table or ring full). *touched is the
+ * destination's delta of this second, NULL when it is not tracked.
+ * entropy_items: one per entropy_feature, NULL without -Y.
+ */
+u_int32_t victim_deltas_add(struct victim_deltas *d, struct spsc_ring *ring, const struct victim_key *key,
+			    u_int32_t now, u_int32_t len, u_int8_t syn, amp_class amp, pkt_class mix,
+			    const u_int64_t *entropy_items, const struct victim_delta **touched);
+/*
+ * Pushes the deltas of second d->epoch now, without waiting for a packet
+ * of the next one: a quiet ring (idle capture loop) and thread exit.
+ * Capture thread only. Returns the number of deltas lost (ring full).
+ */
+u_int32_t victim_deltas_flush(struct victim_deltas *d, struct spsc_ring *ring);
+
+void victim_summary_init(struct victim_summary *s);
+void victim_summary_drain(struct victim_summary *s, struct spsc_ring *ring);
+/* The 'max' heaviest (pkts) destinations of second 'epoch', returns how many were found */
+u_int32_t victim_summary_top(struct victim_summary *s, u_int32_t epoch, struct victim_delta *top, u_int32_t max);
+void victim_summary_expire(struct victim_summary *s, u_int32_t now);
+/* Warm restart (snapshot.h) */
+void victim_summary_restore(struct victim_summary *s, const struct victim_key *key,
+			    const struct victim_totals *second);
+
+#endif /* _VICTIMS_H_ */
@@ -0,0 +1,70 @@
+/*
+ *
+ * Sliding window rate counters for pfcount_multichannel
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#include <string.h>
+
+#include "window.h"
+
+/* *************************************** */
+
+void window_reset(struct rate_window *w) {
+  memset(w, 0, sizeof(struct rate_window));
+}
+
+/* *************************************** */
+
+/* Drop the seconds that fell out of the window and make 'now' the newest slot */
+void window_advance(struct rate_window *w, u_int32_t now) {
+  u_int32_t elapsed = now - w->epoch;
+
+  if((int32_t)elapsed <= 0)
+    return; /* same second, or a late packet: accounted in the newest slot */
+
+  if(elapsed >= WINDOW_SLOTS) {
+    memset(&w->total, 0, sizeof(w->total));
+    memset(w->slot, 0, sizeof(w->slot));
+  } else {
+    while(w->epoch != now) {
+      struct window_slot *s = &w->slot[++w->epoch % WINDOW_SLOTS];
+
+      w->total.pkts -= s->pkts, w->total.syns -= s->syns, w->total.bytes -= s->bytes;
+      memset(s, 0, sizeof(struct window_slot));
+    }
+  }
+
+  w->epoch = now;
+}
+
+/* *************************************** */
+
+void window_add(struct rate_window *w, u_int32_t now, u_int32_t len, u_int8_t syn) {
+  struct window_slot *s;
+
+  if(w->epoch != now) window_advance(w, now);
+
+  s = &w->slot[w->epoch % WINDOW_SLOTS];
+  s->pkts++, s->bytes += len, s->syns += syn;
+  w->total.pkts++, w->total.bytes += len, w->total.syns += syn;
+}
+
+/* *************************************** */
+
+const struct window_slot* window_last_second(const struct rate_window *w, u_int32_t now) {
+  u_int32_t age = now - w->epoch;
+
+  if((int32_t)age <= 0)
+    return(&w->slot[(now - 1) % WINDOW_SLOTS]); /* 'now' is still being filled */
+
+  if(age == 1)
+    return(&w->slot[w->epoch % WINDOW_SLOTS]);
+
+  return(NULL); /* nothing seen during the last second */
+}
@@ -0,0 +1,43 @@
+/*
+ *
+ * Sliding window rate counters for pfcount_multichannel.
+ *
+ * A ring of WINDOW_SLOTS one second buckets plus running totals over the
+ * whole ring. The ring is rotated lazily, when a packet (or a query on a
+ * private copy) comes with a newer second: there is no periodic pass and
+ * both updates and window totals cost O(1) (amortized over the elapsed
+ * seconds, at most WINDOW_SLOTS bucket resets).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ */
+
+#ifndef _WINDOW_H_
+#define _WINDOW_H_
+
+#include <sys/types.h>
+
+#define WINDOW_SLOTS  60 /* sec */
+
+struct window_slot {
+  u_int32_t pkts, syns;
+  u_int64_t bytes;
+};
+
+struct rate_window {
+  u_int32_t epoch;              /* second of slot[epoch % WINDOW_SLOTS] */
+  struct window_slot total;     /* sum of the WINDOW_SLOTS slots */
+  struct window_slot slot[WINDOW_SLOTS];
+};
+
+void window_reset(struct rate_window *w);
+void window_advance(struct rate_window *w, u_int32_t now);
+void window_add(struct rate_window *w, u_int32_t now, u_int32_t len, u_int8_t syn);
+
+/* Last complete second before 'now', NULL if nothing was seen then */
+const struct window_slot* window_last_second(const struct rate_window *w, u_int32_t now);
+
+#endif /* _WINDOW_H_ */
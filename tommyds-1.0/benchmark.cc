@@ -49,6 +49,8 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #endif
 
 #if defined(__MACH__)
@@ -79,6 +81,9 @@
 #include "tommy.h"
 #include "tommy.c"
 
+/* pfcount_multichannel flow table, the open addressing backend */
+#include "../pfcount_multichannel/flow_table.c"
+
 /* Google C dense hash table */
 /* http://code.google.com/p/google-sparsehash/ in the experimental/ directory */
 /* Disabled by default because it's superseeded by the C++ version. */
@@ -151,6 +156,12 @@ struct hashtable_object {
 	char payload[PAYLOAD];
 };
 
+struct hashidx_object {
+	tommy_hashidx_node node;
+	unsigned value;
+	char payload[PAYLOAD];
+};
+
 struct uthash_object {
 	UT_hash_handle hh;
 	unsigned value;
@@ -207,6 +218,9 @@ struct khash_object* KHASH;
 struct google_object* GOOGLE;
 struct uthash_object* UTHASH;
 struct nedtrie_object* NEDTRIE;
+struct hashtable_object* FLOWTABLE;
+struct hashtable_object* HASHOPEN;
+struct hashtable_object* HASHCONC;
 #ifdef USE_JUDY
 struct judy_object* JUDY;
 #endif
@@ -240,6 +254,20 @@ int tommy_hashtable_compare(const void* void_arg, const void* void_obj)
 	return 1;
 }
 
+int tommy_hashidx_compare(const void* void_arg, const void* void_obj)
+{
+	const unsigned* arg = (const unsigned*)void_arg;
+	const struct hashidx_object* obj = (const struct hashidx_object*)void_obj;
+
+	if (*arg == obj->value)
+		return 0;
+
+	return 1;
+}
+
+/* the object of the position i is at the slab index i + 1, as the index 0 is null */
+#define HASHIDX(index) ((struct hashidx_object*)tommy_slab_ref(&hashidx_slab, index))
+
 typedef rbt(struct rbt_object) rbtree_t;
 
 rb_gen(static, rbt_, rbtree_t, struct rbt_object, link, rbt_compare)
@@ -259,12 +287,17 @@ rbtree_t tree;
 tommy_hashtable hashtable;
 tommy_hashdyn hashdyn;
 tommy_hashlin hashlin;
+tommy_hashopen hashopen;
+tommy_hashconc hashconc;
+tommy_slab hashidx_slab;
+tommy_hashidx hashidx;
 tommy_allocator trie_allocator;
 tommy_trie trie;
 tommy_trie_inplace trie_inplace;
 struct uthash_object* uthash = 0;
 struct nedtrie_t nedtrie;
 khash_t(word)* khash;
+struct flow_table flowtable;
 #ifdef USE_CGOOGLE
 struct HashTable* cgoogle;
 #endif
@@ -348,6 +381,250 @@ static tommy_uint64_t nano(void)
 	return ret;
 }
 
+/******************************************************************************/
+/* hardware counters */
+
+/**
+ * Counters read around each measure with the -p option (Linux perf events
+ * of the process, user space only). A counter the machine does not have
+ * is reported as "n/a". Values are scaled when the kernel multiplexes them.
+ */
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+#define PERF_LLC_MISSES 2
+#define PERF_DTLB_MISSES 3
+#define PERF_BRANCH_MISSES 4
+#define PERF_MAX 5
+
+const char* PERF_NAME[PERF_MAX] = {
+	"cycles",
+	"instructions",
+	"llc",
+	"dtlb",
+	"branch",
+};
+
+int PERF_FD[PERF_MAX];
+tommy_uint64_t PERF_START[PERF_MAX];
+
+static void perf_init(void)
+{
+	unsigned i;
+
+	for(i=0;i<PERF_MAX;++i) {
+#if defined(__linux)
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		switch (i) {
+		case PERF_CYCLES :
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case PERF_INSTRUCTIONS :
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case PERF_LLC_MISSES :
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+		case PERF_DTLB_MISSES :
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+		case PERF_BRANCH_MISSES :
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+			break;
+		}
+
+		PERF_FD[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+		PERF_FD[i] = -1;
+#endif
+	}
+}
+
+static tommy_uint64_t perf_read(unsigned i)
+{
+	tommy_uint64_t v[3]; /* value, time enabled, time running */
+
+	if (PERF_FD[i] < 0)
+		return 0;
+
+#if defined(__linux)
+	if (read(PERF_FD[i], v, sizeof(v)) != sizeof(v))
+		return 0;
+#else
+	return 0;
+#endif
+
+	if (v[2] != 0 && v[2] < v[1])
+		return (tommy_uint64_t)((double)v[0] * v[1] / v[2]);
+
+	return v[0];
+}
+
+static void perf_start(void)
+{
+	unsigned i;
+
+	for(i=0;i<PERF_MAX;++i)
+		PERF_START[i] = perf_read(i);
+}
+
+/**
+ * Prints the IPC and the misses per element of the measure.
+ */
+static void perf_stop(unsigned count)
+{
+	tommy_uint64_t d[PERF_MAX];
+	unsigned i;
+
+	for(i=0;i<PERF_MAX;++i)
+		d[i] = perf_read(i) - PERF_START[i];
+
+	if (PERF_FD[PERF_CYCLES] >= 0 && PERF_FD[PERF_INSTRUCTIONS] >= 0 && d[PERF_CYCLES] != 0)
+		printf(" [ipc %.2f]", (double)d[PERF_INSTRUCTIONS] / d[PERF_CYCLES]);
+	else
+		printf(" [ipc n/a]");
+
+	for(i=PERF_LLC_MISSES;i<PERF_MAX;++i) {
+		if (PERF_FD[i] >= 0)
+			printf(" [%s %.3f]", PERF_NAME[i], (double)d[i] / count);
+		else
+			printf(" [%s n/a]", PERF_NAME[i]);
+	}
+}
+
+/******************************************************************************/
+/* tail latency */
+
+/**
+ * Latency of each single operation (-t).
+ * Recorded in a log-linear histogram as HdrHistogram does: exact up to
+ * 2^TAIL_SUB_BITS nanoseconds, then TAIL_SUB sub-buckets for each power of 2,
+ * that is a relative error below 1/TAIL_SUB.
+ * Each measure is the difference of two consecutive reads of the clock, so it
+ * includes the loop and the histogram update, a few nanoseconds, but not the
+ * read of the clock itself, measured once and subtracted.
+ */
+#define TAIL_SUB_BITS 4
+#define TAIL_SUB (1 << TAIL_SUB_BITS)
+#define TAIL_BUCKET_MAX ((32 - TAIL_SUB_BITS + 1) * TAIL_SUB)
+
+#define TAIL_P50 0
+#define TAIL_P99 1
+#define TAIL_P999 2
+#define TAIL_MAXIMUM 3
+#define TAIL_MAX 4
+
+const char* TAIL_NAME[TAIL_MAX] = {
+	"p50",
+	"p99",
+	"p999",
+	"max",
+};
+
+tommy_uint64_t TAIL_BUCKET[TAIL_BUCKET_MAX];
+tommy_uint64_t tail_count;
+tommy_uint64_t tail_max;
+tommy_uint64_t tail_last; /**< Time of the last sample. */
+tommy_uint64_t tail_overhead; /**< Time of a read of the clock. */
+
+static void tail_init(void)
+{
+	unsigned i;
+
+	tail_overhead = (tommy_uint64_t)-1;
+	for(i=0;i<1000;++i) {
+		tommy_uint64_t t = nano();
+		t = nano() - t;
+		if (t < tail_overhead)
+			tail_overhead = t;
+	}
+}
+
+static void tail_start(void)
+{
+	memset(TAIL_BUCKET, 0, sizeof(TAIL_BUCKET));
+	tail_count = 0;
+	tail_max = 0;
+	tail_last = nano();
+}
+
+static void tail_record(tommy_uint64_t v)
+{
+	unsigned bucket;
+
+	if (v >= 0xFFFFFFFF)
+		v = 0xFFFFFFFF;
+
+	if (v < 2 * TAIL_SUB) {
+		bucket = (unsigned)v;
+	} else {
+		unsigned shift = tommy_ilog2_u32((tommy_uint32_t)v) - TAIL_SUB_BITS;
+		bucket = (shift + 1) * TAIL_SUB + (unsigned)(v >> shift) - TAIL_SUB;
+	}
+
+	++TAIL_BUCKET[bucket];
+	++tail_count;
+	if (v > tail_max)
+		tail_max = v;
+}
+
+/**
+ * Records the time elapsed from the previous sample.
+ */
+static void tail_sample(void)
+{
+	tommy_uint64_t now = nano();
+	tommy_uint64_t v = now - tail_last;
+
+	tail_record(v > tail_overhead ? v - tail_overhead : 0);
+	tail_last = now;
+}
+
+/**
+ * Highest value in the bucket containing the given percentile.
+ */
+static unsigned tail_value(unsigned tail)
+{
+	tommy_uint64_t rank;
+	tommy_uint64_t sum = 0;
+	unsigned i;
+
+	switch (tail) {
+	case TAIL_P50 : rank = tail_count / 2; break;
+	case TAIL_P99 : rank = tail_count * 99 / 100; break;
+	case TAIL_P999 : rank = tail_count * 999 / 1000; break;
+	default : return (unsigned)tail_max;
+	}
+
+	for(i=0;i<TAIL_BUCKET_MAX;++i) {
+		sum += TAIL_BUCKET[i];
+		if (sum > rank)
+			break;
+	}
+
+	if (i < 2 * TAIL_SUB)
+		return i;
+	if (i >= TAIL_BUCKET_MAX)
+		return (unsigned)tail_max;
+
+	{
+		unsigned shift = i / TAIL_SUB - 1;
+		tommy_uint64_t v = (((tommy_uint64_t)(i % TAIL_SUB + TAIL_SUB + 1)) << shift) - 1;
+		return (unsigned)(v < tail_max ? v : tail_max);
+	}
+}
+
 /******************************************************************************/
 /* random */
 
@@ -444,7 +721,11 @@ const char* ORDER_NAME[ORDER_MAX] = {
 #define DATA_UTHASH 9
 #define DATA_NEDTRIE 10
 #define DATA_JUDY 11
-#define DATA_MAX 12
+#define DATA_FLOWTABLE 12
+#define DATA_HASHOPEN 13
+#define DATA_HASHCONC 14
+#define DATA_HASHIDX 15
+#define DATA_MAX 16
 
 const char* DATA_NAME[DATA_MAX] = {
 	"tommy-hashtable",
@@ -459,6 +740,10 @@ const char* DATA_NAME[DATA_MAX] = {
 	"uthash",
 	"nedtrie",
 	"judy",
+	"flowtable-open",
+	"tommy-hashopen",
+	"tommy-hashconc",
+	"tommy-hashidx",
 };
 
 /** 
@@ -466,6 +751,11 @@ const char* DATA_NAME[DATA_MAX] = {
  */
 unsigned LOG[RETRY_MAX][DATA_MAX][ORDER_MAX][OPERATION_MAX];
 
+/**
+ * Logged latency percentiles, with -t.
+ */
+unsigned TAIL_LOG[RETRY_MAX][DATA_MAX][ORDER_MAX][OPERATION_MAX][TAIL_MAX];
+
 /**
  * Time limit in nanosecond. 
  * We stop measuring degenerated cases after this limit.
@@ -493,6 +783,8 @@ unsigned the_start_data; /**< Saved data structure in the last START command, si
  * Control flow state.
  */
 tommy_bool_t the_log;
+tommy_bool_t the_perf; /**< Hardware counters around each measure (-p). */
+tommy_bool_t the_tail; /**< Latency of each operation (-t). */
 
 /** 
  * If the data structure should be in the graph, even if with no data.
@@ -524,7 +816,14 @@ tommy_bool_t start(unsigned data)
 	if (!the_log)
 		printf("%10s, %10s, %12s, ", ORDER_NAME[the_order], OPERATION_NAME[the_operation], DATA_NAME[data]);
 
+	if (the_perf)
+		perf_start();
+
 	the_time = nano();
+
+	if (the_tail)
+		tail_start();
+
 	return 1;
 }
 
@@ -535,11 +834,26 @@ void stop(void)
 	if (!is_select(the_start_data))
 		return;
 
+	/* the clock reads of the samples are not in the mean */
+	if (the_tail)
+		elapsed = elapsed > tail_overhead * the_max ? elapsed - tail_overhead * the_max : 0;
+
 	if (!the_log) {
-		printf("%4u [ns]\n", (unsigned)(elapsed / the_max));
+		printf("%4u [ns]", (unsigned)(elapsed / the_max));
+		if (the_tail)
+			printf(" [p50 %u] [p99 %u] [p999 %u] [max %u]", tail_value(TAIL_P50), tail_value(TAIL_P99), tail_value(TAIL_P999), tail_value(TAIL_MAXIMUM));
+		if (the_perf)
+			perf_stop(the_max);
+		printf("\n");
 	} 
 
 	LOG[the_retry][the_data][the_order][the_operation] = (unsigned)(elapsed / the_max);
+
+	if (the_tail) {
+		unsigned t;
+		for(t=0;t<TAIL_MAX;++t)
+			TAIL_LOG[the_retry][the_data][the_order][the_operation][t] = tail_value(t);
+	}
 }
 
 void mem(unsigned data, tommy_size_t v)
@@ -553,7 +867,7 @@ void mem(unsigned data, tommy_size_t v)
 }
 
 #define COND(s) if (is_select(s))
-#define START(s) if (start(s)) for(i=0;i<the_max;++i)
+#define START(s) if (start(s)) for(i=0;i<the_max;++i,the_tail ? tail_sample() : (void)0)
 #define STOP() stop()
 #define MEM(s, v) if (is_select(s)) mem(s, v)
 #define OPERATION(operation) the_operation = operation
@@ -567,6 +881,13 @@ FILE* open(const char* mode)
 	return fopen(buf, mode);
 }
 
+FILE* open_tail(unsigned tail, const char* mode)
+{
+	char buf[128];
+	sprintf(buf, "dat_%s_%s_%s.lst", ORDER_NAME[the_order], OPERATION_NAME[the_operation], TAIL_NAME[tail]);
+	return fopen(buf, mode);
+}
+
 /******************************************************************************/
 /* test */
 
@@ -645,6 +966,8 @@ void order_done(void)
 
 void test_alloc(void)
 {
+	unsigned i;
+
 	COND(DATA_TREE) {
 		rbt_new(&tree);
 		RBTREE = (struct rbt_object*)malloc(sizeof(struct rbt_object) * the_max);
@@ -665,6 +988,29 @@ void test_alloc(void)
 		HASHLIN = (struct hashtable_object*)malloc(sizeof(struct hashtable_object) * the_max);
 	}
 
+	COND(DATA_HASHOPEN) {
+		tommy_hashopen_init(&hashopen);
+		HASHOPEN = (struct hashtable_object*)malloc(sizeof(struct hashtable_object) * the_max);
+	}
+
+	COND(DATA_HASHCONC) {
+		tommy_hashconc_init(&hashconc);
+		HASHCONC = (struct hashtable_object*)malloc(sizeof(struct hashtable_object) * the_max);
+	}
+
+	COND(DATA_HASHIDX) {
+		tommy_slab_init(&hashidx_slab, sizeof(struct hashidx_object));
+		for(i=0;i<the_max;++i)
+			tommy_slab_alloc(&hashidx_slab);
+		tommy_hashidx_init(&hashidx, &hashidx_slab, offsetof(struct hashidx_object, node));
+	}
+
+	COND(DATA_FLOWTABLE) {
+		if (flow_table_init(&flowtable, flow_table_open, the_max) != 0)
+			abort();
+		FLOWTABLE = (struct hashtable_object*)malloc(sizeof(struct hashtable_object) * the_max);
+	}
+
 	COND(DATA_TRIE) {
 		tommy_allocator_init(&trie_allocator, TOMMY_TRIE_BLOCK_SIZE, TOMMY_TRIE_BLOCK_SIZE);
 		tommy_trie_init(&trie, &trie_allocator);
@@ -740,6 +1086,34 @@ void test_free(void)
 		free(HASHLIN);
 	}
 
+	COND(DATA_HASHOPEN) {
+		if (tommy_hashopen_count(&hashopen) != 0)
+			abort();
+		tommy_hashopen_done(&hashopen);
+		free(HASHOPEN);
+	}
+
+	COND(DATA_HASHCONC) {
+		if (tommy_hashconc_count(&hashconc) != 0)
+			abort();
+		tommy_hashconc_done(&hashconc);
+		free(HASHCONC);
+	}
+
+	COND(DATA_HASHIDX) {
+		if (tommy_hashidx_count(&hashidx) != 0)
+			abort();
+		tommy_hashidx_done(&hashidx);
+		tommy_slab_done(&hashidx_slab);
+	}
+
+	COND(DATA_FLOWTABLE) {
+		if (flow_table_count(&flowtable) != 0)
+			abort();
+		flow_table_done(&flowtable);
+		free(FLOWTABLE);
+	}
+
 	COND(DATA_TRIE) {
 		if (tommy_trie_count(&trie) != 0)
 			abort();
@@ -819,6 +1193,35 @@ void test_insert(unsigned* INSERT)
 		tommy_hashlin_insert(&hashlin, &HASHLIN[i].node, &HASHLIN[i], hash_key);
 	} STOP();
 
+	START(DATA_HASHOPEN) {
+		unsigned key = INSERT[i];
+		unsigned hash_key = hash(key);
+		HASHOPEN[i].value = key;
+		tommy_hashopen_insert(&hashopen, &HASHOPEN[i].node, &HASHOPEN[i], hash_key);
+	} STOP();
+
+	START(DATA_HASHCONC) {
+		unsigned key = INSERT[i];
+		unsigned hash_key = hash(key);
+		HASHCONC[i].value = key;
+		tommy_hashconc_insert(&hashconc, &HASHCONC[i].node, &HASHCONC[i], hash_key);
+	} STOP();
+
+	START(DATA_HASHIDX) {
+		unsigned key = INSERT[i];
+		unsigned hash_key = hash(key);
+		HASHIDX(i + 1)->value = key;
+		tommy_hashidx_insert(&hashidx, i + 1, hash_key);
+	} STOP();
+
+	START(DATA_FLOWTABLE) {
+		unsigned key = INSERT[i];
+		unsigned hash_key = hash(key);
+		FLOWTABLE[i].value = key;
+		if (flow_table_insert(&flowtable, &FLOWTABLE[i].node, &FLOWTABLE[i], hash_key) != 0)
+			abort();
+	} STOP();
+
 	START(DATA_TRIE) {
 		unsigned key = INSERT[i];
 		TRIE[i].value = key;
@@ -951,6 +1354,58 @@ void test_hit(unsigned* SEARCH)
 		}
 	} STOP();
 
+	START(DATA_HASHOPEN) {
+		unsigned key = SEARCH[i];
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashopen_search(&hashopen, tommy_hashtable_compare, &key, hash_key);
+		if (!obj)
+			abort();
+		if (dereference) {
+			if (obj->value != key)
+				abort();
+		}
+	} STOP();
+
+	START(DATA_HASHCONC) {
+		unsigned key = SEARCH[i];
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashconc_search(&hashconc, tommy_hashtable_compare, &key, hash_key);
+		if (!obj)
+			abort();
+		if (dereference) {
+			if (obj->value != key)
+				abort();
+		}
+	} STOP();
+
+	START(DATA_HASHIDX) {
+		unsigned key = SEARCH[i];
+		unsigned hash_key = hash(key);
+		tommy_uint32_t index;
+		index = tommy_hashidx_search(&hashidx, tommy_hashidx_compare, &key, hash_key);
+		if (!index)
+			abort();
+		if (dereference) {
+			if (HASHIDX(index)->value != key)
+				abort();
+		}
+	} STOP();
+
+	START(DATA_FLOWTABLE) {
+		unsigned key = SEARCH[i];
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)flow_table_search(&flowtable, tommy_hashtable_compare, &key, hash_key);
+		if (!obj)
+			abort();
+		if (dereference) {
+			if (obj->value != key)
+				abort();
+		}
+	} STOP();
+
 	START(DATA_TRIE) {
 		unsigned key = SEARCH[i];
 		struct trie_object* obj;
@@ -1098,6 +1553,40 @@ void test_miss(unsigned* SEARCH, unsigned DELTA)
 			abort();
 	} STOP();
 
+	START(DATA_HASHOPEN) {
+		unsigned key = SEARCH[i] + DELTA;
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashopen_search(&hashopen, tommy_hashtable_compare, &key, hash_key);
+		if (obj)
+			abort();
+	} STOP();
+
+	START(DATA_HASHCONC) {
+		unsigned key = SEARCH[i] + DELTA;
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashconc_search(&hashconc, tommy_hashtable_compare, &key, hash_key);
+		if (obj)
+			abort();
+	} STOP();
+
+	START(DATA_HASHIDX) {
+		unsigned key = SEARCH[i] + DELTA;
+		unsigned hash_key = hash(key);
+		if (tommy_hashidx_search(&hashidx, tommy_hashidx_compare, &key, hash_key))
+			abort();
+	} STOP();
+
+	START(DATA_FLOWTABLE) {
+		unsigned key = SEARCH[i] + DELTA;
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)flow_table_search(&flowtable, tommy_hashtable_compare, &key, hash_key);
+		if (obj)
+			abort();
+	} STOP();
+
 	START(DATA_TRIE) {
 		struct trie_object* obj;
 		obj = (struct trie_object*)tommy_trie_search(&trie, SEARCH[i] + DELTA);
@@ -1232,46 +1721,104 @@ void test_change(unsigned* REMOVE, unsigned* INSERT)
 		tommy_hashlin_insert(&hashlin, &obj->node, obj, hash_key);
 	} STOP();
 
-	START(DATA_TRIE) {
+	START(DATA_HASHOPEN) {
 		unsigned key = REMOVE[i];
-		struct trie_object* obj;
-		obj = (struct trie_object*)tommy_trie_remove(&trie, key);
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashopen_remove(&hashopen, tommy_hashtable_compare, &key, hash_key);
 		if (!obj)
 			abort();
 
 		key = INSERT[i] + DELTA;
+		hash_key = hash(key);
 		obj->value = key;
-		tommy_trie_insert(&trie, &obj->node, obj, key);
+		tommy_hashopen_insert(&hashopen, &obj->node, obj, hash_key);
 	} STOP();
 
-	START(DATA_TRIE_INPLACE) {
+	START(DATA_HASHCONC) {
 		unsigned key = REMOVE[i];
-		struct trie_inplace_object* obj;
-		obj = (struct trie_inplace_object*)tommy_trie_inplace_remove(&trie_inplace, key);
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashconc_remove(&hashconc, tommy_hashtable_compare, &key, hash_key);
 		if (!obj)
 			abort();
 
 		key = INSERT[i] + DELTA;
+		hash_key = hash(key);
 		obj->value = key;
-		tommy_trie_inplace_insert(&trie_inplace, &obj->node, obj, key);
+		tommy_hashconc_insert(&hashconc, &obj->node, obj, hash_key);
 	} STOP();
 
-	START(DATA_KHASH) {
+	START(DATA_HASHIDX) {
 		unsigned key = REMOVE[i];
 		unsigned hash_key = hash(key);
-		khiter_t k;
-		int r;
-		struct khash_object* obj;
-		k = kh_get(word, khash, hash_key);
-		if (k == kh_end(khash))
+		tommy_uint32_t index;
+		index = tommy_hashidx_remove(&hashidx, tommy_hashidx_compare, &key, hash_key);
+		if (!index)
 			abort();
-		obj = kh_value(khash, k);
-		kh_del(word, khash, k);
 
 		key = INSERT[i] + DELTA;
 		hash_key = hash(key);
-		obj->value = key;
-		k = kh_put(word, khash, hash_key, &r);
+		HASHIDX(index)->value = key;
+		tommy_hashidx_insert(&hashidx, index, hash_key);
+	} STOP();
+
+	START(DATA_FLOWTABLE) {
+		unsigned key = REMOVE[i];
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)flow_table_search(&flowtable, tommy_hashtable_compare, &key, hash_key);
+		if (!obj)
+			abort();
+		flow_table_remove_existing(&flowtable, &obj->node);
+
+		key = INSERT[i] + DELTA;
+		hash_key = hash(key);
+		obj->value = key;
+		if (flow_table_insert(&flowtable, &obj->node, obj, hash_key) != 0)
+			abort();
+	} STOP();
+
+	START(DATA_TRIE) {
+		unsigned key = REMOVE[i];
+		struct trie_object* obj;
+		obj = (struct trie_object*)tommy_trie_remove(&trie, key);
+		if (!obj)
+			abort();
+
+		key = INSERT[i] + DELTA;
+		obj->value = key;
+		tommy_trie_insert(&trie, &obj->node, obj, key);
+	} STOP();
+
+	START(DATA_TRIE_INPLACE) {
+		unsigned key = REMOVE[i];
+		struct trie_inplace_object* obj;
+		obj = (struct trie_inplace_object*)tommy_trie_inplace_remove(&trie_inplace, key);
+		if (!obj)
+			abort();
+
+		key = INSERT[i] + DELTA;
+		obj->value = key;
+		tommy_trie_inplace_insert(&trie_inplace, &obj->node, obj, key);
+	} STOP();
+
+	START(DATA_KHASH) {
+		unsigned key = REMOVE[i];
+		unsigned hash_key = hash(key);
+		khiter_t k;
+		int r;
+		struct khash_object* obj;
+		k = kh_get(word, khash, hash_key);
+		if (k == kh_end(khash))
+			abort();
+		obj = kh_value(khash, k);
+		kh_del(word, khash, k);
+
+		key = INSERT[i] + DELTA;
+		hash_key = hash(key);
+		obj->value = key;
+		k = kh_put(word, khash, hash_key, &r);
 		if (!r)
 			abort();
 		kh_value(khash, k) = obj;
@@ -1430,6 +1977,59 @@ void test_remove(unsigned* REMOVE)
 		}
 	} STOP();
 
+	START(DATA_HASHOPEN) {
+		unsigned key = REMOVE[i] + DELTA;
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashopen_remove(&hashopen, tommy_hashtable_compare, &key, hash_key);
+		if (!obj)
+			abort();
+		if (dereference) {
+			if (obj->value != key)
+				abort();
+		}
+	} STOP();
+
+	START(DATA_HASHCONC) {
+		unsigned key = REMOVE[i] + DELTA;
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashconc_remove(&hashconc, tommy_hashtable_compare, &key, hash_key);
+		if (!obj)
+			abort();
+		if (dereference) {
+			if (obj->value != key)
+				abort();
+		}
+	} STOP();
+
+	START(DATA_HASHIDX) {
+		unsigned key = REMOVE[i] + DELTA;
+		unsigned hash_key = hash(key);
+		tommy_uint32_t index;
+		index = tommy_hashidx_remove(&hashidx, tommy_hashidx_compare, &key, hash_key);
+		if (!index)
+			abort();
+		if (dereference) {
+			if (HASHIDX(index)->value != key)
+				abort();
+		}
+	} STOP();
+
+	START(DATA_FLOWTABLE) {
+		unsigned key = REMOVE[i] + DELTA;
+		unsigned hash_key = hash(key);
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)flow_table_search(&flowtable, tommy_hashtable_compare, &key, hash_key);
+		if (!obj)
+			abort();
+		flow_table_remove_existing(&flowtable, &obj->node);
+		if (dereference) {
+			if (obj->value != key)
+				abort();
+		}
+	} STOP();
+
 	START(DATA_TRIE) {
 		unsigned key = REMOVE[i] + DELTA;
 		struct trie_object* obj;
@@ -1610,6 +2210,13 @@ void test_size(void)
 	MEM(DATA_HASHTABLE, tommy_hashtable_memory_usage(&hashtable));
 	MEM(DATA_HASHDYN, tommy_hashdyn_memory_usage(&hashdyn));
 	MEM(DATA_HASHLIN, tommy_hashlin_memory_usage(&hashlin));
+	MEM(DATA_HASHOPEN, tommy_hashopen_memory_usage(&hashopen));
+	/* no search is running, the old tables can be freed */
+	if (is_select(DATA_HASHCONC))
+		tommy_hashconc_reclaim(&hashconc);
+	MEM(DATA_HASHCONC, tommy_hashconc_memory_usage(&hashconc));
+	MEM(DATA_HASHIDX, tommy_hashidx_memory_usage(&hashidx));
+	MEM(DATA_FLOWTABLE, flow_table_memory_usage(&flowtable));
 	MEM(DATA_TRIE, tommy_trie_memory_usage(&trie));
 	MEM(DATA_TRIE_INPLACE, tommy_trie_inplace_memory_usage(&trie_inplace));
 	MEM(DATA_KHASH, khash_size(khash));
@@ -1659,6 +2266,7 @@ void test(unsigned size, unsigned data, int log, int sparse)
 {
 	double b;
 	double f;
+	unsigned t;
 
 	b = 1000;
 	f = pow(10, 0.1);
@@ -1678,6 +2286,20 @@ void test(unsigned size, unsigned data, int log, int sparse)
 			}
 			fprintf(f, "\n");
 			fclose(f);
+
+			if (!the_tail || the_operation == OPERATION_SIZE)
+				continue;
+
+			for(t=0;t<TAIL_MAX;++t) {
+				f = open_tail(t, "wt");
+				fprintf(f, "0\t");
+				for(the_data=0;the_data<DATA_MAX;++the_data) {
+					if (is_listed(the_data))
+						fprintf(f, "%s\t", DATA_NAME[the_data]);
+				}
+				fprintf(f, "\n");
+				fclose(f);
+			}
 		}
 	}
 
@@ -1700,6 +2322,7 @@ void test(unsigned size, unsigned data, int log, int sparse)
 
 		/* clear the log */
 		memset(LOG, 0, sizeof(LOG));
+		memset(TAIL_LOG, 0, sizeof(TAIL_LOG));
 
 		order_init(the_max, sparse);
 
@@ -1769,6 +2392,34 @@ void test(unsigned size, unsigned data, int log, int sparse)
 
 				fprintf(f, "\n");
 				fclose(f);
+
+				if (!the_tail || the_operation == OPERATION_SIZE)
+					continue;
+
+				for(t=0;t<TAIL_MAX;++t) {
+					f = open_tail(t, "at");
+
+					fprintf(f, "%u\t", the_max);
+
+					for(the_data=0;the_data<DATA_MAX;++the_data) {
+						unsigned i, v;
+
+						if (!is_listed(the_data))
+							continue;
+
+						/* get the minimum, as for the mean */
+						v = TAIL_LOG[0][the_data][the_order][the_operation][t];
+						for(i=1;i<retry;++i) {
+							if (TAIL_LOG[i][the_data][the_order][the_operation][t] < v)
+								v = TAIL_LOG[i][the_data][the_order][the_operation][t];
+						}
+
+						fprintf(f, "%u\t", v);
+					}
+
+					fprintf(f, "\n");
+					fclose(f);
+				}
 			}
 		}
 
@@ -1811,6 +2462,781 @@ void test_cache_miss(void)
 	printf("Cache miss %d [ns]\n", (unsigned)miss_time);
 }
 
+/******************************************************************************/
+/* hash */
+
+/**
+ * Hash functions, -H.
+ *
+ * Each function hashes keys of 8, 16, 32 and 40 bytes, the sizes of the
+ * IPv4 and IPv6 address pairs with and without the rest of a flow key.
+ * The keys are dense, only the first word changes, as consecutive
+ * addresses. The time is of the hash only, of keys already in the cache. The quality is the chi-square of the low bits used as
+ * bucket index, divided by the number of buckets: about 1 for a random
+ * distribution.
+ */
+#define HASH_INTHASH 0
+#define HASH_U64 1
+#define HASH_FIXED 2
+#define HASH_CRC 3
+#define HASH_MAX 4
+
+const char* HASH_NAME[HASH_MAX] = {
+	"inthash-fold",
+	"hash-u64",
+	"hash-u64-fixed",
+	"hash-crc",
+};
+
+template<unsigned FUNC, unsigned LEN>
+tommy_uint64_t hash_key(const tommy_uint32_t* key)
+{
+	switch (FUNC) {
+	case HASH_INTHASH : {
+		/* 64 bits words xored and mixed, as the pfcount fold of IPv6 */
+		tommy_uint64_t fold = 0;
+		unsigned i;
+		for(i=0;i<LEN/4;i+=2)
+			fold ^= key[i] | (tommy_uint64_t)key[i + 1] << 32;
+		return tommy_inthash_u64(fold);
+		}
+	case HASH_U64 :
+		return tommy_hash_u64(0, key, LEN);
+	case HASH_FIXED :
+		return tommy_hash_u64_fixed(0, key, LEN);
+	default :
+		return tommy_hash_crc_u64(0, key, LEN);
+	}
+}
+
+/**
+ * Keys generated and hashed in batches, to time only the hash.
+ */
+#define HASH_BATCH 4096
+
+template<unsigned FUNC, unsigned LEN>
+void test_hash_func(unsigned size, unsigned* bucket, unsigned bucket_bit)
+{
+	static tommy_uint32_t key[HASH_BATCH][LEN/4];
+	unsigned bucket_max = 1U << bucket_bit;
+	tommy_uint64_t elapsed = 0;
+	tommy_uint64_t sum = 0;
+	double chi = 0;
+	unsigned i, j, k;
+
+	memset(bucket, 0, bucket_max * sizeof(unsigned));
+
+	for(i=0;i<size;i+=HASH_BATCH) {
+		unsigned count = size - i < HASH_BATCH ? size - i : HASH_BATCH;
+		tommy_uint64_t start;
+
+		for(j=0;j<count;++j) {
+			key[j][0] = 0x80000000 + 2 * (i + j);
+			for(k=1;k<LEN/4;++k)
+				key[j][k] = 0xC0A80001 + k;
+		}
+
+		start = nano();
+		for(j=0;j<count;++j)
+			sum += hash_key<FUNC, LEN>(key[j]);
+		elapsed += nano() - start;
+
+		for(j=0;j<count;++j)
+			++bucket[hash_key<FUNC, LEN>(key[j]) & (bucket_max - 1)];
+	}
+
+	for(i=0;i<bucket_max;++i) {
+		double expected = (double)size / bucket_max;
+		chi += (bucket[i] - expected) * (bucket[i] - expected) / expected;
+	}
+
+	printf("%14s, %2u [byte], %5.2f [ns], chi-square/buckets %.3f%s\n", HASH_NAME[FUNC], LEN,
+		(double)elapsed / size, chi / bucket_max, sum == 0 ? " " : "");
+}
+
+template<unsigned LEN>
+void test_hash_len(unsigned size)
+{
+	unsigned bucket_bit = 1;
+	unsigned* bucket;
+
+	while ((1U << bucket_bit) < size)
+		++bucket_bit;
+	bucket = (unsigned*)malloc((1U << bucket_bit) * sizeof(unsigned));
+
+	test_hash_func<HASH_INTHASH, LEN>(size, bucket, bucket_bit);
+	test_hash_func<HASH_U64, LEN>(size, bucket, bucket_bit);
+	test_hash_func<HASH_FIXED, LEN>(size, bucket, bucket_bit);
+	test_hash_func<HASH_CRC, LEN>(size, bucket, bucket_bit);
+
+	free(bucket);
+}
+
+void test_hash(unsigned size)
+{
+	test_hash_len<8>(size);
+	test_hash_len<16>(size);
+	test_hash_len<32>(size);
+	test_hash_len<40>(size);
+}
+
+/******************************************************************************/
+/* flow workloads */
+
+/**
+ * Flow shaped workloads, -f zipf|spoof|victim or -F FILE.
+ *
+ * They follow the access pattern of the flow table of a DDoS detector: every
+ * packet searches its sIP/dIP pair, folded here in the 32 bit key used by all
+ * the containers, and inserts it when the flow is new. Flows idle for more
+ * than the aging period are removed. The whole sequence of operations is
+ * generated in advance, with the expected result of each search, and then
+ * replayed on each container timing every single operation.
+ *
+ * - zipf: packets from a population of flows with a Zipf popularity. The tail
+ *   flows expire between two packets and come back: heavy-tail churn.
+ * - spoof: zipf, with a burst of random never seen flows at the end of each
+ *   period of the population size, as a spoofed flood.
+ * - victim: the victim map of the detector, keyed by the IPv4 destination
+ *   itself and not by a hash: zipf over the addresses of a few customer /16,
+ *   with the spoof bursts spread over all their addresses, as a carpet
+ *   bombing. The keys share their prefixes, as the tries see them.
+ * - trace: pairs read from a file, the first two IPv4 addresses of each line,
+ *   as "sIP dIP" or as printed by tcpdump -nn.
+ *
+ * The population size (-N) is also the aging period, in packets.
+ * The tries get the 32 bit key in the high bits of tommy_key_t, the
+ * most significant ones being the first levels, as in a real address map.
+ */
+#define FLOW_ZIPF 0
+#define FLOW_SPOOF 1
+#define FLOW_VICTIM 2
+#define FLOW_TRACE 3
+#define FLOW_MAX 4
+
+const char* FLOW_NAME[FLOW_MAX] = {
+	"zipf",
+	"spoof",
+	"victim",
+	"trace",
+};
+
+#define FLOW_POPULATION 1000000 /**< Default population. */
+#define FLOW_PACKETS_PER_FLOW 4 /**< Packets generated for each flow of the population. */
+#define FLOW_ZIPF_S 1.0 /**< Zipf exponent. */
+#define FLOW_SPOOF_BURST 8 /**< Burst of population/FLOW_SPOOF_BURST spoofed packets. */
+#define FLOW_VICTIM_PREFIXES 64 /**< Customer /16 of the victim workload. */
+
+/**
+ * Operations of a flow sequence.
+ */
+#define FLOW_OP_HIT 0 /**< Search of a live flow. */
+#define FLOW_OP_INSERT 1 /**< Search of a new flow and insert. */
+#define FLOW_OP_REMOVE 2 /**< Search and remove of an expired flow. */
+
+struct flow_op {
+	unsigned key;
+	unsigned slot; /**< Object of the flow in the container arrays. */
+	unsigned op;
+};
+
+struct flow_op* FLOW_OP; /**< Generated sequence. */
+unsigned flow_count; /**< Operations in the sequence. */
+unsigned flow_timed; /**< Operations timed, the others empty the containers. */
+unsigned flow_slots; /**< Objects used. */
+unsigned flow_live_max; /**< Max number of live flows. */
+unsigned flow_live_op; /**< Operations done when the live flows reach the max. */
+
+/**
+ * Generator state.
+ * The live flows are in a hash table and in a list in order of last packet.
+ */
+struct flow_gen {
+	tommy_node node;
+	tommy_node lru;
+	unsigned key;
+	unsigned slot;
+	unsigned last;
+};
+
+tommy_hashdyn flow_gen_map;
+tommy_list flow_gen_lru;
+unsigned* flow_free;
+unsigned flow_free_count;
+unsigned flow_live;
+unsigned flow_tick;
+unsigned flow_age;
+
+int flow_gen_compare(const void* void_arg, const void* void_obj)
+{
+	const unsigned* arg = (const unsigned*)void_arg;
+	const struct flow_gen* obj = (const struct flow_gen*)void_obj;
+
+	return *arg != obj->key;
+}
+
+unsigned flow_key(unsigned src, unsigned dst)
+{
+	unsigned pair[2];
+	unsigned key;
+
+	pair[0] = src;
+	pair[1] = dst;
+	key = tommy_hash_u32(0, pair, sizeof(pair));
+
+	/* the empty and deleted keys of googledensehash */
+	if (key >= 0xfffffffe)
+		key -= 2;
+
+	return key;
+}
+
+unsigned flow_rnd32(void)
+{
+	return (rnd(0x10000) << 16) | rnd(0x10000);
+}
+
+void flow_emit(unsigned key, unsigned slot, unsigned op)
+{
+	FLOW_OP[flow_count].key = key;
+	FLOW_OP[flow_count].slot = slot;
+	FLOW_OP[flow_count].op = op;
+	++flow_count;
+}
+
+void flow_remove(struct flow_gen* gen)
+{
+	flow_emit(gen->key, gen->slot, FLOW_OP_REMOVE);
+	tommy_list_remove_existing(&flow_gen_lru, &gen->lru);
+	tommy_hashdyn_remove_existing(&flow_gen_map, &gen->node);
+	flow_free[flow_free_count++] = gen->slot;
+	--flow_live;
+	free(gen);
+}
+
+void flow_packet(unsigned key)
+{
+	unsigned hash_key = hash(key);
+	struct flow_gen* gen;
+	tommy_node* i;
+
+	gen = (struct flow_gen*)tommy_hashdyn_search(&flow_gen_map, flow_gen_compare, &key, hash_key);
+	if (gen) {
+		flow_emit(key, gen->slot, FLOW_OP_HIT);
+		tommy_list_remove_existing(&flow_gen_lru, &gen->lru);
+	} else {
+		gen = (struct flow_gen*)malloc(sizeof(struct flow_gen));
+		gen->key = key;
+		gen->slot = flow_free_count ? flow_free[--flow_free_count] : flow_slots++;
+		tommy_hashdyn_insert(&flow_gen_map, &gen->node, gen, hash_key);
+		flow_emit(key, gen->slot, FLOW_OP_INSERT);
+		if (++flow_live > flow_live_max) {
+			flow_live_max = flow_live;
+			flow_live_op = flow_count;
+		}
+	}
+
+	gen->last = flow_tick++;
+	tommy_list_insert_tail(&flow_gen_lru, &gen->lru, gen);
+
+	/* aging */
+	while ((i = tommy_list_head(&flow_gen_lru)) != 0) {
+		struct flow_gen* old = (struct flow_gen*)i->data;
+		if (flow_tick - old->last <= flow_age)
+			break;
+		flow_remove(old);
+	}
+}
+
+/**
+ * Random address in one of the customer prefixes.
+ * Unicast first octets only, never the empty and deleted keys of googledensehash.
+ */
+unsigned flow_victim(const unsigned* PREFIX)
+{
+	return PREFIX[rnd(FLOW_VICTIM_PREFIXES)] | rnd(0x10000);
+}
+
+/**
+ * Rank of a Zipf distribution, by inversion of its cumulative CDF.
+ */
+unsigned flow_zipf(const double* CDF, unsigned max)
+{
+	double u = rnd(0x7fffffff) * CDF[max - 1] / 0x7fffffff;
+	unsigned lo = 0;
+	unsigned hi = max - 1;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (CDF[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+void flow_generate(unsigned workload, unsigned population, const unsigned* TRACE, unsigned trace_count)
+{
+	unsigned packets;
+	unsigned* RANK = 0;
+	double* CDF = 0;
+	unsigned PREFIX[FLOW_VICTIM_PREFIXES];
+	unsigned i;
+
+	if (workload == FLOW_TRACE)
+		packets = trace_count;
+	else
+		packets = population * FLOW_PACKETS_PER_FLOW;
+
+	/* at most an insert and a remove for each packet */
+	FLOW_OP = (struct flow_op*)malloc(2 * (size_t)packets * sizeof(struct flow_op));
+	flow_free = (unsigned*)malloc(packets * sizeof(unsigned));
+	flow_count = 0;
+	flow_slots = 0;
+	flow_live = 0;
+	flow_live_max = 0;
+	flow_live_op = 0;
+	flow_free_count = 0;
+	flow_tick = 0;
+	flow_age = population;
+	tommy_hashdyn_init(&flow_gen_map);
+	tommy_list_init(&flow_gen_lru);
+
+	if (workload != FLOW_TRACE) {
+		double sum = 0;
+
+		for(i=0;i<FLOW_VICTIM_PREFIXES;++i)
+			PREFIX[i] = (1 + rnd(223)) << 24 | rnd(0x100) << 16;
+
+		RANK = (unsigned*)malloc(population * sizeof(unsigned));
+		CDF = (double*)malloc(population * sizeof(double));
+		for(i=0;i<population;++i) {
+			if (workload == FLOW_VICTIM)
+				RANK[i] = flow_victim(PREFIX);
+			else
+				RANK[i] = flow_key(flow_rnd32(), flow_rnd32());
+			sum += 1.0 / pow(i + 1, FLOW_ZIPF_S);
+			CDF[i] = sum;
+		}
+	}
+
+	for(i=0;i<packets;++i) {
+		if (workload == FLOW_TRACE)
+			flow_packet(TRACE[i]);
+		else if (workload == FLOW_SPOOF && i % population >= population - population / FLOW_SPOOF_BURST)
+			flow_packet(flow_key(flow_rnd32(), flow_rnd32()));
+		else if (workload == FLOW_VICTIM && i % population >= population - population / FLOW_SPOOF_BURST)
+			flow_packet(flow_victim(PREFIX));
+		else
+			flow_packet(RANK[flow_zipf(CDF, population)]);
+	}
+
+	flow_timed = flow_count;
+
+	/* empty the containers at the end */
+	while (!tommy_list_empty(&flow_gen_lru))
+		flow_remove((struct flow_gen*)tommy_list_head(&flow_gen_lru)->data);
+
+	tommy_hashdyn_done(&flow_gen_map);
+	free(flow_free);
+	free(RANK);
+	free(CDF);
+}
+
+/**
+ * Reads the pairs of a trace file.
+ */
+unsigned* flow_load(const char* path, unsigned* count)
+{
+	FILE* f;
+	char buf[512];
+	unsigned* TRACE = 0;
+	unsigned size = 0;
+
+	f = fopen(path, "rt");
+	if (!f) {
+		printf("Error opening %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	*count = 0;
+	while (fgets(buf, sizeof(buf), f)) {
+		unsigned addr[2];
+		unsigned n = 0;
+		char* token;
+
+		for(token=strtok(buf, " \t\r\n");token && n<2;token=strtok(0, " \t\r\n")) {
+			unsigned a, b, c, d;
+			if (sscanf(token, "%u.%u.%u.%u", &a, &b, &c, &d) == 4 && a < 256 && b < 256 && c < 256 && d < 256)
+				addr[n++] = (a << 24) | (b << 16) | (c << 8) | d;
+		}
+
+		if (n != 2)
+			continue;
+
+		if (*count == size) {
+			size = size ? 2 * size : 1024 * 1024;
+			TRACE = (unsigned*)realloc(TRACE, size * sizeof(unsigned));
+		}
+
+		TRACE[(*count)++] = flow_key(addr[0], addr[1]);
+	}
+
+	fclose(f);
+
+	if (*count == 0) {
+		printf("No flow in %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	return TRACE;
+}
+
+/**
+ * Fails if a search doesn't give the expected result.
+ */
+#define FLOW_CHECK(obj) \
+	if ((obj != 0) == (op->op == FLOW_OP_INSERT) || (obj != 0 && obj->value != op->key)) \
+		abort()
+
+void flow_step(const struct flow_op* op)
+{
+	unsigned key = op->key;
+	unsigned hash_key = hash(key);
+	tommy_key_t trie_key = (tommy_key_t)key << (TOMMY_KEY_BIT - 32);
+
+	switch (the_data) {
+	case DATA_TREE : {
+		struct rbt_object key_obj;
+		struct rbt_object* obj;
+		key_obj.value = key;
+		obj = rbt_search(&tree, &key_obj);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			RBTREE[op->slot].value = key;
+			rbt_insert(&tree, &RBTREE[op->slot]);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			rbt_remove(&tree, obj);
+		}
+		} break;
+	case DATA_HASHTABLE : {
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashtable_search(&hashtable, tommy_hashtable_compare, &key, hash_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			HASHTABLE[op->slot].value = key;
+			tommy_hashtable_insert(&hashtable, &HASHTABLE[op->slot].node, &HASHTABLE[op->slot], hash_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_hashtable_remove_existing(&hashtable, &obj->node);
+		}
+		} break;
+	case DATA_HASHDYN : {
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashdyn_search(&hashdyn, tommy_hashtable_compare, &key, hash_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			HASHDYN[op->slot].value = key;
+			tommy_hashdyn_insert(&hashdyn, &HASHDYN[op->slot].node, &HASHDYN[op->slot], hash_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_hashdyn_remove_existing(&hashdyn, &obj->node);
+		}
+		} break;
+	case DATA_HASHLIN : {
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashlin_search(&hashlin, tommy_hashtable_compare, &key, hash_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			HASHLIN[op->slot].value = key;
+			tommy_hashlin_insert(&hashlin, &HASHLIN[op->slot].node, &HASHLIN[op->slot], hash_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_hashlin_remove_existing(&hashlin, &obj->node);
+		}
+		} break;
+	case DATA_HASHOPEN : {
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashopen_search(&hashopen, tommy_hashtable_compare, &key, hash_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			HASHOPEN[op->slot].value = key;
+			tommy_hashopen_insert(&hashopen, &HASHOPEN[op->slot].node, &HASHOPEN[op->slot], hash_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_hashopen_remove_existing(&hashopen, &obj->node);
+		}
+		} break;
+	case DATA_HASHCONC : {
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)tommy_hashconc_search(&hashconc, tommy_hashtable_compare, &key, hash_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			HASHCONC[op->slot].value = key;
+			tommy_hashconc_insert(&hashconc, &HASHCONC[op->slot].node, &HASHCONC[op->slot], hash_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_hashconc_remove_existing(&hashconc, &obj->node);
+		}
+		} break;
+	case DATA_HASHIDX : {
+		tommy_uint32_t index;
+		struct hashidx_object* obj;
+		index = tommy_hashidx_search(&hashidx, tommy_hashidx_compare, &key, hash_key);
+		obj = index ? HASHIDX(index) : 0;
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			HASHIDX(op->slot + 1)->value = key;
+			tommy_hashidx_insert(&hashidx, op->slot + 1, hash_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_hashidx_remove_existing(&hashidx, index);
+		}
+		} break;
+	case DATA_FLOWTABLE : {
+		struct hashtable_object* obj;
+		obj = (struct hashtable_object*)flow_table_search(&flowtable, tommy_hashtable_compare, &key, hash_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			FLOWTABLE[op->slot].value = key;
+			if (flow_table_insert(&flowtable, &FLOWTABLE[op->slot].node, &FLOWTABLE[op->slot], hash_key) != 0)
+				abort();
+		} else if (op->op == FLOW_OP_REMOVE) {
+			flow_table_remove_existing(&flowtable, &obj->node);
+		}
+		} break;
+	case DATA_TRIE : {
+		struct trie_object* obj;
+		obj = (struct trie_object*)tommy_trie_search(&trie, trie_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			TRIE[op->slot].value = key;
+			tommy_trie_insert(&trie, &TRIE[op->slot].node, &TRIE[op->slot], trie_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_trie_remove_existing(&trie, &obj->node);
+		}
+		} break;
+	case DATA_TRIE_INPLACE : {
+		struct trie_inplace_object* obj;
+		obj = (struct trie_inplace_object*)tommy_trie_inplace_search(&trie_inplace, trie_key);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			TRIE_INPLACE[op->slot].value = key;
+			tommy_trie_inplace_insert(&trie_inplace, &TRIE_INPLACE[op->slot].node, &TRIE_INPLACE[op->slot], trie_key);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			tommy_trie_inplace_remove_existing(&trie_inplace, &obj->node);
+		}
+		} break;
+	case DATA_KHASH : {
+		struct khash_object* obj = 0;
+		khiter_t k;
+		int r;
+		k = kh_get(word, khash, hash_key);
+		if (k != kh_end(khash))
+			obj = kh_value(khash, k);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			KHASH[op->slot].value = key;
+			k = kh_put(word, khash, hash_key, &r);
+			if (!r)
+				abort();
+			kh_value(khash, k) = &KHASH[op->slot];
+		} else if (op->op == FLOW_OP_REMOVE) {
+			kh_del(word, khash, k);
+		}
+		} break;
+#ifdef USE_CGOOGLE
+	case DATA_CGOOGLE : {
+		struct google_object* obj = 0;
+		HTItem* ptr;
+		ptr = HashFind(cgoogle, key);
+		if (ptr)
+			obj = (struct google_object*)ptr->data;
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			GOOGLE[op->slot].value = key;
+			if (!HashInsert(cgoogle, key, (u_long)&GOOGLE[op->slot]))
+				abort();
+		} else if (op->op == FLOW_OP_REMOVE) {
+			HashDeleteLast(cgoogle);
+		}
+		} break;
+#endif
+#ifdef USE_CCGOOGLE
+	case DATA_CCGOOGLE : {
+		struct google_object* obj = 0;
+		ccgoogle_t::iterator ptr = ccgoogle->find(key);
+		if (ptr != ccgoogle->end())
+			obj = ptr->second;
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			GOOGLE[op->slot].value = key;
+			(*ccgoogle)[key] = &GOOGLE[op->slot];
+		} else if (op->op == FLOW_OP_REMOVE) {
+			ccgoogle->erase(ptr);
+			ccgoogle->resize(0);
+		}
+		} break;
+#endif
+	case DATA_UTHASH : {
+		struct uthash_object* obj;
+		HASH_FIND_INT(uthash, &key, obj);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			obj = &UTHASH[op->slot];
+			obj->value = key;
+			HASH_ADD_INT(uthash, value, obj);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			HASH_DEL(uthash, obj);
+		}
+		} break;
+	case DATA_NEDTRIE : {
+		struct nedtrie_object key_obj;
+		struct nedtrie_object* obj;
+		key_obj.value = key;
+		obj = NEDTRIE_FIND(nedtrie_t, &nedtrie, &key_obj);
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			NEDTRIE[op->slot].value = key;
+			NEDTRIE_INSERT(nedtrie_t, &nedtrie, &NEDTRIE[op->slot]);
+		} else if (op->op == FLOW_OP_REMOVE) {
+			NEDTRIE_REMOVE(nedtrie_t, &nedtrie, obj);
+		}
+		} break;
+#ifdef USE_JUDY
+	case DATA_JUDY : {
+		struct judy_object* obj = 0;
+		Pvoid_t PValue;
+		int r;
+		JLG(PValue, judy, key);
+		if (PValue)
+			obj = *(struct judy_object**)PValue;
+		FLOW_CHECK(obj);
+		if (op->op == FLOW_OP_INSERT) {
+			JUDY[op->slot].value = key;
+			JLI(PValue, judy, key);
+			*(struct judy_object**)PValue = &JUDY[op->slot];
+		} else if (op->op == FLOW_OP_REMOVE) {
+			JLD(r, judy, key);
+			if (r != 1)
+				abort();
+		}
+		} break;
+#endif
+	}
+}
+
+/**
+ * Memory used by the container in test, as in test_size().
+ */
+tommy_size_t flow_size(void)
+{
+#ifdef USE_JUDY
+	Word_t w;
+#endif
+
+	switch (the_data) {
+	case DATA_TREE : return rbt_size(&tree, flow_live_max);
+	case DATA_HASHTABLE : return tommy_hashtable_memory_usage(&hashtable);
+	case DATA_HASHDYN : return tommy_hashdyn_memory_usage(&hashdyn);
+	case DATA_HASHLIN : return tommy_hashlin_memory_usage(&hashlin);
+	case DATA_HASHOPEN : return tommy_hashopen_memory_usage(&hashopen);
+	case DATA_HASHCONC : tommy_hashconc_reclaim(&hashconc); return tommy_hashconc_memory_usage(&hashconc);
+	case DATA_HASHIDX : return tommy_hashidx_memory_usage(&hashidx);
+	case DATA_FLOWTABLE : return flow_table_memory_usage(&flowtable);
+	case DATA_TRIE : return tommy_trie_memory_usage(&trie);
+	case DATA_TRIE_INPLACE : return tommy_trie_inplace_memory_usage(&trie_inplace);
+	case DATA_KHASH : return khash_size(khash);
+#ifdef USE_CCGOOGLE
+	case DATA_CCGOOGLE : return ccgoogle_size(ccgoogle);
+#endif
+	case DATA_UTHASH : return uthash_size(uthash);
+	case DATA_NEDTRIE : return nedtrie_size(&nedtrie);
+#ifdef USE_JUDY
+	case DATA_JUDY :
+		JLMU(w, judy);
+		return w;
+#endif
+	}
+
+	return 0;
+}
+
+void test_flow(unsigned workload, unsigned size, unsigned data, const char* path)
+{
+	unsigned* TRACE = 0;
+	unsigned trace_count = 0;
+	unsigned i;
+
+	if (workload == FLOW_TRACE)
+		TRACE = flow_load(path, &trace_count);
+
+	flow_generate(workload, size ? size : FLOW_POPULATION, TRACE, trace_count);
+	free(TRACE);
+
+	printf("%s, %u operations, %u flows at most\n", FLOW_NAME[workload], flow_timed, flow_live_max);
+
+	tail_init();
+
+	for(the_data=0;the_data<DATA_MAX;++the_data) {
+		tommy_uint64_t total = 0;
+		tommy_size_t memory = 0;
+
+		if (data != DATA_MAX && data != the_data)
+			continue;
+
+#ifndef USE_CGOOGLE
+		if (the_data == DATA_CGOOGLE)
+			continue;
+#endif
+#ifndef USE_CCGOOGLE
+		if (the_data == DATA_CCGOOGLE)
+			continue;
+#endif
+#ifndef USE_JUDY
+		if (the_data == DATA_JUDY)
+			continue;
+#endif
+
+		the_max = flow_slots;
+		test_alloc();
+		cache_clear();
+
+		if (the_perf)
+			perf_start();
+
+		tail_start();
+
+		for(i=0;i<flow_count;++i) {
+			if (i < flow_timed) {
+				tommy_uint64_t t = nano();
+				flow_step(&FLOW_OP[i]);
+				t = nano() - t;
+				t = t > tail_overhead ? t - tail_overhead : 0;
+				tail_record(t);
+				total += t;
+			} else {
+				flow_step(&FLOW_OP[i]);
+			}
+
+			if (i + 1 == flow_live_op)
+				memory = flow_size();
+		}
+
+		test_free();
+
+		printf("%10s, %18s, %4u [ns], p50 %4u, p99 %5u, p999 %6u, max %8u, %4u [byte]",
+			FLOW_NAME[workload], DATA_NAME[the_data],
+			(unsigned)(total / flow_timed),
+			tail_value(TAIL_P50),
+			tail_value(TAIL_P99),
+			tail_value(TAIL_P999),
+			tail_value(TAIL_MAXIMUM),
+			(unsigned)(memory / flow_live_max));
+		if (the_perf)
+			perf_stop(flow_count);
+		printf("\n");
+	}
+
+	free(FLOW_OP);
+}
+
 int main(int argc, char * argv[])
 {
 	int i;
@@ -1818,7 +3244,10 @@ int main(int argc, char * argv[])
 	int flag_size = 0;
 	int flag_log = 0;
 	int flag_miss = 0;
+	int flag_hash = 0;
 	int flag_sparse = 0;
+	int flag_flow = FLOW_MAX;
+	const char* flag_trace = 0;
 
 	nano_init();
 
@@ -1831,6 +3260,38 @@ int main(int argc, char * argv[])
 			flag_sparse = 1;
 		} else if (strcmp(argv[i], "-m") == 0) {
 			flag_miss = 1;
+		} else if (strcmp(argv[i], "-H") == 0) {
+			flag_hash = 1;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			the_perf = 1;
+			perf_init();
+		} else if (strcmp(argv[i], "-f") == 0) {
+			int j;
+			if (i+1 >= argc) {
+				printf("Missing data in %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			for(j=0;j<FLOW_TRACE;++j) {
+				if (strcmp(argv[i+1], FLOW_NAME[j]) == 0) {
+					flag_flow = j;
+				}
+			}
+			if (flag_flow == FLOW_MAX) {
+				printf("Unknown workload %s\n", argv[i+1]);
+				exit(EXIT_FAILURE);
+			}
+			++i;
+		} else if (strcmp(argv[i], "-F") == 0) {
+			if (i+1 >= argc) {
+				printf("Missing data in %s\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+			flag_flow = FLOW_TRACE;
+			flag_trace = argv[i+1];
+			++i;
+		} else if (strcmp(argv[i], "-t") == 0) {
+			the_tail = 1;
+			tail_init();
 		} else if (strcmp(argv[i], "-n") == 0) {
 			flag_size = MAX;
 		} else if (strcmp(argv[i], "-N") == 0) {
@@ -1868,6 +3329,16 @@ int main(int argc, char * argv[])
 		return EXIT_SUCCESS;
 	}
 
+	if (flag_hash) {
+		test_hash(flag_size);
+		return EXIT_SUCCESS;
+	}
+
+	if (flag_flow != FLOW_MAX) {
+		test_flow(flag_flow, flag_size, flag_data, flag_trace);
+		return EXIT_SUCCESS;
+	}
+
 	test(flag_size, flag_data, flag_log, flag_sparse);
 
 	printf("OK\n");
@@ -0,0 +1,10 @@
+load "gr_common.gnu"
+
+set output bdir.tdir."img_random_insert_p99".bext
+set title "Random Insert, 99th percentile (-t)".tsub
+set ylabel "99th percentile of the time for element in nanosecond in logarithmic scale\nLower is better"
+set yrange [10:10000]
+data = bdir.tdir.'dat_random_insert_p99.lst'
+
+plot data using 1:2 title columnheader(2), \
+	for [i=3:17] '' using 1:i title columnheader(i)
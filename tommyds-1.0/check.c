@@ -327,6 +327,284 @@ void test_array(void)
 	tommy_array_done(&array);
 }
 
+void test_hash(void)
+{
+	tommy_uint32_t key[10];
+	tommy_uint64_t seed;
+	tommy_uint64_t hash;
+	unsigned i, j;
+
+	START("hash");
+	for(i=0;i<MAX;++i) {
+		seed = tommy_inthash_u64(i);
+		for(j=0;j<10;++j)
+			key[j] = tommy_inthash_u32(i * 10 + j);
+
+		/* the fixed length versions are the same hash */
+		if (tommy_hash_u64_8(seed, key) != tommy_hash_u64(seed, key, 8))
+			abort();
+		if (tommy_hash_u64_16(seed, key) != tommy_hash_u64(seed, key, 16))
+			abort();
+		if (tommy_hash_u64_32(seed, key) != tommy_hash_u64(seed, key, 32))
+			abort();
+		if (tommy_hash_u64_40(seed, key) != tommy_hash_u64(seed, key, 40))
+			abort();
+		if (tommy_hash_u64_fixed(seed, key, 12) != tommy_hash_u64(seed, key, 12))
+			abort();
+
+		/* the bytes after the length are ignored, and every byte of the key counts */
+		hash = tommy_hash_crc_u64(seed, key, 13);
+		((unsigned char*)key)[13] ^= 0xFF;
+		if (tommy_hash_crc_u64(seed, key, 13) != hash)
+			abort();
+		((unsigned char*)key)[12] ^= 0x01;
+		if (tommy_hash_crc_u64(seed, key, 13) == hash)
+			abort();
+	}
+	STOP();
+}
+
+void test_topk(void)
+{
+	tommy_topk topk;
+	tommy_topk half[2];
+	tommy_uint64_t last;
+	unsigned i, count, greater;
+
+	tommy_topk_init(&topk, 100);
+	tommy_topk_init(&half[0], 100);
+	tommy_topk_init(&half[1], 100);
+
+	START("topk insert");
+	for(i=0;i<MAX;++i) {
+		tommy_uint64_t score = tommy_inthash_u32(i) % 10000;
+		tommy_topk_insert(&topk, (void*)i, score);
+		tommy_topk_insert(&half[i & 1], (void*)i, score);
+	}
+	STOP();
+
+	START("topk merge");
+	tommy_topk_merge(&half[0], &half[1]);
+	STOP();
+
+	count = tommy_topk_sort(&topk);
+	if (count != 100 || tommy_topk_sort(&half[0]) != 100)
+		abort();
+
+	/* descending, with the same scores of the merge */
+	for(i=0;i<count;++i) {
+		if (i > 0 && tommy_topk_score(&topk, i) > tommy_topk_score(&topk, i - 1))
+			abort();
+		if (tommy_topk_score(&topk, i) != tommy_inthash_u32((tommy_uint32_t)(tommy_uintptr_t)tommy_topk_get(&topk, i)) % 10000)
+			abort();
+		if (tommy_topk_score(&half[0], i) != tommy_topk_score(&topk, i))
+			abort();
+	}
+
+	/* all the elements greater than the last kept are kept */
+	last = tommy_topk_score(&topk, count - 1);
+	greater = 0;
+	for(i=0;i<MAX;++i)
+		if (tommy_inthash_u32(i) % 10000 > last)
+			++greater;
+	for(i=0;i<count;++i)
+		if (tommy_topk_score(&topk, i) > last)
+			--greater;
+	if (greater != 0)
+		abort();
+
+	tommy_topk_done(&topk);
+	tommy_topk_done(&half[0]);
+	tommy_topk_done(&half[1]);
+}
+
+void test_clock(void)
+{
+	struct object* CLOCK;
+	tommy_clock clock;
+	unsigned i, count;
+
+	CLOCK = malloc(MAX * sizeof(struct object));
+
+	tommy_clock_init(&clock);
+
+	for(i=0;i<MAX;++i) {
+		CLOCK[i].value = i;
+		tommy_clock_insert(&clock, &CLOCK[i].node, &CLOCK[i]);
+	}
+
+	START("clock touch");
+	for(i=0;i<MAX;++i) {
+		if (i % 4 != 0)
+			tommy_clock_touch(&CLOCK[i].node);
+	}
+	STOP();
+
+	/* only the objects not touched are evicted, in insertion order */
+	START("clock sweep");
+	for(i=0;i<MAX;i+=4) {
+		struct object* obj = tommy_clock_sweep(&clock);
+		if ((unsigned)obj->value != i)
+			abort();
+		tommy_clock_remove_existing(&clock, &obj->node);
+	}
+	STOP();
+
+	/* the bits were cleared by the sweep, so the rest is evicted in order */
+	count = tommy_clock_count(&clock);
+	if (count != MAX - MAX / 4)
+		abort();
+	for(i=1;i<MAX;++i) {
+		struct object* obj;
+		if (i % 4 == 0)
+			continue;
+		obj = tommy_clock_sweep(&clock);
+		if ((unsigned)obj->value != i)
+			abort();
+		tommy_clock_remove_existing(&clock, &obj->node);
+	}
+
+	if (!tommy_clock_empty(&clock) || tommy_clock_sweep(&clock) != 0)
+		abort();
+
+	free(CLOCK);
+}
+
+void test_lpm(void)
+{
+	struct object* LPM;
+	tommy_lpm_node* NODE;
+	tommy_lpm lpm, lpm6;
+	tommy_lpm_node a8, a16, a20, a24, b64, b96;
+	int v8 = 8, v16 = 16, v20 = 20, v24 = 24, v64 = 64, v96 = 96;
+	unsigned char addr[16];
+	unsigned char net8[4] = { 10, 0, 0, 0 };
+	unsigned char net16[4] = { 10, 1, 0, 0 };
+	unsigned char net20[4] = { 10, 1, 2, 0 };
+	unsigned char net24[4] = { 10, 1, 2, 0 };
+	unsigned char net6[16] = { 0x20, 0x01, 0x0d, 0xb8, 0, 1, 0, 2, 0, 3, 0, 4, 0, 0, 0, 0 };
+	unsigned i;
+
+	tommy_lpm_init(&lpm, 32);
+
+	/* nested prefixes, inserted from the longest */
+	if (tommy_lpm_insert(&lpm, &a24, &v24, net24, 24) != 0
+		|| tommy_lpm_insert(&lpm, &a20, &v20, net20, 20) != 0
+		|| tommy_lpm_insert(&lpm, &a16, &v16, net16, 16) != 0
+		|| tommy_lpm_insert(&lpm, &a8, &v8, net8, 8) != 0)
+		abort();
+
+	/* the same prefix, whatever the bits after it */
+	net24[3] = 77;
+	if (tommy_lpm_insert(&lpm, &a24, &v24, net24, 24) == 0)
+		abort();
+	if (tommy_lpm_count(&lpm) != 4)
+		abort();
+
+	if (tommy_lpm_search_u32(&lpm, 0x0A010203) != &v24 /* 10.1.2.3 */
+		|| tommy_lpm_search_u32(&lpm, 0x0A010F01) != &v20 /* 10.1.15.1 */
+		|| tommy_lpm_search_u32(&lpm, 0x0A011001) != &v16 /* 10.1.16.1 */
+		|| tommy_lpm_search_u32(&lpm, 0x0AFF0001) != &v8 /* 10.255.0.1 */
+		|| tommy_lpm_search_u32(&lpm, 0x0B010203) != 0 /* 11.1.2.3 */
+		|| tommy_lpm_search_u32(&lpm, 0x09FFFFFF) != 0) /* 9.255.255.255 */
+		abort();
+
+	addr[0] = 10; addr[1] = 1; addr[2] = 2; addr[3] = 200;
+	if (tommy_lpm_search(&lpm, addr) != &v24 || tommy_lpm_search_exact(&lpm, addr, 24) != &v24)
+		abort();
+
+	/* the shorter prefix of the same level is restored, then the one of the level above */
+	if (tommy_lpm_remove_existing(&lpm, &a24) != &v24)
+		abort();
+	if (tommy_lpm_search_u32(&lpm, 0x0A010203) != &v20)
+		abort();
+	if (tommy_lpm_remove_existing(&lpm, &a20) != &v20)
+		abort();
+	if (tommy_lpm_search_u32(&lpm, 0x0A010203) != &v16 || tommy_lpm_search_u32(&lpm, 0x0A020203) != &v8)
+		abort();
+
+	/* the level below the root is freed with its last prefix */
+	if (lpm.table_count != 0)
+		abort();
+	tommy_lpm_remove_existing(&lpm, &a16);
+	tommy_lpm_remove_existing(&lpm, &a8);
+	if (tommy_lpm_count(&lpm) != 0 || tommy_lpm_search_u32(&lpm, 0x0A010203) != 0)
+		abort();
+
+	tommy_lpm_done(&lpm);
+
+	/* IPv6, below /64 */
+	tommy_lpm_init(&lpm6, 128);
+
+	if (tommy_lpm_insert(&lpm6, &b64, &v64, net6, 64) != 0
+		|| tommy_lpm_insert(&lpm6, &b96, &v96, net6, 96) != 0)
+		abort();
+	if (lpm6.table_count != 10)
+		abort();
+
+	memcpy(addr, net6, 16);
+	addr[15] = 1;
+	if (tommy_lpm_search(&lpm6, addr) != &v96)
+		abort();
+	addr[11] = 5; /* out of the /96 */
+	if (tommy_lpm_search(&lpm6, addr) != &v64)
+		abort();
+	addr[7] = 3; /* out of the /64 */
+	if (tommy_lpm_search(&lpm6, addr) != 0)
+		abort();
+
+	/* the /96 levels are freed, the ones of the /64 are kept */
+	tommy_lpm_remove_existing(&lpm6, &b96);
+	if (lpm6.table_count != 6)
+		abort();
+	addr[7] = 2;
+	if (tommy_lpm_search(&lpm6, addr) != &v64)
+		abort();
+
+	/* the levels still allocated are freed by tommy_lpm_done() */
+	tommy_lpm_done(&lpm6);
+
+	/* a /24 for each element */
+	LPM = malloc(MAX * sizeof(struct object));
+	NODE = malloc(MAX * sizeof(tommy_lpm_node));
+
+	tommy_lpm_init(&lpm, 32);
+
+	START("lpm insert");
+	for(i=0;i<MAX;++i) {
+		unsigned char net[4];
+
+		net[0] = i >> 16; net[1] = i >> 8; net[2] = i; net[3] = 0;
+		LPM[i].value = i;
+		if (tommy_lpm_insert(&lpm, &NODE[i], &LPM[i], net, 24) != 0)
+			abort();
+	}
+	STOP();
+
+	START("lpm search");
+	for(i=0;i<MAX;++i) {
+		struct object* obj = tommy_lpm_search_u32(&lpm, (i << 8) | (i & 0xFF));
+		if (!obj || (unsigned)obj->value != i)
+			abort();
+	}
+	STOP();
+
+	START("lpm remove");
+	for(i=0;i<MAX;++i) {
+		if (tommy_lpm_remove_existing(&lpm, &NODE[i]) != &LPM[i])
+			abort();
+	}
+	STOP();
+
+	if (tommy_lpm_count(&lpm) != 0 || lpm.table_count != 0)
+		abort();
+
+	tommy_lpm_done(&lpm);
+
+	free(LPM);
+	free(NODE);
+}
+
 int main() {
 	nano_init();
 
@@ -334,6 +612,10 @@ int main() {
 
 	test_list();
 	test_array();
+	test_hash();
+	test_topk();
+	test_clock();
+	test_lpm();
 
 	printf("OK\n");
 
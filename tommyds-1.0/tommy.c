@@ -34,4 +34,10 @@
 #include "tommyhashtbl.c"
 #include "tommyhashdyn.c"
 #include "tommyhashlin.c"
+#include "tommyhashopen.c"
+#include "tommyhashconc.c"
+#include "tommyslab.c"
+#include "tommyhashidx.c"
+#include "tommylpm.c"
+#include "tommytopk.c"
 
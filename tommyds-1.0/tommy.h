@@ -46,8 +46,20 @@
  * - ::tommy_hashlin - A linear chained hashtable. It doesn't have the
  * problem of the delay when resizing and it doesn't fragment
  * the heap.
+ * - ::tommy_hashopen - A dynamic open addressing hashtable. A search usually
+ * reads only the table and the object found.
+ * - ::tommy_hashconc - A concurrent open addressing hashtable, with searches
+ * that never lock, for objects shared by multiple threads.
+ * - ::tommy_hashidx and ::tommy_listidx - A compact chained hashtable and a
+ * compact list, linking objects of a ::tommy_slab with 32 bits indexes,
+ * with nodes of 8 bytes.
+ * - ::tommy_clock - A CLOCK approximation of a least recently used list, where
+ * marking an object as used is a single store in its node.
  * - ::tommy_trie - A trie optimized for cache utilization.
  * - ::tommy_trie_inplace - A trie completely inplace.
+ * - ::tommy_lpm - A longest prefix match trie for IPv4 and IPv6 addresses.
+ * - ::tommy_topk - A selection of the K elements with the greatest score,
+ * from any other container, in O(N*log(K)).
  *
  * The most interesting are ::tommy_hashlin, ::tommy_trie and ::tommy_trie_inplace.
  *
@@ -211,6 +223,9 @@
  *  - ::tommy_hashtable - Fixed size chained hashtable.
  *  - ::tommy_hashdyn - Dynamic chained hashtable.
  *  - ::tommy_hashlin - Linear chained hashtable.
+ *  - ::tommy_hashopen - Dynamic open addressing hashtable.
+ *  - ::tommy_hashconc - Concurrent open addressing hashtable.
+ *  - ::tommy_hashidx - Compact chained hashtable with 32 bits indexes.
  *  - ::tommy_trie - Trie optimized for cache usage.
  *  - ::tommy_trie_inplace - Trie completely inplace.
  *  - <a href="http://www.canonware.com/rb/">rbtree</a> - Red-black tree by Jason Evans.
@@ -553,6 +568,14 @@ extern "C" {
 #include "tommyhashtbl.h"
 #include "tommyhashdyn.h"
 #include "tommyhashlin.h"
+#include "tommyhashopen.h"
+#include "tommyhashconc.h"
+#include "tommyslab.h"
+#include "tommyhashidx.h"
+#include "tommylistidx.h"
+#include "tommyclock.h"
+#include "tommylpm.h"
+#include "tommytopk.h"
 
 #ifdef __cplusplus
 }
@@ -27,6 +27,15 @@
 
 #include "tommyalloc.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(MAP_ANONYMOUS)
+#define TOMMY_ALLOCATOR_MMAP 1
+#endif
+#endif
+
 /******************************************************************************/
 /* allocator */
 
@@ -37,12 +46,21 @@
  */
 #define TOMMY_ALLOCATOR_BLOCK_SIZE (4096-64)
 
-void tommy_allocator_init(tommy_allocator* alloc, unsigned block_size, unsigned align_size)
+/**
+ * Minimum number of blocks in a segment.
+ * Bigger blocks get bigger segments.
+ */
+#define TOMMY_ALLOCATOR_BLOCK_MIN 8
+
+void tommy_allocator_init_ex(tommy_allocator* alloc, unsigned block_size, unsigned align_size, unsigned flags, int node)
 {
 	/* setup the minimal alignment */
 	if (align_size < sizeof(void*))
 		align_size = sizeof(void*);
 
+	if ((flags & TOMMY_ALLOCATOR_CACHELINE) != 0 && align_size < TOMMY_CACHELINE_SIZE)
+		align_size = TOMMY_CACHELINE_SIZE;
+
 	/* ensure that the block_size keeps the alignment */
 	if (block_size % align_size != 0) {
 		block_size += align_size - block_size % align_size;
@@ -50,22 +68,143 @@ void tommy_allocator_init(tommy_allocator* alloc, unsigned block_size, unsigned
 
 	alloc->block_size = block_size;
 	alloc->align_size = align_size;
+	alloc->flags = flags;
+	alloc->node = node;
 
 	alloc->count = 0;
 	alloc->free_block = 0;
 	alloc->used_segment = 0;
 }
 
+void tommy_allocator_init(tommy_allocator* alloc, unsigned block_size, unsigned align_size)
+{
+	tommy_allocator_init_ex(alloc, block_size, align_size, 0, -1);
+}
+
+#if defined(TOMMY_ALLOCATOR_MMAP)
+/** \internal
+ * Maps a segment, with hugepages if requested and if available.
+ * \return The segment, or 0 on failure.
+ */
+static void* allocator_map(tommy_allocator* alloc, tommy_size_t size)
+{
+	void* ptr = MAP_FAILED;
+
+#if defined(MAP_HUGETLB)
+	if ((alloc->flags & TOMMY_ALLOCATOR_HUGEPAGE) != 0)
+		ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+	if (ptr == MAP_FAILED) {
+		ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return 0;
+
+#if defined(MADV_HUGEPAGE)
+		/* no hugepage reserved, ask for transparent ones */
+		if ((alloc->flags & TOMMY_ALLOCATOR_HUGEPAGE) != 0)
+			madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+	}
+
+#if defined(SYS_mbind)
+	/* before the first touch, the pages are not yet allocated */
+	if (alloc->node >= 0 && alloc->node < (int)(8 * sizeof(unsigned long))) {
+		unsigned long nodemask = 1UL << alloc->node;
+		/* MPOL_PREFERRED from <numaif.h>, not to depend on libnuma */
+		syscall(SYS_mbind, ptr, size, 1, &nodemask, 8 * sizeof(nodemask) + 1, 0);
+	}
+#endif
+
+	return ptr;
+}
+#endif
+
+/**
+ * Allocates a new segment, and puts it in the segment list.
+ */
+static tommy_allocator_segment* allocator_segment(tommy_allocator* alloc)
+{
+	tommy_allocator_segment* segment = 0;
+	tommy_size_t size;
+
+	/* enough for the header, the alignment and the minimum number of blocks */
+	size = sizeof(tommy_allocator_segment) + alloc->align_size + TOMMY_ALLOCATOR_BLOCK_MIN * (tommy_size_t)alloc->block_size;
+
+#if defined(TOMMY_ALLOCATOR_MMAP)
+	if ((alloc->flags & TOMMY_ALLOCATOR_HUGEPAGE) != 0 || alloc->node >= 0) {
+		tommy_size_t map_size = TOMMY_ALLOCATOR_HUGEPAGE_SIZE;
+
+		while (map_size < size)
+			map_size *= 2;
+
+		segment = tommy_cast(tommy_allocator_segment*, allocator_map(alloc, map_size));
+		if (segment) {
+			segment->size = map_size;
+			segment->mapped = 1;
+		}
+	}
+#endif
+
+	if (!segment) {
+		if (size < TOMMY_ALLOCATOR_BLOCK_SIZE)
+			size = TOMMY_ALLOCATOR_BLOCK_SIZE;
+
+		segment = tommy_cast(tommy_allocator_segment*, tommy_malloc(size));
+		segment->size = size;
+		segment->mapped = 0;
+	}
+
+	/* put in the segment list */
+	segment->next = alloc->used_segment;
+	alloc->used_segment = segment;
+
+	return segment;
+}
+
+/**
+ * Puts all the blocks of a segment in the free list.
+ */
+static void allocator_carve(tommy_allocator* alloc, tommy_allocator_segment* segment)
+{
+	tommy_uintptr_t off, mis;
+	tommy_size_t size = segment->size - sizeof(tommy_allocator_segment);
+	char* data = (char*)segment + sizeof(tommy_allocator_segment);
+
+	/* align if not aligned */
+	off = (tommy_uintptr_t)data;
+	mis = off % alloc->align_size;
+	if (mis != 0) {
+		data += alloc->align_size - mis;
+		size -= alloc->align_size - mis;
+	}
+
+	/* insert in free list */
+	while (size >= alloc->block_size) {
+		tommy_allocator_entry* free_block = (tommy_allocator_entry*)data;
+		free_block->next = alloc->free_block;
+		alloc->free_block = free_block;
+
+		data += alloc->block_size;
+		size -= alloc->block_size;
+	}
+}
+
 /**
  * Reset the allocator and free all.
  */ 
 static void allocator_reset(tommy_allocator* alloc)
 {
-	tommy_allocator_entry* block = alloc->used_segment;
-	while (block) {
-		tommy_allocator_entry* block_next = block->next;
-		tommy_free(block);
-		block = block_next;
+	tommy_allocator_segment* segment = alloc->used_segment;
+	while (segment) {
+		tommy_allocator_segment* segment_next = segment->next;
+#if defined(TOMMY_ALLOCATOR_MMAP)
+		if (segment->mapped)
+			munmap(segment, segment->size);
+		else
+#endif
+			tommy_free(segment);
+		segment = segment_next;
 	}
 
 	alloc->count = 0;
@@ -78,40 +217,25 @@ void tommy_allocator_done(tommy_allocator* alloc)
 	allocator_reset(alloc);
 }
 
+void tommy_allocator_reset(tommy_allocator* alloc)
+{
+	tommy_allocator_segment* segment;
+
+	/* the free list is rebuilt from the segments */
+	alloc->free_block = 0;
+	for(segment=alloc->used_segment;segment;segment=segment->next)
+		allocator_carve(alloc, segment);
+
+	alloc->count = 0;
+}
+
 void* tommy_allocator_alloc(tommy_allocator* alloc)
 {
 	void* ptr;
 
 	/* if no free block available */
-	if (!alloc->free_block) {
-		tommy_uintptr_t off, mis;
-		tommy_size_t size = TOMMY_ALLOCATOR_BLOCK_SIZE;
-		char* data = tommy_cast(char*, tommy_malloc(size));
-		tommy_allocator_entry* segment = (tommy_allocator_entry*)data;
-
-		/* put in the segment list */
-		segment->next = alloc->used_segment;
-		alloc->used_segment = segment;
-		data += sizeof(tommy_allocator_entry);
-
-		/* align if not aligned */
-		off = (tommy_uintptr_t)data;
-		mis = off % alloc->align_size;
-		if (mis != 0) {
-			data += alloc->align_size - mis;
-			size -= alloc->align_size - mis;
-		}
-
-		/* insert in free list */
-		while (size >= alloc->block_size) {
-			tommy_allocator_entry* free_block = (tommy_allocator_entry*)data;
-			free_block->next = alloc->free_block;
-			alloc->free_block = free_block;
-
-			data += alloc->block_size;
-			size -= alloc->block_size;
-		}
-	}
+	if (!alloc->free_block)
+		allocator_carve(alloc, allocator_segment(alloc));
 
 	/* remove one from the free list */
 	ptr = alloc->free_block;
@@ -121,7 +245,6 @@ void* tommy_allocator_alloc(tommy_allocator* alloc)
 
 	return ptr;
 }
-
 void tommy_allocator_free(tommy_allocator* alloc, void* ptr)
 {
 	tommy_allocator_entry* free_block = tommy_cast(tommy_allocator_entry*, ptr);
@@ -27,6 +27,14 @@
 
 /** \file
  * Allocator of fixed size blocks.
+ *
+ * The blocks are carved from segments allocated on demand, and put back
+ * in a free list by tommy_allocator_free().
+ * With tommy_allocator_init_ex() the blocks can be aligned at cache lines,
+ * the segments can be backed by hugepages and bound to a NUMA node, and
+ * all the blocks can be freed at once with tommy_allocator_reset(), keeping
+ * the segments for the next allocations. This fits tables rebuilt every
+ * interval, where freeing every object one by one is a waste.
  */
 
 #ifndef __TOMMYALLOC_H
@@ -37,7 +45,30 @@
 /******************************************************************************/
 /* allocator */
 
-/** \internal 
+/**
+ * Size of a cache line.
+ */
+#define TOMMY_CACHELINE_SIZE 64
+
+/**
+ * Flag to round the block size and the alignment to ::TOMMY_CACHELINE_SIZE.
+ * Every block starts in its cache line, and no cache line is shared by two blocks.
+ */
+#define TOMMY_ALLOCATOR_CACHELINE 1
+
+/**
+ * Flag to allocate segments of ::TOMMY_ALLOCATOR_HUGEPAGE_SIZE backed by hugepages.
+ * If no hugepage is available, regular pages are used, asking for transparent
+ * hugepages. It's supported only in Linux, otherwise it's ignored.
+ */
+#define TOMMY_ALLOCATOR_HUGEPAGE 2
+
+/**
+ * Size of the segments with ::TOMMY_ALLOCATOR_HUGEPAGE or a NUMA node.
+ */
+#define TOMMY_ALLOCATOR_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/** \internal
  * Allocator entry.
  */
 struct tommy_allocator_entry_struct {
@@ -45,15 +76,27 @@ struct tommy_allocator_entry_struct {
 };
 typedef struct tommy_allocator_entry_struct tommy_allocator_entry;
 
+/** \internal
+ * Allocator segment. It's at the start of each segment.
+ */
+struct tommy_allocator_segment_struct {
+	struct tommy_allocator_segment_struct* next; /**< Pointer at the next segment. 0 for last. */
+	tommy_size_t size; /**< Size of the segment, this header included. */
+	unsigned mapped; /**< If the segment is mapped, and not allocated with tommy_malloc(). */
+};
+typedef struct tommy_allocator_segment_struct tommy_allocator_segment;
+
 /**
  * Allocator of fixed size blocks.
  */
 typedef struct tommy_allocator_struct {
 	struct tommy_allocator_entry_struct* free_block; /**< List of free blocks. */
-	struct tommy_allocator_entry_struct* used_segment; /**< List of allocated segments. */
+	struct tommy_allocator_segment_struct* used_segment; /**< List of allocated segments. */
 	unsigned block_size; /**< Block size. */
 	unsigned align_size; /**< Alignment size. */
 	unsigned count; /**< Number of allocated elements. */
+	unsigned flags; /**< TOMMY_ALLOCATOR_* flags. */
+	int node; /**< NUMA node of the segments, or -1 for any. */
 } tommy_allocator;
 
 /**
@@ -64,6 +107,17 @@ typedef struct tommy_allocator_struct {
  */
 void tommy_allocator_init(tommy_allocator* alloc, unsigned block_size, unsigned align_size);
 
+/**
+ * Initializes the allocator with options.
+ * \param alloc Allocator to initialize.
+ * \param block_size Size of the block to allocate.
+ * \param align_size Minimum alignment requirement. No less than sizeof(void*).
+ * \param flags Combination of ::TOMMY_ALLOCATOR_CACHELINE and ::TOMMY_ALLOCATOR_HUGEPAGE, or 0.
+ * \param node NUMA node where to allocate the segments, or -1 for any.
+ * The binding is supported only in Linux, otherwise it's ignored.
+ */
+void tommy_allocator_init_ex(tommy_allocator* alloc, unsigned block_size, unsigned align_size, unsigned flags, int node);
+
 /**
  * Deinitialize the allocator.
  * It also releases all the allocated memory to the heap.
@@ -71,6 +125,13 @@ void tommy_allocator_init(tommy_allocator* alloc, unsigned block_size, unsigned
  */
 void tommy_allocator_done(tommy_allocator* alloc);
 
+/**
+ * Frees all the allocated blocks at once.
+ * The segments are kept, and they are used by the next allocations.
+ * \param alloc Allocator to reset.
+ */
+void tommy_allocator_reset(tommy_allocator* alloc);
+
 /**
  * Allocates a block.
  * \param alloc Allocator to use.
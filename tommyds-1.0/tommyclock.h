@@ -0,0 +1,220 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * CLOCK approximation of a least recently used list.
+ *
+ * This is a circular list of the objects, with a hand pointing at the next one
+ * to examine, and a reference bit in each node. Touching an object only sets its
+ * bit, without moving it and without writing any link pointer, so it can be done
+ * for every packet or request.
+ *
+ * To select the object to evict you have to call tommy_clock_sweep(). It moves the
+ * hand clearing the bits it finds set, and it stops at the first object not
+ * touched since the hand passed over it the last time. That object is
+ * approximately the least recently used.
+ *
+ * The node is the same ::tommy_node of ::tommy_list, with the tommy_node::key field
+ * used as reference bit. So, an object can be moved from a ::tommy_clock to a
+ * ::tommy_list, like a free list, with the same node.
+ *
+ * \code
+ * struct object {
+ *     tommy_node node;
+ *     // other fields
+ * };
+ *
+ * tommy_clock clock;
+ *
+ * tommy_clock_init(&clock);
+ *
+ * tommy_clock_insert(&clock, &obj->node, obj);
+ *
+ * tommy_clock_touch(&obj->node); // when the object is used
+ *
+ * struct object* old = tommy_clock_sweep(&clock); // when an object is needed
+ * tommy_clock_remove_existing(&clock, &old->node);
+ * \endcode
+ *
+ * Objects can also be aged stepping the hand with tommy_clock_hand() and tommy_clock_next(),
+ * a few at time, and removing the expired ones.
+ */
+
+#ifndef __TOMMYCLOCK_H
+#define __TOMMYCLOCK_H
+
+#include "tommytypes.h"
+
+/******************************************************************************/
+/* clock */
+
+/**
+ * CLOCK list.
+ */
+typedef struct tommy_clock_struct {
+	tommy_node* hand; /**< Next object to examine. 0 for empty. */
+	unsigned count; /**< Number of objects. */
+} tommy_clock;
+
+/**
+ * Initializes the list.
+ */
+tommy_inline void tommy_clock_init(tommy_clock* clock)
+{
+	clock->hand = 0;
+	clock->count = 0;
+}
+
+/**
+ * Inserts an object.
+ * The object is inserted just behind the hand, so it's the last one examined,
+ * and it starts not referenced.
+ */
+tommy_inline void tommy_clock_insert(tommy_clock* clock, tommy_node* node, void* data)
+{
+	tommy_node* hand = clock->hand;
+
+	node->data = data;
+	node->key = 0;
+
+	if (!hand) {
+		node->next = node;
+		node->prev = node;
+		clock->hand = node;
+	} else {
+		node->next = hand;
+		node->prev = hand->prev;
+		hand->prev->next = node;
+		hand->prev = node;
+	}
+
+	++clock->count;
+}
+
+/**
+ * Removes an object.
+ * If the object is under the hand, the hand moves to the next one.
+ * \return The tommy_node::data field of the node removed.
+ */
+tommy_inline void* tommy_clock_remove_existing(tommy_clock* clock, tommy_node* node)
+{
+	if (node->next == node) {
+		clock->hand = 0;
+	} else {
+		node->prev->next = node->next;
+		node->next->prev = node->prev;
+		if (clock->hand == node)
+			clock->hand = node->next;
+	}
+
+	--clock->count;
+
+	return node->data;
+}
+
+/**
+ * Marks an object as used.
+ * It's a single store in the node. The list is not changed.
+ */
+tommy_inline void tommy_clock_touch(tommy_node* node)
+{
+	node->key = 1;
+}
+
+/**
+ * Gets the object under the hand.
+ * \return The tommy_node::data field, or 0 if empty.
+ */
+tommy_inline void* tommy_clock_hand(tommy_clock* clock)
+{
+	if (!clock->hand)
+		return 0;
+
+	return clock->hand->data;
+}
+
+/**
+ * Moves the hand to the next object.
+ * The reference bit of the object left is cleared.
+ * \return 1 if the object left was referenced.
+ */
+tommy_inline tommy_bool_t tommy_clock_next(tommy_clock* clock)
+{
+	tommy_node* hand = clock->hand;
+	tommy_bool_t referenced;
+
+	if (!hand)
+		return 0;
+
+	referenced = hand->key != 0;
+	hand->key = 0;
+	clock->hand = hand->next;
+
+	return referenced;
+}
+
+/**
+ * Selects the object to evict.
+ * The hand moves, clearing the reference bits, until an object not referenced.
+ * It takes at most one round of the list. The object selected is not removed,
+ * and it's left under the hand.
+ * \return The tommy_node::data field, or 0 if empty.
+ */
+tommy_inline void* tommy_clock_sweep(tommy_clock* clock)
+{
+	tommy_node* hand = clock->hand;
+
+	if (!hand)
+		return 0;
+
+	while (hand->key) {
+		hand->key = 0;
+		hand = hand->next;
+	}
+
+	clock->hand = hand;
+
+	return hand->data;
+}
+
+/**
+ * Gets the number of objects.
+ */
+tommy_inline unsigned tommy_clock_count(tommy_clock* clock)
+{
+	return clock->count;
+}
+
+/**
+ * Checks if empty.
+ */
+tommy_inline tommy_bool_t tommy_clock_empty(tommy_clock* clock)
+{
+	return clock->hand == 0;
+}
+
+#endif
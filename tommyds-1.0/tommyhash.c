@@ -30,42 +30,6 @@
 /******************************************************************************/
 /* hash */
 
-tommy_inline tommy_uint32_t tommy_le_uint32_read(const void* ptr)
-{
-	/* allow unaligned read on Intel x86 and x86_64 platforms */
-#if defined(__i386__) || defined(_M_IX86) || defined(_X86_) || defined(__x86_64__) || defined(_M_X64)
-	/* defines from http://predef.sourceforge.net/ */
-	return *(tommy_uint32_t*)ptr;
-#else
-	const unsigned char* ptr8 = tommy_cast(const unsigned char*, ptr);
-	return ptr8[0] + ((tommy_uint32_t)ptr8[1] << 8) + ((tommy_uint32_t)ptr8[2] << 16) + ((tommy_uint32_t)ptr8[3] << 24);
-#endif
-}
-
-#define tommy_rot(x,k) \
-	(((x)<<(k)) | ((x)>>(32-(k))))
-
-#define tommy_mix(a,b,c) \
-	do { \
-		a -= c;  a ^= tommy_rot(c, 4);  c += b; \
-		b -= a;  b ^= tommy_rot(a, 6);  a += c; \
-		c -= b;  c ^= tommy_rot(b, 8);  b += a; \
-		a -= c;  a ^= tommy_rot(c,16);  c += b; \
-		b -= a;  b ^= tommy_rot(a,19);  a += c; \
-		c -= b;  c ^= tommy_rot(b, 4);  b += a; \
-	} while (0)
-
-#define tommy_final(a,b,c) \
-	do { \
-		c ^= b; c -= tommy_rot(b,14); \
-		a ^= c; a -= tommy_rot(c,11); \
-		b ^= a; b -= tommy_rot(a,25); \
-		c ^= b; c -= tommy_rot(b,16); \
-		a ^= c; a -= tommy_rot(c,4);  \
-		b ^= a; b -= tommy_rot(a,14); \
-		c ^= b; c -= tommy_rot(b,24); \
-	} while (0)
-
 tommy_uint32_t tommy_hash_u32(tommy_uint32_t init_val, const void* void_key, tommy_size_t key_len)
 {
 	const unsigned char* key = tommy_cast(const unsigned char*,void_key);
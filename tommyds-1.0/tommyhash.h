@@ -34,6 +34,10 @@
 
 #include "tommytypes.h"
 
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#include <nmmintrin.h> /* for _mm_crc32_u64 */
+#endif
+
 /******************************************************************************/
 /* hash */
 
@@ -42,6 +46,48 @@
  */
 typedef tommy_key_t tommy_hash_t;
 
+/** \internal
+ * Reads 32 bits in little endian format.
+ */
+tommy_always_inline tommy_uint32_t tommy_le_uint32_read(const void* ptr)
+{
+	/* allow unaligned read on Intel x86 and x86_64 platforms */
+#if defined(__i386__) || defined(_M_IX86) || defined(_X86_) || defined(__x86_64__) || defined(_M_X64)
+	/* defines from http://predef.sourceforge.net/ */
+	return *(tommy_uint32_t*)ptr;
+#else
+	const unsigned char* ptr8 = tommy_cast(const unsigned char*, ptr);
+	return ptr8[0] + ((tommy_uint32_t)ptr8[1] << 8) + ((tommy_uint32_t)ptr8[2] << 16) + ((tommy_uint32_t)ptr8[3] << 24);
+#endif
+}
+
+/** \internal
+ * Mixing macros of the Jenkins "lookup3" hash.
+ */
+#define tommy_rot(x,k) \
+	(((x)<<(k)) | ((x)>>(32-(k))))
+
+#define tommy_mix(a,b,c) \
+	do { \
+		a -= c;  a ^= tommy_rot(c, 4);  c += b; \
+		b -= a;  b ^= tommy_rot(a, 6);  a += c; \
+		c -= b;  c ^= tommy_rot(b, 8);  b += a; \
+		a -= c;  a ^= tommy_rot(c,16);  c += b; \
+		b -= a;  b ^= tommy_rot(a,19);  a += c; \
+		c -= b;  c ^= tommy_rot(b, 4);  b += a; \
+	} while (0)
+
+#define tommy_final(a,b,c) \
+	do { \
+		c ^= b; c -= tommy_rot(b,14); \
+		a ^= c; a -= tommy_rot(c,11); \
+		b ^= a; b -= tommy_rot(a,25); \
+		c ^= b; c -= tommy_rot(b,16); \
+		a ^= c; a -= tommy_rot(c,4);  \
+		b ^= a; b -= tommy_rot(a,14); \
+		c ^= b; c -= tommy_rot(b,24); \
+	} while (0)
+
 /**
  * Hash function.
  * Robert Jenkins "lookup3" hash,
@@ -64,6 +110,130 @@ tommy_uint32_t tommy_hash_u32(tommy_uint32_t init_val, const void* void_key, tom
  */
 tommy_uint64_t tommy_hash_u64(tommy_uint64_t init_val, const void* void_key, tommy_size_t key_len);
 
+/**
+ * Hash function for 64 bits of keys with a constant length.
+ * It's the same of tommy_hash_u64(), but with the length known at compile time
+ * all the loops are unrolled and the tail handling is removed.
+ * \param key_len Length of the key, it must be a multiple of 4.
+ */
+tommy_always_inline tommy_uint64_t tommy_hash_u64_fixed(tommy_uint64_t init_val, const void* void_key, tommy_size_t key_len)
+{
+	const unsigned char* key = tommy_cast(const unsigned char*,void_key);
+	tommy_uint32_t a, b, c;
+
+	a = b = c = 0xdeadbeef + ((tommy_uint32_t)key_len) + (init_val & 0xffffffff);
+	c += init_val >> 32;
+
+	while (key_len > 12) {
+		a += tommy_le_uint32_read(key + 0);
+		b += tommy_le_uint32_read(key + 4);
+		c += tommy_le_uint32_read(key + 8);
+
+		tommy_mix(a,b,c);
+
+		key_len -= 12;
+		key += 12;
+	}
+
+	if (key_len == 0)
+		return c + ((tommy_uint64_t)b << 32); /* used only when called with a zero length */
+
+	if (key_len == 12)
+		c += tommy_le_uint32_read(key + 8);
+	if (key_len >= 8)
+		b += tommy_le_uint32_read(key + 4);
+	a += tommy_le_uint32_read(key + 0);
+
+	tommy_final(a,b,c);
+
+	return c + ((tommy_uint64_t)b << 32);
+}
+
+/**
+ * Hash function for 64 bits of a key of 8 bytes, like a pair of IPv4 addresses.
+ * Same value of tommy_hash_u64().
+ */
+tommy_always_inline tommy_uint64_t tommy_hash_u64_8(tommy_uint64_t init_val, const void* void_key)
+{
+	return tommy_hash_u64_fixed(init_val, void_key, 8);
+}
+
+/**
+ * Hash function for 64 bits of a key of 16 bytes, like an IPv6 address.
+ * Same value of tommy_hash_u64().
+ */
+tommy_always_inline tommy_uint64_t tommy_hash_u64_16(tommy_uint64_t init_val, const void* void_key)
+{
+	return tommy_hash_u64_fixed(init_val, void_key, 16);
+}
+
+/**
+ * Hash function for 64 bits of a key of 32 bytes, like a pair of IPv6 addresses.
+ * Same value of tommy_hash_u64().
+ */
+tommy_always_inline tommy_uint64_t tommy_hash_u64_32(tommy_uint64_t init_val, const void* void_key)
+{
+	return tommy_hash_u64_fixed(init_val, void_key, 32);
+}
+
+/**
+ * Hash function for 64 bits of a key of 40 bytes, like a pair of IPv6 addresses and ports.
+ * Same value of tommy_hash_u64().
+ */
+tommy_always_inline tommy_uint64_t tommy_hash_u64_40(tommy_uint64_t init_val, const void* void_key)
+{
+	return tommy_hash_u64_fixed(init_val, void_key, 40);
+}
+
+/**
+ * Hash function for 64 bits using the CRC32C instruction of SSE 4.2.
+ * Two CRC32C of the 64 bits words of the key, one with the halves of the words
+ * swapped, are combined and mixed with the final step of the MurmurHash3 hash.
+ * With the length known at compile time it takes a few [ns] for any key up to
+ * 40 bytes.
+ * Without SSE 4.2 at compile time, or not in x86_64, it's tommy_hash_u64().
+ * \note
+ * The CRC is linear, so keys with the same hash can be
+ * computed whatever the init_val is. Don't use it for keys chosen by an attacker,
+ * like the addresses of the received packets.
+ */
+tommy_always_inline tommy_uint64_t tommy_hash_crc_u64(tommy_uint64_t init_val, const void* void_key, tommy_size_t key_len)
+{
+#if defined(__SSE4_2__) && defined(__x86_64__)
+	const unsigned char* key = tommy_cast(const unsigned char*,void_key);
+	tommy_uint64_t a = (init_val & 0xffffffff) ^ key_len;
+	tommy_uint64_t b = init_val >> 32;
+	tommy_uint64_t h;
+
+	while (key_len >= 8) {
+		tommy_uint64_t w = tommy_le_uint32_read(key) + ((tommy_uint64_t)tommy_le_uint32_read(key + 4) << 32);
+		a = _mm_crc32_u64(a, w);
+		b = _mm_crc32_u64(b, (w >> 32) | (w << 32));
+		key_len -= 8;
+		key += 8;
+	}
+
+	if (key_len) {
+		tommy_uint64_t w = 0;
+		while (key_len)
+			w = (w << 8) | key[--key_len];
+		a = _mm_crc32_u64(a, w);
+		b = _mm_crc32_u64(b, (w >> 32) | (w << 32));
+	}
+
+	h = (a << 32) | b;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+#else
+	return tommy_hash_u64(init_val, void_key, key_len);
+#endif
+}
+
 /**
  * Integer hash of 32 bits.
  * Robert Jenkins "4-byte Integer Hashing",
@@ -0,0 +1,439 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tommyhashconc.h"
+
+/******************************************************************************/
+/* atomic */
+
+#if defined(__GNUC__)
+#define tommy_atomic_load(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define tommy_atomic_store(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define tommy_atomic_cas(ptr, expected, value) __sync_bool_compare_and_swap(ptr, expected, value)
+#define tommy_atomic_add(ptr, value) __sync_add_and_fetch(ptr, value)
+#define tommy_atomic_lock(ptr) __sync_lock_test_and_set(ptr, 1)
+#define tommy_atomic_unlock(ptr) __sync_lock_release(ptr)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+/* volatile accesses have acquire and release semantics in Visual C */
+#define tommy_atomic_load(ptr) (*(ptr))
+#define tommy_atomic_store(ptr, value) (*(ptr) = (value))
+#define tommy_atomic_cas(ptr, expected, value) (_InterlockedCompareExchangePointer((void* volatile*)(ptr), (value), (expected)) == (void*)(expected))
+#define tommy_atomic_add(ptr, value) ((unsigned)_InterlockedExchangeAdd((volatile long*)(ptr), (value)) + (value))
+#define tommy_atomic_lock(ptr) _InterlockedExchange((volatile long*)(ptr), 1)
+#define tommy_atomic_unlock(ptr) _InterlockedExchange((volatile long*)(ptr), 0)
+#else
+#error "tommyhashconc needs atomic operations"
+#endif
+
+/******************************************************************************/
+/* hashconc */
+
+/** \internal
+ * Slot markers. Any other value is a pointer to a node.
+ */
+#define TOMMY_HASHCONC_EMPTY ((tommy_hashconc_node*)0) /**< Never used. It ends the probe. */
+#define TOMMY_HASHCONC_DELETED ((tommy_hashconc_node*)1) /**< Removed element. */
+#define TOMMY_HASHCONC_MOVED ((tommy_hashconc_node*)2) /**< Element moved by the resize to the next table. */
+#define TOMMY_HASHCONC_CLOSED ((tommy_hashconc_node*)3) /**< Empty slot seen by the resize. It ends the probe, but it doesn't accept inserts. */
+#define TOMMY_HASHCONC_BUSY ((tommy_hashconc_node*)4) /**< Taken by an insert, not yet stored. */
+#define tommy_hashconc_is_node(ptr) ((tommy_uintptr_t)(ptr) > 4)
+
+/** \internal
+ * Stripe of the hash.
+ */
+tommy_inline tommy_hashconc_stripe* tommy_hashconc_stripe_of(tommy_hashconc* hashconc, tommy_hash_t hash)
+{
+	return &hashconc->stripe[hash & (TOMMY_HASHCONC_STRIPE - 1)];
+}
+
+static void tommy_hashconc_lock(tommy_hashconc_stripe* stripe)
+{
+	while (tommy_atomic_lock(&stripe->lock)) {
+		/* wait reading, without writing the cache line */
+		while (tommy_atomic_load(&stripe->lock))
+			;
+	}
+}
+
+tommy_inline void tommy_hashconc_unlock(tommy_hashconc_stripe* stripe)
+{
+	tommy_atomic_unlock(&stripe->lock);
+}
+
+static tommy_hashconc_table* tommy_hashconc_alloc(unsigned bit)
+{
+	tommy_hashconc_table* table;
+	unsigned i;
+
+	table = tommy_cast(tommy_hashconc_table*, tommy_malloc(sizeof(tommy_hashconc_table)));
+	table->size = 1 << bit;
+	table->mask = table->size - 1;
+	table->limit = table->size / 2;
+	table->slot = tommy_cast(tommy_hashconc_slot*, tommy_malloc(table->size * sizeof(tommy_hashconc_slot)));
+	for(i=0;i<table->size;++i)
+		table->slot[i].ptr = TOMMY_HASHCONC_EMPTY;
+	table->used = 0;
+	table->move_pos = 0;
+	table->moved = 0;
+	table->next = 0;
+	table->retired = 0;
+
+	return table;
+}
+
+static void tommy_hashconc_free(tommy_hashconc_table* table)
+{
+	tommy_free(table->slot);
+	tommy_free(table);
+}
+
+void tommy_hashconc_init(tommy_hashconc* hashconc)
+{
+	unsigned i;
+
+	for(i=0;i<TOMMY_HASHCONC_STRIPE;++i) {
+		hashconc->stripe[i].lock = 0;
+		hashconc->stripe[i].count = 0;
+	}
+
+	hashconc->table = tommy_hashconc_alloc(TOMMY_HASHCONC_BIT);
+	hashconc->retired = 0;
+}
+
+void tommy_hashconc_done(tommy_hashconc* hashconc)
+{
+	tommy_hashconc_table* table = hashconc->table;
+
+	while (table) {
+		tommy_hashconc_table* next = table->next;
+		tommy_hashconc_free(table);
+		table = next;
+	}
+
+	tommy_hashconc_reclaim(hashconc);
+}
+
+void tommy_hashconc_reclaim(tommy_hashconc* hashconc)
+{
+	tommy_hashconc_table* table = hashconc->retired;
+
+	hashconc->retired = 0;
+
+	while (table) {
+		tommy_hashconc_table* retired = table->retired;
+		tommy_hashconc_free(table);
+		table = retired;
+	}
+}
+
+/** \internal
+ * Stores the node in the first empty slot of its probe sequence.
+ * The stripe of the hash must be locked.
+ * \return 0 on success, -1 if the table is being moved to a newer one.
+ */
+static int tommy_hashconc_place(tommy_hashconc_table* table, tommy_hashconc_node* node, tommy_hash_t hash)
+{
+	unsigned pos = hash & table->mask;
+
+	while (1) {
+		tommy_hashconc_slot* slot = &table->slot[pos];
+		tommy_hashconc_node* ptr = tommy_atomic_load(&slot->ptr);
+
+		if (ptr == TOMMY_HASHCONC_CLOSED)
+			return -1;
+
+		if (ptr == TOMMY_HASHCONC_EMPTY) {
+			/* other stripes may race for the same slot */
+			if (tommy_atomic_cas(&slot->ptr, TOMMY_HASHCONC_EMPTY, TOMMY_HASHCONC_BUSY)) {
+				slot->hash = hash;
+				tommy_atomic_store(&slot->ptr, node);
+				tommy_atomic_add(&table->used, 1);
+				return 0;
+			}
+			/* retry the same slot */
+			continue;
+		}
+
+		pos = (pos + 1) & table->mask;
+	}
+}
+
+/** \internal
+ * Moves a slot to the next table.
+ */
+static void tommy_hashconc_move(tommy_hashconc* hashconc, tommy_hashconc_table* table, unsigned pos)
+{
+	tommy_hashconc_slot* slot = &table->slot[pos];
+
+	while (1) {
+		tommy_hashconc_node* ptr = tommy_atomic_load(&slot->ptr);
+
+		if (ptr == TOMMY_HASHCONC_DELETED) {
+			/* no one writes it anymore */
+			return;
+		} else if (ptr == TOMMY_HASHCONC_EMPTY) {
+			/* an insert may take it first */
+			if (tommy_atomic_cas(&slot->ptr, TOMMY_HASHCONC_EMPTY, TOMMY_HASHCONC_CLOSED))
+				return;
+		} else if (tommy_hashconc_is_node(ptr)) {
+			/* serialize with the removes of the element */
+			tommy_hashconc_stripe* stripe = tommy_hashconc_stripe_of(hashconc, slot->hash);
+
+			tommy_hashconc_lock(stripe);
+			if (tommy_atomic_load(&slot->ptr) == ptr) {
+				/* stored in the next table before leaving this one, */
+				/* so a search always finds it in one of the two */
+				tommy_hashconc_place(tommy_atomic_load(&table->next), ptr, slot->hash);
+				tommy_atomic_store(&slot->ptr, TOMMY_HASHCONC_MOVED);
+				tommy_hashconc_unlock(stripe);
+				return;
+			}
+			tommy_hashconc_unlock(stripe);
+		}
+
+		/* busy, wait for the insert to complete */
+	}
+}
+
+/** \internal
+ * Moves a chunk of slots to the next table, if a resize is in progress.
+ * It must be called without any lock.
+ */
+static void tommy_hashconc_help(tommy_hashconc* hashconc)
+{
+	tommy_hashconc_table* table = tommy_atomic_load(&hashconc->table);
+	unsigned begin, end, pos;
+
+	if (!tommy_atomic_load(&table->next))
+		return;
+
+	end = tommy_atomic_add(&table->move_pos, TOMMY_HASHCONC_CHUNK);
+	begin = end - TOMMY_HASHCONC_CHUNK;
+	if (begin >= table->size)
+		return;
+	if (end > table->size)
+		end = table->size;
+
+	for(pos=begin;pos<end;++pos)
+		tommy_hashconc_move(hashconc, table, pos);
+
+	/* the last mover ends the resize */
+	if (tommy_atomic_add(&table->moved, end - begin) == table->size) {
+		tommy_hashconc_table* retired;
+
+		tommy_atomic_store(&hashconc->table, table->next);
+
+		/* searches may still read the old table */
+		do {
+			retired = tommy_atomic_load(&hashconc->retired);
+			table->retired = retired;
+		} while (!tommy_atomic_cas(&hashconc->retired, retired, table));
+	}
+}
+
+/** \internal
+ * Starts a resize, if not already started.
+ * It must be called without any lock.
+ */
+static void tommy_hashconc_grow(tommy_hashconc* hashconc, tommy_hashconc_table* table)
+{
+	tommy_hashconc_table* next;
+	unsigned count;
+	unsigned bit;
+
+	/* wait the end of the previous resize */
+	if (table != tommy_atomic_load(&hashconc->table) || tommy_atomic_load(&table->next))
+		return;
+
+	count = tommy_hashconc_count(hashconc);
+	bit = tommy_ctz_u32(table->size);
+	if (count >= table->size / 4) {
+		/* double at 1/2 of load factor, the new table has 1/4 of load */
+		++bit;
+	} else if (count < table->size / 16 && bit > TOMMY_HASHCONC_BIT) {
+		/* mostly removed slots, and few elements */
+		--bit;
+	} /* else only drop the removed slots */
+
+	next = tommy_hashconc_alloc(bit);
+
+	if (!tommy_atomic_cas(&table->next, 0, next))
+		tommy_hashconc_free(next);
+}
+
+/** \internal
+ * Gets the newest table.
+ */
+tommy_inline tommy_hashconc_table* tommy_hashconc_newest(tommy_hashconc* hashconc)
+{
+	tommy_hashconc_table* table = tommy_atomic_load(&hashconc->table);
+	tommy_hashconc_table* next;
+
+	while ((next = tommy_atomic_load(&table->next)) != 0)
+		table = next;
+
+	return table;
+}
+
+void tommy_hashconc_insert(tommy_hashconc* hashconc, tommy_hashconc_node* node, void* data, tommy_hash_t hash)
+{
+	tommy_hashconc_stripe* stripe = tommy_hashconc_stripe_of(hashconc, hash);
+	tommy_hashconc_table* table;
+
+	node->data = data;
+	node->key = hash;
+
+	tommy_hashconc_help(hashconc);
+
+	tommy_hashconc_lock(stripe);
+
+	/* if the table is being moved, insert in the newer one */
+	do {
+		table = tommy_hashconc_newest(hashconc);
+	} while (tommy_hashconc_place(table, node, hash) != 0);
+
+	tommy_atomic_store(&stripe->count, stripe->count + 1);
+
+	tommy_hashconc_unlock(stripe);
+
+	if (tommy_atomic_load(&table->used) >= table->limit)
+		tommy_hashconc_grow(hashconc, table);
+}
+
+/** \internal
+ * Searches the slot of an element in a table.
+ * If node is not 0, it searches the node, otherwise it uses the compare function.
+ */
+static tommy_hashconc_slot* tommy_hashconc_find(tommy_hashconc_table* table, tommy_hashconc_node* node, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	unsigned pos = hash & table->mask;
+	unsigned i;
+
+	for(i=0;i<table->size;++i) {
+		tommy_hashconc_slot* slot = &table->slot[pos];
+		tommy_hashconc_node* ptr = tommy_atomic_load(&slot->ptr);
+
+		/* an element is never inserted after an empty slot of its probe */
+		if (ptr == TOMMY_HASHCONC_EMPTY || ptr == TOMMY_HASHCONC_CLOSED)
+			return 0;
+
+		/* the hash is valid after reading the node */
+		if (tommy_hashconc_is_node(ptr) && slot->hash == hash) {
+			if (node ? ptr == node : cmp(cmp_arg, ptr->data) == 0)
+				return slot;
+		}
+
+		pos = (pos + 1) & table->mask;
+	}
+
+	return 0;
+}
+
+/** \internal
+ * Searches and removes an element.
+ */
+static void* tommy_hashconc_erase(tommy_hashconc* hashconc, tommy_hashconc_node* node, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	tommy_hashconc_stripe* stripe = tommy_hashconc_stripe_of(hashconc, hash);
+	tommy_hashconc_table* table;
+	void* data = 0;
+
+	tommy_hashconc_help(hashconc);
+
+	tommy_hashconc_lock(stripe);
+
+	/* the older table first, as the resize moves elements from it */
+	for(table=tommy_atomic_load(&hashconc->table);table;table=tommy_atomic_load(&table->next)) {
+		tommy_hashconc_slot* slot = tommy_hashconc_find(table, node, cmp, cmp_arg, hash);
+		if (slot) {
+			data = slot->ptr->data;
+			/* the slot stays used, to not break the probe of other elements */
+			tommy_atomic_store(&slot->ptr, TOMMY_HASHCONC_DELETED);
+			tommy_atomic_store(&stripe->count, stripe->count - 1);
+			break;
+		}
+	}
+
+	tommy_hashconc_unlock(stripe);
+
+	return data;
+}
+
+void* tommy_hashconc_remove(tommy_hashconc* hashconc, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	return tommy_hashconc_erase(hashconc, 0, cmp, cmp_arg, hash);
+}
+
+void* tommy_hashconc_remove_existing(tommy_hashconc* hashconc, tommy_hashconc_node* node)
+{
+	return tommy_hashconc_erase(hashconc, node, 0, 0, node->key);
+}
+
+void* tommy_hashconc_search(tommy_hashconc* hashconc, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	tommy_hashconc_table* table;
+
+	/* the older table first, as the resize stores an element in */
+	/* the newer table before removing it from the older one */
+	for(table=tommy_atomic_load(&hashconc->table);table;table=tommy_atomic_load(&table->next)) {
+		tommy_hashconc_slot* slot = tommy_hashconc_find(table, 0, cmp, cmp_arg, hash);
+		if (slot) {
+			tommy_hashconc_node* ptr = tommy_atomic_load(&slot->ptr);
+			/* removed after the compare, it's the same a search before the remove */
+			if (tommy_hashconc_is_node(ptr))
+				return ptr->data;
+		}
+	}
+
+	return 0;
+}
+
+unsigned tommy_hashconc_count(tommy_hashconc* hashconc)
+{
+	unsigned count = 0;
+	unsigned i;
+
+	for(i=0;i<TOMMY_HASHCONC_STRIPE;++i)
+		count += tommy_atomic_load(&hashconc->stripe[i].count);
+
+	return count;
+}
+
+tommy_size_t tommy_hashconc_memory_usage(tommy_hashconc* hashconc)
+{
+	tommy_size_t size = sizeof(tommy_hashconc_node) * tommy_hashconc_count(hashconc);
+	tommy_hashconc_table* table;
+
+	for(table=hashconc->table;table;table=table->next)
+		size += sizeof(tommy_hashconc_table) + table->size * sizeof(tommy_hashconc_slot);
+	for(table=hashconc->retired;table;table=table->retired)
+		size += sizeof(tommy_hashconc_table) + table->size * sizeof(tommy_hashconc_slot);
+
+	return size;
+}
+
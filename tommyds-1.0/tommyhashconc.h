@@ -0,0 +1,222 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * Concurrent open addressing hashtable.
+ *
+ * This hashtable can be used at the same time by multiple threads.
+ * Searches are lock free: they never write into the hashtable and never wait.
+ * Inserts and removes lock only one of ::TOMMY_HASHCONC_STRIPE stripes, selected
+ * by the hash of the element, so writers of different stripes run in parallel.
+ *
+ * The table stores the pointers to the nodes and the hashes, with linear probing.
+ * When half of the slots are used, counting the removed ones, a new table is
+ * allocated, twice larger, or of the same size if most of the slots are removed
+ * ones, or half large if the table is almost empty.
+ * The elements are then moved to the new table ::TOMMY_HASHCONC_CHUNK slots at
+ * time, by each insert and remove, so that no operation has to rehash the
+ * whole table. During the move the searches look in the old table and then in
+ * the new one. The node of an element is never changed by a move.
+ *
+ * The use is the same of ::tommy_hashdyn, with the only difference that
+ * there isn't a bucket function.
+ *
+ * \code
+ * tommy_hashconc hashconc;
+ *
+ * tommy_hashconc_init(&hashconc);
+ *
+ * // in any thread
+ * tommy_hashconc_insert(&hashconc, &obj->node, obj, tommy_inthash_u32(obj->value));
+ *
+ * struct object* obj = tommy_hashconc_search(&hashconc, compare, &value_to_find, tommy_inthash_u32(value_to_find));
+ *
+ * struct object* obj = tommy_hashconc_remove(&hashconc, compare, &value_to_remove, tommy_inthash_u32(value_to_remove));
+ *
+ * // when no other thread uses the hashtable
+ * tommy_hashconc_done(&hashconc);
+ * \endcode
+ *
+ * As the searches don't lock, a search running at the same time of a remove
+ * may still read the removed object, and the compare function may be called on it.
+ * You can free or reuse a removed object only when all the searches started before
+ * the remove are terminated, for example deferring it until all the threads have
+ * gone through a point where they don't use the hashtable.
+ * The same holds for the old tables replaced after a resize. They are kept until
+ * tommy_hashconc_reclaim() or tommy_hashconc_done() are called.
+ *
+ * It requires GCC compatible atomic builtins or the Visual C interlocked functions.
+ */
+
+#ifndef __TOMMYHASHCONC_H
+#define __TOMMYHASHCONC_H
+
+#include "tommyhash.h"
+
+/******************************************************************************/
+/* hashconc */
+
+/**
+ * Number of write locks. It must be a power of 2.
+ */
+#define TOMMY_HASHCONC_STRIPE 256
+
+/**
+ * Number of slots moved to the new table by each insert and remove during a resize.
+ */
+#define TOMMY_HASHCONC_CHUNK 16
+
+/** \internal
+ * Initial and minimal size of the table expressed as a power of 2.
+ */
+#define TOMMY_HASHCONC_BIT 6
+
+/** \internal
+ * Size of a cache line, to keep the locks of different stripes apart.
+ */
+#define TOMMY_HASHCONC_CACHELINE 64
+
+/**
+ * Concurrent hashtable node.
+ * This is the node that you have to include inside your objects.
+ * Only the tommy_node::data and tommy_node::key fields are used.
+ */
+typedef tommy_node tommy_hashconc_node;
+
+/** \internal
+ * Slot of the table.
+ * The hash is written once, before the node pointer is published.
+ */
+typedef struct tommy_hashconc_slot_struct {
+	tommy_hashconc_node* volatile ptr; /**< Node, or one of the slot markers. */
+	tommy_hash_t hash; /**< Hash of the node. */
+} tommy_hashconc_slot;
+
+/** \internal
+ * Table of slots.
+ */
+typedef struct tommy_hashconc_table_struct {
+	tommy_hashconc_slot* slot; /**< Slots. */
+	unsigned size; /**< Number of slots. */
+	unsigned mask; /**< Bit mask to access the slots. */
+	unsigned limit; /**< Slots used before a resize. */
+	volatile unsigned used; /**< Slots used, removed ones included. */
+	volatile unsigned move_pos; /**< First slot not yet taken by a mover. */
+	volatile unsigned moved; /**< Slots moved to the next table. */
+	struct tommy_hashconc_table_struct* volatile next; /**< Newer table, during a resize. */
+	struct tommy_hashconc_table_struct* retired; /**< Next table in the retired list. */
+} tommy_hashconc_table;
+
+/** \internal
+ * Write lock, with the number of elements of the stripe.
+ */
+typedef struct tommy_hashconc_stripe_struct {
+	volatile unsigned lock; /**< Spin lock. */
+	unsigned count; /**< Number of elements with the hash in the stripe. */
+	char pad[TOMMY_HASHCONC_CACHELINE - 2 * sizeof(unsigned)];
+} tommy_hashconc_stripe;
+
+/**
+ * Concurrent hashtable.
+ */
+typedef struct tommy_hashconc_struct {
+	tommy_hashconc_table* volatile table; /**< Oldest table in use. Newer ones follow during a resize. */
+	tommy_hashconc_table* volatile retired; /**< Tables replaced, not yet freed. */
+	tommy_hashconc_stripe stripe[TOMMY_HASHCONC_STRIPE]; /**< Write locks. */
+} tommy_hashconc;
+
+/**
+ * Initializes the hashtable.
+ */
+void tommy_hashconc_init(tommy_hashconc* hashconc);
+
+/**
+ * Deinitializes the hashtable.
+ * No other thread can use the hashtable.
+ */
+void tommy_hashconc_done(tommy_hashconc* hashconc);
+
+/**
+ * Inserts an element in the the hashtable.
+ */
+void tommy_hashconc_insert(tommy_hashconc* hashconc, tommy_hashconc_node* node, void* data, tommy_hash_t hash);
+
+/**
+ * Searches and removes an element from the hashtable.
+ * You have to provide a compare function and the hash of the element you want to remove.
+ * If the element is not found, 0 is returned.
+ * If more equal elements are present, the first one is removed.
+ * \param cmp Compare function called with cmp_arg as first argument and with the element to compare as a second one.
+ * The function should return 0 for equal elements, anything other for different elements.
+ * \param cmp_arg Compare argument passed as first argument of the compare function.
+ * \param hash Hash of the element to find and remove.
+ * \return The removed element, or 0 if not found.
+ */
+void* tommy_hashconc_remove(tommy_hashconc* hashconc, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash);
+
+/**
+ * Removes an element from the hashtable.
+ * You must already have the address of the element to remove.
+ * \return The tommy_node::data field of the node removed, or 0 if another thread removed it.
+ */
+void* tommy_hashconc_remove_existing(tommy_hashconc* hashconc, tommy_hashconc_node* node);
+
+/**
+ * Searches an element in the hashtable.
+ * It never locks, and it can run at the same time of inserts and removes.
+ * You have to provide a compare function and the hash of the element you want to find.
+ * If more equal elements are present, the first one is returned.
+ * \param cmp Compare function called with cmp_arg as first argument and with the element to compare as a second one.
+ * The function should return 0 for equal elements, anything other for different elements.
+ * \param cmp_arg Compare argument passed as first argument of the compare function.
+ * \param hash Hash of the element to find.
+ * \return The first element found, or 0 if none.
+ */
+void* tommy_hashconc_search(tommy_hashconc* hashconc, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash);
+
+/**
+ * Frees the tables replaced by the resizes.
+ * You can call it only when no search is running, as a search may still
+ * read an old table.
+ */
+void tommy_hashconc_reclaim(tommy_hashconc* hashconc);
+
+/**
+ * Gets the number of elements.
+ * With other threads changing the hashtable, the result is approximated.
+ */
+unsigned tommy_hashconc_count(tommy_hashconc* hashconc);
+
+/**
+ * Gets the size of allocated memory.
+ * It includes the size of the ::tommy_hashconc_node of the stored elements,
+ * and the tables not yet reclaimed.
+ */
+tommy_size_t tommy_hashconc_memory_usage(tommy_hashconc* hashconc);
+
+#endif
+
@@ -43,104 +43,147 @@ void tommy_hashdyn_init(tommy_hashdyn* hashdyn)
 	memset(hashdyn->bucket, 0, hashdyn->bucket_max * sizeof(tommy_hashdyn_node*));
 
 	hashdyn->count = 0;
+	hashdyn->old_bucket = 0;
+	hashdyn->min_bit = TOMMY_HASHDYN_BIT;
+	hashdyn->shrink_delay = 0;
+	hashdyn->shrink_wait = 0;
 }
 
-void tommy_hashdyn_done(tommy_hashdyn* hashdyn)
+void tommy_hashdyn_init_size(tommy_hashdyn* hashdyn, unsigned count)
 {
-	tommy_free(hashdyn->bucket);
+	unsigned bit = TOMMY_HASHDYN_BIT;
+
+	/* grows when 50% full */
+	while (bit < 31 && (1U << bit) / 2 <= count)
+		++bit;
+
+	hashdyn->bucket_bit = bit;
+	hashdyn->bucket_max = 1 << hashdyn->bucket_bit;
+	hashdyn->bucket_mask = hashdyn->bucket_max - 1;
+	hashdyn->bucket = tommy_cast(tommy_hashdyn_node**, tommy_malloc(hashdyn->bucket_max * sizeof(tommy_hashdyn_node*)));
+	memset(hashdyn->bucket, 0, hashdyn->bucket_max * sizeof(tommy_hashdyn_node*));
+
+	hashdyn->count = 0;
+	hashdyn->old_bucket = 0;
+	hashdyn->min_bit = bit;
+	hashdyn->shrink_delay = 0;
+	hashdyn->shrink_wait = 0;
 }
 
-/**
- * Resize the bucket vector.
- */
-static void tommy_hashdyn_resize(tommy_hashdyn* hashdyn, unsigned new_bucket_bit)
+void tommy_hashdyn_set_shrink(tommy_hashdyn* hashdyn, unsigned min_count, unsigned shrink_delay)
 {
-	unsigned bucket_bit;
-	unsigned bucket_max;
-	unsigned new_bucket_max;
-	unsigned new_bucket_mask;
-	tommy_hashdyn_node** new_bucket;
+	unsigned bit = TOMMY_HASHDYN_BIT;
 
-	bucket_bit = hashdyn->bucket_bit;
-	bucket_max = hashdyn->bucket_max;
+	/* the size init_size() gives for min_count */
+	while (bit < 31 && (1U << bit) / 2 <= min_count)
+		++bit;
 
-	new_bucket_max = 1 << new_bucket_bit;
-	new_bucket_mask = new_bucket_max - 1;
-	new_bucket = tommy_cast(tommy_hashdyn_node**, tommy_malloc(new_bucket_max * sizeof(tommy_hashdyn_node*)));
+	hashdyn->min_bit = bit;
+	hashdyn->shrink_delay = shrink_delay;
+	hashdyn->shrink_wait = 0;
+}
 
-	/* reinsert all the elements */
-	if (new_bucket_bit > hashdyn->bucket_bit) {
-		unsigned i;
+void tommy_hashdyn_done(tommy_hashdyn* hashdyn)
+{
+	tommy_free(hashdyn->bucket);
+	tommy_free(hashdyn->old_bucket);
+}
 
-		/* grow */
-		for(i=0;i<bucket_max;++i) {
-			tommy_hashdyn_node* j;
+/**
+ * Moves old buckets to the new table.
+ * The old table is freed when all are moved.
+ */
+static void tommy_hashdyn_move(tommy_hashdyn* hashdyn, unsigned count)
+{
+	unsigned end = hashdyn->old_max - hashdyn->old_pos > count ? hashdyn->old_pos + count : hashdyn->old_max;
 
-			/* setup the new two buckets */
-			new_bucket[i] = 0;
-			new_bucket[i + bucket_max] = 0;
+	while (hashdyn->old_pos < end) {
+		tommy_hashdyn_node* j = hashdyn->old_bucket[hashdyn->old_pos];
 
-			/* reinsert the bucket */
-			j = hashdyn->bucket[i];
+		if (hashdyn->old_max > hashdyn->bucket_max) {
+			/* shrink, concat the whole bucket to the lower one */
+			tommy_list_concat(&hashdyn->bucket[hashdyn->old_pos & hashdyn->bucket_mask], &hashdyn->old_bucket[hashdyn->old_pos]);
+		} else {
+			/* grow, reinsert the bucket splitting it in the new two */
 			while (j) {
 				tommy_hashdyn_node* j_next = j->next;
-				unsigned index = j->key & new_bucket_mask;
-				if (new_bucket[index])
-					tommy_list_insert_tail_not_empty(new_bucket[index], j);
+				unsigned index = j->key & hashdyn->bucket_mask;
+				if (hashdyn->bucket[index])
+					tommy_list_insert_tail_not_empty(hashdyn->bucket[index], j);
 				else
-					tommy_list_insert_first(&new_bucket[index], j);
+					tommy_list_insert_first(&hashdyn->bucket[index], j);
 				j = j_next;
 			}
 		}
-	} else {
-		unsigned i;
 
-		/* shrink */
-		for(i=0;i<new_bucket_max;++i) {
-			/* setup the new bucket with the lower bucket*/
-			new_bucket[i] = hashdyn->bucket[i];
+		++hashdyn->old_pos;
+	}
 
-			/* concat the upper bucket */
-			tommy_list_concat(&new_bucket[i], &hashdyn->bucket[i + new_bucket_max]);
-		}
+	if (hashdyn->old_pos == hashdyn->old_max) {
+		tommy_free(hashdyn->old_bucket);
+		hashdyn->old_bucket = 0;
 	}
+}
 
-	tommy_free(hashdyn->bucket);
+/**
+ * Resize the bucket vector.
+ * The elements are moved by the next inserts and removes, or all at once with a 0 TOMMY_HASHDYN_STEP.
+ */
+static void tommy_hashdyn_resize(tommy_hashdyn* hashdyn, unsigned new_bucket_bit)
+{
+	/* completes the previous resize, if still in progress */
+	if (hashdyn->old_bucket)
+		tommy_hashdyn_move(hashdyn, hashdyn->old_max);
+
+	hashdyn->old_bucket = hashdyn->bucket;
+	hashdyn->old_max = hashdyn->bucket_max;
+	hashdyn->old_mask = hashdyn->bucket_mask;
+	hashdyn->old_pos = 0;
 
 	/* setup */
 	hashdyn->bucket_bit = new_bucket_bit;
-	hashdyn->bucket_max = new_bucket_max;
-	hashdyn->bucket_mask = new_bucket_mask;
-	hashdyn->bucket = new_bucket;
+	hashdyn->bucket_max = 1 << new_bucket_bit;
+	hashdyn->bucket_mask = hashdyn->bucket_max - 1;
+	hashdyn->bucket = tommy_cast(tommy_hashdyn_node**, tommy_malloc(hashdyn->bucket_max * sizeof(tommy_hashdyn_node*)));
+	memset(hashdyn->bucket, 0, hashdyn->bucket_max * sizeof(tommy_hashdyn_node*));
+
+	if (TOMMY_HASHDYN_STEP == 0)
+		tommy_hashdyn_move(hashdyn, hashdyn->old_max);
 }
 
 void tommy_hashdyn_insert(tommy_hashdyn* hashdyn, tommy_hashdyn_node* node, void* data, tommy_hash_t hash)
 {
-	unsigned pos = hash & hashdyn->bucket_mask;
-
-	tommy_list_insert_tail(&hashdyn->bucket[pos], node, data);
+	tommy_list_insert_tail(tommy_hashdyn_bucket_ptr(hashdyn, hash), node, data);
 
 	node->key = hash;
 
 	++hashdyn->count;
 
+	/* back above the shrink load, the wait starts again */
+	if (hashdyn->shrink_wait != 0 && hashdyn->count > hashdyn->bucket_max / 8)
+		hashdyn->shrink_wait = 0;
+
 	/* grow if more than 50% full */
 	if (hashdyn->count >= hashdyn->bucket_max / 2) {
 		tommy_hashdyn_resize(hashdyn, hashdyn->bucket_bit + 1);
+	} else if (hashdyn->old_bucket) {
+		tommy_hashdyn_move(hashdyn, TOMMY_HASHDYN_STEP);
 	}
 }
 
 void* tommy_hashdyn_remove_existing(tommy_hashdyn* hashdyn, tommy_hashdyn_node* node)
 {
-	unsigned pos = node->key & hashdyn->bucket_mask;
-
-	tommy_list_remove_existing(&hashdyn->bucket[pos], node);
+	tommy_list_remove_existing(tommy_hashdyn_bucket_ptr(hashdyn, node->key), node);
 
 	--hashdyn->count;
 
-	/* shrink if less than 12.5% full */
-	if (hashdyn->count <= hashdyn->bucket_max / 8 && hashdyn->bucket_bit > TOMMY_HASHDYN_BIT) {
+	/* shrink if less than 12.5% full, for more than shrink_delay removes */
+	if (hashdyn->count <= hashdyn->bucket_max / 8 && hashdyn->bucket_bit > hashdyn->min_bit
+		&& ++hashdyn->shrink_wait > hashdyn->shrink_delay) {
+		hashdyn->shrink_wait = 0;
 		tommy_hashdyn_resize(hashdyn, hashdyn->bucket_bit - 1);
+	} else if (hashdyn->old_bucket) {
+		tommy_hashdyn_move(hashdyn, TOMMY_HASHDYN_STEP);
 	}
 
 	return node->data;
@@ -148,16 +191,19 @@ void* tommy_hashdyn_remove_existing(tommy_hashdyn* hashdyn, tommy_hashdyn_node*
 
 void* tommy_hashdyn_remove(tommy_hashdyn* hashdyn, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
 {
-	unsigned pos = hash % hashdyn->bucket_max;
-	tommy_hashdyn_node* i = hashdyn->bucket[pos];
+	tommy_hashdyn_node** let = tommy_hashdyn_bucket_ptr(hashdyn, hash);
+	tommy_hashdyn_node* i = *let;
 
 	while (i) {
 		/* we first check if the hash matches, as in the same bucket we may have multiples hash values */
 		if (i->key == hash && cmp(cmp_arg, i->data) == 0) {
-			tommy_list_remove_existing(&hashdyn->bucket[pos], i);
+			tommy_list_remove_existing(let, i);
 
 			--hashdyn->count;
 
+			if (hashdyn->old_bucket)
+				tommy_hashdyn_move(hashdyn, TOMMY_HASHDYN_STEP);
+
 			return i->data;
 		}
 		i = i->next;
@@ -166,9 +212,25 @@ void* tommy_hashdyn_remove(tommy_hashdyn* hashdyn, tommy_compare_func* cmp, cons
 	return 0;
 }
 
+void tommy_hashdyn_bucket_batch(tommy_hashdyn* hashdyn, const tommy_hash_t* hash, tommy_hashdyn_node** bucket, unsigned count)
+{
+	unsigned i;
+
+	for(i=0;i<count;++i)
+		tommy_prefetch(tommy_hashdyn_bucket_ptr(hashdyn, hash[i]));
+
+	for(i=0;i<count;++i) {
+		bucket[i] = tommy_hashdyn_bucket(hashdyn, hash[i]);
+		if (bucket[i])
+			tommy_prefetch(bucket[i]);
+	}
+}
+
 tommy_size_t tommy_hashdyn_memory_usage(tommy_hashdyn* hashdyn)
 {
-	return hashdyn->bucket_max * (tommy_size_t)sizeof(hashdyn->bucket[0])
+	tommy_size_t old_max = hashdyn->old_bucket ? hashdyn->old_max : 0;
+
+	return (hashdyn->bucket_max + old_max) * (tommy_size_t)sizeof(hashdyn->bucket[0])
 		+ tommy_hashdyn_count(hashdyn) * (tommy_size_t)sizeof(tommy_hashdyn_node);
 }
 
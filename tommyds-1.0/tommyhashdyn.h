@@ -32,16 +32,22 @@
  * the size then it reaches a load factor greater than 0.5 and it halves the size with a load
  * factor lower than 0.125.
  *
- * All the elements are reallocated in a single resize operation done inside 
- * tommy_hashdyn_insert() or tommy_hashdyn_remove().
+ * The elements are moved to the resized table incrementally, TOMMY_HASHDYN_STEP buckets
+ * for each tommy_hashdyn_insert() or tommy_hashdyn_remove(), keeping both the tables until
+ * all the buckets are moved. The searches look in the bucket of the old table
+ * if it isn't moved yet.
  *
- * Note that the resize operation takes approximatively 100 [ms] with 1 million of elements, 
- * and 1 [second] with 10 millions. This could be a problem in real-time applications.
+ * Defining TOMMY_HASHDYN_STEP to 0 when compiling tommyhashdyn.c, all the elements are
+ * reallocated in a single resize operation. Note that it takes approximatively 100 [ms] with
+ * 1 million of elements, and 1 [second] with 10 millions. This could be a problem in
+ * real-time applications.
  *
  * The resize also fragment the heap, as it involves allocating a double-sized table, copy elements, 
  * and deallocating the older table. Leaving a big hole in the heap.
+ * With populations that swing between sizes, as a flow table between attack waves,
+ * tommy_hashdyn_set_shrink() limits the resizes: a floor and a delay before halving.
  * 
- * The ::tommy_hashlin hashtable fixes both problems.
+ * The ::tommy_hashlin hashtable fixes this problem.
  *
  * To initialize the hashtable you have to call tommy_hashdyn_init().
  *
@@ -144,6 +150,15 @@
  */
 #define TOMMY_HASHDYN_BIT 4
 
+/** \internal
+ * Number of buckets moved to the resized table at each insert or remove.
+ * With 16 or more the move is always complete before the next resize, otherwise
+ * the rest is moved at once then. With 0 the elements are moved all at once.
+ */
+#ifndef TOMMY_HASHDYN_STEP
+#define TOMMY_HASHDYN_STEP 16
+#endif
+
 /**
  * Dynamic hashtable node.
  * This is the node that you have to include inside your objects.
@@ -159,6 +174,13 @@ typedef struct tommy_hashdyn_struct {
 	unsigned bucket_max; /**< Number of buckets. */
 	unsigned bucket_mask; /**< Bit mask to access the buckets. */
 	unsigned count; /**< Number of elements. */
+	tommy_hashdyn_node** old_bucket; /**< Buckets of the table before the resize. 0 if all moved. */
+	unsigned old_max; /**< Number of old buckets. */
+	unsigned old_mask; /**< Bit mask to access the old buckets. */
+	unsigned old_pos; /**< Old buckets already moved, from the first one. */
+	unsigned min_bit; /**< The table never shrinks below 2^min_bit buckets. */
+	unsigned shrink_delay; /**< Removes below a 0.125 load factor before the table halves. */
+	unsigned shrink_wait; /**< Removes below a 0.125 load factor since it was last above. */
 } tommy_hashdyn;
 
 /**
@@ -166,6 +188,25 @@ typedef struct tommy_hashdyn_struct {
  */
 void tommy_hashdyn_init(tommy_hashdyn* hashdyn);
 
+/**
+ * Initializes the hashtable with room for the specified number of elements.
+ * Up to this number no resize happens, and the buckets are already written:
+ * the first inserts have no page fault. The table never shrinks below this size.
+ */
+void tommy_hashdyn_init_size(tommy_hashdyn* hashdyn, unsigned count);
+
+/**
+ * Sets the shrink hysteresis of the hashtable.
+ * Once grown to the size for min_count elements, the table never shrinks below it. It also
+ * halves only after shrink_delay removes with a load factor lower than 0.125, counted since
+ * the load factor was last above: a population that comes back before does not resize it
+ * twice. With 0 and 0, the default, it halves at the first such remove.
+ * The buckets are not allocated in advance, see tommy_hashdyn_init_size() for this.
+ * \param min_count Number of elements of the minimal size.
+ * \param shrink_delay Number of removes to wait.
+ */
+void tommy_hashdyn_set_shrink(tommy_hashdyn* hashdyn, unsigned min_count, unsigned shrink_delay);
+
 /**
  * Deinitializes the hashtable.
  */
@@ -190,6 +231,20 @@ void tommy_hashdyn_insert(tommy_hashdyn* hashdyn, tommy_hashdyn_node* node, void
  */
 void* tommy_hashdyn_remove(tommy_hashdyn* hashdyn, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash);
 
+/** \internal
+ * Gets the bucket head of the specified hash, in the old table if not moved yet.
+ */
+tommy_inline tommy_hashdyn_node** tommy_hashdyn_bucket_ptr(tommy_hashdyn* hashdyn, tommy_hash_t hash)
+{
+	if (hashdyn->old_bucket) {
+		unsigned pos = hash & hashdyn->old_mask;
+		if (pos >= hashdyn->old_pos)
+			return &hashdyn->old_bucket[pos];
+	}
+
+	return &hashdyn->bucket[hash & hashdyn->bucket_mask];
+}
+
 /**
  * Gets the bucket of the specified hash.
  * The bucket is guaranteed to contain ALL the elements with the specified hash,
@@ -200,9 +255,20 @@ void* tommy_hashdyn_remove(tommy_hashdyn* hashdyn, tommy_compare_func* cmp, cons
  */
 tommy_inline tommy_hashdyn_node* tommy_hashdyn_bucket(tommy_hashdyn* hashdyn, tommy_hash_t hash)
 {
-	return hashdyn->bucket[hash & hashdyn->bucket_mask];
+	return *tommy_hashdyn_bucket_ptr(hashdyn, hash);
 }
 
+/**
+ * Gets the buckets of multiple hashes.
+ * This is the same of calling tommy_hashdyn_bucket() for each hash, but the cache
+ * misses of the different buckets are overlapped. All the buckets are first prefetched,
+ * and then read, prefetching the first node of each one.
+ * \param hash Hashes of the elements to find.
+ * \param bucket Where to store the head of the bucket of each hash, or 0 if empty.
+ * \param count Number of hashes.
+ */
+void tommy_hashdyn_bucket_batch(tommy_hashdyn* hashdyn, const tommy_hash_t* hash, tommy_hashdyn_node** bucket, unsigned count);
+
 /**
  * Searches an element in the hashtable.
  * You have to provide a compare function and the hash of the element you want to find.
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tommyhashidx.h"
+
+#include <string.h> /* for memset */
+
+/******************************************************************************/
+/* hashidx */
+
+void tommy_hashidx_init(tommy_hashidx* hashidx, tommy_slab* slab, tommy_size_t node_offset)
+{
+	/* fixed initial size */
+	hashidx->bucket_bit = TOMMY_HASHIDX_BIT;
+	hashidx->bucket_max = 1 << hashidx->bucket_bit;
+	hashidx->bucket_mask = hashidx->bucket_max - 1;
+	hashidx->bucket = tommy_cast(tommy_uint32_t*, tommy_malloc(hashidx->bucket_max * sizeof(tommy_uint32_t)));
+	memset(hashidx->bucket, 0, hashidx->bucket_max * sizeof(tommy_uint32_t));
+
+	hashidx->count = 0;
+	hashidx->slab = slab;
+	hashidx->node_offset = node_offset;
+}
+
+void tommy_hashidx_done(tommy_hashidx* hashidx)
+{
+	tommy_free(hashidx->bucket);
+}
+
+/**
+ * Resize the bucket vector.
+ */
+static void tommy_hashidx_resize(tommy_hashidx* hashidx, unsigned new_bucket_bit)
+{
+	unsigned old_bucket_max = hashidx->bucket_max;
+	tommy_uint32_t* old_bucket = hashidx->bucket;
+	unsigned i;
+
+	hashidx->bucket_bit = new_bucket_bit;
+	hashidx->bucket_max = 1 << hashidx->bucket_bit;
+	hashidx->bucket_mask = hashidx->bucket_max - 1;
+	hashidx->bucket = tommy_cast(tommy_uint32_t*, tommy_malloc(hashidx->bucket_max * sizeof(tommy_uint32_t)));
+	memset(hashidx->bucket, 0, hashidx->bucket_max * sizeof(tommy_uint32_t));
+
+	/* the key has enough bits for any bucket mask */
+	for(i=0;i<old_bucket_max;++i) {
+		tommy_uint32_t j = old_bucket[i];
+		while (j) {
+			tommy_hashidx_node* node = tommy_hashidx_node_of(hashidx, j);
+			tommy_uint32_t next = node->next;
+			tommy_uint32_t* let = &hashidx->bucket[node->key & hashidx->bucket_mask];
+
+			node->next = *let;
+			*let = j;
+
+			j = next;
+		}
+	}
+
+	tommy_free(old_bucket);
+}
+
+void tommy_hashidx_insert(tommy_hashidx* hashidx, tommy_uint32_t index, tommy_hash_t hash)
+{
+	tommy_hashidx_node* node = tommy_hashidx_node_of(hashidx, index);
+	tommy_uint32_t* let = &hashidx->bucket[hash & hashidx->bucket_mask];
+
+	node->key = (tommy_uint32_t)hash;
+	node->next = *let;
+	*let = index;
+
+	++hashidx->count;
+
+	/* grow if more than 50% full */
+	if (hashidx->count >= hashidx->bucket_max / 2)
+		tommy_hashidx_resize(hashidx, hashidx->bucket_bit + 1);
+}
+
+/**
+ * Removes the element linked by let.
+ */
+static tommy_uint32_t tommy_hashidx_unlink(tommy_hashidx* hashidx, tommy_uint32_t* let, tommy_hashidx_node* node)
+{
+	tommy_uint32_t index = *let;
+
+	*let = node->next;
+
+	--hashidx->count;
+
+	/* shrink if less than 12.5% full */
+	if (hashidx->count <= hashidx->bucket_max / 8 && hashidx->bucket_bit > TOMMY_HASHIDX_BIT)
+		tommy_hashidx_resize(hashidx, hashidx->bucket_bit - 1);
+
+	return index;
+}
+
+tommy_uint32_t tommy_hashidx_remove_existing(tommy_hashidx* hashidx, tommy_uint32_t index)
+{
+	tommy_hashidx_node* node = tommy_hashidx_node_of(hashidx, index);
+	tommy_uint32_t* let = &hashidx->bucket[node->key & hashidx->bucket_mask];
+
+	/* singly linked, search the link to the node */
+	while (*let != index)
+		let = &tommy_hashidx_node_of(hashidx, *let)->next;
+
+	return tommy_hashidx_unlink(hashidx, let, node);
+}
+
+tommy_uint32_t tommy_hashidx_remove(tommy_hashidx* hashidx, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	tommy_uint32_t* let = &hashidx->bucket[hash & hashidx->bucket_mask];
+	tommy_uint32_t key = (tommy_uint32_t)hash;
+
+	while (*let) {
+		char* obj = tommy_cast(char*, tommy_slab_ref(hashidx->slab, *let));
+		tommy_hashidx_node* node = (tommy_hashidx_node*)(obj + hashidx->node_offset);
+
+		/* we first check if the hash matches, as in the same bucket we may have multiples hash values */
+		if (node->key == key && cmp(cmp_arg, obj) == 0)
+			return tommy_hashidx_unlink(hashidx, let, node);
+
+		let = &node->next;
+	}
+
+	return 0;
+}
+
+tommy_size_t tommy_hashidx_memory_usage(tommy_hashidx* hashidx)
+{
+	return hashidx->bucket_max * (tommy_size_t)sizeof(hashidx->bucket[0])
+		+ tommy_hashidx_count(hashidx) * (tommy_size_t)sizeof(tommy_hashidx_node);
+}
+
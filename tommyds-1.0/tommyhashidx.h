@@ -0,0 +1,214 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * Compact chained hashtable with 32 bits indexes.
+ *
+ * This hashtable stores objects allocated in a ::tommy_slab, and links them
+ * with their 32 bits slab indexes instead of pointers.
+ * The node included in the objects is only 8 bytes, the index of the next
+ * object and 32 bits of the hash, instead of the 32 bytes of ::tommy_node
+ * in 64 bits hosts, and each bucket takes 4 bytes instead of 8.
+ * Without a pointer at the object, the node is found at a fixed offset
+ * in all the objects of the slab.
+ *
+ * It resizes like ::tommy_hashdyn, doubling the buckets when half full,
+ * and halving them when 1/8 full. The lists are singly linked, so removing
+ * an element walks its bucket.
+ *
+ * \code
+ * struct object {
+ *     tommy_hashidx_node node;
+ *     // other fields
+ *     int value;
+ * };
+ *
+ * tommy_slab slab;
+ * tommy_hashidx hashidx;
+ *
+ * tommy_slab_init(&slab, sizeof(struct object));
+ * tommy_hashidx_init(&hashidx, &slab, offsetof(struct object, node));
+ *
+ * tommy_uint32_t index = tommy_slab_alloc(&slab);
+ * struct object* obj = tommy_slab_ref(&slab, index);
+ * obj->value = ...;
+ *
+ * tommy_hashidx_insert(&hashidx, index, tommy_inthash_u32(obj->value));
+ * \endcode
+ *
+ * To find an element you have to call tommy_hashidx_search() providing
+ * the same compare function of the other hashtables. It's called with the
+ * address of the object in the slab, and the index found is returned.
+ *
+ * \code
+ * int compare(const void* arg, const void* obj)
+ * {
+ *     return *(const int*)arg != ((const struct object*)obj)->value;
+ * }
+ *
+ * int value_to_find = 1;
+ * tommy_uint32_t index = tommy_hashidx_search(&hashidx, compare, &value_to_find, tommy_inthash_u32(value_to_find));
+ * if (!index) {
+ *   // not found
+ * } else {
+ *   struct object* obj = tommy_slab_ref(&slab, index);
+ *   // found
+ * }
+ * \endcode
+ *
+ * The same slab can hold objects stored in other containers, like ::tommy_listidx,
+ * each one with its node at a different offset.
+ */
+
+#ifndef __TOMMYHASHIDX_H
+#define __TOMMYHASHIDX_H
+
+#include "tommyhash.h"
+#include "tommyslab.h"
+
+/******************************************************************************/
+/* hashidx */
+
+/** \internal
+ * Initial and minimal size of the hashtable expressed as a power of 2.
+ * The initial size is 2^TOMMY_HASHIDX_BIT.
+ */
+#define TOMMY_HASHIDX_BIT 4
+
+/**
+ * Compact hashtable node.
+ * This is the node that you have to include inside your objects.
+ */
+typedef struct tommy_hashidx_node_struct {
+	tommy_uint32_t next; /**< Index of the next object in the bucket. 0 for last. */
+	tommy_uint32_t key; /**< Low 32 bits of the hash. */
+} tommy_hashidx_node;
+
+/**
+ * Compact hashtable.
+ */
+typedef struct tommy_hashidx_struct {
+	tommy_uint32_t* bucket; /**< Hash buckets. Index of the first object of each list. */
+	unsigned bucket_bit; /**< Bits used in the bit mask. */
+	unsigned bucket_max; /**< Number of buckets. */
+	unsigned bucket_mask; /**< Bit mask to access the buckets. */
+	unsigned count; /**< Number of elements. */
+	tommy_slab* slab; /**< Slab of the objects. */
+	tommy_size_t node_offset; /**< Offset of the node in the objects. */
+} tommy_hashidx;
+
+/**
+ * Initializes the hashtable.
+ * \param slab Slab where the objects are allocated.
+ * \param node_offset Offset of the ::tommy_hashidx_node in the objects.
+ */
+void tommy_hashidx_init(tommy_hashidx* hashidx, tommy_slab* slab, tommy_size_t node_offset);
+
+/**
+ * Deinitializes the hashtable.
+ * The objects are not freed, as they belong to the slab.
+ */
+void tommy_hashidx_done(tommy_hashidx* hashidx);
+
+/** \internal
+ * Gets the node of an object.
+ */
+tommy_inline tommy_hashidx_node* tommy_hashidx_node_of(tommy_hashidx* hashidx, tommy_uint32_t index)
+{
+	return (tommy_hashidx_node*)((char*)tommy_slab_ref(hashidx->slab, index) + hashidx->node_offset);
+}
+
+/**
+ * Inserts an element in the hashtable.
+ * \param index Slab index of the object to insert.
+ * \param hash Hash of the object.
+ */
+void tommy_hashidx_insert(tommy_hashidx* hashidx, tommy_uint32_t index, tommy_hash_t hash);
+
+/**
+ * Searches and removes an element from the hashtable.
+ * You have to provide a compare function and the hash of the element you want to remove.
+ * If the element is not found, 0 is returned.
+ * If more equal elements are present, the first one is removed.
+ * \param cmp Compare function called with cmp_arg as first argument and with the object to compare as a second one.
+ * The function should return 0 for equal elements, anything other for different elements.
+ * \param cmp_arg Compare argument passed as first argument of the compare function.
+ * \param hash Hash of the element to find and remove.
+ * \return The slab index of the removed element, or 0 if not found.
+ */
+tommy_uint32_t tommy_hashidx_remove(tommy_hashidx* hashidx, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash);
+
+/**
+ * Removes an element from the hashtable.
+ * You must already have the index of the element to remove.
+ * \return The slab index of the removed element.
+ */
+tommy_uint32_t tommy_hashidx_remove_existing(tommy_hashidx* hashidx, tommy_uint32_t index);
+
+/**
+ * Searches an element in the hashtable.
+ * You have to provide a compare function and the hash of the element you want to find.
+ * If more equal elements are present, the first one is returned.
+ * \param cmp Compare function called with cmp_arg as first argument and with the object to compare as a second one.
+ * The function should return 0 for equal elements, anything other for different elements.
+ * \param cmp_arg Compare argument passed as first argument of the compare function.
+ * \param hash Hash of the element to find.
+ * \return The slab index of the first element found, or 0 if none.
+ */
+tommy_inline tommy_uint32_t tommy_hashidx_search(tommy_hashidx* hashidx, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	tommy_uint32_t i = hashidx->bucket[hash & hashidx->bucket_mask];
+	tommy_uint32_t key = (tommy_uint32_t)hash;
+
+	while (i) {
+		char* obj = tommy_cast(char*, tommy_slab_ref(hashidx->slab, i));
+		tommy_hashidx_node* node = (tommy_hashidx_node*)(obj + hashidx->node_offset);
+
+		/* we first check if the hash matches, as in the same bucket we may have multiples hash values */
+		if (node->key == key && cmp(cmp_arg, obj) == 0)
+			return i;
+		i = node->next;
+	}
+	return 0;
+}
+
+/**
+ * Gets the number of elements.
+ */
+tommy_inline unsigned tommy_hashidx_count(tommy_hashidx* hashidx)
+{
+	return hashidx->count;
+}
+
+/**
+ * Gets the size of allocated memory.
+ * It includes the size of the ::tommy_hashidx_node of the stored elements.
+ */
+tommy_size_t tommy_hashidx_memory_usage(tommy_hashidx* hashidx);
+
+#endif
+
@@ -55,14 +55,56 @@ void tommy_hashlin_init(tommy_hashlin* hashlin)
 	hashlin->state = TOMMY_HASHLIN_STATE_STABLE;
 
 	hashlin->count = 0;
+	hashlin->min_bit = TOMMY_HASHLIN_BIT;
+	hashlin->shrink_delay = 0;
+	hashlin->shrink_wait = 0;
+}
+
+void tommy_hashlin_init_size(tommy_hashlin* hashlin, unsigned count)
+{
+	unsigned bit = TOMMY_HASHLIN_BIT;
+
+	tommy_hashlin_init(hashlin);
+
+	/* grows when 50% full */
+	while (bit < TOMMY_HASHLIN_BIT_MAX - 1 && (1U << bit) / 2 <= count)
+		++bit;
+
+	/* the segments the table would have allocated growing to this size */
+	while (hashlin->bucket_bit < bit) {
+		hashlin->bucket[hashlin->bucket_mac] = tommy_cast(tommy_hashlin_node**, tommy_malloc(hashlin->bucket_max * sizeof(tommy_hashlin_node*)));
+		memset(hashlin->bucket[hashlin->bucket_mac], 0, hashlin->bucket_max * sizeof(tommy_hashlin_node*));
+		++hashlin->bucket_mac;
+
+		++hashlin->bucket_bit;
+		hashlin->bucket_max = 1 << hashlin->bucket_bit;
+		hashlin->bucket_mask = hashlin->bucket_max - 1;
+	}
+
+	hashlin->min_bit = bit;
+}
+
+void tommy_hashlin_set_shrink(tommy_hashlin* hashlin, unsigned min_count, unsigned shrink_delay)
+{
+	unsigned bit = TOMMY_HASHLIN_BIT;
+
+	/* the size init_size() gives for min_count */
+	while (bit < TOMMY_HASHLIN_BIT_MAX - 1 && (1U << bit) / 2 <= min_count)
+		++bit;
+
+	hashlin->min_bit = bit;
+	hashlin->shrink_delay = shrink_delay;
+	hashlin->shrink_wait = 0;
 }
 
 void tommy_hashlin_done(tommy_hashlin* hashlin)
 {
-	/* we assume to be empty, so we free only the first bucket */
-	assert(hashlin->bucket_mac == 1);
+	/* we assume to be empty, but a floor not reached yet or a pending shrink */
+	/* (tommy_hashlin_set_shrink()) may leave fewer or more segments than the minimal size */
+	assert(hashlin->count == 0);
 
-	tommy_free(hashlin->bucket[0]);
+	while (hashlin->bucket_mac > 0)
+		tommy_free(hashlin->bucket[--hashlin->bucket_mac]);
 }
 
 /**
@@ -238,10 +280,13 @@ tommy_inline void hashlin_shrink_step(tommy_hashlin* hashlin)
 		}
 	}
 
-	/* shrink if less than 12.5% full */
+	/* shrink if less than 12.5% full, for more than shrink_delay removes */
 	if (hashlin->state != TOMMY_HASHLIN_STATE_SHRINK
-		&& hashlin->count <= hashlin->bucket_max / 8 && hashlin->bucket_bit > TOMMY_HASHLIN_BIT)
+		&& hashlin->count <= hashlin->bucket_max / 8 && hashlin->bucket_bit > hashlin->min_bit
+		&& ++hashlin->shrink_wait > hashlin->shrink_delay)
 	{
+		hashlin->shrink_wait = 0;
+
 		if (hashlin->state == TOMMY_HASHLIN_STATE_STABLE) {
 			/* set the lower size */
 			hashlin->low_max = hashlin->bucket_max / 2;
@@ -264,6 +309,10 @@ void tommy_hashlin_insert(tommy_hashlin* hashlin, tommy_hashlin_node* node, void
 
 	++hashlin->count;
 
+	/* back above the shrink load, the wait starts again */
+	if (hashlin->shrink_wait != 0 && hashlin->count > hashlin->bucket_max / 8)
+		hashlin->shrink_wait = 0;
+
 	hashlin_grow_step(hashlin);
 }
 
@@ -283,6 +332,21 @@ tommy_hashlin_node* tommy_hashlin_bucket(tommy_hashlin* hashlin, tommy_hash_t ha
 	return *tommy_hashlin_bucket_ptr(hashlin, hash);
 }
 
+void tommy_hashlin_bucket_batch(tommy_hashlin* hashlin, const tommy_hash_t* hash, tommy_hashlin_node** bucket, unsigned count)
+{
+	unsigned i;
+
+	/* the segment table is small and stays in cache, only the buckets miss */
+	for(i=0;i<count;++i)
+		tommy_prefetch(tommy_hashlin_bucket_ptr(hashlin, hash[i]));
+
+	for(i=0;i<count;++i) {
+		bucket[i] = *tommy_hashlin_bucket_ptr(hashlin, hash[i]);
+		if (bucket[i])
+			tommy_prefetch(bucket[i]);
+	}
+}
+
 void* tommy_hashlin_remove(tommy_hashlin* hashlin, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
 {
 	tommy_hashlin_node** let_ptr = tommy_hashlin_bucket_ptr(hashlin, hash);
@@ -42,6 +42,8 @@
  * segments.
  * In this way we only allocate additional table segments on the heap, without
  * freeing the previous table, and then not increasing the heap fragmentation.
+ * With populations that swing between sizes, tommy_hashlin_set_shrink() keeps the
+ * segments between the waves: a floor and a delay before halving.
  *
  * The resize takes place inside tommy_hashlin_insert() and tommy_hashlin_remove().
  * No resize is done in the tommy_hashlin_search() operation.
@@ -172,6 +174,9 @@ typedef struct tommy_hashlin_struct {
 	unsigned split; /**< Split position. */
 	unsigned state; /**< Reallocation state. */
 	unsigned count; /**< Number of elements. */
+	unsigned min_bit; /**< The table never shrinks below 2^min_bit buckets. */
+	unsigned shrink_delay; /**< Removes below a 0.125 load factor before the table halves. */
+	unsigned shrink_wait; /**< Removes below a 0.125 load factor since it was last above. */
 } tommy_hashlin;
 
 /**
@@ -179,6 +184,24 @@ typedef struct tommy_hashlin_struct {
  */
 void tommy_hashlin_init(tommy_hashlin* hashlin);
 
+/**
+ * Initializes the hashtable with room for the specified number of elements.
+ * Up to this number no segment is allocated, and the buckets are already written:
+ * the first inserts have no page fault. The table never shrinks below this size.
+ */
+void tommy_hashlin_init_size(tommy_hashlin* hashlin, unsigned count);
+
+/**
+ * Sets the shrink hysteresis of the hashtable.
+ * Once grown to the size for min_count elements, the table never shrinks below it. It also
+ * starts halving only after shrink_delay removes with a load factor lower than 0.125, counted
+ * since the load factor was last above. With 0 and 0, the default, it starts at the first one.
+ * The segments are not allocated in advance, see tommy_hashlin_init_size() for this.
+ * \param min_count Number of elements of the minimal size.
+ * \param shrink_delay Number of removes to wait.
+ */
+void tommy_hashlin_set_shrink(tommy_hashlin* hashlin, unsigned min_count, unsigned shrink_delay);
+
 /**
  * Deinitializes the hashtable.
  */
@@ -213,6 +236,17 @@ void* tommy_hashlin_remove(tommy_hashlin* hashlin, tommy_compare_func* cmp, cons
  */
 tommy_hashlin_node* tommy_hashlin_bucket(tommy_hashlin* hashlin, tommy_hash_t hash);
 
+/**
+ * Gets the buckets of multiple hashes.
+ * This is the same of calling tommy_hashlin_bucket() for each hash, but the cache
+ * misses of the different buckets are overlapped. All the buckets are first prefetched,
+ * and then read, prefetching the first node of each one.
+ * \param hash Hashes of the elements to find.
+ * \param bucket Where to store the head of the bucket of each hash, or 0 if empty.
+ * \param count Number of hashes.
+ */
+void tommy_hashlin_bucket_batch(tommy_hashlin* hashlin, const tommy_hash_t* hash, tommy_hashlin_node** bucket, unsigned count);
+
 /**
  * Searches an element in the hashtable.
  * You have to provide a compare function and the hash of the element you want to find.
@@ -0,0 +1,218 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tommyhashopen.h"
+
+#include <string.h> /* for memset */
+
+/******************************************************************************/
+/* hashopen */
+
+/** \internal
+ * Max number of slots used, counting the deleted ones, before a resize.
+ */
+#define TOMMY_HASHOPEN_LIMIT(group_max) ((group_max) * (TOMMY_HASHOPEN_GROUP / 8 * 7))
+
+static tommy_hashopen_group* tommy_hashopen_alloc(unsigned group_max)
+{
+	tommy_hashopen_group* group;
+	unsigned i;
+
+	group = tommy_cast(tommy_hashopen_group*, tommy_malloc(group_max * sizeof(tommy_hashopen_group)));
+
+	/* the slots are read only if the control byte is used */
+	for(i=0;i<group_max;++i)
+		memset(group[i].ctrl, TOMMY_HASHOPEN_EMPTY, TOMMY_HASHOPEN_GROUP);
+
+	return group;
+}
+
+void tommy_hashopen_init(tommy_hashopen* hashopen)
+{
+	hashopen->group_bit = TOMMY_HASHOPEN_BIT;
+	hashopen->group_max = 1 << hashopen->group_bit;
+	hashopen->group_mask = hashopen->group_max - 1;
+	hashopen->group = tommy_hashopen_alloc(hashopen->group_max);
+
+	hashopen->count = 0;
+	hashopen->deleted = 0;
+}
+
+void tommy_hashopen_done(tommy_hashopen* hashopen)
+{
+	tommy_free(hashopen->group);
+}
+
+/** \internal
+ * Stores the node in the first free slot of its probe sequence.
+ */
+static void tommy_hashopen_place(tommy_hashopen* hashopen, tommy_hashopen_node* node)
+{
+	unsigned pos = node->key & hashopen->group_mask;
+	unsigned step = 0;
+
+	while (1) {
+		tommy_hashopen_group* group = &hashopen->group[pos];
+		unsigned match = tommy_hashopen_match_free(group);
+
+		if (match) {
+			unsigned i = tommy_ctz_u32(match);
+
+			if (group->ctrl[i] == TOMMY_HASHOPEN_DELETED)
+				--hashopen->deleted;
+
+			group->ctrl[i] = tommy_hashopen_tag(node->key);
+			group->slot[i] = node;
+			return;
+		}
+
+		pos = (pos + ++step) & hashopen->group_mask;
+	}
+}
+
+/**
+ * Resizes the hashtable, also dropping the deleted slots.
+ */
+static void tommy_hashopen_resize(tommy_hashopen* hashopen, unsigned new_group_bit)
+{
+	tommy_hashopen_group* old_group = hashopen->group;
+	unsigned old_group_max = hashopen->group_max;
+	unsigned g, i;
+
+	hashopen->group_bit = new_group_bit;
+	hashopen->group_max = 1 << hashopen->group_bit;
+	hashopen->group_mask = hashopen->group_max - 1;
+	hashopen->group = tommy_hashopen_alloc(hashopen->group_max);
+	hashopen->deleted = 0;
+
+	for(g=0;g<old_group_max;++g) {
+		for(i=0;i<TOMMY_HASHOPEN_GROUP;++i) {
+			if ((old_group[g].ctrl[i] & 0x80) == 0)
+				tommy_hashopen_place(hashopen, old_group[g].slot[i]);
+		}
+	}
+
+	tommy_free(old_group);
+}
+
+void tommy_hashopen_insert(tommy_hashopen* hashopen, tommy_hashopen_node* node, void* data, tommy_hash_t hash)
+{
+	node->data = data;
+	node->key = hash;
+
+	if (hashopen->count + hashopen->deleted >= TOMMY_HASHOPEN_LIMIT(hashopen->group_max)) {
+		/* with many deleted slots, a rehash at the same size is enough */
+		if (hashopen->count >= TOMMY_HASHOPEN_LIMIT(hashopen->group_max) / 2)
+			tommy_hashopen_resize(hashopen, hashopen->group_bit + 1);
+		else
+			tommy_hashopen_resize(hashopen, hashopen->group_bit);
+	}
+
+	tommy_hashopen_place(hashopen, node);
+
+	++hashopen->count;
+}
+
+/** \internal
+ * Frees the slot i of the group.
+ */
+static void* tommy_hashopen_erase(tommy_hashopen* hashopen, tommy_hashopen_group* group, unsigned i)
+{
+	tommy_hashopen_node* node = group->slot[i];
+
+	/* a search never passed a group with an empty slot, so it stays empty */
+	if (tommy_hashopen_match(group, TOMMY_HASHOPEN_EMPTY)) {
+		group->ctrl[i] = TOMMY_HASHOPEN_EMPTY;
+	} else {
+		group->ctrl[i] = TOMMY_HASHOPEN_DELETED;
+		++hashopen->deleted;
+	}
+
+	--hashopen->count;
+
+	/* shrink if the load factor is lower than 0.125 */
+	if (hashopen->group_bit > TOMMY_HASHOPEN_BIT && hashopen->count < hashopen->group_max * TOMMY_HASHOPEN_GROUP / 8)
+		tommy_hashopen_resize(hashopen, hashopen->group_bit - 1);
+
+	return node->data;
+}
+
+void* tommy_hashopen_remove_existing(tommy_hashopen* hashopen, tommy_hashopen_node* node)
+{
+	unsigned char tag = tommy_hashopen_tag(node->key);
+	unsigned pos = node->key & hashopen->group_mask;
+	unsigned step = 0;
+
+	while (1) {
+		tommy_hashopen_group* group = &hashopen->group[pos];
+		unsigned match = tommy_hashopen_match(group, tag);
+
+		while (match) {
+			unsigned i = tommy_ctz_u32(match);
+			if (group->slot[i] == node)
+				return tommy_hashopen_erase(hashopen, group, i);
+			match &= match - 1;
+		}
+
+		if (tommy_hashopen_match(group, TOMMY_HASHOPEN_EMPTY))
+			return 0;
+
+		pos = (pos + ++step) & hashopen->group_mask;
+	}
+}
+
+void* tommy_hashopen_remove(tommy_hashopen* hashopen, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	unsigned char tag = tommy_hashopen_tag(hash);
+	unsigned pos = hash & hashopen->group_mask;
+	unsigned step = 0;
+
+	while (1) {
+		tommy_hashopen_group* group = &hashopen->group[pos];
+		unsigned match = tommy_hashopen_match(group, tag);
+
+		while (match) {
+			unsigned i = tommy_ctz_u32(match);
+			tommy_hashopen_node* node = group->slot[i];
+			if (node->key == hash && cmp(cmp_arg, node->data) == 0)
+				return tommy_hashopen_erase(hashopen, group, i);
+			match &= match - 1;
+		}
+
+		if (tommy_hashopen_match(group, TOMMY_HASHOPEN_EMPTY))
+			return 0;
+
+		pos = (pos + ++step) & hashopen->group_mask;
+	}
+}
+
+tommy_size_t tommy_hashopen_memory_usage(tommy_hashopen* hashopen)
+{
+	return hashopen->group_max * (tommy_size_t)sizeof(tommy_hashopen_group)
+		+ tommy_hashopen_count(hashopen) * (tommy_size_t)sizeof(tommy_hashopen_node);
+}
+
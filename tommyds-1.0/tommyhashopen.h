@@ -0,0 +1,254 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * Open addressing hashtable.
+ *
+ * This hashtable stores the pointers to the nodes directly in the table,
+ * without chaining, in groups of ::TOMMY_HASHOPEN_GROUP slots.
+ * Each group starts with one control byte for each slot, containing 7 bits
+ * of the hash of the element, or a marker of empty or deleted slot.
+ * A search compares all the control bytes of a group at once, with SSE2 when
+ * available, and it dereferences only the nodes with the same 7 bits.
+ * In this way a search usually reads only the group, and the object found.
+ * A miss usually reads only the group.
+ *
+ * The groups are probed in triangular order, and the table doubles its size
+ * when 7/8 of the slots are used, counting also the deleted ones.
+ * It halves its size when the load factor is lower than 0.125.
+ * Like ::tommy_hashdyn the resize rehashes all the elements at once.
+ *
+ * The use is the same of ::tommy_hashdyn, with the only difference that
+ * there isn't a bucket function, as the elements with the same hash are not
+ * in a list.
+ *
+ * \code
+ * tommy_hashopen hashopen;
+ *
+ * tommy_hashopen_init(&hashopen);
+ *
+ * tommy_hashopen_insert(&hashopen, &obj->node, obj, tommy_inthash_u32(obj->value)); // inserts the object
+ *
+ * struct object* obj = tommy_hashopen_search(&hashopen, compare, &value_to_find, tommy_inthash_u32(value_to_find));
+ *
+ * struct object* obj = tommy_hashopen_remove(&hashopen, compare, &value_to_remove, tommy_inthash_u32(value_to_remove));
+ *
+ * tommy_hashopen_done(&hashopen);
+ * \endcode
+ *
+ * Note that you cannot iterates over all the elements in the hashtable using the
+ * hashtable itself. You have to insert all the elements also in a ::tommy_list,
+ * and use the list to iterate. See the \ref multiindex example for more detail.
+ */
+
+#ifndef __TOMMYHASHOPEN_H
+#define __TOMMYHASHOPEN_H
+
+#include "tommyhash.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TOMMY_HASHOPEN_SSE2
+#include <emmintrin.h>
+#endif
+
+/******************************************************************************/
+/* hashopen */
+
+/**
+ * Number of slots in a group.
+ */
+#define TOMMY_HASHOPEN_GROUP 16
+
+/** \internal
+ * Initial and minimal number of groups expressed as a power of 2.
+ */
+#define TOMMY_HASHOPEN_BIT 2
+
+/** \internal
+ * Control bytes of the slots not used.
+ * The used ones contain 7 bits of the hash, with the high bit clear.
+ */
+#define TOMMY_HASHOPEN_EMPTY 0x80
+#define TOMMY_HASHOPEN_DELETED 0xFE
+
+/**
+ * Open addressing hashtable node.
+ * This is the node that you have to include inside your objects.
+ * Only the tommy_node::data and tommy_node::key fields are used.
+ */
+typedef tommy_node tommy_hashopen_node;
+
+/** \internal
+ * Group of slots.
+ */
+typedef struct tommy_hashopen_group_struct {
+	unsigned char ctrl[TOMMY_HASHOPEN_GROUP]; /**< Control bytes. */
+	tommy_hashopen_node* slot[TOMMY_HASHOPEN_GROUP]; /**< Nodes stored. */
+} tommy_hashopen_group;
+
+/**
+ * Open addressing hashtable.
+ */
+typedef struct tommy_hashopen_struct {
+	tommy_hashopen_group* group; /**< Groups of slots. */
+	unsigned group_bit; /**< Bits used in the bit mask. */
+	unsigned group_max; /**< Number of groups. */
+	unsigned group_mask; /**< Bit mask to access the groups. */
+	unsigned count; /**< Number of elements. */
+	unsigned deleted; /**< Number of deleted slots. */
+} tommy_hashopen;
+
+/**
+ * Initializes the hashtable.
+ */
+void tommy_hashopen_init(tommy_hashopen* hashopen);
+
+/**
+ * Deinitializes the hashtable.
+ */
+void tommy_hashopen_done(tommy_hashopen* hashopen);
+
+/**
+ * Inserts an element in the the hashtable.
+ */
+void tommy_hashopen_insert(tommy_hashopen* hashopen, tommy_hashopen_node* node, void* data, tommy_hash_t hash);
+
+/**
+ * Searches and removes an element from the hashtable.
+ * You have to provide a compare function and the hash of the element you want to remove.
+ * If the element is not found, 0 is returned.
+ * If more equal elements are present, the first one is removed.
+ * \param cmp Compare function called with cmp_arg as first argument and with the element to compare as a second one.
+ * The function should return 0 for equal elements, anything other for different elements.
+ * \param cmp_arg Compare argument passed as first argument of the compare function.
+ * \param hash Hash of the element to find and remove.
+ * \return The removed element, or 0 if not found.
+ */
+void* tommy_hashopen_remove(tommy_hashopen* hashopen, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash);
+
+/** \internal
+ * Control byte of the specified hash.
+ */
+tommy_inline unsigned char tommy_hashopen_tag(tommy_hash_t hash)
+{
+	return (unsigned char)((hash >> 25) & 0x7F);
+}
+
+/** \internal
+ * Bit mask of the slots of the group with the specified control byte.
+ */
+tommy_inline unsigned tommy_hashopen_match(const tommy_hashopen_group* group, unsigned char value)
+{
+#ifdef TOMMY_HASHOPEN_SSE2
+	__m128i ctrl = _mm_loadu_si128((const __m128i*)group->ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)value)));
+#else
+	unsigned mask = 0;
+	unsigned i;
+	for(i=0;i<TOMMY_HASHOPEN_GROUP;++i)
+		if (group->ctrl[i] == value)
+			mask |= 1U << i;
+	return mask;
+#endif
+}
+
+/** \internal
+ * Bit mask of the slots of the group empty or deleted.
+ */
+tommy_inline unsigned tommy_hashopen_match_free(const tommy_hashopen_group* group)
+{
+#ifdef TOMMY_HASHOPEN_SSE2
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group->ctrl));
+#else
+	unsigned mask = 0;
+	unsigned i;
+	for(i=0;i<TOMMY_HASHOPEN_GROUP;++i)
+		if (group->ctrl[i] & 0x80)
+			mask |= 1U << i;
+	return mask;
+#endif
+}
+
+/**
+ * Searches an element in the hashtable.
+ * You have to provide a compare function and the hash of the element you want to find.
+ * If more equal elements are present, the first one is returned.
+ * \param cmp Compare function called with cmp_arg as first argument and with the element to compare as a second one.
+ * The function should return 0 for equal elements, anything other for different elements.
+ * \param cmp_arg Compare argument passed as first argument of the compare function.
+ * \param hash Hash of the element to find.
+ * \return The first element found, or 0 if none.
+ */
+tommy_inline void* tommy_hashopen_search(tommy_hashopen* hashopen, tommy_compare_func* cmp, const void* cmp_arg, tommy_hash_t hash)
+{
+	unsigned char tag = tommy_hashopen_tag(hash);
+	unsigned pos = hash & hashopen->group_mask;
+	unsigned step = 0;
+
+	while (1) {
+		tommy_hashopen_group* group = &hashopen->group[pos];
+		unsigned match = tommy_hashopen_match(group, tag);
+
+		while (match) {
+			tommy_hashopen_node* i = group->slot[tommy_ctz_u32(match)];
+			/* the tag has only 7 bits of the hash, check all of them */
+			if (i->key == hash && cmp(cmp_arg, i->data) == 0)
+				return i->data;
+			match &= match - 1;
+		}
+
+		/* the element would be in the first empty slot found */
+		if (tommy_hashopen_match(group, TOMMY_HASHOPEN_EMPTY))
+			return 0;
+
+		pos = (pos + ++step) & hashopen->group_mask;
+	}
+}
+
+/**
+ * Removes an element from the hashtable.
+ * You must already have the address of the element to remove.
+ * \return The tommy_node::data field of the node removed.
+ */
+void* tommy_hashopen_remove_existing(tommy_hashopen* hashopen, tommy_hashopen_node* node);
+
+/**
+ * Gets the number of elements.
+ */
+tommy_inline unsigned tommy_hashopen_count(tommy_hashopen* hashopen)
+{
+	return hashopen->count;
+}
+
+/**
+ * Gets the size of allocated memory.
+ * It includes the size of the ::tommy_hashopen_node of the stored elements.
+ */
+tommy_size_t tommy_hashopen_memory_usage(tommy_hashopen* hashopen);
+
+#endif
+
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * Compact double linked list with 32 bits indexes.
+ *
+ * This list is the same of ::tommy_list, but it links objects allocated in a
+ * ::tommy_slab with their 32 bits slab indexes instead of pointers.
+ * The node included in the objects is only 8 bytes, instead of the 32 bytes
+ * of ::tommy_node in 64 bits hosts.
+ *
+ * Like in ::tommy_list the head has the prev field at the tail, and the tail
+ * has the next field at 0, so the insertion at the end doesn't need a tail index.
+ *
+ * \code
+ * struct object {
+ *     tommy_listidx_node node;
+ *     // other fields
+ * };
+ *
+ * tommy_listidx list;
+ *
+ * tommy_listidx_init(&list, &slab, offsetof(struct object, node));
+ *
+ * tommy_listidx_insert_tail(&list, index);
+ *
+ * tommy_uint32_t i = tommy_listidx_head(&list);
+ * while (i) {
+ *     struct object* obj = tommy_slab_ref(&slab, i);
+ *     // process the object
+ *     i = tommy_listidx_next(&list, i);
+ * }
+ * \endcode
+ */
+
+#ifndef __TOMMYLISTIDX_H
+#define __TOMMYLISTIDX_H
+
+#include "tommyslab.h"
+
+/******************************************************************************/
+/* listidx */
+
+/**
+ * Compact list node.
+ * This is the node that you have to include inside your objects.
+ */
+typedef struct tommy_listidx_node_struct {
+	tommy_uint32_t next; /**< Index of the next object. The tail has it at 0. */
+	tommy_uint32_t prev; /**< Index of the previous object. The head has it at the tail. */
+} tommy_listidx_node;
+
+/**
+ * Compact list.
+ */
+typedef struct tommy_listidx_struct {
+	tommy_uint32_t head; /**< Index of the first object. 0 for empty. */
+	tommy_slab* slab; /**< Slab of the objects. */
+	tommy_size_t node_offset; /**< Offset of the node in the objects. */
+} tommy_listidx;
+
+/**
+ * Initializes the list.
+ * \param slab Slab where the objects are allocated.
+ * \param node_offset Offset of the ::tommy_listidx_node in the objects.
+ */
+tommy_inline void tommy_listidx_init(tommy_listidx* list, tommy_slab* slab, tommy_size_t node_offset)
+{
+	list->head = 0;
+	list->slab = slab;
+	list->node_offset = node_offset;
+}
+
+/** \internal
+ * Gets the node of an object.
+ */
+tommy_inline tommy_listidx_node* tommy_listidx_node_of(tommy_listidx* list, tommy_uint32_t index)
+{
+	return (tommy_listidx_node*)((char*)tommy_slab_ref(list->slab, index) + list->node_offset);
+}
+
+/**
+ * Gets the head of the list.
+ * \return The index of the head, or 0 if empty.
+ */
+tommy_inline tommy_uint32_t tommy_listidx_head(tommy_listidx* list)
+{
+	return list->head;
+}
+
+/**
+ * Gets the tail of the list.
+ * \return The index of the tail, or 0 if empty.
+ */
+tommy_inline tommy_uint32_t tommy_listidx_tail(tommy_listidx* list)
+{
+	if (!list->head)
+		return 0;
+
+	return tommy_listidx_node_of(list, list->head)->prev;
+}
+
+/**
+ * Gets the element after the specified one.
+ * \return The index of the next element, or 0 if it's the tail.
+ */
+tommy_inline tommy_uint32_t tommy_listidx_next(tommy_listidx* list, tommy_uint32_t index)
+{
+	return tommy_listidx_node_of(list, index)->next;
+}
+
+/**
+ * Checks if empty.
+ */
+tommy_inline tommy_bool_t tommy_listidx_empty(tommy_listidx* list)
+{
+	return list->head == 0;
+}
+
+/**
+ * Inserts an element at the head of the list.
+ */
+tommy_inline void tommy_listidx_insert_head(tommy_listidx* list, tommy_uint32_t index)
+{
+	tommy_listidx_node* node = tommy_listidx_node_of(list, index);
+
+	if (!list->head) {
+		node->prev = index;
+		node->next = 0;
+	} else {
+		tommy_listidx_node* head = tommy_listidx_node_of(list, list->head);
+
+		node->prev = head->prev;
+		node->next = list->head;
+		head->prev = index;
+	}
+
+	list->head = index;
+}
+
+/**
+ * Inserts an element at the tail of the list.
+ */
+tommy_inline void tommy_listidx_insert_tail(tommy_listidx* list, tommy_uint32_t index)
+{
+	tommy_listidx_node* node = tommy_listidx_node_of(list, index);
+
+	if (!list->head) {
+		node->prev = index;
+		node->next = 0;
+		list->head = index;
+	} else {
+		tommy_listidx_node* head = tommy_listidx_node_of(list, list->head);
+
+		node->prev = head->prev;
+		node->next = 0;
+		tommy_listidx_node_of(list, head->prev)->next = index;
+		head->prev = index;
+	}
+}
+
+/**
+ * Removes an element from the list.
+ * You must already have the index of the element to remove.
+ * \return The index of the element removed.
+ */
+tommy_inline tommy_uint32_t tommy_listidx_remove_existing(tommy_listidx* list, tommy_uint32_t index)
+{
+	tommy_listidx_node* node = tommy_listidx_node_of(list, index);
+	tommy_listidx_node* head = tommy_listidx_node_of(list, list->head);
+
+	/* remove from the "circular" prev list */
+	if (node->next) {
+		tommy_listidx_node_of(list, node->next)->prev = node->prev;
+	} else {
+		head->prev = node->prev; /* the last */
+	}
+
+	/* remove from the "0 terminated" next list */
+	if (list->head == index) {
+		list->head = node->next; /* the new head, in case 0 */
+	} else {
+		tommy_listidx_node_of(list, node->prev)->next = node->next;
+	}
+
+	return index;
+}
+
+#endif
+
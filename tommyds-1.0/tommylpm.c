@@ -0,0 +1,257 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tommylpm.h"
+
+#include <string.h> /* for memset, memcmp */
+
+/******************************************************************************/
+/* lpm */
+
+/** \internal
+ * Max number of levels, for 128 bits addresses.
+ */
+#define TOMMY_LPM_LEVEL_MAX (1 + (TOMMY_LPM_ADDR_MAX * 8 - TOMMY_LPM_ROOT_BIT) / TOMMY_LPM_LEVEL_BIT)
+
+/** \internal
+ * Number of slots of the root.
+ */
+#define TOMMY_LPM_ROOT_MAX (1 << TOMMY_LPM_ROOT_BIT)
+
+/**
+ * Level storing a prefix length.
+ */
+tommy_inline unsigned tommy_lpm_level(unsigned len)
+{
+	if (len <= TOMMY_LPM_ROOT_BIT)
+		return 0;
+	return 1 + (len - TOMMY_LPM_ROOT_BIT - 1) / TOMMY_LPM_LEVEL_BIT;
+}
+
+/**
+ * First bit of the address indexing a level.
+ */
+tommy_inline unsigned tommy_lpm_base(unsigned level)
+{
+	if (level == 0)
+		return 0;
+	return TOMMY_LPM_ROOT_BIT + (level - 1) * TOMMY_LPM_LEVEL_BIT;
+}
+
+/**
+ * Slot index of an address in a level.
+ */
+tommy_inline unsigned tommy_lpm_index(const unsigned char* addr, unsigned level)
+{
+	if (level == 0)
+		return (addr[0] << 8) | addr[1];
+	return addr[level + 1];
+}
+
+/**
+ * Copies the first len bits of an address, clearing the others.
+ */
+static void tommy_lpm_mask(unsigned char* dst, const unsigned char* src, unsigned len)
+{
+	unsigned full = len / 8;
+
+	memset(dst, 0, TOMMY_LPM_ADDR_MAX);
+	memcpy(dst, src, full);
+	if (len % 8)
+		dst[full] = src[full] & (0xFF << (8 - len % 8));
+}
+
+tommy_inline tommy_hash_t tommy_lpm_hash(tommy_lpm* lpm, const unsigned char* addr, unsigned len)
+{
+	return tommy_hash_u64(len, addr, lpm->bits / 8);
+}
+
+/**
+ * Finds a prefix in the set, with the address already masked.
+ */
+static tommy_lpm_node* tommy_lpm_find(tommy_lpm* lpm, const unsigned char* addr, unsigned len)
+{
+	tommy_node* i = tommy_hashdyn_bucket(&lpm->set, tommy_lpm_hash(lpm, addr, len));
+
+	while (i) {
+		/* the tommy_node is the first field of the prefix node */
+		tommy_lpm_node* prefix = (tommy_lpm_node*)i;
+
+		if (prefix->len == len && memcmp(prefix->addr, addr, lpm->bits / 8) == 0)
+			return prefix;
+		i = i->next;
+	}
+
+	return 0;
+}
+
+void tommy_lpm_init(tommy_lpm* lpm, unsigned bits)
+{
+	lpm->root = tommy_cast(tommy_lpm_slot*, tommy_malloc(TOMMY_LPM_ROOT_MAX * sizeof(tommy_lpm_slot)));
+	memset(lpm->root, 0, TOMMY_LPM_ROOT_MAX * sizeof(tommy_lpm_slot));
+
+	tommy_hashdyn_init(&lpm->set);
+
+	lpm->bits = bits;
+	lpm->table_count = 0;
+}
+
+static void tommy_lpm_free(tommy_lpm_slot* slot, unsigned count)
+{
+	unsigned i;
+
+	for(i=0;i<count;++i) {
+		if (slot[i].child) {
+			tommy_lpm_free(slot[i].child->slot, 1 << TOMMY_LPM_LEVEL_BIT);
+			tommy_free(slot[i].child);
+		}
+	}
+}
+
+void tommy_lpm_done(tommy_lpm* lpm)
+{
+	tommy_lpm_free(lpm->root, TOMMY_LPM_ROOT_MAX);
+	tommy_free(lpm->root);
+
+	tommy_hashdyn_done(&lpm->set);
+}
+
+int tommy_lpm_insert(tommy_lpm* lpm, tommy_lpm_node* node, void* data, const void* addr, unsigned len)
+{
+	tommy_lpm_slot* slot = lpm->root;
+	tommy_lpm_table* table = 0;
+	unsigned level, width, count, first, i;
+
+	if (len > lpm->bits)
+		return -1;
+
+	tommy_lpm_mask(node->addr, tommy_cast(const unsigned char*, addr), len);
+	node->len = len;
+
+	if (tommy_lpm_find(lpm, node->addr, len) != 0)
+		return -1;
+
+	/* walks to the level of the prefix, creating the missing ones */
+	level = tommy_lpm_level(len);
+	for(i=0;i<level;++i) {
+		tommy_lpm_slot* parent = &slot[tommy_lpm_index(node->addr, i)];
+
+		if (!parent->child) {
+			parent->child = tommy_cast(tommy_lpm_table*, tommy_malloc(sizeof(tommy_lpm_table)));
+			memset(parent->child, 0, sizeof(tommy_lpm_table));
+			++lpm->table_count;
+			if (table)
+				++table->ref;
+		}
+
+		table = parent->child;
+		slot = table->slot;
+	}
+
+	if (table)
+		++table->ref;
+
+	/* expands the prefix in all the slots it covers, where there isn't a longer one */
+	width = level == 0 ? TOMMY_LPM_ROOT_BIT : TOMMY_LPM_LEVEL_BIT;
+	count = 1U << (width - (len - tommy_lpm_base(level)));
+	first = tommy_lpm_index(node->addr, level) & ~(count - 1);
+	for(i=first;i<first+count;++i) {
+		if (!slot[i].prefix || slot[i].prefix->len < len)
+			slot[i].prefix = node;
+	}
+
+	tommy_hashdyn_insert(&lpm->set, &node->node, data, tommy_lpm_hash(lpm, node->addr, len));
+
+	return 0;
+}
+
+void* tommy_lpm_remove_existing(tommy_lpm* lpm, tommy_lpm_node* node)
+{
+	tommy_lpm_slot* parent[TOMMY_LPM_LEVEL_MAX];
+	tommy_lpm_table* table[TOMMY_LPM_LEVEL_MAX];
+	tommy_lpm_slot* slot = lpm->root;
+	tommy_lpm_node* cover = 0;
+	unsigned char addr[TOMMY_LPM_ADDR_MAX];
+	unsigned level, width, count, first, low, len, i;
+
+	level = tommy_lpm_level(node->len);
+	table[0] = 0;
+	for(i=0;i<level;++i) {
+		parent[i + 1] = &slot[tommy_lpm_index(node->addr, i)];
+		table[i + 1] = parent[i + 1]->child;
+		slot = table[i + 1]->slot;
+	}
+
+	/* the longest shorter prefix of the same level, the shorter levels are checked by the search */
+	low = level == 0 ? 0 : tommy_lpm_base(level) + 1;
+	for(len=node->len;len>low && !cover;) {
+		--len;
+		tommy_lpm_mask(addr, node->addr, len);
+		cover = tommy_lpm_find(lpm, addr, len);
+	}
+
+	width = level == 0 ? TOMMY_LPM_ROOT_BIT : TOMMY_LPM_LEVEL_BIT;
+	count = 1U << (width - (node->len - tommy_lpm_base(level)));
+	first = tommy_lpm_index(node->addr, level) & ~(count - 1);
+	for(i=first;i<first+count;++i) {
+		if (slot[i].prefix == node)
+			slot[i].prefix = cover;
+	}
+
+	/* frees the levels left without prefixes */
+	for(i=level;i>0;--i) {
+		if (--table[i]->ref != 0)
+			break;
+		tommy_free(table[i]);
+		parent[i]->child = 0;
+		--lpm->table_count;
+	}
+
+	return tommy_hashdyn_remove_existing(&lpm->set, &node->node);
+}
+
+void* tommy_lpm_search_exact(tommy_lpm* lpm, const void* addr, unsigned len)
+{
+	unsigned char key[TOMMY_LPM_ADDR_MAX];
+	tommy_lpm_node* prefix;
+
+	if (len > lpm->bits)
+		return 0;
+
+	tommy_lpm_mask(key, tommy_cast(const unsigned char*, addr), len);
+	prefix = tommy_lpm_find(lpm, key, len);
+
+	return prefix ? prefix->node.data : 0;
+}
+
+tommy_size_t tommy_lpm_memory_usage(tommy_lpm* lpm)
+{
+	return TOMMY_LPM_ROOT_MAX * (tommy_size_t)sizeof(tommy_lpm_slot)
+		+ lpm->table_count * (tommy_size_t)sizeof(tommy_lpm_table)
+		+ tommy_hashdyn_memory_usage(&lpm->set)
+		+ tommy_lpm_count(lpm) * (tommy_size_t)(sizeof(tommy_lpm_node) - sizeof(tommy_hashdyn_node));
+}
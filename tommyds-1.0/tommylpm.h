@@ -0,0 +1,248 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * Longest prefix match trie for IP addresses.
+ *
+ * This trie stores prefixes of IPv4 or IPv6 addresses, and finds the longest
+ * prefix containing an address. It's a multibit trie with a stride of 16 bits
+ * at the root and of 8 bits below, with the prefixes expanded over all the
+ * slots they cover in their level.
+ * An IPv4 search reads at most three slots, one for each level. An IPv6 search
+ * reads one slot more for each byte of the longest prefix stored on its path
+ * after the first 16 bits: a /48 is found in five reads.
+ *
+ * The root of 65536 slots takes 1 MB in 64 bits hosts, the other levels are 4 kB
+ * tables allocated when a prefix needs them, and freed when the last one is removed.
+ * The expansion makes the insertion and the removal of a short prefix slow, up to
+ * 65536 slots for a /0, as they are expected to change rarely compared to the searches.
+ *
+ * To initialize the trie you have to call tommy_lpm_init() with the size of the
+ * addresses in bits, 32 for IPv4 and 128 for IPv6.
+ *
+ * \code
+ * tommy_lpm lpm;
+ *
+ * tommy_lpm_init(&lpm, 32);
+ * \endcode
+ *
+ * To store a prefix in the trie you have to include a ::tommy_lpm_node in your structure,
+ * and call tommy_lpm_insert() with the address in network byte order and the
+ * prefix length. The bits of the address after the prefix are ignored.
+ *
+ * \code
+ * struct customer {
+ *     tommy_lpm_node node;
+ *     // other fields
+ *     const char* name;
+ * };
+ *
+ * struct customer* obj = malloc(sizeof(struct customer)); // creates the object
+ * unsigned char addr[4] = { 192, 168, 0, 0 };
+ *
+ * obj->name = ...; // initializes the object
+ *
+ * if (tommy_lpm_insert(&lpm, &obj->node, obj, addr, 16) != 0) {
+ *   // already present
+ * }
+ * \endcode
+ *
+ * To find the longest prefix of an address you have to call tommy_lpm_search(),
+ * or tommy_lpm_search_u32() for IPv4 addresses in host byte order.
+ *
+ * \code
+ * struct customer* obj = tommy_lpm_search_u32(&lpm, 0xC0A80101); // 192.168.1.1
+ * if (!obj) {
+ *   // no prefix contains the address
+ * } else {
+ *   // found
+ * }
+ * \endcode
+ *
+ * To remove a prefix you have to call tommy_lpm_remove_existing() with its node.
+ * The prefixes are also kept in a ::tommy_hashdyn, to restore the shorter prefix
+ * expanded in the slots of the removed one.
+ */
+
+#ifndef __TOMMYLPM_H
+#define __TOMMYLPM_H
+
+#include "tommyhashdyn.h"
+
+/******************************************************************************/
+/* lpm */
+
+/** \internal
+ * Bits of the root level.
+ */
+#define TOMMY_LPM_ROOT_BIT 16
+
+/** \internal
+ * Bits of the levels below the root.
+ */
+#define TOMMY_LPM_LEVEL_BIT 8
+
+/**
+ * Max size of the addresses in bytes.
+ */
+#define TOMMY_LPM_ADDR_MAX 16
+
+/**
+ * Prefix node.
+ * This is the node that you have to include inside your objects.
+ */
+typedef struct tommy_lpm_node_struct {
+	tommy_node node; /**< Node of the prefix set. Its data field points to the object. */
+	unsigned char addr[TOMMY_LPM_ADDR_MAX]; /**< Address of the prefix, with the bits after the prefix cleared. */
+	unsigned len; /**< Length of the prefix in bits. */
+} tommy_lpm_node;
+
+struct tommy_lpm_table_struct;
+
+/** \internal
+ * Slot of a level.
+ */
+typedef struct tommy_lpm_slot_struct {
+	tommy_lpm_node* prefix; /**< Longest prefix of the level covering the slot. 0 if none. */
+	struct tommy_lpm_table_struct* child; /**< Level below. 0 if none. */
+} tommy_lpm_slot;
+
+/** \internal
+ * Level below the root.
+ */
+typedef struct tommy_lpm_table_struct {
+	tommy_lpm_slot slot[1 << TOMMY_LPM_LEVEL_BIT]; /**< Slots, indexed by one byte of the address. */
+	unsigned ref; /**< Prefixes of the level and levels below linked to it. */
+} tommy_lpm_table;
+
+/**
+ * Longest prefix match trie.
+ */
+typedef struct tommy_lpm_struct {
+	tommy_lpm_slot* root; /**< Root level, indexed by the first two bytes of the address. */
+	tommy_hashdyn set; /**< All the prefixes, by address and length. */
+	unsigned bits; /**< Size of the addresses in bits. */
+	unsigned table_count; /**< Number of levels allocated below the root. */
+} tommy_lpm;
+
+/**
+ * Initializes the trie.
+ * \param bits Size of the addresses in bits, 32 for IPv4 and 128 for IPv6.
+ */
+void tommy_lpm_init(tommy_lpm* lpm, unsigned bits);
+
+/**
+ * Deinitializes the trie.
+ * The objects are not freed, you can remove them before with tommy_lpm_remove_existing().
+ */
+void tommy_lpm_done(tommy_lpm* lpm);
+
+/**
+ * Inserts a prefix in the trie.
+ * \param node Pointer at the node embedded into the object to insert.
+ * \param data Pointer at the object to insert.
+ * \param addr Address of the prefix in network byte order, of bits/8 bytes.
+ * \param len Length of the prefix in bits, from 0 to the size of the addresses.
+ * \return 0 if inserted, -1 if the same prefix is already present, or if the length is invalid.
+ */
+int tommy_lpm_insert(tommy_lpm* lpm, tommy_lpm_node* node, void* data, const void* addr, unsigned len);
+
+/**
+ * Removes a prefix from the trie.
+ * You must already have the node of the prefix to remove.
+ * \return The tommy_node::data field of the node removed.
+ */
+void* tommy_lpm_remove_existing(tommy_lpm* lpm, tommy_lpm_node* node);
+
+/**
+ * Searches the prefix with the exact address and length.
+ * \return The first element found, or 0 if none.
+ */
+void* tommy_lpm_search_exact(tommy_lpm* lpm, const void* addr, unsigned len);
+
+/**
+ * Searches the longest prefix containing an address.
+ * \param addr Address to find in network byte order, of bits/8 bytes.
+ * \return The tommy_node::data field of the longest prefix, or 0 if none.
+ */
+tommy_inline void* tommy_lpm_search(tommy_lpm* lpm, const void* addr)
+{
+	const unsigned char* key = tommy_cast(const unsigned char*, addr);
+	const tommy_lpm_slot* slot = &lpm->root[(key[0] << 8) | key[1]];
+	const tommy_lpm_node* best = slot->prefix;
+	unsigned i = 2;
+
+	/* a deeper level exists only if a longer prefix is stored */
+	while (slot->child) {
+		slot = &slot->child->slot[key[i++]];
+		if (slot->prefix)
+			best = slot->prefix;
+	}
+
+	return best ? best->node.data : 0;
+}
+
+/**
+ * Searches the longest prefix containing an IPv4 address.
+ * The trie must have been initialized with 32 bits.
+ * \param addr Address to find in host byte order.
+ * \return The tommy_node::data field of the longest prefix, or 0 if none.
+ */
+tommy_inline void* tommy_lpm_search_u32(tommy_lpm* lpm, tommy_uint32_t addr)
+{
+	const tommy_lpm_slot* slot = &lpm->root[addr >> 16];
+	const tommy_lpm_node* best = slot->prefix;
+
+	if (slot->child) {
+		slot = &slot->child->slot[(addr >> 8) & 0xFF];
+		if (slot->prefix)
+			best = slot->prefix;
+		if (slot->child) {
+			slot = &slot->child->slot[addr & 0xFF];
+			if (slot->prefix)
+				best = slot->prefix;
+		}
+	}
+
+	return best ? best->node.data : 0;
+}
+
+/**
+ * Gets the number of prefixes.
+ */
+tommy_inline unsigned tommy_lpm_count(tommy_lpm* lpm)
+{
+	return tommy_hashdyn_count(&lpm->set);
+}
+
+/**
+ * Gets the size of allocated memory.
+ * It includes the size of the ::tommy_lpm_node of the stored elements.
+ */
+tommy_size_t tommy_lpm_memory_usage(tommy_lpm* lpm);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tommyslab.h"
+
+/******************************************************************************/
+/* slab */
+
+void tommy_slab_init(tommy_slab* slab, unsigned size)
+{
+	/* the free list is stored in the objects */
+	if (size < sizeof(tommy_uint32_t))
+		size = sizeof(tommy_uint32_t);
+
+	/* fixed initial size */
+	slab->size = size;
+	slab->bucket_bit = TOMMY_SLAB_BIT;
+	slab->bucket_max = 1 << slab->bucket_bit;
+	slab->bucket[0] = tommy_cast(char*, tommy_malloc(slab->bucket_max * (tommy_size_t)slab->size));
+	slab->bucket_mac = 1;
+
+	/* the index 0 is the null one */
+	slab->free = 0;
+	slab->top = 1;
+	slab->count = 0;
+}
+
+void tommy_slab_done(tommy_slab* slab)
+{
+	unsigned i;
+	for(i=0;i<slab->bucket_mac;++i)
+		tommy_free(slab->bucket[i]);
+}
+
+tommy_uint32_t tommy_slab_alloc(tommy_slab* slab)
+{
+	tommy_uint32_t index;
+
+	if (slab->free) {
+		index = slab->free;
+		slab->free = *(tommy_uint32_t*)tommy_slab_ref(slab, index);
+	} else {
+		if (slab->top == slab->bucket_max) {
+			/* the new segment has the same size of all the previous ones */
+			slab->bucket[slab->bucket_mac] = tommy_cast(char*, tommy_malloc(slab->bucket_max * (tommy_size_t)slab->size));
+			++slab->bucket_mac;
+			++slab->bucket_bit;
+			slab->bucket_max = 1 << slab->bucket_bit;
+		}
+
+		index = slab->top++;
+	}
+
+	++slab->count;
+
+	return index;
+}
+
+void tommy_slab_free(tommy_slab* slab, tommy_uint32_t index)
+{
+	*(tommy_uint32_t*)tommy_slab_ref(slab, index) = slab->free;
+	slab->free = index;
+
+	--slab->count;
+}
+
+tommy_size_t tommy_slab_memory_usage(tommy_slab* slab)
+{
+	return slab->bucket_max * (tommy_size_t)slab->size;
+}
+
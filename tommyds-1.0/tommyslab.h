@@ -0,0 +1,151 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * Slab of fixed size objects addressed by 32 bits indexes.
+ *
+ * The objects are allocated in segments that double in size, like ::tommy_array,
+ * so the address of an object never changes.
+ * An object is identified by an index, that takes 4 bytes instead of the
+ * 8 bytes of a pointer in 64 bits hosts. The index 0 is never used, and it
+ * can be used as null.
+ *
+ * It's used by ::tommy_hashidx and ::tommy_listidx to link the objects
+ * with indexes instead of pointers.
+ *
+ * \code
+ * tommy_slab slab;
+ *
+ * tommy_slab_init(&slab, sizeof(struct object));
+ *
+ * tommy_uint32_t index = tommy_slab_alloc(&slab);
+ * struct object* obj = tommy_slab_ref(&slab, index);
+ *
+ * tommy_slab_free(&slab, index);
+ *
+ * tommy_slab_done(&slab);
+ * \endcode
+ */
+
+#ifndef __TOMMYSLAB_H
+#define __TOMMYSLAB_H
+
+#include "tommytypes.h"
+
+#include <assert.h> /* for assert */
+
+/******************************************************************************/
+/* slab */
+
+/**
+ * Initial and minimal size of the slab expressed as a power of 2.
+ * The initial size is 2^TOMMY_SLAB_BIT.
+ */
+#define TOMMY_SLAB_BIT 6
+
+/** \internal
+ * Max number of objects as a power of 2.
+ */
+#define TOMMY_SLAB_BIT_MAX 32
+
+/**
+ * Slab.
+ */
+typedef struct tommy_slab_struct {
+	char* bucket[TOMMY_SLAB_BIT_MAX]; /**< Dynamic array of segments. */
+	unsigned bucket_bit; /**< Bits used in the bit mask. */
+	unsigned bucket_max; /**< Number of objects in the allocated segments. */
+	unsigned bucket_mac; /**< Number of segments allocated. */
+	unsigned size; /**< Size of the objects. */
+	tommy_uint32_t free; /**< First free object, linked by their first 4 bytes. 0 for none. */
+	tommy_uint32_t top; /**< First object never allocated. */
+	unsigned count; /**< Number of allocated objects. */
+} tommy_slab;
+
+/**
+ * Initializes the slab.
+ * \param size Size of the objects. No less than 4 bytes.
+ */
+void tommy_slab_init(tommy_slab* slab, unsigned size);
+
+/**
+ * Deinitializes the slab.
+ * It frees the memory of all the objects.
+ */
+void tommy_slab_done(tommy_slab* slab);
+
+/**
+ * Gets the address of an object.
+ * The address doesn't change until the object is freed.
+ */
+tommy_inline void* tommy_slab_ref(tommy_slab* slab, tommy_uint32_t index)
+{
+	unsigned bsr;
+
+	assert(index != 0 && index < slab->top);
+
+	/* special case for the first segment */
+	if (index < (1 << TOMMY_SLAB_BIT)) {
+		return slab->bucket[0] + index * (tommy_size_t)slab->size;
+	}
+
+	/* get the highest bit set */
+	bsr = tommy_ilog2_u32(index);
+
+	/* clear the highest bit */
+	index -= 1 << bsr;
+
+	return slab->bucket[bsr - TOMMY_SLAB_BIT + 1] + index * (tommy_size_t)slab->size;
+}
+
+/**
+ * Allocates an object.
+ * \return The index of the object. Never 0.
+ */
+tommy_uint32_t tommy_slab_alloc(tommy_slab* slab);
+
+/**
+ * Frees an object.
+ * Its index can be returned by a next tommy_slab_alloc().
+ */
+void tommy_slab_free(tommy_slab* slab, tommy_uint32_t index);
+
+/**
+ * Gets the number of allocated objects.
+ */
+tommy_inline unsigned tommy_slab_count(tommy_slab* slab)
+{
+	return slab->count;
+}
+
+/**
+ * Gets the size of allocated memory.
+ */
+tommy_size_t tommy_slab_memory_usage(tommy_slab* slab);
+
+#endif
+
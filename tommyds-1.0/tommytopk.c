@@ -0,0 +1,124 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "tommytopk.h"
+
+/******************************************************************************/
+/* topk */
+
+void tommy_topk_init(tommy_topk* topk, unsigned max)
+{
+	topk->heap = tommy_cast(tommy_topk_entry*, tommy_malloc((max ? max : 1) * sizeof(tommy_topk_entry)));
+	topk->count = 0;
+	topk->max = max;
+}
+
+void tommy_topk_done(tommy_topk* topk)
+{
+	tommy_free(topk->heap);
+}
+
+/**
+ * Moves down an entry from the position pos, in a heap of count entries.
+ */
+static void tommy_topk_down(tommy_topk_entry* heap, unsigned count, unsigned pos, tommy_topk_entry entry)
+{
+	while (1) {
+		unsigned child = 2 * pos + 1;
+
+		if (child >= count)
+			break;
+
+		/* the lowest child */
+		if (child + 1 < count && heap[child + 1].score < heap[child].score)
+			++child;
+
+		if (entry.score <= heap[child].score)
+			break;
+
+		heap[pos] = heap[child];
+		pos = child;
+	}
+
+	heap[pos] = entry;
+}
+
+void tommy_topk_push(tommy_topk* topk, void* data, tommy_uint64_t score)
+{
+	tommy_topk_entry entry;
+
+	entry.score = score;
+	entry.data = data;
+
+	if (topk->count < topk->max) {
+		/* not full, moves up from the last position */
+		unsigned pos = topk->count++;
+
+		while (pos > 0) {
+			unsigned parent = (pos - 1) / 2;
+
+			if (topk->heap[parent].score <= score)
+				break;
+
+			topk->heap[pos] = topk->heap[parent];
+			pos = parent;
+		}
+
+		topk->heap[pos] = entry;
+	} else if (topk->max != 0) {
+		/* replaces the minimum */
+		tommy_topk_down(topk->heap, topk->count, 0, entry);
+	}
+}
+
+void tommy_topk_merge(tommy_topk* topk, tommy_topk* other)
+{
+	unsigned i;
+
+	for(i=0;i<other->count;++i)
+		tommy_topk_insert(topk, other->heap[i].data, other->heap[i].score);
+}
+
+unsigned tommy_topk_sort(tommy_topk* topk)
+{
+	unsigned count = topk->count;
+
+	/* heap sort, the minimum goes at the end */
+	while (count > 1) {
+		tommy_topk_entry last = topk->heap[--count];
+
+		topk->heap[count] = topk->heap[0];
+		tommy_topk_down(topk->heap, count, 0, last);
+	}
+
+	return topk->count;
+}
+
+tommy_size_t tommy_topk_memory_usage(tommy_topk* topk)
+{
+	return topk->max * (tommy_size_t)sizeof(tommy_topk_entry);
+}
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2010 Andrea Mazzoleni. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ANDREA MAZZOLENI AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL ANDREA MAZZOLENI OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/** \file
+ * Top-K selection.
+ *
+ * This container keeps the K elements with the greatest score among all the
+ * ones inserted, in a binary min-heap of K entries. Selecting the top K of N
+ * elements takes O(N*log(K)), and as most elements are lower than the minimum
+ * kept when N is much greater than K, they are discarded with a single compare,
+ * without sorting or copying all of them.
+ *
+ * The elements are not linked, so the same element of any other container,
+ * like a ::tommy_list or a ::tommy_hashdyn, can be inserted directly with its score.
+ *
+ * \code
+ * tommy_topk topk;
+ *
+ * tommy_topk_init(&topk, 100);
+ *
+ * for(i=tommy_list_head(&list);i!=0;i=i->next) {
+ *     struct object* obj = i->data;
+ *     tommy_topk_insert(&topk, obj, obj->pkts);
+ * }
+ * \endcode
+ *
+ * To combine the top K computed separately, for example one for each thread, you
+ * have to call tommy_topk_merge(). The result is the top K of all the elements.
+ *
+ * To get the elements in descending score order you have to call tommy_topk_sort(),
+ * and then tommy_topk_get().
+ *
+ * \code
+ * unsigned count = tommy_topk_sort(&topk);
+ *
+ * for(i=0;i<count;++i) {
+ *     struct object* obj = tommy_topk_get(&topk, i);
+ *     printf("%u: %llu\n", i, obj->pkts);
+ * }
+ * \endcode
+ *
+ * After sorting, you must call tommy_topk_reset() before inserting again.
+ */
+
+#ifndef __TOMMYTOPK_H
+#define __TOMMYTOPK_H
+
+#include "tommytypes.h"
+
+/******************************************************************************/
+/* topk */
+
+/**
+ * Top-K entry.
+ */
+typedef struct tommy_topk_entry_struct {
+	tommy_uint64_t score; /**< Score of the element. */
+	void* data; /**< Pointer at the element. */
+} tommy_topk_entry;
+
+/**
+ * Top-K selection.
+ */
+typedef struct tommy_topk_struct {
+	tommy_topk_entry* heap; /**< Min-heap of the elements on the score. Sorted descending after tommy_topk_sort(). */
+	unsigned count; /**< Number of elements kept. */
+	unsigned max; /**< Number of elements to keep, the K. */
+} tommy_topk;
+
+/**
+ * Initializes the top-K.
+ * \param max Number of elements to keep.
+ */
+void tommy_topk_init(tommy_topk* topk, unsigned max);
+
+/**
+ * Deinitializes the top-K.
+ */
+void tommy_topk_done(tommy_topk* topk);
+
+/**
+ * Removes all the elements.
+ */
+tommy_inline void tommy_topk_reset(tommy_topk* topk)
+{
+	topk->count = 0;
+}
+
+/** \internal
+ * Inserts an element with a score greater than the minimum kept.
+ */
+void tommy_topk_push(tommy_topk* topk, void* data, tommy_uint64_t score);
+
+/**
+ * Inserts an element.
+ * The element is kept if it's in the top K inserted so far, otherwise it's discarded.
+ * With equal scores, the elements inserted first are kept.
+ * \param data Pointer at the element.
+ * \param score Score of the element.
+ */
+tommy_inline void tommy_topk_insert(tommy_topk* topk, void* data, tommy_uint64_t score)
+{
+	/* most of the elements are discarded here */
+	if (topk->count == topk->max && score <= topk->heap[0].score)
+		return;
+
+	tommy_topk_push(topk, data, score);
+}
+
+/**
+ * Inserts all the elements of another top-K.
+ * The result is the top K of all the elements inserted in both.
+ * The other top-K is not changed, and it can also be already sorted.
+ */
+void tommy_topk_merge(tommy_topk* topk, tommy_topk* other);
+
+/**
+ * Sorts the elements in descending score order.
+ * After sorting, no other element can be inserted until tommy_topk_reset().
+ * \return The number of elements.
+ */
+unsigned tommy_topk_sort(tommy_topk* topk);
+
+/**
+ * Gets an element.
+ * After tommy_topk_sort() the element at position 0 is the one with the greatest score.
+ * \param pos Position of the element, from 0 to tommy_topk_count() - 1.
+ */
+tommy_inline void* tommy_topk_get(tommy_topk* topk, unsigned pos)
+{
+	return topk->heap[pos].data;
+}
+
+/**
+ * Gets the score of an element.
+ * \param pos Position of the element, from 0 to tommy_topk_count() - 1.
+ */
+tommy_inline tommy_uint64_t tommy_topk_score(tommy_topk* topk, unsigned pos)
+{
+	return topk->heap[pos].score;
+}
+
+/**
+ * Gets the number of elements kept.
+ */
+tommy_inline unsigned tommy_topk_count(tommy_topk* topk)
+{
+	return topk->count;
+}
+
+/**
+ * Gets the size of allocated memory.
+ */
+tommy_size_t tommy_topk_memory_usage(tommy_topk* topk);
+
+#endif
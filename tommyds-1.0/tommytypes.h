@@ -139,6 +139,17 @@ typedef int tommy_bool_t; /**< Generic boolean type. */
 #endif
 #endif
 
+/** \internal
+ * Hints the processor to load the cache line of an address.
+ */
+#if !defined(tommy_prefetch)
+#if defined(__GNUC__)
+#define tommy_prefetch(ptr) __builtin_prefetch(ptr)
+#else
+#define tommy_prefetch(ptr) ((void)(ptr))
+#endif
+#endif
+
 /******************************************************************************/
 /* key */
 